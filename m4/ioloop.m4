@@ -1,6 +1,33 @@
 dnl * I/O loop function
 AC_DEFUN([DOVECOT_IOLOOP], [
   have_ioloop=no
+
+  AS_IF([test "$ioloop" = "uring"], [
+    AC_CACHE_CHECK([whether we can use io_uring],i_cv_uring_works,[
+      AC_RUN_IFELSE([AC_LANG_PROGRAM([[
+        #include <string.h>
+        #include <unistd.h>
+        #include <sys/syscall.h>
+        #include <linux/io_uring.h>
+      ]], [[
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        if (syscall(__NR_io_uring_setup, 8, &params) < 0)
+          return 1;
+        return (params.features & IORING_FEAT_EXT_ARG) == 0;
+      ]])],[
+        i_cv_uring_works=yes
+      ], [
+        i_cv_uring_works=no
+      ],[])
+    ])
+    AS_IF([test $i_cv_uring_works = yes], [
+      AC_DEFINE(IOLOOP_URING,, [Implement I/O loop with Linux io_uring])
+      have_ioloop=yes
+    ], [
+      AC_MSG_ERROR([uring ioloop requested but io_uring_setup() is not available or the kernel is older than v5.11])
+    ])
+  ])
   
   AS_IF([test "$ioloop" = "best" || test "$ioloop" = "epoll"], [
     AC_CACHE_CHECK([whether we can use epoll],i_cv_epoll_works,[
@@ -20,8 +20,13 @@ struct process {
 struct userip {
 	/* points to user_hash keys */
 	const char *username;
+	/* points to connect_limit.strings */
 	const char *protocol;
 	struct ip_addr ip;
+	/* userip_hash_calc() of the above fields. Cached, because with a lot
+	   of sessions the hash table resizing and the chain walks would
+	   otherwise keep rehashing the same strings. */
+	unsigned int hash;
 };
 
 struct session_alt_username {
@@ -99,21 +104,35 @@ struct connect_limit_iter {
 static void
 connect_limit_process_free(struct connect_limit *limit, struct process *process);
 
-static unsigned int userip_hash(const struct userip *userip)
+static unsigned int userip_hash_calc(const struct userip *userip)
 {
 	return str_hash(userip->username) ^ str_hash(userip->protocol) ^
 		net_ip_hash(&userip->ip);
 }
 
+static unsigned int userip_hash(const struct userip *userip)
+{
+	return userip->hash;
+}
+
 static int userip_cmp(const struct userip *userip1,
 		      const struct userip *userip2)
 {
-	int ret = strcmp(userip1->username, userip2->username);
-	if (ret != 0)
-		return ret;
+	int ret;
+
+	if (userip1->hash != userip2->hash)
+		return userip1->hash < userip2->hash ? -1 : 1;
+	/* The strings are usually interned, so check the pointers first. */
+	if (userip1->username != userip2->username) {
+		ret = strcmp(userip1->username, userip2->username);
+		if (ret != 0)
+			return ret;
+	}
 	ret = net_ip_cmp(&userip1->ip, &userip2->ip);
 	if (ret != 0)
 		return ret;
+	if (userip1->protocol == userip2->protocol)
+		return 0;
 	return strcmp(userip1->protocol, userip2->protocol);
 }
 
@@ -188,6 +207,7 @@ unsigned int connect_limit_lookup(struct connect_limit *limit,
 	};
 	void *value;
 
+	userip_lookup.hash = userip_hash_calc(&userip_lookup);
 	value = hash_table_lookup(limit->userip_hash, &userip_lookup);
 	return POINTER_CAST_TO(value, unsigned int);
 }
@@ -424,6 +444,7 @@ void connect_limit_connect(struct connect_limit *limit, pid_t pid,
 		.protocol = t_strcut(key->service, '-'),
 		.ip = key->ip,
 	};
+	userip_lookup.hash = userip_hash_calc(&userip_lookup);
 
 	if (!SESSION_TRACK_USERIP(session) ||
 	    !hash_table_lookup_full(limit->userip_hash, &userip_lookup,
@@ -433,6 +454,7 @@ void connect_limit_connect(struct connect_limit *limit, pid_t pid,
 		userip->protocol = str_table_ref(limit->strings,
 						 userip_lookup.protocol);
 		userip->ip = key->ip;
+		userip->hash = userip_lookup.hash;
 		value = POINTER_CAST(1);
 		if (SESSION_TRACK_USERIP(session))
 			hash_table_insert(limit->userip_hash, userip, value);
@@ -218,10 +218,98 @@ static void test_connect_limit(void)
 	test_end();
 }
 
+static void test_connect_limit_many_key(struct connect_limit_key *key,
+					unsigned int user_idx,
+					unsigned int ip_idx,
+					unsigned int service_idx)
+{
+	key->username = t_strdup_printf("user%u", user_idx);
+	key->service = service_idx == 0 ? "imap" : "imap-hibernate";
+	i_zero(&key->ip);
+	key->ip.family = AF_INET;
+	key->ip.u.ip4.s_addr = htonl(0x0a000000 + ip_idx);
+}
+
+static void test_connect_limit_many_guid(guid_128_t guid_r, unsigned int n)
+{
+	guid_128_empty(guid_r);
+	cpu32_to_be_unaligned(n + 1, guid_r);
+}
+
+static void test_connect_limit_many(void)
+{
+#define TEST_MANY_USERS 100
+#define TEST_MANY_IPS 10
+#define TEST_MANY_PROCESSES 7
+	struct connect_limit *limit;
+	struct connect_limit_key key;
+	struct ip_addr dest_ip;
+	guid_128_t guid;
+	unsigned int user, ip, service, n;
+
+	test_begin("connect limit many sessions");
+	limit = connect_limit_init();
+	i_zero(&dest_ip);
+
+	/* Each userip gets an imap and an imap-hibernate session. They're
+	   counted towards the same limit. */
+	n = 0;
+	for (user = 0; user < TEST_MANY_USERS; user++) {
+		for (ip = 0; ip < TEST_MANY_IPS; ip++) {
+			for (service = 0; service < 2; service++) T_BEGIN {
+				test_connect_limit_many_key(&key, user, ip,
+							    service);
+				test_connect_limit_many_guid(guid, n);
+				connect_limit_connect(limit,
+					1000 + n % TEST_MANY_PROCESSES,
+					&key, guid, KICK_TYPE_NONE,
+					&dest_ip, NULL);
+				n++;
+			} T_END;
+		}
+	}
+	for (user = 0; user < TEST_MANY_USERS; user++) T_BEGIN {
+		test_connect_limit_many_key(&key, user, 0, 0);
+		test_assert_idx(connect_limit_lookup(limit, &key) == 2, user);
+		test_connect_limit_many_key(&key, user, TEST_MANY_IPS, 0);
+		test_assert_idx(connect_limit_lookup(limit, &key) == 0, user);
+	} T_END;
+
+	/* disconnect the imap-hibernate sessions */
+	n = 0;
+	for (user = 0; user < TEST_MANY_USERS; user++) {
+		for (ip = 0; ip < TEST_MANY_IPS; ip++) {
+			n++;
+			T_BEGIN {
+				test_connect_limit_many_key(&key, user, ip, 1);
+				test_connect_limit_many_guid(guid, n);
+				connect_limit_disconnect(limit,
+					1000 + n % TEST_MANY_PROCESSES,
+					&key, guid);
+			} T_END;
+			n++;
+		}
+	}
+	for (user = 0; user < TEST_MANY_USERS; user++) T_BEGIN {
+		test_connect_limit_many_key(&key, user, TEST_MANY_IPS - 1, 1);
+		test_assert_idx(connect_limit_lookup(limit, &key) == 1, user);
+	} T_END;
+
+	for (n = 0; n < TEST_MANY_PROCESSES; n++)
+		connect_limit_disconnect_pid(limit, 1000 + n);
+	test_session_dump(limit, "", "");
+	test_connect_limit_many_key(&key, 0, 0, 0);
+	test_assert(connect_limit_lookup(limit, &key) == 0);
+
+	connect_limit_deinit(&limit);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_connect_limit,
+		test_connect_limit_many,
 		NULL
 	};
 	return test_run(test_functions);
@@ -17,6 +17,10 @@ struct auth_cache {
 	struct auth_cache_node *head, *tail;
 	struct event *event;
 
+	/* cache_key template => parsed var_expand program */
+	pool_t key_programs_pool;
+	HASH_TABLE(char *, struct var_expand_program *) key_programs;
+
 	size_t max_size, size_left;
 	unsigned int ttl_secs, neg_ttl_secs;
 
@@ -189,6 +193,23 @@ auth_cache_node_destroy(struct auth_cache *cache, struct auth_cache_node *node)
 	i_free(node);
 }
 
+static void auth_cache_evict(struct auth_cache *cache)
+{
+	struct auth_cache_node *node;
+
+	/* CLOCK-style eviction: lookups only mark the node referenced instead
+	   of moving it to head. Referenced nodes get moved to head here
+	   instead of being dropped. Each node is moved at most once, so this
+	   always ends up destroying a node. */
+	while ((node = cache->tail) != NULL && node->referenced) {
+		node->referenced = FALSE;
+		auth_cache_node_unlink(cache, node);
+		auth_cache_node_link_head(cache, node);
+	}
+	if (node != NULL)
+		auth_cache_node_destroy(cache, node);
+}
+
 static void sig_auth_cache_clear(const siginfo_t *si ATTR_UNUSED, void *context)
 {
 	struct auth_cache *cache = context;
@@ -234,6 +255,10 @@ struct auth_cache *auth_cache_new(size_t max_size, unsigned int ttl_secs,
 
 	cache = i_new(struct auth_cache, 1);
 	hash_table_create(&cache->hash, default_pool, 0, str_hash, strcmp);
+	cache->key_programs_pool =
+		pool_alloconly_create("auth cache key programs", 1024);
+	hash_table_create(&cache->key_programs, cache->key_programs_pool, 0,
+			  str_hash, strcmp);
 	cache->max_size = max_size;
 	cache->size_left = max_size;
 	cache->ttl_secs = ttl_secs;
@@ -257,6 +282,8 @@ void auth_cache_free(struct auth_cache **_cache)
 
 	auth_cache_clear(cache);
 	hash_table_destroy(&cache->hash);
+	hash_table_destroy(&cache->key_programs);
+	pool_unref(&cache->key_programs_pool);
 	event_unref(&cache->event);
 	i_free(cache);
 }
@@ -338,8 +365,27 @@ auth_cache_escape(const char *string,
 	return str_tabescape(string);
 }
 
+static const struct var_expand_program *
+auth_cache_get_key_program(struct auth_cache *cache, const char *key)
+{
+	struct var_expand_program *program;
+	char *key_dup;
+
+	/* There are only a few different keys: one per passdb/userdb, with
+	   and without master user. Parse each of them only once. */
+	program = hash_table_lookup(cache->key_programs, key);
+	if (program == NULL) {
+		key_dup = p_strdup(cache->key_programs_pool, key);
+		program = var_expand_program_create(cache->key_programs_pool,
+						    key);
+		hash_table_insert(cache->key_programs, key_dup, program);
+	}
+	return program;
+}
+
 static const char *
-auth_request_expand_cache_key(const struct auth_request *request,
+auth_request_expand_cache_key(struct auth_cache *cache,
+			      const struct auth_request *request,
 			      const char *key, const char *username)
 {
 	static bool error_logged = FALSE;
@@ -363,8 +409,9 @@ auth_request_expand_cache_key(const struct auth_request *request,
 	const struct var_expand_table *table =
 		auth_request_get_var_expand_table_full(request,
 			username, auth_cache_escape, &count);
-	if (auth_request_var_expand_with_table(value, key, request, table,
-					       auth_cache_escape, &error) < 0 &&
+	if (auth_request_var_expand_program_with_table(value,
+			auth_cache_get_key_program(cache, key), request,
+			table, auth_cache_escape, &error) < 0 &&
 	    !error_logged) {
 		error_logged = TRUE;
 		e_error(authdb_event(request),
@@ -386,7 +433,7 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 	*expired_r = FALSE;
 	*neg_expired_r = FALSE;
 
-	key = auth_request_expand_cache_key(request, key, request->fields.translated_username);
+	key = auth_request_expand_cache_key(cache, request, key, request->fields.translated_username);
 	node = hash_table_lookup(cache->hash, key);
 	if (node == NULL) {
 		cache->miss_count++;
@@ -402,11 +449,8 @@ auth_cache_lookup(struct auth_cache *cache, const struct auth_request *request,
 		cache->miss_count++;
 		*expired_r = TRUE;
 	} else {
-		/* move to head */
-		if (node != cache->head) {
-			auth_cache_node_unlink(cache, node);
-			auth_cache_node_link_head(cache, node);
-		}
+		/* keep it from being evicted next */
+		node->referenced = TRUE;
 		cache->hit_count++;
 	}
 	if (node->created < now - (time_t)cache->neg_ttl_secs)
@@ -430,7 +474,7 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 		return;
 	}
 
-	key = auth_request_expand_cache_key(request, key, request->fields.translated_username);
+	key = auth_request_expand_cache_key(cache, request, key, request->fields.translated_username);
 	key_len = strlen(key);
 
 	data_size = key_len + 1 + value_len + 1;
@@ -438,7 +482,7 @@ void auth_cache_insert(struct auth_cache *cache, struct auth_request *request,
 
 	/* make sure we have enough space */
 	while (cache->size_left < alloc_size && cache->tail != NULL)
-		auth_cache_node_destroy(cache, cache->tail);
+		auth_cache_evict(cache);
 
 	node = hash_table_lookup(cache->hash, key);
 	if (node != NULL) {
@@ -474,7 +518,7 @@ void auth_cache_remove(struct auth_cache *cache,
 {
 	struct auth_cache_node *node;
 
-	key = auth_request_expand_cache_key(request, key, request->fields.user);
+	key = auth_request_expand_cache_key(cache, request, key, request->fields.user);
 	node = hash_table_lookup(cache->hash, key);
 	if (node == NULL)
 		return;
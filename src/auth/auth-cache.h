@@ -6,9 +6,12 @@ struct auth_cache_node {
 
 	time_t created;
 	/* Total number of bytes used by this node */
-	uint32_t alloc_size:31;
+	uint32_t alloc_size:30;
 	/* TRUE if the user gave the correct password the last time. */
 	bool last_success:1;
+	/* TRUE if the node was looked up since it was last (re)linked to
+	   head. Such nodes are given a second chance on eviction. */
+	bool referenced:1;
 
 	char data[]; /* key \0 value \0 */
 };
@@ -35,10 +35,22 @@ struct master_userdb_request {
 };
 
 struct master_list_iter_ctx {
+	int refcount;
 	struct auth_master_connection *conn;
 	struct userdb_iterate_context *iter;
 	struct auth_request *auth_request;
-	bool failed;
+
+	/* If non-zero, do a userdb lookup for each listed user with up to
+	   this many lookups in parallel. */
+	unsigned int lookup_batch;
+	unsigned int lookups_pending;
+	/* LIST parameters, used also for the userdb lookups */
+	const char **lookup_args;
+
+	bool failed:1;
+	bool iter_running:1;
+	bool iter_finished:1;
+	bool finished:1;
 };
 
 static void master_input(struct auth_master_connection *conn);
@@ -454,10 +466,23 @@ master_input_pass(struct auth_master_connection *conn, const char *args)
 	return TRUE;
 }
 
+static void master_input_list_unref(struct master_list_iter_ctx **_ctx)
+{
+	struct master_list_iter_ctx *ctx = *_ctx;
+
+	*_ctx = NULL;
+	i_assert(ctx->refcount > 0);
+	if (--ctx->refcount > 0)
+		return;
+	i_free(ctx->lookup_args);
+	i_free(ctx);
+}
+
 static void master_input_list_finish(struct master_list_iter_ctx *ctx)
 {
 	i_assert(ctx->conn->iter_ctx == ctx);
 
+	ctx->finished = TRUE;
 	ctx->conn->iter_ctx = NULL;
 	ctx->conn->io = io_add(ctx->conn->fd, IO_READ, master_input, ctx->conn);
 
@@ -467,7 +492,34 @@ static void master_input_list_finish(struct master_list_iter_ctx *ctx)
 	o_stream_unset_flush_callback(ctx->conn->output);
 	auth_request_unref(&ctx->auth_request);
 	auth_master_connection_unref(&ctx->conn);
-	i_free(ctx);
+	master_input_list_unref(&ctx);
+}
+
+static void master_input_list_done(struct master_list_iter_ctx *ctx)
+{
+	const char *str;
+
+	str = t_strdup_printf("DONE\t%u\t%s\n", ctx->auth_request->id,
+			      ctx->failed ? "fail" : "");
+	o_stream_nsend_str(ctx->conn->output, str);
+	master_input_list_finish(ctx);
+}
+
+static void master_input_list_next(struct master_list_iter_ctx *ctx)
+{
+	if (ctx->iter == NULL || ctx->iter_running)
+		return;
+	if (o_stream_get_buffer_used_size(ctx->conn->output) >= MAX_OUTBUF_SIZE) {
+		/* continue in master_output_list() */
+		o_stream_uncork(ctx->conn->output);
+		return;
+	}
+	if (ctx->lookup_batch > 0 && ctx->lookups_pending >= ctx->lookup_batch) {
+		/* continue when a lookup finishes */
+		return;
+	}
+	ctx->iter_running = TRUE;
+	userdb_blocking_iter_next(ctx->iter);
 }
 
 static int master_output_list(struct master_list_iter_ctx *ctx)
@@ -480,17 +532,131 @@ static int master_output_list(struct master_list_iter_ctx *ctx)
 	}
 	if (ret > 0) {
 		o_stream_cork(ctx->conn->output);
-		userdb_blocking_iter_next(ctx->iter);
+		master_input_list_next(ctx);
 	}
 	return 1;
 }
 
+static void
+master_input_list_import_args(struct auth_request *auth_request,
+			      const char *const *args, bool list)
+{
+	const char *name, *arg;
+
+	for (; *args != NULL; args++) {
+		arg = strchr(*args, '=');
+		if (arg == NULL) {
+			name = *args;
+			arg = "";
+		} else {
+			name = t_strdup_until(*args, arg);
+			arg++;
+		}
+
+		if (!auth_request_import_info(auth_request, name, arg) &&
+		    list && strcmp(name, "user") == 0) {
+			/* username mask */
+			auth_request_set_username_forced(auth_request, arg);
+		}
+	}
+
+	/* rest of the code doesn't like NULL service */
+	if (auth_request->fields.service == NULL) {
+		if (!auth_request_import(auth_request, "service", ""))
+			i_unreached();
+		i_assert(auth_request->fields.service != NULL);
+	}
+}
+
+static void
+master_input_list_send_user(struct master_list_iter_ctx *ctx, const char *user)
+{
+	const char *str;
+
+	str = t_strdup_printf("LIST\t%u\t%s\n", ctx->auth_request->id,
+			      str_tabescape(user));
+	o_stream_nsend_str(ctx->conn->output, str);
+}
+
+static void
+master_input_list_lookup_callback(enum userdb_result result,
+				  struct auth_request *auth_request)
+{
+	struct master_list_iter_ctx *ctx = auth_request->context;
+	struct auth_master_connection *conn = auth_request->master;
+	string_t *str;
+
+	i_assert(ctx->lookups_pending > 0);
+	ctx->lookups_pending--;
+
+	if (auth_request->userdb_lookup_tempfailed)
+		result = USERDB_RESULT_INTERNAL_FAILURE;
+
+	if (ctx->finished)
+		;
+	else if (result == USERDB_RESULT_OK) {
+		str = t_str_new(128);
+		str_printfa(str, "USER\t%u\t", auth_request->id);
+		str_append_tabescaped(str, auth_request->fields.user);
+		str_append_c(str, '\t');
+		auth_fields_append(auth_request->fields.userdb_reply, str,
+				   AUTH_FIELD_FLAG_HIDDEN, 0);
+		str_append_c(str, '\n');
+		o_stream_nsend(conn->output, str_data(str), str_len(str));
+	} else {
+		/* Let the client do the lookup itself. It'll also see
+		   whether the user has disappeared or the lookup fails. */
+		master_input_list_send_user(ctx,
+			auth_request->fields.original_username);
+	}
+
+	if (ctx->finished)
+		;
+	else if (ctx->iter_finished && ctx->lookups_pending == 0)
+		master_input_list_done(ctx);
+	else
+		master_input_list_next(ctx);
+
+	auth_request_unref(&auth_request);
+	auth_master_connection_unref(&conn);
+	master_input_list_unref(&ctx);
+}
+
+static void
+master_input_list_lookup(struct master_list_iter_ctx *ctx, const char *user)
+{
+	struct auth_master_connection *conn = ctx->conn;
+	struct auth_request *auth_request;
+	const char *error;
+
+	auth_request = auth_request_new_dummy(auth_event);
+	auth_request->id = ctx->auth_request->id;
+	auth_request->master = ctx->conn;
+	auth_request->context = ctx;
+	auth_master_connection_ref(ctx->conn);
+	master_input_list_import_args(auth_request, ctx->lookup_args, FALSE);
+	auth_request_init(auth_request);
+
+	if (!auth_request_set_username(auth_request, user, &error)) {
+		auth_request_log_info(auth_request, "userdb", "%s", error);
+		master_input_list_send_user(ctx, user);
+		auth_request_unref(&auth_request);
+		auth_master_connection_unref(&conn);
+		return;
+	}
+	ctx->refcount++;
+	ctx->lookups_pending++;
+	auth_request_set_state(auth_request, AUTH_REQUEST_STATE_USERDB);
+	auth_request_lookup_user(auth_request,
+				 master_input_list_lookup_callback);
+}
+
 static void master_input_list_callback(const char *user, void *context)
 {
 	struct master_list_iter_ctx *ctx = context;
 	struct auth_userdb *userdb = ctx->auth_request->userdb;
-	int ret;
 
+	ctx->iter_running = FALSE;
 	if (user == NULL) {
 		if (userdb_blocking_iter_deinit(&ctx->iter) < 0)
 			ctx->failed = TRUE;
@@ -501,41 +667,38 @@ static void master_input_list_callback(const char *user, void *context)
 			 userdb->userdb->iface->iterate_init == NULL);
 		if (userdb == NULL) {
 			/* iteration is finished */
-			const char *str;
-
-			str = t_strdup_printf("DONE\t%u\t%s\n",
-					      ctx->auth_request->id,
-					      ctx->failed ? "fail" : "");
-			o_stream_nsend_str(ctx->conn->output, str);
-			master_input_list_finish(ctx);
+			ctx->iter_finished = TRUE;
+			if (ctx->lookups_pending == 0)
+				master_input_list_done(ctx);
 			return;
 		}
 
 		/* continue iterating next userdb */
 		ctx->auth_request->userdb = userdb;
+		ctx->iter_running = TRUE;
 		ctx->iter = userdb_blocking_iter_init(ctx->auth_request,
 					master_input_list_callback, ctx);
 		return;
 	}
 
-	T_BEGIN {
-		const char *str;
+	if (ctx->lookup_batch > 0) {
+		T_BEGIN {
+			master_input_list_lookup(ctx, user);
+		} T_END;
+		master_input_list_next(ctx);
+		return;
+	}
 
-		str = t_strdup_printf("LIST\t%u\t%s\n", ctx->auth_request->id,
-				      str_tabescape(user));
-		ret = o_stream_send_str(ctx->conn->output, str);
+	T_BEGIN {
+		master_input_list_send_user(ctx, user);
 	} T_END;
-	if (o_stream_get_buffer_used_size(ctx->conn->output) >= MAX_OUTBUF_SIZE)
-		ret = o_stream_flush(ctx->conn->output);
-	if (ret < 0) {
+	if (o_stream_get_buffer_used_size(ctx->conn->output) >= MAX_OUTBUF_SIZE &&
+	    o_stream_flush(ctx->conn->output) < 0) {
 		/* disconnected, don't bother finishing */
 		master_input_list_finish(ctx);
 		return;
 	}
-	if (o_stream_get_buffer_used_size(ctx->conn->output) < MAX_OUTBUF_SIZE)
-		userdb_blocking_iter_next(ctx->iter);
-	else
-		o_stream_uncork(ctx->conn->output);
+	master_input_list_next(ctx);
 }
 
 static bool
@@ -544,7 +707,7 @@ master_input_list(struct auth_master_connection *conn, const char *args)
 	struct auth_userdb *userdb = conn->auth->userdbs;
 	struct auth_request *auth_request;
 	struct master_list_iter_ctx *ctx;
-	const char *str, *name, *arg, *const *list;
+	const char *str, *arg, *const *list, *const *params;
 	unsigned int id;
 
 	/* <id> [<parameters>] */
@@ -553,7 +716,7 @@ master_input_list(struct auth_master_connection *conn, const char *args)
 		e_error(conn->event, "BUG: Master sent broken LIST");
 		return FALSE;
 	}
-	list++;
+	params = ++list;
 
 	if (conn->iter_ctx != NULL) {
 		e_error(conn->event,
@@ -586,44 +749,35 @@ master_input_list(struct auth_master_connection *conn, const char *args)
 	auth_request->id = id;
 	auth_request->master = conn;
 	auth_master_connection_ref(conn);
+	master_input_list_import_args(auth_request, params, TRUE);
 
-	for (; *list != NULL; list++) {
-		arg = strchr(*list, '=');
-		if (arg == NULL) {
-			name = *list;
-			arg = "";
-		} else {
-			name = t_strdup_until(*list, arg);
-			arg++;
-		}
-
-		if (!auth_request_import_info(auth_request, name, arg) &&
-		    strcmp(name, "user") == 0) {
-			/* username mask */
-			auth_request_set_username_forced(auth_request, arg);
-		}
-	}
-
-	/* rest of the code doesn't like NULL user or service */
+	/* rest of the code doesn't like NULL user */
 	if (auth_request->fields.user == NULL)
 		auth_request_set_username_forced(auth_request, "");
-	if (auth_request->fields.service == NULL) {
-		if (!auth_request_import(auth_request, "service", ""))
-			i_unreached();
-		i_assert(auth_request->fields.service != NULL);
-	}
 
 	ctx = i_new(struct master_list_iter_ctx, 1);
+	ctx->refcount = 1;
 	ctx->conn = conn;
 	ctx->auth_request = auth_request;
 	ctx->auth_request->userdb = userdb;
+	for (list = params; *list != NULL; list++) {
+		if (str_begins(*list, "userdb_lookup=", &arg) &&
+		    str_to_uint(arg, &ctx->lookup_batch) < 0) {
+			e_error(conn->event, "BUG: Master sent LIST with "
+				"invalid userdb_lookup=%s", arg);
+		}
+	}
+	if (ctx->lookup_batch > 0) {
+		ctx->lookup_args = p_strarray_dup(default_pool, params);
+	}
 
 	io_remove(&conn->io);
 	o_stream_cork(conn->output);
 	o_stream_set_flush_callback(conn->output, master_output_list, ctx);
+	conn->iter_ctx = ctx;
+	ctx->iter_running = TRUE;
 	ctx->iter = userdb_blocking_iter_init(auth_request,
 					      master_input_list_callback, ctx);
-	conn->iter_ctx = ctx;
 	return TRUE;
 }
 
@@ -4,6 +4,8 @@
 #include "ioloop.h"
 #include "net.h"
 #include "crc32.h"
+#include "hash.h"
+#include "llist.h"
 #include "master-service.h"
 #include "anvil-client.h"
 #include "auth-request.h"
@@ -15,15 +17,41 @@
    tracking with tons of different IPs. */
 #define PENALTY_IPV6_MASK_BITS 48
 
+/* Maximum number of cached PENALTY-GET replies */
+#define PENALTY_CACHE_MAX_ENTRIES 10000
+
 struct auth_penalty_request {
+	struct auth_penalty *penalty;
 	struct auth_request *auth_request;
 	struct anvil_client *client;
 	auth_penalty_callback_t *callback;
+
+	char *ident;
+	unsigned int update_counter;
+};
+
+/* This process is the only one updating the auth penalties in anvil, so a
+   PENALTY-GET reply stays valid until we send PENALTY-INC for the same
+   ident. */
+struct auth_penalty_cache_entry {
+	struct auth_penalty_cache_entry *prev, *next;
+
+	char *ident;
+	time_t expires;
+	unsigned int penalty;
+	time_t last_penalty;
 };
 
 struct auth_penalty {
 	struct anvil_client *client;
 
+	HASH_TABLE(char *, struct auth_penalty_cache_entry *) cache;
+	/* sorted by expires */
+	struct auth_penalty_cache_entry *cache_head, *cache_tail;
+	/* Incremented by each PENALTY-INC. PENALTY-GET replies aren't cached
+	   if an update was sent while the lookup was in progress. */
+	unsigned int update_counter;
+
 	bool disabled:1;
 };
 
@@ -32,6 +60,7 @@ struct auth_penalty *auth_penalty_init(const char *path)
 	struct auth_penalty *penalty;
 
 	penalty = i_new(struct auth_penalty, 1);
+	hash_table_create(&penalty->cache, default_pool, 0, str_hash, strcmp);
 	penalty->client = anvil_client_init(path, NULL,
 					    ANVIL_CLIENT_FLAG_HIDE_ENOENT);
 	if (anvil_client_connect(penalty->client, TRUE) < 0)
@@ -43,12 +72,55 @@ struct auth_penalty *auth_penalty_init(const char *path)
 	return penalty;
 }
 
+static void
+auth_penalty_cache_remove(struct auth_penalty *penalty,
+			  struct auth_penalty_cache_entry *entry)
+{
+	hash_table_remove(penalty->cache, entry->ident);
+	DLLIST2_REMOVE(&penalty->cache_head, &penalty->cache_tail, entry);
+	i_free(entry->ident);
+	i_free(entry);
+}
+
+static void auth_penalty_cache_expire(struct auth_penalty *penalty)
+{
+	while (penalty->cache_head != NULL &&
+	       penalty->cache_head->expires <= ioloop_time)
+		auth_penalty_cache_remove(penalty, penalty->cache_head);
+}
+
+static void
+auth_penalty_cache_add(struct auth_penalty *penalty, const char *ident,
+		       unsigned int value, time_t last_penalty)
+{
+	struct auth_penalty_cache_entry *entry;
+
+	auth_penalty_cache_expire(penalty);
+	entry = hash_table_lookup(penalty->cache, ident);
+	if (entry != NULL)
+		auth_penalty_cache_remove(penalty, entry);
+	else if (hash_table_count(penalty->cache) >= PENALTY_CACHE_MAX_ENTRIES)
+		auth_penalty_cache_remove(penalty, penalty->cache_head);
+
+	entry = i_new(struct auth_penalty_cache_entry, 1);
+	entry->ident = i_strdup(ident);
+	/* anvil forgets the penalty after this */
+	entry->expires = ioloop_time + AUTH_PENALTY_TIMEOUT;
+	entry->penalty = value;
+	entry->last_penalty = last_penalty;
+	hash_table_insert(penalty->cache, entry->ident, entry);
+	DLLIST2_APPEND(&penalty->cache_head, &penalty->cache_tail, entry);
+}
+
 void auth_penalty_deinit(struct auth_penalty **_penalty)
 {
 	struct auth_penalty *penalty = *_penalty;
 
 	*_penalty = NULL;
 	anvil_client_deinit(&penalty->client);
+	while (penalty->cache_head != NULL)
+		auth_penalty_cache_remove(penalty, penalty->cache_head);
+	hash_table_destroy(&penalty->cache);
 	i_free(penalty);
 }
 
@@ -61,13 +133,34 @@ unsigned int auth_penalty_to_secs(unsigned int penalty)
 	return secs < AUTH_PENALTY_MAX_SECS ? secs : AUTH_PENALTY_MAX_SECS;
 }
 
+static unsigned int
+auth_penalty_get_current(unsigned int penalty, unsigned long last_penalty)
+{
+	unsigned int secs, drop_penalty;
+
+	if ((time_t)last_penalty > ioloop_time) {
+		/* time moved backwards? */
+		last_penalty = ioloop_time;
+	}
+
+	/* update penalty. */
+	drop_penalty = AUTH_PENALTY_MAX_PENALTY;
+	while (penalty > 0) {
+		secs = auth_penalty_to_secs(drop_penalty);
+		if (ioloop_time - last_penalty < secs)
+			break;
+		drop_penalty--;
+		penalty--;
+	}
+	return penalty;
+}
+
 static void
 auth_penalty_anvil_callback(const char *reply,
 			    struct auth_penalty_request *request)
 {
 	unsigned int penalty = 0;
 	unsigned long last_penalty = 0;
-	unsigned int secs, drop_penalty;
 
 	if (reply == NULL) {
 		/* internal failure. */
@@ -80,24 +173,16 @@ auth_penalty_anvil_callback(const char *reply,
 		e_error(request->auth_request->event,
 			"Invalid PENALTY-GET reply: %s", reply);
 	} else {
-		if ((time_t)last_penalty > ioloop_time) {
-			/* time moved backwards? */
-			last_penalty = ioloop_time;
-		}
-
-		/* update penalty. */
-		drop_penalty = AUTH_PENALTY_MAX_PENALTY;
-		while (penalty > 0) {
-			secs = auth_penalty_to_secs(drop_penalty);
-			if (ioloop_time - last_penalty < secs)
-				break;
-			drop_penalty--;
-			penalty--;
+		if (request->update_counter == request->penalty->update_counter) {
+			auth_penalty_cache_add(request->penalty, request->ident,
+					       penalty, last_penalty);
 		}
+		penalty = auth_penalty_get_current(penalty, last_penalty);
 	}
 
 	request->callback(penalty, request->auth_request);
 	auth_request_unref(&request->auth_request);
+	i_free(request->ident);
 	i_free(request);
 }
 
@@ -120,6 +205,7 @@ void auth_penalty_lookup(struct auth_penalty *penalty,
 			 auth_penalty_callback_t *callback)
 {
 	struct auth_penalty_request *request;
+	struct auth_penalty_cache_entry *entry;
 	const char *ident;
 
 	ident = auth_penalty_get_ident(auth_request);
@@ -129,10 +215,22 @@ void auth_penalty_lookup(struct auth_penalty *penalty,
 		return;
 	}
 
+	auth_penalty_cache_expire(penalty);
+	entry = hash_table_lookup(penalty->cache, ident);
+	if (entry != NULL) {
+		callback(auth_penalty_get_current(entry->penalty,
+						  entry->last_penalty),
+			 auth_request);
+		return;
+	}
+
 	request = i_new(struct auth_penalty_request, 1);
+	request->penalty = penalty;
 	request->auth_request = auth_request;
 	request->client = penalty->client;
 	request->callback = callback;
+	request->ident = i_strdup(ident);
+	request->update_counter = penalty->update_counter;
 	auth_request_ref(auth_request);
 
 	T_BEGIN {
@@ -154,6 +252,7 @@ get_userpass_checksum(struct auth_request *auth_request)
 void auth_penalty_update(struct auth_penalty *penalty,
 			 struct auth_request *auth_request, unsigned int value)
 {
+	struct auth_penalty_cache_entry *entry;
 	const char *ident;
 
 	ident = auth_penalty_get_ident(auth_request);
@@ -161,6 +260,13 @@ void auth_penalty_update(struct auth_penalty *penalty,
 	    auth_request->fields.no_penalty)
 		return;
 
+	/* the cached value is no longer valid, and neither are the replies
+	   to lookups sent before this update */
+	penalty->update_counter++;
+	entry = hash_table_lookup(penalty->cache, ident);
+	if (entry != NULL)
+		auth_penalty_cache_remove(penalty, entry);
+
 	if (value > AUTH_PENALTY_MAX_PENALTY) {
 		/* even if the actual value doesn't change, the last_change
 		   timestamp does. */
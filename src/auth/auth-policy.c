@@ -6,6 +6,10 @@
 #include "str.h"
 #include "istream.h"
 #include "ioloop.h"
+#include "llist.h"
+#include "hash.h"
+#include "strescape.h"
+#include "time-util.h"
 #include "base64.h"
 #include "hex-binary.h"
 #include "hash-method.h"
@@ -37,6 +41,27 @@ static char *auth_policy_json_template;
 
 static struct http_client *http_client;
 
+/* Responses to "allow" checks are cached for auth_policy_cache_ttl_msecs.
+   While a check is still pending, identical checks wait for its response
+   instead of sending their own. */
+struct auth_policy_cache_entry {
+	struct auth_policy_cache_entry *prev, *next;
+
+	char *key;
+	struct timeval expires;
+	/* The lookup that sent the request, or NULL once finished */
+	struct policy_lookup_ctx *owner;
+	ARRAY(struct policy_lookup_ctx *) waiters;
+
+	int result;
+	char *message;
+};
+
+static HASH_TABLE(char *, struct auth_policy_cache_entry *) auth_policy_cache;
+/* Finished entries, sorted by expiration time */
+static struct auth_policy_cache_entry *auth_policy_cache_head;
+static struct auth_policy_cache_entry *auth_policy_cache_tail;
+
 struct policy_lookup_ctx {
 	pool_t pool;
 	string_t *json;
@@ -55,6 +80,10 @@ struct policy_lookup_ctx {
 	struct io *io;
 	struct event *event;
 
+	/* Key for auth_policy_cache, or NULL if not cacheable */
+	const char *cache_key;
+	struct auth_policy_cache_entry *cache_entry;
+
 	enum {
 		POLICY_RESULT = 0,
 		POLICY_RESULT_VALUE_STATUS,
@@ -62,6 +91,8 @@ struct policy_lookup_ctx {
 	} parse_state;
 
 	bool parse_error;
+	/* The response was received and parsed */
+	bool parsed;
 };
 
 struct policy_template_keyvalue {
@@ -228,16 +259,50 @@ void auth_policy_init(void)
 	str_truncate(template, str_len(template)-1);
 	auth_policy_json_template = i_strdup(str_c(template));
 
+	if (global_auth_settings->policy_cache_ttl_msecs > 0) {
+		hash_table_create(&auth_policy_cache, default_pool, 0,
+				  str_hash, strcmp);
+	}
+
 	if (global_auth_settings->policy_log_only)
 		e_warning(auth_event,
 			  "auth-policy: Currently in log-only mode. Ignoring "
 			  "tarpit and disconnect instructions from policy server");
 }
 
+static void
+auth_policy_cache_entry_free(struct auth_policy_cache_entry *entry)
+{
+	hash_table_remove(auth_policy_cache, entry->key);
+	if (entry->owner == NULL) {
+		DLLIST2_REMOVE(&auth_policy_cache_head,
+			       &auth_policy_cache_tail, entry);
+	}
+	array_free(&entry->waiters);
+	i_free(entry->message);
+	i_free(entry->key);
+	i_free(entry);
+}
+
+static void auth_policy_cache_expire(void)
+{
+	while (auth_policy_cache_head != NULL &&
+	       timeval_cmp(&auth_policy_cache_head->expires,
+			   &ioloop_timeval) <= 0)
+		auth_policy_cache_entry_free(auth_policy_cache_head);
+}
+
 void auth_policy_deinit(void)
 {
 	if (http_client != NULL)
 		http_client_deinit(&http_client);
+	if (hash_table_is_created(auth_policy_cache)) {
+		/* pending entries were freed with their HTTP requests */
+		while (auth_policy_cache_head != NULL)
+			auth_policy_cache_entry_free(auth_policy_cache_head);
+		i_assert(hash_table_count(auth_policy_cache) == 0);
+		hash_table_destroy(&auth_policy_cache);
+	}
 	i_free(auth_policy_json_template);
 }
 
@@ -270,9 +335,15 @@ void auth_policy_log_result(struct policy_lookup_ctx *context)
 			action);
 }
 
+static void auth_policy_cache_finish(struct policy_lookup_ctx *context);
+
 static
 void auth_policy_finish(struct policy_lookup_ctx *context)
 {
+	if (context->cache_entry != NULL) {
+		/* aborted before the response was received */
+		auth_policy_cache_finish(context);
+	}
 	if (context->parser != NULL) {
 		const char *error ATTR_UNUSED;
 		(void)json_parser_deinit(&context->parser, &error);
@@ -287,12 +358,88 @@ void auth_policy_finish(struct policy_lookup_ctx *context)
 static
 void auth_policy_callback(struct policy_lookup_ctx *context)
 {
+	if (context->cache_entry != NULL)
+		auth_policy_cache_finish(context);
 	if (context->callback != NULL)
 		context->callback(context->result, context->callback_context);
 	if (context->event != NULL)
 		auth_policy_log_result(context);
 }
 
+static void auth_policy_apply_result(struct policy_lookup_ctx *context)
+{
+	context->request->policy_refusal = FALSE;
+
+	if (context->result < 0) {
+		if (context->message != NULL) {
+			/* set message here */
+			e_debug(context->event,
+				"Policy response %d with message: %s",
+				context->result, context->message);
+			auth_request_set_field(context->request, "reason", context->message, NULL);
+		}
+		context->request->policy_refusal = TRUE;
+	} else {
+		e_debug(context->event,
+			"Policy response %d", context->result);
+	}
+
+	if (context->request->policy_refusal) {
+		e_info(context->event, "Authentication failure due to policy server refusal%s%s",
+		       (context->message!=NULL?": ":""),
+		       (context->message!=NULL?context->message:""));
+	}
+
+	auth_policy_callback(context);
+}
+
+static void
+auth_policy_cache_finish_waiter(struct policy_lookup_ctx *waiter,
+				const struct policy_lookup_ctx *owner)
+{
+	waiter->result = owner->result;
+	waiter->message = p_strdup(waiter->pool, owner->message);
+	if (owner->parsed)
+		auth_policy_apply_result(waiter);
+	else
+		auth_policy_callback(waiter);
+	auth_policy_finish(waiter);
+}
+
+static void auth_policy_cache_finish(struct policy_lookup_ctx *context)
+{
+	struct auth_policy_cache_entry *entry = context->cache_entry;
+	struct policy_lookup_ctx *waiter;
+	ARRAY(struct policy_lookup_ctx *) waiters;
+
+	i_assert(entry->owner == context);
+	context->cache_entry = NULL;
+
+	/* Remove the entry first, so the waiters' callbacks can't find it
+	   while it's being finished. Failed lookups aren't cached. */
+	entry->owner = NULL;
+	t_array_init(&waiters, array_count(&entry->waiters));
+	array_append_array(&waiters, &entry->waiters);
+	array_clear(&entry->waiters);
+	if (!context->parsed || context->parse_error) {
+		hash_table_remove(auth_policy_cache, entry->key);
+		array_free(&entry->waiters);
+		i_free(entry->key);
+		i_free(entry);
+	} else {
+		entry->result = context->result;
+		entry->message = i_strdup(context->message);
+		entry->expires = ioloop_timeval;
+		timeval_add_msecs(&entry->expires,
+				  context->set->policy_cache_ttl_msecs);
+		DLLIST2_APPEND(&auth_policy_cache_head,
+			       &auth_policy_cache_tail, entry);
+	}
+
+	array_foreach_elem(&waiters, waiter)
+		auth_policy_cache_finish_waiter(waiter, context);
+}
+
 static
 void auth_policy_parse_response(struct policy_lookup_ctx *context)
 {
@@ -354,30 +501,9 @@ void auth_policy_parse_response(struct policy_lookup_ctx *context)
 	if (context->parse_error) {
 		context->result = (context->set->policy_reject_on_fail ? -1 : 0);
 	}
+	context->parsed = TRUE;
 
-	context->request->policy_refusal = FALSE;
-
-	if (context->result < 0) {
-		if (context->message != NULL) {
-			/* set message here */
-			e_debug(context->event,
-				"Policy response %d with message: %s",
-				context->result, context->message);
-			auth_request_set_field(context->request, "reason", context->message, NULL);
-		}
-		context->request->policy_refusal = TRUE;
-	} else {
-		e_debug(context->event,
-			"Policy response %d", context->result);
-	}
-
-	if (context->request->policy_refusal) {
-		e_info(context->event, "Authentication failure due to policy server refusal%s%s",
-		       (context->message!=NULL?": ":""),
-		       (context->message!=NULL?context->message:""));
-	}
-
-	auth_policy_callback(context);
+	auth_policy_apply_result(context);
 	i_stream_unref(&context->payload);
 }
 
@@ -554,6 +680,21 @@ void auth_policy_create_json(struct policy_lookup_ctx *context,
 		buffer_truncate_rshift_bits(buffer, context->set->policy_hash_truncate);
 	}
 	const char *hashed_password = binary_to_hex(buffer->data, buffer->used);
+	if (context->expect_result &&
+	    context->set->policy_cache_ttl_msecs > 0) {
+		/* The other attributes (e.g. session ID) are expected not to
+		   affect the policy server's decision. */
+		const char *key_fields[] = {
+			str_tabescape(context->request->fields.service),
+			net_ip2addr(&context->request->fields.remote_ip),
+			str_tabescape(requested_username),
+			hashed_password,
+			auth_policy_fail_type(context->request),
+			NULL
+		};
+		context->cache_key = p_strdup(context->pool,
+			t_strarray_join(key_fields, "\t"));
+	}
 	str_append_c(context->json, '{');
 	var_table = policy_get_var_expand_table(context->request, hashed_password, requested_username);
 	const char *error;
@@ -603,6 +744,38 @@ static const char *auth_policy_get_prefix(struct auth_request *request)
 	return str_c(str);
 }
 
+static bool auth_policy_cache_lookup(struct policy_lookup_ctx *ctx)
+{
+	struct auth_policy_cache_entry *entry;
+
+	auth_policy_cache_expire();
+	entry = hash_table_lookup(auth_policy_cache, ctx->cache_key);
+	if (entry == NULL) {
+		entry = i_new(struct auth_policy_cache_entry, 1);
+		entry->key = i_strdup(ctx->cache_key);
+		entry->owner = ctx;
+		i_array_init(&entry->waiters, 4);
+		hash_table_insert(auth_policy_cache, entry->key, entry);
+		ctx->cache_entry = entry;
+		return FALSE;
+	}
+
+	auth_request_ref(ctx->request);
+	if (entry->owner != NULL) {
+		e_debug(ctx->event,
+			"Waiting for an identical pending policy request");
+		array_push_back(&entry->waiters, &ctx);
+		return TRUE;
+	}
+
+	e_debug(ctx->event, "Using cached policy response");
+	ctx->result = entry->result;
+	ctx->message = p_strdup(ctx->pool, entry->message);
+	auth_policy_apply_result(ctx);
+	auth_policy_finish(ctx);
+	return TRUE;
+}
+
 void auth_policy_check(struct auth_request *request, const char *password,
 	auth_policy_callback_t cb, void *context)
 {
@@ -627,6 +800,8 @@ void auth_policy_check(struct auth_request *request, const char *password,
 	T_BEGIN {
 		auth_policy_create_json(ctx, password, FALSE);
 	} T_END;
+	if (ctx->cache_key != NULL && auth_policy_cache_lookup(ctx))
+		return;
 	auth_policy_send_request(ctx);
 }
 
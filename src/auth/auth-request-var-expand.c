@@ -297,6 +297,46 @@ int auth_request_var_expand_with_table(string_t *dest, const char *str,
 				     auth_request_var_funcs_table, &ctx, error_r);
 }
 
+int auth_request_var_expand_program(string_t *dest,
+				    const struct var_expand_program *program,
+				    const struct auth_request *auth_request,
+				    auth_request_escape_func_t *escape_func,
+				    const char **error_r)
+{
+	return auth_request_var_expand_program_with_table(dest, program,
+		auth_request,
+		auth_request_get_var_expand_table(auth_request, escape_func),
+		escape_func, error_r);
+}
+
+int auth_request_var_expand_program_with_table(string_t *dest,
+	const struct var_expand_program *program,
+	const struct auth_request *auth_request,
+	const struct var_expand_table *table,
+	auth_request_escape_func_t *escape_func, const char **error_r)
+{
+	struct auth_request_var_expand_ctx ctx;
+
+	i_zero(&ctx);
+	ctx.auth_request = auth_request;
+	ctx.escape_func = escape_func == NULL ? escape_none : escape_func;
+	return var_expand_program_execute(dest, program, table,
+					  auth_request_var_funcs_table, &ctx,
+					  error_r);
+}
+
+int t_auth_request_var_expand_program(const struct var_expand_program *program,
+				      const struct auth_request *auth_request,
+				      auth_request_escape_func_t *escape_func,
+				      const char **value_r, const char **error_r)
+{
+	string_t *dest = t_str_new(128);
+	int ret = auth_request_var_expand_program(dest, program, auth_request,
+						  escape_func, error_r);
+	*value_r = str_c(dest);
+	return ret;
+}
+
 int t_auth_request_var_expand(const char *str,
 			      const struct auth_request *auth_request ATTR_UNUSED,
 			      auth_request_escape_func_t *escape_func ATTR_UNUSED,
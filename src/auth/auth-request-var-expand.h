@@ -37,6 +37,22 @@ int t_auth_request_var_expand(const char *str,
 			      const struct auth_request *auth_request,
 			      auth_request_escape_func_t *escape_func,
 			      const char **value_r, const char **error_r);
+/* Same as above, but for a template parsed with
+   var_expand_program_create(). */
+int auth_request_var_expand_program(string_t *dest,
+				    const struct var_expand_program *program,
+				    const struct auth_request *auth_request,
+				    auth_request_escape_func_t *escape_func,
+				    const char **error_r);
+int auth_request_var_expand_program_with_table(string_t *dest,
+	const struct var_expand_program *program,
+	const struct auth_request *auth_request,
+	const struct var_expand_table *table,
+	auth_request_escape_func_t *escape_func, const char **error_r);
+int t_auth_request_var_expand_program(const struct var_expand_program *program,
+				      const struct auth_request *auth_request,
+				      auth_request_escape_func_t *escape_func,
+				      const char **value_r, const char **error_r);
 
 const char *auth_request_str_escape(const char *string,
 				    const struct auth_request *request);
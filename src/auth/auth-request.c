@@ -1039,7 +1039,7 @@ void auth_request_default_verify_plain_continue(struct auth_request *request,
 {
 	struct auth_passdb *passdb;
 	enum passdb_result result;
-	const char *cache_key, *error;
+	const char *cache_key;
 	const char *password = request->mech_password;
 
 	i_assert(request->state == AUTH_REQUEST_STATE_MECH_CONTINUE);
@@ -1079,6 +1079,13 @@ void auth_request_default_verify_plain_continue(struct auth_request *request,
 				      &result, FALSE)) {
 		return;
 	}
+	auth_request_verify_plain_passdb(request);
+}
+
+void auth_request_verify_plain_passdb(struct auth_request *request)
+{
+	struct auth_passdb *passdb = request->passdb;
+	const char *error;
 
 	auth_request_set_state(request, AUTH_REQUEST_STATE_PASSDB);
 	/* In case this request had already done a credentials lookup (is it
@@ -1100,7 +1107,8 @@ void auth_request_default_verify_plain_continue(struct auth_request *request,
 		auth_request_verify_plain_callback(
 			PASSDB_RESULT_INTERNAL_FAILURE, request);
 	} else {
-		passdb->passdb->iface.verify_plain(request, password,
+		passdb->passdb->iface.verify_plain(request,
+					   request->mech_password,
 					   auth_request_verify_plain_callback);
 	}
 }
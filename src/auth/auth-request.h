@@ -210,6 +210,10 @@ struct auth_request {
 	/* userdb_* fields have been set by the passdb lookup, userdb prefetch
 	   will work. */
 	bool userdb_prefetch_set:1;
+	/* The cached password is being verified by auth-worker. A password
+	   mismatch means that the cache is stale and the passdb needs to be
+	   looked up. */
+	bool passdb_cache_verify_fallback:1;
 	bool stats_sent:1;
 	bool policy_refusal:1;
 	bool policy_processed:1;
@@ -261,6 +265,8 @@ void auth_request_continue(struct auth_request *request,
 void auth_request_verify_plain(struct auth_request *request,
 			       const char *password,
 			       verify_plain_callback_t *callback);
+/* Verify the password using the current passdb, skipping the cache. */
+void auth_request_verify_plain_passdb(struct auth_request *request);
 void auth_request_lookup_credentials(struct auth_request *request,
 				     const char *scheme,
 				     lookup_credentials_callback_t *callback);
@@ -288,6 +288,7 @@ static const struct setting_define auth_setting_defines[] = {
 	DEF(STR, policy_server_url),
 	DEF(STR, policy_server_api_header),
 	DEF(UINT, policy_server_timeout_msecs),
+	DEF(UINT, policy_cache_ttl_msecs),
 	DEF(STR, policy_hash_mech),
 	DEF(STR, policy_hash_nonce),
 	DEF(STR, policy_request_attributes),
@@ -345,6 +346,7 @@ static const struct auth_settings auth_default_settings = {
 	.policy_server_url = "",
 	.policy_server_api_header = "",
 	.policy_server_timeout_msecs = 2000,
+	.policy_cache_ttl_msecs = 0,
 	.policy_hash_mech = "sha256",
 	.policy_hash_nonce = "",
 	.policy_request_attributes = "login=%{requested_username} pwhash=%{hashed_password} remote=%{rip} device_id=%{client_id} protocol=%s session_id=%{session} fail_type=%{fail_type}",
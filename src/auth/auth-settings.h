@@ -59,6 +59,7 @@ struct auth_settings {
 	const char *policy_server_url;
 	const char *policy_server_api_header;
 	unsigned int policy_server_timeout_msecs;
+	unsigned int policy_cache_ttl_msecs;
 	const char *policy_hash_mech;
 	const char *policy_hash_nonce;
 	const char *policy_request_attributes;
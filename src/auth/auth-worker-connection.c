@@ -508,6 +508,12 @@ void auth_worker_call(pool_t pool, const char *username, const char *data,
 	} else {
 		/* reached the limit, queue the request */
 		aqueue_append(worker_request_queue, &request);
+		e_debug(event_create_passthrough(auth_event)->
+			set_name("auth_worker_request_queued")->
+			add_int("queue_depth",
+				aqueue_count(worker_request_queue))->event(),
+			"auth-worker: Request queued, %u requests in queue",
+			aqueue_count(worker_request_queue));
 	}
 }
 
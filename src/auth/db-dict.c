@@ -349,41 +349,51 @@ db_dict_iter_key_cmp(const struct db_dict_iter_key *k1,
 static int db_dict_iter_lookup_key_values(struct db_dict_value_iter *iter)
 {
 	struct db_dict_iter_key *key;
-	string_t *path;
-	const char *error;
-	int ret;
+	ARRAY_TYPE(const_string) paths;
+	const char *path, *const *values, *error;
+	unsigned int i;
 
 	/* sort the keys so that we'll first lookup the keys without
 	   default value. if their lookup fails, the user doesn't exist. */
 	array_sort(&iter->keys, db_dict_iter_key_cmp);
 
-	path = t_str_new(128);
-	str_append(path, DICT_PATH_SHARED);
+	t_array_init(&paths, array_count(&iter->keys) + 1);
+	array_foreach_modifiable(&iter->keys, key) {
+		if (!key->used)
+			continue;
+		path = t_strconcat(DICT_PATH_SHARED, key->key->key, NULL);
+		array_push_back(&paths, &path);
+	}
+	if (array_count(&paths) == 0)
+		return 1;
+	array_append_zero(&paths);
 
 	struct dict_op_settings set = {
 		.username = iter->auth_request->fields.user,
 	};
+	/* look up all the keys with a single request to the dict */
+	if (dict_lookup_multi(iter->conn->dict, &set, iter->pool,
+			      array_front(&paths), &values, &error) < 0) {
+		e_error(authdb_event(iter->auth_request),
+			"Failed to lookup keys: %s", error);
+		return -1;
+	}
 
+	i = 0;
 	array_foreach_modifiable(&iter->keys, key) {
 		if (!key->used)
 			continue;
 
-		str_truncate(path, strlen(DICT_PATH_SHARED));
-		str_append(path, key->key->key);
-		ret = dict_lookup(iter->conn->dict, &set, iter->pool,
-				  str_c(path), &key->value, &error);
-		if (ret > 0) {
+		path = array_idx_elem(&paths, i);
+		key->value = values[i++];
+		if (key->value != NULL) {
 			e_debug(authdb_event(iter->auth_request),
-				"Lookup: %s = %s", str_c(path),
+				"Lookup: %s = %s", path,
 				str_sanitize(key->value, UINT_MAX));
-		} else if (ret < 0) {
-			e_error(authdb_event(iter->auth_request),
-				"Failed to lookup key %s: %s", str_c(path), error);
-			return -1;
 		} else if (key->key->default_value != NULL) {
 			e_debug(authdb_event(iter->auth_request),
 				"Lookup: %s not found, using default value %s",
-				str_c(path), str_sanitize(key->key->default_value, UINT_MAX));
+				path, str_sanitize(key->key->default_value, UINT_MAX));
 			key->value = key->key->default_value;
 		} else {
 			return 0;
@@ -126,6 +126,7 @@ static struct setting_def setting_defs[] = {
 	DEF_STR(default_pass_scheme),
 	DEF_BOOL(userdb_warning_disable),
 	DEF_BOOL(blocking),
+	DEF_INT(connections),
 
 	{ 0, NULL, 0 }
 };
@@ -162,13 +163,15 @@ static struct ldap_settings default_ldap_settings = {
 	.iterate_filter = "(objectClass=posixAccount)",
 	.default_pass_scheme = "crypt",
 	.userdb_warning_disable = FALSE,
-	.blocking = FALSE
+	.blocking = FALSE,
+	.connections = 1
 };
 
 static struct ldap_connection *ldap_connections = NULL;
 
 static int db_ldap_bind(struct ldap_connection *conn);
 static void db_ldap_conn_close(struct ldap_connection *conn);
+static void db_ldap_init_ld(struct ldap_connection *conn);
 struct db_ldap_result_iterate_context *
 db_ldap_result_iterate_init_full(struct ldap_connection *conn,
 				 struct ldap_request_search *ldap_request,
@@ -462,11 +465,101 @@ db_ldap_check_hanging(struct ldap_connection *conn)
 	}
 }
 
+static struct ldap_connection *
+db_ldap_pool_conn_create(struct ldap_connection *primary)
+{
+	struct ldap_connection *conn;
+	pool_t pool;
+
+	pool = pool_alloconly_create("ldap_connection", 1024);
+	conn = p_new(pool, struct ldap_connection, 1);
+	conn->pool = pool;
+	conn->refcount = 1;
+	conn->pool_primary = primary;
+
+	conn->userdb_used = primary->userdb_used;
+	conn->conn_state = LDAP_CONN_STATE_DISCONNECTED;
+	conn->default_bind_msgid = -1;
+	conn->fd = -1;
+	conn->config_path = primary->config_path;
+	conn->set = primary->set;
+
+	/* the attributes are set up by the passdb/userdb before any
+	   requests are sent, so they can be shared */
+	conn->pass_attr_names = primary->pass_attr_names;
+	conn->user_attr_names = primary->user_attr_names;
+	conn->iterate_attr_names = primary->iterate_attr_names;
+	conn->pass_attr_map = primary->pass_attr_map;
+	conn->user_attr_map = primary->user_attr_map;
+	conn->iterate_attr_map = primary->iterate_attr_map;
+
+	conn->event = event_create(auth_event);
+	event_set_append_log_prefix(conn->event, t_strdup_printf(
+		"ldap(%s): ", conn->config_path));
+
+	i_array_init(&conn->request_array, 512);
+	conn->request_queue = aqueue_init(&conn->request_array.arr);
+
+	array_push_back(&primary->pool_conns, &conn);
+	db_ldap_init_ld(conn);
+	return conn;
+}
+
+static unsigned int
+db_ldap_pool_conn_cost(struct ldap_connection *conn,
+		       enum ldap_request_type type)
+{
+	enum ldap_connection_state wanted_state =
+		type == LDAP_REQUEST_TYPE_BIND ?
+		LDAP_CONN_STATE_BOUND_AUTH : LDAP_CONN_STATE_BOUND_DEFAULT;
+
+	/* Prefer connections that don't need to rebind for the request.
+	   This way auth binds and searches mostly end up on their own
+	   connections, and binds don't keep stalling the searches. */
+	return aqueue_count(conn->request_queue) * 2 +
+		(conn->conn_state == wanted_state ? 0 : 1);
+}
+
+static struct ldap_connection *
+db_ldap_pool_conn_get(struct ldap_connection *conn,
+		      struct ldap_request *request)
+{
+	struct ldap_connection *pconn, *best;
+	unsigned int cost, best_cost;
+
+	if (conn->pool_primary != NULL)
+		conn = conn->pool_primary;
+	if (conn->set.connections <= 1)
+		return conn;
+	if (request->type == LDAP_REQUEST_TYPE_SEARCH &&
+	    ((struct ldap_request_search *)request)->multi_entry) {
+		/* userdb iteration enables/disables the input of the
+		   connection it was started with */
+		return conn;
+	}
+
+	best = conn;
+	best_cost = db_ldap_pool_conn_cost(conn, request->type);
+	array_foreach_elem(&conn->pool_conns, pconn) {
+		cost = db_ldap_pool_conn_cost(pconn, request->type);
+		if (cost < best_cost) {
+			best = pconn;
+			best_cost = cost;
+		}
+	}
+	if (aqueue_count(best->request_queue) > 0 &&
+	    array_count(&conn->pool_conns) + 1 < conn->set.connections)
+		best = db_ldap_pool_conn_create(conn);
+	return best;
+}
+
 void db_ldap_request(struct ldap_connection *conn,
 		     struct ldap_request *request)
 {
 	i_assert(request->auth_request != NULL);
 
+	conn = db_ldap_pool_conn_get(conn, request);
+
 	request->msgid = -1;
 	request->create_time = ioloop_time;
 
@@ -1962,12 +2055,29 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 	if (scope2str(conn->set.scope, &conn->set.ldap_scope) < 0)
 		i_fatal("LDAP %s: Unknown scope option '%s'", config_path, conn->set.scope);
 
+	if (conn->set.connections == 0)
+		i_fatal("LDAP %s: connections must be at least 1", config_path);
+
+	conn->base_program = var_expand_program_create(pool, conn->set.base);
+	if (conn->set.auth_bind_userdn != NULL) {
+		conn->auth_bind_userdn_program =
+			var_expand_program_create(pool,
+						  conn->set.auth_bind_userdn);
+	}
+	conn->pass_filter_program =
+		var_expand_program_create(pool, conn->set.pass_filter);
+	conn->user_filter_program =
+		var_expand_program_create(pool, conn->set.user_filter);
+	conn->iterate_filter_program =
+		var_expand_program_create(pool, conn->set.iterate_filter);
+
 	conn->event = event_create(auth_event);
 	event_set_append_log_prefix(conn->event, t_strdup_printf(
 		"ldap(%s): ", conn->config_path));
 
 	i_array_init(&conn->request_array, 512);
 	conn->request_queue = aqueue_init(&conn->request_array.arr);
+	p_array_init(&conn->pool_conns, pool, conn->set.connections);
 
 	conn->next = ldap_connections;
         ldap_connections = conn;
@@ -1976,10 +2086,24 @@ struct ldap_connection *db_ldap_init(const char *config_path, bool userdb)
 	return conn;
 }
 
+static void db_ldap_conn_free(struct ldap_connection *conn)
+{
+	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
+	i_assert(conn->pending_count == 0);
+	db_ldap_conn_close(conn);
+	i_assert(conn->to == NULL);
+
+	array_free(&conn->request_array);
+	aqueue_deinit(&conn->request_queue);
+
+	event_unref(&conn->event);
+	pool_unref(&conn->pool);
+}
+
 void db_ldap_unref(struct ldap_connection **_conn)
 {
         struct ldap_connection *conn = *_conn;
-	struct ldap_connection **p;
+	struct ldap_connection **p, *pconn;
 
 	*_conn = NULL;
 	i_assert(conn->refcount >= 0);
@@ -1993,16 +2117,9 @@ void db_ldap_unref(struct ldap_connection **_conn)
 		}
 	}
 
-	db_ldap_abort_requests(conn, UINT_MAX, 0, FALSE, "Shutting down");
-	i_assert(conn->pending_count == 0);
-	db_ldap_conn_close(conn);
-	i_assert(conn->to == NULL);
-
-	array_free(&conn->request_array);
-	aqueue_deinit(&conn->request_queue);
-
-	event_unref(&conn->event);
-	pool_unref(&conn->pool);
+	array_foreach_elem(&conn->pool_conns, pconn)
+		db_ldap_conn_free(pconn);
+	db_ldap_conn_free(conn);
 }
 
 #ifndef BUILTIN_LDAP
@@ -68,6 +68,7 @@ struct ldap_settings {
 	const char *default_pass_scheme;
 	bool userdb_warning_disable; /* deprecated for now at least */
 	bool blocking;
+	unsigned int connections;
 
 	/* ... */
 	int ldap_deref, ldap_scope, ldap_tls_require_cert_parsed;
@@ -158,6 +159,12 @@ enum ldap_connection_state {
 
 struct ldap_connection {
 	struct ldap_connection *next;
+	/* The connection returned by db_ldap_init() for this configuration.
+	   NULL if this is it. */
+	struct ldap_connection *pool_primary;
+	/* Additional connections opened by the primary connection, up to
+	   set.connections-1. */
+	ARRAY(struct ldap_connection *) pool_conns;
 
 	pool_t pool;
 	int refcount;
@@ -184,6 +191,12 @@ struct ldap_connection {
 	/* Timestamp when we last received a reply */
 	time_t last_reply_stamp;
 
+	/* Parsed base and filter templates. auth_bind_userdn_program is NULL
+	   if auth_bind_userdn isn't set. */
+	struct var_expand_program *base_program, *auth_bind_userdn_program;
+	struct var_expand_program *pass_filter_program, *user_filter_program;
+	struct var_expand_program *iterate_filter_program;
+
 	char **pass_attr_names, **user_attr_names, **iterate_attr_names;
 	ARRAY_TYPE(ldap_field) pass_attr_map, user_attr_map, iterate_attr_map;
 	bool userdb_used;
@@ -2,6 +2,10 @@
 
 #include "auth-common.h"
 #include "array.h"
+#include "hash.h"
+#include "hex-binary.h"
+#include "ioloop.h"
+#include "sha2.h"
 #include "str.h"
 #include "var-expand.h"
 #include "env-util.h"
@@ -77,8 +81,16 @@ struct passdb_oauth2_settings {
 	unsigned int max_idle_time_msecs;
 	unsigned int max_parallel_connections;
 	unsigned int max_pipelined_requests;
+	bool prefer_pipelining;
 	bool tls_allow_invalid_cert;
 
+	/* Introspection result cache: how long the results for valid and
+	   invalid tokens are cached (0 = disabled), and how many results
+	   are cached at most. */
+	unsigned int introspection_cache_ttl;
+	unsigned int introspection_cache_negative_ttl;
+	unsigned int introspection_cache_size;
+
 	bool debug;
 	/* Should introspection be done even if not necessary */
 	bool force_introspection;
@@ -87,6 +99,23 @@ struct passdb_oauth2_settings {
 	bool use_grant_password;
 };
 
+/* Introspection result for a token. While the introspection request is
+   still running, other requests for the same token wait for its result. */
+struct db_oauth2_introspection {
+	/* cached results, oldest first */
+	struct db_oauth2_introspection *prev, *next;
+
+	pool_t pool;
+	/* hex-encoded SHA256 of the token */
+	const char *token_hash;
+
+	ARRAY(struct db_oauth2_request *) waiters;
+	bool pending;
+
+	ARRAY_TYPE(oauth2_field) fields;
+	time_t expires;
+};
+
 struct db_oauth2 {
 	struct db_oauth2 *prev,*next;
 
@@ -100,6 +129,10 @@ struct db_oauth2 {
 
 	struct db_oauth2_request *head;
 
+	HASH_TABLE(const char *, struct db_oauth2_introspection *) introspections;
+	struct db_oauth2_introspection *cached_head, *cached_tail;
+	unsigned int cached_count;
+
 	unsigned int refcount;
 };
 
@@ -134,6 +167,10 @@ static struct setting_def setting_defs[] = {
 	DEF_INT(max_idle_time_msecs),
 	DEF_INT(max_parallel_connections),
 	DEF_INT(max_pipelined_requests),
+	DEF_BOOL(prefer_pipelining),
+	DEF_INT(introspection_cache_ttl),
+	DEF_INT(introspection_cache_negative_ttl),
+	DEF_INT(introspection_cache_size),
 	DEF_BOOL(send_auth_headers),
 	DEF_BOOL(use_grant_password),
 
@@ -173,6 +210,10 @@ static struct passdb_oauth2_settings default_oauth2_settings = {
 	.max_idle_time_msecs = 60000,
 	.max_parallel_connections = 10,
 	.max_pipelined_requests = 1,
+	.prefer_pipelining = FALSE,
+	.introspection_cache_ttl = 0,
+	.introspection_cache_negative_ttl = 0,
+	.introspection_cache_size = 10000,
 	.tls_ca_cert_file = NULL,
 	.tls_ca_cert_dir = NULL,
 	.tls_cert_file = NULL,
@@ -249,6 +290,7 @@ struct db_oauth2 *db_oauth2_init(const char *config_path)
 	http_set.max_idle_time_msecs = db->set.max_idle_time_msecs;
 	http_set.max_parallel_connections = db->set.max_parallel_connections;
 	http_set.max_pipelined_requests = db->set.max_pipelined_requests;
+	http_set.prefer_pipelining = db->set.prefer_pipelining;
 	http_set.no_auto_redirect = FALSE;
 	http_set.no_auto_retry = TRUE;
 	http_set.debug = db->set.debug;
@@ -321,11 +363,26 @@ struct db_oauth2 *db_oauth2_init(const char *config_path)
 		}
 	}
 
+	hash_table_create(&db->introspections, default_pool, 0,
+			  str_hash, strcmp);
+
 	DLLIST_PREPEND(&db_oauth2_head, db);
 
 	return db;
 }
 
+static void
+db_oauth2_introspection_free(struct db_oauth2 *db,
+			     struct db_oauth2_introspection *intro)
+{
+	hash_table_remove(db->introspections, intro->token_hash);
+	if (!intro->pending) {
+		DLLIST2_REMOVE(&db->cached_head, &db->cached_tail, intro);
+		db->cached_count--;
+	}
+	pool_unref(&intro->pool);
+}
+
 void db_oauth2_ref(struct db_oauth2 *db)
 {
 	i_assert(db->refcount > 0);
@@ -335,6 +392,9 @@ void db_oauth2_ref(struct db_oauth2 *db)
 void db_oauth2_unref(struct db_oauth2 **_db)
 {
 	struct db_oauth2 *ptr, *db = *_db;
+	struct hash_iterate_context *iter;
+	struct db_oauth2_introspection *intro;
+	const char *token_hash;
 	i_assert(db->refcount > 0);
 
 	if (--db->refcount > 0) return;
@@ -352,6 +412,16 @@ void db_oauth2_unref(struct db_oauth2 **_db)
 	while (db->head != NULL)
 		oauth2_request_abort(&db->head->req);
 
+	while (db->cached_head != NULL)
+		db_oauth2_introspection_free(db, db->cached_head);
+	/* only the pending introspections are left */
+	iter = hash_table_iterate_init(db->introspections);
+	while (hash_table_iterate(iter, db->introspections,
+				  &token_hash, &intro))
+		pool_unref(&intro->pool);
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&db->introspections);
+
 	http_client_deinit(&db->client);
 	if (db->oauth2_set.key_dict != NULL)
 		dict_deinit(&db->oauth2_set.key_dict);
@@ -659,32 +729,171 @@ static void db_oauth2_process_fields(struct db_oauth2_request *req,
 }
 
 static void
-db_oauth2_introspect_continue(struct oauth2_request_result *result,
-			      struct db_oauth2_request *req)
+db_oauth2_introspect_finish(struct db_oauth2_request *req,
+			    ARRAY_TYPE(oauth2_field) *fields,
+			    const char *error)
 {
 	enum passdb_result passdb_result;
-	const char *error;
 
-	req->req = NULL;
-
-	if (result->error != NULL) {
+	if (error != NULL) {
 		/* fail here */
 		passdb_result = PASSDB_RESULT_INTERNAL_FAILURE;
-		error = result->error;
 	} else {
 		e_debug(authdb_event(req->auth_request),
 			"Introspection succeeded");
-		db_oauth2_fields_merge(req, result->fields);
+		db_oauth2_fields_merge(req, fields);
 		db_oauth2_process_fields(req, &passdb_result, &error);
 	}
 	db_oauth2_callback(req, passdb_result, "Introspection failed: ", error);
 }
 
+static time_t
+db_oauth2_introspection_get_expires(struct db_oauth2 *db,
+				    const struct oauth2_request_result *result)
+{
+	const char *exp_str;
+	time_t expires, exp;
+
+	expires = ioloop_time + (result->valid ?
+				 db->set.introspection_cache_ttl :
+				 db->set.introspection_cache_negative_ttl);
+	/* never cache the result past the token's expiration */
+	if (result->expires_at > 0 && result->expires_at < expires)
+		expires = result->expires_at;
+	exp_str = db_oauth2_field_find(result->fields, "exp");
+	if (exp_str != NULL && str_to_time(exp_str, &exp) == 0 &&
+	    exp < expires)
+		expires = exp;
+	return expires;
+}
+
+static void
+db_oauth2_introspection_save(struct db_oauth2 *db,
+			     struct db_oauth2_introspection *intro,
+			     const struct oauth2_request_result *result)
+{
+	const struct oauth2_field *field;
+	struct oauth2_field *new_field;
+
+	intro->expires = db_oauth2_introspection_get_expires(db, result);
+	if (intro->expires <= ioloop_time) {
+		db_oauth2_introspection_free(db, intro);
+		return;
+	}
+
+	p_array_init(&intro->fields, intro->pool,
+		     array_count(result->fields));
+	array_foreach(result->fields, field) {
+		new_field = array_append_space(&intro->fields);
+		new_field->name = p_strdup(intro->pool, field->name);
+		new_field->value = p_strdup(intro->pool, field->value);
+	}
+	intro->pending = FALSE;
+	DLLIST2_APPEND(&db->cached_head, &db->cached_tail, intro);
+	db->cached_count++;
+
+	/* drop the oldest results when the cache is full */
+	while (db->cached_count > db->set.introspection_cache_size)
+		db_oauth2_introspection_free(db, db->cached_head);
+}
+
+static void
+db_oauth2_introspect_continue(struct oauth2_request_result *result,
+			      struct db_oauth2_request *req)
+{
+	struct db_oauth2_introspection *intro = req->introspection;
+	struct db_oauth2 *db = req->db;
+	struct db_oauth2_request *const *waiters = NULL;
+	unsigned int i, count = 0;
+
+	req->req = NULL;
+	req->introspection = NULL;
+
+	if (intro == NULL) {
+		db_oauth2_introspect_finish(req, result->fields, result->error);
+		return;
+	}
+
+	/* The waiting requests are finished after this request, so the
+	   introspection can't be freed while they're being processed. */
+	i_assert(intro->pending);
+	hash_table_remove(db->introspections, intro->token_hash);
+	if (array_is_created(&intro->waiters))
+		waiters = array_get(&intro->waiters, &count);
+
+	db_oauth2_introspect_finish(req, result->fields, result->error);
+	for (i = 0; i < count; i++) {
+		db_oauth2_introspect_finish(waiters[i], result->fields,
+					    result->error);
+	}
+
+	if (result->error == NULL && result->fields != NULL &&
+	    array_is_created(result->fields) &&
+	    db->set.introspection_cache_ttl > 0 &&
+	    hash_table_lookup(db->introspections, intro->token_hash) == NULL) {
+		hash_table_insert(db->introspections, intro->token_hash, intro);
+		db_oauth2_introspection_save(db, intro, result);
+	} else {
+		pool_unref(&intro->pool);
+	}
+}
+
+/* Returns TRUE if the request was finished from the introspection cache, or
+   if it's waiting for another identical introspection request to finish. */
+static bool
+db_oauth2_introspection_lookup(struct db_oauth2_request *req)
+{
+	struct db_oauth2 *db = req->db;
+	struct db_oauth2_introspection *intro;
+	unsigned char digest[SHA256_RESULTLEN];
+	const char *token_hash;
+	pool_t pool;
+
+	sha256_get_digest(req->token, strlen(req->token), digest);
+	token_hash = binary_to_hex(digest, sizeof(digest));
+
+	intro = hash_table_lookup(db->introspections, token_hash);
+	if (intro != NULL && !intro->pending &&
+	    intro->expires <= ioloop_time) {
+		db_oauth2_introspection_free(db, intro);
+		intro = NULL;
+	}
+	if (intro != NULL && intro->pending) {
+		e_debug(authdb_event(req->auth_request),
+			"Waiting for an identical introspection request");
+		if (!array_is_created(&intro->waiters))
+			p_array_init(&intro->waiters, intro->pool, 4);
+		array_push_back(&intro->waiters, &req);
+		return TRUE;
+	}
+	if (intro != NULL) {
+		e_debug(authdb_event(req->auth_request),
+			"Using cached introspection result");
+		/* move to the end of the cache */
+		DLLIST2_REMOVE(&db->cached_head, &db->cached_tail, intro);
+		DLLIST2_APPEND(&db->cached_head, &db->cached_tail, intro);
+		db_oauth2_introspect_finish(req, &intro->fields, NULL);
+		return TRUE;
+	}
+
+	pool = pool_alloconly_create("oauth2 introspection", 512);
+	intro = p_new(pool, struct db_oauth2_introspection, 1);
+	intro->pool = pool;
+	intro->token_hash = p_strdup(pool, token_hash);
+	intro->pending = TRUE;
+	hash_table_insert(db->introspections, intro->token_hash, intro);
+	req->introspection = intro;
+	return FALSE;
+}
+
 static void db_oauth2_lookup_introspect(struct db_oauth2_request *req)
 {
 	struct oauth2_request_input input;
 	i_zero(&input);
 
+	if (db_oauth2_introspection_lookup(req))
+		return;
+
 	e_debug(authdb_event(req->auth_request),
 		"Making introspection request to %s",
 		req->db->set.introspection_url);
@@ -863,11 +1072,11 @@ void db_oauth2_lookup(struct db_oauth2 *db, struct db_oauth2_request *req,
 						     request->fields.user, request->mech_password,
 						     db_oauth2_lookup_passwd_grant, req);
 	} else if (*db->oauth2_set.tokeninfo_url == '\0') {
-		e_debug(authdb_event(req->auth_request),
-			"Making introspection request to %s",
-			db->set.introspection_url);
-		req->req = oauth2_introspection_start(&req->db->oauth2_set, &input,
-						      db_oauth2_introspect_continue, req);
+		/* the request may finish immediately from the cache, so it
+		   needs to be in the list already */
+		DLLIST_PREPEND(&db->head, req);
+		db_oauth2_lookup_introspect(req);
+		return;
 	} else {
 		e_debug(authdb_event(req->auth_request),
 			"Making token validation lookup to %s",
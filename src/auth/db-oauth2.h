@@ -15,6 +15,9 @@ struct db_oauth2_request {
 
 	struct db_oauth2 *db;
 	struct oauth2_request *req;
+	/* introspection that this request is running for itself and for
+	   the identical requests waiting for it */
+	struct db_oauth2_introspection *introspection;
 
 	/* username to match */
 	const char *username;
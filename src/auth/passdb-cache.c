@@ -63,11 +63,33 @@ passdb_cache_verify_plain_callback(struct auth_worker_connection *conn ATTR_UNUS
 	result = passdb_blocking_auth_worker_reply_parse(request, args);
 	if (result != PASSDB_RESULT_OK)
 		auth_fields_rollback(request->fields.extra_fields);
-	auth_request_verify_plain_callback_finish(result, request);
+	if (result == PASSDB_RESULT_PASSWORD_MISMATCH &&
+	    request->passdb_cache_verify_fallback) {
+		/* same as with verifying in this process: assume that the
+		   password was changed and the cache is expired */
+		request->passdb_cache_verify_fallback = FALSE;
+		auth_request_verify_plain_passdb(request);
+	} else {
+		auth_request_verify_plain_callback_finish(result, request);
+	}
 	auth_request_unref(&request);
 	return TRUE;
 }
 
+static bool
+passdb_cache_verify_with_worker(struct auth_request *request,
+				const char *cached_pw)
+{
+	const char *scheme;
+
+	if (request->set->cache_verify_password_with_worker)
+		return TRUE;
+	/* Verifying a slow scheme here would block all the other requests
+	   for its whole duration. */
+	scheme = password_get_scheme(&cached_pw);
+	return scheme != NULL && password_scheme_is_slow(scheme);
+}
+
 bool passdb_cache_verify_plain(struct auth_request *request, const char *key,
 			       const char *password,
 			       enum passdb_result *result_r, bool use_expired)
@@ -100,7 +122,7 @@ bool passdb_cache_verify_plain(struct auth_request *request, const char *key,
 		e_info(authdb_event(request),
 		       "Cached NULL password access");
 		ret = PASSDB_RESULT_OK;
-	} else if (request->set->cache_verify_password_with_worker) {
+	} else if (passdb_cache_verify_with_worker(request, cached_pw)) {
 		string_t *str;
 
 		str = t_str_new(128);
@@ -113,6 +135,8 @@ bool passdb_cache_verify_plain(struct auth_request *request, const char *key,
 
 		e_debug(authdb_event(request), "cache: "
 			"validating password on worker");
+		request->passdb_cache_verify_fallback = !use_expired &&
+			(node->last_success || neg_expired);
 		auth_request_ref(request);
 		/* Save the extra fields already here, and take a snapshot.
 		   If verification fails, roll back fields. */
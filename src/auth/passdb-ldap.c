@@ -293,8 +293,9 @@ static void ldap_lookup_pass(struct auth_request *auth_request,
 	srequest->request.type = LDAP_REQUEST_TYPE_SEARCH;
 
 	str = t_str_new(512);
-	if (auth_request_var_expand(str, conn->set.base, auth_request,
-				    ldap_escape, &error) <= 0) {
+	if (auth_request_var_expand_program(str,
+					    conn->base_program, auth_request,
+					    ldap_escape, &error) <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand base=%s: %s", conn->set.base, error);
 		passdb_ldap_request_fail(request, PASSDB_RESULT_INTERNAL_FAILURE);
@@ -303,8 +304,10 @@ static void ldap_lookup_pass(struct auth_request *auth_request,
 	srequest->base = p_strdup(auth_request->pool, str_c(str));
 
 	str_truncate(str, 0);
-	if (auth_request_var_expand(str, conn->set.pass_filter,
-				    auth_request, ldap_escape, &error) <= 0) {
+	if (auth_request_var_expand_program(str,
+					    conn->pass_filter_program,
+					    auth_request, ldap_escape,
+					    &error) <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand pass_filter=%s: %s",
 			conn->set.pass_filter, error);
@@ -339,8 +342,9 @@ static void ldap_bind_lookup_dn(struct auth_request *auth_request,
 	srequest->request.type = LDAP_REQUEST_TYPE_SEARCH;
 
 	str = t_str_new(512);
-	if (auth_request_var_expand(str, conn->set.base, auth_request,
-				    ldap_escape, &error) <= 0) {
+	if (auth_request_var_expand_program(str,
+					    conn->base_program, auth_request,
+					    ldap_escape, &error) <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand base=%s: %s", conn->set.base, error);
 		passdb_ldap_request_fail(request, PASSDB_RESULT_INTERNAL_FAILURE);
@@ -349,8 +353,10 @@ static void ldap_bind_lookup_dn(struct auth_request *auth_request,
 	srequest->base = p_strdup(auth_request->pool, str_c(str));
 
 	str_truncate(str, 0);
-	if (auth_request_var_expand(str, conn->set.pass_filter,
-				    auth_request, ldap_escape, &error) <= 0) {
+	if (auth_request_var_expand_program(str,
+					    conn->pass_filter_program,
+					    auth_request, ldap_escape,
+					    &error) <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand pass_filter=%s: %s",
 			conn->set.pass_filter, error);
@@ -388,8 +394,10 @@ ldap_verify_plain_auth_bind_userdn(struct auth_request *auth_request,
 	brequest->request.type = LDAP_REQUEST_TYPE_BIND;
 
 	dn = t_str_new(512);
-	if (auth_request_var_expand(dn, conn->set.auth_bind_userdn,
-				    auth_request, ldap_escape, &error) <= 0) {
+	if (auth_request_var_expand_program(dn,
+					    conn->auth_bind_userdn_program,
+					    auth_request, ldap_escape,
+					    &error) <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand auth_bind_userdn=%s: %s",
 			conn->set.auth_bind_userdn, error);
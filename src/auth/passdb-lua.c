@@ -167,6 +167,7 @@ static void passdb_lua_deinit(struct passdb_module *_module)
 	struct dlua_passdb_module *module =
 		(struct dlua_passdb_module *)_module;
 	dlua_script_unref(&module->script);
+	dlua_script_cache_deinit();
 }
 
 #ifndef PLUGIN_BUILD
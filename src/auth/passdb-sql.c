@@ -16,6 +16,8 @@ struct sql_passdb_module {
 	struct passdb_module module;
 
 	struct db_sql_connection *conn;
+	struct var_expand_program *password_query;
+	struct var_expand_program *update_query;
 };
 
 struct passdb_sql_request {
@@ -159,9 +161,10 @@ static void sql_lookup_pass(struct passdb_sql_request *sql_request)
 	struct sql_passdb_module *module = (struct sql_passdb_module *)_module;
 	const char *query, *error;
 
-	if (t_auth_request_var_expand(module->conn->set.password_query,
-				      sql_request->auth_request,
-				      passdb_sql_escape, &query, &error) <= 0) {
+	if (t_auth_request_var_expand_program(module->password_query,
+					      sql_request->auth_request,
+					      passdb_sql_escape,
+					      &query, &error) <= 0) {
 		e_debug(authdb_event(sql_request->auth_request),
 			"Failed to expand password_query=%s: %s",
 			module->conn->set.password_query, error);
@@ -241,9 +244,9 @@ static void sql_set_credentials(struct auth_request *request,
 
 	request->mech_password = p_strdup(request->pool, new_credentials);
 
-	if (t_auth_request_var_expand(module->conn->set.update_query,
-				      request, passdb_sql_escape,
-				      &query, &error) <= 0) {
+	if (t_auth_request_var_expand_program(module->update_query,
+					      request, passdb_sql_escape,
+					      &query, &error) <= 0) {
 		e_error(authdb_event(request),
 			"Failed to expand update_query=%s: %s",
 			module->conn->set.update_query, error);
@@ -269,6 +272,10 @@ passdb_sql_preinit(pool_t pool, const char *args)
 
 	module = p_new(pool, struct sql_passdb_module, 1);
 	module->conn = conn = db_sql_init(args, FALSE);
+	module->password_query =
+		var_expand_program_create(pool, conn->set.password_query);
+	module->update_query =
+		var_expand_program_create(pool, conn->set.update_query);
 
 	module->module.default_cache_key =
 		auth_cache_parse_key(pool, conn->set.password_query);
@@ -266,6 +266,15 @@ const char *password_generate_salt(size_t len)
 	return salt;
 }
 
+bool password_scheme_is_slow(const char *scheme)
+{
+	const struct password_scheme *s;
+	enum password_encoding encoding;
+
+	s = password_scheme_lookup(scheme, &encoding);
+	return s != NULL && s->slow;
+}
+
 bool password_scheme_is_alias(const char *scheme1, const char *scheme2)
 {
 	const struct password_scheme *s1 = NULL, *s2 = NULL;
@@ -872,6 +881,7 @@ static const struct password_scheme builtin_schemes[] = {
 		.name = "SCRAM-SHA-1",
 		.default_encoding = PW_ENCODING_NONE,
 		.raw_password_len = 0,
+		.slow = TRUE,
 		.password_verify = scram_sha1_verify,
 		.password_generate = scram_sha1_generate,
 	},
@@ -879,6 +889,7 @@ static const struct password_scheme builtin_schemes[] = {
 		.name = "SCRAM-SHA-256",
 		.default_encoding = PW_ENCODING_NONE,
 		.raw_password_len = 0,
+		.slow = TRUE,
 		.password_verify = scram_sha256_verify,
 		.password_generate = scram_sha256_generate,
 	},
@@ -932,6 +943,7 @@ static const struct password_scheme builtin_schemes[] = {
 		.name = "PBKDF2",
 		.default_encoding = PW_ENCODING_NONE,
 		.raw_password_len = 0,
+		.slow = TRUE,
 		.password_verify = pbkdf2_verify,
 		.password_generate = pbkdf2_generate,
 	},
@@ -39,6 +39,18 @@ int auth_request_var_expand_with_table(string_t *dest, const char *str,
 	return var_expand(dest, str, auth_request_var_expand_static_tab, error_r);
 }
 
+int auth_request_var_expand_program_with_table(string_t *dest,
+	const struct var_expand_program *program,
+	const struct auth_request *auth_request ATTR_UNUSED,
+	const struct var_expand_table *table ATTR_UNUSED,
+	auth_request_escape_func_t *escape_func ATTR_UNUSED,
+	const char **error_r)
+{
+	return var_expand_program_execute(dest, program,
+					  auth_request_var_expand_static_tab,
+					  NULL, NULL, error_r);
+}
+
 static void test_auth_cache_parse_key(void)
 {
 	static const struct {
@@ -118,8 +118,9 @@ static void userdb_ldap_lookup(struct auth_request *auth_request,
 	request->userdb_callback = callback;
 
 	str = t_str_new(512);
-	if (auth_request_var_expand(str, conn->set.base, auth_request,
-				    ldap_escape, &error) <= 0) {
+	if (auth_request_var_expand_program(str,
+					    conn->base_program, auth_request,
+					    ldap_escape, &error) <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand base=%s: %s", conn->set.base, error);
 		callback(USERDB_RESULT_INTERNAL_FAILURE, auth_request);
@@ -128,8 +129,10 @@ static void userdb_ldap_lookup(struct auth_request *auth_request,
 	request->request.base = p_strdup(auth_request->pool, str_c(str));
 
 	str_truncate(str, 0);
-	if (auth_request_var_expand(str, conn->set.user_filter, auth_request,
-				    ldap_escape, &error) <= 0) {
+	if (auth_request_var_expand_program(str,
+					    conn->user_filter_program,
+					    auth_request, ldap_escape,
+					    &error) <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand user_filter=%s: %s",
 			conn->set.user_filter, error);
@@ -225,8 +228,9 @@ userdb_ldap_iterate_init(struct auth_request *auth_request,
 	request->request.request.auth_request = auth_request;
 
 	str = t_str_new(512);
-	if (auth_request_var_expand(str, conn->set.base, auth_request,
-				    ldap_escape, &error) <= 0) {
+	if (auth_request_var_expand_program(str,
+					    conn->base_program, auth_request,
+					    ldap_escape, &error) <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand base=%s: %s", conn->set.base, error);
 		ctx->ctx.failed = TRUE;
@@ -234,8 +238,10 @@ userdb_ldap_iterate_init(struct auth_request *auth_request,
 	request->request.base = p_strdup(auth_request->pool, str_c(str));
 
 	str_truncate(str, 0);
-	if (auth_request_var_expand(str, conn->set.iterate_filter,
-				    auth_request, ldap_escape, &error) <= 0) {
+	if (auth_request_var_expand_program(str,
+					    conn->iterate_filter_program,
+					    auth_request, ldap_escape,
+					    &error) <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand iterate_filter=%s: %s",
 			conn->set.iterate_filter, error);
@@ -89,6 +89,7 @@ static void userdb_lua_deinit(struct userdb_module *_module)
 	struct dlua_userdb_module *module =
 		(struct dlua_userdb_module *)_module;
 	dlua_script_unref(&module->script);
+	dlua_script_cache_deinit();
 }
 
 static struct userdb_iterate_context *
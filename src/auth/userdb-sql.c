@@ -14,6 +14,8 @@ struct sql_userdb_module {
 	struct userdb_module module;
 
 	struct db_sql_connection *conn;
+	struct var_expand_program *user_query;
+	struct var_expand_program *iterate_query;
 };
 
 struct userdb_sql_request {
@@ -107,9 +109,9 @@ static void userdb_sql_lookup(struct auth_request *auth_request,
 	struct userdb_sql_request *sql_request;
 	const char *query, *error;
 
-	if (t_auth_request_var_expand(module->conn->set.user_query,
-				      auth_request, userdb_sql_escape,
-				      &query, &error) <= 0) {
+	if (t_auth_request_var_expand_program(module->user_query,
+					      auth_request, userdb_sql_escape,
+					      &query, &error) <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand user_query=%s: %s",
 			module->conn->set.user_query, error);
@@ -150,9 +152,9 @@ userdb_sql_iterate_init(struct auth_request *auth_request,
 	struct sql_userdb_iterate_context *ctx;
 	const char *query, *error;
 
-	if (t_auth_request_var_expand(module->conn->set.iterate_query,
-				      auth_request, userdb_sql_escape,
-				      &query, &error) <= 0) {
+	if (t_auth_request_var_expand_program(module->iterate_query,
+					      auth_request, userdb_sql_escape,
+					      &query, &error) <= 0) {
 		e_error(authdb_event(auth_request),
 			"Failed to expand iterate_query=%s: %s",
 			module->conn->set.iterate_query, error);
@@ -272,6 +274,10 @@ userdb_sql_preinit(pool_t pool, const char *args)
 
 	module = p_new(pool, struct sql_userdb_module, 1);
 	module->conn = db_sql_init(args, TRUE);
+	module->user_query =
+		var_expand_program_create(pool, module->conn->set.user_query);
+	module->iterate_query =
+		var_expand_program_create(pool, module->conn->set.iterate_query);
 
 	module->module.default_cache_key =
 		auth_cache_parse_key(pool, module->conn->set.user_query);
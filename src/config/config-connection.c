@@ -2,7 +2,10 @@
 
 #include "lib.h"
 #include "array.h"
+#include "buffer.h"
+#include "hash.h"
 #include "llist.h"
+#include "str.h"
 #include "istream.h"
 #include "ostream.h"
 #include "strescape.h"
@@ -16,6 +19,9 @@
 #include <unistd.h>
 
 #define MAX_INBUF_SIZE 1024
+/* Maximum total size of the cached replies. The whole cache is dropped
+   when it's reached. */
+#define CONFIG_REPLY_CACHE_MAX_SIZE (16*1024*1024)
 
 #define CONFIG_CLIENT_PROTOCOL_MAJOR_VERSION 2
 #define CONFIG_CLIENT_PROTOCOL_MINOR_VERSION 0
@@ -34,6 +40,56 @@ struct config_connection {
 
 static struct config_connection *config_connections = NULL;
 
+/* request => full reply. The exported settings depend only on the request
+   parameters, so processes of the same service (e.g. many short-lived
+   auth-worker, lmtp or doveadm processes) get the already serialized
+   reply instead of exporting all the settings again. */
+static HASH_TABLE(char *, buffer_t *) config_reply_cache;
+static size_t config_reply_cache_size = 0;
+
+static void config_reply_cache_clear(void)
+{
+	struct hash_iterate_context *iter;
+	buffer_t *reply;
+	char *key;
+
+	if (!hash_table_is_created(config_reply_cache))
+		return;
+
+	iter = hash_table_iterate_init(config_reply_cache);
+	while (hash_table_iterate(iter, config_reply_cache, &key, &reply)) {
+		buffer_free(&reply);
+		i_free(key);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(config_reply_cache, FALSE);
+	config_reply_cache_size = 0;
+}
+
+static void config_reply_cache_add(const char *key, buffer_t *reply)
+{
+	if (!hash_table_is_created(config_reply_cache)) {
+		hash_table_create(&config_reply_cache, default_pool, 0,
+				  str_hash, strcmp);
+	}
+	if (config_reply_cache_size + reply->used > CONFIG_REPLY_CACHE_MAX_SIZE)
+		config_reply_cache_clear();
+	if (reply->used > CONFIG_REPLY_CACHE_MAX_SIZE ||
+	    hash_table_lookup(config_reply_cache, key) != NULL) {
+		buffer_free(&reply);
+		return;
+	}
+	hash_table_insert(config_reply_cache, i_strdup(key), reply);
+	config_reply_cache_size += reply->used;
+}
+
+static const buffer_t *config_reply_cache_lookup(const char *key)
+{
+	if (!hash_table_is_created(config_reply_cache))
+		return NULL;
+	return hash_table_lookup(config_reply_cache, key);
+}
+
 static const char *const *
 config_connection_next_line(struct config_connection *conn)
 {
@@ -70,16 +126,31 @@ static int config_connection_request(struct config_connection *conn,
 	struct config_export_context *ctx;
 	struct master_service_settings_output output;
 	struct config_filter filter;
+	struct ostream *reply_output;
+	const buffer_t *cached_reply;
+	buffer_t *reply;
 	const char *path, *value, *error, *module, *const *wanted_modules;
 	ARRAY(const char *) modules;
 	ARRAY(const char *) exclude_settings;
+	string_t *key, *key_no_ips;
 	bool is_master = FALSE;
 
 	/* [<args>] */
 	t_array_init(&modules, 4);
 	t_array_init(&exclude_settings, 4);
+	key = t_str_new(128);
+	key_no_ips = t_str_new(128);
 	i_zero(&filter);
 	for (; *args != NULL; args++) {
+		str_append_tabescaped(key, *args);
+		str_append_c(key, '\t');
+		if (!str_begins_with(*args, "lname=") &&
+		    !str_begins_with(*args, "lip=") &&
+		    !str_begins_with(*args, "rip=")) {
+			str_append_tabescaped(key_no_ips, *args);
+			str_append_c(key_no_ips, '\t');
+		}
+
 		if (str_begins(*args, "service=", &filter.service))
 			;
 		else if (str_begins(*args, "module=", &module)) {
@@ -118,15 +189,28 @@ static int config_connection_request(struct config_connection *conn,
 			config_connection_destroy(conn);
 			return -1;
 		}
+		/* the settings may have changed */
+		config_reply_cache_clear();
+	} else {
+		/* Replies that don't depend on the local/remote IP or name
+		   are cached without them. */
+		cached_reply = config_reply_cache_lookup(str_c(key_no_ips));
+		if (cached_reply == NULL)
+			cached_reply = config_reply_cache_lookup(str_c(key));
+		if (cached_reply != NULL) {
+			o_stream_nsend(conn->output, cached_reply->data,
+				       cached_reply->used);
+			return 0;
+		}
 	}
 
-	o_stream_cork(conn->output);
-
+	reply = buffer_create_dynamic(default_pool, 4096);
+	reply_output = o_stream_create_buffer(reply);
 	ctx = config_export_init(wanted_modules,
 				 array_count(&exclude_settings) == 1 ? NULL :
 				 array_front(&exclude_settings),
 				 CONFIG_DUMP_SCOPE_SET, 0,
-				 config_request_output, conn->output);
+				 config_request_output, reply_output);
 	config_export_by_filter(ctx, &filter);
 	config_export_get_output(ctx, &output);
 
@@ -134,26 +218,36 @@ static int config_connection_request(struct config_connection *conn,
 		const char *const *s;
 
 		for (s = output.specific_services; *s != NULL; s++) {
-			o_stream_nsend_str(conn->output,
+			o_stream_nsend_str(reply_output,
 				t_strdup_printf("service=%s\t", *s));
 		}
 	}
 	if (output.service_uses_local)
-		o_stream_nsend_str(conn->output, "service-uses-local\t");
+		o_stream_nsend_str(reply_output, "service-uses-local\t");
 	if (output.service_uses_remote)
-		o_stream_nsend_str(conn->output, "service-uses-remote\t");
+		o_stream_nsend_str(reply_output, "service-uses-remote\t");
 	if (output.used_local)
-		o_stream_nsend_str(conn->output, "used-local\t");
+		o_stream_nsend_str(reply_output, "used-local\t");
 	if (output.used_remote)
-		o_stream_nsend_str(conn->output, "used-remote\t");
-	o_stream_nsend_str(conn->output, "\n");
+		o_stream_nsend_str(reply_output, "used-remote\t");
+	o_stream_nsend_str(reply_output, "\n");
 
 	if (config_export_finish(&ctx) < 0) {
+		o_stream_destroy(&reply_output);
+		buffer_free(&reply);
 		config_connection_destroy(conn);
 		return -1;
 	}
-	o_stream_nsend_str(conn->output, "\n");
-	o_stream_uncork(conn->output);
+	o_stream_nsend_str(reply_output, "\n");
+	o_stream_destroy(&reply_output);
+
+	o_stream_nsend(conn->output, reply->data, reply->used);
+	if (is_master)
+		buffer_free(&reply);
+	else if (!output.service_uses_local && !output.service_uses_remote)
+		config_reply_cache_add(str_c(key_no_ips), reply);
+	else
+		config_reply_cache_add(str_c(key), reply);
 	return 0;
 }
 
@@ -262,4 +356,6 @@ void config_connections_destroy_all(void)
 {
 	while (config_connections != NULL)
 		config_connection_destroy(config_connections);
+	config_reply_cache_clear();
+	hash_table_destroy(&config_reply_cache);
 }
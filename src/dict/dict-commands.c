@@ -16,6 +16,9 @@
 #include "main.h"
 
 #define DICT_OUTPUT_OPTIMAL_SIZE 1024
+/* Maximum number of iteration rows to send at once before letting other
+   connections run. */
+#define DICT_ITERATE_MAX_ROWS_PER_RUN 1000
 
 struct dict_cmd_func {
 	enum dict_protocol_cmd cmd;
@@ -35,6 +38,7 @@ struct dict_connection_cmd {
 	unsigned int async_reply_id;
 	unsigned int trans_id; /* obsolete */
 	unsigned int rows;
+	unsigned int lookup_keys_count;
 
 	bool uncork_pending;
 };
@@ -86,6 +90,10 @@ static void dict_connection_cmd_try_flush(struct dict_connection_cmd **_cmd)
 	i_assert(cmd->async_reply_id != 0);
 	i_assert(cmd->reply != NULL);
 
+	/* Async replies are often finished in bursts by the dict driver's
+	   callbacks outside the input handler. Send them with a single
+	   write. */
+	connection_output_batch(&cmd->conn->conn);
 	o_stream_nsend_str(cmd->conn->conn.output, t_strdup_printf("%c%u\t%s",
 		DICT_PROTOCOL_REPLY_ASYNC_REPLY,
 		cmd->async_reply_id, cmd->reply));
@@ -202,6 +210,69 @@ static int cmd_lookup(struct dict_connection_cmd *cmd, const char *const *args)
 	return 1;
 }
 
+static void
+cmd_lookup_multi_callback(const struct dict_lookup_multi_result *result,
+			  struct dict_connection_cmd *cmd)
+{
+	string_t *str = t_str_new(128);
+	string_t *tmp;
+
+	event_set_name(cmd->event, "dict_server_lookup_multi_finished");
+	if (result->ret >= 0) {
+		/* O<value> or N for each key, double-tabescaped so they end
+		   up becoming a single parameter */
+		tmp = t_str_new(128);
+		for (unsigned int i = 0; i < cmd->lookup_keys_count; i++) {
+			if (i > 0)
+				str_append_c(tmp, '\t');
+			if (result->values[i] == NULL)
+				str_append_c(tmp, DICT_PROTOCOL_REPLY_NOTFOUND);
+			else {
+				str_append_c(tmp, DICT_PROTOCOL_REPLY_OK);
+				str_append_tabescaped(tmp, result->values[i]);
+			}
+		}
+		str_append_c(str, DICT_PROTOCOL_REPLY_OK);
+		str_append_tabescaped(str, str_c(tmp));
+		event_add_int(cmd->event, "found_keys", result->ret);
+		e_debug(cmd->event, "Lookup finished");
+	} else {
+		event_add_str(cmd->event, "error", result->error);
+		e_error(cmd->event, "Lookup failed: %s", result->error);
+		str_append_c(str, DICT_PROTOCOL_REPLY_FAIL);
+		str_append_tabescaped(str, result->error);
+	}
+	dict_cmd_reply_handle_stats(cmd, str, cmd_stats.lookups);
+	str_append_c(str, '\n');
+
+	cmd->reply = i_strdup(str_c(str));
+	dict_connection_cmd_try_flush(&cmd);
+}
+
+static int
+cmd_lookup_multi(struct dict_connection_cmd *cmd, const char *const *args)
+{
+	const char *username;
+
+	/* <username> <key> [<key> ...] */
+	if (str_array_length(args) < 2) {
+		e_error(cmd->event, "LOOKUP_MULTI: broken input");
+		return -1;
+	}
+	username = args[0];
+
+	dict_connection_cmd_async(cmd);
+	cmd->lookup_keys_count = str_array_length(args + 1);
+	event_add_int(cmd->event, "keys", cmd->lookup_keys_count);
+	event_add_str(cmd->event, "user", username);
+	const struct dict_op_settings set = {
+		.username = username,
+	};
+	dict_lookup_multi_async(cmd->conn->dict, &set, args + 1,
+				cmd_lookup_multi_callback, cmd);
+	return 1;
+}
+
 static bool dict_connection_flush_if_full(struct dict_connection *conn)
 {
 	if (o_stream_get_buffer_used_size(conn->conn.output) >
@@ -243,6 +314,7 @@ static int cmd_iterate_flush(struct dict_connection_cmd *cmd)
 {
 	string_t *str = t_str_new(256);
 	const char *key, *const *values;
+	unsigned int run_rows = 0;
 
 	if (cmd->conn->destroyed) {
 		cmd_iterate_flush_finish(cmd, str);
@@ -274,6 +346,15 @@ static int cmd_iterate_flush(struct dict_connection_cmd *cmd)
 
 		if (!dict_connection_flush_if_full(cmd->conn))
 			return 0;
+		if (++run_rows >= DICT_ITERATE_MAX_ROWS_PER_RUN) {
+			/* the dict driver and the client are both fast enough
+			   that this iteration could keep running without
+			   stopping. continue it later so other connections
+			   get their turn. */
+			cmd->conn->iter_flush_pending = TRUE;
+			dict_connection_output_more_later(cmd->conn);
+			return 0;
+		}
 	}
 	if (dict_iterate_has_more(cmd->iter)) {
 		/* wait for the next iteration callback */
@@ -621,6 +702,7 @@ cmd_hide_log_values(struct dict_connection_cmd *cmd, const char *const *args)
 
 static const struct dict_cmd_func cmds[] = {
 	{ DICT_PROTOCOL_CMD_LOOKUP, cmd_lookup },
+	{ DICT_PROTOCOL_CMD_LOOKUP_MULTI, cmd_lookup_multi },
 	{ DICT_PROTOCOL_CMD_ITERATE, cmd_iterate },
 	{ DICT_PROTOCOL_CMD_BEGIN, cmd_begin },
 	{ DICT_PROTOCOL_CMD_COMMIT, cmd_commit },
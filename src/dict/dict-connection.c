@@ -56,6 +56,13 @@ static int dict_connection_handshake_args(struct connection *_conn,
 	if (dict_connection_dict_init(conn) < 0)
 		return -1;
 
+	if (conn->conn.minor_version >= 1) {
+		/* v4.1+ clients send LOOKUP_MULTI only after seeing this */
+		o_stream_nsend_str(conn->conn.output,
+			t_strdup_printf("%c%u\t%u\n", DICT_PROTOCOL_CMD_HELLO,
+					DICT_CLIENT_PROTOCOL_MAJOR_VERSION,
+					DICT_CLIENT_PROTOCOL_MINOR_VERSION));
+	}
 	return 1;
 }
 
@@ -162,6 +169,7 @@ bool dict_connection_unref(struct dict_connection *conn)
 			dict_transaction_rollback(&transaction->ctx);
 	}
 
+	timeout_remove(&conn->to_output_more);
 	if (conn->dict != NULL)
 		dict_init_cache_unref(&conn->dict);
 
@@ -218,6 +226,25 @@ void dict_connection_unref_safe(struct dict_connection *conn)
 	}
 }
 
+static void dict_connection_output_more_timeout(struct dict_connection *conn)
+{
+	timeout_remove(&conn->to_output_more);
+
+	dict_connection_ref(conn);
+	o_stream_cork(conn->conn.output);
+	dict_connection_cmds_output_more(conn);
+	o_stream_uncork(conn->conn.output);
+	dict_connection_unref_safe(conn);
+}
+
+void dict_connection_output_more_later(struct dict_connection *conn)
+{
+	if (conn->to_output_more == NULL) {
+		conn->to_output_more = timeout_add_short(0,
+			dict_connection_output_more_timeout, conn);
+	}
+}
+
 static void dict_connection_destroy(struct connection *_conn)
 {
 	struct dict_connection *conn = container_of(_conn, struct dict_connection, conn);
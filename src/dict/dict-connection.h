@@ -21,6 +21,7 @@ struct dict_connection {
 	enum dict_data_type value_type;
 
 	struct timeout *to_unref;
+	struct timeout *to_output_more;
 
 	/* There are only a few transactions per client, so keeping them in
 	   array is fast enough */
@@ -40,6 +41,8 @@ dict_connection_create(struct master_service_connection *master_conn);
 void dict_connection_ref(struct dict_connection *conn);
 bool dict_connection_unref(struct dict_connection *conn);
 void dict_connection_unref_safe(struct dict_connection *conn);
+/* Continue sending the commands' output in the next ioloop run. */
+void dict_connection_output_more_later(struct dict_connection *conn);
 
 unsigned int dict_connections_current_count(void);
 void dict_connections_init(void);
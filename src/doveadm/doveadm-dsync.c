@@ -113,6 +113,7 @@ struct dsync_cmd_context {
 	bool exited:1;
 	bool empty_hdr_workaround:1;
 	bool no_header_hashes:1;
+	bool skip_unchanged_mailboxes:1;
 	bool err_line_continues:1;
 };
 
@@ -625,7 +626,8 @@ cmd_dsync_ibc_stream_init(struct dsync_cmd_context *ctx,
 					    &ctx->input, &ctx->output);
 	}
 	return dsync_ibc_init_stream(ctx->input, ctx->output,
-				     name, temp_prefix, ctx->io_timeout_secs);
+				     name, temp_prefix, ctx->io_timeout_secs,
+				     doveadm_settings->dsync_compression);
 }
 
 static void
@@ -795,6 +797,8 @@ cmd_dsync_run(struct doveadm_mail_cmd_context *_ctx, struct mail_user *user)
 		brain_flags |= DSYNC_BRAIN_FLAG_EMPTY_HDR_WORKAROUND;
 	if (ctx->no_header_hashes)
 		brain_flags |= DSYNC_BRAIN_FLAG_NO_HEADER_HASHES;
+	if (ctx->skip_unchanged_mailboxes)
+		brain_flags |= DSYNC_BRAIN_FLAG_SKIP_UNCHANGED_MAILBOXES;
 	if (doveadm_debug)
 		brain_flags |= DSYNC_BRAIN_FLAG_DEBUG;
 
@@ -1260,6 +1264,8 @@ static struct doveadm_mail_cmd_context *cmd_dsync_alloc(void)
                 ctx->empty_hdr_workaround = TRUE;
         if ((doveadm_settings->parsed_features & DSYNC_FEATURE_NO_HEADER_HASHES) != 0)
                 ctx->no_header_hashes = TRUE;
+        if ((doveadm_settings->parsed_features & DSYNC_FEATURE_SKIP_UNCHANGED_MAILBOXES) != 0)
+                ctx->skip_unchanged_mailboxes = TRUE;
 	ctx->import_commit_msgs_interval = doveadm_settings->dsync_commit_msgs_interval;
 	return &ctx->ctx;
 }
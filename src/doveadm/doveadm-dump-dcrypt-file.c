@@ -29,6 +29,8 @@ static void dcrypt_istream_dump_metadata(const struct istream *stream)
 		printf("flags: IO_STREAM_ENC_INTEGRITY_NONE\n");
 	if ((flags & IO_STREAM_ENC_VERSION_1) != 0)
 		printf("flags: IO_STREAM_ENC_VERSION_1\n");
+	if ((flags & IO_STREAM_ENC_CHUNKED) != 0)
+		printf("flags: IO_STREAM_ENC_CHUNKED\n");
 
 	enum decrypt_istream_format format = i_stream_encrypt_get_format(stream);
 	switch (format) {
@@ -38,6 +40,9 @@ static void dcrypt_istream_dump_metadata(const struct istream *stream)
 	case DECRYPT_FORMAT_V2:
 		printf("format: DECRYPT_FORMAT_V2\n");
 		break;
+	case DECRYPT_FORMAT_V3:
+		printf("format: DECRYPT_FORMAT_V3\n");
+		break;
 	}
 }
 
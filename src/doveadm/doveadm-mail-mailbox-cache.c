@@ -360,6 +360,72 @@ static void cmd_mailbox_cache_purge_init(struct doveadm_mail_cmd_context *_ctx)
 		i_fatal_status(EX_USAGE, "Missing mailbox");
 }
 
+static void
+cmd_mailbox_index_stats_run_box(struct mailbox *box)
+{
+	struct mail_index_memory_usage usage;
+
+	mail_index_get_memory_usage(box->index, &usage);
+	doveadm_print(mailbox_get_vname(box));
+	doveadm_print(dec2str(usage.maps_count));
+	doveadm_print(dec2str(usage.rec_maps_count));
+	doveadm_print(dec2str(usage.headers_bytes));
+	doveadm_print(dec2str(usage.records_mmap_bytes));
+	doveadm_print(dec2str(usage.records_memory_bytes));
+	doveadm_print(dec2str(usage.ext_records_bytes));
+	doveadm_print(dec2str(usage.modseqs_bytes));
+	doveadm_print(dec2str(usage.cache_mmap_bytes));
+	doveadm_print(dec2str(usage.cache_memory_bytes));
+	doveadm_print(dec2str(usage.log_files_count));
+	doveadm_print(dec2str(usage.log_mmap_bytes));
+	doveadm_print(dec2str(usage.log_memory_bytes));
+}
+
+static int cmd_mailbox_index_stats_run(struct doveadm_mail_cmd_context *_ctx,
+				       struct mail_user *user)
+{
+	struct mailbox_cache_cmd_context *ctx =
+		container_of(_ctx, struct mailbox_cache_cmd_context, ctx);
+	const char *const *boxname;
+	int ret = 0;
+
+	if (_ctx->exit_code != 0)
+		return -1;
+
+	for(boxname = ctx->boxes; ret == 0 && *boxname != NULL; boxname++) {
+		struct mailbox *box;
+		if ((ret = cmd_mailbox_cache_open_box(_ctx, user, *boxname, &box)) < 0)
+			break;
+		cmd_mailbox_index_stats_run_box(box);
+		mailbox_free(&box);
+	}
+
+	return ret;
+}
+
+static void cmd_mailbox_index_stats_init(struct doveadm_mail_cmd_context *_ctx)
+{
+	static const char *const fields[] = {
+		"maps", "rec_maps", "headers_bytes",
+		"records_mmap_bytes", "records_memory_bytes",
+		"ext_records_bytes", "modseqs_bytes",
+		"cache_mmap_bytes", "cache_memory_bytes",
+		"log_files", "log_mmap_bytes", "log_memory_bytes",
+	};
+	struct doveadm_cmd_context *cctx = _ctx->cctx;
+	struct mailbox_cache_cmd_context *ctx =
+		container_of(_ctx, struct mailbox_cache_cmd_context, ctx);
+
+	if (!doveadm_cmd_param_array(cctx, "mailbox", &ctx->boxes))
+		i_fatal_status(EX_USAGE, "Missing mailbox");
+
+	doveadm_print_header_simple("mailbox");
+	for (unsigned int i = 0; i < N_ELEMENTS(fields); i++) {
+		doveadm_print_header(fields[i], fields[i],
+				     DOVEADM_PRINT_HEADER_FLAG_RIGHT_JUSTIFY);
+	}
+}
+
 static struct doveadm_mail_cmd_context *cmd_mailbox_cache_decision_alloc(void)
 {
 	struct mailbox_cache_cmd_context *ctx =
@@ -425,3 +491,23 @@ DOVEADM_CMD_MAIL_COMMON
 DOVEADM_CMD_PARAM('\0', "mailbox", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
 DOVEADM_CMD_PARAMS_END
 };
+
+static struct doveadm_mail_cmd_context *cmd_mailbox_index_stats_alloc(void)
+{
+	struct mailbox_cache_cmd_context *ctx =
+		doveadm_mail_cmd_alloc(struct mailbox_cache_cmd_context);
+	ctx->ctx.v.init = cmd_mailbox_index_stats_init;
+	ctx->ctx.v.run = cmd_mailbox_index_stats_run;
+	doveadm_print_init(DOVEADM_PRINT_TYPE_TABLE);
+	return &ctx->ctx;
+}
+
+struct doveadm_cmd_ver2 doveadm_cmd_mailbox_index_stats = {
+	.name = "mailbox index-stats",
+	.mail_cmd = cmd_mailbox_index_stats_alloc,
+	.usage = DOVEADM_CMD_MAIL_USAGE_PREFIX"<mailbox> [...]",
+DOVEADM_CMD_PARAMS_START
+DOVEADM_CMD_MAIL_COMMON
+DOVEADM_CMD_PARAM('\0', "mailbox", CMD_PARAM_ARRAY, CMD_PARAM_FLAG_POSITIONAL)
+DOVEADM_CMD_PARAMS_END
+};
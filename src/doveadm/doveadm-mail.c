@@ -9,6 +9,7 @@
 #include "istream-seekable.h"
 #include "str.h"
 #include "strescape.h"
+#include "time-util.h"
 #include "unichar.h"
 #include "module-dir.h"
 #include "wildcard-match.h"
@@ -413,6 +414,10 @@ doveadm_mail_ctx_to_storage_service_input(struct doveadm_mail_cmd_context *ctx,
 	input_r->local_port = cctx->local_port;
 	input_r->username = cctx->username;
 	input_r->forward_fields = doveadm_mail_get_forward_fields(ctx);
+	if (ctx->cur_userdb_fields != NULL) {
+		input_r->userdb_fields = ctx->cur_userdb_fields;
+		input_r->userdb_prefetched = TRUE;
+	}
 }
 
 static int
@@ -515,7 +520,10 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 		       const char *wildcard_user)
 {
 	struct doveadm_cmd_context *cctx = ctx->cctx;
-	unsigned int user_idx;
+	unsigned int user_idx, failed_count = 0, missing_count = 0;
+	struct timeval start_time, end_time;
+	struct event *event;
+	long long msecs;
 	const char *ip, *user, *error;
 	int ret;
 
@@ -527,7 +535,16 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 
 	ctx->v.init(ctx);
 
-	if (wildcard_user != NULL) {
+	if (wildcard_user == NULL)
+		;
+	else if (ctx->set->doveadm_userdb_lookup_batch > 0 &&
+		 (ctx->set->doveadm_worker_count == 0 || doveadm_server)) {
+		/* the users aren't proxied to doveadm server, so their
+		   userdb lookups are done in this process */
+		mail_storage_service_all_init_mask_lookup(ctx->storage_service,
+			wildcard_user, &ctx->storage_service_input,
+			ctx->set->doveadm_userdb_lookup_batch);
+	} else {
 		mail_storage_service_all_init_mask(ctx->storage_service,
 						   wildcard_user);
 	}
@@ -535,6 +552,9 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 	if (hook_doveadm_mail_init != NULL)
 		hook_doveadm_mail_init(ctx);
 
+	/* the finished event's duration field covers the whole iteration */
+	event = event_create(ctx->cctx->event);
+	i_gettimeofday(&start_time);
 	user_idx = 0;
 	while ((ret = ctx->v.get_next_user(ctx, &user)) > 0) {
 		if (wildcard_user != NULL) {
@@ -544,19 +564,24 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 		cctx->username = user;
 		T_BEGIN {
 			ret = doveadm_mail_next_user(ctx, &error);
-			if (ret < 0)
+			if (ret < 0) {
 				e_error(ctx->cctx->event, "%s", error);
-			else if (ret == 0)
+				failed_count++;
+			} else if (ret == 0) {
 				e_info(ctx->cctx->event,
 				       "User no longer exists, skipping");
+				missing_count++;
+			}
 		} T_END;
+		user_idx++;
 		if (ret == -1)
 			break;
-		if (doveadm_verbose) {
-			if (++user_idx % 100 == 0) {
-				printf("\r%d", user_idx);
-				fflush(stdout);
-			}
+		if (user_idx % 100 == 0 && doveadm_verbose) {
+			i_gettimeofday(&end_time);
+			msecs = timeval_diff_msecs(&end_time, &start_time);
+			printf("\r%u (%lld users/s)", user_idx,
+			       msecs == 0 ? 0 : user_idx * 1000LL / msecs);
+			fflush(stdout);
 		}
 		if (doveadm_is_killed()) {
 			ret = -1;
@@ -570,6 +595,18 @@ doveadm_mail_all_users(struct doveadm_mail_cmd_context *ctx,
 		i_set_failure_prefix("doveadm: ");
 	else
 		i_set_failure_prefix("doveadm(%s): ", ip);
+
+	i_gettimeofday(&end_time);
+	msecs = timeval_diff_msecs(&end_time, &start_time);
+	e_debug(event_create_passthrough(event)->
+		set_name("doveadm_mail_all_users_finished")->
+		add_int("users", user_idx)->
+		add_int("failed_users", failed_count)->
+		add_int("missing_users", missing_count)->event(),
+		"Processed %u users (%u failed, %u missing) in %lld.%03lld secs",
+		user_idx, failed_count, missing_count,
+		msecs / 1000, msecs % 1000);
+	event_unref(&event);
 	if (ret < 0) {
 		e_error(ctx->cctx->event, "Failed to iterate through some users");
 		ctx->exit_code = EX_TEMPFAIL;
@@ -585,8 +622,11 @@ static int
 doveadm_mail_cmd_get_next_user(struct doveadm_mail_cmd_context *ctx,
 			       const char **username_r)
 {
-	if (ctx->users_list_input == NULL)
-		return mail_storage_service_all_next(ctx->storage_service, username_r);
+	ctx->cur_userdb_fields = NULL;
+	if (ctx->users_list_input == NULL) {
+		return mail_storage_service_all_next_fields(ctx->storage_service,
+			username_r, &ctx->cur_userdb_fields);
+	}
 
 	*username_r = i_stream_read_next_line(ctx->users_list_input);
 	if (ctx->users_list_input->stream_errno != 0) {
@@ -778,6 +818,7 @@ static struct doveadm_cmd_ver2 *mail_commands_ver2[] = {
 	&doveadm_cmd_mailbox_cache_decision,
 	&doveadm_cmd_mailbox_cache_remove,
 	&doveadm_cmd_mailbox_cache_purge,
+	&doveadm_cmd_mailbox_index_stats,
 	&doveadm_cmd_rebuild_attachments,
 };
 
@@ -80,6 +80,9 @@ struct doveadm_mail_cmd_context {
 
 	struct mail_storage_service_user *cur_service_user;
 	struct mail_user *cur_mail_user;
+	/* Userdb fields of the current user, if they were already looked up
+	   while iterating users. */
+	const char *const *cur_userdb_fields;
 	struct doveadm_mail_cmd_vfuncs v;
 
 	struct istream *cmd_input;
@@ -202,6 +205,7 @@ extern struct doveadm_cmd_ver2 doveadm_cmd_mailbox_path_ver2;
 extern struct doveadm_cmd_ver2 doveadm_cmd_mailbox_cache_decision;
 extern struct doveadm_cmd_ver2 doveadm_cmd_mailbox_cache_remove;
 extern struct doveadm_cmd_ver2 doveadm_cmd_mailbox_cache_purge;
+extern struct doveadm_cmd_ver2 doveadm_cmd_mailbox_index_stats;
 extern struct doveadm_cmd_ver2 doveadm_cmd_rebuild_attachments;
 
 #define DOVEADM_CMD_MAIL_COMMON \
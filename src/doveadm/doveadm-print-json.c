@@ -11,12 +11,22 @@
 #include "doveadm-print-private.h"
 #include "client-connection.h"
 
+struct doveadm_print_json_header {
+	/* JSON-escaped "key": prefix, so it's not escaped again for each
+	   row */
+	const char *key_prefix;
+	enum doveadm_print_header_flags flags;
+};
+
 struct doveadm_print_json_context {
 	unsigned int header_idx, header_count;
 	bool first_row;
 	bool in_stream;
 	bool flushed;
-	ARRAY(struct doveadm_print_header) headers;
+	/* Print each row as a separate JSON object on its own line instead
+	   of a single JSON array */
+	bool ndjson;
+	ARRAY(struct doveadm_print_json_header) headers;
 	pool_t pool;
 	string_t *str;
 };
@@ -35,22 +45,36 @@ static void doveadm_print_json_init(void)
 	ctx.in_stream = FALSE;
 }
 
+static void doveadm_print_ndjson_init(void)
+{
+	doveadm_print_json_init();
+	ctx.ndjson = TRUE;
+}
+
 static void
 doveadm_print_json_header(const struct doveadm_print_header *hdr)
 {
-	struct doveadm_print_header *lhdr;
+	struct doveadm_print_json_header *lhdr;
+	string_t *str = t_str_new(64);
+
+	str_append_c(str, '"');
+	json_append_escaped(str, hdr->key);
+	str_append(str, "\":");
+
 	lhdr = array_append_space(&ctx.headers);
-	lhdr->key = p_strdup(ctx.pool, hdr->key);
+	lhdr->key_prefix = p_strdup(ctx.pool, str_c(str));
 	lhdr->flags = hdr->flags;
 	ctx.header_count++;
 }
 
 static void
-doveadm_print_json_value_header(const struct doveadm_print_header *hdr)
+doveadm_print_json_value_header(const struct doveadm_print_json_header *hdr)
 {
 	// get header name
 	if (ctx.header_idx == 0) {
-		if (ctx.first_row == TRUE) {
+		if (ctx.ndjson)
+			;
+		else if (ctx.first_row == TRUE) {
 			ctx.first_row = FALSE;
 			str_append_c(ctx.str, '[');
 		} else {
@@ -61,10 +85,7 @@ doveadm_print_json_value_header(const struct doveadm_print_header *hdr)
 		str_append_c(ctx.str, ',');
 	}
 
-	str_append_c(ctx.str, '"');
-	json_append_escaped(ctx.str, hdr->key);
-	str_append_c(ctx.str, '"');
-	str_append_c(ctx.str, ':');
+	str_append(ctx.str, hdr->key_prefix);
 }
 
 static void
@@ -72,13 +93,18 @@ doveadm_print_json_value_footer(void) {
 	if (++ctx.header_idx == ctx.header_count) {
 		ctx.header_idx = 0;
 		str_append_c(ctx.str, '}');
+		if (ctx.ndjson)
+			str_append_c(ctx.str, '\n');
+		/* the output stream is corked, so this only copies the row
+		   to its buffer */
 		doveadm_print_json_flush_internal();
 	}
 }
 
 static void doveadm_print_json_print(const char *value)
 {
-	const struct doveadm_print_header *hdr = array_idx(&ctx.headers, ctx.header_idx);
+	const struct doveadm_print_json_header *hdr =
+		array_idx(&ctx.headers, ctx.header_idx);
 
 	doveadm_print_json_value_header(hdr);
 
@@ -100,7 +126,7 @@ static void
 doveadm_print_json_print_stream(const unsigned char *value, size_t size)
 {
 	if (!ctx.in_stream) {
-		const struct doveadm_print_header *hdr =
+		const struct doveadm_print_json_header *hdr =
 			array_idx(&ctx.headers, ctx.header_idx);
 		doveadm_print_json_value_header(hdr);
 		i_assert((hdr->flags & DOVEADM_PRINT_HEADER_FLAG_NUMBER) == 0);
@@ -133,6 +159,11 @@ static void doveadm_print_json_flush(void)
 		return;
 	ctx.flushed = TRUE;
 
+	if (ctx.ndjson) {
+		/* all the rows were already written */
+		return;
+	}
+
 	if (ctx.first_row == FALSE)
 		str_append_c(ctx.str,']');
 	else {
@@ -158,3 +189,14 @@ struct doveadm_print_vfuncs doveadm_print_json_vfuncs = {
 	doveadm_print_json_flush
 };
 
+
+struct doveadm_print_vfuncs doveadm_print_ndjson_vfuncs = {
+	"ndjson",
+
+	doveadm_print_ndjson_init,
+	doveadm_print_json_deinit,
+	doveadm_print_json_header,
+	doveadm_print_json_print,
+	doveadm_print_json_print_stream,
+	doveadm_print_json_flush
+};
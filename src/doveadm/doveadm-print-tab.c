@@ -9,6 +9,7 @@ struct doveadm_print_tab_context {
 	unsigned int header_idx, header_count;
 
 	bool header_written:1;
+	bool in_stream:1;
 };
 
 static struct doveadm_print_tab_context ctx;
@@ -36,8 +37,9 @@ doveadm_print_tab_header(const struct doveadm_print_header *hdr)
 static void doveadm_print_tab_print(const char *value)
 {
 	doveadm_print_tab_flush_header();
-	if (ctx.header_idx > 0)
+	if (ctx.header_idx > 0 && !ctx.in_stream)
 		o_stream_nsend(doveadm_print_ostream, "\t", 1);
+	ctx.in_stream = FALSE;
 	o_stream_nsend_str(doveadm_print_ostream, value);
 
 	if (++ctx.header_idx == ctx.header_count) {
@@ -54,8 +56,10 @@ doveadm_print_tab_print_stream(const unsigned char *value, size_t size)
 		return;
 	}
 	doveadm_print_tab_flush_header();
-	if (ctx.header_idx > 0)
+	/* the separator is written only before the first chunk */
+	if (ctx.header_idx > 0 && !ctx.in_stream)
 		o_stream_nsend(doveadm_print_ostream, "\t", 1);
+	ctx.in_stream = TRUE;
 	o_stream_nsend(doveadm_print_ostream, value, size);
 }
 
@@ -77,6 +77,7 @@ static const struct setting_define doveadm_setting_defines[] = {
 	DEF(STR, auth_socket_path),
 	DEF(STR, doveadm_socket_path),
 	DEF(UINT, doveadm_worker_count),
+	DEF(UINT, doveadm_userdb_lookup_batch),
 	DEF(IN_PORT, doveadm_port),
 	{ .type = SET_ALIAS, .key = "doveadm_proxy_port" },
 	DEF(ENUM, doveadm_ssl),
@@ -90,6 +91,7 @@ static const struct setting_define doveadm_setting_defines[] = {
 	DEF(UINT, dsync_commit_msgs_interval),
 	DEF(STR, doveadm_http_rawlog_dir),
 	DEF(STR, dsync_hashed_headers),
+	DEF(STR, dsync_compression),
 
 	{ .type = SET_STRLIST, .key = "plugin",
 	  .offset = offsetof(struct doveadm_settings, plugin_envs) },
@@ -107,6 +109,7 @@ const struct doveadm_settings doveadm_default_settings = {
 	.auth_socket_path = "auth-userdb",
 	.doveadm_socket_path = "doveadm-server",
 	.doveadm_worker_count = 0,
+	.doveadm_userdb_lookup_batch = 0,
 	.doveadm_port = 0,
 	.doveadm_ssl = "no:ssl:starttls",
 	.doveadm_username = "doveadm",
@@ -117,6 +120,7 @@ const struct doveadm_settings doveadm_default_settings = {
 	.dsync_features = "",
 	.dsync_hashed_headers = "Date Message-ID",
 	.dsync_commit_msgs_interval = 100,
+	.dsync_compression = "",
 	.doveadm_api_key = "",
 	.doveadm_http_rawlog_dir = "",
 
@@ -160,6 +164,7 @@ struct dsync_feature_list {
 static const struct dsync_feature_list dsync_feature_list[] = {
 	{ "empty-header-workaround", DSYNC_FEATURE_EMPTY_HDR_WORKAROUND },
 	{ "no-header-hashes", DSYNC_FEATURE_NO_HEADER_HASHES },
+	{ "skip-unchanged-mailboxes", DSYNC_FEATURE_SKIP_UNCHANGED_MAILBOXES },
 	{ NULL, 0 }
 };
 
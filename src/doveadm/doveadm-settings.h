@@ -9,6 +9,7 @@ struct ssl_iostream_settings;
 enum dsync_features {
 	DSYNC_FEATURE_EMPTY_HDR_WORKAROUND = 0x1,
 	DSYNC_FEATURE_NO_HEADER_HASHES = 0x2,
+	DSYNC_FEATURE_SKIP_UNCHANGED_MAILBOXES = 0x4,
 };
 /* </settings checks> */
 
@@ -22,6 +23,7 @@ struct doveadm_settings {
 	const char *auth_socket_path;
 	const char *doveadm_socket_path;
 	unsigned int doveadm_worker_count;
+	unsigned int doveadm_userdb_lookup_batch;
 	in_port_t doveadm_port;
 	const char *doveadm_ssl;
 	const char *doveadm_username;
@@ -32,6 +34,7 @@ struct doveadm_settings {
 	const char *doveadm_api_key;
 	const char *dsync_features;
 	const char *dsync_hashed_headers;
+	const char *dsync_compression;
 	unsigned int dsync_commit_msgs_interval;
 	const char *doveadm_http_rawlog_dir;
 	enum dsync_features parsed_features;
@@ -277,6 +277,20 @@ int dsync_brain_sync_mailbox_open(struct dsync_brain *brain,
 				STATUS_HIGHESTPVTMODSEQ, &status);
 	if (status.nonpermanent_modseqs)
 		status.highest_modseq = 0;
+	if (ret == 0 && last_common_uid != 0 &&
+	    status.uidnext == last_common_uid + 1 &&
+	    status.highest_modseq == last_common_modseq &&
+	    status.highest_pvt_modseq == last_common_pvt_modseq &&
+	    status.highest_modseq != 0) {
+		/* The transaction log has been rotated, but there have been
+		   no changes since the last sync. The incremental sync can
+		   still be done, since there are no changes to find. */
+		e_debug(brain->event,
+			"Modseq %"PRIu64" no longer in transaction log, "
+			"but mailbox %s is unchanged",
+			last_common_modseq, mailbox_get_vname(brain->box));
+		ret = 1;
+	}
 	if (ret == 0) {
 		if (pvt_too_old) {
 			desync_reason = t_strdup_printf(
@@ -471,6 +485,51 @@ dsync_brain_has_mailbox_state_changed(struct dsync_brain *brain,
 		state->last_messages_count != dsync_box->messages_count;
 }
 
+static bool
+dsync_brain_has_mailbox_node_state_changed(struct dsync_brain *brain,
+					   const struct dsync_mailbox_node *node)
+{
+	const struct dsync_mailbox_state *state;
+
+	if (brain->sync_type != DSYNC_BRAIN_SYNC_TYPE_STATE ||
+	    node->highest_modseq == 0)
+		return TRUE;
+
+	/* Use the status cached in the mailbox list index, so the mailbox
+	   doesn't need to be opened at all. Private modseqs aren't known
+	   without opening the mailbox though. */
+	state = dsync_mailbox_state_find(brain, node->mailbox_guid);
+	return state == NULL ||
+		state->last_common_pvt_modseq != 0 ||
+		state->last_uidvalidity != node->uid_validity ||
+		state->last_common_uid+1 != node->uid_next ||
+		state->last_common_modseq != node->highest_modseq ||
+		state->last_messages_count != node->messages_count;
+}
+
+static bool
+dsync_brain_has_remote_mailbox_changed(struct dsync_brain *brain,
+				       const struct dsync_mailbox *dsync_box)
+{
+	const struct dsync_mailbox_node *node;
+
+	if (!brain->skip_unchanged_mailboxes ||
+	    brain->sync_type != DSYNC_BRAIN_SYNC_TYPE_CHANGED)
+		return TRUE;
+	/* private modseqs aren't in the mailbox tree */
+	if (dsync_box->highest_pvt_modseq != 0)
+		return TRUE;
+
+	node = dsync_mailbox_tree_lookup_guid(brain->remote_mailbox_tree,
+					      dsync_box->mailbox_guid);
+	return node == NULL || node->highest_modseq == 0 ||
+		!guid_128_equals(node->mailbox_guid, dsync_box->mailbox_guid) ||
+		node->uid_validity != dsync_box->uid_validity ||
+		node->uid_next != dsync_box->uid_next ||
+		node->messages_count != dsync_box->messages_count ||
+		node->highest_modseq != dsync_box->highest_modseq;
+}
+
 static int
 dsync_brain_try_next_mailbox(struct dsync_brain *brain, struct mailbox **box_r,
 			     struct file_lock **lock_r,
@@ -499,6 +558,16 @@ dsync_brain_try_next_mailbox(struct dsync_brain *brain, struct mailbox **box_r,
 		dsync_mailbox_tree_iter_deinit(&brain->local_tree_iter);
 		return -1;
 	}
+	if (!dsync_brain_has_mailbox_node_state_changed(brain, node)) {
+		e_debug(brain->event,
+			"Skipping mailbox %s with unchanged list index state "
+			"uidvalidity=%u uidnext=%u highestmodseq=%"PRIu64" "
+			"messages=%u",
+			guid_128_to_string(node->mailbox_guid),
+			node->uid_validity, node->uid_next,
+			node->highest_modseq, node->messages_count);
+		return 0;
+	}
 
 	if (brain->backup_send) {
 		/* make sure mailbox isn't modified */
@@ -535,6 +604,15 @@ dsync_brain_try_next_mailbox(struct dsync_brain *brain, struct mailbox **box_r,
 		}
 		if (synced) {
 			/* ok, the mailbox really changed */
+			if (!dsync_brain_has_remote_mailbox_changed(brain, &dsync_box)) {
+				e_debug(brain->event,
+					"Skipping mailbox %s with state equal "
+					"to remote mailbox tree",
+					guid_128_to_string(dsync_box.mailbox_guid));
+				mailbox_free(&box);
+				file_lock_free(&lock);
+				return 0;
+			}
 			break;
 		}
 
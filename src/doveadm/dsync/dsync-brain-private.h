@@ -126,6 +126,7 @@ struct dsync_brain {
 	bool failed:1;
 	bool empty_hdr_workaround:1;
 	bool no_header_hashes:1;
+	bool skip_unchanged_mailboxes:1;
 };
 
 extern const char *dsync_box_state_names[DSYNC_BOX_STATE_DONE+1];
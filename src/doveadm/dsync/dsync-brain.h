@@ -40,6 +40,13 @@ enum dsync_brain_flags {
 	   less safe, but can have huge performance improvement with imapc
 	   if the remote server doesn't have a fast header cache. */
 	DSYNC_BRAIN_FLAG_NO_HEADER_HASHES	= 0x1000,
+	/* With DSYNC_BRAIN_SYNC_TYPE_CHANGED skip mailboxes whose state
+	   equals the state the remote sent in its mailbox tree, without
+	   asking the remote about them. This avoids a round trip for each
+	   unchanged mailbox, but the remote's state comes from its mailbox
+	   list index without fully syncing the mailbox first, so changes
+	   the remote's index hasn't yet noticed aren't synced. */
+	DSYNC_BRAIN_FLAG_SKIP_UNCHANGED_MAILBOXES = 0x2000,
 };
 
 enum dsync_brain_sync_type {
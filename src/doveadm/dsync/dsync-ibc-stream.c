@@ -11,6 +11,7 @@
 #include "str.h"
 #include "strescape.h"
 #include "master-service.h"
+#include "compression.h"
 #include "mail-cache.h"
 #include "mail-storage-private.h"
 #include "dsync-serializer.h"
@@ -56,6 +57,11 @@ enum item_type {
 };
 
 #define END_OF_LIST_LINE "."
+/* Sent among the deserializer headers as "Z<space separated list of
+   supported compression algorithms>". Remotes that don't support compression
+   ignore it. After the headers "Z\t<algorithm>" line is sent just before the
+   rest of the output is compressed. */
+#define COMPRESSION_CHR 'Z'
 static const struct {
 	/* full human readable name of the item */
 	const char *name;
@@ -91,7 +97,8 @@ static const struct {
 	  .chr = 'N',
 	  .required_keys = "name existence",
 	  .optional_keys = "mailbox_guid uid_validity uid_next "
-	  	"last_renamed_or_created subscribed last_subscription_change"
+	  	"last_renamed_or_created subscribed last_subscription_change "
+		"messages_count highest_modseq"
 	},
 	{ .name = "mailbox_delete",
 	  .chr = 'D',
@@ -150,6 +157,7 @@ struct dsync_ibc_stream {
 	struct ostream *output;
 	struct io *io;
 	struct timeout *to;
+	const struct compression_handler *compression_handler;
 
 	unsigned int minor_version;
 	struct dsync_serializer *serializers[ITEM_END_OF_LIST];
@@ -173,6 +181,8 @@ struct dsync_ibc_stream {
 	bool finish_received:1;
 	bool done_received:1;
 	bool stopped:1;
+	bool remote_has_compression:1;
+	bool input_compressed:1;
 };
 
 static const char *dsync_ibc_stream_get_state(struct dsync_ibc_stream *ibc)
@@ -350,6 +360,16 @@ static void dsync_ibc_stream_init(struct dsync_ibc_stream *ibc)
 				dsync_serializer_encode_header_line(ibc->serializers[i]));
 		}
 	} T_END;
+	if (ibc->compression_handler != NULL) {
+		o_stream_nsend(ibc->output, "Z", 1);
+		for (i = 0; compression_handlers[i].name != NULL; i++) {
+			if (compression_handlers[i].create_istream == NULL)
+				continue;
+			o_stream_nsend_str(ibc->output,
+				t_strdup_printf(" %s", compression_handlers[i].name));
+		}
+		o_stream_nsend_str(ibc->output, "\n");
+	}
 	o_stream_nsend_str(ibc->output, ".\n");
 	o_stream_uncork(ibc->output);
 }
@@ -526,6 +546,55 @@ dsync_ibc_check_missing_deserializers(struct dsync_ibc_stream *ibc)
 	return ret;
 }
 
+static void dsync_ibc_stream_compress_output(struct dsync_ibc_stream *ibc)
+{
+	const struct compression_handler *handler = ibc->compression_handler;
+	struct ostream *output;
+	bool corked = o_stream_is_corked(ibc->output);
+
+	i_assert(ibc->value_output == NULL);
+
+	o_stream_nsend_str(ibc->output, t_strdup_printf("%c\t%s\n",
+		COMPRESSION_CHR, handler->name));
+	/* flush everything before the compression starts */
+	if (corked)
+		o_stream_uncork(ibc->output);
+	output = handler->create_ostream(ibc->output,
+					 handler->get_default_level());
+	o_stream_unref(&ibc->output);
+	ibc->output = output;
+	if (corked)
+		o_stream_cork(ibc->output);
+}
+
+static bool
+dsync_ibc_stream_decompress_input(struct dsync_ibc_stream *ibc,
+				  const char *line)
+{
+	const struct compression_handler *handler;
+	struct istream *input;
+
+	if (ibc->input_compressed || line[0] != COMPRESSION_CHR ||
+	    line[1] != '\t')
+		return FALSE;
+
+	if (compression_lookup_handler(line + 2, &handler) <= 0) {
+		dsync_ibc_input_error(ibc, NULL,
+			"Remote sent unsupported compression: %s", line + 2);
+		return TRUE;
+	}
+	/* the rest of the input (including what is already buffered) is
+	   compressed */
+	input = handler->create_istream(ibc->input);
+	i_stream_unref(&ibc->input);
+	ibc->input = input;
+	io_remove(&ibc->io);
+	ibc->io = io_add_istream(ibc->input, dsync_ibc_stream_input, ibc);
+	io_set_pending(ibc->io);
+	ibc->input_compressed = TRUE;
+	return TRUE;
+}
+
 static bool
 dsync_ibc_stream_handshake(struct dsync_ibc_stream *ibc, const char *line)
 {
@@ -554,6 +623,16 @@ dsync_ibc_stream_handshake(struct dsync_ibc_stream *ibc, const char *line)
 			return FALSE;
 		ibc->handshake_received = TRUE;
 		ibc->last_recv_item = ITEM_HANDSHAKE;
+		if (ibc->remote_has_compression)
+			dsync_ibc_stream_compress_output(ibc);
+		return FALSE;
+	}
+	if (line[0] == COMPRESSION_CHR) {
+		/* the remote's supported compression algorithms */
+		if (ibc->compression_handler != NULL &&
+		    str_array_find(t_strsplit_spaces(line + 1, " "),
+				   ibc->compression_handler->name))
+			ibc->remote_has_compression = TRUE;
 		return FALSE;
 	}
 
@@ -595,7 +674,8 @@ dsync_ibc_stream_input_next(struct dsync_ibc_stream *ibc, enum item_type item,
 	do {
 		if (dsync_ibc_stream_next_line(ibc, &line) <= 0)
 			return DSYNC_IBC_RECV_RET_TRYAGAIN;
-	} while (!dsync_ibc_stream_handshake(ibc, line));
+	} while (!dsync_ibc_stream_handshake(ibc, line) ||
+		 dsync_ibc_stream_decompress_input(ibc, line));
 
 	ibc->last_recv_item = item;
 	ibc->last_recv_item_eol = FALSE;
@@ -1052,6 +1132,12 @@ dsync_ibc_stream_send_mailbox_tree_node(struct dsync_ibc *_ibc,
 		dsync_serializer_encode_add(encoder, "uid_next",
 					    dec2str(node->uid_next));
 	}
+	if (node->highest_modseq != 0) {
+		dsync_serializer_encode_add(encoder, "messages_count",
+					    dec2str(node->messages_count));
+		dsync_serializer_encode_add(encoder, "highest_modseq",
+					    dec2str(node->highest_modseq));
+	}
 	if (node->last_renamed_or_created != 0) {
 		dsync_serializer_encode_add(encoder, "last_renamed_or_created",
 					    dec2str(node->last_renamed_or_created));
@@ -1119,6 +1205,16 @@ dsync_ibc_stream_recv_mailbox_tree_node(struct dsync_ibc *_ibc,
 		dsync_ibc_input_error(ibc, decoder, "Invalid uid_next");
 		return DSYNC_IBC_RECV_RET_TRYAGAIN;
 	}
+	if (dsync_deserializer_decode_try(decoder, "messages_count", &value) &&
+	    str_to_uint32(value, &node->messages_count) < 0) {
+		dsync_ibc_input_error(ibc, decoder, "Invalid messages_count");
+		return DSYNC_IBC_RECV_RET_TRYAGAIN;
+	}
+	if (dsync_deserializer_decode_try(decoder, "highest_modseq", &value) &&
+	    str_to_uint64(value, &node->highest_modseq) < 0) {
+		dsync_ibc_input_error(ibc, decoder, "Invalid highest_modseq");
+		return DSYNC_IBC_RECV_RET_TRYAGAIN;
+	}
 	if (dsync_deserializer_decode_try(decoder, "last_renamed_or_created", &value) &&
 	    str_to_time(value, &node->last_renamed_or_created) < 0) {
 		dsync_ibc_input_error(ibc, decoder, "Invalid last_renamed_or_created");
@@ -2122,9 +2218,11 @@ static const struct dsync_ibc_vfuncs dsync_ibc_stream_vfuncs = {
 struct dsync_ibc *
 dsync_ibc_init_stream(struct istream *input, struct ostream *output,
 		      const char *name, const char *temp_path_prefix,
-		      unsigned int timeout_secs)
+		      unsigned int timeout_secs, const char *compression)
 {
 	struct dsync_ibc_stream *ibc;
+	const struct compression_handler *handler;
+	int ret;
 
 	ibc = i_new(struct dsync_ibc_stream, 1);
 	ibc->ibc.v = dsync_ibc_stream_vfuncs;
@@ -2136,6 +2234,18 @@ dsync_ibc_init_stream(struct istream *input, struct ostream *output,
 	ibc->temp_path_prefix = i_strdup(temp_path_prefix);
 	ibc->timeout_secs = timeout_secs;
 	ibc->ret_pool = pool_alloconly_create("ibc stream data", 2048);
+	if (compression != NULL && compression[0] != '\0') {
+		ret = compression_lookup_handler(compression, &handler);
+		if (ret > 0)
+			ibc->compression_handler = handler;
+		else if (ret == 0) {
+			i_warning("dsync(%s): Compression %s not supported "
+				  "- sending uncompressed", name, compression);
+		} else {
+			i_warning("dsync(%s): Unknown compression %s "
+				  "- sending uncompressed", name, compression);
+		}
+	}
 	dsync_ibc_stream_init(ibc);
 	return &ibc->ibc;
 }
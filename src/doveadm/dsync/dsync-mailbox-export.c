@@ -4,6 +4,7 @@
 #include "array.h"
 #include "hash.h"
 #include "istream.h"
+#include "seq-bitmap.h"
 #include "mail-index-modseq.h"
 #include "mail-storage-private.h"
 #include "mail-search-build.h"
@@ -35,7 +36,8 @@ struct dsync_mailbox_exporter {
 
 	/* GUID => instances */
 	HASH_TABLE(char *, struct dsync_mail_guid_instances *) export_guids;
-	ARRAY_TYPE(seq_range) requested_uids;
+	/* UIDs requested by the remote, possibly in random order */
+	struct seq_bitmap *requested_uids;
 	ARRAY_TYPE(seq_range) search_uids;
 
 	ARRAY_TYPE(seq_range) expunged_seqs;
@@ -259,7 +261,7 @@ export_add_mail_instance(struct dsync_mailbox_exporter *exporter,
 
 	if (exporter->auto_export_mails && !exporter->mails_have_guids) {
 		/* GUIDs not supported, mail is requested by UIDs */
-		seq_range_array_add(&exporter->requested_uids, change->uid);
+		(void)seq_bitmap_add(exporter->requested_uids, change->uid);
 		return;
 	}
 	if (*change->guid == '\0') {
@@ -534,7 +536,7 @@ dsync_mailbox_export_init(struct mailbox *box,
 	exporter->hashed_headers = hashed_headers;
 	exporter->event = event_create(parent_event);
 
-	p_array_init(&exporter->requested_uids, pool, 16);
+	exporter->requested_uids = seq_bitmap_create();
 	p_array_init(&exporter->search_uids, pool, 16);
 	hash_table_create(&exporter->export_guids, pool, 0, str_hash, strcmp);
 	p_array_init(&exporter->expunged_seqs, pool, 16);
@@ -730,9 +732,8 @@ dsync_mailbox_export_body_search_init(struct dsync_mailbox_exporter *exporter)
 	const char *const_guid;
 	enum mail_fetch_field wanted_fields;
 	struct dsync_mail_guid_instances *instances;
-	const struct seq_range *range;
-	unsigned int i, count;
-	uint32_t seq, seq1, seq2;
+	struct seq_bitmap_iter uid_iter;
+	uint32_t seq, seq1, seq2, uid1, uid2;
 
 	i_assert(exporter->search_ctx == NULL);
 
@@ -774,17 +775,16 @@ dsync_mailbox_export_body_search_init(struct dsync_mailbox_exporter *exporter)
 	hash_table_iterate_deinit(&iter);
 
 	/* add requested UIDs */
-	range = array_get(&exporter->requested_uids, &count);
-	for (i = 0; i < count; i++) {
-		mailbox_get_seq_range(exporter->box,
-				      range[i].seq1, range[i].seq2,
-				      &seq1, &seq2);
+	seq_bitmap_iter_init(&uid_iter, exporter->requested_uids);
+	while (seq_bitmap_iter_next_range(&uid_iter, &uid1, &uid2)) {
+		mailbox_get_seq_range(exporter->box, uid1, uid2, &seq1, &seq2);
 		seq_range_array_add_range(&sarg->value.seqset,
 					  seq1, seq2);
 	}
 	array_clear(&exporter->search_uids);
-	array_append_array(&exporter->search_uids, &exporter->requested_uids);
-	array_clear(&exporter->requested_uids);
+	seq_bitmap_to_seq_range(exporter->requested_uids,
+				&exporter->search_uids);
+	seq_bitmap_clear(exporter->requested_uids);
 
 	wanted_fields = MAIL_FETCH_GUID | MAIL_FETCH_SAVE_DATE;
 	if (!exporter->minimal_dmail_fill) {
@@ -860,7 +860,7 @@ void dsync_mailbox_export_want_mail(struct dsync_mailbox_exporter *exporter,
 
 	if (request->guid == NULL) {
 		i_assert(request->uid > 0);
-		seq_range_array_add(&exporter->requested_uids, request->uid);
+		(void)seq_bitmap_add(exporter->requested_uids, request->uid);
 		return;
 	}
 
@@ -947,6 +947,7 @@ int dsync_mailbox_export_deinit(struct dsync_mailbox_exporter **_exporter,
 	i_stream_unref(&exporter->attr.value_stream);
 	hash_table_destroy(&exporter->export_guids);
 	hash_table_destroy(&exporter->changes);
+	seq_bitmap_free(&exporter->requested_uids);
 
 	i_assert((exporter->error != NULL) == (exporter->mail_error != 0));
 
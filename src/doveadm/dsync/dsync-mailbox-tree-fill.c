@@ -51,6 +51,11 @@ dsync_mailbox_tree_add_exists_node(struct dsync_mailbox_tree *tree,
 	return 0;
 }
 
+/* These are all normally cached in the mailbox list index */
+#define DSYNC_MAILBOX_TREE_STATUS_ITEMS \
+	(STATUS_UIDVALIDITY | STATUS_UIDNEXT | STATUS_MESSAGES | \
+	 STATUS_HIGHESTMODSEQ)
+
 static int
 dsync_mailbox_tree_get_selectable(struct mailbox *box,
 				  struct mailbox_metadata *metadata_r,
@@ -59,7 +64,7 @@ dsync_mailbox_tree_get_selectable(struct mailbox *box,
 	/* try the fast path */
 	if (mailbox_get_metadata(box, MAILBOX_METADATA_GUID, metadata_r) < 0)
 		return -1;
-	if (mailbox_get_status(box, STATUS_UIDVALIDITY | STATUS_UIDNEXT, status_r) < 0)
+	if (mailbox_get_status(box, DSYNC_MAILBOX_TREE_STATUS_ITEMS, status_r) < 0)
 		return -1;
 
 	i_assert(!guid_128_is_empty(metadata_r->guid));
@@ -69,7 +74,7 @@ dsync_mailbox_tree_get_selectable(struct mailbox *box,
 	/* no UIDVALIDITY assigned yet. syncing a mailbox should add it. */
 	if (mailbox_sync(box, 0) < 0)
 		return -1;
-	if (mailbox_get_status(box, STATUS_UIDVALIDITY | STATUS_UIDNEXT, status_r) < 0)
+	if (mailbox_get_status(box, DSYNC_MAILBOX_TREE_STATUS_ITEMS, status_r) < 0)
 		return -1;
 	i_assert(status_r->uidvalidity != 0);
 	return 0;
@@ -148,6 +153,9 @@ static int dsync_mailbox_tree_add(struct dsync_mailbox_tree *tree,
 	       sizeof(node->mailbox_guid));
 	node->uid_validity = status.uidvalidity;
 	node->uid_next = status.uidnext;
+	node->messages_count = status.messages;
+	node->highest_modseq = status.nonpermanent_modseqs ? 0 :
+		status.highest_modseq;
 	return 0;
 }
 
@@ -161,6 +161,8 @@ void dsync_mailbox_node_copy_data(struct dsync_mailbox_node *dest,
 	       sizeof(dest->mailbox_guid));
 	dest->uid_validity = src->uid_validity;
 	dest->uid_next = src->uid_next;
+	dest->messages_count = src->messages_count;
+	dest->highest_modseq = src->highest_modseq;
 	dest->existence = src->existence;
 	dest->last_renamed_or_created = src->last_renamed_or_created;
 	dest->subscribed = src->subscribed;
@@ -439,6 +441,8 @@ dsync_mailbox_tree_dup_nodes(struct dsync_mailbox_tree *dest_tree,
 		       sizeof(node->mailbox_guid));
 		node->uid_validity = src->uid_validity;
 		node->uid_next = src->uid_next;
+		node->messages_count = src->messages_count;
+		node->highest_modseq = src->highest_modseq;
 		node->existence = src->existence;
 		node->last_renamed_or_created = src->last_renamed_or_created;
 		node->subscribed = src->subscribed;
@@ -45,6 +45,10 @@ struct dsync_mailbox_node {
 	guid_128_t mailbox_guid;
 	/* mailbox's UIDVALIDITY/UIDNEXT (may be 0 if not assigned yet) */
 	uint32_t uid_validity, uid_next;
+	/* mailbox's MESSAGES/HIGHESTMODSEQ. These are known only if
+	   highest_modseq != 0. */
+	uint32_t messages_count;
+	uint64_t highest_modseq;
 
 	/* existence of this mailbox/directory.
 	   doesn't affect subscription state. */
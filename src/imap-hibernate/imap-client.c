@@ -9,8 +9,8 @@
 #include "iostream.h"
 #include "istream.h"
 #include "ostream.h"
-#include "llist.h"
 #include "priorityq.h"
+#include "timer-wheel.h"
 #include "base64.h"
 #include "str.h"
 #include "strescape.h"
@@ -56,11 +56,14 @@ struct imap_client_notify {
 	struct io *io;
 };
 
+/* The client records and their strings are allocated from imap_clients_pool,
+   which is shared by all the hibernated clients. The clients are found by
+   their fd from imap_clients_by_fd, and their keepalives are in
+   keepalive_wheel, so a client has no per-client pool or timeout. */
 struct imap_client {
 	struct priorityq_item item;
+	struct timer_wheel_item keepalive_item;
 
-	struct imap_client *prev, *next;
-	pool_t pool;
 	struct event *event;
 	struct imap_client_state state;
 	ARRAY(struct imap_client_notify) notifys;
@@ -72,17 +75,27 @@ struct imap_client {
 	struct io *io;
 	struct istream *input;
 	struct ostream *output;
-	struct timeout *to_keepalive;
 	struct imap_master_connection *master_conn;
 	struct ioloop_context *ioloop_ctx;
 	const char *log_prefix;
+	unsigned int keepalive_interval_msecs;
 	unsigned int next_read_threshold;
 	bool bad_done, idle_done;
 	bool unhibernate_queued;
 	bool input_pending;
+	bool mem_size_counted;
 };
 
-static struct imap_client *imap_clients;
+static pool_t imap_clients_pool;
+/* fd => struct imap_client */
+static ARRAY(struct imap_client *) imap_clients_by_fd;
+static unsigned int imap_clients_count;
+static size_t imap_clients_mem_size;
+/* Keepalives of all the clients. The ticks are milliseconds. */
+static struct timer_wheel *keepalive_wheel;
+static uint64_t keepalive_wheel_last_tick;
+static struct timeout *to_keepalive;
+static uint64_t to_keepalive_tick;
 static struct priorityq *unhibernate_queue;
 static struct timeout *to_unhibernate;
 static const char imap_still_here_text[] = "* OK Still here\r\n";
@@ -448,7 +461,19 @@ static void imap_client_input_notify(struct imap_client *client)
 	imap_client_move_back(client);
 }
 
-static void keepalive_timeout(struct imap_client *client)
+static uint64_t imap_clients_keepalive_now(void);
+static void imap_clients_keepalive_schedule(uint64_t now_tick);
+
+static void
+imap_client_keepalive_add(struct imap_client *client, uint64_t now_tick)
+{
+	if (timer_wheel_item_is_added(&client->keepalive_item))
+		timer_wheel_remove(keepalive_wheel, &client->keepalive_item);
+	timer_wheel_add(keepalive_wheel, &client->keepalive_item,
+			now_tick + client->keepalive_interval_msecs);
+}
+
+static void imap_client_keepalive(struct imap_client *client, uint64_t now_tick)
 {
 	ssize_t ret;
 
@@ -466,22 +491,107 @@ static void keepalive_timeout(struct imap_client *client)
 	}
 	/* ostream buffer size is definitely large enough for this text */
 	i_assert((size_t)ret == strlen(imap_still_here_text));
-	imap_client_add_idle_keepalive_timeout(client);
+	imap_client_keepalive_add(client, now_tick);
 }
 
 static void imap_client_add_idle_keepalive_timeout(struct imap_client *client)
 {
-	unsigned int interval = client->state.imap_idle_notify_interval;
+	uint64_t now_tick;
+
+	if (client->keepalive_interval_msecs == 0)
+		return;
+
+	now_tick = imap_clients_keepalive_now();
+	imap_client_keepalive_add(client, now_tick);
+	imap_clients_keepalive_schedule(now_tick);
+}
+
+static void imap_clients_keepalive_timeout(void *context ATTR_UNUSED)
+{
+	struct timer_wheel_item *item;
+	struct ioloop_context *ctx;
+	uint64_t now_tick = imap_clients_keepalive_now();
+
+	timeout_remove(&to_keepalive);
+	while ((item = timer_wheel_pop_expired(keepalive_wheel,
+					       now_tick)) != NULL) {
+		struct imap_client *client =
+			container_of(item, struct imap_client, keepalive_item);
+
+		io_loop_context_switch(client->ioloop_ctx);
+		imap_client_keepalive(client, now_tick);
+	}
+	/* the client may have been destroyed already, so don't leave its
+	   context active while scheduling the next timeout */
+	ctx = io_loop_get_current_context(current_ioloop);
+	if (ctx != NULL)
+		io_loop_context_deactivate(ctx);
+	imap_clients_keepalive_schedule(now_tick);
+}
+
+static void imap_clients_keepalive_schedule(uint64_t now_tick)
+{
+	struct ioloop_context *ctx;
+	uint64_t next_tick = timer_wheel_get_next_tick(keepalive_wheel);
 
-	if (interval == 0)
+	if (next_tick == (uint64_t)-1) {
+		timeout_remove(&to_keepalive);
+		return;
+	}
+	if (to_keepalive != NULL && to_keepalive_tick <= next_tick) {
+		/* the timeout is run early enough. if there's nothing to do
+		   yet, it just gets rescheduled. */
 		return;
+	}
 
-	interval = imap_keepalive_interval_msecs(client->state.username,
-						 &client->state.remote_ip,
-						 interval);
+	/* The timeout is shared by all the clients, so it must not be
+	   attached to the ioloop context of the currently active client. */
+	ctx = io_loop_get_current_context(current_ioloop);
+	if (ctx != NULL) {
+		io_loop_context_ref(ctx);
+		io_loop_context_deactivate(ctx);
+	}
+	timeout_remove(&to_keepalive);
+	to_keepalive_tick = next_tick;
+	to_keepalive = timeout_add(next_tick <= now_tick ? 0 :
+				   next_tick - now_tick,
+				   imap_clients_keepalive_timeout, NULL);
+	if (ctx != NULL) {
+		io_loop_context_activate(ctx);
+		io_loop_context_unref(&ctx);
+	}
+}
+
+static uint64_t imap_clients_keepalive_now(void)
+{
+	struct timer_wheel_item *item;
+	ARRAY(struct imap_client *) clients;
+	struct imap_client *client;
+	uint64_t now_tick = (uint64_t)ioloop_timeval.tv_sec * 1000 +
+		ioloop_timeval.tv_usec / 1000;
+
+	if (now_tick >= keepalive_wheel_last_tick) {
+		keepalive_wheel_last_tick = now_tick;
+		return now_tick;
+	}
 
-	timeout_remove(&client->to_keepalive);
-	client->to_keepalive = timeout_add(interval, keepalive_timeout, client);
+	/* Time moved backwards. The wheel's time can't be moved backwards,
+	   so recreate it and restart all the keepalive intervals. */
+	T_BEGIN {
+		t_array_init(&clients, timer_wheel_count(keepalive_wheel) + 1);
+		while ((item = timer_wheel_pop_any(keepalive_wheel)) != NULL) {
+			client = container_of(item, struct imap_client,
+					      keepalive_item);
+			array_push_back(&clients, &client);
+		}
+		timer_wheel_deinit(&keepalive_wheel);
+		keepalive_wheel = timer_wheel_init(now_tick);
+		array_foreach_elem(&clients, client)
+			imap_client_keepalive_add(client, now_tick);
+	} T_END;
+	timeout_remove(&to_keepalive);
+	keepalive_wheel_last_tick = now_tick;
+	return now_tick;
 }
 
 static const struct var_expand_table *
@@ -563,6 +673,33 @@ static void imap_client_io_deactivate_user(struct imap_client *client ATTR_UNUSE
 	i_set_failure_prefix("imap-hibernate: ");
 }
 
+static struct imap_client *imap_client_lookup_fd(int fd)
+{
+	i_assert(fd >= 0);
+
+	if ((unsigned int)fd >= array_count(&imap_clients_by_fd))
+		return NULL;
+	return array_idx_elem(&imap_clients_by_fd, fd);
+}
+
+static size_t imap_client_strsize(const char *str)
+{
+	return str == NULL ? 0 : strlen(str) + 1;
+}
+
+static size_t imap_client_mem_size(const struct imap_client *client)
+{
+	return sizeof(*client) +
+		sizeof(struct imap_client_notify) *
+			array_count(&client->notifys) +
+		imap_client_strsize(client->state.username) +
+		imap_client_strsize(client->state.session_id) +
+		imap_client_strsize(client->state.userdb_fields) +
+		imap_client_strsize(client->state.stats) +
+		imap_client_strsize(client->log_prefix) +
+		client->state.state_size;
+}
+
 struct imap_client *
 imap_client_create(int fd, const struct imap_client_state *state)
 {
@@ -571,7 +708,7 @@ imap_client_create(int fd, const struct imap_client_state *state)
 		{ NULL, NULL }
 	};
 	struct imap_client *client;
-	pool_t pool = pool_alloconly_create("imap client", 256);
+	pool_t pool = imap_clients_pool;
 	void *statebuf;
 	const char *error;
 
@@ -581,7 +718,7 @@ imap_client_create(int fd, const struct imap_client_state *state)
 	fd_set_nonblock(fd, TRUE); /* it should already be, but be sure */
 
 	client = p_new(pool, struct imap_client, 1);
-	client->pool = pool;
+	timer_wheel_item_init(&client->keepalive_item);
 	client->fd = fd;
 	client->input = i_stream_create_fd(fd, IMAP_MAX_INBUF);
 	client->output = o_stream_create_fd(fd, IMAP_MAX_OUTBUF);
@@ -591,6 +728,12 @@ imap_client_create(int fd, const struct imap_client_state *state)
 	client->state.session_id = p_strdup(pool, state->session_id);
 	client->state.userdb_fields = p_strdup(pool, state->userdb_fields);
 	client->state.stats = p_strdup(pool, state->stats);
+	if (state->imap_idle_notify_interval > 0) {
+		client->keepalive_interval_msecs =
+			imap_keepalive_interval_msecs(state->username,
+				&state->remote_ip,
+				state->imap_idle_notify_interval);
+	}
 
 	client->event = event_create(NULL);
 	event_add_category(client->event, &event_category_imap_hibernate);
@@ -638,11 +781,19 @@ imap_client_create(int fd, const struct imap_client_state *state)
 					 TRUE, client->state.anvil_conn_guid))
 		client->state.anvil_sent = TRUE;
 
-	p_array_init(&client->notifys, pool, 2);
-	DLLIST_PREPEND(&imap_clients, client);
+	p_array_init(&client->notifys, pool, 1);
+	i_assert(imap_client_lookup_fd(fd) == NULL);
+	array_idx_set(&imap_clients_by_fd, fd, &client);
 	return client;
 }
 
+static void imap_clients_pool_free(const void *mem)
+{
+	void *ptr = (void *)mem;
+
+	p_free(imap_clients_pool, ptr);
+}
+
 static void imap_client_stop_notify_listening(struct imap_client *client)
 {
 	struct imap_client_notify *notify;
@@ -660,7 +811,8 @@ static void imap_client_stop(struct imap_client *client)
 		client->unhibernate_queued = FALSE;
 	}
 	io_remove(&client->io);
-	timeout_remove(&client->to_keepalive);
+	if (timer_wheel_item_is_added(&client->keepalive_item))
+		timer_wheel_remove(keepalive_wheel, &client->keepalive_item);
 	imap_client_stop_notify_listening(client);
 }
 
@@ -700,13 +852,26 @@ void imap_client_destroy(struct imap_client **_client, const char *reason)
 	if (client->state.tag != NULL)
 		i_free(client->state.tag);
 
-	DLLIST_REMOVE(&imap_clients, client);
+	i_assert(imap_client_lookup_fd(client->fd) == client);
+	array_idx_clear(&imap_clients_by_fd, client->fd);
 	imap_client_stop(client);
 	i_stream_destroy(&client->input);
 	o_stream_destroy(&client->output);
 	i_close_fd(&client->fd);
 	event_unref(&client->event);
-	pool_unref(&client->pool);
+	if (client->mem_size_counted) {
+		imap_clients_count--;
+		imap_clients_mem_size -= imap_client_mem_size(client);
+	}
+
+	array_free(&client->notifys);
+	imap_clients_pool_free(client->state.username);
+	imap_clients_pool_free(client->state.session_id);
+	imap_clients_pool_free(client->state.userdb_fields);
+	imap_clients_pool_free(client->state.stats);
+	imap_clients_pool_free(client->state.state);
+	imap_clients_pool_free(client->log_prefix);
+	p_free(imap_clients_pool, client);
 
 	master_service_client_connection_destroyed(master_service);
 }
@@ -742,6 +907,17 @@ void imap_client_create_finish(struct imap_client *client)
 		notify->io = io_add(notify->fd, IO_READ,
 				    imap_client_input_notify, client);
 	}
+
+	/* the client's memory usage doesn't grow after this */
+	size_t mem_size = imap_client_mem_size(client);
+	client->mem_size_counted = TRUE;
+	imap_clients_count++;
+	imap_clients_mem_size += mem_size;
+	e_debug(client->event, "Hibernated client uses %zu bytes of memory "
+		"(%u clients use %zu bytes on average, "
+		"%zu bytes allocated from the shared pool)", mem_size,
+		imap_clients_count, imap_clients_mem_size / imap_clients_count,
+		pool_slab_get_total_used_size(imap_clients_pool));
 }
 
 static int client_unhibernate_cmp(const void *p1, const void *p2)
@@ -787,12 +963,12 @@ static void imap_client_kick(struct imap_client *client)
 
 unsigned int imap_clients_kick(const char *user, const guid_128_t conn_guid)
 {
-	struct imap_client *client, *next;
+	struct imap_client *client;
 	unsigned int count = 0;
 
-	for (client = imap_clients; client != NULL; client = next) {
-		next = client->next;
-		if (strcmp(client->state.username, user) == 0 &&
+	array_foreach_elem(&imap_clients_by_fd, client) {
+		if (client != NULL &&
+		    strcmp(client->state.username, user) == 0 &&
 		    (guid_128_is_empty(conn_guid) ||
 		     guid_128_cmp(client->state.anvil_conn_guid, conn_guid) == 0))
 			imap_client_kick(client);
@@ -802,14 +978,26 @@ unsigned int imap_clients_kick(const char *user, const guid_128_t conn_guid)
 
 void imap_clients_init(void)
 {
+	imap_clients_pool = pool_slab_create("imap clients");
+	i_array_init(&imap_clients_by_fd, 128);
 	unhibernate_queue = priorityq_init(client_unhibernate_cmp, 64);
+	keepalive_wheel_last_tick = imap_clients_keepalive_now();
+	keepalive_wheel = timer_wheel_init(keepalive_wheel_last_tick);
 }
 
 void imap_clients_deinit(void)
 {
-	while (imap_clients != NULL)
-		imap_client_kick(imap_clients);
+	struct imap_client *client;
+
+	array_foreach_elem(&imap_clients_by_fd, client) {
+		if (client != NULL)
+			imap_client_kick(client);
+	}
 
 	timeout_remove(&to_unhibernate);
+	timeout_remove(&to_keepalive);
+	timer_wheel_deinit(&keepalive_wheel);
 	priorityq_deinit(&unhibernate_queue);
+	array_free(&imap_clients_by_fd);
+	pool_unref(&imap_clients_pool);
 }
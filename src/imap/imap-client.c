@@ -18,6 +18,7 @@
 #include "imap-util.h"
 #include "imap-urlauth.h"
 #include "mail-error.h"
+#include "mail-storage-private.h"
 #include "mail-namespace.h"
 #include "mail-storage-service.h"
 #include "mail-autoexpunge.h"
@@ -546,6 +547,7 @@ static void client_default_destroy(struct client *client, const char *reason)
 		array_free(&client->search_saved_uidset);
 	if (array_is_created(&client->search_updates))
 		array_free(&client->search_updates);
+	imap_search_cache_free(&client->search_cache);
 	pool_unref(&client->command_pool);
 	mail_storage_service_user_unref(&client->service_user);
 
@@ -1025,8 +1027,25 @@ void client_command_free(struct client_command_context **_cmd)
 	event_add_int(cmd->event, "bytes_in", cmd->stats.bytes_in);
 	event_add_int(cmd->event, "bytes_out", cmd->stats.bytes_out);
 
-	e_debug(cmd->event, "Command finished: %s %s", cmd->name,
-		cmd->human_args != NULL ? cmd->human_args : "");
+	if (client->mailbox != NULL) {
+		event_add_str(cmd->event, "mailbox_driver",
+			      mailbox_get_storage(client->mailbox)->name);
+	}
+
+	if (client->set->imap_command_slow_log_threshold > 0 &&
+	    cmd->stats.running_usecs / 1000 >=
+	    client->set->imap_command_slow_log_threshold) {
+		e_warning(cmd->event, "Slow command: %s %s "
+			  "(running %"PRIu64" ms, lock wait %"PRIu64" ms, "
+			  "in=%"PRIu64" out=%"PRIu64")", cmd->name,
+			  cmd->human_args != NULL ? cmd->human_args : "",
+			  cmd->stats.running_usecs / 1000,
+			  cmd->stats.lock_wait_usecs / 1000,
+			  cmd->stats.bytes_in, cmd->stats.bytes_out);
+	} else {
+		e_debug(cmd->event, "Command finished: %s %s", cmd->name,
+			cmd->human_args != NULL ? cmd->human_args : "");
+	}
 	event_unref(&cmd->event);
 	event_unref(&cmd->global_event);
 
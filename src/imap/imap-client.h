@@ -209,6 +209,8 @@ struct client {
 	ARRAY_TYPE(seq_range) search_saved_uidset;
 	/* SEARCH=CONTEXT extension: Searches that get updated */
 	ARRAY(struct imap_search_update) search_updates;
+	/* Latest UID SEARCH/SORT result for paging with PARTIAL */
+	struct imap_search_cache *search_cache;
 	/* NOTIFY extension */
 	struct imap_notify_context *notify_ctx;
 	uint32_t notify_uidnext;
@@ -436,6 +436,22 @@ static int imap_fetch_flush_buffer(struct imap_fetch_context *ctx)
 	return 0;
 }
 
+static int imap_fetch_flush_line(struct imap_fetch_context *ctx)
+{
+	string_t *str = ctx->state.cur_str;
+
+	/* replace the extra space at the end with the end of the line, so
+	   the whole buffered line gets sent at once */
+	if (str_data(str)[str_len(str)-1] == ' ')
+		str_truncate(str, str_len(str)-1);
+	str_append(str, ")\r\n");
+
+	if (o_stream_send(ctx->client->output, str_data(str), str_len(str)) < 0)
+		return -1;
+	str_truncate(str, 0);
+	return 0;
+}
+
 static int imap_fetch_send_nil_reply(struct imap_fetch_context *ctx)
 {
 	const struct imap_fetch_context_handler *handler;
@@ -492,6 +508,7 @@ static int imap_fetch_more_int(struct imap_fetch_context *ctx, bool cancel)
 	struct client *client = ctx->client;
 	const struct imap_fetch_context_handler *handlers;
 	unsigned int count;
+	char num[MAX_INT_STRLEN];
 	int ret;
 
 	if (state->cont_handler != NULL) {
@@ -537,8 +554,10 @@ static int imap_fetch_more_int(struct imap_fetch_context *ctx, bool cancel)
 						 &state->cur_mail))
 				break;
 
-			str_printfa(state->cur_str, "* %u FETCH (",
-				    state->cur_mail->seq);
+			str_append(state->cur_str, "* ");
+			str_append(state->cur_str,
+				   dec2str_buf(num, state->cur_mail->seq));
+			str_append(state->cur_str, " FETCH (");
 			ctx->fetched_mails_count++;
 			state->cur_first = TRUE;
 			state->cur_str_prefix_size = str_len(state->cur_str);
@@ -590,12 +609,11 @@ static int imap_fetch_more_int(struct imap_fetch_context *ctx, bool cancel)
 		    (state->line_partial ||
 		     str_len(state->cur_str) != state->cur_str_prefix_size)) {
 			/* no non-buffered handlers */
-			if (imap_fetch_flush_buffer(ctx) < 0)
+			if (imap_fetch_flush_line(ctx) < 0)
 				return -1;
-		}
-
-		if (state->line_partial)
+		} else if (state->line_partial) {
 			o_stream_nsend(client->output, ")\r\n", 3);
+		}
 		client->last_output = ioloop_time;
 
 		state->cur_mail = NULL;
@@ -767,21 +785,27 @@ static bool fetch_bodystructure_init(struct imap_fetch_init_context *ctx)
 static int fetch_envelope(struct imap_fetch_context *ctx, struct mail *mail,
 			  void *context ATTR_UNUSED)
 {
+	struct const_iovec iov[3];
 	const char *envelope;
 
 	if (mail_get_special(mail, MAIL_FETCH_IMAP_ENVELOPE, &envelope) < 0)
 		return -1;
 
-	if (ctx->state.cur_first)
+	/* the cached envelope is already in IMAP format - send it with
+	   a single call */
+	if (ctx->state.cur_first) {
 		ctx->state.cur_first = FALSE;
-	else {
-		if (o_stream_send(ctx->client->output, " ", 1) < 0)
-			return -1;
+		iov[0].iov_base = "ENVELOPE (";
+		iov[0].iov_len = 10;
+	} else {
+		iov[0].iov_base = " ENVELOPE (";
+		iov[0].iov_len = 11;
 	}
-
-	if (o_stream_send(ctx->client->output, "ENVELOPE (", 10) < 0 ||
-	    o_stream_send_str(ctx->client->output, envelope) < 0 ||
-	    o_stream_send(ctx->client->output, ")", 1) < 0)
+	iov[1].iov_base = envelope;
+	iov[1].iov_len = strlen(envelope);
+	iov[2].iov_base = ")";
+	iov[2].iov_len = 1;
+	if (o_stream_sendv(ctx->client->output, iov, N_ELEMENTS(iov)) < 0)
 		return -1;
 	return 1;
 }
@@ -855,11 +879,14 @@ static int fetch_modseq(struct imap_fetch_context *ctx, struct mail *mail,
 			void *context ATTR_UNUSED)
 {
 	uint64_t modseq;
+	char num[MAX_INT_STRLEN];
 
 	modseq = mail_get_modseq(mail);
 	if (ctx->client->highest_fetch_modseq < modseq)
 		ctx->client->highest_fetch_modseq = modseq;
-	str_printfa(ctx->state.cur_str, "MODSEQ (%"PRIu64") ", modseq);
+	str_append(ctx->state.cur_str, "MODSEQ (");
+	str_append(ctx->state.cur_str, dec2str_buf(num, modseq));
+	str_append(ctx->state.cur_str, ") ");
 	return 1;
 }
 
@@ -878,7 +905,11 @@ bool imap_fetch_modseq_init(struct imap_fetch_init_context *ctx)
 static int fetch_uid(struct imap_fetch_context *ctx, struct mail *mail,
 		     void *context ATTR_UNUSED)
 {
-	str_printfa(ctx->state.cur_str, "UID %u ", mail->uid);
+	char num[MAX_INT_STRLEN];
+
+	str_append(ctx->state.cur_str, "UID ");
+	str_append(ctx->state.cur_str, dec2str_buf(num, mail->uid));
+	str_append_c(ctx->state.cur_str, ' ');
 	return 1;
 }
 
@@ -15,6 +15,8 @@
 #include "imap-search-args.h"
 #include "imap-search.h"
 
+/* Don't cache search results larger than this many messages */
+#define IMAP_SEARCH_CACHE_MAX_IDS 500000
 
 static int imap_search_deinit(struct imap_search_context *ctx);
 
@@ -391,13 +393,21 @@ static bool cmd_search_more(struct client_command_context *cmd)
 		return TRUE;
 	}
 
-	while (mailbox_search_next_nonblock(ctx->search_ctx,
+	tryagain = FALSE;
+	while (ctx->search_ctx != NULL &&
+	       mailbox_search_next_nonblock(ctx->search_ctx,
 					    &mail, &tryagain)) {
 		id = cmd->uid ? mail->uid : mail->seq;
 		ctx->result_count++;
 
 		ctx->max_seq = mail->seq;
 		ctx->max_uid = mail->uid;
+		if (ctx->cache != NULL) {
+			if (ctx->result_count <= IMAP_SEARCH_CACHE_MAX_IDS)
+				array_push_back(&ctx->cache->ids, &id);
+			else
+				imap_search_cache_free(&ctx->cache);
+		}
 		if (HAS_ANY_BITS(opts, SEARCH_RETURN_MIN) && ctx->min_id == 0) {
 			/* MIN not set yet */
 			ctx->min_id = id;
@@ -452,7 +462,8 @@ static bool cmd_search_more(struct client_command_context *cmd)
 		mail_free(&mail);
 	}
 
-	lost_data = mailbox_search_seen_lost_data(ctx->search_ctx);
+	lost_data = ctx->search_ctx != NULL &&
+		mailbox_search_seen_lost_data(ctx->search_ctx);
 	if (imap_search_deinit(ctx) < 0) {
 		client_send_box_error(cmd, cmd->client->mailbox);
 		return TRUE;
@@ -516,6 +527,124 @@ int cmd_search_parse_return_if_found(struct imap_search_context *ctx,
 	return 1;
 }
 
+static bool
+imap_search_cache_get_status(struct mailbox *box,
+			     struct imap_search_cache *cache)
+{
+	struct mailbox_status status;
+
+	mailbox_get_open_status(box, STATUS_UIDVALIDITY | STATUS_MESSAGES |
+				STATUS_HIGHESTMODSEQ |
+				STATUS_HIGHESTPVTMODSEQ, &status);
+	if (status.no_modseq_tracking || status.nonpermanent_modseqs) {
+		/* can't notice flag changes */
+		return FALSE;
+	}
+	cache->uidvalidity = status.uidvalidity;
+	cache->messages = status.messages;
+	cache->highest_modseq = status.highest_modseq;
+	cache->highest_pvt_modseq = status.highest_pvt_modseq;
+	return TRUE;
+}
+
+static bool
+imap_search_cache_state_equals(const struct imap_search_cache *cache1,
+			       const struct imap_search_cache *cache2)
+{
+	return cache1->uidvalidity == cache2->uidvalidity &&
+		cache1->messages == cache2->messages &&
+		cache1->highest_modseq == cache2->highest_modseq &&
+		cache1->highest_pvt_modseq == cache2->highest_pvt_modseq;
+}
+
+static void
+imap_search_cache_init(struct imap_search_context *ctx,
+		       struct mail_search_args *sargs,
+		       const enum mail_sort_type *sort_program)
+{
+	enum search_return_options opts = ctx->return_options;
+	struct imap_search_cache *cache;
+	const char *vname, *error;
+	string_t *key;
+	unsigned int i;
+
+	/* Only the plain UID SEARCH/SORT RETURN (PARTIAL ..) paging that
+	   webmails use is cached. The other return options would need more
+	   than the UIDs to be remembered. */
+	if (!ctx->cmd->uid || ctx->have_seqsets ||
+	    (opts & SEARCH_RETURN_PARTIAL) == 0 ||
+	    (opts & ~(SEARCH_RETURN_ESEARCH | SEARCH_RETURN_PARTIAL |
+		      SEARCH_RETURN_COUNT | SEARCH_RETURN_MIN |
+		      SEARCH_RETURN_MAX)) != 0)
+		return;
+
+	vname = mailbox_get_vname(ctx->box);
+	key = t_str_new(128);
+	str_printfa(key, "%zu:%s ", strlen(vname), vname);
+	if (sort_program != NULL) {
+		for (i = 0; sort_program[i] != MAIL_SORT_END; i++)
+			str_printfa(key, "%x,", sort_program[i]);
+	}
+	str_append_c(key, ' ');
+	if (!mail_search_args_to_imap(key, sargs->args, &error))
+		return;
+	if (strstr(str_c(key), "OLDER ") != NULL ||
+	    strstr(str_c(key), "YOUNGER ") != NULL) {
+		/* relative dates may match differently without any
+		   changes to the mailbox */
+		return;
+	}
+
+	cache = i_new(struct imap_search_cache, 1);
+	if (!imap_search_cache_get_status(ctx->box, cache)) {
+		i_free(cache);
+		return;
+	}
+	cache->key = i_strdup(str_c(key));
+	i_array_init(&cache->ids, 128);
+	ctx->cache = cache;
+}
+
+static bool imap_search_cache_lookup(struct imap_search_context *ctx)
+{
+	const struct imap_search_cache *cache = ctx->cmd->client->search_cache;
+	const uint32_t *ids;
+	unsigned int i, count;
+
+	if (cache == NULL || strcmp(cache->key, ctx->cache->key) != 0 ||
+	    !imap_search_cache_state_equals(cache, ctx->cache))
+		return FALSE;
+
+	ids = array_get(&cache->ids, &count);
+	ctx->result_count = count;
+	if (count > 0) {
+		ctx->min_id = ids[0];
+		ctx->max_seq = cache->max_seq;
+		ctx->max_uid = ids[count-1];
+	}
+	for (i = ctx->partial1; i <= ctx->partial2 && i <= count; i++)
+		search_add_result_id(ctx, ids[i-1]);
+	return TRUE;
+}
+
+static void imap_search_cache_update(struct imap_search_context *ctx)
+{
+	struct client *client = ctx->cmd->client;
+	struct imap_search_cache status;
+
+	i_zero(&status);
+	if (!imap_search_cache_get_status(ctx->box, &status) ||
+	    !imap_search_cache_state_equals(&status, ctx->cache)) {
+		/* mailbox changed while searching */
+		imap_search_cache_free(&ctx->cache);
+		return;
+	}
+	ctx->cache->max_seq = ctx->max_seq;
+	imap_search_cache_free(&client->search_cache);
+	client->search_cache = ctx->cache;
+	ctx->cache = NULL;
+}
+
 bool imap_search_start(struct imap_search_context *ctx,
 		       struct mail_search_args *sargs,
 		       const enum mail_sort_type *sort_program)
@@ -533,10 +662,18 @@ bool imap_search_start(struct imap_search_context *ctx,
 	ctx->trans = mailbox_transaction_begin(ctx->box, 0,
 					       imap_client_command_get_reason(cmd));
 	ctx->sargs = sargs;
-	ctx->search_ctx =
-		mailbox_search_init(ctx->trans, sargs, sort_program, 0, NULL);
 	ctx->sorting = sort_program != NULL;
 	i_array_init(&ctx->result, 128);
+	imap_search_cache_init(ctx, sargs, sort_program);
+	if (ctx->cache != NULL && imap_search_cache_lookup(ctx)) {
+		/* answered from the cached result of a previous search.
+		   imap_search_deinit() still deinitializes the args. */
+		imap_search_cache_free(&ctx->cache);
+		mail_search_args_init(sargs, ctx->box, FALSE, NULL);
+	} else {
+		ctx->search_ctx = mailbox_search_init(ctx->trans, sargs,
+						      sort_program, 0, NULL);
+	}
 	if ((ctx->return_options & SEARCH_RETURN_UPDATE) != 0)
 		imap_search_result_save(ctx);
 	else {
@@ -563,9 +700,17 @@ static int imap_search_deinit(struct imap_search_context *ctx)
 {
 	int ret = 0;
 
-	if (mailbox_search_deinit(&ctx->search_ctx) < 0)
+	if (ctx->search_ctx != NULL &&
+	    mailbox_search_deinit(&ctx->search_ctx) < 0)
 		ret = -1;
 
+	if (ctx->cache != NULL) {
+		if (ret == 0 && !ctx->cmd->cancel)
+			imap_search_cache_update(ctx);
+		else
+			imap_search_cache_free(&ctx->cache);
+	}
+
 	/* Send the result also after failing. It might have something useful,
 	   even though it didn't fully succeed. The client should be able to
 	   realize that there was some failure because NO is returned. */
@@ -601,6 +746,19 @@ void imap_search_context_free(struct imap_search_context *ctx)
 	}
 }
 
+void imap_search_cache_free(struct imap_search_cache **_cache)
+{
+	struct imap_search_cache *cache = *_cache;
+
+	if (cache == NULL)
+		return;
+	*_cache = NULL;
+
+	array_free(&cache->ids);
+	i_free(cache->key);
+	i_free(cache);
+}
+
 void imap_search_update_free(struct imap_search_update *update)
 {
 	if (update->fetch_ctx != NULL) {
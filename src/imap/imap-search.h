@@ -21,6 +21,15 @@ enum search_return_options {
 	 SEARCH_RETURN_UPDATE | SEARCH_RETURN_RELEVANCY)
 };
 
+/* Full result of the latest cacheable UID SEARCH/SORT, used to answer
+   repeated PARTIAL requests while the mailbox stays unchanged. */
+struct imap_search_cache {
+	char *key;
+	uint32_t uidvalidity, messages, max_seq;
+	uint64_t highest_modseq, highest_pvt_modseq;
+	ARRAY(uint32_t) ids;
+};
+
 struct imap_search_context {
 	struct client_command_context *cmd;
 	struct mailbox *box;
@@ -44,6 +53,10 @@ struct imap_search_context {
 
 	uint64_t highest_seen_modseq;
 
+	/* Result being collected for client->search_cache, or NULL if this
+	   search can't be cached. */
+	struct imap_search_cache *cache;
+
 	bool have_seqsets:1;
 	bool have_modseqs:1;
 	bool sorting:1;
@@ -57,5 +70,6 @@ bool imap_search_start(struct imap_search_context *ctx,
 		       struct mail_search_args *sargs,
 		       const enum mail_sort_type *sort_program) ATTR_NULL(3);
 void imap_search_update_free(struct imap_search_update *update);
+void imap_search_cache_free(struct imap_search_cache **cache);
 
 #endif
@@ -99,6 +99,7 @@ static const struct setting_define imap_setting_defines[] = {
 	DEF(BOOL, imap_metadata),
 	DEF(BOOL, imap_literal_minus),
 	DEF(TIME, imap_hibernate_timeout),
+	DEF(TIME_MSECS, imap_command_slow_log_threshold),
 
 	DEF(STR, imap_urlauth_host),
 	DEF(IN_PORT, imap_urlauth_port),
@@ -127,6 +128,7 @@ static const struct imap_settings imap_default_settings = {
 	.imap_metadata = FALSE,
 	.imap_literal_minus = FALSE,
 	.imap_hibernate_timeout = 0,
+	.imap_command_slow_log_threshold = 0,
 
 	.imap_urlauth_host = "",
 	.imap_urlauth_port = 143
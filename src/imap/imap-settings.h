@@ -35,6 +35,7 @@ struct imap_settings {
 	bool imap_metadata;
 	bool imap_literal_minus;
 	unsigned int imap_hibernate_timeout;
+	unsigned int imap_command_slow_log_threshold;
 
 	/* imap urlauth: */
 	const char *imap_urlauth_host;
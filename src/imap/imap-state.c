@@ -141,41 +141,45 @@ int imap_state_import_external(struct client *client,
 	return imap_state_import(client, FALSE, data, size, error_r);
 }
 
-static int
-imap_state_export_mailbox_mails(buffer_t *dest, struct mailbox *box,
-				const char **error_r)
+static void
+imap_state_get_uids(struct mailbox *box, uint32_t messages_count,
+		    ARRAY_TYPE(seq_range) *uids)
 {
-	struct mailbox_transaction_context *trans;
-	struct mail_search_args *search_args;
-	struct mail_search_context *search_ctx;
-	struct mail *mail;
-	ARRAY_TYPE(seq_range) recent_uids;
-	uint32_t crc = 0;
-	int ret = 1;
+	ARRAY_TYPE(seq_range) seqs;
 
-	search_args = mail_search_build_init();
-	mail_search_build_add_all(search_args);
+	if (messages_count == 0)
+		return;
 
-	trans = mailbox_transaction_begin(box, 0,
-				"unhibernate imap_state_export_mailbox_mails");
-	search_ctx = mailbox_search_init(trans, search_args, NULL, 0, NULL);
-	mail_search_args_unref(&search_args);
+	/* look up the UIDs directly from the index instead of searching
+	   through mail objects - this is done for every (un)hibernation */
+	t_array_init(&seqs, 1);
+	seq_range_array_add_range(&seqs, 1, messages_count);
+	mailbox_get_uid_range(box, &seqs, uids);
+}
+
+static void
+imap_state_export_mailbox_mails(buffer_t *dest, struct mailbox *box,
+				uint32_t messages_count)
+{
+	ARRAY_TYPE(seq_range) uids, recent_uids;
+	const struct seq_range *range;
+	uint32_t uid, crc = 0;
 
+	t_array_init(&uids, 64);
 	t_array_init(&recent_uids, 8);
-	while (mailbox_search_next(search_ctx, &mail)) {
-		crc = crc32_data_more(crc, &mail->uid, sizeof(mail->uid));
-		if ((mail_get_flags(mail) & MAIL_RECENT) != 0)
-			seq_range_array_add(&recent_uids, mail->uid);
-	}
-	if (mailbox_search_deinit(&search_ctx) < 0) {
-		*error_r = mailbox_get_last_internal_error(box, NULL);
-		ret = -1;
+	imap_state_get_uids(box, messages_count, &uids);
+	array_foreach(&uids, range) {
+		for (uid = range->seq1;; uid++) {
+			crc = crc32_data_more(crc, &uid, sizeof(uid));
+			if (mailbox_recent_flags_have_uid(box, uid))
+				seq_range_array_add(&recent_uids, uid);
+			if (uid == range->seq2)
+				break;
+		}
 	}
-	(void)mailbox_transaction_commit(&trans);
 
 	numpack_encode(dest, crc);
 	export_seq_range(dest, &recent_uids);
-	return ret;
 }
 
 static uint32_t
@@ -235,7 +239,8 @@ imap_state_export_mailbox(buffer_t *dest, struct client *client,
 	/* we're now basically done, but just in case there's a bug add a
 	   checksum of the currently existing UIDs and verify it when
 	   importing. this also writes the list of recent UIDs. */
-	return imap_state_export_mailbox_mails(dest, box, error_r);
+	imap_state_export_mailbox_mails(dest, box, status.messages);
+	return 1;
 }
 
 int imap_state_export_base(struct client *client, bool internal,
@@ -309,18 +314,13 @@ import_send_expunges(struct client *client,
 		     unsigned int *expunge_count_r,
 		     const char **error_r)
 {
-	struct mailbox_transaction_context *trans;
-	struct mail_search_args *search_args;
-	struct mail_search_context *search_ctx;
-	struct mail *mail;
-	uint32_t crc = 0, seq, expunged_uid;
-	ARRAY_TYPE(seq_range) uids_filter, expunged_uids;
+	uint32_t crc = 0, seq, uid, expunged_uid;
+	ARRAY_TYPE(seq_range) uids_filter, uids, expunged_uids;
 	ARRAY_TYPE(uint32_t) expunged_seqs;
-	struct seq_range_iter iter;
+	struct seq_range_iter iter, uid_iter;
 	const uint32_t *seqs;
-	unsigned int i, expunge_count, n = 0;
+	unsigned int i, expunge_count, n = 0, uid_n = 0;
 	string_t *str;
-	int ret = 0;
 
 	*expunge_count_r = 0;
 
@@ -348,19 +348,15 @@ import_send_expunges(struct client *client,
 	}
 	seq_range_array_iter_init(&iter, &expunged_uids);
 
-	search_args = mail_search_build_init();
-	mail_search_build_add_all(search_args);
-
-	trans = mailbox_transaction_begin(client->mailbox, 0,
-					  "unhibernate import_send_expunges");
-	search_ctx = mailbox_search_init(trans, search_args, NULL, 0, NULL);
-	mail_search_args_unref(&search_args);
+	t_array_init(&uids, 64);
+	imap_state_get_uids(client->mailbox, client->messages_count, &uids);
+	seq_range_array_iter_init(&uid_iter, &uids);
 
 	/* find sequence numbers for the expunged UIDs */
 	t_array_init(&expunged_seqs, array_count(&expunged_uids)+1); seq = 0;
-	while (mailbox_search_next(search_ctx, &mail)) {
+	while (seq_range_array_iter_nth(&uid_iter, uid_n++, &uid)) {
 		while (seq_range_array_iter_nth(&iter, n, &expunged_uid) &&
-		       expunged_uid < mail->uid && seq < state->messages) {
+		       expunged_uid < uid && seq < state->messages) {
 			seq++; n++;
 			array_push_back(&expunged_seqs, &seq);
 			crc = crc32_data_more(crc, &expunged_uid,
@@ -368,7 +364,7 @@ import_send_expunges(struct client *client,
 		}
 		if (seq == state->messages)
 			break;
-		crc = crc32_data_more(crc, &mail->uid, sizeof(mail->uid));
+		crc = crc32_data_more(crc, &uid, sizeof(uid));
 		if (++seq == state->messages)
 			break;
 	}
@@ -380,18 +376,12 @@ import_send_expunges(struct client *client,
 				      sizeof(expunged_uid));
 	}
 
-	if (mailbox_search_deinit(&search_ctx) < 0) {
-		*error_r = mailbox_get_last_internal_error(client->mailbox, NULL);
-		ret = -1;
-	} else if (seq != state->messages) {
+	if (seq != state->messages) {
 		*error_r = t_strdup_printf("Message count mismatch after "
 					   "handling expunges (%u != %u)",
 					   seq, state->messages);
-		ret = -1;
-	}
-	(void)mailbox_transaction_commit(&trans);
-	if (ret < 0)
 		return -1;
+	}
 
 	seqs = array_get(&expunged_seqs, &expunge_count);
 	if (client->messages_count + expunge_count < state->messages) {
@@ -652,7 +642,10 @@ import_state_mailbox_open(struct client *client,
 	} else {
 		client_send_mailbox_flags(client, TRUE);
 	}
-	if (import_send_flag_changes(client, state, &flag_change_count) < 0) {
+	if (status.highest_modseq == state->highest_modseq) {
+		/* no flag changes */
+	} else if (import_send_flag_changes(client, state,
+					    &flag_change_count) < 0) {
 		*error_r = "Couldn't send flag changes";
 		return -1;
 	}
@@ -29,6 +29,16 @@ struct imap_sync_context {
 	ARRAY_TYPE(seq_range) expunges;
 	uint32_t seq;
 
+	/* "FLAGS (..)" of the previously sent FETCH reply. It's reused as
+	   long as the following mails have identical flags. */
+	string_t *prev_flags_str;
+	enum mail_flags prev_flags;
+	ARRAY_TYPE(keyword_indexes) prev_keywords;
+
+	/* When the current imap_sync_more() call started */
+	struct timeval run_start;
+	unsigned int run_count;
+
 	ARRAY_TYPE(seq_range) search_adds, search_removes;
 	unsigned int search_update_idx;
 
@@ -3,6 +3,7 @@
 #include "imap-common.h"
 #include "str.h"
 #include "ostream.h"
+#include "time-util.h"
 #include "mail-user.h"
 #include "mail-storage.h"
 #include "mail-search-build.h"
@@ -13,6 +14,12 @@
 #include "imap-commands.h"
 #include "imap-sync-private.h"
 
+/* Check the elapsed time after sending this many FETCH replies */
+#define IMAP_SYNC_RUN_CHECK_INTERVAL 100
+/* Give other clients a chance to run after spending this long sending
+   flag changes */
+#define IMAP_SYNC_MAX_RUN_MSECS 100
+
 static void uids_to_seqs(struct mailbox *box, ARRAY_TYPE(seq_range) *uids)
 {
 	T_BEGIN {
@@ -194,6 +201,8 @@ imap_sync_init(struct client *client, struct mailbox *box,
 	ctx->mail = mail_alloc(ctx->t, MAIL_FETCH_FLAGS, NULL);
 	ctx->messages_count = client->messages_count;
 	i_array_init(&ctx->tmp_keywords, client->keywords.announce_count + 8);
+	i_array_init(&ctx->prev_keywords, 8);
+	ctx->prev_flags_str = str_new(default_pool, 128);
 
 	if (client_has_enabled(client, imap_feature_qresync)) {
 		i_array_init(&ctx->expunges, 128);
@@ -356,6 +365,8 @@ int imap_sync_deinit(struct imap_sync_context *ctx,
 	}
 
 	array_free(&ctx->tmp_keywords);
+	array_free(&ctx->prev_keywords);
+	str_free(&ctx->prev_flags_str);
 	array_free(&ctx->module_contexts);
 	i_free(ctx);
 	return ret;
@@ -371,31 +382,56 @@ static void imap_sync_add_modseq(struct imap_sync_context *ctx, string_t *str)
 	str_printfa(str, "MODSEQ (%"PRIu64")", modseq);
 }
 
+static void
+imap_sync_append_fetch_prefix(struct imap_sync_context *ctx, string_t *str)
+{
+	char num[MAX_INT_STRLEN];
+
+	str_truncate(str, 0);
+	str_append(str, "* ");
+	str_append(str, dec2str_buf(num, ctx->seq));
+	str_append(str, " FETCH (");
+	if ((ctx->imap_flags & IMAP_SYNC_FLAG_SEND_UID) != 0) {
+		str_append(str, "UID ");
+		str_append(str, dec2str_buf(num, ctx->mail->uid));
+		str_append_c(str, ' ');
+	}
+}
+
 static int imap_sync_send_flags(struct imap_sync_context *ctx, string_t *str)
 {
 	enum mail_flags flags;
+	const ARRAY_TYPE(keyword_indexes) *keyword_indexes;
 	const char *const *keywords;
 
 	mail_set_seq(ctx->mail, ctx->seq);
 	flags = mail_get_flags(ctx->mail);
-	keywords = client_get_keyword_names(ctx->client, &ctx->tmp_keywords,
-			mail_get_keyword_indexes(ctx->mail));
+	keyword_indexes = mail_get_keyword_indexes(ctx->mail);
 
 	if ((flags & MAIL_DELETED) != 0)
 		ctx->client->sync_seen_deletes = TRUE;
 
-	str_truncate(str, 0);
-	str_printfa(str, "* %u FETCH (", ctx->seq);
-	if ((ctx->imap_flags & IMAP_SYNC_FLAG_SEND_UID) != 0)
-		str_printfa(str, "UID %u ", ctx->mail->uid);
+	if (str_len(ctx->prev_flags_str) == 0 || flags != ctx->prev_flags ||
+	    !array_cmp(keyword_indexes, &ctx->prev_keywords)) {
+		keywords = client_get_keyword_names(ctx->client,
+				&ctx->tmp_keywords, keyword_indexes);
+		str_truncate(ctx->prev_flags_str, 0);
+		str_append(ctx->prev_flags_str, "FLAGS (");
+		imap_write_flags(ctx->prev_flags_str, flags, keywords);
+		str_append(ctx->prev_flags_str, "))");
+
+		ctx->prev_flags = flags;
+		array_clear(&ctx->prev_keywords);
+		array_append_array(&ctx->prev_keywords, keyword_indexes);
+	}
+
+	imap_sync_append_fetch_prefix(ctx, str);
 	if (client_has_enabled(ctx->client, imap_feature_condstore) &&
 	    !ctx->client->nonpermanent_modseqs) {
 		imap_sync_add_modseq(ctx, str);
 		str_append_c(str, ' ');
 	}
-	str_append(str, "FLAGS (");
-	imap_write_flags(str, flags, keywords);
-	str_append(str, "))");
+	str_append_str(str, ctx->prev_flags_str);
 	return client_send_line_next(ctx->client, str_c(str));
 }
 
@@ -403,10 +439,7 @@ static int imap_sync_send_modseq(struct imap_sync_context *ctx, string_t *str)
 {
 	mail_set_seq(ctx->mail, ctx->seq);
 
-	str_truncate(str, 0);
-	str_printfa(str, "* %u FETCH (", ctx->seq);
-	if ((ctx->imap_flags & IMAP_SYNC_FLAG_SEND_UID) != 0)
-		str_printfa(str, "UID %u ", ctx->mail->uid);
+	imap_sync_append_fetch_prefix(ctx, str);
 	imap_sync_add_modseq(ctx, str);
 	str_append_c(str, ')');
 	return client_send_line_next(ctx->client, str_c(str));
@@ -490,6 +523,21 @@ static int imap_sync_send_expunges(struct imap_sync_context *ctx, string_t *str)
 	return 1;
 }
 
+static bool imap_sync_run_time_exceeded(struct imap_sync_context *ctx)
+{
+	struct timeval now;
+
+	if (++ctx->run_count % IMAP_SYNC_RUN_CHECK_INTERVAL != 0)
+		return FALSE;
+
+	i_gettimeofday(&now);
+	if (timeval_diff_msecs(&now, &ctx->run_start) < IMAP_SYNC_MAX_RUN_MSECS)
+		return FALSE;
+	/* continue after the other ioloop handlers have had their turn */
+	o_stream_set_flush_pending(ctx->client->output, TRUE);
+	return TRUE;
+}
+
 int imap_sync_more(struct imap_sync_context *ctx)
 {
 	string_t *str;
@@ -502,6 +550,8 @@ int imap_sync_more(struct imap_sync_context *ctx)
 	   internal state (ctx->messages_count) can get messed up and unless
 	   we immediately stop handling all commands and syncs we could end up
 	   assert-crashing. */
+	i_gettimeofday(&ctx->run_start);
+	ctx->run_count = 0;
 	str = t_str_new(256);
 	for (;;) {
 		if (ctx->seq == 0) {
@@ -543,6 +593,8 @@ int imap_sync_more(struct imap_sync_context *ctx)
 					break;
 
 				ret = imap_sync_send_flags(ctx, str);
+				if (ret > 0 && imap_sync_run_time_exceeded(ctx))
+					ret = 0;
 			}
 			break;
 		case MAILBOX_SYNC_TYPE_EXPUNGE:
@@ -576,11 +628,13 @@ int imap_sync_more(struct imap_sync_context *ctx)
 					break;
 
 				ret = imap_sync_send_modseq(ctx, str);
+				if (ret > 0 && imap_sync_run_time_exceeded(ctx))
+					ret = 0;
 			}
 			break;
 		}
 		if (ret == 0) {
-			/* buffer full */
+			/* buffer full or ran for too long */
 			break;
 		}
 
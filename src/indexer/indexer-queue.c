@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "ioloop.h"
 #include "llist.h"
 #include "hash.h"
 #include "wildcard-match.h"
@@ -15,7 +16,11 @@ struct indexer_queue {
 	HASH_TABLE(struct indexer_request *, struct indexer_request *) requests;
 	/* username -> indexer_request */
 	HASH_TABLE(char *, struct indexer_request *) users;
+	/* All queued requests, sorted by priority (highest first) */
 	struct indexer_request *head, *tail;
+	/* The last request in each priority class, NULL if the class is
+	   empty. */
+	struct indexer_request *class_tails[INDEXER_REQUEST_PRIORITY_COUNT];
 };
 
 struct indexer_queue_iter {
@@ -93,8 +98,82 @@ static void request_add_context(struct indexer_request *request, void *context)
 	array_push_back(&request->contexts, &context);
 }
 
+static struct indexer_request *
+indexer_queue_higher_class_tail(struct indexer_queue *queue,
+				enum indexer_request_priority priority)
+{
+	unsigned int i;
+
+	/* the lowest non-empty class above the priority is the one right
+	   before it in the list */
+	for (i = priority + 1; i < INDEXER_REQUEST_PRIORITY_COUNT; i++) {
+		if (queue->class_tails[i] != NULL)
+			return queue->class_tails[i];
+	}
+	return NULL;
+}
+
+static void
+indexer_queue_link(struct indexer_queue *queue,
+		   struct indexer_request *request, bool append)
+{
+	enum indexer_request_priority priority = request->priority;
+	struct indexer_request *after;
+
+	if (append && queue->class_tails[priority] != NULL)
+		after = queue->class_tails[priority];
+	else
+		after = indexer_queue_higher_class_tail(queue, priority);
+
+	if (after == NULL)
+		DLLIST2_PREPEND(&queue->head, &queue->tail, request);
+	else
+		DLLIST2_INSERT_AFTER(&queue->head, &queue->tail, after, request);
+	if (append || queue->class_tails[priority] == NULL)
+		queue->class_tails[priority] = request;
+	request->queued_time = ioloop_time;
+}
+
+static void
+indexer_queue_unlink(struct indexer_queue *queue,
+		     struct indexer_request *request)
+{
+	enum indexer_request_priority priority = request->priority;
+
+	if (queue->class_tails[priority] == request) {
+		queue->class_tails[priority] =
+			request->prev != NULL &&
+			request->prev->priority == priority ?
+			request->prev : NULL;
+	}
+	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+}
+
+static void indexer_queue_age_requests(struct indexer_queue *queue)
+{
+	struct indexer_request *request;
+
+	request = indexer_queue_higher_class_tail(queue,
+						  INDEXER_REQUEST_PRIORITY_LOW);
+	request = request == NULL ? queue->head : request->next;
+
+	/* The oldest LOW requests are right after the NORMAL class, so they
+	   can be moved to its end without relinking them. */
+	while (request != NULL &&
+	       request->priority == INDEXER_REQUEST_PRIORITY_LOW &&
+	       ioloop_time - request->queued_time >=
+	       INDEXER_QUEUE_PRIORITY_AGING_SECS) {
+		if (queue->class_tails[INDEXER_REQUEST_PRIORITY_LOW] == request)
+			queue->class_tails[INDEXER_REQUEST_PRIORITY_LOW] = NULL;
+		request->priority = INDEXER_REQUEST_PRIORITY_NORMAL;
+		queue->class_tails[INDEXER_REQUEST_PRIORITY_NORMAL] = request;
+		request = request->next;
+	}
+}
+
 static struct indexer_request *
 indexer_queue_append_request(struct indexer_queue *queue, bool append,
+			     enum indexer_request_priority priority,
 			     const char *username, const char *mailbox,
 			     const char *session_id,
 			     unsigned int max_recent_msgs, void *context)
@@ -108,19 +187,26 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 			request->max_recent_msgs = max_recent_msgs;
 		request_add_context(request, context);
 		if (request->working) {
-			/* we're already indexing this mailbox. */
+			/* we're already indexing this mailbox. Reindex it with
+			   the highest priority requested since then. */
+			if ((!request->reindex_head && !request->reindex_tail) ||
+			    request->priority < priority)
+				request->priority = priority;
 			if (append)
 				request->reindex_tail = TRUE;
 			else
 				request->reindex_head = TRUE;
+		} else if (request->priority < priority) {
+			/* move request to the higher priority class */
+			indexer_queue_unlink(queue, request);
+			request->priority = priority;
+			indexer_queue_link(queue, request, append);
+		} else if (append) {
+			/* keep the request in its old position */
 		} else {
-			if (append) {
-				/* keep the request in its old position */
-			} else {
-				/* move request to beginning of the queue */
-				DLLIST2_REMOVE(&queue->head, &queue->tail, request);
-				DLLIST2_PREPEND(&queue->head, &queue->tail, request);
-			}
+			/* move request to beginning of its class */
+			indexer_queue_unlink(queue, request);
+			indexer_queue_link(queue, request, FALSE);
 		}
 		return request;
 	}
@@ -130,6 +216,7 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 	request->mailbox = i_strdup(mailbox);
 	request->session_id = i_strdup(session_id);
 	request->max_recent_msgs = max_recent_msgs;
+	request->priority = priority;
 	request_add_context(request, context);
 	hash_table_insert(queue->requests, request, request);
 
@@ -143,10 +230,7 @@ indexer_queue_append_request(struct indexer_queue *queue, bool append,
 		hash_table_update(queue->users, first_username, request);
 	}
 
-	if (append)
-		DLLIST2_APPEND(&queue->head, &queue->tail, request);
-	else
-		DLLIST2_PREPEND(&queue->head, &queue->tail, request);
+	indexer_queue_link(queue, request, append);
 	return request;
 }
 
@@ -164,9 +248,10 @@ void indexer_queue_append(struct indexer_queue *queue, bool append,
 {
 	struct indexer_request *request;
 
-	request = indexer_queue_append_request(queue, append, username, mailbox,
-					       session_id, max_recent_msgs,
-					       context);
+	request = indexer_queue_append_request(queue, append,
+		append ? INDEXER_REQUEST_PRIORITY_NORMAL :
+		INDEXER_REQUEST_PRIORITY_HIGH, username, mailbox,
+		session_id, max_recent_msgs, context);
 	request->type = INDEXER_REQUEST_TYPE_INDEX;
 	indexer_queue_append_finish(queue);
 }
@@ -177,24 +262,53 @@ void indexer_queue_append_optimize(struct indexer_queue *queue,
 {
 	struct indexer_request *request;
 
-	request = indexer_queue_append_request(queue, TRUE, username, mailbox,
-					       NULL, 0, context);
+	request = indexer_queue_append_request(queue, TRUE,
+		INDEXER_REQUEST_PRIORITY_LOW, username, mailbox,
+		NULL, 0, context);
 	request->type = INDEXER_REQUEST_TYPE_OPTIMIZE;
 	indexer_queue_append_finish(queue);
 }
 
 struct indexer_request *indexer_queue_request_peek(struct indexer_queue *queue)
 {
+	indexer_queue_age_requests(queue);
 	return queue->head;
 }
 
+struct indexer_request *
+indexer_queue_request_peek_user(struct indexer_queue *queue,
+				const char *username)
+{
+	struct indexer_request *request, *best = NULL;
+
+	indexer_queue_age_requests(queue);
+	/* the user's requests are newest first, so prefer the later ones
+	   within the same priority */
+	request = hash_table_lookup(queue->users, username);
+	for (; request != NULL; request = request->user_next) {
+		if (request->working)
+			continue;
+		if (best == NULL || request->priority >= best->priority)
+			best = request;
+	}
+	return best;
+}
+
 void indexer_queue_request_remove(struct indexer_queue *queue)
 {
 	struct indexer_request *request = queue->head;
 
 	i_assert(request != NULL);
 
-	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+	indexer_queue_unlink(queue, request);
+}
+
+void indexer_queue_remove_request(struct indexer_queue *queue,
+				  struct indexer_request *request)
+{
+	i_assert(!request->working);
+
+	indexer_queue_unlink(queue, request);
 }
 
 static void indexer_queue_request_status_int(struct indexer_queue *queue,
@@ -224,7 +338,7 @@ void indexer_queue_move_head_to_tail(struct indexer_queue *queue)
 	struct indexer_request *request = queue->head;
 
 	indexer_queue_request_remove(queue);
-	DLLIST2_APPEND(&queue->head, &queue->tail, request);
+	indexer_queue_link(queue, request, TRUE);
 }
 
 void indexer_queue_request_work(struct indexer_request *request)
@@ -253,10 +367,7 @@ void indexer_queue_request_finish(struct indexer_queue *queue,
 			array_delete(&request->contexts, 0,
 				     request->working_context_idx);
 		}
-		if (request->reindex_head)
-			DLLIST2_PREPEND(&queue->head, &queue->tail, request);
-		else
-			DLLIST2_APPEND(&queue->head, &queue->tail, request);
+		indexer_queue_link(queue, request, !request->reindex_head);
 		request->reindex_head = FALSE;
 		request->reindex_tail = FALSE;
 		return;
@@ -291,7 +402,7 @@ indexer_queue_request_cancel(struct indexer_queue *queue,
 
 	*_request = NULL;
 	request->reindex_head = request->reindex_tail = FALSE;
-	DLLIST2_REMOVE(&queue->head, &queue->tail, request);
+	indexer_queue_unlink(queue, request);
 	indexer_queue_request_finish(queue, &request, FALSE);
 }
 
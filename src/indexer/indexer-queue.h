@@ -12,6 +12,24 @@ enum indexer_request_type {
 	INDEXER_REQUEST_TYPE_OPTIMIZE,
 };
 
+/* Requests are handled in priority classes, highest first. Within a class
+   the requests are handled in the queue order. */
+enum indexer_request_priority {
+	/* bulk work that nobody waits for (optimizing) */
+	INDEXER_REQUEST_PRIORITY_LOW,
+	/* appended requests (new mails, doveadm index) */
+	INDEXER_REQUEST_PRIORITY_NORMAL,
+	/* prepended requests (a client is waiting for the indexing to finish
+	   before it can search) */
+	INDEXER_REQUEST_PRIORITY_HIGH,
+
+	INDEXER_REQUEST_PRIORITY_COUNT
+};
+
+/* LOW priority requests that have been waiting this long are moved to the
+   NORMAL priority class, so they can't be starved forever. */
+#define INDEXER_QUEUE_PRIORITY_AGING_SECS 60
+
 struct indexer_request {
 	/* Linked list of all requests - highest priority first */
 	struct indexer_request *prev, *next;
@@ -24,6 +42,9 @@ struct indexer_request {
 	unsigned int max_recent_msgs;
 
 	enum indexer_request_type type;
+	enum indexer_request_priority priority;
+	/* when the request was added to its current position in the queue */
+	time_t queued_time;
 
 	/* currently indexing this mailbox */
 	bool working:1;
@@ -64,16 +85,26 @@ void indexer_queue_cancel_all(struct indexer_queue *queue);
 bool indexer_queue_is_empty(struct indexer_queue *queue);
 unsigned int indexer_queue_count(struct indexer_queue *queue);
 
-/* Return the next request from the queue, without removing it. */
+/* Return the next request from the queue, without removing it. The rest of
+   the queue can be accessed via the request's next pointers. */
 struct indexer_request *indexer_queue_request_peek(struct indexer_queue *queue);
+/* Return the user's highest priority queued request, or NULL if the user has
+   no queued requests. */
+struct indexer_request *
+indexer_queue_request_peek_user(struct indexer_queue *queue,
+				const char *username);
 /* Remove the next request from the queue. You must call
    indexer_queue_request_finish() to free its memory. */
 void indexer_queue_request_remove(struct indexer_queue *queue);
+/* Remove the given queued request from the queue. You must call
+   indexer_queue_request_finish() to free its memory. */
+void indexer_queue_remove_request(struct indexer_queue *queue,
+				  struct indexer_request *request);
 /* Give a status update about how far the indexing is going on. */
 void indexer_queue_request_status(struct indexer_queue *queue,
 				  struct indexer_request *request,
 				  int percentage);
-/* Move the next request to the end of the queue. */
+/* Move the next request to the end of its priority class. */
 void indexer_queue_move_head_to_tail(struct indexer_queue *queue);
 /* Start working on a request */
 void indexer_queue_request_work(struct indexer_request *request);
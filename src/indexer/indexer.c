@@ -16,6 +16,8 @@ static struct indexer_queue *queue;
 static void
 worker_status_callback(int percentage, struct indexer_request *request);
 static void worker_avail_callback(void);
+static struct indexer_request *
+worker_next_request_callback(const char *username);
 
 void indexer_refresh_proctitle(void)
 {
@@ -43,35 +45,26 @@ static bool worker_send_request(struct indexer_request *request)
 {
 	if (worker_connection_try_create("indexer-worker", request,
 					 worker_status_callback,
-					 worker_avail_callback) <= 0)
+					 worker_avail_callback,
+					 worker_next_request_callback) <= 0)
 		return FALSE;
-	indexer_queue_request_remove(queue);
+	indexer_queue_remove_request(queue, request);
 	indexer_queue_request_work(request);
 	return TRUE;
 }
 
 static void queue_try_send_more(struct indexer_queue *queue)
 {
-	struct worker_connection *worker;
-	struct indexer_request *request, *first_moved_request = NULL;
-
-	while ((request = indexer_queue_request_peek(queue)) != NULL) {
-		worker = worker_connections_find_user(request->username);
-		if (worker != NULL) {
-			/* There is already a connection handling a request
-			 * for this user. Move the request to the back of the
-			 * queue and handle requests from other users.
-			 * Terminate if we went through all requests. */
-			if (request == first_moved_request) {
-				/* all requests are waiting for existing users
-				   to finish. */
-				break;
-			}
-			if (first_moved_request == NULL)
-				first_moved_request = request;
-			indexer_queue_move_head_to_tail(queue);
+	struct indexer_request *request, *next;
+
+	/* Go through the queue in priority order. Skip requests for users
+	   that already have a connection handling their request, so a single
+	   user with lots of queued mailboxes can't occupy all the workers. */
+	for (request = indexer_queue_request_peek(queue);
+	     request != NULL; request = next) {
+		next = request->next;
+		if (worker_connections_find_user(request->username) != NULL)
 			continue;
-		}
 
 		/* create a new connection to a worker */
 		if (!worker_send_request(request))
@@ -103,6 +96,26 @@ static void worker_avail_callback(void)
 	queue_try_send_more(queue);
 }
 
+static struct indexer_request *
+worker_next_request_callback(const char *username)
+{
+	struct indexer_request *request, *head;
+
+	request = indexer_queue_request_peek_user(queue, username);
+	if (request == NULL)
+		return NULL;
+
+	/* Don't keep the worker busy with this user while other users have
+	   higher priority requests waiting. */
+	head = indexer_queue_request_peek(queue);
+	if (head->priority > request->priority)
+		return NULL;
+
+	indexer_queue_remove_request(queue, request);
+	indexer_queue_request_work(request);
+	return request;
+}
+
 int main(int argc, char *argv[])
 {
 	const char *error;
@@ -4,6 +4,7 @@
 #include "connection.h"
 #include "ioloop.h"
 #include "istream.h"
+#include "llist.h"
 #include "ostream.h"
 #include "strescape.h"
 #include "hostpid.h"
@@ -24,6 +25,12 @@
 #define INDEXER_MASTER_NAME "indexer-master-worker"
 #define INDEXER_WORKER_NAME "indexer-worker-master"
 
+/* Keep this many users initialized after their indexing is finished. The
+   indexer often sends more requests for the same users soon afterwards. */
+#define INDEXER_WORKER_USER_CACHE_MAX_COUNT 5
+/* Drop cached users that haven't been used for this long. */
+#define INDEXER_WORKER_USER_CACHE_IDLE_SECS 30
+
 static struct event_category event_category_indexer_worker = {
 	.name = "indexer-worker",
 };
@@ -35,6 +42,22 @@ struct master_connection {
 	bool version_received:1;
 };
 
+struct indexer_worker_user {
+	struct indexer_worker_user *prev, *next;
+
+	struct mail_storage_service_user *service_user;
+	struct mail_user *user;
+	/* effective uid/gid the user was used with */
+	uid_t uid;
+	gid_t gid;
+	time_t last_used;
+};
+
+/* Most recently used first */
+static struct indexer_worker_user *cached_users_head, *cached_users_tail;
+static unsigned int cached_users_count = 0;
+static struct timeout *to_cached_users = NULL;
+
 static void ATTR_NULL(1, 2)
 indexer_worker_refresh_proctitle(const char *username, const char *mailbox,
 				 uint32_t seq1, uint32_t seq2)
@@ -250,17 +273,140 @@ index_mailbox(struct master_connection *conn, struct mail_user *user,
 	return ret;
 }
 
+static void indexer_worker_set_eids(uid_t uid, gid_t gid)
+{
+	/* the privileges were dropped only temporarily, so root can be
+	   restored before switching to the wanted ones */
+	if (geteuid() != 0 && seteuid(0) < 0) {
+		i_fatal("Failed to restore temporarily dropped root privileges: "
+			"seteuid(0) failed: %m");
+	}
+	if (setegid(gid) < 0)
+		i_fatal("setegid(%s) failed: %m", dec2str(gid));
+	if (uid != 0 && seteuid(uid) < 0)
+		i_fatal("seteuid(%s) failed: %m", dec2str(uid));
+}
+
+static void indexer_worker_user_free(struct indexer_worker_user **_wuser)
+{
+	struct indexer_worker_user *wuser = *_wuser;
+	uid_t cur_uid = geteuid();
+	gid_t cur_gid = getegid();
+	bool switch_eids = wuser->uid != cur_uid || wuser->gid != cur_gid;
+
+	*_wuser = NULL;
+
+	/* Privileges may have been dropped to another user since this user
+	   was cached. Deinit may still write to the user's indexes, so do it
+	   with the user's own uid/gid. */
+	if (switch_eids)
+		indexer_worker_set_eids(wuser->uid, wuser->gid);
+	/* set the user's log prefix for the deinit */
+	mail_storage_service_io_activate_user(wuser->service_user);
+	mail_user_deinit(&wuser->user);
+	mail_storage_service_io_deactivate_user(wuser->service_user);
+	mail_storage_service_user_unref(&wuser->service_user);
+	if (switch_eids)
+		indexer_worker_set_eids(cur_uid, cur_gid);
+	i_free(wuser);
+}
+
+static void
+indexer_worker_cached_user_remove(struct indexer_worker_user *wuser)
+{
+	DLLIST2_REMOVE(&cached_users_head, &cached_users_tail, wuser);
+	i_assert(cached_users_count > 0);
+	cached_users_count--;
+}
+
+static void indexer_worker_cached_users_expire(void)
+{
+	struct indexer_worker_user *wuser, *prev;
+
+	/* Drop users that can't be reused with the current privileges, the
+	   ones that have been idle for too long and the least recently used
+	   ones above the limit. */
+	for (wuser = cached_users_tail; wuser != NULL; wuser = prev) {
+		prev = wuser->prev;
+		if (wuser->uid != geteuid() || wuser->gid != getegid() ||
+		    wuser->last_used + INDEXER_WORKER_USER_CACHE_IDLE_SECS <=
+		    ioloop_time ||
+		    cached_users_count > INDEXER_WORKER_USER_CACHE_MAX_COUNT) {
+			indexer_worker_cached_user_remove(wuser);
+			indexer_worker_user_free(&wuser);
+		}
+	}
+	if (cached_users_head == NULL)
+		timeout_remove(&to_cached_users);
+}
+
+static void indexer_worker_cached_users_timeout(void *context ATTR_UNUSED)
+{
+	indexer_worker_cached_users_expire();
+}
+
+static void indexer_worker_cached_users_free_all(void)
+{
+	struct indexer_worker_user *wuser;
+
+	while ((wuser = cached_users_head) != NULL) {
+		indexer_worker_cached_user_remove(wuser);
+		indexer_worker_user_free(&wuser);
+	}
+	timeout_remove(&to_cached_users);
+}
+
+static struct indexer_worker_user *
+indexer_worker_cached_user_get(const char *username)
+{
+	struct indexer_worker_user *wuser;
+
+	for (wuser = cached_users_head; wuser != NULL; wuser = wuser->next) {
+		if (strcmp(wuser->user->username, username) == 0)
+			break;
+	}
+	if (wuser == NULL)
+		return NULL;
+
+	indexer_worker_cached_user_remove(wuser);
+	if (wuser->uid != geteuid() || wuser->gid != getegid()) {
+		/* Privileges were (temporarily) dropped to another user
+		   since. The user needs to be looked up again. */
+		indexer_worker_user_free(&wuser);
+		return NULL;
+	}
+	mail_storage_service_io_activate_user(wuser->service_user);
+	if (master_service_get_client_limit(master_service) == 1)
+		master_service_set_current_user(master_service, username);
+	return wuser;
+}
+
+static void indexer_worker_cached_user_add(struct indexer_worker_user *wuser)
+{
+	mail_storage_service_io_deactivate_user(wuser->service_user);
+	wuser->uid = geteuid();
+	wuser->gid = getegid();
+	wuser->last_used = ioloop_time;
+	DLLIST2_PREPEND(&cached_users_head, &cached_users_tail, wuser);
+	cached_users_count++;
+
+	indexer_worker_cached_users_expire();
+	if (to_cached_users != NULL)
+		timeout_reset(to_cached_users);
+	else if (cached_users_head != NULL) {
+		to_cached_users =
+			timeout_add(INDEXER_WORKER_USER_CACHE_IDLE_SECS * 1000,
+				    indexer_worker_cached_users_timeout, NULL);
+	}
+}
+
 static int
-master_connection_cmd_index(struct master_connection *conn,
-			    const char *username, const char *mailbox,
-			    const char *session_id,
-			    unsigned int max_recent_msgs, const char *what)
+indexer_worker_user_lookup(struct master_connection *conn,
+			   const char *username, const char *session_id,
+			   struct indexer_worker_user *wuser)
 {
 	struct mail_storage_service_input input;
-	struct mail_storage_service_user *service_user;
-	struct mail_user *user;
 	const char *error;
-	int ret;
 
 	i_zero(&input);
 	input.module = "mail";
@@ -274,11 +420,41 @@ master_connection_cmd_index(struct master_connection *conn,
 		input.session_id_prefix = session_id;
 
 	if (mail_storage_service_lookup_next(conn->storage_service, &input,
-					     &service_user, &user, &error) <= 0) {
+					     &wuser->service_user,
+					     &wuser->user, &error) <= 0) {
 		e_error(conn->conn.event, "User %s lookup failed: %s",
 			username, error);
 		return -1;
 	}
+	return 0;
+}
+
+static int
+master_connection_cmd_index(struct master_connection *conn,
+			    const char *username, const char *mailbox,
+			    const char *session_id,
+			    unsigned int max_recent_msgs, const char *what)
+{
+	struct indexer_worker_user *wuser;
+	struct mail_user *user;
+	int ret;
+
+	/* The user may still be initialized from an earlier request. It
+	   gets a new session ID for this request. */
+	wuser = indexer_worker_cached_user_get(username);
+	if (wuser != NULL) {
+		e_debug(conn->conn.event, "Reusing cached user %s", username);
+		mail_storage_service_user_new_session_id(wuser->service_user,
+			wuser->user, session_id[0] == '\0' ? NULL : session_id);
+	} else {
+		wuser = i_new(struct indexer_worker_user, 1);
+		if (indexer_worker_user_lookup(conn, username, session_id,
+					       wuser) < 0) {
+			i_free(wuser);
+			return -1;
+		}
+	}
+	user = wuser->user;
 
 	struct master_service_anvil_session anvil_session;
 	guid_128_t anvil_conn_guid;
@@ -293,17 +469,24 @@ master_connection_cmd_index(struct master_connection *conn,
 		event_reason_begin("indexer:index_mailbox");
 	ret = index_mailbox(conn, user, mailbox, max_recent_msgs, what);
 	event_reason_end(&reason);
-	/* refresh proctitle before a potentially long-running
-	   user unref */
-	indexer_worker_refresh_proctitle(user->username, "(deinit)", 0, 0);
 
 	if (anvil_sent) {
 		master_service_anvil_disconnect(master_service, &anvil_session,
 						anvil_conn_guid);
 	}
 
-	mail_user_deinit(&user);
-	mail_storage_service_user_unref(&service_user);
+	if (ret == 0) {
+		/* keep the user around for the following requests */
+		indexer_worker_cached_user_add(wuser);
+	} else {
+		/* refresh proctitle before a potentially long-running
+		   user unref */
+		indexer_worker_refresh_proctitle(user->username, "(deinit)",
+						 0, 0);
+		mail_user_deinit(&wuser->user);
+		mail_storage_service_user_unref(&wuser->service_user);
+		i_free(wuser);
+	}
 	indexer_worker_refresh_proctitle(NULL, NULL, 0, 0);
 	return ret;
 }
@@ -402,4 +585,5 @@ void master_connections_destroy(void)
 {
 	if (master_connection_list != NULL)
 		connection_list_deinit(&master_connection_list);
+	indexer_worker_cached_users_free_all();
 }
@@ -1,6 +1,7 @@
 /* Copyright (c) 2022 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
 #include "test-common.h"
 #include "indexer-queue.h"
 
@@ -28,6 +29,7 @@ static void test_indexer_queue(void)
 	test_assert_strcmp(request->username, "user1");
 	test_assert_strcmp(request->mailbox, "mailbox1");
 
+	/* moves to the end of the prepended requests' priority class */
 	indexer_queue_move_head_to_tail(queue);
 
 	struct {
@@ -35,9 +37,9 @@ static void test_indexer_queue(void)
 		const char *mailbox;
 	} expected[] = {
 		{ "user2", "mailbox2" },
+		{ "user1", "mailbox1" },
 		{ "user2", "mailbox3" },
 		{ "user1", "mailbox4" },
-		{ "user1", "mailbox1" },
 	};
 	for (unsigned int i = 0; i < N_ELEMENTS(expected); i++) {
 		request = indexer_queue_request_peek(queue);
@@ -257,6 +259,121 @@ static void test_indexer_queue_iter(void)
 	test_end();
 }
 
+static void
+test_indexer_queue_check_order(struct indexer_queue *queue,
+			       const char *const *expected)
+{
+	struct indexer_request *request;
+	unsigned int i;
+
+	request = indexer_queue_request_peek(queue);
+	for (i = 0; expected[i] != NULL; i++) {
+		if (request == NULL)
+			break;
+		test_assert_strcmp_idx(request->mailbox, expected[i], i);
+		request = request->next;
+	}
+	test_assert(expected[i] == NULL && request == NULL);
+}
+
+static void test_indexer_queue_priority(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request;
+
+	test_begin("indexer queue priority");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+	ioloop_time = 1000;
+
+	indexer_queue_append_optimize(queue, "user1", "optimize1", NULL);
+	indexer_queue_append(queue, TRUE, "user2", "append1", "session", 0, NULL);
+	indexer_queue_append_optimize(queue, "user3", "optimize2", NULL);
+	indexer_queue_append(queue, FALSE, "user1", "prepend1", "session", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user3", "append2", "session", 0, NULL);
+	indexer_queue_append(queue, FALSE, "user2", "prepend2", "session", 0, NULL);
+	test_indexer_queue_check_order(queue, (const char *const[]) {
+		"prepend2", "prepend1", "append1", "append2",
+		"optimize1", "optimize2", NULL });
+
+	/* a lower priority request doesn't move an existing request */
+	indexer_queue_append_optimize(queue, "user2", "append1", NULL);
+	/* a higher priority request moves it to the higher class */
+	indexer_queue_append(queue, TRUE, "user3", "optimize2", "session", 0, NULL);
+	indexer_queue_append(queue, FALSE, "user3", "append2", "session", 0, NULL);
+	test_indexer_queue_check_order(queue, (const char *const[]) {
+		"append2", "prepend2", "prepend1", "append1", "optimize2",
+		"optimize1", NULL });
+
+	/* removing requests from the middle keeps the classes intact */
+	request = indexer_queue_request_peek(queue)->next->next->next;
+	test_assert_strcmp(request->mailbox, "append1");
+	indexer_queue_remove_request(queue, request);
+	indexer_queue_request_finish(queue, &request, TRUE);
+	indexer_queue_append(queue, TRUE, "user2", "append3", "session", 0, NULL);
+	test_indexer_queue_check_order(queue, (const char *const[]) {
+		"append2", "prepend2", "prepend1", "optimize2", "append3",
+		"optimize1", NULL });
+
+	/* old enough LOW priority requests are moved to the NORMAL class */
+	ioloop_time += INDEXER_QUEUE_PRIORITY_AGING_SECS;
+	indexer_queue_append_optimize(queue, "user2", "optimize3", NULL);
+	test_indexer_queue_check_order(queue, (const char *const[]) {
+		"append2", "prepend2", "prepend1", "optimize2", "append3",
+		"optimize1", "optimize3", NULL });
+	request = indexer_queue_request_peek(queue)->next->next->next->next->next;
+	test_assert(request->priority == INDEXER_REQUEST_PRIORITY_NORMAL);
+	test_assert(request->next->priority == INDEXER_REQUEST_PRIORITY_LOW);
+	indexer_queue_append(queue, TRUE, "user2", "append4", "session", 0, NULL);
+	test_indexer_queue_check_order(queue, (const char *const[]) {
+		"append2", "prepend2", "prepend1", "optimize2", "append3",
+		"optimize1", "append4", "optimize3", NULL });
+
+	indexer_queue_cancel_all(queue);
+	test_assert(indexer_queue_request_peek(queue) == NULL);
+
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
+static void test_indexer_queue_peek_user(void)
+{
+	struct indexer_queue *queue;
+	struct indexer_request *request;
+
+	test_begin("indexer queue peek user");
+	queue = indexer_queue_init(indexer_queue_status_callback);
+
+	indexer_queue_append(queue, TRUE, "user1", "mailbox1", "session1", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user2", "mailbox2", "session2", 0, NULL);
+	indexer_queue_append(queue, TRUE, "user1", "mailbox3", "session3", 0, NULL);
+	indexer_queue_append_optimize(queue, "user1", "mailbox4", NULL);
+	test_assert(indexer_queue_request_peek_user(queue, "user-none") == NULL);
+
+	/* oldest of the highest priority requests */
+	request = indexer_queue_request_peek_user(queue, "user1");
+	test_assert_strcmp(request->mailbox, "mailbox1");
+	indexer_queue_remove_request(queue, request);
+	indexer_queue_request_work(request);
+
+	/* working requests are skipped */
+	indexer_queue_append(queue, FALSE, "user1", "mailbox1", "session1", 0, NULL);
+	test_assert(request->reindex_head);
+	test_assert_strcmp(indexer_queue_request_peek_user(queue, "user1")->mailbox,
+			   "mailbox3");
+	indexer_queue_request_finish(queue, &request, TRUE);
+
+	/* the reindexed request has a higher priority now */
+	request = indexer_queue_request_peek_user(queue, "user1");
+	test_assert_strcmp(request->mailbox, "mailbox1");
+	test_assert(request == indexer_queue_request_peek(queue));
+
+	indexer_queue_cancel_all(queue);
+	test_assert(indexer_queue_request_peek_user(queue, "user1") == NULL);
+
+	indexer_queue_deinit(&queue);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -265,6 +382,8 @@ int main(void)
 		test_indexer_queue_reindex,
 		test_indexer_queue_cancel,
 		test_indexer_queue_iter,
+		test_indexer_queue_priority,
+		test_indexer_queue_peek_user,
 		NULL
 	};
 	return test_run(test_functions);
@@ -22,20 +22,30 @@
 #define INDEXER_MASTER_NAME "indexer-master-worker"
 #define INDEXER_WORKER_NAME "indexer-worker-master"
 
+/* Maximum number of requests to send to the same worker connection before
+   disconnecting it. */
+#define INDEXER_WORKER_MAX_BATCH_REQUESTS 20
+
 struct worker_connection {
 	struct connection conn;
 
 	indexer_status_callback_t *callback;
 	worker_available_callback_t *avail_callback;
+	worker_next_request_callback_t *next_callback;
 
 	pid_t pid;
 	char *request_username;
 	struct indexer_request *request;
+	unsigned int request_count;
 };
 
 static unsigned int worker_last_process_limit = 0;
 static struct connection_list *worker_connections;
 
+static void
+worker_connection_send_request(struct worker_connection *worker,
+			       struct indexer_request *request);
+
 static void worker_connection_call_callback(struct worker_connection *worker,
 					    int percentage)
 {
@@ -109,9 +119,19 @@ worker_connection_input_args(struct connection *conn, const char *const *args)
 		ret = -1;
 
 	worker_connection_call_callback(worker, percentage);
-	if (worker->request == NULL) {
-		/* disconnect after each request */
-		ret = -1;
+	if (worker->request == NULL && ret > 0) {
+		/* The user is most likely still initialized in the worker.
+		   Continue with the user's next request, if there is one. */
+		struct indexer_request *request = NULL;
+
+		if (worker->request_count < INDEXER_WORKER_MAX_BATCH_REQUESTS)
+			request = worker->next_callback(worker->request_username);
+		if (request != NULL)
+			worker_connection_send_request(worker, request);
+		else {
+			/* disconnect after the last request */
+			ret = -1;
+		}
 	}
 
 	return ret;
@@ -121,8 +141,11 @@ static void
 worker_connection_send_request(struct worker_connection *worker,
 			       struct indexer_request *request)
 {
-	worker->request_username = i_strdup(request->username);
+	if (worker->request_username == NULL)
+		worker->request_username = i_strdup(request->username);
+	i_assert(strcmp(worker->request_username, request->username) == 0);
 	worker->request = request;
+	worker->request_count++;
 
 	T_BEGIN {
 		string_t *str = t_str_new(128);
@@ -178,7 +201,8 @@ void worker_connections_deinit(void)
 int worker_connection_try_create(const char *socket_path,
 				 struct indexer_request *request,
 				 indexer_status_callback_t *callback,
-				 worker_available_callback_t *avail_callback)
+				 worker_available_callback_t *avail_callback,
+				 worker_next_request_callback_t *next_callback)
 {
 	struct worker_connection *conn;
 	unsigned int max_connections;
@@ -190,6 +214,7 @@ int worker_connection_try_create(const char *socket_path,
 	conn = i_new(struct worker_connection, 1);
 	conn->callback = callback;
 	conn->avail_callback = avail_callback;
+	conn->next_callback = next_callback;
 	connection_init_client_unix(worker_connections, &conn->conn,
 				    socket_path);
 	if (connection_client_connect(&conn->conn) < 0) {
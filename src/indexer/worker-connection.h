@@ -7,6 +7,11 @@ struct indexer_request;
 struct worker_connection;
 
 typedef void worker_available_callback_t(void);
+/* Called after the worker successfully finished a request. Returns the next
+   request for the same user, which is sent to the same worker, or NULL if
+   the worker should be disconnected. */
+typedef struct indexer_request *
+worker_next_request_callback_t(const char *username);
 
 /* Try to create a new worker connection and send a new indexing request for
    the given username+mailbox. The status callback is called as necessary.
@@ -15,7 +20,8 @@ typedef void worker_available_callback_t(void);
 int worker_connection_try_create(const char *socket_path,
 				 struct indexer_request *request,
 				 indexer_status_callback_t *callback,
-				 worker_available_callback_t *avail_callback);
+				 worker_available_callback_t *avail_callback,
+				 worker_next_request_callback_t *next_callback);
 
 unsigned int worker_connections_get_count(void);
 struct worker_connection *worker_connections_find_user(const char *username);
@@ -60,6 +60,9 @@ struct auth_master_lookup_ctx {
 struct auth_master_user_list_ctx {
 	struct auth_master_connection *conn;
 	string_t *username;
+	/* Userdb fields for username, if the server looked them up */
+	pool_t fields_pool;
+	const char *const *fields;
 	bool finished;
 	bool failed;
 };
@@ -904,6 +907,11 @@ auth_user_list_reply_callback(const char *cmd, const char *const *args,
 		   a higher chance of a failure since the connection could be
 		   open to dovecot-auth for a long time. */
 		str_append(ctx->username, args[0]);
+	} else if (strcmp(cmd, "USER") == 0 && args[0] != NULL &&
+		   ctx->fields_pool != NULL) {
+		/* userdb lookup was done by the server */
+		str_append(ctx->username, args[0]);
+		ctx->fields = p_strarray_dup(ctx->fields_pool, args + 1);
 	} else {
 		e_error(conn->event, "User listing returned invalid input");
 		ctx->failed = TRUE;
@@ -915,6 +923,15 @@ struct auth_master_user_list_ctx *
 auth_master_user_list_init(struct auth_master_connection *conn,
 			   const char *user_mask,
 			   const struct auth_user_info *info)
+{
+	return auth_master_user_list_init_lookup(conn, user_mask, info, 0);
+}
+
+struct auth_master_user_list_ctx *
+auth_master_user_list_init_lookup(struct auth_master_connection *conn,
+				  const char *user_mask,
+				  const struct auth_user_info *info,
+				  unsigned int lookup_batch)
 {
 	struct auth_master_user_list_ctx *ctx;
 	string_t *str;
@@ -922,6 +939,10 @@ auth_master_user_list_init(struct auth_master_connection *conn,
 	ctx = i_new(struct auth_master_user_list_ctx, 1);
 	ctx->conn = conn;
 	ctx->username = str_new(default_pool, 128);
+	if (lookup_batch > 0) {
+		ctx->fields_pool =
+			pool_alloconly_create("auth master user list", 1024);
+	}
 
 	conn->reply_callback = auth_user_list_reply_callback;
 	conn->reply_context = ctx;
@@ -931,6 +952,8 @@ auth_master_user_list_init(struct auth_master_connection *conn,
 		    auth_master_next_request_id(conn));
 	if (*user_mask != '\0')
 		str_printfa(str, "\tuser=%s", user_mask);
+	if (lookup_batch > 0)
+		str_printfa(str, "\tuserdb_lookup=%u", lookup_batch);
 	if (info != NULL)
 		auth_user_info_export(str, info);
 	str_append_c(str, '\n');
@@ -961,6 +984,9 @@ auth_master_user_do_list_next(struct auth_master_user_list_ctx *ctx)
 		return NULL;
 
 	str_truncate(ctx->username, 0);
+	ctx->fields = NULL;
+	if (ctx->fields_pool != NULL)
+		p_clear(ctx->fields_pool);
 
 	/* try to read already buffered input */
 	line = i_stream_next_line(conn->conn.input);
@@ -1002,6 +1028,17 @@ const char *auth_master_user_list_next(struct auth_master_user_list_ctx *ctx)
 	return username;
 }
 
+const char *
+auth_master_user_list_next_fields(struct auth_master_user_list_ctx *ctx,
+				  const char *const **fields_r)
+{
+	const char *username;
+
+	username = auth_master_user_list_next(ctx);
+	*fields_r = username == NULL ? NULL : ctx->fields;
+	return username;
+}
+
 int auth_master_user_list_deinit(struct auth_master_user_list_ctx **_ctx)
 {
 	struct auth_master_user_list_ctx *ctx = *_ctx;
@@ -1025,6 +1062,7 @@ int auth_master_user_list_deinit(struct auth_master_user_list_ctx **_ctx)
 	}
 	auth_master_event_finish(conn);
 
+	pool_unref(&ctx->fields_pool);
 	str_free(&ctx->username);
 	i_free(ctx);
 	return ret;
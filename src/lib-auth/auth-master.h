@@ -67,7 +67,22 @@ struct auth_master_user_list_ctx *
 auth_master_user_list_init(struct auth_master_connection *conn,
 			   const char *user_mask,
 			   const struct auth_user_info *info) ATTR_NULL(3);
+/* Like auth_master_user_list_init(), but ask the auth server to also do a
+   userdb lookup for each user, with up to lookup_batch lookups in parallel.
+   The info is used for the lookups as well. */
+struct auth_master_user_list_ctx *
+auth_master_user_list_init_lookup(struct auth_master_connection *conn,
+				  const char *user_mask,
+				  const struct auth_user_info *info,
+				  unsigned int lookup_batch) ATTR_NULL(3);
 const char *auth_master_user_list_next(struct auth_master_user_list_ctx *ctx);
+/* Returns the next user, and its userdb fields in *fields_r if the auth server
+   looked them up. *fields_r is NULL if it didn't (e.g. the lookup failed), in
+   which case the caller needs to look up the user itself. The returned
+   username is the one returned by the userdb lookup. */
+const char *
+auth_master_user_list_next_fields(struct auth_master_user_list_ctx *ctx,
+				  const char *const **fields_r);
 /* Returns -1 if anything failed, 0 if ok */
 int auth_master_user_list_deinit(struct auth_master_user_list_ctx **ctx);
 
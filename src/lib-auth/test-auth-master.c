@@ -77,6 +77,7 @@ static int
 test_client_userdb_lookup_simple(const char *user, bool retry,
 				 const char **error_r);
 static int test_client_user_list_simple(void);
+static int test_client_user_list_lookup_simple(void);
 
 /* test*/
 static void
@@ -1044,7 +1045,12 @@ static void test_user_list_input(struct server_connection *conn)
 				return;
 			}
 			str = t_str_new(256);
-			str_printfa(str, "LIST\t%u\tuser1\n", id);
+			if (str_array_find(args, "userdb_lookup=4")) {
+				str_printfa(str, "USER\t%u\tuser1\t"
+					    "home=/home/user1\n", id);
+			} else {
+				str_printfa(str, "LIST\t%u\tuser1\n", id);
+			}
 			str_printfa(str, "LIST\t%u\tuser2\n", id);
 			str_printfa(str, "LIST\t%u\tuser3\n", id);
 			str_printfa(str, "LIST\t%u\tuser4\n", id);
@@ -1087,6 +1093,16 @@ static bool test_client_user_list(void)
 	return FALSE;
 }
 
+static bool test_client_user_list_lookup(void)
+{
+	int ret;
+
+	ret = test_client_user_list_lookup_simple();
+	test_out("run (ret == 0)", ret == 0);
+
+	return FALSE;
+}
+
 /* test */
 
 static void test_user_list(void)
@@ -1098,6 +1114,15 @@ static void test_user_list(void)
 	test_end();
 }
 
+static void test_user_list_lookup(void)
+{
+	test_begin("user list with userdb lookups");
+	test_expect_errors(0);
+	test_run_client_server(test_client_user_list_lookup,
+			       test_server_user_list);
+	test_end();
+}
+
 /*
  * All tests
  */
@@ -1114,6 +1139,7 @@ static void (*const test_functions[])(void) = {
 	test_passdb_lookup,
 	test_userdb_lookup,
 	test_user_list,
+	test_user_list_lookup,
 	NULL
 };
 
@@ -1223,6 +1249,44 @@ static int test_client_user_list_simple(void)
 	return ret;
 }
 
+static int test_client_user_list_lookup_simple(void)
+{
+	struct auth_master_connection *auth_conn;
+	struct auth_master_user_list_ctx *list_ctx;
+	enum auth_master_flags flags = 0;
+	struct auth_user_info info;
+	const char *username, *const *fields;
+	unsigned int count = 0;
+	int ret;
+
+	i_zero(&info);
+	info.service = "test";
+	info.debug = debug;
+
+	if (debug)
+		flags |= AUTH_MASTER_FLAG_DEBUG;
+
+	auth_conn = auth_master_init(TEST_SOCKET, flags);
+	auth_master_set_timeout(auth_conn, 1000);
+	list_ctx = auth_master_user_list_init_lookup(auth_conn, "*", &info, 4);
+	while ((username = auth_master_user_list_next_fields(list_ctx,
+							     &fields)) != NULL) {
+		if (strcmp(username, "user1") == 0) {
+			test_assert(fields != NULL &&
+				    str_array_length(fields) == 1 &&
+				    strcmp(fields[0], "home=/home/user1") == 0);
+		} else {
+			test_assert(fields == NULL);
+		}
+		count++;
+	}
+	test_assert(count == 4);
+	ret = auth_master_user_list_deinit(&list_ctx);
+	auth_master_deinit(&auth_conn);
+
+	return ret;
+}
+
 /*
  * Test server
  */
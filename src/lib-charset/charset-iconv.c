@@ -9,31 +9,116 @@
 #include <iconv.h>
 #include <ctype.h>
 
+/* Number of unused iconv handles to keep open. iconv_open() is slow, and
+   the same charsets are typically used over and over again. */
+#define ICONV_CACHE_SIZE 4
+
 struct charset_translation {
 	iconv_t cd;
+	char *charset;
 	normalizer_func_t *normalizer;
+	bool latin1;
+};
+
+struct iconv_cache_entry {
+	char *charset;
+	iconv_t cd;
 };
 
+/* Most recently used entry is first */
+static struct iconv_cache_entry iconv_cache[ICONV_CACHE_SIZE];
+static bool iconv_cache_atexit_registered = FALSE;
+
+static void iconv_cache_free(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ICONV_CACHE_SIZE; i++) {
+		if (iconv_cache[i].charset == NULL)
+			break;
+		iconv_close(iconv_cache[i].cd);
+		i_free_and_null(iconv_cache[i].charset);
+	}
+}
+
+static iconv_t iconv_cache_take(const char *charset)
+{
+	iconv_t cd;
+	unsigned int i;
+
+	for (i = 0; i < ICONV_CACHE_SIZE; i++) {
+		if (iconv_cache[i].charset == NULL)
+			break;
+		if (strcasecmp(iconv_cache[i].charset, charset) == 0) {
+			cd = iconv_cache[i].cd;
+			i_free(iconv_cache[i].charset);
+			memmove(iconv_cache + i, iconv_cache + i + 1,
+				sizeof(iconv_cache[0]) *
+				(ICONV_CACHE_SIZE - i - 1));
+			i_zero(&iconv_cache[ICONV_CACHE_SIZE-1]);
+			return cd;
+		}
+	}
+	return (iconv_t)-1;
+}
+
+static void iconv_cache_put(char *charset, iconv_t cd)
+{
+	struct iconv_cache_entry *last = &iconv_cache[ICONV_CACHE_SIZE-1];
+
+	if (!iconv_cache_atexit_registered) {
+		lib_atexit(iconv_cache_free);
+		iconv_cache_atexit_registered = TRUE;
+	}
+	if (last->charset != NULL) {
+		/* drop the least recently used handle */
+		iconv_close(last->cd);
+		i_free(last->charset);
+	}
+	memmove(iconv_cache + 1, iconv_cache,
+		sizeof(iconv_cache[0]) * (ICONV_CACHE_SIZE - 1));
+	(void)iconv(cd, NULL, NULL, NULL, NULL);
+	iconv_cache[0].charset = charset;
+	iconv_cache[0].cd = cd;
+}
+
+static bool charset_is_latin1(const char *charset)
+{
+	return strcasecmp(charset, "iso-8859-1") == 0 ||
+		strcasecmp(charset, "iso_8859-1") == 0 ||
+		strcasecmp(charset, "latin1") == 0;
+}
+
 static int
 iconv_charset_to_utf8_begin(const char *charset, normalizer_func_t *normalizer,
 			    struct charset_translation **t_r)
 {
 	struct charset_translation *t;
 	iconv_t cd;
+	bool latin1 = FALSE;
 
 	if (charset_is_utf8(charset))
 		cd = (iconv_t)-1;
-	else {
+	else if (charset_is_latin1(charset)) {
+		/* simple enough to convert without iconv */
+		cd = (iconv_t)-1;
+		latin1 = TRUE;
+	} else {
 		if (strcmp(charset, "UTF-8//TEST") == 0)
 			charset = "UTF-8";
-		cd = iconv_open("UTF-8", charset);
+		cd = iconv_cache_take(charset);
+		if (cd == (iconv_t)-1)
+			cd = iconv_open("UTF-8", charset);
 		if (cd == (iconv_t)-1)
 			return -1;
 	}
 
 	t = i_new(struct charset_translation, 1);
 	t->cd = cd;
+	if (cd != (iconv_t)-1)
+		t->charset = i_strdup(charset);
 	t->normalizer = normalizer;
+	t->latin1 = latin1;
 	*t_r = t;
 	return 0;
 }
@@ -41,7 +126,7 @@ iconv_charset_to_utf8_begin(const char *charset, normalizer_func_t *normalizer,
 static void iconv_charset_to_utf8_end(struct charset_translation *t)
 {
 	if (t->cd != (iconv_t)-1)
-		iconv_close(t->cd);
+		iconv_cache_put(t->charset, t->cd);
 	i_free(t);
 }
 
@@ -99,6 +184,32 @@ charset_to_utf8_try(struct charset_translation *t,
 	return ret;
 }
 
+static enum charset_result
+latin1_charset_to_utf8(struct charset_translation *t,
+		       const unsigned char *src, size_t src_size,
+		       buffer_t *dest)
+{
+	unsigned char tmpbuf[8192];
+	enum charset_result result = CHARSET_RET_OK;
+	size_t i, tmpbuf_used;
+
+	for (i = 0; i < src_size; ) {
+		for (tmpbuf_used = 0;
+		     i < src_size && tmpbuf_used + 2 <= sizeof(tmpbuf); i++) {
+			if (src[i] < 0x80)
+				tmpbuf[tmpbuf_used++] = src[i];
+			else {
+				tmpbuf[tmpbuf_used++] = 0xc0 | (src[i] >> 6);
+				tmpbuf[tmpbuf_used++] = 0x80 | (src[i] & 0x3f);
+			}
+		}
+		if (charset_utf8_to_utf8(t->normalizer, tmpbuf,
+					 &tmpbuf_used, dest) != CHARSET_RET_OK)
+			result = CHARSET_RET_INVALID_INPUT;
+	}
+	return result;
+}
+
 static enum charset_result
 iconv_charset_to_utf8(struct charset_translation *t,
 		      const unsigned char *src, size_t *src_size,
@@ -109,6 +220,9 @@ iconv_charset_to_utf8(struct charset_translation *t,
 	size_t prev_invalid_pos = SIZE_MAX;
 	bool ret;
 
+	if (t->latin1)
+		return latin1_charset_to_utf8(t, src, *src_size, dest);
+
 	for (pos = 0;;) {
 		i_assert(pos <= *src_size);
 		size = *src_size - pos;
@@ -1,25 +1,88 @@
 /* Copyright (c) 2020 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "buffer.h"
+#include "str.h"
 #include "istream.h"
 #include "ostream.h"
+#include "ostream-null.h"
+#include "iostream-temp.h"
 #include "randgen.h"
 #include "time-util.h"
 #include "strnum.h"
 #include "compression.h"
+#include "ostream-zlib.h"
 
 #include <stdio.h>
 #include <unistd.h>
+#include <dirent.h>
 #include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
 
 /**
  * Generates semi-compressible data in blocks of given size, to mimic emails
  * remotely and then compresses and decompresses it using each algorithm.
  * It measures the time spent on this giving some estimate how well the data
  * compressed and how long it took.
+ *
+ * With -c the benchmark is run against a real mail corpus instead: a maildir
+ * (or any directory of message files) or an mbox file. Each message is
+ * compressed and decompressed separately, and the results are reported per
+ * message size class: the compression ratio distribution, nanoseconds per
+ * message, the cost of a partial read from the middle of the message and of
+ * seeking back to the beginning afterwards, and the memory used by an
+ * ostream + istream pair.
  */
 
+/* Size of the partial read done from the middle of each message */
+#define BENCH_PARTIAL_READ_SIZE 4096
+/* Number of concurrent streams created when measuring memory usage */
+#define BENCH_MEMORY_STREAM_COUNT 200
+/* Frame size used for the "zstd-seekable" format */
+#define BENCH_ZSTD_SEEKABLE_FRAME_SIZE (64*1024)
+
+enum bench_output_format {
+	BENCH_OUTPUT_FORMAT_TEXT,
+	BENCH_OUTPUT_FORMAT_CSV,
+	BENCH_OUTPUT_FORMAT_JSON,
+};
+
+struct bench_handler {
+	const char *name;
+	const struct compression_handler *handler;
+	/* write zstd's seekable format */
+	bool zstd_seekable;
+};
+
+struct bench_size_class {
+	const char *name;
+	uoff_t max_size;
+};
+
+struct bench_result {
+	unsigned int count, partial_count;
+	uoff_t bytes, compressed_bytes;
+	uint64_t compress_nsecs, decompress_nsecs;
+	uint64_t partial_read_nsecs, seek_back_nsecs;
+	ARRAY(double) ratios;
+};
+
+static const struct bench_size_class bench_size_classes[] = {
+	{ "<4k", 4*1024 },
+	{ "<32k", 32*1024 },
+	{ "<256k", 256*1024 },
+	{ "<2M", 2*1024*1024 },
+	{ ">=2M", UOFF_T_MAX },
+};
+
+static ARRAY(buffer_t *) bench_messages;
+static size_t bench_median_size;
+static enum bench_output_format bench_output_format;
+static bool bench_output_header_written;
+
 static void bench_compression_speed(const struct compression_handler *handler,
 				    unsigned int level, unsigned long block_count)
 {
@@ -92,10 +155,551 @@ static void bench_compression_speed(const struct compression_handler *handler,
 
 }
 
+static void bench_corpus_add_message(const void *data, size_t size)
+{
+	buffer_t *msg = buffer_create_dynamic(default_pool, size);
+
+	buffer_append(msg, data, size);
+	array_push_back(&bench_messages, &msg);
+}
+
+static void bench_corpus_read_file(const char *path, buffer_t *buf)
+{
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+
+	buffer_set_used_size(buf, 0);
+	input = i_stream_create_file(path, IO_BLOCK_SIZE);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		buffer_append(buf, data, size);
+		i_stream_skip(input, size);
+	}
+	if (input->stream_errno != 0)
+		i_fatal("read(%s) failed: %s", path, i_stream_get_error(input));
+	i_stream_unref(&input);
+}
+
+static void bench_corpus_read_mbox(const char *path, unsigned int max_count)
+{
+	buffer_t *buf = buffer_create_dynamic(default_pool, 1024*1024);
+	const unsigned char *data, *end, *msg_start, *p;
+
+	bench_corpus_read_file(path, buf);
+	data = buf->data;
+	end = data + buf->used;
+
+	/* messages are separated by "From " lines */
+	msg_start = NULL;
+	for (p = data; p < end; ) {
+		const unsigned char *lf = memchr(p, '\n', end - p);
+		const unsigned char *next = lf == NULL ? end : lf + 1;
+
+		if ((size_t)(end - p) >= 5 && memcmp(p, "From ", 5) == 0 &&
+		    (p == data || p[-1] == '\n')) {
+			if (msg_start != NULL && p > msg_start)
+				bench_corpus_add_message(msg_start, p - msg_start);
+			if (array_count(&bench_messages) >= max_count)
+				break;
+			msg_start = next;
+		} else if (msg_start == NULL) {
+			/* not an mbox - treat the whole file as a message */
+			msg_start = data;
+		}
+		p = next;
+	}
+	if (msg_start != NULL && msg_start < end &&
+	    array_count(&bench_messages) < max_count)
+		bench_corpus_add_message(msg_start, end - msg_start);
+	buffer_free(&buf);
+}
+
+static void
+bench_corpus_read_dir(const char *path, buffer_t *buf, unsigned int max_count)
+{
+	DIR *dir;
+	struct dirent *d;
+	struct stat st;
+	const char *subpath;
+
+	dir = opendir(path);
+	if (dir == NULL)
+		i_fatal("opendir(%s) failed: %m", path);
+	while ((d = readdir(dir)) != NULL &&
+	       array_count(&bench_messages) < max_count) T_BEGIN {
+		/* skip hidden files, Dovecot's index and other metadata files
+		   and maildir's tmp/ directory */
+		if (d->d_name[0] != '.' &&
+		    !str_begins_with(d->d_name, "dovecot") &&
+		    !str_begins_with(d->d_name, "subscriptions") &&
+		    strcmp(d->d_name, "tmp") != 0) {
+			subpath = t_strconcat(path, "/", d->d_name, NULL);
+			if (stat(subpath, &st) < 0)
+				i_fatal("stat(%s) failed: %m", subpath);
+			if (S_ISDIR(st.st_mode))
+				bench_corpus_read_dir(subpath, buf, max_count);
+			else if (S_ISREG(st.st_mode) && st.st_size > 0) {
+				bench_corpus_read_file(subpath, buf);
+				bench_corpus_add_message(buf->data, buf->used);
+			}
+		}
+	} T_END;
+	if (closedir(dir) < 0)
+		i_error("closedir(%s) failed: %m", path);
+}
+
+static size_t bench_size_diff(size_t size1, size_t size2)
+{
+	return size1 > size2 ? size1 - size2 : size2 - size1;
+}
+
+static int bench_size_cmp(const size_t *s1, const size_t *s2)
+{
+	if (*s1 < *s2)
+		return -1;
+	return *s1 > *s2 ? 1 : 0;
+}
+
+static void bench_corpus_read(const char *path, unsigned int max_count)
+{
+	ARRAY(size_t) sizes;
+	buffer_t *msg;
+	struct stat st;
+	buffer_t *buf;
+
+	i_array_init(&bench_messages, 1024);
+	if (stat(path, &st) < 0)
+		i_fatal("stat(%s) failed: %m", path);
+	if (S_ISDIR(st.st_mode)) {
+		buf = buffer_create_dynamic(default_pool, 1024*64);
+		bench_corpus_read_dir(path, buf, max_count);
+		buffer_free(&buf);
+	} else {
+		bench_corpus_read_mbox(path, max_count);
+	}
+	if (array_count(&bench_messages) == 0)
+		i_fatal("No messages found from %s", path);
+
+	t_array_init(&sizes, array_count(&bench_messages));
+	array_foreach_elem(&bench_messages, msg)
+		array_push_back(&sizes, &msg->used);
+	array_sort(&sizes, bench_size_cmp);
+	bench_median_size = array_idx_elem(&sizes, array_count(&sizes) / 2);
+}
+
+static void bench_corpus_free(void)
+{
+	buffer_t *msg;
+
+	array_foreach_elem(&bench_messages, msg)
+		buffer_free(&msg);
+	array_free(&bench_messages);
+}
+
+static struct ostream *
+bench_create_ostream(const struct bench_handler *bhandler,
+		     struct ostream *output, int level)
+{
+#ifdef HAVE_ZSTD
+	if (bhandler->zstd_seekable) {
+		return o_stream_create_zstd_seekable(output, level,
+			BENCH_ZSTD_SEEKABLE_FRAME_SIZE, NULL, 0);
+	}
+#endif
+	return bhandler->handler->create_ostream(output, level);
+}
+
+static struct istream *
+bench_compress(const struct bench_handler *bhandler, int level,
+	       const buffer_t *msg, uint64_t *nsecs_r)
+{
+	struct ostream *temp_output, *output;
+	struct istream *input;
+	uint64_t ts;
+
+	temp_output = iostream_temp_create_sized(".bench-compression.", 0,
+						 "compressed", SIZE_MAX);
+	ts = i_nanoseconds();
+	output = bench_create_ostream(bhandler, temp_output, level);
+	o_stream_nsend(output, msg->data, msg->used);
+	if (o_stream_finish(output) < 0) {
+		i_fatal("%s: Compression failed: %s", bhandler->name,
+			o_stream_get_error(output));
+	}
+	*nsecs_r = i_nanoseconds() - ts;
+	o_stream_unref(&output);
+	input = iostream_temp_finish(&temp_output, IO_BLOCK_SIZE);
+	return input;
+}
+
+static uint64_t
+bench_decompress(const struct bench_handler *bhandler,
+		 struct istream *compressed, const buffer_t *msg)
+{
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	uint64_t ts, nsecs;
+
+	i_stream_seek(compressed, 0);
+	ts = i_nanoseconds();
+	input = bhandler->handler->create_istream(compressed);
+	while (i_stream_read_more(input, &data, &size) > 0)
+		i_stream_skip(input, size);
+	nsecs = i_nanoseconds() - ts;
+	if (input->stream_errno != 0) {
+		i_fatal("%s: Decompression failed: %s", bhandler->name,
+			i_stream_get_error(input));
+	}
+	if (input->v_offset != msg->used) {
+		i_fatal("%s: Decompressed size %"PRIuUOFF_T" != %zu",
+			bhandler->name, input->v_offset, msg->used);
+	}
+	i_stream_unref(&input);
+	return nsecs;
+}
+
+static void
+bench_partial_read(const struct bench_handler *bhandler,
+		   struct istream *compressed, const buffer_t *msg,
+		   struct bench_result *result)
+{
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	uint64_t ts;
+
+	i_stream_seek(compressed, 0);
+	input = bhandler->handler->create_istream(compressed);
+
+	/* e.g. FETCH BODY[]<offset.size> from the middle of the message */
+	ts = i_nanoseconds();
+	i_stream_seek(input, msg->used / 2);
+	if (i_stream_read_bytes(input, &data, &size,
+				BENCH_PARTIAL_READ_SIZE) <= 0)
+		i_fatal("%s: Partial read failed", bhandler->name);
+	result->partial_read_nsecs += i_nanoseconds() - ts;
+
+	/* seeking backwards, e.g. a following FETCH of the header */
+	ts = i_nanoseconds();
+	i_stream_seek(input, 0);
+	if (i_stream_read_bytes(input, &data, &size,
+				BENCH_PARTIAL_READ_SIZE) <= 0)
+		i_fatal("%s: Seeking backwards failed", bhandler->name);
+	result->seek_back_nsecs += i_nanoseconds() - ts;
+	result->partial_count++;
+	i_stream_unref(&input);
+}
+
+static void
+bench_result_add(struct bench_result *result, const buffer_t *msg,
+		 uoff_t compressed_size, uint64_t compress_nsecs,
+		 uint64_t decompress_nsecs)
+{
+	double ratio = (double)compressed_size / (double)msg->used;
+
+	result->count++;
+	result->bytes += msg->used;
+	result->compressed_bytes += compressed_size;
+	result->compress_nsecs += compress_nsecs;
+	result->decompress_nsecs += decompress_nsecs;
+	array_push_back(&result->ratios, &ratio);
+}
+
+static int bench_ratio_cmp(const double *r1, const double *r2)
+{
+	if (*r1 < *r2)
+		return -1;
+	return *r1 > *r2 ? 1 : 0;
+}
+
+static double bench_result_percentile(struct bench_result *result,
+				      unsigned int percentile)
+{
+	const double *ratios;
+	unsigned int count;
+
+	ratios = array_get(&result->ratios, &count);
+	if (count == 0)
+		return 0;
+	return ratios[(count - 1) * percentile / 100];
+}
+
+/* Returns the memory used by an ostream + istream pair in bytes. This is
+   measured by creating many concurrent streams in a child process and
+   comparing its maximum RSS to a child that doesn't create any streams. */
+static long
+bench_stream_memory_child(const struct bench_handler *bhandler, int level,
+			  const buffer_t *msg, struct istream *compressed)
+{
+	struct ostream *outputs[BENCH_MEMORY_STREAM_COUNT];
+	struct istream *inputs[BENCH_MEMORY_STREAM_COUNT];
+	struct ostream *null_output;
+	struct rusage ru;
+	const unsigned char *data;
+	size_t size;
+	int status;
+	pid_t pid;
+
+	if ((pid = fork()) < 0)
+		i_fatal("fork() failed: %m");
+	if (pid == 0) {
+		if (bhandler == NULL)
+			_exit(0);
+		for (unsigned int i = 0; i < N_ELEMENTS(outputs); i++) {
+			null_output = o_stream_create_null();
+			outputs[i] = bench_create_ostream(bhandler, null_output,
+							  level);
+			o_stream_unref(&null_output);
+			o_stream_nsend(outputs[i], msg->data, msg->used);
+			(void)o_stream_flush(outputs[i]);
+
+			i_stream_seek(compressed, 0);
+			inputs[i] = i_stream_create_limit(compressed,
+							  UOFF_T_MAX);
+			inputs[i] = bhandler->handler->create_istream(inputs[i]);
+			(void)i_stream_read_more(inputs[i], &data, &size);
+		}
+		_exit(0);
+	}
+	if (wait4(pid, &status, 0, &ru) < 0)
+		i_fatal("wait4() failed: %m");
+	/* ru_maxrss is in kilobytes */
+	return ru.ru_maxrss * 1024L;
+}
+
+static long
+bench_stream_memory(const struct bench_handler *bhandler, int level,
+		    const buffer_t *msg, struct istream *compressed)
+{
+	long base, used;
+
+	base = bench_stream_memory_child(NULL, level, msg, compressed);
+	used = bench_stream_memory_child(bhandler, level, msg, compressed);
+	return used < base ? 0 : (used - base) / BENCH_MEMORY_STREAM_COUNT;
+}
+
+static void
+bench_result_print(const struct bench_handler *bhandler, int level,
+		   const char *size_class, struct bench_result *result,
+		   long stream_memory)
+{
+	double count = result->count, partial_count = result->partial_count;
+	double partial_read_ns, seek_back_ns;
+
+	if (result->count == 0)
+		return;
+	array_sort(&result->ratios, bench_ratio_cmp);
+	partial_read_ns = partial_count == 0 ? 0 :
+		result->partial_read_nsecs / partial_count;
+	seek_back_ns = partial_count == 0 ? 0 :
+		result->seek_back_nsecs / partial_count;
+
+	switch (bench_output_format) {
+	case BENCH_OUTPUT_FORMAT_TEXT:
+		printf("%-14s %5d %-6s %7u %12"PRIuUOFF_T" %7.2lf%% "
+		       "%6.3lf %6.3lf %6.3lf %12.0lf %12.0lf %12.0lf %12.0lf %9ld\n",
+		       bhandler->name, level, size_class, result->count,
+		       result->bytes,
+		       (1.0 - (double)result->compressed_bytes /
+			(double)result->bytes) * 100.0,
+		       bench_result_percentile(result, 10),
+		       bench_result_percentile(result, 50),
+		       bench_result_percentile(result, 90),
+		       result->compress_nsecs / count,
+		       result->decompress_nsecs / count,
+		       partial_read_ns, seek_back_ns, stream_memory);
+		break;
+	case BENCH_OUTPUT_FORMAT_CSV:
+		printf("%s,%d,%s,%u,%"PRIuUOFF_T",%"PRIuUOFF_T",%.4lf,%.4lf,"
+		       "%.4lf,%.4lf,%.0lf,%.0lf,%.0lf,%.0lf,%ld\n",
+		       bhandler->name, level, size_class, result->count,
+		       result->bytes, result->compressed_bytes,
+		       bench_result_percentile(result, 10),
+		       bench_result_percentile(result, 50),
+		       bench_result_percentile(result, 90),
+		       bench_result_percentile(result, 99),
+		       result->compress_nsecs / count,
+		       result->decompress_nsecs / count,
+		       partial_read_ns, seek_back_ns, stream_memory);
+		break;
+	case BENCH_OUTPUT_FORMAT_JSON:
+		printf("%s{\"handler\":\"%s\",\"level\":%d,"
+		       "\"size_class\":\"%s\",\"messages\":%u,"
+		       "\"bytes\":%"PRIuUOFF_T",\"compressed_bytes\":%"PRIuUOFF_T","
+		       "\"ratio_p10\":%.4lf,\"ratio_p50\":%.4lf,"
+		       "\"ratio_p90\":%.4lf,\"ratio_p99\":%.4lf,"
+		       "\"compress_ns_per_msg\":%.0lf,"
+		       "\"decompress_ns_per_msg\":%.0lf,"
+		       "\"partial_read_ns\":%.0lf,\"seek_back_ns\":%.0lf,"
+		       "\"stream_memory_bytes\":%ld}",
+		       bench_output_header_written ? ",\n" : "",
+		       bhandler->name, level, size_class, result->count,
+		       result->bytes, result->compressed_bytes,
+		       bench_result_percentile(result, 10),
+		       bench_result_percentile(result, 50),
+		       bench_result_percentile(result, 90),
+		       bench_result_percentile(result, 99),
+		       result->compress_nsecs / count,
+		       result->decompress_nsecs / count,
+		       partial_read_ns, seek_back_ns, stream_memory);
+		bench_output_header_written = TRUE;
+		break;
+	}
+}
+
+static void bench_corpus_print_header(void)
+{
+	switch (bench_output_format) {
+	case BENCH_OUTPUT_FORMAT_TEXT:
+		printf("%u messages, ratios are compressed/original size, "
+		       "times are nanoseconds per message,\n"
+		       "partial reads are %u bytes from the middle of messages "
+		       "larger than %u bytes\n\n",
+		       array_count(&bench_messages), BENCH_PARTIAL_READ_SIZE,
+		       BENCH_PARTIAL_READ_SIZE*2);
+		printf("%-14s %5s %-6s %7s %12s %8s %6s %6s %6s "
+		       "%12s %12s %12s %12s %9s\n",
+		       "handler", "level", "size", "msgs", "bytes", "saving",
+		       "p10", "p50", "p90", "compress", "decompress",
+		       "partial", "seek back", "mem");
+		break;
+	case BENCH_OUTPUT_FORMAT_CSV:
+		printf("handler,level,size_class,messages,bytes,"
+		       "compressed_bytes,ratio_p10,ratio_p50,ratio_p90,"
+		       "ratio_p99,compress_ns_per_msg,decompress_ns_per_msg,"
+		       "partial_read_ns,seek_back_ns,stream_memory_bytes\n");
+		break;
+	case BENCH_OUTPUT_FORMAT_JSON:
+		printf("[\n");
+		break;
+	}
+}
+
+static void
+bench_corpus_handler(const struct bench_handler *bhandler, int level)
+{
+	struct bench_result results[N_ELEMENTS(bench_size_classes)];
+	struct bench_result total;
+	const buffer_t *memory_msg = NULL;
+	buffer_t *msg;
+	struct istream *compressed, *memory_compressed = NULL;
+	uint64_t compress_nsecs, decompress_nsecs;
+	uoff_t compressed_size;
+	unsigned int i;
+	long stream_memory;
+
+	i_zero(&results);
+	i_zero(&total);
+	for (i = 0; i < N_ELEMENTS(results); i++)
+		i_array_init(&results[i].ratios, 128);
+	i_array_init(&total.ratios, array_count(&bench_messages));
+
+	array_foreach_elem(&bench_messages, msg) {
+		for (i = 0; msg->used >= bench_size_classes[i].max_size; i++) ;
+
+		compressed = bench_compress(bhandler, level, msg,
+					    &compress_nsecs);
+		if (i_stream_get_size(compressed, TRUE, &compressed_size) <= 0)
+			i_fatal("%s: Failed to get compressed size",
+				bhandler->name);
+		decompress_nsecs = bench_decompress(bhandler, compressed, msg);
+		bench_result_add(&results[i], msg, compressed_size,
+				 compress_nsecs, decompress_nsecs);
+		bench_result_add(&total, msg, compressed_size,
+				 compress_nsecs, decompress_nsecs);
+		if (msg->used >= BENCH_PARTIAL_READ_SIZE*2) {
+			bench_partial_read(bhandler, compressed, msg,
+					   &results[i]);
+			bench_partial_read(bhandler, compressed, msg, &total);
+		}
+		/* use the message closest to the median size for memory
+		   measurements */
+		if (memory_msg == NULL ||
+		    bench_size_diff(msg->used, bench_median_size) <
+		    bench_size_diff(memory_msg->used, bench_median_size)) {
+			i_stream_unref(&memory_compressed);
+			memory_msg = msg;
+			memory_compressed = compressed;
+			i_stream_ref(memory_compressed);
+		}
+		i_stream_unref(&compressed);
+	}
+	stream_memory = bench_stream_memory(bhandler, level, memory_msg,
+					    memory_compressed);
+	i_stream_unref(&memory_compressed);
+
+	for (i = 0; i < N_ELEMENTS(results); i++) {
+		bench_result_print(bhandler, level, bench_size_classes[i].name,
+				   &results[i], stream_memory);
+		array_free(&results[i].ratios);
+	}
+	bench_result_print(bhandler, level, "all", &total, stream_memory);
+	array_free(&total.ratios);
+	if (bench_output_format == BENCH_OUTPUT_FORMAT_TEXT)
+		printf("\n");
+	fflush(stdout);
+}
+
+static void
+bench_corpus(const char *path, unsigned int max_count, const char *levels)
+{
+	ARRAY(struct bench_handler) bhandlers;
+	const struct bench_handler *bhandler;
+	struct bench_handler *new_bhandler;
+	const char *const *level_strs;
+	unsigned int i;
+	int level;
+
+	bench_corpus_read(path, max_count);
+
+	t_array_init(&bhandlers, 8);
+	for (i = 0; compression_handlers[i].name != NULL; i++) {
+		if (compression_handlers[i].create_istream == NULL ||
+		    compression_handlers[i].create_ostream == NULL)
+			continue;
+		new_bhandler = array_append_space(&bhandlers);
+		new_bhandler->name = compression_handlers[i].name;
+		new_bhandler->handler = &compression_handlers[i];
+#ifdef HAVE_ZSTD
+		if (strcmp(new_bhandler->name, "zstd") == 0) {
+			bhandler = new_bhandler;
+			new_bhandler = array_append_space(&bhandlers);
+			new_bhandler->name = "zstd-seekable";
+			new_bhandler->handler = bhandler->handler;
+			new_bhandler->zstd_seekable = TRUE;
+		}
+#endif
+	}
+
+	level_strs = levels == NULL ? NULL : t_strsplit(levels, ",");
+	bench_corpus_print_header();
+	array_foreach(&bhandlers, bhandler) T_BEGIN {
+		if (level_strs == NULL) {
+			bench_corpus_handler(bhandler,
+				bhandler->handler->get_default_level());
+		} else for (i = 0; level_strs[i] != NULL; i++) {
+			if (str_to_int(level_strs[i], &level) < 0)
+				i_fatal("Invalid level: %s", level_strs[i]);
+			/* clamp to the levels supported by the handler */
+			level = I_MAX(level, bhandler->handler->get_min_level());
+			level = I_MIN(level, bhandler->handler->get_max_level());
+			bench_corpus_handler(bhandler, level);
+		}
+	} T_END;
+	if (bench_output_format == BENCH_OUTPUT_FORMAT_JSON)
+		printf("\n]\n");
+	bench_corpus_free();
+}
+
 static void print_usage(const char *prog)
 {
 	fprintf(stderr, "Usage: %s block_size count level\n", prog);
 	fprintf(stderr, "Runs with 1000 8k blocks using level 6 if nothing given\n");
+	fprintf(stderr, "Usage: %s -c <maildir|mbox> [-l <level>[,<level>...]] "
+		"[-n <max messages>] [-f text|csv|json]\n", prog);
+	fprintf(stderr, "Runs against a mail corpus using each handler's "
+		"default level if not given\n");
 	lib_exit(1);
 }
 
@@ -106,7 +710,46 @@ int main(int argc, const char *argv[])
 
 	unsigned long block_size = 8192UL;
 	unsigned long block_count = 1000UL;
-
+	const char *corpus_path = NULL, *levels = NULL;
+	unsigned int max_count = UINT_MAX;
+	int c;
+
+	while ((c = getopt(argc, (char **)argv, "c:f:l:n:")) > 0) {
+		switch (c) {
+		case 'c':
+			corpus_path = optarg;
+			break;
+		case 'f':
+			if (strcmp(optarg, "text") == 0)
+				bench_output_format = BENCH_OUTPUT_FORMAT_TEXT;
+			else if (strcmp(optarg, "csv") == 0)
+				bench_output_format = BENCH_OUTPUT_FORMAT_CSV;
+			else if (strcmp(optarg, "json") == 0)
+				bench_output_format = BENCH_OUTPUT_FORMAT_JSON;
+			else
+				print_usage(argv[0]);
+			break;
+		case 'l':
+			levels = optarg;
+			break;
+		case 'n':
+			if (str_to_uint(optarg, &max_count) < 0 ||
+			    max_count == 0)
+				print_usage(argv[0]);
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+	if (corpus_path != NULL) {
+		if (optind != argc)
+			print_usage(argv[0]);
+		bench_corpus(corpus_path, max_count, levels);
+		lib_deinit();
+		return 0;
+	}
+	if (optind != 1)
+		print_usage(argv[0]);
 	if (argc >= 3) {
 		if (str_to_ulong(argv[1], &block_size) < 0 ||
 		    str_to_ulong(argv[2], &block_count) < 0) {
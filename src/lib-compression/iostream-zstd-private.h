@@ -1,6 +1,32 @@
 #ifndef IOSTREAM_ZSTD_PRIVATE_H
 #define IOSTREAM_ZSTD_PRIVATE_H 1
 
+/* Dictionaries can be used only with the advanced API added in v1.4.0.
+   Writing multiple frames with the same stream also requires it. */
+#if ZSTD_VERSION_NUMBER >= 10400
+#  define IOSTREAM_ZSTD_HAVE_DICT
+#  define IOSTREAM_ZSTD_HAVE_SEEKABLE_WRITE
+#endif
+
+/* The seekable format is compatible with zstd's contrib/seekable_format:
+   Independently compressed frames are followed by a skippable frame
+   containing the seek table:
+
+   skippable frame magic (4 bytes LE), frame size (4 bytes LE),
+   for each frame: compressed size (4 bytes LE),
+                   decompressed size (4 bytes LE),
+                   [checksum (4 bytes LE) if checksum flag is set]
+   number of frames (4 bytes LE), descriptor (1 byte),
+   seekable magic (4 bytes LE) */
+#define IOSTREAM_ZSTD_SEEKABLE_SKIPPABLE_MAGIC 0x184D2A5E
+#define IOSTREAM_ZSTD_SEEKABLE_MAGIC 0x8F92EAB1
+#define IOSTREAM_ZSTD_SEEKABLE_HEADER_SIZE 8
+#define IOSTREAM_ZSTD_SEEKABLE_FOOTER_SIZE 9
+#define IOSTREAM_ZSTD_SEEKABLE_ENTRY_SIZE 8
+#define IOSTREAM_ZSTD_SEEKABLE_CHECKSUM_ENTRY_SIZE 12
+#define IOSTREAM_ZSTD_SEEKABLE_DESC_CHECKSUM 0x80
+#define IOSTREAM_ZSTD_SEEKABLE_DESC_RESERVED 0x7c
+
 /* a horrible hack to fix issues when the installed libzstd is lot
    newer than what we were compiled against. */
 static inline ZSTD_ErrorCode zstd_version_errcode(ZSTD_ErrorCode err)
@@ -7,4 +7,28 @@ struct istream *i_stream_create_bz2(struct istream *input);
 struct istream *i_stream_create_lz4(struct istream *input);
 struct istream *i_stream_create_zstd(struct istream *input);
 
+/* Returns TRUE and the zstd dictionary with the given ID, or FALSE if it's
+   not known. The dictionary must stay valid until the istream is
+   destroyed. */
+typedef bool zstd_dict_lookup_callback_t(unsigned int dict_id,
+					 const void **dict_r,
+					 size_t *dict_size_r, void *context);
+/* Like i_stream_create_zstd(), but if the input was compressed with a
+   dictionary, it's looked up via the callback. */
+struct istream *
+i_stream_create_zstd_dict(struct istream *input,
+			  zstd_dict_lookup_callback_t *callback,
+			  void *context);
+#define i_stream_create_zstd_dict(input, callback, context) \
+	i_stream_create_zstd_dict(input - \
+		CALLBACK_TYPECHECK(callback, bool (*)( \
+			unsigned int, const void **, size_t *, \
+			typeof(context))), \
+		(zstd_dict_lookup_callback_t *)callback, context)
+/* Returns TRUE if the zstd input is in the seekable format (see
+   o_stream_create_zstd_seekable()). Seeking in such streams doesn't require
+   decompressing everything before the offset. The seek table is read from
+   the end of the input, so this requires a seekable parent stream. */
+bool i_stream_zstd_is_seekable(struct istream *input);
+
 #endif
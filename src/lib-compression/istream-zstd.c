@@ -4,7 +4,9 @@
 
 #ifdef HAVE_ZSTD
 
+#include "array.h"
 #include "buffer.h"
+#include "byteorder.h"
 #include "istream-private.h"
 #include "istream-zlib.h"
 
@@ -22,6 +24,16 @@ ZSTD_ErrorCode ZSTD_getErrorCode(size_t functionResult)
 }
 #endif
 
+/* Don't load seek tables with more frames than this. With the default frame
+   sizes this is large enough for any mail. */
+#define ZSTD_SEEK_TABLE_MAX_FRAMES (1024*1024)
+
+struct zstd_seek_frame {
+	/* offsets where the frame starts */
+	uoff_t compressed_offset;
+	uoff_t uncompressed_offset;
+};
+
 struct zstd_istream {
 	struct istream_private istream;
 
@@ -40,7 +52,17 @@ struct zstd_istream {
 	/* storage for data */
 	buffer_t *data_buffer;
 
+	zstd_dict_lookup_callback_t *dict_callback;
+	void *dict_context;
+	const void *dict;
+	size_t dict_size;
+
+	/* frames of the seekable format */
+	ARRAY(struct zstd_seek_frame) seek_frames;
+
 	bool hdr_read:1;
+	bool dict_checked:1;
+	bool seek_table_checked:1;
 	bool marked:1;
 	bool zs_closed:1;
 	/* is there data remaining */
@@ -53,6 +75,14 @@ static void i_stream_zstd_init(struct zstd_istream *zstream)
 	if (zstream->dstream == NULL)
 		i_fatal_status(FATAL_OUTOFMEM, "zstd: Out of memory");
 	ZSTD_initDStream(zstream->dstream);
+#ifdef IOSTREAM_ZSTD_HAVE_DICT
+	if (zstream->dict != NULL) {
+		/* the same dictionary was already successfully loaded
+		   before the stream was reset */
+		(void)ZSTD_DCtx_loadDictionary(zstream->dstream, zstream->dict,
+					       zstream->dict_size);
+	}
+#endif
 	zstream->input_size = ZSTD_DStreamInSize();
 	if (zstream->frame_buffer == NULL)
 		zstream->frame_buffer = buffer_create_dynamic(default_pool, ZSTD_DStreamInSize());
@@ -87,6 +117,7 @@ static void i_stream_zstd_close(struct iostream_private *stream,
 	if (!zstream->zs_closed)
 		i_stream_zstd_deinit(zstream, FALSE);
 	buffer_free(&zstream->frame_buffer);
+	array_free(&zstream->seek_frames);
 	if (close_parent)
 		i_stream_close(zstream->istream.parent);
 }
@@ -115,6 +146,54 @@ static void i_stream_zstd_read_error(struct zstd_istream *zstream, size_t err)
 			    i_stream_get_absolute_offset(&zstream->istream.istream));
 }
 
+#ifdef IOSTREAM_ZSTD_HAVE_DICT
+/* The largest possible frame header, which contains the dictionary ID
+   (ZSTD_FRAMEHEADERSIZE_MAX is available only with static linking) */
+#define ZSTD_FRAME_HEADER_MAX_SIZE 18
+
+static int i_stream_zstd_load_dict(struct zstd_istream *zstream)
+{
+	struct istream_private *stream = &zstream->istream;
+	const unsigned char *data;
+	unsigned int dict_id;
+	size_t size, zret;
+	ssize_t ret;
+
+	ret = i_stream_read_bytes(stream->parent, &data, &size,
+				  ZSTD_FRAME_HEADER_MAX_SIZE);
+	if (ret == 0)
+		return 0;
+	zstream->dict_checked = TRUE;
+	if (ret < 0 && size == 0) {
+		/* let the regular read handle the error */
+		return 1;
+	}
+
+	dict_id = ZSTD_getDictID_fromFrame(data, size);
+	if (dict_id == 0)
+		return 1;
+	if (!zstream->dict_callback(dict_id, &zstream->dict,
+				    &zstream->dict_size,
+				    zstream->dict_context)) {
+		zstream->dict = NULL;
+		stream->istream.stream_errno = EINVAL;
+		io_stream_set_error(&stream->iostream,
+				    "zstd.read(%s): Unknown dictionary ID %u",
+				    i_stream_get_name(&stream->istream),
+				    dict_id);
+		return -1;
+	}
+	zret = ZSTD_DCtx_loadDictionary(zstream->dstream, zstream->dict,
+					zstream->dict_size);
+	if (ZSTD_isError(zret) != 0) {
+		zstream->dict = NULL;
+		i_stream_zstd_read_error(zstream, zret);
+		return -1;
+	}
+	return 1;
+}
+#endif
+
 static ssize_t i_stream_zstd_read(struct istream_private *stream)
 {
 	struct zstd_istream *zstream =
@@ -125,6 +204,14 @@ static ssize_t i_stream_zstd_read(struct istream_private *stream)
 	if (stream->istream.eof)
 		return -1;
 
+#ifdef IOSTREAM_ZSTD_HAVE_DICT
+	if (zstream->dict_callback != NULL && !zstream->dict_checked) {
+		int ret = i_stream_zstd_load_dict(zstream);
+		if (ret <= 0)
+			return ret;
+	}
+#endif
+
 	for (;;) {
 		if (zstream->data_buffer->used > 0) {
 			if (!i_stream_try_alloc(stream, stream->max_buffer_size, &size))
@@ -190,26 +277,190 @@ static ssize_t i_stream_zstd_read(struct istream_private *stream)
 	i_unreached();
 }
 
-static void i_stream_zstd_reset(struct zstd_istream *zstream)
+static void
+i_stream_zstd_reset_to(struct zstd_istream *zstream,
+		       const struct zstd_seek_frame *frame)
 {
 	struct istream_private *stream = &zstream->istream;
+	uoff_t parent_offset = stream->parent_start_offset +
+		(frame == NULL ? 0 : frame->compressed_offset);
 
-	i_stream_seek(stream->parent, stream->parent_start_offset);
-	stream->parent_expected_offset = stream->parent_start_offset;
+	i_stream_seek(stream->parent, parent_offset);
+	stream->parent_expected_offset = parent_offset;
 	stream->skip = stream->pos = 0;
-	stream->istream.v_offset = 0;
+	stream->istream.v_offset = frame == NULL ? 0 :
+		frame->uncompressed_offset;
 	stream->high_pos = 0;
+	zstream->remain = FALSE;
 
 	i_stream_zstd_deinit(zstream, TRUE);
 	i_stream_zstd_init(zstream);
 }
 
+static void i_stream_zstd_reset(struct zstd_istream *zstream)
+{
+	i_stream_zstd_reset_to(zstream, NULL);
+}
+
+static int
+i_stream_zstd_read_seek_table_data(struct istream *input, uoff_t offset,
+				   size_t size, buffer_t *dest)
+{
+	const unsigned char *data;
+	size_t data_size;
+	ssize_t ret;
+
+	i_stream_seek(input, offset);
+	while (dest->used < size) {
+		ret = i_stream_read_more(input, &data, &data_size);
+		if (ret <= 0) {
+			/* 0 can be returned only for non-blocking streams,
+			   which don't get here */
+			return -1;
+		}
+		data_size = I_MIN(data_size, size - dest->used);
+		buffer_append(dest, data, data_size);
+		i_stream_skip(input, data_size);
+	}
+	return 0;
+}
+
+static int
+i_stream_zstd_parse_seek_table(struct zstd_istream *zstream, uoff_t end_offset)
+{
+	struct istream_private *stream = &zstream->istream;
+	struct zstd_seek_frame *frame;
+	const unsigned char *data;
+	unsigned int i, frame_count, entry_size;
+	uoff_t table_size, compressed_offset = 0, uncompressed_offset = 0;
+	buffer_t *buf;
+
+	if (end_offset - stream->parent_start_offset <
+	    IOSTREAM_ZSTD_SEEKABLE_HEADER_SIZE +
+	    IOSTREAM_ZSTD_SEEKABLE_FOOTER_SIZE)
+		return -1;
+
+	buf = t_buffer_create(IOSTREAM_ZSTD_SEEKABLE_FOOTER_SIZE);
+	if (i_stream_zstd_read_seek_table_data(stream->parent,
+			end_offset - IOSTREAM_ZSTD_SEEKABLE_FOOTER_SIZE,
+			IOSTREAM_ZSTD_SEEKABLE_FOOTER_SIZE, buf) < 0)
+		return -1;
+	data = buf->data;
+	if (le32_to_cpu_unaligned(data + 5) != IOSTREAM_ZSTD_SEEKABLE_MAGIC ||
+	    (data[4] & IOSTREAM_ZSTD_SEEKABLE_DESC_RESERVED) != 0)
+		return -1;
+	frame_count = le32_to_cpu_unaligned(data);
+	entry_size = (data[4] & IOSTREAM_ZSTD_SEEKABLE_DESC_CHECKSUM) != 0 ?
+		IOSTREAM_ZSTD_SEEKABLE_CHECKSUM_ENTRY_SIZE :
+		IOSTREAM_ZSTD_SEEKABLE_ENTRY_SIZE;
+	if (frame_count == 0 || frame_count > ZSTD_SEEK_TABLE_MAX_FRAMES)
+		return -1;
+	table_size = IOSTREAM_ZSTD_SEEKABLE_HEADER_SIZE +
+		(uoff_t)frame_count * entry_size +
+		IOSTREAM_ZSTD_SEEKABLE_FOOTER_SIZE;
+	if (table_size > end_offset - stream->parent_start_offset)
+		return -1;
+
+	buf = t_buffer_create(table_size);
+	if (i_stream_zstd_read_seek_table_data(stream->parent,
+			end_offset - table_size, table_size, buf) < 0)
+		return -1;
+	if (le32_to_cpu_unaligned(buf->data) !=
+	    IOSTREAM_ZSTD_SEEKABLE_SKIPPABLE_MAGIC ||
+	    le32_to_cpu_unaligned(CONST_PTR_OFFSET(buf->data, 4)) !=
+	    table_size - IOSTREAM_ZSTD_SEEKABLE_HEADER_SIZE)
+		return -1;
+
+	i_array_init(&zstream->seek_frames, frame_count);
+	data = CONST_PTR_OFFSET(buf->data, IOSTREAM_ZSTD_SEEKABLE_HEADER_SIZE);
+	for (i = 0; i < frame_count; i++, data += entry_size) {
+		frame = array_append_space(&zstream->seek_frames);
+		frame->compressed_offset = compressed_offset;
+		frame->uncompressed_offset = uncompressed_offset;
+		compressed_offset += le32_to_cpu_unaligned(data);
+		uncompressed_offset += le32_to_cpu_unaligned(data + 4);
+	}
+	/* the frames must be immediately followed by the seek table */
+	if (stream->parent_start_offset + compressed_offset + table_size !=
+	    end_offset) {
+		array_free(&zstream->seek_frames);
+		return -1;
+	}
+	stream->cached_stream_size = uncompressed_offset;
+	return 0;
+}
+
+static bool i_stream_zstd_have_seek_table(struct zstd_istream *zstream)
+{
+	struct istream_private *stream = &zstream->istream;
+	uoff_t size;
+
+	if (zstream->seek_table_checked)
+		return array_is_created(&zstream->seek_frames);
+	zstream->seek_table_checked = TRUE;
+
+	if (!stream->parent->seekable ||
+	    i_stream_get_size(stream->parent, TRUE, &size) <= 0)
+		return FALSE;
+	T_BEGIN {
+		(void)i_stream_zstd_parse_seek_table(zstream, size);
+	} T_END;
+	/* the next read will continue from parent_expected_offset */
+	i_stream_seek(stream->parent, stream->parent_expected_offset);
+	return array_is_created(&zstream->seek_frames);
+}
+
+static const struct zstd_seek_frame *
+i_stream_zstd_find_frame(struct zstd_istream *zstream, uoff_t v_offset)
+{
+	const struct zstd_seek_frame *frames;
+	unsigned int count, left = 0, right, idx;
+
+	/* find the last frame starting at or before v_offset */
+	frames = array_get(&zstream->seek_frames, &count);
+	right = count;
+	while (left + 1 < right) {
+		idx = (left + right) / 2;
+		if (frames[idx].uncompressed_offset <= v_offset)
+			left = idx;
+		else
+			right = idx;
+	}
+	return &frames[left];
+}
+
+static void
+i_stream_zstd_seek_frame(struct zstd_istream *zstream, uoff_t v_offset)
+{
+	struct istream_private *stream = &zstream->istream;
+	const struct zstd_seek_frame *frame;
+	uoff_t start_offset = stream->istream.v_offset - stream->skip;
+
+	if (v_offset >= start_offset && v_offset <= start_offset + stream->pos) {
+		/* already in buffer */
+		return;
+	}
+	if (!i_stream_zstd_have_seek_table(zstream))
+		return;
+
+	frame = i_stream_zstd_find_frame(zstream, v_offset);
+	if (v_offset >= start_offset &&
+	    frame->uncompressed_offset <= start_offset + stream->pos) {
+		/* the frame is already being read - just read forward */
+		return;
+	}
+	i_stream_zstd_reset_to(zstream, frame);
+}
+
 static void
 i_stream_zstd_seek(struct istream_private *stream, uoff_t v_offset, bool mark)
 {
 	struct zstd_istream *zstream =
 		container_of(stream, struct zstd_istream, istream);
 
+	/* with the seekable format, jump directly to the frame containing
+	   the offset */
+	i_stream_zstd_seek_frame(zstream, v_offset);
 	if (i_stream_nonseekable_try_seek(stream, v_offset))
 		return;
 
@@ -237,17 +488,24 @@ static void i_stream_zstd_sync(struct istream_private *stream)
 		}
 		zstream->last_parent_statbuf = *st;
 	}
+	array_free(&zstream->seek_frames);
+	zstream->seek_table_checked = FALSE;
+	stream->cached_stream_size = UOFF_T_MAX;
 	i_stream_zstd_reset(zstream);
 }
 
-struct istream *
-i_stream_create_zstd(struct istream *input)
+static struct istream *
+i_stream_create_zstd_int(struct istream *input,
+			 zstd_dict_lookup_callback_t *dict_callback,
+			 void *dict_context)
 {
 	struct zstd_istream *zstream;
 
 	zstd_version_check();
 
 	zstream = i_new(struct zstd_istream, 1);
+	zstream->dict_callback = dict_callback;
+	zstream->dict_context = dict_context;
 
 	i_stream_zstd_init(zstream);
 
@@ -265,4 +523,30 @@ i_stream_create_zstd(struct istream *input)
 			       i_stream_get_fd(input), 0);
 }
 
+bool i_stream_zstd_is_seekable(struct istream *input)
+{
+	struct zstd_istream *zstream =
+		container_of(input->real_stream, struct zstd_istream, istream);
+
+	i_assert(input->real_stream->read == i_stream_zstd_read);
+	return i_stream_zstd_have_seek_table(zstream);
+}
+
+struct istream *
+i_stream_create_zstd(struct istream *input)
+{
+	return i_stream_create_zstd_int(input, NULL, NULL);
+}
+
+#undef i_stream_create_zstd_dict
+struct istream *
+i_stream_create_zstd_dict(struct istream *input,
+			  zstd_dict_lookup_callback_t *callback,
+			  void *context)
+{
+	i_assert(callback != NULL);
+
+	return i_stream_create_zstd_int(input, callback, context);
+}
+
 #endif
@@ -6,6 +6,23 @@ struct ostream *o_stream_create_deflate(struct ostream *output, int level);
 struct ostream *o_stream_create_bz2(struct ostream *output, int level);
 struct ostream *o_stream_create_lz4(struct ostream *output, int level);
 struct ostream *o_stream_create_zstd(struct ostream *output, int level);
+/* Compress using a zstd dictionary, which is usually trained from samples
+   of similar data (e.g. "zstd --train"). The dictionary's ID is written to
+   the output, so i_stream_create_zstd_dict() can find it. The dictionary
+   is copied, so it can be freed after this call. */
+struct ostream *
+o_stream_create_zstd_dict(struct ostream *output, int level,
+			  const void *dict, size_t dict_size);
+/* Like o_stream_create_zstd_dict(), but split the input into independently
+   compressed frames of frame_size bytes, followed by a seek table. This
+   allows i_stream_create_zstd() to seek without decompressing everything
+   before the wanted offset. The output is compatible with zstd's seekable
+   format and can be read by any zstd decompressor. The seek table is left
+   out if there is only a single frame. dict may be NULL. */
+struct ostream *
+o_stream_create_zstd_seekable(struct ostream *output, int level,
+			      size_t frame_size,
+			      const void *dict, size_t dict_size);
 
 int compression_get_min_level_gz(void);
 int compression_get_default_level_gz(void);
@@ -22,5 +39,8 @@ int compression_get_max_level_lz4(void);
 int compression_get_min_level_zstd(void);
 int compression_get_default_level_zstd(void);
 int compression_get_max_level_zstd(void);
+/* Returns the ID of a zstd dictionary, or 0 if it's not a valid trained
+   dictionary. */
+unsigned int compression_zstd_dict_get_id(const void *dict, size_t dict_size);
 
 #endif
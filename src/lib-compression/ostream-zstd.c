@@ -4,6 +4,8 @@
 
 #ifdef HAVE_ZSTD
 
+#include "buffer.h"
+#include "byteorder.h"
 #include "ostream.h"
 #include "ostream-private.h"
 #include "ostream-zlib.h"
@@ -19,6 +21,18 @@ struct zstd_ostream {
 	ZSTD_outBuffer output;
 
 	unsigned char *outbuf;
+	/* number of compressed bytes sent to parent */
+	uoff_t compressed_offset;
+
+	/* Seekable format: maximum uncompressed size of a frame, or 0 if
+	   everything is written as a single frame. */
+	size_t frame_size;
+	size_t frame_input_size;
+	uoff_t frame_start_offset;
+	unsigned int frame_count;
+	/* seek table skippable frame, which is sent after all frames */
+	buffer_t *seek_table;
+	size_t seek_table_sent;
 
 	bool flushed:1;
 	bool closed:1;
@@ -86,12 +100,99 @@ static ssize_t o_stream_zstd_send_outbuf(struct zstd_ostream *zstream)
 	} else {
 		memmove(zstream->outbuf, zstream->outbuf+ret, zstream->output.pos-ret);
 		zstream->output.pos -= ret;
+		zstream->compressed_offset += ret;
 	}
 	if (zstream->output.pos > 0)
 		return 0;
 	return 1;
 }
 
+static void o_stream_zstd_add_seek_table_entry(struct zstd_ostream *zstream)
+{
+	uoff_t frame_end_offset =
+		zstream->compressed_offset + zstream->output.pos;
+	unsigned char entry[IOSTREAM_ZSTD_SEEKABLE_ENTRY_SIZE];
+
+	i_assert(frame_end_offset - zstream->frame_start_offset <= (uint32_t)-1);
+	cpu32_to_le_unaligned(frame_end_offset - zstream->frame_start_offset,
+			      entry);
+	cpu32_to_le_unaligned(zstream->frame_input_size, entry + 4);
+	buffer_append(zstream->seek_table, entry, sizeof(entry));
+
+	zstream->frame_start_offset = frame_end_offset;
+	zstream->frame_input_size = 0;
+	zstream->frame_count++;
+}
+
+static bool o_stream_zstd_frame_is_full(struct zstd_ostream *zstream)
+{
+	return zstream->frame_size > 0 &&
+		zstream->frame_input_size >= zstream->frame_size;
+}
+
+static int o_stream_zstd_end_frame(struct zstd_ostream *zstream)
+{
+	size_t ret;
+	int fret;
+
+	for (;;) {
+		ret = ZSTD_endStream(zstream->cstream, &zstream->output);
+		if (ZSTD_isError(ret) != 0) {
+			o_stream_zstd_write_error(zstream, ret);
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		/* output buffer full. try to flush it. */
+		if ((fret = o_stream_zstd_send_outbuf(zstream)) < 0)
+			return -1;
+		if (fret == 0 && zstream->output.pos == zstream->output.size)
+			return 0;
+	}
+	o_stream_zstd_add_seek_table_entry(zstream);
+	return 1;
+}
+
+static void o_stream_zstd_finish_seek_table(struct zstd_ostream *zstream)
+{
+	unsigned char *hdr, footer[IOSTREAM_ZSTD_SEEKABLE_FOOTER_SIZE];
+
+	if (zstream->frame_count <= 1) {
+		/* a single frame can't be seeked any faster. leave out the
+		   seek table, so the output is identical to the non-seekable
+		   format. */
+		buffer_set_used_size(zstream->seek_table, 0);
+		return;
+	}
+	cpu32_to_le_unaligned(zstream->frame_count, footer);
+	footer[4] = 0;
+	cpu32_to_le_unaligned(IOSTREAM_ZSTD_SEEKABLE_MAGIC, footer + 5);
+	buffer_append(zstream->seek_table, footer, sizeof(footer));
+
+	hdr = buffer_get_modifiable_data(zstream->seek_table, NULL);
+	cpu32_to_le_unaligned(IOSTREAM_ZSTD_SEEKABLE_SKIPPABLE_MAGIC, hdr);
+	cpu32_to_le_unaligned(zstream->seek_table->used -
+			      IOSTREAM_ZSTD_SEEKABLE_HEADER_SIZE, hdr + 4);
+}
+
+static int o_stream_zstd_send_seek_table(struct zstd_ostream *zstream)
+{
+	ssize_t ret;
+
+	if (zstream->seek_table_sent == zstream->seek_table->used)
+		return 1;
+	ret = o_stream_send(zstream->ostream.parent,
+			    CONST_PTR_OFFSET(zstream->seek_table->data,
+					     zstream->seek_table_sent),
+			    zstream->seek_table->used - zstream->seek_table_sent);
+	if (ret < 0) {
+		o_stream_copy_error_from_parent(&zstream->ostream);
+		return -1;
+	}
+	zstream->seek_table_sent += ret;
+	return zstream->seek_table_sent == zstream->seek_table->used ? 1 : 0;
+}
+
 static ssize_t
 o_stream_zstd_sendv(struct ostream_private *stream,
 		    const struct const_iovec *iov, unsigned int iov_count)
@@ -110,9 +211,27 @@ o_stream_zstd_sendv(struct ostream_private *stream,
 		};
 		bool flush_attempted = FALSE;
 		for (;;) {
+			if (o_stream_zstd_frame_is_full(zstream)) {
+				int fret = o_stream_zstd_end_frame(zstream);
+				if (fret < 0)
+					return -1;
+				if (fret == 0) {
+					/* non-blocking output buffer full */
+					return total;
+				}
+				flush_attempted = FALSE;
+			}
 			size_t prev_pos = input.pos;
+			size_t input_size = input.size;
+			if (zstream->frame_size > 0) {
+				/* don't let the frame grow too large */
+				input.size = I_MIN(input.size, input.pos +
+					zstream->frame_size -
+					zstream->frame_input_size);
+			}
 			ret = ZSTD_compressStream(zstream->cstream, &zstream->output,
 						  &input);
+			input.size = input_size;
 			if (ZSTD_isError(ret) != 0) {
 				o_stream_zstd_write_error(zstream, ret);
 				return -1;
@@ -124,8 +243,11 @@ o_stream_zstd_sendv(struct ostream_private *stream,
 			}
 			stream->ostream.offset += new_input_size;
 			total += new_input_size;
+			zstream->frame_input_size += new_input_size;
 			if (input.pos == input.size)
 				break;
+			if (o_stream_zstd_frame_is_full(zstream))
+				continue;
 			/* output buffer full. try to flush it. */
 			if (o_stream_zstd_send_outbuf(zstream) < 0)
 				return -1;
@@ -158,7 +280,19 @@ static int o_stream_zstd_send_flush(struct zstd_ostream *zstream, bool final)
 	if (!final)
 		return 1;
 
-	if (!zstream->finished) {
+	if (!zstream->finished && zstream->frame_size > 0) {
+		/* end the last frame, unless the previous frame just ended
+		   and nothing was written after it */
+		if (zstream->frame_count == 0 ||
+		    zstream->frame_input_size > 0 ||
+		    zstream->compressed_offset + zstream->output.pos >
+		    zstream->frame_start_offset) {
+			if ((ret = o_stream_zstd_end_frame(zstream)) <= 0)
+				return ret;
+		}
+		o_stream_zstd_finish_seek_table(zstream);
+		zstream->finished = TRUE;
+	} else if (!zstream->finished) {
 		ret = ZSTD_endStream(zstream->cstream, &zstream->output);
 		if (ZSTD_isError(ret) != 0) {
 			o_stream_zstd_write_error(zstream, ret);
@@ -169,6 +303,9 @@ static int o_stream_zstd_send_flush(struct zstd_ostream *zstream, bool final)
 
 	if ((ret = o_stream_zstd_send_outbuf(zstream)) <= 0)
 		return ret;
+	if (zstream->seek_table != NULL &&
+	    (ret = o_stream_zstd_send_seek_table(zstream)) <= 0)
+		return ret;
 
 	if (final)
 		zstream->flushed = TRUE;
@@ -205,13 +342,24 @@ static void o_stream_zstd_close(struct iostream_private *stream,
 		zstream->cstream = NULL;
 	}
 	i_free(zstream->outbuf);
+	buffer_free(&zstream->seek_table);
 	i_zero(&zstream->output);
 	if (close_parent)
 		o_stream_close(zstream->ostream.parent);
 }
 
-struct ostream *
-o_stream_create_zstd(struct ostream *output, int level)
+unsigned int compression_zstd_dict_get_id(const void *dict, size_t dict_size)
+{
+#ifdef IOSTREAM_ZSTD_HAVE_DICT
+	return ZSTD_getDictID_fromDict(dict, dict_size);
+#else
+	return 0;
+#endif
+}
+
+static struct ostream *
+o_stream_create_zstd_int(struct ostream *output, int level,
+			 const void *dict, size_t dict_size, size_t frame_size)
 {
 	struct zstd_ostream *zstream;
 	size_t ret;
@@ -229,15 +377,68 @@ o_stream_create_zstd(struct ostream *output, int level)
 	if (zstream->cstream == NULL)
 		i_fatal_status(FATAL_OUTOFMEM, "zstd: Out of memory");
 	ret = ZSTD_initCStream(zstream->cstream, level);
+#ifdef IOSTREAM_ZSTD_HAVE_DICT
+	if (ZSTD_isError(ret) == 0 && dict != NULL) {
+		ret = ZSTD_CCtx_loadDictionary(zstream->cstream,
+					       dict, dict_size);
+	}
+#endif
 	if (ZSTD_isError(ret) != 0)
 		o_stream_zstd_write_error(zstream, ret);
+#ifndef IOSTREAM_ZSTD_HAVE_DICT
+	else if (dict != NULL) {
+		zstream->ostream.ostream.stream_errno = ENOTSUP;
+		io_stream_set_error(&zstream->ostream.iostream,
+			"zstd: Dictionaries require libzstd v1.4.0 or later");
+	}
+#endif
+#ifndef IOSTREAM_ZSTD_HAVE_SEEKABLE_WRITE
+	else if (frame_size > 0) {
+		zstream->ostream.ostream.stream_errno = ENOTSUP;
+		io_stream_set_error(&zstream->ostream.iostream,
+			"zstd: Seekable format requires libzstd v1.4.0 or later");
+	}
+#endif
 	else {
 		zstream->outbuf = i_malloc(ZSTD_CStreamOutSize());
 		zstream->output.dst = zstream->outbuf;
 		zstream->output.size = ZSTD_CStreamOutSize();
+		if (frame_size > 0) {
+			zstream->frame_size = frame_size;
+			zstream->seek_table =
+				buffer_create_dynamic(default_pool, 128);
+			buffer_append_zero(zstream->seek_table,
+					   IOSTREAM_ZSTD_SEEKABLE_HEADER_SIZE);
+		}
 	}
 	return o_stream_create(&zstream->ostream, output,
 			       o_stream_get_fd(output));
 }
 
+struct ostream *
+o_stream_create_zstd(struct ostream *output, int level)
+{
+	return o_stream_create_zstd_int(output, level, NULL, 0, 0);
+}
+
+struct ostream *
+o_stream_create_zstd_dict(struct ostream *output, int level,
+			  const void *dict, size_t dict_size)
+{
+	i_assert(dict != NULL);
+
+	return o_stream_create_zstd_int(output, level, dict, dict_size, 0);
+}
+
+struct ostream *
+o_stream_create_zstd_seekable(struct ostream *output, int level,
+			      size_t frame_size,
+			      const void *dict, size_t dict_size)
+{
+	i_assert(frame_size > 0 && frame_size <= (uint32_t)-1);
+
+	return o_stream_create_zstd_int(output, level, dict, dict_size,
+					frame_size);
+}
+
 #endif
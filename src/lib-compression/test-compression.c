@@ -10,12 +10,19 @@
 #include "test-common.h"
 #include "compression.h"
 #include "iostream-lz4.h"
+#include "istream-zlib.h"
+#include "ostream-zlib.h"
 
 #include "hex-binary.h"
 
 #include <unistd.h>
 #include <fcntl.h>
 
+#ifdef HAVE_ZSTD
+#  include "zstd.h"
+#  include "zdict.h"
+#endif
+
 static void test_compression_handler_detect(const struct compression_handler *handler)
 {
 	const unsigned char test_data[] = {'h','e','l','l','o',' ',
@@ -995,6 +1002,241 @@ static void test_lz4_small_header(void)
 	test_end();
 }
 
+#if defined(HAVE_ZSTD) && ZSTD_VERSION_NUMBER >= 10400
+#define TEST_ZSTD_DICT_SAMPLE_COUNT 500
+
+static const char *test_zstd_dict_sample(unsigned int i)
+{
+	return t_strdup_printf(
+		"Return-Path: <user%u@example.com>\r\n"
+		"Received: from mx.example.com by imap.example.com "
+		"with LMTP id %x; Mon, 1 Jan 2024 12:%02u:00 +0000\r\n"
+		"From: User %u <user%u@example.com>\r\n"
+		"To: Recipient <recipient@example.org>\r\n"
+		"Subject: Message number %u\r\n"
+		"Message-ID: <%x.%u@example.com>\r\n"
+		"MIME-Version: 1.0\r\n"
+		"Content-Type: text/plain; charset=utf-8\r\n\r\n"
+		"Hello %u, this is the body of the message.\r\n",
+		i, i * 7919, i % 60, i, i, i, i * 104729, i, i);
+}
+
+struct test_zstd_dict {
+	unsigned int id;
+	const void *data;
+	size_t size;
+};
+
+static bool
+test_zstd_dict_lookup(unsigned int dict_id, const void **dict_r,
+		      size_t *dict_size_r, struct test_zstd_dict *dict)
+{
+	if (dict_id != dict->id)
+		return FALSE;
+	*dict_r = dict->data;
+	*dict_size_r = dict->size;
+	return TRUE;
+}
+
+static void
+test_zstd_dict_compress(const char *str, buffer_t *compressed,
+			const struct test_zstd_dict *dict)
+{
+	struct ostream *buf_output, *output;
+
+	buffer_set_used_size(compressed, 0);
+	buf_output = o_stream_create_buffer(compressed);
+	output = dict == NULL ?
+		o_stream_create_zstd(buf_output, 3) :
+		o_stream_create_zstd_dict(buf_output, 3, dict->data, dict->size);
+	o_stream_unref(&buf_output);
+	o_stream_nsend_str(output, str);
+	test_assert(o_stream_finish(output) > 0);
+	o_stream_destroy(&output);
+}
+
+static void test_zstd_dict(void)
+{
+	struct test_zstd_dict dict, wrong_dict;
+	buffer_t *samples, *compressed, *plain_compressed;
+	size_t sample_sizes[TEST_ZSTD_DICT_SAMPLE_COUNT], dict_size;
+	unsigned char dict_buf[4096];
+	struct istream *input, *zinput;
+	const unsigned char *data;
+	const char *str;
+	size_t size;
+	unsigned int i;
+
+	test_begin("zstd dictionary");
+	samples = buffer_create_dynamic(default_pool, 1024*64);
+	for (i = 0; i < TEST_ZSTD_DICT_SAMPLE_COUNT; i++) {
+		str = test_zstd_dict_sample(i);
+		buffer_append(samples, str, strlen(str));
+		sample_sizes[i] = strlen(str);
+	}
+	dict_size = ZDICT_trainFromBuffer(dict_buf, sizeof(dict_buf),
+					  samples->data, sample_sizes,
+					  TEST_ZSTD_DICT_SAMPLE_COUNT);
+	test_assert(ZDICT_isError(dict_size) == 0);
+	buffer_free(&samples);
+
+	dict.data = dict_buf;
+	dict.size = dict_size;
+	dict.id = compression_zstd_dict_get_id(dict_buf, dict_size);
+	test_assert(dict.id != 0);
+
+	str = test_zstd_dict_sample(TEST_ZSTD_DICT_SAMPLE_COUNT);
+	compressed = buffer_create_dynamic(default_pool, 1024);
+	plain_compressed = buffer_create_dynamic(default_pool, 1024);
+	test_zstd_dict_compress(str, compressed, &dict);
+	test_zstd_dict_compress(str, plain_compressed, NULL);
+	test_assert(compressed->used < plain_compressed->used);
+
+	/* decompress with the dictionary */
+	input = i_stream_create_from_buffer(compressed);
+	zinput = i_stream_create_zstd_dict(input, test_zstd_dict_lookup,
+					   &dict);
+	test_assert(i_stream_read_bytes(zinput, &data, &size,
+					strlen(str)) > 0);
+	test_assert(size == strlen(str) && memcmp(data, str, size) == 0);
+	/* seeking backwards resets the stream, which must reload the
+	   dictionary */
+	i_stream_skip(zinput, size);
+	i_stream_seek(zinput, 1);
+	test_assert(i_stream_read_more(zinput, &data, &size) > 0);
+	test_assert(size == strlen(str) - 1 &&
+		    memcmp(data, str + 1, size) == 0);
+	i_stream_unref(&zinput);
+
+	/* unknown dictionary */
+	i_zero(&wrong_dict);
+	zinput = i_stream_create_zstd_dict(input, test_zstd_dict_lookup,
+					   &wrong_dict);
+	i_stream_seek(input, 0);
+	test_assert(i_stream_read(zinput) == -1 &&
+		    zinput->stream_errno == EINVAL);
+	i_stream_unref(&zinput);
+
+	/* compressed without a dictionary */
+	i_stream_unref(&input);
+	input = i_stream_create_from_buffer(plain_compressed);
+	zinput = i_stream_create_zstd_dict(input, test_zstd_dict_lookup,
+					   &wrong_dict);
+	test_assert(i_stream_read_bytes(zinput, &data, &size,
+					strlen(str)) > 0);
+	test_assert(size == strlen(str) && memcmp(data, str, size) == 0);
+	i_stream_unref(&zinput);
+	i_stream_unref(&input);
+
+	buffer_free(&compressed);
+	buffer_free(&plain_compressed);
+	test_end();
+}
+#endif
+
+#if defined(HAVE_ZSTD) && ZSTD_VERSION_NUMBER >= 10400
+static struct istream *
+test_zstd_seekable_compress(const buffer_t *data, size_t frame_size)
+{
+	struct ostream *temp_output, *output;
+	struct istream *input;
+	size_t pos, len;
+
+	temp_output = iostream_temp_create(".temp.", 0);
+	output = frame_size == 0 ? o_stream_create_zstd(temp_output, 3) :
+		o_stream_create_zstd_seekable(temp_output, 3, frame_size,
+					      NULL, 0);
+	for (pos = 0; pos < data->used; pos += len) {
+		len = I_MIN(i_rand_minmax(1, 10000), data->used - pos);
+		o_stream_nsend(output, CONST_PTR_OFFSET(data->data, pos), len);
+	}
+	test_assert(o_stream_finish(output) > 0);
+	input = iostream_temp_finish(&temp_output, SIZE_MAX);
+	o_stream_unref(&output);
+	return input;
+}
+
+static void test_zstd_seekable(void)
+{
+	struct istream *input, *input2, *zinput;
+	const unsigned char *rdata, *rdata2;
+	unsigned char *p;
+	buffer_t *data;
+	uoff_t size, offset;
+	size_t rsize, rsize2;
+	unsigned int i;
+
+	test_begin("zstd seekable");
+	data = buffer_create_dynamic(default_pool, 1024*256);
+	p = buffer_append_space_unsafe(data, 1024*256);
+	for (i = 0; i < 1024*256; i++)
+		p[i] = i_rand_limit(3) == 0 ? i_rand_limit(256) : 'a' + i % 16;
+	input = test_zstd_seekable_compress(data, 8192);
+
+	/* regular zstd istream reads it sequentially */
+	zinput = i_stream_create_zstd(input);
+	for (offset = 0; i_stream_read_more(zinput, &rdata, &rsize) > 0;
+	     offset += rsize) {
+		test_assert(offset + rsize <= data->used &&
+			    memcmp(rdata, CONST_PTR_OFFSET(data->data, offset),
+				   rsize) == 0);
+		i_stream_skip(zinput, rsize);
+	}
+	test_assert(zinput->stream_errno == 0 && offset == data->used);
+
+	/* seek around */
+	test_assert(i_stream_zstd_is_seekable(zinput));
+	test_assert(i_stream_get_size(zinput, TRUE, &size) > 0 &&
+		    size == data->used);
+	for (i = 0; i < 100; i++) {
+		offset = i_rand_limit(data->used);
+		i_stream_seek(zinput, offset);
+		test_assert(i_stream_read_more(zinput, &rdata, &rsize) > 0);
+		rsize = I_MIN(rsize, data->used - offset);
+		test_assert_idx(memcmp(rdata,
+				       CONST_PTR_OFFSET(data->data, offset),
+				       rsize) == 0, i);
+	}
+	i_stream_unref(&zinput);
+
+	/* seek directly near the end of a new stream. only the last frame
+	   is decompressed. */
+	i_stream_seek(input, 0);
+	zinput = i_stream_create_zstd(input);
+	i_stream_seek(zinput, data->used - 10);
+	test_assert(i_stream_read_bytes(zinput, &rdata, &rsize, 10) > 0);
+	test_assert(rsize == 10 &&
+		    memcmp(rdata, CONST_PTR_OFFSET(data->data, data->used - 10),
+			   10) == 0);
+	test_assert(i_stream_get_size(input, TRUE, &size) > 0 &&
+		    input->v_offset > size / 2);
+	i_stream_unref(&zinput);
+	i_stream_unref(&input);
+
+	/* a single frame is written identically to the non-seekable format
+	   without a seek table */
+	buffer_set_used_size(data, 1000);
+	input = test_zstd_seekable_compress(data, 8192);
+	input2 = test_zstd_seekable_compress(data, 0);
+	test_assert(i_stream_read_more(input, &rdata, &rsize) > 0);
+	test_assert(i_stream_read_more(input2, &rdata2, &rsize2) > 0);
+	test_assert(rsize == rsize2 && memcmp(rdata, rdata2, rsize) == 0);
+	i_stream_unref(&input2);
+
+	zinput = i_stream_create_zstd(input);
+	test_assert(!i_stream_zstd_is_seekable(zinput));
+	test_assert(i_stream_read_bytes(zinput, &rdata, &rsize,
+					data->used) > 0);
+	test_assert(rsize == data->used &&
+		    memcmp(rdata, data->data, rsize) == 0);
+	i_stream_unref(&zinput);
+	i_stream_unref(&input);
+
+	buffer_free(&data);
+	test_end();
+}
+#endif
+
 static void test_uncompress_file(const char *path)
 {
 	const struct compression_handler *handler;
@@ -1107,6 +1349,10 @@ int main(int argc, char *argv[])
 		test_gz_header,
 		test_gz_large_header,
 		test_lz4_small_header,
+#if defined(HAVE_ZSTD) && ZSTD_VERSION_NUMBER >= 10400
+		test_zstd_dict,
+		test_zstd_seekable,
+#endif
 		test_compression_ext,
 		NULL
 	};
@@ -4,6 +4,13 @@
 static const unsigned char IOSTREAM_CRYPT_MAGIC[] =
 	{'C','R','Y','P','T','E','D','\x03','\x07'};
 #define IOSTREAM_CRYPT_VERSION 2
+/* Version 3 has the version 2 header with the chunk size added after the
+   header length. The data is encrypted in chunks of that many bytes, each
+   followed by its own AEAD tag. Each chunk uses its own IV and AAD derived
+   from the chunk index, so any chunk can be decrypted independently. */
+#define IOSTREAM_CRYPT_VERSION_CHUNKED 3
+#define IOSTREAM_CRYPT_CHUNK_SIZE (64*1024)
+#define IOSTREAM_CRYPT_MAX_CHUNK_SIZE (1024*1024)
 #define IOSTREAM_TAG_SIZE 16
 
 enum io_stream_encrypt_flags {
@@ -11,6 +18,9 @@ enum io_stream_encrypt_flags {
 	IO_STREAM_ENC_INTEGRITY_AEAD = 0x2,
 	IO_STREAM_ENC_INTEGRITY_NONE = 0x4,
 	IO_STREAM_ENC_VERSION_1      = 0x8,
+	/* Write the version 3 chunked format. Requires
+	   IO_STREAM_ENC_INTEGRITY_AEAD. */
+	IO_STREAM_ENC_CHUNKED        = 0x10,
 };
 
 #endif
@@ -424,6 +424,12 @@ dcrypt_openssl_ctx_sym_init(struct dcrypt_context_symmetric *ctx,
 	i_assert(ctx->iv != NULL);
 	i_assert(ctx->ctx == NULL);
 
+	if (ctx->mode == 1) {
+		/* allow reusing the context for another encryption */
+		p_free(ctx->pool, ctx->tag);
+		ctx->tag_len = 0;
+	}
+
 	if ((ctx->ctx = EVP_CIPHER_CTX_new()) == NULL)
 		dcrypt_openssl_error(error_r);
 
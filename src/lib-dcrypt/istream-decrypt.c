@@ -40,9 +40,18 @@ struct decrypt_istream {
 	uoff_t ftr, pos;
 	enum io_stream_encrypt_flags flags;
 
-	/* original iv, in case seeking is done, future feature */
+	/* original iv, chunk IVs are derived from it */
 	unsigned char *iv;
 
+	/* chunked format: base AAD, encrypted data of the current chunk,
+	   parent offset where the chunks begin and index of the chunk
+	   that is read next */
+	unsigned char *aad;
+	uint32_t chunk_size;
+	buffer_t *chunk_buf;
+	uoff_t chunks_offset;
+	uint64_t chunk_idx;
+
 	struct dcrypt_context_symmetric *ctx_sym;
 	struct dcrypt_context_hmac *ctx_mac;
 
@@ -66,6 +75,11 @@ static void i_stream_decrypt_reset(struct decrypt_istream *dstream)
 			dcrypt_ctx_hmac_destroy(&dstream->ctx_mac);
 	}
 	i_free(dstream->iv);
+	i_free(dstream->aad);
+	dstream->chunk_size = 0;
+	dstream->chunk_idx = 0;
+	if (dstream->chunk_buf != NULL)
+		buffer_set_used_size(dstream->chunk_buf, 0);
 	dstream->format = DECRYPT_FORMAT_V1;
 }
 
@@ -665,6 +679,8 @@ i_stream_decrypt_header_contents(struct decrypt_istream *stream,
 	} else if ((stream->flags & IO_STREAM_ENC_INTEGRITY_AEAD) ==
 		IO_STREAM_ENC_INTEGRITY_AEAD) {
 		dcrypt_ctx_sym_set_aad(stream->ctx_sym, ptr, tagsize);
+		if (stream->chunk_size > 0)
+			stream->aad = i_memdup(ptr, tagsize);
 		stream->ftr = tagsize;
 		stream->use_mac = TRUE;
 	} else {
@@ -702,14 +718,16 @@ i_stream_decrypt_read_header(struct decrypt_istream *stream,
 		stream->format = DECRYPT_FORMAT_V1;
 		return i_stream_decrypt_read_header_v1(stream, data+1,
 						       end - (data+1));
+	} else if (*data == IOSTREAM_CRYPT_VERSION_CHUNKED) {
+		stream->format = DECRYPT_FORMAT_V3;
 	} else if (*data != '\x02') {
 		io_stream_set_error(&stream->istream.iostream,
 				    "Unsupported encrypted data 0x%02x", *data);
 		return -1;
+	} else {
+		stream->format = DECRYPT_FORMAT_V2;
 	}
 
-	stream->format = DECRYPT_FORMAT_V2;
-
 	data++;
 
 	/* read flags */
@@ -726,6 +744,22 @@ i_stream_decrypt_read_header(struct decrypt_istream *stream,
 	if ((size_t)(end-data)+1 < hdr_len)
 		return 0;
 
+	if (stream->format == DECRYPT_FORMAT_V3) {
+		uint32_t chunk_size;
+		if (!get_msb32(&data, end, &chunk_size))
+			return 0;
+		if (chunk_size == 0 ||
+		    chunk_size > IOSTREAM_CRYPT_MAX_CHUNK_SIZE ||
+		    (flags & IO_STREAM_ENC_INTEGRITY_AEAD) == 0) {
+			io_stream_set_error(&stream->istream.iostream,
+				"Decryption error: "
+				"invalid chunked stream header");
+			stream->istream.istream.stream_errno = EIO;
+			return -1;
+		}
+		stream->chunk_size = chunk_size;
+	}
+
 	int ret;
 	if ((ret = i_stream_decrypt_header_contents(stream, data, hdr_len)) < 0)
 		return -1;
@@ -737,6 +771,24 @@ i_stream_decrypt_read_header(struct decrypt_istream *stream,
 	}
 	stream->initialized = TRUE;
 
+	if (stream->chunk_size > 0) {
+		/* each chunk initializes the context separately */
+		if (stream->aad == NULL ||
+		    dcrypt_ctx_sym_get_iv_length(stream->ctx_sym) <
+		    sizeof(uint64_t)) {
+			io_stream_set_error(&stream->istream.iostream,
+				"Decryption error: "
+				"cipher not usable for chunked stream");
+			stream->istream.istream.stream_errno = EIO;
+			return -1;
+		}
+		if (stream->chunk_buf == NULL) {
+			stream->chunk_buf = buffer_create_dynamic(default_pool,
+				stream->chunk_size + IOSTREAM_TAG_SIZE);
+		}
+		return hdr_len;
+	}
+
 	/* if it all went well, try to initialize decryption context */
 	if (!dcrypt_ctx_sym_init(stream->ctx_sym, &error)) {
 		io_stream_set_error(&stream->istream.iostream,
@@ -746,6 +798,17 @@ i_stream_decrypt_read_header(struct decrypt_istream *stream,
 	return hdr_len;
 }
 
+static void
+i_stream_decrypt_header_skip(struct decrypt_istream *dstream, size_t hdr_len)
+{
+	/* clean up buffer */
+	safe_memset(buffer_get_modifiable_data(dstream->buf, 0),
+		    0, dstream->buf->used);
+	buffer_set_used_size(dstream->buf, 0);
+	i_stream_skip(dstream->istream.parent, hdr_len);
+	dstream->chunks_offset = dstream->istream.parent->v_offset;
+}
+
 static void
 i_stream_decrypt_realloc_buf_if_needed(struct decrypt_istream *dstream)
 {
@@ -763,6 +826,82 @@ i_stream_decrypt_realloc_buf_if_needed(struct decrypt_istream *dstream)
        dstream->istream.buffer = dstream->buf->data;
 }
 
+static int
+i_stream_decrypt_chunk(struct decrypt_istream *dstream, bool last)
+{
+	struct istream_private *stream = &dstream->istream;
+	size_t iv_len = dcrypt_ctx_sym_get_iv_length(dstream->ctx_sym);
+	size_t size = dstream->chunk_buf->used - IOSTREAM_TAG_SIZE;
+	const unsigned char *data = dstream->chunk_buf->data;
+	unsigned char iv[iv_len];
+	unsigned char aad[IOSTREAM_TAG_SIZE + sizeof(uint64_t) + 1];
+	const char *error;
+
+	/* see o_stream_encrypt_send_chunk() */
+	memcpy(iv, dstream->iv, iv_len);
+	for (unsigned int i = 0; i < sizeof(uint64_t); i++)
+		iv[iv_len - 1 - i] ^= (dstream->chunk_idx >> (i * 8)) & 0xff;
+	memcpy(aad, dstream->aad, IOSTREAM_TAG_SIZE);
+	cpu64_to_be_unaligned(dstream->chunk_idx, aad + IOSTREAM_TAG_SIZE);
+	aad[sizeof(aad) - 1] = last ? 1 : 0;
+	dcrypt_ctx_sym_set_iv(dstream->ctx_sym, iv, iv_len);
+	dcrypt_ctx_sym_set_aad(dstream->ctx_sym, aad, sizeof(aad));
+	dcrypt_ctx_sym_set_tag(dstream->ctx_sym, data + size,
+			       IOSTREAM_TAG_SIZE);
+
+	if (!dcrypt_ctx_sym_init(dstream->ctx_sym, &error) ||
+	    !dcrypt_ctx_sym_update(dstream->ctx_sym, data, size,
+				   dstream->buf, &error) ||
+	    !dcrypt_ctx_sym_final(dstream->ctx_sym, dstream->buf, &error)) {
+		io_stream_set_error(&stream->iostream,
+			"Decryption error: chunk %"PRIu64": %s",
+			dstream->chunk_idx, error);
+		stream->istream.stream_errno = EIO;
+		return -1;
+	}
+	buffer_set_used_size(dstream->chunk_buf, 0);
+	dstream->chunk_idx++;
+	dstream->finalized = last;
+	return 1;
+}
+
+static int i_stream_decrypt_read_chunk(struct decrypt_istream *dstream)
+{
+	struct istream_private *stream = &dstream->istream;
+	size_t enc_size = dstream->chunk_size + IOSTREAM_TAG_SIZE;
+	const unsigned char *data;
+	size_t size;
+	int ret = 1;
+
+	while (dstream->chunk_buf->used < enc_size) {
+		ret = i_stream_read_more(stream->parent, &data, &size);
+		if (ret <= 0)
+			break;
+		size = I_MIN(size, enc_size - dstream->chunk_buf->used);
+		buffer_append(dstream->chunk_buf, data, size);
+		i_stream_skip(stream->parent, size);
+	}
+	if (ret > 0) {
+		/* the chunk is full - it's the last one only if nothing
+		   follows it */
+		ret = i_stream_read_more(stream->parent, &data, &size);
+	}
+	if (ret == 0)
+		return 0;
+	if (stream->parent->stream_errno != 0) {
+		stream->istream.stream_errno = stream->parent->stream_errno;
+		return -1;
+	}
+	if (ret < 0 && dstream->chunk_buf->used < IOSTREAM_TAG_SIZE) {
+		io_stream_set_error(&stream->iostream,
+				    "Decryption error: chunk %"PRIu64" truncated",
+				    dstream->chunk_idx);
+		stream->istream.stream_errno = EPIPE;
+		return -1;
+	}
+	return i_stream_decrypt_chunk(dstream, ret < 0);
+}
+
 static ssize_t
 i_stream_decrypt_read(struct istream_private *stream)
 {
@@ -823,6 +962,11 @@ i_stream_decrypt_read(struct istream_private *stream)
 			stream->istream.eof = TRUE;
 			return -1;
 		}
+		if (dstream->initialized && dstream->chunk_size > 0) {
+			if ((ret = i_stream_decrypt_read_chunk(dstream)) <= 0)
+				return ret;
+			continue;
+		}
 
 		/* need to read more input */
 		ret = i_stream_read_memarea(stream->parent);
@@ -899,11 +1043,9 @@ i_stream_decrypt_read(struct istream_private *stream)
 				}
 				continue;
 			} else {
-				/* clean up buffer */
-				safe_memset(buffer_get_modifiable_data(dstream->buf, 0),
-					    0, dstream->buf->used);
-				buffer_set_used_size(dstream->buf, 0);
-				i_stream_skip(stream->parent, hret);
+				i_stream_decrypt_header_skip(dstream, hret);
+				if (dstream->chunk_size > 0)
+					continue;
 			}
 
 			data = i_stream_get_data(stream->parent, &size);
@@ -976,6 +1118,67 @@ i_stream_decrypt_read(struct istream_private *stream)
 	}
 }
 
+static bool
+i_stream_decrypt_seek_chunk(struct decrypt_istream *dstream, uoff_t v_offset)
+{
+	struct istream_private *stream = &dstream->istream;
+	uoff_t start_offset = stream->istream.v_offset - stream->skip;
+	uoff_t enc_size, chunk_idx, parent_size;
+	const unsigned char *data;
+	size_t size;
+	ssize_t hret;
+
+	if (!dstream->initialized && start_offset == 0 && v_offset > 0 &&
+	    stream->istream.stream_errno == 0 &&
+	    i_stream_read_more(stream->parent, &data, &size) > 0) {
+		/* read the header to find out whether the stream is chunked
+		   and can be seeked without decrypting everything before
+		   the offset */
+		hret = i_stream_decrypt_read_header(dstream, data, size);
+		if (hret > 0)
+			i_stream_decrypt_header_skip(dstream, hret);
+		else if (hret < 0) {
+			if (stream->istream.stream_errno == 0)
+				stream->istream.stream_errno = EIO;
+			stream->istream.v_offset = v_offset;
+			return TRUE;
+		}
+	}
+	if (!dstream->initialized || dstream->chunk_size == 0)
+		return FALSE;
+	enc_size = dstream->chunk_size + IOSTREAM_TAG_SIZE;
+	if (v_offset >= start_offset && v_offset <= start_offset + stream->pos)
+		return FALSE;
+
+	/* Start from the chunk containing the offset. An offset at a chunk
+	   boundary is read via the previous chunk, so seeking to the end of
+	   the stream still verifies that it isn't truncated. */
+	chunk_idx = v_offset / dstream->chunk_size;
+	if (chunk_idx > 0 && v_offset % dstream->chunk_size == 0)
+		chunk_idx--;
+	if (i_stream_get_size(stream->parent, TRUE, &parent_size) > 0 &&
+	    parent_size > dstream->chunks_offset) {
+		/* don't go past the last chunk */
+		chunk_idx = I_MIN(chunk_idx,
+			(parent_size - dstream->chunks_offset - 1) / enc_size);
+	}
+
+	i_stream_seek(stream->parent,
+		      dstream->chunks_offset + chunk_idx * enc_size);
+	stream->parent_expected_offset = stream->parent->v_offset;
+	buffer_set_used_size(dstream->chunk_buf, 0);
+	buffer_set_used_size(dstream->buf, 0);
+	dstream->chunk_idx = chunk_idx;
+	dstream->finalized = FALSE;
+	stream->istream.eof = FALSE;
+	stream->skip = stream->pos = 0;
+	stream->high_pos = 0;
+	stream->istream.v_offset = chunk_idx * dstream->chunk_size;
+	if (!i_stream_nonseekable_try_seek(stream, v_offset))
+		i_unreached();
+	return TRUE;
+}
+
 static void
 i_stream_decrypt_seek(struct istream_private *stream, uoff_t v_offset,
 		      bool mark ATTR_UNUSED)
@@ -985,6 +1188,8 @@ i_stream_decrypt_seek(struct istream_private *stream, uoff_t v_offset,
 
 	i_stream_decrypt_realloc_buf_if_needed(dstream);
 
+	if (i_stream_decrypt_seek_chunk(dstream, v_offset))
+		return;
 	if (i_stream_nonseekable_try_seek(stream, v_offset))
 		return;
 
@@ -1058,6 +1263,8 @@ static void i_stream_decrypt_destroy(struct iostream_private *stream)
 
 	if (dstream->iv != NULL)
 		i_free_and_null(dstream->iv);
+	i_free(dstream->aad);
+	buffer_free(&dstream->chunk_buf);
 	if (dstream->ctx_sym != NULL)
 		dcrypt_ctx_sym_destroy(&dstream->ctx_sym);
 	if (dstream->ctx_mac != NULL)
@@ -6,7 +6,8 @@ struct dcrypt_context_symmetric;
 
 enum decrypt_istream_format {
 	DECRYPT_FORMAT_V1,
-	DECRYPT_FORMAT_V2
+	DECRYPT_FORMAT_V2,
+	DECRYPT_FORMAT_V3
 };
 
 /* Look for a private key for a specified public key digest and set it to
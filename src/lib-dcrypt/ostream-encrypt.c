@@ -26,6 +26,10 @@
  * key data
  * cipher data
  * mac data (mac specific bytes)
+ *
+ * version 3 (chunked) adds chunk size (4 bytes) after the header size,
+ * and the cipher data is a sequence of chunks, each followed by its
+ * AEAD tag. Only the last chunk may be shorter than the chunk size.
  */
 
 #define IO_STREAM_ENCRYPT_SEED_SIZE 32
@@ -47,6 +51,12 @@ struct encrypt_ostream {
 	buffer_t *mac_oid;
 	size_t block_size;
 
+	/* chunked format: base IV and AAD that are combined with the chunk
+	   index, plaintext of the current chunk and its ciphertext */
+	unsigned char *iv, *aad;
+	buffer_t *chunk_buf, *chunk_output;
+	uint64_t chunk_idx;
+
 	bool finalized;
 	bool failed;
 	bool prefix_written;
@@ -111,18 +121,24 @@ o_stream_encrypt_send_header_v2(struct encrypt_ostream *stream)
 	buffer_t *values = t_buffer_create(256);
 	buffer_append(values, IOSTREAM_CRYPT_MAGIC,
 		      sizeof(IOSTREAM_CRYPT_MAGIC));
-	c = 2;
+	bool chunked = (stream->flags & IO_STREAM_ENC_CHUNKED) != 0;
+	c = chunked ? IOSTREAM_CRYPT_VERSION_CHUNKED : 2;
 	buffer_append(values, &c, 1);
 	i = cpu32_to_be(stream->flags);
 	buffer_append(values, &i, 4);
 	/* store total length of header
 	   9 = version + flags + length
+	   4 = chunk size (version 3 only)
 	   8 = rounds + key data length
 	   */
-	i = cpu32_to_be(sizeof(IOSTREAM_CRYPT_MAGIC) + 9 +
+	i = cpu32_to_be(sizeof(IOSTREAM_CRYPT_MAGIC) + 9 + (chunked ? 4 : 0) +
 		stream->cipher_oid->used + stream->mac_oid->used +
 		8 + stream->key_data_len);
 	buffer_append(values, &i, 4);
+	if (chunked) {
+		i = cpu32_to_be(IOSTREAM_CRYPT_CHUNK_SIZE);
+		buffer_append(values, &i, 4);
+	}
 
 	buffer_append_buf(values, stream->cipher_oid, 0, SIZE_MAX);
 	buffer_append_buf(values, stream->mac_oid, 0, SIZE_MAX);
@@ -455,6 +471,10 @@ o_stream_encrypt_keydata_create_v2(struct encrypt_ostream *stream,
 	ptr += dcrypt_ctx_sym_get_key_length(stream->ctx_sym);
 	dcrypt_ctx_sym_set_iv(stream->ctx_sym, ptr,
 			      dcrypt_ctx_sym_get_iv_length(stream->ctx_sym));
+	if ((stream->flags & IO_STREAM_ENC_CHUNKED) != 0) {
+		stream->iv = i_memdup(ptr,
+			dcrypt_ctx_sym_get_iv_length(stream->ctx_sym));
+	}
 	ptr += dcrypt_ctx_sym_get_iv_length(stream->ctx_sym);
 
 	if ((stream->flags & IO_STREAM_ENC_INTEGRITY_HMAC) ==
@@ -464,11 +484,23 @@ o_stream_encrypt_keydata_create_v2(struct encrypt_ostream *stream,
 	} else if ((stream->flags & IO_STREAM_ENC_INTEGRITY_AEAD) ==
 		IO_STREAM_ENC_INTEGRITY_AEAD) {
 		dcrypt_ctx_sym_set_aad(stream->ctx_sym, ptr, tagsize);
+		if ((stream->flags & IO_STREAM_ENC_CHUNKED) != 0)
+			stream->aad = i_memdup(ptr, tagsize);
 	}
 
 	/* clear out private key data */
 	safe_memset(buffer_get_modifiable_data(keydata, 0), 0, keydata->used);
 
+	if ((stream->flags & IO_STREAM_ENC_CHUNKED) != 0) {
+		/* each chunk initializes the context separately */
+		stream->chunk_buf = buffer_create_dynamic(default_pool,
+			IOSTREAM_CRYPT_CHUNK_SIZE);
+		stream->chunk_output = buffer_create_dynamic(default_pool,
+			IOSTREAM_CRYPT_CHUNK_SIZE + IOSTREAM_TAG_SIZE +
+			stream->block_size);
+		return 0;
+	}
+
 	if (!dcrypt_ctx_sym_init(stream->ctx_sym, &error)) {
 		io_stream_set_error(&stream->ostream.iostream,
 				    "Encryption init error: %s", error);
@@ -477,6 +509,79 @@ o_stream_encrypt_keydata_create_v2(struct encrypt_ostream *stream,
 	return 0;
 }
 
+static int
+o_stream_encrypt_send_chunk(struct encrypt_ostream *stream, bool last)
+{
+	size_t iv_len = dcrypt_ctx_sym_get_iv_length(stream->ctx_sym);
+	unsigned char iv[iv_len];
+	unsigned char aad[IOSTREAM_TAG_SIZE + sizeof(uint64_t) + 1];
+	const char *error;
+
+	/* IV is the base IV XORed with the chunk index, and AAD has the
+	   chunk index and whether it's the last chunk. This prevents
+	   reordering the chunks and truncating the stream. */
+	memcpy(iv, stream->iv, iv_len);
+	for (unsigned int i = 0; i < sizeof(uint64_t); i++)
+		iv[iv_len - 1 - i] ^= (stream->chunk_idx >> (i * 8)) & 0xff;
+	memcpy(aad, stream->aad, IOSTREAM_TAG_SIZE);
+	cpu64_to_be_unaligned(stream->chunk_idx, aad + IOSTREAM_TAG_SIZE);
+	aad[sizeof(aad) - 1] = last ? 1 : 0;
+	dcrypt_ctx_sym_set_iv(stream->ctx_sym, iv, iv_len);
+	dcrypt_ctx_sym_set_aad(stream->ctx_sym, aad, sizeof(aad));
+
+	buffer_set_used_size(stream->chunk_output, 0);
+	if (!dcrypt_ctx_sym_init(stream->ctx_sym, &error) ||
+	    !dcrypt_ctx_sym_update(stream->ctx_sym, stream->chunk_buf->data,
+				   stream->chunk_buf->used,
+				   stream->chunk_output, &error) ||
+	    !dcrypt_ctx_sym_final(stream->ctx_sym, stream->chunk_output,
+				  &error)) {
+		io_stream_set_error(&stream->ostream.iostream,
+				    "Encryption failure: %s", error);
+		return -1;
+	}
+	dcrypt_ctx_sym_get_tag(stream->ctx_sym, stream->chunk_output);
+	i_assert(stream->chunk_output->used ==
+		 stream->chunk_buf->used + IOSTREAM_TAG_SIZE);
+
+	buffer_set_used_size(stream->chunk_buf, 0);
+	stream->chunk_idx++;
+	return o_stream_encrypt_send(stream, stream->chunk_output->data,
+				     stream->chunk_output->used);
+}
+
+static ssize_t
+o_stream_encrypt_sendv_chunked(struct encrypt_ostream *estream,
+			       const struct const_iovec *iov,
+			       unsigned int iov_count)
+{
+	ssize_t total = 0;
+
+	for (unsigned int i = 0; i < iov_count; i++) {
+		const unsigned char *ptr = iov[i].iov_base;
+		size_t len = iov[i].iov_len;
+
+		while (len > 0) {
+			/* a full chunk is sent only after more data arrives,
+			   because the last chunk must be marked as such */
+			if (estream->chunk_buf->used ==
+			    IOSTREAM_CRYPT_CHUNK_SIZE &&
+			    o_stream_encrypt_send_chunk(estream, FALSE) < 0)
+				return -1;
+
+			size_t n = I_MIN(len, IOSTREAM_CRYPT_CHUNK_SIZE -
+					 estream->chunk_buf->used);
+			buffer_append(estream->chunk_buf, ptr, n);
+			ptr += n;
+			len -= n;
+			total += n;
+		}
+	}
+
+	estream->ostream.ostream.offset += total;
+	return total;
+}
+
 static ssize_t
 o_stream_encrypt_sendv(struct ostream_private *stream,
 		       const struct const_iovec *iov, unsigned int iov_count)
@@ -502,6 +607,9 @@ o_stream_encrypt_sendv(struct ostream_private *stream,
 		}
 	}
 
+	if ((estream->flags & IO_STREAM_ENC_CHUNKED) != 0)
+		return o_stream_encrypt_sendv_chunked(estream, iov, iov_count);
+
 	/* buffer for encrypted data */
 	unsigned char ciphertext[IO_BLOCK_SIZE];
 	buffer_t buf;
@@ -565,6 +673,9 @@ o_stream_encrypt_finalize(struct ostream_private *stream)
 	/* if nothing was written, we are done */
 	if (!estream->prefix_written) return 0;
 
+	if ((estream->flags & IO_STREAM_ENC_CHUNKED) != 0)
+		return o_stream_encrypt_send_chunk(estream, TRUE);
+
 	/* acquire last block */
 	buffer_t *buf = t_buffer_create(
 		dcrypt_ctx_sym_get_block_size(estream->ctx_sym));
@@ -650,6 +761,10 @@ o_stream_encrypt_destroy(struct iostream_private *stream)
 		dcrypt_ctx_hmac_destroy(&estream->ctx_mac);
 	if (estream->key_data != NULL)
 		i_free(estream->key_data);
+	i_free(estream->iv);
+	i_free(estream->aad);
+	buffer_free(&estream->chunk_buf);
+	buffer_free(&estream->chunk_output);
 	if (estream->cipher_oid != NULL)
 		buffer_free(&estream->cipher_oid);
 	if (estream->mac_oid != NULL)
@@ -665,6 +780,16 @@ o_stream_encrypt_init(struct encrypt_ostream *estream, const char *algorithm)
 	const char *error;
 	char *calg, *malg;
 
+	if ((estream->flags & IO_STREAM_ENC_CHUNKED) != 0 &&
+	    (estream->flags & (IO_STREAM_ENC_VERSION_1 |
+			       IO_STREAM_ENC_INTEGRITY_AEAD)) !=
+	    IO_STREAM_ENC_INTEGRITY_AEAD) {
+		io_stream_set_error(&estream->ostream.iostream,
+				    "Cannot create ostream-encrypt: "
+				    "Chunked format requires AEAD");
+		return -1;
+	}
+
 	if ((estream->flags & IO_STREAM_ENC_VERSION_1) ==
 		IO_STREAM_ENC_VERSION_1) {
 		if (!dcrypt_ctx_sym_create("AES-256-CTR", DCRYPT_MODE_ENCRYPT,
@@ -728,6 +853,15 @@ o_stream_encrypt_init(struct encrypt_ostream *estream, const char *algorithm)
 			return -1;
 		}
 
+		if ((estream->flags & IO_STREAM_ENC_CHUNKED) != 0 &&
+		    dcrypt_ctx_sym_get_iv_length(estream->ctx_sym) <
+		    sizeof(uint64_t)) {
+			io_stream_set_error(&estream->ostream.iostream,
+				"Cannot create ostream-encrypt: "
+				"Chunked format requires at least 64bit IV");
+			return -1;
+		}
+
 		/* MAC algorithm is used for PBKDF2 and keydata hashing */
 		return o_stream_encrypt_keydata_create_v2(estream, malg);
 	}
@@ -500,6 +500,155 @@ static void test_write_read_v2_empty(void)
 	test_end();
 }
 
+static buffer_t *test_write_v3(const unsigned char *payload, size_t size)
+{
+	buffer_t *buf = buffer_create_dynamic(default_pool, size + 1024);
+	struct ostream *os = o_stream_create_buffer(buf);
+	struct ostream *os_2 = o_stream_create_encrypt(os,
+		"aes-256-gcm-sha256", test_v1_kp.pub,
+		IO_STREAM_ENC_INTEGRITY_AEAD | IO_STREAM_ENC_CHUNKED);
+	o_stream_nsend(os_2, payload, size);
+	test_assert(o_stream_finish(os_2) > 0);
+	if (os_2->stream_errno != 0)
+		i_debug("error: %s", o_stream_get_error(os_2));
+	o_stream_unref(&os);
+	o_stream_unref(&os_2);
+	return buf;
+}
+
+static void test_write_read_v3(void)
+{
+	const size_t sizes[] = {
+		1, IOSTREAM_CRYPT_CHUNK_SIZE, IOSTREAM_CRYPT_CHUNK_SIZE*3 + 1000
+	};
+	unsigned char payload[IOSTREAM_CRYPT_CHUNK_SIZE*3 + 1000];
+	const unsigned char *ptr;
+	size_t pos, siz;
+
+	test_begin("test_write_read_v3");
+	random_fill(payload, sizeof(payload));
+
+	for (unsigned int i = 0; i < N_ELEMENTS(sizes); i++) {
+		buffer_t *buf = test_write_v3(payload, sizes[i]);
+		struct istream *is = test_istream_create_data(buf->data,
+							      buf->used);
+		i_stream_set_max_buffer_size(is, 8192);
+		struct istream *is_2 = i_stream_create_decrypt(is,
+							test_v1_kp.priv);
+
+		/* read it with the input growing one byte at a time (except
+		   the largest one, which would be too slow with test-istream) */
+		bool grow = sizes[i] <= IOSTREAM_CRYPT_CHUNK_SIZE;
+		size_t offset = 0;
+		if (grow) {
+			test_istream_set_size(is, 0);
+			test_istream_set_allow_eof(is, FALSE);
+		}
+		pos = 0;
+		while (i_stream_read_more(is_2, &ptr, &siz) >= 0) {
+			if (grow && offset == buf->used)
+				test_istream_set_allow_eof(is, TRUE);
+			else if (grow)
+				test_istream_set_size(is, ++offset);
+			if (pos + siz > sizes[i]) {
+				test_assert_idx(pos + siz <= sizes[i], i);
+				break;
+			}
+			test_assert_idx(memcmp(ptr, payload + pos, siz) == 0, i);
+			i_stream_skip(is_2, siz);
+			pos += siz;
+		}
+		test_assert_idx(pos == sizes[i], i);
+		test_assert_idx(is_2->stream_errno == 0, i);
+		test_assert_idx(i_stream_encrypt_get_format(is_2) ==
+				DECRYPT_FORMAT_V3, i);
+
+		/* seek backwards and forwards */
+		for (size_t off = sizes[i] - 1;; off = off * 2 / 3) {
+			i_stream_seek(is_2, off);
+			test_assert_idx(i_stream_read_more(is_2, &ptr, &siz) > 0,
+					off);
+			test_assert_idx(memcmp(ptr, payload + off, siz) == 0,
+					off);
+			i_stream_seek(is_2, sizes[i] - off / 2 - 1);
+			test_assert_idx(i_stream_read_more(is_2, &ptr, &siz) > 0,
+					off);
+			test_assert_idx(memcmp(ptr, payload + sizes[i] -
+					       off / 2 - 1, siz) == 0, off);
+			if (off == 0)
+				break;
+		}
+		/* seeking to the end reaches EOF without errors */
+		i_stream_seek(is_2, sizes[i]);
+		test_assert_idx(i_stream_read(is_2) == -1, i);
+		test_assert_idx(is_2->stream_errno == 0, i);
+
+		i_stream_unref(&is);
+		i_stream_unref(&is_2);
+		buffer_free(&buf);
+	}
+	test_end();
+}
+
+static void test_read_v3_corrupted(void)
+{
+	const size_t chunk_size = IOSTREAM_CRYPT_CHUNK_SIZE;
+	const size_t enc_chunk_size = chunk_size + IOSTREAM_TAG_SIZE;
+	unsigned char payload[IOSTREAM_CRYPT_CHUNK_SIZE*3];
+	const unsigned char *ptr;
+	unsigned char *data;
+	size_t siz, hdr_size;
+
+	test_begin("test_read_v3_corrupted");
+	random_fill(payload, sizeof(payload));
+	buffer_t *buf = test_write_v3(payload, sizeof(payload));
+	hdr_size = buf->used - 3 * enc_chunk_size;
+
+	/* corrupt the first chunk - the others can still be read */
+	data = buffer_get_modifiable_data(buf, NULL);
+	data[hdr_size + 100] ^= 1;
+	struct istream *is = test_istream_create_data(buf->data, buf->used);
+	struct istream *is_2 = i_stream_create_decrypt(is, test_v1_kp.priv);
+	i_stream_seek(is_2, chunk_size * 2 + 10);
+	test_assert(i_stream_read_more(is_2, &ptr, &siz) > 0);
+	test_assert(memcmp(ptr, payload + chunk_size * 2 + 10, siz) == 0);
+	i_stream_seek(is_2, 10);
+	test_assert(i_stream_read(is_2) == -1);
+	test_assert(is_2->stream_errno == EIO);
+	i_stream_unref(&is);
+	i_stream_unref(&is_2);
+	data[hdr_size + 100] ^= 1;
+
+	/* drop the last chunk - truncation is detected */
+	is = test_istream_create_data(buf->data, buf->used - enc_chunk_size);
+	is_2 = i_stream_create_decrypt(is, test_v1_kp.priv);
+	i_stream_seek(is_2, chunk_size + 10);
+	test_assert(i_stream_read(is_2) == -1);
+	test_assert(is_2->stream_errno == EIO);
+	i_stream_unref(&is);
+	i_stream_unref(&is_2);
+
+	/* swap the first two chunks */
+	buffer_t *swapped = buffer_create_dynamic(default_pool, buf->used);
+	buffer_append(swapped, buf->data, hdr_size);
+	buffer_append(swapped, CONST_PTR_OFFSET(buf->data,
+		      hdr_size + enc_chunk_size), enc_chunk_size);
+	buffer_append(swapped, CONST_PTR_OFFSET(buf->data, hdr_size),
+		      enc_chunk_size);
+	buffer_append(swapped, CONST_PTR_OFFSET(buf->data,
+		      hdr_size + enc_chunk_size * 2), enc_chunk_size);
+	is = test_istream_create_data(swapped->data, swapped->used);
+	is_2 = i_stream_create_decrypt(is, test_v1_kp.priv);
+	test_assert(i_stream_read(is_2) == -1);
+	test_assert(is_2->stream_errno == EIO);
+	i_stream_unref(&is);
+	i_stream_unref(&is_2);
+
+	buffer_free(&swapped);
+	buffer_free(&buf);
+	test_end();
+}
+
 static int
 no_op_cb(const char *digest ATTR_UNUSED,
 	 struct dcrypt_private_key **priv_key_r ATTR_UNUSED,
@@ -649,6 +798,8 @@ int main(void)
 		test_write_read_v2,
 		test_write_read_v2_short,
 		test_write_read_v2_empty,
+		test_write_read_v3,
+		test_read_v3_corrupted,
 		test_free_keys,
 		test_read_0_to_400_byte_garbage,
 		test_read_large_header,
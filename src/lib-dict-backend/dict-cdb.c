@@ -1,39 +1,92 @@
 /* Copyright (c) 2013-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
-#include "buffer.h"
 
 #ifdef BUILD_CDB
+#include "byteorder.h"
+#include "mmap-util.h"
 #include "dict-private.h"
 
 #include <string.h>
-#include <cdb.h>
 #include <unistd.h>
 #include <fcntl.h>
 
 #define CDB_WITH_NULL 1
 #define CDB_WITHOUT_NULL 2
 
+/* The file begins with 256 (hash table position, slot count) pairs */
+#define CDB_HEADER_SIZE (256 * 8)
+
+/* The cdb file is mmap()ed and read directly. Lookups return values
+   pointing to the mapping when they are NUL-terminated in the file, so they
+   stay valid until the dict is deinitialized. */
 struct cdb_dict {
 	struct dict dict;
-	struct cdb cdb;
 	char *path;
-	int fd, flag;
+	int flag;
+
+	const unsigned char *map;
+	size_t map_size;
+	/* the records are between CDB_HEADER_SIZE and data_end, followed by
+	   the hash tables */
+	uint32_t data_end;
 };
 
 struct cdb_dict_iterate_context {
 	struct dict_iterate_context ctx;
 
 	enum dict_iterate_flags flags;
-	buffer_t *buffer;
+	pool_t row_pool;
 	const char *values[2];
 	char *path;
-	unsigned cptr;
+	uint32_t pos;
 	char *error;
 };
 
 static void cdb_dict_deinit(struct dict *_dict);
 
+static int cdb_dict_map(struct cdb_dict *dict, const char **error_r)
+{
+	size_t size;
+	void *map;
+	int fd;
+
+	fd = open(dict->path, O_RDONLY);
+	if (fd == -1) {
+		*error_r = t_strdup_printf("open(%s) failed: %m", dict->path);
+		return -1;
+	}
+	map = mmap_ro_file(fd, &size);
+	if (map == MAP_FAILED) {
+		*error_r = t_strdup_printf("mmap(%s) failed: %m", dict->path);
+		i_close_fd_path(&fd, dict->path);
+		return -1;
+	}
+	i_close_fd_path(&fd, dict->path);
+	dict->map = map;
+	dict->map_size = size;
+
+	if (size < CDB_HEADER_SIZE) {
+		*error_r = t_strdup_printf("cdb file %s is corrupted: "
+			"File too small (%zu bytes)", dict->path, size);
+		return -1;
+	}
+	/* the first hash table is written right after the records */
+	dict->data_end = le32_to_cpu_unaligned(dict->map);
+	if (dict->data_end < CDB_HEADER_SIZE || dict->data_end > size) {
+		*error_r = t_strdup_printf("cdb file %s is corrupted: "
+			"Invalid hash table position %u", dict->path,
+			dict->data_end);
+		return -1;
+	}
+#ifdef MADV_RANDOM
+	/* lookups jump between the header, the hash tables and the records.
+	   reading ahead would only waste page cache. */
+	(void)madvise(map, size, MADV_RANDOM);
+#endif
+	return 0;
+}
+
 static int
 cdb_dict_init(struct dict *driver, const char *uri,
 	      const struct dict_settings *set ATTR_UNUSED,
@@ -46,26 +99,11 @@ cdb_dict_init(struct dict *driver, const char *uri,
 	dict->path = i_strdup(uri);
 	dict->flag = CDB_WITH_NULL | CDB_WITHOUT_NULL;
 
-	/* initialize cdb to 0 (unallocated) */
-	i_zero(&dict->cdb);
-
-	dict->fd = open(dict->path, O_RDONLY);
-	if (dict->fd == -1) {
-		*error_r = t_strdup_printf("open(%s) failed: %m", dict->path);
+	if (cdb_dict_map(dict, error_r) < 0) {
 		cdb_dict_deinit(&dict->dict);
 		return -1;
 	}
 
-#ifdef TINYCDB_VERSION
-	if (cdb_init(&dict->cdb, dict->fd) < 0) {
-		*error_r = t_strdup_printf("cdb_init(%s) failed: %m", dict->path);
-		cdb_dict_deinit(&dict->dict);
-		return -1;
-	}
-#else
-	cdb_init(&dict->cdb, dict->fd);
-#endif
-
 	*dict_r = &dict->dict;
 	return 0;
 }
@@ -74,15 +112,99 @@ static void cdb_dict_deinit(struct dict *_dict)
 {
 	struct cdb_dict *dict = (struct cdb_dict *)_dict;
 
-	/* we can safely deinit unallocated cdb */
-	cdb_free(&dict->cdb);
-
-	i_close_fd_path(&dict->fd, dict->path);
-
+	if (dict->map != NULL) {
+		if (munmap((void *)dict->map, dict->map_size) < 0)
+			i_error("munmap(%s) failed: %m", dict->path);
+	}
 	i_free(dict->path);
 	i_free(dict);
 }
 
+static uint32_t cdb_hash(const unsigned char *key, size_t size)
+{
+	uint32_t hash = 5381;
+
+	for (size_t i = 0; i < size; i++)
+		hash = ((hash << 5) + hash) ^ key[i];
+	return hash;
+}
+
+/* Get the key and data sizes of the record at pos. Returns FALSE if the
+   record doesn't fit into the area ending at end. */
+static bool
+cdb_dict_record_get(struct cdb_dict *dict, uint32_t pos, uint32_t end,
+		    uint32_t *key_size_r, uint32_t *data_size_r)
+{
+	if (pos > end || end - pos < 8)
+		return FALSE;
+	*key_size_r = le32_to_cpu_unaligned(dict->map + pos);
+	*data_size_r = le32_to_cpu_unaligned(dict->map + pos + 4);
+	return *key_size_r <= end - pos - 8 &&
+		*data_size_r <= end - pos - 8 - *key_size_r;
+}
+
+/* Returns 1 and the data's position and size if the key was found, 0 if
+   not, -1 if the file is corrupted. */
+static int
+cdb_dict_find(struct cdb_dict *dict, const void *key, uint32_t key_size,
+	      uint32_t *data_pos_r, uint32_t *data_size_r,
+	      const char **error_r)
+{
+	uint32_t hash, table_pos, slots, slot, i, slot_pos, record_pos;
+	uint32_t record_key_size, record_data_size;
+
+	hash = cdb_hash(key, key_size);
+	table_pos = le32_to_cpu_unaligned(dict->map + (hash % 256) * 8);
+	slots = le32_to_cpu_unaligned(dict->map + (hash % 256) * 8 + 4);
+	if (slots == 0)
+		return 0;
+	if (table_pos < dict->data_end || table_pos > dict->map_size ||
+	    slots > (dict->map_size - table_pos) / 8) {
+		*error_r = "Invalid hash table";
+		return -1;
+	}
+
+	slot = (hash >> 8) % slots;
+	for (i = 0; i < slots; i++) {
+		slot_pos = table_pos + slot * 8;
+		record_pos = le32_to_cpu_unaligned(dict->map + slot_pos + 4);
+		if (record_pos == 0)
+			return 0;
+		if (le32_to_cpu_unaligned(dict->map + slot_pos) == hash) {
+			if (!cdb_dict_record_get(dict, record_pos,
+						 dict->data_end,
+						 &record_key_size,
+						 &record_data_size)) {
+				*error_r = "Invalid record position";
+				return -1;
+			}
+			if (record_key_size == key_size &&
+			    memcmp(dict->map + record_pos + 8, key,
+				   key_size) == 0) {
+				*data_pos_r = record_pos + 8 + key_size;
+				*data_size_r = record_data_size;
+				return 1;
+			}
+		}
+		if (++slot == slots)
+			slot = 0;
+	}
+	return 0;
+}
+
+/* Return the data as a string. If it's NUL-terminated in the file, it's
+   returned directly from the mapping. */
+static const char *
+cdb_dict_get_str(struct cdb_dict *dict, pool_t pool,
+		 uint32_t pos, uint32_t size)
+{
+	const char *data = (const char *)dict->map + pos;
+
+	if (size > 0 && data[size-1] == '\0')
+		return data;
+	return p_strndup(pool, data, size);
+}
+
 static int
 cdb_dict_lookup(struct dict *_dict,
 		const struct dict_op_settings *set ATTR_UNUSED,
@@ -91,20 +213,23 @@ cdb_dict_lookup(struct dict *_dict,
 	        const char **error_r)
 {
 	struct cdb_dict *dict = (struct cdb_dict *)_dict;
-	unsigned datalen;
+	uint32_t key_size = strlen(key);
+	uint32_t data_pos, data_size;
+	const char *error;
 	int ret = 0;
-	char *data;
 
 	/* keys and values may be null terminated... */
 	if ((dict->flag & CDB_WITH_NULL) != 0) {
-		ret = cdb_find(&dict->cdb, key, (unsigned)strlen(key)+1);
+		ret = cdb_dict_find(dict, key, key_size + 1,
+				    &data_pos, &data_size, &error);
 		if (ret > 0)
 			dict->flag &= ENUM_NEGATE(CDB_WITHOUT_NULL);
 	}
 
 	/* ...or not */
 	if (ret == 0 && (dict->flag & CDB_WITHOUT_NULL) != 0) {
-		ret = cdb_find(&dict->cdb, key, (unsigned)strlen(key));
+		ret = cdb_dict_find(dict, key, key_size,
+				    &data_pos, &data_size, &error);
 		if (ret > 0)
 			dict->flag &= ENUM_NEGATE(CDB_WITH_NULL);
 	}
@@ -112,21 +237,17 @@ cdb_dict_lookup(struct dict *_dict,
 	if (ret <= 0) {
 		/* something bad with db */
 		if (ret < 0) {
-			*error_r = t_strdup_printf("cdb_find(%s) failed: %m", dict->path);
+			*error_r = t_strdup_printf(
+				"cdb file %s is corrupted: %s",
+				dict->path, error);
 			return -1;
 		}
 		/* found nothing */
 		return 0;
 	}
 
-	datalen = cdb_datalen(&dict->cdb);
-	data = p_malloc(pool, datalen + 1);
-	if (cdb_read(&dict->cdb, data, datalen, cdb_datapos(&dict->cdb)) < 0) {
-		*error_r = t_strdup_printf("cdb_read(%s) failed: %m", dict->path);
-		return -1;
-	}
 	const char **values = p_new(pool, const char *, 2);
-	values[0] = data;
+	values[0] = cdb_dict_get_str(dict, pool, data_pos, data_size);
 	*values_r = values;
 	return 1;
 }
@@ -143,42 +264,33 @@ cdb_dict_iterate_init(struct dict *_dict,
 	ctx->ctx.dict = &dict->dict;
 	ctx->path = i_strdup(path);
 	ctx->flags = flags;
-	ctx->buffer = buffer_create_dynamic(default_pool, 256);
-
-	cdb_seqinit(&ctx->cptr, &dict->cdb);
-
+	ctx->row_pool = pool_alloconly_create("cdb dict iterate row", 256);
+	ctx->pos = CDB_HEADER_SIZE;
 	return &ctx->ctx;
 }
 
 static bool
-cdb_dict_next(struct cdb_dict_iterate_context *ctx, const char **key_r)
+cdb_dict_next(struct cdb_dict_iterate_context *ctx, const char **key_r,
+	      uint32_t *data_pos_r, uint32_t *data_size_r)
 {
 	struct cdb_dict *dict = (struct cdb_dict *)ctx->ctx.dict;
-	char *data;
-	unsigned datalen;
-	int ret;
-
-	if ((ret = cdb_seqnext(&ctx->cptr, &dict->cdb)) < 1) {
-		if (ret < 0)
-			ctx->error = i_strdup_printf("cdb_seqnext(%s) failed: %m",
-						     dict->path);
-		return FALSE;
-	}
-
-	buffer_set_used_size(ctx->buffer, 0);
+	uint32_t key_size, data_size;
 
-	datalen = cdb_keylen(&dict->cdb);
-	data = buffer_append_space_unsafe(ctx->buffer, datalen + 1);
-
-	if (cdb_read(&dict->cdb, data, datalen, cdb_keypos(&dict->cdb)) < 0) {
-		ctx->error = i_strdup_printf("cdb_read(%s) failed: %m",
-					     dict->path);
+	if (ctx->pos >= dict->data_end)
+		return FALSE;
+	if (!cdb_dict_record_get(dict, ctx->pos, dict->data_end,
+				 &key_size, &data_size)) {
+		ctx->error = i_strdup_printf(
+			"cdb file %s is corrupted: Invalid record at %u",
+			dict->path, ctx->pos);
 		return FALSE;
 	}
 
-	data[datalen] = '\0';
-	*key_r = data;
-
+	p_clear(ctx->row_pool);
+	*key_r = cdb_dict_get_str(dict, ctx->row_pool, ctx->pos + 8, key_size);
+	*data_pos_r = ctx->pos + 8 + key_size;
+	*data_size_r = data_size;
+	ctx->pos += 8 + key_size + data_size;
 	return TRUE;
 }
 
@@ -189,14 +301,13 @@ static bool cdb_dict_iterate(struct dict_iterate_context *_ctx,
 		(struct cdb_dict_iterate_context *)_ctx;
 	struct cdb_dict *dict = (struct cdb_dict *)_ctx->dict;
 	const char *key;
+	uint32_t data_pos, data_size;
 	bool match = FALSE;
-	char *data;
-	unsigned datalen;
 
 	if (ctx->error != NULL)
 		return FALSE;
 
-	while(!match && cdb_dict_next(ctx, &key)) {
+	while(!match && cdb_dict_next(ctx, &key, &data_pos, &data_size)) {
 		if (((ctx->flags & DICT_ITERATE_FLAG_EXACT_KEY) != 0 &&
 		     strcmp(key, ctx->path) == 0) ||
 		    ((ctx->flags & DICT_ITERATE_FLAG_RECURSE) != 0 &&
@@ -217,19 +328,9 @@ static bool cdb_dict_iterate(struct dict_iterate_context *_ctx,
 	if ((ctx->flags & DICT_ITERATE_FLAG_NO_VALUE) != 0)
 		return TRUE;
 
-	datalen = cdb_datalen(&dict->cdb);
-	data = buffer_append_space_unsafe(ctx->buffer, datalen + 1);
-
-	if (cdb_read(&dict->cdb, data, datalen, cdb_datapos(&dict->cdb)) < 0) {
-		ctx->error = i_strdup_printf("cdb_read(%s) failed: %m",
-					     dict->path);
-		return FALSE;
-	}
-
-	data[datalen] = '\0';
-	ctx->values[0] = data;
+	ctx->values[0] = cdb_dict_get_str(dict, ctx->row_pool,
+					  data_pos, data_size);
 	*values_r = ctx->values;
-
 	return TRUE;
 }
 
@@ -244,7 +345,7 @@ static int cdb_dict_iterate_deinit(struct dict_iterate_context *_ctx,
 		ret = -1;
 	}
 
-	buffer_free(&ctx->buffer);
+	pool_unref(&ctx->row_pool);
 	i_free(ctx->error);
 	i_free(ctx->path);
 	i_free(ctx);
@@ -215,6 +215,13 @@ parse_setting(const char *key, const char *value,
 			ctx->set->connect = p_strdup(ctx->pool, value);
 			return NULL;
 		}
+		if (strcmp(key, "iterate_page_size") == 0) {
+			if (str_to_uint(value, &ctx->set->iterate_page_size) < 0) {
+				return t_strconcat("Invalid iterate_page_size: ",
+						   value, NULL);
+			}
+			return NULL;
+		}
 		break;
 	case SECTION_MAP:
 		return parse_setting_from_defs(ctx->pool,
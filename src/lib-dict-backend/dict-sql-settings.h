@@ -36,6 +36,10 @@ struct dict_sql_map {
 
 struct dict_sql_settings {
 	const char *connect;
+	/* Iterate at most this many rows with a single SQL query. The next
+	   rows are fetched with a new query continuing after the last
+	   returned key. 0 = unlimited. */
+	unsigned int iterate_page_size;
 
 	unsigned int max_pattern_fields_count;
 	ARRAY(struct dict_sql_map) maps;
@@ -7,6 +7,7 @@
 #include "hex-binary.h"
 #include "hash.h"
 #include "str.h"
+#include "strescape.h"
 #include "sql-api-private.h"
 #include "sql-db-cache.h"
 #include "dict-private.h"
@@ -48,6 +49,12 @@ struct sql_dict_iterate_context {
 	const struct dict_sql_map *map;
 	size_t key_prefix_len, pattern_prefix_len;
 	unsigned int sql_fields_start_idx, next_map_idx;
+	/* with iterate_page_size: number of rows the current query may
+	   return (0 = not paging), number of rows it has returned so far,
+	   and the last pattern field value returned by it. */
+	unsigned int page_limit, page_rows;
+	string_t *page_last_value;
+	bool page_continue;
 	bool destroyed;
 	bool synchronous_result;
 	bool iter_query_sent;
@@ -448,12 +455,12 @@ sql_dict_where_build(const char *username, const struct dict_sql_map *map,
 }
 
 static int
-sql_lookup_get_query(struct sql_dict *dict,
-		     const struct dict_op_settings *set,
-		     const char *key,
-		     const struct dict_sql_map **map_r,
-		     struct sql_statement **stmt_r,
-		     const char **error_r)
+sql_lookup_append_query(struct sql_dict *dict,
+			const struct dict_op_settings *set,
+			const char *key, const char *extra_field,
+			string_t *query, ARRAY_TYPE(sql_dict_param) *params,
+			const struct dict_sql_map **map_r,
+			const char **error_r)
 {
 	const struct dict_sql_map *map;
 	ARRAY_TYPE(const_string) pattern_values;
@@ -466,22 +473,39 @@ sql_lookup_get_query(struct sql_dict *dict,
 		return -1;
 	}
 
-	string_t *query = t_str_new(256);
-	ARRAY_TYPE(sql_dict_param) params;
-	t_array_init(&params, 4);
 	str_append(query, "SELECT ");
 	if (map->expire_field != NULL)
 		str_printfa(query, "%s,", map->expire_field);
-	str_printfa(query, "%s FROM %s%s",
-		    map->value_field, sql_db_table_prefix(dict->db), map->table);
+	str_append(query, map->value_field);
+	if (extra_field != NULL)
+		str_printfa(query, ",%s", extra_field);
+	str_printfa(query, " FROM %s%s",
+		    sql_db_table_prefix(dict->db), map->table);
 	if (sql_dict_where_build(set->username, map, &pattern_values,
 				 key[0] == DICT_PATH_PRIVATE[0],
 				 SQL_DICT_RECURSE_NONE, query,
-				 &params, &error) < 0) {
+				 params, &error) < 0) {
 		*error_r = t_strdup_printf(
 			"sql dict lookup: Failed to lookup key %s: %s", key, error);
 		return -1;
 	}
+	return 0;
+}
+
+static int
+sql_lookup_get_query(struct sql_dict *dict,
+		     const struct dict_op_settings *set,
+		     const char *key,
+		     const struct dict_sql_map **map_r,
+		     struct sql_statement **stmt_r,
+		     const char **error_r)
+{
+	string_t *query = t_str_new(256);
+	ARRAY_TYPE(sql_dict_param) params;
+	t_array_init(&params, 4);
+	if (sql_lookup_append_query(dict, set, key, NULL, query, &params,
+				    map_r, error_r) < 0)
+		return -1;
 	*stmt_r = sql_dict_statement_init(dict, str_c(query), &params);
 	return 0;
 }
@@ -651,6 +675,319 @@ sql_dict_lookup_async(struct dict *_dict,
 	}
 }
 
+struct sql_dict_lookup_multi_query {
+	struct sql_dict_lookup_multi_context *ctx;
+	const struct dict_sql_map *map;
+	struct sql_statement *stmt;
+	/* keys[] indexes looked up by this query. With multiple keys the
+	   query has a "UNION ALL" SELECT for each key, and each row has the
+	   index to this array as its last field. */
+	ARRAY(unsigned int) key_idxs;
+};
+
+struct sql_dict_lookup_multi_context {
+	pool_t pool;
+	unsigned int keys_count;
+	const char **values;
+	/* keys[] index of the first identical key for each key */
+	unsigned int *first_idxs;
+	ARRAY(struct sql_dict_lookup_multi_query) queries;
+
+	unsigned int pending;
+	const char *error;
+	dict_lookup_multi_callback_t *callback;
+	void *context;
+};
+
+static struct sql_dict_lookup_multi_query *
+sql_dict_lookup_multi_query_get(struct sql_dict *dict,
+				struct sql_dict_lookup_multi_context *ctx,
+				const struct dict_sql_map *map)
+{
+	struct sql_dict_lookup_multi_query *query;
+
+	/* Cassandra doesn't support UNION, so each key is looked up with
+	   its own query there. */
+	if (strcmp(dict->db->name, "cassandra") != 0) {
+		array_foreach_modifiable(&ctx->queries, query) {
+			if (query->map == map)
+				return query;
+		}
+	}
+	query = array_append_space(&ctx->queries);
+	query->ctx = ctx;
+	query->map = map;
+	p_array_init(&query->key_idxs, ctx->pool, 4);
+	return query;
+}
+
+static int
+sql_dict_lookup_multi_query_build(struct sql_dict *dict,
+				  const struct dict_op_settings *set,
+				  const char *const *keys,
+				  struct sql_dict_lookup_multi_query *query,
+				  const char **error_r)
+{
+	const struct dict_sql_map *map;
+	unsigned int i, count;
+	const unsigned int *key_idxs;
+
+	key_idxs = array_get(&query->key_idxs, &count);
+	if (count == 1) {
+		/* only a single key - use the regular lookup query */
+		return sql_lookup_get_query(dict, set, keys[key_idxs[0]],
+					    &map, &query->stmt, error_r);
+	}
+
+	/* The rows are mapped back to the keys by the index in the last
+	   field, not by comparing the returned field values to the keys.
+	   The database's collation may match values that aren't
+	   byte-for-byte identical to the key. */
+	string_t *str = t_str_new(256);
+	ARRAY_TYPE(sql_dict_param) params;
+	t_array_init(&params, 4 * count);
+	for (i = 0; i < count; i++) {
+		if (i > 0)
+			str_append(str, " UNION ALL ");
+		if (sql_lookup_append_query(dict, set, keys[key_idxs[i]],
+					    dec2str(i), str, &params,
+					    &map, error_r) < 0)
+			return -1;
+		i_assert(map == query->map);
+	}
+	query->stmt = sql_dict_statement_init(dict, str_c(str), &params);
+	return 0;
+}
+
+static void
+sql_dict_lookup_multi_free(struct sql_dict_lookup_multi_context **_ctx)
+{
+	struct sql_dict_lookup_multi_context *ctx = *_ctx;
+	struct sql_dict_lookup_multi_query *query;
+
+	*_ctx = NULL;
+	array_foreach_modifiable(&ctx->queries, query) {
+		if (query->stmt != NULL)
+			sql_statement_abort(&query->stmt);
+	}
+	pool_unref(&ctx->pool);
+}
+
+static struct sql_dict_lookup_multi_context *
+sql_dict_lookup_multi_init(struct sql_dict *dict,
+			   const struct dict_op_settings *set,
+			   const char *const *keys, const char **error_r)
+{
+	struct sql_dict_lookup_multi_context *ctx;
+	struct sql_dict_lookup_multi_query *query;
+	const struct dict_sql_map *map;
+	ARRAY_TYPE(const_string) pattern_values;
+	unsigned int i, j;
+	pool_t pool;
+
+	pool = pool_alloconly_create("sql dict lookup multi", 1024);
+	ctx = p_new(pool, struct sql_dict_lookup_multi_context, 1);
+	ctx->pool = pool;
+	ctx->keys_count = str_array_length(keys);
+	ctx->values = p_new(pool, const char *, ctx->keys_count + 1);
+	ctx->first_idxs = p_new(pool, unsigned int, ctx->keys_count);
+	p_array_init(&ctx->queries, pool, 4);
+
+	for (i = 0; i < ctx->keys_count; i++) {
+		/* the same key may have been given multiple times */
+		for (j = 0; j < i; j++) {
+			if (strcmp(keys[j], keys[i]) == 0)
+				break;
+		}
+		ctx->first_idxs[i] = j;
+		if (j < i)
+			continue;
+
+		map = sql_dict_find_map(dict, keys[i], &pattern_values);
+		if (map == NULL) {
+			*error_r = t_strdup_printf(
+				"sql dict lookup: Invalid/unmapped key: %s",
+				keys[i]);
+			sql_dict_lookup_multi_free(&ctx);
+			return NULL;
+		}
+		query = sql_dict_lookup_multi_query_get(dict, ctx, map);
+		array_push_back(&query->key_idxs, &i);
+	}
+
+	array_foreach_modifiable(&ctx->queries, query) {
+		if (sql_dict_lookup_multi_query_build(dict, set, keys, query,
+						      error_r) < 0) {
+			sql_dict_lookup_multi_free(&ctx);
+			return NULL;
+		}
+	}
+	return ctx;
+}
+
+static int
+sql_dict_lookup_multi_query_result(struct sql_dict_lookup_multi_query *query,
+				   struct sql_result *result,
+				   const char **error_r)
+{
+	struct sql_dict_lookup_multi_context *ctx = query->ctx;
+	const struct dict_sql_map *map = query->map;
+	const char *const *values, *idx_str;
+	const unsigned int *key_idxs;
+	unsigned int count, idx, idx_result_idx;
+	int ret;
+
+	key_idxs = array_get(&query->key_idxs, &count);
+	/* the key index is returned after the values */
+	idx_result_idx = (map->expire_field != NULL ? 1 : 0) +
+		map->values_count;
+
+	while ((ret = sql_dict_result_next_row(map, result)) > 0) {
+		values = sql_dict_result_unescape_values(map, ctx->pool,
+							 result);
+		if (values[0] == NULL) {
+			/* NULL value - treat it as "not found" */
+			continue;
+		}
+		if (count == 1) {
+			ctx->values[key_idxs[0]] = values[0];
+			break;
+		}
+		idx_str = sql_result_get_field_value(result, idx_result_idx);
+		if (idx_str == NULL || str_to_uint(idx_str, &idx) < 0 ||
+		    idx >= count) {
+			*error_r = t_strdup_printf(
+				"dict sql lookup failed: Invalid key index: %s",
+				idx_str == NULL ? "NULL" : idx_str);
+			return -1;
+		}
+		if (ctx->values[key_idxs[idx]] == NULL)
+			ctx->values[key_idxs[idx]] = values[0];
+	}
+	if (ret < 0) {
+		*error_r = t_strdup_printf("dict sql lookup failed: %s",
+					   sql_result_get_error(result));
+		return -1;
+	}
+	return 0;
+}
+
+static unsigned int
+sql_dict_lookup_multi_finish_values(struct sql_dict_lookup_multi_context *ctx)
+{
+	unsigned int i, found = 0;
+
+	for (i = 0; i < ctx->keys_count; i++) {
+		ctx->values[i] = ctx->values[ctx->first_idxs[i]];
+		if (ctx->values[i] != NULL)
+			found++;
+	}
+	return found;
+}
+
+static int
+sql_dict_lookup_multi(struct dict *_dict, const struct dict_op_settings *set,
+		      pool_t pool, const char *const *keys,
+		      const char **values, const char **error_r)
+{
+	struct sql_dict *dict = (struct sql_dict *)_dict;
+	struct sql_dict_lookup_multi_context *ctx;
+	struct sql_dict_lookup_multi_query *query;
+	struct sql_result *result;
+	unsigned int i;
+	int ret = 0;
+
+	ctx = sql_dict_lookup_multi_init(dict, set, keys, error_r);
+	if (ctx == NULL)
+		return -1;
+
+	array_foreach_modifiable(&ctx->queries, query) {
+		result = sql_statement_query_s(&query->stmt);
+		if (sql_dict_lookup_multi_query_result(query, result,
+						       error_r) < 0)
+			ret = -1;
+		sql_result_unref(result);
+		if (ret < 0)
+			break;
+	}
+	if (ret == 0) {
+		ret = sql_dict_lookup_multi_finish_values(ctx);
+		for (i = 0; i < ctx->keys_count; i++)
+			values[i] = p_strdup(pool, ctx->values[i]);
+	}
+	sql_dict_lookup_multi_free(&ctx);
+	return ret;
+}
+
+static void
+sql_dict_lookup_multi_async_finish(struct sql_dict_lookup_multi_context *ctx)
+{
+	struct dict_lookup_multi_result result;
+
+	i_assert(ctx->pending > 0);
+	if (--ctx->pending > 0)
+		return;
+
+	i_zero(&result);
+	if (ctx->error != NULL) {
+		result.ret = -1;
+		result.error = ctx->error;
+	} else {
+		result.ret = sql_dict_lookup_multi_finish_values(ctx);
+		result.values = ctx->values;
+	}
+	ctx->callback(&result, ctx->context);
+	sql_dict_lookup_multi_free(&ctx);
+}
+
+static void
+sql_dict_lookup_multi_async_callback(struct sql_result *sql_result,
+				     struct sql_dict_lookup_multi_query *query)
+{
+	struct sql_dict_lookup_multi_context *ctx = query->ctx;
+	const char *error;
+
+	if (ctx->error == NULL &&
+	    sql_dict_lookup_multi_query_result(query, sql_result, &error) < 0)
+		ctx->error = p_strdup(ctx->pool, error);
+	sql_dict_lookup_multi_async_finish(ctx);
+}
+
+static void
+sql_dict_lookup_multi_async(struct dict *_dict,
+			    const struct dict_op_settings *set,
+			    const char *const *keys,
+			    dict_lookup_multi_callback_t *callback,
+			    void *context)
+{
+	struct sql_dict *dict = (struct sql_dict *)_dict;
+	struct sql_dict_lookup_multi_context *ctx;
+	struct sql_dict_lookup_multi_query *query;
+	const char *error;
+
+	ctx = sql_dict_lookup_multi_init(dict, set, keys, &error);
+	if (ctx == NULL) {
+		struct dict_lookup_multi_result result;
+
+		i_zero(&result);
+		result.ret = -1;
+		result.error = error;
+		callback(&result, context);
+		return;
+	}
+	ctx->callback = callback;
+	ctx->context = context;
+	/* keep the context alive until all the queries have been sent, in
+	   case some of the callbacks are called immediately */
+	ctx->pending = array_count(&ctx->queries) + 1;
+	array_foreach_modifiable(&ctx->queries, query) {
+		sql_statement_query(&query->stmt,
+				    sql_dict_lookup_multi_async_callback,
+				    query);
+	}
+	sql_dict_lookup_multi_async_finish(ctx);
+}
+
 static const struct dict_sql_map *
 sql_dict_iterate_find_next_map(struct sql_dict_iterate_context *ctx,
 			       ARRAY_TYPE(const_string) *pattern_values)
@@ -693,7 +1030,16 @@ sql_dict_iterate_build_next_query(struct sql_dict_iterate_context *ctx,
 	const struct dict_sql_field *pattern_fields;
 	enum sql_recurse_type recurse_type;
 	unsigned int i, count;
+	uint64_t limit = 0;
+	size_t where_pos;
 
+	if (ctx->page_continue) {
+		/* the previous page was full. continue with the same map. */
+		i_assert(ctx->next_map_idx > 0);
+		ctx->next_map_idx--;
+	} else {
+		str_truncate(ctx->page_last_value, 0);
+	}
 	map = sql_dict_iterate_find_next_map(ctx, &pattern_values);
 	/* NULL map is allowed if we have already done some lookups */
 	if (map == NULL) {
@@ -742,10 +1088,33 @@ sql_dict_iterate_build_next_query(struct sql_dict_iterate_context *ctx,
 	ARRAY_TYPE(sql_dict_param) params;
 	t_array_init(&params, 4);
 	bool add_username = (ctx->path[0] == DICT_PATH_PRIVATE[0]);
+	where_pos = str_len(query);
 	if (sql_dict_where_build(set->username, map, &pattern_values, add_username,
 				 recurse_type, query, &params, error_r) < 0)
 		return -1;
 
+	/* Paging is done by continuing after the last returned value of the
+	   only selected pattern field. The other pattern fields are fixed by
+	   the WHERE, so the values are unique. */
+	ctx->page_limit = 0;
+	ctx->page_rows = 0;
+	if (dict->set->iterate_page_size > 0 && count > 0 &&
+	    ctx->sql_fields_start_idx == count - 1 &&
+	    (ctx->flags & (DICT_ITERATE_FLAG_EXACT_KEY |
+			   DICT_ITERATE_FLAG_SORT_BY_VALUE)) == 0) {
+		ctx->page_limit = dict->set->iterate_page_size;
+		if (ctx->page_continue) {
+			str_printfa(query, " %s %s > ?",
+				    str_len(query) == where_pos ? "WHERE" : "AND",
+				    pattern_fields[count-1].name);
+			if (sql_dict_field_get_value(map, &pattern_fields[count-1],
+						     str_c(ctx->page_last_value),
+						     "", &params, error_r) < 0)
+				return -1;
+		}
+	}
+	ctx->page_continue = FALSE;
+
 	if ((ctx->flags & DICT_ITERATE_FLAG_SORT_BY_KEY) != 0) {
 		str_append(query, " ORDER BY ");
 		for (i = 0; i < count; i++) {
@@ -755,12 +1124,17 @@ sql_dict_iterate_build_next_query(struct sql_dict_iterate_context *ctx,
 		}
 	} else if ((ctx->flags & DICT_ITERATE_FLAG_SORT_BY_VALUE) != 0)
 		str_printfa(query, " ORDER BY %s", map->value_field);
+	else if (ctx->page_limit > 0)
+		str_printfa(query, " ORDER BY %s", pattern_fields[count-1].name);
 
 	if (ctx->ctx.max_rows > 0) {
 		i_assert(ctx->ctx.row_count < ctx->ctx.max_rows);
-		str_printfa(query, " LIMIT %"PRIu64,
-			    ctx->ctx.max_rows - ctx->ctx.row_count);
+		limit = ctx->ctx.max_rows - ctx->ctx.row_count;
 	}
+	if (ctx->page_limit > 0 && (limit == 0 || limit > ctx->page_limit))
+		limit = ctx->page_limit;
+	if (limit > 0)
+		str_printfa(query, " LIMIT %"PRIu64, limit);
 
 	*stmt_r = sql_dict_statement_init(dict, str_c(query), &params);
 	ctx->map = map;
@@ -828,6 +1202,7 @@ sql_dict_iterate_init(struct dict *_dict,
 	ctx->path = p_strdup(pool, path);
 
 	ctx->key = str_new(pool, 256);
+	ctx->page_last_value = str_new(pool, 64);
 	return &ctx->ctx;
 }
 
@@ -873,6 +1248,13 @@ static bool sql_dict_iterate(struct dict_iterate_context *_ctx,
 		}
 		ret = sql_dict_result_next_row(ctx->map, ctx->result);
 	}
+	if (ret == 0 && ctx->page_limit > 0 &&
+	    ctx->page_rows == ctx->page_limit) {
+		/* the page was full, so there may be more rows */
+		ctx->page_continue = TRUE;
+		ctx->iter_query_sent = FALSE;
+		return sql_dict_iterate(_ctx, key_r, values_r);
+	}
 	if (ret == 0) {
 		/* see if there are more results in the next map.
 		   don't do it if we're looking for an exact match, since we
@@ -911,10 +1293,21 @@ static bool sql_dict_iterate(struct dict_iterate_context *_ctx,
 					pool_datastack_create(), ctx->result, i, sql_field_i);
 			if (value != NULL)
 				str_append(ctx->key, value);
+			if (ctx->page_limit > 0) {
+				/* paging is done only with a single
+				   pattern field, so this is it */
+				if (value == NULL)
+					ctx->page_limit = 0;
+				else {
+					str_truncate(ctx->page_last_value, 0);
+					str_append(ctx->page_last_value, value);
+				}
+			}
 			i++; sql_field_i++;
 		}
 	}
 
+	ctx->page_rows++;
 	*key_r = str_c(ctx->key);
 	if ((ctx->flags & DICT_ITERATE_FLAG_NO_VALUE) == 0) {
 		*values_r = sql_dict_result_unescape_values(ctx->map,
@@ -1623,6 +2016,7 @@ static struct dict sql_dict = {
 		.wait = sql_dict_wait,
 		.expire_scan = sql_dict_expire_scan,
 		.lookup = sql_dict_lookup,
+		.lookup_multi = sql_dict_lookup_multi,
 		.iterate_init = sql_dict_iterate_init,
 		.iterate = sql_dict_iterate,
 		.iterate_deinit = sql_dict_iterate_deinit,
@@ -1633,6 +2027,7 @@ static struct dict sql_dict = {
 		.unset = sql_dict_unset,
 		.atomic_inc = sql_dict_atomic_inc,
 		.lookup_async = sql_dict_lookup_async,
+		.lookup_multi_async = sql_dict_lookup_multi_async,
 	}
 };
 
@@ -7,6 +7,7 @@
 #include "dict-private.h"
 #include "dict-sql.h"
 #include "dict-sql-private.h"
+#include "dict-sql-settings.h"
 #include "driver-test.h"
 
 struct dict_op_settings dict_op_settings = {
@@ -78,6 +79,74 @@ static void test_lookup_one(void)
 	test_end();
 }
 
+static void test_lookup_multi(void)
+{
+	const char *const *values, *error = NULL;
+	const char *const keys[] = {
+		"shared/dictmap/hello/world",
+		"shared/dictmap/hello/missing",
+		"shared/dictmap/hello/there",
+		"shared/counters/global/counter",
+		"shared/dictmap/hello/world",
+		"shared/dictmap/hello/WORLD",
+		NULL
+	};
+	/* The rows are mapped to the keys by the index in the last field,
+	   so it doesn't matter if the database's collation would have
+	   matched the same row for different keys. */
+	struct test_driver_result_set rset = {
+		.rows = 3,
+		.cols = 2,
+		.col_names = (const char *[]){"value", "idx", NULL},
+		.row_data = (const char **[]){
+			(const char*[]){"two", "2", NULL},
+			(const char*[]){"one", "0", NULL},
+			(const char*[]){"ONE", "3", NULL},
+		},
+	};
+	struct test_driver_result_set rset2 = {
+		.rows = 1,
+		.cols = 1,
+		.col_names = (const char *[]){"value", NULL},
+		.row_data = (const char **[]){(const char*[]){"3", NULL}},
+	};
+	struct test_driver_result res = {
+		.nqueries = 1,
+		.queries = (const char *[]){"SELECT value,0 FROM table WHERE a = 'hello' AND b = 'world' UNION ALL "
+			"SELECT value,1 FROM table WHERE a = 'hello' AND b = 'missing' UNION ALL "
+			"SELECT value,2 FROM table WHERE a = 'hello' AND b = 'there' UNION ALL "
+			"SELECT value,3 FROM table WHERE a = 'hello' AND b = 'WORLD'", NULL},
+		.result = &rset,
+	};
+	struct test_driver_result res2 = {
+		.nqueries = 1,
+		.queries = (const char *[]){"SELECT value FROM counters WHERE class = 'global' AND name = 'counter'", NULL},
+		.result = &rset2,
+	};
+	struct dict *dict;
+	pool_t pool = pool_datastack_create();
+
+	test_begin("dict lookup multi");
+	test_setup(&dict);
+
+	test_set_expected(dict, &res);
+	test_set_expected(dict, &res2);
+
+	test_assert(dict_lookup_multi(dict, &dict_op_settings, pool, keys,
+				      &values, &error) == 5);
+	test_assert_strcmp(values[0], "one");
+	test_assert(values[1] == NULL);
+	test_assert_strcmp(values[2], "two");
+	test_assert_strcmp(values[3], "3");
+	/* a duplicate key gets the same value */
+	test_assert_strcmp(values[4], "one");
+	test_assert_strcmp(values[5], "ONE");
+	if (error != NULL)
+		i_error("dict_lookup_multi failed: %s", error);
+	test_teardown(&dict);
+	test_end();
+}
+
 static void test_atomic_inc(void)
 {
 	const char *error;
@@ -290,6 +359,74 @@ static void test_iterate(void)
 	test_end();
 }
 
+static void test_iterate_paged(void)
+{
+	const char *key = NULL, *value = NULL, *error;
+	struct test_driver_result_set rset_1 = {
+		.rows = 2,
+		.cols = 2,
+		.col_names = (const char *[]){"value", "name", NULL},
+		.row_data = (const char **[]){
+			(const char*[]){"1", "a", NULL},
+			(const char*[]){"2", "b", NULL},
+		},
+	};
+	struct test_driver_result_set rset_2 = {
+		.rows = 1,
+		.cols = 2,
+		.col_names = (const char *[]){"value", "name", NULL},
+		.row_data = (const char **[]){
+			(const char*[]){"3", "c", NULL},
+		},
+	};
+	struct test_driver_result res_1 = {
+		.nqueries = 1,
+		.queries = (const char *[]){
+			"SELECT value,name FROM counters WHERE class = 'global' AND name LIKE '%' AND name NOT LIKE '%/%' ORDER BY name LIMIT 2",
+			NULL},
+		.result = &rset_1,
+	};
+	struct test_driver_result res_2 = {
+		.nqueries = 1,
+		.queries = (const char *[]){
+			"SELECT value,name FROM counters WHERE class = 'global' AND name LIKE '%' AND name NOT LIKE '%/%' AND name > 'b' ORDER BY name LIMIT 2",
+			NULL},
+		.result = &rset_2,
+	};
+	static const char *const expected_keys[] = {
+		"shared/counters/global/a",
+		"shared/counters/global/b",
+		"shared/counters/global/c",
+	};
+	struct dict *dict;
+	struct dict_sql_settings *set;
+
+	test_begin("dict iterate paged");
+	test_setup(&dict);
+	set = (struct dict_sql_settings *)((struct sql_dict *)dict)->set;
+	set->iterate_page_size = 2;
+
+	test_set_expected(dict, &res_1);
+	test_set_expected(dict, &res_2);
+
+	struct dict_iterate_context *iter =
+		dict_iterate_init(dict, &dict_op_settings,
+				  "shared/counters/global/", 0);
+	unsigned int idx = 0;
+	while (dict_iterate(iter, &key, &value)) {
+		i_assert(idx < N_ELEMENTS(expected_keys));
+		test_assert_strcmp_idx(key, expected_keys[idx], idx);
+		test_assert_idx(value[0] == (char)('1' + idx), idx);
+		idx++;
+	}
+	test_assert(idx == N_ELEMENTS(expected_keys));
+	test_assert(dict_iterate_deinit(&iter, &error) == 0);
+
+	set->iterate_page_size = 0;
+	test_teardown(&dict);
+	test_end();
+}
+
 int main(void) {
 	sql_drivers_init();
 	sql_driver_test_register();
@@ -297,10 +434,12 @@ int main(void) {
 
 	static void (*const test_functions[])(void) = {
 		test_lookup_one,
+		test_lookup_multi,
 		test_atomic_inc,
 		test_set,
 		test_unset,
 		test_iterate,
+		test_iterate_paged,
 		NULL
 	};
 
@@ -13,6 +13,7 @@ void dict_drivers_register_builtin(void)
 	dict_driver_register(&dict_driver_file);
 	dict_driver_register(&dict_driver_fs);
 	dict_driver_register(&dict_driver_redis);
+	dict_driver_register(&dict_driver_cache);
 }
 
 void dict_drivers_unregister_builtin(void)
@@ -23,4 +24,5 @@ void dict_drivers_unregister_builtin(void)
 	dict_driver_unregister(&dict_driver_file);
 	dict_driver_unregister(&dict_driver_fs);
 	dict_driver_unregister(&dict_driver_redis);
+	dict_driver_unregister(&dict_driver_cache);
 }
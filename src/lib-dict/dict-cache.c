@@ -0,0 +1,564 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "hash.h"
+#include "llist.h"
+#include "ioloop.h"
+#include "str-parse.h"
+#include "dict-transaction-memory.h"
+#include "dict-private.h"
+
+/* URI: cache:[<option>=<value>:...]<dict uri>
+
+   Caches lookup results of the wrapped dict in memory:
+
+   max_entries=<n> - Maximum number of cached keys. The least recently used
+     key is dropped when the cache is full.
+   ttl=<interval> - How long lookup results are cached. 0 disables caching.
+   ttl/<key prefix>=<interval> - Cache time for keys beginning with the
+     prefix, e.g. ttl/priv/quota/=5s. The longest matching prefix is used.
+
+   Changes committed via this dict invalidate the changed keys. Changes done
+   by other processes become visible only after the cache time. */
+
+#define DICT_CACHE_DEFAULT_MAX_ENTRIES 1000
+#define DICT_CACHE_DEFAULT_TTL_SECS 30
+
+struct cache_dict_prefix_ttl {
+	const char *prefix;
+	unsigned int ttl_secs;
+};
+
+struct cache_dict_entry {
+	struct cache_dict_entry *prev, *next;
+
+	char *key;
+	/* NULL if the key doesn't exist */
+	const char **values;
+	time_t expire_time;
+};
+
+struct cache_dict {
+	struct dict dict;
+	struct dict *inner;
+	pool_t pool;
+
+	unsigned int max_entries;
+	unsigned int default_ttl_secs;
+	ARRAY(struct cache_dict_prefix_ttl) prefix_ttls;
+
+	HASH_TABLE(char *, struct cache_dict_entry *) entries;
+	/* head is the least recently used entry */
+	struct cache_dict_entry *lru_head, *lru_tail;
+	/* Increased whenever keys are invalidated. Lookups that were started
+	   before that may have returned the old value, so they aren't
+	   cached. */
+	unsigned int invalidate_counter;
+};
+
+struct cache_dict_lookup_context {
+	struct cache_dict *dict;
+	char *key, *cache_key;
+	unsigned int ttl_secs;
+	unsigned int invalidate_counter;
+
+	dict_lookup_callback_t *callback;
+	void *context;
+};
+
+struct cache_dict_iterate_context {
+	struct dict_iterate_context ctx;
+	struct dict_iterate_context *inner;
+};
+
+struct cache_dict_commit_context {
+	struct dict_transaction_memory_context *mctx;
+
+	dict_transaction_commit_callback_t *callback;
+	void *context;
+};
+
+static int
+cache_dict_parse_prefix_ttl(struct cache_dict *dict, const char *value,
+			    const char **error_r)
+{
+	struct cache_dict_prefix_ttl *prefix_ttl;
+	const char *p, *error;
+	unsigned int secs;
+
+	/* <key prefix>=<interval> */
+	p = strchr(value, '=');
+	if (p == NULL || p == value) {
+		*error_r = t_strdup_printf("Invalid ttl/%s", value);
+		return -1;
+	}
+	if (str_parse_get_interval(p + 1, &secs, &error) < 0) {
+		*error_r = t_strdup_printf("Invalid ttl/%s: %s", value, error);
+		return -1;
+	}
+	prefix_ttl = array_append_space(&dict->prefix_ttls);
+	prefix_ttl->prefix = p_strdup_until(dict->pool, value, p);
+	prefix_ttl->ttl_secs = secs;
+	return 0;
+}
+
+static int
+cache_dict_init(struct dict *driver, const char *uri,
+		const struct dict_settings *set,
+		struct dict **dict_r, const char **error_r)
+{
+	struct cache_dict *dict;
+	const char *p, *arg, *value, *error;
+	unsigned int secs;
+	int ret = 0;
+
+	pool_t pool = pool_alloconly_create("cache dict", 512);
+	dict = p_new(pool, struct cache_dict, 1);
+	dict->pool = pool;
+	dict->max_entries = DICT_CACHE_DEFAULT_MAX_ENTRIES;
+	dict->default_ttl_secs = DICT_CACHE_DEFAULT_TTL_SECS;
+	p_array_init(&dict->prefix_ttls, pool, 4);
+
+	/* options are given until the wrapped dict's driver name, which
+	   doesn't contain '=' */
+	while (ret == 0 && (p = strchr(uri, ':')) != NULL) {
+		arg = t_strdup_until(uri, p);
+		if (strchr(arg, '=') == NULL)
+			break;
+		if (str_begins(arg, "max_entries=", &value)) {
+			if (str_to_uint(value, &dict->max_entries) < 0 ||
+			    dict->max_entries == 0) {
+				*error_r = t_strdup_printf(
+					"Invalid max_entries: %s", value);
+				ret = -1;
+			}
+		} else if (str_begins(arg, "ttl=", &value)) {
+			if (str_parse_get_interval(value, &secs, &error) < 0) {
+				*error_r = t_strdup_printf(
+					"Invalid ttl: %s", error);
+				ret = -1;
+			} else {
+				dict->default_ttl_secs = secs;
+			}
+		} else if (str_begins(arg, "ttl/", &value)) {
+			ret = cache_dict_parse_prefix_ttl(dict, value, error_r);
+		} else {
+			*error_r = t_strdup_printf("Unknown parameter: %s",
+						   arg);
+			ret = -1;
+		}
+		uri = p + 1;
+	}
+	if (ret == 0 && *uri == '\0') {
+		*error_r = "Missing the cached dict's URI";
+		ret = -1;
+	}
+	if (ret == 0 && dict_init(uri, set, &dict->inner, &error) < 0) {
+		*error_r = error;
+		ret = -1;
+	}
+	if (ret < 0) {
+		pool_unref(&pool);
+		return -1;
+	}
+
+	dict->dict = *driver;
+	/* the cache doesn't change the expiration semantics */
+	dict->dict.flags |= dict->inner->flags &
+		DICT_DRIVER_FLAG_SUPPORT_EXPIRE_SECS;
+	hash_table_create(&dict->entries, default_pool, 0, str_hash, strcmp);
+	*dict_r = &dict->dict;
+	return 0;
+}
+
+static void
+cache_dict_entry_free(struct cache_dict *dict, struct cache_dict_entry *entry)
+{
+	hash_table_remove(dict->entries, entry->key);
+	DLLIST2_REMOVE(&dict->lru_head, &dict->lru_tail, entry);
+	i_free(entry->values);
+	i_free(entry->key);
+	i_free(entry);
+}
+
+static void cache_dict_deinit(struct dict *_dict)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+	pool_t pool = dict->pool;
+
+	while (dict->lru_head != NULL)
+		cache_dict_entry_free(dict, dict->lru_head);
+	hash_table_destroy(&dict->entries);
+	dict_deinit(&dict->inner);
+	pool_unref(&pool);
+}
+
+static void cache_dict_wait(struct dict *_dict)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+
+	dict_wait(dict->inner);
+}
+
+static bool cache_dict_switch_ioloop(struct dict *_dict)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+
+	return dict_switch_ioloop(dict->inner);
+}
+
+static int cache_dict_expire_scan(struct dict *_dict, const char **error_r)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+
+	return dict_expire_scan(dict->inner, error_r);
+}
+
+static const char *
+cache_dict_get_key(const char *key, const char *username)
+{
+	/* private keys are different for each user */
+	if (str_begins_with(key, DICT_PATH_PRIVATE))
+		return t_strconcat(key, "\t", username, NULL);
+	return key;
+}
+
+static unsigned int
+cache_dict_get_ttl(struct cache_dict *dict, const char *key)
+{
+	const struct cache_dict_prefix_ttl *prefix_ttl, *match = NULL;
+
+	array_foreach(&dict->prefix_ttls, prefix_ttl) {
+		if (str_begins_with(key, prefix_ttl->prefix) &&
+		    (match == NULL ||
+		     strlen(prefix_ttl->prefix) > strlen(match->prefix)))
+			match = prefix_ttl;
+	}
+	return match != NULL ? match->ttl_secs : dict->default_ttl_secs;
+}
+
+static struct cache_dict_entry *
+cache_dict_entry_lookup(struct cache_dict *dict, const char *cache_key)
+{
+	struct cache_dict_entry *entry;
+
+	entry = hash_table_lookup(dict->entries, cache_key);
+	if (entry == NULL)
+		return NULL;
+	if (entry->expire_time <= ioloop_time) {
+		cache_dict_entry_free(dict, entry);
+		return NULL;
+	}
+	/* move to the end of the LRU list */
+	DLLIST2_REMOVE(&dict->lru_head, &dict->lru_tail, entry);
+	DLLIST2_APPEND(&dict->lru_head, &dict->lru_tail, entry);
+	return entry;
+}
+
+static void
+cache_dict_entry_add(struct cache_dict *dict, const char *cache_key,
+		     const char *const *values, unsigned int ttl_secs)
+{
+	struct cache_dict_entry *entry;
+
+	entry = hash_table_lookup(dict->entries, cache_key);
+	if (entry != NULL)
+		cache_dict_entry_free(dict, entry);
+	else if (hash_table_count(dict->entries) >= dict->max_entries)
+		cache_dict_entry_free(dict, dict->lru_head);
+
+	entry = i_new(struct cache_dict_entry, 1);
+	entry->key = i_strdup(cache_key);
+	if (values != NULL)
+		entry->values = p_strarray_dup(default_pool, values);
+	entry->expire_time = ioloop_time + ttl_secs;
+	hash_table_insert(dict->entries, entry->key, entry);
+	DLLIST2_APPEND(&dict->lru_head, &dict->lru_tail, entry);
+}
+
+static void
+cache_dict_invalidate(struct cache_dict *dict, const char *key,
+		      const char *username)
+{
+	struct cache_dict_entry *entry;
+
+	entry = hash_table_lookup(dict->entries,
+				  cache_dict_get_key(key, username));
+	if (entry != NULL)
+		cache_dict_entry_free(dict, entry);
+	dict->invalidate_counter++;
+}
+
+static void
+cache_dict_lookup_finished(struct cache_dict *dict, const char *key, bool hit)
+{
+	struct event_passthrough *e = event_create_passthrough(dict->dict.event)->
+		set_name("dict_cache_lookup_finished")->
+		add_str("key", key)->
+		add_str("cache", hit ? "hit" : "miss");
+
+	e_debug(e->event(), "Cache %s for '%s'", hit ? "hit" : "miss", key);
+}
+
+static int
+cache_dict_lookup(struct dict *_dict, const struct dict_op_settings *set,
+		  pool_t pool, const char *key, const char *const **values_r,
+		  const char **error_r)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+	struct cache_dict_entry *entry = NULL;
+	const char *cache_key = cache_dict_get_key(key, set->username);
+	unsigned int ttl_secs = cache_dict_get_ttl(dict, key);
+	unsigned int invalidate_counter = dict->invalidate_counter;
+	int ret;
+
+	if (ttl_secs > 0)
+		entry = cache_dict_entry_lookup(dict, cache_key);
+	if (entry != NULL) {
+		cache_dict_lookup_finished(dict, key, TRUE);
+		if (entry->values == NULL)
+			return 0;
+		*values_r = p_strarray_dup(pool, entry->values);
+		return 1;
+	}
+
+	ret = dict_lookup_values(dict->inner, set, pool, key, values_r, error_r);
+	if (ret >= 0 && ttl_secs > 0 &&
+	    invalidate_counter == dict->invalidate_counter) {
+		cache_dict_entry_add(dict, cache_key,
+				     ret > 0 ? *values_r : NULL, ttl_secs);
+	}
+	cache_dict_lookup_finished(dict, key, FALSE);
+	return ret;
+}
+
+static void
+cache_dict_lookup_async_callback(const struct dict_lookup_result *result,
+				 struct cache_dict_lookup_context *lctx)
+{
+	struct cache_dict *dict = lctx->dict;
+
+	if (result->ret >= 0 && lctx->ttl_secs > 0 &&
+	    lctx->invalidate_counter == dict->invalidate_counter) {
+		cache_dict_entry_add(dict, lctx->cache_key,
+				     result->ret > 0 ? result->values : NULL,
+				     lctx->ttl_secs);
+	}
+	cache_dict_lookup_finished(dict, lctx->key, FALSE);
+	lctx->callback(result, lctx->context);
+	i_free(lctx->key);
+	i_free(lctx->cache_key);
+	i_free(lctx);
+}
+
+static void
+cache_dict_lookup_async(struct dict *_dict, const struct dict_op_settings *set,
+			const char *key, dict_lookup_callback_t *callback,
+			void *context)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+	struct cache_dict_lookup_context *lctx;
+	struct cache_dict_entry *entry = NULL;
+	const char *cache_key = cache_dict_get_key(key, set->username);
+	unsigned int ttl_secs = cache_dict_get_ttl(dict, key);
+
+	if (ttl_secs > 0)
+		entry = cache_dict_entry_lookup(dict, cache_key);
+	if (entry != NULL) {
+		const char *const no_values[] = { NULL };
+		struct dict_lookup_result result = {
+			.ret = entry->values == NULL ? 0 : 1,
+			.values = entry->values == NULL ?
+				no_values : entry->values,
+		};
+		result.value = result.values[0];
+		cache_dict_lookup_finished(dict, key, TRUE);
+		callback(&result, context);
+		return;
+	}
+
+	lctx = i_new(struct cache_dict_lookup_context, 1);
+	lctx->dict = dict;
+	lctx->key = i_strdup(key);
+	lctx->cache_key = i_strdup(cache_key);
+	lctx->ttl_secs = ttl_secs;
+	lctx->invalidate_counter = dict->invalidate_counter;
+	lctx->callback = callback;
+	lctx->context = context;
+	dict_lookup_async(dict->inner, set, key,
+			  cache_dict_lookup_async_callback, lctx);
+}
+
+static void
+cache_dict_iterate_async_callback(struct cache_dict_iterate_context *ctx)
+{
+	if (ctx->ctx.async_callback != NULL)
+		ctx->ctx.async_callback(ctx->ctx.async_context);
+}
+
+static struct dict_iterate_context *
+cache_dict_iterate_init(struct dict *_dict, const struct dict_op_settings *set,
+			const char *path, enum dict_iterate_flags flags)
+{
+	struct cache_dict *dict = (struct cache_dict *)_dict;
+	struct cache_dict_iterate_context *ctx;
+
+	/* iterations aren't cached */
+	ctx = i_new(struct cache_dict_iterate_context, 1);
+	ctx->ctx.dict = _dict;
+	ctx->inner = dict_iterate_init(dict->inner, set, path, flags);
+	if ((flags & DICT_ITERATE_FLAG_ASYNC) != 0) {
+		dict_iterate_set_async_callback(ctx->inner,
+			cache_dict_iterate_async_callback, ctx);
+	}
+	return &ctx->ctx;
+}
+
+static bool
+cache_dict_iterate(struct dict_iterate_context *_ctx,
+		   const char **key_r, const char *const **values_r)
+{
+	struct cache_dict_iterate_context *ctx =
+		(struct cache_dict_iterate_context *)_ctx;
+	bool ret;
+
+	ret = dict_iterate_values(ctx->inner, key_r, values_r);
+	_ctx->has_more = dict_iterate_has_more(ctx->inner);
+	return ret;
+}
+
+static int
+cache_dict_iterate_deinit(struct dict_iterate_context *_ctx,
+			  const char **error_r)
+{
+	struct cache_dict_iterate_context *ctx =
+		(struct cache_dict_iterate_context *)_ctx;
+	int ret;
+
+	ret = dict_iterate_deinit(&ctx->inner, error_r);
+	i_free(ctx);
+	return ret;
+}
+
+static struct dict_transaction_context *
+cache_dict_transaction_init(struct dict *_dict)
+{
+	struct dict_transaction_memory_context *ctx;
+	pool_t pool;
+
+	pool = pool_alloconly_create("cache dict transaction", 1024);
+	ctx = p_new(pool, struct dict_transaction_memory_context, 1);
+	dict_transaction_memory_init(ctx, _dict, pool);
+	return &ctx->ctx;
+}
+
+static void
+cache_dict_transaction_invalidate(struct dict_transaction_memory_context *ctx)
+{
+	struct cache_dict *dict = (struct cache_dict *)ctx->ctx.dict;
+	const struct dict_transaction_memory_change *change;
+
+	array_foreach(&ctx->changes, change) T_BEGIN {
+		cache_dict_invalidate(dict, change->key, ctx->ctx.set.username);
+	} T_END;
+}
+
+static void
+cache_dict_commit_callback(const struct dict_commit_result *result,
+			   struct cache_dict_commit_context *cctx)
+{
+	struct dict_transaction_memory_context *ctx = cctx->mctx;
+
+	/* Lookups done while the commit was running may have cached the old
+	   values. Drop them again. */
+	cache_dict_transaction_invalidate(ctx);
+	cctx->callback(result, cctx->context);
+	pool_unref(&ctx->pool);
+}
+
+static void
+cache_dict_transaction_commit(struct dict_transaction_context *_ctx,
+			      bool async,
+			      dict_transaction_commit_callback_t *callback,
+			      void *context)
+{
+	struct dict_transaction_memory_context *ctx =
+		(struct dict_transaction_memory_context *)_ctx;
+	struct cache_dict *dict = (struct cache_dict *)_ctx->dict;
+	struct dict_transaction_context *inner;
+	const struct dict_transaction_memory_change *change;
+	struct cache_dict_commit_context *cctx;
+	struct dict_commit_result result;
+	const char *error;
+
+	if (array_count(&ctx->changes) == 0) {
+		i_zero(&result);
+		result.ret = DICT_COMMIT_RET_OK;
+		callback(&result, context);
+		pool_unref(&ctx->pool);
+		return;
+	}
+
+	const struct dict_op_settings set = {
+		.username = _ctx->set.username,
+		.home_dir = _ctx->set.home_dir,
+		.expire_secs = _ctx->set.expire_secs,
+		.no_slowness_warning = _ctx->set.no_slowness_warning,
+		.hide_log_values = _ctx->set.hide_log_values,
+	};
+	inner = dict_transaction_begin(dict->inner, &set);
+	if (_ctx->timestamp.tv_sec > 0)
+		dict_transaction_set_timestamp(inner, &_ctx->timestamp);
+	array_foreach(&ctx->changes, change) {
+		switch (change->type) {
+		case DICT_CHANGE_TYPE_SET:
+			dict_set(inner, change->key, change->value.str);
+			break;
+		case DICT_CHANGE_TYPE_UNSET:
+			dict_unset(inner, change->key);
+			break;
+		case DICT_CHANGE_TYPE_INC:
+			dict_atomic_inc(inner, change->key, change->value.diff);
+			break;
+		}
+	}
+	cache_dict_transaction_invalidate(ctx);
+
+	cctx = p_new(ctx->pool, struct cache_dict_commit_context, 1);
+	cctx->mctx = ctx;
+	cctx->callback = callback;
+	cctx->context = context;
+	if (async) {
+		dict_transaction_commit_async(&inner,
+			cache_dict_commit_callback, cctx);
+		return;
+	}
+
+	i_zero(&result);
+	result.ret = dict_transaction_commit(&inner, &error);
+	result.error = error;
+	cache_dict_commit_callback(&result, cctx);
+}
+
+struct dict dict_driver_cache = {
+	.name = "cache",
+	.v = {
+		.init = cache_dict_init,
+		.deinit = cache_dict_deinit,
+		.wait = cache_dict_wait,
+		.expire_scan = cache_dict_expire_scan,
+		.lookup = cache_dict_lookup,
+		.iterate_init = cache_dict_iterate_init,
+		.iterate = cache_dict_iterate,
+		.iterate_deinit = cache_dict_iterate_deinit,
+		.transaction_init = cache_dict_transaction_init,
+		.transaction_commit = cache_dict_transaction_commit,
+		.transaction_rollback = dict_transaction_memory_rollback,
+		.set = dict_transaction_memory_set,
+		.unset = dict_transaction_memory_unset,
+		.atomic_inc = dict_transaction_memory_atomic_inc,
+		.lookup_async = cache_dict_lookup_async,
+		.switch_ioloop = cache_dict_switch_ioloop,
+	},
+};
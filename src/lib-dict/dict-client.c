@@ -38,6 +38,7 @@ struct client_dict_cmd {
 	char *query;
 	unsigned int async_id;
 	struct timeval async_id_received_time;
+	unsigned int lookup_keys_count;
 
 	uint64_t start_global_ioloop_usecs;
 	uint64_t start_dict_ioloop_usecs;
@@ -58,6 +59,7 @@ struct client_dict_cmd {
 
 	struct {
 		dict_lookup_callback_t *lookup;
+		dict_lookup_multi_callback_t *lookup_multi;
 		dict_transaction_commit_callback_t *commit;
 		void *context;
 	} api_callback;
@@ -89,6 +91,9 @@ struct client_dict {
 	struct client_dict_transaction_context *transactions;
 
 	unsigned int transaction_id_counter;
+	/* Minor version announced by the server in its handshake reply.
+	   Servers older than v4.1 don't reply to the handshake at all. */
+	unsigned int server_minor_version;
 };
 
 struct client_dict_iter_result {
@@ -518,6 +523,17 @@ static int dict_conn_input_line(struct connection *_conn, const char *line)
 
 	if (line[0] == DICT_PROTOCOL_REPLY_ASYNC_ID)
 		return dict_conn_assign_next_async_id(conn, line) < 0 ? -1 : 1;
+	if (line[0] == DICT_PROTOCOL_CMD_HELLO) {
+		/* server handshake: H<major> <minor> (protocol v4.1+) */
+		args = t_strsplit_tabescaped(line + 1);
+		if (str_array_length(args) < 2 ||
+		    str_to_uint(args[1], &dict->server_minor_version) < 0) {
+			e_error(conn->conn.event,
+				"Received invalid handshake line: %s", line);
+			return -1;
+		}
+		return 1;
+	}
 
 	cmds = array_get(&conn->dict->cmds, &count);
 	if (count == 0) {
@@ -625,6 +641,7 @@ static void client_dict_disconnect(struct client_dict *dict, const char *reason)
 	timeout_remove(&dict->to_idle);
 	timeout_remove(&dict->to_requests);
 	connection_disconnect(&dict->conn.conn);
+	dict->server_minor_version = 0;
 }
 
 static int client_dict_reconnect(struct client_dict *dict, const char *reason,
@@ -1041,6 +1058,265 @@ static int client_dict_lookup(struct dict *_dict,
 	i_unreached();
 }
 
+static int
+client_dict_lookup_multi_parse(struct client_dict_cmd *cmd, const char *value,
+			       const char *const **values_r)
+{
+	const char *const *args = t_strsplit_tabescaped(value);
+	const char **values;
+	unsigned int i;
+	int found = 0;
+
+	if (str_array_length(args) != cmd->lookup_keys_count)
+		return -1;
+	values = t_new(const char *, cmd->lookup_keys_count + 1);
+	for (i = 0; i < cmd->lookup_keys_count; i++) {
+		switch (args[i][0]) {
+		case DICT_PROTOCOL_REPLY_OK:
+			values[i] = args[i] + 1;
+			found++;
+			break;
+		case DICT_PROTOCOL_REPLY_NOTFOUND:
+			break;
+		default:
+			return -1;
+		}
+	}
+	*values_r = values;
+	return found;
+}
+
+static void
+client_dict_lookup_multi_async_callback(struct client_dict_cmd *cmd,
+					enum dict_protocol_reply reply,
+					const char *value,
+					const char *const *extra_args,
+					const char *error,
+					bool disconnected ATTR_UNUSED)
+{
+	struct client_dict *dict = cmd->dict;
+	struct dict_lookup_multi_result result;
+
+	i_zero(&result);
+	if (error != NULL) {
+		result.ret = -1;
+		result.error = error;
+	} else if (reply == DICT_PROTOCOL_REPLY_FAIL) {
+		result.error = value[0] == '\0' ? "dict-server returned failure" :
+			t_strdup_printf("dict-server returned failure: %s",
+			value);
+		result.ret = -1;
+	} else if (reply != DICT_PROTOCOL_REPLY_OK ||
+		   (result.ret = client_dict_lookup_multi_parse(
+				cmd, value, &result.values)) < 0) {
+		result.error = t_strdup_printf(
+			"dict-client: Invalid lookup '%s' reply: %c%s",
+			cmd->query, reply, value);
+		/* This is already the command's callback being called.
+		   Make sure it is not called again by
+		   dict_cmd_callback_error() */
+		cmd->callback = NULL;
+		client_dict_disconnect(dict, result.error);
+		result.ret = -1;
+	}
+
+	int diff = timeval_diff_msecs(&ioloop_timeval, &cmd->start_time);
+	if (result.error != NULL) {
+		/* include timing info always in error messages */
+		result.error = t_strdup_printf("%s (reply took %s)",
+			result.error, dict_warnings_sec(cmd, diff, extra_args));
+	} else if (!cmd->background &&
+		   diff >= (int)dict->warn_slow_msecs) {
+		e_warning(dict->conn.conn.event, "dict lookup took %s: %s",
+			  dict_warnings_sec(cmd, diff, extra_args),
+			  cmd->query);
+	}
+
+	dict_pre_api_callback(&dict->dict);
+	cmd->api_callback.lookup_multi(&result, cmd->api_callback.context);
+	dict_post_api_callback(&dict->dict);
+}
+
+struct client_dict_lookup_multi_fallback {
+	pool_t pool;
+	const char **values;
+	unsigned int pending;
+	int found;
+	const char *error;
+
+	dict_lookup_multi_callback_t *callback;
+	void *context;
+};
+
+struct client_dict_lookup_multi_fallback_key {
+	struct client_dict_lookup_multi_fallback *ctx;
+	unsigned int idx;
+};
+
+static void
+client_dict_lookup_multi_fallback_finish(
+	struct client_dict_lookup_multi_fallback *ctx)
+{
+	struct dict_lookup_multi_result result;
+
+	i_assert(ctx->pending > 0);
+	if (--ctx->pending > 0)
+		return;
+
+	i_zero(&result);
+	if (ctx->error != NULL) {
+		result.ret = -1;
+		result.error = ctx->error;
+	} else {
+		result.ret = ctx->found;
+		result.values = ctx->values;
+	}
+	ctx->callback(&result, ctx->context);
+	pool_unref(&ctx->pool);
+}
+
+static void
+client_dict_lookup_multi_fallback_callback(
+	const struct dict_lookup_result *result,
+	struct client_dict_lookup_multi_fallback_key *key)
+{
+	struct client_dict_lookup_multi_fallback *ctx = key->ctx;
+
+	if (result->ret < 0) {
+		if (ctx->error == NULL)
+			ctx->error = p_strdup(ctx->pool, result->error);
+	} else if (result->ret > 0) {
+		ctx->values[key->idx] = p_strdup(ctx->pool, result->value);
+		ctx->found++;
+	}
+	client_dict_lookup_multi_fallback_finish(ctx);
+}
+
+static void
+client_dict_lookup_multi_fallback(struct client_dict *dict,
+				  const struct dict_op_settings *set,
+				  const char *const *keys,
+				  dict_lookup_multi_callback_t *callback,
+				  void *context)
+{
+	struct client_dict_lookup_multi_fallback *ctx;
+	struct client_dict_lookup_multi_fallback_key *key;
+	unsigned int i, count = str_array_length(keys);
+	pool_t pool;
+
+	pool = pool_alloconly_create("dict-client lookup multi", 512);
+	ctx = p_new(pool, struct client_dict_lookup_multi_fallback, 1);
+	ctx->pool = pool;
+	ctx->values = p_new(pool, const char *, count + 1);
+	ctx->callback = callback;
+	ctx->context = context;
+	/* the lookups may finish immediately on errors */
+	ctx->pending = count + 1;
+
+	for (i = 0; i < count; i++) {
+		key = p_new(pool, struct client_dict_lookup_multi_fallback_key, 1);
+		key->ctx = ctx;
+		key->idx = i;
+		dict_lookup_async(&dict->dict, set, keys[i],
+				  client_dict_lookup_multi_fallback_callback,
+				  key);
+	}
+	client_dict_lookup_multi_fallback_finish(ctx);
+}
+
+static void
+client_dict_lookup_multi_async(struct dict *_dict,
+			       const struct dict_op_settings *set,
+			       const char *const *keys,
+			       dict_lookup_multi_callback_t *callback,
+			       void *context)
+{
+	struct client_dict *dict = (struct client_dict *)_dict;
+	struct client_dict_cmd *cmd;
+	string_t *query;
+	unsigned int i;
+
+	if (dict->server_minor_version < 1) {
+		/* The server isn't known to support LOOKUP_MULTI. Older
+		   servers disconnect on unknown commands, so look up the
+		   keys one by one. */
+		client_dict_lookup_multi_fallback(dict, set, keys,
+						  callback, context);
+		return;
+	}
+
+	query = t_str_new(128);
+	str_append_c(query, DICT_PROTOCOL_CMD_LOOKUP_MULTI);
+	if (set->username != NULL)
+		str_append_tabescaped(query, set->username);
+	for (i = 0; keys[i] != NULL; i++) {
+		str_append_c(query, '\t');
+		str_append_tabescaped(query, keys[i]);
+	}
+	cmd = client_dict_cmd_init(dict, str_c(query));
+	cmd->lookup_keys_count = i;
+	cmd->callback = client_dict_lookup_multi_async_callback;
+	cmd->api_callback.lookup_multi = callback;
+	cmd->api_callback.context = context;
+	cmd->retry_errors = TRUE;
+
+	client_dict_cmd_send(dict, &cmd, NULL);
+}
+
+struct client_dict_sync_lookup_multi {
+	unsigned int count;
+	char *error;
+	char **values;
+	int ret;
+};
+
+static void
+client_dict_lookup_multi_callback(const struct dict_lookup_multi_result *result,
+				  struct client_dict_sync_lookup_multi *lookup)
+{
+	lookup->ret = result->ret;
+	if (result->ret == -1) {
+		lookup->error = i_strdup(result->error);
+		return;
+	}
+	/* The caller's pool could point to data stack. We can't allocate from
+	   there, since we're in a different data stack frame. */
+	lookup->values = i_new(char *, lookup->count);
+	for (unsigned int i = 0; i < lookup->count; i++)
+		lookup->values[i] = i_strdup(result->values[i]);
+}
+
+static int
+client_dict_lookup_multi(struct dict *_dict, const struct dict_op_settings *set,
+			 pool_t pool, const char *const *keys,
+			 const char **values, const char **error_r)
+{
+	struct client_dict_sync_lookup_multi lookup;
+	unsigned int i;
+
+	i_zero(&lookup);
+	lookup.count = str_array_length(keys);
+	lookup.ret = -2;
+
+	dict_lookup_multi_async(_dict, set, keys,
+				client_dict_lookup_multi_callback, &lookup);
+	if (lookup.ret == -2)
+		client_dict_wait(_dict);
+
+	if (lookup.ret < 0) {
+		i_assert(lookup.ret == -1);
+		*error_r = t_strdup(lookup.error);
+		i_free(lookup.error);
+		return -1;
+	}
+	for (i = 0; i < lookup.count; i++) {
+		values[i] = p_strdup(pool, lookup.values[i]);
+		i_free(lookup.values[i]);
+	}
+	i_free(lookup.values);
+	return lookup.ret;
+}
+
 static void client_dict_iterate_unref(struct client_dict_iterate_context *ctx)
 {
 	i_assert(ctx->refcount > 0);
@@ -1509,6 +1785,7 @@ struct dict dict_driver_client = {
 		.deinit = client_dict_deinit,
 		.wait = client_dict_wait,
 		.lookup = client_dict_lookup,
+		.lookup_multi = client_dict_lookup_multi,
 		.iterate_init = client_dict_iterate_init,
 		.iterate = client_dict_iterate,
 		.iterate_deinit = client_dict_iterate_deinit,
@@ -1519,6 +1796,7 @@ struct dict dict_driver_client = {
 		.unset = client_dict_unset,
 		.atomic_inc = client_dict_atomic_inc,
 		.lookup_async = client_dict_lookup_async,
+		.lookup_multi_async = client_dict_lookup_multi_async,
 		.switch_ioloop = client_dict_switch_ioloop,
 		.set_timestamp = client_dict_set_timestamp,
 		.set_hide_log_values = client_dict_set_hide_log_values,
@@ -6,15 +6,20 @@
 #define DEFAULT_DICT_SERVER_SOCKET_FNAME "dict"
 
 #define DICT_CLIENT_PROTOCOL_MAJOR_VERSION 4
-#define DICT_CLIENT_PROTOCOL_MINOR_VERSION 0
+#define DICT_CLIENT_PROTOCOL_MINOR_VERSION 1
 
 #define DICT_CLIENT_MAX_LINE_LENGTH (64*1024)
 
 enum dict_protocol_cmd {
-        /* <major-version> <minor-version> <value type> <user> <dict name> */
+        /* <major-version> <minor-version> <value type> <user> <dict name>
+	   v4.1+ servers reply to this with H<major-version> <minor-version> */
 	DICT_PROTOCOL_CMD_HELLO = 'H',
 
 	DICT_PROTOCOL_CMD_LOOKUP = 'L', /* <key> */
+	/* <user> <key> [<key> ...] (protocol v4.1+, sent only after the
+	   server's handshake reply) - reply has O<value> or N
+	   for each key double-tabescaped inside a single O parameter */
+	DICT_PROTOCOL_CMD_LOOKUP_MULTI = 'K',
 	DICT_PROTOCOL_CMD_ITERATE = 'I', /* <flags> <path> */
 
 	DICT_PROTOCOL_CMD_BEGIN = 'B', /* <id> <user> <expire secs> */
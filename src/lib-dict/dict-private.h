@@ -51,6 +51,17 @@ struct dict_vfuncs {
 	void (*lookup_async)(struct dict *dict, const struct dict_op_settings *set,
 			     const char *key, dict_lookup_callback_t *callback,
 			     void *context);
+	/* values has space for all the keys, and it's initially filled
+	   with NULLs. Returns the number of found keys or -1 on error. */
+	int (*lookup_multi)(struct dict *dict,
+			    const struct dict_op_settings *set, pool_t pool,
+			    const char *const *keys, const char **values,
+			    const char **error_r);
+	void (*lookup_multi_async)(struct dict *dict,
+				   const struct dict_op_settings *set,
+				   const char *const *keys,
+				   dict_lookup_multi_callback_t *callback,
+				   void *context);
 	bool (*switch_ioloop)(struct dict *dict);
 	void (*set_timestamp)(struct dict_transaction_context *ctx,
 			      const struct timespec *ts);
@@ -120,6 +131,7 @@ extern struct dict dict_driver_fs;
 extern struct dict dict_driver_redis;
 extern struct dict dict_driver_cdb;
 extern struct dict dict_driver_fail;
+extern struct dict dict_driver_cache;
 
 extern struct dict_iterate_context dict_iter_unsupported;
 extern struct dict_transaction_context dict_transaction_unsupported;
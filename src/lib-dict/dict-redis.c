@@ -19,6 +19,12 @@ enum redis_input_state {
 	REDIS_INPUT_STATE_SELECT,
 	/* expecting $-1 / $<size> followed by GET reply */
 	REDIS_INPUT_STATE_GET,
+	/* same as GET, but the reply is given to the first async lookup */
+	REDIS_INPUT_STATE_GET_ASYNC,
+	/* expecting *<nvalues> for MGET */
+	REDIS_INPUT_STATE_MGET,
+	/* expecting $-1 / $<size> followed by one of the MGET values */
+	REDIS_INPUT_STATE_MGET_VALUE,
 	/* expecting +QUEUED */
 	REDIS_INPUT_STATE_MULTI,
 	/* expecting +OK reply for DISCARD */
@@ -35,6 +41,11 @@ struct redis_connection {
 
 	string_t *last_reply;
 	unsigned int bytes_left;
+	/* MGET values are written to mget_values[mget_idx]. They're allocated
+	   from default_pool, since the caller's pool may be a data stack pool
+	   and the replies are read in a different data stack frame. */
+	char **mget_values;
+	unsigned int mget_count, mget_idx;
 	bool value_not_found;
 	bool value_received;
 };
@@ -45,6 +56,11 @@ struct redis_dict_reply {
 	void *context;
 };
 
+struct redis_dict_lookup {
+	dict_lookup_callback_t *callback;
+	void *context;
+};
+
 struct redis_dict {
 	struct dict dict;
 	char *password, *key_prefix, *expire_value;
@@ -54,6 +70,9 @@ struct redis_dict {
 
 	ARRAY(enum redis_input_state) input_states;
 	ARRAY(struct redis_dict_reply) replies;
+	/* Pending async lookups in the order their GETs were sent */
+	ARRAY(struct redis_dict_lookup) lookups;
+	struct timeout *to_lookup;
 
 	bool connected;
 	bool transaction_open;
@@ -90,13 +109,29 @@ static void redis_reply_callback(struct redis_connection *conn,
 		io_loop_set_current(conn->dict->dict.ioloop);
 }
 
+static void redis_lookup_callback(struct redis_dict *dict,
+				  const struct redis_dict_lookup *lookup,
+				  const struct dict_lookup_result *result)
+{
+	if (dict->dict.prev_ioloop != NULL)
+		io_loop_set_current(dict->dict.prev_ioloop);
+	lookup->callback(result, lookup->context);
+	if (dict->dict.prev_ioloop != NULL)
+		io_loop_set_current(dict->dict.ioloop);
+}
+
 static void
 redis_disconnected(struct redis_connection *conn, const char *reason)
 {
 	const struct dict_commit_result result = {
 		DICT_COMMIT_RET_FAILED, reason
 	};
+	const struct dict_lookup_result lookup_result = {
+		.ret = -1, .error = reason
+	};
 	const struct redis_dict_reply *reply;
+	const struct redis_dict_lookup *lookup;
+	ARRAY(struct redis_dict_lookup) lookups;
 
 	conn->dict->db_id_set = FALSE;
 	conn->dict->connected = FALSE;
@@ -107,6 +142,14 @@ redis_disconnected(struct redis_connection *conn, const char *reason)
 	array_clear(&conn->dict->replies);
 	array_clear(&conn->dict->input_states);
 
+	/* the callbacks may start new lookups */
+	t_array_init(&lookups, array_count(&conn->dict->lookups) + 1);
+	array_append_array(&lookups, &conn->dict->lookups);
+	array_clear(&conn->dict->lookups);
+	timeout_remove(&conn->dict->to_lookup);
+	array_foreach(&lookups, lookup)
+		redis_lookup_callback(conn->dict, lookup, &lookup_result);
+
 	if (conn->dict->dict.ioloop != NULL)
 		io_loop_stop(conn->dict->dict.ioloop);
 }
@@ -149,6 +192,52 @@ static void redis_wait(struct redis_dict *dict)
 	dict->dict.prev_ioloop = NULL;
 }
 
+static void redis_input_get_finish(struct redis_connection *conn, bool found)
+{
+	enum redis_input_state state = *array_front(&conn->dict->input_states);
+
+	if (state == REDIS_INPUT_STATE_GET_ASYNC) {
+		struct redis_dict *dict = conn->dict;
+		struct redis_dict_lookup lookup = *array_front(&dict->lookups);
+		const char *const values[] = {
+			found ? t_strdup(str_c(conn->last_reply)) : NULL, NULL
+		};
+		const struct dict_lookup_result result = {
+			.ret = found ? 1 : 0,
+			.value = values[0],
+			.values = found ? values : NULL,
+		};
+
+		/* remove the state before calling the callback, since it may
+		   send new commands */
+		if (dict->dict.ioloop != NULL)
+			io_loop_stop(dict->dict.ioloop);
+		redis_input_state_remove(dict);
+		array_pop_front(&dict->lookups);
+		if (array_count(&dict->lookups) == 0)
+			timeout_remove(&dict->to_lookup);
+		else
+			timeout_reset(dict->to_lookup);
+		redis_lookup_callback(dict, &lookup, &result);
+		return;
+	} else if (state == REDIS_INPUT_STATE_MGET_VALUE) {
+		i_assert(conn->mget_idx < conn->mget_count);
+		if (found) {
+			conn->mget_values[conn->mget_idx] =
+				i_strdup(str_c(conn->last_reply));
+		}
+		if (++conn->mget_idx == conn->mget_count)
+			conn->value_received = TRUE;
+	} else {
+		conn->value_received = TRUE;
+		conn->value_not_found = !found;
+	}
+
+	if (conn->dict->dict.ioloop != NULL)
+		io_loop_stop(conn->dict->dict.ioloop);
+	redis_input_state_remove(conn->dict);
+}
+
 static int redis_input_get(struct redis_connection *conn, const char **error_r)
 {
 	const unsigned char *data;
@@ -160,12 +249,11 @@ static int redis_input_get(struct redis_connection *conn, const char **error_r)
 		line = i_stream_next_line(conn->conn.input);
 		if (line == NULL)
 			return 0;
+		/* there may be multiple replies pipelined - each one
+		   starts from scratch */
+		str_truncate(conn->last_reply, 0);
 		if (strcmp(line, "$-1") == 0) {
-			conn->value_received = TRUE;
-			conn->value_not_found = TRUE;
-			if (conn->dict->dict.ioloop != NULL)
-				io_loop_stop(conn->dict->dict.ioloop);
-			redis_input_state_remove(conn->dict);
+			redis_input_get_finish(conn, FALSE);
 			return 1;
 		}
 		if (line[0] != '$' || str_to_uint(line+1, &conn->bytes_left) < 0) {
@@ -188,12 +276,8 @@ static int redis_input_get(struct redis_connection *conn, const char **error_r)
 		return 0;
 
 	/* reply fully read - drop trailing CRLF */
-	conn->value_received = TRUE;
 	str_truncate(conn->last_reply, str_len(conn->last_reply)-2);
-
-	if (conn->dict->dict.ioloop != NULL)
-		io_loop_stop(conn->dict->dict.ioloop);
-	redis_input_state_remove(conn->dict);
+	redis_input_get_finish(conn, TRUE);
 	return 1;
 }
 
@@ -217,7 +301,9 @@ redis_conn_input_more(struct redis_connection *conn, const char **error_r)
 		return -1;
 	}
 	state = states[0];
-	if (state == REDIS_INPUT_STATE_GET)
+	if (state == REDIS_INPUT_STATE_GET ||
+	    state == REDIS_INPUT_STATE_GET_ASYNC ||
+	    state == REDIS_INPUT_STATE_MGET_VALUE)
 		return redis_input_get(conn, error_r);
 
 	line = i_stream_next_line(conn->conn.input);
@@ -227,7 +313,23 @@ redis_conn_input_more(struct redis_connection *conn, const char **error_r)
 	redis_input_state_remove(dict);
 	switch (state) {
 	case REDIS_INPUT_STATE_GET:
+	case REDIS_INPUT_STATE_GET_ASYNC:
+	case REDIS_INPUT_STATE_MGET_VALUE:
 		i_unreached();
+	case REDIS_INPUT_STATE_MGET:
+		if (line[0] != '*' || str_to_uint(line+1, &num_replies) < 0)
+			break;
+		if (num_replies != conn->mget_count) {
+			*error_r = t_strdup_printf(
+				"redis: MGET expected %u values, not %u",
+				conn->mget_count, num_replies);
+			return -1;
+		}
+		/* the values are the next replies */
+		state = REDIS_INPUT_STATE_MGET_VALUE;
+		for (unsigned int i = 0; i < num_replies; i++)
+			array_push_front(&dict->input_states, &state);
+		return 1;
 	case REDIS_INPUT_STATE_AUTH:
 	case REDIS_INPUT_STATE_SELECT:
 	case REDIS_INPUT_STATE_MULTI:
@@ -438,6 +540,7 @@ redis_dict_init(struct dict *driver, const char *uri,
 
 	i_array_init(&dict->input_states, 4);
 	i_array_init(&dict->replies, 4);
+	i_array_init(&dict->lookups, 4);
 
 	*dict_r = &dict->dict;
 	return 0;
@@ -453,6 +556,9 @@ static void redis_dict_deinit(struct dict *_dict)
 	}
 	connection_deinit(&dict->conn.conn);
 	str_free(&dict->conn.last_reply);
+	i_assert(array_count(&dict->lookups) == 0);
+	i_assert(dict->to_lookup == NULL);
+	array_free(&dict->lookups);
 	array_free(&dict->replies);
 	array_free(&dict->input_states);
 	i_free(dict->expire_value);
@@ -532,19 +638,11 @@ static void redis_dict_select_db(struct redis_dict *dict)
 	redis_input_state_add(dict, REDIS_INPUT_STATE_SELECT);
 }
 
-static int redis_dict_lookup(struct dict *_dict,
-			     const struct dict_op_settings *set,
-			     pool_t pool, const char *key,
-			     const char *const **values_r, const char **error_r)
+static void
+redis_dict_lookup_run(struct redis_dict *dict, const char *cmd,
+		      enum redis_input_state state)
 {
-	struct redis_dict *dict = (struct redis_dict *)_dict;
 	struct timeout *to;
-	const char *cmd;
-
-	key = redis_dict_get_full_key(dict, set->username, key);
-
-	dict->conn.value_received = FALSE;
-	dict->conn.value_not_found = FALSE;
 
 	i_assert(dict->dict.ioloop == NULL);
 
@@ -567,12 +665,8 @@ static int redis_dict_lookup(struct dict *_dict,
 
 		if (dict->connected) {
 			redis_dict_select_db(dict);
-			cmd = t_strdup_printf("*2\r\n$3\r\nGET\r\n$%zu\r\n%s\r\n",
-					      strlen(key), key);
 			o_stream_nsend_str(dict->conn.conn.output, cmd);
-
-			str_truncate(dict->conn.last_reply, 0);
-			redis_input_state_add(dict, REDIS_INPUT_STATE_GET);
+			redis_input_state_add(dict, state);
 			do {
 				io_loop_run(dict->dict.ioloop);
 			} while (array_count(&dict->input_states) > 0);
@@ -585,6 +679,24 @@ static int redis_dict_lookup(struct dict *_dict,
 	io_loop_set_current(dict->dict.ioloop);
 	io_loop_destroy(&dict->dict.ioloop);
 	dict->dict.prev_ioloop = NULL;
+}
+
+static int redis_dict_lookup(struct dict *_dict,
+			     const struct dict_op_settings *set,
+			     pool_t pool, const char *key,
+			     const char *const **values_r, const char **error_r)
+{
+	struct redis_dict *dict = (struct redis_dict *)_dict;
+	const char *cmd;
+
+	key = redis_dict_get_full_key(dict, set->username, key);
+
+	dict->conn.value_received = FALSE;
+	dict->conn.value_not_found = FALSE;
+
+	cmd = t_strdup_printf("*2\r\n$3\r\nGET\r\n$%zu\r\n%s\r\n",
+			      strlen(key), key);
+	redis_dict_lookup_run(dict, cmd, REDIS_INPUT_STATE_GET);
 
 	if (!dict->conn.value_received) {
 		/* we failed in some way. make sure we disconnect since the
@@ -603,18 +715,53 @@ static int redis_dict_lookup(struct dict *_dict,
 	return 1;
 }
 
-static struct dict_transaction_context *
-redis_transaction_init(struct dict *_dict)
+static int
+redis_dict_lookup_multi(struct dict *_dict, const struct dict_op_settings *set,
+			pool_t pool, const char *const *keys,
+			const char **values, const char **error_r)
 {
 	struct redis_dict *dict = (struct redis_dict *)_dict;
-	struct redis_dict_transaction_context *ctx;
+	unsigned int i, count = str_array_length(keys);
+	string_t *cmd = t_str_new(128);
+	const char *key;
+	int found = 0;
+
+	str_printfa(cmd, "*%u\r\n$4\r\nMGET\r\n", count + 1);
+	for (i = 0; i < count; i++) {
+		key = redis_dict_get_full_key(dict, set->username, keys[i]);
+		str_printfa(cmd, "$%zu\r\n%s\r\n", strlen(key), key);
+	}
 
-	i_assert(!dict->transaction_open);
-	dict->transaction_open = TRUE;
+	dict->conn.value_received = FALSE;
+	dict->conn.mget_values = i_new(char *, count);
+	dict->conn.mget_count = count;
+	dict->conn.mget_idx = 0;
 
-	ctx = i_new(struct redis_dict_transaction_context, 1);
-	ctx->ctx.dict = _dict;
+	redis_dict_lookup_run(dict, str_c(cmd), REDIS_INPUT_STATE_MGET);
+
+	for (i = 0; i < count; i++) {
+		if (dict->conn.mget_values[i] != NULL) {
+			values[i] = p_strdup(pool, dict->conn.mget_values[i]);
+			i_free(dict->conn.mget_values[i]);
+			found++;
+		}
+	}
+	i_free(dict->conn.mget_values);
+	dict->conn.mget_count = 0;
+
+	if (!dict->conn.value_received) {
+		/* we failed in some way. make sure we disconnect since the
+		   connection state isn't known anymore */
+		*error_r = t_strdup_printf("redis: Communication failure (last reply: %s)",
+					   str_c(dict->conn.last_reply));
+		redis_disconnected(&dict->conn, *error_r);
+		return -1;
+	}
+	return found;
+}
 
+static bool redis_dict_connect(struct redis_dict *dict)
+{
 	if (dict->conn.conn.fd_in == -1 &&
 	    connection_client_connect(&dict->conn.conn) < 0) {
 		e_error(dict->conn.conn.event, "Couldn't connect");
@@ -626,6 +773,67 @@ redis_transaction_init(struct dict *_dict)
 	}
 	if (dict->connected)
 		redis_dict_select_db(dict);
+	return dict->connected;
+}
+
+static void
+redis_dict_lookup_async(struct dict *_dict, const struct dict_op_settings *set,
+			const char *key, dict_lookup_callback_t *callback,
+			void *context)
+{
+	struct redis_dict *dict = (struct redis_dict *)_dict;
+	struct redis_dict_lookup *lookup;
+	const char *cmd;
+
+	if (!redis_dict_connect(dict)) {
+		const struct dict_lookup_result result = {
+			.ret = -1,
+			.error = "redis: Couldn't connect",
+		};
+		callback(&result, context);
+		return;
+	}
+
+	/* Pipeline the GET after any previously sent commands. The replies
+	   come in the same order, so the lookups array is used as a FIFO. */
+	key = redis_dict_get_full_key(dict, set->username, key);
+	cmd = t_strdup_printf("*2\r\n$3\r\nGET\r\n$%zu\r\n%s\r\n",
+			      strlen(key), key);
+	o_stream_nsend_str(dict->conn.conn.output, cmd);
+	redis_input_state_add(dict, REDIS_INPUT_STATE_GET_ASYNC);
+
+	lookup = array_append_space(&dict->lookups);
+	lookup->callback = callback;
+	lookup->context = context;
+	if (dict->to_lookup == NULL) {
+		dict->to_lookup = timeout_add(dict->timeout_msecs,
+					      redis_dict_lookup_timeout, dict);
+	}
+}
+
+static bool redis_dict_switch_ioloop(struct dict *_dict)
+{
+	struct redis_dict *dict = (struct redis_dict *)_dict;
+
+	if (dict->to_lookup != NULL)
+		dict->to_lookup = io_loop_move_timeout(&dict->to_lookup);
+	connection_switch_ioloop(&dict->conn.conn);
+	return array_count(&dict->input_states) > 0;
+}
+
+static struct dict_transaction_context *
+redis_transaction_init(struct dict *_dict)
+{
+	struct redis_dict *dict = (struct redis_dict *)_dict;
+	struct redis_dict_transaction_context *ctx;
+
+	i_assert(!dict->transaction_open);
+	dict->transaction_open = TRUE;
+
+	ctx = i_new(struct redis_dict_transaction_context, 1);
+	ctx->ctx.dict = _dict;
+
+	(void)redis_dict_connect(dict);
 	return &ctx->ctx;
 }
 
@@ -822,11 +1030,14 @@ struct dict dict_driver_redis = {
 		.deinit = redis_dict_deinit,
 		.wait = redis_dict_wait,
 		.lookup = redis_dict_lookup,
+		.lookup_multi = redis_dict_lookup_multi,
 		.transaction_init = redis_transaction_init,
 		.transaction_commit = redis_transaction_commit,
 		.transaction_rollback = redis_transaction_rollback,
 		.set = redis_set,
 		.unset = redis_unset,
 		.atomic_inc = redis_atomic_inc,
+		.lookup_async = redis_dict_lookup_async,
+		.switch_ioloop = redis_dict_switch_ioloop,
 	}
 };
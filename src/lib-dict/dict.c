@@ -29,6 +29,14 @@ struct dict_lookup_callback_ctx {
 	void *context;
 };
 
+struct dict_lookup_multi_callback_ctx {
+	struct dict *dict;
+	struct event *event;
+	unsigned int keys_count;
+	dict_lookup_multi_callback_t *callback;
+	void *context;
+};
+
 static ARRAY(struct dict *) dict_drivers;
 
 static void
@@ -256,6 +264,20 @@ static void dict_lookup_finished(struct event *event, int ret, const char *error
 			"not found");
 }
 
+static void
+dict_lookup_multi_finished(struct event *event, int ret,
+			   unsigned int keys_count, const char *error)
+{
+	i_assert(ret >= 0 || error != NULL);
+	if (ret < 0)
+		event_add_str(event, "error", error);
+	else
+		event_add_int(event, "found_keys", ret);
+	event_set_name(event, "dict_lookup_multi_finished");
+	e_debug(event, "Lookup finished for %u keys: %d found",
+		keys_count, ret);
+}
+
 static void dict_transaction_finished(struct event *event, enum dict_commit_ret ret,
 				      bool rollback, const char *error)
 {
@@ -289,6 +311,23 @@ dict_lookup_callback(const struct dict_lookup_result *result,
 	i_free(ctx);
 }
 
+static void
+dict_lookup_multi_callback(const struct dict_lookup_multi_result *result,
+			   void *context)
+{
+	struct dict_lookup_multi_callback_ctx *ctx = context;
+
+	dict_pre_api_callback(ctx->dict);
+	ctx->callback(result, ctx->context);
+	dict_post_api_callback(ctx->dict);
+	dict_lookup_multi_finished(ctx->event, result->ret, ctx->keys_count,
+				   result->error);
+	event_unref(&ctx->event);
+
+	dict_unref(&ctx->dict);
+	i_free(ctx);
+}
+
 static void dict_transaction_rollback_run(struct dict_transaction_context *ctx)
 {
 	struct event *event = ctx->event;
@@ -410,6 +449,95 @@ void dict_lookup_async(struct dict *dict, const struct dict_op_settings *set,
 	dict->v.lookup_async(dict, set, key, dict_lookup_callback, lctx);
 }
 
+static int
+dict_lookup_multi_fallback(struct dict *dict,
+			   const struct dict_op_settings *set, pool_t pool,
+			   const char *const *keys, const char **values,
+			   const char **error_r)
+{
+	const char *const *key_values;
+	unsigned int i;
+	int ret, found = 0;
+
+	for (i = 0; keys[i] != NULL; i++) {
+		ret = dict->v.lookup(dict, set, pool, keys[i], &key_values,
+				     error_r);
+		if (ret < 0)
+			return -1;
+		if (ret > 0) {
+			values[i] = key_values[0];
+			found++;
+		}
+	}
+	return found;
+}
+
+int dict_lookup_multi(struct dict *dict, const struct dict_op_settings *set,
+		      pool_t pool, const char *const *keys,
+		      const char *const **values_r, const char **error_r)
+{
+	struct event *event = dict_event_create(dict, set);
+	unsigned int i, count = str_array_length(keys);
+	const char **values;
+	int ret;
+
+	i_assert(count > 0);
+	for (i = 0; i < count; i++)
+		i_assert(dict_key_prefix_is_valid(keys[i], set->username));
+
+	e_debug(event, "Looking up %u keys", count);
+	event_add_int(event, "keys", count);
+	values = p_new(pool, const char *, count + 1);
+	if (dict->v.lookup_multi != NULL) {
+		ret = dict->v.lookup_multi(dict, set, pool, keys, values,
+					   error_r);
+	} else {
+		ret = dict_lookup_multi_fallback(dict, set, pool, keys, values,
+						 error_r);
+	}
+	*values_r = values;
+	dict_lookup_multi_finished(event, ret, count, *error_r);
+	event_unref(&event);
+	return ret;
+}
+
+#undef dict_lookup_multi_async
+void dict_lookup_multi_async(struct dict *dict,
+			     const struct dict_op_settings *set,
+			     const char *const *keys,
+			     dict_lookup_multi_callback_t *callback,
+			     void *context)
+{
+	unsigned int i, count = str_array_length(keys);
+
+	i_assert(count > 0);
+	for (i = 0; i < count; i++)
+		i_assert(dict_key_prefix_is_valid(keys[i], set->username));
+	if (dict->v.lookup_multi_async == NULL) {
+		struct dict_lookup_multi_result result;
+
+		i_zero(&result);
+		/* event is going to be sent by dict_lookup_multi */
+		result.ret = dict_lookup_multi(dict, set,
+					       pool_datastack_create(), keys,
+					       &result.values, &result.error);
+		callback(&result, context);
+		return;
+	}
+	struct dict_lookup_multi_callback_ctx *lctx =
+		i_new(struct dict_lookup_multi_callback_ctx, 1);
+	lctx->dict = dict;
+	dict_ref(lctx->dict);
+	lctx->keys_count = count;
+	lctx->callback = callback;
+	lctx->context = context;
+	lctx->event = dict_event_create(dict, set);
+	event_add_int(lctx->event, "keys", count);
+	e_debug(lctx->event, "Looking up (async) %u keys", count);
+	dict->v.lookup_multi_async(dict, set, keys,
+				   dict_lookup_multi_callback, lctx);
+}
+
 struct dict_iterate_context *
 dict_iterate_init(struct dict *dict, const struct dict_op_settings *set,
 		  const char *path, enum dict_iterate_flags flags)
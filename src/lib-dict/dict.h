@@ -76,6 +76,18 @@ enum dict_commit_ret {
 	DICT_COMMIT_RET_WRITE_UNCERTAIN = -2,
 };
 
+struct dict_lookup_multi_result {
+	/* Number of found keys (ret >= 0) or -1 if lookup failed */
+	int ret;
+
+	/* values[i] is the first value of keys[i] or NULL if it wasn't
+	   found (ret >= 0) */
+	const char *const *values;
+
+	/* Error message for a failed lookup (ret < 0) */
+	const char *error;
+};
+
 struct dict_commit_result {
 	enum dict_commit_ret ret;
 	const char *error;
@@ -83,6 +95,9 @@ struct dict_commit_result {
 
 typedef void dict_lookup_callback_t(const struct dict_lookup_result *result,
 				    void *context);
+typedef void
+dict_lookup_multi_callback_t(const struct dict_lookup_multi_result *result,
+			     void *context);
 typedef void dict_iterate_callback_t(void *context);
 typedef void
 dict_transaction_commit_callback_t(const struct dict_commit_result *result,
@@ -136,6 +151,27 @@ void dict_lookup_async(struct dict *dict, const struct dict_op_settings *set,
 		1 ? (context) : \
 		CALLBACK_TYPECHECK(callback, \
 			void (*)(const struct dict_lookup_result *, typeof(context))))
+/* Lookup the first values for all the keys in the NULL-terminated keys
+   array. Drivers that support it do this with a single request to the
+   backend, others look up the keys one by one. values_r[i] is set to the
+   value of keys[i] or NULL if it's not found. Returns the number of found
+   keys, or -1 if lookup failed. */
+int dict_lookup_multi(struct dict *dict, const struct dict_op_settings *set,
+		      pool_t pool, const char *const *keys,
+		      const char *const **values_r, const char **error_r);
+/* Asynchronously lookup values for all the keys. The keys don't need to
+   stay valid after this call. */
+void dict_lookup_multi_async(struct dict *dict,
+			     const struct dict_op_settings *set,
+			     const char *const *keys,
+			     dict_lookup_multi_callback_t *callback,
+			     void *context);
+#define dict_lookup_multi_async(dict, set, keys, callback, context) \
+	dict_lookup_multi_async(dict, set, keys, \
+		(dict_lookup_multi_callback_t *)(callback), 1 ? (context) : \
+		CALLBACK_TYPECHECK(callback, \
+			void (*)(const struct dict_lookup_multi_result *, \
+				 typeof(context))))
 
 /* Iterate through all values in a path. flag indicates how iteration
    is carried out */
@@ -0,0 +1,206 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "write-full.h"
+#include "dict-private.h"
+#include "test-common.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define TEST_DICT_PATH ".test-dict-cache.dict"
+
+static const struct dict_settings test_dict_set = {
+	.base_dir = "",
+};
+static const struct dict_op_settings test_op_set = {
+	.username = "testuser",
+};
+
+static void test_dict_file_write(const char *contents)
+{
+	const char *temp_path = TEST_DICT_PATH".tmp";
+	int fd;
+
+	/* replace the file, so the file dict notices the change */
+	fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", temp_path);
+	if (write_full(fd, contents, strlen(contents)) < 0)
+		i_fatal("write(%s) failed: %m", temp_path);
+	i_close_fd(&fd);
+	if (rename(temp_path, TEST_DICT_PATH) < 0)
+		i_fatal("rename(%s) failed: %m", temp_path);
+}
+
+static const char *test_dict_lookup(struct dict *dict, const char *key)
+{
+	const char *value, *error;
+	int ret;
+
+	ret = dict_lookup(dict, &test_op_set, pool_datastack_create(), key,
+			  &value, &error);
+	test_assert(ret >= 0);
+	return ret > 0 ? value : NULL;
+}
+
+static struct dict *test_dict_cache_init(const char *options)
+{
+	struct dict *dict;
+	const char *error;
+
+	if (dict_init(t_strdup_printf("cache:%sfile:"TEST_DICT_PATH, options),
+		      &test_dict_set, &dict, &error) < 0)
+		i_fatal("dict_init() failed: %s", error);
+	return dict;
+}
+
+static void test_dict_cache_lookup(void)
+{
+	struct dict *dict;
+
+	test_begin("dict cache lookup");
+	test_dict_file_write("shared/foo\nbar\n");
+	dict = test_dict_cache_init("");
+
+	test_assert_strcmp(test_dict_lookup(dict, "shared/foo"), "bar");
+	test_assert(test_dict_lookup(dict, "shared/missing") == NULL);
+
+	/* changes done outside the cache dict aren't seen */
+	test_dict_file_write("shared/foo\nchanged\nshared/missing\nfound\n");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/foo"), "bar");
+	test_assert(test_dict_lookup(dict, "shared/missing") == NULL);
+	dict_deinit(&dict);
+
+	dict = test_dict_cache_init("");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/foo"), "changed");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/missing"), "found");
+	dict_deinit(&dict);
+	test_end();
+}
+
+static void test_dict_cache_invalidate(void)
+{
+	struct dict_transaction_context *trans;
+	struct dict *dict;
+	const char *error;
+
+	test_begin("dict cache invalidate");
+	test_dict_file_write("shared/foo\nbar\nshared/count\n1\n");
+	dict = test_dict_cache_init("");
+
+	test_assert_strcmp(test_dict_lookup(dict, "shared/foo"), "bar");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/count"), "1");
+
+	trans = dict_transaction_begin(dict, &test_op_set);
+	dict_set(trans, "shared/foo", "new");
+	dict_atomic_inc(trans, "shared/count", 2);
+	test_assert(dict_transaction_commit(&trans, &error) == 1);
+
+	test_assert_strcmp(test_dict_lookup(dict, "shared/foo"), "new");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/count"), "3");
+
+	/* rollback doesn't change anything */
+	trans = dict_transaction_begin(dict, &test_op_set);
+	dict_unset(trans, "shared/foo");
+	dict_transaction_rollback(&trans);
+	test_assert_strcmp(test_dict_lookup(dict, "shared/foo"), "new");
+
+	trans = dict_transaction_begin(dict, &test_op_set);
+	dict_unset(trans, "shared/foo");
+	test_assert(dict_transaction_commit(&trans, &error) == 1);
+	test_assert(test_dict_lookup(dict, "shared/foo") == NULL);
+	dict_deinit(&dict);
+	test_end();
+}
+
+static void test_dict_cache_lru(void)
+{
+	struct dict *dict;
+
+	test_begin("dict cache lru");
+	test_dict_file_write("shared/a\n1\nshared/b\n1\nshared/c\n1\n");
+	dict = test_dict_cache_init("max_entries=2:");
+
+	test_assert_strcmp(test_dict_lookup(dict, "shared/a"), "1");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/b"), "1");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/a"), "1");
+	/* drops b, which is the least recently used */
+	test_assert_strcmp(test_dict_lookup(dict, "shared/c"), "1");
+
+	test_dict_file_write("shared/a\n2\nshared/b\n2\nshared/c\n2\n");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/a"), "1");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/c"), "1");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/b"), "2");
+	dict_deinit(&dict);
+	test_end();
+}
+
+static void test_dict_cache_ttl(void)
+{
+	struct dict *dict;
+
+	test_begin("dict cache ttl");
+	test_dict_file_write("shared/cached/a\n1\nshared/uncached/a\n1\n"
+			     "shared/uncached/cached/a\n1\n");
+	dict = test_dict_cache_init("ttl/shared/uncached/=0:"
+				    "ttl/shared/uncached/cached/=1h:");
+
+	test_assert_strcmp(test_dict_lookup(dict, "shared/cached/a"), "1");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/uncached/a"), "1");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/uncached/cached/a"),
+			   "1");
+
+	test_dict_file_write("shared/cached/a\n2\nshared/uncached/a\n2\n"
+			     "shared/uncached/cached/a\n2\n");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/cached/a"), "1");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/uncached/a"), "2");
+	test_assert_strcmp(test_dict_lookup(dict, "shared/uncached/cached/a"),
+			   "1");
+	dict_deinit(&dict);
+	test_end();
+}
+
+static void test_dict_cache_init_errors(void)
+{
+	static const char *const uris[] = {
+		"cache:",
+		"cache:ttl=5s:",
+		"cache:max_entries=0:file:"TEST_DICT_PATH,
+		"cache:ttl=foo:file:"TEST_DICT_PATH,
+		"cache:ttl/=5s:file:"TEST_DICT_PATH,
+		"cache:foo=bar:file:"TEST_DICT_PATH,
+		"cache:nonexistent:foo",
+	};
+	struct dict *dict;
+	const char *error;
+
+	test_begin("dict cache init errors");
+	for (unsigned int i = 0; i < N_ELEMENTS(uris); i++) {
+		test_assert_idx(dict_init(uris[i], &test_dict_set,
+					  &dict, &error) < 0, i);
+	}
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_dict_cache_lookup,
+		test_dict_cache_invalidate,
+		test_dict_cache_lru,
+		test_dict_cache_ttl,
+		test_dict_cache_init_errors,
+		NULL
+	};
+	int ret;
+
+	dict_driver_register(&dict_driver_file);
+	dict_driver_register(&dict_driver_cache);
+	ret = test_run(test_functions);
+	dict_driver_unregister(&dict_driver_cache);
+	dict_driver_unregister(&dict_driver_file);
+	i_unlink_if_exists(TEST_DICT_PATH);
+	return ret;
+}
@@ -53,34 +53,43 @@ struct dns_client_cache_entry {
 	struct priorityq_item item;
 	time_t expires;
 	unsigned int ips_count;
+	/* non-zero for a cached lookup failure */
+	int ret;
 	bool refresh:1;
 	bool refreshing:1;
 
 	char *cache_key;
 	char *name;
+	char *error;
 	struct ip_addr *ips;
 };
 
+/* The cache is shared by all the DNS clients in the process that have
+   caching enabled, and it's kept until the process exits. */
+struct dns_client_cache {
+	HASH_TABLE(char *, struct dns_client_cache_entry *) table;
+	struct priorityq *queue;
+	struct dns_client_cache_stats stats;
+};
+
 struct dns_client {
 	struct connection conn;
 	struct connection_list *clist;
 	struct dns_lookup *head, *tail;
 	struct timeout *to_idle;
 	struct ioloop *ioloop;
-	struct timeout *to_cache_clean;
 	char *path;
-	HASH_TABLE(char *, struct dns_client_cache_entry *) cache_table;
-	struct priorityq *cache_queue;
 
 	unsigned int timeout_msecs;
 	unsigned int idle_timeout_msecs;
 	unsigned int cache_ttl_secs;
+	unsigned int cache_negative_ttl_secs;
 
 	bool connected:1;
 	bool deinit_client_at_free:1;
 };
 
-static void dns_client_cache_clean(struct dns_client *client);
+static struct dns_client_cache *dns_cache = NULL;
 
 /* cache code */
 static int dns_client_cache_entry_cmp(const void *p1, const void *p2)
@@ -96,46 +105,83 @@ static void dns_client_cache_entry_free(struct dns_client_cache_entry **_entry)
 	*_entry = NULL;
 	i_free(entry->ips);
 	i_free(entry->name);
+	i_free(entry->error);
 	i_free(entry->cache_key);
 	i_free(entry);
 }
 
+static void dns_client_cache_remove(struct dns_client_cache_entry *entry)
+{
+	priorityq_remove(dns_cache->queue, &entry->item);
+	hash_table_remove(dns_cache->table, entry->cache_key);
+	dns_client_cache_entry_free(&entry);
+}
+
+static void dns_client_cache_clean(void)
+{
+	while (priorityq_count(dns_cache->queue) > 0) {
+		struct priorityq_item *item = priorityq_peek(dns_cache->queue);
+		struct dns_client_cache_entry *entry =
+			container_of(item, struct dns_client_cache_entry, item);
+		if (entry->expires > ioloop_time) {
+			/* no more entries that need attention */
+			break;
+		}
+		/* drop item */
+		(void)priorityq_pop(dns_cache->queue);
+		hash_table_remove(dns_cache->table, entry->cache_key);
+		dns_client_cache_entry_free(&entry);
+	}
+}
+
+static bool dns_client_cache_failure_is_permanent(int ret)
+{
+	/* Only cache answers saying that the name doesn't exist. Timeouts
+	   and temporary resolver failures are always retried. */
+	return ret == EAI_NONAME;
+}
+
 static void dns_client_cache_entry(struct dns_client *client,
 				   const struct dns_lookup *lookup)
 {
+	unsigned int ttl_secs = client->cache_ttl_secs;
+
 	if (client->cache_ttl_secs == 0)
 		return;
 
-	/* start cache cleanup since put something there */
-	if (client->to_cache_clean == NULL)
-		client->to_cache_clean =
-			timeout_add((client->cache_ttl_secs/2)*1000,
-				     dns_client_cache_clean, client);
+	/* expired entries are dropped while adding new ones */
+	dns_client_cache_clean();
 
 	struct dns_client_cache_entry *entry =
-		hash_table_lookup(client->cache_table, lookup->cache_key);
-	if (lookup->result.ret < 0) {
-		if (entry != NULL)
+		hash_table_lookup(dns_cache->table, lookup->cache_key);
+	if (lookup->result.ret != 0) {
+		if (entry != NULL) {
+			/* keep using the old entry until it expires */
 			entry->refreshing = FALSE;
-		return;
+			return;
+		}
+		if (client->cache_negative_ttl_secs == 0 ||
+		    !dns_client_cache_failure_is_permanent(lookup->result.ret))
+			return;
+		ttl_secs = client->cache_negative_ttl_secs;
 	}
 	if (entry != NULL) {
 		/* remove entry */
-		priorityq_remove(client->cache_queue, &entry->item);
-		hash_table_remove(client->cache_table, entry->cache_key);
-		dns_client_cache_entry_free(&entry);
+		dns_client_cache_remove(entry);
 	}
 	entry = i_new(struct dns_client_cache_entry, 1);
-	entry->expires = ioloop_time + client->cache_ttl_secs;
+	entry->expires = ioloop_time + ttl_secs;
 	entry->cache_key = i_strdup(lookup->cache_key);
+	entry->ret = lookup->result.ret;
+	entry->error = i_strdup(lookup->result.error);
 	entry->name = i_strdup(lookup->result.name);
 	entry->ips_count = lookup->result.ips_count;
 	if (lookup->result.ips_count > 0) {
 		entry->ips = i_memdup(lookup->result.ips,
 				      sizeof(struct ip_addr) * lookup->result.ips_count);
 	}
-	priorityq_add(client->cache_queue, &entry->item);
-	hash_table_insert(client->cache_table, entry->cache_key, entry);
+	priorityq_add(dns_cache->queue, &entry->item);
+	hash_table_insert(dns_cache->table, entry->cache_key, entry);
 }
 
 static void dns_cache_lookup_free(struct dns_cache_lookup **_ctx)
@@ -212,18 +258,28 @@ static bool dns_client_cache_lookup(struct dns_client *client,
 	if (client->cache_ttl_secs == 0)
 		return FALSE;
 	struct dns_client_cache_entry *entry =
-		hash_table_lookup(client->cache_table, lookup->cache_key);
-	if (entry == NULL)
+		hash_table_lookup(dns_cache->table, lookup->cache_key);
+	if (entry == NULL) {
+		dns_cache->stats.misses++;
 		return FALSE;
+	}
 	if (entry->expires <= ioloop_time) {
-		priorityq_remove(client->cache_queue, &entry->item);
-		hash_table_remove(client->cache_table, entry->cache_key);
-		dns_client_cache_entry_free(&entry);
+		dns_client_cache_remove(entry);
+		dns_cache->stats.misses++;
 		return FALSE;
 	}
-	if (entry->refresh)
+	if (entry->refresh) {
+		dns_cache->stats.misses++;
 		return FALSE;
-	lookup->result.ret = 0;
+	}
+	lookup->cached = TRUE;
+	lookup->result.ret = entry->ret;
+	if (entry->ret != 0) {
+		dns_cache->stats.negative_hits++;
+		lookup->result.error = p_strdup(lookup->pool, entry->error);
+		return TRUE;
+	}
+	dns_cache->stats.hits++;
 	lookup->result.name = p_strdup(lookup->pool, entry->name);
 	lookup->result.ips_count = entry->ips_count;
 	if (entry->ips_count > 0) {
@@ -231,55 +287,50 @@ static bool dns_client_cache_lookup(struct dns_client *client,
 			p_memdup(lookup->pool, entry->ips,
 				 sizeof(struct ip_addr) * entry->ips_count);
 	}
-	lookup->cached = TRUE;
-	if (!entry->refreshing &&
+	/* One-shot clients are freed along with the lookup, so they can't
+	   do a background refresh. */
+	if (!entry->refreshing && !client->deinit_client_at_free &&
 	    entry->expires <= ioloop_time + client->cache_ttl_secs / 2)
 		dns_client_cache_entry_refresh(client, entry);
 	return TRUE;
 }
 
-static void dns_client_cache_clean(struct dns_client *client)
+static void dns_client_cache_free(void)
 {
-	while (priorityq_count(client->cache_queue) > 0) {
-		struct priorityq_item *item = priorityq_peek(client->cache_queue);
+	while (priorityq_count(dns_cache->queue) > 0) {
+		struct priorityq_item *item = priorityq_pop(dns_cache->queue);
 		struct dns_client_cache_entry *entry =
 			container_of(item, struct dns_client_cache_entry, item);
-		if (entry->expires <= ioloop_time) {
-			/* drop item */
-			(void)priorityq_pop(client->cache_queue);
-			hash_table_remove(client->cache_table, entry->cache_key);
-			dns_client_cache_entry_free(&entry);
-		} else {
-			/* no more entries that need attention */
-			break;
-		}
+		hash_table_remove(dns_cache->table, entry->cache_key);
+		dns_client_cache_entry_free(&entry);
 	}
-
-	/* stop cleaning cache if it becomes empty */
-	if (priorityq_count(client->cache_queue) == 0)
-		timeout_remove(&client->to_cache_clean);
+	hash_table_destroy(&dns_cache->table);
+	priorityq_deinit(&dns_cache->queue);
+	i_free(dns_cache);
 }
 
-static void dns_client_cache_init(struct dns_client *client, unsigned int ttl_secs)
+static void
+dns_client_cache_init(struct dns_client *client,
+		      const struct dns_lookup_settings *set)
 {
-	client->cache_ttl_secs = ttl_secs;
-	hash_table_create(&client->cache_table, default_pool, 0, strfastcase_hash,
+	client->cache_ttl_secs = set->cache_ttl_secs;
+	client->cache_negative_ttl_secs = set->cache_negative_ttl_secs;
+	if (dns_cache != NULL)
+		return;
+
+	dns_cache = i_new(struct dns_client_cache, 1);
+	hash_table_create(&dns_cache->table, default_pool, 0, strfastcase_hash,
 			  strcmp);
-	client->cache_queue = priorityq_init(dns_client_cache_entry_cmp, 0);
+	dns_cache->queue = priorityq_init(dns_client_cache_entry_cmp, 0);
+	lib_atexit(dns_client_cache_free);
 }
 
-static void dns_client_cache_deinit(struct dns_client *client)
+void dns_client_cache_get_stats(struct dns_client_cache_stats *stats_r)
 {
-	while (priorityq_count(client->cache_queue) > 0) {
-		struct priorityq_item *item = priorityq_pop(client->cache_queue);
-		struct dns_client_cache_entry *entry =
-			container_of(item, struct dns_client_cache_entry, item);
-		hash_table_remove(client->cache_table, entry->cache_key);
-		dns_client_cache_entry_free(&entry);
-	}
-	timeout_remove(&client->to_cache_clean);
-	hash_table_destroy(&client->cache_table);
-	priorityq_deinit(&client->cache_queue);
+	if (dns_cache == NULL)
+		i_zero(stats_r);
+	else
+		*stats_r = dns_cache->stats;
 }
 
 #undef dns_lookup
@@ -437,7 +488,6 @@ int dns_lookup(const char *host, const struct dns_lookup_settings *set,
 {
 	struct dns_client *client;
 
-	i_assert(set->cache_ttl_secs == 0);
 	client = dns_client_init(set);
 	client->deinit_client_at_free = TRUE;
 	return dns_client_lookup(client, host, client->conn.event, callback,
@@ -451,7 +501,6 @@ int dns_lookup_ptr(const struct ip_addr *ip,
 {
 	struct dns_client *client;
 
-	i_assert(set->cache_ttl_secs == 0);
 	client = dns_client_init(set);
 	client->deinit_client_at_free = TRUE;
 	return dns_client_lookup_ptr(client, ip, client->conn.event,
@@ -544,7 +593,7 @@ struct dns_client *dns_client_init(const struct dns_lookup_settings *set)
 	client->path = i_strdup(set->dns_client_socket_path);
 	client->conn.event_parent=set->event_parent;
 	if (set->cache_ttl_secs > 0)
-		dns_client_cache_init(client, set->cache_ttl_secs);
+		dns_client_cache_init(client, set);
 	connection_init_client_unix(client->clist, &client->conn, client->path);
 	event_add_category(client->conn.event, &event_category_dns);
 	return client;
@@ -562,9 +611,6 @@ void dns_client_deinit(struct dns_client **_client)
 	i_assert(client->head == NULL);
 	connection_list_deinit(&clist);
 
-	if (client->cache_ttl_secs > 0)
-		dns_client_cache_deinit(client);
-
 	i_free(client->path);
 	i_free(client);
 }
@@ -644,6 +690,7 @@ dns_client_lookup_common(struct dns_client *client,
 	if (dns_client_cache_lookup(client, lookup)) {
 		lookup->to = timeout_add_short(0, dns_lookup_callback_cached,
 					       lookup);
+		*lookup_r = lookup;
 		return 0;
 	}
 
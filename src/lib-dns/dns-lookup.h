@@ -11,15 +11,30 @@ struct dns_lookup_settings {
 	/* the idle_timeout_msecs works only with the dns_client_* API.
 	   0 = disconnect immediately */
 	unsigned int idle_timeout_msecs;
-	/* Non-zero enables caching for the client, is not supported with
-	   dns_lookup() or dns_lookup_ptr(). Note that DNS TTL is ignored. */
+	/* Non-zero enables caching for the client. The cache is shared by all
+	   the clients in the process that have caching enabled. Note that DNS
+	   TTL is ignored, since the dns-client service doesn't return it.
+	   With dns_lookup() and dns_lookup_ptr() the entries aren't refreshed
+	   in the background, they simply expire. */
 	unsigned int cache_ttl_secs;
+	/* Non-zero enables caching the lookups that failed because the name
+	   doesn't exist for this long. Requires cache_ttl_secs. */
+	unsigned int cache_negative_ttl_secs;
 
 	/* ioloop to run the lookup on (defaults to current_ioloop) */
 	struct ioloop *ioloop;
 	struct event *event_parent;
 };
 
+struct dns_client_cache_stats {
+	/* Lookups answered from the cache with a successful result */
+	uint64_t hits;
+	/* Lookups answered from the cache with a cached failure */
+	uint64_t negative_hits;
+	/* Lookups that had to be sent to the dns-client service */
+	uint64_t misses;
+};
+
 struct dns_lookup_result {
 	/* all is ok if ret=0, otherwise it contains net_gethosterror()
 	   compatible error code. error string is always set if ret != 0. */
@@ -90,6 +105,9 @@ int dns_client_lookup_ptr(struct dns_client *client, const struct ip_addr *ip,
 			const struct dns_lookup_result *, typeof(context))), \
 		event, (dns_lookup_callback_t *)callback, context, lookup_r)
 
+/* Get the process-wide DNS cache statistics. */
+void dns_client_cache_get_stats(struct dns_client_cache_stats *stats_r);
+
 /* Returns true if the DNS client has any pending queries */
 bool dns_client_has_pending_queries(struct dns_client *client);
 
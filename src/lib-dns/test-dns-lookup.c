@@ -22,6 +22,7 @@ static const struct {
 	{ "localhost", "0\t127.0.0.1\t::1\n" },
 	{ "127.0.0.1", "0\tlocalhost\n" },
 	{ "once-host", "0\t127.0.0.2\n" },
+	{ "shared-host", "0\t127.0.0.3\n" },
 };
 
 static struct test_server {
@@ -73,6 +74,11 @@ test_dns_client_input_args(struct connection *client, const char *const *args)
 		}
 		test_server.once_host_seen = TRUE;
 	}
+	if (strcmp(args[1], "nonexistent-host") == 0) {
+		o_stream_nsend_str(client->output, t_strdup_printf(
+			"%d\tName does not exist\n", EAI_NONAME));
+		return 1;
+	}
 	for (size_t i = 0; i < N_ELEMENTS(replies); i++) {
 		if (strcmp(args[1], replies[i].name) == 0) {
 			o_stream_nsend_str(client->output, replies[i].reply);
@@ -383,6 +389,72 @@ static void test_dns_lookup_cached(void)
 	test_end();
 }
 
+static void test_dns_lookup_cache_shared(void)
+{
+	struct test_expect_result ctx;
+	struct dns_client_cache_stats stats1, stats2;
+	struct dns_lookup *lookup;
+
+	test_begin("dns lookup (shared cache)");
+	create_dns_server(&test_server);
+	const struct dns_lookup_settings set = {
+		.dns_client_socket_path = TEST_SOCKET_NAME,
+		.ioloop = test_server.loop,
+		.timeout_msecs = 1000,
+		.cache_ttl_secs = 10,
+		.cache_negative_ttl_secs = 10,
+	};
+	struct dns_client *client1 = dns_client_init(&set);
+	struct dns_client *client2 = dns_client_init(&set);
+
+	dns_client_cache_get_stats(&stats1);
+	ctx.result = "127.0.0.3";
+	ctx.ret = 0;
+
+	/* the entry looked up by one client is used by the others */
+	test_assert(dns_client_lookup(client1, "shared-host", NULL,
+				      test_callback_ips, &ctx, &lookup) == 0);
+	io_loop_run(current_ioloop);
+	test_assert(dns_client_lookup(client2, "shared-host", NULL,
+				      test_callback_ips, &ctx, &lookup) == 0);
+	io_loop_run(current_ioloop);
+	test_assert(dns_lookup("shared-host", &set,
+			       test_callback_ips, &ctx, &lookup) == 0);
+	io_loop_run(current_ioloop);
+	test_assert_cmp(test_server.lookup_counter, ==, 1);
+
+	/* nonexistent names are cached as well */
+	ctx.result = NULL;
+	ctx.ret = EAI_NONAME;
+	test_assert(dns_client_lookup(client1, "nonexistent-host", NULL,
+				      test_callback_ips, &ctx, &lookup) == 0);
+	io_loop_run(current_ioloop);
+	test_assert(dns_client_lookup(client2, "nonexistent-host", NULL,
+				      test_callback_ips, &ctx, &lookup) == 0);
+	io_loop_run(current_ioloop);
+	test_assert_cmp(test_server.lookup_counter, ==, 2);
+
+	/* but other failures aren't */
+	ctx.ret = -1;
+	test_assert(dns_client_lookup(client1, "failhost", NULL,
+				      test_callback_ips, &ctx, &lookup) == 0);
+	io_loop_run(current_ioloop);
+	test_assert(dns_client_lookup(client2, "failhost", NULL,
+				      test_callback_ips, &ctx, &lookup) == 0);
+	io_loop_run(current_ioloop);
+	test_assert_cmp(test_server.lookup_counter, ==, 4);
+
+	dns_client_cache_get_stats(&stats2);
+	test_assert_cmp(stats2.hits - stats1.hits, ==, 2);
+	test_assert_cmp(stats2.negative_hits - stats1.negative_hits, ==, 1);
+	test_assert_cmp(stats2.misses - stats1.misses, ==, 4);
+
+	dns_client_deinit(&client1);
+	dns_client_deinit(&client2);
+	destroy_dns_server(&test_server);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -390,6 +462,7 @@ int main(void)
 		test_dns_lookup_timeout,
 		test_dns_lookup_abort,
 		test_dns_lookup_cached,
+		test_dns_lookup_cache_shared,
 		NULL
 	};
 
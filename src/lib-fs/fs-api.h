@@ -187,6 +187,11 @@ struct fs_stats {
 	unsigned int rename_count;
 	/* Number of fs_iter_init() calls. */
 	unsigned int iter_count;
+	/* Number of fs_read*() calls that were served from a local cache
+	   (the "cache" fs wrapper), and the ones that had to go to the
+	   parent fs. */
+	unsigned int cache_hit_count;
+	unsigned int cache_miss_count;
 
 	/* Number of bytes written by fs_write*() calls. */
 	uint64_t write_bytes;
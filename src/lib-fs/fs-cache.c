@@ -0,0 +1,762 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "llist.h"
+#include "hash.h"
+#include "sha1.h"
+#include "hex-binary.h"
+#include "str.h"
+#include "str-parse.h"
+#include "write-full.h"
+#include "mkdir-parents.h"
+#include "safe-mkstemp.h"
+#include "istream-private.h"
+#include "ostream.h"
+#include "fs-api-private.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* Objects read from or written to the parent fs are copied to a local cache
+   directory, and later reads are served from there. The cache is meant for
+   backends where objects are never modified in place, such as object
+   storages. Changes done via this fs invalidate the cached copies.
+
+   The total size is tracked in an in-memory LRU list, which only knows
+   about the objects this process has written or read. Cache files created
+   by other processes are used when they exist, and they're added to the
+   list once they've been read. When the cache is full, TinyLFU is used to
+   decide whether a new object is worth caching: it's admitted only if it
+   has been accessed more often than the object that would be evicted. */
+
+#define FS_CACHE_DEFAULT_MAX_SIZE (1024ULL*1024*1024)
+#define FS_CACHE_TEMP_PREFIX ".temp.fs-cache."
+
+/* Access frequencies are estimated with a count-min sketch. All the counters
+   are halved after FS_CACHE_SKETCH_RESET_ADDITIONS accesses, so old accesses
+   gradually lose their weight. */
+#define FS_CACHE_SKETCH_DEPTH 4
+#define FS_CACHE_SKETCH_WIDTH 4096
+#define FS_CACHE_SKETCH_RESET_ADDITIONS (FS_CACHE_SKETCH_WIDTH*10)
+
+struct cache_fs_entry {
+	struct cache_fs_entry *prev, *next;
+
+	char *key;
+	unsigned char digest[SHA1_RESULTLEN];
+	uoff_t size;
+};
+
+struct cache_fs {
+	struct fs fs;
+
+	char *dir;
+	uoff_t max_size, cur_size;
+
+	HASH_TABLE(char *, struct cache_fs_entry *) entries;
+	/* head is the least recently used entry */
+	struct cache_fs_entry *lru_head, *lru_tail;
+
+	uint8_t sketch[FS_CACHE_SKETCH_DEPTH][FS_CACHE_SKETCH_WIDTH];
+	unsigned int sketch_additions;
+};
+
+struct cache_fs_file {
+	struct fs_file file;
+	struct cache_fs *fs;
+
+	unsigned char digest[SHA1_RESULTLEN];
+	char *cache_path;
+
+	/* write_stream() first writes to a temporary file in the cache
+	   directory, which is then copied to the parent fs */
+	struct ostream *super_output;
+	char *temp_path;
+	int temp_fd;
+	bool writing_parent;
+};
+
+struct cache_fs_istream {
+	struct istream_private istream;
+	struct cache_fs *fs;
+
+	unsigned char digest[SHA1_RESULTLEN];
+	char *temp_path;
+	struct ostream *output;
+};
+
+#define CACHE_FS(ptr)	container_of((ptr), struct cache_fs, fs)
+#define CACHE_FILE(ptr)	container_of((ptr), struct cache_fs_file, file)
+
+static void cache_fs_sketch_add(struct cache_fs *fs,
+				const unsigned char digest[SHA1_RESULTLEN])
+{
+	unsigned int i, j, idx;
+
+	for (i = 0; i < FS_CACHE_SKETCH_DEPTH; i++) {
+		idx = be32_to_cpu_unaligned(digest + i*4) %
+			FS_CACHE_SKETCH_WIDTH;
+		if (fs->sketch[i][idx] < UINT8_MAX)
+			fs->sketch[i][idx]++;
+	}
+	if (++fs->sketch_additions < FS_CACHE_SKETCH_RESET_ADDITIONS)
+		return;
+
+	for (i = 0; i < FS_CACHE_SKETCH_DEPTH; i++) {
+		for (j = 0; j < FS_CACHE_SKETCH_WIDTH; j++)
+			fs->sketch[i][j] /= 2;
+	}
+	fs->sketch_additions /= 2;
+}
+
+static unsigned int
+cache_fs_sketch_get(struct cache_fs *fs,
+		    const unsigned char digest[SHA1_RESULTLEN])
+{
+	unsigned int i, idx, count, min_count = UINT8_MAX;
+
+	for (i = 0; i < FS_CACHE_SKETCH_DEPTH; i++) {
+		idx = be32_to_cpu_unaligned(digest + i*4) %
+			FS_CACHE_SKETCH_WIDTH;
+		count = fs->sketch[i][idx];
+		if (min_count > count)
+			min_count = count;
+	}
+	return min_count;
+}
+
+static bool cache_fs_admit(struct cache_fs *fs,
+			   const unsigned char digest[SHA1_RESULTLEN],
+			   uoff_t size)
+{
+	if (fs->cur_size + size <= fs->max_size || fs->lru_head == NULL)
+		return TRUE;
+	return cache_fs_sketch_get(fs, digest) >
+		cache_fs_sketch_get(fs, fs->lru_head->digest);
+}
+
+static const char *
+cache_fs_get_cache_path(struct cache_fs *fs,
+			const unsigned char digest[SHA1_RESULTLEN])
+{
+	const char *key = binary_to_hex(digest, SHA1_RESULTLEN);
+
+	return t_strdup_printf("%s/%c%c/%s", fs->dir, key[0], key[1], key + 2);
+}
+
+static struct cache_fs_entry *
+cache_fs_entry_lookup(struct cache_fs *fs,
+		      const unsigned char digest[SHA1_RESULTLEN])
+{
+	return hash_table_lookup(fs->entries,
+				 binary_to_hex(digest, SHA1_RESULTLEN));
+}
+
+static void
+cache_fs_entry_remove(struct cache_fs *fs, struct cache_fs_entry *entry)
+{
+	i_assert(fs->cur_size >= entry->size);
+
+	hash_table_remove(fs->entries, entry->key);
+	DLLIST2_REMOVE(&fs->lru_head, &fs->lru_tail, entry);
+	fs->cur_size -= entry->size;
+	i_free(entry->key);
+	i_free(entry);
+}
+
+static void cache_fs_evict(struct cache_fs *fs)
+{
+	struct cache_fs_entry *entry;
+
+	while (fs->cur_size > fs->max_size && fs->lru_head != fs->lru_tail) {
+		entry = fs->lru_head;
+		i_unlink_if_exists(cache_fs_get_cache_path(fs, entry->digest));
+		cache_fs_entry_remove(fs, entry);
+	}
+}
+
+static void
+cache_fs_entry_update(struct cache_fs *fs,
+		      const unsigned char digest[SHA1_RESULTLEN], uoff_t size)
+{
+	struct cache_fs_entry *entry;
+
+	entry = cache_fs_entry_lookup(fs, digest);
+	if (entry == NULL) {
+		entry = i_new(struct cache_fs_entry, 1);
+		entry->key = i_strdup(binary_to_hex(digest, SHA1_RESULTLEN));
+		memcpy(entry->digest, digest, SHA1_RESULTLEN);
+		hash_table_insert(fs->entries, entry->key, entry);
+	} else {
+		DLLIST2_REMOVE(&fs->lru_head, &fs->lru_tail, entry);
+		fs->cur_size -= entry->size;
+	}
+	DLLIST2_APPEND(&fs->lru_head, &fs->lru_tail, entry);
+	entry->size = size;
+	fs->cur_size += size;
+	cache_fs_evict(fs);
+}
+
+static void
+cache_fs_invalidate(struct cache_fs *fs,
+		    const unsigned char digest[SHA1_RESULTLEN])
+{
+	struct cache_fs_entry *entry;
+
+	entry = cache_fs_entry_lookup(fs, digest);
+	if (entry != NULL)
+		cache_fs_entry_remove(fs, entry);
+	/* the file may have been created by another process */
+	i_unlink_if_exists(cache_fs_get_cache_path(fs, digest));
+}
+
+static int
+cache_fs_temp_create(struct cache_fs *fs, struct event *event,
+		     const unsigned char digest[SHA1_RESULTLEN],
+		     const char **temp_path_r)
+{
+	const char *key = binary_to_hex(digest, SHA1_RESULTLEN);
+	const char *dir = t_strdup_printf("%s/%c%c", fs->dir, key[0], key[1]);
+	string_t *path = t_str_new(256);
+	int fd;
+
+	str_printfa(path, "%s/"FS_CACHE_TEMP_PREFIX, dir);
+	fd = safe_mkstemp_hostpid(path, 0600, (uid_t)-1, (gid_t)-1);
+	if (fd == -1 && errno == ENOENT) {
+		if (mkdir_parents(dir, 0700) < 0 && errno != EEXIST) {
+			e_error(event, "fs-cache: mkdir_parents(%s) failed: %m",
+				dir);
+			return -1;
+		}
+		str_truncate(path, 0);
+		str_printfa(path, "%s/"FS_CACHE_TEMP_PREFIX, dir);
+		fd = safe_mkstemp_hostpid(path, 0600, (uid_t)-1, (gid_t)-1);
+	}
+	if (fd == -1) {
+		e_error(event, "fs-cache: safe_mkstemp(%s) failed: %m",
+			str_c(path));
+		return -1;
+	}
+	*temp_path_r = str_c(path);
+	return fd;
+}
+
+/* Move the fully written temporary file into the cache. The temporary file
+   is deleted if the object isn't admitted to the cache. Written objects are
+   always admitted, since they're likely to be read soon. */
+static void
+cache_fs_temp_commit(struct cache_fs *fs, struct event *event,
+		     const unsigned char digest[SHA1_RESULTLEN],
+		     const char *temp_path, uoff_t size, bool written)
+{
+	const char *cache_path;
+
+	if (size > fs->max_size ||
+	    (!written && cache_fs_entry_lookup(fs, digest) == NULL &&
+	     !cache_fs_admit(fs, digest, size))) {
+		i_unlink(temp_path);
+		return;
+	}
+	cache_path = cache_fs_get_cache_path(fs, digest);
+	if (rename(temp_path, cache_path) < 0) {
+		e_error(event, "fs-cache: rename(%s, %s) failed: %m",
+			temp_path, cache_path);
+		i_unlink(temp_path);
+		return;
+	}
+	cache_fs_entry_update(fs, digest, size);
+}
+
+static void cache_fs_istream_abort(struct cache_fs_istream *cstream)
+{
+	o_stream_destroy(&cstream->output);
+	i_unlink(cstream->temp_path);
+}
+
+static void cache_fs_istream_finish(struct cache_fs_istream *cstream)
+{
+	struct istream *istream = &cstream->istream.istream;
+
+	if (o_stream_finish(cstream->output) < 0) {
+		e_error(cstream->fs->fs.event, "fs-cache: write(%s) failed: %s",
+			o_stream_get_name(cstream->output),
+			o_stream_get_error(cstream->output));
+		cache_fs_istream_abort(cstream);
+		return;
+	}
+	if (cstream->output->offset != istream->v_offset +
+	    (cstream->istream.pos - cstream->istream.skip)) {
+		/* seeked forward to EOF - some of the data is missing */
+		cache_fs_istream_abort(cstream);
+		return;
+	}
+	T_BEGIN {
+		cache_fs_temp_commit(cstream->fs, cstream->fs->fs.event,
+				     cstream->digest, cstream->temp_path,
+				     cstream->output->offset, FALSE);
+	} T_END;
+	o_stream_destroy(&cstream->output);
+}
+
+static ssize_t i_stream_cache_fs_read(struct istream_private *stream)
+{
+	struct cache_fs_istream *cstream =
+		container_of(stream, struct cache_fs_istream, istream);
+	uoff_t start;
+	ssize_t ret;
+
+	i_stream_seek(stream->parent, stream->parent_start_offset +
+		      stream->istream.v_offset);
+
+	ret = i_stream_read_copy_from_parent(&stream->istream);
+	if (cstream->output == NULL)
+		return ret;
+
+	if (ret > 0) {
+		/* the buffer begins at v_offset. copy the parts that haven't
+		   been written to the cache yet. */
+		if (stream->istream.v_offset > cstream->output->offset) {
+			/* seeked forward - the object can't be cached */
+			cache_fs_istream_abort(cstream);
+			return ret;
+		}
+		start = cstream->output->offset - stream->istream.v_offset;
+		if (start < stream->pos) {
+			o_stream_nsend(cstream->output, stream->buffer + start,
+				       stream->pos - start);
+		}
+	} else if (ret == -1) {
+		if (stream->istream.stream_errno == 0)
+			cache_fs_istream_finish(cstream);
+		else
+			cache_fs_istream_abort(cstream);
+	}
+	return ret;
+}
+
+static void i_stream_cache_fs_destroy(struct iostream_private *stream)
+{
+	struct cache_fs_istream *cstream =
+		container_of(stream, struct cache_fs_istream, istream.iostream);
+
+	/* the stream wasn't read until EOF */
+	if (cstream->output != NULL)
+		cache_fs_istream_abort(cstream);
+	i_stream_free_buffer(&cstream->istream);
+	i_free(cstream->temp_path);
+}
+
+static struct istream *
+i_stream_create_cache_fs(struct istream *input, struct cache_fs_file *file,
+			 int *temp_fd, const char *temp_path)
+{
+	struct cache_fs_istream *cstream;
+
+	cstream = i_new(struct cache_fs_istream, 1);
+	cstream->fs = file->fs;
+	memcpy(cstream->digest, file->digest, SHA1_RESULTLEN);
+	cstream->temp_path = i_strdup(temp_path);
+	cstream->output = o_stream_create_fd_autoclose(temp_fd, 0);
+	o_stream_set_name(cstream->output, temp_path);
+	o_stream_cork(cstream->output);
+
+	cstream->istream.max_buffer_size = input->real_stream->max_buffer_size;
+	cstream->istream.stream_size_passthrough = TRUE;
+	cstream->istream.read = i_stream_cache_fs_read;
+	cstream->istream.iostream.destroy = i_stream_cache_fs_destroy;
+	cstream->istream.istream.blocking = input->blocking;
+	cstream->istream.istream.seekable = input->seekable;
+	return i_stream_create(&cstream->istream, input,
+			       i_stream_get_fd(input), 0);
+}
+
+static struct fs *fs_cache_alloc(void)
+{
+	struct cache_fs *fs;
+
+	fs = i_new(struct cache_fs, 1);
+	fs->fs = fs_class_cache;
+	hash_table_create(&fs->entries, default_pool, 0, str_hash, strcmp);
+	return &fs->fs;
+}
+
+static int
+fs_cache_parse_params(struct cache_fs *fs, const char *params,
+		      const char **error_r)
+{
+	const char *const *tmp;
+
+	fs->max_size = FS_CACHE_DEFAULT_MAX_SIZE;
+	for (tmp = t_strsplit_spaces(params, ","); *tmp != NULL; tmp++) {
+		const char *key = *tmp;
+		const char *value = strchr(key, '=');
+
+		if (value == NULL) {
+			*error_r = "Missing '='";
+			return -1;
+		}
+		key = t_strdup_until(key, value++);
+		if (strcmp(key, "dir") == 0) {
+			i_free(fs->dir);
+			fs->dir = i_strdup(value);
+		} else if (strcmp(key, "size") == 0) {
+			if (str_parse_get_size(value, &fs->max_size,
+					       error_r) < 0)
+				return -1;
+			if (fs->max_size == 0) {
+				*error_r = "size must not be 0";
+				return -1;
+			}
+		} else {
+			*error_r = t_strdup_printf("Unknown key '%s'", key);
+			return -1;
+		}
+	}
+	if (fs->dir == NULL || fs->dir[0] == '\0') {
+		*error_r = "dir not given";
+		return -1;
+	}
+	return 0;
+}
+
+static int
+fs_cache_init(struct fs *_fs, const char *args, const struct fs_settings *set,
+	      const char **error_r)
+{
+	struct cache_fs *fs = CACHE_FS(_fs);
+	const char *p, *parent_name, *parent_args, *error;
+
+	p = strchr(args, ':');
+	if (p == NULL) {
+		*error_r = "Cache parameters missing";
+		return -1;
+	}
+	if (fs_cache_parse_params(fs, t_strdup_until(args, p++), &error) < 0) {
+		*error_r = t_strdup_printf(
+			"Invalid cache parameters: %s", error);
+		return -1;
+	}
+	args = p;
+
+	if (*args == '\0') {
+		*error_r = "Parent filesystem not given as parameter";
+		return -1;
+	}
+
+	parent_args = strchr(args, ':');
+	if (parent_args == NULL) {
+		parent_name = args;
+		parent_args = "";
+	} else {
+		parent_name = t_strdup_until(args, parent_args);
+		parent_args++;
+	}
+	if (fs_init(parent_name, parent_args, set, &_fs->parent, error_r) < 0)
+		return -1;
+	return 0;
+}
+
+static void fs_cache_free(struct fs *_fs)
+{
+	struct cache_fs *fs = CACHE_FS(_fs);
+
+	/* the cache files are left behind for other processes */
+	while (fs->lru_head != NULL)
+		cache_fs_entry_remove(fs, fs->lru_head);
+	hash_table_destroy(&fs->entries);
+	i_free(fs->dir);
+	i_free(fs);
+}
+
+static struct fs_file *fs_cache_file_alloc(void)
+{
+	struct cache_fs_file *file = i_new(struct cache_fs_file, 1);
+	return &file->file;
+}
+
+static void
+fs_cache_file_init(struct fs_file *_file, const char *path,
+		   enum fs_open_mode mode, enum fs_open_flags flags)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+	struct cache_fs *fs = CACHE_FS(_file->fs);
+
+	file->file.path = i_strdup(path);
+	file->fs = fs;
+	file->temp_fd = -1;
+	sha1_get_digest(path, strlen(path), file->digest);
+	file->cache_path = i_strdup(cache_fs_get_cache_path(fs, file->digest));
+	file->file.parent = fs_file_init_parent(_file, path, mode, flags);
+}
+
+static void fs_cache_file_deinit(struct fs_file *_file)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+
+	i_assert(file->temp_fd == -1);
+
+	fs_file_free(_file);
+	i_free(file->cache_path);
+	i_free(file->file.path);
+	i_free(file);
+}
+
+static bool fs_cache_prefetch(struct fs_file *_file, uoff_t length)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+
+	if (access(file->cache_path, R_OK) == 0)
+		return TRUE;
+	/* let the parent start fetching the object. the following read
+	   will add it to the cache. */
+	return fs_prefetch(_file->parent, length);
+}
+
+static struct istream *
+fs_cache_read_stream(struct fs_file *_file, size_t max_buffer_size)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+	struct cache_fs *fs = file->fs;
+	struct cache_fs_entry *entry;
+	struct istream *input, *input2;
+	const char *temp_path;
+	struct stat st;
+	int fd;
+
+	cache_fs_sketch_add(fs, file->digest);
+	entry = cache_fs_entry_lookup(fs, file->digest);
+
+	fd = open(file->cache_path, O_RDONLY);
+	if (fd != -1 && fstat(fd, &st) < 0) {
+		e_error(_file->event, "fs-cache: fstat(%s) failed: %m",
+			file->cache_path);
+		i_close_fd(&fd);
+	} else if (fd == -1 && errno != ENOENT) {
+		e_error(_file->event, "fs-cache: open(%s) failed: %m",
+			file->cache_path);
+	}
+	if (fd != -1) {
+		_file->fs->stats.cache_hit_count++;
+		if (entry == NULL || entry->size != (uoff_t)st.st_size)
+			cache_fs_entry_update(fs, file->digest, st.st_size);
+		else {
+			DLLIST2_REMOVE(&fs->lru_head, &fs->lru_tail, entry);
+			DLLIST2_APPEND(&fs->lru_head, &fs->lru_tail, entry);
+		}
+		input = i_stream_create_fd_autoclose(&fd, max_buffer_size);
+		i_stream_set_name(input, file->cache_path);
+		return input;
+	}
+	if (entry != NULL) {
+		/* deleted by another process */
+		cache_fs_entry_remove(fs, entry);
+	}
+
+	_file->fs->stats.cache_miss_count++;
+	input = fs_read_stream(_file->parent, max_buffer_size);
+	if (input->stream_errno != 0 || !cache_fs_admit(fs, file->digest, 0))
+		return input;
+	if ((fd = cache_fs_temp_create(fs, _file->event, file->digest,
+				       &temp_path)) == -1)
+		return input;
+
+	input2 = i_stream_create_cache_fs(input, file, &fd, temp_path);
+	i_stream_unref(&input);
+	return input2;
+}
+
+static int fs_cache_write(struct fs_file *_file, const void *data, size_t size)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+	const char *temp_path;
+	int fd;
+
+	cache_fs_invalidate(file->fs, file->digest);
+	if (fs_write(_file->parent, data, size) < 0)
+		return -1;
+
+	/* keep the written object in the cache, so it can be read back
+	   without going to the parent */
+	if ((fd = cache_fs_temp_create(file->fs, _file->event, file->digest,
+				       &temp_path)) == -1)
+		return 0;
+	if (write_full(fd, data, size) < 0) {
+		e_error(_file->event, "fs-cache: write(%s) failed: %m",
+			temp_path);
+		i_close_fd(&fd);
+		i_unlink(temp_path);
+		return 0;
+	}
+	i_close_fd(&fd);
+	cache_fs_temp_commit(file->fs, _file->event, file->digest,
+			     temp_path, size, TRUE);
+	return 0;
+}
+
+static void fs_cache_write_stream(struct fs_file *_file)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+	const char *temp_path;
+
+	i_assert(_file->output == NULL);
+
+	cache_fs_invalidate(file->fs, file->digest);
+	file->temp_fd = cache_fs_temp_create(file->fs, _file->event,
+					     file->digest, &temp_path);
+	if (file->temp_fd == -1) {
+		/* write directly to the parent without caching */
+		file->super_output = fs_write_stream(_file->parent);
+		_file->output = file->super_output;
+	} else {
+		file->temp_path = i_strdup(temp_path);
+		_file->output = o_stream_create_fd(file->temp_fd, 0);
+		o_stream_set_name(_file->output, _file->path);
+	}
+}
+
+static void fs_cache_write_stream_temp_free(struct cache_fs_file *file)
+{
+	if (file->temp_fd == -1)
+		return;
+
+	i_close_fd(&file->temp_fd);
+	i_free(file->temp_path);
+}
+
+static void fs_cache_write_stream_temp_abort(struct cache_fs_file *file)
+{
+	if (file->temp_fd != -1)
+		i_unlink(file->temp_path);
+	fs_cache_write_stream_temp_free(file);
+}
+
+static int fs_cache_write_stream_finish_temp(struct cache_fs_file *file)
+{
+	struct fs_file *_file = &file->file;
+	struct istream *input;
+	int ret;
+
+	input = i_stream_create_fd(file->temp_fd, IO_BLOCK_SIZE);
+	i_stream_set_name(input, file->temp_path);
+	file->super_output = fs_write_stream(_file->parent);
+	o_stream_nsend_istream(file->super_output, input);
+	ret = fs_write_stream_finish(_file->parent, &file->super_output);
+	i_stream_unref(&input);
+	return ret;
+}
+
+static int fs_cache_write_stream_finish(struct fs_file *_file, bool success)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+	struct stat st;
+	int ret;
+
+	if (_file->output != NULL) {
+		if (_file->output == file->super_output)
+			_file->output = NULL;
+		else
+			o_stream_unref(&_file->output);
+	}
+	if (!success) {
+		if (file->super_output != NULL)
+			fs_write_stream_abort_parent(_file, &file->super_output);
+		fs_cache_write_stream_temp_abort(file);
+		file->writing_parent = FALSE;
+		return -1;
+	}
+
+	if (file->temp_fd == -1) {
+		/* not cached */
+		return fs_write_stream_finish(_file->parent,
+					      &file->super_output);
+	}
+	if (file->writing_parent)
+		ret = fs_write_stream_finish_async(_file->parent);
+	else {
+		ret = fs_cache_write_stream_finish_temp(file);
+		file->writing_parent = TRUE;
+	}
+	if (ret == 0)
+		return 0;
+	file->writing_parent = FALSE;
+
+	if (ret < 0)
+		fs_cache_write_stream_temp_abort(file);
+	else if (fstat(file->temp_fd, &st) < 0) {
+		e_error(_file->event, "fs-cache: fstat(%s) failed: %m",
+			file->temp_path);
+		fs_cache_write_stream_temp_abort(file);
+	} else {
+		cache_fs_temp_commit(file->fs, _file->event, file->digest,
+				     file->temp_path, st.st_size, TRUE);
+		fs_cache_write_stream_temp_free(file);
+	}
+	return ret;
+}
+
+static int fs_cache_copy(struct fs_file *_src, struct fs_file *_dest)
+{
+	struct cache_fs_file *dest = CACHE_FILE(_dest);
+
+	cache_fs_invalidate(dest->fs, dest->digest);
+	return fs_wrapper_copy(_src, _dest);
+}
+
+static int fs_cache_rename(struct fs_file *_src, struct fs_file *_dest)
+{
+	struct cache_fs_file *src = CACHE_FILE(_src);
+	struct cache_fs_file *dest = CACHE_FILE(_dest);
+
+	cache_fs_invalidate(src->fs, src->digest);
+	cache_fs_invalidate(dest->fs, dest->digest);
+	return fs_wrapper_rename(_src, _dest);
+}
+
+static int fs_cache_delete(struct fs_file *_file)
+{
+	struct cache_fs_file *file = CACHE_FILE(_file);
+
+	cache_fs_invalidate(file->fs, file->digest);
+	return fs_wrapper_delete(_file);
+}
+
+const struct fs fs_class_cache = {
+	.name = "cache",
+	.v = {
+		.alloc = fs_cache_alloc,
+		.init = fs_cache_init,
+		.deinit = NULL,
+		.free = fs_cache_free,
+		.get_properties = fs_wrapper_get_properties,
+		.file_alloc = fs_cache_file_alloc,
+		.file_init = fs_cache_file_init,
+		.file_deinit = fs_cache_file_deinit,
+		.file_close = fs_wrapper_file_close,
+		.get_path = fs_wrapper_file_get_path,
+		.set_async_callback = fs_wrapper_set_async_callback,
+		.wait_async = fs_wrapper_wait_async,
+		.set_metadata = fs_wrapper_set_metadata,
+		.get_metadata = fs_wrapper_get_metadata,
+		.prefetch = fs_cache_prefetch,
+		.read = NULL,
+		.read_stream = fs_cache_read_stream,
+		.write = fs_cache_write,
+		.write_stream = fs_cache_write_stream,
+		.write_stream_finish = fs_cache_write_stream_finish,
+		.lock = fs_wrapper_lock,
+		.unlock = fs_wrapper_unlock,
+		.exists = fs_wrapper_exists,
+		.stat = fs_wrapper_stat,
+		.copy = fs_cache_copy,
+		.rename = fs_cache_rename,
+		.delete_file = fs_cache_delete,
+		.iter_alloc = fs_wrapper_iter_alloc,
+		.iter_init = fs_wrapper_iter_init,
+		.iter_next = NULL,
+		.iter_deinit = NULL,
+		.switch_ioloop = NULL,
+		.get_nlinks = fs_wrapper_get_nlinks,
+	}
+};
@@ -414,7 +414,7 @@ static int fs_posix_open_for_read(struct posix_fs_file *file)
 	return 0;
 }
 
-static bool fs_posix_prefetch(struct fs_file *_file, uoff_t length ATTR_UNUSED)
+static bool fs_posix_prefetch(struct fs_file *_file, uoff_t length)
 {
 	struct posix_fs_file *file =
 		container_of(_file, struct posix_fs_file, file);
@@ -424,6 +424,11 @@ static bool fs_posix_prefetch(struct fs_file *_file, uoff_t length ATTR_UNUSED)
 
 /* HAVE_POSIX_FADVISE alone isn't enough for CentOS 4.9 */
 #if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	/* The kernel starts reading the file in the background, so prefetching
+	   a batch of files overlaps their I/O. Length 0 means until the end of
+	   the file. */
+	if (length > (uoff_t)OFF_T_MAX)
+		length = 0;
 	if (posix_fadvise(file->fd, 0, length, POSIX_FADV_WILLNEED) < 0) {
 		e_error(_file->event, "posix_fadvise(%s) failed: %m", file->full_path);
 		return TRUE;
@@ -476,6 +481,14 @@ fs_posix_read_stream(struct fs_file *_file, size_t max_buffer_size)
 		   Don't use file->fd directly, because the fd may still be
 		   used for other purposes. It's especially important for files
 		   that were just created. */
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_SEQUENTIAL)
+		/* the file is most likely going to be read until the end, so
+		   ask the kernel to use a larger readahead window */
+		if (posix_fadvise(fd_dup, 0, 0, POSIX_FADV_SEQUENTIAL) < 0) {
+			e_debug(_file->event, "posix_fadvise(%s) failed: %m",
+				file->full_path);
+		}
+#endif
 		input = i_stream_create_fd_autoclose(&fd_dup, max_buffer_size);
 	}
 	i_stream_set_name(input, file->full_path);
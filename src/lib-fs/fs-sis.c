@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "str.h"
+#include "str-parse.h"
 #include "istream.h"
 #include "ostream.h"
 #include "ostream-cmp.h"
@@ -12,6 +13,9 @@
 
 struct sis_fs {
 	struct fs fs;
+	/* The hashes are strong enough that equal hashes mean equal
+	   contents, so files are linked without comparing them first. */
+	bool trust_hash;
 };
 
 struct sis_fs_file {
@@ -39,12 +43,51 @@ static struct fs *fs_sis_alloc(void)
 	return &fs->fs;
 }
 
+static int fs_sis_parse_params(struct sis_fs *fs, const char *params,
+			       const char **error_r)
+{
+	const char *const *tmp;
+
+	for (tmp = t_strsplit_spaces(params, ","); *tmp != NULL; tmp++) {
+		const char *key = *tmp;
+		const char *value = strchr(key, '=');
+
+		if (value == NULL) {
+			*error_r = "Missing '='";
+			return -1;
+		}
+		key = t_strdup_until(key, value++);
+		if (strcmp(key, "trust_hash") == 0) {
+			if (str_parse_get_bool(value, &fs->trust_hash,
+					       error_r) < 0)
+				return -1;
+		} else {
+			*error_r = t_strdup_printf("Unknown key '%s'", key);
+			return -1;
+		}
+	}
+	return 0;
+}
+
 static int
 fs_sis_init(struct fs *_fs, const char *args, const struct fs_settings *set,
 	    const char **error_r)
 {
+	struct sis_fs *fs = SIS_FS(_fs);
 	enum fs_properties props;
-	const char *parent_name, *parent_args;
+	const char *p, *parent_name, *parent_args, *error;
+
+	/* optional key=value[,key=value..] parameters before the parent */
+	p = strchr(args, ':');
+	if (p != NULL && memchr(args, '=', p - args) != NULL) {
+		if (fs_sis_parse_params(fs, t_strdup_until(args, p++),
+					&error) < 0) {
+			*error_r = t_strdup_printf(
+				"Invalid sis parameters: %s", error);
+			return -1;
+		}
+		args = p;
+	}
 
 	if (*args == '\0') {
 		*error_r = "Parent filesystem not given as parameter";
@@ -107,6 +150,12 @@ fs_sis_file_init(struct fs_file *_file, const char *path,
 	file->hash_file = fs_file_init_parent(_file, file->hash_path,
 					      FS_OPEN_MODE_READONLY, 0);
 
+	if (fs->trust_hash) {
+		/* the contents aren't compared, so there's no need to read
+		   the hash file. fs_sis_try_link() checks if it exists. */
+		file->file.parent = fs_file_init_parent(_file, path, mode, flags);
+		return;
+	}
 	file->hash_input = fs_read_stream(file->hash_file, IO_BLOCK_SIZE);
 	if (i_stream_read(file->hash_input) == -1) {
 		/* doesn't exist */
@@ -144,10 +193,21 @@ static void fs_sis_file_close(struct fs_file *_file)
 static bool fs_sis_try_link(struct sis_fs_file *file)
 {
 	const struct stat *st;
-	struct stat st2;
+	struct stat hash_st, st2;
 
-	if (i_stream_stat(file->hash_input, FALSE, &st) < 0)
-		return FALSE;
+	if (file->hash_input != NULL) {
+		if (i_stream_stat(file->hash_input, FALSE, &st) < 0)
+			return FALSE;
+	} else {
+		if (fs_stat(file->hash_file, &hash_st) < 0) {
+			if (errno != ENOENT) {
+				e_error(file->file.event, "%s",
+					fs_file_last_error(file->hash_file));
+			}
+			return FALSE;
+		}
+		st = &hash_st;
+	}
 
 	/* we can use the existing file */
 	if (fs_copy(file->hash_file, file->file.parent) < 0) {
@@ -251,6 +311,8 @@ static int fs_sis_write(struct fs_file *_file, const void *data, size_t size)
 	if (_file->parent == NULL)
 		return -1;
 
+	if (file->fs->trust_hash && fs_sis_try_link(file))
+		return 0;
 	if (file->hash_input != NULL &&
 	    stream_cmp_block(file->hash_input, data, size) &&
 	    i_stream_read_eof(file->hash_input)) {
@@ -301,6 +363,13 @@ static int fs_sis_write_stream_finish(struct fs_file *_file, bool success)
 		return -1;
 	}
 
+	if (file->fs->trust_hash) {
+		o_stream_unref(&_file->output);
+		if (fs_sis_try_link(file)) {
+			fs_write_stream_abort_parent(_file, &file->fs_output);
+			return 1;
+		}
+	}
 	if (file->hash_input != NULL &&
 	    o_stream_cmp_equals(_file->output) &&
 	    i_stream_read_eof(file->hash_input)) {
@@ -0,0 +1,219 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "istream.h"
+#include "ostream.h"
+#include "unlink-directory.h"
+#include "write-full.h"
+#include "fs-api.h"
+#include "test-common.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define TEST_DIR ".test-fs-cache"
+#define TEST_PARENT_DIR TEST_DIR"/parent"
+#define TEST_CACHE_DIR TEST_DIR"/cache"
+
+static struct fs_settings test_fs_set;
+
+static void test_parent_file_write(const char *fname, const char *contents)
+{
+	const char *path = t_strdup_printf(TEST_PARENT_DIR"/%s", fname);
+	int fd;
+
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", path);
+	if (write_full(fd, contents, strlen(contents)) < 0)
+		i_fatal("write(%s) failed: %m", path);
+	i_close_fd(&fd);
+}
+
+static void test_dir_reset(void)
+{
+	const char *error;
+
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &error) < 0)
+		i_fatal("unlink_directory(%s) failed: %s", TEST_DIR, error);
+	if (mkdir(TEST_DIR, 0700) < 0 || mkdir(TEST_PARENT_DIR, 0700) < 0)
+		i_fatal("mkdir(%s) failed: %m", TEST_PARENT_DIR);
+}
+
+static const char *test_fs_read(struct fs *fs, const char *fname)
+{
+	struct fs_file *file;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	const char *ret = NULL;
+
+	file = fs_file_init(fs, fname, FS_OPEN_MODE_READONLY);
+	input = fs_read_stream(file, IO_BLOCK_SIZE);
+	if (i_stream_read_more(input, &data, &size) > 0) {
+		ret = t_strndup(data, size);
+		i_stream_skip(input, size);
+		test_assert(i_stream_read(input) == -1);
+	}
+	test_assert(input->stream_errno == 0 || ret == NULL);
+	i_stream_unref(&input);
+	fs_file_deinit(&file);
+	return ret;
+}
+
+static void test_fs_write(struct fs *fs, const char *fname,
+			  const char *contents, bool stream)
+{
+	struct fs_file *file;
+	struct ostream *output;
+
+	file = fs_file_init(fs, fname, FS_OPEN_MODE_REPLACE);
+	if (!stream)
+		test_assert(fs_write(file, contents, strlen(contents)) == 0);
+	else {
+		output = fs_write_stream(file);
+		o_stream_nsend_str(output, contents);
+		test_assert(fs_write_stream_finish(file, &output) > 0);
+	}
+	fs_file_deinit(&file);
+}
+
+static struct fs *test_fs_cache_init(const char *params)
+{
+	struct fs *fs;
+	const char *error;
+
+	if (fs_init("cache", t_strdup_printf(
+			"dir="TEST_CACHE_DIR"%s:posix:prefix="TEST_PARENT_DIR"/",
+			params), &test_fs_set, &fs, &error) < 0)
+		i_fatal("fs_init() failed: %s", error);
+	return fs;
+}
+
+static void test_fs_cache_read(void)
+{
+	struct fs *fs;
+
+	test_begin("fs cache read");
+	test_dir_reset();
+	test_parent_file_write("foo", "hello");
+	fs = test_fs_cache_init("");
+
+	test_assert_strcmp(test_fs_read(fs, "foo"), "hello");
+	test_assert(fs_get_stats(fs)->cache_miss_count == 1);
+
+	/* the parent isn't accessed anymore */
+	test_parent_file_write("foo", "changed");
+	test_assert_strcmp(test_fs_read(fs, "foo"), "hello");
+	test_assert(fs_get_stats(fs)->cache_hit_count == 1);
+	test_assert(test_fs_read(fs, "nonexistent") == NULL);
+	test_assert(fs_get_stats(fs)->cache_miss_count == 2);
+	fs_deinit(&fs);
+
+	/* another fs instance sees the same cache */
+	fs = test_fs_cache_init("");
+	test_assert_strcmp(test_fs_read(fs, "foo"), "hello");
+	test_assert(fs_get_stats(fs)->cache_hit_count == 1);
+	fs_deinit(&fs);
+	test_end();
+}
+
+static void test_fs_cache_write(void)
+{
+	struct fs_file *file;
+	struct fs *fs;
+
+	test_begin("fs cache write");
+	test_dir_reset();
+	fs = test_fs_cache_init("");
+
+	test_fs_write(fs, "buf", "written", FALSE);
+	test_fs_write(fs, "stream", "streamed", TRUE);
+	test_parent_file_write("buf", "changed");
+	test_parent_file_write("stream", "changed");
+	test_assert_strcmp(test_fs_read(fs, "buf"), "written");
+	test_assert_strcmp(test_fs_read(fs, "stream"), "streamed");
+	test_assert(fs_get_stats(fs)->cache_hit_count == 2);
+
+	/* overwriting replaces the cached object */
+	test_fs_write(fs, "buf", "rewritten", TRUE);
+	test_assert_strcmp(test_fs_read(fs, "buf"), "rewritten");
+
+	/* deleting removes it from the cache */
+	file = fs_file_init(fs, "stream", FS_OPEN_MODE_READONLY);
+	test_assert(fs_delete(file) == 0);
+	fs_file_deinit(&file);
+	test_assert(test_fs_read(fs, "stream") == NULL);
+	fs_deinit(&fs);
+	test_end();
+}
+
+static void test_fs_cache_evict(void)
+{
+	struct fs *fs;
+
+	test_begin("fs cache evict");
+	test_dir_reset();
+	fs = test_fs_cache_init(",size=10");
+
+	test_fs_write(fs, "a", "111111", FALSE);
+	test_fs_write(fs, "b", "222222", FALSE);
+	test_parent_file_write("a", "333333");
+	test_parent_file_write("b", "444444");
+	/* a was evicted */
+	test_assert_strcmp(test_fs_read(fs, "b"), "222222");
+
+	/* a isn't accessed more often than b, so it's not admitted */
+	test_assert_strcmp(test_fs_read(fs, "a"), "333333");
+	test_assert_strcmp(test_fs_read(fs, "b"), "222222");
+	test_assert_strcmp(test_fs_read(fs, "a"), "333333");
+
+	/* once it has been accessed more often, it replaces b */
+	test_parent_file_write("a", "555555");
+	test_assert_strcmp(test_fs_read(fs, "a"), "555555");
+	test_parent_file_write("a", "666666");
+	test_assert_strcmp(test_fs_read(fs, "a"), "555555");
+	test_assert_strcmp(test_fs_read(fs, "b"), "444444");
+	fs_deinit(&fs);
+	test_end();
+}
+
+static void test_fs_cache_init_errors(void)
+{
+	static const char *const args[] = {
+		"",
+		"dir="TEST_CACHE_DIR,
+		"dir="TEST_CACHE_DIR":",
+		"size=1M:posix",
+		"dir="TEST_CACHE_DIR",size=0:posix",
+		"dir="TEST_CACHE_DIR",size=foo:posix",
+		"dir="TEST_CACHE_DIR",foo=bar:posix",
+	};
+	struct fs *fs;
+	const char *error;
+
+	test_begin("fs cache init errors");
+	for (unsigned int i = 0; i < N_ELEMENTS(args); i++) {
+		test_assert_idx(fs_init("cache", args[i], &test_fs_set,
+					&fs, &error) < 0, i);
+	}
+
+	if (unlink_directory(TEST_DIR, UNLINK_DIRECTORY_FLAG_RMDIR,
+			     &error) < 0)
+		i_error("unlink_directory(%s) failed: %s", TEST_DIR, error);
+	test_end();
+}
+
+int main(void)
+{
+	static void (*const test_functions[])(void) = {
+		test_fs_cache_read,
+		test_fs_cache_write,
+		test_fs_cache_evict,
+		test_fs_cache_init_errors,
+		NULL
+	};
+	return test_run(test_functions);
+}
@@ -0,0 +1,118 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "time-util.h"
+#include "buffer.h"
+#include "unichar.h"
+#include "fts-tokenizer.h"
+#include "fts-tokenizer-private.h"
+#include "fts-tokenizer-generic-private.h"
+
+#include <stdio.h>
+
+/**
+ * Measures the throughput of the generic tokenizer with both the simple and
+ * the TR29 algorithms. The French UDHR text is always used, since it has a
+ * fair amount of non-ASCII letters. Mails (or any other text) given as
+ * parameters are tokenized as well. They're mostly ASCII in practice.
+ * Each supported implementation of the ASCII run scanning is measured.
+ */
+
+#define BENCH_MIN_BYTES (64*1024*1024UL)
+#define UDHR_FRA_NAME "/udhr_fra.txt"
+
+static unsigned int bench_tokenize(struct fts_tokenizer *tok,
+				   const buffer_t *text)
+{
+	const char *token, *error;
+	unsigned int count = 0;
+	size_t pos = 0, len;
+	int ret;
+
+	/* feed the text in blocks like the indexer does */
+	while (pos < text->used) {
+		len = I_MIN(text->used - pos, IO_BLOCK_SIZE);
+		while ((ret = fts_tokenizer_next(tok,
+				CONST_PTR_OFFSET(text->data, pos), len,
+				&token, &error)) > 0)
+			count++;
+		i_assert(ret == 0);
+		pos += len;
+	}
+	while ((ret = fts_tokenizer_final(tok, &token, &error)) > 0)
+		count++;
+	i_assert(ret == 0);
+	return count;
+}
+
+static void bench_algorithm(const char *algorithm, const char *impl_name,
+			    const buffer_t *text)
+{
+	const char *const settings[] = { "algorithm", algorithm, NULL };
+	struct fts_tokenizer *tok;
+	const char *error;
+	unsigned long i, rounds = BENCH_MIN_BYTES / text->used + 1;
+	unsigned int count = 0;
+	uint64_t ts_0, nsecs;
+
+	if (fts_tokenizer_create(fts_tokenizer_generic, NULL, settings,
+				 &tok, &error) < 0)
+		i_fatal("fts_tokenizer_create(%s) failed: %s", algorithm, error);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < rounds; i++) T_BEGIN {
+		count = bench_tokenize(tok, text);
+	} T_END;
+	nsecs = i_nanoseconds() - ts_0;
+	printf("\t%s %s: %0.0lf MB/s (%u tokens)\n", algorithm, impl_name,
+	       (double)(rounds * text->used) * 1000 / (double)nsecs, count);
+	fts_tokenizer_unref(&tok);
+}
+
+static void bench_file(buffer_t *text, const char *path)
+{
+	const char *error;
+
+	buffer_set_used_size(text, 0);
+	if (buffer_append_full_file(text, path, SIZE_MAX,
+				    &error) != BUFFER_APPEND_OK)
+		i_fatal("%s: %s", path, error);
+	if (text->used == 0)
+		return;
+
+	static const struct {
+		enum fts_ascii_span_impl impl;
+		const char *name;
+	} impls[] = {
+		{ FTS_ASCII_SPAN_IMPL_SCALAR, "scalar" },
+		{ FTS_ASCII_SPAN_IMPL_SSSE3, "SSSE3" },
+		{ FTS_ASCII_SPAN_IMPL_AVX2, "AVX2" },
+	};
+
+	printf("%s (%zu bytes)\n", path, text->used);
+	for (unsigned int i = 0; i < N_ELEMENTS(impls); i++) {
+		if (!fts_ascii_span_set_impl(impls[i].impl))
+			continue;
+		bench_algorithm("simple", impls[i].name, text);
+		bench_algorithm("tr29", impls[i].name, text);
+	}
+}
+
+int main(int argc, const char *argv[])
+{
+	buffer_t *text;
+	int i;
+
+	lib_init();
+	fts_tokenizers_init();
+
+	text = buffer_create_dynamic(default_pool, 1024*64);
+	bench_file(text, UDHRDIR UDHR_FRA_NAME);
+	for (i = 1; i < argc; i++)
+		bench_file(text, argv[i]);
+	buffer_free(&text);
+
+	fts_tokenizers_deinit();
+	lib_deinit();
+	return 0;
+}
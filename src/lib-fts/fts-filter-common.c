@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "str.h"
 #include "buffer.h"
+#include "hash.h"
 #include "unichar.h"
 #include "fts-filter-private.h"
 #include "fts-filter-common.h"
@@ -18,3 +19,70 @@ void fts_filter_truncate_token(string_t *token, size_t max_length)
 	str_truncate(token, len);
 	i_assert(len <= max_length);
 }
+
+struct fts_filter_cache {
+	pool_t pool;
+	HASH_TABLE(const char *, const char *) tokens;
+	unsigned int max_count;
+	unsigned int hits, misses;
+};
+
+struct fts_filter_cache *fts_filter_cache_init(unsigned int max_count)
+{
+	struct fts_filter_cache *cache;
+
+	i_assert(max_count > 0);
+
+	cache = i_new(struct fts_filter_cache, 1);
+	cache->pool = pool_alloconly_create("fts filter cache", 1024*16);
+	cache->max_count = max_count;
+	hash_table_create(&cache->tokens, default_pool, max_count,
+			  str_hash, strcmp);
+	return cache;
+}
+
+void fts_filter_cache_deinit(struct fts_filter_cache **_cache)
+{
+	struct fts_filter_cache *cache = *_cache;
+
+	*_cache = NULL;
+	hash_table_destroy(&cache->tokens);
+	pool_unref(&cache->pool);
+	i_free(cache);
+}
+
+bool fts_filter_cache_lookup(struct fts_filter_cache *cache, const char *token,
+			     const char **result_r)
+{
+	*result_r = hash_table_lookup(cache->tokens, token);
+	if (*result_r == NULL) {
+		cache->misses++;
+		return FALSE;
+	}
+	cache->hits++;
+	return TRUE;
+}
+
+void fts_filter_cache_add(struct fts_filter_cache *cache, const char *token,
+			  const char *result)
+{
+	const char *key, *value;
+
+	if (hash_table_count(cache->tokens) >= cache->max_count) {
+		/* Keep it simple: just start from scratch. The frequent
+		   tokens get quickly added back. */
+		hash_table_clear(cache->tokens, TRUE);
+		p_clear(cache->pool);
+	}
+	key = p_strdup(cache->pool, token);
+	value = strcmp(token, result) == 0 ? key :
+		p_strdup(cache->pool, result);
+	hash_table_update(cache->tokens, key, value);
+}
+
+void fts_filter_cache_get_stats(const struct fts_filter_cache *cache,
+				unsigned int *hits_r, unsigned int *misses_r)
+{
+	*hits_r = cache->hits;
+	*misses_r = cache->misses;
+}
@@ -1,6 +1,28 @@
 #ifndef FTS_FILTER_COMMON_H
 #define FTS_FILTER_COMMON_H
 
+/* Maximum number of tokens in a filter's result cache. When it's full, the
+   cache is cleared. */
+#define FTS_FILTER_CACHE_MAX_COUNT 2048
+
 void fts_filter_truncate_token(string_t *token, size_t max_length);
 
+/* Cache of token -> filtered token results for filters that are expensive
+   and always give the same result for the same token. */
+struct fts_filter_cache *fts_filter_cache_init(unsigned int max_count);
+void fts_filter_cache_deinit(struct fts_filter_cache **cache);
+
+/* Returns TRUE if the token was found from the cache. The result is
+   "" if the filter dropped the token. The result stays valid until the next
+   fts_filter_cache_add() call. */
+bool fts_filter_cache_lookup(struct fts_filter_cache *cache, const char *token,
+			     const char **result_r);
+/* Add a filtered token to the cache. Use "" as the result if the token was
+   dropped. */
+void fts_filter_cache_add(struct fts_filter_cache *cache, const char *token,
+			  const char *result);
+/* Returns the number of cache hits and misses since the cache was created. */
+void fts_filter_cache_get_stats(const struct fts_filter_cache *cache,
+				unsigned int *hits_r, unsigned int *misses_r);
+
 #endif
@@ -19,6 +19,7 @@ struct fts_filter_normalizer_icu {
 	UTransliterator *transliterator;
 	ARRAY_TYPE(icu_utf16) utf16_token, trans_token;
 	string_t *utf8_token;
+	struct fts_filter_cache *cache;
 };
 
 static void fts_filter_normalizer_icu_destroy(struct fts_filter *filter)
@@ -28,6 +29,7 @@ static void fts_filter_normalizer_icu_destroy(struct fts_filter *filter)
 
 	if (np->transliterator != NULL)
 		utrans_close(np->transliterator);
+	fts_filter_cache_deinit(&np->cache);
 	pool_unref(&np->pool);
 }
 
@@ -68,6 +70,7 @@ fts_filter_normalizer_icu_create(const struct fts_language *lang ATTR_UNUSED,
 	p_array_init(&np->utf16_token, pp, 64);
 	p_array_init(&np->trans_token, pp, 64);
 	np->utf8_token = buffer_create_dynamic(pp, 128);
+	np->cache = fts_filter_cache_init(FTS_FILTER_CACHE_MAX_COUNT);
 	np->filter.max_length = max_length;
 	*filter_r = &np->filter;
 	return 0;
@@ -79,6 +82,16 @@ fts_filter_normalizer_icu_filter(struct fts_filter *filter, const char **token,
 {
 	struct fts_filter_normalizer_icu *np =
 		(struct fts_filter_normalizer_icu *)filter;
+	const char *cached_token;
+
+	/* the transliteration is slow, and the same tokens are seen over
+	   and over again */
+	if (fts_filter_cache_lookup(np->cache, *token, &cached_token)) {
+		if (cached_token[0] == '\0')
+			return 0;
+		*token = cached_token;
+		return 1;
+	}
 
 	if (np->transliterator == NULL)
 		if (fts_icu_transliterator_create(np->transliterator_id,
@@ -95,12 +108,15 @@ fts_filter_normalizer_icu_filter(struct fts_filter *filter, const char **token,
 			      np->transliterator, error_r) < 0)
 		return -1;
 
-	if (array_count(&np->trans_token) == 0)
+	if (array_count(&np->trans_token) == 0) {
+		fts_filter_cache_add(np->cache, *token, "");
 		return 0;
+	}
 
 	fts_icu_utf16_to_utf8(np->utf8_token, array_front(&np->trans_token),
 			      array_count(&np->trans_token));
 	fts_filter_truncate_token(np->utf8_token, np->filter.max_length);
+	fts_filter_cache_add(np->cache, *token, str_c(np->utf8_token));
 	*token = str_c(np->utf8_token);
 	return 1;
 }
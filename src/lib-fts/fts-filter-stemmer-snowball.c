@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "fts-language.h"
 #include "fts-filter-private.h"
+#include "fts-filter-common.h"
 
 #ifdef HAVE_FTS_STEMMER
 
@@ -13,6 +14,7 @@ struct fts_filter_stemmer_snowball {
 	pool_t pool;
 	struct fts_language *lang;
 	struct sb_stemmer *stemmer;
+	struct fts_filter_cache *cache;
 };
 
 static void fts_filter_stemmer_snowball_destroy(struct fts_filter *filter)
@@ -22,6 +24,8 @@ static void fts_filter_stemmer_snowball_destroy(struct fts_filter *filter)
 
 	if (sp->stemmer != NULL)
 		sb_stemmer_delete(sp->stemmer);
+	if (sp->cache != NULL)
+		fts_filter_cache_deinit(&sp->cache);
 	pool_unref(&sp->pool);
 }
 
@@ -47,6 +51,7 @@ fts_filter_stemmer_snowball_create(const struct fts_language *lang,
 	sp->filter = *fts_filter_stemmer_snowball;
 	sp->lang = p_malloc(sp->pool, sizeof(struct fts_language));
 	sp->lang->name = p_strdup(sp->pool, lang->name);
+	sp->cache = fts_filter_cache_init(FTS_FILTER_CACHE_MAX_COUNT);
 	*filter_r = &sp->filter;
 	return 0;
 }
@@ -73,6 +78,12 @@ fts_filter_stemmer_snowball_filter(struct fts_filter *filter,
 	struct fts_filter_stemmer_snowball *sp =
 		(struct fts_filter_stemmer_snowball *) filter;
 	const sb_symbol *base;
+	const char *orig_token = *token, *cached_token;
+
+	if (fts_filter_cache_lookup(sp->cache, *token, &cached_token)) {
+		*token = cached_token;
+		return 1;
+	}
 
 	if (sp->stemmer == NULL) {
 		if (fts_filter_stemmer_snowball_create_stemmer(sp, error_r) < 0)
@@ -100,6 +111,7 @@ fts_filter_stemmer_snowball_filter(struct fts_filter *filter,
 		 * So, when the stemmer asks to remove a token,
 		 * keep the original token unchanged instead. */
 	}
+	fts_filter_cache_add(sp->cache, orig_token, *token);
 	return 1;
 }
 
@@ -38,6 +38,20 @@ enum boundary_algorithm {
 #define ALGORITHM_TR29_NAME "tr29"
 };
 
+/* A set of ASCII characters whose runs can be skipped over with
+   fts_ascii_set_span(). */
+struct fts_ascii_set {
+	/* Bit (1 << high nibble) is set in low_nibbles[low nibble] for each
+	   character in the set. This is the form the SIMD code uses. */
+	uint8_t low_nibbles[16];
+};
+
+enum fts_ascii_span_impl {
+	FTS_ASCII_SPAN_IMPL_SCALAR = 0,
+	FTS_ASCII_SPAN_IMPL_SSSE3,
+	FTS_ASCII_SPAN_IMPL_AVX2,
+};
+
 struct generic_fts_tokenizer {
 	struct fts_tokenizer tokenizer;
 	unsigned int max_length;
@@ -54,4 +68,16 @@ struct generic_fts_tokenizer {
 	buffer_t *token;
 };
 
+/* Add an ASCII character to the set. */
+void fts_ascii_set_add(struct fts_ascii_set *set, unsigned char chr);
+/* Returns the number of characters at the beginning of the data that are in
+   the set. Returns size if all of them are. */
+size_t fts_ascii_set_span(const struct fts_ascii_set *set,
+			  const unsigned char *data, size_t size);
+
+/* Use the given implementation instead of the best one supported by the CPU.
+   Returns FALSE if the CPU doesn't support it. This is intended for unit
+   tests and benchmarks. */
+bool fts_ascii_span_set_impl(enum fts_ascii_span_impl impl);
+
 #endif
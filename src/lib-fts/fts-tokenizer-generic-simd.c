@@ -0,0 +1,163 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "unichar.h"
+#include "fts-tokenizer-private.h"
+#include "fts-tokenizer-generic-private.h"
+
+/* The characters are classified with the nibble lookup used by simdjson and
+   the lib's UTF-8 validation: the low nibble of each byte selects a bitmask
+   of the high nibbles that are in the set, and the high nibble selects its
+   own bit. A byte is in the set if the two lookups have a common bit. Bytes
+   with the high bit set are never in the set, since the high nibble table
+   has no bits for them. The SIMD versions do this for 16 (SSSE3) or 32
+   (AVX2) bytes at a time, and the implementation is picked at runtime in the
+   same way as in the lib. */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(__GNUC__ >= 5 || defined(__clang__))
+#  define FTS_ASCII_SPAN_X86
+#  include <immintrin.h>
+#  define FTS_TARGET_SSSE3 __attribute__((target("ssse3")))
+#  define FTS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define FTS_ASCII_HIGH_NIBBLES \
+	0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80, \
+	0, 0, 0, 0, 0, 0, 0, 0
+
+static size_t (*fts_ascii_span_func)(const struct fts_ascii_set *set,
+				     const unsigned char *data,
+				     size_t size) = NULL;
+
+void fts_ascii_set_add(struct fts_ascii_set *set, unsigned char chr)
+{
+	i_assert(chr < 0x80);
+	set->low_nibbles[chr & 0x0f] |= 1 << (chr >> 4);
+}
+
+static size_t
+fts_ascii_span_scalar(const struct fts_ascii_set *set,
+		      const unsigned char *data, size_t size)
+{
+	size_t pos;
+
+	for (pos = 0; pos < size; pos++) {
+		if (data[pos] >= 0x80 ||
+		    (set->low_nibbles[data[pos] & 0x0f] &
+		     (1 << (data[pos] >> 4))) == 0)
+			break;
+	}
+	return pos;
+}
+
+#ifdef FTS_ASCII_SPAN_X86
+
+static FTS_TARGET_SSSE3 size_t
+fts_ascii_span_ssse3(const struct fts_ascii_set *set,
+		     const unsigned char *data, size_t size)
+{
+	const __m128i low_table =
+		_mm_loadu_si128((const void *)set->low_nibbles);
+	const __m128i high_table = _mm_setr_epi8(FTS_ASCII_HIGH_NIBBLES);
+	const __m128i nibble_mask = _mm_set1_epi8(0x0f);
+	const __m128i zeros = _mm_setzero_si128();
+	__m128i in, bits;
+	unsigned int mask;
+	size_t pos;
+
+	for (pos = 0; pos + 16 <= size; pos += 16) {
+		in = _mm_loadu_si128((const void *)(data + pos));
+		bits = _mm_and_si128(
+			_mm_shuffle_epi8(low_table,
+					 _mm_and_si128(in, nibble_mask)),
+			_mm_shuffle_epi8(high_table,
+					 _mm_and_si128(_mm_srli_epi16(in, 4),
+						       nibble_mask)));
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(bits, zeros));
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos + fts_ascii_span_scalar(set, data + pos, size - pos);
+}
+
+static FTS_TARGET_AVX2 size_t
+fts_ascii_span_avx2(const struct fts_ascii_set *set,
+		    const unsigned char *data, size_t size)
+{
+	/* vpshufb looks up each 128 bit lane separately, so both lanes need
+	   the tables */
+	const __m256i low_table = _mm256_broadcastsi128_si256(
+		_mm_loadu_si128((const void *)set->low_nibbles));
+	const __m256i high_table = _mm256_setr_epi8(FTS_ASCII_HIGH_NIBBLES,
+						    FTS_ASCII_HIGH_NIBBLES);
+	const __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+	const __m256i zeros = _mm256_setzero_si256();
+	__m256i in, bits;
+	unsigned int mask;
+	size_t pos;
+
+	for (pos = 0; pos + 32 <= size; pos += 32) {
+		in = _mm256_loadu_si256((const void *)(data + pos));
+		bits = _mm256_and_si256(
+			_mm256_shuffle_epi8(low_table,
+					    _mm256_and_si256(in, nibble_mask)),
+			_mm256_shuffle_epi8(high_table,
+				_mm256_and_si256(_mm256_srli_epi16(in, 4),
+						 nibble_mask)));
+		mask = (unsigned int)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(bits, zeros));
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	/* the tail may still contain a full 16 byte block */
+	return pos + fts_ascii_span_ssse3(set, data + pos, size - pos);
+}
+
+#endif
+
+static void fts_ascii_span_init(void)
+{
+	fts_ascii_span_func = fts_ascii_span_scalar;
+#ifdef FTS_ASCII_SPAN_X86
+	__builtin_cpu_init();
+	if (!fts_ascii_span_set_impl(FTS_ASCII_SPAN_IMPL_AVX2))
+		(void)fts_ascii_span_set_impl(FTS_ASCII_SPAN_IMPL_SSSE3);
+#endif
+}
+
+bool fts_ascii_span_set_impl(enum fts_ascii_span_impl impl)
+{
+	switch (impl) {
+	case FTS_ASCII_SPAN_IMPL_SCALAR:
+		fts_ascii_span_func = fts_ascii_span_scalar;
+		return TRUE;
+	case FTS_ASCII_SPAN_IMPL_SSSE3:
+#ifdef FTS_ASCII_SPAN_X86
+		if (!__builtin_cpu_supports("ssse3"))
+			return FALSE;
+		fts_ascii_span_func = fts_ascii_span_ssse3;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	case FTS_ASCII_SPAN_IMPL_AVX2:
+#ifdef FTS_ASCII_SPAN_X86
+		if (!__builtin_cpu_supports("avx2"))
+			return FALSE;
+		fts_ascii_span_func = fts_ascii_span_avx2;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	}
+	i_unreached();
+}
+
+size_t fts_ascii_set_span(const struct fts_ascii_set *set,
+			  const unsigned char *data, size_t size)
+{
+	if (unlikely(fts_ascii_span_func == NULL))
+		fts_ascii_span_init();
+	return fts_ascii_span_func(set, data, size);
+}
@@ -32,6 +32,39 @@ static unsigned char fts_ascii_word_breaks[128] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 0  /* 112-127: {|}~ */
 };
 
+/* Letter types of ASCII characters, filled from letter_type_lookup() */
+static enum letter_type fts_ascii_letter_types[128];
+static bool fts_ascii_letter_types_initialized = FALSE;
+/* ASCII characters that can't end a word: in the simple algorithm after
+   a word character, in TR29 after ALetter and Numeric. */
+static struct fts_ascii_set fts_ascii_simple_word_chars;
+static struct fts_ascii_set fts_ascii_aletters, fts_ascii_numerics;
+
+static enum letter_type letter_type_lookup(unichar_t c);
+
+static inline bool fts_ascii_is_simple_word_char(unsigned char c)
+{
+	return c < 0x80 && fts_ascii_word_breaks[c] == 0 && c != '\'';
+}
+
+static void fts_ascii_letter_types_init(void)
+{
+	unichar_t c;
+
+	if (fts_ascii_letter_types_initialized)
+		return;
+	for (c = 0; c < N_ELEMENTS(fts_ascii_letter_types); c++) {
+		fts_ascii_letter_types[c] = letter_type_lookup(c);
+		if (fts_ascii_is_simple_word_char(c))
+			fts_ascii_set_add(&fts_ascii_simple_word_chars, c);
+		if (fts_ascii_letter_types[c] == LETTER_TYPE_ALETTER)
+			fts_ascii_set_add(&fts_ascii_aletters, c);
+		else if (fts_ascii_letter_types[c] == LETTER_TYPE_NUMERIC)
+			fts_ascii_set_add(&fts_ascii_numerics, c);
+	}
+	fts_ascii_letter_types_initialized = TRUE;
+}
+
 static int
 fts_tokenizer_generic_create(const char *const *settings,
 			     struct fts_tokenizer **tokenizer_r,
@@ -91,6 +124,7 @@ fts_tokenizer_generic_create(const char *const *settings,
 		return -1;
 	}
 
+	fts_ascii_letter_types_init();
 	tok = i_new(struct generic_fts_tokenizer, 1);
 	if (algo == BOUNDARY_ALGORITHM_TR29)
 		tok->tokenizer.v = &generic_tokenizer_vfuncs_tr29;
@@ -355,6 +389,17 @@ fts_tokenizer_generic_simple_next(struct fts_tokenizer *_tok,
 
 	start = tok->token->used > 0 ? 0 : skip_base64(data, size);
 	for (i = start; i < size; i += char_size) {
+		if (tok->prev_type == LETTER_TYPE_ALETTER &&
+		    fts_ascii_is_simple_word_char(data[i])) {
+			/* Fast path: continuing a word with ASCII characters
+			   that can't break it. This is what the slow path
+			   below would do for each of them. */
+			char_size = 1 + fts_ascii_set_span(
+				&fts_ascii_simple_word_chars,
+				data + i + 1, size - i - 1);
+			tok->prev_prev_type = LETTER_TYPE_ALETTER;
+			continue;
+		}
 		char_size = uni_utf8_get_char_n(data + i, size - i, &c);
 		i_assert(char_size > 0);
 
@@ -415,7 +460,7 @@ fts_tokenizer_generic_simple_next(struct fts_tokenizer *_tok,
    HYPHEN.
    TODO
 */
-static enum letter_type letter_type(unichar_t c)
+static enum letter_type letter_type_lookup(unichar_t c)
 {
 	unsigned int idx;
 
@@ -458,6 +503,13 @@ static enum letter_type letter_type(unichar_t c)
 	return LETTER_TYPE_OTHER;
 }
 
+static inline enum letter_type letter_type(unichar_t c)
+{
+	if (c < N_ELEMENTS(fts_ascii_letter_types))
+		return fts_ascii_letter_types[c];
+	return letter_type_lookup(c);
+}
+
 static bool letter_panic(struct generic_fts_tokenizer *tok ATTR_UNUSED)
 {
 	i_panic("Letter type should not be used.");
@@ -811,6 +863,20 @@ fts_tokenizer_generic_tr29_next(struct fts_tokenizer *_tok,
 
 	start_pos = tok->token->used > 0 ? 0 : skip_base64(data, size);
 	for (i = start_pos; i < size; ) {
+		if ((tok->prev_type == LETTER_TYPE_ALETTER ||
+		     tok->prev_type == LETTER_TYPE_NUMERIC) &&
+		    !tok->wb5a && data[i] < 0x80 &&
+		    fts_ascii_letter_types[data[i]] == tok->prev_type) {
+			/* Fast path: an ASCII ALetter or Numeric following
+			   the same type never breaks the word (WB5, WB8), so
+			   skip over the whole run. */
+			i += fts_ascii_set_span(
+				tok->prev_type == LETTER_TYPE_ALETTER ?
+				&fts_ascii_aletters : &fts_ascii_numerics,
+				data + i, size - i);
+			tok->prev_prev_type = tok->prev_type;
+			continue;
+		}
 		char_start_i = i;
 		char_size = uni_utf8_get_char_n(data + i, size - i, &c);
 		i_assert(char_size > 0);
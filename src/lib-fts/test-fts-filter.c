@@ -7,6 +7,7 @@
 #include "test-common.h"
 #include "fts-language.h"
 #include "fts-filter.h"
+#include "fts-filter-common.h"
 
 #include <stdio.h>
 
@@ -973,6 +974,35 @@ static void test_fts_filter_english_possessive(void)
 	test_end();
 }
 
+static void test_fts_filter_cache(void)
+{
+	struct fts_filter_cache *cache;
+	const char *result;
+	unsigned int hits, misses;
+
+	test_begin("fts filter cache");
+	cache = fts_filter_cache_init(2);
+	test_assert(!fts_filter_cache_lookup(cache, "running", &result));
+	fts_filter_cache_add(cache, "running", "run");
+	fts_filter_cache_add(cache, "the", "");
+	test_assert(fts_filter_cache_lookup(cache, "running", &result));
+	test_assert_strcmp(result, "run");
+	test_assert(fts_filter_cache_lookup(cache, "the", &result));
+	test_assert_strcmp(result, "");
+
+	/* full cache gets cleared */
+	fts_filter_cache_add(cache, "same", "same");
+	test_assert(!fts_filter_cache_lookup(cache, "running", &result));
+	test_assert(fts_filter_cache_lookup(cache, "same", &result));
+	test_assert_strcmp(result, "same");
+
+	fts_filter_cache_get_stats(cache, &hits, &misses);
+	test_assert(hits == 3);
+	test_assert(misses == 2);
+	fts_filter_cache_deinit(&cache);
+	test_end();
+}
+
 /* TODO: Functions to test 1. ref-unref pairs 2. multiple registers +
   an unregister + find */
 
@@ -1014,6 +1044,7 @@ int main(void)
 #endif
 #endif
 		test_fts_filter_english_possessive,
+		test_fts_filter_cache,
 		NULL
 	};
 	int ret;
@@ -9,6 +9,8 @@
 #include "fts-tokenizer-private.h"
 #include "fts-tokenizer-generic-private.h"
 
+#include <ctype.h>
+
 /*there should be a trailing space ' ' at the end of each string except the last one*/
 #define TEST_INPUT_ADDRESS \
 	"@invalid invalid@ Abc Dfg <abc.dfg@example.com>, " \
@@ -662,6 +664,47 @@ static void test_fts_tokenizer_skip_base64(void)
 	test_end();
 }
 
+static void test_fts_tokenizer_ascii_span_impl(const char *impl_name)
+{
+	struct fts_ascii_set set;
+	unsigned char data[70];
+	unsigned int chr, pos, size;
+
+	test_begin(t_strdup_printf("fts tokenizer ASCII span (%s)", impl_name));
+	/* letters, digits, '_' and all the nibble edges */
+	i_zero(&set);
+	for (chr = 0; chr < 0x80; chr++) {
+		if (i_isalnum(chr) || chr == '_' || chr == 0x0f || chr == 0x70)
+			fts_ascii_set_add(&set, chr);
+	}
+	memset(data, 'x', sizeof(data));
+	for (chr = 0; chr < 256; chr++) {
+		bool in_set = chr < 0x80 &&
+			(i_isalnum(chr) || chr == '_' ||
+			 chr == 0x0f || chr == 0x70);
+
+		for (pos = 0; pos < sizeof(data); pos++) {
+			data[pos] = chr;
+			for (size = pos; size <= sizeof(data); size += 17) {
+				test_assert_idx(fts_ascii_set_span(&set, data, size) ==
+					(size > pos && !in_set ? pos : size), chr);
+			}
+			data[pos] = 'x';
+		}
+	}
+	test_end();
+}
+
+static void test_fts_tokenizer_ascii_span(void)
+{
+	test_assert(fts_ascii_span_set_impl(FTS_ASCII_SPAN_IMPL_SCALAR));
+	test_fts_tokenizer_ascii_span_impl("scalar");
+	if (fts_ascii_span_set_impl(FTS_ASCII_SPAN_IMPL_SSSE3))
+		test_fts_tokenizer_ascii_span_impl("SSSE3");
+	if (fts_ascii_span_set_impl(FTS_ASCII_SPAN_IMPL_AVX2))
+		test_fts_tokenizer_ascii_span_impl("AVX2");
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -678,6 +721,7 @@ int main(void)
 		test_fts_tokenizer_delete_trailing_partial_char,
 		test_fts_tokenizer_random,
 		test_fts_tokenizer_explicit_prefix,
+		test_fts_tokenizer_ascii_span,
 		NULL
 	};
 	int ret;
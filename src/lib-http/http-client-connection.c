@@ -1162,6 +1162,12 @@ static void http_client_connection_input(struct connection *_conn)
 			response.reason, suffix,
 			timeval_diff_msecs(&req->response_time, &req->sent_time),
 			timeval_diff_msecs(&req->sent_time, &req->submit_time));
+		if (conn->ppool != NULL &&
+		    timeval_cmp(&req->response_time, &req->sent_time) > 0) {
+			http_client_peer_shared_add_latency(conn->ppool->peer,
+				timeval_diff_usecs(&req->response_time,
+						   &req->sent_time));
+		}
 
 		/* Make sure connection output is unlocked if 100-continue
 		   failed */
@@ -563,6 +563,44 @@ http_client_peer_shared_max_connections(struct http_client_peer_shared *pshared)
 	return max_conns;
 }
 
+struct http_client_peer_shared *
+http_client_peer_shared_lookup(struct http_client_context *cctx,
+			       const struct http_client_peer_addr *addr)
+{
+	return hash_table_lookup(cctx->peers, addr);
+}
+
+void http_client_peer_shared_add_latency(
+	struct http_client_peer_shared *pshared, unsigned int usecs)
+{
+	/* Make sure a measured latency is never 0 */
+	usecs = I_MAX(usecs, 1);
+	if (pshared->latency_ewma_usecs == 0)
+		pshared->latency_ewma_usecs = usecs;
+	else {
+		/* new_avg = old_avg + (sample - old_avg) / weight */
+		pshared->latency_ewma_usecs = (unsigned int)
+			(((uint64_t)pshared->latency_ewma_usecs *
+			  (HTTP_CLIENT_PEER_LATENCY_EWMA_WEIGHT - 1) + usecs) /
+			 HTTP_CLIENT_PEER_LATENCY_EWMA_WEIGHT);
+	}
+}
+
+unsigned int
+http_client_peer_shared_requests_pending(
+	struct http_client_peer_shared *pshared)
+{
+	struct http_client_peer_pool *ppool;
+	struct http_client_connection *conn;
+	unsigned int count = 0;
+
+	for (ppool = pshared->pools_list; ppool != NULL; ppool = ppool->next) {
+		array_foreach_elem(&ppool->conns, conn)
+			count += http_client_connection_count_pending(conn);
+	}
+	return count;
+}
+
 /*
  * Peer
  */
@@ -912,7 +950,7 @@ http_client_peer_handle_requests_real(struct http_client_peer *peer)
 	unsigned int num_pending, num_urgent, new_connections;
 	unsigned int working_conn_count;
 	struct http_client_peer *tmp_peer;
-	bool statistics_dirty = TRUE;
+	bool statistics_dirty = TRUE, pipeline_first = FALSE;
 
 	/* FIXME: limit the number of requests handled in one run to prevent
 	   I/O starvation. */
@@ -1054,8 +1092,24 @@ http_client_peer_handle_requests_real(struct http_client_peer *peer)
 	i_assert(idle == 0);
 	connecting = array_count(&peer->pending_conns);
 
+	if (peer->client->set.prefer_pipelining &&
+	    pshared->allows_pipelining) {
+		/* Pipeline to the existing connections as long as some of
+		   them still have room */
+		array_foreach_modifiable(&conns_avail, conn_avail_idx) {
+			if (conn_avail_idx->conn != NULL) {
+				pipeline_first = TRUE;
+				break;
+			}
+		}
+	}
+
 	/* Determine how many new connections we can set up */
-	if (pshared->last_failure.tv_sec > 0 && working_conn_count > 0 &&
+	if (pipeline_first) {
+		/* Only create connections for urgent requests */
+		new_connections = (num_urgent > connecting ?
+				   num_urgent - connecting : 0);
+	} else if (pshared->last_failure.tv_sec > 0 && working_conn_count > 0 &&
 	    working_conn_count == connecting) {
 		/* Don't create new connections until the existing ones have
 		   finished connecting successfully. */
@@ -1105,7 +1159,8 @@ http_client_peer_handle_requests_real(struct http_client_peer *peer)
 
 	/* Cannot create new connections for normal request; attempt pipelining
 	 */
-	if ((working_conn_count - connecting) >=
+	if (pipeline_first ||
+	    (working_conn_count - connecting) >=
 	    peer->client->set.max_parallel_connections) {
 		unsigned int pipeline_level = 0, total_handled = 0, handled;
 
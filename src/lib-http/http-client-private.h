@@ -17,6 +17,8 @@
 #define HTTP_CLIENT_DEFAULT_BACKOFF_MAX_TIME_MSECS (1000*60)
 #define HTTP_CLIENT_DEFAULT_DNS_TTL_MSECS (1000*60*30)
 #define HTTP_CLIENT_MIN_IDLE_TIMEOUT_MSECS 50
+/* Each new response latency sample has 1/N weight in the peer's average */
+#define HTTP_CLIENT_PEER_LATENCY_EWMA_WEIGHT 8
 
 /*
  * Types
@@ -232,6 +234,9 @@ struct http_client_peer_shared {
 	unsigned int backoff_current_time_msecs;
 	unsigned int backoff_max_time_msecs;
 
+	/* Moving average of the response latency (0 = not measured yet) */
+	unsigned int latency_ewma_usecs;
+
 	bool no_payload_sync:1;   /* Expect: 100-continue failed before */
 	bool seen_100_response:1; /* Expect: 100-continue succeeded before */
 	bool allows_pipelining:1; /* Peer is known to allow persistent
@@ -587,6 +592,17 @@ void http_client_peer_shared_switch_ioloop(
 unsigned int
 http_client_peer_shared_max_connections(
 	struct http_client_peer_shared *pshared);
+/* Find an existing shared peer for the address, or NULL if none exists. */
+struct http_client_peer_shared *
+http_client_peer_shared_lookup(struct http_client_context *cctx,
+			       const struct http_client_peer_addr *addr);
+void http_client_peer_shared_add_latency(
+	struct http_client_peer_shared *pshared, unsigned int usecs);
+/* Returns the number of requests currently sent to the peer and waiting
+   for a response, counted over all its connections. */
+unsigned int
+http_client_peer_shared_requests_pending(
+	struct http_client_peer_shared *pshared);
 
 /* peer */
 
@@ -28,6 +28,8 @@ http_client_queue_set_delay_timer(struct http_client_queue *queue,
 static void
 http_client_queue_set_request_timer(struct http_client_queue *queue,
 				    const struct timeval *time);
+static unsigned int
+http_client_queue_choose_ip(struct http_client_queue *queue);
 
 /*
  * Queue object
@@ -89,7 +91,12 @@ http_client_queue_create(struct http_client_host *host,
 	queue->event = event_create(queue->client->event);
 	event_set_append_log_prefix(queue->event,
 		t_strdup_printf("queue %s: ", str_sanitize(queue->name, 256)));
-	queue->ips_connect_idx = 0;
+	if (addr->type != HTTP_CLIENT_PEER_ADDR_UNIX &&
+	    http_client_host_ready(host)) {
+		/* IPs are already known from an earlier lookup */
+		queue->ips_connect_idx = queue->ips_connect_start_idx =
+			http_client_queue_choose_ip(queue);
+	}
 	i_array_init(&queue->pending_peers, 8);
 	i_array_init(&queue->requests, 16);
 	i_array_init(&queue->queued_requests, 16);
@@ -226,6 +233,42 @@ http_client_queue_is_last_connect_ip(struct http_client_queue *queue)
 		queue->ips_connect_start_idx);
 }
 
+static uint64_t
+http_client_queue_ip_cost(struct http_client_queue *queue, unsigned int idx)
+{
+	struct http_client_peer_addr addr = queue->addr;
+	struct http_client_peer_shared *pshared;
+
+	addr.a.tcp.ip = *http_client_host_get_ip(queue->host, idx);
+	pshared = http_client_peer_shared_lookup(queue->client->cctx, &addr);
+	if (pshared == NULL || pshared->latency_ewma_usecs == 0) {
+		/* Not measured yet - prefer trying it out */
+		return 0;
+	}
+	return (uint64_t)pshared->latency_ewma_usecs *
+		(http_client_peer_shared_requests_pending(pshared) + 1);
+}
+
+static unsigned int
+http_client_queue_choose_ip(struct http_client_queue *queue)
+{
+	unsigned int ips_count = http_client_host_get_ips_count(queue->host);
+	unsigned int idx1, idx2;
+
+	if (ips_count < 2)
+		return 0;
+
+	/* Power of two choices: pick two random IPs and use the one with the
+	   lower expected latency, i.e. its average response latency weighted
+	   by the number of requests already waiting for it. */
+	idx1 = i_rand_limit(ips_count);
+	idx2 = i_rand_limit(ips_count - 1);
+	if (idx2 >= idx1)
+		idx2++;
+	return http_client_queue_ip_cost(queue, idx2) <
+		http_client_queue_ip_cost(queue, idx1) ? idx2 : idx1;
+}
+
 static void
 http_client_queue_recover_from_lookup(struct http_client_queue *queue)
 {
@@ -235,7 +278,8 @@ http_client_queue_recover_from_lookup(struct http_client_queue *queue)
 	i_assert(queue->addr.type != HTTP_CLIENT_PEER_ADDR_UNIX);
 
 	if (queue->cur_peer == NULL) {
-		queue->ips_connect_idx = queue->ips_connect_start_idx = 0;
+		queue->ips_connect_idx = queue->ips_connect_start_idx =
+			http_client_queue_choose_ip(queue);
 		return;
 	}
 
@@ -245,7 +289,8 @@ http_client_queue_recover_from_lookup(struct http_client_queue *queue)
 		queue->ips_connect_idx = queue->ips_connect_start_idx = ip_idx;
 	} else {
 		/* Reset connect attempts */
-		queue->ips_connect_idx = queue->ips_connect_start_idx = 0;
+		queue->ips_connect_idx = queue->ips_connect_start_idx =
+			http_client_queue_choose_ip(queue);
 	}
 }
 
@@ -205,6 +205,8 @@ http_client_init_shared(struct http_client_context *cctx,
 			client->set.no_auto_retry || set->no_auto_retry;
 		client->set.no_ssl_tunnel =
 			client->set.no_ssl_tunnel || set->no_ssl_tunnel;
+		client->set.prefer_pipelining =
+			client->set.prefer_pipelining || set->prefer_pipelining;
 		if (set->max_redirects > 0)
 			client->set.max_redirects = set->max_redirects;
 		if (set->request_absolute_timeout_msecs > 0) {
@@ -493,6 +495,7 @@ http_client_context_create(const struct http_client_settings *set)
 	cctx->set.no_auto_redirect = set->no_auto_redirect;
 	cctx->set.no_auto_retry = set->no_auto_retry;
 	cctx->set.no_ssl_tunnel = set->no_ssl_tunnel;
+	cctx->set.prefer_pipelining = set->prefer_pipelining;
 	cctx->set.max_redirects = set->max_redirects;
 	cctx->set.response_hdr_limits = set->response_hdr_limits;
 	cctx->set.request_absolute_timeout_msecs =
@@ -56,6 +56,11 @@ struct http_client_settings {
 
 	/* maximum number of pipelined requests per connection (default = 1) */
 	unsigned int max_pipelined_requests;
+	/* once the peer has shown support for pipelining, fill the pipelines
+	   of the existing connections before creating new ones. this way a
+	   few connections carry many requests, rather than having up to
+	   max_parallel_connections connections with one request each. */
+	bool prefer_pipelining;
 
 	/* don't automatically act upon redirect responses */
 	bool no_auto_redirect;
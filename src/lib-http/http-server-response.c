@@ -584,7 +584,11 @@ static int http_server_response_send_real(struct http_server_response *resp)
 	struct http_server_request *req = resp->request;
 	struct http_server_connection *conn = req->conn;
 	string_t *rtext = t_str_new(256);
-	struct const_iovec iov[3];
+	struct const_iovec iov[4];
+	unsigned int iov_count;
+	const unsigned char *payload_data;
+	size_t payload_data_size = 0, hdr_size;
+	ssize_t sent;
 	uoff_t content_length = 0;
 	bool chunked = FALSE, send_content_length = FALSE, close = FALSE;
 	bool is_head = http_request_method_is(&req->req, "HEAD");
@@ -732,16 +736,40 @@ static int http_server_response_send_real(struct http_server_response *resp)
 	/* End of header */
 	iov[2].iov_base = "\r\n";
 	iov[2].iov_len = 2;
+	iov_count = 3;
+	hdr_size = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+
+	/* Send the part of a fixed-size payload that is already in memory
+	   (e.g. http_server_response_set_payload_data()) along with the
+	   header. The ostream can then writev() it directly without copying
+	   it to its buffer first. */
+	if (resp->payload_input != NULL && !resp->payload_chunked &&
+	    resp->payload_output == conn->conn.output) {
+		payload_data = i_stream_get_data(resp->payload_input,
+						 &payload_data_size);
+		if (payload_data_size > resp->payload_size)
+			payload_data_size = resp->payload_size;
+		if (payload_data_size > 0) {
+			iov[3].iov_base = payload_data;
+			iov[3].iov_len = payload_data_size;
+			iov_count++;
+		}
+	}
 
 	req->state = HTTP_SERVER_REQUEST_STATE_PAYLOAD_OUT;
 	o_stream_cork(conn->conn.output);
 
-	if (o_stream_sendv(conn->conn.output, iov, N_ELEMENTS(iov)) < 0) {
+	if ((sent = o_stream_sendv(conn->conn.output, iov, iov_count)) < 0) {
 		http_server_connection_handle_output_error(conn);
 		return -1;
 	}
 
 	e_debug(resp->event, "Sent header");
+	if (payload_data_size > 0 && (size_t)sent > hdr_size) {
+		e_debug(resp->event, "Sent %zu bytes of payload with header",
+			(size_t)sent - hdr_size);
+		i_stream_skip(resp->payload_input, (size_t)sent - hdr_size);
+	}
 
 	if (resp->payload_stream != NULL)
 		http_server_ostream_output_available(resp->payload_stream);
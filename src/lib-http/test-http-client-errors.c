@@ -3567,6 +3567,192 @@ static void test_idle_hosts(void)
 	test_end();
 }
 
+/*
+ * Prefer pipelining
+ */
+
+/* server */
+
+struct _prefer_pipelining_sctx {
+	unsigned int conn_num;
+};
+
+static unsigned int prefer_pipelining_conn_count = 0;
+
+static int test_prefer_pipelining_init(struct server_connection *conn)
+{
+	struct _prefer_pipelining_sctx *ctx;
+
+	ctx = p_new(conn->pool, struct _prefer_pipelining_sctx, 1);
+	ctx->conn_num = ++prefer_pipelining_conn_count;
+	conn->context = ctx;
+	return 0;
+}
+
+static void test_prefer_pipelining_input(struct server_connection *conn)
+{
+	struct _prefer_pipelining_sctx *ctx = conn->context;
+	const char *line;
+	string_t *resp;
+
+	while ((line = i_stream_read_next_line(conn->conn.input)) != NULL) {
+		if (*line != '\0')
+			continue;
+
+		/* end of request header; answer it and continue with the
+		   next pipelined request */
+		resp = t_str_new(128);
+		str_printfa(resp,
+			    "HTTP/1.1 200 OK\r\n"
+			    "X-Test-Connection: %u\r\n"
+			    "Content-Length: 0\r\n"
+			    "\r\n", ctx->conn_num);
+		o_stream_nsend(conn->conn.output, str_data(resp),
+			       str_len(resp));
+	}
+
+	if (conn->conn.input->stream_errno != 0) {
+		i_fatal("server: Stream error: %s",
+			i_stream_get_error(conn->conn.input));
+	}
+	if (o_stream_flush(conn->conn.output) < 0) {
+		i_fatal("server: Flush error: %s",
+			o_stream_get_error(conn->conn.output));
+	}
+	if (conn->conn.input->eof)
+		server_connection_deinit(&conn);
+}
+
+static void test_server_prefer_pipelining(unsigned int index)
+{
+	test_server_init = test_prefer_pipelining_init;
+	test_server_input = test_prefer_pipelining_input;
+	test_server_run(index);
+}
+
+/* client */
+
+#define PREFER_PIPELINING_REQUESTS 8
+
+struct _prefer_pipelining {
+	struct http_client *client;
+	struct timeout *to;
+	unsigned int count;
+	unsigned int max_conn_num;
+};
+
+static bool test_prefer_pipelining_expect_single;
+
+static void
+test_client_prefer_pipelining_response(const struct http_response *resp,
+				       struct _prefer_pipelining *ctx)
+{
+	const char *value;
+	unsigned int conn_num;
+
+	test_client_assert_response(resp, resp->status == 200);
+
+	value = http_response_header_get(resp, "X-Test-Connection");
+	test_assert(value != NULL && str_to_uint(value, &conn_num) == 0);
+	if (value != NULL && str_to_uint(value, &conn_num) == 0 &&
+	    conn_num > ctx->max_conn_num)
+		ctx->max_conn_num = conn_num;
+
+	if (--ctx->count > 0)
+		return;
+
+	if (test_prefer_pipelining_expect_single) {
+		/* everything was pipelined to the first connection */
+		test_assert(ctx->max_conn_num == 1);
+	} else {
+		/* more connections were created for the requests */
+		test_assert(ctx->max_conn_num > 1);
+	}
+	i_free(ctx);
+	io_loop_stop(ioloop);
+}
+
+static void test_client_prefer_pipelining_stage2(struct _prefer_pipelining *ctx)
+{
+	struct http_client_request *hreq;
+	unsigned int i;
+
+	if (debug)
+		i_debug("STAGE 2");
+
+	timeout_remove(&ctx->to);
+
+	ctx->count = PREFER_PIPELINING_REQUESTS;
+	for (i = 0; i < PREFER_PIPELINING_REQUESTS; i++) {
+		hreq = http_client_request(
+			ctx->client, "GET", net_ip2addr(&bind_ip),
+			t_strdup_printf("/prefer-pipelining-stage2-%u.txt", i),
+			test_client_prefer_pipelining_response, ctx);
+		http_client_request_set_port(hreq, bind_ports[0]);
+		http_client_request_submit(hreq);
+	}
+}
+
+static void
+test_client_prefer_pipelining_response_stage1(const struct http_response *resp,
+					      struct _prefer_pipelining *ctx)
+{
+	test_client_assert_response(resp, resp->status == 200);
+
+	/* the connection has now shown pipelining support; continue once
+	   it has become idle again */
+	ctx->to = timeout_add_short(
+		50, test_client_prefer_pipelining_stage2, ctx);
+}
+
+static bool
+test_client_prefer_pipelining(const struct http_client_settings *client_set)
+{
+	struct http_client_request *hreq;
+	struct _prefer_pipelining *ctx;
+
+	if (debug)
+		i_debug("STAGE 1");
+
+	ctx = i_new(struct _prefer_pipelining, 1);
+	ctx->client = http_client = http_client_init(client_set);
+
+	hreq = http_client_request(
+		ctx->client, "GET", net_ip2addr(&bind_ip),
+		"/prefer-pipelining-stage1.txt",
+		test_client_prefer_pipelining_response_stage1, ctx);
+	http_client_request_set_port(hreq, bind_ports[0]);
+	http_client_request_submit(hreq);
+
+	return TRUE;
+}
+
+/* test */
+
+static void test_prefer_pipelining(void)
+{
+	struct http_client_settings http_client_set;
+
+	test_client_defaults(&http_client_set);
+	http_client_set.max_parallel_connections = PREFER_PIPELINING_REQUESTS;
+	http_client_set.max_pipelined_requests = PREFER_PIPELINING_REQUESTS;
+
+	test_begin("prefer pipelining (disabled)");
+	test_prefer_pipelining_expect_single = FALSE;
+	test_run_client_server(&http_client_set,
+			       test_client_prefer_pipelining,
+			       test_server_prefer_pipelining, 1, NULL);
+	test_end();
+
+	test_begin("prefer pipelining (enabled)");
+	http_client_set.prefer_pipelining = TRUE;
+	test_prefer_pipelining_expect_single = TRUE;
+	test_run_client_server(&http_client_set,
+			       test_client_prefer_pipelining,
+			       test_server_prefer_pipelining, 1, NULL);
+	test_end();
+}
+
 /*
  * All tests
  */
@@ -3603,6 +3789,7 @@ static void (*const test_functions[])(void) = {
 	test_multi_ip_attempts,
 	test_idle_connections,
 	test_idle_hosts,
+	test_prefer_pipelining,
 	NULL
 };
 
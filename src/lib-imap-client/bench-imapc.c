@@ -0,0 +1,497 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "ostream.h"
+#include "hostpid.h"
+#include "str.h"
+#include "strescape.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "imapc-client.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/**
+ * Runs an IMAP workload against a running server and reports the throughput
+ * and latency percentiles of each command.
+ *
+ * Each session is run in a separate process with its own connection. A
+ * session logs in, opens the mailbox and then runs the given steps (by
+ * default SELECT, FETCH ENVELOPE, SEARCH, SORT and APPEND) the given number
+ * of times. The "envelope" step runs a plain FETCH 1:* ENVELOPE, which is
+ * what most clients send when opening a folder. The latency of each command is measured from sending it until
+ * its tagged reply is received. The throughput is calculated against the
+ * wall clock time of the whole run, so it's the total throughput of all the
+ * concurrent sessions.
+ *
+ * The APPEND step adds messages to the mailbox, so a test user should be
+ * used. A username containing "%d" is expanded to the session number, so
+ * each session can use a different user.
+ */
+
+#define BENCH_DEFAULT_HOST "127.0.0.1"
+#define BENCH_DEFAULT_PORT 143
+#define BENCH_DEFAULT_MAILBOX "INBOX"
+#define BENCH_DEFAULT_STEPS "select,fetch,search,sort,append"
+#define BENCH_DEFAULT_APPEND_SIZE 4096
+
+enum bench_output_format {
+	BENCH_OUTPUT_FORMAT_TEXT,
+	BENCH_OUTPUT_FORMAT_JSON,
+};
+
+enum bench_step_type {
+	BENCH_STEP_LOGIN,
+	BENCH_STEP_SELECT,
+	BENCH_STEP_FETCH,
+	BENCH_STEP_ENVELOPE,
+	BENCH_STEP_SEARCH,
+	BENCH_STEP_SORT,
+	BENCH_STEP_APPEND,
+	BENCH_STEP_NOOP,
+
+	BENCH_STEP_COUNT
+};
+
+static const char *const bench_step_names[BENCH_STEP_COUNT] = {
+	"login",
+	"select",
+	"fetch",
+	"envelope",
+	"search",
+	"sort",
+	"append",
+	"noop",
+};
+
+struct bench_result {
+	unsigned int errors;
+	ARRAY_TYPE(uint64_t) usecs;
+};
+
+struct bench_session {
+	struct imapc_client *client;
+	struct imapc_client_mailbox *box;
+	enum imapc_command_state last_state;
+	struct ostream *output;
+};
+
+static enum bench_output_format bench_output_format = BENCH_OUTPUT_FORMAT_TEXT;
+static struct imapc_client_settings bench_client_set = {
+	.host = BENCH_DEFAULT_HOST,
+	.port = BENCH_DEFAULT_PORT,
+	.dns_client_socket_path = "",
+	.temp_path_prefix = "/tmp/bench-imapc-temp.",
+	.rawlog_dir = "",
+	.max_idle_time = IMAPC_DEFAULT_MAX_IDLE_TIME,
+};
+static const char *bench_mailbox = BENCH_DEFAULT_MAILBOX;
+static ARRAY(enum bench_step_type) bench_steps;
+static buffer_t *bench_append_msg;
+
+static void
+bench_callback(const struct imapc_command_reply *reply, void *context)
+{
+	struct bench_session *session = context;
+
+	session->last_state = reply->state;
+	if (reply->state != IMAPC_COMMAND_STATE_OK)
+		i_error("Command failed: %s", reply->text_full);
+	imapc_client_stop(session->client);
+}
+
+static void
+bench_session_record(struct bench_session *session,
+		     enum bench_step_type step, const struct timeval *start)
+{
+	struct timeval end;
+
+	i_gettimeofday(&end);
+	o_stream_nsend_str(session->output, t_strdup_printf("%s\t%d\t%lld\n",
+		bench_step_names[step],
+		session->last_state == IMAPC_COMMAND_STATE_OK ? 1 : 0,
+		timeval_diff_usecs(&end, start)));
+}
+
+static void
+bench_session_step(struct bench_session *session, enum bench_step_type step)
+{
+	struct imapc_command *cmd;
+	struct istream *input;
+	struct timeval start;
+
+	if (step == BENCH_STEP_APPEND || step == BENCH_STEP_NOOP)
+		cmd = imapc_client_cmd(session->client, bench_callback, session);
+	else {
+		cmd = imapc_client_mailbox_cmd(session->box, bench_callback,
+					       session);
+	}
+
+	i_gettimeofday(&start);
+	switch (step) {
+	case BENCH_STEP_SELECT:
+		imapc_command_set_flags(cmd, IMAPC_COMMAND_FLAG_SELECT);
+		imapc_command_sendf(cmd, "SELECT %s", bench_mailbox);
+		break;
+	case BENCH_STEP_FETCH:
+		imapc_command_send(cmd, "UID FETCH 1:* (UID FLAGS ENVELOPE)");
+		break;
+	case BENCH_STEP_ENVELOPE:
+		imapc_command_send(cmd, "FETCH 1:* ENVELOPE");
+		break;
+	case BENCH_STEP_SEARCH:
+		imapc_command_send(cmd, "UID SEARCH SUBJECT \"bench\"");
+		break;
+	case BENCH_STEP_SORT:
+		imapc_command_send(cmd, "UID SORT (REVERSE ARRIVAL) UTF-8 ALL");
+		break;
+	case BENCH_STEP_APPEND:
+		input = i_stream_create_from_data(bench_append_msg->data,
+						  bench_append_msg->used);
+		imapc_command_sendf(cmd, "APPEND %s %p", bench_mailbox, input);
+		i_stream_unref(&input);
+		break;
+	case BENCH_STEP_NOOP:
+		imapc_command_send(cmd, "NOOP");
+		break;
+	case BENCH_STEP_LOGIN:
+	case BENCH_STEP_COUNT:
+		i_unreached();
+	}
+	imapc_client_run(session->client);
+	bench_session_record(session, step, &start);
+}
+
+static const char *bench_session_username(const char *username,
+					  unsigned int session_idx)
+{
+	const char *p = strstr(username, "%d");
+
+	if (p == NULL)
+		return username;
+	return t_strdup_printf("%s%u%s", t_strdup_until(username, p),
+			       session_idx, p + 2);
+}
+
+static void
+bench_session_run(unsigned int session_idx, unsigned int iterations,
+		  const char *path)
+{
+	struct imapc_client_settings set = bench_client_set;
+	struct bench_session session;
+	const enum bench_step_type *step;
+	struct ioloop *ioloop;
+	struct timeval start;
+
+	i_zero(&session);
+	session.output = o_stream_create_file(path, 0, 0600, 0);
+	if (session.output->stream_errno != 0) {
+		i_fatal("creat(%s) failed: %s", path,
+			o_stream_get_error(session.output));
+	}
+	o_stream_cork(session.output);
+
+	set.username = bench_session_username(set.username, session_idx);
+	ioloop = io_loop_create();
+	session.client = imapc_client_init(&set, NULL);
+
+	i_gettimeofday(&start);
+	imapc_client_set_login_callback(session.client, bench_callback,
+					&session);
+	imapc_client_login(session.client);
+	imapc_client_run(session.client);
+	bench_session_record(&session, BENCH_STEP_LOGIN, &start);
+
+	if (session.last_state == IMAPC_COMMAND_STATE_OK) {
+		session.box = imapc_client_mailbox_open(session.client, NULL);
+		for (unsigned int i = 0; i < iterations; i++) {
+			array_foreach(&bench_steps, step) T_BEGIN {
+				bench_session_step(&session, *step);
+			} T_END;
+		}
+		imapc_client_mailbox_close(&session.box);
+		imapc_client_logout(session.client);
+	}
+	imapc_client_deinit(&session.client);
+	io_loop_destroy(&ioloop);
+
+	if (o_stream_finish(session.output) < 0) {
+		i_fatal("write(%s) failed: %s", path,
+			o_stream_get_error(session.output));
+	}
+	o_stream_unref(&session.output);
+}
+
+static void
+bench_results_read(struct bench_result *results, const char *path)
+{
+	struct istream *input;
+	const char *line, *const *args;
+	uint64_t usecs;
+	unsigned int i;
+
+	input = i_stream_create_file(path, IO_BLOCK_SIZE);
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		args = t_strsplit_tabescaped(line);
+		if (str_array_length(args) != 3 ||
+		    str_to_uint64(args[2], &usecs) < 0)
+			i_fatal("%s: Invalid line: %s", path, line);
+		for (i = 0; i < BENCH_STEP_COUNT; i++) {
+			if (strcmp(bench_step_names[i], args[0]) == 0)
+				break;
+		}
+		if (i == BENCH_STEP_COUNT)
+			i_fatal("%s: Unknown step: %s", path, args[0]);
+
+		if (strcmp(args[1], "1") != 0)
+			results[i].errors++;
+		array_push_back(&results[i].usecs, &usecs);
+	}
+	if (input->stream_errno != 0) {
+		i_fatal("read(%s) failed: %s", path,
+			i_stream_get_error(input));
+	}
+	i_stream_unref(&input);
+}
+
+static int uint64_cmp(const uint64_t *n1, const uint64_t *n2)
+{
+	return *n1 < *n2 ? -1 : (*n1 > *n2 ? 1 : 0);
+}
+
+static double bench_usecs_percentile_msecs(const ARRAY_TYPE(uint64_t) *usecs,
+					   unsigned int percentile)
+{
+	const uint64_t *values;
+	unsigned int count;
+
+	values = array_get(usecs, &count);
+	i_assert(count > 0);
+	return values[(count - 1) * percentile / 100] / 1000.0;
+}
+
+static void
+bench_results_print(struct bench_result *results, long long total_usecs)
+{
+	unsigned int count;
+	uint64_t sum;
+	double avg, ops;
+	bool first = TRUE;
+
+	if (bench_output_format == BENCH_OUTPUT_FORMAT_JSON)
+		printf("[\n");
+	else {
+		printf("%-8s %8s %7s %10s %9s %9s %9s %9s %9s\n", "command",
+		       "count", "errors", "ops/s", "avg ms", "p50 ms",
+		       "p90 ms", "p99 ms", "max ms");
+	}
+	for (unsigned int i = 0; i < BENCH_STEP_COUNT; i++) {
+		count = array_count(&results[i].usecs);
+		if (count == 0)
+			continue;
+		array_sort(&results[i].usecs, uint64_cmp);
+
+		sum = 0;
+		for (unsigned int j = 0; j < count; j++)
+			sum += array_idx_elem(&results[i].usecs, j);
+		avg = sum / 1000.0 / count;
+		ops = total_usecs == 0 ? 0 : count * 1000000.0 / total_usecs;
+
+		switch (bench_output_format) {
+		case BENCH_OUTPUT_FORMAT_TEXT:
+			printf("%-8s %8u %7u %10.1lf %9.3lf %9.3lf %9.3lf "
+			       "%9.3lf %9.3lf\n", bench_step_names[i], count,
+			       results[i].errors, ops, avg,
+			       bench_usecs_percentile_msecs(&results[i].usecs, 50),
+			       bench_usecs_percentile_msecs(&results[i].usecs, 90),
+			       bench_usecs_percentile_msecs(&results[i].usecs, 99),
+			       bench_usecs_percentile_msecs(&results[i].usecs, 100));
+			break;
+		case BENCH_OUTPUT_FORMAT_JSON:
+			printf("%s{\"command\":\"%s\",\"count\":%u,"
+			       "\"errors\":%u,\"ops_per_sec\":%.1lf,"
+			       "\"avg_ms\":%.3lf,\"p50_ms\":%.3lf,"
+			       "\"p90_ms\":%.3lf,\"p99_ms\":%.3lf,"
+			       "\"max_ms\":%.3lf}",
+			       first ? "" : ",\n", bench_step_names[i], count,
+			       results[i].errors, ops, avg,
+			       bench_usecs_percentile_msecs(&results[i].usecs, 50),
+			       bench_usecs_percentile_msecs(&results[i].usecs, 90),
+			       bench_usecs_percentile_msecs(&results[i].usecs, 99),
+			       bench_usecs_percentile_msecs(&results[i].usecs, 100));
+			break;
+		}
+		first = FALSE;
+	}
+	if (bench_output_format == BENCH_OUTPUT_FORMAT_JSON)
+		printf("\n]\n");
+	else
+		printf("\nTotal time: %.3lf secs\n", total_usecs / 1000000.0);
+}
+
+static void bench_run(unsigned int sessions, unsigned int iterations)
+{
+	struct bench_result results[BENCH_STEP_COUNT];
+	struct timeval start, end;
+	const char *path_prefix, *path;
+	unsigned int i;
+	int status;
+	pid_t pid;
+
+	path_prefix = t_strdup_printf("/tmp/bench-imapc.%s.", my_pid);
+
+	i_gettimeofday(&start);
+	for (i = 0; i < sessions; i++) {
+		if ((pid = fork()) < 0)
+			i_fatal("fork() failed: %m");
+		if (pid == 0) {
+			bench_session_run(i + 1, iterations, t_strdup_printf(
+				"%s%u", path_prefix, i + 1));
+			lib_exit(0);
+		}
+	}
+	for (i = 0; i < sessions; i++) {
+		if (wait(&status) < 0)
+			i_fatal("wait() failed: %m");
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			i_error("Session process failed with status %d", status);
+	}
+	i_gettimeofday(&end);
+
+	i_zero(&results);
+	for (i = 0; i < BENCH_STEP_COUNT; i++)
+		i_array_init(&results[i].usecs, 128);
+	for (i = 0; i < sessions; i++) T_BEGIN {
+		path = t_strdup_printf("%s%u", path_prefix, i + 1);
+		bench_results_read(results, path);
+		i_unlink(path);
+	} T_END;
+
+	bench_results_print(results, timeval_diff_usecs(&end, &start));
+	for (i = 0; i < BENCH_STEP_COUNT; i++)
+		array_free(&results[i].usecs);
+}
+
+static void bench_append_msg_init(size_t size)
+{
+	size_t line_len;
+
+	bench_append_msg = buffer_create_dynamic(default_pool, size + 256);
+	str_printfa(bench_append_msg,
+		    "From: bench@example.com\r\n"
+		    "To: bench@example.com\r\n"
+		    "Subject: bench message\r\n"
+		    "Date: Thu, 1 Jan 2026 00:00:00 +0000\r\n"
+		    "Message-ID: <bench.%s@example.com>\r\n"
+		    "\r\n", my_pid);
+	while (bench_append_msg->used < size) {
+		line_len = I_MIN(size - bench_append_msg->used, 76);
+		for (size_t i = 0; i < line_len; i++)
+			str_append_c(bench_append_msg, 'a' + i % 26);
+		str_append(bench_append_msg, "\r\n");
+	}
+}
+
+static void bench_steps_parse(const char *steps)
+{
+	const char *const *names = t_strsplit(steps, ",");
+	enum bench_step_type step;
+
+	for (; *names != NULL; names++) {
+		for (step = BENCH_STEP_SELECT; step < BENCH_STEP_COUNT; step++) {
+			if (strcmp(bench_step_names[step], *names) == 0)
+				break;
+		}
+		if (step == BENCH_STEP_COUNT)
+			i_fatal("Unknown step: %s", *names);
+		array_push_back(&bench_steps, &step);
+	}
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s -u <user> -w <password> [-h <host>] "
+		"[-p <port>] [-c <sessions>] [-n <iterations>] "
+		"[-m <mailbox>] [-s <step>[,<step>...]] [-a <append size>] "
+		"[-f text|json]\n", prog);
+	fprintf(stderr, "Steps: select, fetch, envelope, search, sort, append, "
+		"noop (default: "BENCH_DEFAULT_STEPS")\n");
+	fprintf(stderr, "Username may contain %%d, which is replaced with "
+		"the session number\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned int sessions = 1, iterations = 10;
+	unsigned int append_size = BENCH_DEFAULT_APPEND_SIZE;
+	const char *steps = BENCH_DEFAULT_STEPS;
+	int c;
+
+	lib_init();
+	i_array_init(&bench_steps, 8);
+
+	while ((c = getopt(argc, (char **)argv, "a:c:f:h:m:n:p:s:u:w:")) > 0) {
+		switch (c) {
+		case 'a':
+			if (str_to_uint(optarg, &append_size) < 0)
+				print_usage(argv[0]);
+			break;
+		case 'c':
+			if (str_to_uint(optarg, &sessions) < 0 || sessions == 0)
+				print_usage(argv[0]);
+			break;
+		case 'f':
+			if (strcmp(optarg, "text") == 0)
+				bench_output_format = BENCH_OUTPUT_FORMAT_TEXT;
+			else if (strcmp(optarg, "json") == 0)
+				bench_output_format = BENCH_OUTPUT_FORMAT_JSON;
+			else
+				print_usage(argv[0]);
+			break;
+		case 'h':
+			bench_client_set.host = optarg;
+			break;
+		case 'm':
+			bench_mailbox = optarg;
+			break;
+		case 'n':
+			if (str_to_uint(optarg, &iterations) < 0)
+				print_usage(argv[0]);
+			break;
+		case 'p':
+			if (net_str2port(optarg, &bench_client_set.port) < 0)
+				print_usage(argv[0]);
+			break;
+		case 's':
+			steps = optarg;
+			break;
+		case 'u':
+			bench_client_set.username = optarg;
+			break;
+		case 'w':
+			bench_client_set.password = optarg;
+			break;
+		default:
+			print_usage(argv[0]);
+		}
+	}
+	if (optind != argc || bench_client_set.username == NULL ||
+	    bench_client_set.password == NULL)
+		print_usage(argv[0]);
+
+	bench_steps_parse(steps);
+	bench_append_msg_init(append_size);
+	bench_run(sessions, iterations);
+
+	buffer_free(&bench_append_msg);
+	array_free(&bench_steps);
+	lib_deinit();
+	return 0;
+}
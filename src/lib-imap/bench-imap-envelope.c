@@ -0,0 +1,137 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "istream.h"
+#include "str.h"
+#include "message-parser.h"
+#include "message-part-data.h"
+#include "imap-envelope.h"
+#include "bench-common.h"
+
+/**
+ * Micro-benchmarks for the work FETCH ENVELOPE does for each message. When
+ * the envelope isn't cached yet, the headers are parsed into a
+ * message_part_envelope, which is then written in IMAP format. A cached
+ * imap.envelope is sent as-is, but it's parsed back when the envelope
+ * fields are needed for e.g. SORT or the imapc backend.
+ *
+ * The whole FETCH 1:* ENVELOPE command can be benchmarked against a running
+ * server with "bench-imapc -s envelope".
+ */
+
+#define BENCH_ENVELOPE_MESSAGE \
+	"Message-ID: <1234567890.abcdef@mail.example.com>\n" \
+	"In-Reply-To: <0987654321.fedcba@mail.example.org>\n" \
+	"Date: Thu, 15 Feb 2007 01:02:03 +0200\n" \
+	"Subject: Re: [list] Quarterly \"status\" report for the project\n" \
+	"From: \"Sender, Real\" <sender.user@example.com>\n" \
+	"To: First Recipient <first@example.org>, second@example.org,\n" \
+	" \"Third \\\"Quoted\\\" Recipient\" <third@example.net>\n" \
+	"Cc: list: member1@example.com, member2@example.com;\n" \
+	"Reply-To: list@lists.example.com\n" \
+	"\n" \
+	"body\n"
+
+struct bench_envelope_context {
+	pool_t pool;
+	struct message_part_envelope *envelope;
+	string_t *str;
+	const char *imap_envelope;
+};
+
+static struct message_part_envelope *
+bench_envelope_parse_message(pool_t pool, const char *message)
+{
+	const struct message_parser_settings parser_set = {
+		.hdr_flags = MESSAGE_HEADER_PARSER_FLAG_SKIP_INITIAL_LWSP |
+			MESSAGE_HEADER_PARSER_FLAG_DROP_CR,
+		.flags = MESSAGE_PARSER_FLAG_SKIP_BODY_BLOCK,
+	};
+	struct message_parser_ctx *parser;
+	struct message_part_envelope *envlp = NULL;
+	struct istream *input;
+	struct message_block block;
+	struct message_part *parts;
+
+	input = i_stream_create_from_data(message, strlen(message));
+	parser = message_parser_init(pool, input, &parser_set);
+	while (message_parser_parse_next_block(parser, &block) > 0)
+		message_part_envelope_parse_from_header(pool, &envlp, block.hdr);
+	message_parser_deinit(&parser, &parts);
+	i_stream_unref(&input);
+	return envlp;
+}
+
+static void
+bench_envelope_from_header(struct bench_envelope_context *ctx,
+			   unsigned int iterations)
+{
+	for (unsigned int i = 0; i < iterations; i++) {
+		p_clear(ctx->pool);
+		bench_use_ptr(bench_envelope_parse_message(ctx->pool,
+			BENCH_ENVELOPE_MESSAGE));
+	}
+}
+
+static void bench_envelope_write(struct bench_envelope_context *ctx,
+				 unsigned int iterations)
+{
+	for (unsigned int i = 0; i < iterations; i++) {
+		str_truncate(ctx->str, 0);
+		imap_envelope_write(ctx->envelope, ctx->str);
+	}
+	bench_use(str_len(ctx->str));
+}
+
+static void bench_envelope_parse(struct bench_envelope_context *ctx,
+				 unsigned int iterations)
+{
+	struct message_part_envelope *envlp;
+	const char *error;
+
+	for (unsigned int i = 0; i < iterations; i++) {
+		p_clear(ctx->pool);
+		if (!imap_envelope_parse(ctx->imap_envelope, ctx->pool,
+					 &envlp, &error))
+			i_fatal("imap_envelope_parse() failed: %s", error);
+		bench_use_ptr(envlp);
+	}
+}
+
+static void bench_imap_envelope(void)
+{
+	struct bench_envelope_context ctx;
+	pool_t envelope_pool;
+	size_t envelope_len;
+
+	i_zero(&ctx);
+	ctx.pool = pool_alloconly_create("bench envelope", 4096);
+	envelope_pool = pool_alloconly_create("bench envelope parsed", 4096);
+	ctx.envelope = bench_envelope_parse_message(envelope_pool,
+						    BENCH_ENVELOPE_MESSAGE);
+	ctx.str = str_new(default_pool, 1024);
+	imap_envelope_write(ctx.envelope, ctx.str);
+	ctx.imap_envelope = p_strdup(envelope_pool, str_c(ctx.str));
+	envelope_len = strlen(ctx.imap_envelope);
+
+	bench_run("envelope/from header",
+		  sizeof(BENCH_ENVELOPE_MESSAGE) - 1,
+		  bench_envelope_from_header, &ctx);
+	bench_run("envelope/write", envelope_len,
+		  bench_envelope_write, &ctx);
+	bench_run("envelope/parse", envelope_len,
+		  bench_envelope_parse, &ctx);
+
+	str_free(&ctx.str);
+	pool_unref(&envelope_pool);
+	pool_unref(&ctx.pool);
+}
+
+int main(int argc, const char *argv[])
+{
+	static void (*const bench_functions[])(void) = {
+		bench_imap_envelope,
+		NULL
+	};
+	return bench_main(argc, argv, bench_functions);
+}
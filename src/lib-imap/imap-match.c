@@ -9,15 +9,32 @@
 
 #include <ctype.h>
 
+/* Index the patterns by their first character when there are at least
+   this many of them. */
+#define IMAP_MATCH_CHAR_INDEX_MIN_PATTERNS 8
+/* One bucket for each character + one for patterns that must always be
+   checked */
+#define IMAP_MATCH_CHAR_BUCKETS (256 + 1)
+#define IMAP_MATCH_CHAR_BUCKET_ALWAYS 256
+
 struct imap_match_pattern {
 	const char *pattern;
 	bool inboxcase;
 };
 
+struct imap_match_char_index {
+	/* Indexes of the patterns that can match a name beginning with
+	   character c are in idx[offsets[c] .. offsets[c+1]-1]. Patterns
+	   beginning with a wildcard are in the ALWAYS bucket. */
+	unsigned int offsets[IMAP_MATCH_CHAR_BUCKETS + 1];
+	unsigned int idx[FLEXIBLE_ARRAY_MEMBER];
+};
+
 struct imap_match_glob {
 	pool_t pool;
 
 	struct imap_match_pattern *patterns;
+	struct imap_match_char_index *char_index;
 
 	char sep;
 	char patterns_data[FLEXIBLE_ARRAY_MEMBER];
@@ -108,6 +125,61 @@ static bool pattern_is_inboxcase(const char *pattern, char separator)
 	return TRUE;
 }
 
+static unsigned int
+pattern_get_char_buckets(const struct imap_match_pattern *pattern,
+			 unsigned int buckets_r[2])
+{
+	unsigned char c = pattern->pattern[0];
+
+	if (c == '*' || c == '%' || c == '\0') {
+		/* an empty pattern can still match the name's children */
+		buckets_r[0] = IMAP_MATCH_CHAR_BUCKET_ALWAYS;
+		return 1;
+	}
+	buckets_r[0] = c;
+	if (!pattern->inboxcase || i_toupper(c) == i_tolower(c))
+		return 1;
+	/* the INBOX prefix is matched case-insensitively */
+	buckets_r[0] = (unsigned char)i_toupper(c);
+	buckets_r[1] = (unsigned char)i_tolower(c);
+	return 2;
+}
+
+static void imap_match_init_char_index(struct imap_match_glob *glob,
+				       unsigned int patterns_count)
+{
+	struct imap_match_char_index *char_index;
+	unsigned int counts[IMAP_MATCH_CHAR_BUCKETS];
+	unsigned int i, j, n, buckets[2], total = 0;
+
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < patterns_count; i++) {
+		n = pattern_get_char_buckets(&glob->patterns[i], buckets);
+		for (j = 0; j < n; j++)
+			counts[buckets[j]]++;
+		total += n;
+	}
+
+	char_index = p_malloc(glob->pool, sizeof(*char_index) +
+			      sizeof(char_index->idx[0]) * total);
+	for (i = 0, n = 0; i < IMAP_MATCH_CHAR_BUCKETS; i++) {
+		char_index->offsets[i] = n;
+		n += counts[i];
+	}
+	char_index->offsets[i] = n;
+
+	/* fill the buckets, keeping the patterns in their original order */
+	memset(counts, 0, sizeof(counts));
+	for (i = 0; i < patterns_count; i++) {
+		n = pattern_get_char_buckets(&glob->patterns[i], buckets);
+		for (j = 0; j < n; j++) {
+			char_index->idx[char_index->offsets[buckets[j]] +
+					counts[buckets[j]]++] = i;
+		}
+	}
+	glob->char_index = char_index;
+}
+
 static struct imap_match_glob *
 imap_match_init_multiple_real(pool_t pool, const char *const *patterns,
 			      bool inboxcase, char separator)
@@ -150,6 +222,9 @@ imap_match_init_multiple_real(pool_t pool, const char *const *patterns,
 		pos += len;
 	}
 	glob->patterns = match_patterns;
+
+	if (patterns_count >= IMAP_MATCH_CHAR_INDEX_MIN_PATTERNS)
+		imap_match_init_char_index(glob, patterns_count);
 	return glob;
 }
 
@@ -174,6 +249,7 @@ void imap_match_deinit(struct imap_match_glob **glob)
 {
 	if (glob == NULL || *glob == NULL)
 		return;
+	p_free((*glob)->pool, (*glob)->char_index);
 	p_free((*glob)->pool, (*glob)->patterns);
 	p_free((*glob)->pool, *glob);
 	*glob = NULL;
@@ -359,24 +435,61 @@ imap_match_pattern(struct imap_match_context *ctx,
 		IMAP_MATCH_YES : match;
 }
 
+static bool
+imap_match_idx(struct imap_match_glob *glob, struct imap_match_context *ctx,
+	       unsigned int idx, const char *data,
+	       enum imap_match_result *match)
+{
+	enum imap_match_result ret;
+
+	ctx->inboxcase = glob->patterns[idx].inboxcase;
+	ret = imap_match_pattern(ctx, data, glob->patterns[idx].pattern);
+	if (ret == IMAP_MATCH_YES)
+		return TRUE;
+	*match |= ret;
+	return FALSE;
+}
+
+static bool
+imap_match_char_bucket(struct imap_match_glob *glob,
+		       struct imap_match_context *ctx, unsigned int bucket,
+		       const char *data, enum imap_match_result *match)
+{
+	const struct imap_match_char_index *char_index = glob->char_index;
+	unsigned int i;
+
+	for (i = char_index->offsets[bucket];
+	     i < char_index->offsets[bucket+1]; i++) {
+		if (imap_match_idx(glob, ctx, char_index->idx[i], data, match))
+			return TRUE;
+	}
+	return FALSE;
+}
+
 enum imap_match_result
 imap_match(struct imap_match_glob *glob, const char *data)
 {
 	struct imap_match_context ctx;
 	unsigned int i;
-	enum imap_match_result ret, match;
+	enum imap_match_result match;
 
 	match = IMAP_MATCH_NO;
 	ctx.sep = glob->sep;
-	for (i = 0; glob->patterns[i].pattern != NULL; i++) {
-		ctx.inboxcase = glob->patterns[i].inboxcase;
-
-		ret = imap_match_pattern(&ctx, data, glob->patterns[i].pattern);
-		if (ret == IMAP_MATCH_YES)
+	if (glob->char_index != NULL && data[0] != '\0') {
+		/* a pattern beginning with a different character can't match
+		   the name or its children */
+		if (imap_match_char_bucket(glob, &ctx,
+					   IMAP_MATCH_CHAR_BUCKET_ALWAYS,
+					   data, &match) ||
+		    imap_match_char_bucket(glob, &ctx, (unsigned char)data[0],
+					   data, &match))
 			return IMAP_MATCH_YES;
-
-		match |= ret;
+		return match;
 	}
 
+	for (i = 0; glob->patterns[i].pattern != NULL; i++) {
+		if (imap_match_idx(glob, &ctx, i, data, &match))
+			return IMAP_MATCH_YES;
+	}
 	return match;
 }
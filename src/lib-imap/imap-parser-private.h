@@ -0,0 +1,24 @@
+#ifndef IMAP_PARSER_PRIVATE_H
+#define IMAP_PARSER_PRIVATE_H
+
+enum imap_parser_scan_impl {
+	IMAP_PARSER_SCAN_IMPL_SCALAR = 0,
+	IMAP_PARSER_SCAN_IMPL_SSE2,
+	IMAP_PARSER_SCAN_IMPL_AVX2,
+};
+
+/* Returns the number of plain atom characters at the beginning of the data,
+   i.e. the position of the first control, space, '"', '(', ')', '{', DEL or
+   8bit character. Returns size if there are none. */
+size_t imap_parser_scan_atom(const unsigned char *data, size_t size);
+/* Returns the number of plain quoted string characters at the beginning of
+   the data, i.e. the position of the first NUL, CR, LF, '"' or '\\'.
+   Returns size if there are none. */
+size_t imap_parser_scan_string(const unsigned char *data, size_t size);
+
+/* Use the given implementation instead of the best one supported by the CPU.
+   Returns FALSE if the CPU doesn't support it. This is intended for unit
+   tests and benchmarks. */
+bool imap_parser_scan_set_impl(enum imap_parser_scan_impl impl);
+
+#endif
@@ -0,0 +1,248 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "imap-parser-private.h"
+
+/* Atoms and quoted strings are scanned for the characters that need to be
+   looked at more closely by the parser. The SIMD versions compare 16 (SSE2)
+   or 32 (AVX2) bytes at a time and find the first special character with a
+   single bit scan. The implementation is picked at runtime in the same way
+   as the lib's base64, UTF-8 and JSON SIMD code. */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(__GNUC__ >= 5 || defined(__clang__))
+#  define IMAP_PARSER_SCAN_X86
+#  include <immintrin.h>
+#  define IMAP_PARSER_TARGET_SSE2 __attribute__((target("sse2")))
+#  define IMAP_PARSER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define IMAP_PARSER_CHAR_ATOM_SPECIAL 0x01
+#define IMAP_PARSER_CHAR_STRING_SPECIAL 0x02
+static const unsigned char imap_parser_chars[256] = {
+	3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 3, 1, 1, 3, 1, 1, /* 0-15 */
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, /* 16-31 */
+	1, 0, 3, 0, 0, 0, 0, 0, 1, 1, 0, 0, 0, 0, 0, 0, /* 32-47 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 48-63 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 64-79 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 0, 0, /* 80-95 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, /* 96-111 */
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 1, /* 112-127 */
+
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1
+};
+
+static size_t (*imap_parser_scan_atom_func)(const unsigned char *data,
+					    size_t size) = NULL;
+static size_t (*imap_parser_scan_string_func)(const unsigned char *data,
+					      size_t size) = NULL;
+
+static size_t
+imap_parser_scan_atom_scalar(const unsigned char *data, size_t size)
+{
+	size_t pos;
+
+	for (pos = 0; pos < size; pos++) {
+		if ((imap_parser_chars[data[pos]] &
+		     IMAP_PARSER_CHAR_ATOM_SPECIAL) != 0)
+			break;
+	}
+	return pos;
+}
+
+static size_t
+imap_parser_scan_string_scalar(const unsigned char *data, size_t size)
+{
+	size_t pos;
+
+	for (pos = 0; pos < size; pos++) {
+		if ((imap_parser_chars[data[pos]] &
+		     IMAP_PARSER_CHAR_STRING_SPECIAL) != 0)
+			break;
+	}
+	return pos;
+}
+
+#ifdef IMAP_PARSER_SCAN_X86
+
+static IMAP_PARSER_TARGET_SSE2 size_t
+imap_parser_scan_atom_sse2(const unsigned char *data, size_t size)
+{
+	/* signed comparison: both 0..32 and 8bit chars are less than 33 */
+	const __m128i min_plain = _mm_set1_epi8(33);
+	const __m128i quotes = _mm_set1_epi8('"');
+	const __m128i lparens = _mm_set1_epi8('(');
+	const __m128i rparens = _mm_set1_epi8(')');
+	const __m128i braces = _mm_set1_epi8('{');
+	const __m128i dels = _mm_set1_epi8(0x7f);
+	__m128i in, special;
+	unsigned int mask;
+	size_t pos;
+
+	for (pos = 0; pos + 16 <= size; pos += 16) {
+		in = _mm_loadu_si128((const void *)(data + pos));
+		special = _mm_or_si128(
+			_mm_or_si128(_mm_cmplt_epi8(in, min_plain),
+				     _mm_cmpeq_epi8(in, quotes)),
+			_mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(in, lparens),
+					     _mm_cmpeq_epi8(in, rparens)),
+				_mm_or_si128(_mm_cmpeq_epi8(in, braces),
+					     _mm_cmpeq_epi8(in, dels))));
+		mask = _mm_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos + imap_parser_scan_atom_scalar(data + pos, size - pos);
+}
+
+static IMAP_PARSER_TARGET_SSE2 size_t
+imap_parser_scan_string_sse2(const unsigned char *data, size_t size)
+{
+	const __m128i zeros = _mm_setzero_si128();
+	const __m128i crs = _mm_set1_epi8('\r');
+	const __m128i lfs = _mm_set1_epi8('\n');
+	const __m128i quotes = _mm_set1_epi8('"');
+	const __m128i backslashes = _mm_set1_epi8('\\');
+	__m128i in, special;
+	unsigned int mask;
+	size_t pos;
+
+	for (pos = 0; pos + 16 <= size; pos += 16) {
+		in = _mm_loadu_si128((const void *)(data + pos));
+		special = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(in, zeros),
+				     _mm_or_si128(_mm_cmpeq_epi8(in, crs),
+						  _mm_cmpeq_epi8(in, lfs))),
+			_mm_or_si128(_mm_cmpeq_epi8(in, quotes),
+				     _mm_cmpeq_epi8(in, backslashes)));
+		mask = _mm_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos + imap_parser_scan_string_scalar(data + pos, size - pos);
+}
+
+static IMAP_PARSER_TARGET_AVX2 size_t
+imap_parser_scan_atom_avx2(const unsigned char *data, size_t size)
+{
+	/* signed comparison: both 0..32 and 8bit chars are less than 33 */
+	const __m256i min_plain = _mm256_set1_epi8(33);
+	const __m256i quotes = _mm256_set1_epi8('"');
+	const __m256i lparens = _mm256_set1_epi8('(');
+	const __m256i rparens = _mm256_set1_epi8(')');
+	const __m256i braces = _mm256_set1_epi8('{');
+	const __m256i dels = _mm256_set1_epi8(0x7f);
+	__m256i in, special;
+	unsigned int mask;
+	size_t pos;
+
+	for (pos = 0; pos + 32 <= size; pos += 32) {
+		in = _mm256_loadu_si256((const void *)(data + pos));
+		special = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpgt_epi8(min_plain, in),
+					_mm256_cmpeq_epi8(in, quotes)),
+			_mm256_or_si256(
+				_mm256_or_si256(_mm256_cmpeq_epi8(in, lparens),
+						_mm256_cmpeq_epi8(in, rparens)),
+				_mm256_or_si256(_mm256_cmpeq_epi8(in, braces),
+						_mm256_cmpeq_epi8(in, dels))));
+		mask = (unsigned int)_mm256_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	/* the tail may still contain a full 16 byte block */
+	return pos + imap_parser_scan_atom_sse2(data + pos, size - pos);
+}
+
+static IMAP_PARSER_TARGET_AVX2 size_t
+imap_parser_scan_string_avx2(const unsigned char *data, size_t size)
+{
+	const __m256i zeros = _mm256_setzero_si256();
+	const __m256i crs = _mm256_set1_epi8('\r');
+	const __m256i lfs = _mm256_set1_epi8('\n');
+	const __m256i quotes = _mm256_set1_epi8('"');
+	const __m256i backslashes = _mm256_set1_epi8('\\');
+	__m256i in, special;
+	unsigned int mask;
+	size_t pos;
+
+	for (pos = 0; pos + 32 <= size; pos += 32) {
+		in = _mm256_loadu_si256((const void *)(data + pos));
+		special = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(in, zeros),
+					_mm256_or_si256(_mm256_cmpeq_epi8(in, crs),
+							_mm256_cmpeq_epi8(in, lfs))),
+			_mm256_or_si256(_mm256_cmpeq_epi8(in, quotes),
+					_mm256_cmpeq_epi8(in, backslashes)));
+		mask = (unsigned int)_mm256_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	/* the tail may still contain a full 16 byte block */
+	return pos + imap_parser_scan_string_sse2(data + pos, size - pos);
+}
+
+#endif
+
+static void imap_parser_scan_init(void)
+{
+	(void)imap_parser_scan_set_impl(IMAP_PARSER_SCAN_IMPL_SCALAR);
+#ifdef IMAP_PARSER_SCAN_X86
+	__builtin_cpu_init();
+	if (!imap_parser_scan_set_impl(IMAP_PARSER_SCAN_IMPL_AVX2))
+		(void)imap_parser_scan_set_impl(IMAP_PARSER_SCAN_IMPL_SSE2);
+#endif
+}
+
+bool imap_parser_scan_set_impl(enum imap_parser_scan_impl impl)
+{
+	switch (impl) {
+	case IMAP_PARSER_SCAN_IMPL_SCALAR:
+		imap_parser_scan_atom_func = imap_parser_scan_atom_scalar;
+		imap_parser_scan_string_func = imap_parser_scan_string_scalar;
+		return TRUE;
+	case IMAP_PARSER_SCAN_IMPL_SSE2:
+#ifdef IMAP_PARSER_SCAN_X86
+		if (!__builtin_cpu_supports("sse2"))
+			return FALSE;
+		imap_parser_scan_atom_func = imap_parser_scan_atom_sse2;
+		imap_parser_scan_string_func = imap_parser_scan_string_sse2;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	case IMAP_PARSER_SCAN_IMPL_AVX2:
+#ifdef IMAP_PARSER_SCAN_X86
+		if (!__builtin_cpu_supports("avx2"))
+			return FALSE;
+		imap_parser_scan_atom_func = imap_parser_scan_atom_avx2;
+		imap_parser_scan_string_func = imap_parser_scan_string_avx2;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	}
+	i_unreached();
+}
+
+size_t imap_parser_scan_atom(const unsigned char *data, size_t size)
+{
+	if (unlikely(imap_parser_scan_atom_func == NULL))
+		imap_parser_scan_init();
+	return imap_parser_scan_atom_func(data, size);
+}
+
+size_t imap_parser_scan_string(const unsigned char *data, size_t size)
+{
+	if (unlikely(imap_parser_scan_string_func == NULL))
+		imap_parser_scan_init();
+	return imap_parser_scan_string_func(data, size);
+}
@@ -5,6 +5,7 @@
 #include "ostream.h"
 #include "strescape.h"
 #include "imap-parser.h"
+#include "imap-parser-private.h"
 
 /* We use this macro to read atoms from input. It should probably contain
    everything some day, but for now we can't handle some input otherwise:
@@ -324,6 +325,10 @@ static bool imap_parser_read_atom(struct imap_parser *parser,
 
 	/* read until we've found space, CR or LF. */
 	for (i = parser->cur_pos; i < data_size; i++) {
+		i += imap_parser_scan_atom(data + i, data_size - i);
+		if (i == data_size)
+			break;
+
 		if (data[i] == ' ' || is_linebreak(data[i])) {
 			imap_parser_save_arg(parser, data, i);
 			break;
@@ -354,6 +359,10 @@ static bool imap_parser_read_string(struct imap_parser *parser,
 
 	/* read until we've found non-escaped ", CR or LF */
 	for (i = parser->cur_pos; i < data_size; i++) {
+		i += imap_parser_scan_string(data + i, data_size - i);
+		if (i == data_size)
+			break;
+
 		if (data[i] == '"') {
 			imap_parser_save_arg(parser, data, i);
 
@@ -129,28 +129,36 @@ void imap_append_nstring_nolf(string_t *dest, const char *src)
 
 void imap_append_quoted(string_t *dest, const char *src)
 {
+	const char *start;
+
+	/* append the unchanged parts of the string in as large blocks
+	   as possible */
 	str_append_c(dest, '"');
-	for (; *src != '\0'; src++) {
+	for (start = src; *src != '\0'; src++) {
 		switch (*src) {
 		case 13:
 		case 10:
 			/* not allowed */
+			str_append_data(dest, start, src - start);
+			start = src + 1;
 			break;
 		case '"':
 		case '\\':
+			str_append_data(dest, start, src - start);
 			str_append_c(dest, '\\');
-			str_append_c(dest, *src);
+			/* the char itself is appended with the next block */
+			start = src;
 			break;
 		default:
 			if ((unsigned char)*src >= 0x80) {
 				/* 8bit input not allowed in dquotes */
-				break;
+				str_append_data(dest, start, src - start);
+				start = src + 1;
 			}
-
-			str_append_c(dest, *src);
 			break;
 		}
 	}
+	str_append_data(dest, start, src - start);
 	str_append_c(dest, '"');
 }
 
@@ -1,6 +1,7 @@
 /* Copyright (c) 2002-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "imap-seqset.h"
 
 static uint32_t get_next_number(const char **str)
@@ -70,12 +71,29 @@ get_next_seq_range(const char **str, uint32_t *seq1_r, uint32_t *seq2_r)
 
 int imap_seq_set_parse(const char *str, ARRAY_TYPE(seq_range) *dest)
 {
+	struct seq_range *last;
 	uint32_t seq1, seq2;
 
 	while (*str != '\0') {
 		if (get_next_seq_range(&str, &seq1, &seq2) < 0)
 			return -1;
-		seq_range_array_add_range(dest, seq1, seq2);
+
+		last = array_count(dest) == 0 ? NULL :
+			array_back_modifiable(dest);
+		if (last != NULL && seq1 > last->seq2) {
+			/* seqsets are usually sorted, so this range most
+			   likely goes to the end. avoid the lookups. */
+			if (seq1 == last->seq2 + 1)
+				last->seq2 = seq2;
+			else {
+				struct seq_range *range =
+					array_append_space(dest);
+				range->seq1 = seq1;
+				range->seq2 = seq2;
+			}
+		} else {
+			seq_range_array_add_range(dest, seq1, seq2);
+		}
 
 		if (*str == ',')
 			str++;
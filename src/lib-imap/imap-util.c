@@ -63,14 +63,17 @@ void imap_write_seq_range(string_t *dest, const ARRAY_TYPE(seq_range) *array)
 {
 	const struct seq_range *range;
 	unsigned int i, count;
+	char num[MAX_INT_STRLEN];
 
 	range = array_get(array, &count);
 	for (i = 0; i < count; i++) {
 		if (i > 0)
 			str_append_c(dest, ',');
-		str_printfa(dest, "%u", range[i].seq1);
-		if (range[i].seq1 != range[i].seq2)
-			str_printfa(dest, ":%u", range[i].seq2);
+		str_append(dest, dec2str_buf(num, range[i].seq1));
+		if (range[i].seq1 != range[i].seq2) {
+			str_append_c(dest, ':');
+			str_append(dest, dec2str_buf(num, range[i].seq2));
+		}
 	}
 }
 
@@ -10,6 +10,26 @@ struct test_imap_match {
 	enum imap_match_result result;
 };
 
+static void
+test_imap_match_multiple(pool_t pool, const struct test_imap_match *test,
+			 bool inboxcase)
+{
+	const char *patterns[10];
+	struct imap_match_glob *glob;
+	unsigned int i;
+
+	/* enough patterns to use the character index. the extra patterns
+	   don't affect the result. */
+	for (i = 0; i < 8; i++)
+		patterns[i] = p_strdup_printf(pool, "zz%u/%%", i);
+	patterns[i++] = test->pattern;
+	patterns[i] = NULL;
+
+	glob = imap_match_init_multiple(pool, patterns, inboxcase, '/');
+	test_assert(imap_match(glob, test->input) == test->result);
+	imap_match_deinit(&glob);
+}
+
 static void test_imap_match(void)
 {
 	struct test_imap_match test[] = {
@@ -68,6 +88,10 @@ static void test_imap_match(void)
 		/* test the dup after clearing first one's memory */
 		test_assert(imap_match(glob2, test[i].input) == test[i].result);
 		imap_match_deinit(&glob2);
+
+		/* the same with multiple patterns */
+		test_imap_match_multiple(pool, &test[i], FALSE);
+		p_clear(pool);
 	}
 
 	/* inboxcasing tests */
@@ -83,6 +107,10 @@ static void test_imap_match(void)
 		/* test the dup after clearing first one's memory */
 		test_assert(imap_match(glob2, inbox_test[i].input) == inbox_test[i].result);
 		imap_match_deinit(&glob2);
+
+		/* the same with multiple patterns */
+		test_imap_match_multiple(pool, &inbox_test[i], TRUE);
+		p_clear(pool);
 	}
 	pool_unref(&pool);
 	test_end();
@@ -2,7 +2,9 @@
 
 #include "lib.h"
 #include "istream.h"
+#include "str.h"
 #include "imap-parser.h"
+#include "imap-parser-private.h"
 #include "test-common.h"
 
 static void test_imap_parser_crlf(void)
@@ -145,12 +147,119 @@ static void test_imap_parser_read_tag_cmd(void)
 	test_end();
 }
 
+static bool test_is_atom_special(unsigned char chr)
+{
+	return chr <= ' ' || chr >= 0x7f || chr == '"' ||
+		chr == '(' || chr == ')' || chr == '{';
+}
+
+static bool test_is_string_special(unsigned char chr)
+{
+	return chr == '\0' || chr == '\r' || chr == '\n' ||
+		chr == '"' || chr == '\\';
+}
+
+static void test_imap_parser_scan_impl(const char *impl_name)
+{
+	unsigned char data[70];
+	unsigned int chr, pos, size;
+
+	test_begin(t_strdup_printf("imap parser scan (%s)", impl_name));
+	/* every character at every position of blocks of various sizes, so
+	   that all the vector and scalar parts are used */
+	memset(data, 'x', sizeof(data));
+	for (chr = 0; chr < 256; chr++) {
+		for (pos = 0; pos < sizeof(data); pos++) {
+			data[pos] = chr;
+			for (size = pos; size <= sizeof(data); size += 17) {
+				test_assert_idx(imap_parser_scan_atom(data, size) ==
+					(size > pos && test_is_atom_special(chr) ?
+					 pos : size), chr);
+				test_assert_idx(imap_parser_scan_string(data, size) ==
+					(size > pos && test_is_string_special(chr) ?
+					 pos : size), chr);
+			}
+			data[pos] = 'x';
+		}
+	}
+	test_end();
+}
+
+static void test_imap_parser_long_args_impl(const char *impl_name)
+{
+	struct istream *input;
+	struct imap_parser *parser;
+	const struct imap_arg *args;
+	const char *atom, *str;
+	string_t *line = t_str_new(512);
+	string_t *atom_value = t_str_new(256);
+	string_t *str_value = t_str_new(256);
+	unsigned int i;
+	size_t size;
+
+	test_begin(t_strdup_printf("imap parser long args (%s)", impl_name));
+	for (i = 0; i < 100; i++)
+		str_append_c(atom_value, 'a' + i % 26);
+	str_append(atom_value, "[]%*\\");
+	for (i = 0; i < 100; i++) {
+		if (i % 37 == 36)
+			str_append_c(str_value, '"');
+		else if (i % 41 == 40)
+			str_append_c(str_value, '\\');
+		else
+			str_append_c(str_value, 'A' + i % 26);
+	}
+	str_append_str(line, atom_value);
+	str_append(line, " \"");
+	for (i = 0; i < str_len(str_value); i++) {
+		if (str_c(str_value)[i] == '"' || str_c(str_value)[i] == '\\')
+			str_append_c(line, '\\');
+		str_append_c(line, str_c(str_value)[i]);
+	}
+	str_append(line, "\"\r\n");
+
+	input = test_istream_create_data(str_data(line), str_len(line));
+	parser = imap_parser_create(input, NULL, 1024);
+	/* feed the input one byte at a time */
+	for (size = 1; size <= str_len(line); size++) {
+		test_istream_set_size(input, size);
+		(void)i_stream_read(input);
+		if (imap_parser_read_args(parser, 0, 0, &args) != -2)
+			break;
+	}
+	test_assert(size == str_len(line));
+	test_assert(imap_arg_get_atom(&args[0], &atom) &&
+		    strcmp(atom, str_c(atom_value)) == 0);
+	test_assert(imap_arg_get_quoted(&args[1], &str) &&
+		    strcmp(str, str_c(str_value)) == 0);
+	test_assert(args[2].type == IMAP_ARG_EOL);
+	imap_parser_unref(&parser);
+	i_stream_destroy(&input);
+	test_end();
+}
+
+static void test_imap_parser_scan(void)
+{
+	test_assert(imap_parser_scan_set_impl(IMAP_PARSER_SCAN_IMPL_SCALAR));
+	test_imap_parser_scan_impl("scalar");
+	test_imap_parser_long_args_impl("scalar");
+	if (imap_parser_scan_set_impl(IMAP_PARSER_SCAN_IMPL_SSE2)) {
+		test_imap_parser_scan_impl("SSE2");
+		test_imap_parser_long_args_impl("SSE2");
+	}
+	if (imap_parser_scan_set_impl(IMAP_PARSER_SCAN_IMPL_AVX2)) {
+		test_imap_parser_scan_impl("AVX2");
+		test_imap_parser_long_args_impl("AVX2");
+	}
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_imap_parser_crlf,
 		test_imap_parser_partial_list,
 		test_imap_parser_read_tag_cmd,
+		test_imap_parser_scan,
 		NULL
 	};
 	return test_run(test_functions);
@@ -158,6 +158,32 @@ static void test_imap_append_nstring_nolf(void)
 	test_end();
 }
 
+static void test_imap_append_quoted(void)
+{
+	static const struct {
+		const char *input, *output;
+	} tests[] = {
+		{ "", "\"\"" },
+		{ "foo", "\"foo\"" },
+		{ "\"", "\"\\\"\"" },
+		{ "foo\\bar\"", "\"foo\\\\bar\\\"\"" },
+		{ "foo\r\nbar\n", "\"foobar\"" },
+		{ "\x80" "foo\xff" "bar\xc3", "\"foobar\"" },
+		{ "\"\r\"\x80\\", "\"\\\"\\\"\\\\\"" },
+	};
+	string_t *str = t_str_new(128);
+	unsigned int i;
+
+	test_begin("test_imap_append_quoted()");
+
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		str_truncate(str, 0);
+		imap_append_quoted(str, tests[i].input);
+		test_assert_idx(strcmp(tests[i].output, str_c(str)) == 0, i);
+	}
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -165,6 +191,7 @@ int main(void)
 		test_imap_append_astring,
 		test_imap_append_nstring,
 		test_imap_append_nstring_nolf,
+		test_imap_append_quoted,
 		NULL
 	};
 	return test_run(test_functions);
@@ -0,0 +1,346 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "bsearch-insert-pos.h"
+#include "mail-cache-private.h"
+
+#define COLUMN_PAD32(size) (((size) + 3) & ~(uint64_t)3)
+
+struct mail_cache_column {
+	uint32_t file_field;
+	unsigned int field_size;
+	/* Offsets to the exists bitmap and the values. With the builder
+	   these are relative to the beginning of the columns, otherwise
+	   they're cache file offsets. */
+	size_t exists_offset, values_offset;
+};
+ARRAY_DEFINE_TYPE(mail_cache_column, struct mail_cache_column);
+
+struct mail_cache_columns {
+	/* Columns are for the cache file with this file_seq */
+	uint32_t file_seq;
+	uint32_t uid_count;
+	size_t uids_offset;
+	ARRAY_TYPE(mail_cache_column) columns;
+};
+
+struct mail_cache_columns_builder {
+	buffer_t *data;
+	uint32_t uid_count;
+	/* mail_cache_field.idx -> columns index + 1, or 0 if no column */
+	ARRAY(unsigned int) field_columns;
+	ARRAY_TYPE(mail_cache_column) columns;
+};
+
+static uint64_t
+mail_cache_columns_layout(ARRAY_TYPE(mail_cache_column) *columns,
+			  uint32_t uid_count)
+{
+	struct mail_cache_column *column;
+	uint64_t pos;
+
+	pos = sizeof(struct mail_cache_columns_header) +
+		(uint64_t)uid_count * sizeof(uint32_t) +
+		array_count(columns) * sizeof(struct mail_cache_column_header);
+	array_foreach_modifiable(columns, column) {
+		column->exists_offset = pos;
+		pos += COLUMN_PAD32((uid_count + 7) / 8);
+		column->values_offset = pos;
+		pos += COLUMN_PAD32((uint64_t)uid_count * column->field_size);
+	}
+	return pos;
+}
+
+struct mail_cache_columns_builder *
+mail_cache_columns_builder_init(struct mail_cache *cache,
+				const uint32_t *field_file_map,
+				const uint32_t *uids, unsigned int uid_count)
+{
+	struct mail_cache_columns_builder *builder;
+	struct mail_cache_columns_header hdr;
+	struct mail_cache_column_header column_hdr;
+	const struct mail_cache_column *column;
+	struct mail_cache_column *new_column;
+	const struct mail_cache_field *field;
+	enum mail_cache_decision_type dec;
+	unsigned int i, column_idx;
+	uint64_t size;
+	size_t pos;
+
+	if (uid_count == 0)
+		return NULL;
+
+	builder = i_new(struct mail_cache_columns_builder, 1);
+	builder->uid_count = uid_count;
+	i_array_init(&builder->field_columns, cache->fields_count);
+	i_array_init(&builder->columns, 8);
+	for (i = 0; i < cache->fields_count; i++) {
+		if (field_file_map[i] == (uint32_t)-1)
+			continue;
+		field = &cache->fields[i].field;
+		dec = field->decision & ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED);
+		if (field->type != MAIL_CACHE_FIELD_FIXED_SIZE ||
+		    field->field_size == 0 ||
+		    field->field_size > MAIL_CACHE_COLUMN_MAX_FIELD_SIZE ||
+		    dec == MAIL_CACHE_DECISION_NO)
+			continue;
+		if (array_count(&builder->columns) == MAIL_CACHE_COLUMNS_MAX_COUNT)
+			break;
+
+		new_column = array_append_space(&builder->columns);
+		new_column->file_field = field_file_map[i];
+		new_column->field_size = field->field_size;
+		column_idx = array_count(&builder->columns);
+		array_idx_set(&builder->field_columns, i, &column_idx);
+	}
+
+	size = mail_cache_columns_layout(&builder->columns, uid_count);
+	if (array_count(&builder->columns) == 0 || size > (uint32_t)-1) {
+		mail_cache_columns_builder_deinit(&builder);
+		return NULL;
+	}
+
+	builder->data = buffer_create_dynamic(default_pool, size);
+	buffer_append_zero(builder->data, size);
+
+	i_zero(&hdr);
+	hdr.size = size;
+	hdr.uid_count = uid_count;
+	hdr.columns_count = array_count(&builder->columns);
+	buffer_write(builder->data, 0, &hdr, sizeof(hdr));
+	pos = sizeof(hdr);
+	buffer_write(builder->data, pos, uids, uid_count * sizeof(uint32_t));
+	pos += uid_count * sizeof(uint32_t);
+	array_foreach(&builder->columns, column) {
+		column_hdr.file_field = column->file_field;
+		column_hdr.field_size = column->field_size;
+		buffer_write(builder->data, pos, &column_hdr, sizeof(column_hdr));
+		pos += sizeof(column_hdr);
+	}
+	return builder;
+}
+
+void mail_cache_columns_builder_deinit(struct mail_cache_columns_builder **_builder)
+{
+	struct mail_cache_columns_builder *builder = *_builder;
+
+	*_builder = NULL;
+	buffer_free(&builder->data);
+	array_free(&builder->field_columns);
+	array_free(&builder->columns);
+	i_free(builder);
+}
+
+void mail_cache_columns_builder_add(struct mail_cache_columns_builder *builder,
+				    unsigned int uid_idx, unsigned int field_idx,
+				    const void *data, size_t size)
+{
+	const struct mail_cache_column *column;
+	const unsigned int *column_idxp;
+	unsigned char *exists;
+
+	if (field_idx >= array_count(&builder->field_columns))
+		return;
+	column_idxp = array_idx(&builder->field_columns, field_idx);
+	if (*column_idxp == 0)
+		return;
+	column = array_idx(&builder->columns, *column_idxp - 1);
+	if (size != column->field_size)
+		return;
+
+	i_assert(uid_idx < builder->uid_count);
+	exists = buffer_get_space_unsafe(builder->data,
+		column->exists_offset + uid_idx / 8, 1);
+	*exists |= 1 << (uid_idx % 8);
+	buffer_write(builder->data, column->values_offset + uid_idx * size,
+		     data, size);
+}
+
+const buffer_t *
+mail_cache_columns_builder_get_data(struct mail_cache_columns_builder *builder)
+{
+	return builder->data;
+}
+
+void mail_cache_columns_free(struct mail_cache *cache)
+{
+	struct mail_cache_columns *columns = cache->columns;
+
+	if (columns == NULL)
+		return;
+	cache->columns = NULL;
+
+	array_free(&columns->columns);
+	i_free(columns);
+}
+
+static int
+mail_cache_columns_map(struct mail_cache *cache, size_t offset, size_t size,
+		       const void **data_r)
+{
+	int ret;
+
+	if ((ret = mail_cache_map(cache, offset, size, data_r)) == 0) {
+		mail_cache_set_corrupted(cache, "columns point outside file");
+		return -1;
+	}
+	return ret < 0 ? -1 : 0;
+}
+
+static int
+mail_cache_columns_read(struct mail_cache *cache,
+			struct mail_cache_columns *columns)
+{
+	struct mail_cache_columns_header hdr;
+	const struct mail_cache_column_header *column_hdrs;
+	struct mail_cache_column *column;
+	const void *data;
+	size_t offset = sizeof(struct mail_cache_header);
+	uint64_t size;
+	uint32_t dict_size, i;
+
+	columns->file_seq = 0;
+	columns->uid_count = 0;
+	array_clear(&columns->columns);
+
+	if ((cache->hdr->flags & MAIL_CACHE_HEADER_FLAG_COMPRESSED_RECORDS) != 0) {
+		/* skip over the compression dictionary */
+		if (mail_cache_columns_map(cache, offset, sizeof(dict_size),
+					   &data) < 0)
+			return -1;
+		memcpy(&dict_size, data, sizeof(dict_size));
+		offset += sizeof(dict_size) + COLUMN_PAD32(dict_size);
+	}
+
+	if (mail_cache_columns_map(cache, offset, sizeof(hdr), &data) < 0)
+		return -1;
+	memcpy(&hdr, data, sizeof(hdr));
+	if (hdr.columns_count > MAIL_CACHE_COLUMNS_MAX_COUNT ||
+	    hdr.uid_count > hdr.size / sizeof(uint32_t) ||
+	    sizeof(hdr) + hdr.uid_count * sizeof(uint32_t) +
+	    hdr.columns_count * sizeof(struct mail_cache_column_header) > hdr.size) {
+		mail_cache_set_corrupted(cache, "columns header is broken");
+		return -1;
+	}
+	if (mail_cache_columns_map(cache, offset, hdr.size, &data) < 0)
+		return -1;
+
+	column_hdrs = CONST_PTR_OFFSET(data, sizeof(hdr) +
+				       hdr.uid_count * sizeof(uint32_t));
+	for (i = 0; i < hdr.columns_count; i++) {
+		if (column_hdrs[i].field_size == 0 ||
+		    column_hdrs[i].field_size > MAIL_CACHE_COLUMN_MAX_FIELD_SIZE) {
+			mail_cache_set_corrupted(cache,
+				"column has invalid field size %u",
+				column_hdrs[i].field_size);
+			return -1;
+		}
+		column = array_append_space(&columns->columns);
+		column->file_field = column_hdrs[i].file_field;
+		column->field_size = column_hdrs[i].field_size;
+	}
+	size = mail_cache_columns_layout(&columns->columns, hdr.uid_count);
+	if (size != hdr.size) {
+		mail_cache_set_corrupted(cache,
+			"columns have invalid size (%u != %"PRIu64")",
+			hdr.size, size);
+		array_clear(&columns->columns);
+		return -1;
+	}
+	array_foreach_modifiable(&columns->columns, column) {
+		column->exists_offset += offset;
+		column->values_offset += offset;
+	}
+	columns->uids_offset = offset + sizeof(hdr);
+	columns->uid_count = hdr.uid_count;
+	columns->file_seq = cache->hdr->file_seq;
+	return 0;
+}
+
+static const struct mail_cache_column *
+mail_cache_columns_find(struct mail_cache_columns *columns, uint32_t file_field)
+{
+	const struct mail_cache_column *column;
+
+	array_foreach(&columns->columns, column) {
+		if (column->file_field == file_field)
+			return column;
+	}
+	return NULL;
+}
+
+static bool
+mail_cache_columns_find_uid(const uint32_t *data, unsigned int count,
+			    uint32_t value, unsigned int *idx_r)
+{
+	BINARY_NUMBER_SEARCH(data, count, value, idx_r);
+}
+
+int mail_cache_lookup_column(struct mail_cache_view *view, buffer_t *dest_buf,
+			     uint32_t seq, unsigned int field_idx)
+{
+	struct mail_cache *cache = view->cache;
+	struct mail_cache_columns *columns;
+	const struct mail_cache_column *column;
+	const unsigned char *exists;
+	const uint32_t *uids;
+	const void *data;
+	uint32_t file_field, offset, reset_id, uid;
+	unsigned int idx;
+
+	if (MAIL_CACHE_IS_UNUSABLE(cache) || cache->map_with_read ||
+	    (cache->hdr->flags & MAIL_CACHE_HEADER_FLAG_COLUMNS) == 0)
+		return 0;
+	file_field = cache->field_file_map[field_idx];
+	if (file_field == (uint32_t)-1)
+		return 0;
+
+	/* the message must have a record in the current cache file */
+	offset = mail_cache_lookup_cur_offset(view->view, seq, &reset_id);
+	if (offset == 0 || reset_id != cache->hdr->file_seq)
+		return 0;
+
+	if (cache->columns == NULL) {
+		cache->columns = i_new(struct mail_cache_columns, 1);
+		i_array_init(&cache->columns->columns, 8);
+	}
+	columns = cache->columns;
+	if (columns->file_seq != cache->hdr->file_seq) {
+		if (mail_cache_columns_read(cache, columns) < 0)
+			return -1;
+	}
+	column = mail_cache_columns_find(columns, file_field);
+	if (column == NULL ||
+	    column->field_size != cache->fields[field_idx].field.field_size)
+		return 0;
+
+	mail_index_lookup_uid(view->view, seq, &uid);
+	if (mail_cache_columns_map(cache, columns->uids_offset,
+				   columns->uid_count * sizeof(uint32_t),
+				   &data) < 0)
+		return -1;
+	uids = data;
+	idx = view->column_uid_idx_hint;
+	if (idx >= columns->uid_count || uids[idx] != uid) {
+		if (!mail_cache_columns_find_uid(uids, columns->uid_count,
+						 uid, &idx))
+			return 0;
+	}
+	view->column_uid_idx_hint = idx + 1;
+
+	if (mail_cache_columns_map(cache, column->exists_offset + idx / 8, 1,
+				   &data) < 0)
+		return -1;
+	exists = data;
+	if ((*exists & (1 << (idx % 8))) == 0)
+		return 0;
+
+	if (mail_cache_columns_map(cache,
+				   column->values_offset + idx * column->field_size,
+				   column->field_size, &data) < 0)
+		return -1;
+	buffer_append(dest_buf, data, column->field_size);
+	return 1;
+}
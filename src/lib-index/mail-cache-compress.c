@@ -0,0 +1,243 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "mail-cache-private.h"
+
+#include <zlib.h>
+
+/* Sanity check for the uncompressed record size, so a corrupted file can't
+   cause huge memory allocations. Records are never this large, because
+   mail_index_cache_optimization_settings.record_max_size is much smaller. */
+#define MAIL_CACHE_COMPRESS_MAX_UNCOMPRESSED_SIZE (1024*1024*16)
+
+struct mail_cache_uncompress {
+	z_stream zs;
+	/* Dictionary of the cache file with dict_file_seq */
+	buffer_t *dict;
+	uint32_t dict_file_seq;
+};
+
+struct mail_cache_compress_context {
+	z_stream zs;
+	buffer_t *dict;
+};
+
+static void mail_cache_zlib_init_error(const char *function, int ret)
+{
+	switch (ret) {
+	case Z_MEM_ERROR:
+		i_fatal_status(FATAL_OUTOFMEM, "%s(): Out of memory", function);
+	case Z_VERSION_ERROR:
+		i_fatal("Wrong zlib library version (broken compilation)");
+	case Z_STREAM_ERROR:
+		i_fatal("%s(): Invalid parameters", function);
+	default:
+		i_fatal("%s() failed with %d", function, ret);
+	}
+}
+
+static struct mail_cache_uncompress *mail_cache_uncompress_init(void)
+{
+	struct mail_cache_uncompress *uc;
+	int ret;
+
+	uc = i_new(struct mail_cache_uncompress, 1);
+	if ((ret = inflateInit2(&uc->zs, -15)) != Z_OK)
+		mail_cache_zlib_init_error("inflateInit2", ret);
+	uc->dict = buffer_create_dynamic(default_pool, 1024);
+	return uc;
+}
+
+void mail_cache_uncompress_free(struct mail_cache *cache)
+{
+	struct mail_cache_uncompress *uc = cache->uncompress;
+
+	if (uc == NULL)
+		return;
+	cache->uncompress = NULL;
+
+	(void)inflateEnd(&uc->zs);
+	buffer_free(&uc->dict);
+	i_free(uc);
+}
+
+static int
+mail_cache_uncompress_read_dict(struct mail_cache *cache,
+				struct mail_cache_uncompress *uc)
+{
+	const size_t offset = sizeof(struct mail_cache_header);
+	const void *data;
+	uint32_t dict_size;
+	int ret;
+
+	if (uc->dict_file_seq == cache->hdr->file_seq)
+		return 0;
+
+	/* the dictionary follows the header */
+	if ((ret = mail_cache_map(cache, offset, sizeof(dict_size), &data)) <= 0) {
+		if (ret == 0) {
+			mail_cache_set_corrupted(cache,
+				"compression dictionary points outside file");
+		}
+		return -1;
+	}
+	memcpy(&dict_size, data, sizeof(dict_size));
+	if (dict_size > MAIL_CACHE_COMPRESS_DICT_MAX_SIZE) {
+		mail_cache_set_corrupted(cache,
+			"compression dictionary is too large (%u)", dict_size);
+		return -1;
+	}
+	if ((ret = mail_cache_map(cache, offset,
+				  sizeof(dict_size) + dict_size, &data)) <= 0) {
+		if (ret == 0) {
+			mail_cache_set_corrupted(cache,
+				"compression dictionary points outside file");
+		}
+		return -1;
+	}
+	buffer_set_used_size(uc->dict, 0);
+	buffer_append(uc->dict, CONST_PTR_OFFSET(data, sizeof(dict_size)),
+		      dict_size);
+	uc->dict_file_seq = cache->hdr->file_seq;
+	return 0;
+}
+
+int mail_cache_record_uncompress(struct mail_cache *cache, uint32_t offset,
+				 buffer_t *buf)
+{
+	const struct mail_cache_record *rec;
+	const struct mail_cache_compressed_record *comp;
+	struct mail_cache_record *new_rec;
+	int ret;
+
+	if (cache->uncompress == NULL)
+		cache->uncompress = mail_cache_uncompress_init();
+	struct mail_cache_uncompress *uc = cache->uncompress;
+
+	/* reading the dictionary may remap the file, so get the record only
+	   after it */
+	if (mail_cache_uncompress_read_dict(cache, uc) < 0)
+		return -1;
+	if (mail_cache_get_record(cache, offset, &rec) < 0)
+		return -1;
+
+	i_assert(mail_cache_record_is_compressed(cache, rec));
+	comp = CONST_PTR_OFFSET(rec, sizeof(*rec));
+	if (rec->size < sizeof(*rec) + sizeof(*comp) ||
+	    comp->uncompressed_size == 0 ||
+	    comp->uncompressed_size > MAIL_CACHE_COMPRESS_MAX_UNCOMPRESSED_SIZE ||
+	    comp->uncompressed_size % sizeof(uint32_t) != 0) {
+		mail_cache_set_corrupted(cache,
+			"compressed record has invalid size");
+		return -1;
+	}
+
+	buffer_set_used_size(buf, 0);
+	new_rec = buffer_append_space_unsafe(buf,
+		sizeof(*new_rec) + comp->uncompressed_size);
+	new_rec->prev_offset = rec->prev_offset;
+	new_rec->size = sizeof(*new_rec) + comp->uncompressed_size;
+
+	(void)inflateReset(&uc->zs);
+	if (uc->dict->used > 0 &&
+	    inflateSetDictionary(&uc->zs, uc->dict->data,
+				 uc->dict->used) != Z_OK)
+		i_unreached();
+	uc->zs.next_in = (void *)(comp + 1);
+	uc->zs.avail_in = rec->size - sizeof(*rec) - sizeof(*comp);
+	uc->zs.next_out = (void *)(new_rec + 1);
+	uc->zs.avail_out = comp->uncompressed_size;
+
+	ret = inflate(&uc->zs, Z_FINISH);
+	if (ret != Z_STREAM_END || uc->zs.avail_out != 0) {
+		mail_cache_set_corrupted(cache,
+			"compressed record is broken (inflate() returned %d%s)",
+			ret, uc->zs.msg == NULL ? "" :
+			t_strdup_printf(": %s", uc->zs.msg));
+		buffer_set_used_size(buf, 0);
+		return -1;
+	}
+	return 0;
+}
+
+struct mail_cache_compress_context *
+mail_cache_compress_init(int level, const void *dict, size_t dict_size)
+{
+	struct mail_cache_compress_context *ctx;
+	int ret;
+
+	i_assert(dict_size <= MAIL_CACHE_COMPRESS_DICT_MAX_SIZE);
+
+	ctx = i_new(struct mail_cache_compress_context, 1);
+	ret = deflateInit2(&ctx->zs, level, Z_DEFLATED, -15, 8,
+			   Z_DEFAULT_STRATEGY);
+	if (ret != Z_OK)
+		mail_cache_zlib_init_error("deflateInit2", ret);
+	ctx->dict = buffer_create_dynamic(default_pool, dict_size);
+	buffer_append(ctx->dict, dict, dict_size);
+	return ctx;
+}
+
+void mail_cache_compress_deinit(struct mail_cache_compress_context **_ctx)
+{
+	struct mail_cache_compress_context *ctx = *_ctx;
+
+	*_ctx = NULL;
+	(void)deflateEnd(&ctx->zs);
+	buffer_free(&ctx->dict);
+	i_free(ctx);
+}
+
+bool mail_cache_compress_record(struct mail_cache_compress_context *ctx,
+				const struct mail_cache_record *rec,
+				buffer_t *dest)
+{
+	struct mail_cache_record *new_rec;
+	struct mail_cache_compressed_record *comp;
+	size_t size, max_size, new_size, start_pos = dest->used;
+	int ret;
+
+	i_assert(rec->size >= sizeof(*rec));
+	size = rec->size - sizeof(*rec);
+	if (size < MAIL_CACHE_COMPRESS_MIN_RECORD_SIZE)
+		return FALSE;
+
+	(void)deflateReset(&ctx->zs);
+	if (ctx->dict->used > 0 &&
+	    deflateSetDictionary(&ctx->zs, ctx->dict->data,
+				 ctx->dict->used) != Z_OK)
+		i_unreached();
+
+	max_size = deflateBound(&ctx->zs, size);
+	new_rec = buffer_append_space_unsafe(dest,
+		sizeof(*new_rec) + sizeof(*comp) + max_size + sizeof(uint32_t));
+	comp = PTR_OFFSET(new_rec, sizeof(*new_rec));
+
+	ctx->zs.next_in = (void *)(rec + 1);
+	ctx->zs.avail_in = size;
+	ctx->zs.next_out = (void *)(comp + 1);
+	ctx->zs.avail_out = max_size;
+	if ((ret = deflate(&ctx->zs, Z_FINISH)) != Z_STREAM_END)
+		i_panic("deflate() failed with %d", ret);
+
+	/* each record begins from 32bit aligned position */
+	new_size = sizeof(*new_rec) + sizeof(*comp) +
+		((ctx->zs.total_out + sizeof(uint32_t)-1) &
+		 ~(sizeof(uint32_t)-1));
+	if (new_size >= rec->size) {
+		/* didn't compress well enough */
+		buffer_set_used_size(dest, start_pos);
+		return FALSE;
+	}
+	memset(PTR_OFFSET(comp + 1, ctx->zs.total_out), 0,
+	       new_size - sizeof(*new_rec) - sizeof(*comp) -
+	       ctx->zs.total_out);
+
+	new_rec->prev_offset = rec->prev_offset;
+	new_rec->size = new_size;
+	comp->field = MAIL_CACHE_COMPRESSED_RECORD_FIELD;
+	comp->uncompressed_size = size;
+	buffer_set_used_size(dest, start_pos + new_size);
+	return TRUE;
+}
@@ -55,12 +55,37 @@
 
    - When last_used becomes 60 days old (or 2*unaccessed_field_drop_secs) a
      TEMP caching decision is changed to NO.
+
+   With the cost_decisions setting the decisions are also affected by how
+   expensive the fields are to recompute. The caller tells with
+   mail_cache_field_add_recompute_cost() how much time and I/O was spent on
+   recomputing a field that wasn't in cache. Together with the cache hits and
+   the space the field uses in the cache this is used to:
+
+   - Change TEMP decision to YES immediately for fields that are expensive
+     to recompute (e.g. BODYSTRUCTURE and snippet for large mails).
+
+   - Reject adding and drop on the next purge the header fields that are
+     cheap to recompute and rarely accessed from cache.
+
+   The statistics are kept only in memory for the current session, so the
+   decisions fall back to the access based rules until enough samples have
+   been collected.
 */
 
 #include "lib.h"
 #include "ioloop.h"
 #include "mail-cache-private.h"
 
+/* Number of recomputations needed before the cost is trusted */
+#define MAIL_CACHE_COST_MIN_SAMPLES 3
+/* Reading this many bytes is assumed to cost 1 usec */
+#define MAIL_CACHE_COST_BYTES_PER_USEC 100
+/* Average recompute cost at which the field is permanently cached */
+#define MAIL_CACHE_COST_EXPENSIVE_USECS 200
+/* Average recompute cost below which a rarely used field isn't cached */
+#define MAIL_CACHE_COST_CHEAP_USECS 20
+
 const char *mail_cache_decision_to_string(enum mail_cache_decision_type dec)
 {
 	switch (dec & ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED)) {
@@ -84,6 +109,50 @@ mail_cache_decision_changed_event(struct mail_cache *cache, struct event *event,
 		add_int("last_used", cache->fields[field].field.last_used);
 }
 
+enum mail_cache_field_cost
+mail_cache_field_get_cost(struct mail_cache *cache, unsigned int field)
+{
+	const struct mail_cache_field_private *priv = &cache->fields[field];
+	uint64_t avg_cost, avg_read_cost;
+
+	if (!cache->index->optimization_set.cache.cost_decisions ||
+	    priv->recompute_count < MAIL_CACHE_COST_MIN_SAMPLES)
+		return MAIL_CACHE_FIELD_COST_UNKNOWN;
+
+	avg_cost = (priv->recompute_usecs +
+		    priv->recompute_bytes / MAIL_CACHE_COST_BYTES_PER_USEC) /
+		priv->recompute_count;
+	if (avg_cost >= MAIL_CACHE_COST_EXPENSIVE_USECS)
+		return MAIL_CACHE_FIELD_COST_EXPENSIVE;
+
+	/* reading the value from cache isn't free either */
+	avg_read_cost = priv->added_count == 0 ? 0 :
+		priv->added_bytes / priv->added_count /
+		MAIL_CACHE_COST_BYTES_PER_USEC;
+	if (avg_cost <= avg_read_cost)
+		return MAIL_CACHE_FIELD_COST_CHEAP;
+	if (avg_cost < MAIL_CACHE_COST_CHEAP_USECS &&
+	    priv->lookup_hits <= priv->recompute_count) {
+		/* cheap and used from cache less often than recomputed */
+		return MAIL_CACHE_FIELD_COST_CHEAP;
+	}
+	return MAIL_CACHE_FIELD_COST_NORMAL;
+}
+
+void mail_cache_field_add_recompute_cost(struct mail_cache *cache,
+					 unsigned int field_idx,
+					 uint64_t usecs, uoff_t bytes)
+{
+	struct mail_cache_field_private *priv;
+
+	i_assert(field_idx < cache->fields_count);
+
+	priv = &cache->fields[field_idx];
+	priv->recompute_count++;
+	priv->recompute_usecs += usecs;
+	priv->recompute_bytes += bytes;
+}
+
 static void
 mail_cache_update_last_used(struct mail_cache *cache, unsigned int field)
 {
@@ -105,6 +174,7 @@ void mail_cache_decision_state_update(struct mail_cache_view *view,
 	if (view->no_decision_updates)
 		return;
 
+	cache->fields[field].lookup_hits++;
 	dec = cache->fields[field].field.decision;
 	if (dec == (MAIL_CACHE_DECISION_NO | MAIL_CACHE_DECISION_FORCED)) {
 		/* don't update last_used */
@@ -138,8 +208,11 @@ void mail_cache_decision_state_update(struct mail_cache_view *view,
 	mail_index_lookup_uid(view->view, seq, &uid);
 	hdr = mail_index_get_header(view->view);
 
+	bool expensive = dec == MAIL_CACHE_DECISION_TEMP &&
+		mail_cache_field_get_cost(cache, field) ==
+		MAIL_CACHE_FIELD_COST_EXPENSIVE;
 	if (uid >= cache->fields[field].uid_highwater &&
-	    uid >= hdr->day_first_uid[7]) {
+	    uid >= hdr->day_first_uid[7] && !expensive) {
 		cache->fields[field].uid_highwater = uid;
 	} else if (dec == MAIL_CACHE_DECISION_YES) {
 		/* Confirmed that we still want to preserve YES as cache
@@ -153,14 +226,18 @@ void mail_cache_decision_state_update(struct mail_cache_view *view,
 		   b) accessing message older than one week. assume it's a
 		      client with no local cache. if it was just a new client
 		      generating the local cache for the first time, we'll
-		      drop back to TEMP within few months. */
+		      drop back to TEMP within few months.
+		   c) the field is expensive to recompute. */
 		i_assert(dec == MAIL_CACHE_DECISION_TEMP);
 		cache->fields[field].field.decision = MAIL_CACHE_DECISION_YES;
 		cache->fields[field].decision_dirty = TRUE;
 		cache->field_header_write_pending = TRUE;
 
-		const char *reason = uid < hdr->day_first_uid[7] ?
+		const char *reason = expensive ? "expensive" :
+			uid < hdr->day_first_uid[7] ?
 			"old_mail" : "unordered_access";
+		if (uid >= cache->fields[field].uid_highwater)
+			cache->fields[field].uid_highwater = uid;
 		struct event_passthrough *e =
 			mail_cache_decision_changed_event(
 				view->cache, view->cache->event, field)->
@@ -245,6 +322,20 @@ void mail_cache_decision_add(struct mail_cache_view *view, uint32_t seq,
 				priv->field.name, reason);
 			return;
 		}
+		if (priv->field.type == MAIL_CACHE_FIELD_HEADER &&
+		    mail_cache_field_get_cost(cache, field) ==
+		    MAIL_CACHE_FIELD_COST_CHEAP) {
+			*rejected_r = TRUE;
+
+			const char *reason = "cheap_to_recompute";
+			struct event_passthrough *e =
+				mail_cache_decision_rejected_event(
+					cache, field, reason);
+			e_debug(e->event(),
+				"Cache rejected header '%s': %s",
+				priv->field.name, reason);
+			return;
+		}
 
 		priv->field.decision = MAIL_CACHE_DECISION_TEMP;
 	}
@@ -173,6 +173,7 @@ mail_cache_lookup_iter_transaction(struct mail_cache_lookup_iterate_ctx *ctx)
 		return FALSE;
 
 	ctx->inmemory_field_idx = TRUE;
+	ctx->rec_uncompressed = FALSE;
 	ctx->remap_counter = ctx->view->cache->remap_counter;
 	ctx->pos = sizeof(*ctx->rec);
 	ctx->rec_size = ctx->rec->size;
@@ -228,6 +229,18 @@ mail_cache_lookup_iter_next_record(struct mail_cache_lookup_iterate_ctx *ctx)
 		return -1;
 	}
 	ctx->inmemory_field_idx = FALSE;
+	ctx->rec_uncompressed = FALSE;
+	if (mail_cache_record_is_compressed(view->cache, ctx->rec)) {
+		if (view->uncompressed_rec_buf == NULL) {
+			view->uncompressed_rec_buf =
+				buffer_create_dynamic(default_pool, 1024);
+		}
+		if (mail_cache_record_uncompress(view->cache, ctx->offset,
+						 view->uncompressed_rec_buf) < 0)
+			return -1;
+		ctx->rec = view->uncompressed_rec_buf->data;
+		ctx->rec_uncompressed = TRUE;
+	}
 	ctx->remap_counter = view->cache->remap_counter;
 
 	ctx->pos = sizeof(*ctx->rec);
@@ -264,7 +277,8 @@ mail_cache_lookup_rec_get_field(struct mail_cache_lookup_iterate_ctx *ctx,
 
 		/* field reading might have re-mmaped the file and
 		   caused rec pointer to break. need to get it again. */
-		if (mail_cache_get_record(cache, ctx->offset, &ctx->rec) < 0)
+		if (!ctx->rec_uncompressed &&
+		    mail_cache_get_record(cache, ctx->offset, &ctx->rec) < 0)
 			return -1;
 		ctx->remap_counter = cache->remap_counter;
 	}
@@ -419,6 +433,13 @@ int mail_cache_lookup_field(struct mail_cache_view *view, buffer_t *dest_buf,
 	struct mail_cache_iterate_field field;
 	int ret;
 
+	/* small fixed size fields may be found directly from the columns
+	   without going through the whole record */
+	if ((ret = mail_cache_lookup_column(view, dest_buf, seq, field_idx)) != 0) {
+		mail_cache_decision_state_update(view, seq, field_idx);
+		return ret;
+	}
+
 	ret = mail_cache_field_exists(view, seq, field_idx);
 	mail_cache_decision_state_update(view, seq, field_idx);
 	if (ret <= 0)
@@ -13,9 +13,33 @@
 
 #define MAIL_CACHE_MAX_WRITE_BUFFER (1024*256)
 
+/* Maximum size for the deflate dictionary of compressed records. Deflate
+   can't refer further back than 32 kB, so larger dictionaries are useless. */
+#define MAIL_CACHE_COMPRESS_DICT_MAX_SIZE (1024*32)
+/* Don't try to compress records smaller than this. */
+#define MAIL_CACHE_COMPRESS_MIN_RECORD_SIZE 128
+/* Maximum number of fixed size field columns */
+#define MAIL_CACHE_COLUMNS_MAX_COUNT 32
+/* Only fixed size fields up to this size are stored as columns */
+#define MAIL_CACHE_COLUMN_MAX_FIELD_SIZE 8
+/* Compressed records begin with this field index. It's followed by
+   mail_cache_compressed_record. */
+#define MAIL_CACHE_COMPRESSED_RECORD_FIELD ((uint32_t)-1)
+
 #define MAIL_CACHE_IS_UNUSABLE(cache) \
 	((cache)->hdr == NULL)
 
+enum mail_cache_header_flags {
+	/* Some of the records may be compressed. The deflate dictionary used
+	   for them is stored right after this header as
+	   { uint32_t size; unsigned char dict[size]; } padded to 32 bits. */
+	MAIL_CACHE_HEADER_FLAG_COMPRESSED_RECORDS	= 0x01,
+	/* Small fixed size fields are also stored as columns, see
+	   mail_cache_columns_header. The columns follow the compression
+	   dictionary, or if there isn't one, the header. */
+	MAIL_CACHE_HEADER_FLAG_COLUMNS			= 0x02,
+};
+
 struct mail_cache_header {
 	/* Major version is increased only when you can't have backwards
 	   compatibility. If the field doesn't match MAIL_CACHE_MAJOR_VERSION,
@@ -27,7 +51,8 @@ struct mail_cache_header {
 	/* Minor version is increased when the file format changes in a
 	   backwards compatible way. */
 	uint8_t minor_version;
-	uint8_t unused;
+	/* enum mail_cache_header_flags */
+	uint8_t flags;
 
 	/* Unique index file ID, which must match the main index's indexid.
 	   See mail_index_header.indexid. */
@@ -104,6 +129,40 @@ struct mail_cache_record {
 	/* array of { uint32_t field; [ uint32_t size; ] { .. } } */
 };
 
+/* With MAIL_CACHE_HEADER_FLAG_COMPRESSED_RECORDS the record's fields may be
+   replaced by a single compressed blob. Field index is
+   MAIL_CACHE_COMPRESSED_RECORD_FIELD. */
+struct mail_cache_compressed_record {
+	uint32_t field;
+	/* Size of the uncompressed fields array */
+	uint32_t uncompressed_size;
+	/* raw deflate data, padded to 32 bits */
+};
+
+struct mail_cache_columns_header {
+	/* Full size of the columns, including this header */
+	uint32_t size;
+	/* Number of messages in each column */
+	uint32_t uid_count;
+	/* Number of columns */
+	uint32_t columns_count;
+#if 0
+	/* UIDs of the messages in ascending order */
+	uint32_t uids[uid_count];
+	struct mail_cache_column_header columns[columns_count];
+	/* For each column: bitmap of the messages that have the field,
+	   followed by the field values. Both are padded to 32 bits. */
+	uint8_t exists[(uid_count+7)/8];
+	uint8_t values[uid_count][field_size];
+#endif
+};
+
+struct mail_cache_column_header {
+	/* File-specific field index */
+	uint32_t file_field;
+	uint32_t field_size;
+};
+
 struct mail_cache_field_private {
 	struct mail_cache_field field;
 
@@ -114,6 +173,16 @@ struct mail_cache_field_private {
 	   decision to change from TEMP to YES. */
 	uint32_t uid_highwater;
 
+	/* Statistics within this session for the cost based caching
+	   decisions: How many times the field was found from cache, how much
+	   time and I/O it took to recompute it when it wasn't, and how much
+	   space it has used in the cache. */
+	uint32_t lookup_hits;
+	uint32_t recompute_count;
+	uint64_t recompute_usecs, recompute_bytes;
+	uint32_t added_count;
+	uint64_t added_bytes;
+
 	/* Unused fields aren't written to cache file */
 	bool used:1;
 	/* field.decision is pending a write to cache file header. If the
@@ -221,6 +290,11 @@ struct mail_cache {
 	bool map_with_read:1;
 	/* Cache headers count has been capped */
 	bool headers_capped:1;
+
+	/* Inflate state and dictionary for reading compressed records */
+	struct mail_cache_uncompress *uncompress;
+	/* Fixed size field columns of the current cache file */
+	struct mail_cache_columns *columns;
 };
 
 struct mail_cache_loop_track {
@@ -266,6 +340,13 @@ struct mail_cache_view {
 	uint8_t cached_exists_value;
 	uint32_t cached_exists_seq;
 
+	/* Uncompressed copy of the compressed record currently being
+	   iterated. */
+	buffer_t *uncompressed_rec_buf;
+	/* Column position where the next message is expected to be found.
+	   This makes looking up messages in ascending order fast. */
+	unsigned int column_uid_idx_hint;
+
 	/* mail_cache_view_update_cache_decisions() has been used to disable
 	   updating cache decisions. */
 	bool no_decision_updates:1;
@@ -326,6 +407,9 @@ struct mail_cache_lookup_iterate_ctx {
 	   This indicates that the rec points to uncommited transaction's
 	   in-memory buffer. */
 	bool inmemory_field_idx:1;
+	/* rec points to view->uncompressed_rec_buf instead of the cache
+	   file. */
+	bool rec_uncompressed:1;
 };
 
 /* Explicitly lock the cache file. Returns -1 if error / timed out,
@@ -399,6 +483,21 @@ mail_cache_decision_changed_event(struct mail_cache *cache, struct event *event,
 
 bool mail_cache_headers_check_capped(struct mail_cache *cache);
 
+enum mail_cache_field_cost {
+	/* Not enough samples to know */
+	MAIL_CACHE_FIELD_COST_UNKNOWN,
+	/* Cheaper to recompute than to keep in cache */
+	MAIL_CACHE_FIELD_COST_CHEAP,
+	MAIL_CACHE_FIELD_COST_NORMAL,
+	/* Expensive to recompute, so it's worth caching permanently */
+	MAIL_CACHE_FIELD_COST_EXPENSIVE,
+};
+/* Returns the recompute cost of the field based on the statistics
+   collected within this session. Always returns UNKNOWN unless
+   cost_decisions setting is enabled. */
+enum mail_cache_field_cost
+mail_cache_field_get_cost(struct mail_cache *cache, unsigned int field);
+
 struct mail_cache_purge_drop_ctx {
 	struct mail_cache *cache;
 	time_t max_yes_downgrade_time;
@@ -419,6 +518,59 @@ mail_cache_purge_drop_test(struct mail_cache_purge_drop_ctx *ctx,
 int mail_cache_expunge_handler(struct mail_index_sync_map_ctx *sync_ctx,
 			       const void *data, void **sync_context);
 
+/* Returns TRUE if the record in the cache file is compressed. */
+static inline bool
+mail_cache_record_is_compressed(struct mail_cache *cache,
+				const struct mail_cache_record *rec)
+{
+	const uint32_t *field = CONST_PTR_OFFSET(rec, sizeof(*rec));
+
+	return (cache->hdr->flags & MAIL_CACHE_HEADER_FLAG_COMPRESSED_RECORDS) != 0 &&
+		rec->size >= sizeof(*rec) + sizeof(*field) &&
+		*field == MAIL_CACHE_COMPRESSED_RECORD_FIELD;
+}
+/* Uncompress the record in the given cache file offset into buf as a regular
+   mail_cache_record. Returns 0 if ok, -1 if cache is corrupted or there was
+   an I/O error. */
+int mail_cache_record_uncompress(struct mail_cache *cache, uint32_t offset,
+				 buffer_t *buf);
+void mail_cache_uncompress_free(struct mail_cache *cache);
+
+/* Initialize compressing records with the given deflate level and
+   dictionary. */
+struct mail_cache_compress_context *
+mail_cache_compress_init(int level, const void *dict, size_t dict_size);
+void mail_cache_compress_deinit(struct mail_cache_compress_context **ctx);
+/* Append the compressed version of the record to dest. Returns FALSE and
+   leaves dest unchanged if the record didn't become smaller. */
+bool mail_cache_compress_record(struct mail_cache_compress_context *ctx,
+				const struct mail_cache_record *rec,
+				buffer_t *dest);
+
+/* Look up a fixed size field from the columns. Returns 1 if found, 0 if the
+   columns don't have it, -1 if cache is corrupted or there was an I/O
+   error. */
+int mail_cache_lookup_column(struct mail_cache_view *view, buffer_t *dest_buf,
+			     uint32_t seq, unsigned int field_idx);
+void mail_cache_columns_free(struct mail_cache *cache);
+
+/* Create columns for the fields being written to a purged cache file.
+   uids[] contains all the messages written to the new file. Returns NULL if
+   there are no fields suitable for columns. */
+struct mail_cache_columns_builder *
+mail_cache_columns_builder_init(struct mail_cache *cache,
+				const uint32_t *field_file_map,
+				const uint32_t *uids, unsigned int uid_count);
+void mail_cache_columns_builder_deinit(struct mail_cache_columns_builder **builder);
+/* Set the field value for uids[uid_idx]. Fields without a column are
+   ignored. */
+void mail_cache_columns_builder_add(struct mail_cache_columns_builder *builder,
+				    unsigned int uid_idx, unsigned int field_idx,
+				    const void *data, size_t size);
+/* Returns the columns in their file format. */
+const buffer_t *
+mail_cache_columns_builder_get_data(struct mail_cache_columns_builder *builder);
+
 void mail_cache_set_syscall_error(struct mail_cache *cache,
 				  const char *function) ATTR_COLD;
 
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "time-util.h"
 #include "ostream.h"
 #include "nfs-workarounds.h"
 #include "read-full.h"
@@ -13,6 +14,15 @@
 #include <stdio.h>
 #include <sys/stat.h>
 
+/* Number of records sampled for building the compression dictionary */
+#define MAIL_CACHE_COMPRESS_DICT_SAMPLES 16
+/* Highest deflate compression level */
+#define MAIL_CACHE_COMPRESS_MAX_LEVEL 9
+/* Check whether to send a progress event after this many messages */
+#define MAIL_CACHE_PURGE_PROGRESS_CHECK_COUNT 256
+/* Send the progress events at this interval */
+#define MAIL_CACHE_PURGE_PROGRESS_INTERVAL_MSECS 1000
+
 struct mail_cache_copy_context {
 	struct mail_cache *cache;
 	struct event *event;
@@ -22,6 +32,14 @@ struct mail_cache_copy_context {
 	ARRAY(unsigned int) bitmask_pos;
 	uint32_t *field_file_map;
 
+	/* Fixed size field columns being built and the index of the current
+	   message in them */
+	struct mail_cache_columns_builder *columns;
+	unsigned int column_uid_idx;
+
+	/* When the last progress event was sent */
+	struct timeval last_progress;
+
 	uint8_t field_seen_value;
 	bool new_msg;
 };
@@ -94,6 +112,96 @@ mail_cache_purge_field(struct mail_cache_copy_context *ctx,
 	buffer_append(ctx->buffer, field->data, field->size);
 	if ((field->size & 3) != 0)
 		buffer_append_zero(ctx->buffer, 4 - (field->size & 3));
+
+	if (ctx->columns != NULL) {
+		mail_cache_columns_builder_add(ctx->columns, ctx->column_uid_idx,
+					       field->field_idx, field->data,
+					       field->size);
+	}
+}
+
+static void
+mail_cache_copy_record(struct mail_cache_copy_context *ctx,
+		       struct mail_cache_view *cache_view, uint32_t seq,
+		       uint32_t first_new_seq)
+{
+	struct mail_cache_lookup_iterate_ctx iter;
+	struct mail_cache_iterate_field field;
+	struct mail_cache_record cache_rec;
+
+	ctx->new_msg = seq >= first_new_seq;
+	buffer_set_used_size(ctx->buffer, 0);
+
+	ctx->field_seen_value = (ctx->field_seen_value + 1) & UINT8_MAX;
+	if (ctx->field_seen_value == 0) {
+		memset(buffer_get_modifiable_data(ctx->field_seen, NULL),
+		       0, buffer_get_size(ctx->field_seen));
+		ctx->field_seen_value++;
+	}
+	array_clear(&ctx->bitmask_pos);
+
+	i_zero(&cache_rec);
+	buffer_append(ctx->buffer, &cache_rec, sizeof(cache_rec));
+
+	mail_cache_lookup_iter_init(cache_view, seq, &iter);
+	while (mail_cache_lookup_iter_next(&iter, &field) > 0)
+		mail_cache_purge_field(ctx, &field);
+}
+
+static void
+mail_cache_copy_build_dict(struct mail_cache_copy_context *ctx,
+			   struct mail_index_transaction *trans,
+			   struct mail_cache_view *cache_view,
+			   uint32_t first_seq, uint32_t message_count,
+			   uint32_t first_new_seq, buffer_t *dict)
+{
+	const struct mail_cache_record *rec;
+	uint32_t seq, count, samples, i;
+	size_t max_sample_size, size;
+
+	/* Build the dictionary from records sampled evenly across the
+	   mailbox. Deflate refers most cheaply to the end of the dictionary,
+	   so add the newest mails last. */
+	count = message_count - first_seq + 1;
+	samples = I_MIN(count, MAIL_CACHE_COMPRESS_DICT_SAMPLES);
+	max_sample_size = MAIL_CACHE_COMPRESS_DICT_MAX_SIZE / samples;
+	for (i = samples; i > 0; i--) {
+		seq = message_count - (uint64_t)count * (i-1) / samples;
+		if (mail_index_transaction_is_expunged(trans, seq))
+			continue;
+
+		mail_cache_copy_record(ctx, cache_view, seq, first_new_seq);
+		rec = ctx->buffer->data;
+		size = I_MIN(ctx->buffer->used - sizeof(*rec), max_sample_size);
+		buffer_append(dict, rec + 1, size);
+	}
+	i_assert(dict->used <= MAIL_CACHE_COMPRESS_DICT_MAX_SIZE);
+}
+
+static struct mail_cache_columns_builder *
+mail_cache_copy_columns_init(struct mail_cache_copy_context *ctx,
+			     struct mail_index_transaction *trans,
+			     struct mail_index_view *view,
+			     uint32_t first_seq, uint32_t message_count)
+{
+	ARRAY_TYPE(uint32_t) uids;
+	uint32_t seq, uid;
+
+	if (first_seq > message_count)
+		return NULL;
+
+	t_array_init(&uids, message_count - first_seq + 1);
+	for (seq = first_seq; seq <= message_count; seq++) {
+		if (!mail_index_transaction_is_expunged(trans, seq)) {
+			mail_index_lookup_uid(view, seq, &uid);
+			array_push_back(&uids, &uid);
+		}
+	}
+	if (array_count(&uids) == 0)
+		return NULL;
+	return mail_cache_columns_builder_init(ctx->cache, ctx->field_file_map,
+					       array_front(&uids),
+					       array_count(&uids));
 }
 
 static uint32_t get_next_file_seq(struct mail_cache *cache)
@@ -156,8 +264,22 @@ mail_cache_purge_check_field(struct mail_cache_copy_context *ctx,
 {
 	struct mail_cache_field_private *priv = &ctx->cache->fields[field];
 	enum mail_cache_decision_type dec = priv->field.decision;
-
-	switch (mail_cache_purge_drop_test(&ctx->drop_ctx, field)) {
+	enum mail_cache_purge_drop_decision drop_dec =
+		mail_cache_purge_drop_test(&ctx->drop_ctx, field);
+
+	if (drop_dec == MAIL_CACHE_PURGE_DROP_DECISION_NONE &&
+	    (dec & MAIL_CACHE_DECISION_FORCED) == 0 &&
+	    dec != MAIL_CACHE_DECISION_NO &&
+	    priv->field.type == MAIL_CACHE_FIELD_HEADER &&
+	    mail_cache_field_get_cost(ctx->cache, field) ==
+	    MAIL_CACHE_FIELD_COST_CHEAP) {
+		/* The header is cheaper to parse than to keep in cache.
+		   This alone isn't a reason to purge, but since we're
+		   purging anyway drop it now. */
+		drop_dec = MAIL_CACHE_PURGE_DROP_DECISION_DROP;
+	}
+
+	switch (drop_dec) {
 	case MAIL_CACHE_PURGE_DROP_DECISION_NONE:
 		break;
 	case MAIL_CACHE_PURGE_DROP_DECISION_DROP: {
@@ -198,6 +320,27 @@ mail_cache_purge_check_field(struct mail_cache_copy_context *ctx,
 	return priv->used;
 }
 
+static void
+mail_cache_copy_progress(struct mail_cache_copy_context *ctx,
+			 uint32_t seq, uint32_t message_count)
+{
+	struct timeval now;
+
+	i_gettimeofday(&now);
+	if (timeval_diff_msecs(&now, &ctx->last_progress) <
+	    MAIL_CACHE_PURGE_PROGRESS_INTERVAL_MSECS)
+		return;
+	ctx->last_progress = now;
+
+	struct event_passthrough *e =
+		event_create_passthrough(ctx->event)->
+		set_name("mail_cache_purge_progress")->
+		add_int("seq", seq)->
+		add_int("messages_count", message_count);
+	e_debug(e->event(), "Purging in progress: %u/%u messages",
+		seq, message_count);
+}
+
 static int
 mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 		struct event *event, int fd, const char *reason,
@@ -205,16 +348,18 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 		uint32_t *ext_first_seq_r, ARRAY_TYPE(uint32_t) *ext_offsets)
 {
         struct mail_cache_copy_context ctx;
-	struct mail_cache_lookup_iterate_ctx iter;
-	struct mail_cache_iterate_field field;
+	struct mail_cache_compress_context *compress_ctx = NULL;
 	struct mail_index_view *view;
 	struct mail_cache_view *cache_view;
 	const struct mail_index_header *idx_hdr;
 	struct mail_cache_header hdr;
 	struct mail_cache_record cache_rec;
 	struct ostream *output;
+	buffer_t *compress_buf;
+	uoff_t columns_offset = 0;
 	uint32_t message_count, seq, first_new_seq, ext_offset;
 	unsigned int i, used_fields_count, orig_fields_count, record_count;
+	unsigned int compress_level;
 
 	i_assert(reason != NULL);
 
@@ -250,6 +395,7 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 	ctx.field_seen_value = 0;
 	ctx.field_file_map = t_new(uint32_t, cache->fields_count + 1);
 	t_array_init(&ctx.bitmask_pos, 32);
+	i_gettimeofday(&ctx.last_progress);
 
 	/* @UNSAFE: drop unused fields and create a field mapping for
 	   used fields */
@@ -283,48 +429,83 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 	}
 
 	*ext_first_seq_r = seq;
+
+	compress_buf = t_buffer_create(1024);
+	compress_level = I_MIN(cache->index->optimization_set.cache.compress_level,
+			       MAIL_CACHE_COMPRESS_MAX_LEVEL);
+	if (compress_level > 0 && seq <= message_count) {
+		/* write the dictionary right after the header */
+		buffer_t *dict = t_buffer_create(MAIL_CACHE_COMPRESS_DICT_MAX_SIZE);
+		uint32_t dict_size32;
+
+		mail_cache_copy_build_dict(&ctx, trans, cache_view, seq,
+					   message_count, first_new_seq, dict);
+		dict_size32 = dict->used;
+		compress_ctx = mail_cache_compress_init(compress_level,
+							dict->data, dict->used);
+		if ((dict->used & 3) != 0)
+			buffer_append_zero(dict, 4 - (dict->used & 3));
+		o_stream_nsend(output, &dict_size32, sizeof(dict_size32));
+		o_stream_nsend(output, dict->data, dict->used);
+		hdr.flags |= MAIL_CACHE_HEADER_FLAG_COMPRESSED_RECORDS;
+	}
+
+	if (cache->index->optimization_set.cache.fixed_field_columns) {
+		/* reserve space for the columns. they're written once all the
+		   records have been copied. */
+		columns_offset = output->offset;
+		ctx.columns = mail_cache_copy_columns_init(&ctx, trans, view, seq,
+							   message_count);
+		if (ctx.columns != NULL) {
+			const buffer_t *columns_buf =
+				mail_cache_columns_builder_get_data(ctx.columns);
+			o_stream_nsend(output, columns_buf->data,
+				       columns_buf->used);
+			hdr.flags |= MAIL_CACHE_HEADER_FLAG_COLUMNS;
+		}
+	}
+
 	i_array_init(ext_offsets, message_count); record_count = 0;
 	for (; seq <= message_count; seq++) {
+		if (seq % MAIL_CACHE_PURGE_PROGRESS_CHECK_COUNT == 0)
+			mail_cache_copy_progress(&ctx, seq, message_count);
 		if (mail_index_transaction_is_expunged(trans, seq)) {
 			array_append_zero(ext_offsets);
 			continue;
 		}
 
-		ctx.new_msg = seq >= first_new_seq;
-		buffer_set_used_size(ctx.buffer, 0);
-
-		ctx.field_seen_value = (ctx.field_seen_value + 1) & UINT8_MAX;
-		if (ctx.field_seen_value == 0) {
-			memset(buffer_get_modifiable_data(ctx.field_seen, NULL),
-			       0, buffer_get_size(ctx.field_seen));
-			ctx.field_seen_value++;
-		}
-		array_clear(&ctx.bitmask_pos);
-
-		i_zero(&cache_rec);
-		buffer_append(ctx.buffer, &cache_rec, sizeof(cache_rec));
-
-		mail_cache_lookup_iter_init(cache_view, seq, &iter);
-		while (mail_cache_lookup_iter_next(&iter, &field) > 0)
-			mail_cache_purge_field(&ctx, &field);
-
+		mail_cache_copy_record(&ctx, cache_view, seq, first_new_seq);
 		if (ctx.buffer->used == sizeof(cache_rec) ||
 		    ctx.buffer->used > cache->index->optimization_set.cache.record_max_size) {
 			/* nothing cached */
 			ext_offset = 0;
 		} else {
 			mail_index_lookup_uid(view, seq, max_uid_r);
+			i_zero(&cache_rec);
 			cache_rec.size = ctx.buffer->used;
 			ext_offset = output->offset;
 			buffer_write(ctx.buffer, 0, &cache_rec,
 				     sizeof(cache_rec));
-			o_stream_nsend(output, ctx.buffer->data, cache_rec.size);
+			buffer_set_used_size(compress_buf, 0);
+			if (compress_ctx != NULL &&
+			    mail_cache_compress_record(compress_ctx,
+						       ctx.buffer->data,
+						       compress_buf)) {
+				o_stream_nsend(output, compress_buf->data,
+					       compress_buf->used);
+			} else {
+				o_stream_nsend(output, ctx.buffer->data,
+					       cache_rec.size);
+			}
 			record_count++;
 		}
+		ctx.column_uid_idx++;
 
 		array_push_back(ext_offsets, &ext_offset);
 	}
 	i_assert(orig_fields_count == cache->fields_count);
+	if (compress_ctx != NULL)
+		mail_cache_compress_deinit(&compress_ctx);
 
 	hdr.record_count = record_count;
 	hdr.field_header_offset = mail_index_uint32_to_offset(output->offset);
@@ -336,6 +517,13 @@ mail_cache_copy(struct mail_cache *cache, struct mail_index_transaction *trans,
 	buffer_free(&ctx.field_seen);
 
 	*file_size_r = output->offset;
+	if (ctx.columns != NULL) {
+		const buffer_t *columns_buf =
+			mail_cache_columns_builder_get_data(ctx.columns);
+		(void)o_stream_seek(output, columns_offset);
+		o_stream_nsend(output, columns_buf->data, columns_buf->used);
+		mail_cache_columns_builder_deinit(&ctx.columns);
+	}
 	(void)o_stream_seek(output, 0);
 	o_stream_nsend(output, &hdr, sizeof(hdr));
 
@@ -631,7 +819,8 @@ int mail_cache_purge(struct mail_cache *cache, uint32_t purge_file_seq,
 	return ret;
 }
 
-bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r)
+static bool
+mail_cache_want_purge(struct mail_cache *cache, const char **reason_r)
 {
 	if (cache->need_purge_file_seq == 0)
 		return FALSE; /* delayed purging not requested */
@@ -651,6 +840,34 @@ bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r)
 	return TRUE;
 }
 
+bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r)
+{
+	uoff_t background_min_size =
+		cache->index->optimization_set.cache.purge_background_min_size;
+
+	if (!mail_cache_want_purge(cache, reason_r))
+		return FALSE;
+	if (background_min_size != 0 &&
+	    cache->last_stat_size >= background_min_size) {
+		/* The file is large enough that purging it could stall the
+		   session for a while. Leave it for
+		   mail_cache_purge_background(). */
+		return FALSE;
+	}
+	return TRUE;
+}
+
+int mail_cache_purge_background(struct mail_cache *cache)
+{
+	const char *reason;
+
+	if (!mail_cache_want_purge(cache, &reason))
+		return 0;
+	if (mail_cache_purge(cache, cache->need_purge_file_seq, reason) < 0)
+		return -1;
+	return 1;
+}
+
 void mail_cache_purge_later(struct mail_cache *cache, const char *reason)
 {
 	i_assert(cache->hdr != NULL);
@@ -697,6 +914,8 @@ mail_cache_purge_drop_test(struct mail_cache_purge_drop_ctx *ctx,
 
 	if ((dec & MAIL_CACHE_DECISION_FORCED) != 0)
 		return MAIL_CACHE_PURGE_DROP_DECISION_NONE;
+	enum mail_cache_field_cost cost =
+		mail_cache_field_get_cost(ctx->cache, field);
 	if (dec != MAIL_CACHE_DECISION_NO &&
 	    priv->field.last_used < ctx->max_temp_drop_time) {
 		/* YES or TEMP decision field hasn't been accessed for a long
@@ -704,7 +923,8 @@ mail_cache_purge_drop_test(struct mail_cache_purge_drop_ctx *ctx,
 		return MAIL_CACHE_PURGE_DROP_DECISION_DROP;
 	}
 	if (dec == MAIL_CACHE_DECISION_YES &&
-	    priv->field.last_used < ctx->max_yes_downgrade_time) {
+	    priv->field.last_used < ctx->max_yes_downgrade_time &&
+	    cost != MAIL_CACHE_FIELD_COST_EXPENSIVE) {
 		/* YES decision field hasn't been accessed for a while
 		   now. Change its decision to TEMP. */
 		return MAIL_CACHE_PURGE_DROP_DECISION_TO_TEMP;
@@ -837,6 +837,8 @@ void mail_cache_add(struct mail_cache_transaction_ctx *ctx, uint32_t seq,
 	   setting it here, because cache purging may run and clear it. */
 	uint8_t field_idx_set = 1;
 	array_idx_set(&ctx->cache_field_idx_used, field_idx, &field_idx_set);
+	ctx->cache->fields[field_idx].added_count++;
+	ctx->cache->fields[field_idx].added_bytes += data_size;
 
 	/* Remember that this value exists for the mail, in case we try to look
 	   it up. Note that this gets forgotten whenever changing the mail. */
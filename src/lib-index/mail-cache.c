@@ -115,8 +115,13 @@ static void mail_cache_init_file_cache(struct mail_cache *cache)
 {
 	struct stat st;
 
-	if (cache->file_cache != NULL)
+	if (cache->file_cache != NULL) {
+		struct mmap_advice advice;
+
+		mail_index_get_mmap_advice(cache->index, &advice);
+		file_cache_set_advice(cache->file_cache, &advice);
 		file_cache_set_fd(cache->file_cache, cache->fd);
+	}
 
 	if (fstat(cache->fd, &st) == 0) {
 		if (cache->file_cache != NULL)
@@ -403,6 +408,8 @@ mail_cache_map_full(struct mail_cache *cache, size_t offset, size_t size,
 		    const void **data_r, bool *corrupted_r)
 {
 	struct stat st;
+	struct mmap_advice advice;
+	struct mmap_advice_stats stats;
 	const void *data;
 	ssize_t ret;
 	size_t orig_size = size;
@@ -492,7 +499,9 @@ mail_cache_map_full(struct mail_cache *cache, size_t offset, size_t size,
 	if (cache->read_buf != NULL)
 		buffer_set_used_size(cache->read_buf, 0);
 
-	cache->mmap_base = mmap_ro_file(cache->fd, &cache->mmap_length);
+	mail_index_get_mmap_advice(cache->index, &advice);
+	cache->mmap_base = mmap_ro_file_advice(cache->fd, &cache->mmap_length,
+					       &advice, &stats);
 	if (cache->mmap_base == MAP_FAILED) {
 		cache->mmap_base = NULL;
 		if (ioloop_time != cache->last_mmap_error_time) {
@@ -503,6 +512,8 @@ mail_cache_map_full(struct mail_cache *cache, size_t offset, size_t size,
 		cache->mmap_length = 0;
 		return -1;
 	}
+	if (cache->mmap_base != NULL)
+		mail_index_mmap_event(cache->event, cache->filepath, &stats);
 	*data_r = offset > cache->mmap_length ? NULL :
 		CONST_PTR_OFFSET(cache->mmap_base, offset);
 	return mail_cache_map_finish(cache, offset, orig_size,
@@ -622,6 +633,8 @@ void mail_cache_free(struct mail_cache **_cache)
 	mail_cache_file_close(cache);
 
 	buffer_free(&cache->read_buf);
+	mail_cache_uncompress_free(cache);
+	mail_cache_columns_free(cache);
 	hash_table_destroy(&cache->field_name_hash);
 	pool_unref(&cache->field_pool);
 	event_unref(&cache->event);
@@ -944,6 +957,19 @@ int mail_cache_append(struct mail_cache *cache, const void *data, size_t size,
 	return 0;
 }
 
+void mail_cache_get_memory_usage(struct mail_cache *cache,
+				 uint64_t *mmap_bytes_r,
+				 uint64_t *memory_bytes_r)
+{
+	*mmap_bytes_r = *memory_bytes_r = 0;
+	if (cache->mmap_base != NULL)
+		*mmap_bytes_r = cache->mmap_length;
+	else if (cache->file_cache != NULL)
+		*memory_bytes_r = cache->mmap_length;
+	else if (cache->read_buf != NULL)
+		*memory_bytes_r = buffer_get_size(cache->read_buf);
+}
+
 bool mail_cache_exists(struct mail_cache *cache)
 {
 	return !MAIL_CACHE_IS_UNUSABLE(cache);
@@ -977,6 +1003,7 @@ void mail_cache_view_close(struct mail_cache_view **_view)
 
 	DLLIST_REMOVE(&view->cache->views, view);
 	buffer_free(&view->cached_exists_buf);
+	buffer_free(&view->uncompressed_rec_buf);
 	i_free(view);
 }
 
@@ -90,9 +90,20 @@ mail_cache_register_get_field(struct mail_cache *cache, unsigned int field_idx);
 struct mail_cache_field *
 mail_cache_register_get_list(struct mail_cache *cache, pool_t pool,
 			     unsigned int *count_r);
-
-/* Returns TRUE if cache should be purged. */
+/* Tell how long it took to recompute the field's value for a message that
+   didn't have it in cache, and how many bytes of the message were read for
+   it. This is used by the cost based caching decisions. */
+void mail_cache_field_add_recompute_cost(struct mail_cache *cache,
+					 unsigned int field_idx,
+					 uint64_t usecs, uoff_t bytes);
+
+/* Returns TRUE if cache should be purged. Purging large cache files may be
+   delayed to mail_cache_purge_background(). */
 bool mail_cache_need_purge(struct mail_cache *cache, const char **reason_r);
+/* Purge the cache file if purging was requested, including purges that were
+   delayed by purge_background_min_size. Returns 1 if purged, 0 if purging
+   wasn't needed, -1 if error. */
+int mail_cache_purge_background(struct mail_cache *cache);
 /* Set cache file to be purged later. */
 void mail_cache_purge_later(struct mail_cache *cache, const char *reason);
 /* Don't try to purge the cache file later after all. */
@@ -190,6 +201,12 @@ void mail_cache_set_seq_corrupted_reason(struct mail_cache_view *cache_view,
 					 uint32_t seq, const char *reason)
 	ATTR_COLD;
 
+/* Returns the number of bytes of the cache file that are currently mmap()ed
+   or read into memory. */
+void mail_cache_get_memory_usage(struct mail_cache *cache,
+				 uint64_t *mmap_bytes_r,
+				 uint64_t *memory_bytes_r);
+
 /* Returns human-readable reason for why a cached field is missing for
    the specified mail. This is mainly for debugging purposes, so the exact
    field doesn't matter here. */
@@ -33,6 +33,8 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 	struct mail_index *index = map->index;
 	struct mail_index_record_map *rec_map = map->rec_map;
 	const struct mail_index_header *hdr;
+	struct mmap_advice advice;
+	struct mmap_advice_stats stats;
 	const char *error;
 
 	i_assert(rec_map->mmap_base == NULL);
@@ -45,8 +47,10 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 		return -1;
 	}
 
-	rec_map->mmap_base = mmap(NULL, file_size, PROT_READ | PROT_WRITE,
-				  MAP_PRIVATE, index->fd, 0);
+	mail_index_get_mmap_advice(index, &advice);
+	rec_map->mmap_base = mmap_fd_advice(index->fd, file_size,
+					    PROT_READ | PROT_WRITE, MAP_PRIVATE,
+					    &advice, &stats);
 	if (rec_map->mmap_base == MAP_FAILED) {
 		rec_map->mmap_base = NULL;
 		if (ioloop_time != index->last_mmap_error_time) {
@@ -57,6 +61,7 @@ static int mail_index_mmap(struct mail_index_map *map, uoff_t file_size)
 		return -1;
 	}
 	rec_map->mmap_size = file_size;
+	mail_index_mmap_event(index->event, index->filepath, &stats);
 
 	hdr = rec_map->mmap_base;
 	if (rec_map->mmap_size >
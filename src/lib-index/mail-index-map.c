@@ -494,6 +494,122 @@ void mail_index_map_move_to_memory(struct mail_index_map *map)
 	}
 }
 
+bool mail_index_record_map_move_to_private_expunge(struct mail_index_map *map,
+						   const struct seq_range *ranges,
+						   unsigned int count)
+{
+	struct mail_index_record_map *new_map, *old_map = map->rec_map;
+	const struct mail_index_record *rec;
+	unsigned int i, record_size = map->hdr.record_size;
+	uint32_t seq, messages_count = map->hdr.messages_count;
+	buffer_t *buffer;
+	size_t size;
+
+	if (old_map->mmap_base == NULL && array_count(&old_map->maps) == 1)
+		return FALSE;
+
+	/* Copy only the records that are left after the expunges. This avoids
+	   copying the whole rec_map first and then moving most of it again
+	   in memory. */
+	size = messages_count * record_size;
+	buffer = buffer_create_dynamic(default_pool,
+				       size + I_MAX(size/100, 1024));
+	for (i = 0, seq = 1; i < count; i++) {
+		i_assert(ranges[i].seq1 >= seq);
+		i_assert(ranges[i].seq2 <= messages_count);
+		buffer_append(buffer, MAIL_INDEX_REC_AT_SEQ(map, seq),
+			      (ranges[i].seq1 - seq) * record_size);
+		seq = ranges[i].seq2 + 1;
+	}
+	if (seq <= messages_count) {
+		buffer_append(buffer, MAIL_INDEX_REC_AT_SEQ(map, seq),
+			      (messages_count - seq + 1) * record_size);
+	}
+
+	if (array_count(&old_map->maps) == 1) {
+		/* only we refer to the mmap()ed rec_map - replace it */
+		new_map = old_map;
+		if (munmap(new_map->mmap_base, new_map->mmap_size) < 0)
+			mail_index_set_syscall_error(map->index, "munmap()");
+		new_map->mmap_base = NULL;
+	} else {
+		new_map = mail_index_record_map_alloc(map);
+		if (old_map->modseq != NULL)
+			new_map->modseq = mail_index_map_modseq_clone(old_map->modseq);
+		mail_index_record_map_unlink(map);
+		map->rec_map = new_map;
+	}
+	new_map->buffer = buffer;
+	new_map->records = buffer_get_modifiable_data(buffer, NULL);
+	new_map->records_count = buffer->used / record_size;
+	if (new_map->records_count == 0)
+		new_map->last_appended_uid = 0;
+	else {
+		rec = MAIL_INDEX_MAP_IDX(map, new_map->records_count - 1);
+		new_map->last_appended_uid = rec->uid;
+	}
+	return TRUE;
+}
+
+struct mail_index_map_memory_usage_context {
+	ARRAY(struct mail_index_map *) maps;
+	ARRAY(struct mail_index_record_map *) rec_maps;
+	struct mail_index_memory_usage *usage;
+};
+
+static void
+mail_index_map_add_memory_usage(struct mail_index_map_memory_usage_context *ctx,
+				struct mail_index_map *map)
+{
+	struct mail_index_memory_usage *usage = ctx->usage;
+	struct mail_index_record_map *rec_map = map->rec_map;
+	struct mail_index_map *seen_map;
+	struct mail_index_record_map *seen_rec_map;
+
+	array_foreach_elem(&ctx->maps, seen_map) {
+		if (seen_map == map)
+			return;
+	}
+	array_push_back(&ctx->maps, &map);
+	usage->maps_count++;
+	usage->headers_bytes += map->hdr_copy_buf->used;
+
+	array_foreach_elem(&ctx->rec_maps, seen_rec_map) {
+		if (seen_rec_map == rec_map)
+			return;
+	}
+	array_push_back(&ctx->rec_maps, &rec_map);
+	usage->rec_maps_count++;
+	if (rec_map->mmap_base != NULL)
+		usage->records_mmap_bytes += rec_map->mmap_size;
+	else if (rec_map->buffer != NULL)
+		usage->records_memory_bytes += buffer_get_size(rec_map->buffer);
+	usage->ext_records_bytes += (uint64_t)rec_map->records_count *
+		(map->hdr.record_size - sizeof(struct mail_index_record));
+	if (rec_map->modseq != NULL) {
+		usage->modseqs_bytes +=
+			mail_index_map_modseq_get_memory_usage(rec_map->modseq);
+	}
+}
+
+void mail_index_maps_add_memory_usage(struct mail_index *index,
+				      struct mail_index_memory_usage *usage)
+{
+	struct mail_index_map_memory_usage_context ctx;
+	struct mail_index_view *view;
+
+	i_zero(&ctx);
+	ctx.usage = usage;
+	t_array_init(&ctx.maps, 8);
+	t_array_init(&ctx.rec_maps, 8);
+	if (index->map != NULL)
+		mail_index_map_add_memory_usage(&ctx, index->map);
+	for (view = index->views; view != NULL; view = view->next) {
+		if (view->map != NULL)
+			mail_index_map_add_memory_usage(&ctx, view->map);
+	}
+}
+
 bool mail_index_map_get_ext_idx(struct mail_index_map *map,
 				uint32_t ext_id, uint32_t *idx_r)
 {
@@ -7,7 +7,10 @@
 #include "mail-index-sync-private.h"
 #include "mail-index-modseq.h"
 
-ARRAY_DEFINE_TYPE(modseqs, uint64_t);
+/* The per-flag modseqs are stored as 32bit values relative to
+   metadata_modseqs.base_modseq. This halves their memory usage compared to
+   storing the full 64bit modseqs. */
+ARRAY_DEFINE_TYPE(modseqs, uint32_t);
 
 enum modseq_metadata_idx {
 	/* must be in the same order as enum mail_flags */
@@ -21,7 +24,9 @@ enum modseq_metadata_idx {
 };
 
 struct metadata_modseqs {
+	/* modseq - base_modseq + 1, or 0 if the modseq isn't known */
 	ARRAY_TYPE(modseqs) modseqs;
+	uint64_t base_modseq;
 };
 
 struct mail_index_map_modseq {
@@ -228,7 +233,7 @@ modseq_idx_lookup(struct mail_index_map_modseq *mmap,
 		  unsigned int idx, uint32_t seq)
 {
 	const struct metadata_modseqs *metadata;
-	const uint64_t *modseqs;
+	const uint32_t *modseqs;
 	unsigned int count;
 
 	metadata = array_get(&mmap->metadata_modseqs, &count);
@@ -236,7 +241,9 @@ modseq_idx_lookup(struct mail_index_map_modseq *mmap,
 		return 0;
 
 	modseqs = array_get(&metadata[idx].modseqs, &count);
-	return seq > count ? 0 : modseqs[seq-1];
+	if (seq > count || modseqs[seq-1] == 0)
+		return 0;
+	return metadata[idx].base_modseq + modseqs[seq-1] - 1;
 }
 
 uint64_t mail_index_modseq_lookup_flags(struct mail_index_view *view,
@@ -572,13 +579,24 @@ void mail_index_modseq_expunge(struct mail_index_modseq_sync *ctx,
 }
 
 static void
-modseqs_update(ARRAY_TYPE(modseqs) *array, uint32_t seq1, uint32_t seq2,
-	       uint64_t value)
+modseqs_update(struct metadata_modseqs *metadata, uint32_t seq1, uint32_t seq2,
+	       uint64_t modseq)
 {
-	uint64_t *modseqp;
+	uint32_t value, *modseqp;
+
+	if (modseq < metadata->base_modseq ||
+	    modseq - metadata->base_modseq >= (uint32_t)-1) {
+		/* The modseq can't be stored relative to the current base.
+		   Forget the existing modseqs and start again using this
+		   modseq as the base. The lookups fall back to the messages'
+		   modseqs, which are at least as high. */
+		array_clear(&metadata->modseqs);
+		metadata->base_modseq = modseq;
+	}
+	value = modseq - metadata->base_modseq + 1;
 
 	for (; seq1 <= seq2; seq1++) {
-		modseqp = array_idx_get_space(array, seq1-1);
+		modseqp = array_idx_get_space(&metadata->modseqs, seq1-1);
 		if (*modseqp < value)
 			*modseqp = value;
 	}
@@ -599,9 +617,11 @@ modseqs_idx_update(struct mail_index_modseq_sync *ctx, unsigned int idx,
 
 	modseq = mail_transaction_log_view_get_prev_modseq(ctx->log_view);
 	metadata = array_idx_get_space(&ctx->mmap->metadata_modseqs, idx);
-	if (!array_is_created(&metadata->modseqs))
+	if (!array_is_created(&metadata->modseqs)) {
 		i_array_init(&metadata->modseqs, seq2 + 16);
-	modseqs_update(&metadata->modseqs, seq1, seq2, modseq);
+		metadata->base_modseq = modseq;
+	}
+	modseqs_update(metadata, seq1, seq2, modseq);
 }
 
 void mail_index_modseq_update_flags(struct mail_index_modseq_sync *ctx,
@@ -663,6 +683,8 @@ mail_index_map_modseq_clone(const struct mail_index_map_modseq *mmap)
 				     array_count(&src_metadata[i].modseqs));
 			array_append_array(&dest_metadata->modseqs,
 					   &src_metadata[i].modseqs);
+			dest_metadata->base_modseq =
+				src_metadata[i].base_modseq;
 		}
 	}
 	return new_mmap;
@@ -683,6 +705,21 @@ void mail_index_map_modseq_free(struct mail_index_map_modseq **_mmap)
 	i_free(mmap);
 }
 
+uint64_t mail_index_map_modseq_get_memory_usage(const struct mail_index_map_modseq *mmap)
+{
+	const struct metadata_modseqs *metadata;
+	uint64_t size;
+
+	size = array_count(&mmap->metadata_modseqs) * sizeof(*metadata);
+	array_foreach(&mmap->metadata_modseqs, metadata) {
+		if (array_is_created(&metadata->modseqs)) {
+			size += array_count(&metadata->modseqs) *
+				sizeof(uint32_t);
+		}
+	}
+	return size;
+}
+
 bool mail_index_modseq_get_next_log_offset(struct mail_index_view *view,
 					   uint64_t modseq, uint32_t *log_seq_r,
 					   uoff_t *log_offset_r)
@@ -58,6 +58,8 @@ void mail_index_modseq_reset_keywords(struct mail_index_modseq_sync *ctx,
 struct mail_index_map_modseq *
 mail_index_map_modseq_clone(const struct mail_index_map_modseq *mmap);
 void mail_index_map_modseq_free(struct mail_index_map_modseq **mmap);
+/* Returns the number of bytes used by the in-memory modseqs. */
+uint64_t mail_index_map_modseq_get_memory_usage(const struct mail_index_map_modseq *mmap);
 
 bool mail_index_modseq_get_next_log_offset(struct mail_index_view *view,
 					   uint64_t modseq, uint32_t *log_seq_r,
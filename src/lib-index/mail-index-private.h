@@ -12,6 +12,8 @@
 struct mail_transaction_header;
 struct mail_transaction_log_view;
 struct mail_index_sync_map_ctx;
+struct mmap_advice;
+struct mmap_advice_stats;
 
 /* How large index files to mmap() instead of reading to memory. */
 #define MAIL_INDEX_MMAP_MIN_SIZE (1024*64)
@@ -373,6 +375,16 @@ struct mail_index_map *mail_index_map_clone(const struct mail_index_map *map);
 void mail_index_record_map_move_to_private(struct mail_index_map *map);
 /* If map points to mmap()ed index, copy it to the memory. */
 void mail_index_map_move_to_memory(struct mail_index_map *map);
+/* Add the memory usage of the index's map and its views' maps to usage. */
+void mail_index_maps_add_memory_usage(struct mail_index *index,
+				      struct mail_index_memory_usage *usage);
+/* If map's rec_map is shared with other maps or mmap()ed, replace it with a
+   private in-memory copy that doesn't contain the records in the given
+   sequence ranges. Returns FALSE if the rec_map was already private and in
+   memory, so the records need to be removed from it by the caller. */
+bool mail_index_record_map_move_to_private_expunge(struct mail_index_map *map,
+						   const struct seq_range *ranges,
+						   unsigned int count);
 
 void mail_index_fchown(struct mail_index *index, int fd, const char *path);
 
@@ -419,6 +431,13 @@ unsigned int mail_index_map_ext_hdr_offset(unsigned int name_len);
 
 void mail_index_fsck_locked(struct mail_index *index);
 
+/* Returns the mmap() advice based on the optimization settings. */
+void mail_index_get_mmap_advice(struct mail_index *index,
+				struct mmap_advice *advice_r);
+/* Send a debug event about mmap()ing the file. */
+void mail_index_mmap_event(struct event *event, const char *path,
+			   const struct mmap_advice_stats *stats);
+
 /* Log an error and set it as the index's current error that is available
    with mail_index_get_error_message(). */
 void mail_index_set_error(struct mail_index *index, const char *fmt, ...)
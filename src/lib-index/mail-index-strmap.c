@@ -8,6 +8,7 @@
 #include "file-lock.h"
 #include "file-dotlock.h"
 #include "crc32.h"
+#include "primes.h"
 #include "safe-mkstemp.h"
 #include "str.h"
 #include "mail-index-private.h"
@@ -186,6 +187,7 @@ mail_index_strmap_view_open(struct mail_index_strmap *strmap,
 			    const struct hash2_table **hash_r)
 {
 	struct mail_index_strmap_view *view;
+	unsigned int messages_count;
 
 	view = i_new(struct mail_index_strmap_view, 1);
 	view->strmap = strmap;
@@ -196,9 +198,14 @@ mail_index_strmap_view_open(struct mail_index_strmap *strmap,
 	view->cb_context = context;
 	view->next_str_idx = 1;
 
-	i_array_init(&view->recs, 64);
-	i_array_init(&view->recs_crc32, 64);
-	view->hash = hash2_create(0, sizeof(struct mail_index_strmap_rec),
+	/* Each message has at least one record. Reserve space for them
+	   already, so huge mailboxes don't need to grow the arrays and
+	   rehash the whole hash table many times while syncing. */
+	messages_count = mail_index_view_get_messages_count(idx_view);
+	i_array_init(&view->recs, I_MAX(messages_count, 64));
+	i_array_init(&view->recs_crc32, I_MAX(messages_count, 64));
+	view->hash = hash2_create(primes_closest(messages_count),
+				  sizeof(struct mail_index_strmap_rec),
 				  mail_index_strmap_hash_key,
 				  mail_index_strmap_hash_cmp, view);
 	*recs_r = &view->recs;
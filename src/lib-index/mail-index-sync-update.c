@@ -71,7 +71,7 @@ static void mail_index_sync_replace_map(struct mail_index_sync_map_ctx *ctx,
 }
 
 static struct mail_index_map *
-mail_index_sync_move_to_private_memory(struct mail_index_sync_map_ctx *ctx)
+mail_index_sync_move_to_private_map(struct mail_index_sync_map_ctx *ctx)
 {
 	struct mail_index_map *map = ctx->view->map;
 
@@ -82,7 +82,15 @@ mail_index_sync_move_to_private_memory(struct mail_index_sync_map_ctx *ctx)
 		mail_index_sync_replace_map(ctx, map);
 		i_assert(ctx->view->map == map);
 	}
+	return map;
+}
+
+static struct mail_index_map *
+mail_index_sync_move_to_private_memory(struct mail_index_sync_map_ctx *ctx)
+{
+	struct mail_index_map *map;
 
+	map = mail_index_sync_move_to_private_map(ctx);
 	if (!MAIL_INDEX_MAP_IS_IN_MEMORY(ctx->view->map)) {
 		/* map points to mmap()ed area, copy it into memory. */
 		mail_index_map_move_to_memory(ctx->view->map);
@@ -149,6 +157,98 @@ mail_index_header_update_counts(struct mail_index_header *hdr,
 	return 0;
 }
 
+static int
+mail_index_header_update_counts_range(struct mail_index_header *hdr,
+				      bool seen_added, uint32_t seen_changes,
+				      bool deleted_added,
+				      uint32_t deleted_changes,
+				      const char **error_r)
+{
+	uint32_t count;
+	int ret = 0;
+
+	/* This is the same as calling mail_index_header_update_counts() for
+	   each changed message, when all the messages' flags were changed
+	   the same way. */
+	if (seen_changes == 0)
+		;
+	else if (!seen_added) {
+		count = I_MIN(seen_changes, hdr->seen_messages_count);
+		hdr->seen_messages_count -= count;
+		if (count < seen_changes) {
+			*error_r = "Seen counter wrong";
+			ret = -1;
+		}
+	} else if (hdr->seen_messages_count >= hdr->messages_count) {
+		*error_r = "Seen counter wrong";
+		ret = -1;
+	} else {
+		count = I_MIN(seen_changes,
+			      hdr->messages_count - hdr->seen_messages_count);
+		hdr->seen_messages_count += count;
+		if (hdr->seen_messages_count == hdr->messages_count)
+			hdr->first_unseen_uid_lowwater = hdr->next_uid;
+		if (count < seen_changes) {
+			*error_r = "Seen counter wrong";
+			ret = -1;
+		}
+	}
+
+	if (deleted_changes == 0)
+		;
+	else if (deleted_added) {
+		hdr->deleted_messages_count += deleted_changes;
+		if (hdr->deleted_messages_count > hdr->messages_count) {
+			*error_r = "Deleted counter wrong";
+			ret = -1;
+		}
+	} else if (hdr->deleted_messages_count > hdr->messages_count) {
+		*error_r = "Deleted counter wrong";
+		ret = -1;
+	} else {
+		count = I_MIN(deleted_changes, hdr->deleted_messages_count);
+		hdr->deleted_messages_count -= count;
+		if (count > 0 && hdr->deleted_messages_count == 0)
+			hdr->first_deleted_uid_lowwater = hdr->next_uid;
+		if (count < deleted_changes) {
+			*error_r = "Deleted counter wrong";
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+static bool
+mail_index_sync_maps_have_uid(struct mail_index_sync_map_ctx *ctx,
+			      uint32_t uid)
+{
+	struct mail_index_map *const *mapp;
+
+	array_foreach(&ctx->view->map->rec_map->maps, mapp) {
+		if (uid >= (*mapp)->hdr.next_uid)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void
+mail_index_sync_header_update_counts_all_range(struct mail_index_sync_map_ctx *ctx,
+					       bool seen_added,
+					       uint32_t seen_changes,
+					       bool deleted_added,
+					       uint32_t deleted_changes)
+{
+	struct mail_index_map *const *mapp;
+	const char *error;
+
+	array_foreach(&ctx->view->map->rec_map->maps, mapp) {
+		if (mail_index_header_update_counts_range(&(*mapp)->hdr,
+				seen_added, seen_changes,
+				deleted_added, deleted_changes, &error) < 0)
+			mail_index_sync_set_corrupted(ctx, "%s", error);
+	}
+}
+
 static void
 mail_index_sync_header_update_counts_all(struct mail_index_sync_map_ctx *ctx,
 					 uint32_t uid,
@@ -243,15 +343,24 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 {
 	struct mail_index_map *map;
 	const struct seq_range *range;
+	const struct mail_index_record *rec;
 	unsigned int i, count;
-	uint32_t dest_seq1, prev_seq2, orig_rec_count;
+	uint32_t dest_seq1, prev_seq2, orig_rec_count, seq;
+	bool copy_records;
 
 	range = array_get(seqs, &count);
 	if (count == 0)
 		return;
 
-	/* Get a private in-memory rec_map, which we can modify. */
-	map = mail_index_sync_get_atomic_map(ctx);
+	/* Get a private map. If its rec_map is shared with other maps or
+	   mmap()ed, it needs to be copied. Delay that until the expunged
+	   records are no longer needed, so they don't need to be copied at
+	   all. Otherwise the rec_map can be modified in place. */
+	map = mail_index_sync_move_to_private_map(ctx);
+	copy_records = !MAIL_INDEX_MAP_IS_IN_MEMORY(map) ||
+		array_count(&map->rec_map->maps) > 1;
+	if (!copy_records)
+		map = mail_index_sync_get_atomic_map(ctx);
 
 	/* call the expunge handlers first */
 	if (sync_expunge_handlers_init(ctx)) {
@@ -261,22 +370,38 @@ sync_expunge_range(struct mail_index_sync_map_ctx *ctx, const ARRAY_TYPE(seq_ran
 		}
 	}
 
+	for (i = 0; i < count; i++) {
+		for (seq = range[i].seq1; seq <= range[i].seq2; seq++) {
+			rec = MAIL_INDEX_REC_AT_SEQ(map, seq);
+			mail_index_sync_header_update_counts(ctx, rec->uid, rec->flags, 0);
+		}
+	}
+
+	if (copy_records) {
+		if (!mail_index_record_map_move_to_private_expunge(map, range,
+								   count))
+			i_unreached();
+		mail_index_modseq_sync_map_replaced(ctx->modseq_ctx);
+		for (i = 0; i < count; i++) {
+			map->hdr.messages_count -=
+				range[i].seq2 - range[i].seq1 + 1;
+			mail_index_modseq_expunge(ctx->modseq_ctx,
+						  range[i].seq1, range[i].seq2);
+		}
+		i_assert(map->rec_map->records_count == map->hdr.messages_count);
+		return;
+	}
+
 	prev_seq2 = 0;
 	dest_seq1 = 1;
 	orig_rec_count = map->rec_map->records_count;
 	for (i = 0; i < count; i++) {
 		uint32_t seq1 = range[i].seq1;
 		uint32_t seq2 = range[i].seq2;
-		struct mail_index_record *rec;
-		uint32_t seq_count, seq;
+		uint32_t seq_count;
 
 		i_assert(seq1 > prev_seq2);
 
-		for (seq = seq1; seq <= seq2; seq++) {
-			rec = MAIL_INDEX_REC_AT_SEQ(map, seq);
-			mail_index_sync_header_update_counts(ctx, rec->uid, rec->flags, 0);
-		}
-
 		if (prev_seq2+1 <= seq1-1) {
 			/* @UNSAFE: move (prev_seq2+1) .. (seq1-1) to its
 			   final location in the map if necessary */
@@ -436,8 +561,9 @@ static int sync_flag_update(const struct mail_transaction_flag_update *u,
 {
 	struct mail_index_view *view = ctx->view;
 	struct mail_index_record *rec;
-	uint8_t flag_mask, old_flags;
-	uint32_t seq, seq1, seq2;
+	uint8_t flag_mask, old_flags, changed_flags;
+	uint32_t seq, seq1, seq2, seen_changes, deleted_changes;
+	uint32_t first_unseen_uid, first_deleted_uid;
 
 	if (!mail_index_lookup_seq_range(view, u->uid1, u->uid2, &seq1, &seq2))
 		return 1;
@@ -461,7 +587,9 @@ static int sync_flag_update(const struct mail_transaction_flag_update *u,
 			rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
 			rec->flags = (rec->flags & flag_mask) | u->add_flags;
 		}
-	} else {
+	} else if (!mail_index_sync_maps_have_uid(ctx,
+			MAIL_INDEX_REC_AT_SEQ(view->map, seq2)->uid)) {
+		/* some of the maps don't contain all of the messages */
 		for (seq = seq1; seq <= seq2; seq++) {
 			rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
 
@@ -474,10 +602,54 @@ static int sync_flag_update(const struct mail_transaction_flag_update *u,
 								 old_flags,
 								 rec->flags);
 		}
+	} else {
+		/* All the messages' flags change the same way, so count the
+		   changes and update the headers only once for the whole
+		   range. */
+		seen_changes = deleted_changes = 0;
+		first_unseen_uid = first_deleted_uid = 0;
+		for (seq = seq1; seq <= seq2; seq++) {
+			rec = MAIL_INDEX_REC_AT_SEQ(view->map, seq);
+
+			old_flags = rec->flags;
+			rec->flags = (rec->flags & flag_mask) | u->add_flags;
+
+			changed_flags = old_flags ^ rec->flags;
+			if ((changed_flags & MAIL_SEEN) != 0)
+				seen_changes++;
+			if ((changed_flags & MAIL_DELETED) != 0)
+				deleted_changes++;
+			if ((rec->flags & MAIL_SEEN) == 0 &&
+			    first_unseen_uid == 0)
+				first_unseen_uid = rec->uid;
+			if ((rec->flags & MAIL_DELETED) != 0 &&
+			    first_deleted_uid == 0)
+				first_deleted_uid = rec->uid;
+		}
+		if (first_unseen_uid != 0)
+			mail_index_header_update_lowwaters(ctx, first_unseen_uid, 0);
+		if (first_deleted_uid != 0) {
+			mail_index_header_update_lowwaters(ctx,
+				first_deleted_uid, MAIL_SEEN | MAIL_DELETED);
+		}
+		mail_index_sync_header_update_counts_all_range(ctx,
+			(u->add_flags & MAIL_SEEN) != 0, seen_changes,
+			(u->add_flags & MAIL_DELETED) != 0, deleted_changes);
 	}
 	return 1;
 }
 
+static bool
+sync_flag_update_can_merge(const struct mail_transaction_flag_update *u,
+			   const struct mail_transaction_flag_update *next)
+{
+	return u->uid2 < (uint32_t)-1 && next->uid1 == u->uid2 + 1 &&
+		next->uid2 >= next->uid1 &&
+		next->add_flags == u->add_flags &&
+		next->remove_flags == u->remove_flags &&
+		next->modseq_inc_flag == u->modseq_inc_flag;
+}
+
 static int sync_header_update(const struct mail_transaction_header_update *u,
 			      struct mail_index_sync_map_ctx *ctx)
 {
@@ -582,10 +754,18 @@ mail_index_sync_record_real(struct mail_index_sync_map_ctx *ctx,
 	}
 	case MAIL_TRANSACTION_FLAG_UPDATE: {
 		const struct mail_transaction_flag_update *rec, *end;
+		struct mail_transaction_flag_update merged;
 
 		end = CONST_PTR_OFFSET(data, hdr->size);
-		for (rec = data; rec < end; rec++) {
-			ret = sync_flag_update(rec, ctx);
+		for (rec = data; rec < end; ) {
+			/* Merge the following updates that continue the UID
+			   range with the same changes, so the merged range
+			   is looked up and applied only once. */
+			merged = *rec;
+			for (rec++; rec < end &&
+			     sync_flag_update_can_merge(&merged, rec); rec++)
+				merged.uid2 = rec->uid2;
+			ret = sync_flag_update(&merged, ctx);
 			if (ret <= 0)
 				break;
 		}
@@ -206,6 +206,10 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 		dest->log.min_age_secs = set->log.min_age_secs;
 	if (set->log.log2_max_age_secs != 0)
 		dest->log.log2_max_age_secs = set->log.log2_max_age_secs;
+	if (set->log.group_commit)
+		dest->log.group_commit = set->log.group_commit;
+	if (set->log.group_commit_msecs != 0)
+		dest->log.group_commit_msecs = set->log.group_commit_msecs;
 
 	/* cache */
 	if (set->cache.unaccessed_field_drop_secs != 0)
@@ -224,11 +228,58 @@ void mail_index_set_optimization_settings(struct mail_index *index,
 	if (set->cache.purge_header_continue_count != 0)
 		dest->cache.purge_header_continue_count =
 			set->cache.purge_header_continue_count;
+	if (set->cache.purge_background_min_size != 0)
+		dest->cache.purge_background_min_size =
+			set->cache.purge_background_min_size;
 	if (set->cache.record_max_size != 0)
 		dest->cache.record_max_size = set->cache.record_max_size;
+	if (set->cache.compress_level != 0)
+		dest->cache.compress_level = set->cache.compress_level;
+	if (set->cache.fixed_field_columns)
+		dest->cache.fixed_field_columns = set->cache.fixed_field_columns;
+	if (set->cache.cost_decisions)
+		dest->cache.cost_decisions = set->cache.cost_decisions;
 
 	dest->cache.max_header_name_length = set->cache.max_header_name_length;
 	dest->cache.max_headers_count = set->cache.max_headers_count;
+
+	/* mmap */
+	if (set->mmap.populate_min_size != 0)
+		dest->mmap.populate_min_size = set->mmap.populate_min_size;
+	if (set->mmap.willneed_min_size != 0)
+		dest->mmap.willneed_min_size = set->mmap.willneed_min_size;
+	if (set->mmap.hugepage_min_size != 0)
+		dest->mmap.hugepage_min_size = set->mmap.hugepage_min_size;
+}
+
+void mail_index_get_mmap_advice(struct mail_index *index,
+				struct mmap_advice *advice_r)
+{
+	const struct mail_index_mmap_optimization_settings *set =
+		&index->optimization_set.mmap;
+
+	i_zero(advice_r);
+	advice_r->populate_min_size = I_MIN(set->populate_min_size, SIZE_MAX);
+	advice_r->willneed_min_size = I_MIN(set->willneed_min_size, SIZE_MAX);
+	advice_r->hugepage_min_size = I_MIN(set->hugepage_min_size, SIZE_MAX);
+}
+
+void mail_index_mmap_event(struct event *event, const char *path,
+			   const struct mmap_advice_stats *stats)
+{
+	e_debug(event_create_passthrough(event)->
+		set_name("mail_index_mmap_finished")->
+		add_str("path", path)->
+		add_int("mapped_bytes", stats->mapped_bytes)->
+		add_int("populated", stats->populated ? 1 : 0)->
+		add_int("willneed", stats->willneed ? 1 : 0)->
+		add_int("minor_faults", stats->minor_faults)->
+		add_int("major_faults", stats->major_faults)->event(),
+		"mmap(%s, size=%zu)%s%s: %"PRIu64" minor, %"PRIu64" major faults",
+		path, stats->mapped_bytes,
+		stats->populated ? " populated" : "",
+		stats->willneed ? " willneed" : "",
+		stats->minor_faults, stats->major_faults);
 }
 
 void mail_index_set_ext_init_data(struct mail_index *index, uint32_t ext_id,
@@ -954,6 +1005,25 @@ int mail_index_move_to_memory(struct mail_index *index)
 	return 0;
 }
 
+void mail_index_get_memory_usage(struct mail_index *index,
+				 struct mail_index_memory_usage *usage_r)
+{
+	i_zero(usage_r);
+	T_BEGIN {
+		mail_index_maps_add_memory_usage(index, usage_r);
+	} T_END;
+	if (index->cache != NULL) {
+		mail_cache_get_memory_usage(index->cache,
+					    &usage_r->cache_mmap_bytes,
+					    &usage_r->cache_memory_bytes);
+	}
+	if (index->log != NULL) {
+		mail_transaction_log_get_memory_usage(index->log,
+			&usage_r->log_files_count, &usage_r->log_mmap_bytes,
+			&usage_r->log_memory_bytes);
+	}
+}
+
 void mail_index_mark_corrupted(struct mail_index *index)
 {
 	index->indexid = 0;
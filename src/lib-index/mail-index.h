@@ -323,6 +323,13 @@ struct mail_index_log_optimization_settings {
 	/* Delete .log.2 when it's older than log2_stale_secs. Don't be too
 	   eager, because older files are useful for QRESYNC and dsync. */
 	unsigned int log2_max_age_secs;
+
+	/* fdatasync() the log only after unlocking it, so concurrent
+	   writers don't have to wait for each others' fsyncs and can share
+	   the same disk flush. Before fsyncing wait for group_commit_msecs
+	   to give the other writers time to append their changes. */
+	bool group_commit;
+	unsigned int group_commit_msecs;
 };
 
 struct mail_index_cache_optimization_settings {
@@ -349,12 +356,61 @@ struct mail_index_cache_optimization_settings {
 	/* Purge the file when we need to follow more than n next_offsets to
 	   find the latest cache header. */
 	unsigned int purge_header_continue_count;
+	/* Don't purge the file during regular index syncing if it's at least
+	   this large. The purging is delayed until mail_cache_purge_background()
+	   is called, e.g. by the indexer or doveadm. 0 = never delay. */
+	uoff_t purge_background_min_size;
+	/* Compress the cache records with this deflate level (1..9) when
+	   purging the file. The deflate dictionary is built from a sample of
+	   the records and stored in the cache file. 0 = don't compress. */
+	unsigned int compress_level;
+	/* Store small fixed size fields (e.g. dates and sizes) also as columns
+	   when purging the file. This makes looking them up for many
+	   messages (e.g. for SORT) faster. */
+	bool fixed_field_columns;
+	/* Base caching decisions also on how expensive the fields are to
+	   recompute compared to how much space they use in the cache and how
+	   often they're accessed. */
+	bool cost_decisions;
+};
+
+struct mail_index_mmap_optimization_settings {
+	/* Prefault the whole mmap()ed index or cache file if it's at least
+	   this large. 0 = never. */
+	uoff_t populate_min_size;
+	/* Start reading the mmap()ed file ahead if it's at least this
+	   large. 0 = never. */
+	uoff_t willneed_min_size;
+	/* Use huge pages for the in-memory copy of the cache file
+	   (mmap_disable=yes) if it's at least this large. 0 = never. */
+	uoff_t hugepage_min_size;
 };
 
 struct mail_index_optimization_settings {
 	struct mail_index_base_optimization_settings index;
 	struct mail_index_log_optimization_settings log;
 	struct mail_index_cache_optimization_settings cache;
+	struct mail_index_mmap_optimization_settings mmap;
+};
+
+struct mail_index_memory_usage {
+	/* Number of distinct maps and record maps used by the index and its
+	   views */
+	unsigned int maps_count, rec_maps_count;
+	/* Headers of the maps, including the extension headers */
+	uint64_t headers_bytes;
+	/* Records (including extension records) mmap()ed from the index
+	   file or copied into memory */
+	uint64_t records_mmap_bytes, records_memory_bytes;
+	/* How much of the records are used by the extension records */
+	uint64_t ext_records_bytes;
+	/* In-memory per-flag and per-keyword modseqs */
+	uint64_t modseqs_bytes;
+	/* Cache file mmap()ed or read into memory */
+	uint64_t cache_mmap_bytes, cache_memory_bytes;
+	/* Transaction log files mmap()ed or read into memory */
+	unsigned int log_files_count;
+	uint64_t log_mmap_bytes, log_memory_bytes;
 };
 
 struct mail_index;
@@ -408,6 +464,10 @@ int mail_index_unlink(struct mail_index *index);
 bool mail_index_is_in_memory(struct mail_index *index);
 /* Move the index into memory. Returns 0 if ok, -1 if error occurred. */
 int mail_index_move_to_memory(struct mail_index *index);
+/* Returns how much memory the index, its views, cache and transaction log
+   are currently using. */
+void mail_index_get_memory_usage(struct mail_index *index,
+				 struct mail_index_memory_usage *usage_r);
 
 struct mail_cache *mail_index_get_cache(struct mail_index *index);
 
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "sleep.h"
 #include "write-full.h"
 #include "mail-index-private.h"
 #include "mail-transaction-log-private.h"
@@ -91,7 +92,12 @@ static int log_buffer_write(struct mail_transaction_log_append_ctx *ctx)
 	if ((ctx->want_fsync &&
 	     file->log->index->set.fsync_mode != FSYNC_MODE_NEVER) ||
 	    file->log->index->set.fsync_mode == FSYNC_MODE_ALWAYS) {
-		if (fdatasync(file->fd) < 0) {
+		if (file->log->index->optimization_set.log.group_commit &&
+		    !file->log->index->log_sync_locked) {
+			/* group commit: fsync after the log is unlocked in
+			   mail_transaction_log_append_commit() */
+			ctx->fsync_after_unlock = TRUE;
+		} else if (fdatasync(file->fd) < 0) {
 			mail_index_file_set_syscall_error(ctx->log->index,
 							  file->filepath,
 							  "fdatasync()");
@@ -238,10 +244,34 @@ int mail_transaction_log_append_begin(struct mail_index *index,
 	return 0;
 }
 
+static int
+log_append_group_commit(struct mail_transaction_log_append_ctx *ctx,
+			struct mail_transaction_log_file *file)
+{
+	struct mail_index *index = ctx->log->index;
+
+	/* Other writers can now append to the log while we're waiting and
+	   fsyncing. A single fdatasync() flushes all of their changes written
+	   so far, and with most filesystems the concurrent fdatasync()s end
+	   up in the same journal commit. */
+	if (index->optimization_set.log.group_commit_msecs > 0)
+		i_sleep_msecs(index->optimization_set.log.group_commit_msecs);
+	if (fdatasync(file->fd) < 0) {
+		mail_index_file_set_syscall_error(index, file->filepath,
+						  "fdatasync()");
+		/* Unlike with fsyncing while locked, the written transaction
+		   can't be truncated away, because other writers may already
+		   have appended after it. */
+		return mail_index_move_to_memory(index);
+	}
+	return 0;
+}
+
 int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **_ctx)
 {
 	struct mail_transaction_log_append_ctx *ctx = *_ctx;
 	struct mail_index *index = ctx->log->index;
+	struct mail_transaction_log_file *file = index->log->head;
 	int ret = 0;
 
 	*_ctx = NULL;
@@ -249,6 +279,8 @@ int mail_transaction_log_append_commit(struct mail_transaction_log_append_ctx **
 	ret = mail_transaction_log_append_locked(ctx);
 	if (!index->log_sync_locked)
 		mail_transaction_log_file_unlock(index->log->head, "appending");
+	if (ret == 0 && ctx->fsync_after_unlock)
+		ret = log_append_group_commit(ctx, file);
 
 	buffer_free(&ctx->output);
 	i_free(ctx);
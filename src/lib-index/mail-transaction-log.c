@@ -632,6 +632,24 @@ void mail_transaction_log_get_tail(struct mail_transaction_log *log,
 	*file_seq_r = tail->hdr.file_seq;
 }
 
+void mail_transaction_log_get_memory_usage(struct mail_transaction_log *log,
+					   unsigned int *files_count_r,
+					   uint64_t *mmap_bytes_r,
+					   uint64_t *memory_bytes_r)
+{
+	struct mail_transaction_log_file *file;
+
+	*files_count_r = 0;
+	*mmap_bytes_r = *memory_bytes_r = 0;
+	for (file = log->files; file != NULL; file = file->next) {
+		*files_count_r += 1;
+		if (file->mmap_base != NULL)
+			*mmap_bytes_r += file->mmap_size;
+		else if (file->buffer != NULL)
+			*memory_bytes_r += buffer_get_size(file->buffer);
+	}
+}
+
 bool mail_transaction_log_is_head_prev(struct mail_transaction_log *log,
 				       uint32_t file_seq, uoff_t file_offset)
 {
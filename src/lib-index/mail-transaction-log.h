@@ -369,6 +369,9 @@ struct mail_transaction_log_append_ctx {
 	bool sync_includes_this:1;
 	/* fdatasync() after writing the transaction. */
 	bool want_fsync:1;
+	/* The transaction was written, but the fdatasync() is done only
+	   after the log is unlocked (group commit). */
+	bool fsync_after_unlock:1;
 };
 
 #define LOG_IS_BEFORE(seq1, offset1, seq2, offset2) \
@@ -481,6 +484,12 @@ void mail_transaction_log_get_head(struct mail_transaction_log *log,
 /* Returns the current tail from which all files are open to head. */
 void mail_transaction_log_get_tail(struct mail_transaction_log *log,
 				   uint32_t *file_seq_r);
+/* Returns the number of opened log files and how many bytes of them are
+   mmap()ed or read into memory. */
+void mail_transaction_log_get_memory_usage(struct mail_transaction_log *log,
+					   unsigned int *files_count_r,
+					   uint64_t *mmap_bytes_r,
+					   uint64_t *memory_bytes_r);
 /* Returns TRUE if given seq/offset is current head log's rotate point. */
 bool mail_transaction_log_is_head_prev(struct mail_transaction_log *log,
 				       uint32_t file_seq, uoff_t file_offset);
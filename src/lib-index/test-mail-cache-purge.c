@@ -1044,6 +1044,289 @@ static void test_mail_cache_update_need_purge_deleted_records2(void)
 	test_end();
 }
 
+static void test_mail_cache_purge_background(void)
+{
+	struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.purge_min_size = 1,
+			.purge_delete_percentage = 30,
+			.purge_background_min_size = 1,
+		},
+	};
+	struct mail_index_transaction *trans;
+	struct test_mail_cache_ctx ctx;
+	const char *reason;
+	uint32_t seq;
+
+	test_begin("mail cache purge background");
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+
+	for (seq = 1; seq <= 10; seq++)
+		test_mail_cache_add_mail(&ctx, ctx.cache_field.idx, "foo");
+	test_assert(mail_cache_purge_background(ctx.cache) == 0);
+
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	for (seq = 1; seq <= 3; seq++)
+		mail_index_expunge(trans, seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	/* syncing doesn't purge the large file */
+	test_mail_cache_index_sync(&ctx);
+	test_assert(ctx.cache->need_purge_file_seq != 0);
+	test_assert(!mail_cache_need_purge(ctx.cache, &reason));
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 0);
+
+	/* background purging does it */
+	test_assert(mail_cache_purge_background(ctx.cache) == 1);
+	test_assert(ctx.cache->need_purge_file_seq == 0);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+	test_assert(mail_cache_purge_background(ctx.cache) == 0);
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 1);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static const char *test_mail_cache_compress_value(unsigned int i)
+{
+	return t_strdup_printf(
+		"Received: from mx%u.example.com (mx%u.example.com [192.0.2.%u])\n"
+		"\tby imap.example.com with LMTP id %u; 14 Oct 2024 12:00:%02u\n"
+		"Content-Type: text/plain; charset=utf-8; format=flowed\n",
+		i, i, i, i * 1000, i);
+}
+
+static void test_mail_cache_purge_compressed(void)
+{
+	const struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.compress_level = 6,
+		},
+	};
+	const unsigned int mail_count = 20;
+	struct test_mail_cache_ctx ctx, ctx2;
+	struct mail_cache_view *cache_view;
+	const struct mail_cache_record *rec;
+	struct stat st;
+	uoff_t uncompressed_size;
+	uint32_t offset, reset_id;
+	unsigned int i;
+
+	test_begin("mail cache purge compressed");
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	for (i = 1; i <= mail_count; i++) {
+		test_mail_cache_add_mail(&ctx, ctx.cache_field.idx,
+					 test_mail_cache_compress_value(i));
+	}
+	test_assert(stat(ctx.index->cache->filepath, &st) == 0);
+	uncompressed_size = st.st_size;
+
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+	test_mail_cache_view_sync(&ctx);
+	test_assert((ctx.cache->hdr->flags &
+		     MAIL_CACHE_HEADER_FLAG_COMPRESSED_RECORDS) != 0);
+	test_assert(stat(ctx.index->cache->filepath, &st) == 0);
+	test_assert((uoff_t)st.st_size < uncompressed_size);
+
+	/* all the records were compressed */
+	for (i = 1; i <= mail_count; i++) {
+		offset = mail_cache_lookup_cur_offset(ctx.view, i, &reset_id);
+		test_assert_idx(offset != 0 &&
+				mail_cache_get_record(ctx.cache, offset, &rec) == 0 &&
+				mail_cache_record_is_compressed(ctx.cache, rec), i);
+	}
+
+	/* add an uncompressed record linked to a compressed one */
+	test_mail_cache_add_field(&ctx, 1, ctx.cache_field2.idx, "bar1");
+
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	for (i = 1; i <= mail_count; i++) {
+		test_assert(cache_equals(cache_view, i, ctx.cache_field.idx,
+					 test_mail_cache_compress_value(i)));
+	}
+	test_assert(cache_equals(cache_view, 1, ctx.cache_field2.idx, "bar1"));
+	mail_cache_view_close(&cache_view);
+
+	/* reading works also without the compression setting */
+	test_mail_cache_init(test_mail_index_open(), &ctx2);
+	cache_view = mail_cache_view_open(ctx2.cache, ctx2.view);
+	test_assert(cache_equals(cache_view, mail_count, ctx2.cache_field.idx,
+				 test_mail_cache_compress_value(mail_count)));
+	test_assert(cache_equals(cache_view, 1, ctx2.cache_field2.idx, "bar1"));
+	mail_cache_view_close(&cache_view);
+	test_mail_cache_deinit(&ctx2);
+
+	/* purging again without the setting uncompresses the records */
+	test_mail_cache_purge();
+	test_assert(mail_index_refresh(ctx.index) == 0);
+	test_mail_cache_view_sync(&ctx);
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(cache_equals(cache_view, 2, ctx.cache_field.idx,
+				 test_mail_cache_compress_value(2)));
+	test_assert((ctx.cache->hdr->flags &
+		     MAIL_CACHE_HEADER_FLAG_COMPRESSED_RECORDS) == 0);
+	test_assert(cache_equals(cache_view, 1, ctx.cache_field2.idx, "bar1"));
+	mail_cache_view_close(&cache_view);
+
+	test_assert(test_mail_cache_get_purge_count(&ctx) == 2);
+	mail_index_view_close(&ctx.view);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static void test_mail_cache_purge_compressed_corrupted(void)
+{
+	const struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.compress_level = 6,
+		},
+	};
+	struct test_mail_cache_ctx ctx;
+	struct mail_cache_view *cache_view;
+	const struct mail_cache_record *rec;
+	string_t *str = t_str_new(128);
+	uint32_t offset, reset_id;
+	unsigned char byte = 0xff;
+	int fd;
+
+	test_begin("mail cache purge compressed corrupted");
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	test_mail_cache_add_mail(&ctx, ctx.cache_field.idx,
+				 test_mail_cache_compress_value(1));
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+	test_mail_cache_view_sync(&ctx);
+
+	/* overwrite the beginning of the deflate data */
+	offset = mail_cache_lookup_cur_offset(ctx.view, 1, &reset_id);
+	test_assert(offset != 0 &&
+		    mail_cache_get_record(ctx.cache, offset, &rec) == 0 &&
+		    mail_cache_record_is_compressed(ctx.cache, rec));
+	fd = open(ctx.cache->filepath, O_WRONLY);
+	test_assert(fd != -1);
+	test_assert(pwrite(fd, &byte, 1, offset + sizeof(*rec) +
+			   sizeof(struct mail_cache_compressed_record)) == 1);
+	i_close_fd(&fd);
+	mail_cache_file_close(ctx.cache);
+
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_expect_error_string("compressed record is broken");
+	test_assert(mail_cache_lookup_field(cache_view, str, 1,
+					    ctx.cache_field.idx) < 0);
+	test_expect_no_more_errors();
+	mail_cache_view_close(&cache_view);
+
+	mail_index_view_close(&ctx.view);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
+static void test_mail_cache_purge_columns_int(bool compress)
+{
+	struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.fixed_field_columns = TRUE,
+			.compress_level = compress ? 6 : 0,
+		},
+	};
+	struct mail_cache_field fixed_field = {
+		.name = "fixed",
+		.type = MAIL_CACHE_FIELD_FIXED_SIZE,
+		.field_size = 4,
+		.decision = MAIL_CACHE_DECISION_YES,
+	};
+	const unsigned int mail_count = 10;
+	struct test_mail_cache_ctx ctx;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	string_t *str = t_str_new(16);
+	unsigned int i;
+	uint32_t seq;
+
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	mail_cache_register_fields(ctx.cache, &fixed_field, 1,
+				   MAIL_CACHE_TRUNCATE_NAME_FAIL);
+	for (i = 1; i <= mail_count; i++) {
+		test_mail_cache_add_mail(&ctx, ctx.cache_field.idx,
+					 test_mail_cache_compress_value(i));
+		/* leave the last mail without the fixed field */
+		if (i < mail_count) {
+			test_mail_cache_add_field(&ctx, i, fixed_field.idx,
+						  t_strdup_printf("f%03u", i));
+		}
+	}
+	/* expunge the 3rd mail so UIDs and sequences differ */
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	mail_index_expunge(trans, 3);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_mail_cache_index_sync(&ctx);
+
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+	test_mail_cache_view_sync(&ctx);
+	test_assert((ctx.cache->hdr->flags &
+		     MAIL_CACHE_HEADER_FLAG_COLUMNS) != 0);
+	test_assert(((ctx.cache->hdr->flags &
+		      MAIL_CACHE_HEADER_FLAG_COMPRESSED_RECORDS) != 0) == compress);
+
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	/* look up in descending order to skip the hint */
+	for (seq = mail_count - 2; seq > 0; seq--) {
+		uint32_t uid = seq < 3 ? seq : seq + 1;
+
+		str_truncate(str, 0);
+		test_assert_idx(mail_cache_lookup_column(cache_view, str, seq,
+							 fixed_field.idx) == 1, seq);
+		test_assert_idx(strcmp(str_c(str),
+				       t_strdup_printf("f%03u", uid)) == 0, seq);
+	}
+	/* the last mail and non-fixed fields aren't in columns */
+	test_assert(mail_cache_lookup_column(cache_view, str, mail_count - 1,
+					     fixed_field.idx) == 0);
+	test_assert(mail_cache_lookup_column(cache_view, str, 1,
+					     ctx.cache_field.idx) == 0);
+	for (seq = 1; seq < mail_count; seq++) {
+		uint32_t uid = seq < 3 ? seq : seq + 1;
+
+		test_assert(cache_equals(cache_view, seq, ctx.cache_field.idx,
+					 test_mail_cache_compress_value(uid)));
+		test_assert(cache_equals(cache_view, seq, fixed_field.idx,
+			uid == mail_count ? NULL : t_strdup_printf("f%03u", uid)));
+	}
+	mail_cache_view_close(&cache_view);
+
+	/* fields added after purging are found from the records */
+	test_mail_cache_add_field(&ctx, mail_count - 1, fixed_field.idx, "new1");
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(mail_cache_lookup_column(cache_view, str, mail_count - 1,
+					     fixed_field.idx) == 0);
+	test_assert(cache_equals(cache_view, mail_count - 1, fixed_field.idx,
+				 "new1"));
+	mail_cache_view_close(&cache_view);
+
+	mail_index_view_close(&ctx.view);
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+}
+
+static void test_mail_cache_purge_columns(void)
+{
+	test_begin("mail cache purge columns");
+	test_mail_cache_purge_columns_int(FALSE);
+	test_end();
+}
+
+static void test_mail_cache_purge_columns_compressed(void)
+{
+	test_begin("mail cache purge columns compressed");
+	test_mail_cache_purge_columns_int(TRUE);
+	test_end();
+}
+
 static void test_mail_cache_purge_deadlines(void)
 {
 	static const uint32_t BASE_TIME = 1000;
@@ -1109,6 +1392,11 @@ int main(void)
 		test_mail_cache_update_need_purge_deleted_records,
 		test_mail_cache_update_need_purge_deleted_records2,
 		test_mail_cache_purge_deadlines,
+		test_mail_cache_purge_background,
+		test_mail_cache_purge_compressed,
+		test_mail_cache_purge_compressed_corrupted,
+		test_mail_cache_purge_columns,
+		test_mail_cache_purge_columns_compressed,
 		NULL
 	};
 	return test_run(test_functions);
@@ -806,6 +806,88 @@ static void test_mail_cache_duplicate_fields(void)
 	test_end();
 }
 
+static void test_mail_cache_cost_decisions(void)
+{
+	const struct mail_index_optimization_settings optimization_set = {
+		.cache = {
+			.cost_decisions = TRUE,
+		},
+	};
+	struct mail_cache_field cost_fields[] = {
+		{
+			.name = "hdr.x-cheap",
+			.type = MAIL_CACHE_FIELD_HEADER,
+			.decision = MAIL_CACHE_DECISION_NO,
+		},
+		{
+			.name = "expensive",
+			.type = MAIL_CACHE_FIELD_STRING,
+			.decision = MAIL_CACHE_DECISION_NO,
+		},
+	};
+	struct test_mail_cache_ctx ctx;
+	struct mail_index_transaction *trans;
+	struct mail_cache_view *cache_view;
+	struct mail_cache_transaction_ctx *cache_trans;
+	string_t *str = t_str_new(16);
+	unsigned int i;
+
+	test_begin("mail cache cost decisions");
+	test_mail_cache_init(test_mail_index_init(), &ctx);
+	mail_index_set_optimization_settings(ctx.index, &optimization_set);
+	test_mail_cache_add_mail(&ctx, UINT_MAX, NULL);
+	test_mail_cache_add_mail(&ctx, UINT_MAX, NULL);
+	test_assert(mail_cache_purge(ctx.cache, (uint32_t)-1, "test") == 0);
+
+	mail_cache_register_fields(ctx.cache, cost_fields,
+				   N_ELEMENTS(cost_fields),
+				   unsafe_data_stack_pool);
+	unsigned int cheap_idx = cost_fields[0].idx;
+	unsigned int expensive_idx = cost_fields[1].idx;
+
+	/* not enough samples yet */
+	mail_cache_field_add_recompute_cost(ctx.cache, cheap_idx, 1, 100);
+	mail_cache_field_add_recompute_cost(ctx.cache, expensive_idx, 500, 0);
+	test_assert(mail_cache_field_get_cost(ctx.cache, cheap_idx) ==
+		    MAIL_CACHE_FIELD_COST_UNKNOWN);
+	for (i = 0; i < 2; i++) {
+		mail_cache_field_add_recompute_cost(ctx.cache, cheap_idx,
+						    1, 100);
+		mail_cache_field_add_recompute_cost(ctx.cache, expensive_idx,
+						    100, 50000);
+	}
+	test_assert(mail_cache_field_get_cost(ctx.cache, cheap_idx) ==
+		    MAIL_CACHE_FIELD_COST_CHEAP);
+	test_assert(mail_cache_field_get_cost(ctx.cache, expensive_idx) ==
+		    MAIL_CACHE_FIELD_COST_EXPENSIVE);
+
+	/* the cheap header isn't added to cache */
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	trans = mail_index_transaction_begin(ctx.view, 0);
+	cache_trans = mail_cache_get_transaction(cache_view, trans);
+	mail_cache_add(cache_trans, 1, cheap_idx, "foo", 3);
+	mail_cache_add(cache_trans, 1, expensive_idx, "bar", 3);
+	test_assert(ctx.cache->fields[cheap_idx].field.decision ==
+		    MAIL_CACHE_DECISION_NO);
+	test_assert(ctx.cache->fields[expensive_idx].field.decision ==
+		    MAIL_CACHE_DECISION_TEMP);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_cache_view_close(&cache_view);
+	test_mail_cache_view_sync(&ctx);
+
+	/* the expensive field becomes YES even with ordered access */
+	cache_view = mail_cache_view_open(ctx.cache, ctx.view);
+	test_assert(mail_cache_lookup_field(cache_view, str, 1,
+					    expensive_idx) == 1);
+	test_assert(ctx.cache->fields[expensive_idx].field.decision ==
+		    MAIL_CACHE_DECISION_YES);
+	mail_cache_view_close(&cache_view);
+
+	test_mail_cache_deinit(&ctx);
+	test_mail_index_delete();
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -820,6 +902,7 @@ int main(void)
 		test_mail_cache_in_memory,
 		test_mail_cache_size_corruption,
 		test_mail_cache_duplicate_fields,
+		test_mail_cache_cost_decisions,
 		NULL
 	};
 	return test_run(test_functions);
@@ -67,10 +67,74 @@ static void test_mail_index_modseq_get_next_log_offset(void)
 	test_end();
 }
 
+static uint64_t
+test_mail_index_modseq_update_flags(struct mail_index *index, uint32_t seq,
+				    enum mail_flags flags)
+{
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint64_t modseq;
+
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_flags(trans, seq, MODIFY_ADD, flags);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	view = mail_index_view_open(index);
+	modseq = mail_index_modseq_lookup(view, seq);
+	mail_index_view_close(&view);
+	return modseq;
+}
+
+static void test_mail_index_modseq_lookup_flags(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	uint64_t seen1, flagged2, seen2;
+	uint32_t seq, uid;
+
+	test_begin("mail index modseq lookup flags");
+	index = test_mail_index_init();
+	view = mail_index_view_open(index);
+	mail_index_modseq_enable(index);
+
+	trans = mail_index_transaction_begin(view, 0);
+	uid = 1234;
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid, sizeof(uid), TRUE);
+	for (uid = 1; uid <= 3; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	seen1 = test_mail_index_modseq_update_flags(index, 1, MAIL_SEEN);
+	flagged2 = test_mail_index_modseq_update_flags(index, 2, MAIL_FLAGGED);
+	seen2 = test_mail_index_modseq_update_flags(index, 2, MAIL_SEEN);
+	test_assert(seen1 < flagged2 && flagged2 < seen2);
+
+	view = mail_index_view_open(index);
+	test_assert(mail_index_modseq_lookup_flags(view, MAIL_SEEN, 1) == seen1);
+	test_assert(mail_index_modseq_lookup_flags(view, MAIL_FLAGGED, 2) == flagged2);
+	test_assert(mail_index_modseq_lookup_flags(view, MAIL_SEEN, 2) == seen2);
+	test_assert(mail_index_modseq_lookup_flags(view, MAIL_SEEN | MAIL_FLAGGED, 2) == seen2);
+	/* no specific modseq - fall back to the message's modseq */
+	test_assert(mail_index_modseq_lookup_flags(view, MAIL_ANSWERED, 2) == seen2);
+	test_assert(mail_index_modseq_lookup_flags(view, MAIL_SEEN, 3) ==
+		    mail_index_modseq_lookup(view, 3));
+	mail_index_view_close(&view);
+
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_modseq_get_next_log_offset,
+		test_mail_index_modseq_lookup_flags,
 		NULL
 	};
 	return test_run(test_functions);
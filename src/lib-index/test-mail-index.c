@@ -158,11 +158,170 @@ static void test_mail_index_new_extension(void)
 	test_end();
 }
 
+static void test_mail_index_expunge_shared_map(void)
+{
+	static const uint32_t expected_uids[] = { 1, 3, 4, 7, 8, 9, 10 };
+	struct mail_index *index;
+	struct mail_index_view *view, *view2;
+	struct mail_index_transaction *trans;
+	uint32_t seq, uid, uid_validity = 123456;
+
+	test_begin("mail index expunge shared map");
+	index = test_mail_index_init();
+	view = mail_index_view_open(index);
+
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid <= 10; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	mail_index_view_close(&view);
+
+	/* the view keeps referring to the old map */
+	view = mail_index_view_open(index);
+	trans = mail_index_transaction_begin(view,
+			MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL);
+	mail_index_expunge(trans, 2);
+	mail_index_expunge(trans, 5);
+	mail_index_expunge(trans, 6);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_assert(mail_index_refresh(index) == 0);
+
+	view2 = mail_index_view_open(index);
+	test_assert(mail_index_view_get_messages_count(view2) ==
+		    N_ELEMENTS(expected_uids));
+	for (seq = 1; seq <= N_ELEMENTS(expected_uids); seq++) {
+		mail_index_lookup_uid(view2, seq, &uid);
+		test_assert_idx(uid == expected_uids[seq-1], seq);
+	}
+	test_assert(index->map->rec_map->records_count ==
+		    N_ELEMENTS(expected_uids));
+	test_assert(index->map->rec_map->last_appended_uid == 10);
+
+	/* the old view still sees the expunged mails */
+	test_assert(mail_index_view_get_messages_count(view) == 10);
+	for (seq = 1; seq <= 10; seq++) {
+		mail_index_lookup_uid(view, seq, &uid);
+		test_assert_idx(uid == seq, seq);
+	}
+
+	mail_index_view_close(&view);
+	mail_index_view_close(&view2);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void
+test_mail_index_flag_update(struct mail_index_view *view, uint32_t seq1,
+			    uint32_t seq2, enum modify_type modify_type,
+			    enum mail_flags flags)
+{
+	struct mail_index_transaction *trans;
+	uint32_t seq;
+
+	trans = mail_index_transaction_begin(view, 0);
+	/* individual updates get merged into ranges */
+	for (seq = seq1; seq <= seq2; seq++)
+		mail_index_update_flags(trans, seq, modify_type, flags);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_assert(mail_index_refresh(view->index) == 0);
+}
+
+static void test_mail_index_flag_update_counts(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view, *view2;
+	struct mail_index_transaction *trans;
+	const struct mail_index_header *hdr;
+	uint32_t seq, uid, uid_validity = 123456;
+
+	test_begin("mail index flag update counts");
+	index = test_mail_index_init();
+	view = mail_index_view_open(index);
+
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid <= 10; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_assert(mail_index_refresh(index) == 0);
+	mail_index_view_close(&view);
+	view = mail_index_view_open(index);
+	/* keep another view open, so the rec_map is shared */
+	view2 = mail_index_view_open(index);
+	hdr = &index->map->hdr;
+
+	test_mail_index_flag_update(view, 1, 10, MODIFY_ADD, MAIL_SEEN);
+	test_assert(hdr->seen_messages_count == 10);
+	test_assert(hdr->first_unseen_uid_lowwater == 11);
+
+	test_mail_index_flag_update(view, 3, 5, MODIFY_REMOVE, MAIL_SEEN);
+	test_assert(hdr->seen_messages_count == 7);
+	test_assert(hdr->first_unseen_uid_lowwater == 3);
+
+	test_mail_index_flag_update(view, 2, 4, MODIFY_ADD, MAIL_DELETED);
+	test_mail_index_flag_update(view, 8, 8, MODIFY_ADD, MAIL_DELETED);
+	test_assert(hdr->deleted_messages_count == 4);
+	test_assert(hdr->first_deleted_uid_lowwater <= 2);
+
+	test_mail_index_flag_update(view, 1, 10, MODIFY_REPLACE, MAIL_SEEN);
+	test_assert(hdr->seen_messages_count == 10);
+	test_assert(hdr->first_unseen_uid_lowwater == 11);
+	test_assert(hdr->deleted_messages_count == 0);
+	test_assert(hdr->first_deleted_uid_lowwater == 11);
+
+	mail_index_view_close(&view);
+	mail_index_view_close(&view2);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
+static void test_mail_index_memory_usage(void)
+{
+	struct mail_index *index;
+	struct mail_index_view *view;
+	struct mail_index_transaction *trans;
+	struct mail_index_memory_usage usage;
+	uint32_t seq, uid, uid_validity = 123456;
+
+	test_begin("mail index memory usage");
+	index = test_mail_index_init();
+	view = mail_index_view_open(index);
+
+	trans = mail_index_transaction_begin(view, 0);
+	mail_index_update_header(trans,
+		offsetof(struct mail_index_header, uid_validity),
+		&uid_validity, sizeof(uid_validity), TRUE);
+	for (uid = 1; uid <= 10; uid++)
+		mail_index_append(trans, uid, &seq);
+	test_assert(mail_index_transaction_commit(&trans) == 0);
+	test_assert(mail_index_refresh(index) == 0);
+
+	mail_index_get_memory_usage(index, &usage);
+	test_assert(usage.maps_count >= 1);
+	test_assert(usage.rec_maps_count >= 1);
+	test_assert(usage.headers_bytes >= sizeof(struct mail_index_header));
+	test_assert(usage.records_mmap_bytes + usage.records_memory_bytes >=
+		    10 * sizeof(struct mail_index_record));
+	test_assert(usage.log_files_count >= 1);
+
+	mail_index_view_close(&view);
+	test_mail_index_deinit(&index);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_mail_index_rotate,
 		test_mail_index_new_extension,
+		test_mail_index_expunge_shared_map,
+		test_mail_index_flag_update_counts,
+		test_mail_index_memory_usage,
 		NULL
 	};
 	return test_run(test_functions);
@@ -9,6 +9,7 @@
 #include <sys/stat.h>
 
 static bool log_lock_failure = FALSE;
+static unsigned int log_unlock_count = 0;
 
 void mail_index_file_set_syscall_error(struct mail_index *index ATTR_UNUSED,
 				       const char *filepath ATTR_UNUSED,
@@ -23,7 +24,10 @@ int mail_transaction_log_lock_head(struct mail_transaction_log *log ATTR_UNUSED,
 }
 
 void mail_transaction_log_file_unlock(struct mail_transaction_log_file *file ATTR_UNUSED,
-				      const char *lock_reason ATTR_UNUSED) {}
+				      const char *lock_reason ATTR_UNUSED)
+{
+	log_unlock_count++;
+}
 
 void mail_transaction_update_modseq(const struct mail_transaction_header *hdr,
 				    const void *data ATTR_UNUSED,
@@ -123,6 +127,7 @@ static void test_mail_transaction_log_append(void)
 	struct mail_transaction_log_append_ctx *ctx;
 	char tmp_path[] = "/tmp/dovecot.test.XXXXXX";
 	struct stat st;
+	uint32_t uid = 1;
 	int fd;
 
 	fd = mkstemp(tmp_path);
@@ -134,6 +139,7 @@ static void test_mail_transaction_log_append(void)
 	log->index = i_new(struct mail_index, 1);
 	log->index->log = log;
 	log->head = file = i_new(struct mail_transaction_log_file, 1);
+	file->log = log;
 	file->fd = -1;
 
 	test_append_expunge(log);
@@ -159,6 +165,34 @@ static void test_mail_transaction_log_append(void)
 	file->fd = -1;
 	test_end();
 
+	test_begin("transaction log append: group commit");
+	log->index->set.fsync_mode = FSYNC_MODE_ALWAYS;
+	log->index->optimization_set.log.group_commit = TRUE;
+	log->index->optimization_set.log.group_commit_msecs = 1;
+	file->fd = fd;
+	if (lseek(fd, 0, SEEK_END) < 0)
+		i_fatal("lseek() failed: %m");
+	log_unlock_count = 0;
+	test_assert(mail_transaction_log_append_begin(log->index, 0, &ctx) == 0);
+	mail_transaction_log_append_add(ctx, MAIL_TRANSACTION_APPEND,
+					&uid, sizeof(uid));
+	test_assert(mail_transaction_log_append_commit(&ctx) == 0);
+	test_assert(log_unlock_count == 1);
+	if (fstat(fd, &st) < 0) i_fatal("fstat() failed: %m");
+	test_assert((uoff_t)st.st_size == file->sync_offset);
+	test_assert(st.st_size == 1 + sizeof(struct mail_transaction_header) +
+		    sizeof(uid));
+	/* with the log locked for syncing the fsync can't be delayed */
+	log->index->log_sync_locked = TRUE;
+	test_assert(mail_transaction_log_append_begin(log->index, 0, &ctx) == 0);
+	mail_transaction_log_append_add(ctx, MAIL_TRANSACTION_APPEND,
+					&uid, sizeof(uid));
+	test_assert(mail_transaction_log_append_commit(&ctx) == 0);
+	log->index->log_sync_locked = FALSE;
+	test_assert(log_unlock_count == 1);
+	file->fd = -1;
+	test_end();
+
 	buffer_free(&log->head->buffer);
 	i_free(log->head);
 	i_free(log->index);
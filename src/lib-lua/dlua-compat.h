@@ -17,6 +17,11 @@
 	 0)
 #endif
 
+/* lua_dump() has no strip parameter in <= 5.2 */
+#if LUA_VERSION_NUM <= 502
+#  define lua_dump(L, w, d, s) lua_dump(L, w, d)
+#endif
+
 /* functionality missing from <= 5.1 */
 #if LUA_VERSION_NUM <= 501
 #  define lua_load(L, r, s, fn, m) lua_load(L, r, s, fn)
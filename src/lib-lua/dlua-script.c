@@ -2,16 +2,20 @@
 
 #include "lib.h"
 #include "llist.h"
+#include "buffer.h"
+#include "hash.h"
 #include "istream.h"
 #include "sha1.h"
 #include "str.h"
 #include "hex-binary.h"
 #include "eacces-error.h"
 #include "ioloop.h"
+#include "time-util.h"
 #include "dlua-script-private.h"
 
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 /* the registry entry with a pointer to struct dlua_script */
 #define LUA_SCRIPT_REGISTRY_KEY	"DLUA_SCRIPT"
@@ -23,7 +27,18 @@ struct event_category event_category_lua = {
 	.name = "lua",
 };
 
+/* Compiled script file, which can be loaded without parsing the file again
+   as long as the file hasn't changed. */
+struct dlua_script_chunk {
+	char *path;
+	ino_t ino;
+	time_t mtime;
+	off_t size;
+	buffer_t *bytecode;
+};
+
 static struct dlua_script *dlua_scripts = NULL;
+static HASH_TABLE(char *, struct dlua_script_chunk *) dlua_script_chunks;
 
 static int
 dlua_script_create_finish(struct dlua_script *script, const char **error_r);
@@ -159,12 +174,8 @@ static void dlua_call_deinit_function(struct dlua_script *script)
 			error);
 }
 
-int dlua_script_init(struct dlua_script *script, const char **error_r)
+static int dlua_script_init_run(struct dlua_script *script, const char **error_r)
 {
-	if (script->init)
-		return 0;
-	script->init = TRUE;
-
 	if (dlua_script_create_finish(script, error_r) < 0)
 		return -1;
 
@@ -194,6 +205,29 @@ int dlua_script_init(struct dlua_script *script, const char **error_r)
 	return ret;
 }
 
+int dlua_script_init(struct dlua_script *script, const char **error_r)
+{
+	struct event_passthrough *e;
+	struct timeval start, end;
+	int ret;
+
+	if (script->init)
+		return 0;
+	script->init = TRUE;
+
+	i_gettimeofday(&start);
+	ret = dlua_script_init_run(script, error_r);
+	i_gettimeofday(&end);
+
+	e = event_create_passthrough(script->event)->
+		set_name("lua_script_initialized")->
+		add_int("init_usecs", timeval_diff_usecs(&end, &start));
+	if (ret < 0)
+		e->add_str("error", *error_r);
+	e_debug(e->event(), "Script initialized");
+	return ret;
+}
+
 static int dlua_atpanic(lua_State *L)
 {
 	struct dlua_script *script = dlua_script_from_state(L);
@@ -291,10 +325,91 @@ int dlua_script_create_string(const char *str, struct dlua_script **script_r,
 	return -1;
 }
 
+static int
+dlua_script_chunk_writer(lua_State *L ATTR_UNUSED, const void *data,
+			 size_t size, void *context)
+{
+	buffer_t *bytecode = context;
+
+	buffer_append(bytecode, data, size);
+	return 0;
+}
+
+static void dlua_script_chunk_free(struct dlua_script_chunk *chunk)
+{
+	buffer_free(&chunk->bytecode);
+	i_free(chunk->path);
+	i_free(chunk);
+}
+
+static struct dlua_script_chunk *
+dlua_script_chunk_lookup(const char *file, const struct stat *st)
+{
+	struct dlua_script_chunk *chunk;
+
+	if (!hash_table_is_created(dlua_script_chunks))
+		return NULL;
+	chunk = hash_table_lookup(dlua_script_chunks, file);
+	if (chunk == NULL || chunk->ino != st->st_ino ||
+	    chunk->mtime != st->st_mtime || chunk->size != st->st_size)
+		return NULL;
+	return chunk;
+}
+
+static void
+dlua_script_chunk_save(lua_State *L, const char *file, const struct stat *st)
+{
+	struct dlua_script_chunk *chunk;
+	char *orig_file;
+
+	if (!hash_table_is_created(dlua_script_chunks)) {
+		hash_table_create(&dlua_script_chunks, default_pool, 0,
+				  str_hash, strcmp);
+	}
+	if (hash_table_lookup_full(dlua_script_chunks, file,
+				   &orig_file, &chunk)) {
+		hash_table_remove(dlua_script_chunks, orig_file);
+		dlua_script_chunk_free(chunk);
+	}
+
+	chunk = i_new(struct dlua_script_chunk, 1);
+	chunk->bytecode = buffer_create_dynamic(default_pool, 1024);
+	/* keep the debug information, so errors still have line numbers */
+	if (lua_dump(L, dlua_script_chunk_writer, chunk->bytecode, 0) != 0) {
+		dlua_script_chunk_free(chunk);
+		return;
+	}
+	chunk->path = i_strdup(file);
+	chunk->ino = st->st_ino;
+	chunk->mtime = st->st_mtime;
+	chunk->size = st->st_size;
+	hash_table_insert(dlua_script_chunks, chunk->path, chunk);
+}
+
+void dlua_script_cache_deinit(void)
+{
+	struct hash_iterate_context *iter;
+	struct dlua_script_chunk *chunk;
+	char *path;
+
+	if (!hash_table_is_created(dlua_script_chunks))
+		return;
+
+	iter = hash_table_iterate_init(dlua_script_chunks);
+	while (hash_table_iterate(iter, dlua_script_chunks, &path, &chunk))
+		dlua_script_chunk_free(chunk);
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&dlua_script_chunks);
+}
+
 int dlua_script_create_file(const char *file, struct dlua_script **script_r,
 			    struct event *event_parent, const char **error_r)
 {
 	struct dlua_script *script;
+	struct dlua_script_chunk *chunk;
+	struct stat st;
+	bool have_stat;
+	int ret;
 
 	/* lua reports file access errors poorly */
 	if (access(file, O_RDONLY) < 0) {
@@ -306,13 +421,32 @@ int dlua_script_create_file(const char *file, struct dlua_script **script_r,
 		return -1;
 	}
 
+	/* The file is stat()ed before loading it. If it's changed while it's
+	   being loaded, the next stat() won't match the cached chunk. */
+	have_stat = stat(file, &st) == 0;
+	chunk = !have_stat ? NULL : dlua_script_chunk_lookup(file, &st);
+
 	script = dlua_create_script(file, event_parent);
-	if (luaL_loadfile(script->L, file) != LUA_OK) {
+	if (chunk != NULL) {
+		ret = luaL_loadbuffer(script->L, chunk->bytecode->data,
+				      chunk->bytecode->used,
+				      t_strconcat("@", file, NULL));
+	} else {
+		ret = luaL_loadfile(script->L, file);
+	}
+	if (ret != LUA_OK) {
 		*error_r = t_strdup_printf("lua_load(%s) failed: %s",
 					   file, lua_tostring(script->L, -1));
 		dlua_script_unref(&script);
 		return -1;
 	}
+	if (chunk == NULL && have_stat)
+		dlua_script_chunk_save(script->L, file, &st);
+
+	e_debug(event_create_passthrough(script->event)->
+		set_name("lua_script_loaded")->
+		add_str("cached", chunk != NULL ? "yes" : "no")->event(),
+		"Script loaded");
 
 	*script_r = script;
 	return 0;
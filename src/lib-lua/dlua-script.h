@@ -12,6 +12,10 @@ int dlua_script_create_file(const char *file, struct dlua_script **script_r,
 int dlua_script_create_stream(struct istream *is, struct dlua_script **script_r,
 			      struct event *event_parent, const char **error_r);
 
+/* Free the compiled script files cached by dlua_script_create_file().
+   Scripts that are already created aren't affected. */
+void dlua_script_cache_deinit(void);
+
 /* run dlua_script_init function */
 int dlua_script_init(struct dlua_script *script, const char **error_r);
 
@@ -1,9 +1,14 @@
 /* Copyright (c) 2018 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
+#include "write-full.h"
 #include "dlua-script-private.h"
 
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TEST_LUA_FILE ".test-lua-script.lua"
 
 static int dlua_test_assert(lua_State *L)
 {
@@ -407,6 +412,59 @@ static void test_tls(void)
 	test_end();
 }
 
+static void test_lua_file_write(const char *contents)
+{
+	int fd;
+
+	fd = open(TEST_LUA_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd == -1)
+		i_fatal("open(%s) failed: %m", TEST_LUA_FILE);
+	if (write_full(fd, contents, strlen(contents)) < 0)
+		i_fatal("write(%s) failed: %m", TEST_LUA_FILE);
+	i_close_fd(&fd);
+}
+
+static lua_Integer test_lua_file_run(void)
+{
+	struct dlua_script *script;
+	const char *error;
+	lua_Integer value = -1;
+
+	if (dlua_script_create_file(TEST_LUA_FILE, &script, NULL, &error) < 0)
+		i_fatal("dlua_script_create_file() failed: %s", error);
+	test_assert(dlua_script_init(script, &error) == 0);
+
+	lua_getglobal(script->L, "lua_test_value");
+	test_assert(lua_pcall(script->L, 0, 1, 0) == 0);
+	if (lua_isinteger(script->L, -1))
+		value = lua_tointeger(script->L, -1);
+	lua_pop(script->L, 1);
+	dlua_script_unref(&script);
+	return value;
+}
+
+static void test_script_file_cache(void)
+{
+	test_begin("lua script file cache");
+
+	test_lua_file_write("function lua_test_value() return 1 end\n");
+	test_assert(test_lua_file_run() == 1);
+	/* loaded from the cached chunk */
+	test_assert(test_lua_file_run() == 1);
+
+	/* a changed file is loaded again */
+	test_lua_file_write("function lua_test_value() return 1234 end\n");
+	test_assert(test_lua_file_run() == 1234);
+	test_assert(test_lua_file_run() == 1234);
+
+	dlua_script_cache_deinit();
+	test_assert(test_lua_file_run() == 1234);
+	dlua_script_cache_deinit();
+
+	i_unlink(TEST_LUA_FILE);
+	test_end();
+}
+
 /* check lua_tointegerx against top-of-stack item */
 static void check_tointegerx_compat(lua_State *L, bool expected_isnum,
 				    bool expected_isint,
@@ -517,6 +575,7 @@ int main(void) {
 	void (*tests[])(void) = {
 		test_lua,
 		test_tls,
+		test_script_file_cache,
 		test_compat_tointegerx_and_isinteger,
 		NULL
 	};
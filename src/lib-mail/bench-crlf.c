@@ -0,0 +1,206 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "buffer.h"
+#include "str.h"
+#include "istream.h"
+#include "istream-crlf.h"
+#include "ostream.h"
+#include "istream-dot.h"
+#include "ostream-dot.h"
+
+#include <stdio.h>
+
+/**
+ * Measures the line ending conversion streams used when serving and
+ * receiving mails: LF -> CRLF (FETCH BODY[] from maildir/mdbox), CRLF -> LF
+ * (saving), dot-unstuffing (LMTP DATA) and dot-stuffing (SMTP submission).
+ *
+ * The mails are read from files given as parameters, or a corpus resembling
+ * real mails is generated: headers, text lines of varying lengths and
+ * base64 encoded attachments.
+ */
+
+#define BENCH_MIN_BYTES (256*1024*1024UL)
+#define BENCH_GENERATED_SIZE (10*1024*1024)
+
+static void bench_generate_mail(string_t *mail)
+{
+	static const char b64chars[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	unsigned int i, j, len;
+
+	while (str_len(mail) < BENCH_GENERATED_SIZE) {
+		for (i = 0; i < 20; i++) {
+			str_printfa(mail, "X-Header-%u: ", i);
+			len = 20 + i_rand_limit(60);
+			for (j = 0; j < len; j++)
+				str_append_c(mail, 'a' + i_rand_limit(26));
+			str_append_c(mail, '\n');
+		}
+		str_append_c(mail, '\n');
+		/* text part: mostly shortish lines, some empty, some
+		   starting with a dot */
+		for (i = 0; i < 200; i++) {
+			len = i_rand_limit(5) == 0 ? 0 : i_rand_limit(78);
+			if (i_rand_limit(50) == 0)
+				str_append_c(mail, '.');
+			for (j = 0; j < len; j++) {
+				str_append_c(mail, j % 7 == 6 ? ' ' :
+					     'a' + i_rand_limit(26));
+			}
+			str_append_c(mail, '\n');
+		}
+		/* attachment: 76 character base64 lines */
+		for (i = 0; i < 2000; i++) {
+			for (j = 0; j < 76; j++)
+				str_append_c(mail, b64chars[i_rand_limit(64)]);
+			str_append_c(mail, '\n');
+		}
+	}
+}
+
+static void bench_add_cr(string_t *dest, const unsigned char *data, size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (data[i] == '\n' && (i == 0 || data[i-1] != '\r'))
+			str_append_c(dest, '\r');
+		str_append_c(dest, data[i]);
+	}
+}
+
+static void bench_add_dots(string_t *dest, const unsigned char *data,
+			   size_t size)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		if (data[i] == '.' && (i == 0 || data[i-1] == '\n'))
+			str_append_c(dest, '.');
+		str_append_c(dest, data[i]);
+	}
+	str_append(dest, "\r\n.\r\n");
+}
+
+static void bench_print(const char *name, uint64_t nsecs, uint64_t bytes)
+{
+	printf("\t%s: %0.0lf MB/s\n", name,
+	       (double)bytes * 1000 / (double)nsecs);
+}
+
+static uint64_t bench_istream(struct istream *input)
+{
+	const unsigned char *data;
+	size_t size;
+	uint64_t bytes = 0;
+
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		bytes += size;
+		i_stream_skip(input, size);
+	}
+	i_assert(input->stream_errno == 0);
+	return bytes;
+}
+
+static void
+bench_istream_filter(const char *name, const buffer_t *mail,
+		     struct istream *(*create)(struct istream *input))
+{
+	struct istream *input, *filter;
+	unsigned long i, rounds = BENCH_MIN_BYTES / mail->used + 1;
+	uint64_t ts_0, bytes = 0;
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < rounds; i++) {
+		input = i_stream_create_from_buffer(mail);
+		filter = create(input);
+		bytes += bench_istream(filter);
+		i_stream_unref(&filter);
+		i_stream_unref(&input);
+	}
+	i_assert(bytes > 0);
+	bench_print(name, i_nanoseconds() - ts_0, rounds * mail->used);
+}
+
+static struct istream *bench_create_dot(struct istream *input)
+{
+	return i_stream_create_dot(input, TRUE);
+}
+
+static void bench_ostream_dot(const buffer_t *mail)
+{
+	struct ostream *output, *dot_output;
+	buffer_t *dest;
+	unsigned long i, rounds = BENCH_MIN_BYTES / mail->used + 1;
+	uint64_t ts_0;
+
+	dest = buffer_create_dynamic(default_pool, mail->used * 2);
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < rounds; i++) {
+		buffer_set_used_size(dest, 0);
+		output = o_stream_create_buffer(dest);
+		dot_output = o_stream_create_dot(output, FALSE);
+		o_stream_nsend(dot_output, mail->data, mail->used);
+		if (o_stream_finish(dot_output) < 0)
+			i_fatal("o_stream_finish() failed");
+		o_stream_unref(&dot_output);
+		o_stream_unref(&output);
+	}
+	bench_print("ostream-dot", i_nanoseconds() - ts_0,
+		    rounds * mail->used);
+	buffer_free(&dest);
+}
+
+static void bench_mail(const char *name, const buffer_t *mail_lf)
+{
+	string_t *mail_crlf, *mail_dot;
+
+	mail_crlf = str_new(default_pool, mail_lf->used * 2);
+	bench_add_cr(mail_crlf, mail_lf->data, mail_lf->used);
+	mail_dot = str_new(default_pool, str_len(mail_crlf) + 1024);
+	bench_add_dots(mail_dot, mail_crlf->data, mail_crlf->used);
+
+	printf("%s (%zu bytes)\n", name, mail_lf->used);
+	bench_istream_filter("istream-crlf (LF input)", mail_lf,
+			     i_stream_create_crlf);
+	bench_istream_filter("istream-crlf (CRLF input)", mail_crlf,
+			     i_stream_create_crlf);
+	bench_istream_filter("istream-lf", mail_crlf, i_stream_create_lf);
+	bench_istream_filter("istream-dot", mail_dot, bench_create_dot);
+	bench_ostream_dot(mail_crlf);
+
+	str_free(&mail_crlf);
+	str_free(&mail_dot);
+}
+
+int main(int argc, const char *argv[])
+{
+	buffer_t *mail;
+	const char *error;
+	int i;
+
+	lib_init();
+
+	mail = buffer_create_dynamic(default_pool, BENCH_GENERATED_SIZE + 1024);
+	if (argc == 1) {
+		bench_generate_mail(mail);
+		bench_mail("generated", mail);
+	}
+	for (i = 1; i < argc; i++) {
+		buffer_set_used_size(mail, 0);
+		if (buffer_append_full_file(mail, argv[i], SIZE_MAX,
+					    &error) != BUFFER_APPEND_OK)
+			i_fatal("%s: %s", argv[i], error);
+		if (mail->used == 0)
+			continue;
+		bench_mail(argv[i], mail);
+	}
+	buffer_free(&mail);
+
+	lib_deinit();
+	return 0;
+}
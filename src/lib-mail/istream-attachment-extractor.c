@@ -322,16 +322,12 @@ static void astream_add_body(struct attachment_istream *astream,
 		}
 		part->state = MAIL_ATTACHMENT_STATE_YES;
 		astream_try_base64_decode(part, part_buf->data, part_buf->used);
-		hash_format_loop(astream->set.hash_format,
-				 part_buf->data, part_buf->used);
 		o_stream_nsend(part->temp_output,
 			       part_buf->data, part_buf->used);
 		buffer_set_used_size(part_buf, 0);
 		/* fall through - write the new data to temp file */
 	case MAIL_ATTACHMENT_STATE_YES:
 		astream_try_base64_decode(part, block->data, block->size);
-		hash_format_loop(astream->set.hash_format,
-				 block->data, block->size);
 		o_stream_nsend(part->temp_output, block->data, block->size);
 		break;
 	}
@@ -465,6 +461,29 @@ static int astream_decode_base64(struct attachment_istream *astream,
 	return 1;
 }
 
+static int
+astream_hash_temp_file(struct attachment_istream *astream, const char **error_r)
+{
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	int ret = 0;
+
+	hash_format_reset(astream->set.hash_format);
+	input = i_stream_create_fd(astream->part.temp_fd, IO_BLOCK_SIZE);
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		hash_format_loop(astream->set.hash_format, data, size);
+		i_stream_skip(input, size);
+	}
+	if (input->stream_errno != 0) {
+		*error_r = t_strdup_printf("read(%s) failed: %s",
+			i_stream_get_name(input), i_stream_get_error(input));
+		ret = -1;
+	}
+	i_stream_destroy(&input);
+	return ret;
+}
+
 static int
 astream_part_finish(struct attachment_istream *astream, const char **error_r)
 {
@@ -492,10 +511,6 @@ astream_part_finish(struct attachment_istream *astream, const char **error_r)
 	   is saved as an attachment. the rest of the data (typically
 	   linefeeds) is added back to main stream */
 	info.encoded_size = part->base64_bytes;
-	/* get the hash before base64-decoder resets it */
-	digest_str = t_str_new(128);
-	hash_format_write(astream->set.hash_format, digest_str);
-	info.hash = str_c(digest_str);
 
 	/* if it looks like we can decode base64 without any data loss,
 	   do it and write the decoded data to another temp file. */
@@ -525,15 +540,21 @@ astream_part_finish(struct attachment_istream *astream, const char **error_r)
 	if (!part->base64_failed) {
 		info.base64_blocks_per_line = part->base64_line_blocks;
 		info.base64_have_crlf = part->base64_have_crlf;
-		/* base64-decoder updated the hash, use it */
-		str_truncate(digest_str, 0);
-		hash_format_write(astream->set.hash_format, digest_str);
-		info.hash = str_c(digest_str);
+		/* base64-decoder updated the hash */
 	} else {
 		/* couldn't decode base64, so write the entire MIME part
-		   as attachment */
+		   as attachment. the hash wasn't calculated while the
+		   data was being written to the temp file, because it's
+		   needed only in this case. */
 		info.encoded_size = part->temp_output->offset;
+		if (astream_hash_temp_file(astream, error_r) < 0) {
+			buffer_free(&extra_buf);
+			return -1;
+		}
 	}
+	digest_str = t_str_new(128);
+	hash_format_write(astream->set.hash_format, digest_str);
+	info.hash = str_c(digest_str);
 	if (astream->set.open_attachment_ostream(&info, &output, error_r,
 						 astream->context) < 0) {
 		buffer_free(&extra_buf);
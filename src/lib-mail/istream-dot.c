@@ -111,8 +111,8 @@ static ssize_t i_stream_dot_read(struct istream_private *stream)
 {
 	/* @UNSAFE */
 	struct dot_istream *dstream = (struct dot_istream *)stream;
-	const unsigned char *data;
-	size_t i, dest, size, avail;
+	const unsigned char *data, *p;
+	size_t i, dest, size, avail, len;
 	ssize_t ret, ret1;
 
 	if (dstream->pending[0] != '\0') {
@@ -145,6 +145,18 @@ static ssize_t i_stream_dot_read(struct istream_private *stream)
 
 	data = i_stream_get_data(stream->parent, &size);
 	for (i = 0; i < size && dest < stream->buffer_size; i++) {
+		if (dstream->state == 0) {
+			/* copy everything up to the next CR or LF */
+			len = I_MIN(size - i, stream->buffer_size - dest);
+			p = i_memchr2(data + i, '\r', '\n', len);
+			if (p != NULL)
+				len = p - (data + i);
+			memcpy(stream->w_buffer + dest, data + i, len);
+			dest += len;
+			i += len;
+			if (p == NULL)
+				break;
+		}
 		switch (dstream->state) {
 		case 0:
 			break;
@@ -8,6 +8,8 @@
 #include "istream-private.h"
 #include "istream-header-filter.h"
 
+#include <ctype.h>
+
 struct header_filter_istream_snapshot {
 	struct istream_snapshot snapshot;
 	struct header_filter_istream *mstream;
@@ -22,6 +24,10 @@ struct header_filter_istream {
 
 	const char **headers;
 	unsigned int headers_count;
+	/* Quick lookups for rejecting non-matching header names before
+	   the binary search. The first characters are lowercased. */
+	size_t headers_min_len;
+	bool headers_first_chars[256];
 
 	header_filter_callback *callback;
 	void *context;
@@ -260,6 +266,11 @@ static ssize_t read_header(struct header_filter_istream *mstream)
 		} else if (mstream->headers_count == 0) {
 			/* no include/exclude headers - default matching */
 			matched = FALSE;
+		} else if (hdr->name_len < mstream->headers_min_len ||
+			   !mstream->headers_first_chars[
+				(unsigned char)i_tolower(hdr->name[0])]) {
+			/* can't be any of the headers */
+			matched = FALSE;
 		} else {
 			matched = i_bsearch(hdr->name, mstream->headers,
 					    mstream->headers_count,
@@ -699,6 +710,7 @@ i_stream_create_header_filter(struct istream *input,
 {
 	struct header_filter_istream *mstream;
 	unsigned int i, j;
+	size_t len;
 	int ret;
 
 	i_assert((flags & (HEADER_FILTER_INCLUDE|HEADER_FILTER_EXCLUDE)) != 0);
@@ -719,6 +731,12 @@ i_stream_create_header_filter(struct istream *input,
 		}
 		i_assert(ret < 0);
 		mstream->headers[j++] = p_strdup(mstream->pool, headers[i]);
+
+		len = strlen(headers[i]);
+		if (j == 1 || len < mstream->headers_min_len)
+			mstream->headers_min_len = len;
+		mstream->headers_first_chars[
+			(unsigned char)i_tolower(headers[i][0])] = TRUE;
 	}
 	mstream->headers_count = j;
 	mstream->hdr_buf = buffer_create_dynamic(default_pool, 1024);
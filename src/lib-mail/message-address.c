@@ -442,6 +442,58 @@ static int parse_path(struct message_address_parser_context *ctx)
 	return ret;
 }
 
+static bool
+message_address_parse_simple(pool_t pool, const unsigned char *data,
+			     size_t size, struct message_address **addr_r)
+{
+	struct message_address *addr;
+	const unsigned char *at = NULL;
+	size_t i, local_len, domain_len;
+	char *mailbox, *domain;
+
+	/* Fast path for the common case of a single plain ASCII
+	   "user@domain" address. Anything else (comments, quoting, display
+	   names, unusual dots, etc.) goes through the full parser. */
+	while (size > 0 && (data[0] == ' ' || data[0] == '\t')) {
+		data++; size--;
+	}
+	while (size > 0 && (data[size-1] == ' ' || data[size-1] == '\t'))
+		size--;
+
+	for (i = 0; i < size; i++) {
+		if (data[i] == '@') {
+			if (at != NULL)
+				return FALSE;
+			at = data + i;
+		} else if (data[i] == '.') {
+			if (i == 0 || i+1 == size ||
+			    data[i-1] == '.' || data[i-1] == '@' ||
+			    data[i+1] == '@')
+				return FALSE;
+		} else if (data[i] >= 0x80 || !IS_ATEXT(data[i])) {
+			return FALSE;
+		}
+	}
+	if (at == NULL || at == data || at == data + size - 1)
+		return FALSE;
+
+	/* allocate the address and both strings at once */
+	local_len = at - data;
+	domain_len = size - local_len - 1;
+	addr = p_malloc(pool, sizeof(*addr) + size + 1);
+	mailbox = (char *)(addr + 1);
+	memcpy(mailbox, data, local_len);
+	mailbox[local_len] = '\0';
+	domain = mailbox + local_len + 1;
+	memcpy(domain, at + 1, domain_len);
+	domain[domain_len] = '\0';
+
+	addr->mailbox = mailbox;
+	addr->domain = domain;
+	*addr_r = addr;
+	return TRUE;
+}
+
 static struct message_address *
 message_address_parse_real(pool_t pool, const unsigned char *data, size_t size,
 			   unsigned int max_addresses,
@@ -495,6 +547,10 @@ message_address_parse(pool_t pool, const unsigned char *data, size_t size,
 {
 	struct message_address *addr;
 
+	if (max_addresses > 0 &&
+	    message_address_parse_simple(pool, data, size, &addr))
+		return addr;
+
 	if (pool->datastack_pool) {
 		return message_address_parse_real(pool, data, size,
 						  max_addresses, flags);
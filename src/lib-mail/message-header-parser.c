@@ -414,6 +414,58 @@ void message_parse_header(struct istream *input, struct message_size *hdr_size,
 	callback(NULL, context);
 }
 
+static int
+message_header_find_wanted(const char *const *wanted_headers,
+			   const bool *found, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; wanted_headers[i] != NULL; i++) {
+		if (!found[i] && strcasecmp(wanted_headers[i], name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+#undef message_parse_header_wanted
+void message_parse_header_wanted(struct istream *input,
+				 const char *const *wanted_headers,
+				 enum message_header_parser_flags flags,
+				 message_header_callback_t *callback,
+				 void *context)
+{
+	struct message_header_parser_ctx *hdr_ctx;
+	struct message_header_line *hdr;
+	unsigned int count = str_array_length(wanted_headers);
+	unsigned int found_count = 0;
+	bool *found;
+	int idx, ret = 1;
+
+	found = i_new(bool, count);
+	hdr_ctx = message_parse_header_init(input, NULL, flags);
+	while (found_count < count &&
+	       (ret = message_parse_header_next(hdr_ctx, &hdr)) > 0) {
+		if (hdr->eoh)
+			break;
+		idx = message_header_find_wanted(wanted_headers, found,
+						 hdr->name);
+		if (idx < 0)
+			continue;
+		if (hdr->continues) {
+			hdr->use_full_value = TRUE;
+			continue;
+		}
+		found[idx] = TRUE;
+		found_count++;
+		callback(hdr, context);
+	}
+	i_assert(ret != 0);
+	message_parse_header_deinit(&hdr_ctx);
+	i_free(found);
+
+	callback(NULL, context);
+}
+
 void message_header_line_write(buffer_t *output,
 			       const struct message_header_line *hdr)
 {
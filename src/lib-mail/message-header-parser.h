@@ -69,6 +69,24 @@ void message_parse_header(struct istream *input, struct message_size *hdr_size,
 			struct message_header_line *hdr, typeof(context))), \
  		(message_header_callback_t *)callback, context)
 
+/* Parse the header, but call the callback only for the first instance of each
+   of the wanted headers (matched case-insensitively). Continued lines aren't
+   given to the callback, only the final line with the full_value. Parsing
+   stops as soon as all the wanted headers have been found, so the rest of the
+   header isn't read. The callback is called once with hdr = NULL at the
+   end. */
+void message_parse_header_wanted(struct istream *input,
+				 const char *const *wanted_headers,
+				 enum message_header_parser_flags flags,
+				 message_header_callback_t *callback,
+				 void *context);
+#define message_parse_header_wanted(input, wanted_headers, flags, \
+				    callback, context) \
+	  message_parse_header_wanted(input, wanted_headers, flags - \
+		CALLBACK_TYPECHECK(callback, void (*)( \
+			struct message_header_line *hdr, typeof(context))), \
+		(message_header_callback_t *)callback, context)
+
 /* Write the header line to buffer exactly as it was read, including the
    newline. */
 void message_header_line_write(buffer_t *output,
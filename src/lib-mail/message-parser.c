@@ -395,7 +395,7 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 				       struct message_block *block_r)
 {
 	struct message_boundary *boundary = NULL;
-	const unsigned char *data, *cur, *next, *end;
+	const unsigned char *data, *cur, *next, *end, *last_lf;
 	size_t boundary_start;
 	int ret;
 	bool full;
@@ -420,10 +420,17 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 
 	/* skip to beginning of the next line. the first line was
 	   handled already. */
-	cur = data; end = data + block_r->size;
+	cur = data; end = data + block_r->size; last_lf = NULL;
 	while ((next = memchr(cur, '\n', end - cur)) != NULL) {
 		cur = next + 1;
 
+		if (end - cur >= 2 && (cur[0] != '-' || cur[1] != '-')) {
+			/* not a boundary line. this is the common case, so
+			   skip it without any further processing. */
+			last_lf = next;
+			continue;
+		}
+
 		boundary_start = next - data;
 		if (next > data && next[-1] == '\r')
 			boundary_start--;
@@ -441,6 +448,13 @@ static int parse_next_body_to_boundary(struct message_parser_ctx *ctx,
 				ctx->want_count += cur - block_r->data;
 			break;
 		}
+		last_lf = NULL;
+	}
+	if (next == NULL && last_lf != NULL) {
+		/* the data after the last skipped line wasn't examined */
+		boundary_start = last_lf - data;
+		if (last_lf > data && last_lf[-1] == '\r')
+			boundary_start--;
 	}
 
 	if (next != NULL) {
@@ -5,6 +5,7 @@
 #include "istream.h"
 #include "str.h"
 #include "str-find.h"
+#include "str-find-multi.h"
 #include "rfc822-parser.h"
 #include "message-decoder.h"
 #include "message-parser.h"
@@ -14,11 +15,14 @@ struct message_search_context {
 	enum message_search_flags flags;
 	normalizer_func_t *normalizer;
 
+	/* Either a single key or multiple keys are searched */
 	struct str_find_context *str_find_ctx;
+	struct str_find_multi_context *str_find_multi_ctx;
 	struct message_part *prev_part;
 
 	struct message_decoder_context *decoder;
 	bool content_type_text:1; /* text/any or message/any */
+	bool found:1; /* single key was found */
 };
 
 struct message_search_context *
@@ -37,12 +41,37 @@ message_search_init(const char *normalized_key_utf8,
 	return ctx;
 }
 
+struct message_search_context *
+message_search_init_multi(const char *const *normalized_keys_utf8,
+			  unsigned int key_count,
+			  normalizer_func_t *normalizer,
+			  enum message_search_flags flags)
+{
+	struct message_search_context *ctx;
+
+	if (key_count == 1) {
+		return message_search_init(normalized_keys_utf8[0],
+					   normalizer, flags);
+	}
+
+	ctx = i_new(struct message_search_context, 1);
+	ctx->flags = flags;
+	ctx->decoder = message_decoder_init(normalizer, 0);
+	ctx->str_find_multi_ctx =
+		str_find_multi_init(default_pool, normalized_keys_utf8,
+				    key_count);
+	return ctx;
+}
+
 void message_search_deinit(struct message_search_context **_ctx)
 {
 	struct message_search_context *ctx = *_ctx;
 
 	*_ctx = NULL;
-	str_find_deinit(&ctx->str_find_ctx);
+	if (ctx->str_find_ctx != NULL)
+		str_find_deinit(&ctx->str_find_ctx);
+	else
+		str_find_multi_deinit(&ctx->str_find_multi_ctx);
 	message_decoder_deinit(&ctx->decoder);
 	i_free(ctx);
 }
@@ -79,19 +108,27 @@ static void handle_header(struct message_search_context *ctx,
 	}
 }
 
+static bool search_data(struct message_search_context *ctx,
+			const unsigned char *data, size_t size)
+{
+	if (ctx->str_find_multi_ctx != NULL)
+		return str_find_multi_more(ctx->str_find_multi_ctx, data, size);
+	if (!str_find_more(ctx->str_find_ctx, data, size))
+		return FALSE;
+	ctx->found = TRUE;
+	return TRUE;
+}
+
 static bool search_header(struct message_search_context *ctx,
 			  const struct message_header_line *hdr)
 {
 	static const unsigned char crlf[2] = { '\r', '\n' };
 
-	return str_find_more(ctx->str_find_ctx,
-			     (const unsigned char *)hdr->name, hdr->name_len) ||
-		str_find_more(ctx->str_find_ctx,
-			      hdr->middle, hdr->middle_len) ||
-		str_find_more(ctx->str_find_ctx, hdr->full_value,
-			      hdr->full_value_len) ||
-		(!hdr->no_newline &&
-		 str_find_more(ctx->str_find_ctx, crlf, 2));
+	return search_data(ctx, (const unsigned char *)hdr->name,
+			   hdr->name_len) ||
+		search_data(ctx, hdr->middle, hdr->middle_len) ||
+		search_data(ctx, hdr->full_value, hdr->full_value_len) ||
+		(!hdr->no_newline && search_data(ctx, crlf, 2));
 }
 
 static bool message_search_more_decoded2(struct message_search_context *ctx,
@@ -101,12 +138,25 @@ static bool message_search_more_decoded2(struct message_search_context *ctx,
 		if (search_header(ctx, block->hdr))
 			return TRUE;
 	} else {
-		if (str_find_more(ctx->str_find_ctx, block->data, block->size))
+		if (search_data(ctx, block->data, block->size))
 			return TRUE;
 	}
 	return FALSE;
 }
 
+static void message_search_reset_input(struct message_search_context *ctx)
+{
+	/* Content-Type defaults to text/plain */
+	ctx->content_type_text = TRUE;
+
+	ctx->prev_part = NULL;
+	if (ctx->str_find_ctx != NULL)
+		str_find_reset(ctx->str_find_ctx);
+	else
+		str_find_multi_reset(ctx->str_find_multi_ctx);
+	message_decoder_decode_reset(ctx->decoder);
+}
+
 bool message_search_more(struct message_search_context *ctx,
 			 struct message_block *raw_block)
 {
@@ -128,7 +178,7 @@ bool message_search_more_get_decoded(struct message_search_context *ctx,
 	if (raw_block->part != ctx->prev_part) {
 		/* part changes. we must change this before looking at
 		   content type */
-		message_search_reset(ctx);
+		message_search_reset_input(ctx);
 		ctx->prev_part = raw_block->part;
 
 		if (hdr == NULL) {
@@ -174,7 +224,7 @@ bool message_search_more_decoded(struct message_search_context *ctx,
 {
 	if (block->part != ctx->prev_part) {
 		/* part changes */
-		message_search_reset(ctx);
+		message_search_reset_input(ctx);
 		ctx->prev_part = block->part;
 	}
 
@@ -183,28 +233,46 @@ bool message_search_more_decoded(struct message_search_context *ctx,
 
 void message_search_reset(struct message_search_context *ctx)
 {
-	/* Content-Type defaults to text/plain */
-	ctx->content_type_text = TRUE;
+	message_search_reset_input(ctx);
+	ctx->found = FALSE;
+	if (ctx->str_find_multi_ctx != NULL)
+		str_find_multi_reset_found(ctx->str_find_multi_ctx);
+}
 
-	ctx->prev_part = NULL;
-	str_find_reset(ctx->str_find_ctx);
-	message_decoder_decode_reset(ctx->decoder);
+bool message_search_is_key_found(struct message_search_context *ctx,
+				 unsigned int key_idx)
+{
+	if (ctx->str_find_multi_ctx != NULL) {
+		return str_find_multi_is_found(ctx->str_find_multi_ctx,
+					       key_idx);
+	}
+	i_assert(key_idx == 0);
+	return ctx->found;
 }
 
 static int
-message_search_msg_real(struct message_search_context *ctx,
-			struct istream *input, struct message_part *parts,
-			const char **error_r)
+message_search_msg_real(struct message_search_context *const *ctxs,
+			unsigned int count, struct istream *input,
+			struct message_part *parts, const char **error_r)
 {
 	const struct message_parser_settings parser_set = {
 		.hdr_flags = MESSAGE_HEADER_PARSER_FLAG_CLEAN_ONELINE,
 	};
 	struct message_parser_ctx *parser_ctx;
-	struct message_block raw_block;
+	struct message_block raw_block, decoded_block;
 	struct message_part *new_parts;
+	bool *found;
+	unsigned int i, found_count = 0;
 	int ret;
 
-	message_search_reset(ctx);
+	found = t_new(bool, count);
+	for (i = 0; i < count; i++) {
+		/* the first context decodes the message for all of them, so
+		   it can't skip headers unless all the others do as well */
+		i_assert((ctxs[0]->flags & MESSAGE_SEARCH_FLAG_SKIP_HEADERS) == 0 ||
+			 (ctxs[i]->flags & MESSAGE_SEARCH_FLAG_SKIP_HEADERS) != 0);
+		message_search_reset(ctxs[i]);
+	}
 
 	if (parts != NULL) {
 		parser_ctx = message_parser_init_from_parts(parts,
@@ -216,7 +284,25 @@ message_search_msg_real(struct message_search_context *ctx,
 
 	while ((ret = message_parser_parse_next_block(parser_ctx,
 						      &raw_block)) > 0) {
-		if (message_search_more(ctx, &raw_block)) {
+		if (message_search_more_get_decoded(ctxs[0], &raw_block,
+						    &decoded_block) &&
+		    !found[0]) {
+			found[0] = TRUE;
+			found_count++;
+		}
+		for (i = 1; i < count; i++) {
+			if (found[i])
+				continue;
+			if (decoded_block.hdr != NULL &&
+			    (ctxs[i]->flags & MESSAGE_SEARCH_FLAG_SKIP_HEADERS) != 0)
+				continue;
+			if (message_search_more_decoded(ctxs[i],
+							&decoded_block)) {
+				found[i] = TRUE;
+				found_count++;
+			}
+		}
+		if (found_count == count) {
 			ret = 1;
 			break;
 		}
@@ -236,11 +322,21 @@ message_search_msg_real(struct message_search_context *ctx,
 int message_search_msg(struct message_search_context *ctx,
 		       struct istream *input, struct message_part *parts,
 		       const char **error_r)
+{
+	return message_search_msg_multi(&ctx, 1, input, parts, error_r);
+}
+
+int message_search_msg_multi(struct message_search_context *const *ctxs,
+			     unsigned int count, struct istream *input,
+			     struct message_part *parts, const char **error_r)
 {
 	int ret;
 
+	i_assert(count > 0);
+
 	T_BEGIN {
-		ret = message_search_msg_real(ctx, input, parts, error_r);
+		ret = message_search_msg_real(ctxs, count, input, parts,
+					      error_r);
 	} T_END_PASS_STR_IF(ret < 0, error_r);
 	return ret;
 }
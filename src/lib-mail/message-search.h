@@ -15,6 +15,15 @@ struct message_search_context *
 message_search_init(const char *normalized_key_utf8,
 		    normalizer_func_t *normalizer,
 		    enum message_search_flags flags);
+/* Search multiple keys with a single pass over the message. The searching
+   functions return TRUE only after all the keys have been found, and
+   message_search_is_key_found() can be used to find out which of the keys
+   were found. */
+struct message_search_context *
+message_search_init_multi(const char *const *normalized_keys_utf8,
+			  unsigned int key_count,
+			  normalizer_func_t *normalizer,
+			  enum message_search_flags flags);
 void message_search_deinit(struct message_search_context **ctx);
 
 /* Returns TRUE if key is found from input buffer, FALSE if not. */
@@ -29,12 +38,26 @@ bool message_search_more_get_decoded(struct message_search_context *ctx,
 /* The data has already passed through decoder. */
 bool message_search_more_decoded(struct message_search_context *ctx,
 				 struct message_block *block);
+/* Reset the search for a new message. This also forgets the found keys. */
 void message_search_reset(struct message_search_context *ctx);
+/* Returns TRUE if the key with the given index was found since the last
+   reset. */
+bool message_search_is_key_found(struct message_search_context *ctx,
+				 unsigned int key_idx);
 /* Search a full message. Returns 1 if match was found, 0 if not,
    -1 if error (if stream_error == 0, the parts contained broken data) */
 int message_search_msg(struct message_search_context *ctx,
 		       struct istream *input, struct message_part *parts,
 		       const char **error_r)
 	ATTR_NULL(3);
+/* Search a full message with multiple contexts, parsing and decoding it only
+   once. The first context does the decoding, so it may have
+   MESSAGE_SEARCH_FLAG_SKIP_HEADERS only if all the other contexts have it
+   as well. All the contexts must use the same normalizer. Returns 1 if all
+   the contexts found their keys, 0 if not, -1 if error. */
+int message_search_msg_multi(struct message_search_context *const *ctxs,
+			     unsigned int count, struct istream *input,
+			     struct message_part *parts, const char **error_r)
+	ATTR_NULL(4);
 
 #endif
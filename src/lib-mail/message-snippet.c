@@ -11,6 +11,9 @@
 
 #include <ctype.h>
 
+/* How much HTML to convert to text at a time */
+#define SNIPPET_HTML_CHUNK_SIZE 1024
+
 enum snippet_state {
 	/* beginning of the line */
 	SNIPPET_STATE_NEWLINE = 0,
@@ -77,20 +80,12 @@ static void snippet_add_content(struct snippet_context *ctx,
 	str_append_data(target->snippet, data, *count_r);
 }
 
-static bool snippet_generate(struct snippet_context *ctx,
-			     const unsigned char *data, size_t size)
+static bool snippet_generate_text(struct snippet_context *ctx,
+				  const unsigned char *data, size_t size)
 {
 	size_t i, count;
 	struct snippet_data *target;
 
-	if (ctx->html2text != NULL) {
-		buffer_set_used_size(ctx->plain_output, 0);
-		mail_html2text_more(ctx->html2text, data, size,
-				    ctx->plain_output);
-		data = ctx->plain_output->data;
-		size = ctx->plain_output->used;
-	}
-
 	if (ctx->state == SNIPPET_STATE_QUOTED)
 		target = &ctx->quoted_snippet;
 	else
@@ -127,6 +122,34 @@ static bool snippet_generate(struct snippet_context *ctx,
 	return TRUE;
 }
 
+static bool snippet_generate(struct snippet_context *ctx,
+			     const unsigned char *data, size_t size)
+{
+	size_t chunk_size;
+
+	if (ctx->html2text == NULL)
+		return snippet_generate_text(ctx, data, size);
+
+	/* Convert HTML in small chunks, so the rest of the block doesn't
+	   need to be converted once the snippet is full. */
+	while (size > 0) {
+		chunk_size = I_MIN(size, SNIPPET_HTML_CHUNK_SIZE);
+		/* don't split UTF-8 characters */
+		while (chunk_size < size && chunk_size > 1 &&
+		       (data[chunk_size] & 0xc0) == 0x80)
+			chunk_size--;
+		buffer_set_used_size(ctx->plain_output, 0);
+		mail_html2text_more(ctx->html2text, data, chunk_size,
+				    ctx->plain_output);
+		if (!snippet_generate_text(ctx, ctx->plain_output->data,
+					   ctx->plain_output->used))
+			return FALSE;
+		data += chunk_size;
+		size -= chunk_size;
+	}
+	return TRUE;
+}
+
 static void snippet_copy(const char *src, string_t *dst)
 {
 	while (*src != '\0' && i_isspace(*src)) src++;
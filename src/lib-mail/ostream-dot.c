@@ -108,6 +108,18 @@ o_stream_dot_sendv(struct ostream_private *stream,
 		for (; p < pend && (size_t)(p-data)+2 < max_bytes; p++) {
 			char add = 0;
 
+			if (dstream->state == STREAM_STATE_NONE) {
+				/* only CR and LF change the state */
+				size_t len = I_MIN((size_t)(pend - p),
+					max_bytes - 2 - (size_t)(p - data));
+				const char *next = i_memchr2(p, '\r', '\n', len);
+				if (next == NULL) {
+					p += len;
+					break;
+				}
+				p = next;
+			}
+
 			switch (dstream->state) {
 			/* none */
 			case STREAM_STATE_NONE:
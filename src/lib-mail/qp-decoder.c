@@ -2,7 +2,6 @@
 
 #include "lib.h"
 #include "buffer.h"
-#include "hex-binary.h"
 #include "qp-decoder.h"
 
 /* quoted-printable lines can be max 76 characters. if we've seen more than
@@ -48,6 +47,13 @@ void qp_decoder_deinit(struct qp_decoder **_qp)
 	i_free(qp);
 }
 
+static inline unsigned char qp_hex_value(unsigned char c)
+{
+	if (c <= '9')
+		return c - '0';
+	return (c | 0x20) - 'a' + 10;
+}
+
 static size_t
 qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 		     size_t src_size)
@@ -74,6 +80,11 @@ qp_decoder_more_text(struct qp_decoder *qp, const unsigned char *src,
 			continue;
 		case ' ':
 		case '\t':
+			if (i+1 < src_size && src[i+1] > ' ') {
+				/* whitespace followed by text can't be
+				   trailing whitespace - keep it as text */
+				continue;
+			}
 			i_assert(qp->whitespace->used == 0);
 			qp->state = STATE_WHITESPACE;
 			buffer_append_c(qp->whitespace, src[i]);
@@ -203,13 +214,9 @@ int qp_decoder_more(struct qp_decoder *qp, const unsigned char *src,
 			if ((src[i] >= '0' && src[i] <= '9') ||
 			    (src[i] >= 'A' && src[i] <= 'F') ||
 			    (src[i] >= 'a' && src[i] <= 'f')) {
-				char data[3];
-
-				data[0] = qp->hexchar;
-				data[1] = src[i];
-				data[2] = '\0';
-				if (hex_to_binary(data, qp->dest) < 0)
-					i_unreached();
+				buffer_append_c(qp->dest,
+					(qp_hex_value(qp->hexchar) << 4) |
+					qp_hex_value(src[i]));
 				qp->state = STATE_TEXT;
 			} else {
 				/* invalid input */
@@ -51,6 +51,18 @@ void qp_encoder_deinit(struct qp_encoder **qp)
 	i_free(*qp);
 }
 
+static inline void
+qp_append_encoded(string_t *dest, unsigned char c)
+{
+	static const char hexchars[] = "0123456789ABCDEF";
+	char data[3];
+
+	data[0] = '=';
+	data[1] = hexchars[c >> 4];
+	data[2] = hexchars[c & 0x0f];
+	str_append_data(dest, data, sizeof(data));
+}
+
 static inline void
 qp_encode_or_break(struct qp_encoder *qp, unsigned char c)
 {
@@ -70,7 +82,8 @@ qp_encode_or_break(struct qp_encoder *qp, unsigned char c)
 	/* Include terminating = as well */
 	if ((c == ' ' || c == '\t') && qp->line_len + 4 >= qp->max_len) {
 		const char *ptr = strchr(qp->linebreak, '\n');
-		str_printfa(qp->dest, "=%02X%s", c, qp->linebreak);
+		qp_append_encoded(qp->dest, c);
+		str_append(qp->dest, qp->linebreak);
 		if (ptr != NULL)
 			qp->line_len = strlen(ptr+1);
 		else
@@ -85,7 +98,7 @@ qp_encode_or_break(struct qp_encoder *qp, unsigned char c)
 	}
 
 	if (encode) {
-		str_printfa(qp->dest, "=%02X", c);
+		qp_append_encoded(qp->dest, c);
 		qp->line_len += 3;
 	} else {
 		str_append_c(qp->dest, c);
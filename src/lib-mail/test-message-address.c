@@ -49,6 +49,9 @@ static void test_message_address(void)
 		{ "user@domain", "<user@domain>", NULL,
 		  { NULL, NULL, NULL, "user", "domain", FALSE },
 		  { NULL, NULL, NULL, "user", "domain", FALSE }, 0 },
+		{ "first.last+tag@sub.domain", "<first.last+tag@sub.domain>", NULL,
+		  { NULL, NULL, NULL, "first.last+tag", "sub.domain", FALSE },
+		  { NULL, NULL, NULL, "first.last+tag", "sub.domain", FALSE }, 0 },
 		{ "\"user\"@domain", "<user@domain>", NULL,
 		  { NULL, NULL, NULL, "user", "domain", FALSE },
 		  { NULL, NULL, NULL, "user", "domain", FALSE }, 0 },
@@ -463,6 +463,63 @@ static void test_message_header_parser_extra_crlf_in_name(void)
 	test_end();
 }
 
+static void
+test_message_header_parser_wanted_cb(struct message_header_line *hdr,
+				     string_t *str)
+{
+	if (hdr == NULL) {
+		str_append(str, "END");
+		return;
+	}
+	str_printfa(str, "%s=", hdr->name);
+	str_append_data(str, hdr->full_value, hdr->full_value_len);
+	str_append_c(str, '|');
+}
+
+static void test_message_header_parser_wanted(void)
+{
+	static const char *str =
+		"From: user@example.com\n"
+		"To: to@example.com\n"
+		"subject: first\n"
+		" line\n"
+		"Subject: second\n"
+		"X-Last: foo\n"
+		"\n"
+		"body\n";
+	static const char *const wanted[] = { "Subject", "From", NULL };
+	static const char *const wanted_missing[] = {
+		"Subject", "X-Missing", NULL
+	};
+	struct istream *input;
+	string_t *output = t_str_new(128);
+
+	test_begin("message header parser wanted headers");
+
+	input = test_istream_create(str);
+	message_parse_header_wanted(input, wanted, 0,
+				    test_message_header_parser_wanted_cb,
+				    output);
+	test_assert_strcmp(str_c(output),
+			   "From=user@example.com|subject=first\n line|END");
+	/* parsing stopped after the last wanted header */
+	test_assert(input->v_offset ==
+		    (uoff_t)(strstr(str, "Subject: second") - str));
+	i_stream_unref(&input);
+
+	str_truncate(output, 0);
+	input = test_istream_create(str);
+	message_parse_header_wanted(input, wanted_missing, 0,
+				    test_message_header_parser_wanted_cb,
+				    output);
+	test_assert_strcmp(str_c(output), "subject=first\n line|END");
+	test_assert(input->v_offset == (uoff_t)(strstr(str, "body") - str));
+	test_assert(input->stream_errno == 0);
+	i_stream_unref(&input);
+
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
@@ -473,6 +530,7 @@ int main(void)
 		test_message_header_parser_no_eoh,
 		test_message_header_parser_nul,
 		test_message_header_parser_extra_crlf_in_name,
+		test_message_header_parser_wanted,
 		NULL
 	};
 	return test_run(test_functions);
@@ -510,11 +510,118 @@ static void test_message_search_more_get_decoded(void)
 	test_end();
 }
 
+static void test_message_search_multi(void)
+{
+	static const char *const keys[] = {
+		"Find me here", "undersigned", "penmanship", "Search me",
+		"Don't find"
+	};
+	static const bool expect_found[][N_ELEMENTS(keys)] = {
+		{ TRUE, FALSE, TRUE, TRUE, TRUE },
+		/* headers skipped */
+		{ TRUE, FALSE, FALSE, TRUE, TRUE },
+	};
+	static const enum message_search_flags flags[] = {
+		0, MESSAGE_SEARCH_FLAG_SKIP_HEADERS
+	};
+	const char *all_found_keys[] = { "Search me", "title" };
+	struct message_search_context *ctx;
+	struct istream *input;
+	const char *error;
+	unsigned int i, j;
+
+	test_begin("message search multi");
+	input = test_istream_create(SIGNED_MIME_CORPUS);
+	for (i = 0; i < N_ELEMENTS(flags); i++) {
+		ctx = message_search_init_multi(keys, N_ELEMENTS(keys),
+						NULL, flags[i]);
+		for (j = 0; j < 2; j++) {
+			/* the second search must forget the earlier results */
+			i_stream_seek(input, 0);
+			test_assert_idx(message_search_msg(ctx, input, NULL,
+							   &error) == 0, i);
+			for (unsigned int k = 0; k < N_ELEMENTS(keys); k++) {
+				test_assert_idx(message_search_is_key_found(ctx, k) ==
+						expect_found[i][k], i*100 + k);
+			}
+		}
+		message_search_deinit(&ctx);
+	}
+
+	/* all keys found: stops early */
+	ctx = message_search_init_multi(all_found_keys,
+					N_ELEMENTS(all_found_keys), NULL, 0);
+	i_stream_seek(input, 0);
+	test_assert(message_search_msg(ctx, input, NULL, &error) == 1);
+	test_assert(message_search_is_key_found(ctx, 0));
+	test_assert(message_search_is_key_found(ctx, 1));
+	message_search_deinit(&ctx);
+
+	/* a single key works the same way */
+	ctx = message_search_init_multi(keys, 1, NULL, 0);
+	i_stream_seek(input, 0);
+	test_assert(message_search_msg(ctx, input, NULL, &error) == 1);
+	test_assert(message_search_is_key_found(ctx, 0));
+	message_search_deinit(&ctx);
+	i_stream_unref(&input);
+	test_end();
+}
+
+static void test_message_search_msg_multi(void)
+{
+	static const char *const keys[] = {
+		"Find me here", "undersigned", "penmanship", "Search me",
+		"Don't find"
+	};
+	static const bool expect_text_found[] = {
+		TRUE, FALSE, TRUE, TRUE, TRUE
+	};
+	static const bool expect_body_found[] = {
+		TRUE, FALSE, FALSE, TRUE, TRUE
+	};
+	struct message_search_context *ctxs[2];
+	struct istream *input;
+	const char *error;
+	unsigned int i;
+
+	test_begin("message search msg multi");
+	input = test_istream_create(SIGNED_MIME_CORPUS);
+	ctxs[0] = message_search_init_multi(keys, N_ELEMENTS(keys), NULL, 0);
+	ctxs[1] = message_search_init_multi(keys, N_ELEMENTS(keys), NULL,
+					    MESSAGE_SEARCH_FLAG_SKIP_HEADERS);
+	test_assert(message_search_msg_multi(ctxs, 2, input, NULL,
+					     &error) == 0);
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		test_assert_idx(message_search_is_key_found(ctxs[0], i) ==
+				expect_text_found[i], i);
+		test_assert_idx(message_search_is_key_found(ctxs[1], i) ==
+				expect_body_found[i], i);
+	}
+	message_search_deinit(&ctxs[0]);
+	message_search_deinit(&ctxs[1]);
+
+	/* stops only after all the contexts have found their keys */
+	ctxs[0] = message_search_init("penmanship", NULL, 0);
+	ctxs[1] = message_search_init("Search me", NULL,
+				      MESSAGE_SEARCH_FLAG_SKIP_HEADERS);
+	i_stream_seek(input, 0);
+	test_assert(message_search_msg_multi(ctxs, 2, input, NULL,
+					     &error) == 1);
+	test_assert(message_search_is_key_found(ctxs[0], 0));
+	test_assert(message_search_is_key_found(ctxs[1], 0));
+	message_search_deinit(&ctxs[0]);
+	message_search_deinit(&ctxs[1]);
+	i_stream_unref(&input);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_message_search,
 		test_message_search_more_get_decoded,
+		test_message_search_multi,
+		test_message_search_msg_multi,
 		NULL
 	};
 	return test_run(test_functions);
@@ -29,6 +29,8 @@ struct anvil_query {
 struct anvil_client {
 	struct connection conn;
 	struct timeout *to_cancel;
+	/* Set while conn.output is corked for batching commands */
+	struct timeout *to_flush;
 
 	struct timeout *to_reconnect;
 	time_t last_reconnect;
@@ -51,6 +53,7 @@ struct anvil_client {
 
 static void anvil_client_destroy(struct connection *conn);
 static int anvil_client_input_line(struct connection *conn, const char *line);
+static void anvil_client_flush(struct anvil_client *client);
 
 static struct connection_list *anvil_connections;
 
@@ -100,6 +103,8 @@ void anvil_client_deinit(struct anvil_client **_client)
 	*_client = NULL;
 
 	client->deinitializing = TRUE;
+	if (client->to_flush != NULL)
+		anvil_client_flush(client);
 	anvil_client_destroy(&client->conn);
 
 	array_free(&client->queries_arr);
@@ -287,6 +292,7 @@ static void anvil_client_destroy(struct connection *conn)
 	struct anvil_client *client =
 		container_of(conn, struct anvil_client, conn);
 
+	timeout_remove(&client->to_flush);
 	io_remove(&client->cmd_io);
 	i_stream_destroy(&client->cmd_input);
 	o_stream_destroy(&client->cmd_output);
@@ -312,7 +318,14 @@ static void anvil_client_timeout(struct anvil_query *anvil_query)
 	anvil_client_destroy(&client->conn);
 }
 
-static int anvil_client_send(struct anvil_client *client, const char *cmd)
+static void anvil_client_flush(struct anvil_client *client)
+{
+	timeout_remove(&client->to_flush);
+	o_stream_uncork(client->conn.output);
+}
+
+static int anvil_client_send(struct anvil_client *client, const char *cmd,
+			     bool batch)
 {
 	struct const_iovec iov[2];
 
@@ -321,11 +334,25 @@ static int anvil_client_send(struct anvil_client *client, const char *cmd)
 			return -1;
 	}
 
+	if (batch && client->to_flush == NULL) {
+		/* Commands without replies (e.g. CONNECT and DISCONNECT) are
+		   written in a single batch at the end of the ioloop run.
+		   With high connection churn this avoids a separate write()
+		   and anvil wakeup for each one of them. */
+		o_stream_cork(client->conn.output);
+		client->to_flush = timeout_add_short(0, anvil_client_flush,
+						     client);
+	}
+
 	iov[0].iov_base = cmd;
 	iov[0].iov_len = strlen(cmd);
 	iov[1].iov_base = "\n";
 	iov[1].iov_len = 1;
 	o_stream_nsendv(client->conn.output, iov, 2);
+	if (!batch && client->to_flush != NULL) {
+		/* don't delay queries */
+		anvil_client_flush(client);
+	}
 	return 0;
 }
 
@@ -345,7 +372,7 @@ anvil_client_query(struct anvil_client *client, const char *query,
 	anvil_query->callback = callback;
 	anvil_query->context = context;
 	aqueue_append(client->queries, &anvil_query);
-	if (anvil_client_send(client, query) < 0) {
+	if (anvil_client_send(client, query, FALSE) < 0) {
 		/* connection failure. add a delayed failure callback.
 		   the caller may not expect the callback to be called
 		   immediately. */
@@ -402,7 +429,7 @@ void anvil_client_send_reply(struct anvil_client *client, const char *reply)
 
 void anvil_client_cmd(struct anvil_client *client, const char *cmd)
 {
-	(void)anvil_client_send(client, cmd);
+	(void)anvil_client_send(client, cmd, TRUE);
 }
 
 bool anvil_client_is_connected(struct anvil_client *client)
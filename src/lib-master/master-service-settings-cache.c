@@ -1,6 +1,7 @@
 /* Copyright (c) 2010-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "wildcard-match.h"
 #include "hash.h"
 #include "llist.h"
@@ -15,12 +16,29 @@
 #define CACHE_INITIAL_ENTRY_POOL_SIZE (1024*16)
 #define CACHE_ADD_ENTRY_POOL_SIZE 1024
 
-struct config_filter {
-	struct config_filter *prev, *next;
+struct config_filter_net {
+	struct ip_addr ip;
+	unsigned int bits;
+};
 
-	const char *local_name;
-	struct ip_addr local_ip, remote_ip;
-	unsigned int local_bits, remote_bits;
+/* Index of local-net or remote-net filters. An IP is looked up by masking it
+   with each distinct prefix length that is used by the filters. */
+struct config_filter_net_index {
+	/* distinct prefix lengths */
+	ARRAY(unsigned int) bits;
+	/* masked network => itself */
+	HASH_TABLE(struct config_filter_net *,
+		   struct config_filter_net *) nets;
+};
+
+/* Index of local-name filters */
+struct config_filter_name_index {
+	/* names without wildcards => itself */
+	HASH_TABLE(const char *, const char *) names;
+	/* "*.domain" masks: domain => itself */
+	HASH_TABLE(const char *, const char *) wildcard_domains;
+	/* all the other wildcard masks */
+	ARRAY_TYPE(const_string) masks;
 };
 
 struct settings_entry {
@@ -52,7 +70,8 @@ struct master_service_settings_cache {
 	HASH_TABLE(char *, struct settings_entry *) local_name_hash;
 	HASH_TABLE(struct ip_addr *, struct settings_entry *) local_ip_hash;
 
-	struct config_filter *filters;
+	struct config_filter_net_index local_nets, remote_nets;
+	struct config_filter_name_index local_names;
 
 	/* Initial size for new settings entry pools */
 	size_t approx_entry_pool_size;
@@ -61,6 +80,7 @@ struct master_service_settings_cache {
 	size_t cache_malloc_size;
 
 	bool done_initial_lookup:1;
+	bool have_filters:1;
 	bool service_uses_local:1;
 	bool service_uses_remote:1;
 };
@@ -83,12 +103,179 @@ master_service_settings_cache_init(struct master_service *service,
 	return cache;
 }
 
+static void
+config_filter_net_mask(const struct ip_addr *ip, unsigned int bits,
+		       struct ip_addr *net_r)
+{
+	unsigned char *p;
+	unsigned int i, size;
+
+	i_zero(net_r);
+	net_r->family = ip->family;
+	if (IPADDR_IS_V4(ip)) {
+		net_r->u.ip4 = ip->u.ip4;
+		p = (void *)&net_r->u.ip4;
+		size = sizeof(net_r->u.ip4);
+	} else {
+		net_r->u.ip6 = ip->u.ip6;
+		p = net_r->u.ip6.s6_addr;
+		size = sizeof(net_r->u.ip6);
+	}
+	for (i = 0; i < size; i++) {
+		if (bits >= 8)
+			bits -= 8;
+		else {
+			p[i] &= (0xff00 >> bits) & 0xff;
+			bits = 0;
+		}
+	}
+}
+
+static unsigned int config_filter_net_hash(const struct config_filter_net *net)
+{
+	return net_ip_hash(&net->ip) ^ net->bits;
+}
+
+static int config_filter_net_cmp(const struct config_filter_net *net1,
+				 const struct config_filter_net *net2)
+{
+	if (net1->bits != net2->bits)
+		return net1->bits < net2->bits ? -1 : 1;
+	return net_ip_cmp(&net1->ip, &net2->ip);
+}
+
+static void
+config_filter_net_index_add(struct master_service_settings_cache *cache,
+			    struct config_filter_net_index *index,
+			    const struct ip_addr *ip, unsigned int bits)
+{
+	struct config_filter_net *net;
+	const unsigned int *bitsp;
+
+	if (bits == 0)
+		return;
+
+	if (!hash_table_is_created(index->nets)) {
+		p_array_init(&index->bits, cache->pool, 4);
+		hash_table_create(&index->nets, cache->pool, 0,
+				  config_filter_net_hash, config_filter_net_cmp);
+	}
+	net = p_new(cache->pool, struct config_filter_net, 1);
+	config_filter_net_mask(ip, bits, &net->ip);
+	net->bits = bits;
+	if (hash_table_lookup(index->nets, net) != NULL)
+		return;
+	hash_table_insert(index->nets, net, net);
+
+	array_foreach(&index->bits, bitsp) {
+		if (*bitsp == bits)
+			return;
+	}
+	array_push_back(&index->bits, &bits);
+}
+
+static bool
+config_filter_net_index_match(const struct config_filter_net_index *index,
+			      const struct ip_addr *ip)
+{
+	struct config_filter_net lookup;
+	struct ip_addr tmp_ip;
+	const unsigned int *bitsp;
+
+	if (!hash_table_is_created(index->nets))
+		return FALSE;
+
+	if (net_ipv6_mapped_ipv4_convert(ip, &tmp_ip) == 0) {
+		/* IPv4 address mapped disguised as IPv6 address */
+		ip = &tmp_ip;
+	}
+	if (ip->family == 0) {
+		/* non-IPv4/IPv6 address (e.g. UNIX socket) never matches
+		   anything */
+		return FALSE;
+	}
+
+	array_foreach(&index->bits, bitsp) {
+		if (IPADDR_IS_V4(ip) && *bitsp > 32)
+			continue;
+		config_filter_net_mask(ip, *bitsp, &lookup.ip);
+		lookup.bits = *bitsp;
+		if (hash_table_lookup(index->nets, &lookup) != NULL)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static void
+config_filter_name_index_add(struct master_service_settings_cache *cache,
+			     struct config_filter_name_index *index,
+			     const char *local_name)
+{
+	/* Handle multiple names separated by spaces in local_name
+	   * Ex: local_name "mail.domain.tld domain.tld mx.domain.tld" { ... } */
+	const char *const *names = t_strsplit(local_name, " ");
+	const char *name;
+
+	if (!hash_table_is_created(index->names)) {
+		hash_table_create(&index->names, cache->pool, 0,
+				  strcase_hash, strcasecmp);
+		hash_table_create(&index->wildcard_domains, cache->pool, 0,
+				  strcase_hash, strcasecmp);
+		p_array_init(&index->masks, cache->pool, 4);
+	}
+
+	for (; *names != NULL; names++) {
+		if (strpbrk(*names, "*?") == NULL) {
+			if (hash_table_lookup(index->names, *names) == NULL) {
+				name = p_strdup(cache->pool, *names);
+				hash_table_insert(index->names, name, name);
+			}
+		} else if (str_begins(*names, "*.", &name) &&
+			   strpbrk(name, "*?") == NULL) {
+			/* '*' matches exactly one label */
+			if (hash_table_lookup(index->wildcard_domains,
+					      name) == NULL) {
+				name = p_strdup(cache->pool, name);
+				hash_table_insert(index->wildcard_domains,
+						  name, name);
+			}
+		} else {
+			name = p_strdup(cache->pool, *names);
+			array_push_back(&index->masks, &name);
+		}
+	}
+}
+
+static bool
+config_filter_name_index_match(const struct config_filter_name_index *index,
+			       const char *local_name)
+{
+	const char *mask, *domain;
+
+	if (!hash_table_is_created(index->names))
+		return FALSE;
+
+	if (hash_table_lookup(index->names, local_name) != NULL)
+		return TRUE;
+	domain = strchr(local_name, '.');
+	if (domain != NULL &&
+	    hash_table_lookup(index->wildcard_domains, domain + 1) != NULL)
+		return TRUE;
+	array_foreach_elem(&index->masks, mask) {
+		if (dns_match_wildcard(local_name, mask) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
 int master_service_settings_cache_init_filter(struct master_service_settings_cache *cache)
 {
 	const char *const *filters;
 	const char *value, *error;
+	struct ip_addr ip;
+	unsigned int bits;
 
-	if (cache->filters != NULL)
+	if (cache->have_filters)
 		return 0;
 	if (master_service_settings_get_filters(cache->service, &filters, &error) < 0) {
 		e_error(cache->service->event,
@@ -99,75 +286,46 @@ int master_service_settings_cache_init_filter(struct master_service_settings_cac
 	/* parse filters */
 	while(*filters != NULL) {
 		const char *const *keys = t_strsplit_tabescaped(*filters);
-		struct config_filter *filter =
-			p_new(cache->pool, struct config_filter, 1);
 		while(*keys != NULL) {
 			if (str_begins(*keys, "local-net=", &value)) {
-				(void)net_parse_range(value,
-					&filter->local_ip, &filter->local_bits);
+				if (net_parse_range(value, &ip, &bits) == 0) {
+					config_filter_net_index_add(cache,
+						&cache->local_nets, &ip, bits);
+				}
 			} else if (str_begins(*keys, "remote-net=", &value)) {
-				(void)net_parse_range(value,
-					&filter->remote_ip, &filter->remote_bits);
+				if (net_parse_range(value, &ip, &bits) == 0) {
+					config_filter_net_index_add(cache,
+						&cache->remote_nets, &ip, bits);
+				}
 			} else if (str_begins(*keys, "local-name=", &value)) {
-				filter->local_name = p_strdup(cache->pool, value);
+				config_filter_name_index_add(cache,
+					&cache->local_names, value);
 			}
 			keys++;
 		}
-		DLLIST_PREPEND(&cache->filters, filter);
+		cache->have_filters = TRUE;
 		filters++;
 	}
 	return 0;
 }
 
-static bool
-match_local_name(const char *local_name,
-		 const char *filter_local_name)
-{
-	/* Handle multiple names separated by spaces in local_name
-	   * Ex: local_name "mail.domain.tld domain.tld mx.domain.tld" { ... } */
-	const char *ptr;
-	while((ptr = strchr(filter_local_name, ' ')) != NULL) {
-		if (dns_match_wildcard(local_name,
-		    t_strdup_until(filter_local_name, ptr)) == 0)
-			return TRUE;
-		filter_local_name = ptr+1;
-	}
-	return dns_match_wildcard(local_name, filter_local_name) == 0;
-}
-
 /* Remove any elements which there is no filter for */
 static void
 master_service_settings_cache_fix_input(struct master_service_settings_cache *cache,
 				        const struct master_service_settings_input *input,
 					struct master_service_settings_input *new_input)
 {
-	bool found_lip, found_rip, found_local_name;
-
-	found_lip = found_rip = found_local_name = FALSE;
-
-	struct config_filter *filter = cache->filters;
-	while(filter != NULL) {
-		if (filter->local_bits > 0 &&
-		    net_is_in_network(&input->local_ip, &filter->local_ip,
-				      filter->local_bits))
-			found_lip = TRUE;
-		if (filter->remote_bits > 0 &&
-		    net_is_in_network(&input->remote_ip, &filter->remote_ip,
-				      filter->remote_bits))
-			found_rip = TRUE;
-		if (input->local_name != NULL && filter->local_name != NULL &&
-		    match_local_name(input->local_name, filter->local_name))
-			found_local_name = TRUE;
-		filter = filter->next;
-	};
-
 	*new_input = *input;
 
-	if (!found_lip)
+	if (!config_filter_net_index_match(&cache->local_nets,
+					   &input->local_ip))
 		i_zero(&new_input->local_ip);
-	if (!found_rip)
+	if (!config_filter_net_index_match(&cache->remote_nets,
+					   &input->remote_ip))
 		i_zero(&new_input->remote_ip);
-	if (!found_local_name)
+	if (input->local_name == NULL ||
+	    !config_filter_name_index_match(&cache->local_names,
+					    input->local_name))
 		new_input->local_name = NULL;
 }
 
@@ -191,6 +349,10 @@ void master_service_settings_cache_deinit(struct master_service_settings_cache *
 	}
 	hash_table_destroy(&cache->local_name_hash);
 	hash_table_destroy(&cache->local_ip_hash);
+	hash_table_destroy(&cache->local_nets.nets);
+	hash_table_destroy(&cache->remote_nets.nets);
+	hash_table_destroy(&cache->local_names.names);
+	hash_table_destroy(&cache->local_names.wildcard_domains);
 	if (cache->global_parser != NULL)
 		settings_parser_unref(&cache->global_parser);
 	pool_unref(&cache->pool);
@@ -372,7 +534,7 @@ int master_service_settings_cache_read(struct master_service_settings_cache *cac
 		return 0;
 
 	new_input = *input;
-	if (cache->filters != NULL) {
+	if (cache->have_filters) {
 		master_service_settings_cache_fix_input(cache, input, &new_input);
 		if (cache_find(cache, &new_input, parser_r))
 			return 0;
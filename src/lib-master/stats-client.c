@@ -45,6 +45,20 @@ client_handshake_filter(const char *const *args, struct event_filter **filter_r,
 		event_filter_unref(filter_r);
 		return -1;
 	}
+	if (args[2] != NULL) {
+		/* FILTER <filter> <sample rate> <max events/sec> */
+		unsigned int sample_rate, max_events_per_sec;
+
+		if (str_to_uint(args[2], &sample_rate) < 0 ||
+		    sample_rate == 0 || args[3] == NULL ||
+		    str_to_uint(args[3], &max_events_per_sec) < 0) {
+			*error_r = "Invalid sampling parameters";
+			event_filter_unref(filter_r);
+			return -1;
+		}
+		event_filter_set_sampling(*filter_r, sample_rate,
+					  max_events_per_sec);
+	}
 	return 0;
 }
 
@@ -199,11 +213,19 @@ stats_client_send_event(struct stats_client *client, struct event *event,
 
 	if (!event_filter_match(client->filter, event, ctx))
 		return;
+	if (event->sending_sample_rate == 0) {
+		/* not decided yet by event_want_level() */
+		event->sending_sample_rate = event_filter_sample(client->filter);
+		if (event->sending_sample_rate == 0)
+			return;
+	}
 
 	/* Need to send the event for stats and/or export */
 	string_t *str = t_str_new(256);
 
-	if (++recursion == 0)
+	/* Cork only in the outermost call, so the event and its parents are
+	   written with a single write() */
+	if (recursion++ == 0)
 		o_stream_cork(client->conn.output);
 	struct event *global_event = event_get_global();
 	if (global_event != NULL)
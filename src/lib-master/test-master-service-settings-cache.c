@@ -15,6 +15,8 @@ static struct master_service_settings set;
 static struct master_service_settings_input input;
 static struct master_service_settings_output output;
 static struct master_service_settings_cache *cache;
+static const char *const *test_filters = NULL;
+static struct master_service_settings_input last_input;
 
 struct test_service_settings {
 	const char *foo;
@@ -45,19 +47,25 @@ static const struct setting_parser_info test_setting_parser_info = {
 };
 
 int master_service_settings_read(struct master_service *service ATTR_UNUSED,
-				 const struct master_service_settings_input *input ATTR_UNUSED,
+				 const struct master_service_settings_input *input,
 				 struct master_service_settings_output *output_r,
 				 const char **error_r ATTR_UNUSED)
 {
+	last_input = *input;
 	*output_r = output;
 	return 0;
 }
 
 int master_service_settings_get_filters(struct master_service *service ATTR_UNUSED,
-					const char *const **filters ATTR_UNUSED,
-					const char **error_r ATTR_UNUSED)
+					const char *const **filters,
+					const char **error_r)
 {
-	return -1;
+	if (test_filters == NULL) {
+		*error_r = "no filters";
+		return -1;
+	}
+	*filters = test_filters;
+	return 0;
 }
 
 
@@ -100,10 +108,83 @@ static void test_master_service_settings_cache(void)
 	}
 }
 
+static void
+test_master_service_settings_cache_filter_lookup(const char *local_ip,
+						 const char *remote_ip,
+						 const char *local_name,
+						 bool lip_match, bool rip_match,
+						 bool name_match)
+{
+	struct master_service_settings_input lookup = input;
+	struct setting_parser_context *parser;
+	const char *error;
+
+	i_zero(&last_input);
+	test_assert(net_addr2ip(local_ip, &lookup.local_ip) == 0);
+	test_assert(net_addr2ip(remote_ip, &lookup.remote_ip) == 0);
+	lookup.local_name = local_name;
+	test_assert(master_service_settings_cache_read(cache, &lookup,
+						       &parser, &error) == 0);
+	test_assert_idx(lip_match == (last_input.local_ip.family != 0),
+			lip_match);
+	test_assert_idx(rip_match == (last_input.remote_ip.family != 0),
+			rip_match);
+	test_assert_idx(name_match == (last_input.local_name != NULL),
+			name_match);
+}
+
+static void test_master_service_settings_cache_filters(void)
+{
+	static const char *const filters[] = {
+		"local-net=10.1.0.0/16",
+		"local-net=10.2.3.4/32\tlocal-name=*.example.com",
+		"remote-net=192.168.0.0/24",
+		"remote-net=2001:db8::/32",
+		"local-name=mail.example.org MX.example.org",
+		"local-name=imap?.example.net",
+		NULL
+	};
+
+	test_begin("master service settings cache filters");
+	test_filters = filters;
+	output.service_uses_local = TRUE;
+	output.service_uses_remote = TRUE;
+	cache = master_service_settings_cache_init(master_service,
+						   "module", "service_name");
+	test_assert(master_service_settings_cache_init_filter(cache) == 0);
+
+	test_master_service_settings_cache_filter_lookup(
+		"10.1.255.1", "192.168.0.255", "mail.example.org",
+		TRUE, TRUE, TRUE);
+	test_master_service_settings_cache_filter_lookup(
+		"10.3.0.1", "192.168.1.1", "example.org",
+		FALSE, FALSE, FALSE);
+	test_master_service_settings_cache_filter_lookup(
+		"10.2.3.4", "2001:db8:1::1", "mx.EXAMPLE.org",
+		TRUE, TRUE, TRUE);
+	test_master_service_settings_cache_filter_lookup(
+		"10.2.3.5", "2001:db9::1", "foo.example.com",
+		FALSE, FALSE, TRUE);
+	test_master_service_settings_cache_filter_lookup(
+		"::ffff:10.1.2.3", "::ffff:192.168.0.1", "foo.bar.example.com",
+		TRUE, TRUE, FALSE);
+	test_master_service_settings_cache_filter_lookup(
+		"::1", "::1", "imap1.example.net",
+		FALSE, FALSE, TRUE);
+	test_master_service_settings_cache_filter_lookup(
+		"::1", "::1", "imap12.example.net",
+		FALSE, FALSE, FALSE);
+
+	master_service_settings_cache_deinit(&cache);
+	test_filters = NULL;
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_master_service_settings_cache,
+		test_master_service_settings_cache_filters,
 		NULL
 	};
 	pool_t pool;
@@ -0,0 +1,388 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "buffer.h"
+#include "str.h"
+#include "ioloop.h"
+#include "istream.h"
+#include "sort.h"
+#include "strnum.h"
+#include "time-util.h"
+#include "smtp-address.h"
+#include "smtp-reply.h"
+#include "smtp-client.h"
+#include "smtp-client-connection.h"
+#include "smtp-client-transaction.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+/**
+ * Load generator for a running LMTP (or SMTP) service. It opens the given
+ * number of connections and keeps up to the pipelining depth of transactions
+ * in flight on each of them until the requested number of transactions has
+ * been sent. Each transaction has the given number of recipients and a
+ * generated message of the given size. The achieved delivery rate is
+ * reported along with the latency distribution of the whole transaction and
+ * of its MAIL, RCPT and DATA phases. The server-internal phases (user
+ * lookup, saving and committing the mail) show up in the RCPT and DATA
+ * replies respectively.
+ */
+
+#define BENCH_LMTP_DEFAULT_PORT 24
+
+struct bench_lmtp_phases {
+	ARRAY_TYPE(uint64_t) mail, rcpt, data, total;
+};
+
+struct bench_lmtp_conn;
+
+struct bench_lmtp_trans {
+	struct bench_lmtp_conn *conn;
+	struct smtp_client_transaction *trans;
+
+	uint64_t ts_start, ts_mail, ts_rcpt, ts_data;
+	unsigned int rcpts_pending, data_pending;
+	bool failed;
+};
+
+struct bench_lmtp_conn {
+	struct smtp_client_connection *conn;
+	unsigned int trans_pending;
+};
+
+static struct smtp_client *client;
+static buffer_t *msg_data;
+static const char *rcpt_user = "bench";
+static const char *rcpt_domain = "example.com";
+static unsigned int rcpt_users = 1, rcpt_count = 1;
+static unsigned int trans_total = 1000, trans_started = 0, trans_done = 0;
+static unsigned int trans_failed = 0, rcpt_next = 0, pipeline_depth = 1;
+static unsigned int deliveries = 0;
+static struct bench_lmtp_phases phases;
+static const struct smtp_address mail_from = {
+	.localpart = "sender",
+	.domain = "example.com",
+};
+
+static void bench_lmtp_trans_start(struct bench_lmtp_conn *bconn);
+
+static void bench_lmtp_generate_message(uoff_t size)
+{
+	static const char *hdr =
+		"From: <sender@example.com>\r\n"
+		"To: <bench@example.com>\r\n"
+		"Subject: bench-lmtp\r\n"
+		"Message-ID: <bench-lmtp@example.com>\r\n"
+		"\r\n";
+	static const char line[] =
+		"0123456789abcdefghijklmnopqrstuvwxyz"
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	size_t left;
+
+	msg_data = buffer_create_dynamic(default_pool, size + 128);
+	buffer_append(msg_data, hdr, strlen(hdr));
+	while (msg_data->used < size) {
+		left = size - msg_data->used;
+		if (left <= 2) {
+			buffer_append(msg_data, "\r\n", 2);
+			break;
+		}
+		buffer_append(msg_data, line, I_MIN(left - 2, sizeof(line) - 1));
+		buffer_append(msg_data, "\r\n", 2);
+	}
+}
+
+static void bench_lmtp_trans_check_done(struct bench_lmtp_trans *btrans)
+{
+	if (btrans->rcpts_pending > 0 || btrans->data_pending > 0)
+		return;
+	if (btrans->ts_data == 0)
+		btrans->ts_data = i_nanoseconds();
+}
+
+static void
+bench_lmtp_mail_cb(const struct smtp_reply *reply,
+		   struct bench_lmtp_trans *btrans)
+{
+	btrans->ts_mail = i_nanoseconds();
+	if (!smtp_reply_is_success(reply)) {
+		i_error("MAIL failed: %s", smtp_reply_log(reply));
+		btrans->failed = TRUE;
+	}
+}
+
+static void
+bench_lmtp_rcpt_cb(const struct smtp_reply *reply,
+		   struct bench_lmtp_trans *btrans)
+{
+	i_assert(btrans->rcpts_pending > 0);
+	if (--btrans->rcpts_pending == 0)
+		btrans->ts_rcpt = i_nanoseconds();
+	if (!smtp_reply_is_success(reply)) {
+		i_error("RCPT failed: %s", smtp_reply_log(reply));
+		btrans->failed = TRUE;
+	} else {
+		btrans->data_pending++;
+	}
+}
+
+static void
+bench_lmtp_data_cb(const struct smtp_reply *reply,
+		   struct bench_lmtp_trans *btrans)
+{
+	i_assert(btrans->data_pending > 0);
+	btrans->data_pending--;
+	if (!smtp_reply_is_success(reply)) {
+		i_error("DATA failed: %s", smtp_reply_log(reply));
+		btrans->failed = TRUE;
+	} else {
+		deliveries++;
+	}
+	bench_lmtp_trans_check_done(btrans);
+}
+
+static void
+bench_lmtp_data_trans_cb(const struct smtp_reply *reply ATTR_UNUSED,
+			 struct bench_lmtp_trans *btrans ATTR_UNUSED)
+{
+	/* LMTP only yields the reply for the last recipient here; the
+	   per-recipient replies are handled by bench_lmtp_data_cb() */
+}
+
+static void bench_lmtp_trans_finished(struct bench_lmtp_trans *btrans)
+{
+	struct bench_lmtp_conn *bconn = btrans->conn;
+	uint64_t ts_end = i_nanoseconds();
+
+	if (btrans->failed || btrans->ts_mail == 0 || btrans->ts_rcpt == 0)
+		trans_failed++;
+	else {
+		if (btrans->ts_data == 0)
+			btrans->ts_data = ts_end;
+		array_push_back(&phases.mail,
+			&(uint64_t){ btrans->ts_mail - btrans->ts_start });
+		array_push_back(&phases.rcpt,
+			&(uint64_t){ btrans->ts_rcpt - btrans->ts_mail });
+		array_push_back(&phases.data,
+			&(uint64_t){ btrans->ts_data - btrans->ts_rcpt });
+		array_push_back(&phases.total,
+			&(uint64_t){ btrans->ts_data - btrans->ts_start });
+	}
+	i_free(btrans);
+
+	i_assert(bconn->trans_pending > 0);
+	bconn->trans_pending--;
+	if (++trans_done == trans_total) {
+		io_loop_stop(current_ioloop);
+		return;
+	}
+	if (trans_started < trans_total)
+		bench_lmtp_trans_start(bconn);
+}
+
+static const struct smtp_address *bench_lmtp_next_rcpt(void)
+{
+	const char *localpart = rcpt_user;
+
+	if (rcpt_users > 1) {
+		localpart = t_strdup_printf("%s%u", rcpt_user,
+					    rcpt_next++ % rcpt_users);
+	}
+	return smtp_address_create_temp(localpart, rcpt_domain);
+}
+
+static void bench_lmtp_trans_start(struct bench_lmtp_conn *bconn)
+{
+	struct bench_lmtp_trans *btrans;
+	struct istream *input;
+	unsigned int i;
+
+	trans_started++;
+	bconn->trans_pending++;
+
+	btrans = i_new(struct bench_lmtp_trans, 1);
+	btrans->conn = bconn;
+	btrans->ts_start = i_nanoseconds();
+	btrans->rcpts_pending = rcpt_count;
+
+	btrans->trans = smtp_client_transaction_create(bconn->conn,
+		&mail_from, NULL, 0, bench_lmtp_trans_finished, btrans);
+	smtp_client_transaction_start(btrans->trans,
+				      bench_lmtp_mail_cb, btrans);
+	T_BEGIN {
+		for (i = 0; i < rcpt_count; i++) {
+			smtp_client_transaction_add_rcpt(btrans->trans,
+				bench_lmtp_next_rcpt(), NULL,
+				bench_lmtp_rcpt_cb, bench_lmtp_data_cb, btrans);
+		}
+	} T_END;
+
+	input = i_stream_create_from_data(msg_data->data, msg_data->used);
+	smtp_client_transaction_send(btrans->trans, input,
+				     bench_lmtp_data_trans_cb, btrans);
+	i_stream_unref(&input);
+}
+
+static void
+bench_lmtp_print_phase(const char *name, ARRAY_TYPE(uint64_t) *samples)
+{
+	const uint64_t *values;
+	unsigned int count;
+	uint64_t sum = 0;
+	unsigned int i;
+
+	values = array_get(samples, &count);
+	if (count == 0)
+		return;
+	array_sort(samples, uint64_cmp);
+	for (i = 0; i < count; i++)
+		sum += values[i];
+	printf("  %-6s avg %8.3f ms  p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n",
+	       name, (double)sum / count / 1000000.0,
+	       (double)values[count / 2] / 1000000.0,
+	       (double)values[(count * 99) / 100] / 1000000.0,
+	       (double)values[count - 1] / 1000000.0);
+}
+
+static void bench_lmtp_run(const char *target, enum smtp_protocol protocol,
+			   unsigned int conn_count)
+{
+	struct smtp_client_settings smtp_set;
+	struct bench_lmtp_conn *conns;
+	const char *host;
+	in_port_t port;
+	uint64_t ts_0, nsecs;
+	unsigned int i, j;
+
+	i_zero(&smtp_set);
+	smtp_set.my_hostname = "bench-lmtp";
+	smtp_set.max_reply_size = SIZE_MAX;
+	client = smtp_client_init(&smtp_set);
+
+	conns = i_new(struct bench_lmtp_conn, conn_count);
+	for (i = 0; i < conn_count; i++) {
+		if (strchr(target, '/') != NULL) {
+			conns[i].conn = smtp_client_connection_create_unix(
+				client, protocol, target, NULL);
+		} else {
+			if (net_str2hostport(target, BENCH_LMTP_DEFAULT_PORT,
+					     &host, &port) < 0)
+				i_fatal("Invalid target: %s", target);
+			conns[i].conn = smtp_client_connection_create(
+				client, protocol, host, port,
+				SMTP_CLIENT_SSL_MODE_NONE, NULL);
+		}
+		smtp_client_connection_connect(conns[i].conn, NULL, NULL);
+	}
+
+	ts_0 = i_nanoseconds();
+	for (j = 0; j < pipeline_depth; j++) {
+		for (i = 0; i < conn_count && trans_started < trans_total; i++)
+			bench_lmtp_trans_start(&conns[i]);
+	}
+	io_loop_run(current_ioloop);
+	nsecs = i_nanoseconds() - ts_0;
+
+	printf("%u transactions (%u failed), %u deliveries in %.3f s\n",
+	       trans_done, trans_failed, deliveries,
+	       (double)nsecs / 1000000000.0);
+	printf("  %.1f transactions/s, %.1f deliveries/s\n",
+	       (double)trans_done * 1000000000.0 / (double)nsecs,
+	       (double)deliveries * 1000000000.0 / (double)nsecs);
+	bench_lmtp_print_phase("mail", &phases.mail);
+	bench_lmtp_print_phase("rcpt", &phases.rcpt);
+	bench_lmtp_print_phase("data", &phases.data);
+	bench_lmtp_print_phase("total", &phases.total);
+
+	for (i = 0; i < conn_count; i++)
+		smtp_client_connection_close(&conns[i].conn);
+	i_free(conns);
+	smtp_client_deinit(&client);
+}
+
+static void ATTR_NORETURN usage(void)
+{
+	i_fatal("Usage: bench-lmtp [-S] [-c <connections>] [-p <pipeline depth>] "
+		"[-n <transactions>] [-r <recipients>] [-s <message size>] "
+		"[-u <user>] [-U <user count>] [-d <domain>] "
+		"<socket path | host[:port]>");
+}
+
+int main(int argc, char *argv[])
+{
+	struct ioloop *ioloop;
+	enum smtp_protocol protocol = SMTP_PROTOCOL_LMTP;
+	unsigned int conn_count = 1;
+	uoff_t msg_size = 10*1024;
+	int c;
+
+	lib_init();
+
+	while ((c = getopt(argc, argv, "Sc:p:n:r:s:u:U:d:")) > 0) {
+		switch (c) {
+		case 'S':
+			protocol = SMTP_PROTOCOL_SMTP;
+			break;
+		case 'c':
+			if (str_to_uint(optarg, &conn_count) < 0 ||
+			    conn_count == 0)
+				usage();
+			break;
+		case 'p':
+			if (str_to_uint(optarg, &pipeline_depth) < 0 ||
+			    pipeline_depth == 0)
+				usage();
+			break;
+		case 'n':
+			if (str_to_uint(optarg, &trans_total) < 0 ||
+			    trans_total == 0)
+				usage();
+			break;
+		case 'r':
+			if (str_to_uint(optarg, &rcpt_count) < 0 ||
+			    rcpt_count == 0)
+				usage();
+			break;
+		case 's':
+			if (str_to_uoff(optarg, &msg_size) < 0)
+				usage();
+			break;
+		case 'u':
+			rcpt_user = optarg;
+			break;
+		case 'U':
+			if (str_to_uint(optarg, &rcpt_users) < 0 ||
+			    rcpt_users == 0)
+				usage();
+			break;
+		case 'd':
+			rcpt_domain = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	argv += optind;
+	if (argv[0] == NULL)
+		usage();
+
+	ioloop = io_loop_create();
+	bench_lmtp_generate_message(msg_size);
+	i_array_init(&phases.mail, trans_total);
+	i_array_init(&phases.rcpt, trans_total);
+	i_array_init(&phases.data, trans_total);
+	i_array_init(&phases.total, trans_total);
+
+	bench_lmtp_run(argv[0], protocol, conn_count);
+
+	array_free(&phases.mail);
+	array_free(&phases.rcpt);
+	array_free(&phases.data);
+	array_free(&phases.total);
+	buffer_free(&msg_data);
+	io_loop_destroy(&ioloop);
+	lib_deinit();
+	return 0;
+}
@@ -9,6 +9,7 @@
 #include "istream-dot.h"
 
 #include "smtp-parser.h"
+#include "smtp-parser-private.h"
 #include "smtp-command-parser.h"
 
 #include <ctype.h>
@@ -192,6 +193,14 @@ static int smtp_command_parse_parameters(struct smtp_command_parser *parser)
 	while (p < parser->end) {
 		unichar_t ch;
 
+		/* skip over US-ASCII textstr without decoding UTF-8 */
+		p += smtp_parser_scan_textstr(p, (size_t)(parser->end - p));
+		if (p == parser->end)
+			break;
+		if (*p < 0x80) {
+			nch = 1;
+			break;
+		}
 		if (parser->auth_response)
 			ch = *p;
 		else {
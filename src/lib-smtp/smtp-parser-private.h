@@ -0,0 +1,20 @@
+#ifndef SMTP_PARSER_PRIVATE_H
+#define SMTP_PARSER_PRIVATE_H
+
+enum smtp_parser_scan_impl {
+	SMTP_PARSER_SCAN_IMPL_SCALAR = 0,
+	SMTP_PARSER_SCAN_IMPL_SSE2,
+	SMTP_PARSER_SCAN_IMPL_AVX2,
+};
+
+/* Returns the number of US-ASCII textstr characters (HT, SP, printable
+   US-ASCII) at the beginning of the data, i.e. the position of the first
+   control, DEL or 8bit character. Returns size if there are none. */
+size_t smtp_parser_scan_textstr(const unsigned char *data, size_t size);
+
+/* Use the given implementation instead of the best one supported by the CPU.
+   Returns FALSE if the CPU doesn't support it. This is intended for unit
+   tests and benchmarks. */
+bool smtp_parser_scan_set_impl(enum smtp_parser_scan_impl impl);
+
+#endif
@@ -0,0 +1,132 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "smtp-parser.h"
+#include "smtp-parser-private.h"
+
+/* Command parameters and AUTH responses are scanned for the characters that
+   aren't US-ASCII textstr. The SIMD versions compare 16 (SSE2) or 32 (AVX2)
+   bytes at a time and find the first such character with a single bit scan.
+   The implementation is picked at runtime in the same way as the lib's
+   base64, UTF-8 and JSON SIMD code and lib-imap's parser. */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(__GNUC__ >= 5 || defined(__clang__))
+#  define SMTP_PARSER_SCAN_X86
+#  include <immintrin.h>
+#  define SMTP_PARSER_TARGET_SSE2 __attribute__((target("sse2")))
+#  define SMTP_PARSER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static size_t (*smtp_parser_scan_textstr_func)(const unsigned char *data,
+					       size_t size) = NULL;
+
+static size_t
+smtp_parser_scan_textstr_scalar(const unsigned char *data, size_t size)
+{
+	size_t pos;
+
+	for (pos = 0; pos < size; pos++) {
+		if (!smtp_char_is_textstr(data[pos]))
+			break;
+	}
+	return pos;
+}
+
+#ifdef SMTP_PARSER_SCAN_X86
+
+static SMTP_PARSER_TARGET_SSE2 size_t
+smtp_parser_scan_textstr_sse2(const unsigned char *data, size_t size)
+{
+	/* signed comparison: both 0..31 and 8bit chars are less than 32 */
+	const __m128i min_plain = _mm_set1_epi8(' ');
+	const __m128i tabs = _mm_set1_epi8('\t');
+	const __m128i dels = _mm_set1_epi8(0x7f);
+	__m128i in, special;
+	unsigned int mask;
+	size_t pos;
+
+	for (pos = 0; pos + 16 <= size; pos += 16) {
+		in = _mm_loadu_si128((const void *)(data + pos));
+		special = _mm_or_si128(
+			_mm_andnot_si128(_mm_cmpeq_epi8(in, tabs),
+					 _mm_cmplt_epi8(in, min_plain)),
+			_mm_cmpeq_epi8(in, dels));
+		mask = _mm_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos + smtp_parser_scan_textstr_scalar(data + pos, size - pos);
+}
+
+static SMTP_PARSER_TARGET_AVX2 size_t
+smtp_parser_scan_textstr_avx2(const unsigned char *data, size_t size)
+{
+	/* signed comparison: both 0..31 and 8bit chars are less than 32 */
+	const __m256i min_plain = _mm256_set1_epi8(' ');
+	const __m256i tabs = _mm256_set1_epi8('\t');
+	const __m256i dels = _mm256_set1_epi8(0x7f);
+	__m256i in, special;
+	unsigned int mask;
+	size_t pos;
+
+	for (pos = 0; pos + 32 <= size; pos += 32) {
+		in = _mm256_loadu_si256((const void *)(data + pos));
+		special = _mm256_or_si256(
+			_mm256_andnot_si256(_mm256_cmpeq_epi8(in, tabs),
+					    _mm256_cmpgt_epi8(min_plain, in)),
+			_mm256_cmpeq_epi8(in, dels));
+		mask = (unsigned int)_mm256_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	/* the tail may still contain a full 16 byte block */
+	return pos + smtp_parser_scan_textstr_sse2(data + pos, size - pos);
+}
+
+#endif
+
+static void smtp_parser_scan_init(void)
+{
+	(void)smtp_parser_scan_set_impl(SMTP_PARSER_SCAN_IMPL_SCALAR);
+#ifdef SMTP_PARSER_SCAN_X86
+	__builtin_cpu_init();
+	if (!smtp_parser_scan_set_impl(SMTP_PARSER_SCAN_IMPL_AVX2))
+		(void)smtp_parser_scan_set_impl(SMTP_PARSER_SCAN_IMPL_SSE2);
+#endif
+}
+
+bool smtp_parser_scan_set_impl(enum smtp_parser_scan_impl impl)
+{
+	switch (impl) {
+	case SMTP_PARSER_SCAN_IMPL_SCALAR:
+		smtp_parser_scan_textstr_func = smtp_parser_scan_textstr_scalar;
+		return TRUE;
+	case SMTP_PARSER_SCAN_IMPL_SSE2:
+#ifdef SMTP_PARSER_SCAN_X86
+		if (!__builtin_cpu_supports("sse2"))
+			return FALSE;
+		smtp_parser_scan_textstr_func = smtp_parser_scan_textstr_sse2;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	case SMTP_PARSER_SCAN_IMPL_AVX2:
+#ifdef SMTP_PARSER_SCAN_X86
+		if (!__builtin_cpu_supports("avx2"))
+			return FALSE;
+		smtp_parser_scan_textstr_func = smtp_parser_scan_textstr_avx2;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	}
+	i_unreached();
+}
+
+size_t smtp_parser_scan_textstr(const unsigned char *data, size_t size)
+{
+	if (unlikely(smtp_parser_scan_textstr_func == NULL))
+		smtp_parser_scan_init();
+	return smtp_parser_scan_textstr_func(data, size);
+}
@@ -8,6 +8,7 @@
 #include "istream.h"
 #include "ostream.h"
 #include "test-common.h"
+#include "smtp-parser-private.h"
 #include "smtp-command-parser.h"
 
 #include <time.h>
@@ -626,6 +627,110 @@ static void test_smtp_auth_response_parse_invalid(void)
 	} T_END;
 }
 
+/*
+ * Parameter scanning tests
+ */
+
+static bool test_is_textstr(unsigned char chr)
+{
+	return chr == '\t' || (chr >= 0x20 && chr < 0x7f);
+}
+
+static void test_smtp_parser_scan_impl(const char *impl_name)
+{
+	unsigned char data[70];
+	unsigned int chr, pos, size;
+
+	test_begin(t_strdup_printf("smtp parser scan (%s)", impl_name));
+	/* every character at every position of blocks of various sizes, so
+	   that all the vector and scalar parts are used */
+	memset(data, 'x', sizeof(data));
+	for (chr = 0; chr < 256; chr++) {
+		for (pos = 0; pos < sizeof(data); pos++) {
+			data[pos] = chr;
+			for (size = pos; size <= sizeof(data); size += 17) {
+				test_assert_idx(
+					smtp_parser_scan_textstr(data, size) ==
+					(size > pos && !test_is_textstr(chr) ?
+					 pos : size), chr);
+			}
+			data[pos] = 'x';
+		}
+	}
+	test_end();
+}
+
+static void test_smtp_parser_long_params_impl(const char *impl_name)
+{
+	struct istream *input;
+	struct smtp_command_parser *parser;
+	const char *cmd_name, *cmd_params, *line, *error;
+	enum smtp_command_parse_error error_code;
+	string_t *params = t_str_new(512);
+	string_t *text = t_str_new(512);
+	unsigned int i;
+	size_t size;
+	int ret;
+
+	test_begin(t_strdup_printf("smtp parser long params (%s)", impl_name));
+	/* long ASCII runs with tabs and UTF-8 characters in between */
+	for (i = 0; i < 200; i++) {
+		if (i % 53 == 52)
+			str_append(params, "\xc3\xa4");
+		else if (i % 61 == 60)
+			str_append_c(params, '\t');
+		else
+			str_append_c(params, 'a' + i % 26);
+	}
+	str_printfa(text, "XTEST %s\r\n", str_c(params));
+
+	input = test_istream_create_data(str_data(text), str_len(text));
+	parser = smtp_command_parser_init(input, NULL);
+	/* feed the input one byte at a time */
+	ret = 0;
+	for (size = 0; size <= str_len(text) && ret == 0; size++) {
+		test_istream_set_size(input, size);
+		ret = smtp_command_parse_next(parser, &cmd_name, &cmd_params,
+					      &error_code, &error);
+	}
+	test_assert(ret > 0);
+	if (ret > 0) {
+		test_assert_strcmp(cmd_name, "XTEST");
+		test_assert_strcmp(cmd_params, str_c(params));
+	}
+	smtp_command_parser_deinit(&parser);
+	i_stream_unref(&input);
+
+	/* AUTH responses don't allow 8bit characters */
+	str_truncate(text, 0);
+	for (i = 0; i < 200; i++)
+		str_append_c(text, 'A' + i % 26);
+	str_append(text, "\xc3\xa4\r\n");
+	input = i_stream_create_from_data(str_data(text), str_len(text));
+	parser = smtp_command_parser_init(input, NULL);
+	test_assert(smtp_command_parse_auth_response(parser, &line,
+						     &error_code, &error) < 0);
+	test_assert(error_code == SMTP_COMMAND_PARSE_ERROR_BAD_COMMAND);
+	smtp_command_parser_deinit(&parser);
+	i_stream_unref(&input);
+	test_end();
+}
+
+static void test_smtp_parser_scan(void)
+{
+	test_assert(smtp_parser_scan_set_impl(SMTP_PARSER_SCAN_IMPL_SCALAR));
+	test_smtp_parser_scan_impl("scalar");
+	test_smtp_parser_long_params_impl("scalar");
+	if (smtp_parser_scan_set_impl(SMTP_PARSER_SCAN_IMPL_SSE2)) {
+		test_smtp_parser_scan_impl("SSE2");
+		test_smtp_parser_long_params_impl("SSE2");
+	}
+	if (smtp_parser_scan_set_impl(SMTP_PARSER_SCAN_IMPL_AVX2)) {
+		test_smtp_parser_scan_impl("AVX2");
+		test_smtp_parser_long_params_impl("AVX2");
+	}
+}
+
 /*
  * Tests
  */
@@ -637,6 +742,7 @@ int main(void)
 		test_smtp_command_parse_invalid,
 		test_smtp_auth_response_parse_valid,
 		test_smtp_auth_response_parse_invalid,
+		test_smtp_parser_scan,
 		NULL
 	};
 	return test_run(test_functions);
@@ -31,9 +31,6 @@ struct pgsql_db {
 	struct ioloop *ioloop, *orig_ioloop;
 	struct sql_result *sync_result;
 
-	bool (*next_callback)(void *);
-	void *next_context;
-
 	char *error;
 	const char *connect_state;
 
@@ -51,6 +48,9 @@ struct pgsql_result {
 	struct pgsql_result *prev, *next;
 
 	PGresult *pgres;
+	/* Results of the earlier statements in a multi-statement query.
+	   pgres is the last statement's result. */
+	ARRAY(PGresult *) multi_pgres;
 	struct timeout *to;
 
 	unsigned int rownum, rows;
@@ -65,6 +65,8 @@ struct pgsql_result {
 	void *context;
 
 	bool timeout:1;
+	/* Query has multiple statements - read all of their results */
+	bool multi_statement:1;
 };
 
 struct pgsql_transaction_context {
@@ -84,9 +86,6 @@ extern const struct sql_db driver_pgsql_db;
 extern const struct sql_result driver_pgsql_result;
 
 static void result_finish(struct pgsql_result *result);
-static void
-transaction_update_callback(struct sql_result *result,
-			    struct sql_transaction_query *query);
 
 static struct event_category event_category_pgsql = {
 	.parent = &event_category_sql,
@@ -112,19 +111,6 @@ static void driver_pgsql_set_state(struct pgsql_db *db, enum sql_db_state state)
 		io_loop_set_current(db->ioloop);
 }
 
-static bool driver_pgsql_next_callback(struct pgsql_db *db)
-{
-	bool (*next_callback)(void *) = db->next_callback;
-	void *next_context = db->next_context;
-
-	if (next_callback == NULL)
-		return FALSE;
-
-	db->next_callback = NULL;
-	db->next_context = NULL;
-	return next_callback(next_context);
-}
-
 static void driver_pgsql_stop_io(struct pgsql_db *db)
 {
 	if (db->io != NULL) {
@@ -151,7 +137,6 @@ static void driver_pgsql_close(struct pgsql_db *db)
 		/* running a sync query, stop it */
 		io_loop_stop(db->ioloop);
 	}
-	driver_pgsql_next_callback(db);
 }
 
 static const char *last_error(struct pgsql_db *db)
@@ -364,7 +349,7 @@ static void driver_pgsql_set_idle(struct pgsql_db *db)
 
 	if (db->fatal_error)
 		driver_pgsql_close(db);
-	else if (!driver_pgsql_next_callback(db))
+	else
 		driver_pgsql_set_state(db, SQL_DB_STATE_IDLE);
 }
 
@@ -413,6 +398,13 @@ static void driver_pgsql_result_free(struct sql_result *_result)
 		PQclear(result->pgres);
 		result->pgres = NULL;
 	}
+	if (array_is_created(&result->multi_pgres)) {
+		PGresult *pgres;
+
+		array_foreach_elem(&result->multi_pgres, pgres)
+			PQclear(pgres);
+		array_free(&result->multi_pgres);
+	}
 
 	if (success) {
 		/* we'll have to read the rest of the results as well */
@@ -494,6 +486,7 @@ static void result_finish(struct pgsql_result *result)
 static void get_result(struct pgsql_result *result)
 {
         struct pgsql_db *db = (struct pgsql_db *)result->api.db;
+	PGresult *pgres;
 
 	driver_pgsql_stop_io(db);
 
@@ -502,15 +495,26 @@ static void get_result(struct pgsql_result *result)
 		return;
 	}
 
-	if (PQisBusy(db->pg) != 0) {
-		db->io = io_add(PQsocket(db->pg), IO_READ,
-				get_result, result);
-		db->io_dir = IO_READ;
-		return;
+	while (PQisBusy(db->pg) == 0) {
+		pgres = PQgetResult(db->pg);
+		if (!result->multi_statement || pgres == NULL) {
+			if (!result->multi_statement)
+				result->pgres = pgres;
+			result_finish(result);
+			return;
+		}
+		/* multi-statement query: read all the results, so a failure
+		   in any of the statements is noticed. */
+		if (result->pgres != NULL) {
+			if (!array_is_created(&result->multi_pgres))
+				i_array_init(&result->multi_pgres, 8);
+			array_push_back(&result->multi_pgres, &result->pgres);
+		}
+		result->pgres = pgres;
 	}
 
-	result->pgres = PQgetResult(db->pg);
-	result_finish(result);
+	db->io = io_add(PQsocket(db->pg), IO_READ, get_result, result);
+	db->io_dir = IO_READ;
 }
 
 static void flush_callback(struct pgsql_result *result)
@@ -626,8 +630,10 @@ static void driver_pgsql_exec(struct sql_db *db, const char *query)
 	do_query(result, query);
 }
 
-static void driver_pgsql_query(struct sql_db *db, const char *query,
-			       sql_query_callback_t *callback, void *context)
+static void
+driver_pgsql_query_full(struct sql_db *db, const char *query,
+			bool multi_statement,
+			sql_query_callback_t *callback, void *context)
 {
 	struct pgsql_result *result;
 
@@ -638,9 +644,16 @@ static void driver_pgsql_query(struct sql_db *db, const char *query,
 	result->api.event = event_create(db->event);
 	result->callback = callback;
 	result->context = context;
+	result->multi_statement = multi_statement;
 	do_query(result, query);
 }
 
+static void driver_pgsql_query(struct sql_db *db, const char *query,
+			       sql_query_callback_t *callback, void *context)
+{
+	driver_pgsql_query_full(db, query, FALSE, callback, context);
+}
+
 static void pgsql_query_s_callback(struct sql_result *result, void *context)
 {
         struct pgsql_db *db = context;
@@ -682,7 +695,8 @@ static void driver_pgsql_sync_deinit(struct pgsql_db *db)
 }
 
 static struct sql_result *
-driver_pgsql_sync_query(struct pgsql_db *db, const char *query)
+driver_pgsql_sync_query(struct pgsql_db *db, const char *query,
+			bool multi_statement)
 {
 	struct sql_result *result;
 
@@ -699,7 +713,8 @@ driver_pgsql_sync_query(struct pgsql_db *db, const char *query)
 		break;
 	}
 
-	driver_pgsql_query(&db->api, query, pgsql_query_s_callback, db);
+	driver_pgsql_query_full(&db->api, query, multi_statement,
+				pgsql_query_s_callback, db);
 	if (db->sync_result == NULL)
 		io_loop_run(db->ioloop);
 
@@ -726,7 +741,7 @@ driver_pgsql_query_s(struct sql_db *_db, const char *query)
 	struct sql_result *result;
 
 	driver_pgsql_sync_init(db);
-	result = driver_pgsql_sync_query(db, query);
+	result = driver_pgsql_sync_query(db, query, FALSE);
 	driver_pgsql_sync_deinit(db);
 	return result;
 }
@@ -944,51 +959,6 @@ driver_pgsql_transaction_free(struct pgsql_transaction_context *ctx)
 	i_free(ctx);
 }
 
-static void
-transaction_commit_callback(struct sql_result *result,
-			    struct pgsql_transaction_context *ctx)
-{
-	struct sql_commit_result commit_result;
-
-	i_zero(&commit_result);
-	if (sql_result_next_row(result) < 0) {
-		commit_result.error = sql_result_get_error(result);
-		commit_result.error_type = sql_result_get_error_type(result);
-	}
-	ctx->callback(&commit_result, ctx->context);
-	driver_pgsql_transaction_free(ctx);
-}
-
-static bool transaction_send_next(void *context)
-{
-	struct pgsql_transaction_context *ctx = context;
-
-	i_assert(!ctx->failed);
-
-	if (ctx->ctx.db->state == SQL_DB_STATE_BUSY) {
-		/* kludgy.. */
-		ctx->ctx.db->state = SQL_DB_STATE_IDLE;
-	} else if (!SQL_DB_IS_READY(ctx->ctx.db)) {
-		struct sql_commit_result commit_result = {
-			.error = "Not connected"
-		};
-		ctx->callback(&commit_result, ctx->context);
-		return FALSE;
-	}
-
-	if (ctx->ctx.head != NULL) {
-		struct sql_transaction_query *query = ctx->ctx.head;
-
-		ctx->ctx.head = ctx->ctx.head->next;
-		sql_query(ctx->ctx.db, query->query,
-			  transaction_update_callback, query);
-	} else {
-		sql_query(ctx->ctx.db, "COMMIT",
-			  transaction_commit_callback, ctx);
-	}
-	return TRUE;
-}
-
 static void
 transaction_commit_error_callback(struct pgsql_transaction_context *ctx,
 				  struct sql_result *result)
@@ -1004,31 +974,55 @@ transaction_commit_error_callback(struct pgsql_transaction_context *ctx,
 	ctx->callback(&commit_result, ctx->context);
 }
 
-static void
-transaction_begin_callback(struct sql_result *result,
-			   struct pgsql_transaction_context *ctx)
+/* PostgreSQL executes multiple statements sent in a single query as one
+   implicit transaction, so the whole transaction can be sent with a single
+   round trip. */
+static const char *
+driver_pgsql_transaction_get_query(struct pgsql_transaction_context *ctx)
 {
-	struct pgsql_db *db = (struct pgsql_db *)result->db;
+	struct sql_transaction_query *query;
+	string_t *str = t_str_new(256);
 
-	i_assert(result->db == ctx->ctx.db);
+	for (query = ctx->ctx.head; query != NULL; query = query->next) {
+		str_append(str, query->query);
+		str_append_c(str, ';');
+	}
+	return str_c(str);
+}
 
-	if (sql_result_next_row(result) < 0) {
-		transaction_commit_error_callback(ctx, result);
-		driver_pgsql_transaction_free(ctx);
-		return;
+static int
+transaction_multi_get_affected_rows(struct pgsql_transaction_context *ctx,
+				    struct pgsql_result *result,
+				    const char **error_r)
+{
+	struct sql_transaction_query *query;
+	PGresult *const *pgres = NULL, *query_pgres;
+	unsigned int i, count = 0;
+
+	if (array_is_created(&result->multi_pgres))
+		pgres = array_get(&result->multi_pgres, &count);
+	for (query = ctx->ctx.head, i = 0; query != NULL;
+	     query = query->next, i++) {
+		if (i > count) {
+			*error_r = t_strdup_printf(
+				"Expected results for %u statements, got %u",
+				i + 1, count + 1);
+			return -1;
+		}
+		if (query->affected_rows == NULL)
+			continue;
+		query_pgres = i < count ? pgres[i] : result->pgres;
+		if (str_to_uint(PQcmdTuples(query_pgres),
+				query->affected_rows) < 0)
+			i_unreached();
 	}
-	i_assert(db->next_callback == NULL);
-	db->next_callback = transaction_send_next;
-	db->next_context = ctx;
+	return 0;
 }
 
-static void
-transaction_update_callback(struct sql_result *result,
-			    struct sql_transaction_query *query)
+static void transaction_multi_callback(struct sql_result *result, void *context)
 {
-	struct pgsql_transaction_context *ctx =
-		(struct pgsql_transaction_context *)query->trans;
-	struct pgsql_db *db = (struct pgsql_db *)result->db;
+	struct pgsql_transaction_context *ctx = context;
+	struct sql_commit_result commit_result;
 
 	if (sql_result_next_row(result) < 0) {
 		transaction_commit_error_callback(ctx, result);
@@ -1036,16 +1030,19 @@ transaction_update_callback(struct sql_result *result,
 		return;
 	}
 
-	if (query->affected_rows != NULL) {
-		struct pgsql_result *pg_result = (struct pgsql_result *)result;
-
-		if (str_to_uint(PQcmdTuples(pg_result->pgres),
-				query->affected_rows) < 0)
-			i_unreached();
+	i_zero(&commit_result);
+	if (transaction_multi_get_affected_rows(ctx,
+			(struct pgsql_result *)result,
+			&commit_result.error) < 0) {
+		e_debug(sql_transaction_finished_event(&ctx->ctx)->
+			add_str("error", commit_result.error)->event(),
+			"Transaction failed: %s", commit_result.error);
+	} else {
+		e_debug(sql_transaction_finished_event(&ctx->ctx)->event(),
+			"Transaction committed");
 	}
-	i_assert(db->next_callback == NULL);
-	db->next_callback = transaction_send_next;
-	db->next_context = ctx;
+	ctx->callback(&commit_result, ctx->context);
+	driver_pgsql_transaction_free(ctx);
 }
 
 static void
@@ -1105,9 +1102,11 @@ driver_pgsql_transaction_commit(struct sql_transaction_context *_ctx,
 		sql_query(_ctx->db, _ctx->head->query,
 			  transaction_trans_query_callback, _ctx->head);
 	} else {
-		/* multiple queries, use a transaction */
+		/* multiple queries, send them all at once */
 		i_assert(_ctx->db->v.query == driver_pgsql_query);
-		sql_query(_ctx->db, "BEGIN", transaction_begin_callback, ctx);
+		driver_pgsql_query_full(_ctx->db,
+					driver_pgsql_transaction_get_query(ctx),
+					TRUE, transaction_multi_callback, ctx);
 	}
 }
 
@@ -1126,35 +1125,22 @@ driver_pgsql_transaction_commit_multi(struct pgsql_transaction_context *ctx)
 {
 	struct pgsql_db *db = (struct pgsql_db *)ctx->ctx.db;
 	struct sql_result *result;
-	struct sql_transaction_query *query;
+	const char *query, *error;
 
-	result = driver_pgsql_sync_query(db, "BEGIN");
+	query = driver_pgsql_transaction_get_query(ctx);
+	result = driver_pgsql_sync_query(db, query, TRUE);
 	if (sql_result_next_row(result) < 0) {
-		commit_multi_fail(ctx, result, "BEGIN");
+		commit_multi_fail(ctx, result, query);
 		return NULL;
 	}
-	sql_result_unref(result);
-
-	/* send queries */
-	for (query = ctx->ctx.head; query != NULL; query = query->next) {
-		result = driver_pgsql_sync_query(db, query->query);
-		if (sql_result_next_row(result) < 0) {
-			commit_multi_fail(ctx, result, query->query);
-			break;
-		}
-		if (query->affected_rows != NULL) {
-			struct pgsql_result *pg_result =
-				(struct pgsql_result *)result;
-
-			if (str_to_uint(PQcmdTuples(pg_result->pgres),
-					query->affected_rows) < 0)
-				i_unreached();
-		}
+	if (transaction_multi_get_affected_rows(ctx,
+			(struct pgsql_result *)result, &error) < 0) {
+		ctx->failed = TRUE;
+		ctx->error = error;
 		sql_result_unref(result);
+		return NULL;
 	}
-
-	return driver_pgsql_sync_query(db, ctx->failed ?
-				       "ROLLBACK" : "COMMIT");
+	return result;
 }
 
 static void
@@ -1270,7 +1256,7 @@ driver_pgsql_escape_blob(struct sql_db *_db ATTR_UNUSED,
 
 static bool driver_pgsql_have_work(struct pgsql_db *db)
 {
-	return db->next_callback != NULL || db->pending_results != NULL ||
+	return db->pending_results != NULL ||
 		db->api.state == SQL_DB_STATE_CONNECTING;
 }
 
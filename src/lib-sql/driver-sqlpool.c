@@ -4,6 +4,7 @@
 #include "array.h"
 #include "llist.h"
 #include "ioloop.h"
+#include "time-util.h"
 #include "sql-api-private.h"
 
 #include <time.h>
@@ -16,15 +17,43 @@ static struct event_category event_category_sqlpool = {
 	.name = "sqlpool",
 };
 
+/* Default number of seconds a connection above minconns can be idle before
+   it's disconnected. */
+#define SQLPOOL_DEFAULT_IDLE_TIMEOUT_SECS 60
+/* Weight of the previous average in the host latency and queue wait moving
+   averages. */
+#define SQLPOOL_AVG_WEIGHT 8
+/* Each time a host is passed over for a faster one, its average latency is
+   lowered by 1/SQLPOOL_LATENCY_DECAY. This way a host that was slow earlier
+   eventually gets tried again. */
+#define SQLPOOL_LATENCY_DECAY 32
+
+enum sqlpool_host_role {
+	/* Primary hosts are used for transactions and other writes, and for
+	   reads if there are no replicas available. */
+	SQLPOOL_HOST_ROLE_PRIMARY,
+	/* Replica hosts are used only for reads. */
+	SQLPOOL_HOST_ROLE_REPLICA,
+};
+
 struct sqlpool_host {
 	char *connect_string;
+	/* host=/replica_host= value, "" if none were given */
+	char *name;
+	enum sqlpool_host_role role;
 
 	unsigned int connection_count;
+	/* moving averages of how long requests took to finish after being
+	   sent to this host, and how long they waited in queue before it */
+	uint64_t avg_latency_usecs;
+	uint64_t avg_queue_wait_usecs;
 };
 
 struct sqlpool_connection {
 	struct sql_db *db;
 	unsigned int host_idx;
+	/* last time a request was sent to this connection */
+	time_t last_used;
 };
 
 struct sqlpool_db {
@@ -32,7 +61,18 @@ struct sqlpool_db {
 
 	pool_t pool;
 	const struct sql_db *driver;
+	/* each host has min..max connections. Connections above the minimum
+	   are created when there are no idle connections, and disconnected
+	   after they have been idle for idle_timeout_secs and no requests
+	   have needed to wait in queue during that time. */
+	unsigned int min_connections;
 	unsigned int connection_limit;
+	unsigned int idle_timeout_secs;
+	unsigned int replica_count;
+
+	/* last time a request had to be queued */
+	time_t last_queued;
+	struct timeout *to_idle;
 
 	ARRAY(struct sqlpool_host) hosts;
 	/* all connections from all hosts */
@@ -51,9 +91,13 @@ struct sqlpool_request {
 
 	struct sqlpool_db *db;
 	time_t created;
+	struct timeval queue_start, sent_time;
+	uint64_t queue_wait_usecs;
 
 	unsigned int host_idx;
 	unsigned int retry_count;
+	/* query only reads, so it can be sent to a replica */
+	bool read:1;
 
 	struct event *event;
 
@@ -74,6 +118,10 @@ struct sqlpool_transaction_context {
 
 	pool_t query_pool;
 	struct sqlpool_request *commit_request;
+
+	unsigned int host_idx;
+	struct timeval sent_time;
+	uint64_t queue_wait_usecs;
 };
 
 extern struct sql_db driver_sqlpool_db;
@@ -149,35 +197,157 @@ driver_sqlpool_new_conn_trans(struct sqlpool_transaction_context *trans,
 	return conn_trans;
 }
 
+static struct sqlpool_connection *
+sqlpool_connection_find(struct sqlpool_db *db, struct sql_db *conndb)
+{
+	struct sqlpool_connection *conn;
+
+	array_foreach_modifiable(&db->all_connections, conn) {
+		if (conn->db == conndb)
+			return conn;
+	}
+	i_unreached();
+}
+
+static enum sqlpool_host_role
+sqlpool_connection_get_role(struct sqlpool_db *db,
+			    const struct sqlpool_connection *conn)
+{
+	const struct sqlpool_host *host = array_idx(&db->hosts, conn->host_idx);
+
+	return host->role;
+}
+
+static const char *sqlpool_host_role_to_str(enum sqlpool_host_role role)
+{
+	switch (role) {
+	case SQLPOOL_HOST_ROLE_PRIMARY:
+		return "primary";
+	case SQLPOOL_HOST_ROLE_REPLICA:
+		return "replica";
+	}
+	i_unreached();
+}
+
+static uint64_t sqlpool_avg_add(uint64_t avg, uint64_t value)
+{
+	return (avg * (SQLPOOL_AVG_WEIGHT - 1) + value) / SQLPOOL_AVG_WEIGHT;
+}
+
+static void
+sqlpool_request_sent(struct sqlpool_db *db, struct sqlpool_request *request,
+		     struct sqlpool_connection *conn)
+{
+	struct sqlpool_host *host =
+		array_idx_modifiable(&db->hosts, conn->host_idx);
+
+	request->host_idx = conn->host_idx;
+	request->sent_time = ioloop_timeval;
+	if (request->queue_start.tv_sec == 0)
+		request->queue_wait_usecs = 0;
+	else {
+		request->queue_wait_usecs =
+			timeval_diff_usecs(&ioloop_timeval,
+					   &request->queue_start);
+	}
+	host->avg_queue_wait_usecs =
+		sqlpool_avg_add(host->avg_queue_wait_usecs,
+				request->queue_wait_usecs);
+	conn->last_used = ioloop_time;
+}
+
 static void
-sqlpool_request_handle_transaction(struct sql_db *conndb,
+sqlpool_request_finished(struct sqlpool_db *db, struct event *event,
+			 unsigned int host_idx,
+			 const struct timeval *sent_time,
+			 uint64_t queue_wait_usecs)
+{
+	struct sqlpool_host *host = array_idx_modifiable(&db->hosts, host_idx);
+	long long latency_usecs;
+
+	latency_usecs = timeval_diff_usecs(&ioloop_timeval, sent_time);
+	if (latency_usecs < 0)
+		latency_usecs = 0;
+	if (host->avg_latency_usecs == 0)
+		host->avg_latency_usecs = latency_usecs;
+	else {
+		host->avg_latency_usecs =
+			sqlpool_avg_add(host->avg_latency_usecs,
+					latency_usecs);
+	}
+
+	e_debug(event_create_passthrough(event)->
+		set_name("sqlpool_request_finished")->
+		add_str("host", host->name)->
+		add_str("host_role", sqlpool_host_role_to_str(host->role))->
+		add_int("latency_usecs", latency_usecs)->
+		add_int("queue_wait_usecs", queue_wait_usecs)->
+		add_int("host_avg_latency_usecs", host->avg_latency_usecs)->
+		add_int("host_avg_queue_wait_usecs",
+			host->avg_queue_wait_usecs)->event(),
+		"Request finished in %lld usecs (queue wait %"PRIu64" usecs)",
+		latency_usecs, queue_wait_usecs);
+}
+
+static void
+sqlpool_request_handle_transaction(struct sqlpool_db *db,
+				   struct sqlpool_connection *conn,
 				   struct sqlpool_transaction_context *trans)
 {
 	struct sql_transaction_context *conn_trans;
 
+	sqlpool_request_sent(db, trans->commit_request, conn);
+	trans->host_idx = conn->host_idx;
+	trans->sent_time = trans->commit_request->sent_time;
+	trans->queue_wait_usecs = trans->commit_request->queue_wait_usecs;
+
 	sqlpool_request_free(&trans->commit_request);
-	conn_trans = driver_sqlpool_new_conn_trans(trans, conndb);
+	conn_trans = driver_sqlpool_new_conn_trans(trans, conn->db);
 	sql_transaction_commit(&conn_trans,
 			       driver_sqlpool_commit_callback, trans);
 }
 
+static struct sqlpool_request *
+sqlpool_request_find_next(struct sqlpool_db *db,
+			  enum sqlpool_host_role role)
+{
+	struct sqlpool_request *request;
+
+	if (role == SQLPOOL_HOST_ROLE_PRIMARY)
+		return db->requests_head;
+
+	/* replicas can handle only reads */
+	for (request = db->requests_head; request != NULL;
+	     request = request->next) {
+		if (request->read)
+			return request;
+	}
+	return NULL;
+}
+
 static void
 sqlpool_request_send_next(struct sqlpool_db *db, struct sql_db *conndb)
 {
+	struct sqlpool_connection *conn;
 	struct sqlpool_request *request;
 
 	if (db->requests_head == NULL || !SQL_DB_IS_READY(conndb))
 		return;
 
-	request = db->requests_head;
+	conn = sqlpool_connection_find(db, conndb);
+	request = sqlpool_request_find_next(db,
+		sqlpool_connection_get_role(db, conn));
+	if (request == NULL)
+		return;
 	DLLIST2_REMOVE(&db->requests_head, &db->requests_tail, request);
 	timeout_reset(db->request_to);
 
 	if (request->query != NULL) {
+		sqlpool_request_sent(db, request, conn);
 		sql_query(conndb, request->query,
 			  driver_sqlpool_query_callback, request);
 	} else if (request->trans != NULL) {
-		sqlpool_request_handle_transaction(conndb, request->trans);
+		sqlpool_request_handle_transaction(db, conn, request->trans);
 	} else {
 		i_unreached();
 	}
@@ -191,19 +361,18 @@ static void sqlpool_reconnect(struct sql_db *conndb)
 
 static struct sqlpool_host *
 sqlpool_find_host_with_least_connections(struct sqlpool_db *db,
+					 enum sqlpool_host_role role,
 					 unsigned int *host_idx_r)
 {
 	struct sqlpool_host *hosts, *min = NULL;
 	unsigned int i, count;
 
 	hosts = array_get_modifiable(&db->hosts, &count);
-	i_assert(count > 0);
-
-	min = &hosts[0];
-	*host_idx_r = 0;
-
-	for (i = 1; i < count; i++) {
-		if (min->connection_count > hosts[i].connection_count) {
+	for (i = 0; i < count; i++) {
+		if (hosts[i].role != role)
+			continue;
+		if (min == NULL ||
+		    min->connection_count > hosts[i].connection_count) {
 			min = &hosts[i];
 			*host_idx_r = i;
 		}
@@ -245,9 +414,14 @@ sqlpool_handle_connect_failed(struct sqlpool_db *db, struct sql_db *conndb)
 	/* if we have zero successful hosts and there still are hosts
 	   without connections, connect to one of them. */
 	if (!sqlpool_have_successful_connections(db)) {
-		host = sqlpool_find_host_with_least_connections(db, &host_idx);
-		if (host->connection_count == 0)
-			(void)sqlpool_add_connection(db, host, host_idx);
+		array_foreach_modifiable(&db->hosts, host) {
+			if (host->connection_count == 0) {
+				host_idx = array_foreach_idx(&db->hosts, host);
+				(void)sqlpool_add_connection(db, host,
+							     host_idx);
+				break;
+			}
+		}
 	}
 }
 
@@ -303,87 +477,168 @@ sqlpool_add_connection(struct sqlpool_db *db, struct sqlpool_host *host,
 	conn = array_append_space(&db->all_connections);
 	conn->host_idx = host_idx;
 	conn->db = conndb;
+	conn->last_used = ioloop_time;
 	return conn;
 }
 
+static void sqlpool_idle_timeout(struct sqlpool_db *db)
+{
+	struct sqlpool_connection *conns;
+	struct sqlpool_host *host;
+	unsigned int i, count;
+	bool have_extra = FALSE;
+
+	if (db->requests_head != NULL ||
+	    db->last_queued + (time_t)db->idle_timeout_secs > ioloop_time) {
+		/* requests have recently been waiting for a free connection.
+		   the extra connections are still needed. */
+		return;
+	}
+
+	conns = array_get_modifiable(&db->all_connections, &count);
+	for (i = count; i > 0; i--) {
+		struct sqlpool_connection *conn = &conns[i-1];
+
+		host = array_idx_modifiable(&db->hosts, conn->host_idx);
+		if (host->connection_count <= db->min_connections)
+			continue;
+		if (conn->db->state != SQL_DB_STATE_IDLE ||
+		    conn->last_used + (time_t)db->idle_timeout_secs >
+		    ioloop_time) {
+			have_extra = TRUE;
+			continue;
+		}
+
+		e_debug(db->api.event, "Disconnecting idle connection");
+		conn->db->state_change_callback = NULL;
+		sql_unref(&conn->db);
+		host->connection_count--;
+		array_delete(&db->all_connections, i-1, 1);
+	}
+	db->last_query_conn_idx = 0;
+	if (!have_extra)
+		timeout_remove(&db->to_idle);
+}
+
 static struct sqlpool_connection *
-sqlpool_add_new_connection(struct sqlpool_db *db)
+sqlpool_add_new_connection(struct sqlpool_db *db, enum sqlpool_host_role role)
 {
 	struct sqlpool_host *host;
 	unsigned int host_idx;
 
-	host = sqlpool_find_host_with_least_connections(db, &host_idx);
-	if (host->connection_count >= db->connection_limit)
+	host = sqlpool_find_host_with_least_connections(db, role, &host_idx);
+	if (host == NULL || host->connection_count >= db->connection_limit)
 		return NULL;
-	else
-		return sqlpool_add_connection(db, host, host_idx);
+	if (db->to_idle == NULL &&
+	    host->connection_count >= db->min_connections) {
+		db->to_idle = timeout_add(db->idle_timeout_secs * 1000,
+					  sqlpool_idle_timeout, db);
+	}
+	return sqlpool_add_connection(db, host, host_idx);
 }
 
-static const struct sqlpool_connection *
+static void
+sqlpool_hosts_decay_latency(struct sqlpool_db *db,
+			    enum sqlpool_host_role role,
+			    unsigned int used_host_idx)
+{
+	struct sqlpool_host *host;
+
+	array_foreach_modifiable(&db->hosts, host) {
+		if (host->role == role &&
+		    array_foreach_idx(&db->hosts, host) != used_host_idx) {
+			host->avg_latency_usecs -=
+				host->avg_latency_usecs / SQLPOOL_LATENCY_DECAY;
+		}
+	}
+}
+
+static struct sqlpool_connection *
 sqlpool_find_available_connection(struct sqlpool_db *db,
+				  enum sqlpool_host_role role,
 				  unsigned int unwanted_host_idx,
 				  bool *all_disconnected_r)
 {
-	const struct sqlpool_connection *conns;
-	unsigned int i, count;
+	struct sqlpool_connection *conns;
+	const struct sqlpool_host *host;
+	unsigned int i, count, best_idx = UINT_MAX;
+	uint64_t best_latency = 0;
 
 	*all_disconnected_r = TRUE;
 
-	conns = array_get(&db->all_connections, &count);
+	/* Go through the connections in round-robin order and use the ready
+	   one whose host has the lowest average latency. Hosts with equal
+	   latency are still used in round-robin order. */
+	conns = array_get_modifiable(&db->all_connections, &count);
 	for (i = 0; i < count; i++) {
 		unsigned int idx = (i + db->last_query_conn_idx + 1) % count;
 		struct sql_db *conndb = conns[idx].db;
 
 		if (conns[idx].host_idx == unwanted_host_idx)
 			continue;
+		host = array_idx(&db->hosts, conns[idx].host_idx);
+		if (host->role != role)
+			continue;
 
 		if (!SQL_DB_IS_READY(conndb) && conndb->to_reconnect == NULL) {
 			/* see if we could reconnect to it immediately */
 			(void)sql_connect(conndb);
 		}
 		if (SQL_DB_IS_READY(conndb)) {
-			db->last_query_conn_idx = idx;
 			*all_disconnected_r = FALSE;
-			return &conns[idx];
+			if (best_idx == UINT_MAX ||
+			    host->avg_latency_usecs < best_latency) {
+				best_idx = idx;
+				best_latency = host->avg_latency_usecs;
+			}
+			continue;
 		}
 		if (conndb->state != SQL_DB_STATE_DISCONNECTED)
 			*all_disconnected_r = FALSE;
 	}
-	return NULL;
+	if (best_idx == UINT_MAX)
+		return NULL;
+
+	db->last_query_conn_idx = best_idx;
+	sqlpool_hosts_decay_latency(db, role, conns[best_idx].host_idx);
+	return &conns[best_idx];
 }
 
 static bool
-driver_sqlpool_get_connection(struct sqlpool_db *db,
-			      unsigned int unwanted_host_idx,
-			      const struct sqlpool_connection **conn_r)
+sqlpool_get_role_connection(struct sqlpool_db *db,
+			    enum sqlpool_host_role role,
+			    unsigned int unwanted_host_idx,
+			    struct sqlpool_connection **conn_r)
 {
-	const struct sqlpool_connection *conn, *conns;
+	struct sqlpool_connection *conn, *conns;
 	unsigned int i, count;
 	bool all_disconnected;
 
-	conn = sqlpool_find_available_connection(db, unwanted_host_idx,
+	conn = sqlpool_find_available_connection(db, role, unwanted_host_idx,
 						 &all_disconnected);
 	if (conn == NULL && unwanted_host_idx != UINT_MAX) {
 		/* maybe there are no wanted hosts. use any of them. */
-		conn = sqlpool_find_available_connection(db, UINT_MAX,
+		conn = sqlpool_find_available_connection(db, role, UINT_MAX,
 							 &all_disconnected);
 	}
 	if (conn == NULL && all_disconnected) {
 		/* no connected connections. connect_delays may have gotten too
 		   high, reset all of them to see if some are still alive. */
-		conns = array_get(&db->all_connections, &count);
+		conns = array_get_modifiable(&db->all_connections, &count);
 		for (i = 0; i < count; i++) {
 			struct sql_db *conndb = conns[i].db;
 
+			if (sqlpool_connection_get_role(db, &conns[i]) != role)
+				continue;
 			if (conndb->connect_delay > SQL_CONNECT_RESET_DELAY)
 				conndb->connect_delay = SQL_CONNECT_RESET_DELAY;
 		}
-		conn = sqlpool_find_available_connection(db, UINT_MAX,
+		conn = sqlpool_find_available_connection(db, role, UINT_MAX,
 							 &all_disconnected);
 	}
 	if (conn == NULL) {
 		/* still nothing. try creating new connections */
-		conn = sqlpool_add_new_connection(db);
+		conn = sqlpool_add_new_connection(db, role);
 		if (conn != NULL)
 			(void)sql_connect(conn->db);
 		if (conn == NULL || !SQL_DB_IS_READY(conn->db))
@@ -394,19 +649,37 @@ driver_sqlpool_get_connection(struct sqlpool_db *db,
 }
 
 static bool
-driver_sqlpool_get_sync_connection(struct sqlpool_db *db,
-				   const struct sqlpool_connection **conn_r)
+driver_sqlpool_get_connection(struct sqlpool_db *db,
+			      unsigned int unwanted_host_idx, bool read,
+			      struct sqlpool_connection **conn_r)
 {
-	const struct sqlpool_connection *conns;
+	if (read && db->replica_count > 0) {
+		if (sqlpool_get_role_connection(db, SQLPOOL_HOST_ROLE_REPLICA,
+						unwanted_host_idx, conn_r))
+			return TRUE;
+		/* no free replicas - primaries can handle reads as well */
+	}
+	return sqlpool_get_role_connection(db, SQLPOOL_HOST_ROLE_PRIMARY,
+					   unwanted_host_idx, conn_r);
+}
+
+static bool
+driver_sqlpool_get_sync_connection(struct sqlpool_db *db, bool read,
+				   struct sqlpool_connection **conn_r)
+{
+	struct sqlpool_connection *conns;
 	unsigned int i, count;
 
-	if (driver_sqlpool_get_connection(db, UINT_MAX, conn_r))
+	if (driver_sqlpool_get_connection(db, UINT_MAX, read, conn_r))
 		return TRUE;
 
 	/* no idling connections, but maybe we can find one that's trying to
 	   connect to server, and we can use it once it's finished */
-	conns = array_get(&db->all_connections, &count);
+	conns = array_get_modifiable(&db->all_connections, &count);
 	for (i = 0; i < count; i++) {
+		if (!read && sqlpool_connection_get_role(db, &conns[i]) !=
+		    SQLPOOL_HOST_ROLE_PRIMARY)
+			continue;
 		if (conns[i].db->state == SQL_DB_STATE_CONNECTING) {
 			*conn_r = &conns[i];
 			return TRUE;
@@ -433,17 +706,17 @@ driver_sqlpool_get_connected_flags(struct sqlpool_db *db,
 static enum sql_db_flags driver_sqlpool_get_flags(struct sql_db *_db)
 {
 	struct sqlpool_db *db = (struct sqlpool_db *)_db;
-	const struct sqlpool_connection *conn;
+	struct sqlpool_connection *conn;
 	enum sql_db_flags flags;
 
 	/* try to use a connected db */
 	if (driver_sqlpool_get_connected_flags(db, &flags))
 		return flags;
 
-	if (!driver_sqlpool_get_sync_connection(db, &conn)) {
+	if (!driver_sqlpool_get_sync_connection(db, TRUE, &conn)) {
 		/* Failed to connect to database. Just use the first
 		   connection. */
-		conn = array_idx(&db->all_connections, 0);
+		conn = array_idx_modifiable(&db->all_connections, 0);
 	}
 	return sql_get_flags(conn->db);
 }
@@ -454,9 +727,11 @@ driver_sqlpool_parse_hosts(struct sqlpool_db *db, const char *connect_string,
 {
 	const char *const *args, *key, *value, *hostname;
 	struct sqlpool_host *host;
-	ARRAY_TYPE(const_string) hostnames, connect_args;
+	ARRAY_TYPE(const_string) hostnames, replica_hostnames, connect_args;
+	bool min_set = FALSE, idle_timeout_set = FALSE;
 
 	t_array_init(&hostnames, 8);
+	t_array_init(&replica_hostnames, 8);
 	t_array_init(&connect_args, 32);
 
 	/* connect string is a space separated list. it may contain
@@ -479,8 +754,26 @@ driver_sqlpool_parse_hosts(struct sqlpool_db *db, const char *connect_string,
 					value);
 				return -1;
 			}
+		} else if (strcmp(key, "minconns") == 0) {
+			if (str_to_uint(value, &db->min_connections) < 0 ||
+			    db->min_connections == 0) {
+				*error_r = t_strdup_printf("Invalid value for minconns: %s",
+					value);
+				return -1;
+			}
+			min_set = TRUE;
+		} else if (strcmp(key, "idle_timeout") == 0) {
+			if (str_to_uint(value, &db->idle_timeout_secs) < 0 ||
+			    db->idle_timeout_secs == 0) {
+				*error_r = t_strdup_printf("Invalid value for idle_timeout: %s",
+					value);
+				return -1;
+			}
+			idle_timeout_set = TRUE;
 		} else if (strcmp(key, "host") == 0) {
 			array_push_back(&hostnames, &value);
+		} else if (strcmp(key, "replica_host") == 0) {
+			array_push_back(&replica_hostnames, &value);
 		} else {
 			array_push_back(&connect_args, args);
 		}
@@ -491,9 +784,14 @@ driver_sqlpool_parse_hosts(struct sqlpool_db *db, const char *connect_string,
 	connect_string = t_strarray_join(array_front(&connect_args), " ");
 
 	if (array_count(&hostnames) == 0) {
+		if (array_count(&replica_hostnames) > 0) {
+			*error_r = "replica_host requires at least one host";
+			return -1;
+		}
 		/* no hosts specified. create a default one. */
 		host = array_append_space(&db->hosts);
 		host->connect_string = i_strdup(connect_string);
+		host->name = i_strdup("");
 	} else {
 		if (*connect_string == '\0')
 			connect_string = NULL;
@@ -503,24 +801,43 @@ driver_sqlpool_parse_hosts(struct sqlpool_db *db, const char *connect_string,
 			host->connect_string =
 				i_strconcat("host=", hostname, " ",
 					    connect_string, NULL);
+			host->name = i_strdup(hostname);
+		}
+		array_foreach_elem(&replica_hostnames, hostname) {
+			host = array_append_space(&db->hosts);
+			host->connect_string =
+				i_strconcat("host=", hostname, " ",
+					    connect_string, NULL);
+			host->name = i_strdup(hostname);
+			host->role = SQLPOOL_HOST_ROLE_REPLICA;
+			db->replica_count++;
 		}
 	}
 
 	if (db->connection_limit == 0)
 		db->connection_limit = SQL_DEFAULT_CONNECTION_LIMIT;
+	if (!min_set)
+		db->min_connections = 1;
+	if (db->min_connections > db->connection_limit) {
+		*error_r = t_strdup_printf(
+			"minconns=%u can't be larger than maxconns=%u",
+			db->min_connections, db->connection_limit);
+		return -1;
+	}
+	if (!idle_timeout_set)
+		db->idle_timeout_secs = SQLPOOL_DEFAULT_IDLE_TIMEOUT_SECS;
 	return 0;
 }
 
-static void sqlpool_add_all_once(struct sqlpool_db *db)
+static void sqlpool_add_all_min(struct sqlpool_db *db)
 {
 	struct sqlpool_host *host;
 	unsigned int host_idx;
 
-	for (;;) {
-		host = sqlpool_find_host_with_least_connections(db, &host_idx);
-		if (host->connection_count > 0)
-			break;
-		(void)sqlpool_add_connection(db, host, host_idx);
+	array_foreach_modifiable(&db->hosts, host) {
+		host_idx = array_foreach_idx(&db->hosts, host);
+		while (host->connection_count < db->min_connections)
+			(void)sqlpool_add_connection(db, host, host_idx);
 	}
 }
 
@@ -551,7 +868,7 @@ int driver_sqlpool_init_full(const struct sql_settings *set, const struct sql_db
 	}
 	i_array_init(&db->all_connections, 16);
 	/* connect to all databases so we can do load balancing immediately */
-	sqlpool_add_all_once(db);
+	sqlpool_add_all_min(db);
 
 	*db_r = &db->api;
 	return 0;
@@ -578,9 +895,12 @@ static void driver_sqlpool_deinit(struct sql_db *_db)
 	array_clear(&db->all_connections);
 
 	driver_sqlpool_abort_requests(db);
+	timeout_remove(&db->to_idle);
 
-	array_foreach_modifiable(&db->hosts, host)
+	array_foreach_modifiable(&db->hosts, host) {
 		i_free(host->connect_string);
+		i_free(host->name);
+	}
 
 	i_assert(array_count(&db->all_connections) == 0);
 	array_free(&db->hosts);
@@ -675,6 +995,8 @@ static void
 driver_sqlpool_prepend_request(struct sqlpool_db *db,
 			       struct sqlpool_request *request)
 {
+	request->queue_start = ioloop_timeval;
+	db->last_queued = ioloop_time;
 	DLLIST2_PREPEND(&db->requests_head, &db->requests_tail, request);
 	if (db->request_to == NULL) {
 		db->request_to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
@@ -686,6 +1008,8 @@ static void
 driver_sqlpool_append_request(struct sqlpool_db *db,
 			      struct sqlpool_request *request)
 {
+	request->queue_start = ioloop_timeval;
+	db->last_queued = ioloop_time;
 	DLLIST2_APPEND(&db->requests_head, &db->requests_tail, request);
 	if (db->request_to == NULL) {
 		db->request_to = timeout_add(SQL_QUERY_TIMEOUT_SECS * 1000,
@@ -698,9 +1022,12 @@ driver_sqlpool_query_callback(struct sql_result *result,
 			      struct sqlpool_request *request)
 {
 	struct sqlpool_db *db = request->db;
-	const struct sqlpool_connection *conn = NULL;
+	struct sqlpool_connection *conn = NULL;
 	struct sql_db *conndb;
 
+	sqlpool_request_finished(db, request->event, request->host_idx,
+				 &request->sent_time,
+				 request->queue_wait_usecs);
 	if (result->failed_try_retry &&
 	    request->retry_count < array_count(&db->hosts)) {
 		e_warning(db->api.event, "Query failed, retrying: %s",
@@ -709,10 +1036,9 @@ driver_sqlpool_query_callback(struct sql_result *result,
 		driver_sqlpool_prepend_request(db, request);
 
 		if (driver_sqlpool_get_connection(request->db,
-						  request->host_idx, &conn)) {
-			request->host_idx = conn->host_idx;
+						  request->host_idx,
+						  request->read, &conn))
 			sqlpool_request_send_next(db, conn->db);
-		}
 	} else {
 		if (result->failed) {
 			e_error(db->api.event, "Query failed, aborting: %s",
@@ -728,51 +1054,85 @@ driver_sqlpool_query_callback(struct sql_result *result,
 	}
 }
 
-static void ATTR_NULL(3, 4)
-driver_sqlpool_query(struct sql_db *_db, const char *query,
-		     sql_query_callback_t *callback, void *context)
+static void ATTR_NULL(4, 5)
+driver_sqlpool_query_full(struct sqlpool_db *db, const char *query, bool read,
+			  sql_query_callback_t *callback, void *context)
 {
-        struct sqlpool_db *db = (struct sqlpool_db *)_db;
 	struct sqlpool_request *request;
-	const struct sqlpool_connection *conn;
+	struct sqlpool_connection *conn;
 
 	request = sqlpool_request_new(db, query);
 	request->callback = callback;
 	request->context = context;
+	request->read = read;
 
-	if (!driver_sqlpool_get_connection(db, UINT_MAX, &conn))
+	if (!driver_sqlpool_get_connection(db, UINT_MAX, read, &conn))
 		driver_sqlpool_append_request(db, request);
 	else {
-		request->host_idx = conn->host_idx;
+		sqlpool_request_sent(db, request, conn);
 		sql_query(conn->db, query, driver_sqlpool_query_callback,
 			  request);
 	}
 }
 
+static void ATTR_NULL(3, 4)
+driver_sqlpool_query(struct sql_db *_db, const char *query,
+		     sql_query_callback_t *callback, void *context)
+{
+        struct sqlpool_db *db = (struct sqlpool_db *)_db;
+
+	/* queries are expected to be reads, which replicas can handle.
+	   writes go through exec and transactions. */
+	driver_sqlpool_query_full(db, query, TRUE, callback, context);
+}
+
 static void driver_sqlpool_exec(struct sql_db *_db, const char *query)
 {
-	driver_sqlpool_query(_db, query, NULL, NULL);
+        struct sqlpool_db *db = (struct sqlpool_db *)_db;
+
+	driver_sqlpool_query_full(db, query, FALSE, NULL, NULL);
+}
+
+static struct sql_result *
+sqlpool_query_s(struct sqlpool_db *db, struct sqlpool_connection *conn,
+		const char *query)
+{
+	struct sqlpool_request *request;
+	struct sql_result *result;
+
+	request = sqlpool_request_new(db, query);
+	request->read = TRUE;
+	io_loop_time_refresh();
+	sqlpool_request_sent(db, request, conn);
+
+	result = sql_query_s(conn->db, query);
+
+	io_loop_time_refresh();
+	sqlpool_request_finished(db, request->event, request->host_idx,
+				 &request->sent_time, 0);
+	sqlpool_request_free(&request);
+	return result;
 }
 
 static struct sql_result *
 driver_sqlpool_query_s(struct sql_db *_db, const char *query)
 {
         struct sqlpool_db *db = (struct sqlpool_db *)_db;
-	const struct sqlpool_connection *conn;
+	struct sqlpool_connection *conn;
 	struct sql_result *result;
 
-	if (!driver_sqlpool_get_sync_connection(db, &conn)) {
+	if (!driver_sqlpool_get_sync_connection(db, TRUE, &conn)) {
 		sql_not_connected_result.refcount++;
 		return &sql_not_connected_result;
 	}
 
-	result = sql_query_s(conn->db, query);
+	result = sqlpool_query_s(db, conn, query);
 	if (result->failed_try_retry) {
-		if (!driver_sqlpool_get_sync_connection(db, &conn))
+		if (!driver_sqlpool_get_sync_connection(db, TRUE, &conn))
 			return result;
 
 		sql_result_unref(result);
-		result = sql_query_s(conn->db, query);
+		result = sqlpool_query_s(db, conn, query);
 	}
 	return result;
 }
@@ -805,6 +1165,10 @@ static void
 driver_sqlpool_commit_callback(const struct sql_commit_result *result,
 			       struct sqlpool_transaction_context *ctx)
 {
+	struct sqlpool_db *db = (struct sqlpool_db *)ctx->ctx.db;
+
+	sqlpool_request_finished(db, db->api.event, ctx->host_idx,
+				 &ctx->sent_time, ctx->queue_wait_usecs);
 	ctx->callback(result, ctx->context);
 	driver_sqlpool_transaction_free(ctx);
 }
@@ -817,7 +1181,7 @@ driver_sqlpool_transaction_commit(struct sql_transaction_context *_ctx,
 	struct sqlpool_transaction_context *ctx =
 		(struct sqlpool_transaction_context *)_ctx;
 	struct sqlpool_db *db = (struct sqlpool_db *)_ctx->db;
-	const struct sqlpool_connection *conn;
+	struct sqlpool_connection *conn;
 
 	ctx->callback = callback;
 	ctx->context = context;
@@ -825,8 +1189,8 @@ driver_sqlpool_transaction_commit(struct sql_transaction_context *_ctx,
 	ctx->commit_request = sqlpool_request_new(db, NULL);
 	ctx->commit_request->trans = ctx;
 
-	if (driver_sqlpool_get_connection(db, UINT_MAX, &conn))
-		sqlpool_request_handle_transaction(conn->db, ctx);
+	if (driver_sqlpool_get_connection(db, UINT_MAX, FALSE, &conn))
+		sqlpool_request_handle_transaction(db, conn, ctx);
 	else
 		driver_sqlpool_append_request(db, ctx->commit_request);
 }
@@ -838,20 +1202,27 @@ driver_sqlpool_transaction_commit_s(struct sql_transaction_context *_ctx,
 	struct sqlpool_transaction_context *ctx =
 		(struct sqlpool_transaction_context *)_ctx;
         struct sqlpool_db *db = (struct sqlpool_db *)_ctx->db;
-	const struct sqlpool_connection *conn;
+	struct sqlpool_connection *conn;
 	struct sql_transaction_context *conn_trans;
+	struct timeval sent_time;
 	int ret;
 
 	*error_r = NULL;
 
-	if (!driver_sqlpool_get_sync_connection(db, &conn)) {
+	if (!driver_sqlpool_get_sync_connection(db, FALSE, &conn)) {
 		*error_r = SQL_ERRSTR_NOT_CONNECTED;
 		driver_sqlpool_transaction_free(ctx);
 		return -1;
 	}
 
+	io_loop_time_refresh();
+	sent_time = ioloop_timeval;
+	conn->last_used = ioloop_time;
 	conn_trans = driver_sqlpool_new_conn_trans(ctx, conn->db);
 	ret = sql_transaction_commit_s(&conn_trans, error_r);
+	io_loop_time_refresh();
+	sqlpool_request_finished(db, db->api.event, conn->host_idx,
+				 &sent_time, 0);
 	driver_sqlpool_transaction_free(ctx);
 	return ret;
 }
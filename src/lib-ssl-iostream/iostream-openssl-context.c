@@ -1,9 +1,11 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "str.h"
 #include "hex-binary.h"
 #include "safe-memset.h"
+#include "hash.h"
 #include "iostream-openssl.h"
 #include "dovecot-openssl-common.h"
 
@@ -15,6 +17,12 @@
 #include <openssl/pem.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
+#ifdef HAVE_SSL_CTX_set_tlsext_ticket_key_evp_cb
+#  include <openssl/core_names.h>
+#else
+#  include <openssl/hmac.h>
+#endif
 #include <arpa/inet.h>
 
 #ifndef HAVE_EVP_PKEY_get0_DH
@@ -577,6 +585,136 @@ ssl_iostream_context_load_ca(struct ssl_iostream_context *ctx,
 	return 0;
 }
 
+static const struct openssl_ticket_key *
+ssl_ticket_key_find(struct ssl_iostream_context *ctx,
+		    const unsigned char *key_name, unsigned int *idx_r)
+{
+	const struct openssl_ticket_key *key;
+
+	array_foreach(&ctx->ticket_keys, key) {
+		if (memcmp(key->name, key_name, sizeof(key->name)) == 0) {
+			*idx_r = array_foreach_idx(&ctx->ticket_keys, key);
+			return key;
+		}
+	}
+	return NULL;
+}
+
+#ifdef HAVE_SSL_CTX_set_tlsext_ticket_key_evp_cb
+static bool
+ssl_ticket_key_set_hmac(EVP_MAC_CTX *hctx,
+			const struct openssl_ticket_key *key)
+{
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+			(void *)key->hmac_key, sizeof(key->hmac_key)),
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+			(char *)"sha256", 0),
+		OSSL_PARAM_construct_end()
+	};
+	return EVP_MAC_CTX_set_params(hctx, params) == 1;
+}
+#else
+static bool
+ssl_ticket_key_set_hmac(HMAC_CTX *hctx, const struct openssl_ticket_key *key)
+{
+	return HMAC_Init_ex(hctx, key->hmac_key, sizeof(key->hmac_key),
+			    EVP_sha256(), NULL) == 1;
+}
+#endif
+
+static int
+ssl_ticket_key_callback(SSL *ssl, unsigned char *key_name, unsigned char *iv,
+			EVP_CIPHER_CTX *cctx,
+#ifdef HAVE_SSL_CTX_set_tlsext_ticket_key_evp_cb
+			EVP_MAC_CTX *hctx,
+#else
+			HMAC_CTX *hctx,
+#endif
+			int enc)
+{
+	struct ssl_iostream *ssl_io =
+		SSL_get_ex_data(ssl, dovecot_ssl_extdata_index);
+	struct ssl_iostream_context *ctx = ssl_io->ctx;
+	const struct openssl_ticket_key *key;
+	unsigned int idx;
+
+	if (!array_is_created(&ctx->ticket_keys) ||
+	    array_is_empty(&ctx->ticket_keys)) {
+		/* SNI switched to a context without keys */
+		return enc == 1 ? -1 : 0;
+	}
+
+	if (enc == 1) {
+		/* new ticket */
+		key = array_front(&ctx->ticket_keys);
+		memcpy(key_name, key->name, sizeof(key->name));
+		if (RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1 ||
+		    EVP_EncryptInit_ex(cctx, EVP_aes_256_cbc(), NULL,
+				       key->aes_key, iv) != 1 ||
+		    !ssl_ticket_key_set_hmac(hctx, key))
+			return -1;
+		return 1;
+	}
+
+	/* decrypting a ticket sent by the client */
+	key = ssl_ticket_key_find(ctx, key_name, &idx);
+	if (key == NULL) {
+		/* unknown or expired key - do a full handshake */
+		return 0;
+	}
+	if (!ssl_ticket_key_set_hmac(hctx, key) ||
+	    EVP_DecryptInit_ex(cctx, EVP_aes_256_cbc(), NULL,
+			       key->aes_key, iv) != 1)
+		return -1;
+	/* renew tickets that were encrypted with an old key */
+	return idx == 0 ? 1 : 2;
+}
+
+static int
+ssl_iostream_ctx_set_ticket_keys(struct ssl_iostream_context *ctx,
+				 const char *keys, const char **error_r)
+{
+	const char *const *hex_keys = t_strsplit_spaces(keys, " \t\r\n");
+	struct openssl_ticket_key *key;
+	buffer_t *buf;
+
+	if (hex_keys[0] == NULL)
+		return 0;
+
+	p_array_init(&ctx->ticket_keys, ctx->pool,
+		     str_array_length(hex_keys));
+	buf = t_buffer_create(sizeof(*key));
+	for (; *hex_keys != NULL; hex_keys++) {
+		buffer_set_used_size(buf, 0);
+		if (strlen(*hex_keys) != sizeof(*key) * 2 ||
+		    hex_to_binary(*hex_keys, buf) < 0) {
+			*error_r = t_strdup_printf(
+				"Invalid ssl_session_ticket_keys: "
+				"Keys must be %zu hex digits",
+				sizeof(*key) * 2);
+			return -1;
+		}
+		key = array_append_space(&ctx->ticket_keys);
+		memcpy(key, buf->data, sizeof(*key));
+	}
+	safe_memset(buffer_get_modifiable_data(buf, NULL), 0, buf->used);
+
+#ifdef HAVE_SSL_CTX_set_tlsext_ticket_key_evp_cb
+	if (SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx->ssl_ctx,
+			ssl_ticket_key_callback) != 1) {
+#else
+	if (SSL_CTX_set_tlsext_ticket_key_cb(ctx->ssl_ctx,
+			ssl_ticket_key_callback) != 1) {
+#endif
+		*error_r = t_strdup_printf(
+			"Can't set session ticket key callback: %s",
+			openssl_iostream_error());
+		return -1;
+	}
+	return 0;
+}
+
 static int
 ssl_iostream_context_set(struct ssl_iostream_context *ctx,
 			 const struct ssl_iostream_settings *set,
@@ -670,6 +808,12 @@ ssl_iostream_context_set(struct ssl_iostream_context *ctx,
 			return -1;
 		}
 	}
+	if (!ctx->client_ctx && set->tickets &&
+	    set->session_ticket_keys != NULL) {
+		if (ssl_iostream_ctx_set_ticket_keys(ctx,
+				set->session_ticket_keys, error_r) < 0)
+			return -1;
+	}
 	if (!ctx->client_ctx) {
 		if (SSL_CTX_set_tlsext_servername_callback(ctx->ssl_ctx,
 					ssl_servername_callback) != 1) {
@@ -755,6 +899,69 @@ ssl_iostream_context_init_common(struct ssl_iostream_context *ctx,
 	return ssl_iostream_context_set(ctx, set, error_r);
 }
 
+static int openssl_iostream_new_client_session(SSL *ssl, SSL_SESSION *session)
+{
+	struct ssl_iostream *ssl_io =
+		SSL_get_ex_data(ssl, dovecot_ssl_extdata_index);
+	struct ssl_iostream_context *ctx = ssl_io->ctx;
+	SSL_SESSION *old_session;
+	char *host;
+
+	/* Remember only sessions whose certificate was valid. The
+	   certificate chain isn't verified again when resuming. */
+	if (ssl_io->connected_host == NULL ||
+	    !ssl_io->cert_received || ssl_io->cert_broken)
+		return 0;
+
+	if (!hash_table_is_created(ctx->client_sessions)) {
+		hash_table_create(&ctx->client_sessions, default_pool, 0,
+				  str_hash, strcmp);
+	}
+	if (hash_table_lookup_full(ctx->client_sessions,
+				   ssl_io->connected_host,
+				   &host, &old_session)) {
+		SSL_SESSION_free(old_session);
+		hash_table_update(ctx->client_sessions, host, session);
+	} else {
+		host = i_strdup(ssl_io->connected_host);
+		hash_table_insert(ctx->client_sessions, host, session);
+	}
+	/* we took the session's reference */
+	return 1;
+}
+
+void openssl_iostream_context_resume_session(struct ssl_iostream_context *ctx,
+					     SSL *ssl, const char *host)
+{
+	SSL_SESSION *session;
+
+	if (!hash_table_is_created(ctx->client_sessions))
+		return;
+	session = hash_table_lookup(ctx->client_sessions, host);
+	if (session != NULL)
+		(void)SSL_set_session(ssl, session);
+}
+
+static void
+openssl_iostream_context_free_sessions(struct ssl_iostream_context *ctx)
+{
+	struct hash_iterate_context *iter;
+	SSL_SESSION *session;
+	char *host;
+
+	if (!hash_table_is_created(ctx->client_sessions))
+		return;
+
+	iter = hash_table_iterate_init(ctx->client_sessions);
+	while (hash_table_iterate(iter, ctx->client_sessions,
+				  &host, &session)) {
+		SSL_SESSION_free(session);
+		i_free(host);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&ctx->client_sessions);
+}
+
 int openssl_iostream_context_init_client(const struct ssl_iostream_settings *set,
 					 struct ssl_iostream_context **ctx_r,
 					 const char **error_r)
@@ -768,6 +975,11 @@ int openssl_iostream_context_init_client(const struct ssl_iostream_settings *set
 		return -1;
 	}
 	SSL_CTX_set_mode(ssl_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+	/* remember sessions ourselves, so connections to the same host can
+	   skip the full handshake */
+	SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT |
+				       SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ssl_ctx, openssl_iostream_new_client_session);
 
 	ctx = i_new(struct ssl_iostream_context, 1);
 	ctx->refcount = 1;
@@ -817,6 +1029,12 @@ void openssl_iostream_context_unref(struct ssl_iostream_context *ctx)
 	if (--ctx->refcount > 0)
 		return;
 
+	openssl_iostream_context_free_sessions(ctx);
+	if (array_is_created(&ctx->ticket_keys)) {
+		safe_memset(array_get_modifiable(&ctx->ticket_keys, NULL), 0,
+			    array_count(&ctx->ticket_keys) *
+			    sizeof(struct openssl_ticket_key));
+	}
 	SSL_CTX_free(ctx->ssl_ctx);
 	pool_unref(&ctx->pool);
 	i_free(ctx);
@@ -328,6 +328,8 @@ openssl_iostream_create(struct ssl_iostream_context *ctx,
 	SSL_set_bio(ssl_io->ssl, bio_int, bio_int);
         SSL_set_ex_data(ssl_io->ssl, dovecot_ssl_extdata_index, ssl_io);
 	SSL_set_tlsext_host_name(ssl_io->ssl, host);
+	if (client && host != NULL)
+		openssl_iostream_context_resume_session(ctx, ssl_io->ssl, host);
 
 	if (openssl_iostream_set(ssl_io, set, error_r) < 0) {
 		openssl_iostream_free(ssl_io);
@@ -412,14 +414,15 @@ static int openssl_iostream_bio_output_real(struct ssl_iostream *ssl_io)
 {
 	size_t bytes, max_bytes = 0;
 	ssize_t sent;
-	unsigned char buffer[IO_BLOCK_SIZE];
+	char *data;
 	int result = 0;
 	int ret;
 
 	o_stream_cork(ssl_io->plain_output);
-	while ((bytes = BIO_ctrl_pending(ssl_io->bio_ext)) > 0) {
-		/* bytes contains how many SSL encrypted bytes we should be
-		   sending out */
+	/* BIO_nread0() returns how many SSL encrypted bytes we can send out
+	   directly from bio_ext's buffer without first copying them. */
+	while ((ret = BIO_nread0(ssl_io->bio_ext, &data)) > 0) {
+		bytes = ret;
 		max_bytes = o_stream_get_buffer_avail_size(ssl_io->plain_output);
 		if (bytes > max_bytes) {
 			if (max_bytes == 0) {
@@ -428,25 +431,24 @@ static int openssl_iostream_bio_output_real(struct ssl_iostream *ssl_io)
 			}
 			bytes = max_bytes;
 		}
-		if (bytes > sizeof(buffer))
-			bytes = sizeof(buffer);
 
-		/* BIO_read() is guaranteed to return all the bytes that
-		   BIO_ctrl_pending() returned */
-		ret = BIO_read(ssl_io->bio_ext, buffer, bytes);
-		i_assert(ret == (int)bytes);
-
-		/* we limited number of read bytes to plain_output's
+		/* we limited number of sent bytes to plain_output's
 		   available size. this send() is guaranteed to either
 		   fully succeed or completely fail due to some error. */
-		sent = o_stream_send(ssl_io->plain_output, buffer, bytes);
+		sent = o_stream_send(ssl_io->plain_output, data, bytes);
 		if (sent < 0) {
 			o_stream_uncork(ssl_io->plain_output);
 			return -1;
 		}
 		i_assert(sent == (ssize_t)bytes);
+
+		/* mark the sent bytes as read */
+		ret = BIO_nread(ssl_io->bio_ext, &data, bytes);
+		i_assert(ret == (int)bytes);
 		result = 1;
 	}
+	if (ret <= 0)
+		bytes = 0;
 
 	ret = o_stream_uncork_flush(ssl_io->plain_output);
 	if (ret < 0)
@@ -696,6 +698,11 @@ static int openssl_iostream_handshake(struct ssl_iostream *ssl_io)
 			if (ret <= 0)
 				return ret;
 		}
+		if (SSL_session_reused(ssl_io->ssl) != 0) {
+			/* only sessions with a valid certificate are
+			   resumed */
+			ssl_io->cert_received = TRUE;
+		}
 	} else {
 		while ((ret = SSL_accept(ssl_io->ssl)) <= 0) {
 			ret = openssl_iostream_handle_error(ssl_io, ret,
@@ -16,6 +16,16 @@ enum openssl_iostream_sync_type {
 	OPENSSL_IOSTREAM_SYNC_TYPE_HANDSHAKE
 };
 
+/* Session ticket key: 16 bytes key name, 32 bytes HMAC-SHA256 key and
+   32 bytes AES-256 key */
+#define OPENSSL_TICKET_KEY_NAME_SIZE 16
+#define OPENSSL_TICKET_KEY_SECRET_SIZE 32
+struct openssl_ticket_key {
+	unsigned char name[OPENSSL_TICKET_KEY_NAME_SIZE];
+	unsigned char hmac_key[OPENSSL_TICKET_KEY_SECRET_SIZE];
+	unsigned char aes_key[OPENSSL_TICKET_KEY_SECRET_SIZE];
+};
+
 struct ssl_iostream_context {
 	int refcount;
 	SSL_CTX *ssl_ctx;
@@ -24,6 +34,11 @@ struct ssl_iostream_context {
 	struct ssl_iostream_settings set;
 
 	int username_nid;
+	/* SSL clients: the latest resumable session for each host */
+	HASH_TABLE(char *, SSL_SESSION *) client_sessions;
+	/* SSL servers: keys from ssl_session_ticket_keys. The first one is
+	   used for new tickets, the rest only for decrypting old ones. */
+	ARRAY(struct openssl_ticket_key) ticket_keys;
 
 	bool client_ctx:1;
 };
@@ -86,6 +101,9 @@ int openssl_iostream_context_init_server(const struct ssl_iostream_settings *set
 					 const char **error_r);
 void openssl_iostream_context_ref(struct ssl_iostream_context *ctx);
 void openssl_iostream_context_unref(struct ssl_iostream_context *ctx);
+/* Try to resume the previous session to the host, if there is one. */
+void openssl_iostream_context_resume_session(struct ssl_iostream_context *ctx,
+					     SSL *ssl, const char *host);
 void openssl_iostream_global_deinit(void);
 
 int openssl_iostream_load_key(const struct ssl_iostream_cert *set,
@@ -26,6 +26,10 @@ struct ssl_iostream_settings {
 	const char *dh; /* context-only */
 	const char *cert_username_field; /* both */
 	const char *crypto_device; /* context-only */
+	/* Session ticket keys shared by all the processes, so that sessions
+	   can be resumed in any of them. Whitespace-separated list of
+	   160 hex digit keys. */
+	const char *session_ticket_keys; /* context-only */
 
 	bool verbose, verbose_invalid_cert; /* stream-only */
 	bool skip_crl_check; /* context-only */
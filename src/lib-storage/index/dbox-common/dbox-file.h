@@ -129,6 +129,10 @@ struct dbox_file_append_context {
 
 	uoff_t first_append_offset, last_checkpoint_offset, last_flush_offset;
 	struct ostream *output;
+
+	/* Don't fdatasync() the file when flushing. The caller is
+	   responsible for syncing it before the index is committed. */
+	bool skip_fsync:1;
 };
 
 #define dbox_file_is_open(file) ((file)->fd != -1)
@@ -160,7 +160,9 @@ static int mdbox_deleted_sync(struct mdbox_mailbox *mbox,
 	struct mail_index_transaction *trans;
 	struct mdbox_mail_index_record rec;
 	struct mdbox_map_mail_index_record map_rec;
+	struct mdbox_map *map;
 	enum mail_index_sync_flags sync_flags;
+	unsigned int shard_idx;
 	uint16_t refcount;
 	uint32_t map_seq, map_count, seq, uid = 0;
 	int ret = 0;
@@ -193,19 +195,26 @@ static int mdbox_deleted_sync(struct mdbox_mailbox *mbox,
 		return -1;
 	}
 
-	map_count = mdbox_map_get_messages_count(mbox->storage->map);
-	for (map_seq = 1; map_seq <= map_count; map_seq++) {
-		if (mdbox_map_lookup_seq_full(mbox->storage->map, map_seq,
-					      &map_rec, &refcount) < 0) {
-			ret = -1;
-			break;
-		}
-		if (refcount == 0) {
-			rec.map_uid = mdbox_map_lookup_uid(mbox->storage->map,
-							   map_seq);
-			mail_index_append(trans, ++uid, &seq);
-			mail_index_update_ext(trans, seq,
-					      mbox->ext_id, &rec, NULL);
+	/* the map UIDs are in ascending order across the shards */
+	for (shard_idx = 0; ret == 0 && shard_idx < MDBOX_MAP_MAX_SHARDS;
+	     shard_idx++) {
+		map = mdbox_map_get_shard(mbox->storage->map, shard_idx);
+		if (map == NULL || mdbox_map_open(map) <= 0)
+			continue;
+
+		map_count = mdbox_map_get_messages_count(map);
+		for (map_seq = 1; map_seq <= map_count; map_seq++) {
+			if (mdbox_map_lookup_seq_full(map, map_seq,
+						      &map_rec, &refcount) < 0) {
+				ret = -1;
+				break;
+			}
+			if (refcount == 0) {
+				rec.map_uid = mdbox_map_lookup_uid(map, map_seq);
+				mail_index_append(trans, ++uid, &seq);
+				mail_index_update_ext(trans, seq,
+						      mbox->ext_id, &rec, NULL);
+			}
 		}
 	}
 
@@ -22,7 +22,23 @@ struct mdbox_map {
 
 	struct mailbox_list *root_list;
 
+	/* The first map is also shard 0. It owns the other shards, which are
+	   allocated when they're first needed. */
+	struct mdbox_map *root;
+	struct mdbox_map *shards[MDBOX_MAP_MAX_SHARDS];
+	unsigned int shard_idx;
+	/* Number of shards that new messages are appended to */
+	unsigned int append_shards_count;
+	/* Used to pick the shard for the next append */
+	unsigned int append_counter;
+
+	/* Bitmask of shards 1.. that exist on disk */
+	uint32_t disk_shards;
+	time_t shards_detect_time;
+
 	bool verify_existing_file_ids:1;
+	/* disk_shards has been filled */
+	bool shards_detected:1;
 };
 
 struct mdbox_map_append {
@@ -31,7 +47,9 @@ struct mdbox_map_append {
 };
 
 struct mdbox_map_append_context {
+	/* the map shard where the messages are appended to */
 	struct mdbox_map *map;
+	/* atomic context of the shard */
 	struct mdbox_map_atomic_context *atomic;
 	struct mail_index_transaction *trans;
 
@@ -52,12 +70,34 @@ struct mdbox_map_atomic_context {
 	struct mail_index_sync_ctx *sync_ctx;
 	struct mail_index_view *sync_view;
 
+	/* The atomic context returned by mdbox_map_atomic_begin() is for
+	   shard 0. It owns the atomic contexts of the other shards. The
+	   success/failed state is kept only in the root. */
+	struct mdbox_map_atomic_context *root;
+	struct mdbox_map_atomic_context *shards[MDBOX_MAP_MAX_SHARDS];
+	/* Bitmask of shards that mdbox_map_atomic_lock() locks */
+	uint32_t want_shards;
+
 	bool map_refreshed:1;
 	bool locked:1;
 	bool success:1;
 	bool failed:1;
+	/* Changes have been written to some of the locked shards. The
+	   shards can't be unlocked and locked again in a different order
+	   anymore. */
+	bool changed:1;
 };
 
+/* Returns the shard containing the given map UID or file ID. */
+struct mdbox_map *mdbox_map_get_id_shard(struct mdbox_map *map, uint32_t id);
+/* Returns the atomic context for the given map shard. */
+struct mdbox_map_atomic_context *
+mdbox_map_atomic_get_shard(struct mdbox_map_atomic_context *atomic,
+			   struct mdbox_map *shard);
+/* Lock only the given shard's atomic context. */
+int mdbox_map_atomic_lock_shard(struct mdbox_map_atomic_context *atomic,
+				const char *reason);
+
 int mdbox_map_view_lookup_rec(struct mdbox_map *map,
 			      struct mail_index_view *view, uint32_t seq,
 			      struct dbox_mail_lookup_rec *rec_r);
@@ -19,13 +19,20 @@
 
 struct mdbox_map_transaction_context {
 	struct mdbox_map_atomic_context *atomic;
-	struct mail_index_transaction *trans;
+	enum mail_index_transaction_flags flags;
+	/* index transaction for each map shard, begun when needed */
+	struct mail_index_transaction *trans[MDBOX_MAP_MAX_SHARDS];
+	/* bitmask of shards that have changes */
+	uint32_t changed_shards;
 
-	bool changed:1;
 	bool committed:1;
 };
 
 static int mdbox_map_generate_uid_validity(struct mdbox_map *map);
+static void
+mdbox_map_get_ext_hdr(struct mdbox_map *map, struct mail_index_view *view,
+		      struct mdbox_map_mail_index_header *hdr_r);
+static int mdbox_map_refresh_shard(struct mdbox_map *map);
 
 void mdbox_map_set_corrupted(struct mdbox_map *map, const char *format, ...)
 {
@@ -41,11 +48,59 @@ void mdbox_map_set_corrupted(struct mdbox_map *map, const char *format, ...)
 	mdbox_storage_set_corrupted(map->storage);
 }
 
-struct mdbox_map *
-mdbox_map_init(struct mdbox_storage *storage, struct mailbox_list *root_list)
+static void mdbox_map_detect_shards(struct mdbox_map *root)
+{
+	struct stat st;
+	const char *path;
+	unsigned int i;
+
+	/* Shards that exist on disk are used even if mdbox_map_shards is
+	   lower (or 1), so that their mails stay reachable after the setting
+	   is lowered or when running with a different configuration. Every
+	   existing shard has a transaction log, so stat() them instead of
+	   reading the (possibly large) storage directory. */
+	root->disk_shards = 0;
+	root->shards_detect_time = ioloop_time;
+	root->shards_detected = TRUE;
+	for (i = 1; i < MDBOX_MAP_MAX_SHARDS; i++) {
+		path = t_strdup_printf("%s/"MDBOX_GLOBAL_SHARD_INDEX_PREFIX_FORMAT
+				       ".log", root->index_path, i);
+		if (stat(path, &st) == 0)
+			root->disk_shards |= 1U << i;
+		else if (errno != ENOENT) {
+			e_error(root->event, "stat(%s) failed: %m", path);
+			/* assume it exists rather than losing its mails */
+			root->disk_shards |= 1U << i;
+		}
+	}
+}
+
+static void mdbox_map_redetect_shards(struct mdbox_map *root)
+{
+	/* another process may have created new shards. this is done only
+	   when there's a reason to suspect that, so do it at most once per
+	   second. */
+	if (root->shards_detect_time != ioloop_time)
+		mdbox_map_detect_shards(root);
+}
+
+static bool mdbox_map_is_sharded(struct mdbox_map *map)
+{
+	struct mdbox_map *root = map->root;
+
+	if (root->append_shards_count > 1)
+		return TRUE;
+	if (!root->shards_detected)
+		mdbox_map_detect_shards(root);
+	return root->disk_shards != 0;
+}
+
+static struct mdbox_map *
+mdbox_map_alloc(struct mdbox_storage *storage, struct mailbox_list *root_list,
+		struct mdbox_map *root_map, unsigned int shard_idx)
 {
 	struct mdbox_map *map;
-	const char *root, *index_root;
+	const char *root, *index_root, *index_prefix;
 
 	root = mailbox_list_get_root_forced(root_list, MAILBOX_LIST_PATH_TYPE_DIR);
 	index_root = mailbox_list_get_root_forced(root_list, MAILBOX_LIST_PATH_TYPE_INDEX);
@@ -56,15 +111,19 @@ mdbox_map_init(struct mdbox_storage *storage, struct mailbox_list *root_list)
 	map->path = i_strconcat(root, "/"MDBOX_GLOBAL_DIR_NAME, NULL);
 	map->index_path =
 		i_strconcat(index_root, "/"MDBOX_GLOBAL_DIR_NAME, NULL);
+	index_prefix = shard_idx == 0 ? MDBOX_GLOBAL_INDEX_PREFIX :
+		t_strdup_printf(MDBOX_GLOBAL_SHARD_INDEX_PREFIX_FORMAT,
+				shard_idx);
 	map->index = mail_index_alloc(storage->storage.storage.event,
-				      map->index_path,
-				      MDBOX_GLOBAL_INDEX_PREFIX);
+				      map->index_path, index_prefix);
 	mail_index_set_fsync_mode(map->index,
 		MAP_STORAGE(map)->set->parsed_fsync_mode, 0);
 	mail_index_set_lock_method(map->index,
 		MAP_STORAGE(map)->set->parsed_lock_method,
 		mail_storage_get_lock_timeout(MAP_STORAGE(map), UINT_MAX));
 	map->root_list = root_list;
+	map->root = root_map == NULL ? map : root_map;
+	map->shard_idx = shard_idx;
 	map->map_ext_id = mail_index_ext_register(map->index, "map",
 				sizeof(struct mdbox_map_mail_index_header),
 				sizeof(struct mdbox_map_mail_index_record),
@@ -74,18 +133,25 @@ mdbox_map_init(struct mdbox_storage *storage, struct mailbox_list *root_list)
 
 	map->event = event_create(storage->storage.storage.event);
 	event_drop_parent_log_prefixes(map->event, 1);
-	event_set_append_log_prefix(map->event, t_strdup_printf(
-		"mdbox(%s): ", map->path));
-
+	event_set_append_log_prefix(map->event, shard_idx == 0 ?
+		t_strdup_printf("mdbox(%s): ", map->path) :
+		t_strdup_printf("mdbox(%s, shard %u): ", map->path, shard_idx));
 	return map;
 }
 
-void mdbox_map_deinit(struct mdbox_map **_map)
+struct mdbox_map *
+mdbox_map_init(struct mdbox_storage *storage, struct mailbox_list *root_list)
 {
-	struct mdbox_map *map = *_map;
+	struct mdbox_map *map;
 
-	*_map = NULL;
+	map = mdbox_map_alloc(storage, root_list, NULL, 0);
+	map->shards[0] = map;
+	map->append_shards_count = storage->set->mdbox_map_shards;
+	return map;
+}
 
+static void mdbox_map_free(struct mdbox_map *map)
+{
 	if (map->view != NULL) {
 		mail_index_view_close(&map->view);
 		mail_index_close(map->index);
@@ -97,6 +163,78 @@ void mdbox_map_deinit(struct mdbox_map **_map)
 	i_free(map);
 }
 
+void mdbox_map_deinit(struct mdbox_map **_map)
+{
+	struct mdbox_map *map = *_map;
+	unsigned int i;
+
+	*_map = NULL;
+
+	i_assert(map->root == map);
+	for (i = 1; i < N_ELEMENTS(map->shards); i++) {
+		if (map->shards[i] != NULL)
+			mdbox_map_free(map->shards[i]);
+	}
+	mdbox_map_free(map);
+}
+
+static struct mdbox_map *
+mdbox_map_alloc_shard(struct mdbox_map *map, unsigned int shard_idx)
+{
+	struct mdbox_map *root = map->root;
+
+	i_assert(shard_idx < N_ELEMENTS(root->shards));
+
+	if (root->shards[shard_idx] == NULL) {
+		root->shards[shard_idx] =
+			mdbox_map_alloc(root->storage, root->root_list,
+					root, shard_idx);
+	}
+	return root->shards[shard_idx];
+}
+
+struct mdbox_map *mdbox_map_get_id_shard(struct mdbox_map *map, uint32_t id)
+{
+	if (!mdbox_map_is_sharded(map)) {
+		if ((id >> MDBOX_MAP_SHARD_ID_BITS) == 0)
+			return map->root;
+		/* the ID belongs to a shard, which some other process may
+		   have created after we last checked */
+		mdbox_map_redetect_shards(map->root);
+		if (!mdbox_map_is_sharded(map))
+			return map->root;
+	}
+	return mdbox_map_alloc_shard(map, id >> MDBOX_MAP_SHARD_ID_BITS);
+}
+
+static uint32_t mdbox_map_shard_last_id(struct mdbox_map *map)
+{
+	if (!mdbox_map_is_sharded(map))
+		return (uint32_t)-1;
+	return MDBOX_MAP_SHARD_BASE_ID(map->shard_idx) +
+		((1U << MDBOX_MAP_SHARD_ID_BITS) - 1);
+}
+
+struct mdbox_map *
+mdbox_map_get_shard(struct mdbox_map *map, unsigned int shard_idx)
+{
+	struct mdbox_map *root = map->root;
+
+	i_assert(shard_idx < N_ELEMENTS(root->shards));
+
+	if (shard_idx == 0)
+		return root;
+	if (!mdbox_map_is_sharded(root))
+		return NULL;
+	/* Shards above mdbox_map_shards exist if the setting has been
+	   lowered. Nothing new is appended to them, but their messages are
+	   still looked up, expunged, purged and rebuilt. */
+	if (shard_idx < root->append_shards_count ||
+	    (root->disk_shards & (1U << shard_idx)) != 0)
+		return mdbox_map_alloc_shard(root, shard_idx);
+	return NULL;
+}
+
 static int mdbox_map_mkdir_storage(struct mdbox_map *map)
 {
 	if (mailbox_list_mkdir_root(map->root_list, map->path,
@@ -136,6 +274,33 @@ static void mdbox_map_cleanup(struct mdbox_map *map)
 	}
 }
 
+static int mdbox_map_check_shardable(struct mdbox_map *map)
+{
+	struct mdbox_map_mail_index_header map_hdr;
+	const struct mail_index_header *hdr;
+	uint32_t last_id;
+
+	if (!mdbox_map_is_sharded(map))
+		return 0;
+
+	/* A map that was created without sharding may already have IDs
+	   that belong to the other shards' ranges. They can't be moved, so
+	   refuse to use the map instead of mixing up the shards. */
+	last_id = mdbox_map_shard_last_id(map);
+	hdr = mail_index_get_header(map->view);
+	mdbox_map_get_ext_hdr(map, map->view, &map_hdr);
+	if (hdr->next_uid - 1 > last_id || map_hdr.highest_file_id > last_id) {
+		mail_storage_set_critical(MAP_STORAGE(map),
+			"mdbox map %s can't be sharded: It already has map UIDs "
+			"or file IDs above %u (next_uid=%u, highest_file_id=%u) "
+			"- use mdbox_map_shards=1",
+			map->index->filepath, last_id, hdr->next_uid,
+			map_hdr.highest_file_id);
+		return -1;
+	}
+	return 0;
+}
+
 static int mdbox_map_open_internal(struct mdbox_map *map, bool create_missing)
 {
 	enum mail_index_open_flags open_flags;
@@ -146,6 +311,13 @@ static int mdbox_map_open_internal(struct mdbox_map *map, bool create_missing)
 		/* already opened */
 		return 1;
 	}
+	if (map->root != map) {
+		/* the root map is checked to be shardable before any of the
+		   other shards are created */
+		ret = mdbox_map_open_internal(map->root, create_missing);
+		if (ret <= 0)
+			return ret;
+	}
 
 	mailbox_list_get_root_permissions(map->root_list, &perm);
 	mail_index_set_permissions(map->index, perm.file_create_mode,
@@ -192,11 +364,16 @@ static int mdbox_map_open_internal(struct mdbox_map *map, bool create_missing)
 			mail_index_close(map->index);
 			return -1;
 		}
-		if (mdbox_map_refresh(map) < 0) {
+		if (mdbox_map_refresh_shard(map) < 0) {
 			mail_index_close(map->index);
 			return -1;
 		}
 	}
+	if (map->root == map && mdbox_map_check_shardable(map) < 0) {
+		mail_index_view_close(&map->view);
+		mail_index_close(map->index);
+		return -1;
+	}
 	return 1;
 }
 
@@ -210,7 +387,7 @@ int mdbox_map_open_or_create(struct mdbox_map *map)
 	return mdbox_map_open_internal(map, TRUE) <= 0 ? -1 : 0;
 }
 
-int mdbox_map_refresh(struct mdbox_map *map)
+static int mdbox_map_refresh_shard(struct mdbox_map *map)
 {
 	struct mail_index_view_sync_ctx *ctx;
 	bool delayed_expunges, fscked;
@@ -242,17 +419,40 @@ int mdbox_map_refresh(struct mdbox_map *map)
 	return ret;
 }
 
+int mdbox_map_refresh(struct mdbox_map *map)
+{
+	struct mdbox_map *root = map->root;
+	unsigned int i;
+	int ret = 0;
+
+	if (!mdbox_map_is_sharded(root))
+		return mdbox_map_refresh_shard(root);
+
+	/* refresh all the opened shards */
+	for (i = 0; i < N_ELEMENTS(root->shards); i++) {
+		if (root->shards[i] != NULL && root->shards[i]->view != NULL &&
+		    mdbox_map_refresh_shard(root->shards[i]) < 0)
+			ret = -1;
+	}
+	return ret;
+}
+
 bool mdbox_map_is_fscked(struct mdbox_map *map)
 {
+	struct mdbox_map *root = map->root;
 	const struct mail_index_header *hdr;
+	unsigned int i;
 
-	if (map->view == NULL) {
-		/* map isn't opened yet. don't bother. */
-		return FALSE;
+	for (i = 0; i < N_ELEMENTS(root->shards); i++) {
+		if (root->shards[i] == NULL || root->shards[i]->view == NULL) {
+			/* map isn't opened yet. don't bother. */
+			continue;
+		}
+		hdr = mail_index_get_header(root->shards[i]->view);
+		if ((hdr->flags & MAIL_INDEX_HDR_FLAG_FSCKD) != 0)
+			return TRUE;
 	}
-
-	hdr = mail_index_get_header(map->view);
-	return (hdr->flags & MAIL_INDEX_HDR_FLAG_FSCKD) != 0;
+	return FALSE;
 }
 
 static void
@@ -300,7 +500,7 @@ mdbox_map_get_seq(struct mdbox_map *map, uint32_t map_uid, uint32_t *seq_r)
 {
 	if (!mail_index_lookup_seq(map->view, map_uid, seq_r)) {
 		/* not found - try again after a refresh */
-		if (mdbox_map_refresh(map) < 0)
+		if (mdbox_map_refresh_shard(map) < 0)
 			return -1;
 		if (!mail_index_lookup_seq(map->view, map_uid, seq_r))
 			return 0;
@@ -315,6 +515,7 @@ int mdbox_map_lookup(struct mdbox_map *map, uint32_t map_uid,
 	uint32_t seq;
 	int ret;
 
+	map = mdbox_map_get_id_shard(map, map_uid);
 	if (mdbox_map_open_or_create(map) < 0)
 		return -1;
 
@@ -335,6 +536,7 @@ int mdbox_map_lookup_full(struct mdbox_map *map, uint32_t map_uid,
 	uint32_t seq;
 	int ret;
 
+	map = mdbox_map_get_id_shard(map, map_uid);
 	if (mdbox_map_open_or_create(map) < 0)
 		return -1;
 
@@ -414,7 +616,8 @@ int mdbox_map_get_file_msgs(struct mdbox_map *map, uint32_t file_id,
 	struct mdbox_map_file_msg msg;
 	uint32_t seq;
 
-	if (mdbox_map_refresh(map) < 0)
+	map = mdbox_map_get_id_shard(map, file_id);
+	if (mdbox_map_refresh_shard(map) < 0)
 		return -1;
 	hdr = mail_index_get_header(map->view);
 
@@ -433,23 +636,40 @@ int mdbox_map_get_file_msgs(struct mdbox_map *map, uint32_t file_id,
 	return 0;
 }
 
-int mdbox_map_get_zero_ref_files(struct mdbox_map *map,
-				 ARRAY_TYPE(seq_range) *file_ids_r)
+static int
+mdbox_map_zero_ref_file_cmp(const struct mdbox_map_zero_ref_file *f1,
+			    const struct mdbox_map_zero_ref_file *f2)
+{
+	/* compare zero_ref_size/total_size ratios without dividing */
+	uintmax_t r1 = (uintmax_t)f1->zero_ref_size * f2->total_size;
+	uintmax_t r2 = (uintmax_t)f2->zero_ref_size * f1->total_size;
+
+	if (r1 > r2)
+		return -1;
+	if (r1 < r2)
+		return 1;
+	if (f1->file_id < f2->file_id)
+		return -1;
+	if (f1->file_id > f2->file_id)
+		return 1;
+	return 0;
+}
+
+static void
+mdbox_map_shard_get_zero_ref_files(struct mdbox_map *map,
+				   ARRAY_TYPE(mdbox_map_zero_ref_file) *files_r)
 {
 	const struct mail_index_header *hdr;
 	const struct mdbox_map_mail_index_record *rec;
+	struct mdbox_map_zero_ref_file *file;
 	const uint16_t *ref16_p;
 	const void *data;
 	uint32_t seq;
-	bool expunged;
-	int ret;
+	bool expunged, zero_ref;
 
-	if ((ret = mdbox_map_open(map)) <= 0) {
-		/* no map / internal error */
-		return ret;
-	}
-	if (mdbox_map_refresh(map) < 0)
-		return -1;
+	/* file_id => files_r index + 1 */
+	HASH_TABLE(void *, void *) file_idx;
+	hash_table_create_direct(&file_idx, default_pool, 0);
 
 	hdr = mail_index_get_header(map->view);
 	for (seq = 1; seq <= hdr->messages_count; seq++) {
@@ -457,17 +677,74 @@ int mdbox_map_get_zero_ref_files(struct mdbox_map *map,
 				      &data, &expunged);
 		if (data != NULL && !expunged) {
 			ref16_p = data;
-			if (*ref16_p != 0)
-				continue;
+			zero_ref = *ref16_p == 0;
+		} else {
+			zero_ref = TRUE;
 		}
 
 		mail_index_lookup_ext(map->view, seq, map->map_ext_id,
 				      &data, &expunged);
-		if (data != NULL && !expunged) {
-			rec = data;
-			seq_range_array_add(file_ids_r, rec->file_id);
+		if (data == NULL || expunged)
+			continue;
+		rec = data;
+
+		unsigned int idx = POINTER_CAST_TO(
+			hash_table_lookup(file_idx, POINTER_CAST(rec->file_id)),
+			unsigned int);
+		if (idx == 0) {
+			file = array_append_space(files_r);
+			file->file_id = rec->file_id;
+			hash_table_insert(file_idx, POINTER_CAST(rec->file_id),
+					  POINTER_CAST(array_count(files_r)));
+		} else {
+			file = array_idx_modifiable(files_r, idx - 1);
 		}
+		file->total_size += rec->size;
+		if (zero_ref) {
+			file->zero_ref_count++;
+			file->zero_ref_size += rec->size;
+		}
+	}
+	hash_table_destroy(&file_idx);
+}
+
+int mdbox_map_get_zero_ref_files(struct mdbox_map *map,
+				 ARRAY_TYPE(mdbox_map_zero_ref_file) *files_r)
+{
+	struct mdbox_map *shard;
+	unsigned int shard_idx;
+	int ret;
+
+	if ((ret = mdbox_map_open(map)) <= 0) {
+		/* no map / internal error */
+		return ret;
 	}
+
+	/* each file belongs to a single shard */
+	for (shard_idx = 0; shard_idx < MDBOX_MAP_MAX_SHARDS; shard_idx++) {
+		shard = mdbox_map_get_shard(map, shard_idx);
+		if (shard == NULL)
+			continue;
+		if ((ret = mdbox_map_open(shard)) < 0)
+			return -1;
+		if (ret == 0)
+			continue;
+		if (mdbox_map_refresh_shard(shard) < 0)
+			return -1;
+		mdbox_map_shard_get_zero_ref_files(shard, files_r);
+	}
+
+	/* drop the files that have nothing to purge */
+	struct mdbox_map_zero_ref_file *files;
+	unsigned int i, count, dest = 0;
+
+	files = array_get_modifiable(files_r, &count);
+	for (i = 0; i < count; i++) {
+		if (files[i].zero_ref_count > 0)
+			files[dest++] = files[i];
+	}
+	array_delete(files_r, dest, count - dest);
+	array_sort(files_r, mdbox_map_zero_ref_file_cmp);
 	return 0;
 }
 
@@ -476,10 +753,29 @@ struct mdbox_map_atomic_context *mdbox_map_atomic_begin(struct mdbox_map *map)
 	struct mdbox_map_atomic_context *atomic;
 
 	atomic = i_new(struct mdbox_map_atomic_context, 1);
-	atomic->map = map;
+	atomic->map = map->root;
+	atomic->root = atomic;
+	atomic->shards[0] = atomic;
 	return atomic;
 }
 
+struct mdbox_map_atomic_context *
+mdbox_map_atomic_get_shard(struct mdbox_map_atomic_context *atomic,
+			   struct mdbox_map *shard)
+{
+	struct mdbox_map_atomic_context *root = atomic->root;
+
+	i_assert(shard->root == root->map);
+
+	if (root->shards[shard->shard_idx] == NULL) {
+		atomic = i_new(struct mdbox_map_atomic_context, 1);
+		atomic->map = shard;
+		atomic->root = root;
+		root->shards[shard->shard_idx] = atomic;
+	}
+	return root->shards[shard->shard_idx];
+}
+
 static void
 mdbox_map_sync_handle(struct mdbox_map *map,
 		      struct mail_index_sync_ctx *sync_ctx)
@@ -500,8 +796,8 @@ mdbox_map_sync_handle(struct mdbox_map *map,
 	while (mail_index_sync_next(sync_ctx, &sync_rec)) ;
 }
 
-int mdbox_map_atomic_lock(struct mdbox_map_atomic_context *atomic,
-			  const char *reason)
+int mdbox_map_atomic_lock_shard(struct mdbox_map_atomic_context *atomic,
+				const char *reason)
 {
 	int ret;
 
@@ -533,39 +829,150 @@ int mdbox_map_atomic_lock(struct mdbox_map_atomic_context *atomic,
 	return 0;
 }
 
+static void mdbox_map_atomic_unlock_shard(struct mdbox_map_atomic_context *atomic)
+{
+	mail_index_sync_rollback(&atomic->sync_ctx);
+	atomic->sync_view = NULL;
+	atomic->sync_trans = NULL;
+	atomic->locked = FALSE;
+	atomic->map_refreshed = FALSE;
+}
+
+static uint32_t
+mdbox_map_atomic_get_locked_shards(struct mdbox_map_atomic_context *root)
+{
+	uint32_t locked_shards = 0;
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(root->shards); i++) {
+		if (root->shards[i] != NULL && root->shards[i]->locked)
+			locked_shards |= 1U << i;
+	}
+	return locked_shards;
+}
+
+static int
+mdbox_map_atomic_lock_shards(struct mdbox_map_atomic_context *atomic,
+			     uint32_t want_shards, const char *reason)
+{
+	struct mdbox_map_atomic_context *root = atomic->root;
+	struct mdbox_map_atomic_context *shard_atomic;
+	uint32_t locked_shards, missing_shards;
+	unsigned int i;
+
+	root->want_shards |= want_shards;
+	if (root->want_shards == 0)
+		root->want_shards = 1;
+
+	locked_shards = mdbox_map_atomic_get_locked_shards(root);
+	missing_shards = root->want_shards & ~locked_shards;
+	if (missing_shards == 0)
+		return 0;
+
+	/* The shards are always locked in ascending order, so processes
+	   locking multiple shards can't deadlock each other. If a shard
+	   below an already locked one is needed, unlock the shards first
+	   unless something was already written to them. */
+	if ((missing_shards & -missing_shards) < locked_shards &&
+	    !root->changed) {
+		for (i = 0; i < N_ELEMENTS(root->shards); i++) {
+			if ((locked_shards & (1U << i)) != 0)
+				mdbox_map_atomic_unlock_shard(root->shards[i]);
+		}
+	}
+
+	for (i = 0; i < N_ELEMENTS(root->shards); i++) {
+		if ((root->want_shards & (1U << i)) == 0)
+			continue;
+		shard_atomic = mdbox_map_atomic_get_shard(root,
+			mdbox_map_alloc_shard(root->map, i));
+		if (mdbox_map_atomic_lock_shard(shard_atomic, reason) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int mdbox_map_atomic_lock(struct mdbox_map_atomic_context *atomic,
+			  const char *reason)
+{
+	return mdbox_map_atomic_lock_shards(atomic, 0, reason);
+}
+
+static uint32_t mdbox_map_get_existing_shards(struct mdbox_map *map)
+{
+	uint32_t shards = 0;
+	unsigned int i;
+
+	mdbox_map_redetect_shards(map->root);
+	for (i = 0; i < MDBOX_MAP_MAX_SHARDS; i++) {
+		if (mdbox_map_get_shard(map, i) != NULL)
+			shards |= 1U << i;
+	}
+	return shards;
+}
+
+int mdbox_map_atomic_lock_all(struct mdbox_map_atomic_context *atomic,
+			      const char *reason)
+{
+	return mdbox_map_atomic_lock_shards(atomic,
+		mdbox_map_get_existing_shards(atomic->map), reason);
+}
+
+void mdbox_map_atomic_want_id(struct mdbox_map_atomic_context *atomic,
+			      uint32_t id)
+{
+	struct mdbox_map *shard = mdbox_map_get_id_shard(atomic->map, id);
+
+	atomic->root->want_shards |= 1U << shard->shard_idx;
+}
+
 bool mdbox_map_atomic_is_locked(struct mdbox_map_atomic_context *atomic)
 {
-	return atomic->locked;
+	return mdbox_map_atomic_get_locked_shards(atomic->root) != 0;
+}
+
+bool mdbox_map_atomic_is_locked_all(struct mdbox_map_atomic_context *atomic)
+{
+	uint32_t existing_shards =
+		mdbox_map_get_existing_shards(atomic->map);
+
+	return (mdbox_map_atomic_get_locked_shards(atomic->root) &
+		existing_shards) == existing_shards;
 }
 
 void mdbox_map_atomic_set_failed(struct mdbox_map_atomic_context *atomic)
 {
-	atomic->success = FALSE;
-	atomic->failed = TRUE;
+	atomic->root->success = FALSE;
+	atomic->root->failed = TRUE;
 }
 
 void mdbox_map_atomic_set_success(struct mdbox_map_atomic_context *atomic)
 {
-	if (!atomic->failed)
-		atomic->success = TRUE;
+	if (!atomic->root->failed)
+		atomic->root->success = TRUE;
 }
 
 void mdbox_map_atomic_unset_fscked(struct mdbox_map_atomic_context *atomic)
 {
-	mail_index_unset_fscked(atomic->sync_trans);
+	struct mdbox_map_atomic_context *root = atomic->root;
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(root->shards); i++) {
+		if (root->shards[i] != NULL && root->shards[i]->locked)
+			mail_index_unset_fscked(root->shards[i]->sync_trans);
+	}
 }
 
-int mdbox_map_atomic_finish(struct mdbox_map_atomic_context **_atomic)
+static int
+mdbox_map_atomic_finish_shard(struct mdbox_map_atomic_context *atomic,
+			      bool success)
 {
-	struct mdbox_map_atomic_context *atomic = *_atomic;
 	int ret = 0;
 
-	*_atomic = NULL;
-
 	if (atomic->sync_ctx == NULL) {
 		/* not locked */
 		i_assert(!atomic->locked);
-	} else if (atomic->success) {
+	} else if (success) {
 		if (mail_index_sync_commit(&atomic->sync_ctx) < 0) {
 			mail_storage_set_index_error(MAP_STORAGE(atomic->map),
 						     atomic->map->index);
@@ -574,6 +981,28 @@ int mdbox_map_atomic_finish(struct mdbox_map_atomic_context **_atomic)
 	} else {
 		mail_index_sync_rollback(&atomic->sync_ctx);
 	}
+	return ret;
+}
+
+int mdbox_map_atomic_finish(struct mdbox_map_atomic_context **_atomic)
+{
+	struct mdbox_map_atomic_context *atomic = *_atomic;
+	unsigned int i;
+	int ret = 0;
+
+	*_atomic = NULL;
+
+	i_assert(atomic->root == atomic);
+	for (i = N_ELEMENTS(atomic->shards); i > 1; i--) {
+		if (atomic->shards[i-1] == NULL)
+			continue;
+		if (mdbox_map_atomic_finish_shard(atomic->shards[i-1],
+						  atomic->success) < 0)
+			ret = -1;
+		i_free(atomic->shards[i-1]);
+	}
+	if (mdbox_map_atomic_finish_shard(atomic, atomic->success) < 0)
+		ret = -1;
 	i_free(atomic);
 	return ret;
 }
@@ -583,47 +1012,72 @@ mdbox_map_transaction_begin(struct mdbox_map_atomic_context *atomic,
 			    bool external)
 {
 	struct mdbox_map_transaction_context *ctx;
-	enum mail_index_transaction_flags flags =
-		MAIL_INDEX_TRANSACTION_FLAG_FSYNC;
-	bool success;
 
+	ctx = i_new(struct mdbox_map_transaction_context, 1);
+	ctx->atomic = atomic->root;
+	ctx->flags = MAIL_INDEX_TRANSACTION_FLAG_FSYNC;
 	if (external)
-		flags |= MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL;
+		ctx->flags |= MAIL_INDEX_TRANSACTION_FLAG_EXTERNAL;
+	return ctx;
+}
+
+static struct mail_index_transaction *
+mdbox_map_transaction_get_trans(struct mdbox_map_transaction_context *ctx,
+				struct mdbox_map *map)
+{
+	struct mdbox_map_atomic_context *atomic =
+		mdbox_map_atomic_get_shard(ctx->atomic, map);
+	bool success;
+	int ret;
+
+	if (ctx->trans[map->shard_idx] != NULL)
+		return ctx->trans[map->shard_idx];
 
-	ctx = i_new(struct mdbox_map_transaction_context, 1);
-	ctx->atomic = atomic;
 	if (atomic->locked && atomic->map_refreshed) {
 		/* already refreshed within a lock, don't do it again */
 		success = TRUE;
+	} else if ((ret = mdbox_map_open(map)) <= 0) {
+		if (ret == 0)
+			mdbox_map_set_corrupted(map, "map index is missing");
+		success = FALSE;
 	} else {
-		success = mdbox_map_open(atomic->map) > 0 &&
-			mdbox_map_refresh(atomic->map) == 0;
+		success = mdbox_map_refresh_shard(map) == 0;
 	}
 
 	if (success) {
 		atomic->map_refreshed = TRUE;
-		ctx->trans = mail_index_transaction_begin(atomic->map->view,
-							  flags);
+		ctx->trans[map->shard_idx] =
+			mail_index_transaction_begin(map->view, ctx->flags);
 	}
-	return ctx;
+	return ctx->trans[map->shard_idx];
 }
 
 int mdbox_map_transaction_commit(struct mdbox_map_transaction_context *ctx,
 				 const char *reason)
 {
+	struct mdbox_map *map;
+	unsigned int i;
+
 	i_assert(!ctx->committed);
 
 	ctx->committed = TRUE;
-	if (!ctx->changed)
+	if (ctx->changed_shards == 0)
 		return 0;
 
-	if (mdbox_map_atomic_lock(ctx->atomic, reason) < 0)
+	if (mdbox_map_atomic_lock_shards(ctx->atomic, ctx->changed_shards,
+					 reason) < 0)
 		return -1;
 
-	if (mail_index_transaction_commit(&ctx->trans) < 0) {
-		mail_storage_set_index_error(MAP_STORAGE(ctx->atomic->map),
-					     ctx->atomic->map->index);
-		return -1;
+	for (i = 0; i < N_ELEMENTS(ctx->trans); i++) {
+		if ((ctx->changed_shards & (1U << i)) == 0)
+			continue;
+		map = mdbox_map_alloc_shard(ctx->atomic->map, i);
+		if (mail_index_transaction_commit(&ctx->trans[i]) < 0) {
+			mail_storage_set_index_error(MAP_STORAGE(map),
+						     map->index);
+			return -1;
+		}
+		ctx->atomic->changed = TRUE;
 	}
 	mdbox_map_atomic_set_success(ctx->atomic);
 	return 0;
@@ -632,23 +1086,29 @@ int mdbox_map_transaction_commit(struct mdbox_map_transaction_context *ctx,
 void mdbox_map_transaction_free(struct mdbox_map_transaction_context **_ctx)
 {
 	struct mdbox_map_transaction_context *ctx = *_ctx;
+	unsigned int i;
 
 	*_ctx = NULL;
 
-	if (ctx->trans != NULL)
-		mail_index_transaction_rollback(&ctx->trans);
+	for (i = 0; i < N_ELEMENTS(ctx->trans); i++) {
+		if (ctx->trans[i] != NULL)
+			mail_index_transaction_rollback(&ctx->trans[i]);
+	}
 	i_free(ctx);
 }
 
 int mdbox_map_update_refcount(struct mdbox_map_transaction_context *ctx,
 			      uint32_t map_uid, int diff)
 {
-	struct mdbox_map *map = ctx->atomic->map;
+	struct mdbox_map *map =
+		mdbox_map_get_id_shard(ctx->atomic->map, map_uid);
+	struct mail_index_transaction *trans;
 	const void *data;
 	uint32_t seq;
 	int old_diff, new_diff;
 
-	if (unlikely(ctx->trans == NULL))
+	trans = mdbox_map_transaction_get_trans(ctx, map);
+	if (unlikely(trans == NULL))
 		return -1;
 
 	if (!mail_index_lookup_seq(map->view, map_uid, &seq)) {
@@ -666,8 +1126,8 @@ int mdbox_map_update_refcount(struct mdbox_map_transaction_context *ctx,
 	}
 	mail_index_lookup_ext(map->view, seq, map->ref_ext_id, &data, NULL);
 	old_diff = data == NULL ? 0 : *((const uint16_t *)data);
-	ctx->changed = TRUE;
-	new_diff = mail_index_atomic_inc_ext(ctx->trans, seq,
+	ctx->changed_shards |= 1U << map->shard_idx;
+	new_diff = mail_index_atomic_inc_ext(trans, seq,
 					     map->ref_ext_id, diff);
 	if (old_diff + new_diff < 0) {
 		mdbox_map_set_corrupted(map, "map_uid=%u refcount too low",
@@ -692,9 +1152,6 @@ int mdbox_map_update_refcounts(struct mdbox_map_transaction_context *ctx,
 	const uint32_t *uidp;
 	unsigned int i, count;
 
-	if (unlikely(ctx->trans == NULL))
-		return -1;
-
 	count = array_count(map_uids);
 	for (i = 0; i < count; i++) {
 		uidp = array_idx(map_uids, i);
@@ -708,6 +1165,7 @@ int mdbox_map_remove_file_id(struct mdbox_map *map, uint32_t file_id)
 {
 	struct mdbox_map_atomic_context *atomic;
 	struct mdbox_map_transaction_context *map_trans;
+	struct mail_index_transaction *trans;
 	const struct mail_index_header *hdr;
 	const struct mdbox_map_mail_index_record *rec;
 	const void *data;
@@ -718,11 +1176,15 @@ int mdbox_map_remove_file_id(struct mdbox_map *map, uint32_t file_id)
 	   messages that have already been moved to other files. */
 
 	/* we need a per-file transaction, otherwise we can't refresh the map */
-	atomic = mdbox_map_atomic_begin(map);
+	map = mdbox_map_get_id_shard(map, file_id);
+	atomic = mdbox_map_atomic_begin(map->root);
 	map_trans = mdbox_map_transaction_begin(atomic, TRUE);
+	trans = mdbox_map_transaction_get_trans(map_trans, map);
+	if (trans == NULL)
+		ret = -1;
 
-	hdr = mail_index_get_header(map->view);
-	for (seq = 1; seq <= hdr->messages_count; seq++) {
+	hdr = ret < 0 ? NULL : mail_index_get_header(map->view);
+	for (seq = 1; ret == 0 && seq <= hdr->messages_count; seq++) {
 		mail_index_lookup_ext(map->view, seq, map->map_ext_id,
 				      &data, NULL);
 		if (data == NULL) {
@@ -733,8 +1195,8 @@ int mdbox_map_remove_file_id(struct mdbox_map *map, uint32_t file_id)
 
 		rec = data;
 		if (rec->file_id == file_id) {
-			map_trans->changed = TRUE;
-			mail_index_expunge(map_trans->trans, seq);
+			map_trans->changed_shards |= 1U << map->shard_idx;
+			mail_index_expunge(trans, seq);
 		}
 	}
 	if (ret == 0)
@@ -745,32 +1207,64 @@ int mdbox_map_remove_file_id(struct mdbox_map *map, uint32_t file_id)
 	return ret;
 }
 
-struct mdbox_map_append_context *
-mdbox_map_append_begin(struct mdbox_map_atomic_context *atomic)
+static struct mdbox_map *mdbox_map_get_append_shard(struct mdbox_map *map)
+{
+	struct mdbox_map *root = map->root;
+	unsigned int shard_idx;
+
+	if (!mdbox_map_is_sharded(root))
+		return root;
+
+	/* Spread the appends of concurrent processes to different shards,
+	   so they rarely need to wait for each others' map locks. */
+	shard_idx = ((unsigned int)getpid() + root->append_counter++) %
+		root->append_shards_count;
+	return mdbox_map_alloc_shard(root, shard_idx);
+}
+
+static struct mdbox_map_append_context *
+mdbox_map_append_begin_shard(struct mdbox_map_atomic_context *atomic,
+			     struct mdbox_map *map)
 {
 	struct mdbox_map_append_context *ctx;
 
 	ctx = i_new(struct mdbox_map_append_context, 1);
-	ctx->atomic = atomic;
-	ctx->map = atomic->map;
+	ctx->atomic = mdbox_map_atomic_get_shard(atomic, map);
+	ctx->map = map;
 	ctx->first_new_file_id = (uint32_t)-1;
 	i_array_init(&ctx->file_appends, 64);
 	i_array_init(&ctx->files, 64);
 	i_array_init(&ctx->appends, 128);
+	atomic->root->want_shards |= 1U << map->shard_idx;
 
-	if (mdbox_map_open_or_create(atomic->map) < 0)
+	if (mdbox_map_open_or_create(map) < 0)
 		ctx->failed = TRUE;
 	else {
 		/* refresh the map so we can try appending to the
 		   latest files */
-		if (mdbox_map_refresh(atomic->map) == 0)
-			atomic->map_refreshed = TRUE;
+		if (mdbox_map_refresh_shard(map) == 0)
+			ctx->atomic->map_refreshed = TRUE;
 		else
 			ctx->failed = TRUE;
 	}
 	return ctx;
 }
 
+struct mdbox_map_append_context *
+mdbox_map_append_begin(struct mdbox_map_atomic_context *atomic)
+{
+	return mdbox_map_append_begin_shard(atomic,
+		mdbox_map_get_append_shard(atomic->map));
+}
+
+struct mdbox_map_append_context *
+mdbox_map_append_begin_file_shard(struct mdbox_map_atomic_context *atomic,
+				  uint32_t file_id)
+{
+	return mdbox_map_append_begin_shard(atomic,
+		mdbox_map_get_id_shard(atomic->map, file_id));
+}
+
 static time_t day_begin_stamp(unsigned int interval)
 {
 	struct tm tm;
@@ -1209,7 +1703,8 @@ mdbox_find_highest_file_id(struct mdbox_map *map, uint32_t *file_id_r)
 	}
 	while ((d = readdir(dir)) != NULL) {
 		if (strncmp(d->d_name, MDBOX_MAIL_FILE_PREFIX, prefix_len) == 0 &&
-		    str_to_uint(d->d_name + prefix_len, &id) == 0) {
+		    str_to_uint(d->d_name + prefix_len, &id) == 0 &&
+		    mdbox_map_get_id_shard(map, id) == map) {
 			if (highest_id < id)
 				highest_id = id;
 		}
@@ -1231,11 +1726,14 @@ mdbox_map_assign_file_ids(struct mdbox_map_append_context *ctx,
 
 	/* start the syncing. we'll need it even if there are no file ids to
 	   be assigned. */
-	if (mdbox_map_atomic_lock(ctx->atomic, reason) < 0)
+	if (mdbox_map_atomic_lock_shards(ctx->atomic,
+					 1U << ctx->map->shard_idx, reason) < 0)
 		return -1;
 
 	mdbox_map_get_ext_hdr(ctx->map, ctx->atomic->sync_view, &hdr);
 	file_id = hdr.highest_file_id + 1;
+	if (file_id <= MDBOX_MAP_SHARD_BASE_ID(ctx->map->shard_idx))
+		file_id = MDBOX_MAP_SHARD_BASE_ID(ctx->map->shard_idx) + 1;
 
 	if (ctx->map->verify_existing_file_ids) {
 		/* storage/ directory had been already created but
@@ -1259,6 +1757,13 @@ mdbox_map_assign_file_ids(struct mdbox_map_append_context *ctx,
 			return -1;
 
 		if (mfile->file_id == 0) {
+			if (file_id > mdbox_map_shard_last_id(ctx->map) ||
+			    file_id == 0) {
+				mail_storage_set_critical(MAP_STORAGE(ctx->map),
+					"mdbox map shard %u is full",
+					ctx->map->shard_idx);
+				return -1;
+			}
 			if (mdbox_file_assign_file_id(mfile, file_id++) < 0)
 				return -1;
 		}
@@ -1275,6 +1780,8 @@ mdbox_map_assign_file_ids(struct mdbox_map_append_context *ctx,
 					     ctx->atomic->sync_trans,
 					     ctx->map->map_ext_id,
 					     0, &file_id, sizeof(file_id));
+		if (ctx->trans == NULL)
+			ctx->atomic->root->changed = TRUE;
 	}
 	return 0;
 }
@@ -1289,7 +1796,7 @@ int mdbox_map_append_assign_map_uids(struct mdbox_map_append_context *ctx,
 	unsigned int i, count;
 	ARRAY_TYPE(seq_range) uids;
 	const struct seq_range *range;
-	uint32_t seq;
+	uint32_t seq, next_uid;
 	uint16_t ref16;
 	int ret = 0;
 
@@ -1326,8 +1833,16 @@ int mdbox_map_append_assign_map_uids(struct mdbox_map_append_context *ctx,
 
 	/* assign map UIDs for appended records */
 	hdr = mail_index_get_header(ctx->atomic->sync_view);
+	next_uid = I_MAX(hdr->next_uid,
+			 MDBOX_MAP_SHARD_BASE_ID(ctx->map->shard_idx) + 1);
+	if (next_uid - 1 + count > mdbox_map_shard_last_id(ctx->map) ||
+	    next_uid - 1 + count < next_uid - 1) {
+		mail_storage_set_critical(MAP_STORAGE(ctx->map),
+			"mdbox map shard %u is full", ctx->map->shard_idx);
+		return -1;
+	}
 	t_array_init(&uids, 1);
-	mail_index_append_finish_uids(ctx->trans, hdr->next_uid, &uids);
+	mail_index_append_finish_uids(ctx->trans, next_uid, &uids);
 	range = array_front(&uids);
 	i_assert(range[0].seq2 - range[0].seq1 + 1 == count);
 
@@ -1344,6 +1859,7 @@ int mdbox_map_append_assign_map_uids(struct mdbox_map_append_context *ctx,
 					     ctx->map->index);
 		return -1;
 	}
+	ctx->atomic->root->changed = TRUE;
 
 	*first_map_uid_r = range[0].seq1;
 	*last_map_uid_r = range[0].seq2;
@@ -1368,7 +1884,9 @@ int mdbox_map_append_move(struct mdbox_map_append_context *ctx,
 	i_zero(&rec);
 	appends = array_get(&ctx->appends, &appends_count);
 
-	next_uid = mail_index_get_header(ctx->atomic->sync_view)->next_uid;
+	next_uid = I_MAX(mail_index_get_header(ctx->atomic->sync_view)->next_uid,
+			 MDBOX_MAP_SHARD_BASE_ID(ctx->map->shard_idx) + 1);
+	ctx->atomic->root->changed = TRUE;
 	uids = array_get(map_uids, &map_uids_count);
 	for (i = j = 0; i < map_uids_count; i++) {
 		struct mdbox_file *mfile =
@@ -1500,6 +2018,7 @@ uint32_t mdbox_map_get_uid_validity(struct mdbox_map *map)
 {
 	uint32_t uid_validity;
 
+	map = map->root;
 	i_assert(map->view != NULL);
 
 	uid_validity = mail_index_get_header(map->view)->uid_validity;
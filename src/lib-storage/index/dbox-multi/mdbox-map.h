@@ -2,6 +2,14 @@
 #define MDBOX_MAP_H
 
 #include "seq-range-array.h"
+#include "mdbox-settings.h"
+
+/* Map UIDs and file IDs of a sharded map have the shard index in their
+   highest bits, which leaves room for MDBOX_MAP_MAX_SHARDS shards. The
+   shard's first ID is MDBOX_MAP_SHARD_BASE_ID() + 1. */
+#define MDBOX_MAP_SHARD_ID_BITS 28
+#define MDBOX_MAP_SHARD_BASE_ID(shard_idx) \
+	((uint32_t)(shard_idx) << MDBOX_MAP_SHARD_ID_BITS)
 
 struct dbox_file_append_context;
 struct mdbox_map_append_context;
@@ -30,10 +38,26 @@ struct mdbox_map_file_msg {
 };
 ARRAY_DEFINE_TYPE(mdbox_map_file_msg, struct mdbox_map_file_msg);
 
+struct mdbox_map_zero_ref_file {
+	uint32_t file_id;
+	unsigned int zero_ref_count;
+	/* total size of the zero refcount messages in the file */
+	uoff_t zero_ref_size;
+	/* total size of all the messages in the file */
+	uoff_t total_size;
+};
+ARRAY_DEFINE_TYPE(mdbox_map_zero_ref_file, struct mdbox_map_zero_ref_file);
+
 struct mdbox_map *
 mdbox_map_init(struct mdbox_storage *storage, struct mailbox_list *root_list);
 void mdbox_map_deinit(struct mdbox_map **map);
 
+/* Returns the map shard with the given index, or NULL if the map isn't
+   sharded or the shard is above mdbox_map_shards and doesn't exist. Shard 0
+   is always the map itself. The shard isn't necessarily opened yet. */
+struct mdbox_map *
+mdbox_map_get_shard(struct mdbox_map *map, unsigned int shard_idx);
+
 /* Open the map. Returns 1 if ok, 0 if map doesn't exist, -1 if error. */
 int mdbox_map_open(struct mdbox_map *map);
 /* Open or create the map. This is done automatically for most operations.
@@ -71,11 +95,22 @@ int mdbox_map_get_file_msgs(struct mdbox_map *map, uint32_t file_id,
 /* Begin atomic context. There can be multiple transactions/appends within the
    same atomic context. */
 struct mdbox_map_atomic_context *mdbox_map_atomic_begin(struct mdbox_map *map);
-/* Lock the map immediately. */
+/* Lock the map immediately. With a sharded map this locks only the shards
+   that are used by the appends and transactions within this atomic context
+   and the shards given to mdbox_map_atomic_want_id(). */
 int mdbox_map_atomic_lock(struct mdbox_map_atomic_context *atomic,
 			  const char *reason);
-/* Returns TRUE if map is locked */
+/* Like mdbox_map_atomic_lock(), but lock all the map shards. This is needed
+   when the map UIDs that are going to be changed aren't known yet. */
+int mdbox_map_atomic_lock_all(struct mdbox_map_atomic_context *atomic,
+			      const char *reason);
+/* Lock also the shard of this map UID or file ID when the map is locked. */
+void mdbox_map_atomic_want_id(struct mdbox_map_atomic_context *atomic,
+			      uint32_t id);
+/* Returns TRUE if map (or any of its shards) is locked */
 bool mdbox_map_atomic_is_locked(struct mdbox_map_atomic_context *atomic);
+/* Returns TRUE if all the existing map shards are locked */
+bool mdbox_map_atomic_is_locked_all(struct mdbox_map_atomic_context *atomic);
 /* When finish() is called, rollback the changes. If data was already written
    to map's transaction log, this desyncs the map and causes a rebuild */
 void mdbox_map_atomic_set_failed(struct mdbox_map_atomic_context *atomic);
@@ -103,12 +138,19 @@ int mdbox_map_update_refcounts(struct mdbox_map_transaction_context *ctx,
 			       const ARRAY_TYPE(uint32_t) *map_uids, int diff);
 int mdbox_map_remove_file_id(struct mdbox_map *map, uint32_t file_id);
 
-/* Return all files containing messages with zero refcount. */
+/* Return all files containing messages with zero refcount. The files are
+   sorted so that the files with the largest portion of reclaimable space
+   are first. */
 int mdbox_map_get_zero_ref_files(struct mdbox_map *map,
-				 ARRAY_TYPE(seq_range) *file_ids_r);
+				 ARRAY_TYPE(mdbox_map_zero_ref_file) *files_r);
 
 struct mdbox_map_append_context *
 mdbox_map_append_begin(struct mdbox_map_atomic_context *atomic);
+/* Like mdbox_map_append_begin(), but append to the same map shard where the
+   given file is. Used when moving the file's messages to new files. */
+struct mdbox_map_append_context *
+mdbox_map_append_begin_file_shard(struct mdbox_map_atomic_context *atomic,
+				  uint32_t file_id);
 /* Request file for saving a new message with given size (if available). If an
    existing file can be used, the record is locked and updated in index.
    Returns 0 if ok, -1 if error. */
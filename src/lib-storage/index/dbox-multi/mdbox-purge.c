@@ -6,6 +6,8 @@
 #include "ostream.h"
 #include "str.h"
 #include "hash.h"
+#include "sleep.h"
+#include "time-util.h"
 #include "dbox-attachment.h"
 #include "mdbox-storage.h"
 #include "mdbox-storage-rebuild.h"
@@ -46,6 +48,10 @@ struct mdbox_purge_context {
 	HASH_TABLE(void *, void *) altmoves;
 	bool have_altmoves;
 
+	/* for mdbox_purge_rate_limit */
+	struct timeval start_time;
+	uoff_t purged_bytes;
+
 	struct mdbox_map_atomic_context *atomic;
 	struct mdbox_map_append_context *append_ctx;
 };
@@ -194,8 +200,12 @@ mdbox_purge_save_msg(struct mdbox_purge_context *ctx, struct dbox_file *file,
 	uoff_t msg_size;
 	int ret;
 
-	if (ctx->append_ctx == NULL)
-		ctx->append_ctx = mdbox_map_append_begin(ctx->atomic);
+	if (ctx->append_ctx == NULL) {
+		/* the moved messages keep their map UIDs, so the new files
+		   must be in the same map shard */
+		ctx->append_ctx = mdbox_map_append_begin_file_shard(ctx->atomic,
+			((struct mdbox_file *)file)->file_id);
+	}
 
 	append_flags = !mdbox_purge_want_altpath(ctx, file, msg->map_uid) ? 0 :
 		DBOX_MAP_APPEND_FLAG_ALT;
@@ -321,6 +331,8 @@ mdbox_file_purge(struct mdbox_purge_context *ctx, struct dbox_file *file,
 		return -1;
 	}
 
+	ctx->purged_bytes += st.st_size;
+
 	/* get list of map UIDs that exist in this file (again has to be done
 	   after locking) */
 	i_array_init(&msgs_arr, 128);
@@ -335,6 +347,7 @@ mdbox_file_purge(struct mdbox_purge_context *ctx, struct dbox_file *file,
 
 	ext_refs_pool = pool_alloconly_create("mdbox purge ext refs", 1024);
 	ctx->atomic = mdbox_map_atomic_begin(ctx->storage->map);
+	mdbox_map_atomic_want_id(ctx->atomic, file_id);
 	msgs = array_get(&msgs_arr, &count);
 	i_array_init(&ext_refs, 32);
 	i_array_init(&copied_map_uids, I_MIN(count, 1));
@@ -644,6 +657,23 @@ static int mdbox_altmove_add_files(struct mdbox_purge_context *ctx)
 	return ret;
 }
 
+static void mdbox_purge_throttle(struct mdbox_purge_context *ctx)
+{
+	uoff_t rate_limit = ctx->storage->set->mdbox_purge_rate_limit;
+	long long expected_msecs, elapsed_msecs;
+	struct timeval now;
+
+	if (rate_limit == 0 || ctx->purged_bytes == 0)
+		return;
+
+	/* sleep until the bytes read so far fit within the rate limit */
+	expected_msecs = ctx->purged_bytes * 1000 / rate_limit;
+	i_gettimeofday(&now);
+	elapsed_msecs = timeval_diff_msecs(&now, &ctx->start_time);
+	if (expected_msecs > elapsed_msecs)
+		i_sleep_msecs(expected_msecs - elapsed_msecs);
+}
+
 int mdbox_purge(struct mail_storage *_storage)
 {
 	struct mdbox_storage *storage = (struct mdbox_storage *)_storage;
@@ -651,12 +681,23 @@ int mdbox_purge(struct mail_storage *_storage)
 	struct dbox_file *file;
 	struct seq_range_iter iter;
 	unsigned int i = 0;
+	ARRAY_TYPE(mdbox_map_zero_ref_file) zero_ref_files;
+	ARRAY_TYPE(uint32_t) file_ids;
+	ARRAY_TYPE(seq_range) zero_ref_file_ids;
+	const struct mdbox_map_zero_ref_file *zero_ref_file;
 	uint32_t file_id;
 	bool deleted;
 	int ret;
 
 	ctx = mdbox_purge_alloc(storage);
-	ret = mdbox_map_get_zero_ref_files(storage->map, &ctx->purge_file_ids);
+	t_array_init(&zero_ref_files, 64);
+	t_array_init(&zero_ref_file_ids, 64);
+	ret = mdbox_map_get_zero_ref_files(storage->map, &zero_ref_files);
+	array_foreach(&zero_ref_files, zero_ref_file) {
+		seq_range_array_add(&zero_ref_file_ids,
+				    zero_ref_file->file_id);
+	}
+	seq_range_array_merge(&ctx->purge_file_ids, &zero_ref_file_ids);
 	if (storage->alt_storage_dir != NULL) {
 		if (mdbox_purge_get_primary_files(ctx) < 0)
 			ret = -1;
@@ -667,9 +708,22 @@ int mdbox_purge(struct mail_storage *_storage)
 		}
 	}
 
+	/* purge first the files that free the most space relative to the
+	   amount of data that needs to be copied. the files that only need
+	   altmoving come last. */
+	t_array_init(&file_ids, array_count(&ctx->purge_file_ids));
+	array_foreach(&zero_ref_files, zero_ref_file)
+		array_push_back(&file_ids, &zero_ref_file->file_id);
 	seq_range_array_iter_init(&iter, &ctx->purge_file_ids); i = 0;
-	while (ret == 0 &&
-	       seq_range_array_iter_nth(&iter, i++, &file_id)) T_BEGIN {
+	while (seq_range_array_iter_nth(&iter, i++, &file_id)) {
+		if (!seq_range_exists(&zero_ref_file_ids, file_id))
+			array_push_back(&file_ids, &file_id);
+	}
+
+	i_gettimeofday(&ctx->start_time);
+	for (i = 0; ret == 0 && i < array_count(&file_ids); i++) T_BEGIN {
+		file_id = *array_idx(&file_ids, i);
+		mdbox_purge_throttle(ctx);
 		file = mdbox_file_init(storage, file_id);
 		if (dbox_file_open(file, &deleted) > 0 && !deleted) {
 			if (mdbox_file_purge(ctx, file, file_id) < 0)
@@ -295,7 +295,14 @@ int mdbox_transaction_save_commit_pre(struct mail_save_context *_ctx)
 		return -1;
 	}
 
-	/* make sure the map gets locked */
+	/* make sure the map gets locked, including the shards of the
+	   copied mails whose refcounts are increased */
+	if (array_is_created(&ctx->copy_map_uids)) {
+		const uint32_t *map_uidp;
+
+		array_foreach(&ctx->copy_map_uids, map_uidp)
+			mdbox_map_atomic_want_id(ctx->atomic, *map_uidp);
+	}
 	if (mdbox_map_atomic_lock(ctx->atomic, "saving") < 0) {
 		mdbox_transaction_save_rollback(_ctx);
 		return -1;
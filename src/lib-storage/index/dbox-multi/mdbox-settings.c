@@ -7,6 +7,8 @@
 
 #include <stddef.h>
 
+static bool mdbox_settings_check(void *_set, pool_t pool, const char **error_r);
+
 #undef DEF
 #define DEF(type, name) \
 	SETTING_DEFINE_STRUCT_##type(#name, name, struct mdbox_settings)
@@ -15,6 +17,8 @@ static const struct setting_define mdbox_setting_defines[] = {
 	DEF(BOOL, mdbox_preallocate_space),
 	DEF(SIZE, mdbox_rotate_size),
 	DEF(TIME, mdbox_rotate_interval),
+	DEF(SIZE, mdbox_purge_rate_limit),
+	DEF(UINT, mdbox_map_shards),
 
 	SETTING_DEFINE_LIST_END
 };
@@ -22,7 +26,9 @@ static const struct setting_define mdbox_setting_defines[] = {
 static const struct mdbox_settings mdbox_default_settings = {
 	.mdbox_preallocate_space = FALSE,
 	.mdbox_rotate_size = 10*1024*1024,
-	.mdbox_rotate_interval = 0
+	.mdbox_rotate_interval = 0,
+	.mdbox_purge_rate_limit = 0,
+	.mdbox_map_shards = 1
 };
 
 static const struct setting_parser_info mdbox_setting_parser_info = {
@@ -34,9 +40,27 @@ static const struct setting_parser_info mdbox_setting_parser_info = {
 	.struct_size = sizeof(struct mdbox_settings),
 
 	.parent_offset = SIZE_MAX,
-	.parent = &mail_user_setting_parser_info
+	.parent = &mail_user_setting_parser_info,
+
+	.check_func = mdbox_settings_check
 };
 
+/* <settings checks> */
+static bool mdbox_settings_check(void *_set, pool_t pool ATTR_UNUSED,
+				 const char **error_r)
+{
+	struct mdbox_settings *set = _set;
+
+	if (set->mdbox_map_shards == 0 ||
+	    set->mdbox_map_shards > MDBOX_MAP_MAX_SHARDS) {
+		*error_r = t_strdup_printf(
+			"mdbox_map_shards must be 1..%u", MDBOX_MAP_MAX_SHARDS);
+		return FALSE;
+	}
+	return TRUE;
+}
+/* </settings checks> */
+
 const struct setting_parser_info *mdbox_get_setting_parser_info(void)
 {
 	return &mdbox_setting_parser_info;
@@ -1,10 +1,17 @@
 #ifndef MDBOX_SETTINGS_H
 #define MDBOX_SETTINGS_H
 
+/* <settings checks> */
+/* Maximum value for mdbox_map_shards */
+#define MDBOX_MAP_MAX_SHARDS 16
+/* </settings checks> */
+
 struct mdbox_settings {
 	bool mdbox_preallocate_space;
 	uoff_t mdbox_rotate_size;
 	unsigned int mdbox_rotate_interval;
+	uoff_t mdbox_purge_rate_limit;
+	unsigned int mdbox_map_shards;
 };
 
 const struct setting_parser_info *mdbox_get_setting_parser_info(void);
@@ -43,18 +43,27 @@ struct rebuild_msg_mailbox {
 	uint32_t next_uid;
 };
 
+struct mdbox_rebuild_shard {
+	/* NULL until the shard is locked for the rebuild */
+	struct mdbox_map *map;
+	struct mdbox_map_atomic_context *atomic;
+
+	struct mdbox_map_mail_index_header orig_map_hdr;
+	uint32_t highest_file_id;
+};
+
 struct mdbox_storage_rebuild_context {
 	struct mdbox_storage *storage;
 	struct mdbox_map_atomic_context *atomic;
 	pool_t pool;
 
-	struct mdbox_map_mail_index_header orig_map_hdr;
 	HASH_TABLE(uint8_t *, struct mdbox_rebuild_msg *) guid_hash;
 	ARRAY(struct mdbox_rebuild_msg *) msgs;
 	ARRAY_TYPE(seq_range) seen_file_ids;
 
+	/* map shards, or only shards[0] if the map isn't sharded */
+	struct mdbox_rebuild_shard shards[MDBOX_MAP_MAX_SHARDS];
 	uint32_t rebuild_count;
-	uint32_t highest_file_id;
 
 	struct mailbox_list *default_list;
 
@@ -236,8 +245,49 @@ static int rebuild_file_mails(struct mdbox_storage_rebuild_context *ctx,
 		return 1;
 }
 
+static int
+rebuild_prepare_shard(struct mdbox_storage_rebuild_context *ctx,
+		      struct mdbox_map *map)
+{
+	struct mdbox_rebuild_shard *shard = &ctx->shards[map->shard_idx];
+	const void *data;
+	size_t data_size;
+
+	if (shard->map != NULL)
+		return 0;
+
+	/* The existing shards were already locked in order by
+	   mdbox_storage_rebuild_scan_prepare(). The only shards locked here
+	   are the ones whose index was lost, but which still have m.* files. */
+	if (mdbox_map_open_or_create(map) < 0)
+		return -1;
+	shard->atomic = mdbox_map_atomic_get_shard(ctx->atomic, map);
+	if (mdbox_map_atomic_lock_shard(shard->atomic,
+					"mdbox storage rebuild") < 0)
+		return -1;
+
+	/* fsck the map just in case its UIDs are broken */
+	if (mail_index_fsck(map->index) < 0) {
+		mail_storage_set_index_error(&ctx->storage->storage.storage,
+					     map->index);
+		return -1;
+	}
+
+	/* get old map header */
+	mail_index_get_header_ext(shard->atomic->sync_view, map->map_ext_id,
+				  &data, &data_size);
+	i_zero(&shard->orig_map_hdr);
+	memcpy(&shard->orig_map_hdr, data,
+	       I_MIN(data_size, sizeof(shard->orig_map_hdr)));
+	shard->highest_file_id = I_MAX(shard->orig_map_hdr.highest_file_id,
+				       MDBOX_MAP_SHARD_BASE_ID(map->shard_idx));
+	shard->map = map;
+	return 0;
+}
+
 static int
 rebuild_rename_file(struct mdbox_storage_rebuild_context *ctx,
+		    struct mdbox_rebuild_shard *shard,
 		    const char *dir, const char **fname_p, uint32_t *file_id_r)
 {
 	struct event *event = ctx->storage->storage.storage.event;
@@ -246,13 +296,13 @@ rebuild_rename_file(struct mdbox_storage_rebuild_context *ctx,
 	old_path = t_strconcat(dir, "/", fname, NULL);
 	do {
 		new_path = t_strdup_printf("%s/"MDBOX_MAIL_FILE_FORMAT,
-					   dir, ++ctx->highest_file_id);
+					   dir, ++shard->highest_file_id);
 		/* use link()+unlink() instead of rename() to make sure we
 		   don't overwrite any files. */
 		if (link(old_path, new_path) == 0) {
 			i_unlink(old_path);
 			*fname_p = strrchr(new_path, '/') + 1;
-			*file_id_r = ctx->highest_file_id;
+			*file_id_r = shard->highest_file_id;
 			return 0;
 		}
 	} while (errno == EEXIST);
@@ -265,6 +315,8 @@ static int rebuild_add_file(struct mdbox_storage_rebuild_context *ctx,
 			    const char *dir, const char *fname)
 {
 	struct event *event = ctx->storage->storage.storage.event;
+	struct mdbox_rebuild_shard *shard;
+	struct mdbox_map *map;
 	struct dbox_file *file;
 	uint32_t file_id;
 	const char *id_str, *ext;
@@ -284,15 +336,20 @@ static int rebuild_add_file(struct mdbox_storage_rebuild_context *ctx,
 		}
 		return 0;
 	}
+	map = mdbox_map_get_id_shard(ctx->storage->map, file_id);
+	if (rebuild_prepare_shard(ctx, map) < 0)
+		return -1;
+	shard = &ctx->shards[map->shard_idx];
+
 	if (!seq_range_exists(&ctx->seen_file_ids, file_id)) {
-		if (ctx->highest_file_id < file_id)
-			ctx->highest_file_id = file_id;
+		if (shard->highest_file_id < file_id)
+			shard->highest_file_id = file_id;
 	} else {
 		/* duplicate file. either readdir() returned it twice
 		   (unlikely) or it exists in both alt and primary storage.
 		   to make sure we don't lose any mails from either of the
 		   files, give this file a new ID and rename it. */
-		if (rebuild_rename_file(ctx, dir, &fname, &file_id) < 0)
+		if (rebuild_rename_file(ctx, shard, dir, &fname, &file_id) < 0)
 			return -1;
 	}
 	seq_range_array_add(&ctx->seen_file_ids, file_id);
@@ -308,6 +365,7 @@ static int rebuild_add_file(struct mdbox_storage_rebuild_context *ctx,
 
 static void
 rebuild_add_missing_map_uids(struct mdbox_storage_rebuild_context *ctx,
+			     struct mdbox_rebuild_shard *shard,
 			     uint32_t next_uid)
 {
 	struct mdbox_rebuild_msg **msgs;
@@ -318,7 +376,9 @@ rebuild_add_missing_map_uids(struct mdbox_storage_rebuild_context *ctx,
 	i_zero(&rec);
 	msgs = array_get_modifiable(&ctx->msgs, &count);
 	for (i = 0; i < count; i++) {
-		if (msgs[i]->map_uid != 0)
+		if (msgs[i]->map_uid != 0 ||
+		    mdbox_map_get_id_shard(shard->map,
+					   msgs[i]->file_id) != shard->map)
 			continue;
 
 		rec.file_id = msgs[i]->file_id;
@@ -326,30 +386,27 @@ rebuild_add_missing_map_uids(struct mdbox_storage_rebuild_context *ctx,
 		rec.size = msgs[i]->rec_size;
 
 		msgs[i]->map_uid = next_uid++;
-		mail_index_append(ctx->atomic->sync_trans,
+		mail_index_append(shard->atomic->sync_trans,
 				  msgs[i]->map_uid, &seq);
-		mail_index_update_ext(ctx->atomic->sync_trans, seq,
-				      ctx->storage->map->map_ext_id,
-				      &rec, NULL);
+		mail_index_update_ext(shard->atomic->sync_trans, seq,
+				      shard->map->map_ext_id, &rec, NULL);
 	}
 }
 
-static void rebuild_apply_map(struct mdbox_storage_rebuild_context *ctx)
+static void
+rebuild_apply_map_shard(struct mdbox_storage_rebuild_context *ctx,
+			struct mdbox_rebuild_shard *shard)
 {
-	struct mdbox_map *map = ctx->storage->map;
+	struct mdbox_map *map = shard->map;
 	const struct mail_index_header *hdr;
 	struct mdbox_rebuild_msg **pos;
 	struct mdbox_rebuild_msg search_msg, *search_msgp = &search_msg;
 	struct dbox_mail_lookup_rec rec;
 	uint32_t seq;
 
-	array_sort(&ctx->msgs, mdbox_rebuild_msg_offset_cmp);
-	/* msgs now contains a list of all messages that exists in m.* files,
-	   sorted by file_id,offset */
-
-	hdr = mail_index_get_header(ctx->atomic->sync_view);
+	hdr = mail_index_get_header(shard->atomic->sync_view);
 	for (seq = 1; seq <= hdr->messages_count; seq++) {
-		if (mdbox_map_view_lookup_rec(map, ctx->atomic->sync_view,
+		if (mdbox_map_view_lookup_rec(map, shard->atomic->sync_view,
 					      seq, &rec) < 0) {
 			/* map or ref extension is missing from the index.
 			   Just ignore the file entirely. (Don't try to
@@ -366,10 +423,12 @@ static void rebuild_apply_map(struct mdbox_storage_rebuild_context *ctx)
 		search_msg.rec_size = rec.rec.size;
 		pos = array_bsearch(&ctx->msgs, &search_msgp,
 				    mdbox_rebuild_msg_offset_cmp);
-		if (pos == NULL || (*pos)->map_uid != 0) {
+		if (pos == NULL || (*pos)->map_uid != 0 ||
+		    mdbox_map_get_id_shard(map, rec.rec.file_id) != map) {
 			/* map record points to nonexistent or
-			   a duplicate message. */
-			mail_index_expunge(ctx->atomic->sync_trans, seq);
+			   a duplicate message, or to a file in another
+			   shard. */
+			mail_index_expunge(shard->atomic->sync_trans, seq);
 		} else {
 			/* remember this message's map_uid */
 			(*pos)->map_uid = rec.map_uid;
@@ -377,7 +436,22 @@ static void rebuild_apply_map(struct mdbox_storage_rebuild_context *ctx)
 				(*pos)->seen_zero_ref_in_map = TRUE;
 		}
 	}
-	rebuild_add_missing_map_uids(ctx, hdr->next_uid);
+	rebuild_add_missing_map_uids(ctx, shard,
+		I_MAX(hdr->next_uid, MDBOX_MAP_SHARD_BASE_ID(map->shard_idx) + 1));
+}
+
+static void rebuild_apply_map(struct mdbox_storage_rebuild_context *ctx)
+{
+	unsigned int i;
+
+	array_sort(&ctx->msgs, mdbox_rebuild_msg_offset_cmp);
+	/* msgs now contains a list of all messages that exists in m.* files,
+	   sorted by file_id,offset */
+
+	for (i = 0; i < N_ELEMENTS(ctx->shards); i++) {
+		if (ctx->shards[i].map != NULL)
+			rebuild_apply_map_shard(ctx, &ctx->shards[i]);
+	}
 
 	/* afterwards we're interested in looking up map_uids.
 	   re-sort the messages to make it easier. */
@@ -805,33 +879,35 @@ static int rebuild_handle_zero_refs(struct mdbox_storage_rebuild_context *ctx)
 	return 0;
 }
 
-static void rebuild_update_refcounts(struct mdbox_storage_rebuild_context *ctx)
+static void
+rebuild_update_refcounts_shard(struct mdbox_rebuild_shard *shard,
+			       struct mdbox_rebuild_msg *const *msgs,
+			       unsigned int count)
 {
+	struct mail_index_view *view = shard->atomic->sync_view;
+	struct mail_index_transaction *trans = shard->atomic->sync_trans;
 	const struct mail_index_header *hdr;
 	const void *data;
-	struct mdbox_rebuild_msg **msgs;
 	const uint16_t *ref16_p;
 	uint32_t seq, map_uid;
-	unsigned int i, count;
+	unsigned int i;
 
 	/* update refcounts for existing map records */
-	msgs = array_get_modifiable(&ctx->msgs, &count);
-	hdr = mail_index_get_header(ctx->atomic->sync_view);
+	hdr = mail_index_get_header(view);
 	for (seq = 1, i = 0; seq <= hdr->messages_count && i < count; seq++) {
-		mail_index_lookup_uid(ctx->atomic->sync_view, seq, &map_uid);
+		mail_index_lookup_uid(view, seq, &map_uid);
 		if (map_uid != msgs[i]->map_uid) {
 			/* we've already expunged this map record */
 			i_assert(map_uid < msgs[i]->map_uid);
 			continue;
 		}
 
-		mail_index_lookup_ext(ctx->atomic->sync_view, seq,
-				      ctx->storage->map->ref_ext_id,
+		mail_index_lookup_ext(view, seq, shard->map->ref_ext_id,
 				      &data, NULL);
 		ref16_p = data;
 		if (ref16_p == NULL || *ref16_p != msgs[i]->refcount) {
-			mail_index_update_ext(ctx->atomic->sync_trans, seq,
-					      ctx->storage->map->ref_ext_id,
+			mail_index_update_ext(trans, seq,
+					      shard->map->ref_ext_id,
 					      &msgs[i]->refcount, NULL);
 		}
 		i++;
@@ -839,15 +915,38 @@ static void rebuild_update_refcounts(struct mdbox_storage_rebuild_context *ctx)
 
 	/* update refcounts for newly created map records */
 	for (; i < count; i++, seq++) {
-		mail_index_update_ext(ctx->atomic->sync_trans, seq,
-				      ctx->storage->map->ref_ext_id,
+		mail_index_update_ext(trans, seq, shard->map->ref_ext_id,
 				      &msgs[i]->refcount, NULL);
 	}
 }
 
+static void rebuild_update_refcounts(struct mdbox_storage_rebuild_context *ctx)
+{
+	struct mdbox_rebuild_msg **msgs;
+	struct mdbox_map *map;
+	unsigned int i, first, count;
+
+	/* msgs are sorted by map_uid, so each shard's messages are
+	   together in ascending shard order */
+	msgs = array_get_modifiable(&ctx->msgs, &count);
+	for (first = 0; first < count; first = i) {
+		map = mdbox_map_get_id_shard(ctx->storage->map,
+					     msgs[first]->map_uid);
+		for (i = first + 1; i < count; i++) {
+			if (mdbox_map_get_id_shard(map, msgs[i]->map_uid) != map)
+				break;
+		}
+		i_assert(ctx->shards[map->shard_idx].map == map);
+		rebuild_update_refcounts_shard(&ctx->shards[map->shard_idx],
+					       msgs + first, i - first);
+	}
+}
+
 static int rebuild_finish(struct mdbox_storage_rebuild_context *ctx)
 {
 	struct mdbox_map_mail_index_header map_hdr;
+	struct mdbox_rebuild_shard *shard;
+	unsigned int i;
 
 	i_assert(ctx->default_list != NULL);
 
@@ -855,14 +954,21 @@ static int rebuild_finish(struct mdbox_storage_rebuild_context *ctx)
 		return -1;
 	rebuild_update_refcounts(ctx);
 
-	/* update map header */
-	map_hdr = ctx->orig_map_hdr;
-	map_hdr.highest_file_id = ctx->highest_file_id;
-	map_hdr.rebuild_count = ++ctx->rebuild_count;
+	/* update map headers. the rebuild count is the same in all
+	   shards, but only shard 0's is used. */
+	ctx->rebuild_count++;
+	for (i = 0; i < N_ELEMENTS(ctx->shards); i++) {
+		shard = &ctx->shards[i];
+		if (shard->map == NULL)
+			continue;
 
-	mail_index_update_header_ext(ctx->atomic->sync_trans,
-				     ctx->storage->map->map_ext_id,
-				     0, &map_hdr, sizeof(map_hdr));
+		map_hdr = shard->orig_map_hdr;
+		map_hdr.highest_file_id = shard->highest_file_id;
+		map_hdr.rebuild_count = ctx->rebuild_count;
+		mail_index_update_header_ext(shard->atomic->sync_trans,
+					     shard->map->map_ext_id,
+					     0, &map_hdr, sizeof(map_hdr));
+	}
 	return 0;
 }
 
@@ -905,33 +1011,22 @@ mdbox_storage_rebuild_scan_dir(struct mdbox_storage_rebuild_context *ctx,
 static int
 mdbox_storage_rebuild_scan_prepare(struct mdbox_storage_rebuild_context *ctx)
 {
-	const void *data;
-	size_t data_size;
+	struct mdbox_map *map;
+	unsigned int i;
 
 	if (mdbox_map_open_or_create(ctx->storage->map) < 0)
 		return -1;
 
-	/* begin by locking the map, so that other processes can't try to
-	   rebuild at the same time. */
-	if (mdbox_map_atomic_lock(ctx->atomic, "mdbox storage rebuild") < 0)
-		return -1;
-
-	/* fsck the map just in case its UIDs are broken */
-	if (mail_index_fsck(ctx->storage->map->index) < 0) {
-		mail_storage_set_index_error(&ctx->storage->storage.storage,
-					     ctx->storage->map->index);
+	/* begin by locking the map and all of its shards, so that other
+	   processes can't try to rebuild at the same time. */
+	if (mdbox_map_atomic_lock_all(ctx->atomic, "mdbox storage rebuild") < 0)
 		return -1;
+	for (i = 0; i < N_ELEMENTS(ctx->shards); i++) {
+		map = mdbox_map_get_shard(ctx->storage->map, i);
+		if (map != NULL && rebuild_prepare_shard(ctx, map) < 0)
+			return -1;
 	}
 
-	/* get old map header */
-	mail_index_get_header_ext(ctx->atomic->sync_view,
-				  ctx->storage->map->map_ext_id,
-				  &data, &data_size);
-	i_zero(&ctx->orig_map_hdr);
-	memcpy(&ctx->orig_map_hdr, data,
-	       I_MIN(data_size, sizeof(ctx->orig_map_hdr)));
-	ctx->highest_file_id = ctx->orig_map_hdr.highest_file_id;
-
 	/* get storage rebuild counter after locking */
 	ctx->rebuild_count = mdbox_map_get_rebuild_count(ctx->storage->map);
 	if (ctx->rebuild_count != ctx->storage->corrupted_rebuild_count &&
@@ -209,15 +209,16 @@ static int mdbox_sync_try_begin(struct mdbox_sync_context *ctx,
 	if (ret <= 0)
 		return ret; /* error / nothing to do */
 
-	if (!mdbox_map_atomic_is_locked(ctx->atomic) &&
+	if (!mdbox_map_atomic_is_locked_all(ctx->atomic) &&
 	    mail_index_sync_has_expunges(ctx->index_sync_ctx)) {
 		/* we have expunges, so we need to write to map.
-		   it needs to be locked before mailbox index. */
+		   it needs to be locked before mailbox index. the expunged
+		   messages may be in any of the map shards. */
 		mail_index_sync_set_reason(ctx->index_sync_ctx, "mdbox expunge check");
 		mail_index_sync_rollback(&ctx->index_sync_ctx);
 		index_storage_expunging_deinit(&ctx->mbox->box);
 
-		if (mdbox_map_atomic_lock(ctx->atomic, "mdbox syncing with expunges") < 0)
+		if (mdbox_map_atomic_lock_all(ctx->atomic, "mdbox syncing with expunges") < 0)
 			return -1;
 		return mdbox_sync_try_begin(ctx, sync_flags);
 	}
@@ -106,6 +106,8 @@ int sdbox_save_begin(struct mail_save_context *_ctx, struct istream *input)
 
 	file = sdbox_file_create(ctx->mbox);
 	ctx->append_ctx = dbox_file_append_init(file);
+	/* all the saved files are synced at once in commit_pre() */
+	ctx->append_ctx->skip_fsync = TRUE;
 	ret = dbox_file_get_append_stream(ctx->append_ctx,
 					  &ctx->ctx.dbox_output);
 	if (ret <= 0) {
@@ -276,6 +278,30 @@ static void dbox_save_unref_files(struct sdbox_save_context *ctx)
 	array_free(&ctx->files);
 }
 
+static int sdbox_save_fsync_files(struct sdbox_save_context *ctx)
+{
+	struct mail_storage *storage = ctx->mbox->box.storage;
+	struct dbox_file *const *files;
+	unsigned int i, count;
+
+	if (storage->set->parsed_fsync_mode == FSYNC_MODE_NEVER)
+		return 0;
+
+	/* The files were written without fsyncing each one separately.
+	   Sync them all now, before they're renamed and added to index.
+	   Most of their data has typically already been written back by
+	   the kernel while the later mails were being saved. */
+	files = array_get(&ctx->files, &count);
+	for (i = 0; i < count; i++) {
+		if (fdatasync_path(files[i]->cur_path) < 0) {
+			dbox_file_set_syscall_error(files[i],
+						    "fdatasync_path()");
+			return -1;
+		}
+	}
+	return 0;
+}
+
 int sdbox_transaction_save_commit_pre(struct mail_save_context *_ctx)
 {
 	struct sdbox_save_context *ctx = SDBOX_SAVECTX(_ctx);
@@ -289,6 +315,11 @@ int sdbox_transaction_save_commit_pre(struct mail_save_context *_ctx)
 		return 0;
 	}
 
+	if (sdbox_save_fsync_files(ctx) < 0) {
+		sdbox_transaction_save_rollback(_ctx);
+		return -1;
+	}
+
 	if (sdbox_sync_begin(ctx->mbox, SDBOX_SYNC_FLAG_FORCE |
 			     SDBOX_SYNC_FLAG_FSYNC, &ctx->sync_ctx) < 0) {
 		sdbox_transaction_save_rollback(_ctx);
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "str.h"
+#include "seq-range-array.h"
 #include "ioloop.h"
 #include "istream.h"
 #include "istream-concat.h"
@@ -139,39 +140,15 @@ headers_merge(pool_t pool, const char *const *h1, const char *const *h2)
 	return array_front(&headers);
 }
 
-static bool
-imapc_mail_try_merge_fetch(struct imapc_mailbox *mbox, string_t *str)
-{
-	const char *s1 = str_c(str);
-	const char *s2 = str_c(mbox->pending_fetch_cmd);
-	const char *s1_args, *s2_args, *p1, *p2;
-
-	if (!str_begins(s1, "UID FETCH ", &s1_args))
-		i_unreached();
-	if (!str_begins(s2, "UID FETCH ", &s2_args))
-		i_unreached();
-
-	/* skip over UID range */
-	p1 = strchr(s1_args, ' ');
-	p2 = strchr(s2_args, ' ');
-
-	if (null_strcmp(p1, p2) != 0)
-		return FALSE;
-	/* append the new UID to the pending FETCH UID range */
-	str_truncate(str, p1-s1);
-	str_insert(mbox->pending_fetch_cmd, p2-s2, ",");
-	str_insert(mbox->pending_fetch_cmd, p2-s2+1, str_c(str) + 10);
-	return TRUE;
-}
-
 static void
 imapc_mail_delayed_send_or_merge(struct imapc_mail *mail, string_t *str)
 {
 	struct imapc_mailbox *mbox = IMAPC_MAILBOX(mail->imail.mail.mail.box);
 
 	if (mbox->pending_fetch_request != NULL &&
-	    !imapc_mail_try_merge_fetch(mbox, str)) {
-		/* send the previous FETCH and create a new one */
+	    strcmp(str_c(mbox->pending_fetch_cmd), str_c(str)) != 0) {
+		/* fetching different items - send the previous FETCH and
+		   create a new one */
 		imapc_mail_fetch_flush(mbox);
 	}
 	if (mbox->pending_fetch_request == NULL) {
@@ -181,6 +158,9 @@ imapc_mail_delayed_send_or_merge(struct imapc_mail *mail, string_t *str)
 		i_assert(mbox->pending_fetch_cmd->used == 0);
 		str_append_str(mbox->pending_fetch_cmd, str);
 	}
+	/* append the new UID to the pending FETCH UID range */
+	seq_range_array_add(&mbox->pending_fetch_uids,
+			    mail->imail.mail.mail.uid);
 	array_push_back(&mbox->pending_fetch_request->mails, &mail);
 
 	if (mbox->to_pending_fetch_send == NULL &&
@@ -254,7 +234,7 @@ imapc_mail_send_fetch(struct mail *_mail, enum mail_fetch_field fields,
 		fields |= MAIL_FETCH_STREAM_HEADER;
 
 	str = t_str_new(64);
-	str_printfa(str, "UID FETCH %u (", _mail->uid);
+	str_append_c(str, '(');
 	if ((fields & MAIL_FETCH_RECEIVED_DATE) != 0)
 		str_append(str, "INTERNALDATE ");
 	if ((fields & MAIL_FETCH_SAVE_DATE) != 0) {
@@ -385,9 +365,14 @@ void imapc_mail_try_init_stream_from_cache(struct imapc_mail *mail)
 {
 	struct mail *_mail = &mail->imail.mail.mail;
 	struct imapc_mailbox *mbox = IMAPC_MAILBOX(_mail->box);
+	struct imapc_mail_cache cache;
 
-	if (mbox->prev_mail_cache.uid == _mail->uid)
-		imapc_mail_cache_get(mail, &mbox->prev_mail_cache);
+	if (mail->body_fetched)
+		return;
+	if (imapc_mailbox_mail_cache_remove(mbox, _mail->uid, &cache)) {
+		imapc_mail_cache_get(mail, &cache);
+		imapc_mail_cache_free(&cache);
+	}
 }
 
 bool imapc_mail_prefetch(struct mail *_mail)
@@ -519,6 +504,7 @@ void imapc_mail_fetch_flush(struct imapc_mailbox *mbox)
 {
 	struct imapc_command *cmd;
 	struct imapc_mail *mail;
+	string_t *str;
 
 	if (mbox->pending_fetch_request == NULL) {
 		i_assert(mbox->to_pending_fetch_send == NULL);
@@ -534,11 +520,17 @@ void imapc_mail_fetch_flush(struct imapc_mailbox *mbox)
 	imapc_command_set_flags(cmd, IMAPC_COMMAND_FLAG_RETRIABLE);
 	array_push_back(&mbox->fetch_requests, &mbox->pending_fetch_request);
 
-	imapc_command_send(cmd, str_c(mbox->pending_fetch_cmd));
+	str = t_str_new(128);
+	str_append(str, "UID FETCH ");
+	imap_write_seq_range(str, &mbox->pending_fetch_uids);
+	str_append_c(str, ' ');
+	str_append_str(str, mbox->pending_fetch_cmd);
+	imapc_command_send(cmd, str_c(str));
 
 	mbox->pending_fetch_request = NULL;
 	timeout_remove(&mbox->to_pending_fetch_send);
 	str_truncate(mbox->pending_fetch_cmd, 0);
+	array_clear(&mbox->pending_fetch_uids);
 }
 
 static bool imapc_find_lfile_arg(const struct imapc_untagged_reply *reply,
@@ -454,7 +454,6 @@ static void imapc_mail_close(struct mail *_mail)
 {
 	struct imapc_mail *mail = IMAPC_MAIL(_mail);
 	struct imapc_mailbox *mbox = IMAPC_MAILBOX(_mail->box);
-	struct imapc_mail_cache *cache = &mbox->prev_mail_cache;
 
 	if (mail->fetch_count > 0) {
 		imapc_mail_fetch_flush(mbox);
@@ -466,15 +465,10 @@ static void imapc_mail_close(struct mail *_mail)
 
 	mail->fetching_headers = NULL;
 	if (mail->body_fetched) {
-		imapc_mail_cache_free(cache);
-		cache->uid = _mail->uid;
-		if (mail->fd != -1) {
-			cache->fd = mail->fd;
-			mail->fd = -1;
-		} else {
-			cache->buf = mail->body;
-			mail->body = NULL;
-		}
+		imapc_mailbox_mail_cache_add(mbox, _mail->uid,
+					     mail->fd, mail->body);
+		mail->fd = -1;
+		mail->body = NULL;
 	}
 	i_close_fd(&mail->fd);
 	buffer_free(&mail->body);
@@ -16,6 +16,8 @@
 #include "imapc-settings.h"
 #include "imapc-storage.h"
 
+#include <sys/stat.h>
+
 #define DNS_CLIENT_SOCKET_NAME "dns-client"
 
 struct imapc_open_context {
@@ -422,7 +424,7 @@ imapc_storage_create(struct mail_storage *_storage,
 	_storage->unique_root_dir = p_strdup_printf(_storage->pool,
 						    "%s%s://(%s|%s):%s@%s:%u/%s mechs:%s features:%s "
 						    "rawlog:%s cmd_timeout:%u maxidle:%u maxline:%zuu "
-						    "pop3delflg:%s root_dir:%s",
+						    "mailcache:%zuu pop3delflg:%s root_dir:%s",
 						    storage->set->imapc_ssl,
 						    storage->set->imapc_ssl_verify ? "(verify)" : "",
 						    storage->set->imapc_user,
@@ -437,6 +439,7 @@ imapc_storage_create(struct mail_storage *_storage,
 						    storage->set->imapc_cmd_timeout,
 						    storage->set->imapc_max_idle_time,
 						    (size_t) storage->set->imapc_max_line_length,
+						    (size_t) storage->set->imapc_mail_cache_size,
 						    storage->set->pop3_deleted_flag,
 						    ns->list->set.root_dir);
 
@@ -544,8 +547,9 @@ imapc_mailbox_alloc(struct mail_storage *storage, struct mailbox_list *list,
 	p_array_init(&mbox->delayed_expunged_uids, pool, 16);
 	p_array_init(&mbox->copy_rollback_expunge_uids, pool, 16);
 	mbox->pending_fetch_cmd = str_new(pool, 128);
+	p_array_init(&mbox->pending_fetch_uids, pool, 16);
 	mbox->pending_copy_cmd = str_new(pool, 128);
-	mbox->prev_mail_cache.fd = -1;
+	p_array_init(&mbox->mail_cache, pool, 4);
 	imapc_mailbox_register_callbacks(mbox);
 	return &mbox->box;
 }
@@ -847,6 +851,63 @@ void imapc_mail_cache_free(struct imapc_mail_cache *cache)
 	cache->uid = 0;
 }
 
+bool imapc_mailbox_mail_cache_remove(struct imapc_mailbox *mbox, uint32_t uid,
+				     struct imapc_mail_cache *cache_r)
+{
+	const struct imapc_mail_cache *cache;
+
+	array_foreach(&mbox->mail_cache, cache) {
+		if (cache->uid == uid) {
+			*cache_r = *cache;
+			mbox->mail_cache_size -= cache->size;
+			array_delete(&mbox->mail_cache,
+				     array_foreach_idx(&mbox->mail_cache, cache), 1);
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+void imapc_mailbox_mail_cache_add(struct imapc_mailbox *mbox, uint32_t uid,
+				  int fd, buffer_t *buf)
+{
+	struct imapc_mail_cache *cache, old_cache;
+	struct stat st;
+
+	if (imapc_mailbox_mail_cache_remove(mbox, uid, &old_cache))
+		imapc_mail_cache_free(&old_cache);
+
+	cache = array_append_space(&mbox->mail_cache);
+	cache->uid = uid;
+	cache->fd = fd;
+	cache->buf = buf;
+	if (buf != NULL)
+		cache->size = buf->used;
+	else if (fstat(fd, &st) == 0)
+		cache->size = st.st_size;
+	mbox->mail_cache_size += cache->size;
+
+	/* drop the least recently used bodies, but always keep at least the
+	   latest one */
+	while (array_count(&mbox->mail_cache) > 1 &&
+	       mbox->mail_cache_size > mbox->storage->set->imapc_mail_cache_size) {
+		cache = array_front_modifiable(&mbox->mail_cache);
+		mbox->mail_cache_size -= cache->size;
+		imapc_mail_cache_free(cache);
+		array_pop_front(&mbox->mail_cache);
+	}
+}
+
+void imapc_mailbox_mail_cache_clear(struct imapc_mailbox *mbox)
+{
+	struct imapc_mail_cache *cache;
+
+	array_foreach_modifiable(&mbox->mail_cache, cache)
+		imapc_mail_cache_free(cache);
+	array_clear(&mbox->mail_cache);
+	mbox->mail_cache_size = 0;
+}
+
 static void imapc_mailbox_close(struct mailbox *box)
 {
 	struct imapc_mailbox *mbox = IMAPC_MAILBOX(box);
@@ -872,7 +933,7 @@ static void imapc_mailbox_close(struct mailbox *box)
 		mail_index_view_close(&mbox->sync_view);
 	timeout_remove(&mbox->to_idle_delay);
 	timeout_remove(&mbox->to_idle_check);
-	imapc_mail_cache_free(&mbox->prev_mail_cache);
+	imapc_mailbox_mail_cache_clear(mbox);
 	index_storage_mailbox_close(box);
 }
 
@@ -88,6 +88,7 @@ struct imapc_mail_cache {
 	/* either fd != -1 or buf != NULL */
 	int fd;
 	buffer_t *buf;
+	uoff_t size;
 };
 
 struct imapc_fetch_request {
@@ -132,10 +133,12 @@ struct imapc_mailbox {
 
 	ARRAY(struct imapc_fetch_request *) fetch_requests;
 	ARRAY(struct imapc_untagged_fetch_ctx *) untagged_fetch_contexts;
-	/* if non-empty, contains the latest FETCH command we're going to be
-	   sending soon (but still waiting to see if we can increase its
-	   UID range) */
+	/* if non-empty, contains the fetch items of the latest FETCH command
+	   we're going to be sending soon (but still waiting to see if we can
+	   increase its UID range) */
 	string_t *pending_fetch_cmd;
+	/* UIDs to be fetched with pending_fetch_cmd */
+	ARRAY_TYPE(seq_range) pending_fetch_uids;
 	/* if non-empty, contains the latest COPY command we're going to be
 	   sending soon. */
 	string_t *pending_copy_cmd;
@@ -163,9 +166,11 @@ struct imapc_mailbox {
 	uint32_t min_append_uid;
 	char *sync_gmail_pop3_search_tag;
 
-	/* keep the previous fetched message body cached,
-	   mainly for partial IMAP fetches */
-	struct imapc_mail_cache prev_mail_cache;
+	/* keep the recently fetched message bodies cached, least recently
+	   used first. mainly for partial IMAP fetches and re-reading the
+	   same messages. */
+	ARRAY(struct imapc_mail_cache) mail_cache;
+	uoff_t mail_cache_size;
 
 	uint32_t prev_skipped_rseq, prev_skipped_uid;
 	struct imapc_sync_context *sync_ctx;
@@ -217,6 +222,15 @@ void imapc_transaction_save_rollback(struct mail_save_context *ctx);
 void imapc_mailbox_run(struct imapc_mailbox *mbox);
 void imapc_mailbox_run_nofetch(struct imapc_mailbox *mbox);
 void imapc_mail_cache_free(struct imapc_mail_cache *cache);
+/* Add a fetched message body to the mailbox's cache. The fd or buf is owned
+   by the cache afterwards. */
+void imapc_mailbox_mail_cache_add(struct imapc_mailbox *mbox, uint32_t uid,
+				  int fd, buffer_t *buf);
+/* Remove the body for the given UID from the cache and return it. The
+   caller is responsible for freeing it. */
+bool imapc_mailbox_mail_cache_remove(struct imapc_mailbox *mbox, uint32_t uid,
+				     struct imapc_mail_cache *cache_r);
+void imapc_mailbox_mail_cache_clear(struct imapc_mailbox *mbox);
 int imapc_mailbox_select(struct imapc_mailbox *mbox);
 void imap_mailbox_select_finish(struct imapc_mailbox *mbox);
 
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "dict.h"
+#include "mailbox-attribute-cache.h"
 #include "index-storage.h"
 
 struct index_storage_attribute_iter {
@@ -145,6 +146,33 @@ index_storage_get_dict(struct mailbox *box, enum mail_attribute_type type_flags,
 	return 0;
 }
 
+static struct mailbox_attribute_cache *
+index_storage_get_attr_cache(struct mailbox *box,
+			     enum mail_attribute_type type_flags)
+{
+	enum mail_attribute_type type = type_flags & MAIL_ATTRIBUTE_TYPE_MASK;
+	struct mail_namespace *ns = mailbox_get_namespace(box);
+	struct mail_user *dict_user;
+
+	if (box->storage->set->mail_attribute_cache_ttl == 0)
+		return NULL;
+
+	/* cache the lookups in the same user that owns the dict. public
+	   mailboxes' shared attributes are not cached. */
+	if (type == MAIL_ATTRIBUTE_TYPE_PRIVATE || ns->user == ns->owner)
+		dict_user = box->storage->user;
+	else if (ns->owner != NULL)
+		dict_user = ns->owner;
+	else
+		return NULL;
+
+	if (dict_user->_attr_cache == NULL) {
+		dict_user->_attr_cache = mailbox_attribute_cache_init(
+			box->storage->set->mail_attribute_cache_ttl);
+	}
+	return dict_user->_attr_cache;
+}
+
 static const char *
 key_get_prefixed(enum mail_attribute_type type_flags, const char *mailbox_prefix,
 		 const char *key)
@@ -221,6 +249,11 @@ int index_storage_attribute_set(struct mailbox_transaction_context *t,
 	if (index_storage_attribute_get_dict_trans(t, type_flags, &dtrans,
 						   &mailbox_prefix) < 0)
 		return -1;
+	/* The changed key is dropped from the cache already here, since the
+	   transaction is usually committed. If it's rolled back, the value
+	   is just looked up again. */
+	struct mailbox_attribute_cache *attr_cache =
+		index_storage_get_attr_cache(t->box, type_flags);
 
 	T_BEGIN {
 		const char *prefixed_key =
@@ -231,10 +264,18 @@ int index_storage_attribute_set(struct mailbox_transaction_context *t,
 						      &value_str) < 0) {
 			ret = -1;
 		} else if (value_str != NULL) {
+			if (attr_cache != NULL) {
+				mailbox_attribute_cache_remove(attr_cache,
+							       prefixed_key);
+			}
 			dict_set(dtrans, prefixed_key, value_str);
 			mail_index_attribute_set(t->itrans, pvt, key,
 						 ts, strlen(value_str));
 		} else {
+			if (attr_cache != NULL) {
+				mailbox_attribute_cache_remove(attr_cache,
+							       prefixed_key);
+			}
 			dict_unset(dtrans, prefixed_key);
 			mail_index_attribute_unset(t->itrans, pvt, key, ts);
 		}
@@ -256,16 +297,41 @@ int index_storage_attribute_get(struct mailbox *box,
 	if (index_storage_get_dict(box, type_flags, &dict, &mailbox_prefix) < 0)
 		return -1;
 
+	const char *prefixed_key =
+		key_get_prefixed(type_flags, mailbox_prefix, key);
+	struct mailbox_attribute_cache *attr_cache =
+		index_storage_get_attr_cache(box, type_flags);
+	if (attr_cache != NULL &&
+	    mailbox_attribute_cache_lookup(attr_cache, prefixed_key,
+					   &value_r->value)) {
+		struct event_passthrough *e =
+			event_create_passthrough(box->event)->
+			set_name("mail_attribute_lookup")->
+			add_str("key", key)->
+			add_str("cache", "hit");
+		e_debug(e->event(), "Attribute %s found from cache", key);
+		return value_r->value != NULL ? 1 : 0;
+	}
+
 	struct mail_user *user = mailbox_list_get_user(box->list);
 	const struct dict_op_settings *set = mail_user_get_dict_op_settings(user);
-	ret = dict_lookup(dict, set, pool_datastack_create(),
-			  key_get_prefixed(type_flags, mailbox_prefix, key),
+	ret = dict_lookup(dict, set, pool_datastack_create(), prefixed_key,
 			  &value_r->value, &error);
 	if (ret < 0) {
 		mailbox_set_critical(box,
 			"Failed to get attribute %s: %s", key, error);
 		return -1;
 	}
+	if (attr_cache != NULL) {
+		mailbox_attribute_cache_add(attr_cache, prefixed_key,
+					    value_r->value);
+		struct event_passthrough *e =
+			event_create_passthrough(box->event)->
+			set_name("mail_attribute_lookup")->
+			add_str("key", key)->
+			add_str("cache", "miss");
+		e_debug(e->event(), "Attribute %s not found from cache", key);
+	}
 	return ret;
 }
 
@@ -544,6 +544,65 @@ index_mail_get_binary_size(struct mail *_mail,
 	return 0;
 }
 
+static bool
+binary_parts_have_converted(const struct message_binary_part *bin_part,
+			    const struct message_part *part)
+{
+	uoff_t end_offset = part->physical_pos +
+		part->header_size.physical_size +
+		part->body_size.physical_size;
+
+	for (; bin_part != NULL; bin_part = bin_part->next) {
+		if (bin_part->physical_pos >= part->physical_pos &&
+		    bin_part->physical_pos < end_offset)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static bool binary_part_has_nuls(const struct message_part *part)
+{
+	const struct message_part *child;
+
+	if ((part->flags & MESSAGE_PART_FLAG_HAS_NULS) != 0)
+		return TRUE;
+	for (child = part->children; child != NULL; child = child->next) {
+		if (binary_part_has_nuls(child))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static int
+index_mail_get_unconverted_binary_stream(struct mail *_mail,
+					 const struct message_part *part,
+					 bool include_hdr, uoff_t *size_r,
+					 bool *binary_r,
+					 struct istream **stream_r)
+{
+	struct istream *input, *crlf_input;
+
+	/* binary.parts is cached and it shows that nothing inside this part
+	   needs to be decoded. the binary stream is the same as the original
+	   stream with CRLF linefeeds, so there's no need to parse the
+	   message or write it to a temp file. */
+	if (mail_get_stream_because(_mail, NULL, NULL, "binary stream",
+				    &input) < 0)
+		return -1;
+
+	*size_r = part->body_size.virtual_size;
+	if (include_hdr)
+		*size_r += part->header_size.virtual_size;
+	*binary_r = binary_part_has_nuls(part);
+
+	i_stream_seek(input, part->physical_pos +
+		      (include_hdr ? 0 : part->header_size.physical_size));
+	crlf_input = i_stream_create_crlf(input);
+	*stream_r = i_stream_create_limit(crlf_input, *size_r);
+	i_stream_unref(&crlf_input);
+	return 0;
+}
+
 int index_mail_get_binary_stream(struct mail *_mail,
 				 const struct message_part *part,
 				 bool include_hdr, uoff_t *size_r,
@@ -572,6 +631,11 @@ int index_mail_get_binary_stream(struct mail *_mail,
 		timeout_reset(cache->to);
 		binary = TRUE;
 		converted = TRUE;
+	} else if (get_cached_binary_parts(mail) &&
+		   !binary_parts_have_converted(mail->data.bin_parts, part)) {
+		mail->data.cache_fetch_fields |= MAIL_FETCH_STREAM_BINARY;
+		return index_mail_get_unconverted_binary_stream(_mail, part,
+				include_hdr, size_r, binary_r, stream_r);
 	} else {
 		if (index_mail_read_binary_to_cache(_mail, part, include_hdr,
 						    "binary stream", &binary, &converted) < 0)
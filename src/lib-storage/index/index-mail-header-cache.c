@@ -0,0 +1,129 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "hash.h"
+#include "llist.h"
+#include "index-mail-header-cache.h"
+
+struct index_mail_header_cache_entry {
+	struct index_mail_header_cache_entry *prev, *next;
+
+	uint32_t uid;
+	buffer_t *data;
+};
+
+struct index_mail_header_cache {
+	size_t max_size, size;
+	uint32_t uid_validity;
+
+	HASH_TABLE(void *, struct index_mail_header_cache_entry *) uid_hash;
+	/* head is the most recently used entry */
+	struct index_mail_header_cache_entry *head, *tail;
+};
+
+static size_t
+index_mail_header_cache_entry_size(const struct index_mail_header_cache_entry *entry)
+{
+	return sizeof(*entry) + entry->data->used;
+}
+
+struct index_mail_header_cache *
+index_mail_header_cache_init(size_t max_size, uint32_t uid_validity)
+{
+	struct index_mail_header_cache *cache;
+
+	cache = i_new(struct index_mail_header_cache, 1);
+	cache->max_size = max_size;
+	cache->uid_validity = uid_validity;
+	hash_table_create_direct(&cache->uid_hash, default_pool, 0);
+	return cache;
+}
+
+static void
+index_mail_header_cache_remove(struct index_mail_header_cache *cache,
+			       struct index_mail_header_cache_entry *entry)
+{
+	i_assert(cache->size >= index_mail_header_cache_entry_size(entry));
+
+	cache->size -= index_mail_header_cache_entry_size(entry);
+	hash_table_remove(cache->uid_hash, POINTER_CAST(entry->uid));
+	DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+	buffer_free(&entry->data);
+	i_free(entry);
+}
+
+static void index_mail_header_cache_clear(struct index_mail_header_cache *cache)
+{
+	while (cache->head != NULL)
+		index_mail_header_cache_remove(cache, cache->head);
+	i_assert(cache->size == 0);
+}
+
+void index_mail_header_cache_deinit(struct index_mail_header_cache **_cache)
+{
+	struct index_mail_header_cache *cache = *_cache;
+
+	*_cache = NULL;
+	index_mail_header_cache_clear(cache);
+	hash_table_destroy(&cache->uid_hash);
+	i_free(cache);
+}
+
+void index_mail_header_cache_add(struct index_mail_header_cache *cache,
+				 uint32_t uid, const buffer_t *data)
+{
+	struct index_mail_header_cache_entry *entry;
+
+	i_assert(uid != 0);
+
+	entry = hash_table_lookup(cache->uid_hash, POINTER_CAST(uid));
+	if (entry != NULL)
+		index_mail_header_cache_remove(cache, entry);
+	if (sizeof(*entry) + data->used > cache->max_size)
+		return;
+
+	entry = i_new(struct index_mail_header_cache_entry, 1);
+	entry->uid = uid;
+	entry->data = buffer_create_dynamic(default_pool, data->used);
+	buffer_append_buf(entry->data, data, 0, SIZE_MAX);
+	cache->size += index_mail_header_cache_entry_size(entry);
+	hash_table_insert(cache->uid_hash, POINTER_CAST(uid), entry);
+	DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+
+	while (cache->size > cache->max_size) {
+		i_assert(cache->tail != entry);
+		index_mail_header_cache_remove(cache, cache->tail);
+	}
+}
+
+const buffer_t *
+index_mail_header_cache_lookup(struct index_mail_header_cache *cache,
+			       uint32_t uid)
+{
+	struct index_mail_header_cache_entry *entry;
+
+	entry = hash_table_lookup(cache->uid_hash, POINTER_CAST(uid));
+	if (entry == NULL)
+		return NULL;
+
+	if (cache->head != entry) {
+		DLLIST2_REMOVE(&cache->head, &cache->tail, entry);
+		DLLIST2_PREPEND(&cache->head, &cache->tail, entry);
+	}
+	return entry->data;
+}
+
+void index_mail_header_cache_check_uid_validity(
+	struct index_mail_header_cache *cache, uint32_t uid_validity)
+{
+	if (cache->uid_validity != uid_validity) {
+		index_mail_header_cache_clear(cache);
+		cache->uid_validity = uid_validity;
+	}
+}
+
+size_t index_mail_header_cache_get_size(struct index_mail_header_cache *cache)
+{
+	return cache->size;
+}
@@ -0,0 +1,31 @@
+#ifndef INDEX_MAIL_HEADER_CACHE_H
+#define INDEX_MAIL_HEADER_CACHE_H
+
+/* Bounded in-memory LRU of mails' parsed headers, keyed by UID. This allows
+   looking up headers that aren't in the cache file without reading and
+   parsing the mail again. The data is opaque to the cache: it's written and
+   read by index-mail-headers.c. */
+struct index_mail_header_cache;
+
+struct index_mail_header_cache *
+index_mail_header_cache_init(size_t max_size, uint32_t uid_validity);
+void index_mail_header_cache_deinit(struct index_mail_header_cache **cache);
+
+/* Add headers for the UID, replacing any existing ones. If the data is larger
+   than the maximum size, it's not added. The least recently used entries
+   are dropped as needed to stay within the maximum size. */
+void index_mail_header_cache_add(struct index_mail_header_cache *cache,
+				 uint32_t uid, const buffer_t *data);
+/* Returns the headers for the UID, or NULL if they're not cached. The entry
+   becomes the most recently used one. */
+const buffer_t *
+index_mail_header_cache_lookup(struct index_mail_header_cache *cache,
+			       uint32_t uid);
+/* Drop all entries if UIDVALIDITY has changed. */
+void index_mail_header_cache_check_uid_validity(
+	struct index_mail_header_cache *cache, uint32_t uid_validity);
+
+/* Returns the number of bytes currently used by the cache. */
+size_t index_mail_header_cache_get_size(struct index_mail_header_cache *cache);
+
+#endif
@@ -5,6 +5,7 @@
 #include "array.h"
 #include "buffer.h"
 #include "str.h"
+#include "time-util.h"
 #include "message-date.h"
 #include "message-part-data.h"
 #include "message-parser.h"
@@ -15,6 +16,7 @@
 #include "imap-bodystructure.h"
 #include "index-storage.h"
 #include "index-mail.h"
+#include "index-mail-header-cache.h"
 
 static const struct message_parser_settings msg_parser_set = {
 	.hdr_flags = MESSAGE_HEADER_PARSER_FLAG_SKIP_INITIAL_LWSP |
@@ -37,6 +39,72 @@ static int header_line_cmp(const struct index_mail_line *l1,
 void index_mail_parse_header_deinit(struct index_mail *mail)
 {
 	mail->data.header_parser_initialized = FALSE;
+	mail->header_cache_record_uid = 0;
+}
+
+static struct index_mail_header_cache *
+index_mail_get_header_cache(struct index_mail *mail)
+{
+	struct mailbox *box = mail->mail.mail.box;
+	uint32_t uid_validity;
+
+	if (mail->ibox->header_cache == NULL) {
+		if (box->storage->set->mail_header_cache_max_size == 0)
+			return NULL;
+		mail->ibox->header_cache = index_mail_header_cache_init(
+			box->storage->set->mail_header_cache_max_size,
+			mail_index_get_header(box->view)->uid_validity);
+		return mail->ibox->header_cache;
+	}
+	uid_validity = mail_index_get_header(box->view)->uid_validity;
+	index_mail_header_cache_check_uid_validity(mail->ibox->header_cache,
+						   uid_validity);
+	return mail->ibox->header_cache;
+}
+
+static void index_mail_header_cache_record_start(struct index_mail *mail)
+{
+	i_assert(mail->data.header_parser_initialized);
+
+	/* don't record mails that are being saved */
+	if (mail->mail.mail.uid == 0 ||
+	    index_mail_get_header_cache(mail) == NULL)
+		return;
+
+	if (mail->header_cache_record == NULL) {
+		mail->header_cache_record =
+			buffer_create_dynamic(default_pool, 4096);
+	} else {
+		buffer_set_used_size(mail->header_cache_record, 0);
+	}
+	mail->header_cache_record_uid = mail->mail.mail.uid;
+}
+
+static void
+index_mail_header_cache_record(struct index_mail *mail,
+			       const struct message_header_line *hdr)
+{
+	buffer_t *buf = mail->header_cache_record;
+
+	if (hdr != NULL) {
+		/* the header is stored with LF-only linefeeds, the same way
+		   as in the cache file */
+		if (!hdr->continued) {
+			buffer_append(buf, hdr->name, hdr->name_len);
+			buffer_append(buf, hdr->middle, hdr->middle_len);
+		}
+		buffer_append(buf, hdr->value, hdr->value_len);
+		if (!hdr->no_newline)
+			buffer_append_c(buf, '\n');
+		return;
+	}
+
+	if (mail->header_cache_record_uid == mail->mail.mail.uid &&
+	    mail->ibox->header_cache != NULL) {
+		index_mail_header_cache_add(mail->ibox->header_cache,
+					    mail->header_cache_record_uid, buf);
+	}
+	mail->header_cache_record_uid = 0;
 }
 
 static void index_mail_parse_header_finish(struct index_mail *mail)
@@ -266,6 +334,7 @@ void index_mail_parse_header_init(struct index_mail *mail,
 			      &mail->header_match_value);
 	}
 	mail->data.header_parser_initialized = TRUE;
+	mail->header_cache_record_uid = 0;
 	mail->data.parse_line_num = 0;
 	i_zero(&mail->data.parse_line);
 }
@@ -301,6 +370,8 @@ void index_mail_parse_header(struct message_part *part,
 	i_assert(data->header_parser_initialized);
 
         data->parse_line_num++;
+	if (mail->header_cache_record_uid != 0)
+		index_mail_header_cache_record(mail, hdr);
 
 	if (data->save_bodystructure_header &&
 	    !data->parsed_bodystructure_header) {
@@ -457,6 +528,7 @@ int index_mail_parse_headers_internal(struct index_mail *mail,
 	i_assert(data->stream != NULL);
 
 	index_mail_parse_header_init(mail, headers);
+	index_mail_header_cache_record_start(mail);
 
 	if (data->parts == NULL || data->save_bodystructure_header ||
 	    (data->access_part & PARSE_BODY) != 0) {
@@ -484,20 +556,55 @@ int index_mail_parse_headers_internal(struct index_mail *mail,
 	return 0;
 }
 
+static bool
+index_mail_header_cache_parse(struct index_mail *mail,
+			      struct mailbox_header_lookup_ctx *headers)
+{
+	struct mail *_mail = &mail->mail.mail;
+	struct index_mail_header_cache *cache;
+	const buffer_t *data;
+	struct istream *input;
+
+	/* bodystructure parsing needs the message_part */
+	if (mail->data.save_bodystructure_header)
+		return FALSE;
+	if ((cache = index_mail_get_header_cache(mail)) == NULL)
+		return FALSE;
+	if ((data = index_mail_header_cache_lookup(cache, _mail->uid)) == NULL)
+		return FALSE;
+
+	input = i_stream_create_from_data(data->data, data->used);
+	index_mail_parse_header_init(mail, headers);
+	message_parse_header(input, NULL, msg_parser_set.hdr_flags,
+			     index_mail_parse_header_cb, mail);
+	i_assert(!mail->data.header_parser_initialized);
+	i_stream_unref(&input);
+	return TRUE;
+}
+
 int index_mail_parse_headers(struct index_mail *mail,
 			     struct mailbox_header_lookup_ctx *headers,
 			     const char *reason)
 {
 	struct index_mail_data *data = &mail->data;
 	struct istream *input;
+	struct timeval start_time;
 	uoff_t old_offset;
 
+	i_gettimeofday(&start_time);
 	old_offset = data->stream == NULL ? 0 : data->stream->v_offset;
 
 	if (mail_get_hdr_stream_because(&mail->mail.mail, NULL, reason, &input) < 0)
 		return -1;
 
 	int ret = index_mail_parse_headers_internal(mail, headers);
+	if (ret == 0 && headers != NULL) {
+		for (unsigned int i = 0; i < headers->count; i++) {
+			index_mail_cache_add_recompute_cost(mail,
+				headers->idx[i], &start_time, headers->count,
+				data->hdr_size.physical_size);
+		}
+	}
 	i_stream_seek(data->stream, old_offset);
 	return ret;
 }
@@ -690,7 +797,12 @@ index_mail_get_raw_headers(struct index_mail *mail, const char *field,
 			headers[0] = field; headers[1] = NULL;
 			headers_ctx = mailbox_header_lookup_init(_mail->box,
 								 headers);
-			ret = index_mail_parse_headers(mail, headers_ctx, reason);
+			if (index_mail_header_cache_parse(mail, headers_ctx))
+				ret = 0;
+			else {
+				ret = index_mail_parse_headers(mail, headers_ctx,
+							       reason);
+			}
 			mailbox_header_lookup_unref(&headers_ctx);
 			if (ret < 0)
 				return -1;
@@ -922,6 +1034,43 @@ static void index_mail_filter_stream_destroy(struct index_mail *mail)
 	i_stream_destroy(&mail->data.filter_stream);
 }
 
+static bool
+index_mail_header_cache_get_stream(struct index_mail *mail,
+				   struct mailbox_header_lookup_ctx *headers,
+				   struct istream **stream_r)
+{
+	struct mail *_mail = &mail->mail.mail;
+	struct index_mail_header_cache *cache;
+	const buffer_t *data;
+	struct istream *input;
+	void *copy;
+
+	if (mail->data.save_bodystructure_header)
+		return FALSE;
+	if ((cache = index_mail_get_header_cache(mail)) == NULL)
+		return FALSE;
+	if ((data = index_mail_header_cache_lookup(cache, _mail->uid)) == NULL)
+		return FALSE;
+
+	/* the entry may be dropped from the cache while the stream is still
+	   being read */
+	copy = p_malloc(mail->mail.data_pool, data->used);
+	memcpy(copy, data->data, data->used);
+	input = i_stream_create_from_data(copy, data->used);
+
+	index_mail_parse_header_init(mail, headers);
+	mail->data.filter_stream =
+		i_stream_create_header_filter(input,
+					      HEADER_FILTER_INCLUDE |
+					      HEADER_FILTER_ADD_MISSING_EOH |
+					      HEADER_FILTER_HIDE_BODY,
+					      headers->name, headers->count,
+					      header_cache_callback, mail);
+	i_stream_unref(&input);
+	*stream_r = mail->data.filter_stream;
+	return TRUE;
+}
+
 int index_mail_get_header_stream(struct mail *_mail,
 				 struct mailbox_header_lookup_ctx *headers,
 				 struct istream **stream_r)
@@ -956,6 +1105,9 @@ int index_mail_get_header_stream(struct mail *_mail,
 	/* not in cache / error */
 	p_free(mail->mail.data_pool, dest);
 
+	if (index_mail_header_cache_get_stream(mail, headers, stream_r))
+		return 0;
+
 	unsigned int first_not_found = UINT_MAX, not_found_count = 0;
 	for (unsigned int i = 0; i < headers->count; i++) {
 		if (mail_cache_field_exists(_mail->transaction->cache_view,
@@ -979,6 +1131,7 @@ int index_mail_get_header_stream(struct mail *_mail,
 		return -1;
 
 	index_mail_parse_header_init(mail, headers);
+	index_mail_header_cache_record_start(mail);
 	mail->data.filter_stream =
 		i_stream_create_header_filter(mail->data.stream,
 					      HEADER_FILTER_INCLUDE |
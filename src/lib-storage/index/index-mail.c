@@ -7,6 +7,7 @@
 #include "istream.h"
 #include "hex-binary.h"
 #include "str.h"
+#include "time-util.h"
 #include "mailbox-recent-flags.h"
 #include "message-date.h"
 #include "message-part-data.h"
@@ -515,6 +516,23 @@ const uint32_t *index_mail_get_vsize_extension(struct mail *_mail)
 	return vsize;
 }
 
+static bool index_mail_want_vsize_extension(struct mail *_mail)
+{
+	struct mail_index_view *view = _mail->transaction->view;
+	unsigned int idx ATTR_UNUSED;
+
+	/* Store the virtual size in index if either the extension or the
+	   mailbox vsize header already exists. POP3 sessions need the
+	   virtual sizes of all the mails at login, so for them create the
+	   extension so that the following logins and newly saved mails
+	   can get the sizes directly from the index records. */
+	return mail_index_map_get_ext_idx(view->index->map,
+					  _mail->box->mail_vsize_ext_id, &idx) ||
+		mail_index_map_get_ext_idx(view->index->map,
+					   _mail->box->vsize_hdr_ext_id, &idx) ||
+		(_mail->box->flags & MAILBOX_FLAG_POP3_SESSION) != 0;
+}
+
 static void index_mail_try_set_body_size(struct index_mail *mail)
 {
 	struct index_mail_data *data = &mail->data;
@@ -575,9 +593,10 @@ bool index_mail_get_cached_virtual_size(struct index_mail *mail, uoff_t *size_r)
 	index_mail_try_set_body_size(mail);
 	*size_r = data->virtual_size;
 
-	/* if vsize is present and wanted for index, but missing from index
-	   add it to index. */
-	if (vsize != NULL && *vsize == 0 &&
+	/* if vsize is wanted for index, but missing from index add it to
+	   index. */
+	if ((vsize != NULL ? *vsize == 0 :
+	     index_mail_want_vsize_extension(_mail)) &&
 	    data->virtual_size < (uint32_t)-1) {
 		uint32_t vsize = data->virtual_size+1;
 		mail_index_update_ext(_mail->transaction->itrans, _mail->seq,
@@ -695,6 +714,27 @@ void index_mail_cache_add_idx(struct index_mail *mail, unsigned int field_idx,
 	}
 }
 
+void index_mail_cache_add_recompute_cost(struct index_mail *mail,
+					 unsigned int field_idx,
+					 const struct timeval *start_time,
+					 unsigned int fields_count,
+					 uoff_t bytes)
+{
+	struct mail *_mail = &mail->mail.mail;
+	struct timeval end_time;
+	long long usecs;
+
+	if (_mail->box->cache == NULL || fields_count == 0)
+		return;
+
+	/* the cost is shared by all the fields recomputed at the same time */
+	i_gettimeofday(&end_time);
+	usecs = timeval_diff_usecs(&end_time, start_time);
+	mail_cache_field_add_recompute_cost(_mail->box->cache, field_idx,
+					    I_MAX(usecs, 0) / fields_count,
+					    bytes / fields_count);
+}
+
 void index_mail_cache_pop3_data(struct mail *_mail,
 				const char *uidl, uint32_t order)
 {
@@ -995,7 +1035,6 @@ static void index_mail_save_finish_make_snippet(struct index_mail *mail)
 static void index_mail_cache_sizes(struct index_mail *mail)
 {
 	struct mail *_mail = &mail->mail.mail;
-	struct mail_index_view *view = _mail->transaction->view;
 
 	static enum index_cache_field size_fields[] = {
 		MAIL_CACHE_VIRTUAL_FULL_SIZE,
@@ -1004,20 +1043,19 @@ static void index_mail_cache_sizes(struct index_mail *mail)
 	uoff_t sizes[N_ELEMENTS(size_fields)];
 	unsigned int i;
 	uint32_t vsize;
-	uint32_t idx ATTR_UNUSED;
 
 	sizes[0] = mail->data.virtual_size;
 	sizes[1] = mail->data.physical_size;
 
 	/* store the virtual size in index if
 		extension for it exists or
-		extension for box virtual size exists and
+		extension for box virtual size exists or
+		this is a POP3 session and
 		size fits and is present and
 		size is not cached or
 		cached size differs
 	*/
-	if ((mail_index_map_get_ext_idx(view->index->map, _mail->box->mail_vsize_ext_id, &idx) ||
-	     mail_index_map_get_ext_idx(view->index->map, _mail->box->vsize_hdr_ext_id, &idx)) &&
+	if (index_mail_want_vsize_extension(_mail) &&
 	    (sizes[0] != UOFF_T_MAX &&
 	     sizes[0] < (uint32_t)-1)) {
 		const uint32_t *vsize_ext =
@@ -1128,6 +1166,7 @@ static int index_mail_write_body_snippet(struct index_mail *mail)
 {
 	struct message_part *part;
 	struct istream *input;
+	struct timeval start_time;
 	uoff_t old_offset;
 	string_t *str;
 	int ret;
@@ -1140,6 +1179,7 @@ static int index_mail_write_body_snippet(struct index_mail *mail)
 		return 0;
 	}
 
+	i_gettimeofday(&start_time);
 	old_offset = mail->data.stream == NULL ? 0 : mail->data.stream->v_offset;
 	const char *reason = index_mail_cache_reason(&mail->mail.mail, "snippet");
 	if (mail_get_stream_because(&mail->mail.mail, NULL, NULL, reason, &input) < 0)
@@ -1153,8 +1193,12 @@ static int index_mail_write_body_snippet(struct index_mail *mail)
 	str = str_new(mail->mail.data_pool, 128);
 	str_append(str, BODY_SNIPPET_ALGO_V1);
 	ret = message_snippet_generate(input, BODY_SNIPPET_MAX_CHARS, str);
-	if (ret == 0)
+	if (ret == 0) {
 		mail->data.body_snippet = str_c(str);
+		index_mail_cache_add_recompute_cost(mail,
+			mail->ibox->cache_fields[MAIL_CACHE_BODY_SNIPPET].idx,
+			&start_time, 1, input->v_offset);
+	}
 	i_stream_destroy(&input);
 
 	i_stream_seek(mail->data.stream, old_offset);
@@ -1316,11 +1360,13 @@ static int index_mail_parse_body(struct index_mail *mail,
 				 enum index_cache_field field)
 {
 	struct index_mail_data *data = &mail->data;
+	struct timeval start_time;
 	uoff_t old_offset;
 	int ret;
 
 	i_assert(data->parser_ctx != NULL);
 
+	i_gettimeofday(&start_time);
 	old_offset = data->stream->v_offset;
 	i_stream_seek(data->stream, data->hdr_size.physical_size);
 
@@ -1336,6 +1382,12 @@ static int index_mail_parse_body(struct index_mail *mail,
 			*null_message_part_header_callback, NULL);
 	}
 	ret = index_mail_stream_check_failure(mail);
+	if (ret == 0 && field != MAIL_CACHE_FLAGS) {
+		/* MAIL_CACHE_FLAGS means there's no specific field */
+		index_mail_cache_add_recompute_cost(mail,
+			mail->ibox->cache_fields[field].idx, &start_time, 1,
+			data->stream->v_offset - data->hdr_size.physical_size);
+	}
 	if (index_mail_parse_body_finish(mail, field, TRUE) < 0)
 		ret = -1;
 
@@ -1508,6 +1560,36 @@ index_mail_parse_bodystructure_full(struct index_mail *mail,
 	return index_mail_parse_body(mail, field);
 }
 
+int index_mail_get_bodystructure_parts(struct index_mail *mail,
+				       struct message_part **parts_r)
+{
+	struct index_mail_data *data = &mail->data;
+	const char *bodystructure, *error;
+
+	if (data->bodystructure_parts == NULL) {
+		if (mail_get_special(&mail->mail.mail,
+				     MAIL_FETCH_IMAP_BODYSTRUCTURE,
+				     &bodystructure) < 0)
+			return -1;
+		if (data->parsed_bodystructure && data->parts != NULL) {
+			/* the message was just parsed, so the parts
+			   already have their data */
+			*parts_r = data->parts;
+			return 0;
+		}
+		if (imap_bodystructure_parse_full(bodystructure,
+				mail->mail.data_pool,
+				&data->bodystructure_parts, &error) < 0) {
+			mail_set_cache_corrupted(&mail->mail.mail,
+				MAIL_FETCH_IMAP_BODYSTRUCTURE, error);
+			data->bodystructure_parts = NULL;
+			return -1;
+		}
+	}
+	*parts_r = data->bodystructure_parts;
+	return 0;
+}
+
 static int index_mail_parse_bodystructure(struct index_mail *mail,
 					  enum index_cache_field field)
 {
@@ -2178,6 +2260,29 @@ void index_mail_set_seq(struct mail *_mail, uint32_t seq, bool saving)
 	mail->data.initialized = TRUE;
 }
 
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+static void
+index_mail_update_prefetch_latency(struct mail_storage *storage,
+				   const struct timeval *start_time)
+{
+	struct timeval now;
+	long long usecs;
+
+	i_gettimeofday(&now);
+	usecs = timeval_diff_usecs(&now, start_time);
+	if (usecs <= 0)
+		usecs = 1;
+	else if (usecs > INT_MAX)
+		usecs = INT_MAX;
+	if (storage->prefetch_open_usecs == 0)
+		storage->prefetch_open_usecs = usecs;
+	else {
+		storage->prefetch_open_usecs =
+			(storage->prefetch_open_usecs * 7ULL + usecs) / 8;
+	}
+}
+#endif
+
 bool index_mail_prefetch(struct mail *_mail)
 {
 	struct index_mail *mail = INDEX_MAIL(_mail);
@@ -2198,9 +2303,13 @@ bool index_mail_prefetch(struct mail *_mail)
 	}
 
 	if (mail->data.stream == NULL) {
+		struct timeval start_time;
+
+		i_gettimeofday(&start_time);
 		(void)mail_get_stream_because(_mail, NULL, NULL, "prefetch", &input);
 		if (mail->data.stream == NULL)
 			return TRUE;
+		index_mail_update_prefetch_latency(storage, &start_time);
 	}
 
 	/* tell OS to start reading the file into memory */
@@ -2289,6 +2398,7 @@ void index_mail_free(struct mail *_mail)
 	_mail->transaction->mail_ref_count--;
 
 	buffer_free(&mail->header_data);
+	buffer_free(&mail->header_cache_record);
 	if (array_is_created(&mail->header_lines))
 		array_free(&mail->header_lines);
 	if (array_is_created(&mail->header_match))
@@ -80,6 +80,8 @@ struct index_mail_data {
 	uint32_t parse_line_num;
 
 	struct message_part *parts;
+	/* parts with data parsed from the BODYSTRUCTURE string */
+	struct message_part *bodystructure_parts;
 	struct message_binary_part *bin_parts;
 	const char *envelope, *body, *bodystructure, *guid, *filename;
 	const char *from_envelope, *body_snippet;
@@ -154,6 +156,10 @@ struct index_mail {
 	ARRAY(uint8_t) header_match;
 	ARRAY(unsigned int) header_match_lines;
 	uint8_t header_match_value;
+	/* Full header of header_cache_record_uid being recorded for the
+	   mailbox's header cache. */
+	buffer_t *header_cache_record;
+	uint32_t header_cache_record_uid;
 
 	bool pop3_state_set:1;
 	/* close() is being called from mail_free() */
@@ -225,6 +231,11 @@ const char *const *index_mail_get_keywords(struct mail *_mail);
 const ARRAY_TYPE(keyword_indexes) *
 index_mail_get_keyword_indexes(struct mail *_mail);
 int index_mail_get_parts(struct mail *_mail, struct message_part **parts_r);
+/* Returns the message parts with their message_part_data filled. If the
+   message hasn't been parsed, the data comes from the cached BODYSTRUCTURE,
+   which is parsed only once per mail. */
+int index_mail_get_bodystructure_parts(struct index_mail *mail,
+				       struct message_part **parts_r);
 int index_mail_get_received_date(struct mail *_mail, time_t *date_r);
 int index_mail_get_save_date(struct mail *_mail, time_t *date_r);
 int index_mail_get_date(struct mail *_mail, time_t *date_r, int *timezone_r);
@@ -275,6 +286,13 @@ void index_mail_cache_add(struct index_mail *mail, enum index_cache_field field,
 			  const void *data, size_t data_size);
 void index_mail_cache_add_idx(struct index_mail *mail, unsigned int field_idx,
 			      const void *data, size_t data_size);
+/* Tell cache how long it took since start_time to recompute the field, and
+   how many bytes of the mail were read for it. */
+void index_mail_cache_add_recompute_cost(struct index_mail *mail,
+					 unsigned int field_idx,
+					 const struct timeval *start_time,
+					 unsigned int fields_count,
+					 uoff_t bytes);
 
 void index_mail_cache_pop3_data(struct mail *_mail,
 				const char *uidl, uint32_t order);
@@ -5,9 +5,9 @@
 #include "message-date.h"
 #include "message-address.h"
 #include "message-part-data.h"
-#include "imap-bodystructure.h"
 #include "mail-search.h"
 #include "mail-search-mime.h"
+#include "index-mail.h"
 #include "index-search-private.h"
 
 struct search_mimepart_stack {
@@ -530,7 +530,6 @@ static int search_arg_match_mimepart(struct search_mimepart_context *mpctx,
 				   struct mail_search_arg *arg)
 {
 	struct index_search_context *ctx = mpctx->index_ctx;
-	const char *bodystructure, *error;
 
 	if (arg->type != SEARCH_MIMEPART)
 		return -1;
@@ -541,13 +540,10 @@ static int search_arg_match_mimepart(struct search_mimepart_context *mpctx,
 		p_array_init(&mpctx->stack, mpctx->pool, 16);
 	}
 	if (mpctx->mime_parts == NULL) {
-		/* FIXME: could the mail object already have message_part tree with
-		   data? */
-		if (mail_get_special(ctx->cur_mail,
-			MAIL_FETCH_IMAP_BODYSTRUCTURE, &bodystructure) < 0)
-			return -1;
-		if (imap_bodystructure_parse_full(bodystructure, mpctx->pool,
-			&mpctx->mime_parts, &error) < 0)
+		/* the parts are kept in the mail, so they're parsed only
+		   once even if the args are matched multiple times */
+		if (index_mail_get_bodystructure_parts(INDEX_MAIL(ctx->cur_mail),
+						       &mpctx->mime_parts) < 0)
 			return -1;
 	}
 
@@ -0,0 +1,358 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "str.h"
+#include "mail-cache.h"
+#include "mail-search.h"
+#include "index-storage.h"
+#include "index-mail.h"
+#include "index-search-private.h"
+
+#include <float.h>
+
+/* Estimated size of a mail when its body needs to be read */
+#define SEARCH_PLAN_BODY_KBYTES 32ULL
+/* Estimated size of a mail's header */
+#define SEARCH_PLAN_HEADER_KBYTES 2ULL
+
+#define SEARCH_PLAN_COST_INDEX 0.1
+#define SEARCH_PLAN_COST_CACHE ((double)SEARCH_COST_CACHE)
+#define SEARCH_PLAN_COST_OPEN \
+	((double)(SEARCH_COST_DENTRY + SEARCH_COST_FILES_READ))
+#define SEARCH_PLAN_COST_HEADER \
+	(SEARCH_PLAN_COST_OPEN + SEARCH_PLAN_HEADER_KBYTES * SEARCH_COST_KBYTE)
+#define SEARCH_PLAN_COST_BODY \
+	(SEARCH_PLAN_COST_OPEN + SEARCH_PLAN_BODY_KBYTES * SEARCH_COST_KBYTE)
+
+/* Default selectivities, i.e. estimated ratio of matching mails */
+#define SEARCH_PLAN_SELECTIVITY_DEFAULT 0.5
+#define SEARCH_PLAN_SELECTIVITY_STRING 0.1
+#define SEARCH_PLAN_SELECTIVITY_KEYWORD 0.1
+#define SEARCH_PLAN_SELECTIVITY_FLAG 0.2
+
+struct search_plan_estimate {
+	/* Estimated cost of matching the arg for one mail, in the same units
+	   as search_get_cost() */
+	double cost;
+	/* Estimated ratio of mails the arg matches (0..1) */
+	double selectivity;
+};
+
+struct search_plan_arg {
+	struct mail_search_arg *arg;
+	struct search_plan_estimate est;
+	double rank;
+	unsigned int idx;
+};
+
+struct search_plan_context {
+	struct index_search_context *ctx;
+	const struct mail_index_header *hdr;
+};
+
+static void
+search_plan_list(struct search_plan_context *pctx,
+		 struct mail_search_arg **argsp, bool and_list,
+		 struct search_plan_estimate *est_r);
+
+static bool
+search_plan_cache_field_is_cached(struct search_plan_context *pctx,
+				  unsigned int field_idx)
+{
+	const struct mail_cache_field *field;
+
+	if (field_idx == UINT_MAX)
+		return FALSE;
+	field = mail_cache_register_get_field(pctx->ctx->box->cache, field_idx);
+	return (field->decision & ENUM_NEGATE(MAIL_CACHE_DECISION_FORCED)) !=
+		MAIL_CACHE_DECISION_NO;
+}
+
+static double
+search_plan_field_cost(struct search_plan_context *pctx,
+		       enum index_cache_field field, double uncached_cost)
+{
+	struct index_mailbox_context *ibox =
+		INDEX_STORAGE_CONTEXT(pctx->ctx->box);
+
+	return search_plan_cache_field_is_cached(pctx,
+			ibox->cache_fields[field].idx) ?
+		SEARCH_PLAN_COST_CACHE : uncached_cost;
+}
+
+static double
+search_plan_header_cost(struct search_plan_context *pctx, const char *name)
+{
+	unsigned int field_idx;
+
+	field_idx = mail_cache_register_lookup(pctx->ctx->box->cache,
+		t_strconcat("hdr.", name, NULL));
+	return search_plan_cache_field_is_cached(pctx, field_idx) ?
+		SEARCH_PLAN_COST_CACHE : SEARCH_PLAN_COST_HEADER;
+}
+
+static double
+search_plan_seqset_selectivity(const ARRAY_TYPE(seq_range) *seqset,
+			       uint32_t max_value)
+{
+	const struct seq_range *range;
+	uint64_t count = 0;
+
+	if (max_value == 0)
+		return 1;
+	array_foreach(seqset, range) {
+		if (range->seq1 > max_value)
+			continue;
+		count += (uint64_t)I_MIN(range->seq2, max_value) -
+			range->seq1 + 1;
+	}
+	return I_MIN((double)count / max_value, 1.0);
+}
+
+static double
+search_plan_flags_selectivity(struct search_plan_context *pctx,
+			      enum mail_flags flags)
+{
+	const struct mail_index_header *hdr = pctx->hdr;
+
+	if (hdr->messages_count == 0)
+		return SEARCH_PLAN_SELECTIVITY_DEFAULT;
+	if (flags == MAIL_SEEN)
+		return (double)hdr->seen_messages_count / hdr->messages_count;
+	if (flags == MAIL_DELETED)
+		return (double)hdr->deleted_messages_count / hdr->messages_count;
+	return SEARCH_PLAN_SELECTIVITY_FLAG;
+}
+
+static void
+search_plan_arg_estimate(struct search_plan_context *pctx,
+			 struct mail_search_arg *arg,
+			 struct search_plan_estimate *est_r)
+{
+	est_r->cost = SEARCH_PLAN_COST_INDEX;
+	est_r->selectivity = SEARCH_PLAN_SELECTIVITY_DEFAULT;
+
+	if (arg->match_always || arg->nonmatch_always) {
+		/* result is already known (e.g. from FTS) */
+		est_r->cost = 0;
+		est_r->selectivity = arg->match_always ? 1 : 0;
+		return;
+	}
+
+	switch (arg->type) {
+	case SEARCH_OR:
+		search_plan_list(pctx, &arg->value.subargs, FALSE, est_r);
+		break;
+	case SEARCH_SUB:
+		search_plan_list(pctx, &arg->value.subargs, TRUE, est_r);
+		break;
+	case SEARCH_ALL:
+		est_r->selectivity = 1;
+		break;
+	case SEARCH_SEQSET:
+		est_r->selectivity = search_plan_seqset_selectivity(
+			&arg->value.seqset, pctx->hdr->messages_count);
+		break;
+	case SEARCH_UIDSET:
+		est_r->selectivity = search_plan_seqset_selectivity(
+			&arg->value.seqset, pctx->hdr->next_uid - 1);
+		break;
+	case SEARCH_FLAGS:
+		est_r->selectivity =
+			search_plan_flags_selectivity(pctx, arg->value.flags);
+		break;
+	case SEARCH_KEYWORDS:
+		est_r->selectivity = SEARCH_PLAN_SELECTIVITY_KEYWORD;
+		break;
+	case SEARCH_MODSEQ:
+	case SEARCH_INTHREAD:
+	case SEARCH_REAL_UID:
+		break;
+	case SEARCH_BEFORE:
+	case SEARCH_ON:
+	case SEARCH_SINCE:
+		switch (arg->value.date_type) {
+		case MAIL_SEARCH_DATE_TYPE_SENT:
+			est_r->cost = search_plan_field_cost(pctx,
+				MAIL_CACHE_SENT_DATE, SEARCH_PLAN_COST_HEADER);
+			break;
+		case MAIL_SEARCH_DATE_TYPE_RECEIVED:
+			est_r->cost = search_plan_field_cost(pctx,
+				MAIL_CACHE_RECEIVED_DATE, SEARCH_PLAN_COST_OPEN);
+			break;
+		case MAIL_SEARCH_DATE_TYPE_SAVED:
+			est_r->cost = search_plan_field_cost(pctx,
+				MAIL_CACHE_SAVE_DATE, SEARCH_PLAN_COST_OPEN);
+			break;
+		}
+		break;
+	case SEARCH_SMALLER:
+	case SEARCH_LARGER:
+		est_r->cost = search_plan_field_cost(pctx,
+			MAIL_CACHE_VIRTUAL_FULL_SIZE, SEARCH_PLAN_COST_BODY);
+		break;
+	case SEARCH_HEADER:
+	case SEARCH_HEADER_ADDRESS:
+	case SEARCH_HEADER_COMPRESS_LWSP:
+		est_r->cost = search_plan_header_cost(pctx, arg->hdr_field_name);
+		est_r->selectivity = SEARCH_PLAN_SELECTIVITY_STRING;
+		break;
+	case SEARCH_BODY:
+	case SEARCH_TEXT:
+		est_r->cost = SEARCH_PLAN_COST_BODY;
+		est_r->selectivity = SEARCH_PLAN_SELECTIVITY_STRING;
+		break;
+	case SEARCH_SAVEDATESUPPORTED:
+	case SEARCH_MAILBOX:
+	case SEARCH_MAILBOX_GUID:
+	case SEARCH_MAILBOX_GLOB:
+		break;
+	case SEARCH_GUID:
+		est_r->cost = search_plan_field_cost(pctx, MAIL_CACHE_GUID,
+						     SEARCH_PLAN_COST_OPEN);
+		est_r->selectivity = 0;
+		break;
+	case SEARCH_MIMEPART:
+		est_r->cost = search_plan_field_cost(pctx,
+			MAIL_CACHE_IMAP_BODYSTRUCTURE, SEARCH_PLAN_COST_BODY);
+		est_r->selectivity = SEARCH_PLAN_SELECTIVITY_STRING;
+		break;
+	}
+	if (arg->match_not)
+		est_r->selectivity = 1 - est_r->selectivity;
+}
+
+static int search_plan_arg_cmp(const struct search_plan_arg *a1,
+			       const struct search_plan_arg *a2)
+{
+	if (a1->rank < a2->rank)
+		return -1;
+	if (a1->rank > a2->rank)
+		return 1;
+	/* equal ranks keep their original order */
+	if (a1->idx < a2->idx)
+		return -1;
+	return a1->idx > a2->idx ? 1 : 0;
+}
+
+static void
+search_plan_list(struct search_plan_context *pctx,
+		 struct mail_search_arg **argsp, bool and_list,
+		 struct search_plan_estimate *est_r)
+{
+	ARRAY(struct search_plan_arg) plan_args;
+	struct search_plan_arg *plan_arg;
+	struct mail_search_arg *arg, **nextp;
+	double remaining = 1;
+
+	t_array_init(&plan_args, 8);
+	for (arg = *argsp; arg != NULL; arg = arg->next) {
+		plan_arg = array_append_space(&plan_args);
+		plan_arg->arg = arg;
+		plan_arg->idx = array_count(&plan_args) - 1;
+		search_plan_arg_estimate(pctx, arg, &plan_arg->est);
+		/* With AND-lists the args that are cheapest per rejected mail
+		   are checked first. With OR-lists the args that are cheapest
+		   per matched mail are checked first. */
+		double stop_ratio = and_list ?
+			1 - plan_arg->est.selectivity :
+			plan_arg->est.selectivity;
+		plan_arg->rank = stop_ratio <= 0 ? DBL_MAX :
+			plan_arg->est.cost / stop_ratio;
+	}
+	array_sort(&plan_args, search_plan_arg_cmp);
+
+	nextp = argsp;
+	est_r->cost = 0;
+	array_foreach_modifiable(&plan_args, plan_arg) {
+		*nextp = plan_arg->arg;
+		nextp = &plan_arg->arg->next;
+
+		/* the arg is checked only if the previous args didn't
+		   already decide the result */
+		est_r->cost += remaining * plan_arg->est.cost;
+		remaining *= and_list ? plan_arg->est.selectivity :
+			1 - plan_arg->est.selectivity;
+	}
+	*nextp = NULL;
+	est_r->selectivity = and_list ? remaining : 1 - remaining;
+}
+
+static void
+search_plan_append_args(string_t *dest, const struct mail_search_arg *arg,
+			struct search_plan_context *pctx);
+
+static void
+search_plan_append_arg(string_t *dest, const struct mail_search_arg *arg,
+		       struct search_plan_context *pctx)
+{
+	struct search_plan_estimate est;
+	const char *error;
+
+	if (arg->match_not &&
+	    (arg->type == SEARCH_OR || arg->type == SEARCH_SUB))
+		str_append(dest, "NOT ");
+	if (arg->type == SEARCH_OR) {
+		str_append(dest, "OR(");
+		search_plan_append_args(dest, arg->value.subargs, pctx);
+		str_append_c(dest, ')');
+	} else if (arg->type == SEARCH_SUB) {
+		str_append_c(dest, '(');
+		search_plan_append_args(dest, arg->value.subargs, pctx);
+		str_append_c(dest, ')');
+	} else {
+		size_t pos = str_len(dest);
+		if (!mail_search_arg_to_imap(dest, arg, &error)) {
+			str_truncate(dest, pos);
+			str_printfa(dest, "<%s>", error);
+		}
+		/* estimating doesn't modify non-list args */
+		search_plan_arg_estimate(pctx, (struct mail_search_arg *)arg,
+					 &est);
+		str_printfa(dest, " [cost=%.1f sel=%.2f]",
+			    est.cost, est.selectivity);
+	}
+}
+
+static void
+search_plan_append_args(string_t *dest, const struct mail_search_arg *arg,
+			struct search_plan_context *pctx)
+{
+	for (; arg != NULL; arg = arg->next) {
+		search_plan_append_arg(dest, arg, pctx);
+		if (arg->next != NULL)
+			str_append(dest, ", ");
+	}
+}
+
+void index_search_plan(struct index_search_context *ctx)
+{
+	struct search_plan_context pctx = {
+		.ctx = ctx,
+		.hdr = mail_index_get_header(ctx->view),
+	};
+	struct search_plan_estimate est;
+
+	if (ctx->box->cache == NULL)
+		return;
+
+	T_BEGIN {
+		search_plan_list(&pctx, &ctx->mail_ctx.args->args, TRUE, &est);
+		if (event_want_debug(ctx->box->event)) {
+			string_t *str = t_str_new(128);
+			search_plan_append_args(str, ctx->mail_ctx.args->args,
+						&pctx);
+			struct event_passthrough *e =
+				event_create_passthrough(ctx->box->event)->
+				set_name("mail_search_plan")->
+				add_str("plan", str_c(str))->
+				add_int("estimated_cost", (intmax_t)est.cost)->
+				add_int("messages_count",
+					pctx.hdr->messages_count);
+			e_debug(e->event(), "Search plan (estimated cost "
+				"%.1f per mail, selectivity %.2f): %s",
+				est.cost, est.selectivity, str_c(str));
+		}
+	} T_END;
+}
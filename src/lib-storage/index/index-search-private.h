@@ -5,8 +5,23 @@
 
 #include <sys/time.h>
 
+/* Relative costs used for estimating how expensive searching is */
+#define SEARCH_COST_DENTRY 3ULL
+#define SEARCH_COST_ATTR 1ULL
+#define SEARCH_COST_FILES_READ 25ULL
+#define SEARCH_COST_KBYTE 15ULL
+#define SEARCH_COST_CACHE 1ULL
+
 struct mail_search_mime_part;
 struct imap_message_part;
+struct message_search_context;
+
+/* SEARCH_BODY or SEARCH_TEXT args whose keys are all searched with a single
+   pass over the message. */
+struct index_search_body_group {
+	ARRAY(struct mail_search_arg *) args;
+	struct message_search_context *msg_search_ctx;
+};
 
 struct index_search_context {
         struct mail_search_context mail_ctx;
@@ -28,16 +43,30 @@ struct index_search_context {
 	struct timeval interrupt_start_time;
 	unsigned long long cost, next_time_check_cost;
 
+	struct index_search_body_group body_group, text_group;
+
+	/* Sequences matching the root level index-only args. Built at init
+	   with a single pass over the index records, so the per-mail matching
+	   doesn't need to look at the non-matching mails at all. */
+	ARRAY_TYPE(seq_range) prefilter_seqs;
+	unsigned int prefilter_range_idx;
+
 	bool failed:1;
 	bool sorted:1;
 	bool have_seqsets:1;
 	bool have_index_args:1;
 	bool have_mailbox_args:1;
 	bool have_nonmatch_always:1;
+	bool body_groups_initialized:1;
+	bool have_prefilter:1;
 };
 
 struct mail *index_search_get_mail(struct index_search_context *ctx);
 
+/* Reorder the search args so that cheap and selective args are checked
+   first, and log the plan as a debug event. */
+void index_search_plan(struct index_search_context *ctx);
+
 int index_search_mime_arg_match(struct mail_search_arg *args,
 	struct index_search_context *ctx);
 void index_search_mime_arg_deinit(struct mail_search_arg *arg,
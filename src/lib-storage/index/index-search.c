@@ -27,17 +27,24 @@
 
 #define SEARCH_NOTIFY_INTERVAL_SECS 10
 
-#define SEARCH_COST_DENTRY 3ULL
-#define SEARCH_COST_ATTR 1ULL
-#define SEARCH_COST_FILES_READ 25ULL
-#define SEARCH_COST_KBYTE 15ULL
-#define SEARCH_COST_CACHE 1ULL
-
 #define SEARCH_MIN_NONBLOCK_USECS 200000
 #define SEARCH_MAX_NONBLOCK_USECS 250000
 #define SEARCH_INITIAL_MAX_COST 30000
+
+/* Maximum total length of the keys searched with a single multi-key search.
+   The memory usage grows with this, so with longer keys fall back to
+   searching each key separately. */
+#define SEARCH_BODY_GROUP_MAX_KEYS_LEN 1024
 #define SEARCH_RECALC_MIN_USECS 50000
 
+/* Build the index-only prefilter only when searching at least this many
+   mails. With less mails the per-mail matching is fast enough. */
+#define SEARCH_PREFILTER_MIN_MESSAGES 256
+/* With mail_prefetch_adaptive, don't prefetch if opening mails takes less
+   than this. Otherwise prefetch one more mail for each this many usecs. */
+#define SEARCH_PREFETCH_LOCAL_USECS 200
+#define SEARCH_PREFETCH_USECS_PER_MAIL 1000
+
 /* If interrupt signal is received and search doesn't finish in this many
    milliseconds, fail the search with MAIL_ERRSTR_INTERRUPTED. */
 #define SEARCH_INTERRUPT_DELAY_MSECS 2000
@@ -61,6 +68,8 @@ struct search_body_context {
         struct index_search_context *index_ctx;
 	struct istream *input;
 	struct message_part *part;
+
+	bool read_failed:1;
 };
 
 static void search_parse_msgset_args(unsigned int messages_count,
@@ -690,11 +699,45 @@ static void search_header(struct message_header_line *hdr,
 	}
 }
 
+static int
+search_body_msg_multi(struct search_body_context *ctx,
+		      struct message_search_context *const *msg_search_ctxs,
+		      unsigned int count)
+{
+	const char *error;
+	int ret;
+
+	i_stream_seek(ctx->input, 0);
+	ret = message_search_msg_multi(msg_search_ctxs, count, ctx->input,
+				       ctx->part, &error);
+	if (ret < 0 && ctx->input->stream_errno == 0) {
+		/* try again without cached parts */
+		index_mail_set_message_parts_corrupted(ctx->index_ctx->cur_mail, error);
+
+		i_stream_seek(ctx->input, 0);
+		ret = message_search_msg_multi(msg_search_ctxs, count,
+					       ctx->input, NULL, &error);
+		i_assert(ret >= 0 || ctx->input->stream_errno != 0);
+	}
+	if (ctx->input->stream_errno != 0) {
+		mailbox_set_critical(ctx->index_ctx->box,
+			"read(%s) failed: %s", i_stream_get_name(ctx->input),
+			i_stream_get_error(ctx->input));
+		ctx->read_failed = TRUE;
+	}
+	return ret;
+}
+
+static int search_body_msg(struct search_body_context *ctx,
+			   struct message_search_context *msg_search_ctx)
+{
+	return search_body_msg_multi(ctx, &msg_search_ctx, 1);
+}
+
 static void search_body(struct mail_search_arg *arg,
 			struct search_body_context *ctx)
 {
 	struct message_search_context *msg_search_ctx;
-	const char *error;
 	int ret;
 
 	switch (arg->type) {
@@ -710,24 +753,166 @@ static void search_body(struct mail_search_arg *arg,
 		ARG_SET_RESULT(arg, 0);
 		return;
 	}
+	if (ctx->read_failed) {
+		/* don't log the same error again for each arg */
+		return;
+	}
 
-	i_stream_seek(ctx->input, 0);
-	ret = message_search_msg(msg_search_ctx, ctx->input, ctx->part, &error);
-	if (ret < 0 && ctx->input->stream_errno == 0) {
-		/* try again without cached parts */
-		index_mail_set_message_parts_corrupted(ctx->index_ctx->cur_mail, error);
+	ret = search_body_msg(ctx, msg_search_ctx);
+	ARG_SET_RESULT(arg, ret);
+}
 
-		i_stream_seek(ctx->input, 0);
-		ret = message_search_msg(msg_search_ctx, ctx->input, NULL, &error);
-		i_assert(ret >= 0 || ctx->input->stream_errno != 0);
+static void
+search_body_group_init(struct index_search_context *ctx,
+		       struct index_search_body_group *group,
+		       const ARRAY_TYPE(const_string) *keys,
+		       enum message_search_flags flags)
+{
+	const char *key;
+	size_t keys_len = 0;
+
+	array_foreach_elem(keys, key)
+		keys_len += strlen(key);
+	if (array_count(keys) < 2 || keys_len > SEARCH_BODY_GROUP_MAX_KEYS_LEN) {
+		/* search the keys separately */
+		array_free(&group->args);
+		return;
 	}
-	if (ctx->input->stream_errno != 0) {
-		mailbox_set_critical(ctx->index_ctx->box,
-			"read(%s) failed: %s", i_stream_get_name(ctx->input),
-			i_stream_get_error(ctx->input));
+	group->msg_search_ctx =
+		message_search_init_multi(array_front(keys), array_count(keys),
+					  ctx->mail_ctx.normalizer, flags);
+}
+
+static void
+search_body_groups_add(struct index_search_context *ctx,
+		       struct mail_search_arg *arg,
+		       ARRAY_TYPE(const_string) *body_keys,
+		       ARRAY_TYPE(const_string) *text_keys)
+{
+	string_t *dtc;
+	const char *key;
+
+	for (; arg != NULL; arg = arg->next) {
+		switch (arg->type) {
+		case SEARCH_OR:
+		case SEARCH_SUB:
+			search_body_groups_add(ctx, arg->value.subargs,
+					       body_keys, text_keys);
+			continue;
+		case SEARCH_BODY:
+		case SEARCH_TEXT:
+			break;
+		default:
+			continue;
+		}
+		if (arg->value.str[0] == '\0' ||
+		    arg->match_always || arg->nonmatch_always)
+			continue;
+
+		dtc = t_str_new(128);
+		if (ctx->mail_ctx.normalizer(arg->value.str,
+					     strlen(arg->value.str), dtc) < 0)
+			i_panic("search key not utf8: %s", arg->value.str);
+		if (str_len(dtc) == 0) {
+			/* search_body() handles these as non-matches */
+			continue;
+		}
+		key = str_c(dtc);
+		if (arg->type == SEARCH_BODY) {
+			array_push_back(&ctx->body_group.args, &arg);
+			array_push_back(body_keys, &key);
+		} else {
+			array_push_back(&ctx->text_group.args, &arg);
+			array_push_back(text_keys, &key);
+		}
 	}
+}
 
-	ARG_SET_RESULT(arg, ret);
+static void search_body_groups_init(struct index_search_context *ctx)
+{
+	ctx->body_groups_initialized = TRUE;
+
+	T_BEGIN {
+		ARRAY_TYPE(const_string) body_keys, text_keys;
+
+		i_array_init(&ctx->body_group.args, 8);
+		i_array_init(&ctx->text_group.args, 8);
+		t_array_init(&body_keys, 8);
+		t_array_init(&text_keys, 8);
+		search_body_groups_add(ctx, ctx->mail_ctx.args->args,
+				       &body_keys, &text_keys);
+		search_body_group_init(ctx, &ctx->body_group, &body_keys,
+				       MESSAGE_SEARCH_FLAG_SKIP_HEADERS);
+		search_body_group_init(ctx, &ctx->text_group, &text_keys, 0);
+	} T_END;
+}
+
+static void search_body_group_deinit(struct index_search_body_group *group)
+{
+	if (group->msg_search_ctx != NULL)
+		message_search_deinit(&group->msg_search_ctx);
+	if (array_is_created(&group->args))
+		array_free(&group->args);
+}
+
+static bool search_body_group_want(struct index_search_body_group *group,
+				   struct search_body_context *ctx)
+{
+	struct mail_search_arg *const *args;
+	unsigned int i, count, unknown_count = 0;
+
+	if (group->msg_search_ctx == NULL || ctx->read_failed)
+		return FALSE;
+
+	args = array_get(&group->args, &count);
+	for (i = 0; i < count; i++) {
+		if (args[i]->result == -1)
+			unknown_count++;
+	}
+	/* with less than 2 unknown keys leave it to search_body() */
+	return unknown_count >= 2;
+}
+
+static void search_body_group_set_results(struct index_search_body_group *group)
+{
+	struct mail_search_arg *const *args;
+	unsigned int i, count;
+	int ret;
+
+	args = array_get(&group->args, &count);
+	for (i = 0; i < count; i++) {
+		if (args[i]->result != -1)
+			continue;
+		ret = message_search_is_key_found(group->msg_search_ctx, i) ?
+			1 : 0;
+		ARG_SET_RESULT(args[i], ret);
+	}
+}
+
+static void search_body_groups(struct index_search_context *ctx,
+			       struct search_body_context *body_ctx)
+{
+	struct message_search_context *msg_search_ctxs[2];
+	bool want_text, want_body;
+	unsigned int count = 0;
+
+	want_text = search_body_group_want(&ctx->text_group, body_ctx);
+	want_body = search_body_group_want(&ctx->body_group, body_ctx);
+	/* search both TEXT and BODY keys with the same pass. The TEXT
+	   context must be first, since it decodes the headers as well. */
+	if (want_text)
+		msg_search_ctxs[count++] = ctx->text_group.msg_search_ctx;
+	if (want_body)
+		msg_search_ctxs[count++] = ctx->body_group.msg_search_ctx;
+	if (count == 0)
+		return;
+
+	if (search_body_msg_multi(body_ctx, msg_search_ctxs, count) < 0)
+		return;
+	if (want_text)
+		search_body_group_set_results(&ctx->text_group);
+	if (want_body)
+		search_body_group_set_results(&ctx->body_group);
 }
 
 static int search_arg_match_text(struct mail_search_arg *args,
@@ -862,6 +1047,11 @@ static int search_arg_match_text(struct mail_search_arg *args,
 	(void)mail_get_parts(ctx->cur_mail, &body_ctx.part);
 	ctx->cur_mail->lookup_abort = MAIL_LOOKUP_ABORT_NEVER;
 
+	/* With multiple BODY/TEXT keys, search them all with a single pass
+	   over the message. The rest are searched one by one. */
+	if (!ctx->body_groups_initialized)
+		search_body_groups_init(ctx);
+	search_body_groups(ctx, &body_ctx);
 	return mail_search_args_foreach(args, search_body, &body_ctx);
 }
 
@@ -1135,6 +1325,133 @@ static void search_get_seqset(struct index_search_context *ctx,
 	}
 }
 
+static bool search_prefilter_arg_is_usable(struct index_search_context *ctx,
+					   const struct mail_search_arg *arg)
+{
+	enum mail_flags pvt_flags_mask;
+
+	if (arg->match_always || arg->nonmatch_always)
+		return FALSE;
+
+	switch (arg->type) {
+	case SEARCH_SEQSET:
+	case SEARCH_UIDSET:
+	case SEARCH_INTHREAD:
+	case SEARCH_KEYWORDS:
+		return TRUE;
+	case SEARCH_FLAGS:
+		/* recent and private flags aren't in the index records */
+		pvt_flags_mask = ctx->box->view_pvt == NULL ? 0 :
+			mailbox_get_private_flags_mask(ctx->box);
+		return (arg->value.flags & (MAIL_RECENT | pvt_flags_mask)) == 0;
+	default:
+		return FALSE;
+	}
+}
+
+static bool
+search_prefilter_arg_match(struct index_search_context *ctx,
+			   const struct mail_search_arg *arg, uint32_t seq,
+			   const struct mail_index_record *rec,
+			   ARRAY_TYPE(keyword_indexes) *keyword_indexes)
+{
+	const struct mail_keywords *search_kws;
+	const unsigned int *kw_idx;
+	unsigned int i, j, count;
+	bool match;
+
+	switch (arg->type) {
+	case SEARCH_SEQSET:
+		match = seq_range_exists(&arg->value.seqset, seq);
+		break;
+	case SEARCH_UIDSET:
+	case SEARCH_INTHREAD:
+		match = seq_range_exists(&arg->value.seqset, rec->uid);
+		break;
+	case SEARCH_FLAGS:
+		match = (rec->flags & arg->value.flags) == arg->value.flags;
+		break;
+	case SEARCH_KEYWORDS:
+		search_kws = arg->initialized.keywords;
+		match = search_kws->count > 0;
+		if (!match)
+			break;
+		mail_index_lookup_keywords(ctx->view, seq, keyword_indexes);
+		kw_idx = array_get(keyword_indexes, &count);
+		for (i = 0; i < search_kws->count && match; i++) {
+			for (j = 0; j < count; j++) {
+				if (search_kws->idx[i] == kw_idx[j])
+					break;
+			}
+			match = j < count;
+		}
+		break;
+	default:
+		i_unreached();
+	}
+	return match != arg->match_not;
+}
+
+static void search_build_prefilter(struct index_search_context *ctx)
+{
+	ARRAY(const struct mail_search_arg *) prefilter_args;
+	ARRAY_TYPE(keyword_indexes) keyword_indexes;
+	const struct mail_search_arg *arg, *const *args;
+	const struct mail_index_record *rec;
+	unsigned int i, count;
+	uint32_t seq;
+
+	if (ctx->seq1 > ctx->seq2 ||
+	    ctx->seq2 - ctx->seq1 + 1 < SEARCH_PREFILTER_MIN_MESSAGES)
+		return;
+
+	t_array_init(&prefilter_args, 8);
+	for (arg = ctx->mail_ctx.args->args; arg != NULL; arg = arg->next) {
+		if (search_prefilter_arg_is_usable(ctx, arg))
+			array_push_back(&prefilter_args, &arg);
+	}
+	args = array_get(&prefilter_args, &count);
+	if (count == 0)
+		return;
+
+	t_array_init(&keyword_indexes, 32);
+	i_array_init(&ctx->prefilter_seqs, 64);
+	for (seq = ctx->seq1; seq <= ctx->seq2; seq++) {
+		rec = mail_index_lookup(ctx->view, seq);
+		for (i = 0; i < count; i++) {
+			if (!search_prefilter_arg_match(ctx, args[i], seq, rec,
+							&keyword_indexes))
+				break;
+		}
+		if (i == count)
+			seq_range_array_add(&ctx->prefilter_seqs, seq);
+	}
+	ctx->have_prefilter = TRUE;
+
+	e_debug(ctx->box->event, "Search index prefilter: %u/%u mails "
+		"left to match (%u args)",
+		seq_range_count(&ctx->prefilter_seqs),
+		ctx->seq2 - ctx->seq1 + 1, count);
+}
+
+static bool
+search_prefilter_next(struct index_search_context *ctx, uint32_t *seq)
+{
+	const struct seq_range *range;
+	unsigned int count;
+
+	range = array_get(&ctx->prefilter_seqs, &count);
+	while (ctx->prefilter_range_idx < count &&
+	       range[ctx->prefilter_range_idx].seq2 < *seq)
+		ctx->prefilter_range_idx++;
+	if (ctx->prefilter_range_idx == count)
+		return FALSE;
+	range += ctx->prefilter_range_idx;
+	if (*seq < range->seq1)
+		*seq = range->seq1;
+	return TRUE;
+}
+
 static int search_build_subthread(struct mail_thread_iterate_context *iter,
 				  ARRAY_TYPE(seq_range) *uids)
 {
@@ -1337,6 +1654,10 @@ index_storage_search_init(struct mailbox_transaction_context *t,
 
 	search_get_seqset(ctx, status.messages, args->args);
 	(void)mail_search_args_foreach(args->args, search_init_arg, ctx);
+	index_search_plan(ctx);
+	T_BEGIN {
+		search_build_prefilter(ctx);
+	} T_END;
 
 	/* Need to reset results for match_always cases */
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
@@ -1371,6 +1692,8 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 	mail_search_args_reset(ctx->mail_ctx.args->args, FALSE);
 	(void)mail_search_args_foreach(ctx->mail_ctx.args->args,
 				       search_arg_deinit, ctx);
+	search_body_group_deinit(&ctx->body_group);
+	search_body_group_deinit(&ctx->text_group);
 
 	mailbox_header_lookup_unref(&ctx->mail_ctx.wanted_headers);
 	if (ctx->mail_ctx.sort_program != NULL) {
@@ -1379,6 +1702,8 @@ int index_storage_search_deinit(struct mail_search_context *_ctx)
 	}
 	if (ctx->thread_ctx != NULL)
 		mail_thread_deinit(&ctx->thread_ctx);
+	if (array_is_created(&ctx->prefilter_seqs))
+		array_free(&ctx->prefilter_seqs);
 	array_free(&ctx->mail_ctx.results);
 	array_free(&ctx->mail_ctx.module_contexts);
 
@@ -1696,13 +2021,39 @@ static int search_more_with_mail(struct index_search_context *ctx,
 	return ret;
 }
 
+static unsigned int
+index_search_get_prefetch_window(struct index_search_context *ctx)
+{
+	struct mail_storage *storage = ctx->box->storage;
+	unsigned int usecs, window;
+
+	if (ctx->mail_ctx.max_mails <= 1 ||
+	    !storage->set->mail_prefetch_adaptive)
+		return ctx->mail_ctx.max_mails;
+
+	/* Size the window by how long it has taken to open the mails.
+	   With fast storage the mails are read before prefetching would
+	   help and it just wastes memory, while slow storage benefits
+	   from having more reads in progress. */
+	usecs = storage->prefetch_open_usecs;
+	if (usecs == 0) {
+		/* not measured yet */
+		return 2;
+	}
+	if (usecs < SEARCH_PREFETCH_LOCAL_USECS)
+		return 1;
+	window = 1 + usecs / SEARCH_PREFETCH_USECS_PER_MAIL;
+	return I_MIN(window, ctx->mail_ctx.max_mails);
+}
+
 struct mail *index_search_get_mail(struct index_search_context *ctx)
 {
 	struct index_mail *imail;
 	struct mail *const *mails, *mail;
 	unsigned int count;
 
-	if (ctx->mail_ctx.unused_mail_idx == ctx->mail_ctx.max_mails)
+	if (ctx->mail_ctx.unused_mail_idx >=
+	    index_search_get_prefetch_window(ctx))
 		return NULL;
 
 	mails = array_get(&ctx->mail_ctx.mails, &count);
@@ -1917,6 +2268,12 @@ bool index_storage_search_next_update_seq(struct mail_search_context *_ctx)
 
 	ret = 0;
 	while (_ctx->seq <= ctx->seq2) {
+		if (ctx->have_prefilter &&
+		    !search_prefilter_next(ctx, &_ctx->seq)) {
+			/* no more mails can match */
+			_ctx->seq = ctx->seq2 + 1;
+			break;
+		}
 		/* check if the sequence matches */
 		ret = mail_search_args_foreach(ctx->mail_ctx.args->args,
 					       search_seqset_arg, ctx);
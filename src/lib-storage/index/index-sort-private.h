@@ -8,6 +8,9 @@ struct mail_search_sort_program {
 	enum mail_sort_type sort_program[MAX_SORT_PROGRAM_SIZE];
 	struct mail *temp_mail;
 	unsigned int slow_mails_left;
+	/* Index record extensions caching DATE and ARRIVAL sort keys, or
+	   (uint32_t)-1 if the sort program doesn't use them. */
+	uint32_t date_ext_id, arrival_ext_id;
 
 	void (*sort_list_add)(struct mail_search_sort_program *program,
 			      struct mail *mail);
@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "array.h"
 #include "str.h"
+#include "sort.h"
 #include "unichar.h"
 #include "message-address.h"
 #include "message-header-decode.h"
@@ -10,6 +11,9 @@
 #include "index-storage.h"
 #include "index-sort-private.h"
 
+/* Use radix sort instead of comparison sort for numeric sort keys when
+   sorting at least this many mails. */
+#define INDEX_SORT_RADIX_MIN_NODES 1024
 
 struct mail_sort_node_date {
 	uint32_t seq;
@@ -71,6 +75,87 @@ index_sort_program_set_date_failed(struct mail_search_sort_program *program,
 	}
 }
 
+static int
+index_sort_get_date_uncached(struct mail *mail, enum mail_sort_type sort_type,
+			     time_t *date_r)
+{
+	int tz;
+
+	if (sort_type == MAIL_SORT_ARRIVAL)
+		return mail_get_received_date(mail, date_r);
+
+	if (mail_get_date(mail, date_r, &tz) < 0)
+		return -1;
+	if (*date_r == 0)
+		return mail_get_received_date(mail, date_r);
+	return 0;
+}
+
+uint32_t index_sort_date_ext_register(struct mailbox *box,
+				      enum mail_sort_type sort_type)
+{
+	const char *name;
+
+	switch (sort_type) {
+	case MAIL_SORT_ARRIVAL:
+		name = "sort-arrival";
+		break;
+	case MAIL_SORT_DATE:
+		name = "sort-date";
+		break;
+	default:
+		i_unreached();
+	}
+	return mail_index_ext_register(box->index, name, 0, sizeof(uint32_t),
+				       sizeof(uint32_t));
+}
+
+int index_sort_get_date(struct mail *mail, enum mail_sort_type sort_type,
+			uint32_t ext_id, time_t *date_r)
+{
+	const void *data;
+	uint32_t value;
+	bool expunged;
+
+	/* The dates never change for an existing message, so once they're
+	   looked up they can be kept in the index. This allows sorting
+	   without accessing the cache file at all. 0 means the date isn't
+	   known yet, dates that don't fit into 32 bits are never stored. */
+	mail_index_lookup_ext(mail->transaction->view, mail->seq, ext_id,
+			      &data, &expunged);
+	if (data != NULL && !expunged) {
+		value = *(const uint32_t *)data;
+		if (value != 0) {
+			*date_r = value;
+			return 0;
+		}
+	}
+
+	if (index_sort_get_date_uncached(mail, sort_type, date_r) < 0)
+		return -1;
+	if (!expunged && *date_r > 0 && *date_r < (time_t)(uint32_t)-1) {
+		value = *date_r;
+		mail_index_update_ext(mail->transaction->itrans, mail->seq,
+				      ext_id, &value, NULL);
+	}
+	return 0;
+}
+
+static time_t
+index_sort_get_date_key(struct mail_search_sort_program *program,
+			struct mail *mail, enum mail_sort_type sort_type)
+{
+	uint32_t ext_id = sort_type == MAIL_SORT_ARRIVAL ?
+		program->arrival_ext_id : program->date_ext_id;
+	time_t date;
+
+	i_assert(ext_id != (uint32_t)-1);
+
+	if (index_sort_get_date(mail, sort_type, ext_id, &date) < 0)
+		return index_sort_program_set_date_failed(program, mail);
+	return date;
+}
+
 static void
 index_sort_list_add_arrival(struct mail_search_sort_program *program,
 			    struct mail *mail)
@@ -80,8 +165,7 @@ index_sort_list_add_arrival(struct mail_search_sort_program *program,
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_received_date(mail, &node->date) < 0)
-		node->date = index_sort_program_set_date_failed(program, mail);
+	node->date = index_sort_get_date_key(program, mail, MAIL_SORT_ARRIVAL);
 }
 
 static void
@@ -90,16 +174,10 @@ index_sort_list_add_date(struct mail_search_sort_program *program,
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
 	struct mail_sort_node_date *node;
-	int tz;
 
 	node = array_append_space(nodes);
 	node->seq = mail->seq;
-	if (mail_get_date(mail, &node->date, &tz) < 0)
-		node->date = index_sort_program_set_date_failed(program, mail);
-	else if (node->date == 0) {
-		if (mail_get_received_date(mail, &node->date) < 0)
-			node->date = index_sort_program_set_date_failed(program, mail);
-	}
+	node->date = index_sort_get_date_key(program, mail, MAIL_SORT_DATE);
 }
 
 static void
@@ -211,12 +289,82 @@ static int sort_node_date_cmp(const struct mail_sort_node_date *n1,
 					n1->seq, n2->seq);
 }
 
+static bool
+index_sort_radix_usable(struct mail_search_sort_program *program,
+			unsigned int count)
+{
+	/* With secondary sort keys the ties would need to be sorted with the
+	   comparison function anyway. Without them the ties are ordered by
+	   sequence, which the stable radix sort keeps. */
+	return count >= INDEX_SORT_RADIX_MIN_NODES &&
+		program->sort_program[1] == MAIL_SORT_END;
+}
+
+static bool
+index_sort_radix_date(ARRAY_TYPE(mail_sort_node_date) *nodes, bool reverse)
+{
+	struct mail_sort_node_date *node;
+	struct sort_radix_u64_node *radix;
+	unsigned int i, count;
+	uint64_t key;
+
+	node = array_get_modifiable(nodes, &count);
+	radix = i_new(struct sort_radix_u64_node, count);
+	for (i = 0; i < count; i++) {
+		if (i > 0 && node[i].seq <= node[i-1].seq) {
+			/* ties wouldn't end up sorted by sequence */
+			i_free(radix);
+			return FALSE;
+		}
+		/* convert the signed time to unsigned preserving its order */
+		key = (uint64_t)(int64_t)node[i].date ^ (1ULL << 63);
+		radix[i].key = !reverse ? key : ~key;
+		radix[i].value = node[i].seq;
+	}
+	sort_radix_u64(radix, count);
+	for (i = 0; i < count; i++) {
+		key = !reverse ? radix[i].key : ~radix[i].key;
+		node[i].seq = radix[i].value;
+		node[i].date = (time_t)(int64_t)(key ^ (1ULL << 63));
+	}
+	i_free(radix);
+	return TRUE;
+}
+
+static bool
+index_sort_radix_size(ARRAY_TYPE(mail_sort_node_size) *nodes, bool reverse)
+{
+	struct mail_sort_node_size *node;
+	struct sort_radix_u64_node *radix;
+	unsigned int i, count;
+
+	node = array_get_modifiable(nodes, &count);
+	radix = i_new(struct sort_radix_u64_node, count);
+	for (i = 0; i < count; i++) {
+		if (i > 0 && node[i].seq <= node[i-1].seq) {
+			i_free(radix);
+			return FALSE;
+		}
+		radix[i].key = !reverse ? node[i].size : ~(uint64_t)node[i].size;
+		radix[i].value = node[i].seq;
+	}
+	sort_radix_u64(radix, count);
+	for (i = 0; i < count; i++) {
+		node[i].seq = radix[i].value;
+		node[i].size = !reverse ? radix[i].key : ~radix[i].key;
+	}
+	i_free(radix);
+	return TRUE;
+}
+
 static void
 index_sort_list_finish_date(struct mail_search_sort_program *program)
 {
 	ARRAY_TYPE(mail_sort_node_date) *nodes = program->context;
 
-	array_sort(nodes, sort_node_date_cmp);
+	if (!index_sort_radix_usable(program, array_count(nodes)) ||
+	    !index_sort_radix_date(nodes, static_node_cmp_context.reverse))
+		array_sort(nodes, sort_node_date_cmp);
 	memcpy(&program->seqs, nodes, sizeof(program->seqs));
 	i_free(nodes);
 	program->context = NULL;
@@ -242,7 +390,9 @@ index_sort_list_finish_size(struct mail_search_sort_program *program)
 {
 	ARRAY_TYPE(mail_sort_node_size) *nodes = program->context;
 
-	array_sort(nodes, sort_node_size_cmp);
+	if (!index_sort_radix_usable(program, array_count(nodes)) ||
+	    !index_sort_radix_size(nodes, static_node_cmp_context.reverse))
+		array_sort(nodes, sort_node_size_cmp);
 	memcpy(&program->seqs, nodes, sizeof(program->seqs));
 	i_free(nodes);
 	program->context = NULL;
@@ -395,10 +545,24 @@ index_sort_program_init(struct mailbox_transaction_context *t,
 	if (program->slow_mails_left == 0)
 		program->slow_mails_left = UINT_MAX;
 
+	program->date_ext_id = (uint32_t)-1;
+	program->arrival_ext_id = (uint32_t)-1;
 	for (i = 0; i < MAX_SORT_PROGRAM_SIZE; i++) {
 		program->sort_program[i] = sort_program[i];
 		if (sort_program[i] == MAIL_SORT_END)
 			break;
+		switch (sort_program[i] & MAIL_SORT_MASK) {
+		case MAIL_SORT_ARRIVAL:
+			program->arrival_ext_id = index_sort_date_ext_register(
+				t->box, MAIL_SORT_ARRIVAL);
+			break;
+		case MAIL_SORT_DATE:
+			program->date_ext_id = index_sort_date_ext_register(
+				t->box, MAIL_SORT_DATE);
+			break;
+		default:
+			break;
+		}
 	}
 	if (i == MAX_SORT_PROGRAM_SIZE)
 		i_panic("index_sort_program_init(): Invalid sort program");
@@ -622,7 +786,7 @@ int index_sort_node_cmp_type(struct mail_search_sort_program *program,
 	time_t time1, time2;
 	uoff_t size1, size2;
 	float float1, float2;
-	int tz, ret = 0;
+	int ret = 0;
 
 	sort_type = *sort_program & MAIL_SORT_MASK;
 	switch (sort_type) {
@@ -646,33 +810,11 @@ int index_sort_node_cmp_type(struct mail_search_sort_program *program,
 		} T_END;
 		break;
 	case MAIL_SORT_ARRIVAL:
-		index_sort_set_seq(program, mail, seq1);
-		if (mail_get_received_date(mail, &time1) < 0)
-			time1 = index_sort_program_set_date_failed(program, mail);
-
-		index_sort_set_seq(program, mail, seq2);
-		if (mail_get_received_date(mail, &time2) < 0)
-			time2 = index_sort_program_set_date_failed(program, mail);
-
-		ret = time1 < time2 ? -1 :
-			(time1 > time2 ? 1 : 0);
-		break;
 	case MAIL_SORT_DATE:
 		index_sort_set_seq(program, mail, seq1);
-		if (mail_get_date(mail, &time1, &tz) < 0)
-			time1 = index_sort_program_set_date_failed(program, mail);
-		else if (time1 == 0) {
-			if (mail_get_received_date(mail, &time1) < 0)
-				time1 = index_sort_program_set_date_failed(program, mail);
-		}
-
+		time1 = index_sort_get_date_key(program, mail, sort_type);
 		index_sort_set_seq(program, mail, seq2);
-		if (mail_get_date(mail, &time2, &tz) < 0)
-			time2 = index_sort_program_set_date_failed(program, mail);
-		else if (time2 == 0) {
-			if (mail_get_received_date(mail, &time2) < 0)
-				time2 = index_sort_program_set_date_failed(program, mail);
-		}
+		time2 = index_sort_get_date_key(program, mail, sort_type);
 
 		ret = time1 < time2 ? -1 :
 			(time1 > time2 ? 1 : 0);
@@ -15,4 +15,15 @@ void index_sort_list_finish(struct mail_search_sort_program *program);
 bool index_sort_list_next(struct mail_search_sort_program *program,
 			  uint32_t *seq_r);
 
+/* Register the index record extension that caches the mails' DATE (sent
+   date, or received date if it's missing) or ARRIVAL sort keys. */
+uint32_t index_sort_date_ext_register(struct mailbox *box,
+				      enum mail_sort_type sort_type);
+/* Get the DATE or ARRIVAL sort key for the mail. The key is looked up from
+   the index extension returned by index_sort_date_ext_register(). If it's
+   not there yet, it's looked up from the mail and added to the index via
+   the mail's transaction. Returns 0 on success, -1 on error. */
+int index_sort_get_date(struct mail *mail, enum mail_sort_type sort_type,
+			uint32_t ext_id, time_t *date_r);
+
 #endif
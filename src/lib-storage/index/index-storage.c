@@ -19,6 +19,7 @@
 #include "mail-search-build.h"
 #include "index-storage.h"
 #include "index-mail.h"
+#include "index-mail-header-cache.h"
 #include "index-attachment.h"
 #include "index-thread-private.h"
 #include "index-mailbox-size.h"
@@ -287,6 +288,8 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			.max_size = set->mail_index_log_rotate_max_size,
 			.min_age_secs = set->mail_index_log_rotate_min_age,
 			.log2_max_age_secs = set->mail_index_log2_max_age,
+			.group_commit = set->mail_index_log_group_commit,
+			.group_commit_msecs = set->mail_index_log_group_commit_wait,
 		},
 		.cache = {
 			.unaccessed_field_drop_secs = set->mail_cache_unaccessed_field_drop,
@@ -298,6 +301,15 @@ int index_storage_mailbox_alloc_index(struct mailbox *box)
 			.purge_delete_percentage = set->mail_cache_purge_delete_percentage,
 			.purge_continued_percentage = set->mail_cache_purge_continued_percentage,
 			.purge_header_continue_count = set->mail_cache_purge_header_continue_count,
+			.purge_background_min_size = set->mail_cache_purge_background_min_size,
+			.compress_level = set->mail_cache_compress_level,
+			.fixed_field_columns = set->mail_cache_fixed_field_columns,
+			.cost_decisions = set->mail_cache_cost_decisions,
+		},
+		.mmap = {
+			.populate_min_size = set->mail_index_mmap_populate_min_size,
+			.willneed_min_size = set->mail_index_mmap_willneed_min_size,
+			.hugepage_min_size = set->mail_index_mmap_hugepage_min_size,
 		},
 	};
 	mail_index_set_optimization_settings(box->index, &optimization_set);
@@ -442,6 +454,34 @@ int index_storage_mailbox_enable(struct mailbox *box,
 	return 0;
 }
 
+static void index_storage_mailbox_log_memory_usage(struct mailbox *box)
+{
+	struct mail_index_memory_usage usage;
+
+	mail_index_get_memory_usage(box->index, &usage);
+	struct event_passthrough *e = event_create_passthrough(box->event)->
+		set_name("mail_index_memory_usage")->
+		add_int("maps_count", usage.maps_count)->
+		add_int("rec_maps_count", usage.rec_maps_count)->
+		add_int("headers_bytes", usage.headers_bytes)->
+		add_int("records_mmap_bytes", usage.records_mmap_bytes)->
+		add_int("records_memory_bytes", usage.records_memory_bytes)->
+		add_int("ext_records_bytes", usage.ext_records_bytes)->
+		add_int("modseqs_bytes", usage.modseqs_bytes)->
+		add_int("cache_mmap_bytes", usage.cache_mmap_bytes)->
+		add_int("cache_memory_bytes", usage.cache_memory_bytes)->
+		add_int("log_files_count", usage.log_files_count)->
+		add_int("log_mmap_bytes", usage.log_mmap_bytes)->
+		add_int("log_memory_bytes", usage.log_memory_bytes);
+	e_debug(e->event(), "Index memory usage: "
+		"records %"PRIu64"+%"PRIu64" mmap, "
+		"cache %"PRIu64"+%"PRIu64" mmap, "
+		"log %"PRIu64"+%"PRIu64" mmap bytes",
+		usage.records_memory_bytes, usage.records_mmap_bytes,
+		usage.cache_memory_bytes, usage.cache_mmap_bytes,
+		usage.log_memory_bytes, usage.log_mmap_bytes);
+}
+
 void index_storage_mailbox_close(struct mailbox *box)
 {
 	struct index_mailbox_context *ibox = INDEX_STORAGE_CONTEXT(box);
@@ -449,6 +489,8 @@ void index_storage_mailbox_close(struct mailbox *box)
 	mailbox_watch_remove_all(box);
 	i_stream_unref(&box->input);
 
+	if (box->view != NULL && event_want_debug(box->event))
+		index_storage_mailbox_log_memory_usage(box);
 	if (box->view_pvt != NULL)
 		mail_index_view_close(&box->view_pvt);
 	if (box->index_pvt != NULL)
@@ -461,6 +503,8 @@ void index_storage_mailbox_close(struct mailbox *box)
 
 	ibox->keyword_names = NULL;
 	i_free_and_null(ibox->cache_fields);
+	if (ibox->header_cache != NULL)
+		index_mail_header_cache_deinit(&ibox->header_cache);
 
 	ibox->sync_last_check = 0;
 }
@@ -44,6 +44,9 @@ struct index_mailbox_context {
 
 	time_t sync_last_check;
 	uint32_t list_index_sync_ext_id;
+
+	/* Created lazily if mail_header_cache_max_size is set */
+	struct index_mail_header_cache *header_cache;
 };
 
 #define INDEX_STORAGE_CONTEXT(obj) \
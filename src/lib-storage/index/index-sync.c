@@ -4,6 +4,7 @@
 #include "seq-range-array.h"
 #include "ioloop.h"
 #include "array.h"
+#include "mail-cache.h"
 #include "index-mailbox-size.h"
 #include "index-sync-private.h"
 #include "mailbox-recent-flags.h"
@@ -354,6 +355,10 @@ int index_mailbox_sync_deinit(struct mailbox_sync_context *_ctx,
 	index_sync_search_results_update(ctx);
 	/* update vsize header if wanted */
 	index_mailbox_vsize_update_appends(_ctx->box);
+	/* purge the cache file now if it was delayed from regular syncs */
+	if ((_ctx->flags & MAILBOX_SYNC_FLAG_OPTIMIZE) != 0 &&
+	    _ctx->box->opened)
+		(void)mail_cache_purge_background(_ctx->box->cache);
 
 	if (ret == 0 && mail_index_view_is_inconsistent(_ctx->box->view)) {
 		/* we probably had MAILBOX_SYNC_FLAG_FIX_INCONSISTENT set,
@@ -5,6 +5,7 @@
 #include "hash.h"
 #include "imap-base-subject.h"
 #include "mail-storage-private.h"
+#include "index-sort.h"
 #include "index-thread-private.h"
 
 
@@ -37,6 +38,8 @@ struct thread_finish_context {
 
 	struct mail *tmp_mail;
 	struct mail_thread_cache *cache;
+	/* index extension caching the sent dates, shared with SORT DATE */
+	uint32_t date_ext_id;
 
 	ARRAY(struct mail_thread_root_node) roots;
 	ARRAY(struct mail_thread_shadow_node) shadow_nodes;
@@ -144,8 +147,6 @@ static void
 thread_child_node_fill(struct thread_finish_context *ctx,
 		       struct mail_thread_child_node *child)
 {
-	int tz;
-
 	child->uid = thread_lookup_existing(ctx, child->idx);
 
 	if (!mail_set_uid(ctx->tmp_mail, child->uid)) {
@@ -154,15 +155,15 @@ thread_child_node_fill(struct thread_finish_context *ctx,
 		i_unreached();
 	}
 
-	/* get sent date if we want to use it and if it's valid */
-	if (!ctx->use_sent_date)
-		child->sort_date = 0;
-	else if (mail_get_date(ctx->tmp_mail, &child->sort_date, &tz) < 0)
-		child->sort_date = 0;
-
-	if (child->sort_date == 0) {
-		/* fallback to received date */
-		(void)mail_get_received_date(ctx->tmp_mail, &child->sort_date);
+	/* get sent date if we want to use it and if it's valid. otherwise
+	   fallback to received date. The dates are normally found from the
+	   index, so only the newly added mails need to be looked up. */
+	if (!ctx->use_sent_date ||
+	    index_sort_get_date(ctx->tmp_mail, MAIL_SORT_DATE,
+				ctx->date_ext_id, &child->sort_date) < 0) {
+		if (mail_get_received_date(ctx->tmp_mail,
+					   &child->sort_date) < 0)
+			child->sort_date = 0;
 	}
 }
 
@@ -624,6 +625,8 @@ mail_thread_iterate_init_full(struct mail_thread_cache *cache,
 	ctx->refcount = 1;
 	ctx->cache = cache;
 	ctx->tmp_mail = tmp_mail;
+	ctx->date_ext_id = index_sort_date_ext_register(tmp_mail->box,
+							MAIL_SORT_DATE);
 	ctx->return_seqs = return_seqs;
 
 	struct event_reason *reason = event_reason_begin("mailbox:thread");
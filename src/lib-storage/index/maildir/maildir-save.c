@@ -1,5 +1,10 @@
 /* Copyright (c) 2002-2018 Dovecot authors, see the included COPYING file */
 
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#define _GNU_SOURCE /* for sync_file_range() */
 #include "lib.h"
 #include "ioloop.h"
 #include "array.h"
@@ -36,6 +41,8 @@ struct maildir_filename {
 	enum mail_flags flags;
 	unsigned int pop3_order;
 	bool preserve_filename:1;
+	/* file was written, but not fsynced yet */
+	bool fsync_pending:1;
 	ARRAY_TYPE(keyword_indexes) keywords;
 };
 
@@ -572,13 +579,13 @@ static int maildir_save_finish_real(struct mail_save_context *_ctx)
 
 	if (storage->set->parsed_fsync_mode != FSYNC_MODE_NEVER &&
 	    !ctx->failed) {
-		if (fsync(ctx->fd) < 0) {
-			if (!mail_storage_set_error_from_errno(storage)) {
-				mail_set_critical(_ctx->dest_mail,
-						  "fsync(%s) failed: %m", path);
-			}
-			ctx->failed = TRUE;
-		}
+		/* Start writing the file to disk already now, while the next
+		   mail is still being received. All the saved files are
+		   fsynced when committing. */
+#ifdef HAVE_SYNC_FILE_RANGE
+		(void)sync_file_range(ctx->fd, 0, 0, SYNC_FILE_RANGE_WRITE);
+#endif
+		ctx->file_last->fsync_pending = TRUE;
 	}
 	real_size = lseek(ctx->fd, 0, SEEK_END);
 	if (real_size == (off_t)-1) {
@@ -657,6 +664,42 @@ maildir_save_unlink_files(struct maildir_save_context *ctx)
 	ctx->files = NULL;
 }
 
+static int maildir_save_fsync_files(struct maildir_save_context *ctx)
+{
+	struct mail_storage *storage = &ctx->mbox->storage->storage;
+	struct maildir_filename *mf;
+	const char *path;
+	int fd, ret = 0;
+
+	for (mf = ctx->files; mf != NULL && ret == 0; mf = mf->next) {
+		if (!mf->fsync_pending)
+			continue;
+
+		/* use full fsync(), because the received date is stored in
+		   the file's mtime */
+		path = t_strdup_printf("%s/%s", ctx->tmpdir, mf->tmp_name);
+		fd = open(path, O_RDONLY);
+		if (fd == -1) {
+			if (!mail_storage_set_error_from_errno(storage)) {
+				mail_storage_set_critical(storage,
+					"open(%s) failed: %m", path);
+			}
+			return -1;
+		}
+		if (fsync(fd) < 0) {
+			if (!mail_storage_set_error_from_errno(storage)) {
+				mail_storage_set_critical(storage,
+					"fsync(%s) failed: %m", path);
+			}
+			ret = -1;
+		} else {
+			mf->fsync_pending = FALSE;
+		}
+		i_close_fd(&fd);
+	}
+	return ret;
+}
+
 static int maildir_transaction_fsync_dirs(struct maildir_save_context *ctx,
 					  bool new_changed, bool cur_changed)
 {
@@ -967,6 +1010,14 @@ int maildir_transaction_save_commit_pre(struct mail_save_context *_ctx)
 	if (ctx->files_count == 0)
 		return 0;
 
+	T_BEGIN {
+		ret = maildir_save_fsync_files(ctx);
+	} T_END;
+	if (ret < 0) {
+		maildir_transaction_save_rollback(_ctx);
+		return -1;
+	}
+
 	sync_flags = MAILDIR_UIDLIST_SYNC_PARTIAL |
 		MAILDIR_UIDLIST_SYNC_NOREFRESH;
 
@@ -408,6 +408,7 @@ maildir_scan_dir(struct maildir_sync_context *ctx, bool new_dir, bool final,
 	const char *path;
 	DIR *dirp;
 	string_t *src, *dest;
+	size_t src_dir_len, dest_dir_len;
 	struct dirent *dp;
 	struct stat st;
 	enum maildir_uidlist_rec_flag flags;
@@ -465,6 +466,11 @@ maildir_scan_dir(struct maildir_sync_context *ctx, bool new_dir, bool final,
 
 	src = t_str_new(1024);
 	dest = t_str_new(1024);
+	/* the directory prefixes stay the same for all the renamed files */
+	str_printfa(src, "%s/", ctx->new_dir);
+	str_printfa(dest, "%s/", ctx->cur_dir);
+	src_dir_len = str_len(src);
+	dest_dir_len = str_len(dest);
 
 	move_new = new_dir && ctx->locked &&
 		((ctx->mbox->box.flags & MAILBOX_FLAG_DROP_RECENT) != 0 ||
@@ -487,10 +493,10 @@ maildir_scan_dir(struct maildir_sync_context *ctx, bool new_dir, bool final,
 		if (move_new) {
 			i_assert(dp->d_name[0] != '\0');
 
-			str_truncate(src, 0);
-			str_truncate(dest, 0);
-			str_printfa(src, "%s/%s", ctx->new_dir, dp->d_name);
-			str_printfa(dest, "%s/%s", ctx->cur_dir, dp->d_name);
+			str_truncate(src, src_dir_len);
+			str_truncate(dest, dest_dir_len);
+			str_append(src, dp->d_name);
+			str_append(dest, dp->d_name);
 			if (strchr(dp->d_name, MAILDIR_INFO_SEP) == NULL) {
 				str_append(dest, MAILDIR_FLAGS_FULL_SEP);
 			}
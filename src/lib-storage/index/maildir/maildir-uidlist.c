@@ -409,17 +409,18 @@ maildir_uidlist_read_extended(struct maildir_uidlist *uidlist,
 			      struct maildir_uidlist_rec *rec)
 {
 	const char *start, *line = *line_p;
-	buffer_t *buf;
+	unsigned char *dest;
+	size_t size = 0;
 
-	buf = t_buffer_create(128);
+	/* first find out how much space the valid extensions need, so they
+	   can be copied directly to the record pool */
 	while (*line != '\0' && *line != ':') {
 		/* skip over an extension field */
 		start = line;
 		while (*line != ' ' && *line != '\0') line++;
-		if (MAILDIR_UIDLIST_REC_EXT_KEY_IS_VALID(*start)) {
-			buffer_append(buf, start, line - start);
-			buffer_append_c(buf, '\0');
-		} else {
+		if (MAILDIR_UIDLIST_REC_EXT_KEY_IS_VALID(*start))
+			size += line - start + 1;
+		else {
 			maildir_uidlist_set_corrupted(uidlist,
 				"Invalid extension record, removing: %s",
 				t_strdup_until(start, line));
@@ -428,11 +429,21 @@ maildir_uidlist_read_extended(struct maildir_uidlist *uidlist,
 		while (*line == ' ') line++;
 	}
 
-	if (buf->used > 0) {
+	if (size > 0) {
 		/* save the extensions */
-		buffer_append_c(buf, '\0');
-		rec->extensions = p_malloc(uidlist->record_pool, buf->used);
-		memcpy(rec->extensions, buf->data, buf->used);
+		rec->extensions = dest =
+			p_malloc(uidlist->record_pool, size + 1);
+		line = *line_p;
+		while (*line != '\0' && *line != ':') {
+			start = line;
+			while (*line != ' ' && *line != '\0') line++;
+			if (MAILDIR_UIDLIST_REC_EXT_KEY_IS_VALID(*start)) {
+				memcpy(dest, start, line - start);
+				dest += line - start + 1;
+			}
+			while (*line == ' ') line++;
+		}
+		/* p_malloc() already zero-filled the NUL separators */
 	}
 
 	if (*line == ':')
@@ -452,12 +463,8 @@ static bool maildir_uidlist_next(struct maildir_uidlist *uidlist,
 	unsigned int count;
 	uint32_t uid;
 
-	uid = 0;
-	while (*line >= '0' && *line <= '9') {
-		uid = uid*10 + (*line - '0');
-		line++;
-	}
-
+	if (str_parse_uint32(line, &uid, &line) < 0)
+		uid = 0;
 	if (uid == 0 || *line != ' ') {
 		/* invalid file */
 		maildir_uidlist_set_corrupted(uidlist, "Invalid data: %s",
@@ -498,13 +505,7 @@ static bool maildir_uidlist_next(struct maildir_uidlist *uidlist,
 
 	if (uidlist->version == UIDLIST_VERSION) {
 		/* read extended fields */
-		bool ret;
-
-		T_BEGIN {
-			ret = maildir_uidlist_read_extended(uidlist, &line,
-							    rec);
-		} T_END;
-		if (!ret) {
+		if (!maildir_uidlist_read_extended(uidlist, &line, rec)) {
 			maildir_uidlist_set_corrupted(uidlist,
 				"Invalid extended fields: %s", line);
 			return FALSE;
@@ -291,6 +291,17 @@ static ssize_t i_stream_raw_mbox_read(struct istream_private *stream)
         fromp = mbox_from; from_start_pos = from_after_pos = SIZE_MAX;
 	eoh_char = rstream->body_offset == UOFF_T_MAX ? '\n' : -1;
 	for (i = stream->pos; i < pos; i++) {
+		if (fromp == mbox_from) {
+			/* both the From-line and the end of headers can only
+			   begin with LF, so skip directly to the next one */
+			const unsigned char *lf =
+				memchr(buf + i, '\n', pos - i);
+			if (lf == NULL) {
+				i = pos;
+				break;
+			}
+			i = lf - buf;
+		}
 		if (buf[i] == eoh_char &&
 		    ((i > 0 && buf[i-1] == '\n') ||
                      (i > 1 && buf[i-1] == '\r' && buf[i-2] == '\n') ||
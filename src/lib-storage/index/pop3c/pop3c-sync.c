@@ -19,30 +19,30 @@ struct pop3c_sync_msg {
 };
 ARRAY_DEFINE_TYPE(pop3c_sync_msg, struct pop3c_sync_msg);
 
-int pop3c_sync_get_uidls(struct pop3c_mailbox *mbox)
+struct pop3c_sync_cmd_ctx {
+	enum pop3c_command_state state;
+	char *reply;
+};
+
+static void pop3c_sync_cmd_reply(enum pop3c_command_state state,
+				 const char *reply, void *context)
+{
+	struct pop3c_sync_cmd_ctx *ctx = context;
+
+	i_assert(ctx->reply == NULL);
+
+	ctx->state = state;
+	ctx->reply = i_strdup(reply);
+}
+
+static int
+pop3c_sync_parse_uidls(struct pop3c_mailbox *mbox, struct istream *input)
 {
 	ARRAY_TYPE(const_string) uidls;
-	struct istream *input;
-	const char *error, *cline;
+	const char *cline;
 	char *line, *p;
 	unsigned int seq, line_seq;
 
-	if (mbox->msg_uidls != NULL)
-		return 0;
-	if ((pop3c_client_get_capabilities(mbox->client) &
-	     POP3C_CAPABILITY_UIDL) == 0) {
-		mail_storage_set_error(mbox->box.storage,
-				       MAIL_ERROR_NOTPOSSIBLE,
-				       "UIDLs not supported by server");
-		return -1;
-	}
-
-	if (pop3c_client_cmd_stream(mbox->client, "UIDL\r\n",
-				    &input, &error) < 0) {
-		mailbox_set_critical(&mbox->box, "UIDL failed: %s", error);
-		return -1;
-	}
-
 	mbox->uidl_pool = pool_alloconly_create("POP3 UIDLs", 1024*32);
 	p_array_init(&uidls, mbox->uidl_pool, 64); seq = 0;
 	while ((line = i_stream_read_next_line(input)) != NULL) {
@@ -63,7 +63,6 @@ int pop3c_sync_get_uidls(struct pop3c_mailbox *mbox)
 		cline = p_strdup(mbox->uidl_pool, p);
 		array_push_back(&uidls, &cline);
 	}
-	i_stream_destroy(&input);
 	if (line != NULL) {
 		pool_unref(&mbox->uidl_pool);
 		return -1;
@@ -77,31 +76,13 @@ int pop3c_sync_get_uidls(struct pop3c_mailbox *mbox)
 	return 0;
 }
 
-int pop3c_sync_get_sizes(struct pop3c_mailbox *mbox)
+static int
+pop3c_sync_parse_sizes(struct pop3c_mailbox *mbox, struct istream *input)
 {
-	struct istream *input;
-	const char *error;
 	char *line, *p;
 	unsigned int seq, line_seq;
 
-	i_assert(mbox->msg_sizes == NULL);
-
-	if (mbox->msg_uidls == NULL) {
-		if (pop3c_sync_get_uidls(mbox) < 0)
-			return -1;
-	}
-	if (mbox->msg_count == 0) {
-		mbox->msg_sizes = i_new(uoff_t, 1);
-		return 0;
-	}
-
-	if (pop3c_client_cmd_stream(mbox->client, "LIST\r\n",
-				    &input, &error) < 0) {
-		mailbox_set_critical(&mbox->box, "LIST failed: %s", error);
-		return -1;
-	}
-
-	mbox->msg_sizes = i_new(uoff_t, mbox->msg_count); seq = 0;
+	mbox->msg_sizes = i_new(uoff_t, I_MAX(mbox->msg_count, 1)); seq = 0;
 	while ((line = i_stream_read_next_line(input)) != NULL) {
 		if (++seq > mbox->msg_count) {
 			mailbox_set_critical(&mbox->box,
@@ -126,7 +107,6 @@ int pop3c_sync_get_sizes(struct pop3c_mailbox *mbox)
 			break;
 		}
 	}
-	i_stream_destroy(&input);
 	if (line != NULL) {
 		i_free_and_null(mbox->msg_sizes);
 		return -1;
@@ -134,6 +114,91 @@ int pop3c_sync_get_sizes(struct pop3c_mailbox *mbox)
 	return 0;
 }
 
+int pop3c_sync_get_uidls(struct pop3c_mailbox *mbox)
+{
+	struct pop3c_sync_cmd_ctx uidl_ctx, list_ctx;
+	struct istream *uidl_input, *list_input = NULL;
+	enum pop3c_capability capa;
+	int ret;
+
+	if (mbox->msg_uidls != NULL)
+		return 0;
+	capa = pop3c_client_get_capabilities(mbox->client);
+	if ((capa & POP3C_CAPABILITY_UIDL) == 0) {
+		mail_storage_set_error(mbox->box.storage,
+				       MAIL_ERROR_NOTPOSSIBLE,
+				       "UIDLs not supported by server");
+		return -1;
+	}
+
+	i_zero(&uidl_ctx);
+	i_zero(&list_ctx);
+	uidl_input = pop3c_client_cmd_stream_async(mbox->client, "UIDL\r\n",
+						   pop3c_sync_cmd_reply,
+						   &uidl_ctx);
+	if (mbox->msg_sizes == NULL &&
+	    (mbox->box.flags & MAILBOX_FLAG_POP3_SESSION) != 0 &&
+	    (capa & POP3C_CAPABILITY_PIPELINING) != 0) {
+		/* POP3 sessions most likely need the sizes for the LIST
+		   command. Get them without an extra roundtrip. */
+		list_input = pop3c_client_cmd_stream_async(mbox->client,
+							   "LIST\r\n",
+							   pop3c_sync_cmd_reply,
+							   &list_ctx);
+	}
+	while (uidl_ctx.reply == NULL ||
+	       (list_input != NULL && list_ctx.reply == NULL))
+		pop3c_client_wait_one(mbox->client);
+
+	if (uidl_ctx.state != POP3C_COMMAND_STATE_OK) {
+		mailbox_set_critical(&mbox->box, "UIDL failed: %s",
+				     uidl_ctx.reply);
+		ret = -1;
+	} else {
+		ret = pop3c_sync_parse_uidls(mbox, uidl_input);
+	}
+	i_stream_destroy(&uidl_input);
+
+	if (list_input != NULL) {
+		/* failures here are retried when the sizes are needed */
+		if (ret == 0 && list_ctx.state == POP3C_COMMAND_STATE_OK)
+			(void)pop3c_sync_parse_sizes(mbox, list_input);
+		i_stream_destroy(&list_input);
+	}
+	i_free(uidl_ctx.reply);
+	i_free(list_ctx.reply);
+	return ret;
+}
+
+int pop3c_sync_get_sizes(struct pop3c_mailbox *mbox)
+{
+	struct istream *input;
+	const char *error;
+	int ret;
+
+	i_assert(mbox->msg_sizes == NULL);
+
+	if (mbox->msg_uidls == NULL) {
+		if (pop3c_sync_get_uidls(mbox) < 0)
+			return -1;
+		if (mbox->msg_sizes != NULL)
+			return 0;
+	}
+	if (mbox->msg_count == 0) {
+		mbox->msg_sizes = i_new(uoff_t, 1);
+		return 0;
+	}
+
+	if (pop3c_client_cmd_stream(mbox->client, "LIST\r\n",
+				    &input, &error) < 0) {
+		mailbox_set_critical(&mbox->box, "LIST failed: %s", error);
+		return -1;
+	}
+	ret = pop3c_sync_parse_sizes(mbox, input);
+	i_stream_destroy(&input);
+	return ret;
+}
+
 static void
 pop3c_get_local_msgs(pool_t pool, ARRAY_TYPE(pop3c_sync_msg) *local_msgs,
 		     uint32_t messages_count,
@@ -848,8 +848,11 @@ index_list_rename_mailbox(struct mailbox_list *_oldlist, const char *oldname,
 	newnode->uid = oldnode->uid;
 	newnode->flags = oldnode->flags;
 	newnode->children = oldnode->children; oldnode->children = NULL;
-	for (child = newnode->children; child != NULL; child = child->next)
+	for (child = newnode->children; child != NULL; child = child->next) {
+		mailbox_list_index_node_hash_remove(sync_ctx->ilist, child);
 		child->parent = newnode;
+		mailbox_list_index_node_hash_add(sync_ctx->ilist, child);
+	}
 
 	/* remove the old node from existence */
 	mailbox_list_index_node_unlink(sync_ctx->ilist, oldnode);
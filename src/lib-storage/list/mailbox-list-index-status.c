@@ -27,6 +27,22 @@ struct index_list_changes {
 struct index_list_storage_module index_list_storage_module =
 	MODULE_CONTEXT_INIT(&mail_storage_module_register);
 
+static int index_list_update_mailbox(struct mailbox *box);
+
+static void index_list_update_opened_mailbox(struct mailbox *box)
+{
+	/* The mailbox was opened and possibly synced internally without
+	   mailbox_sync(), so the list index wasn't updated. If it isn't
+	   updated now, the following STATUS lookups can't be answered from
+	   the list index either and they keep opening the mailbox. */
+	if (!box->opened)
+		return;
+
+	mail_storage_last_error_push(mailbox_get_storage(box));
+	(void)index_list_update_mailbox(box);
+	mail_storage_last_error_pop(mailbox_get_storage(box));
+}
+
 static int
 index_list_exists(struct mailbox *box, bool auto_boxes,
 		  enum mailbox_existence *existence_r)
@@ -178,6 +194,10 @@ index_list_get_status(struct mailbox *box, enum mailbox_status_items items,
 		if (index_list_get_cached_status(box, items, status_r) > 0)
 			return 0;
 		/* nonsynced / error, fallback to doing it the slow way */
+		if (ibox->module_ctx.super.get_status(box, items, status_r) < 0)
+			return -1;
+		index_list_update_opened_mailbox(box);
+		return 0;
 	}
 	return ibox->module_ctx.super.get_status(box, items, status_r);
 }
@@ -368,11 +388,17 @@ index_list_get_metadata(struct mailbox *box,
 			struct mailbox_metadata *metadata_r)
 {
 	struct index_list_mailbox *ibox = INDEX_LIST_STORAGE_CONTEXT(box);
+	bool was_opened = box->opened;
 	int ret;
 
 	if ((ret = index_list_try_get_metadata(box, items, metadata_r)) != 0)
 		return ret;
-	return ibox->module_ctx.super.get_metadata(box, items, metadata_r);
+	if (ibox->module_ctx.super.get_metadata(box, items, metadata_r) < 0)
+		return -1;
+	/* looking up e.g. the vsize may also have updated the mailbox index */
+	if (!was_opened || (items & MAILBOX_METADATA_SYNC_ITEMS) != 0)
+		index_list_update_opened_mailbox(box);
+	return 0;
 }
 
 static void
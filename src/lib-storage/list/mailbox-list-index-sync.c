@@ -85,6 +85,7 @@ mailbox_list_index_node_add(struct mailbox_list_index_sync_context *ctx,
 			  POINTER_CAST(node->uid), node);
 	hash_table_insert(ctx->ilist->mailbox_names,
 			  POINTER_CAST(node->name_id), dup_name);
+	mailbox_list_index_node_hash_add(ctx->ilist, node);
 
 	node_add_to_index(ctx, node, seq_r);
 	return node;
@@ -19,6 +19,10 @@
 #define MAILBOX_LIST_INDEX_LOG2_MAX_AGE_SECS (10*60)
 
 static void mailbox_list_index_init_finish(struct mailbox_list *list);
+static int mailbox_list_index_node_cmp(const struct mailbox_list_index_node *n1,
+				       const struct mailbox_list_index_node *n2);
+static unsigned int
+mailbox_list_index_node_hash(const struct mailbox_list_index_node *node);
 
 struct mailbox_list_index_module mailbox_list_index_module =
 	MODULE_CONTEXT_INIT(&mailbox_list_module_register);
@@ -36,12 +40,16 @@ static void mailbox_list_index_init_pool(struct mailbox_list_index *ilist)
 	ilist->mailbox_pool = pool_alloconly_create("mailbox list index", 4096);
 	hash_table_create_direct(&ilist->mailbox_names, ilist->mailbox_pool, 0);
 	hash_table_create_direct(&ilist->mailbox_hash, ilist->mailbox_pool, 0);
+	hash_table_create(&ilist->mailbox_children_hash, ilist->mailbox_pool, 0,
+			  mailbox_list_index_node_hash,
+			  mailbox_list_index_node_cmp);
 }
 
 void mailbox_list_index_reset(struct mailbox_list_index *ilist)
 {
 	hash_table_destroy(&ilist->mailbox_names);
 	hash_table_destroy(&ilist->mailbox_hash);
+	hash_table_destroy(&ilist->mailbox_children_hash);
 	pool_unref(&ilist->mailbox_pool);
 
 	ilist->mailbox_tree = NULL;
@@ -114,18 +122,22 @@ int mailbox_list_index_index_open(struct mailbox_list *list)
 }
 
 struct mailbox_list_index_node *
-mailbox_list_index_node_find_sibling(const struct mailbox_list *list,
+mailbox_list_index_node_find_sibling(struct mailbox_list *list,
 				     struct mailbox_list_index_node *node,
 				     const char *name)
 {
+	struct mailbox_list_index *ilist = INDEX_LIST_CONTEXT_REQUIRE(list);
+	struct mailbox_list_index_node key;
+
+	if (node == NULL)
+		return NULL;
 	mailbox_list_name_unescape(&name, list->set.storage_name_escape_char);
 
-	while (node != NULL) {
-		if (strcmp(node->raw_name, name) == 0)
-			return node;
-		node = node->next;
-	}
-	return NULL;
+	/* all the siblings have the same parent */
+	i_zero(&key);
+	key.parent = node->parent;
+	key.raw_name = name;
+	return hash_table_lookup(ilist->mailbox_children_hash, &key);
 }
 
 static struct mailbox_list_index_node *
@@ -178,11 +190,27 @@ void mailbox_list_index_node_get_path(const struct mailbox_list_index_node *node
 	str_append(str, node->raw_name);
 }
 
+void mailbox_list_index_node_hash_add(struct mailbox_list_index *ilist,
+				      struct mailbox_list_index_node *node)
+{
+	if (hash_table_lookup(ilist->mailbox_children_hash, node) == NULL)
+		hash_table_insert(ilist->mailbox_children_hash, node, node);
+}
+
+void mailbox_list_index_node_hash_remove(struct mailbox_list_index *ilist,
+					 struct mailbox_list_index_node *node)
+{
+	/* the node may not be in the hash if it was a duplicate */
+	if (hash_table_lookup(ilist->mailbox_children_hash, node) == node)
+		hash_table_remove(ilist->mailbox_children_hash, node);
+}
+
 void mailbox_list_index_node_unlink(struct mailbox_list_index *ilist,
 				    struct mailbox_list_index_node *node)
 {
 	struct mailbox_list_index_node **prev;
 
+	mailbox_list_index_node_hash_remove(ilist, node);
 	prev = node->parent == NULL ?
 		&ilist->mailbox_tree : &node->parent->children;
 
@@ -194,17 +222,22 @@ void mailbox_list_index_node_unlink(struct mailbox_list_index *ilist,
 static int mailbox_list_index_parse_header(struct mailbox_list_index *ilist,
 					   struct mail_index_view *view)
 {
-	const void *data, *name_start, *p;
+	const void *map_data, *name_start, *p;
 	size_t i, len, size;
 	uint32_t id, prev_id = 0;
 	string_t *str;
-	char *name;
+	char *data, *name;
 	int ret = 0;
 
-	mail_index_map_get_header_ext(view, view->map, ilist->ext_id, &data, &size);
+	mail_index_map_get_header_ext(view, view->map, ilist->ext_id,
+				      &map_data, &size);
 	if (size == 0)
 		return 0;
 
+	/* Copy all the names with a single allocation and point to them
+	   directly. This keeps the name table compact even with a huge
+	   number of mailboxes. */
+	data = p_memdup(ilist->mailbox_pool, map_data, size);
 	str = t_str_new(128);
 	for (i = sizeof(struct mailbox_list_index_header); i < size; ) {
 		/* get id */
@@ -227,7 +260,7 @@ static int mailbox_list_index_parse_header(struct mailbox_list_index *ilist,
 		len = (const char *)p - (const char *)name_start;
 
 		if (uni_utf8_get_valid_data(name_start, len, str)) {
-			name = p_strndup(ilist->mailbox_pool, name_start, len);
+			name = data + i;
 		} else {
 			/* corrupted index. fix the name. */
 			name = p_strdup(ilist->mailbox_pool, str_c(str));
@@ -298,8 +331,6 @@ static int mailbox_list_index_parse_records(struct mailbox_list_index *ilist,
 					    const char **error_r)
 {
 	struct mailbox_list_index_node *node, *parent;
-	HASH_TABLE(struct mailbox_list_index_node *,
-		   struct mailbox_list_index_node *) duplicate_hash;
 	const struct mail_index_record *rec;
 	const struct mailbox_list_index_record *irec;
 	const void *data;
@@ -311,9 +342,6 @@ static int mailbox_list_index_parse_records(struct mailbox_list_index *ilist,
 
 	pool_t dup_pool =
 		pool_alloconly_create(MEMPOOL_GROWING"duplicate pool", 2048);
-	hash_table_create(&duplicate_hash, dup_pool, 0,
-			  mailbox_list_index_node_hash,
-			  mailbox_list_index_node_cmp);
 	count = mail_index_view_get_messages_count(view);
 	if (!ilist->has_backing_store)
 		hash_table_create(&duplicate_guid, dup_pool, 0, guid_128_hash,
@@ -439,8 +467,8 @@ static int mailbox_list_index_parse_records(struct mailbox_list_index *ilist,
 		} else if (strcasecmp(node->raw_name, "INBOX") == 0) {
 			ilist->rebuild_on_missing_inbox = FALSE;
 		}
-		if (hash_table_lookup(duplicate_hash, node) == NULL)
-			hash_table_insert(duplicate_hash, node, node);
+		if (hash_table_lookup(ilist->mailbox_children_hash, node) == NULL)
+			hash_table_insert(ilist->mailbox_children_hash, node, node);
 		else {
 			const char *old_name = node->raw_name;
 
@@ -460,13 +488,13 @@ static int mailbox_list_index_parse_records(struct mailbox_list_index *ilist,
 			*error_r = t_strdup_printf(
 				"Duplicate mailbox '%s' in index, renaming to %s",
 				old_name, node->raw_name);
+			mailbox_list_index_node_hash_add(ilist, node);
 		}
 		if (node->parent == NULL) {
 			node->next = ilist->mailbox_tree;
 			ilist->mailbox_tree = node;
 		}
 	}
-	hash_table_destroy(&duplicate_hash);
 	if (!ilist->has_backing_store)
 		hash_table_destroy(&duplicate_guid);
 	pool_unref(&dup_pool);
@@ -882,6 +910,7 @@ static void mailbox_list_index_deinit(struct mailbox_list *list)
 	if (ilist->index != NULL) {
 		hash_table_destroy(&ilist->mailbox_hash);
 		hash_table_destroy(&ilist->mailbox_names);
+		hash_table_destroy(&ilist->mailbox_children_hash);
 		pool_unref(&ilist->mailbox_pool);
 		if (ilist->opened)
 			mail_index_close(ilist->index);
@@ -118,6 +118,10 @@ struct mailbox_list_index {
 
 	/* uint32_t uid => node */
 	HASH_TABLE(void *, struct mailbox_list_index_node *) mailbox_hash;
+	/* (parent, raw_name) => node, for looking up children without
+	   scanning through all the siblings */
+	HASH_TABLE(struct mailbox_list_index_node *,
+		   struct mailbox_list_index_node *) mailbox_children_hash;
 	struct mailbox_list_index_node *mailbox_tree;
 
 	bool pending_init:1;
@@ -160,8 +164,15 @@ struct mailbox_list_index_node *
 mailbox_list_index_lookup_uid(struct mailbox_list_index *ilist, uint32_t uid);
 void mailbox_list_index_node_get_path(const struct mailbox_list_index_node *node,
 				      char sep, string_t *str);
+/* Unlink the node from its parent and from mailbox_children_hash. */
 void mailbox_list_index_node_unlink(struct mailbox_list_index *ilist,
 				    struct mailbox_list_index_node *node);
+/* Add/remove node to/from mailbox_children_hash. The node must be removed
+   before changing its parent or raw_name and added back afterwards. */
+void mailbox_list_index_node_hash_add(struct mailbox_list_index *ilist,
+				      struct mailbox_list_index_node *node);
+void mailbox_list_index_node_hash_remove(struct mailbox_list_index *ilist,
+					 struct mailbox_list_index_node *node);
 
 /* Return mailbox name encoded into box-name header. */
 const unsigned char *
@@ -197,8 +208,9 @@ int mailbox_list_index_view_open(struct mailbox *box, bool require_refreshed,
 				 struct mail_index_view **view_r,
 				 uint32_t *seq_r);
 
+/* Find the node with the given name from node and its siblings. */
 struct mailbox_list_index_node *
-mailbox_list_index_node_find_sibling(const struct mailbox_list *list,
+mailbox_list_index_node_find_sibling(struct mailbox_list *list,
 				     struct mailbox_list_index_node *node,
 				     const char *name);
 void mailbox_list_index_reset(struct mailbox_list_index *ilist);
@@ -54,6 +54,8 @@ struct mail_duplicate {
 
 	bool marked:1;
 	bool changed:1;
+	/* A record for this ID has been read from the DB file */
+	bool in_file:1;
 };
 
 struct mail_duplicate_file_header {
@@ -70,6 +72,10 @@ struct mail_duplicate_transaction {
 	pool_t pool;
 	struct mail_duplicate_db *db;
 	ino_t db_ino;
+	/* Offset up to which the DB file has been read */
+	uoff_t db_offset;
+	/* Record size used by the DB file, 0 if it's not known yet */
+	unsigned int db_record_size;
 	struct event *event;
 
 	HASH_TABLE(struct mail_duplicate *, struct mail_duplicate *) hash;
@@ -77,6 +83,9 @@ struct mail_duplicate_transaction {
 	unsigned int id_lock_count;
 
 	bool changed:1;
+	/* DB file has enough expired or overwritten records that it should
+	   be rewritten instead of appended to. */
+	bool compact:1;
 };
 
 struct mail_duplicate_db {
@@ -255,9 +264,9 @@ mail_duplicate_read_records(struct mail_duplicate_transaction *trans,
 	const unsigned char *data;
 	struct mail_duplicate_record_header hdr;
 	size_t size;
-	unsigned int change_count;
+	unsigned int stale_count;
 
-	change_count = 0;
+	stale_count = 0;
 	while (i_stream_read_bytes(input, &data, &size, record_size) > 0) {
 		if (record_size == sizeof(hdr))
 			memcpy(&hdr, data, sizeof(hdr));
@@ -299,8 +308,13 @@ mail_duplicate_read_records(struct mail_duplicate_transaction *trans,
 		dup_q.user = t_strndup(data + hdr.id_size, hdr.user_size);
 
 		dup = hash_table_lookup(trans->hash, &dup_q);
+		if (dup != NULL && dup->in_file) {
+			/* an older record for the same ID was overwritten
+			   by an appended record */
+			stale_count++;
+		}
 		if ((time_t)hdr.stamp < ioloop_time) {
-                        change_count++;
+			stale_count++;
 			if (dup != NULL && !dup->changed)
 				dup->marked = FALSE;
 		} else {
@@ -321,13 +335,16 @@ mail_duplicate_read_records(struct mail_duplicate_transaction *trans,
 				dup->marked = TRUE;
 				dup->time = hdr.stamp;
 			}
+			dup->in_file = TRUE;
 		}
 		i_stream_skip(input, hdr.id_size + hdr.user_size);
+		trans->db_offset = input->v_offset;
 	}
 
-	if (hash_table_count(trans->hash) *
-	    COMPRESS_PERCENTAGE / 100 > change_count)
-		trans->changed = TRUE;
+	if (stale_count > 0 &&
+	    stale_count >= hash_table_count(trans->hash) *
+			   COMPRESS_PERCENTAGE / 100)
+		trans->compact = TRUE;
 	return 0;
 }
 
@@ -346,11 +363,14 @@ mail_duplicate_read_db_from_fd(struct mail_duplicate_transaction *trans, int fd)
 			"stat(%s) failed: %m", trans->path);
 		return -1;
 	}
-	trans->db_ino = st.st_ino;
-
 	/* <timestamp> <id_size> <user_size> <id> <user> */
 	input = i_stream_create_fd(fd, DUPLICATE_BUFSIZE);
-	if (i_stream_read_bytes(input, &data, &size, sizeof(hdr)) > 0) {
+	if (trans->db_ino == st.st_ino && trans->db_record_size != 0 &&
+	    (uoff_t)st.st_size >= trans->db_offset) {
+		/* records were only appended since the last read */
+		record_size = trans->db_record_size;
+		i_stream_seek(input, trans->db_offset);
+	} else if (i_stream_read_bytes(input, &data, &size, sizeof(hdr)) > 0) {
 		memcpy(&hdr, data, sizeof(hdr));
 		if (hdr.version == 0 || hdr.version > DUPLICATE_VERSION + 10) {
 			/* FIXME: backwards compatibility with v1.0 */
@@ -359,7 +379,10 @@ mail_duplicate_read_db_from_fd(struct mail_duplicate_transaction *trans, int fd)
 			record_size = sizeof(struct mail_duplicate_record_header);
 			i_stream_skip(input, sizeof(hdr));
 		}
+		trans->db_offset = input->v_offset;
 	}
+	trans->db_ino = st.st_ino;
+	trans->db_record_size = record_size;
 
 	if (record_size == 0)
 		i_unlink_if_exists(trans->path);
@@ -431,7 +454,8 @@ static void mail_duplicate_update(struct mail_duplicate_transaction *trans)
 			e_error(trans->event,
 				"stat(%s) failed: %m", trans->path);
 		}
-	} else if (trans->db_ino == st.st_ino) {
+	} else if (trans->db_ino == st.st_ino &&
+		   (uoff_t)st.st_size == trans->db_offset) {
 		e_debug(trans->event, "DB file not changed");
 	} else {
 		e_debug(trans->event, "DB file changed: "
@@ -599,36 +623,38 @@ void mail_duplicate_mark(struct mail_duplicate_transaction *trans,
 	trans->changed = TRUE;
 }
 
-void mail_duplicate_transaction_commit(
-	struct mail_duplicate_transaction **_trans)
+static void
+mail_duplicate_write_records(struct mail_duplicate_transaction *trans,
+			     struct ostream *output, bool changed_only)
 {
-	struct mail_duplicate_transaction *trans = *_trans;
-	struct mail_duplicate_file_header hdr;
 	struct mail_duplicate_record_header rec;
-	struct ostream *output;
-        struct hash_iterate_context *iter;
+	struct hash_iterate_context *iter;
 	struct mail_duplicate *d;
-	int new_fd;
-	struct dotlock *dotlock;
 
-	if (trans == NULL)
-		return;
-	*_trans = NULL;
+	i_zero(&rec);
+	iter = hash_table_iterate_init(trans->hash);
+	while (hash_table_iterate(iter, trans->hash, &d, &d)) {
+		if (d->marked && (d->changed || !changed_only)) {
+			rec.stamp = time_to_uint32_trunc(d->time);
+			rec.id_size = d->id_size;
+			rec.user_size = strlen(d->user);
 
-	if (trans->path == NULL) {
-		e_debug(trans->event, "Commit (dummy)");
-		mail_duplicate_transaction_free(&trans);
-		return;
-	}
-	if (!trans->changed) {
-		e_debug(trans->event, "Commit; no changes");
-		mail_duplicate_transaction_free(&trans);
-		return;
+			o_stream_nsend(output, &rec, sizeof(rec));
+			o_stream_nsend(output, d->id, rec.id_size);
+			o_stream_nsend(output, d->user, rec.user_size);
+		}
 	}
+	hash_table_iterate_deinit(&iter);
+}
 
+static int mail_duplicate_rewrite(struct mail_duplicate_transaction *trans)
+{
 	struct mail_duplicate_db *db = trans->db;
+	struct mail_duplicate_file_header hdr;
+	struct ostream *output;
+	struct dotlock *dotlock;
+	int new_fd;
 
-	i_assert(trans->path != NULL);
 	e_debug(trans->event, "Commit; overwrite %s", trans->path);
 
 	new_fd = file_dotlock_open(&db->dotlock_set, trans->path, 0, &dotlock);
@@ -638,15 +664,16 @@ void mail_duplicate_transaction_commit(
 		e_error(trans->event,
 			"file_dotlock_open(%s) failed: %m",
 			trans->path);
-		mail_duplicate_transaction_free(&trans);
-		return;
+		return -1;
 	} else {
 		e_error(trans->event,
 			"Creating lock file for %s timed out in %u secs",
 			trans->path, db->dotlock_set.timeout);
-		mail_duplicate_transaction_free(&trans);
-		return;
+		return -1;
 	}
+	/* pick up any records appended by others since we last read the
+	   file, so they don't get lost by the rewrite */
+	(void)mail_duplicate_read_db_file(trans);
 
 	i_zero(&hdr);
 	hdr.version = DUPLICATE_VERSION;
@@ -654,40 +681,115 @@ void mail_duplicate_transaction_commit(
 	output = o_stream_create_fd_file(new_fd, 0, FALSE);
 	o_stream_cork(output);
 	o_stream_nsend(output, &hdr, sizeof(hdr));
-
-	i_zero(&rec);
-	iter = hash_table_iterate_init(trans->hash);
-	while (hash_table_iterate(iter, trans->hash, &d, &d)) {
-		if (d->marked) {
-			rec.stamp = time_to_uint32_trunc(d->time);
-			rec.id_size = d->id_size;
-			rec.user_size = strlen(d->user);
-
-			o_stream_nsend(output, &rec, sizeof(rec));
-			o_stream_nsend(output, d->id, rec.id_size);
-			o_stream_nsend(output, d->user, rec.user_size);
-		}
-	}
-	hash_table_iterate_deinit(&iter);
+	mail_duplicate_write_records(trans, output, FALSE);
 
 	if (o_stream_finish(output) < 0) {
 		e_error(trans->event, "write(%s) failed: %s",
 			trans->path, o_stream_get_error(output));
 		o_stream_unref(&output);
-		mail_duplicate_transaction_free(&trans);
-		return;
+		file_dotlock_delete(&dotlock);
+		return -1;
 	}
 	o_stream_unref(&output);
 
 	if (file_dotlock_replace(&dotlock, 0) < 0) {
 		e_error(trans->event,
 			"file_dotlock_replace(%s) failed: %m", trans->path);
+		return -1;
 	}
+	return 0;
+}
 
-	iter = hash_table_iterate_init(trans->hash);
-	while (hash_table_iterate(iter, trans->hash, &d, &d))
-		mail_duplicate_unlock(trans, d);
-	hash_table_iterate_deinit(&iter);
+static int mail_duplicate_append(struct mail_duplicate_transaction *trans)
+{
+	struct mail_duplicate_db *db = trans->db;
+	struct mail_duplicate_file_header hdr;
+	struct ostream *output;
+	struct dotlock *dotlock;
+	struct stat st;
+	int fd, ret;
+
+	e_debug(trans->event, "Commit; append to %s", trans->path);
+
+	ret = file_dotlock_create(&db->dotlock_set, trans->path, 0, &dotlock);
+	if (ret < 0) {
+		e_error(trans->event,
+			"file_dotlock_create(%s) failed: %m", trans->path);
+		return -1;
+	} else if (ret == 0) {
+		e_error(trans->event,
+			"Creating lock file for %s timed out in %u secs",
+			trans->path, db->dotlock_set.timeout);
+		return -1;
+	}
+
+	fd = open(trans->path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+	if (fd == -1) {
+		e_error(trans->event, "open(%s) failed: %m", trans->path);
+		file_dotlock_delete(&dotlock);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		e_error(trans->event, "fstat(%s) failed: %m", trans->path);
+		i_close_fd(&fd);
+		file_dotlock_delete(&dotlock);
+		return -1;
+	}
+
+	output = o_stream_create_fd_file(fd, st.st_size, FALSE);
+	o_stream_cork(output);
+	if (st.st_size == 0) {
+		/* new file */
+		i_zero(&hdr);
+		hdr.version = DUPLICATE_VERSION;
+		o_stream_nsend(output, &hdr, sizeof(hdr));
+	}
+	mail_duplicate_write_records(trans, output, TRUE);
+
+	ret = 0;
+	if (o_stream_finish(output) < 0) {
+		e_error(trans->event, "write(%s) failed: %s",
+			trans->path, o_stream_get_error(output));
+		ret = -1;
+	}
+	o_stream_unref(&output);
+	if (close(fd) < 0) {
+		e_error(trans->event, "close(%s) failed: %m", trans->path);
+		ret = -1;
+	}
+	file_dotlock_delete(&dotlock);
+	return ret;
+}
+
+void mail_duplicate_transaction_commit(
+	struct mail_duplicate_transaction **_trans)
+{
+	struct mail_duplicate_transaction *trans = *_trans;
+
+	if (trans == NULL)
+		return;
+	*_trans = NULL;
+
+	if (trans->path == NULL) {
+		e_debug(trans->event, "Commit (dummy)");
+		mail_duplicate_transaction_free(&trans);
+		return;
+	}
+	if (!trans->changed && !trans->compact) {
+		e_debug(trans->event, "Commit; no changes");
+		mail_duplicate_transaction_free(&trans);
+		return;
+	}
+
+	/* Only the changed records are normally appended to the DB file. The
+	   file is rewritten when it has accumulated enough expired or
+	   overwritten records, or if it still uses the old record format. */
+	if (trans->compact ||
+	    (trans->db_record_size != 0 &&
+	     trans->db_record_size != sizeof(struct mail_duplicate_record_header)))
+		(void)mail_duplicate_rewrite(trans);
+	else
+		(void)mail_duplicate_append(trans);
 
 	mail_duplicate_transaction_free(&trans);
 }
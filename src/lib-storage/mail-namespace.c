@@ -4,12 +4,19 @@
 #include "array.h"
 #include "str.h"
 #include "file-lock.h"
+#include "hash.h"
 #include "settings-parser.h"
 #include "mailbox-list-private.h"
 #include "mail-storage-private.h"
 #include "mail-storage-settings.h"
 #include "mail-namespace.h"
 
+struct namespace_listindex {
+	struct mail_namespace *ns;
+	const char *mailboxes_root;
+};
+HASH_TABLE_DEFINE_TYPE(namespace_listindex,
+		       const char *, struct namespace_listindex *);
 
 static struct mail_namespace_settings prefixless_ns_set = {
 	.name = "",
@@ -268,11 +275,11 @@ static bool get_listindex_path(struct mail_namespace *ns, const char **path_r)
 
 static bool
 namespace_has_duplicate_listindex(struct mail_namespace *ns,
+				  HASH_TABLE_TYPE(namespace_listindex) listindexes,
 				  const char **error_r)
 {
-	struct mail_namespace *ns2;
+	struct namespace_listindex *ns_listindex;
 	const char *ns_list_index_path, *ns_mailboxes_root;
-	const char *ns2_list_index_path, *ns2_mailboxes_root;
 
 	if (!ns->mail_set->mailbox_list_index) {
 		/* mailbox list indexes not in use */
@@ -284,26 +291,32 @@ namespace_has_duplicate_listindex(struct mail_namespace *ns,
 					&ns_mailboxes_root))
 		return FALSE;
 
-	for (ns2 = ns->next; ns2 != NULL; ns2 = ns2->next) {
-		if (!get_listindex_path(ns2, &ns2_list_index_path) ||
-		    !mailbox_list_get_root_path(ns2->list, MAILBOX_LIST_PATH_TYPE_MAILBOX,
-						&ns2_mailboxes_root))
-			continue;
-
-		if (strcmp(ns_list_index_path, ns2_list_index_path) == 0 &&
-		    strcmp(ns_mailboxes_root, ns2_mailboxes_root) != 0) {
-			*error_r = t_strdup_printf(
-				"Namespaces '%s' and '%s' have different mailboxes paths, but duplicate LISTINDEX path. "
-				"Add a unique LISTINDEX=<fname>",
-				ns->prefix, ns2->prefix);
-			return TRUE;
-		}
+	/* Compare only against the first namespace using the same LISTINDEX
+	   path. Any later ones with a different mailboxes root would have
+	   already failed the check. */
+	ns_listindex = hash_table_lookup(listindexes, ns_list_index_path);
+	if (ns_listindex == NULL) {
+		ns_listindex = t_new(struct namespace_listindex, 1);
+		ns_listindex->ns = ns;
+		ns_listindex->mailboxes_root = ns_mailboxes_root;
+		hash_table_insert(listindexes, ns_list_index_path,
+				  ns_listindex);
+		return FALSE;
+	}
+	if (strcmp(ns_listindex->mailboxes_root, ns_mailboxes_root) != 0) {
+		*error_r = t_strdup_printf(
+			"Namespaces '%s' and '%s' have different mailboxes paths, but duplicate LISTINDEX path. "
+			"Add a unique LISTINDEX=<fname>",
+			ns_listindex->ns->prefix, ns->prefix);
+		return TRUE;
 	}
 	return FALSE;
 }
 
 static bool
-namespaces_check(struct mail_namespace *namespaces, const char **error_r)
+namespaces_check_real(struct mail_namespace *namespaces,
+		      HASH_TABLE_TYPE(namespace_listindex) listindexes,
+		      const char **error_r)
 {
 	struct mail_namespace *ns, *inbox_ns = NULL;
 	unsigned int subscriptions_count = 0;
@@ -331,7 +344,7 @@ namespaces_check(struct mail_namespace *namespaces, const char **error_r)
 		}
 		if (namespace_set_alias_for(ns, namespaces, error_r) < 0)
 			return FALSE;
-		if (namespace_has_duplicate_listindex(ns, error_r))
+		if (namespace_has_duplicate_listindex(ns, listindexes, error_r))
 			return FALSE;
 
 		if (*ns->prefix != '\0' &&
@@ -387,6 +400,18 @@ namespaces_check(struct mail_namespace *namespaces, const char **error_r)
 	return TRUE;
 }
 
+static bool
+namespaces_check(struct mail_namespace *namespaces, const char **error_r)
+{
+	HASH_TABLE_TYPE(namespace_listindex) listindexes;
+	bool ret;
+
+	hash_table_create(&listindexes, default_pool, 0, str_hash, strcmp);
+	ret = namespaces_check_real(namespaces, listindexes, error_r);
+	hash_table_destroy(&listindexes);
+	return ret;
+}
+
 int mail_namespaces_init_finish(struct mail_namespace *namespaces,
 				const char **error_r)
 {
@@ -189,6 +189,9 @@ struct mail_storage {
 
 	/* optional fs-api object for accessing mailboxes */
 	struct fs *mailboxes_fs;
+	/* Moving average of the microseconds it took to open a mail's stream
+	   when prefetching it. Used to size the adaptive prefetch window. */
+	unsigned int prefetch_open_usecs;
 
 	/* Module-specific contexts. See mail_storage_module_id. */
 	ARRAY(union mail_storage_module_context *) module_contexts;
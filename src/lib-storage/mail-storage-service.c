@@ -4,6 +4,7 @@
 #include "ioloop.h"
 #include "array.h"
 #include "base64.h"
+#include "hash.h"
 #include "hostpid.h"
 #include "module-dir.h"
 #include "restrict-access.h"
@@ -39,6 +40,15 @@
 /* If time moves backwards more than this, kill ourself instead of sleeping. */
 #define MAX_TIME_BACKWARDS_SLEEP_MSECS  (5*1000)
 #define MAX_NOWARN_FORWARD_MSECS        (10*1000)
+/* Maximum number of userdb replies kept in the userdb cache */
+#define USERDB_CACHE_MAX_ENTRIES 100
+
+struct mail_storage_service_userdb_cache_entry {
+	pool_t pool;
+	time_t expire_time;
+	const char *username;
+	const char *const *fields;
+};
 
 struct mail_storage_service_privileges {
 	uid_t uid;
@@ -65,6 +75,9 @@ struct mail_storage_service_ctx {
 	pool_t userdb_next_pool;
 	const char *const **userdb_next_fieldsp;
 
+	HASH_TABLE(char *, struct mail_storage_service_userdb_cache_entry *)
+		userdb_cache;
+
 	bool debug:1;
 	bool log_initialized:1;
 	bool config_permission_denied:1;
@@ -313,25 +326,154 @@ user_reply_handle(struct mail_storage_service_ctx *ctx,
 	return ret;
 }
 
+static void
+userdb_cache_entry_free(struct mail_storage_service_userdb_cache_entry *entry)
+{
+	pool_unref(&entry->pool);
+}
+
+static void
+mail_storage_service_userdb_cache_clean(struct mail_storage_service_ctx *ctx)
+{
+	struct hash_iterate_context *iter;
+	struct mail_storage_service_userdb_cache_entry *entry;
+	char *key;
+
+	iter = hash_table_iterate_init(ctx->userdb_cache);
+	while (hash_table_iterate(iter, ctx->userdb_cache, &key, &entry)) {
+		if (entry->expire_time <= ioloop_time) {
+			hash_table_remove(ctx->userdb_cache, key);
+			userdb_cache_entry_free(entry);
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+
+	if (hash_table_count(ctx->userdb_cache) >= USERDB_CACHE_MAX_ENTRIES) {
+		/* still full - just start over */
+		iter = hash_table_iterate_init(ctx->userdb_cache);
+		while (hash_table_iterate(iter, ctx->userdb_cache, &key, &entry))
+			userdb_cache_entry_free(entry);
+		hash_table_iterate_deinit(&iter);
+		hash_table_clear(ctx->userdb_cache, FALSE);
+	}
+}
+
+static void
+mail_storage_service_userdb_cache_deinit(struct mail_storage_service_ctx *ctx)
+{
+	struct hash_iterate_context *iter;
+	struct mail_storage_service_userdb_cache_entry *entry;
+	char *key;
+
+	if (!hash_table_is_created(ctx->userdb_cache))
+		return;
+
+	iter = hash_table_iterate_init(ctx->userdb_cache);
+	while (hash_table_iterate(iter, ctx->userdb_cache, &key, &entry))
+		userdb_cache_entry_free(entry);
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&ctx->userdb_cache);
+}
+
+static const char *
+userdb_cache_get_key(const char *username, const struct auth_user_info *info)
+{
+	return t_strdup_printf("%s\t%s\t%s\t%u\t%s\t%u", username,
+			       info->service,
+			       net_ip2addr(&info->local_ip), info->local_port,
+			       net_ip2addr(&info->remote_ip), info->remote_port);
+}
+
+static bool
+mail_storage_service_userdb_cache_lookup(struct mail_storage_service_ctx *ctx,
+					 const char *key, pool_t pool,
+					 const char **username_r,
+					 const char *const **fields_r)
+{
+	struct mail_storage_service_userdb_cache_entry *entry;
+
+	if (!hash_table_is_created(ctx->userdb_cache))
+		return FALSE;
+	entry = hash_table_lookup(ctx->userdb_cache, key);
+	if (entry == NULL || entry->expire_time <= ioloop_time)
+		return FALSE;
+
+	*username_r = p_strdup(pool, entry->username);
+	*fields_r = p_strarray_dup(pool, entry->fields);
+	return TRUE;
+}
+
+static void
+mail_storage_service_userdb_cache_add(struct mail_storage_service_ctx *ctx,
+				      const char *key, unsigned int ttl_secs,
+				      const char *username,
+				      const char *const *fields)
+{
+	struct mail_storage_service_userdb_cache_entry *entry, *old_entry;
+	char *old_key;
+	pool_t pool;
+
+	if (!hash_table_is_created(ctx->userdb_cache)) {
+		hash_table_create(&ctx->userdb_cache, default_pool, 0,
+				  str_hash, strcmp);
+	} else if (hash_table_lookup_full(ctx->userdb_cache, key,
+					  &old_key, &old_entry)) {
+		hash_table_remove(ctx->userdb_cache, old_key);
+		userdb_cache_entry_free(old_entry);
+	}
+	if (hash_table_count(ctx->userdb_cache) >= USERDB_CACHE_MAX_ENTRIES)
+		mail_storage_service_userdb_cache_clean(ctx);
+
+	pool = pool_alloconly_create("userdb cache entry", 512);
+	entry = p_new(pool, struct mail_storage_service_userdb_cache_entry, 1);
+	entry->pool = pool;
+	entry->expire_time = ioloop_time + ttl_secs;
+	entry->username = p_strdup(pool, username);
+	entry->fields = p_strarray_dup(pool, fields);
+	hash_table_insert(ctx->userdb_cache, p_strdup(pool, key), entry);
+}
+
+static void
+service_auth_user_info_init(struct mail_storage_service_ctx *ctx,
+			    const struct mail_storage_service_input *input,
+			    struct auth_user_info *info_r)
+{
+	i_zero(info_r);
+	info_r->service = input->service != NULL ? input->service :
+		ctx->service->name;
+	info_r->local_ip = input->local_ip;
+	info_r->remote_ip = input->remote_ip;
+	info_r->local_port = input->local_port;
+	info_r->remote_port = input->remote_port;
+	info_r->forward_fields = input->forward_fields;
+	info_r->debug = input->debug;
+}
+
 static int
 service_auth_userdb_lookup(struct mail_storage_service_ctx *ctx,
 			   const struct mail_storage_service_input *input,
+			   const struct mail_user_settings *user_set,
 			   pool_t pool, struct event *event, const char **user,
 			   const char *const **fields_r, const char **error_r)
 {
 	struct auth_user_info info;
-	const char *new_username;
+	const char *new_username, *cache_key = NULL;
 	int ret;
 
-	i_zero(&info);
-	info.service = input->service != NULL ? input->service :
-		ctx->service->name;
-	info.local_ip = input->local_ip;
-	info.remote_ip = input->remote_ip;
-	info.local_port = input->local_port;
-	info.remote_port = input->remote_port;
-	info.forward_fields = input->forward_fields;
-	info.debug = input->debug;
+	service_auth_user_info_init(ctx, input, &info);
+
+	/* The userdb reply can depend on the forward_fields, so don't
+	   cache those lookups. */
+	if (user_set->auth_userdb_cache_ttl > 0 &&
+	    info.forward_fields == NULL) {
+		cache_key = userdb_cache_get_key(*user, &info);
+		if (mail_storage_service_userdb_cache_lookup(ctx, cache_key,
+				pool, &new_username, fields_r)) {
+			e_debug(event, "userdb lookup found from cache");
+			*user = new_username;
+			return 1;
+		}
+	}
 
 	ret = auth_master_user_lookup(ctx->conn, *user, &info, pool,
 				      &new_username, fields_r);
@@ -341,6 +483,11 @@ service_auth_userdb_lookup(struct mail_storage_service_ctx *ctx,
 			*user = t_strdup(new_username);
 		}
 		*user = new_username;
+		if (cache_key != NULL) {
+			mail_storage_service_userdb_cache_add(ctx, cache_key,
+				user_set->auth_userdb_cache_ttl,
+				new_username, *fields_r);
+		}
 	} else if (ret == 0)
 		*error_r = "Unknown user";
 	else if (**fields_r != NULL) {
@@ -1231,6 +1378,18 @@ mail_storage_service_generate_session_id(pool_t pool, const char *prefix)
 
 }
 
+void mail_storage_service_user_new_session_id(
+	struct mail_storage_service_user *user, struct mail_user *mail_user,
+	const char *session_id_prefix)
+{
+	user->input.session_id = mail_storage_service_generate_session_id(
+		user->pool, session_id_prefix);
+	user->session_id_counter = 1;
+	mail_user->session_id = p_strdup(mail_user->pool,
+					 user->input.session_id);
+	event_add_str(user->event, "session", mail_user->session_id);
+}
+
 static int
 mail_storage_service_lookup_real(struct mail_storage_service_ctx *ctx,
 				 const struct mail_storage_service_input *input,
@@ -1322,9 +1481,15 @@ mail_storage_service_lookup_real(struct mail_storage_service_ctx *ctx,
 		{ .key = NULL }
 	});
 
-	if ((flags & MAIL_STORAGE_SERVICE_FLAG_USERDB_LOOKUP) != 0) {
+	if ((flags & MAIL_STORAGE_SERVICE_FLAG_USERDB_LOOKUP) != 0 &&
+	    input->userdb_prefetched) {
+		i_assert(input->userdb_fields != NULL);
+		userdb_fields = input->userdb_fields;
+		if (ctx->userdb_next_fieldsp != NULL)
+			*ctx->userdb_next_fieldsp = userdb_fields;
+	} else if ((flags & MAIL_STORAGE_SERVICE_FLAG_USERDB_LOOKUP) != 0) {
 		ret = service_auth_userdb_lookup(
-			ctx, input, temp_pool, event,
+			ctx, input, user_set, temp_pool, event,
 			&username, &userdb_fields, error_r);
 		if (ret <= 0) {
 			event_unref(&event);
@@ -1710,8 +1875,18 @@ mail_storage_service_all_iter_deinit(struct mail_storage_service_ctx *ctx)
 
 void mail_storage_service_all_init_mask(struct mail_storage_service_ctx *ctx,
 					const char *user_mask_hint)
+{
+	mail_storage_service_all_init_mask_lookup(ctx, user_mask_hint,
+						  NULL, 0);
+}
+
+void mail_storage_service_all_init_mask_lookup(
+	struct mail_storage_service_ctx *ctx, const char *user_mask_hint,
+	const struct mail_storage_service_input *input,
+	unsigned int lookup_batch)
 {
 	enum auth_master_flags flags = 0;
+	struct auth_user_info info;
 
 	(void)mail_storage_service_all_iter_deinit(ctx);
 	mail_storage_service_init_settings(ctx, NULL);
@@ -1723,16 +1898,33 @@ void mail_storage_service_all_init_mask(struct mail_storage_service_ctx *ctx,
 		flags |= AUTH_MASTER_FLAG_DEBUG;
 	ctx->iter_conn = auth_master_init(auth_master_get_socket_path(ctx->conn),
 					  flags);
-	ctx->auth_list = auth_master_user_list_init(ctx->iter_conn,
-						    user_mask_hint, NULL);
+	if (lookup_batch == 0) {
+		ctx->auth_list = auth_master_user_list_init(ctx->iter_conn,
+							    user_mask_hint, NULL);
+		return;
+	}
+	service_auth_user_info_init(ctx, input, &info);
+	ctx->auth_list = auth_master_user_list_init_lookup(ctx->iter_conn,
+		user_mask_hint, &info, lookup_batch);
 }
 
 int mail_storage_service_all_next(struct mail_storage_service_ctx *ctx,
 				  const char **username_r)
+{
+	const char *const *userdb_fields;
+
+	return mail_storage_service_all_next_fields(ctx, username_r,
+						    &userdb_fields);
+}
+
+int mail_storage_service_all_next_fields(struct mail_storage_service_ctx *ctx,
+					 const char **username_r,
+					 const char *const **userdb_fields_r)
 {
 	i_assert((ctx->flags & MAIL_STORAGE_SERVICE_FLAG_USERDB_LOOKUP) != 0);
 
-	*username_r = auth_master_user_list_next(ctx->auth_list);
+	*username_r = auth_master_user_list_next_fields(ctx->auth_list,
+							userdb_fields_r);
 	if (*username_r != NULL)
 		return 1;
 	return mail_storage_service_all_iter_deinit(ctx);
@@ -1751,6 +1943,7 @@ void mail_storage_service_deinit(struct mail_storage_service_ctx **_ctx)
 	}
 	if (ctx->set_cache != NULL)
 		master_service_settings_cache_deinit(&ctx->set_cache);
+	mail_storage_service_userdb_cache_deinit(ctx);
 
 	if (storage_service_global == ctx)
 		storage_service_global = NULL;
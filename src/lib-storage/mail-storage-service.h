@@ -66,6 +66,9 @@ struct mail_storage_service_input {
 
 	/* override MAIL_STORAGE_SERVICE_FLAG_USERDB_LOOKUP for this lookup */
 	bool no_userdb_lookup:1;
+	/* userdb_fields (and username) are the reply of an already done userdb
+	   lookup. Use them instead of doing the userdb lookup. */
+	bool userdb_prefetched:1;
 	/* Enable auth_debug=yes for this lookup */
 	bool debug:1;
 	/* The end client connection (not just the previous hop proxy
@@ -132,10 +135,25 @@ void mail_storage_service_all_init(struct mail_storage_service_ctx *ctx);
    usernames. */
 void mail_storage_service_all_init_mask(struct mail_storage_service_ctx *ctx,
 					const char *user_mask_hint);
+/* Like mail_storage_service_all_init_mask(), but have the auth server also
+   look up the users' userdb fields while listing them, with up to
+   lookup_batch lookups in parallel. The lookups are done using the input's
+   service, IPs and forward_fields. */
+void mail_storage_service_all_init_mask_lookup(
+	struct mail_storage_service_ctx *ctx, const char *user_mask_hint,
+	const struct mail_storage_service_input *input,
+	unsigned int lookup_batch);
 /* Iterate through all usernames. Returns 1 if username was returned, 0 if
    there are no more users, -1 if error. */
 int mail_storage_service_all_next(struct mail_storage_service_ctx *ctx,
 				  const char **username_r);
+/* Like mail_storage_service_all_next(), but return also the userdb fields if
+   they were looked up already. They can be given to
+   mail_storage_service_lookup() with input.userdb_prefetched=TRUE.
+   *userdb_fields_r is NULL if the user still needs to be looked up. */
+int mail_storage_service_all_next_fields(struct mail_storage_service_ctx *ctx,
+					 const char **username_r,
+					 const char *const **userdb_fields_r);
 void mail_storage_service_deinit(struct mail_storage_service_ctx **ctx);
 /* Returns the first created service context. If it gets freed, NULL is
    returned until the next time mail_storage_service_init() is called. */
@@ -148,6 +166,12 @@ void mail_storage_service_io_activate_user(struct mail_storage_service_user *use
 /* Deactivate user context. This only switches back to non-user-specific
    log prefix. */
 void mail_storage_service_io_deactivate_user(struct mail_storage_service_user *user);
+/* Generate a new session ID for a mail_user that is reused for a new
+   session. The session ID is prefixed with session_id_prefix if it's
+   non-NULL. */
+void mail_storage_service_user_new_session_id(
+	struct mail_storage_service_user *user, struct mail_user *mail_user,
+	const char *session_id_prefix);
 
 /* Return settings struct for the given root. The settings contain all the
    changes done by userdb lookups. */
@@ -38,6 +38,7 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(SIZE, mail_attachment_min_size),
 	DEF(STR, mail_attachment_detection_options),
 	DEF(STR_VARS, mail_attribute_dict),
+	DEF(TIME_HIDDEN, mail_attribute_cache_ttl),
 	DEF(UINT, mail_prefetch_count),
 	DEF(STR, mail_cache_fields),
 	DEF(STR, mail_always_cache_fields),
@@ -49,17 +50,24 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(UINT_HIDDEN, mail_cache_max_header_name_length),
 	DEF(UINT_HIDDEN, mail_cache_max_headers_count),
 	DEF(SIZE_HIDDEN, mail_cache_max_size),
+	DEF(SIZE_HIDDEN, mail_header_cache_max_size),
 	DEF(UINT_HIDDEN, mail_cache_min_mail_count),
 	DEF(SIZE_HIDDEN, mail_cache_purge_min_size),
 	DEF(UINT_HIDDEN, mail_cache_purge_delete_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_continued_percentage),
 	DEF(UINT_HIDDEN, mail_cache_purge_header_continue_count),
+	DEF(SIZE_HIDDEN, mail_cache_purge_background_min_size),
+	DEF(UINT_HIDDEN, mail_cache_compress_level),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_min_log_bytes),
 	DEF(SIZE_HIDDEN, mail_index_rewrite_max_log_bytes),
 	DEF(SIZE_HIDDEN, mail_index_log_rotate_min_size),
 	DEF(SIZE_HIDDEN, mail_index_log_rotate_max_size),
 	DEF(TIME_HIDDEN, mail_index_log_rotate_min_age),
 	DEF(TIME_HIDDEN, mail_index_log2_max_age),
+	DEF(TIME_MSECS_HIDDEN, mail_index_log_group_commit_wait),
+	DEF(SIZE_HIDDEN, mail_index_mmap_populate_min_size),
+	DEF(SIZE_HIDDEN, mail_index_mmap_willneed_min_size),
+	DEF(SIZE_HIDDEN, mail_index_mmap_hugepage_min_size),
 	DEF(TIME, mailbox_idle_check_interval),
 	DEF(UINT, mail_max_keyword_length),
 	DEF(TIME, mail_max_lock_timeout),
@@ -68,6 +76,10 @@ static const struct setting_define mail_storage_setting_defines[] = {
 	DEF(UINT, mail_sort_max_read_count),
 	DEF(BOOL, mail_save_crlf),
 	DEF(ENUM, mail_fsync),
+	DEF(BOOL_HIDDEN, mail_index_log_group_commit),
+	DEF(BOOL_HIDDEN, mail_cache_fixed_field_columns),
+	DEF(BOOL_HIDDEN, mail_cache_cost_decisions),
+	DEF(BOOL_HIDDEN, mail_prefetch_adaptive),
 	DEF(BOOL, mmap_disable),
 	DEF(BOOL, dotlock_use_excl),
 	DEF(BOOL, mail_nfs_storage),
@@ -96,6 +108,7 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_attachment_min_size = 1024*128,
 	.mail_attachment_detection_options = "",
 	.mail_attribute_dict = "",
+	.mail_attribute_cache_ttl = 0,
 	.mail_prefetch_count = 0,
 	.mail_cache_fields = "flags",
 	.mail_always_cache_fields = "",
@@ -108,16 +121,23 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_cache_max_header_name_length = 100,
 	.mail_cache_max_headers_count = 100,
 	.mail_cache_max_size = 1024 * 1024 * 1024,
+	.mail_header_cache_max_size = 0,
 	.mail_cache_purge_min_size = 32 * 1024,
 	.mail_cache_purge_delete_percentage = 20,
 	.mail_cache_purge_continued_percentage = 200,
 	.mail_cache_purge_header_continue_count = 4,
+	.mail_cache_purge_background_min_size = 0,
+	.mail_cache_compress_level = 0,
 	.mail_index_rewrite_min_log_bytes = 8 * 1024,
 	.mail_index_rewrite_max_log_bytes = 128 * 1024,
 	.mail_index_log_rotate_min_size = 32 * 1024,
 	.mail_index_log_rotate_max_size = 1024 * 1024,
 	.mail_index_log_rotate_min_age = 5 * 60,
 	.mail_index_log2_max_age = 3600 * 24 * 2,
+	.mail_index_log_group_commit_wait = 0,
+	.mail_index_mmap_populate_min_size = 0,
+	.mail_index_mmap_willneed_min_size = 0,
+	.mail_index_mmap_hugepage_min_size = 0,
 	.mailbox_idle_check_interval = 30,
 	.mail_max_keyword_length = 50,
 	.mail_max_lock_timeout = 0,
@@ -126,6 +146,10 @@ const struct mail_storage_settings mail_storage_default_settings = {
 	.mail_sort_max_read_count = 0,
 	.mail_save_crlf = FALSE,
 	.mail_fsync = "optimized:never:always",
+	.mail_index_log_group_commit = FALSE,
+	.mail_cache_fixed_field_columns = FALSE,
+	.mail_cache_cost_decisions = FALSE,
+	.mail_prefetch_adaptive = FALSE,
 	.mmap_disable = FALSE,
 	.dotlock_use_excl = TRUE,
 	.mail_nfs_storage = FALSE,
@@ -276,6 +300,7 @@ const struct setting_parser_info mail_namespace_setting_parser_info = {
 static const struct setting_define mail_user_setting_defines[] = {
 	DEF(STR, base_dir),
 	DEF(STR, auth_socket_path),
+	DEF(TIME_HIDDEN, auth_userdb_cache_ttl),
 	DEF(STR_VARS, mail_temp_dir),
 
 	DEF(STR, mail_uid),
@@ -309,6 +334,7 @@ static const struct setting_define mail_user_setting_defines[] = {
 static const struct mail_user_settings mail_user_default_settings = {
 	.base_dir = PKG_RUNDIR,
 	.auth_socket_path = "auth-userdb",
+	.auth_userdb_cache_ttl = 0,
 	.mail_temp_dir = "/tmp",
 
 	.mail_uid = "",
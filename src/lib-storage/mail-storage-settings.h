@@ -18,6 +18,7 @@ struct mail_storage_settings {
 	const char *mail_attachment_hash;
 	uoff_t mail_attachment_min_size;
 	const char *mail_attribute_dict;
+	unsigned int mail_attribute_cache_ttl;
 	unsigned int mail_prefetch_count;
 	const char *mail_cache_fields;
 	const char *mail_always_cache_fields;
@@ -30,16 +31,23 @@ struct mail_storage_settings {
 	unsigned int mail_cache_max_header_name_length;
 	unsigned int mail_cache_max_headers_count;
 	uoff_t mail_cache_max_size;
+	uoff_t mail_header_cache_max_size;
 	uoff_t mail_cache_purge_min_size;
 	unsigned int mail_cache_purge_delete_percentage;
 	unsigned int mail_cache_purge_continued_percentage;
 	unsigned int mail_cache_purge_header_continue_count;
+	uoff_t mail_cache_purge_background_min_size;
+	unsigned int mail_cache_compress_level;
 	uoff_t mail_index_rewrite_min_log_bytes;
 	uoff_t mail_index_rewrite_max_log_bytes;
 	uoff_t mail_index_log_rotate_min_size;
 	uoff_t mail_index_log_rotate_max_size;
 	unsigned int mail_index_log_rotate_min_age;
 	unsigned int mail_index_log2_max_age;
+	unsigned int mail_index_log_group_commit_wait;
+	uoff_t mail_index_mmap_populate_min_size;
+	uoff_t mail_index_mmap_willneed_min_size;
+	uoff_t mail_index_mmap_hugepage_min_size;
 	unsigned int mailbox_idle_check_interval;
 	unsigned int mail_max_keyword_length;
 	unsigned int mail_max_lock_timeout;
@@ -48,6 +56,10 @@ struct mail_storage_settings {
 	unsigned int mail_sort_max_read_count;
 	bool mail_save_crlf;
 	const char *mail_fsync;
+	bool mail_index_log_group_commit;
+	bool mail_cache_fixed_field_columns;
+	bool mail_cache_cost_decisions;
+	bool mail_prefetch_adaptive;
 	bool mmap_disable;
 	bool dotlock_use_excl;
 	bool mail_nfs_storage;
@@ -116,6 +128,7 @@ struct mailbox_settings {
 struct mail_user_settings {
 	const char *base_dir;
 	const char *auth_socket_path;
+	unsigned int auth_userdb_cache_ttl;
 	const char *mail_temp_dir;
 
 	const char *mail_uid;
@@ -28,6 +28,7 @@
 #include "mailbox-list-private.h"
 #include "mail-autoexpunge.h"
 #include "mail-user.h"
+#include "mailbox-attribute-cache.h"
 
 
 struct mail_user_module_register mail_user_module_register = { 0 };
@@ -39,6 +40,7 @@ static void mail_user_deinit_base(struct mail_user *user)
 		dict_wait(user->_attr_dict);
 		dict_deinit(&user->_attr_dict);
 	}
+	mailbox_attribute_cache_deinit(&user->_attr_cache);
 	mail_namespaces_deinit(&user->namespaces);
 	if (user->_service_user != NULL)
 		mail_storage_service_user_unref(&user->_service_user);
@@ -12,6 +12,7 @@ struct ssl_iostream_settings;
 struct master_service_anvil_session;
 struct mail_user;
 struct dict_op_settings;
+struct mailbox_attribute_cache;
 
 struct mail_user_vfuncs {
 	void (*deinit)(struct mail_user *user);
@@ -70,6 +71,8 @@ struct mail_user {
 	normalizer_func_t *default_normalizer;
 	/* Filled lazily by mailbox_attribute_*() when accessing attributes. */
 	struct dict *_attr_dict;
+	/* Cache of _attr_dict lookups, if mail_attribute_cache_ttl is set */
+	struct mailbox_attribute_cache *_attr_cache;
 
 	/* Module-specific contexts. See mail_storage_module_id. */
 	ARRAY(union mail_user_module_context *) module_contexts;
@@ -0,0 +1,105 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "ioloop.h"
+#include "hash.h"
+#include "mailbox-attribute-cache.h"
+
+/* Maximum number of cached keys. When reached, the cache is cleared. */
+#define MAILBOX_ATTRIBUTE_CACHE_MAX_ENTRIES 1000
+
+struct mailbox_attribute_cache_entry {
+	char *value;
+	time_t expire_time;
+};
+
+struct mailbox_attribute_cache {
+	unsigned int ttl_secs;
+	HASH_TABLE(char *, struct mailbox_attribute_cache_entry *) entries;
+};
+
+struct mailbox_attribute_cache *
+mailbox_attribute_cache_init(unsigned int ttl_secs)
+{
+	struct mailbox_attribute_cache *cache;
+
+	cache = i_new(struct mailbox_attribute_cache, 1);
+	cache->ttl_secs = ttl_secs;
+	hash_table_create(&cache->entries, default_pool, 0, str_hash, strcmp);
+	return cache;
+}
+
+static void
+mailbox_attribute_cache_entry_free(char *key,
+				   struct mailbox_attribute_cache_entry *entry)
+{
+	i_free(key);
+	i_free(entry->value);
+	i_free(entry);
+}
+
+static void mailbox_attribute_cache_clear(struct mailbox_attribute_cache *cache)
+{
+	struct hash_iterate_context *iter;
+	struct mailbox_attribute_cache_entry *entry;
+	char *key;
+
+	iter = hash_table_iterate_init(cache->entries);
+	while (hash_table_iterate(iter, cache->entries, &key, &entry))
+		mailbox_attribute_cache_entry_free(key, entry);
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(cache->entries, FALSE);
+}
+
+void mailbox_attribute_cache_deinit(struct mailbox_attribute_cache **_cache)
+{
+	struct mailbox_attribute_cache *cache = *_cache;
+
+	if (cache == NULL)
+		return;
+	*_cache = NULL;
+
+	mailbox_attribute_cache_clear(cache);
+	hash_table_destroy(&cache->entries);
+	i_free(cache);
+}
+
+bool mailbox_attribute_cache_lookup(struct mailbox_attribute_cache *cache,
+				    const char *key, const char **value_r)
+{
+	struct mailbox_attribute_cache_entry *entry;
+
+	entry = hash_table_lookup(cache->entries, key);
+	if (entry == NULL || entry->expire_time <= ioloop_time)
+		return FALSE;
+	*value_r = t_strdup(entry->value);
+	return TRUE;
+}
+
+void mailbox_attribute_cache_add(struct mailbox_attribute_cache *cache,
+				 const char *key, const char *value)
+{
+	struct mailbox_attribute_cache_entry *entry;
+
+	mailbox_attribute_cache_remove(cache, key);
+	if (hash_table_count(cache->entries) >=
+	    MAILBOX_ATTRIBUTE_CACHE_MAX_ENTRIES)
+		mailbox_attribute_cache_clear(cache);
+
+	entry = i_new(struct mailbox_attribute_cache_entry, 1);
+	entry->value = i_strdup(value);
+	entry->expire_time = ioloop_time + cache->ttl_secs;
+	hash_table_insert(cache->entries, i_strdup(key), entry);
+}
+
+void mailbox_attribute_cache_remove(struct mailbox_attribute_cache *cache,
+				    const char *key)
+{
+	struct mailbox_attribute_cache_entry *entry;
+	char *orig_key;
+
+	if (!hash_table_lookup_full(cache->entries, key, &orig_key, &entry))
+		return;
+	hash_table_remove(cache->entries, orig_key);
+	mailbox_attribute_cache_entry_free(orig_key, entry);
+}
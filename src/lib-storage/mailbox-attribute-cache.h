@@ -0,0 +1,26 @@
+#ifndef MAILBOX_ATTRIBUTE_CACHE_H
+#define MAILBOX_ATTRIBUTE_CACHE_H
+
+/* In-memory cache of attribute dict lookups. The keys are the full dict
+   keys, which already contain the attribute type and the mailbox GUID.
+   The cache doesn't notice changes done by other processes, so the entries
+   are only trusted for a limited time. */
+struct mailbox_attribute_cache;
+
+struct mailbox_attribute_cache *
+mailbox_attribute_cache_init(unsigned int ttl_secs);
+void mailbox_attribute_cache_deinit(struct mailbox_attribute_cache **cache);
+
+/* Returns TRUE if the key was found from the cache. *value_r is set to NULL
+   if the attribute is cached as nonexistent. */
+bool mailbox_attribute_cache_lookup(struct mailbox_attribute_cache *cache,
+				    const char *key, const char **value_r);
+/* Add a looked up value to the cache. value may be NULL if the attribute
+   doesn't exist. */
+void mailbox_attribute_cache_add(struct mailbox_attribute_cache *cache,
+				 const char *key, const char *value);
+/* Drop the key from the cache, because it's being changed. */
+void mailbox_attribute_cache_remove(struct mailbox_attribute_cache *cache,
+				    const char *key);
+
+#endif
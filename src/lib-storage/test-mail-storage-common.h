@@ -18,6 +18,8 @@ struct test_mail_storage_settings {
 	const char *driver_opts;
 	const char *hierarchy_sep;
 	const char *const *extra_input;
+	/* Keep the user's existing home directory */
+	bool keep_home;
 };
 
 struct test_mail_storage_ctx *test_mail_storage_init(void);
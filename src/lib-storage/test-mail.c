@@ -3,10 +3,15 @@
 #include "lib.h"
 #include "test-common.h"
 #include "istream.h"
+#include "str.h"
 #include "master-service.h"
 #include "message-size.h"
+#include "mail-search-build.h"
+#include "mailbox-list.h"
 #include "test-mail-storage-common.h"
 
+#include <dirent.h>
+
 static struct event *test_event;
 
 static int
@@ -477,6 +482,279 @@ static void test_bodystructure_corruption_reparsing(void)
 	test_end();
 }
 
+static struct mail_search_arg *
+test_search_arg_body(pool_t pool, enum mail_search_arg_type type,
+		     const char *key, struct mail_search_arg *next)
+{
+	struct mail_search_arg *arg;
+
+	arg = p_new(pool, struct mail_search_arg, 1);
+	arg->type = type;
+	arg->value.str = p_strdup(pool, key);
+	arg->next = next;
+	return arg;
+}
+
+static const char *
+test_mail_search_seqs(struct mailbox *box, struct mail_search_args *args)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail_search_context *search_ctx;
+	struct mail *mail;
+	string_t *seqs = t_str_new(32);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	search_ctx = mailbox_search_init(trans, args, NULL, 0, NULL);
+	while (mailbox_search_next(search_ctx, &mail)) {
+		if (str_len(seqs) > 0)
+			str_append_c(seqs, ',');
+		str_printfa(seqs, "%u", mail->seq);
+	}
+	test_assert(mailbox_search_deinit(&search_ctx) == 0);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	mail_search_args_unref(&args);
+	return str_c(seqs);
+}
+
+static void test_mail_search_body_multi(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "sdbox",
+	};
+	struct mail_search_args *args;
+	struct mail_search_arg *arg;
+
+	test_begin("mail search multiple body keys");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mailbox *box =
+		mailbox_alloc(ctx->user->namespaces->list, "INBOX", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_mail_save(box, "Subject: apple\n\nbanana split\n");
+	test_mail_save(box, "Subject: x\n\napple and banana\n");
+	test_mail_save(box, "Subject: y\n\ngrape\n");
+
+	/* BODY apple BODY banana */
+	args = mail_search_build_init();
+	args->args = test_search_arg_body(args->pool, SEARCH_BODY, "apple",
+		test_search_arg_body(args->pool, SEARCH_BODY, "banana", NULL));
+	test_assert_strcmp(test_mail_search_seqs(box, args), "2");
+
+	/* TEXT apple TEXT banana */
+	args = mail_search_build_init();
+	args->args = test_search_arg_body(args->pool, SEARCH_TEXT, "apple",
+		test_search_arg_body(args->pool, SEARCH_TEXT, "banana", NULL));
+	test_assert_strcmp(test_mail_search_seqs(box, args), "1,2");
+
+	/* OR BODY apple OR BODY banana BODY grape */
+	args = mail_search_build_init();
+	arg = mail_search_build_add(args, SEARCH_OR);
+	arg->value.subargs =
+		test_search_arg_body(args->pool, SEARCH_BODY, "apple",
+		test_search_arg_body(args->pool, SEARCH_BODY, "banana",
+		test_search_arg_body(args->pool, SEARCH_BODY, "grape", NULL)));
+	test_assert_strcmp(test_mail_search_seqs(box, args), "1,2,3");
+
+	/* NOT BODY apple BODY banana */
+	args = mail_search_build_init();
+	args->args = test_search_arg_body(args->pool, SEARCH_BODY, "apple",
+		test_search_arg_body(args->pool, SEARCH_BODY, "banana", NULL));
+	args->args->match_not = TRUE;
+	test_assert_strcmp(test_mail_search_seqs(box, args), "1");
+
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
+#define TEST_MDBOX_SHARD_MAIL_COUNT 8
+
+static unsigned int test_mailbox_messages_count(struct mailbox *box)
+{
+	struct mailbox_status status;
+
+	mailbox_get_open_status(box, STATUS_MESSAGES, &status);
+	return status.messages;
+}
+
+static const char *test_mdbox_shard_mail(unsigned int i)
+{
+	return t_strdup_printf("Subject: mail %u\n\nbody %u\n", i, i);
+}
+
+static void test_mdbox_shards_verify(struct mailbox *box, unsigned int count)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	string_t *str = t_str_new(64);
+	unsigned int i;
+
+	test_assert(mailbox_sync(box, 0) == 0);
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	for (i = 0; i < count; i++) {
+		const char *expected = test_mdbox_shard_mail(i);
+
+		mail_set_seq(mail, i + 1);
+		if (mail_get_stream(mail, NULL, NULL, &input) < 0) {
+			test_failed(t_strdup_printf("mail_get_stream(%u) failed: %s",
+				i + 1, mailbox_get_last_internal_error(box, NULL)));
+			break;
+		}
+		str_truncate(str, 0);
+		while (i_stream_read_more(input, &data, &size) > 0) {
+			str_append_data(str, data, size);
+			i_stream_skip(input, size);
+		}
+		test_assert(input->stream_errno == 0);
+		test_assert_idx(strcmp(str_c(str), expected) == 0, i);
+	}
+	test_assert(test_mailbox_messages_count(box) == count);
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+}
+
+static unsigned int test_mdbox_shards_with_files(const char *root_dir)
+{
+	const char *storage_dir = t_strconcat(root_dir, "/storage", NULL);
+	struct dirent *d;
+	const char *suffix;
+	unsigned int shards = 0;
+	uint32_t file_id;
+	DIR *dir;
+
+	dir = opendir(storage_dir);
+	if (dir == NULL)
+		i_fatal("opendir(%s) failed: %m", storage_dir);
+	while ((d = readdir(dir)) != NULL) {
+		if (str_begins(d->d_name, "m.", &suffix) &&
+		    str_to_uint32(suffix, &file_id) == 0)
+			shards |= 1U << (file_id >> 28);
+	}
+	(void)closedir(dir);
+	return shards;
+}
+
+static void test_mdbox_shards_expunge(struct mailbox *box, uint32_t first_seq)
+{
+	struct mailbox_transaction_context *trans;
+	struct mail *mail;
+	uint32_t seq, count = test_mailbox_messages_count(box);
+
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	for (seq = first_seq; seq <= count; seq++) {
+		mail_set_seq(mail, seq);
+		mail_expunge(mail);
+	}
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_assert(mailbox_sync(box, 0) == 0);
+}
+
+static void test_mdbox_map_shards(void)
+{
+	struct test_mail_storage_ctx *ctx;
+	struct test_mail_storage_settings set = {
+		.driver = "mdbox",
+		.extra_input = (const char *const[]) {
+			"mdbox_map_shards=4",
+			NULL
+		},
+	};
+	struct mailbox_transaction_context *trans, *dest_trans;
+	struct mail_save_context *save_ctx;
+	struct mail *mail;
+	struct stat st;
+	const char *root_dir;
+	unsigned int i;
+
+	test_begin("mdbox map shards");
+	ctx = test_mail_storage_init();
+	test_mail_storage_init_user(ctx, &set);
+
+	struct mail_namespace *ns = ctx->user->namespaces;
+	struct mailbox *box = mailbox_alloc(ns->list, "INBOX", 0);
+	struct mailbox *dest_box = mailbox_alloc(ns->list, "Copy", 0);
+	test_assert(mailbox_open(box) == 0);
+	test_assert(mailbox_create(dest_box, NULL, FALSE) == 0);
+	test_assert(mailbox_open(dest_box) == 0);
+
+	/* each save goes to the next shard */
+	for (i = 0; i < TEST_MDBOX_SHARD_MAIL_COUNT; i++)
+		test_mail_save(box, test_mdbox_shard_mail(i));
+	root_dir = t_strdup(mailbox_list_get_root_forced(ns->list,
+						MAILBOX_LIST_PATH_TYPE_INDEX));
+	for (i = 0; i < 4; i++) {
+		const char *path = i == 0 ?
+			t_strdup_printf("%s/storage/dovecot.map.index.log",
+					root_dir) :
+			t_strdup_printf("%s/storage/dovecot.map.%u.index.log",
+					root_dir, i);
+		test_assert_idx(stat(path, &st) == 0, i);
+	}
+
+	/* copying updates the refcounts in all the shards */
+	test_assert(mailbox_sync(box, 0) == 0);
+	trans = mailbox_transaction_begin(box, 0, __func__);
+	dest_trans = mailbox_transaction_begin(dest_box,
+			MAILBOX_TRANSACTION_FLAG_EXTERNAL, __func__);
+	mail = mail_alloc(trans, 0, NULL);
+	for (i = 1; i <= TEST_MDBOX_SHARD_MAIL_COUNT; i++) {
+		mail_set_seq(mail, i);
+		save_ctx = mailbox_save_alloc(dest_trans);
+		test_assert(mailbox_copy(&save_ctx, mail) == 0);
+	}
+	mail_free(&mail);
+	test_assert(mailbox_transaction_commit(&dest_trans) == 0);
+	test_assert(mailbox_transaction_commit(&trans) == 0);
+	test_mdbox_shards_verify(dest_box, TEST_MDBOX_SHARD_MAIL_COUNT);
+
+	/* expunge everything from INBOX and the second half of the copies.
+	   each shard's file has one mail from both halves, so purging has to
+	   move the remaining mails to new files within the same shards. */
+	test_mdbox_shards_expunge(box, 1);
+	test_mdbox_shards_expunge(dest_box, TEST_MDBOX_SHARD_MAIL_COUNT / 2 + 1);
+	test_assert(mail_storage_purge(box->storage) == 0);
+	test_assert(test_mailbox_messages_count(box) == 0);
+	test_mdbox_shards_verify(dest_box, TEST_MDBOX_SHARD_MAIL_COUNT / 2);
+	test_assert(test_mdbox_shards_with_files(root_dir) == 0xf);
+
+	mailbox_free(&dest_box);
+	mailbox_free(&box);
+	test_mail_storage_deinit_user(ctx);
+
+	/* the shards existing on disk are still used after the setting is
+	   lowered back to 1. new mails are appended to the first shard. */
+	set.extra_input = NULL;
+	set.keep_home = TRUE;
+	test_mail_storage_init_user(ctx, &set);
+	dest_box = mailbox_alloc(ctx->user->namespaces->list, "Copy", 0);
+	test_assert(mailbox_open(dest_box) == 0);
+	test_mdbox_shards_verify(dest_box, TEST_MDBOX_SHARD_MAIL_COUNT / 2);
+	test_mail_save(dest_box,
+		       test_mdbox_shard_mail(TEST_MDBOX_SHARD_MAIL_COUNT / 2));
+	test_mdbox_shards_verify(dest_box, TEST_MDBOX_SHARD_MAIL_COUNT / 2 + 1);
+
+	/* rebuilding keeps the mails in the shards. each shard is fscked. */
+	test_expect_errors(4 + 1);
+	test_assert(mailbox_sync(dest_box, MAILBOX_SYNC_FLAG_FORCE_RESYNC) == 0);
+	test_expect_no_more_errors();
+	test_mdbox_shards_verify(dest_box, TEST_MDBOX_SHARD_MAIL_COUNT / 2 + 1);
+	test_assert(test_mdbox_shards_with_files(root_dir) == 0xf);
+
+	mailbox_free(&dest_box);
+	test_mail_storage_deinit_user(ctx);
+	test_mail_storage_deinit(&ctx);
+	test_end();
+}
+
 int main(int argc, char **argv)
 {
 	void (*const tests[])(void) = {
@@ -484,6 +762,8 @@ int main(int argc, char **argv)
 		test_attachment_flags_during_header_fetch,
 		test_bodystructure_reparsing,
 		test_bodystructure_corruption_reparsing,
+		test_mail_search_body_multi,
+		test_mdbox_map_shards,
 		NULL
 	};
 	int ret;
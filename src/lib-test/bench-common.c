@@ -0,0 +1,148 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "str.h"
+#include "strnum.h"
+#include "sort.h"
+#include "time-util.h"
+#include "json-parser.h"
+#include "bench-common.h"
+
+#include <stdio.h>
+
+#define BENCH_DEFAULT_REPEAT 5
+#define BENCH_DEFAULT_MIN_MSECS 20
+
+static struct {
+	const char *match;
+	unsigned int repeat;
+	uint64_t min_nsecs;
+	bool json;
+} bench_set;
+
+static string_t *bench_json;
+volatile uintmax_t bench_sink;
+const void *volatile bench_sink_ptr;
+
+static int bench_double_cmp(const double *d1, const double *d2)
+{
+	return *d1 < *d2 ? -1 : (*d1 > *d2 ? 1 : 0);
+}
+
+static uint64_t
+bench_time(bench_callback_t *callback, void *context, unsigned int iterations)
+{
+	uint64_t ts_0 = i_nanoseconds();
+
+	callback(context, iterations);
+	return i_nanoseconds() - ts_0;
+}
+
+static void
+bench_report(const char *name, size_t bytes_per_iter,
+	     unsigned int iterations, double min_ns, double median_ns)
+{
+	if (bench_set.json) {
+		if (str_len(bench_json) > 1)
+			str_append(bench_json, ",\n");
+		str_append(bench_json, "{\"name\":\"");
+		json_append_escaped(bench_json, name);
+		str_printfa(bench_json, "\",\"iterations\":%u,"
+			    "\"ns_per_op\":%.3f,\"median_ns_per_op\":%.3f",
+			    iterations, min_ns, median_ns);
+		if (bytes_per_iter > 0) {
+			str_printfa(bench_json, ",\"bytes_per_sec\":%.0f",
+				    (double)bytes_per_iter * 1e9 / min_ns);
+		}
+		str_append_c(bench_json, '}');
+		return;
+	}
+
+	printf("%-45s %12.2f ns/op (median %.2f)", name, min_ns, median_ns);
+	if (bytes_per_iter > 0) {
+		printf(" %10.1f MB/s",
+		       (double)bytes_per_iter * 1000.0 / min_ns);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+#undef bench_run
+void bench_run(const char *name, size_t bytes_per_iter,
+	       bench_callback_t *callback, void *context)
+{
+	unsigned int i, iterations = 1;
+	double ns_per_op[bench_set.repeat];
+	uint64_t nsecs;
+
+	if (strstr(name, bench_set.match) == NULL)
+		return;
+
+	/* calibrate and warm up */
+	while (bench_time(callback, context, iterations) < bench_set.min_nsecs &&
+	       iterations < UINT_MAX / 2)
+		iterations *= 2;
+
+	for (i = 0; i < bench_set.repeat; i++) {
+		nsecs = bench_time(callback, context, iterations);
+		ns_per_op[i] = (double)nsecs / iterations;
+	}
+	i_qsort(ns_per_op, bench_set.repeat, sizeof(ns_per_op[0]),
+		bench_double_cmp);
+	bench_report(name, bytes_per_iter, iterations, ns_per_op[0],
+		     ns_per_op[bench_set.repeat / 2]);
+}
+
+static void ATTR_NORETURN print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [--match <substring>] [--json] "
+		"[--repeat <count>] [--min-time <msecs>]\n", prog);
+	lib_exit(1);
+}
+
+int bench_main(int argc, const char *argv[],
+	       void (*const bench_functions[])(void))
+{
+	unsigned int i, min_msecs = BENCH_DEFAULT_MIN_MSECS;
+	int arg;
+
+	lib_init();
+	bench_set.match = "";
+	bench_set.repeat = BENCH_DEFAULT_REPEAT;
+
+	for (arg = 1; arg < argc; arg++) {
+		if (strcmp(argv[arg], "--json") == 0)
+			bench_set.json = TRUE;
+		else if (arg + 1 == argc)
+			print_usage(argv[0]);
+		else if (strcmp(argv[arg], "--match") == 0)
+			bench_set.match = argv[++arg];
+		else if (strcmp(argv[arg], "--repeat") == 0) {
+			if (str_to_uint(argv[++arg], &bench_set.repeat) < 0 ||
+			    bench_set.repeat == 0)
+				print_usage(argv[0]);
+		} else if (strcmp(argv[arg], "--min-time") == 0) {
+			if (str_to_uint(argv[++arg], &min_msecs) < 0)
+				print_usage(argv[0]);
+		} else {
+			print_usage(argv[0]);
+		}
+	}
+	bench_set.min_nsecs = (uint64_t)min_msecs * 1000000;
+
+	if (bench_set.json) {
+		bench_json = str_new(default_pool, 4096);
+		str_append_c(bench_json, '[');
+	}
+	for (i = 0; bench_functions[i] != NULL; i++) T_BEGIN {
+		bench_functions[i]();
+	} T_END;
+	if (bench_set.json) {
+		str_append(bench_json, "]\n");
+		fwrite(str_data(bench_json), 1, str_len(bench_json), stdout);
+		str_free(&bench_json);
+	}
+
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+/* The callback must run the benchmarked operation the given number of
+   times. Setup that shouldn't be measured belongs outside the callback. */
+typedef void bench_callback_t(void *context, unsigned int iterations);
+
+/* Run a benchmark: the iteration count is first doubled until a single run
+   takes at least the minimum time (this also works as warmup), after which
+   the measurement is repeated and the fastest and median runs are reported.
+   If bytes_per_iter is non-zero, the throughput is reported as well. */
+void bench_run(const char *name, size_t bytes_per_iter,
+	       bench_callback_t *callback, void *context);
+#define bench_run(name, bytes_per_iter, callback, context) \
+	bench_run(name, bytes_per_iter, (bench_callback_t *)callback, \
+		TRUE ? context : \
+		CALLBACK_TYPECHECK(callback, void (*)(typeof(context), unsigned int)))
+
+/* Make the compiler believe that the integer/pointer value is used, so that
+   the benchmarked code can't be optimized away. */
+extern volatile uintmax_t bench_sink;
+extern const void *volatile bench_sink_ptr;
+#define bench_use(value) \
+	STMT_START { bench_sink += (value); } STMT_END
+#define bench_use_ptr(ptr) \
+	STMT_START { bench_sink_ptr = (ptr); } STMT_END
+
+/* Parse the --match, --json, --repeat and --min-time options and run the
+   NULL-terminated list of benchmark functions. Returns the exit code. */
+int bench_main(int argc, const char *argv[],
+	       void (*const bench_functions[])(void));
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef BASE64_PRIVATE_H
+#define BASE64_PRIVATE_H
+
+/* The SIMD code paths work with schemes whose first 62 characters are the
+   standard "A-Za-z0-9". They differ only by the last two characters. */
+struct base64_simd_chars {
+	unsigned char c62, c63;
+};
+
+enum base64_simd_impl {
+	BASE64_SIMD_IMPL_NONE = 0,
+	BASE64_SIMD_IMPL_SSSE3,
+	BASE64_SIMD_IMPL_AVX2,
+};
+
+/* Minimum number of input bytes the SIMD functions can do anything with.
+   This is also the size of the decoder's input blocks. */
+#define BASE64_SIMD_MIN_INPUT 16
+
+/* Encode as many full 3 byte groups from src as possible, without writing
+   more than dst_size bytes to dst. Returns the number of bytes consumed from
+   src, which is always a multiple of 3. The caller handles the rest. */
+size_t base64_simd_encode(const struct base64_simd_chars *chars,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dst, size_t dst_size);
+/* Decode as many full 4 character groups from src as possible, without
+   writing more than dst_size bytes to dst. The decoding stops at the first
+   BASE64_SIMD_MIN_INPUT sized block containing anything else than base64
+   characters (e.g. whitespace or padding). Returns the number of bytes
+   consumed from src, which is always a multiple of 4. */
+size_t base64_simd_decode(const struct base64_simd_chars *chars,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dst, size_t dst_size);
+
+/* Use the given implementation instead of the best one supported by the CPU.
+   Returns FALSE if the CPU doesn't support it. This is intended for unit
+   tests. */
+bool base64_simd_set_impl(enum base64_simd_impl impl);
+
+#endif
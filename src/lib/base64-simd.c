@@ -0,0 +1,400 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "base64-private.h"
+
+/* The encoding and decoding algorithms are based on the work of Wojciech
+   Muła: the input is reshuffled so that each 32bit lane contains one 3 byte
+   group, which is then split into (or merged from) 4 6bit values with
+   multiplications. Translating the 6bit values to/from the characters is
+   done with range comparisons, which works for both the base64 and base64url
+   alphabets. */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(__GNUC__ >= 5 || defined(__clang__))
+#  define BASE64_SIMD_X86
+#  include <immintrin.h>
+#  define BASE64_TARGET_SSSE3 __attribute__((target("ssse3")))
+#  define BASE64_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+typedef size_t
+base64_simd_func_t(const struct base64_simd_chars *chars,
+		   const unsigned char *src, size_t src_size,
+		   unsigned char *dst, size_t dst_size);
+
+static bool base64_simd_initialized = FALSE;
+static base64_simd_func_t *base64_simd_encode_func = NULL;
+static base64_simd_func_t *base64_simd_decode_func = NULL;
+
+#ifdef BASE64_SIMD_X86
+
+/*
+ * SSSE3
+ */
+
+static inline BASE64_TARGET_SSSE3 __m128i
+base64_ssse3_enc_reshuffle(__m128i in)
+{
+	/* Input bytes in each lane: [b1, b0, b2, b1]. The first 16bit word
+	   then contains the 1st and 2nd 6bit values, and the second word
+	   the 3rd and 4th values. */
+	in = _mm_shuffle_epi8(in, _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+						7, 6, 8, 7, 10, 9, 11, 10));
+	__m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	__m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	__m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	__m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(t1, t3);
+}
+
+static inline BASE64_TARGET_SSSE3 __m128i
+base64_ssse3_enc_translate(__m128i idx, const struct base64_simd_chars *chars)
+{
+	__m128i offset, eq;
+
+	/* 0..25 -> 'A'..'Z', 26..51 -> 'a'..'z', 52..61 -> '0'..'9' */
+	offset = _mm_set1_epi8('A');
+	offset = _mm_add_epi8(offset, _mm_and_si128(
+		_mm_cmpgt_epi8(idx, _mm_set1_epi8(25)),
+		_mm_set1_epi8('a' - 26 - 'A')));
+	offset = _mm_add_epi8(offset, _mm_and_si128(
+		_mm_cmpgt_epi8(idx, _mm_set1_epi8(51)),
+		_mm_set1_epi8('0' - 52 - ('a' - 26))));
+	eq = _mm_cmpeq_epi8(idx, _mm_set1_epi8(62));
+	offset = _mm_or_si128(_mm_andnot_si128(eq, offset), _mm_and_si128(
+		eq, _mm_set1_epi8((char)(chars->c62 - 62))));
+	eq = _mm_cmpeq_epi8(idx, _mm_set1_epi8(63));
+	offset = _mm_or_si128(_mm_andnot_si128(eq, offset), _mm_and_si128(
+		eq, _mm_set1_epi8((char)(chars->c63 - 63))));
+	return _mm_add_epi8(idx, offset);
+}
+
+static inline BASE64_TARGET_SSSE3 __m128i
+base64_ssse3_range(__m128i in, char first, char last)
+{
+	/* Signed comparison is fine, since all the characters are ASCII and
+	   the 8bit characters are negative. */
+	return _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8(first - 1)),
+			     _mm_cmplt_epi8(in, _mm_set1_epi8(last + 1)));
+}
+
+static inline BASE64_TARGET_SSSE3 bool
+base64_ssse3_dec_translate(__m128i in, const struct base64_simd_chars *chars,
+			   __m128i *values_r)
+{
+	__m128i upper, lower, digit, c62, c63, valid, offset;
+
+	upper = base64_ssse3_range(in, 'A', 'Z');
+	lower = base64_ssse3_range(in, 'a', 'z');
+	digit = base64_ssse3_range(in, '0', '9');
+	c62 = _mm_cmpeq_epi8(in, _mm_set1_epi8((char)chars->c62));
+	c63 = _mm_cmpeq_epi8(in, _mm_set1_epi8((char)chars->c63));
+
+	valid = _mm_or_si128(_mm_or_si128(upper, lower),
+			     _mm_or_si128(digit, _mm_or_si128(c62, c63)));
+	if (_mm_movemask_epi8(valid) != 0xffff)
+		return FALSE;
+
+	offset = _mm_and_si128(upper, _mm_set1_epi8(-'A'));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		lower, _mm_set1_epi8(26 - 'a')));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		digit, _mm_set1_epi8(52 - '0')));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		c62, _mm_set1_epi8((char)(62 - chars->c62))));
+	offset = _mm_or_si128(offset, _mm_and_si128(
+		c63, _mm_set1_epi8((char)(63 - chars->c63))));
+	*values_r = _mm_add_epi8(in, offset);
+	return TRUE;
+}
+
+static inline BASE64_TARGET_SSSE3 __m128i
+base64_ssse3_dec_pack(__m128i values)
+{
+	/* merge the 6bit values into 12bit words, then into 24bits */
+	__m128i merged = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+	merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+	/* the 3 bytes are in reverse order in each lane */
+	return _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4,
+						      10, 9, 8, 14, 13, 12,
+						      -1, -1, -1, -1));
+}
+
+static inline BASE64_TARGET_SSSE3 size_t
+base64_ssse3_encode_loop(const struct base64_simd_chars *chars,
+			 const unsigned char *src, size_t src_size,
+			 unsigned char *dst, size_t dst_size)
+{
+	size_t src_pos = 0, dst_pos = 0;
+
+	/* 16 bytes are read, but only 12 are used */
+	while (src_size - src_pos >= 16 && dst_size - dst_pos >= 16) {
+		__m128i in = _mm_loadu_si128((const void *)(src + src_pos));
+		__m128i out = base64_ssse3_enc_translate(
+			base64_ssse3_enc_reshuffle(in), chars);
+		_mm_storeu_si128((void *)(dst + dst_pos), out);
+		src_pos += 12;
+		dst_pos += 16;
+	}
+	return src_pos;
+}
+
+static inline BASE64_TARGET_SSSE3 bool
+base64_ssse3_decode_block(const struct base64_simd_chars *chars,
+			  const unsigned char *src, unsigned char *dst)
+{
+	__m128i in = _mm_loadu_si128((const void *)src);
+	__m128i values, out;
+	uint32_t last;
+
+	if (!base64_ssse3_dec_translate(in, chars, &values))
+		return FALSE;
+	out = base64_ssse3_dec_pack(values);
+	_mm_storel_epi64((void *)dst, out);
+	last = _mm_cvtsi128_si32(_mm_srli_si128(out, 8));
+	memcpy(dst + 8, &last, 4);
+	return TRUE;
+}
+
+static inline BASE64_TARGET_SSSE3 size_t
+base64_ssse3_decode_loop(const struct base64_simd_chars *chars,
+			 const unsigned char *src, size_t src_size,
+			 unsigned char *dst, size_t dst_size)
+{
+	size_t src_pos = 0, dst_pos = 0;
+
+	while (src_size - src_pos >= 16 && dst_size - dst_pos >= 12) {
+		if (!base64_ssse3_decode_block(chars, src + src_pos,
+					       dst + dst_pos))
+			break;
+		src_pos += 16;
+		dst_pos += 12;
+	}
+	return src_pos;
+}
+
+static BASE64_TARGET_SSSE3 size_t
+base64_ssse3_encode(const struct base64_simd_chars *chars,
+		    const unsigned char *src, size_t src_size,
+		    unsigned char *dst, size_t dst_size)
+{
+	return base64_ssse3_encode_loop(chars, src, src_size, dst, dst_size);
+}
+
+static BASE64_TARGET_SSSE3 size_t
+base64_ssse3_decode(const struct base64_simd_chars *chars,
+		    const unsigned char *src, size_t src_size,
+		    unsigned char *dst, size_t dst_size)
+{
+	return base64_ssse3_decode_loop(chars, src, src_size, dst, dst_size);
+}
+
+/*
+ * AVX2
+ */
+
+static inline BASE64_TARGET_AVX2 __m256i
+base64_avx2_enc_reshuffle(__m256i in)
+{
+	in = _mm256_shuffle_epi8(in, _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10));
+	__m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+	__m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+	__m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+	__m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+	return _mm256_or_si256(t1, t3);
+}
+
+static inline BASE64_TARGET_AVX2 __m256i
+base64_avx2_enc_translate(__m256i idx, const struct base64_simd_chars *chars)
+{
+	__m256i offset, eq;
+
+	offset = _mm256_set1_epi8('A');
+	offset = _mm256_add_epi8(offset, _mm256_and_si256(
+		_mm256_cmpgt_epi8(idx, _mm256_set1_epi8(25)),
+		_mm256_set1_epi8('a' - 26 - 'A')));
+	offset = _mm256_add_epi8(offset, _mm256_and_si256(
+		_mm256_cmpgt_epi8(idx, _mm256_set1_epi8(51)),
+		_mm256_set1_epi8('0' - 52 - ('a' - 26))));
+	eq = _mm256_cmpeq_epi8(idx, _mm256_set1_epi8(62));
+	offset = _mm256_blendv_epi8(offset,
+		_mm256_set1_epi8((char)(chars->c62 - 62)), eq);
+	eq = _mm256_cmpeq_epi8(idx, _mm256_set1_epi8(63));
+	offset = _mm256_blendv_epi8(offset,
+		_mm256_set1_epi8((char)(chars->c63 - 63)), eq);
+	return _mm256_add_epi8(idx, offset);
+}
+
+static inline BASE64_TARGET_AVX2 __m256i
+base64_avx2_range(__m256i in, char first, char last)
+{
+	return _mm256_and_si256(
+		_mm256_cmpgt_epi8(in, _mm256_set1_epi8(first - 1)),
+		_mm256_cmpgt_epi8(_mm256_set1_epi8(last + 1), in));
+}
+
+static inline BASE64_TARGET_AVX2 bool
+base64_avx2_dec_translate(__m256i in, const struct base64_simd_chars *chars,
+			  __m256i *values_r)
+{
+	__m256i upper, lower, digit, c62, c63, valid, offset;
+
+	upper = base64_avx2_range(in, 'A', 'Z');
+	lower = base64_avx2_range(in, 'a', 'z');
+	digit = base64_avx2_range(in, '0', '9');
+	c62 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8((char)chars->c62));
+	c63 = _mm256_cmpeq_epi8(in, _mm256_set1_epi8((char)chars->c63));
+
+	valid = _mm256_or_si256(_mm256_or_si256(upper, lower),
+				_mm256_or_si256(digit,
+						_mm256_or_si256(c62, c63)));
+	if ((uint32_t)_mm256_movemask_epi8(valid) != 0xffffffff)
+		return FALSE;
+
+	offset = _mm256_and_si256(upper, _mm256_set1_epi8(-'A'));
+	offset = _mm256_or_si256(offset, _mm256_and_si256(
+		lower, _mm256_set1_epi8(26 - 'a')));
+	offset = _mm256_or_si256(offset, _mm256_and_si256(
+		digit, _mm256_set1_epi8(52 - '0')));
+	offset = _mm256_or_si256(offset, _mm256_and_si256(
+		c62, _mm256_set1_epi8((char)(62 - chars->c62))));
+	offset = _mm256_or_si256(offset, _mm256_and_si256(
+		c63, _mm256_set1_epi8((char)(63 - chars->c63))));
+	*values_r = _mm256_add_epi8(in, offset);
+	return TRUE;
+}
+
+static BASE64_TARGET_AVX2 size_t
+base64_avx2_encode(const struct base64_simd_chars *chars,
+		   const unsigned char *src, size_t src_size,
+		   unsigned char *dst, size_t dst_size)
+{
+	size_t src_pos = 0, dst_pos = 0;
+
+	/* Each 128bit lane gets its own 12 input bytes, so 28 bytes are read
+	   and 24 are used. */
+	while (src_size - src_pos >= 28 && dst_size - dst_pos >= 32) {
+		__m128i lo = _mm_loadu_si128((const void *)(src + src_pos));
+		__m128i hi = _mm_loadu_si128((const void *)(src + src_pos + 12));
+		__m256i in = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(lo), hi, 1);
+		__m256i out = base64_avx2_enc_translate(
+			base64_avx2_enc_reshuffle(in), chars);
+		_mm256_storeu_si256((void *)(dst + dst_pos), out);
+		src_pos += 24;
+		dst_pos += 32;
+	}
+	/* The rest is inlined, so that it uses VEX encoded instructions
+	   without SSE/AVX transition penalties. */
+	return src_pos + base64_ssse3_encode_loop(chars, src + src_pos,
+						  src_size - src_pos,
+						  dst + dst_pos,
+						  dst_size - dst_pos);
+}
+
+static BASE64_TARGET_AVX2 size_t
+base64_avx2_decode(const struct base64_simd_chars *chars,
+		   const unsigned char *src, size_t src_size,
+		   unsigned char *dst, size_t dst_size)
+{
+	size_t src_pos = 0, dst_pos = 0;
+
+	while (src_size - src_pos >= 32 && dst_size - dst_pos >= 32) {
+		__m256i in = _mm256_loadu_si256((const void *)(src + src_pos));
+		__m256i values, merged, out;
+
+		if (!base64_avx2_dec_translate(in, chars, &values))
+			break;
+		merged = _mm256_maddubs_epi16(values,
+					      _mm256_set1_epi32(0x01400140));
+		merged = _mm256_madd_epi16(merged,
+					   _mm256_set1_epi32(0x00011000));
+		out = _mm256_shuffle_epi8(merged, _mm256_setr_epi8(
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+			2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+		/* move the 12 bytes from both lanes next to each other */
+		out = _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(
+			0, 1, 2, 4, 5, 6, 3, 7));
+		/* 32 bytes are written, but only 24 are used */
+		_mm256_storeu_si256((void *)(dst + dst_pos), out);
+		src_pos += 32;
+		dst_pos += 24;
+	}
+	/* the rest, or the 32 byte block which had invalid characters in one
+	   of its halves */
+	return src_pos + base64_ssse3_decode_loop(chars, src + src_pos,
+						  src_size - src_pos,
+						  dst + dst_pos,
+						  dst_size - dst_pos);
+}
+
+#endif
+
+static void base64_simd_init(void)
+{
+	base64_simd_initialized = TRUE;
+#ifdef BASE64_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		(void)base64_simd_set_impl(BASE64_SIMD_IMPL_AVX2);
+	else if (__builtin_cpu_supports("ssse3"))
+		(void)base64_simd_set_impl(BASE64_SIMD_IMPL_SSSE3);
+#endif
+}
+
+bool base64_simd_set_impl(enum base64_simd_impl impl)
+{
+	base64_simd_initialized = TRUE;
+	switch (impl) {
+	case BASE64_SIMD_IMPL_NONE:
+		base64_simd_encode_func = NULL;
+		base64_simd_decode_func = NULL;
+		return TRUE;
+	case BASE64_SIMD_IMPL_SSSE3:
+#ifdef BASE64_SIMD_X86
+		if (!__builtin_cpu_supports("ssse3"))
+			return FALSE;
+		base64_simd_encode_func = base64_ssse3_encode;
+		base64_simd_decode_func = base64_ssse3_decode;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	case BASE64_SIMD_IMPL_AVX2:
+#ifdef BASE64_SIMD_X86
+		if (!__builtin_cpu_supports("avx2"))
+			return FALSE;
+		base64_simd_encode_func = base64_avx2_encode;
+		base64_simd_decode_func = base64_avx2_decode;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	}
+	i_unreached();
+}
+
+size_t base64_simd_encode(const struct base64_simd_chars *chars,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dst, size_t dst_size)
+{
+	if (unlikely(!base64_simd_initialized))
+		base64_simd_init();
+	if (base64_simd_encode_func == NULL)
+		return 0;
+	return base64_simd_encode_func(chars, src, src_size, dst, dst_size);
+}
+
+size_t base64_simd_decode(const struct base64_simd_chars *chars,
+			  const unsigned char *src, size_t src_size,
+			  unsigned char *dst, size_t dst_size)
+{
+	if (unlikely(!base64_simd_initialized))
+		base64_simd_init();
+	if (base64_simd_decode_func == NULL)
+		return 0;
+	return base64_simd_decode_func(chars, src, src_size, dst, dst_size);
+}
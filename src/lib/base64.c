@@ -2,8 +2,29 @@
 
 #include "lib.h"
 #include "base64.h"
+#include "base64-private.h"
 #include "buffer.h"
 
+/* Don't reserve more than this much space from the decoding destination
+   buffer at a time for the SIMD code. */
+#define BASE64_SIMD_MAX_DECODE_INPUT 4096
+
+static bool
+base64_scheme_get_simd_chars(const struct base64_scheme *b64,
+			     struct base64_simd_chars *chars_r)
+{
+	if (b64 == &base64_scheme) {
+		chars_r->c62 = '+';
+		chars_r->c63 = '/';
+	} else if (b64 == &base64url_scheme) {
+		chars_r->c62 = '-';
+		chars_r->c63 = '_';
+	} else {
+		return FALSE;
+	}
+	return TRUE;
+}
+
 /*
  * Low-level Base64 encoder
  */
@@ -221,6 +242,7 @@ base64_encode_more_data(struct base64_encoder *enc,
 {
 	const struct base64_scheme *b64 = enc->b64;
 	const char *b64enc = b64->encmap;
+	struct base64_simd_chars chars;
 	size_t res_size;
 	unsigned char *start, *ptr, *end;
 	size_t src_pos;
@@ -307,6 +329,14 @@ base64_encode_more_data(struct base64_encoder *enc,
 	}
 
 	/* Convert the bulk */
+	if (src_size - src_pos >= BASE64_SIMD_MIN_INPUT &&
+	    base64_scheme_get_simd_chars(b64, &chars)) {
+		size_t simd_size = base64_simd_encode(&chars, src_c + src_pos,
+						      src_size - src_pos,
+						      ptr, end - ptr);
+		src_pos += simd_size;
+		ptr += simd_size / 3 * 4;
+	}
 	for (; src_size - src_pos > 2 && &ptr[3] < end;
 	     src_pos += 3, ptr += 4) {
 		ptr[0] = b64enc[src_c[src_pos] >> 2];
@@ -599,6 +629,24 @@ base64_skip_whitespace(struct base64_decoder *dec, const unsigned char *src_c,
 		(*src_pos)++;
 }
 
+static size_t
+base64_decode_more_simd(const struct base64_simd_chars *chars,
+			const unsigned char *src, size_t src_size,
+			buffer_t *dest, size_t *dst_avail)
+{
+	unsigned char *dst;
+	size_t dst_size, src_pos;
+
+	src_size = I_MIN(src_size, BASE64_SIMD_MAX_DECODE_INPUT);
+	dst_size = I_MIN(*dst_avail, src_size / 4 * 3);
+	dst = buffer_append_space_unsafe(dest, dst_size);
+	src_pos = base64_simd_decode(chars, src, src_size, dst, dst_size);
+	i_assert(src_pos / 4 * 3 <= dst_size);
+	buffer_set_used_size(dest, dest->used - dst_size + src_pos / 4 * 3);
+	*dst_avail -= src_pos / 4 * 3;
+	return src_pos;
+}
+
 int base64_decode_more(struct base64_decoder *dec,
 		       const void *src, size_t src_size, size_t *src_pos_r,
 		       buffer_t *dest)
@@ -611,7 +659,9 @@ int base64_decode_more(struct base64_decoder *dec,
 		dec->flags, BASE64_DECODE_FLAG_NO_WHITESPACE);
 	bool no_padding = HAS_ALL_BITS(
 		dec->flags, BASE64_DECODE_FLAG_NO_PADDING);
-	size_t src_pos, dst_avail;
+	struct base64_simd_chars chars;
+	size_t src_pos, dst_avail, simd_next_pos = 0;
+	bool simd;
 	int ret = 1;
 
 	i_assert(!dec->finished);
@@ -660,9 +710,28 @@ int base64_decode_more(struct base64_decoder *dec,
 		return 1;
 	}
 
+	simd = src_size >= BASE64_SIMD_MIN_INPUT &&
+		base64_scheme_get_simd_chars(b64, &chars);
 	for (; !dec->seen_padding && src_pos < src_size; src_pos++) {
-		unsigned char in = src_c[src_pos];
-		unsigned char dm = b64->decmap[in];
+		unsigned char in, dm;
+
+		if (simd && dec->sub_pos == 0 && src_pos >= simd_next_pos &&
+		    src_size - src_pos >= BASE64_SIMD_MIN_INPUT &&
+		    dst_avail >= 3) {
+			/* Decode the bulk of the input with SIMD, until it
+			   hits a block with whitespace or padding. That block
+			   is handled by the code below. */
+			src_pos += base64_decode_more_simd(&chars,
+							   src_c + src_pos,
+							   src_size - src_pos,
+							   dest, &dst_avail);
+			simd_next_pos = src_pos + BASE64_SIMD_MIN_INPUT;
+			if (src_pos == src_size)
+				break;
+		}
+
+		in = src_c[src_pos];
+		dm = b64->decmap[in];
 
 		if (dm == 0xff) {
 			if (no_whitespace) {
@@ -0,0 +1,91 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "crc32.h"
+
+#include <stdio.h>
+
+/**
+ * Measures the throughput of crc32_data() and crc32c_data() with the
+ * different implementations. Small buffers are included, since many of the
+ * callers hash short strings.
+ */
+
+#define BENCH_TOTAL_BYTES (256*1024*1024UL)
+
+static void bench_crc(const char *name, const unsigned char *data,
+		      size_t size, bool castagnoli)
+{
+	unsigned long i, rounds = BENCH_TOTAL_BYTES / size;
+	uint32_t crc = 0;
+	uint64_t ts_0, nsecs;
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < rounds; i++) {
+		if (castagnoli)
+			crc = crc32c_data(data, size);
+		else
+			crc = crc32_data(data, size);
+	}
+	nsecs = i_nanoseconds() - ts_0;
+	printf("\t%s %zu bytes: %0.0lf MB/s (%08x)\n", name, size,
+	       (double)(rounds * size) * 1000 / (double)nsecs, crc);
+}
+
+static void bench_impl(const char *name, enum crc32_impl impl,
+		       const unsigned char *data, const size_t *sizes,
+		       unsigned int sizes_count)
+{
+	unsigned int i;
+
+	if (!crc32_set_impl(impl)) {
+		printf("%s: not supported\n", name);
+		return;
+	}
+	printf("%s\n", name);
+	for (i = 0; i < sizes_count; i++)
+		bench_crc("crc32", data, sizes[i], FALSE);
+	for (i = 0; i < sizes_count; i++)
+		bench_crc("crc32c", data, sizes[i], TRUE);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [buffer_size]\n", prog);
+	fprintf(stderr, "Runs with 16, 64, 1024 and 65536 byte buffers if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	size_t sizes[] = { 16, 64, 1024, 65536 };
+	unsigned int sizes_count = N_ELEMENTS(sizes);
+	unsigned char *data;
+	unsigned long size;
+
+	lib_init();
+
+	if (argc == 2) {
+		if (str_to_ulong(argv[1], &size) < 0 || size == 0) {
+			fprintf(stderr, "Invalid parameters\n");
+			print_usage(argv[0]);
+		}
+		sizes[0] = size;
+		sizes_count = 1;
+	} else if (argc != 1) {
+		print_usage(argv[0]);
+	}
+
+	data = i_malloc(sizes[sizes_count - 1]);
+	random_fill(data, sizes[sizes_count - 1]);
+
+	bench_impl("table", CRC32_IMPL_TABLE, data, sizes, sizes_count);
+	bench_impl("hardware", CRC32_IMPL_HW, data, sizes, sizes_count);
+
+	i_free(data);
+	lib_deinit();
+	return 0;
+}
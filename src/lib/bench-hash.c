@@ -0,0 +1,139 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "hash.h"
+
+#include <stdio.h>
+
+/**
+ * Compares the chained and the flat hash tables. The keys are random
+ * integers used directly as the pointers. Each table size is run enough
+ * times to get at least BENCH_MIN_OPS operations, so the small tables aren't
+ * measuring just the timer overhead.
+ */
+
+#define BENCH_MIN_OPS 10000000UL
+
+/* Random numbers are generated beforehand, so they don't affect the
+   results. */
+static uintptr_t *keys, *missing_keys;
+
+static void bench_print(const char *op, uint64_t nsecs, unsigned long count)
+{
+	printf("\t%s: %0.02lf ns/op\n", op, (double)nsecs / (double)count);
+}
+
+static void bench_hash(const char *name, bool flat, unsigned long count)
+{
+	HASH_TABLE(void *, void *) hash;
+	uint64_t ts_insert = 0, ts_hit = 0, ts_miss = 0, ts_remove = 0, ts_0;
+	unsigned long i, round, rounds, found = 0;
+
+	rounds = (BENCH_MIN_OPS + count - 1) / count;
+	printf("%s\n", name);
+	for (round = 0; round < rounds; round++) {
+		if (flat)
+			hash_table_create_direct_flat(&hash, default_pool, 0);
+		else
+			hash_table_create_direct(&hash, default_pool, 0);
+
+		ts_0 = i_nanoseconds();
+		for (i = 0; i < count; i++) {
+			hash_table_insert(hash, POINTER_CAST(keys[i]),
+					  POINTER_CAST(keys[i]));
+		}
+		ts_insert += i_nanoseconds() - ts_0;
+
+		ts_0 = i_nanoseconds();
+		for (i = 0; i < count; i++) {
+			if (hash_table_lookup(hash, POINTER_CAST(keys[i])) != NULL)
+				found++;
+		}
+		ts_hit += i_nanoseconds() - ts_0;
+
+		ts_0 = i_nanoseconds();
+		for (i = 0; i < count; i++) {
+			if (hash_table_lookup(hash, POINTER_CAST(missing_keys[i])) != NULL)
+				found++;
+		}
+		ts_miss += i_nanoseconds() - ts_0;
+
+		ts_0 = i_nanoseconds();
+		for (i = 0; i < count; i++)
+			hash_table_remove(hash, POINTER_CAST(keys[i]));
+		ts_remove += i_nanoseconds() - ts_0;
+
+		hash_table_destroy(&hash);
+	}
+	i_assert(found == count * rounds);
+
+	bench_print("Insert", ts_insert, count * rounds);
+	bench_print("Lookup (found)", ts_hit, count * rounds);
+	bench_print("Lookup (missing)", ts_miss, count * rounds);
+	bench_print("Remove", ts_remove, count * rounds);
+}
+
+static void bench_size(unsigned long count)
+{
+	HASH_TABLE(void *, void *) unique;
+	unsigned long i;
+	uintptr_t key;
+
+	keys = i_new(uintptr_t, count);
+	missing_keys = i_new(uintptr_t, count);
+
+	/* Odd keys are inserted, even keys are looked up as missing. */
+	hash_table_create_direct_flat(&unique, default_pool, count);
+	for (i = 0; i < count; ) {
+		key = (((uintptr_t)i_rand() << 16) ^ i_rand()) | 1;
+		if (hash_table_lookup(unique, POINTER_CAST(key)) != NULL)
+			continue;
+		hash_table_insert(unique, POINTER_CAST(key), POINTER_CAST(key));
+		keys[i] = key;
+		missing_keys[i] = key + 1;
+		i++;
+	}
+	hash_table_destroy(&unique);
+
+	printf("%lu keys\n\n", count);
+	bench_hash("chained", FALSE, count);
+	bench_hash("flat", TRUE, count);
+	printf("\n");
+
+	i_free(keys);
+	i_free(missing_keys);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [key_count ...]\n", prog);
+	fprintf(stderr, "Runs with 1000, 100000 and 10000000 keys if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned long count;
+	int i;
+
+	lib_init();
+
+	if (argc == 1) {
+		bench_size(1000);
+		bench_size(100000);
+		bench_size(10000000);
+	}
+	for (i = 1; i < argc; i++) {
+		if (str_to_ulong(argv[i], &count) < 0 || count == 0) {
+			fprintf(stderr, "Invalid parameters\n");
+			print_usage(argv[0]);
+		}
+		bench_size(count);
+	}
+
+	lib_deinit();
+	return 0;
+}
@@ -0,0 +1,75 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "buffer.h"
+#include "base64.h"
+
+#define BENCH_BASE64_SIZE (64*1024)
+
+struct bench_base64_context {
+	unsigned char *data;
+	buffer_t *encoded, *encoded_lines, *dest;
+	size_t max_line_len;
+};
+
+static void bench_base64_encode(struct bench_base64_context *ctx,
+				unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		buffer_set_used_size(ctx->dest, 0);
+		base64_scheme_encode(&base64_scheme, BASE64_ENCODE_FLAG_CRLF,
+				     ctx->max_line_len, ctx->data,
+				     BENCH_BASE64_SIZE, ctx->dest);
+	}
+}
+
+static void bench_base64_decode(struct bench_base64_context *ctx,
+				unsigned int iterations)
+{
+	const buffer_t *src = ctx->max_line_len == 0 ?
+		ctx->encoded : ctx->encoded_lines;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		buffer_set_used_size(ctx->dest, 0);
+		if (base64_decode(src->data, src->used, ctx->dest) < 0)
+			i_unreached();
+	}
+}
+
+void bench_base64(void)
+{
+	struct bench_base64_context ctx;
+	unsigned int i;
+
+	i_zero(&ctx);
+	ctx.data = i_malloc(BENCH_BASE64_SIZE);
+	for (i = 0; i < BENCH_BASE64_SIZE; i++)
+		ctx.data[i] = i_rand_limit(256);
+	ctx.encoded = buffer_create_dynamic(default_pool,
+					    BENCH_BASE64_SIZE * 2);
+	base64_encode(ctx.data, BENCH_BASE64_SIZE, ctx.encoded);
+	ctx.encoded_lines = buffer_create_dynamic(default_pool,
+						  BENCH_BASE64_SIZE * 2);
+	base64_scheme_encode(&base64_scheme, BASE64_ENCODE_FLAG_CRLF, 76,
+			     ctx.data, BENCH_BASE64_SIZE, ctx.encoded_lines);
+	ctx.dest = buffer_create_dynamic(default_pool, BENCH_BASE64_SIZE * 2);
+
+	/* the throughput is counted from the binary size */
+	bench_run("base64/encode 64k", BENCH_BASE64_SIZE,
+		  bench_base64_encode, &ctx);
+	bench_run("base64/decode 64k", BENCH_BASE64_SIZE,
+		  bench_base64_decode, &ctx);
+	ctx.max_line_len = 76;
+	bench_run("base64/encode 64k 76 char lines", BENCH_BASE64_SIZE,
+		  bench_base64_encode, &ctx);
+	bench_run("base64/decode 64k 76 char lines", BENCH_BASE64_SIZE,
+		  bench_base64_decode, &ctx);
+
+	buffer_free(&ctx.encoded);
+	buffer_free(&ctx.encoded_lines);
+	buffer_free(&ctx.dest);
+	i_free(ctx.data);
+}
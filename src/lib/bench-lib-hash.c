@@ -0,0 +1,115 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "hash.h"
+
+#define BENCH_HASH_KEY_COUNT 10000
+
+struct bench_hash_context {
+	HASH_TABLE(char *, char *) hash;
+	char **keys, **missing_keys;
+	bool flat;
+};
+
+static void bench_hash_create(struct bench_hash_context *ctx)
+{
+	if (ctx->flat)
+		hash_table_create_flat(&ctx->hash, default_pool, 0,
+				       str_hash, strcmp);
+	else
+		hash_table_create(&ctx->hash, default_pool, 0, str_hash, strcmp);
+}
+
+static void bench_hash_insert(struct bench_hash_context *ctx,
+			      unsigned int iterations)
+{
+	unsigned int i, idx;
+
+	bench_hash_create(ctx);
+	for (i = 0; i < iterations; i++) {
+		idx = i % BENCH_HASH_KEY_COUNT;
+		if (idx == 0 && i > 0)
+			hash_table_clear(ctx->hash, FALSE);
+		hash_table_insert(ctx->hash, ctx->keys[idx], ctx->keys[idx]);
+	}
+	hash_table_destroy(&ctx->hash);
+}
+
+static void bench_hash_lookup(struct bench_hash_context *ctx,
+			      unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		bench_use(hash_table_lookup(ctx->hash,
+			ctx->keys[i % BENCH_HASH_KEY_COUNT]) != NULL);
+	}
+}
+
+static void bench_hash_lookup_missing(struct bench_hash_context *ctx,
+				      unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		bench_use(hash_table_lookup(ctx->hash,
+			ctx->missing_keys[i % BENCH_HASH_KEY_COUNT]) != NULL);
+	}
+}
+
+static void bench_hash_iterate(struct bench_hash_context *ctx,
+			       unsigned int iterations)
+{
+	struct hash_iterate_context *iter;
+	char *key, *value;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		iter = hash_table_iterate_init(ctx->hash);
+		while (hash_table_iterate(iter, ctx->hash, &key, &value))
+			bench_use(key[0]);
+		hash_table_iterate_deinit(&iter);
+	}
+}
+
+static void bench_hash_table_type(struct bench_hash_context *ctx,
+				  const char *type)
+{
+	unsigned int i;
+
+	bench_run(t_strdup_printf("hash/%s/insert", type), 0,
+		  bench_hash_insert, ctx);
+
+	bench_hash_create(ctx);
+	for (i = 0; i < BENCH_HASH_KEY_COUNT; i++)
+		hash_table_insert(ctx->hash, ctx->keys[i], ctx->keys[i]);
+	bench_run(t_strdup_printf("hash/%s/lookup", type), 0,
+		  bench_hash_lookup, ctx);
+	bench_run(t_strdup_printf("hash/%s/lookup missing", type), 0,
+		  bench_hash_lookup_missing, ctx);
+	bench_run(t_strdup_printf("hash/%s/iterate %u", type,
+				  BENCH_HASH_KEY_COUNT), 0,
+		  bench_hash_iterate, ctx);
+	hash_table_destroy(&ctx->hash);
+}
+
+void bench_hash_table(void)
+{
+	struct bench_hash_context ctx;
+	pool_t pool;
+	unsigned int i;
+
+	i_zero(&ctx);
+	pool = pool_alloconly_create("bench hash keys", 1024*512);
+	ctx.keys = p_new(pool, char *, BENCH_HASH_KEY_COUNT);
+	ctx.missing_keys = p_new(pool, char *, BENCH_HASH_KEY_COUNT);
+	for (i = 0; i < BENCH_HASH_KEY_COUNT; i++) {
+		ctx.keys[i] = p_strdup_printf(pool, "user%u@example.com", i);
+		ctx.missing_keys[i] = p_strdup_printf(pool, "nobody%u", i);
+	}
+
+	bench_hash_table_type(&ctx, "chained");
+	ctx.flat = TRUE;
+	bench_hash_table_type(&ctx, "flat");
+	pool_unref(&pool);
+}
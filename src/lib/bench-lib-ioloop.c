@@ -0,0 +1,89 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "ioloop.h"
+
+struct bench_ioloop_context {
+	struct ioloop *ioloop;
+	struct timeout **timeouts;
+	unsigned int timeout_count;
+	unsigned int fired, fire_count;
+};
+
+static void bench_timeout_callback(struct bench_ioloop_context *ctx)
+{
+	if (++ctx->fired == ctx->fire_count)
+		io_loop_stop(ctx->ioloop);
+}
+
+static void bench_timeout_add_remove(struct bench_ioloop_context *ctx,
+				     unsigned int iterations)
+{
+	struct timeout *to;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		to = timeout_add(60*1000 + i % 1000,
+				 bench_timeout_callback, ctx);
+		timeout_remove(&to);
+	}
+}
+
+static void bench_timeout_reset(struct bench_ioloop_context *ctx,
+				unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++)
+		timeout_reset(ctx->timeouts[i % ctx->timeout_count]);
+}
+
+static void bench_timeout_fire(struct bench_ioloop_context *ctx,
+			       unsigned int iterations)
+{
+	struct timeout **timeouts;
+	unsigned int i;
+
+	timeouts = i_new(struct timeout *, iterations);
+	ctx->fired = 0;
+	ctx->fire_count = iterations;
+	for (i = 0; i < iterations; i++) {
+		timeouts[i] = timeout_add_short(0, bench_timeout_callback,
+						ctx);
+	}
+	io_loop_run(ctx->ioloop);
+	for (i = 0; i < iterations; i++)
+		timeout_remove(&timeouts[i]);
+	i_free(timeouts);
+}
+
+void bench_ioloop_timeouts(void)
+{
+	static const unsigned int counts[] = { 100, 10000 };
+	struct bench_ioloop_context ctx;
+	unsigned int i, j;
+
+	i_zero(&ctx);
+	ctx.ioloop = io_loop_create();
+	bench_run("ioloop/timeout_add+timeout_remove", 0,
+		  bench_timeout_add_remove, &ctx);
+
+	/* idle timeouts of many connections being reset */
+	for (i = 0; i < N_ELEMENTS(counts); i++) {
+		ctx.timeout_count = counts[i];
+		ctx.timeouts = i_new(struct timeout *, ctx.timeout_count);
+		for (j = 0; j < ctx.timeout_count; j++) {
+			ctx.timeouts[j] = timeout_add(60*1000 + j,
+				bench_timeout_callback, &ctx);
+		}
+		bench_run(t_strdup_printf("ioloop/timeout_reset (%u timeouts)",
+					  ctx.timeout_count), 0,
+			  bench_timeout_reset, &ctx);
+		for (j = 0; j < ctx.timeout_count; j++)
+			timeout_remove(&ctx.timeouts[j]);
+		i_free(ctx.timeouts);
+	}
+
+	bench_run("ioloop/timeout fire", 0, bench_timeout_fire, &ctx);
+	io_loop_destroy(&ctx.ioloop);
+}
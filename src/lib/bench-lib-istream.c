@@ -0,0 +1,186 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "istream.h"
+#include "istream-crlf.h"
+#include "istream-concat.h"
+#include "istream-seekable.h"
+#include "istream-tee.h"
+
+#define BENCH_ISTREAM_SIZE (256*1024)
+#define BENCH_ISTREAM_CONCAT_COUNT 16
+#define BENCH_ISTREAM_SEEKABLE_MAX_BUFFER (1024*1024)
+
+struct bench_istream_context {
+	unsigned char *lf_data, *crlf_data;
+	size_t lf_size, crlf_size;
+};
+
+static size_t bench_istream_read_all(struct istream *input)
+{
+	const unsigned char *data;
+	size_t size, total = 0;
+
+	while (i_stream_read_more(input, &data, &size) > 0) {
+		total += size;
+		i_stream_skip(input, size);
+	}
+	i_assert(input->stream_errno == 0);
+	return total;
+}
+
+static void bench_istream_crlf(struct bench_istream_context *ctx,
+			       unsigned int iterations)
+{
+	struct istream *input, *crlf_input;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		input = i_stream_create_from_data(ctx->lf_data, ctx->lf_size);
+		crlf_input = i_stream_create_crlf(input);
+		bench_use(bench_istream_read_all(crlf_input));
+		i_stream_unref(&crlf_input);
+		i_stream_unref(&input);
+	}
+}
+
+static void bench_istream_lf(struct bench_istream_context *ctx,
+			     unsigned int iterations)
+{
+	struct istream *input, *lf_input;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		input = i_stream_create_from_data(ctx->crlf_data,
+						  ctx->crlf_size);
+		lf_input = i_stream_create_lf(input);
+		bench_use(bench_istream_read_all(lf_input));
+		i_stream_unref(&lf_input);
+		i_stream_unref(&input);
+	}
+}
+
+static void bench_istream_concat(struct bench_istream_context *ctx,
+				 unsigned int iterations)
+{
+	struct istream *inputs[BENCH_ISTREAM_CONCAT_COUNT + 1], *input;
+	size_t part_size = ctx->lf_size / BENCH_ISTREAM_CONCAT_COUNT;
+	unsigned int i, j;
+
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < BENCH_ISTREAM_CONCAT_COUNT; j++) {
+			inputs[j] = i_stream_create_from_data(
+				ctx->lf_data + j * part_size, part_size);
+		}
+		inputs[j] = NULL;
+		input = i_stream_create_concat(inputs);
+		for (j = 0; j < BENCH_ISTREAM_CONCAT_COUNT; j++)
+			i_stream_unref(&inputs[j]);
+		bench_use(bench_istream_read_all(input));
+		i_stream_unref(&input);
+	}
+}
+
+static int
+bench_istream_seekable_fd_callback(const char **path_r ATTR_UNUSED,
+				   void *context ATTR_UNUSED)
+{
+	/* the data always fits into memory */
+	i_unreached();
+}
+
+static void bench_istream_seekable(struct bench_istream_context *ctx,
+				   unsigned int iterations)
+{
+	struct istream *inputs[2], *input;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		/* a crlf stream isn't seekable, so it's read in smaller blocks
+		   and the seekable stream needs to buffer it */
+		input = i_stream_create_from_data(ctx->lf_data, ctx->lf_size);
+		inputs[0] = i_stream_create_crlf(input);
+		inputs[1] = NULL;
+		i_stream_unref(&input);
+		input = i_streams_merge(inputs,
+					BENCH_ISTREAM_SEEKABLE_MAX_BUFFER,
+					bench_istream_seekable_fd_callback,
+					NULL);
+		i_stream_unref(&inputs[0]);
+
+		bench_use(bench_istream_read_all(input));
+		i_stream_seek(input, 0);
+		bench_use(bench_istream_read_all(input));
+		i_stream_unref(&input);
+	}
+}
+
+static void bench_istream_tee_read_some(struct istream *input)
+{
+	const unsigned char *data;
+	size_t size;
+
+	if (i_stream_read_more(input, &data, &size) > 0)
+		i_stream_skip(input, size);
+	i_assert(input->stream_errno == 0);
+}
+
+static void bench_istream_tee(struct bench_istream_context *ctx,
+			      unsigned int iterations)
+{
+	struct istream *input, *crlf_input, *child1, *child2;
+	struct tee_istream *tee;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		input = i_stream_create_from_data(ctx->lf_data, ctx->lf_size);
+		crlf_input = i_stream_create_crlf(input);
+		tee = tee_i_stream_create(crlf_input);
+		child1 = tee_i_stream_create_child(tee);
+		child2 = tee_i_stream_create_child(tee);
+		i_stream_unref(&crlf_input);
+		i_stream_unref(&input);
+
+		while (!child1->eof || !child2->eof) {
+			bench_istream_tee_read_some(child1);
+			bench_istream_tee_read_some(child2);
+		}
+		i_stream_unref(&child1);
+		i_stream_unref(&child2);
+	}
+}
+
+void bench_istreams(void)
+{
+	struct bench_istream_context ctx;
+	unsigned int i, j, line_len;
+
+	i_zero(&ctx);
+	ctx.lf_data = i_malloc(BENCH_ISTREAM_SIZE);
+	ctx.crlf_data = i_malloc(BENCH_ISTREAM_SIZE * 2);
+	/* mail-like text with 0..78 character lines */
+	for (i = 0; i < BENCH_ISTREAM_SIZE - 80; ) {
+		line_len = i_rand_limit(79);
+		for (j = 0; j < line_len; j++) {
+			ctx.lf_data[i] = 'a' + i_rand_limit(26);
+			ctx.crlf_data[ctx.crlf_size++] = ctx.lf_data[i++];
+		}
+		ctx.lf_data[i++] = '\n';
+		ctx.crlf_data[ctx.crlf_size++] = '\r';
+		ctx.crlf_data[ctx.crlf_size++] = '\n';
+	}
+	ctx.lf_size = i;
+
+	bench_run("istream/crlf", ctx.lf_size, bench_istream_crlf, &ctx);
+	bench_run("istream/lf", ctx.crlf_size, bench_istream_lf, &ctx);
+	bench_run(t_strdup_printf("istream/concat %u",
+				  BENCH_ISTREAM_CONCAT_COUNT), ctx.lf_size,
+		  bench_istream_concat, &ctx);
+	bench_run("istream/seekable(crlf) read twice", ctx.lf_size * 2,
+		  bench_istream_seekable, &ctx);
+	bench_run("istream/tee(crlf) 2 children", ctx.lf_size,
+		  bench_istream_tee, &ctx);
+
+	i_free(ctx.lf_data);
+	i_free(ctx.crlf_data);
+}
@@ -0,0 +1,75 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "str.h"
+#include "istream.h"
+#include "json-parser.h"
+#include "json-parser-private.h"
+
+#define BENCH_JSON_DOC_COUNT 500
+
+struct bench_json_context {
+	string_t *json;
+};
+
+static void bench_json_parse(struct bench_json_context *ctx,
+			     unsigned int iterations)
+{
+	struct json_parser *parser;
+	struct istream *input;
+	enum json_type type;
+	const char *value, *error;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		input = i_stream_create_from_data(str_data(ctx->json),
+						  str_len(ctx->json));
+		parser = json_parser_init(input);
+		while (json_parse_next(parser, &type, &value) > 0)
+			bench_use(type);
+		if (json_parser_deinit(&parser, &error) < 0)
+			i_fatal("JSON parsing failed: %s", error);
+		i_stream_unref(&input);
+	}
+}
+
+static void bench_json_run(struct bench_json_context *ctx, const char *impl)
+{
+	bench_run(t_strdup_printf("json/json_parse_next %s", impl),
+		  str_len(ctx->json), bench_json_parse, ctx);
+}
+
+void bench_json_parser(void)
+{
+	struct bench_json_context ctx;
+	unsigned int i, j;
+
+	/* Solr-like result set: documents with a few short fields and a
+	   longer text field with an occasional escape */
+	i_zero(&ctx);
+	ctx.json = str_new(default_pool, 256*1024);
+	str_append(ctx.json, "{\"response\":{\"numFound\":500,\"docs\":[");
+	for (i = 0; i < BENCH_JSON_DOC_COUNT; i++) {
+		if (i > 0)
+			str_append_c(ctx.json, ',');
+		str_printfa(ctx.json, "{\"uid\":\"%u/c8a1b4d2e6f7a9b0\","
+			    "\"box\":\"INBOX\",\"score\":%u.25,\"body\":\"",
+			    i, i % 100);
+		for (j = 0; j < 400; j++) {
+			if (j % 97 == 96)
+				str_append(ctx.json, "\\n");
+			else
+				str_append_c(ctx.json, 'a' + (i + j) % 26);
+		}
+		str_append(ctx.json, "\"}");
+	}
+	str_append(ctx.json, "]}}");
+
+	if (json_scan_set_impl(JSON_SCAN_IMPL_SCALAR))
+		bench_json_run(&ctx, "scalar");
+	if (json_scan_set_impl(JSON_SCAN_IMPL_SSE2))
+		bench_json_run(&ctx, "SSE2");
+	if (json_scan_set_impl(JSON_SCAN_IMPL_AVX2))
+		bench_json_run(&ctx, "AVX2");
+	str_free(&ctx.json);
+}
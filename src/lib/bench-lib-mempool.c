@@ -0,0 +1,134 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+
+/* How many allocations are done before the pool/frame is cleared */
+#define BENCH_ALLOC_BATCH 1024
+
+struct bench_mempool_context {
+	pool_t pool;
+	size_t size;
+};
+
+static void bench_alloconly_malloc(struct bench_mempool_context *ctx,
+				   unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		if (i % BENCH_ALLOC_BATCH == 0)
+			p_clear(ctx->pool);
+		bench_use_ptr(p_malloc(ctx->pool, ctx->size));
+	}
+}
+
+static void bench_alloconly_create(struct bench_mempool_context *ctx,
+				   unsigned int iterations)
+{
+	pool_t pool;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		pool = pool_alloconly_create("bench", ctx->size);
+		bench_use_ptr(p_malloc(pool, 16));
+		pool_unref(&pool);
+	}
+}
+
+static void bench_system_malloc(struct bench_mempool_context *ctx,
+				unsigned int iterations)
+{
+	unsigned int i;
+	void *mem;
+
+	for (i = 0; i < iterations; i++) {
+		mem = p_malloc(default_pool, ctx->size);
+		bench_use_ptr(mem);
+		p_free(default_pool, mem);
+	}
+}
+
+static void bench_slab_malloc(struct bench_mempool_context *ctx,
+			      unsigned int iterations)
+{
+	unsigned int i;
+	void *mem;
+
+	for (i = 0; i < iterations; i++) {
+		mem = p_malloc(ctx->pool, ctx->size);
+		bench_use_ptr(mem);
+		p_free(ctx->pool, mem);
+	}
+}
+
+static void bench_t_malloc(struct bench_mempool_context *ctx,
+			   unsigned int iterations)
+{
+	unsigned int i = 0, j;
+
+	while (i < iterations) T_BEGIN {
+		for (j = 0; j < BENCH_ALLOC_BATCH && i < iterations; j++, i++)
+			bench_use_ptr(t_malloc_no0(ctx->size));
+	} T_END;
+}
+
+static void bench_t_malloc0(struct bench_mempool_context *ctx,
+			    unsigned int iterations)
+{
+	unsigned int i = 0, j;
+
+	while (i < iterations) T_BEGIN {
+		for (j = 0; j < BENCH_ALLOC_BATCH && i < iterations; j++, i++)
+			bench_use_ptr(t_malloc0(ctx->size));
+	} T_END;
+}
+
+static void bench_t_frame(struct bench_mempool_context *ctx ATTR_UNUSED,
+			  unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) T_BEGIN {
+		bench_use_ptr(t_malloc_no0(16));
+	} T_END;
+}
+
+void bench_mempool(void)
+{
+	static const size_t sizes[] = { 16, 256, 4096 };
+	struct bench_mempool_context ctx;
+	unsigned int i;
+
+	i_zero(&ctx);
+	ctx.pool = pool_alloconly_create("bench alloconly", 1024*16);
+	for (i = 0; i < N_ELEMENTS(sizes); i++) {
+		ctx.size = sizes[i];
+		bench_run(t_strdup_printf("mempool/alloconly/p_malloc %zu",
+					  sizes[i]), 0,
+			  bench_alloconly_malloc, &ctx);
+		bench_run(t_strdup_printf("mempool/system/p_malloc+p_free %zu",
+					  sizes[i]), 0,
+			  bench_system_malloc, &ctx);
+		bench_run(t_strdup_printf("data-stack/t_malloc_no0 %zu",
+					  sizes[i]), 0,
+			  bench_t_malloc, &ctx);
+		bench_run(t_strdup_printf("data-stack/t_malloc0 %zu",
+					  sizes[i]), 0,
+			  bench_t_malloc0, &ctx);
+	}
+	pool_unref(&ctx.pool);
+
+	ctx.pool = pool_slab_create("bench slab");
+	for (i = 0; i < N_ELEMENTS(sizes); i++) {
+		ctx.size = sizes[i];
+		bench_run(t_strdup_printf("mempool/slab/p_malloc+p_free %zu",
+					  sizes[i]), 0,
+			  bench_slab_malloc, &ctx);
+	}
+	pool_unref(&ctx.pool);
+
+	ctx.size = 1024;
+	bench_run("mempool/alloconly/create+unref", 0,
+		  bench_alloconly_create, &ctx);
+	bench_run("data-stack/T_BEGIN+T_END", 0, bench_t_frame, &ctx);
+}
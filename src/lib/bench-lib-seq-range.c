@@ -0,0 +1,92 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "array.h"
+#include "seq-bitmap.h"
+
+/* Number of UIDs inserted in one iteration */
+#define BENCH_UID_COUNT 20000
+
+struct bench_seq_range_context {
+	uint32_t uids[BENCH_UID_COUNT];
+};
+
+static void bench_seq_range_array_add(struct bench_seq_range_context *ctx,
+				      unsigned int iterations)
+{
+	ARRAY_TYPE(seq_range) range;
+	unsigned int i, j;
+
+	i_array_init(&range, 128);
+	for (i = 0; i < iterations; i++) {
+		array_clear(&range);
+		for (j = 0; j < BENCH_UID_COUNT; j++)
+			seq_range_array_add(&range, ctx->uids[j]);
+		bench_use(array_count(&range));
+	}
+	array_free(&range);
+}
+
+static void bench_seq_bitmap_add(struct bench_seq_range_context *ctx,
+				 unsigned int iterations)
+{
+	struct seq_bitmap *bitmap = seq_bitmap_create();
+	unsigned int i, j;
+
+	for (i = 0; i < iterations; i++) {
+		seq_bitmap_clear(bitmap);
+		for (j = 0; j < BENCH_UID_COUNT; j++)
+			(void)seq_bitmap_add(bitmap, ctx->uids[j]);
+		bench_use(seq_bitmap_count(bitmap));
+	}
+	seq_bitmap_free(&bitmap);
+}
+
+static void
+bench_seq_bitmap_to_seq_range(struct bench_seq_range_context *ctx,
+			      unsigned int iterations)
+{
+	struct seq_bitmap *bitmap = seq_bitmap_create();
+	ARRAY_TYPE(seq_range) range;
+	unsigned int i, j;
+
+	i_array_init(&range, 128);
+	for (i = 0; i < iterations; i++) {
+		seq_bitmap_clear(bitmap);
+		array_clear(&range);
+		for (j = 0; j < BENCH_UID_COUNT; j++)
+			(void)seq_bitmap_add(bitmap, ctx->uids[j]);
+		seq_bitmap_to_seq_range(bitmap, &range);
+		bench_use(array_count(&range));
+	}
+	array_free(&range);
+	seq_bitmap_free(&bitmap);
+}
+
+void bench_seq_range(void)
+{
+	static const uint32_t uid_spaces[] = {
+		BENCH_UID_COUNT * 2, BENCH_UID_COUNT * 50
+	};
+	struct bench_seq_range_context *ctx;
+	unsigned int i, j;
+
+	ctx = i_new(struct bench_seq_range_context, 1);
+	for (i = 0; i < N_ELEMENTS(uid_spaces); i++) {
+		/* UIDs in random order, e.g. search results sorted by
+		   relevancy */
+		for (j = 0; j < BENCH_UID_COUNT; j++)
+			ctx->uids[j] = i_rand_minmax(1, uid_spaces[i]);
+
+		bench_run(t_strdup_printf("seq-range/random add %u/%u",
+					  BENCH_UID_COUNT, uid_spaces[i]), 0,
+			  bench_seq_range_array_add, ctx);
+		bench_run(t_strdup_printf("seq-bitmap/random add %u/%u",
+					  BENCH_UID_COUNT, uid_spaces[i]), 0,
+			  bench_seq_bitmap_add, ctx);
+		bench_run(t_strdup_printf("seq-bitmap/random add+to_seq_range %u/%u",
+					  BENCH_UID_COUNT, uid_spaces[i]), 0,
+			  bench_seq_bitmap_to_seq_range, ctx);
+	}
+	i_free(ctx);
+}
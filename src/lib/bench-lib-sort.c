@@ -0,0 +1,76 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "sort.h"
+
+struct bench_sort_context {
+	const struct sort_radix_u64_node *input;
+	struct sort_radix_u64_node *nodes;
+	unsigned int count;
+};
+
+static int
+bench_sort_node_cmp(const struct sort_radix_u64_node *n1,
+		    const struct sort_radix_u64_node *n2)
+{
+	if (n1->key < n2->key)
+		return -1;
+	if (n1->key > n2->key)
+		return 1;
+	return uint32_cmp(&n1->value, &n2->value);
+}
+
+static void bench_sort_qsort(struct bench_sort_context *ctx,
+			     unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		memcpy(ctx->nodes, ctx->input, sizeof(ctx->nodes[0]) * ctx->count);
+		i_qsort(ctx->nodes, ctx->count, sizeof(ctx->nodes[0]),
+			bench_sort_node_cmp);
+		bench_use(ctx->nodes[0].value);
+	}
+}
+
+static void bench_sort_radix_u64(struct bench_sort_context *ctx,
+				 unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		memcpy(ctx->nodes, ctx->input, sizeof(ctx->nodes[0]) * ctx->count);
+		sort_radix_u64(ctx->nodes, ctx->count);
+		bench_use(ctx->nodes[0].value);
+	}
+}
+
+void bench_sort(void)
+{
+	static const unsigned int counts[] = { 100000, 1000000 };
+	struct sort_radix_u64_node *input;
+	struct bench_sort_context ctx;
+	unsigned int i, j;
+
+	for (i = 0; i < N_ELEMENTS(counts); i++) {
+		i_zero(&ctx);
+		ctx.count = counts[i];
+		input = i_new(struct sort_radix_u64_node, ctx.count);
+		ctx.nodes = i_new(struct sort_radix_u64_node, ctx.count);
+		/* mostly ascending dates, like the Date headers of the mails
+		   in a mailbox */
+		for (j = 0; j < ctx.count; j++) {
+			input[j].key = 1500000000 + j * 60 +
+				i_rand_minmax(0, 3600);
+			input[j].value = j + 1;
+		}
+		ctx.input = input;
+
+		bench_run(t_strdup_printf("sort qsort %u", ctx.count), 0,
+			  bench_sort_qsort, &ctx);
+		bench_run(t_strdup_printf("sort radix u64 %u", ctx.count), 0,
+			  bench_sort_radix_u64, &ctx);
+		i_free(input);
+		i_free(ctx.nodes);
+	}
+}
@@ -0,0 +1,230 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "str.h"
+#include "str-find.h"
+#include "str-find-multi.h"
+#include "unichar.h"
+#include "unichar-private.h"
+
+#define BENCH_STR_TEXT_SIZE (64*1024)
+
+struct bench_str_context {
+	string_t *str;
+	unsigned char *text;
+
+	unsigned char *utf8_text;
+
+	struct str_find_context *find;
+	struct str_find_multi_context *find_multi;
+};
+
+static void bench_str_append_c(struct bench_str_context *ctx,
+			       unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		if (i % 4096 == 0)
+			str_truncate(ctx->str, 0);
+		str_append_c(ctx->str, 'x');
+	}
+}
+
+static void bench_str_append(struct bench_str_context *ctx,
+			     unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		if (i % 128 == 0)
+			str_truncate(ctx->str, 0);
+		str_append(ctx->str, "0123456789abcdef0123456789abcdef");
+	}
+}
+
+static void bench_str_printfa(struct bench_str_context *ctx,
+			      unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		if (i % 128 == 0)
+			str_truncate(ctx->str, 0);
+		str_printfa(ctx->str, "%u %s", i, "user@example.com");
+	}
+}
+
+static void bench_t_strsplit(struct bench_str_context *ctx ATTR_UNUSED,
+			     unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) T_BEGIN {
+		bench_use_ptr(t_strsplit("a\tbb\tccc\tdddd\t1\t2\t3\t4\t5\t6", "\t"));
+	} T_END;
+}
+
+static void bench_t_str_lcase(struct bench_str_context *ctx ATTR_UNUSED,
+			      unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) T_BEGIN {
+		bench_use_ptr(t_str_lcase("Message-ID: <FOO.BAR@Example.COM>"));
+	} T_END;
+}
+
+static void bench_memchr2(struct bench_str_context *ctx,
+			  unsigned int iterations)
+{
+	const unsigned char *p, *end = ctx->text + BENCH_STR_TEXT_SIZE;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		for (p = ctx->text; p < end; p++) {
+			p = i_memchr2(p, '\r', '\n', end - p);
+			if (p == NULL)
+				break;
+			bench_use(*p);
+		}
+	}
+}
+
+static void bench_str_find(struct bench_str_context *ctx,
+			   unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		str_find_reset(ctx->find);
+		bench_use(str_find_more(ctx->find, ctx->text,
+					BENCH_STR_TEXT_SIZE));
+	}
+}
+
+static void bench_str_find_multi(struct bench_str_context *ctx,
+				 unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		str_find_multi_reset_found(ctx->find_multi);
+		bench_use(str_find_multi_more(ctx->find_multi, ctx->text,
+					      BENCH_STR_TEXT_SIZE));
+	}
+}
+
+static void bench_utf8_is_valid(const unsigned char *text,
+				unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++)
+		bench_use(uni_utf8_data_is_valid(text, BENCH_STR_TEXT_SIZE));
+}
+
+static void bench_utf8_is_valid_ascii(struct bench_str_context *ctx,
+				      unsigned int iterations)
+{
+	bench_utf8_is_valid(ctx->text, iterations);
+}
+
+static void bench_utf8_is_valid_mixed(struct bench_str_context *ctx,
+				      unsigned int iterations)
+{
+	bench_utf8_is_valid(ctx->utf8_text, iterations);
+}
+
+static void bench_utf8_strlen_n(struct bench_str_context *ctx,
+				unsigned int iterations)
+{
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++)
+		bench_use(uni_utf8_strlen_n(ctx->text, BENCH_STR_TEXT_SIZE));
+}
+
+static void bench_unichar(struct bench_str_context *ctx, const char *impl)
+{
+	bench_run(t_strdup_printf("unichar/uni_utf8_data_is_valid 64k ascii %s",
+				  impl), BENCH_STR_TEXT_SIZE,
+		  bench_utf8_is_valid_ascii, ctx);
+	bench_run(t_strdup_printf("unichar/uni_utf8_data_is_valid 64k mixed %s",
+				  impl), BENCH_STR_TEXT_SIZE,
+		  bench_utf8_is_valid_mixed, ctx);
+}
+
+void bench_str(void)
+{
+	static const char *const keys[] = {
+		"invoice", "meeting agenda", "password", "unsubscribe"
+	};
+	struct bench_str_context ctx;
+	buffer_t *buf;
+	unsigned int i;
+
+	i_zero(&ctx);
+	ctx.str = str_new(default_pool, 8192);
+	bench_run("str/str_append_c", 0, bench_str_append_c, &ctx);
+	bench_run("str/str_append 32", 32, bench_str_append, &ctx);
+	bench_run("str/str_printfa", 0, bench_str_printfa, &ctx);
+	bench_run("strfuncs/t_strsplit 10", 0, bench_t_strsplit, &ctx);
+	bench_run("strfuncs/t_str_lcase", 0, bench_t_str_lcase, &ctx);
+
+	/* text with lines of 0..99 characters */
+	ctx.text = i_malloc(BENCH_STR_TEXT_SIZE);
+	for (i = 0; i < BENCH_STR_TEXT_SIZE; i++)
+		ctx.text[i] = 'a' + i_rand_limit(26);
+	for (i = 0; i < BENCH_STR_TEXT_SIZE; i += 2 + i_rand_limit(100))
+		ctx.text[i] = '\n';
+	bench_run("strfuncs/i_memchr2 64k", BENCH_STR_TEXT_SIZE,
+		  bench_memchr2, &ctx);
+
+	/* text with about 1/3 ASCII and 2/3 2..4 byte characters */
+	buf = buffer_create_dynamic(default_pool, BENCH_STR_TEXT_SIZE + 4);
+	while (buf->used < BENCH_STR_TEXT_SIZE) {
+		switch (i_rand_limit(3)) {
+		case 0:
+			buffer_append_c(buf, 'a' + i_rand_limit(26));
+			break;
+		case 1:
+			uni_ucs4_to_utf8_c(0xc0 + i_rand_limit(0x100), buf);
+			break;
+		default:
+			uni_ucs4_to_utf8_c(i_rand_limit(2) == 0 ?
+					   0x4e00 + i_rand_limit(0x5000) :
+					   0x1f600 + i_rand_limit(0x50), buf);
+			break;
+		}
+	}
+	buffer_set_used_size(buf, uni_utf8_data_truncate(
+		buf->data, buf->used, BENCH_STR_TEXT_SIZE));
+	while (buf->used < BENCH_STR_TEXT_SIZE)
+		buffer_append_c(buf, 'a');
+	ctx.utf8_text = buffer_free_without_data(&buf);
+
+	(void)uni_utf8_simd_set_impl(UNI_UTF8_SIMD_IMPL_NONE);
+	bench_unichar(&ctx, "scalar");
+	if (uni_utf8_simd_set_impl(UNI_UTF8_SIMD_IMPL_SSSE3))
+		bench_unichar(&ctx, "SSSE3");
+	if (uni_utf8_simd_set_impl(UNI_UTF8_SIMD_IMPL_AVX2))
+		bench_unichar(&ctx, "AVX2");
+	bench_run("unichar/uni_utf8_strlen_n 64k ascii", BENCH_STR_TEXT_SIZE,
+		  bench_utf8_strlen_n, &ctx);
+
+	ctx.find = str_find_init(default_pool, keys[0]);
+	bench_run("str-find/str_find_more 64k", BENCH_STR_TEXT_SIZE,
+		  bench_str_find, &ctx);
+	str_find_deinit(&ctx.find);
+	ctx.find_multi = str_find_multi_init(default_pool, keys,
+					     N_ELEMENTS(keys));
+	bench_run(t_strdup_printf("str-find/str_find_multi_more 64k %u keys",
+				  (unsigned int)N_ELEMENTS(keys)),
+		  BENCH_STR_TEXT_SIZE, bench_str_find_multi, &ctx);
+	str_find_multi_deinit(&ctx.find_multi);
+
+	i_free(ctx.utf8_text);
+	i_free(ctx.text);
+	str_free(&ctx.str);
+}
@@ -0,0 +1,101 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "bench-lib.h"
+#include "str.h"
+
+/* Number of lines in the generated dovecot-uidlist */
+#define BENCH_UIDLIST_LINES 1000000
+/* Number of separate numbers parsed in one iteration */
+#define BENCH_NUMBER_COUNT 10000
+
+struct bench_strnum_context {
+	string_t *uidlist;
+	const char *numbers[BENCH_NUMBER_COUNT];
+};
+
+static void bench_strnum_uidlist(struct bench_strnum_context *ctx,
+				 unsigned int iterations)
+{
+	const char *data = str_c(ctx->uidlist), *p;
+	uint32_t uid, prev_uid;
+	unsigned int i;
+
+	for (i = 0; i < iterations; i++) {
+		prev_uid = 0;
+		for (p = data; *p != '\0'; p++) {
+			/* parse the UID the same way as maildir-uidlist */
+			if (str_parse_uint32(p, &uid, &p) < 0 ||
+			    *p != ' ' || uid <= prev_uid)
+				i_unreached();
+			prev_uid = uid;
+			p = strchr(p, '\n');
+		}
+		bench_use(prev_uid);
+	}
+}
+
+static void bench_strnum_to_uint32(struct bench_strnum_context *ctx,
+				   unsigned int iterations)
+{
+	uint32_t num, sum = 0;
+	unsigned int i, j;
+
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < BENCH_NUMBER_COUNT; j++) {
+			if (str_to_uint32(ctx->numbers[j], &num) < 0)
+				i_unreached();
+			sum += num;
+		}
+	}
+	bench_use(sum);
+}
+
+static void bench_strnum_to_uint64(struct bench_strnum_context *ctx,
+				   unsigned int iterations)
+{
+	uint64_t num, sum = 0;
+	unsigned int i, j;
+
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < BENCH_NUMBER_COUNT; j++) {
+			if (str_to_uint64(ctx->numbers[j], &num) < 0)
+				i_unreached();
+			sum += num;
+		}
+	}
+	bench_use(sum);
+}
+
+void bench_strnum(void)
+{
+	struct bench_strnum_context ctx;
+	uint32_t uid = 0;
+	unsigned int i;
+
+	i_zero(&ctx);
+	/* UIDs with small gaps, like expunged mails cause */
+	ctx.uidlist = str_new(default_pool, BENCH_UIDLIST_LINES * 64);
+	for (i = 0; i < BENCH_UIDLIST_LINES; i++) {
+		uid += i_rand_minmax(1, 3);
+		str_printfa(ctx.uidlist,
+			    "%u W%u :%u.M%uP%u.host,S=%u:2,S\n", uid,
+			    i_rand_minmax(1000, 100000), 1700000000 + i,
+			    i_rand_limit(1000000), i_rand_limit(100000),
+			    i_rand_minmax(1000, 100000));
+	}
+	bench_run(t_strdup_printf("strnum/uidlist %u lines",
+				  BENCH_UIDLIST_LINES),
+		  str_len(ctx.uidlist), bench_strnum_uidlist, &ctx);
+
+	/* numbers of random length, 1..10 digits */
+	for (i = 0; i < BENCH_NUMBER_COUNT; i++) {
+		ctx.numbers[i] = t_strdup_printf("%u",
+			i_rand_limit(10) == 0 ? i_rand() :
+			i_rand_limit(1U << i_rand_limit(32)));
+	}
+	bench_run("strnum/str_to_uint32 1..10 digits", 0,
+		  bench_strnum_to_uint32, &ctx);
+	bench_run("strnum/str_to_uint64 1..10 digits", 0,
+		  bench_strnum_to_uint64, &ctx);
+	str_free(&ctx.uidlist);
+}
@@ -0,0 +1,23 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "bench-lib.h"
+
+/**
+ * Micro-benchmarks for the basic lib primitives. Each benchmark reports
+ * nanoseconds per operation (and bytes/s when it makes sense) for the
+ * fastest and the median of the repeated runs. With --json the results are
+ * written as a JSON array, which can be compared between builds to catch
+ * regressions.
+ */
+
+int main(int argc, const char *argv[])
+{
+	static void (*const bench_functions[])(void) = {
+#define BENCH(x) x,
+#include "bench-lib.inc"
+#undef BENCH
+		NULL
+	};
+	return bench_main(argc, argv, bench_functions);
+}
@@ -0,0 +1,11 @@
+#ifndef BENCH_LIB_H
+#define BENCH_LIB_H
+
+#include "lib.h"
+#include "bench-common.h"
+
+#define BENCH(x) void x(void);
+#include "bench-lib.inc"
+#undef BENCH
+
+#endif
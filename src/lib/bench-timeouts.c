@@ -0,0 +1,157 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "randgen.h"
+#include "time-util.h"
+#include "strnum.h"
+#include "priorityq.h"
+#include "timer-wheel.h"
+
+#include <stdio.h>
+
+/**
+ * Compares priorityq and timer wheel with a workload resembling idle
+ * timeouts of many clients: all timers are added, then they are constantly
+ * reset to a later time, and finally all of them are expired by moving the
+ * time forwards.
+ */
+
+struct bench_timer {
+	struct priorityq_item pq_item;
+	struct timer_wheel_item wheel_item;
+	uint64_t expire;
+};
+
+/* Random numbers are generated beforehand, so they don't affect the
+   results. */
+static uint32_t *initial_expires, *reset_indexes;
+
+static int bench_timer_cmp(const void *p1, const void *p2)
+{
+	const struct bench_timer *t1 = p1, *t2 = p2;
+
+	return t1->expire < t2->expire ? -1 :
+		(t1->expire > t2->expire ? 1 : 0);
+}
+
+static void bench_print(const char *op, uint64_t nsecs, unsigned long count)
+{
+	printf("\t%s: %0.02lf ns/op\n", op, (double)nsecs / (double)count);
+}
+
+static void bench_priorityq(struct bench_timer *timers, unsigned long count,
+			    unsigned long reset_count)
+{
+	struct priorityq *pq;
+	struct priorityq_item *item;
+	uint64_t ts_0, now = 0;
+	unsigned long i, idx;
+
+	printf("priorityq\n");
+	pq = priorityq_init(bench_timer_cmp, count);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		timers[i].expire = now + initial_expires[i];
+		priorityq_add(pq, &timers[i].pq_item);
+	}
+	bench_print("Add", i_nanoseconds() - ts_0, count);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < reset_count; i++) {
+		idx = reset_indexes[i];
+		now = i / (reset_count / 60000 + 1);
+		priorityq_remove(pq, &timers[idx].pq_item);
+		timers[idx].expire = now + 60000;
+		priorityq_add(pq, &timers[idx].pq_item);
+	}
+	bench_print("Reset", i_nanoseconds() - ts_0, reset_count);
+
+	ts_0 = i_nanoseconds();
+	while ((item = priorityq_pop(pq)) != NULL) ;
+	bench_print("Expire", i_nanoseconds() - ts_0, count);
+	priorityq_deinit(&pq);
+}
+
+static void bench_timer_wheel(struct bench_timer *timers, unsigned long count,
+			      unsigned long reset_count)
+{
+	struct timer_wheel *wheel;
+	uint64_t ts_0, now = 0;
+	unsigned long i, idx, popped = 0;
+
+	printf("timer wheel\n");
+	wheel = timer_wheel_init(now);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < count; i++) {
+		timer_wheel_item_init(&timers[i].wheel_item);
+		timers[i].expire = now + initial_expires[i];
+		timer_wheel_add(wheel, &timers[i].wheel_item, timers[i].expire);
+	}
+	bench_print("Add", i_nanoseconds() - ts_0, count);
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < reset_count; i++) {
+		idx = reset_indexes[i];
+		now = i / (reset_count / 60000 + 1);
+		timer_wheel_remove(wheel, &timers[idx].wheel_item);
+		timers[idx].expire = now + 60000;
+		timer_wheel_add(wheel, &timers[idx].wheel_item,
+				timers[idx].expire);
+	}
+	bench_print("Reset", i_nanoseconds() - ts_0, reset_count);
+
+	ts_0 = i_nanoseconds();
+	for (now = 0; popped < count; now++) {
+		while (timer_wheel_pop_expired(wheel, now) != NULL)
+			popped++;
+	}
+	bench_print("Expire", i_nanoseconds() - ts_0, count);
+	timer_wheel_deinit(&wheel);
+}
+
+static void print_usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [timer_count reset_count]\n", prog);
+	fprintf(stderr, "Runs with 100000 timers and 1000000 resets if nothing given\n");
+	lib_exit(1);
+}
+
+int main(int argc, const char *argv[])
+{
+	unsigned long count = 100000UL;
+	unsigned long reset_count = 1000000UL;
+	struct bench_timer *timers;
+
+	lib_init();
+
+	if (argc == 3) {
+		if (str_to_ulong(argv[1], &count) < 0 ||
+		    str_to_ulong(argv[2], &reset_count) < 0 || count == 0) {
+			fprintf(stderr, "Invalid parameters\n");
+			print_usage(argv[0]);
+		}
+	} else if (argc != 1) {
+		print_usage(argv[0]);
+	}
+
+	printf("%lu timers, %lu resets\n\n", count, reset_count);
+	timers = i_new(struct bench_timer, count);
+	initial_expires = i_new(uint32_t, count);
+	reset_indexes = i_new(uint32_t, reset_count);
+	for (unsigned long i = 0; i < count; i++)
+		initial_expires[i] = 1000 + i_rand_limit(60000);
+	for (unsigned long i = 0; i < reset_count; i++)
+		reset_indexes[i] = i_rand_limit(count);
+
+	bench_priorityq(timers, count, reset_count);
+	bench_timer_wheel(timers, count, reset_count);
+
+	i_free(timers);
+	i_free(initial_expires);
+	i_free(reset_indexes);
+
+	lib_deinit();
+	return 0;
+}
@@ -45,6 +45,7 @@ static int connection_input_parse_lines(struct connection *conn)
 	const char *line;
 	struct istream *input;
 	struct ostream *output;
+	bool first_line = TRUE;
 	int ret = 0;
 
 	input = conn->input;
@@ -55,6 +56,13 @@ static int connection_input_parse_lines(struct connection *conn)
 		o_stream_cork(output);
 	}
 	while (!input->closed && (line = i_stream_next_line(input)) != NULL) {
+		/* the handler may destroy the connection, so update the
+		   stats before calling it */
+		conn->list->stats.input_lines++;
+		if (first_line) {
+			conn->list->stats.input_batches++;
+			first_line = FALSE;
+		}
 		T_BEGIN {
 			if (!conn->handshake_received &&
 			    conn->v.handshake_line != NULL) {
@@ -80,7 +88,11 @@ static int connection_input_parse_lines(struct connection *conn)
 		}
 	}
 	if (output != NULL) {
-		o_stream_uncork(output);
+		/* if the input handler started batching the output, it gets
+		   flushed later on together with the rest of the batch */
+		if (input->closed || conn->to_output_batch == NULL ||
+		    conn->output != output)
+			o_stream_uncork(output);
 		o_stream_unref(&output);
 	}
 	if (ret < 0 && !input->closed) {
@@ -96,6 +108,39 @@ static int connection_input_parse_lines(struct connection *conn)
 	return ret;
 }
 
+static void connection_output_batch_timeout(struct connection *conn)
+{
+	connection_output_batch_flush(conn);
+}
+
+void connection_output_batch(struct connection *conn)
+{
+	if (conn->output == NULL)
+		return;
+
+	conn->list->stats.output_batch_requests++;
+	if (conn->to_output_batch != NULL)
+		return;
+
+	o_stream_cork(conn->output);
+	conn->to_output_batch = timeout_add_short_to(conn->ioloop, 0,
+		connection_output_batch_timeout, conn);
+}
+
+void connection_output_batch_flush(struct connection *conn)
+{
+	if (conn->to_output_batch == NULL)
+		return;
+
+	timeout_remove(&conn->to_output_batch);
+	if (conn->output != NULL) {
+		conn->list->stats.output_batch_flushes++;
+		conn->list->stats.output_batch_bytes +=
+			o_stream_get_buffer_used_size(conn->output);
+		o_stream_uncork(conn->output);
+	}
+}
+
 void connection_input_default(struct connection *conn)
 {
 	int ret;
@@ -808,6 +853,7 @@ void connection_disconnect(struct connection *conn)
 
 	conn->last_input = 0;
 	i_zero(&conn->last_input_tv);
+	connection_output_batch_flush(conn);
 	timeout_remove(&conn->to);
 	io_remove(&conn->io);
 	i_stream_close(conn->input);
@@ -956,6 +1002,10 @@ void connection_switch_ioloop_to(struct connection *conn,
 		conn->io = io_loop_move_io_to(ioloop, &conn->io);
 	if (conn->to != NULL)
 		conn->to = io_loop_move_timeout_to(ioloop, &conn->to);
+	if (conn->to_output_batch != NULL) {
+		conn->to_output_batch =
+			io_loop_move_timeout_to(ioloop, &conn->to_output_batch);
+	}
 	if (conn->input != NULL)
 		i_stream_switch_ioloop_to(conn->input, ioloop);
 	if (conn->output != NULL)
@@ -131,6 +131,8 @@ struct connection {
 
 	unsigned int input_idle_timeout_secs;
 	struct timeout *to;
+	/* connection_output_batch() flush */
+	struct timeout *to_output_batch;
 	time_t last_input;
 	struct timeval last_input_tv;
 	struct timeval connect_started;
@@ -162,6 +164,21 @@ struct connection {
 	bool disconnected:1;
 };
 
+struct connection_list_stats {
+	/* Number of lines given to the line input handlers, and the number
+	   of times the handlers were called for lines read with a single
+	   read. input_lines / input_batches is the input batching factor. */
+	uint64_t input_lines;
+	uint64_t input_batches;
+	/* Number of connection_output_batch() calls and the number of times
+	   the batched output was flushed. Their ratio is the output batching
+	   factor. */
+	uint64_t output_batch_requests;
+	uint64_t output_batch_flushes;
+	/* Number of bytes flushed from batched output */
+	uint64_t output_batch_bytes;
+};
+
 struct connection_list {
 	struct connection *connections;
 	unsigned int connections_count;
@@ -170,6 +187,8 @@ struct connection_list {
 
 	struct connection_settings set;
 	struct connection_vfuncs v;
+
+	struct connection_list_stats stats;
 };
 
 void connection_init(struct connection_list *list, struct connection *conn,
@@ -232,6 +251,16 @@ void connection_update_properties(struct connection *conn);
 /* This needs to be called if the input/output streams are changed */
 void connection_streams_changed(struct connection *conn);
 
+/* Cork the output stream and flush it at the beginning of the next ioloop
+   iteration (or once the ostream buffer becomes full). This should be
+   called before sending data. It allows many small writes done during the
+   same ioloop iteration - also outside input handlers - to be sent with a
+   single write(). Calling it while a batch is already pending does
+   nothing. */
+void connection_output_batch(struct connection *conn);
+/* Flush the currently batched output immediately. */
+void connection_output_batch_flush(struct connection *conn);
+
 /* Returns -1 = disconnected, 0 = nothing new, 1 = something new.
    If input_full_behavior is ALLOW, may return also -2 = buffer full. */
 int connection_input_read(struct connection *conn);
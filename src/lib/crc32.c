@@ -1,8 +1,25 @@
 /* Copyright (c) 2006-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "byteorder.h"
 #include "crc32.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(__GNUC__ >= 5 || defined(__clang__))
+#  define CRC32_X86
+#  include <immintrin.h>
+#  define CRC32_TARGET_PCLMUL __attribute__((target("pclmul,sse4.1")))
+#  define CRC32_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#ifdef __ARM_FEATURE_CRC32
+#  include <arm_acle.h>
+#endif
+
+/* Castagnoli polynomial, reversed */
+#define CRC32C_POLY 0x82f63b78
+
+typedef uint32_t crc32_func_t(uint32_t crc, const uint8_t *p, size_t size);
+
 static uint32_t crc32tab[256] = {
 	0x00000000,
 	0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
@@ -58,6 +75,268 @@ static uint32_t crc32tab[256] = {
 	0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
 };
 
+/* The lookup tables for slicing-by-8. The first crc32 table is the one
+   above, the rest are generated on first use. */
+static uint32_t crc32_slice_tab[8][256];
+static uint32_t crc32c_slice_tab[8][256];
+static bool crc32_initialized = FALSE;
+static crc32_func_t *crc32_func, *crc32c_func;
+
+/* Load a little endian word. le*_to_cpu_unaligned() can't always be
+   optimized into a single load. */
+static inline uint32_t crc32_load32(const uint8_t *p)
+{
+#ifdef WORDS_BIGENDIAN
+	return le32_to_cpu_unaligned(p);
+#else
+	uint32_t value;
+
+	memcpy(&value, p, sizeof(value));
+	return value;
+#endif
+}
+
+static inline uint64_t crc32_load64(const uint8_t *p)
+{
+#ifdef WORDS_BIGENDIAN
+	return le64_to_cpu_unaligned(p);
+#else
+	uint64_t value;
+
+	memcpy(&value, p, sizeof(value));
+	return value;
+#endif
+}
+
+static void crc32_slice_tab_fill(uint32_t tab[8][256])
+{
+	unsigned int i, j;
+
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			tab[j][i] = (tab[j-1][i] >> 8) ^
+				tab[0][tab[j-1][i] & 0xff];
+		}
+	}
+}
+
+static uint32_t
+crc32_slice8(const uint32_t tab[8][256], uint32_t crc,
+	     const uint8_t *p, size_t size)
+{
+	uint32_t one, two;
+
+	for (; size >= 8; size -= 8, p += 8) {
+		one = crc32_load32(p) ^ crc;
+		two = crc32_load32(p + 4);
+		crc = tab[7][one & 0xff] ^
+			tab[6][(one >> 8) & 0xff] ^
+			tab[5][(one >> 16) & 0xff] ^
+			tab[4][one >> 24] ^
+			tab[3][two & 0xff] ^
+			tab[2][(two >> 8) & 0xff] ^
+			tab[1][(two >> 16) & 0xff] ^
+			tab[0][two >> 24];
+	}
+	for (; size > 0; size--, p++)
+		crc = (crc >> 8) ^ tab[0][(crc ^ *p) & 0xff];
+	return crc;
+}
+
+static uint32_t crc32_slice8_ieee(uint32_t crc, const uint8_t *p, size_t size)
+{
+	return crc32_slice8(crc32_slice_tab, crc, p, size);
+}
+
+static uint32_t crc32_slice8_c(uint32_t crc, const uint8_t *p, size_t size)
+{
+	return crc32_slice8(crc32c_slice_tab, crc, p, size);
+}
+
+#ifdef CRC32_X86
+/* Folding with carry-less multiplication, as described in Intel's "Fast CRC
+   Computation for Generic Polynomials Using PCLMULQDQ Instruction". The
+   constants are x^n mod P(x) for the bit-reflected CRC-32 polynomial. */
+static const uint64_t crc32_pclmul_k1k2[] =
+	{ 0x0154442bd4, 0x01c6e41596 };
+static const uint64_t crc32_pclmul_k3k4[] =
+	{ 0x01751997d0, 0x00ccaa009e };
+static const uint64_t crc32_pclmul_k5k0[] =
+	{ 0x0163cd6124, 0x0000000000 };
+static const uint64_t crc32_pclmul_poly[] =
+	{ 0x01db710641, 0x01f7011641 };
+
+static inline CRC32_TARGET_PCLMUL __m128i
+crc32_pclmul_fold(__m128i x, __m128i k, __m128i next)
+{
+	__m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+	__m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+
+	return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+}
+
+static CRC32_TARGET_PCLMUL uint32_t
+crc32_pclmul(uint32_t crc, const uint8_t *p, size_t size)
+{
+	__m128i x0, x1, x2, x3, x4, mask32;
+
+	if (size < 64)
+		return crc32_slice8_ieee(crc, p, size);
+
+	/* fold 64 bytes at a time with 4 parallel accumulators */
+	x1 = _mm_loadu_si128((const void *)(p + 0x00));
+	x2 = _mm_loadu_si128((const void *)(p + 0x10));
+	x3 = _mm_loadu_si128((const void *)(p + 0x20));
+	x4 = _mm_loadu_si128((const void *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	x0 = _mm_loadu_si128((const void *)crc32_pclmul_k1k2);
+	p += 64; size -= 64;
+
+	for (; size >= 64; p += 64, size -= 64) {
+		x1 = crc32_pclmul_fold(x1, x0,
+			_mm_loadu_si128((const void *)(p + 0x00)));
+		x2 = crc32_pclmul_fold(x2, x0,
+			_mm_loadu_si128((const void *)(p + 0x10)));
+		x3 = crc32_pclmul_fold(x3, x0,
+			_mm_loadu_si128((const void *)(p + 0x20)));
+		x4 = crc32_pclmul_fold(x4, x0,
+			_mm_loadu_si128((const void *)(p + 0x30)));
+	}
+
+	/* fold the accumulators into one */
+	x0 = _mm_loadu_si128((const void *)crc32_pclmul_k3k4);
+	x1 = crc32_pclmul_fold(x1, x0, x2);
+	x1 = crc32_pclmul_fold(x1, x0, x3);
+	x1 = crc32_pclmul_fold(x1, x0, x4);
+
+	for (; size >= 16; p += 16, size -= 16)
+		x1 = crc32_pclmul_fold(x1, x0, _mm_loadu_si128((const void *)p));
+
+	/* fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+	mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	x1 = _mm_srli_si128(x1, 8);
+	x1 = _mm_xor_si128(x1, x2);
+	x0 = _mm_loadl_epi64((const void *)crc32_pclmul_k5k0);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_loadu_si128((const void *)crc32_pclmul_poly);
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	crc = _mm_extract_epi32(x1, 1);
+
+	return crc32_slice8_ieee(crc, p, size);
+}
+
+static CRC32_TARGET_SSE42 uint32_t
+crc32c_sse42(uint32_t crc, const uint8_t *p, size_t size)
+{
+#ifdef __x86_64__
+	uint64_t crc64 = crc;
+
+	for (; size >= 8; size -= 8, p += 8)
+		crc64 = _mm_crc32_u64(crc64, crc32_load64(p));
+	crc = (uint32_t)crc64;
+#endif
+	for (; size >= 4; size -= 4, p += 4)
+		crc = _mm_crc32_u32(crc, crc32_load32(p));
+	for (; size > 0; size--, p++)
+		crc = _mm_crc32_u8(crc, *p);
+	return crc;
+}
+#endif
+
+#ifdef __ARM_FEATURE_CRC32
+static uint32_t crc32_armv8(uint32_t crc, const uint8_t *p, size_t size)
+{
+	for (; size >= 8; size -= 8, p += 8)
+		crc = __crc32d(crc, crc32_load64(p));
+	for (; size > 0; size--, p++)
+		crc = __crc32b(crc, *p);
+	return crc;
+}
+
+static uint32_t crc32c_armv8(uint32_t crc, const uint8_t *p, size_t size)
+{
+	for (; size >= 8; size -= 8, p += 8)
+		crc = __crc32cd(crc, crc32_load64(p));
+	for (; size > 0; size--, p++)
+		crc = __crc32cb(crc, *p);
+	return crc;
+}
+#endif
+
+static void crc32_init(void)
+{
+	unsigned int i, j;
+	uint32_t crc;
+
+	memcpy(crc32_slice_tab[0], crc32tab, sizeof(crc32tab));
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) != 0 ? CRC32C_POLY : 0);
+		crc32c_slice_tab[0][i] = crc;
+	}
+	crc32_slice_tab_fill(crc32_slice_tab);
+	crc32_slice_tab_fill(crc32c_slice_tab);
+
+	(void)crc32_set_impl(CRC32_IMPL_AUTO);
+	crc32_initialized = TRUE;
+}
+
+bool crc32_set_impl(enum crc32_impl impl)
+{
+	if (!crc32_initialized && impl != CRC32_IMPL_AUTO)
+		crc32_init();
+
+	switch (impl) {
+	case CRC32_IMPL_AUTO:
+#ifdef CRC32_X86
+		__builtin_cpu_init();
+		crc32_func = __builtin_cpu_supports("pclmul") &&
+			__builtin_cpu_supports("sse4.1") ?
+			crc32_pclmul : crc32_slice8_ieee;
+		crc32c_func = __builtin_cpu_supports("sse4.2") ?
+			crc32c_sse42 : crc32_slice8_c;
+#elif defined(__ARM_FEATURE_CRC32)
+		crc32_func = crc32_armv8;
+		crc32c_func = crc32c_armv8;
+#else
+		crc32_func = crc32_slice8_ieee;
+		crc32c_func = crc32_slice8_c;
+#endif
+		return TRUE;
+	case CRC32_IMPL_TABLE:
+		crc32_func = crc32_slice8_ieee;
+		crc32c_func = crc32_slice8_c;
+		return TRUE;
+	case CRC32_IMPL_HW:
+#ifdef CRC32_X86
+		if (!__builtin_cpu_supports("pclmul") ||
+		    !__builtin_cpu_supports("sse4.2"))
+			return FALSE;
+		crc32_func = crc32_pclmul;
+		crc32c_func = crc32c_sse42;
+		return TRUE;
+#elif defined(__ARM_FEATURE_CRC32)
+		crc32_func = crc32_armv8;
+		crc32c_func = crc32c_armv8;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	}
+	i_unreached();
+}
+
 uint32_t crc32_data(const void *data, size_t size)
 {
 	return crc32_data_more(0, data, size);
@@ -65,13 +344,9 @@ uint32_t crc32_data(const void *data, size_t size)
 
 uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size)
 {
-	const uint8_t *p = data, *end = p + size;
-
-	crc ^= 0xffffffff;
-	for (; p != end; p++)
-		crc = (crc >> 8) ^ crc32tab[((crc ^ *p) & 0xff)];
-	crc ^= 0xffffffff;
-	return crc;
+	if (unlikely(!crc32_initialized))
+		crc32_init();
+	return ~crc32_func(~crc, data, size);
 }
 
 uint32_t crc32_str(const char *str)
@@ -81,11 +356,17 @@ uint32_t crc32_str(const char *str)
 
 uint32_t crc32_str_more(uint32_t crc, const char *str)
 {
-	const uint8_t *p = (const uint8_t *)str;
+	return crc32_data_more(crc, str, strlen(str));
+}
 
-	crc ^= 0xffffffff;
-	for (; *p != '\0'; p++)
-		crc = (crc >> 8) ^ crc32tab[((crc ^ *p) & 0xff)];
-	crc ^= 0xffffffff;
-	return crc;
+uint32_t crc32c_data(const void *data, size_t size)
+{
+	return crc32c_data_more(0, data, size);
+}
+
+uint32_t crc32c_data_more(uint32_t crc, const void *data, size_t size)
+{
+	if (unlikely(!crc32_initialized))
+		crc32_init();
+	return ~crc32c_func(~crc, data, size);
 }
@@ -1,10 +1,30 @@
 #ifndef CRC32_H
 #define CRC32_H
 
+enum crc32_impl {
+	/* Use the fastest implementation supported by the CPU (default) */
+	CRC32_IMPL_AUTO = 0,
+	/* Slicing-by-8 lookup tables */
+	CRC32_IMPL_TABLE,
+	/* CPU instructions (PCLMULQDQ and SSE4.2 on x86, ARMv8 CRC) */
+	CRC32_IMPL_HW,
+};
+
+/* CRC-32 as used by zlib, PNG, etc. */
 uint32_t crc32_data(const void *data, size_t size) ATTR_PURE;
 uint32_t crc32_str(const char *str) ATTR_PURE;
 
 uint32_t crc32_data_more(uint32_t crc, const void *data, size_t size) ATTR_PURE;
 uint32_t crc32_str_more(uint32_t crc, const char *str) ATTR_PURE;
 
+/* CRC-32C (Castagnoli), as used by iSCSI, ext4, etc. It has better error
+   detection properties than CRC-32 and it's faster on CPUs with the CRC32
+   instruction. Use this for new on-disk formats. */
+uint32_t crc32c_data(const void *data, size_t size) ATTR_PURE;
+uint32_t crc32c_data_more(uint32_t crc, const void *data, size_t size) ATTR_PURE;
+
+/* Change the implementation used by all the functions. Returns FALSE if the
+   CPU doesn't support it. This is intended for unit tests and benchmarks. */
+bool crc32_set_impl(enum crc32_impl impl);
+
 #endif
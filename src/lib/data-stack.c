@@ -3,7 +3,10 @@
 /* @UNSAFE: whole file */
 
 #include "lib.h"
+#include "array.h"
+#include "hash.h"
 #include "backtrace-string.h"
+#include "mmap-util.h"
 #include "str.h"
 #include "data-stack.h"
 
@@ -16,6 +19,12 @@
 #  define INITIAL_STACK_SIZE (1024*32)
 #endif
 
+/* Blocks at least this large are allocated with mmap(). When such a block is
+   freed it's guaranteed to be returned to the OS. With malloc() a large
+   free()d block may stay in the heap, keeping the process's RSS inflated
+   long after the large allocation was needed. */
+#define DATA_STACK_MMAP_MIN_SIZE (1024*128)
+
 #ifdef DEBUG
 #  define CLEAR_CHR 0xD5               /* D5 is mnemonic for "Data 5tack" */
 #  define SENTRY_COUNT (4*8)
@@ -38,6 +47,8 @@ struct stack_block {
 	   needs to be cleared if DEBUG is used. */
 	size_t left_lowwater;
 #endif
+	/* Block was allocated with mmap_anon() instead of malloc() */
+	bool mmaped;
 	/* NULL or a poison value, just in case something accesses
 	   the memory in front of an allocated area */
 	void *canary;
@@ -59,6 +70,13 @@ struct stack_frame {
 	size_t block_space_left;
 	size_t last_alloc_size;
 	const char *marker;
+
+	/* blocks_before_size and block_depth for the frame's first block */
+	size_t block_blocks_before_size;
+	unsigned int block_depth;
+	/* The highest position that nested frames have reached (frame stats) */
+	size_t peak_pos;
+	unsigned int peak_depth;
 #ifdef DEBUG
 	/* Fairly arbitrary profiling data */
 	unsigned long long alloc_bytes;
@@ -86,6 +104,17 @@ static struct stack_block *current_block;
    freed. This can prevent rapid malloc()+free()ing when data stack is grown
    and shrunk constantly. */
 static struct stack_block *unused_block = NULL;
+/* Sum of the sizes of the blocks before current_block, and their count.
+   These give each allocation a position within the whole data stack. */
+static size_t blocks_before_size = 0;
+static unsigned int block_depth = 0;
+
+static bool frame_stats_enabled = FALSE;
+static bool frame_stats_sending_event = FALSE;
+static size_t frame_stats_min_peak_bytes;
+static HASH_TABLE(char *, struct data_stack_frame_stats *) frame_stats_hash;
+static ARRAY(struct data_stack_frame_stats *) frame_stats_arr;
+static struct event *event_datastack_frame = NULL;
 
 static struct event *event_datastack = NULL;
 static bool event_datastack_deinitialized = FALSE;
@@ -100,6 +129,7 @@ static union {
 } outofmem_area;
 
 static struct stack_block *mem_block_alloc(size_t min_size);
+static void mem_block_free(struct stack_block *block);
 
 static inline
 unsigned char *data_stack_after_last_alloc(struct stack_block *block)
@@ -107,6 +137,11 @@ unsigned char *data_stack_after_last_alloc(struct stack_block *block)
 	return STACK_BLOCK_DATA(block) + (block->size - block->left);
 }
 
+static inline size_t data_stack_get_pos(void)
+{
+	return blocks_before_size + (current_block->size - current_block->left);
+}
+
 static void data_stack_last_buffer_reset(bool preserve_data ATTR_UNUSED)
 {
 	if (last_buffer_block != NULL) {
@@ -168,6 +203,10 @@ data_stack_frame_t t_push(const char *marker)
 	current_frame->block_space_left = current_block->left;
 	current_frame->last_alloc_size = 0;
 	current_frame->marker = marker;
+	current_frame->block_blocks_before_size = blocks_before_size;
+	current_frame->block_depth = block_depth;
+	current_frame->peak_pos = 0;
+	current_frame->peak_depth = 0;
 #ifdef DEBUG
 	current_frame->alloc_bytes = 0;
 	current_frame->alloc_count = 0;
@@ -229,10 +268,10 @@ static void free_blocks(struct stack_block *block)
 			;
 		else if (unused_block == NULL ||
 			 block->size > unused_block->size) {
-			free(unused_block);
+			mem_block_free(unused_block);
 			unused_block = block;
 		} else {
-			free(block);
+			mem_block_free(block);
 		}
 
 		block = next;
@@ -276,9 +315,83 @@ static void t_pop_verify(void)
 }
 #endif
 
+static void
+data_stack_frame_stats_send_event(const struct data_stack_frame_stats *stats,
+				  size_t prev_peak_bytes)
+{
+	if (event_datastack_deinitialized)
+		return;
+	if (event_datastack_frame == NULL)
+		event_datastack_frame = event_create(NULL);
+	event_set_name(event_datastack_frame, "data_stack_frame_peak");
+	event_add_str(event_datastack_frame, "frame_marker", stats->marker);
+	event_add_int(event_datastack_frame, "peak_bytes", stats->peak_bytes);
+	event_add_int(event_datastack_frame, "prev_peak_bytes",
+		      prev_peak_bytes);
+	event_add_int(event_datastack_frame, "peak_blocks", stats->peak_blocks);
+	event_add_int(event_datastack_frame, "frame_count", stats->count);
+	event_add_int(event_datastack_frame, "alloc_size",
+		      data_stack_get_alloc_size());
+	e_debug(event_datastack_frame,
+		"Data stack frame '%s' reached new peak: %zu bytes in %u blocks",
+		stats->marker, stats->peak_bytes, stats->peak_blocks);
+}
+
+static struct data_stack_frame_stats *
+data_stack_frame_stats_update(const struct stack_frame *frame,
+			      size_t peak_bytes, unsigned int peak_blocks,
+			      size_t *prev_peak_bytes_r)
+{
+	struct data_stack_frame_stats *stats;
+
+	stats = hash_table_lookup(frame_stats_hash, frame->marker);
+	if (stats == NULL) {
+		stats = i_new(struct data_stack_frame_stats, 1);
+		stats->marker = i_strdup(frame->marker);
+		hash_table_insert(frame_stats_hash, stats->marker, stats);
+		array_push_back(&frame_stats_arr, &stats);
+	}
+	stats->count++;
+	stats->total_peak_bytes += peak_bytes;
+	if (stats->peak_blocks < peak_blocks)
+		stats->peak_blocks = peak_blocks;
+	*prev_peak_bytes_r = stats->peak_bytes;
+	if (stats->peak_bytes >= peak_bytes)
+		return NULL;
+	stats->peak_bytes = peak_bytes;
+	return stats;
+}
+
+static struct data_stack_frame_stats *
+data_stack_frame_stats_pop(size_t *prev_peak_bytes_r)
+{
+	struct stack_frame *frame = current_frame, *parent = frame->prev;
+	size_t start_pos, peak_pos = data_stack_get_pos();
+	unsigned int peak_depth = block_depth;
+
+	/* The position can only grow within the frame, except when nested
+	   frames are popped. They have updated peak_pos. */
+	peak_pos = I_MAX(peak_pos, frame->peak_pos);
+	peak_depth = I_MAX(peak_depth, frame->peak_depth);
+	if (parent != NULL) {
+		parent->peak_pos = I_MAX(parent->peak_pos, peak_pos);
+		parent->peak_depth = I_MAX(parent->peak_depth, peak_depth);
+	}
+
+	start_pos = frame->block_blocks_before_size +
+		(frame->block->size - frame->block_space_left);
+	if (peak_pos - start_pos < frame_stats_min_peak_bytes ||
+	    frame_stats_sending_event)
+		return NULL;
+	return data_stack_frame_stats_update(frame, peak_pos - start_pos,
+					     peak_depth - frame->block_depth + 1,
+					     prev_peak_bytes_r);
+}
+
 void t_pop_last_unsafe(void)
 {
-	size_t block_space_left;
+	struct data_stack_frame_stats *new_peak_stats = NULL;
+	size_t block_space_left, prev_peak_bytes = 0;
 
 	if (unlikely(current_frame == NULL))
 		i_panic("t_pop() called with empty stack");
@@ -287,11 +400,15 @@ void t_pop_last_unsafe(void)
 #ifdef DEBUG
 	t_pop_verify();
 #endif
+	if (unlikely(frame_stats_enabled))
+		new_peak_stats = data_stack_frame_stats_pop(&prev_peak_bytes);
 
 	/* Usually the block doesn't change. If it doesn't, the next pointer
 	   must also be NULL. */
 	if (current_block != current_frame->block) {
 		current_block = current_frame->block;
+		blocks_before_size = current_frame->block_blocks_before_size;
+		block_depth = current_frame->block_depth;
 		if (current_block->next != NULL) {
 			/* free unused blocks */
 			free_blocks(current_block->next);
@@ -319,6 +436,20 @@ void t_pop_last_unsafe(void)
 	current_block->left = block_space_left;
 
 	data_stack_frame_id--;
+
+	if (unlikely(new_peak_stats != NULL)) {
+		/* send the event only after the frame is fully popped, so it
+		   can allocate memory from the data stack. */
+		int old_errno = errno;
+
+		frame_stats_sending_event = TRUE;
+		T_BEGIN {
+			data_stack_frame_stats_send_event(new_peak_stats,
+							  prev_peak_bytes);
+		} T_END;
+		frame_stats_sending_event = FALSE;
+		errno = old_errno;
+	}
 }
 
 bool t_pop(data_stack_frame_t *id)
@@ -366,7 +497,8 @@ static void mem_block_reset(struct stack_block *block)
 static struct stack_block *mem_block_alloc(size_t min_size)
 {
 	struct stack_block *block;
-	size_t prev_size, alloc_size;
+	size_t prev_size, alloc_size, page_size;
+	bool mmaped = FALSE;
 
 	prev_size = current_block == NULL ? 0 : current_block->size;
 	/* Use INITIAL_STACK_SIZE without growing it to nearest power. */
@@ -375,7 +507,18 @@ static struct stack_block *mem_block_alloc(size_t min_size)
 
 	/* nearest_power() returns 2^n values, so alloc_size can't be
 	   anywhere close to SIZE_MAX */
-	block = malloc(SIZEOF_MEMBLOCK + alloc_size);
+	if (alloc_size < DATA_STACK_MMAP_MIN_SIZE)
+		block = malloc(SIZEOF_MEMBLOCK + alloc_size);
+	else {
+		/* use the rest of the last page as well */
+		page_size = mmap_get_page_size();
+		alloc_size = ((SIZEOF_MEMBLOCK + alloc_size + page_size - 1) &
+			      ~(page_size - 1)) - SIZEOF_MEMBLOCK;
+		block = mmap_anon(SIZEOF_MEMBLOCK + alloc_size);
+		if (block == MAP_FAILED)
+			block = NULL;
+		mmaped = TRUE;
+	}
 	if (unlikely(block == NULL)) {
 		if (outofmem) {
 			if (min_size > outofmem_area.block.left)
@@ -387,6 +530,7 @@ static struct stack_block *mem_block_alloc(size_t min_size)
 			alloc_size + SIZEOF_MEMBLOCK);
 	}
 	block->size = alloc_size;
+	block->mmaped = mmaped;
 	block->canary = BLOCK_CANARY;
 	mem_block_reset(block);
 #ifdef DEBUG
@@ -395,6 +539,16 @@ static struct stack_block *mem_block_alloc(size_t min_size)
 	return block;
 }
 
+static void mem_block_free(struct stack_block *block)
+{
+	if (block == NULL)
+		return;
+	if (!block->mmaped)
+		free(block);
+	else if (munmap_anon(block, SIZEOF_MEMBLOCK + block->size) < 0)
+		i_panic("data stack: munmap() failed: %m");
+}
+
 static void data_stack_send_grow_event(size_t last_alloc_size)
 {
 	if (event_datastack_deinitialized) {
@@ -498,6 +652,8 @@ static void *t_malloc_real(size_t size, bool permanent)
 		   the linked list. */
 		block->prev = current_block;
 		current_block->next = block;
+		blocks_before_size += current_block->size;
+		block_depth++;
 		current_block = block;
 	}
 
@@ -732,10 +888,47 @@ size_t data_stack_get_used_size(void)
 
 void data_stack_free_unused(void)
 {
-	free(unused_block);
+	mem_block_free(unused_block);
 	unused_block = NULL;
 }
 
+void data_stack_frame_stats_enable(size_t min_peak_bytes)
+{
+	if (!frame_stats_enabled) {
+		hash_table_create(&frame_stats_hash, default_pool, 0,
+				  str_hash, strcmp);
+		i_array_init(&frame_stats_arr, 32);
+	}
+	frame_stats_enabled = TRUE;
+	frame_stats_min_peak_bytes = min_peak_bytes;
+}
+
+void data_stack_frame_stats_disable(void)
+{
+	struct data_stack_frame_stats *stats;
+
+	if (!frame_stats_enabled)
+		return;
+	frame_stats_enabled = FALSE;
+
+	array_foreach_elem(&frame_stats_arr, stats) {
+		i_free(stats->marker);
+		i_free(stats);
+	}
+	array_free(&frame_stats_arr);
+	hash_table_destroy(&frame_stats_hash);
+}
+
+const struct data_stack_frame_stats *const *
+data_stack_frame_stats_get(unsigned int *count_r)
+{
+	if (!frame_stats_enabled) {
+		*count_r = 0;
+		return NULL;
+	}
+	return (const void *)array_get(&frame_stats_arr, count_r);
+}
+
 void data_stack_init(void)
 {
 	if (data_stack_initialized) {
@@ -762,6 +955,7 @@ void data_stack_init(void)
 void data_stack_deinit_event(void)
 {
 	event_unref(&event_datastack);
+	event_unref(&event_datastack_frame);
 	event_datastack_deinitialized = TRUE;
 }
 
@@ -771,7 +965,8 @@ void data_stack_deinit(void)
 	    current_frame != NULL)
 		i_panic("Missing t_pop() call");
 
-	free(current_block);
+	data_stack_frame_stats_disable();
+	mem_block_free(current_block);
 	current_block = NULL;
 	data_stack_free_unused();
 }
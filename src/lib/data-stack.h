@@ -158,6 +158,32 @@ size_t data_stack_get_used_size(void);
    data stack quickly). */
 void data_stack_free_unused(void);
 
+struct data_stack_frame_stats {
+	/* t_push() marker. Note that in non-DEBUG builds the marker for
+	   t_push_named() is the unformatted format string. */
+	char *marker;
+	/* Number of times the frame was popped after using at least
+	   min_peak_bytes */
+	unsigned int count;
+	/* The highest number of bytes and blocks that the frame (including
+	   its nested frames) has used */
+	size_t peak_bytes;
+	unsigned int peak_blocks;
+	/* Sum of the peak bytes of each accounted frame */
+	uint64_t total_peak_bytes;
+};
+
+/* Start accounting the peak memory usage of data stack frames by their
+   markers. Only frames that used at least min_peak_bytes are accounted.
+   Each time a frame marker reaches a new peak, a "data_stack_frame_peak"
+   debug event is sent. Calling this again only changes min_peak_bytes. */
+void data_stack_frame_stats_enable(size_t min_peak_bytes);
+/* Stop accounting and free the gathered statistics. */
+void data_stack_frame_stats_disable(void);
+/* Returns the statistics of all the accounted frame markers. */
+const struct data_stack_frame_stats *const *
+data_stack_frame_stats_get(unsigned int *count_r);
+
 void data_stack_init(void);
 void data_stack_deinit_event(void);
 void data_stack_deinit(void);
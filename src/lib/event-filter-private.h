@@ -23,6 +23,15 @@ struct event_filter {
 	pool_t pool;
 	int refcount;
 	ARRAY(struct event_filter_query_internal) queries;
+	/* Built lazily when matching and freed whenever the queries
+	   change. */
+	struct event_filter_index *index;
+
+	/* Sampling settings and state, see event_filter_set_sampling() */
+	unsigned int sample_rate, sample_max_events_per_sec;
+	unsigned int sample_cur_rate, sample_counter;
+	unsigned int sample_window_matches;
+	time_t sample_window_start;
 
 	bool fragment;
 	bool named_queries_only;
@@ -3,6 +3,8 @@
 #include "lib.h"
 #include "array.h"
 #include "llist.h"
+#include "hash.h"
+#include "ioloop.h"
 #include "str.h"
 #include "strescape.h"
 #include "wildcard-match.h"
@@ -40,8 +42,27 @@ struct event_filter_query_internal {
 	void *context;
 };
 
+/* Queries that can match only events with specific names are indexed by the
+   names, so that matching an event needs to evaluate only the queries for
+   its name and the queries that may match any event. The query index lists
+   are in the same order as the queries. */
+struct event_filter_index {
+	pool_t pool;
+	HASH_TABLE(char *, ARRAY_TYPE(uint) *) names;
+	ARRAY_TYPE(uint) any_name_queries;
+};
+
 static struct event_filter *event_filters = NULL;
 
+static void event_filter_index_free(struct event_filter *filter)
+{
+	if (filter->index == NULL)
+		return;
+	hash_table_destroy(&filter->index->names);
+	pool_unref(&filter->index->pool);
+	filter->index = NULL;
+}
+
 static struct event_filter *event_filter_create_real(pool_t pool, bool fragment)
 {
 	struct event_filter *filter;
@@ -50,6 +71,8 @@ static struct event_filter *event_filter_create_real(pool_t pool, bool fragment)
 	filter->pool = pool;
 	filter->refcount = 1;
 	filter->named_queries_only = TRUE;
+	filter->sample_rate = 1;
+	filter->sample_cur_rate = 1;
 	filter->fragment = fragment;
 	p_array_init(&filter->queries, pool, 4);
 	if (!fragment)
@@ -87,6 +110,7 @@ void event_filter_unref(struct event_filter **_filter)
 
 	if (!filter->fragment) {
 		DLLIST_REMOVE(&event_filters, filter);
+		event_filter_index_free(filter);
 
 		/* fragments' pools are freed by the consumer */
 		pool_unref(&filter->pool);
@@ -104,6 +128,9 @@ event_filter_get_or_alloc_internal_query(struct event_filter *filter,
 {
 	struct event_filter_query_internal *query;
 
+	/* the caller modifies the returned query's expression */
+	event_filter_index_free(filter);
+
 	array_foreach_modifiable(&filter->queries, query) {
 		if (query->context == context)
 			return query;
@@ -265,6 +292,8 @@ event_filter_merge_with_context_internal(struct event_filter *dest,
 {
 	const struct event_filter_query_internal *int_query;
 
+	if (!src->named_queries_only)
+		dest->named_queries_only = FALSE;
 	array_foreach(&src->queries, int_query) T_BEGIN {
 		void *context = with_context ? new_context : int_query->context;
 		struct event_filter_query_internal *new;
@@ -287,6 +316,7 @@ bool event_filter_remove_queries_with_context(struct event_filter *filter,
 		if (int_query->context == context) {
 			idx = array_foreach_idx(&filter->queries, int_query);
 			array_delete(&filter->queries, idx, 1);
+			event_filter_index_free(filter);
 			return TRUE;
 		}
 	}
@@ -755,6 +785,111 @@ event_filter_query_match(const struct event_filter_query_internal *query,
 					     source_linenum, log_type);
 }
 
+/* Add the event names the expression requires to the array: the expression
+   can match only events that have one of these names. Returns FALSE if the
+   expression may match events with any name (or without a name), in which
+   case the array may contain garbage at the end. */
+static bool
+event_filter_node_get_names(const struct event_filter_node *node,
+			    ARRAY_TYPE(const_string) *names)
+{
+	unsigned int count;
+
+	switch (node->op) {
+	case EVENT_FILTER_OP_NOT:
+		return FALSE;
+	case EVENT_FILTER_OP_AND:
+		count = array_count(names);
+		if (event_filter_node_get_names(node->children[0], names))
+			return TRUE;
+		array_delete(names, count, array_count(names) - count);
+		return event_filter_node_get_names(node->children[1], names);
+	case EVENT_FILTER_OP_OR:
+		return event_filter_node_get_names(node->children[0], names) &&
+			event_filter_node_get_names(node->children[1], names);
+	default:
+		if (node->type != EVENT_FILTER_NODE_TYPE_EVENT_NAME_EXACT)
+			return FALSE;
+		array_push_back(names, &node->str);
+		return TRUE;
+	}
+}
+
+static void
+event_filter_index_add(struct event_filter_index *index,
+		       const ARRAY_TYPE(const_string) *names,
+		       unsigned int query_idx)
+{
+	ARRAY_TYPE(uint) *queries;
+	const char *name;
+	char *key;
+
+	array_foreach_elem(names, name) {
+		queries = hash_table_lookup(index->names, name);
+		if (queries == NULL) {
+			key = p_strdup(index->pool, name);
+			queries = p_new(index->pool, ARRAY_TYPE(uint), 1);
+			p_array_init(queries, index->pool, 4);
+			hash_table_insert(index->names, key, queries);
+		} else if (*array_back(queries) == query_idx) {
+			/* same name multiple times in the query */
+			continue;
+		}
+		array_push_back(queries, &query_idx);
+	}
+}
+
+static struct event_filter_index *
+event_filter_get_index(struct event_filter *filter)
+{
+	const struct event_filter_query_internal *query;
+	struct event_filter_index *index;
+	ARRAY_TYPE(const_string) names;
+	unsigned int query_idx;
+	pool_t pool;
+
+	if (filter->index != NULL)
+		return filter->index;
+
+	pool = pool_alloconly_create("event filter index", 1024);
+	index = p_new(pool, struct event_filter_index, 1);
+	index->pool = pool;
+	hash_table_create(&index->names, pool, 0, str_hash, strcmp);
+	p_array_init(&index->any_name_queries, pool, 4);
+
+	T_BEGIN {
+		t_array_init(&names, 8);
+		array_foreach(&filter->queries, query) {
+			query_idx = array_foreach_idx(&filter->queries, query);
+			array_clear(&names);
+			if (query->expr != NULL &&
+			    event_filter_node_get_names(query->expr, &names))
+				event_filter_index_add(index, &names, query_idx);
+			else {
+				array_push_back(&index->any_name_queries,
+						&query_idx);
+			}
+		}
+	} T_END;
+	filter->index = index;
+	return index;
+}
+
+/* Returns the sorted list of queries that need to be checked for the event's
+   name (or NULL if there are none) and the sorted list of queries that need
+   to be checked for all events. */
+static void
+event_filter_get_candidates(struct event_filter *filter, struct event *event,
+			    const ARRAY_TYPE(uint) **named_queries_r,
+			    const ARRAY_TYPE(uint) **any_name_queries_r)
+{
+	struct event_filter_index *index = event_filter_get_index(filter);
+
+	*named_queries_r = event->sending_name == NULL ? NULL :
+		hash_table_lookup(index->names, event->sending_name);
+	*any_name_queries_r = &index->any_name_queries;
+}
+
 static bool
 event_filter_match_fastpath(struct event_filter *filter, struct event *event)
 {
@@ -781,17 +916,27 @@ bool event_filter_match_source(struct event_filter *filter, struct event *event,
 			       unsigned int source_linenum,
 			       const struct failure_context *ctx)
 {
+	const ARRAY_TYPE(uint) *candidates[2];
 	const struct event_filter_query_internal *query;
+	unsigned int i, query_idx;
 
 	i_assert(!filter->fragment);
 
 	if (!event_filter_match_fastpath(filter, event))
 		return FALSE;
 
-	array_foreach(&filter->queries, query) {
-		if (event_filter_query_match(query, event, source_filename,
-					     source_linenum, ctx))
-			return TRUE;
+	event_filter_get_candidates(filter, event, &candidates[0],
+				    &candidates[1]);
+	for (i = 0; i < N_ELEMENTS(candidates); i++) {
+		if (candidates[i] == NULL)
+			continue;
+		array_foreach_elem(candidates[i], query_idx) {
+			query = array_idx(&filter->queries, query_idx);
+			if (event_filter_query_match(query, event,
+						     source_filename,
+						     source_linenum, ctx))
+				return TRUE;
+		}
 	}
 	return FALSE;
 }
@@ -800,37 +945,79 @@ struct event_filter_match_iter {
 	struct event_filter *filter;
 	struct event *event;
 	const struct failure_context *failure_ctx;
-	unsigned int idx;
+
+	/* The candidate queries. They're copied, because the filter's index
+	   is freed if the queries change during the iteration. */
+	unsigned int *query_idxs;
+	unsigned int count, idx;
 };
 
+static void
+event_filter_match_iter_merge(struct event_filter_match_iter *iter,
+			      const ARRAY_TYPE(uint) *named_queries,
+			      const ARRAY_TYPE(uint) *any_name_queries)
+{
+	const unsigned int *named = NULL, *any;
+	unsigned int named_count = 0, any_count, i = 0, j = 0;
+
+	if (named_queries != NULL)
+		named = array_get(named_queries, &named_count);
+	any = array_get(any_name_queries, &any_count);
+
+	/* merge the sorted lists to keep the queries' order */
+	while (i < named_count || j < any_count) {
+		if (j == any_count || (i < named_count && named[i] < any[j]))
+			iter->query_idxs[iter->count++] = named[i++];
+		else
+			iter->query_idxs[iter->count++] = any[j++];
+	}
+}
+
 struct event_filter_match_iter *
 event_filter_match_iter_init(struct event_filter *filter, struct event *event,
 			     const struct failure_context *ctx)
 {
+	const ARRAY_TYPE(uint) *named_queries = NULL, *any_name_queries = NULL;
 	struct event_filter_match_iter *iter;
+	unsigned int max_count = 0;
 
 	i_assert(!filter->fragment);
 
-	iter = i_new(struct event_filter_match_iter, 1);
+	if (event_filter_match_fastpath(filter, event)) {
+		event_filter_get_candidates(filter, event, &named_queries,
+					    &any_name_queries);
+		max_count = array_count(any_name_queries);
+		if (named_queries != NULL)
+			max_count += array_count(named_queries);
+	}
+
+	iter = i_malloc(MALLOC_ADD(sizeof(*iter),
+				   MALLOC_MULTIPLY(sizeof(unsigned int),
+						   max_count)));
 	iter->filter = filter;
 	iter->event = event;
 	iter->failure_ctx = ctx;
-	if (!event_filter_match_fastpath(filter, event))
-		iter->idx = UINT_MAX;
+	iter->query_idxs = (unsigned int *)(iter + 1);
+	if (any_name_queries != NULL) {
+		event_filter_match_iter_merge(iter, named_queries,
+					      any_name_queries);
+	}
 	return iter;
 }
 
 void *event_filter_match_iter_next(struct event_filter_match_iter *iter)
 {
-	const struct event_filter_query_internal *queries;
-	unsigned int count;
+	const struct event_filter_query_internal *queries, *query;
+	unsigned int count, query_idx;
 
 	queries = array_get(&iter->filter->queries, &count);
-	while (iter->idx < count) {
-		const struct event_filter_query_internal *query =
-			&queries[iter->idx];
-
-		iter->idx++;
+	while (iter->idx < iter->count) {
+		query_idx = iter->query_idxs[iter->idx++];
+		if (query_idx >= count) {
+			/* queries were removed during the iteration */
+			break;
+		}
+		query = &queries[query_idx];
 		if (query->context != NULL &&
 		    event_filter_query_match(query, iter->event,
 					     iter->event->source_filename,
@@ -849,6 +1036,66 @@ void event_filter_match_iter_deinit(struct event_filter_match_iter **_iter)
 	i_free(iter);
 }
 
+void event_filter_set_sampling(struct event_filter *filter,
+			       unsigned int sample_rate,
+			       unsigned int max_events_per_sec)
+{
+	i_assert(sample_rate > 0);
+
+	filter->sample_rate = sample_rate;
+	filter->sample_max_events_per_sec = max_events_per_sec;
+	filter->sample_cur_rate = sample_rate;
+	filter->sample_counter = 0;
+	filter->sample_window_matches = 0;
+	filter->sample_window_start = 0;
+}
+
+void event_filter_get_sampling(const struct event_filter *filter,
+			       unsigned int *sample_rate_r,
+			       unsigned int *max_events_per_sec_r)
+{
+	*sample_rate_r = filter->sample_rate;
+	*max_events_per_sec_r = filter->sample_max_events_per_sec;
+}
+
+static void event_filter_sample_update_rate(struct event_filter *filter)
+{
+	unsigned int max = filter->sample_max_events_per_sec;
+	unsigned int rate = filter->sample_rate;
+
+	if (filter->sample_window_start != 0 &&
+	    ioloop_time > filter->sample_window_start) {
+		/* rate needed to keep the previous window's matches under
+		   the limit */
+		uint64_t secs = ioloop_time - filter->sample_window_start;
+		uint64_t matches_per_sec = filter->sample_window_matches / secs;
+		uint64_t needed_rate = (matches_per_sec + max - 1) / max;
+
+		if (needed_rate > rate)
+			rate = I_MIN(needed_rate, UINT_MAX);
+	}
+	filter->sample_cur_rate = rate;
+	filter->sample_window_start = ioloop_time;
+	filter->sample_window_matches = 0;
+}
+
+unsigned int event_filter_sample(struct event_filter *filter)
+{
+	if (filter->sample_max_events_per_sec > 0) {
+		if (filter->sample_window_start != ioloop_time)
+			event_filter_sample_update_rate(filter);
+		filter->sample_window_matches++;
+	} else if (filter->sample_rate == 1) {
+		/* sampling disabled */
+		return 1;
+	}
+
+	if (++filter->sample_counter < filter->sample_cur_rate)
+		return 0;
+	filter->sample_counter = 0;
+	return filter->sample_cur_rate;
+}
+
 static void
 event_filter_query_update_category(struct event_filter_query_internal *query,
 				   struct event_filter_node *node,
@@ -58,6 +58,23 @@ event_filter_match_iter_init(struct event_filter *filter, struct event *event,
 void *event_filter_match_iter_next(struct event_filter_match_iter *iter);
 void event_filter_match_iter_deinit(struct event_filter_match_iter **iter);
 
+/* Sample the events matching the filter: only every sample_rate'th matching
+   event is wanted. If max_events_per_sec is non-zero, the rate is
+   recalculated every second so that roughly at most that many events per
+   second are wanted (but never fewer than every sample_rate'th one).
+   sample_rate=1 and max_events_per_sec=0 disables sampling. The sampling
+   settings aren't exported or merged. */
+void event_filter_set_sampling(struct event_filter *filter,
+			       unsigned int sample_rate,
+			       unsigned int max_events_per_sec);
+void event_filter_get_sampling(const struct event_filter *filter,
+			       unsigned int *sample_rate_r,
+			       unsigned int *max_events_per_sec_r);
+/* Make the sampling decision for an event that matched the filter. Returns 0
+   if the event should be skipped, otherwise the number of matching events the
+   wanted event represents (1 if sampling is disabled). */
+unsigned int event_filter_sample(struct event_filter *filter);
+
 void event_filter_init(void);
 void event_filter_deinit(void);
 
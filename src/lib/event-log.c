@@ -315,8 +315,15 @@ bool event_want_level(struct event *event, enum log_type level,
 
 		if (event_filter_match_source(global_debug_send_filter, event,
 					      source_filename, source_linenum,
-					      &ctx))
-			return TRUE;
+					      &ctx)) {
+			/* Make the sampling decision already here, so the
+			   log message isn't formatted for skipped events. */
+			if (event->sending_sample_rate == 0) {
+				event->sending_sample_rate =
+					event_filter_sample(global_debug_send_filter);
+			}
+			return event->sending_sample_rate != 0;
+		}
 	}
 	return FALSE;
 }
@@ -57,6 +57,11 @@ static struct failure_context failure_ctx_error = { .type = LOG_TYPE_ERROR };
 static int log_fd = STDERR_FILENO, log_info_fd = STDERR_FILENO,
 	   log_debug_fd = STDERR_FILENO;
 static char *log_prefix = NULL;
+/* Lines waiting to be written to log_write_buffer_fd, if buffering is
+   enabled with i_set_failure_write_buffer(). */
+static string_t *log_write_buffer = NULL;
+static int log_write_buffer_fd = -1;
+static size_t log_write_buffer_max_size = 0;
 static char *log_stamp_format = NULL, *log_stamp_format_suffix = NULL;
 static bool failure_ignore_errors = FALSE, log_prefix_sent = FALSE;
 static bool coredump_on_error = FALSE;
@@ -95,7 +100,22 @@ static int default_write(enum log_type type, string_t *data, size_t prefix_len A
 		break;
 	}
 	str_append_c(data, '\n');
-	return log_fd_write(fd, str_data(data), str_len(data));
+	if (log_write_buffer_max_size == 0)
+		return log_fd_write(fd, str_data(data), str_len(data));
+
+	if (log_write_buffer_fd != fd || type >= LOG_TYPE_FATAL) {
+		if (i_failure_flush() < 0)
+			return -1;
+	}
+	if (type >= LOG_TYPE_FATAL) {
+		/* the process is about to die - write it immediately */
+		return log_fd_write(fd, str_data(data), str_len(data));
+	}
+	log_write_buffer_fd = fd;
+	str_append_str(log_write_buffer, data);
+	if (str_len(log_write_buffer) < log_write_buffer_max_size)
+		return 0;
+	return i_failure_flush();
 }
 
 static void default_on_handler_failure(const struct failure_context *ctx)
@@ -311,6 +331,8 @@ void failure_exit(int status)
 {
 	static bool recursed = FALSE;
 
+	(void)i_failure_flush();
+
 	if (failure_exit_callback != NULL && !recursed) {
 		recursed = TRUE;
 		failure_exit_callback(&status);
@@ -661,6 +683,7 @@ void i_syslog_error_handler(const struct failure_context *ctx,
 
 void i_set_failure_syslog(const char *ident, int options, int facility)
 {
+	(void)i_failure_flush();
 	openlog(ident, options, facility);
 
 	i_set_fatal_handler(i_syslog_fatal_handler);
@@ -673,6 +696,8 @@ static void open_log_file(int *fd, const char *path)
 {
 	const char *str;
 
+	(void)i_failure_flush();
+
 	if (*fd != STDERR_FILENO) {
 		if (close(*fd) < 0) {
 			str = t_strdup_printf("close(%d) failed: %m\n", *fd);
@@ -700,6 +725,7 @@ static void open_log_file(int *fd, const char *path)
 
 void i_set_failure_file(const char *path, const char *prefix)
 {
+	(void)i_failure_flush();
 	i_set_failure_prefix("%s", prefix);
 
 	if (log_info_fd != STDERR_FILENO && log_info_fd != log_fd) {
@@ -891,6 +917,7 @@ i_internal_error_handler(const struct failure_context *ctx,
 
 void i_set_failure_internal(void)
 {
+	(void)i_failure_flush();
 	fd_set_nonblock(STDERR_FILENO, TRUE);
 	i_set_fatal_handler(i_internal_fatal_handler);
 	i_set_error_handler(i_internal_error_handler);
@@ -962,8 +989,37 @@ void i_set_failure_exit_callback(void (*callback)(int *status))
 	failure_exit_callback = callback;
 }
 
+void i_set_failure_write_buffer(size_t max_size)
+{
+	(void)i_failure_flush();
+	log_write_buffer_max_size = max_size;
+	if (max_size == 0)
+		str_free(&log_write_buffer);
+	else if (log_write_buffer == NULL)
+		log_write_buffer = str_new(default_pool, max_size + 1024);
+}
+
+int i_failure_flush(void)
+{
+	int fd = log_write_buffer_fd;
+	int ret;
+
+	if (log_write_buffer == NULL || str_len(log_write_buffer) == 0)
+		return 0;
+
+	log_write_buffer_fd = -1;
+	ret = log_fd_write(fd, str_data(log_write_buffer),
+			   str_len(log_write_buffer));
+	str_truncate(log_write_buffer, 0);
+	if (ret < 0 && failure_ignore_errors)
+		ret = 0;
+	return ret;
+}
+
 void failures_deinit(void)
 {
+	i_set_failure_write_buffer(0);
+
 	if (log_debug_fd == log_info_fd || log_debug_fd == log_fd)
 		log_debug_fd = STDERR_FILENO;
 
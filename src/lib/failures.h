@@ -146,6 +146,13 @@ void i_set_failure_send_prefix(const char *prefix);
 
 /* Call the callback before exit()ing. The callback may update the status. */
 void i_set_failure_exit_callback(void (*callback)(int *status));
+/* Buffer up to max_size bytes of debug, info, warning and error lines written
+   to log files and write them with a single write() call. The buffer is
+   flushed before writing a fatal or panic line, when changing the log file
+   and when i_failure_flush() is called. 0 disables the buffering. */
+void i_set_failure_write_buffer(size_t max_size);
+/* Write the buffered log lines. Returns 0 on success, -1 if write() failed. */
+int i_failure_flush(void);
 /* Call the exit callback and exit() */
 void failure_exit(int status) ATTR_NORETURN ATTR_COLD;
 
@@ -15,6 +15,8 @@ struct file_cache {
 	void *mmap_base;
 	size_t mmap_length;
 	size_t read_highwater;
+
+	struct mmap_advice advice;
 };
 
 struct file_cache *file_cache_new(int fd)
@@ -54,6 +56,12 @@ void file_cache_set_fd(struct file_cache *cache, int fd)
 	file_cache_invalidate(cache, 0, cache->mmap_length);
 }
 
+void file_cache_set_advice(struct file_cache *cache,
+			   const struct mmap_advice *advice)
+{
+	cache->advice = *advice;
+}
+
 int file_cache_set_size(struct file_cache *cache, uoff_t size)
 {
 	size_t page_size = mmap_get_page_size();
@@ -98,6 +106,7 @@ int file_cache_set_size(struct file_cache *cache, uoff_t size)
 		cache->mmap_base = new_base;
 	}
 	cache->mmap_length = size;
+	mmap_anon_advise(cache->mmap_base, size, &cache->advice);
 	return 0;
 }
 
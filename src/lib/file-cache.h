@@ -1,6 +1,8 @@
 #ifndef FILE_CACHE_H
 #define FILE_CACHE_H
 
+struct mmap_advice;
+
 /* Create a new file cache. It works very much like file-backed mmap()ed
    memory, but it works more nicely with remote filesystems (no SIGBUS). */
 struct file_cache *file_cache_new(int fd);
@@ -11,6 +13,12 @@ void file_cache_free(struct file_cache **cache);
 /* Change cached file descriptor. Invalidates the whole cache. */
 void file_cache_set_fd(struct file_cache *cache, int fd);
 
+/* Set advice for the cache's memory mapping. Only the huge page advice is
+   used, since the cache is filled with read(). It's used the next time
+   file_cache_set_size() grows the mapping. */
+void file_cache_set_advice(struct file_cache *cache,
+			   const struct mmap_advice *advice);
+
 /* Change the memory allocated for the cache. This can be used to immediately
    set the maximum size so there's no need to grow the memory area with
    possibly slow copying. */
@@ -5,13 +5,36 @@
 #include "lib.h"
 #include "hash.h"
 #include "primes.h"
+#include "byteorder.h"
 
 #include <ctype.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 #define HASH_TABLE_MIN_SIZE 67
 
+/* Flat (open addressing) tables are probed in groups of control bytes. With
+   SSE2 a group of 16 bytes is compared with a single instruction, otherwise
+   8 bytes are compared at once within an uint64_t. */
+#ifdef __SSE2__
+#  define HASH_FLAT_GROUP_WIDTH 16
+typedef uint32_t hash_flat_mask_t;
+#else
+#  define HASH_FLAT_GROUP_WIDTH 8
+typedef uint64_t hash_flat_mask_t;
+#endif
+#define HASH_FLAT_MIN_SIZE 16
+/* Control byte values. Full slots contain the lowest 7 bits of the hash. */
+#define HASH_FLAT_CTRL_EMPTY 0x80
+#define HASH_FLAT_CTRL_DELETED 0xfe
+/* Maximum load factor is 7/8 */
+#define HASH_FLAT_MAX_LOAD(size) ((size) - (size) / 8)
+
 #undef hash_table_create
 #undef hash_table_create_direct
+#undef hash_table_create_flat
+#undef hash_table_create_direct_flat
 #undef hash_table_destroy
 #undef hash_table_clear
 #undef hash_table_lookup
@@ -32,6 +55,11 @@ struct hash_node {
 	void *value;
 };
 
+struct hash_flat_slot {
+	void *key;
+	void *value;
+};
+
 struct hash_table {
 	pool_t node_pool;
 
@@ -42,6 +70,20 @@ struct hash_table {
 	struct hash_node *nodes;
 	struct hash_node *free_nodes;
 
+	/* Flat tables: size is a power of two and there are size slots and
+	   size + HASH_FLAT_GROUP_WIDTH control bytes. The last control bytes
+	   mirror the first ones, so a group can be read starting from any
+	   slot. */
+	bool flat;
+	unsigned int iter_count;
+	/* Number of DELETED control bytes */
+	unsigned int deleted_count;
+	/* Number of EMPTY slots that can still be filled before the table
+	   needs to be rehashed */
+	unsigned int growth_left;
+	uint8_t *ctrl;
+	struct hash_flat_slot *slots;
+
 	hash_callback_t *hash_cb;
 	hash_cmp_callback_t *key_compare_cb;
 };
@@ -59,6 +101,8 @@ enum hash_table_operation{
 };
 
 static bool hash_table_resize(struct hash_table *table, bool grow);
+static void hash_flat_alloc(struct hash_table *table, unsigned int size);
+static void hash_flat_maybe_shrink(struct hash_table *table);
 
 void hash_table_create(struct hash_table **table_r, pool_t node_pool,
 		       unsigned int initial_size, hash_callback_t *hash_cb,
@@ -98,6 +142,328 @@ void hash_table_create_direct(struct hash_table **table_r, pool_t node_pool,
 			  direct_hash, direct_cmp);
 }
 
+static unsigned int hash_flat_size_for_count(unsigned int count)
+{
+	size_t size = nearest_power((size_t)count + count / 7 + 1);
+
+	i_assert(size <= UINT_MAX / 2);
+	return I_MAX(size, HASH_FLAT_MIN_SIZE);
+}
+
+void hash_table_create_flat(struct hash_table **table_r, pool_t node_pool,
+			    unsigned int initial_size,
+			    hash_callback_t *hash_cb,
+			    hash_cmp_callback_t *key_compare_cb)
+{
+	struct hash_table *table;
+
+	pool_ref(node_pool);
+	table = i_new(struct hash_table, 1);
+	table->node_pool = node_pool;
+	table->flat = TRUE;
+	table->initial_size = hash_flat_size_for_count(initial_size);
+
+	table->hash_cb = hash_cb;
+	table->key_compare_cb = key_compare_cb;
+
+	hash_flat_alloc(table, table->initial_size);
+	*table_r = table;
+}
+
+void hash_table_create_direct_flat(struct hash_table **table_r,
+				   pool_t node_pool,
+				   unsigned int initial_size)
+{
+	hash_table_create_flat(table_r, node_pool, initial_size,
+			       direct_hash, direct_cmp);
+}
+
+/*
+ * Flat table implementation. This is a "Swiss table": each slot has a control
+ * byte telling whether it's empty, deleted or full. Full slots' control bytes
+ * contain 7 bits of the hash, so most key comparisons against non-matching
+ * slots are avoided by comparing a whole group of control bytes at once.
+ */
+
+static inline unsigned int hash_flat_mask_first(hash_flat_mask_t mask)
+{
+	i_assert(mask != 0);
+#ifdef __SSE2__
+	return __builtin_ctz(mask);
+#else
+	return __builtin_ctzll(mask) / 8;
+#endif
+}
+
+#ifdef __SSE2__
+static inline hash_flat_mask_t
+hash_flat_group_match(const uint8_t *ctrl, uint8_t h2)
+{
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+}
+
+static inline hash_flat_mask_t hash_flat_group_match_empty(const uint8_t *ctrl)
+{
+	return hash_flat_group_match(ctrl, HASH_FLAT_CTRL_EMPTY);
+}
+
+static inline hash_flat_mask_t
+hash_flat_group_match_empty_or_deleted(const uint8_t *ctrl)
+{
+	/* both EMPTY and DELETED have the highest bit set */
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+#else
+#define HASH_FLAT_LSBS 0x0101010101010101ULL
+#define HASH_FLAT_MSBS 0x8080808080808080ULL
+
+static inline hash_flat_mask_t
+hash_flat_group_match(const uint8_t *ctrl, uint8_t h2)
+{
+	/* This may give false positives for bytes following a real match,
+	   but the callers compare the keys anyway. */
+	uint64_t x = le64_to_cpu_unaligned(ctrl) ^ (HASH_FLAT_LSBS * h2);
+
+	return (x - HASH_FLAT_LSBS) & ~x & HASH_FLAT_MSBS;
+}
+
+static inline hash_flat_mask_t hash_flat_group_match_empty(const uint8_t *ctrl)
+{
+	/* EMPTY is the only value with the highest bit set and bit 1 unset */
+	uint64_t x = le64_to_cpu_unaligned(ctrl);
+
+	return x & ~(x << 6) & HASH_FLAT_MSBS;
+}
+
+static inline hash_flat_mask_t
+hash_flat_group_match_empty_or_deleted(const uint8_t *ctrl)
+{
+	return le64_to_cpu_unaligned(ctrl) & HASH_FLAT_MSBS;
+}
+#endif
+
+static inline uint64_t ATTR_NO_SANITIZE_INTEGER
+hash_flat_mix(unsigned int hash)
+{
+	/* Many of the hash functions (especially the direct pointer hash)
+	   have poor lower bits, which would cause long probe sequences. */
+	return (uint64_t)hash * 0x9e3779b97f4a7c15ULL;
+}
+
+static inline unsigned int hash_flat_h1(uint64_t mixed)
+{
+	return (unsigned int)(mixed >> 32);
+}
+
+static inline uint8_t hash_flat_h2(uint64_t mixed)
+{
+	return (mixed >> 25) & 0x7f;
+}
+
+static void hash_flat_set_ctrl(struct hash_table *table, unsigned int idx,
+			       uint8_t value)
+{
+	table->ctrl[idx] = value;
+	if (idx < HASH_FLAT_GROUP_WIDTH)
+		table->ctrl[table->size + idx] = value;
+}
+
+static void hash_flat_alloc(struct hash_table *table, unsigned int size)
+{
+	i_assert(bits_is_power_of_two(size));
+	i_assert(size >= HASH_FLAT_GROUP_WIDTH);
+
+	/* slots and control bytes are allocated with a single allocation */
+	table->size = size;
+	table->slots = i_malloc(sizeof(struct hash_flat_slot) * size +
+				size + HASH_FLAT_GROUP_WIDTH);
+	table->ctrl = (uint8_t *)(table->slots + size);
+	memset(table->ctrl, HASH_FLAT_CTRL_EMPTY, size + HASH_FLAT_GROUP_WIDTH);
+	table->nodes_count = 0;
+	table->deleted_count = 0;
+	table->growth_left = HASH_FLAT_MAX_LOAD(size);
+}
+
+/* Calls the code block for each probed group. The group starting position is
+   in the pos variable. The probes go through the groups using triangular
+   numbers, which visits every group when the size is a power of two. */
+#define HASH_FLAT_PROBE_FOREACH(table, h1, pos) \
+	for (unsigned int pos = (h1) & ((table)->size - 1), _probe_step = 0; ; \
+	     _probe_step += HASH_FLAT_GROUP_WIDTH, \
+	     pos = (pos + _probe_step) & ((table)->size - 1))
+
+static struct hash_flat_slot *
+hash_flat_lookup_slot(const struct hash_table *table, const void *key)
+{
+	uint64_t mixed = hash_flat_mix(table->hash_cb(key));
+	uint8_t h2 = hash_flat_h2(mixed);
+	hash_flat_mask_t mask;
+	unsigned int idx;
+
+	HASH_FLAT_PROBE_FOREACH(table, hash_flat_h1(mixed), pos) {
+		const uint8_t *group = table->ctrl + pos;
+
+		mask = hash_flat_group_match(group, h2);
+		while (mask != 0) {
+			idx = (pos + hash_flat_mask_first(mask)) &
+				(table->size - 1);
+			if (table->ctrl[idx] == h2 &&
+			    table->key_compare_cb(table->slots[idx].key,
+						  key) == 0)
+				return &table->slots[idx];
+			mask &= mask - 1;
+		}
+		if (hash_flat_group_match_empty(group) != 0)
+			return NULL;
+	}
+}
+
+static unsigned int
+hash_flat_find_free(const struct hash_table *table, unsigned int h1)
+{
+	hash_flat_mask_t mask;
+
+	/* there's always at least one EMPTY slot */
+	HASH_FLAT_PROBE_FOREACH(table, h1, pos) {
+		mask = hash_flat_group_match_empty_or_deleted(table->ctrl + pos);
+		if (mask != 0) {
+			return (pos + hash_flat_mask_first(mask)) &
+				(table->size - 1);
+		}
+	}
+}
+
+static void
+hash_flat_insert_new(struct hash_table *table, uint64_t mixed,
+		     void *key, void *value)
+{
+	unsigned int idx = hash_flat_find_free(table, hash_flat_h1(mixed));
+
+	if (table->ctrl[idx] == HASH_FLAT_CTRL_DELETED)
+		table->deleted_count--;
+	else {
+		i_assert(table->growth_left > 0);
+		table->growth_left--;
+	}
+	hash_flat_set_ctrl(table, idx, hash_flat_h2(mixed));
+	table->slots[idx].key = key;
+	table->slots[idx].value = value;
+	table->nodes_count++;
+}
+
+static void hash_flat_rehash(struct hash_table *table, unsigned int new_size)
+{
+	struct hash_flat_slot *old_slots = table->slots;
+	const uint8_t *old_ctrl = table->ctrl;
+	unsigned int i, old_size = table->size;
+
+	/* The slots move around, so any iteration would skip or duplicate
+	   nodes. */
+	i_assert(table->iter_count == 0);
+
+	hash_flat_alloc(table, new_size);
+	for (i = 0; i < old_size; i++) {
+		if ((old_ctrl[i] & 0x80) != 0)
+			continue;
+		hash_flat_insert_new(table,
+				     hash_flat_mix(table->hash_cb(old_slots[i].key)),
+				     old_slots[i].key, old_slots[i].value);
+	}
+	i_free(old_slots);
+}
+
+static void
+hash_flat_insert(struct hash_table *table, void *key, void *value,
+		 enum hash_table_operation opcode)
+{
+	struct hash_flat_slot *slot;
+	uint64_t mixed;
+	unsigned int idx;
+
+	i_assert(table->nodes_count < UINT_MAX / 2);
+	i_assert(key != NULL);
+
+	slot = hash_flat_lookup_slot(table, key);
+	if (slot != NULL) {
+		i_assert(opcode == HASH_TABLE_OP_UPDATE);
+		slot->value = value;
+		return;
+	}
+
+	mixed = hash_flat_mix(table->hash_cb(key));
+	if (table->growth_left == 0) {
+		idx = hash_flat_find_free(table, hash_flat_h1(mixed));
+		if (table->ctrl[idx] != HASH_FLAT_CTRL_DELETED) {
+			/* Out of EMPTY slots. If most of the used slots are
+			   tombstones, rehashing to the same size is enough. */
+			if (table->nodes_count < HASH_FLAT_MAX_LOAD(table->size) / 2)
+				hash_flat_rehash(table, table->size);
+			else
+				hash_flat_rehash(table, table->size * 2);
+		}
+	}
+	hash_flat_insert_new(table, mixed, key, value);
+}
+
+static bool hash_flat_try_remove(struct hash_table *table, const void *key)
+{
+	struct hash_flat_slot *slot;
+	unsigned int idx;
+
+	slot = hash_flat_lookup_slot(table, key);
+	if (slot == NULL)
+		return FALSE;
+
+	/* Leave a tombstone, since there may be other keys whose probe
+	   sequence went through this slot. They're cleaned up when the table
+	   is rehashed. */
+	idx = slot - table->slots;
+	hash_flat_set_ctrl(table, idx, HASH_FLAT_CTRL_DELETED);
+	slot->key = NULL;
+	slot->value = NULL;
+	table->nodes_count--;
+	table->deleted_count++;
+
+	if (table->frozen == 0)
+		hash_flat_maybe_shrink(table);
+	return TRUE;
+}
+
+static void hash_flat_maybe_shrink(struct hash_table *table)
+{
+	unsigned int new_size;
+
+	i_assert(table->frozen == 0);
+
+	if (table->size <= table->initial_size ||
+	    table->nodes_count >= table->size / 8)
+		return;
+	new_size = I_MAX(hash_flat_size_for_count(table->nodes_count * 2),
+			 table->initial_size);
+	if (new_size < table->size)
+		hash_flat_rehash(table, new_size);
+}
+
+static bool
+hash_flat_iterate(struct hash_iterate_context *ctx,
+		  void **key_r, void **value_r)
+{
+	struct hash_table *table = ctx->table;
+
+	for (; ctx->pos < table->size; ctx->pos++) {
+		if ((table->ctrl[ctx->pos] & 0x80) == 0) {
+			*key_r = table->slots[ctx->pos].key;
+			*value_r = table->slots[ctx->pos].value;
+			ctx->pos++;
+			return TRUE;
+		}
+	}
+	*key_r = *value_r = NULL;
+	return FALSE;
+}
+
 static void free_node(struct hash_table *table, struct hash_node *node)
 {
 	if (!table->node_pool->alloconly_pool)
@@ -139,7 +505,9 @@ void hash_table_destroy(struct hash_table **_table)
 
 	i_assert(table->frozen == 0);
 
-	if (!table->node_pool->alloconly_pool) {
+	if (table->flat)
+		i_free(table->slots);
+	else if (!table->node_pool->alloconly_pool) {
 		hash_table_destroy_nodes(table);
 		destroy_node_list(table, table->free_nodes);
 	}
@@ -153,6 +521,15 @@ void hash_table_clear(struct hash_table *table, bool free_nodes)
 {
 	i_assert(table->frozen == 0);
 
+	if (table->flat) {
+		memset(table->ctrl, HASH_FLAT_CTRL_EMPTY,
+		       table->size + HASH_FLAT_GROUP_WIDTH);
+		table->nodes_count = 0;
+		table->deleted_count = 0;
+		table->growth_left = HASH_FLAT_MAX_LOAD(table->size);
+		return;
+	}
+
 	if (!table->node_pool->alloconly_pool)
 		hash_table_destroy_nodes(table);
 
@@ -191,6 +568,11 @@ void *hash_table_lookup(const struct hash_table *table, const void *key)
 {
 	struct hash_node *node;
 
+	if (table->flat) {
+		struct hash_flat_slot *slot = hash_flat_lookup_slot(table, key);
+		return slot != NULL ? slot->value : NULL;
+	}
+
 	node = hash_table_lookup_node(table, key, table->hash_cb(key));
 	return node != NULL ? node->value : NULL;
 }
@@ -201,6 +583,16 @@ bool hash_table_lookup_full(const struct hash_table *table,
 {
 	struct hash_node *node;
 
+	if (table->flat) {
+		struct hash_flat_slot *slot =
+			hash_flat_lookup_slot(table, lookup_key);
+		if (slot == NULL)
+			return FALSE;
+		*orig_key = slot->key;
+		*value = slot->value;
+		return TRUE;
+	}
+
 	node = hash_table_lookup_node(table, lookup_key,
 				      table->hash_cb(lookup_key));
 	if (node == NULL)
@@ -297,12 +689,18 @@ hash_table_insert_node(struct hash_table *table, void *key, void *value,
 
 void hash_table_insert(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
+	if (table->flat)
+		hash_flat_insert(table, key, value, HASH_TABLE_OP_INSERT);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_INSERT);
 }
 
 void hash_table_update(struct hash_table *table, void *key, void *value)
 {
-	hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
+	if (table->flat)
+		hash_flat_insert(table, key, value, HASH_TABLE_OP_UPDATE);
+	else
+		hash_table_insert_node(table, key, value, HASH_TABLE_OP_UPDATE);
 }
 
 static void
@@ -347,6 +745,9 @@ bool hash_table_try_remove(struct hash_table *table, const void *key)
 	struct hash_node *node;
 	unsigned int hash;
 
+	if (table->flat)
+		return hash_flat_try_remove(table, key);
+
 	hash = table->hash_cb(key);
 
 	node = hash_table_lookup_node(table, key, hash);
@@ -376,7 +777,10 @@ struct hash_iterate_context *hash_table_iterate_init(struct hash_table *table)
 
 	ctx = i_new(struct hash_iterate_context, 1);
 	ctx->table = table;
-	ctx->next = &table->nodes[0];
+	if (table->flat)
+		table->iter_count++;
+	else
+		ctx->next = &table->nodes[0];
 	return ctx;
 }
 
@@ -403,6 +807,9 @@ bool hash_table_iterate(struct hash_iterate_context *ctx,
 {
 	struct hash_node *node;
 
+	if (ctx->table->flat)
+		return hash_flat_iterate(ctx, key_r, value_r);
+
 	node = ctx->next;
 	if (node != NULL && node->key == NULL)
 		node = hash_table_iterate_next(ctx, node);
@@ -425,6 +832,10 @@ void hash_table_iterate_deinit(struct hash_iterate_context **_ctx)
 		return;
 
 	*_ctx = NULL;
+	if (ctx->table->flat) {
+		i_assert(ctx->table->iter_count > 0);
+		ctx->table->iter_count--;
+	}
 	hash_table_thaw(ctx->table);
 	i_free(ctx);
 }
@@ -441,6 +852,10 @@ void hash_table_thaw(struct hash_table *table)
 	if (--table->frozen > 0)
 		return;
 
+	if (table->flat) {
+		hash_flat_maybe_shrink(table);
+		return;
+	}
 	if (table->removed_count > 0) {
 		if (!hash_table_resize(table, FALSE))
 			hash_table_compress_removed(table);
@@ -17,6 +17,8 @@ struct io *io_notify_fd_add(struct ioloop_notify_fd_context *ctx, int fd,
 	io->io.context = context;
 	io->io.ioloop = current_ioloop;
 	io->fd = fd;
+	/* don't call it for an event that is already being handled */
+	io->call_id = ctx->call_id;
 
 	if (ctx->notifies != NULL) {
 		ctx->notifies->prev = io;
@@ -39,17 +41,49 @@ void io_notify_fd_free(struct ioloop_notify_fd_context *ctx,
 	i_free(io);
 }
 
-struct io_notify *
-io_notify_fd_find(struct ioloop_notify_fd_context *ctx, int fd)
+static struct io_notify *
+io_notify_fd_find_uncalled(struct ioloop_notify_fd_context *ctx, int fd)
 {
 	struct io_notify *io;
 
 	for (io = ctx->notifies; io != NULL; io = io->next) {
-		if (io->fd == fd)
+		if (io->fd == fd && io->call_id != ctx->call_id)
 			return io;
 	}
-
 	return NULL;
 }
 
+void io_notify_fd_call(struct ioloop_notify_fd_context *ctx, int fd,
+		       bool removed)
+{
+	struct io_notify *io;
+
+	/* the callbacks may remove any of the IOs, so look up the next one
+	   again after each call */
+	ctx->call_id++;
+	while ((io = io_notify_fd_find_uncalled(ctx, fd)) != NULL) {
+		io->call_id = ctx->call_id;
+		io_loop_call_io(&io->io);
+	}
+
+	if (removed) {
+		for (io = ctx->notifies; io != NULL; io = io->next) {
+			if (io->fd == fd)
+				io->fd = -1;
+		}
+	}
+}
+
+bool io_notify_fd_is_shared(struct ioloop_notify_fd_context *ctx,
+			    struct io_notify *io)
+{
+	struct io_notify *io2;
+
+	for (io2 = ctx->notifies; io2 != NULL; io2 = io2->next) {
+		if (io2 != io && io2->fd == io->fd)
+			return TRUE;
+	}
+	return FALSE;
+}
+
 #endif
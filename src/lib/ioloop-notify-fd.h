@@ -10,10 +10,13 @@ struct io_notify {
 	struct io_notify *prev, *next;
 
 	int fd;
+	/* ioloop_notify_fd_context.call_id when the callback was last called */
+	unsigned int call_id;
 };
 
 struct ioloop_notify_fd_context {
 	struct io_notify *notifies;
+	unsigned int call_id;
 };
 
 struct io *
@@ -22,7 +25,13 @@ io_notify_fd_add(struct ioloop_notify_fd_context *ctx, int fd,
 void io_notify_fd_free(struct ioloop_notify_fd_context *ctx,
 		       struct io_notify *io);
 
-struct io_notify *
-io_notify_fd_find(struct ioloop_notify_fd_context *ctx, int fd);
+/* Call the callbacks of all the notify IOs using the fd. The same file may
+   be watched by multiple IOs, which all share the same fd. If removed=TRUE,
+   the fd is no longer valid afterwards. */
+void io_notify_fd_call(struct ioloop_notify_fd_context *ctx, int fd,
+		       bool removed);
+/* Returns TRUE if another notify IO is still using the same fd as io. */
+bool io_notify_fd_is_shared(struct ioloop_notify_fd_context *ctx,
+			    struct io_notify *io);
 
 #endif
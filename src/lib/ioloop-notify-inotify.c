@@ -37,7 +37,6 @@ static bool inotify_input_more(struct ioloop *ioloop)
 		ioloop->notify_handler_context;
         const struct inotify_event *event;
 	unsigned char event_buf[INOTIFY_BUFLEN];
-	struct io_notify *io;
 	ssize_t ret, pos;
 
 	/* read as many events as there is available and fit into our buffer.
@@ -62,15 +61,10 @@ static bool inotify_input_more(struct ioloop *ioloop)
 		i_assert(event->len < (size_t)ret);
 		pos += sizeof(*event) + event->len;
 
-		io = io_notify_fd_find(&ctx->fd_ctx, event->wd);
-		if (io != NULL) {
-			if ((event->mask & IN_IGNORED) != 0) {
-				/* calling inotify_rm_watch() would now give
-				   EINVAL */
-				io->fd = -1;
-			}
-			io_loop_call_io(&io->io);
-		}
+		/* calling inotify_rm_watch() would give EINVAL after
+		   IN_IGNORED */
+		io_notify_fd_call(&ctx->fd_ctx, event->wd,
+				  (event->mask & IN_IGNORED) != 0);
 	}
 	if (pos != ret)
 		i_error("read(inotify) returned partial event");
@@ -136,8 +130,11 @@ void io_loop_notify_remove(struct io *_io)
 		_io->ioloop->notify_handler_context;
 	struct io_notify *io = (struct io_notify *)_io;
 
-	if (io->fd != -1) {
-		/* ernro=EINVAL happens if the file itself is deleted and
+	if (io->fd != -1 && !io_notify_fd_is_shared(&ctx->fd_ctx, io)) {
+		/* inotify returns the same watch descriptor when the same
+		   path is added multiple times, so remove it only after
+		   the last IO using it is gone.
+		   ernro=EINVAL happens if the file itself is deleted and
 		   kernel has sent IN_IGNORED event which we haven't read. */
 		if (inotify_rm_watch(ctx->inotify_fd, io->fd) < 0 &&
 		    errno != EINVAL)
@@ -2,6 +2,7 @@
 #define IOLOOP_PRIVATE_H
 
 #include "priorityq.h"
+#include "timer-wheel.h"
 #include "ioloop.h"
 #include "array-decl.h"
 
@@ -17,6 +18,9 @@ struct ioloop {
 	struct io_file *io_files;
 	struct io_file *next_io_file;
 	struct priorityq *timeouts;
+	/* Long timeouts (timeout_add*() with msecs >= 1000) are kept in the
+	   timer wheel, since they're often reset. */
+	struct timer_wheel *timeouts_wheel;
 	ARRAY(struct timeout *) timeouts_new;
 	struct io_wait_timer *wait_timers;
 
@@ -69,6 +73,7 @@ struct io_file {
 
 struct timeout {
 	struct priorityq_item item;
+	struct timer_wheel_item wheel_item;
 	const char *source_filename;
 	unsigned int source_linenum;
 
@@ -82,6 +87,8 @@ struct timeout {
 	struct ioloop_context *ctx;
 
 	bool one_shot:1;
+	/* timeout is in timeouts_wheel instead of timeouts priorityq */
+	bool coarse:1;
 };
 
 struct io_wait_timer {
@@ -0,0 +1,493 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+
+#include "lib.h"
+#include "array.h"
+#include "fd-util.h"
+#include "sleep.h"
+#include "ioloop-private.h"
+#include "ioloop-iolist.h"
+
+#ifdef IOLOOP_URING
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/* Number of submission queue entries. Each wakeup normally needs only one
+   SQE per fd that fired, so this doesn't need to scale with the number of
+   fds. If the queue fills up, the pending SQEs are flushed early. */
+#define IOLOOP_URING_SQ_ENTRIES 256
+
+/* user_data for SQEs whose completions are ignored (poll removals) */
+#define IOLOOP_URING_USER_DATA_IGNORE ((uint64_t)-1)
+
+struct io_uring_fd {
+	struct io_list list;
+	int fd;
+
+	/* Incremented whenever the armed poll request is cancelled, so that
+	   completions for the old request can be recognized and ignored. */
+	uint32_t generation;
+	/* poll() events that the currently armed request waits for */
+	unsigned int armed_events;
+	bool armed:1;
+};
+
+struct io_uring_event {
+	struct io_uring_fd *ufd;
+	int res;
+};
+
+struct ioloop_handler_context {
+	int ring_fd;
+	unsigned int active_count;
+	ARRAY(struct io_uring_fd *) fd_index;
+	ARRAY(struct io_uring_cqe) cqes;
+	ARRAY(struct io_uring_event) events;
+
+	void *sq_ptr, *cq_ptr;
+	size_t sq_ptr_size, cq_ptr_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cq_entries;
+
+	/* SQEs added to the ring, but not yet submitted to kernel */
+	unsigned int sq_unsubmitted;
+};
+
+static int
+sys_io_uring_setup(unsigned int entries, struct io_uring_params *params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		   unsigned int flags, const void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			    flags, arg, argsz);
+}
+
+static void *
+io_uring_mmap(struct ioloop_handler_context *ctx, size_t size, off_t offset)
+{
+	void *ptr;
+
+	ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ctx->ring_fd, offset);
+	if (ptr == MAP_FAILED)
+		i_fatal("mmap(io_uring, offset=%lld) failed: %m",
+			(long long)offset);
+	return ptr;
+}
+
+void io_loop_handler_init(struct ioloop *ioloop, unsigned int initial_fd_count)
+{
+	struct ioloop_handler_context *ctx;
+	struct io_uring_params params;
+
+	ioloop->handler_context = ctx = i_new(struct ioloop_handler_context, 1);
+	i_array_init(&ctx->fd_index, initial_fd_count);
+	i_array_init(&ctx->cqes, IOLOOP_URING_SQ_ENTRIES * 2);
+	i_array_init(&ctx->events, IOLOOP_URING_SQ_ENTRIES * 2);
+
+	i_zero(&params);
+	ctx->ring_fd = sys_io_uring_setup(IOLOOP_URING_SQ_ENTRIES, &params);
+	if (ctx->ring_fd < 0) {
+		if (errno != EMFILE && errno != ENOMEM)
+			i_fatal("io_uring_setup(): %m");
+		else {
+			i_fatal("io_uring_setup(): %m (you may need to increase "
+				"RLIMIT_MEMLOCK or the number of open files)");
+		}
+	}
+	if ((params.features & IORING_FEAT_EXT_ARG) == 0) {
+		i_fatal("io_uring_setup(): Kernel doesn't support "
+			"IORING_FEAT_EXT_ARG (Linux v5.11+ required) - "
+			"rebuild with a different --with-ioloop");
+	}
+	fd_close_on_exec(ctx->ring_fd, TRUE);
+
+	ctx->sq_ptr_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned int);
+	ctx->cq_ptr_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		ctx->sq_ptr_size = ctx->cq_ptr_size =
+			I_MAX(ctx->sq_ptr_size, ctx->cq_ptr_size);
+	}
+	ctx->sq_ptr = io_uring_mmap(ctx, ctx->sq_ptr_size, IORING_OFF_SQ_RING);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+		ctx->cq_ptr = ctx->sq_ptr;
+	else {
+		ctx->cq_ptr = io_uring_mmap(ctx, ctx->cq_ptr_size,
+					    IORING_OFF_CQ_RING);
+	}
+	ctx->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sqes = io_uring_mmap(ctx, ctx->sqes_size, IORING_OFF_SQES);
+
+	ctx->sq_head = PTR_OFFSET(ctx->sq_ptr, params.sq_off.head);
+	ctx->sq_tail = PTR_OFFSET(ctx->sq_ptr, params.sq_off.tail);
+	ctx->sq_mask = PTR_OFFSET(ctx->sq_ptr, params.sq_off.ring_mask);
+	ctx->sq_array = PTR_OFFSET(ctx->sq_ptr, params.sq_off.array);
+	ctx->cq_head = PTR_OFFSET(ctx->cq_ptr, params.cq_off.head);
+	ctx->cq_tail = PTR_OFFSET(ctx->cq_ptr, params.cq_off.tail);
+	ctx->cq_mask = PTR_OFFSET(ctx->cq_ptr, params.cq_off.ring_mask);
+	ctx->cq_entries = PTR_OFFSET(ctx->cq_ptr, params.cq_off.cqes);
+}
+
+void io_loop_handler_deinit(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	struct io_uring_fd **list;
+	unsigned int i, count;
+
+	list = array_get_modifiable(&ctx->fd_index, &count);
+	for (i = 0; i < count; i++)
+		i_free(list[i]);
+
+	if (munmap(ctx->sqes, ctx->sqes_size) < 0)
+		i_error("munmap(io_uring sqes) failed: %m");
+	if (ctx->cq_ptr != ctx->sq_ptr &&
+	    munmap(ctx->cq_ptr, ctx->cq_ptr_size) < 0)
+		i_error("munmap(io_uring cq) failed: %m");
+	if (munmap(ctx->sq_ptr, ctx->sq_ptr_size) < 0)
+		i_error("munmap(io_uring sq) failed: %m");
+	if (close(ctx->ring_fd) < 0)
+		i_error("close(io_uring) failed: %m");
+	array_free(&ctx->fd_index);
+	array_free(&ctx->cqes);
+	array_free(&ctx->events);
+	i_free(ioloop->handler_context);
+}
+
+static void io_uring_submit(struct ioloop_handler_context *ctx)
+{
+	int ret;
+
+	while (ctx->sq_unsubmitted > 0) {
+		ret = sys_io_uring_enter(ctx->ring_fd, ctx->sq_unsubmitted,
+					 0, 0, NULL, 0);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EBUSY) {
+				/* completion queue is full - the caller
+				   will reap the completions and retry */
+				return;
+			}
+			i_fatal("io_uring_enter(submit) failed: %m");
+		}
+		i_assert((unsigned int)ret <= ctx->sq_unsubmitted);
+		ctx->sq_unsubmitted -= ret;
+	}
+}
+
+static struct io_uring_sqe *io_uring_get_sqe(struct ioloop_handler_context *ctx)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int head, tail, idx;
+
+	tail = *ctx->sq_tail;
+	head = __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE);
+	if (tail - head > *ctx->sq_mask) {
+		/* submission queue is full - flush it */
+		io_uring_submit(ctx);
+		head = __atomic_load_n(ctx->sq_head, __ATOMIC_ACQUIRE);
+		if (tail - head > *ctx->sq_mask)
+			i_panic("io_uring: Submission queue stays full");
+	}
+
+	idx = tail & *ctx->sq_mask;
+	sqe = &ctx->sqes[idx];
+	i_zero(sqe);
+	ctx->sq_array[idx] = idx;
+	__atomic_store_n(ctx->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ctx->sq_unsubmitted++;
+	return sqe;
+}
+
+#define IO_URING_ERROR (POLLERR | POLLHUP)
+#define IO_URING_INPUT (POLLIN | POLLPRI | IO_URING_ERROR)
+#define IO_URING_OUTPUT (POLLOUT | IO_URING_ERROR)
+
+static unsigned int io_uring_event_mask(struct io_list *list)
+{
+	unsigned int events = 0;
+	struct io_file *io;
+	int i;
+
+	for (i = 0; i < IOLOOP_IOLIST_IOS_PER_FD; i++) {
+		io = list->ios[i];
+
+		if (io == NULL)
+			continue;
+
+		if ((io->io.condition & IO_READ) != 0)
+			events |= IO_URING_INPUT;
+		if ((io->io.condition & IO_WRITE) != 0)
+			events |= IO_URING_OUTPUT;
+		if ((io->io.condition & IO_ERROR) != 0)
+			events |= IO_URING_ERROR;
+	}
+	return events;
+}
+
+static uint64_t io_uring_fd_user_data(const struct io_uring_fd *ufd)
+{
+	return ((uint64_t)(unsigned int)ufd->fd << 32) | ufd->generation;
+}
+
+static void
+io_uring_fd_disarm(struct ioloop_handler_context *ctx, struct io_uring_fd *ufd)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!ufd->armed)
+		return;
+
+	/* The poll request keeps a reference to the file, so it must be
+	   cancelled explicitly even if the fd was already closed. */
+	sqe = io_uring_get_sqe(ctx);
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = io_uring_fd_user_data(ufd);
+	sqe->user_data = IOLOOP_URING_USER_DATA_IGNORE;
+
+	ufd->generation++;
+	ufd->armed = FALSE;
+}
+
+static void
+io_uring_fd_arm(struct ioloop_handler_context *ctx, struct io_uring_fd *ufd)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int events = io_uring_event_mask(&ufd->list);
+
+	if (ufd->armed) {
+		if (ufd->armed_events == events)
+			return;
+		io_uring_fd_disarm(ctx, ufd);
+	}
+	if (events == 0)
+		return;
+
+	sqe = io_uring_get_sqe(ctx);
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = ufd->fd;
+	sqe->poll32_events = events;
+	sqe->user_data = io_uring_fd_user_data(ufd);
+
+	ufd->armed_events = events;
+	ufd->armed = TRUE;
+}
+
+void io_loop_handle_add(struct io_file *io)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct io_uring_fd **ufdp, *ufd;
+
+	ufdp = array_idx_get_space(&ctx->fd_index, io->fd);
+	if (*ufdp == NULL) {
+		*ufdp = i_new(struct io_uring_fd, 1);
+		(*ufdp)->fd = io->fd;
+	}
+	ufd = *ufdp;
+
+	if (ioloop_iolist_add(&ufd->list, io))
+		ctx->active_count++;
+	io_uring_fd_arm(ctx, ufd);
+	/* Submit immediately, so that the completions are ordered the same
+	   way as with epoll: an fd that is already readable completes
+	   before fds that become readable later. Only the rearming after
+	   the callbacks is batched with the next wait. */
+	io_uring_submit(ctx);
+}
+
+void io_loop_handle_remove(struct io_file *io, bool closed ATTR_UNUSED)
+{
+	struct ioloop_handler_context *ctx = io->io.ioloop->handler_context;
+	struct io_uring_fd *ufd;
+
+	ufd = array_idx_elem(&ctx->fd_index, io->fd);
+	if (ioloop_iolist_del(&ufd->list, io)) {
+		i_assert(ctx->active_count > 0);
+		ctx->active_count--;
+		io_uring_fd_disarm(ctx, ufd);
+	} else {
+		io_uring_fd_arm(ctx, ufd);
+	}
+	/* a closed fd stays referenced by the poll request until the removal
+	   is submitted */
+	io_uring_submit(ctx);
+	i_free(io);
+}
+
+static void
+io_uring_wait(struct ioloop_handler_context *ctx, int msecs,
+	      const struct timeval *tv)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int head, tail;
+	int ret;
+
+	i_zero(&arg);
+	if (msecs >= 0) {
+		ts.tv_sec = tv->tv_sec;
+		ts.tv_nsec = tv->tv_usec * 1000LL;
+		arg.ts = (uintptr_t)&ts;
+	}
+
+	head = *ctx->cq_head;
+	tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+	if (head != tail && ctx->sq_unsubmitted == 0) {
+		/* completions are already waiting */
+		return;
+	}
+
+	/* submit the pending poll changes and wait for completions with
+	   a single syscall */
+	ret = sys_io_uring_enter(ctx->ring_fd, ctx->sq_unsubmitted,
+				 head != tail ? 0 : 1,
+				 IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+				 &arg, sizeof(arg));
+	if (ret < 0) {
+		if (errno != EINTR && errno != ETIME &&
+		    errno != EAGAIN && errno != EBUSY)
+			i_fatal("io_uring_enter(): %m");
+	} else {
+		i_assert((unsigned int)ret <= ctx->sq_unsubmitted);
+		ctx->sq_unsubmitted -= ret;
+	}
+}
+
+static void io_uring_reap(struct ioloop_handler_context *ctx)
+{
+	const struct io_uring_cqe *cqe;
+	unsigned int head, tail;
+
+	array_clear(&ctx->cqes);
+	head = *ctx->cq_head;
+	tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		cqe = &ctx->cq_entries[head & *ctx->cq_mask];
+		if (cqe->user_data != IOLOOP_URING_USER_DATA_IGNORE)
+			array_push_back(&ctx->cqes, cqe);
+	}
+	__atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static struct io_uring_fd *
+io_uring_cqe_get_fd(struct ioloop_handler_context *ctx,
+		    const struct io_uring_cqe *cqe)
+{
+	struct io_uring_fd *const *ufdp;
+	unsigned int fd = cqe->user_data >> 32;
+
+	if (fd >= array_count(&ctx->fd_index))
+		return NULL;
+	ufdp = array_idx(&ctx->fd_index, fd);
+	if (*ufdp == NULL || !(*ufdp)->armed ||
+	    io_uring_fd_user_data(*ufdp) != cqe->user_data) {
+		/* completion for an already cancelled request */
+		return NULL;
+	}
+	return *ufdp;
+}
+
+static bool io_uring_event_matches(const struct io_file *io, int res)
+{
+	if (res < 0 || (res & (POLLHUP | POLLERR | POLLNVAL)) != 0)
+		return TRUE;
+	if ((io->io.condition & IO_READ) != 0)
+		return (res & (POLLIN | POLLPRI)) != 0;
+	if ((io->io.condition & IO_WRITE) != 0)
+		return (res & POLLOUT) != 0;
+	if ((io->io.condition & IO_ERROR) != 0)
+		return (res & IO_URING_ERROR) != 0;
+	return FALSE;
+}
+
+void io_loop_handler_run_internal(struct ioloop *ioloop)
+{
+	struct ioloop_handler_context *ctx = ioloop->handler_context;
+	const struct io_uring_cqe *cqes;
+	struct io_uring_event *event;
+	struct io_uring_fd *ufd;
+	struct io_file *io;
+	struct timeval tv;
+	unsigned int i, count;
+	int msecs, j;
+
+	i_assert(ctx != NULL);
+
+	/* get the time left for next timeout task */
+	msecs = io_loop_run_get_wait_time(ioloop, &tv);
+
+	if (ioloop->io_files != NULL && ctx->active_count > 0)
+		io_uring_wait(ctx, msecs, &tv);
+	else {
+		/* no I/Os, but we should have some timeouts.
+		   just wait for them. */
+		i_assert(msecs >= 0);
+		io_uring_submit(ctx);
+		i_sleep_intr_msecs(msecs);
+	}
+	io_uring_reap(ctx);
+
+	/* Poll requests are one-shot, so they're no longer armed after they
+	   completed. They're rearmed after the callbacks are called. */
+	array_clear(&ctx->events);
+	cqes = array_get(&ctx->cqes, &count);
+	for (i = 0; i < count; i++) {
+		ufd = io_uring_cqe_get_fd(ctx, &cqes[i]);
+		if (ufd == NULL)
+			continue;
+		ufd->armed = FALSE;
+		ufd->generation++;
+
+		event = array_append_space(&ctx->events);
+		event->ufd = ufd;
+		event->res = cqes[i].res;
+	}
+
+	/* execute timeout handlers */
+	io_loop_handle_timeouts(ioloop);
+
+	count = array_count(&ctx->events);
+	for (i = 0; i < count && ioloop->running; i++) {
+		/* io_loop_handle_add() never frees the io_uring_fds, so the
+		   pointers stay valid even if the callbacks change the ios */
+		event = array_idx_modifiable(&ctx->events, i);
+		ufd = event->ufd;
+
+		for (j = 0; j < IOLOOP_IOLIST_IOS_PER_FD; j++) {
+			io = ufd->list.ios[j];
+			if (io == NULL || !io_uring_event_matches(io, event->res))
+				continue;
+
+			io_loop_call_io(&io->io);
+			if (!ioloop->running)
+				break;
+		}
+	}
+
+	/* Rearm all the fired fds, including the ones whose callbacks weren't
+	   called because the ioloop was stopped. Arming is a no-op if a
+	   callback already did it. */
+	for (i = 0; i < count; i++) {
+		event = array_idx_modifiable(&ctx->events, i);
+		io_uring_fd_arm(ctx, event->ufd);
+	}
+}
+
+#endif	/* IOLOOP_URING */
@@ -19,6 +19,12 @@
    logging many warnings about this, use a rather high value. */
 #define IOLOOP_TIME_MOVED_FORWARDS_MIN_USECS (100000)
 
+/* Timeouts added with timeout_add*() (not _short) with at least this many
+   milliseconds are kept in the timer wheel instead of the priority queue.
+   They're typically idle/keepalive timeouts that are reset all the time, and
+   the timer wheel makes timeout_reset() O(1). */
+#define IOLOOP_TIMER_WHEEL_MIN_MSECS 1000
+
 time_t ioloop_time = 0;
 struct timeval ioloop_timeval;
 struct ioloop *current_ioloop = NULL;
@@ -254,6 +260,40 @@ static void timeout_update_next(struct timeout *timeout, struct timeval *tv_now)
 	}
 }
 
+static uint64_t timeval_to_wheel_tick(const struct timeval *tv)
+{
+	return (uint64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+static bool timeout_is_queued(const struct timeout *timeout)
+{
+	return timeout->item.idx != UINT_MAX ||
+		timer_wheel_item_is_added(&timeout->wheel_item);
+}
+
+static void timeout_queue_add(struct timeout *timeout)
+{
+	struct ioloop *ioloop = timeout->ioloop;
+
+	if (timeout->coarse) {
+		/* next_run is already truncated to milliseconds */
+		timer_wheel_add(ioloop->timeouts_wheel, &timeout->wheel_item,
+				timeval_to_wheel_tick(&timeout->next_run));
+	} else {
+		priorityq_add(ioloop->timeouts, &timeout->item);
+	}
+}
+
+static void timeout_queue_remove(struct timeout *timeout)
+{
+	struct ioloop *ioloop = timeout->ioloop;
+
+	if (timeout->coarse)
+		timer_wheel_remove(ioloop->timeouts_wheel, &timeout->wheel_item);
+	else
+		priorityq_remove(ioloop->timeouts, &timeout->item);
+}
+
 static struct timeout *
 timeout_add_common(struct ioloop *ioloop, const char *source_filename,
 		   unsigned int source_linenum,
@@ -263,6 +303,7 @@ timeout_add_common(struct ioloop *ioloop, const char *source_filename,
 
 	timeout = i_new(struct timeout, 1);
 	timeout->item.idx = UINT_MAX;
+	timer_wheel_item_init(&timeout->wheel_item);
 	timeout->source_filename = source_filename;
 	timeout->source_linenum = source_linenum;
 	timeout->ioloop = ioloop;
@@ -278,17 +319,17 @@ timeout_add_common(struct ioloop *ioloop, const char *source_filename,
 	return timeout;
 }
 
-#undef timeout_add_to
-struct timeout *timeout_add_to(struct ioloop *ioloop, unsigned int msecs,
-			       const char *source_filename,
-			       unsigned int source_linenum,
-			       timeout_callback_t *callback, void *context)
+static struct timeout *
+timeout_add_to_full(struct ioloop *ioloop, unsigned int msecs, bool coarse,
+		    const char *source_filename, unsigned int source_linenum,
+		    timeout_callback_t *callback, void *context)
 {
 	struct timeout *timeout;
 
 	timeout = timeout_add_common(ioloop, source_filename, source_linenum,
 				     callback, context);
 	timeout->msecs = msecs;
+	timeout->coarse = coarse && msecs >= IOLOOP_TIMER_WHEEL_MIN_MSECS;
 
 	if (msecs > 0) {
 		/* start this timeout in the next run cycle */
@@ -304,6 +345,17 @@ struct timeout *timeout_add_to(struct ioloop *ioloop, unsigned int msecs,
 	return timeout;
 }
 
+#undef timeout_add_to
+struct timeout *timeout_add_to(struct ioloop *ioloop, unsigned int msecs,
+			       const char *source_filename,
+			       unsigned int source_linenum,
+			       timeout_callback_t *callback, void *context)
+{
+	return timeout_add_to_full(ioloop, msecs, TRUE,
+				   source_filename, source_linenum,
+				   callback, context);
+}
+
 #undef timeout_add
 struct timeout *timeout_add(unsigned int msecs, const char *source_filename,
 			    unsigned int source_linenum,
@@ -320,9 +372,9 @@ timeout_add_short_to(struct ioloop *ioloop, unsigned int msecs,
 		     const char *source_filename, unsigned int source_linenum,
 		     timeout_callback_t *callback, void *context)
 {
-	return timeout_add_to(ioloop, msecs,
-			      source_filename, source_linenum,
-			      callback, context);
+	return timeout_add_to_full(ioloop, msecs, FALSE,
+				   source_filename, source_linenum,
+				   callback, context);
 }
 
 #undef timeout_add_short
@@ -331,8 +383,9 @@ timeout_add_short(unsigned int msecs, const char *source_filename,
 		  unsigned int source_linenum,
 		  timeout_callback_t *callback, void *context)
 {
-	return timeout_add(msecs, source_filename, source_linenum,
-			   callback, context);
+	return timeout_add_short_to(current_ioloop, msecs,
+				    source_filename, source_linenum,
+				    callback, context);
 }
 
 #undef timeout_add_absolute_to
@@ -374,11 +427,12 @@ timeout_copy(const struct timeout *old_to, struct ioloop *ioloop)
 		old_to->source_filename, old_to->source_linenum,
 		old_to->callback, old_to->context);
 	new_to->one_shot = old_to->one_shot;
+	new_to->coarse = old_to->coarse;
 	new_to->msecs = old_to->msecs;
 	new_to->next_run = old_to->next_run;
 
-	if (old_to->item.idx != UINT_MAX)
-		priorityq_add(new_to->ioloop->timeouts, &new_to->item);
+	if (timeout_is_queued(old_to))
+		timeout_queue_add(new_to);
 	else if (!new_to->one_shot) {
 		i_assert(new_to->msecs > 0);
 		array_push_back(&new_to->ioloop->timeouts_new, &new_to);
@@ -405,8 +459,8 @@ void timeout_remove(struct timeout **_timeout)
 	ioloop = timeout->ioloop;
 
 	*_timeout = NULL;
-	if (timeout->item.idx != UINT_MAX)
-		priorityq_remove(timeout->ioloop->timeouts, &timeout->item);
+	if (timeout_is_queued(timeout))
+		timeout_queue_remove(timeout);
 	else if (!timeout->one_shot && timeout->msecs > 0) {
 		struct timeout *const *to_idx;
 		array_foreach(&ioloop->timeouts_new, to_idx) {
@@ -423,8 +477,16 @@ void timeout_remove(struct timeout **_timeout)
 static void ATTR_NULL(2)
 timeout_reset_timeval(struct timeout *timeout, struct timeval *tv_now)
 {
-	if (timeout->item.idx == UINT_MAX)
+	if (!timeout_is_queued(timeout))
+		return;
+
+	if (timeout->coarse) {
+		timer_wheel_remove(timeout->ioloop->timeouts_wheel,
+				   &timeout->wheel_item);
+		timeout_update_next(timeout, tv_now);
+		timeout_queue_add(timeout);
 		return;
+	}
 
 	timeout_update_next(timeout, tv_now);
 	/* If we came here from io_loop_handle_timeouts_real(), next_run must
@@ -450,8 +512,9 @@ void timeout_reset(struct timeout *timeout)
 	timeout_reset_timeval(timeout, NULL);
 }
 
-static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
-				 struct timeval *tv_now, bool in_timeout_loop)
+static int timeout_get_wait_time(const struct timeval *next_run,
+				 struct timeval *tv_r, struct timeval *tv_now,
+				 bool in_timeout_loop)
 {
 	int ret;
 
@@ -461,10 +524,10 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 	tv_r->tv_usec = tv_now->tv_usec;
 
 	i_assert(tv_r->tv_sec > 0);
-	i_assert(timeout->next_run.tv_sec > 0);
+	i_assert(next_run->tv_sec > 0);
 
-	tv_r->tv_sec = timeout->next_run.tv_sec - tv_r->tv_sec;
-	tv_r->tv_usec = timeout->next_run.tv_usec - tv_r->tv_usec;
+	tv_r->tv_sec = next_run->tv_sec - tv_r->tv_sec;
+	tv_r->tv_usec = next_run->tv_usec - tv_r->tv_usec;
 	if (tv_r->tv_usec < 0) {
 		tv_r->tv_sec--;
 		tv_r->tv_usec += 1000000;
@@ -493,18 +556,21 @@ static int timeout_get_wait_time(struct timeout *timeout, struct timeval *tv_r,
 
 static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 {
-	struct timeval tv_now;
+	struct timeval tv_now, wheel_next_run, wheel_tv;
 	struct priorityq_item *item;
 	struct timeout *timeout;
-	int msecs;
+	uint64_t wheel_tick;
+	int msecs, wheel_msecs;
 
 	item = priorityq_peek(ioloop->timeouts);
 	timeout = (struct timeout *)item;
+	wheel_tick = timer_wheel_get_next_tick(ioloop->timeouts_wheel);
 
 	/* we need to see if there are pending IO waiting,
 	   if there is, we set msecs = 0 to ensure they are
 	   processed without delay */
-	if (timeout == NULL && ioloop->io_pending_count == 0) {
+	if (timeout == NULL && wheel_tick == (uint64_t)-1 &&
+	    ioloop->io_pending_count == 0) {
 		/* no timeouts. use INT_MAX msecs for timeval and
 		   return -1 for poll/epoll infinity. */
 		tv_r->tv_sec = INT_MAX / 1000;
@@ -521,7 +587,20 @@ static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 		tv_r->tv_usec = 0;
 	} else {
 		tv_now.tv_sec = 0;
-		msecs = timeout_get_wait_time(timeout, tv_r, &tv_now, FALSE);
+		msecs = timeout == NULL ? -1 :
+			timeout_get_wait_time(&timeout->next_run, tv_r,
+					      &tv_now, FALSE);
+		if (wheel_tick != (uint64_t)-1) {
+			wheel_next_run.tv_sec = wheel_tick / 1000;
+			wheel_next_run.tv_usec = (wheel_tick % 1000) * 1000;
+			wheel_msecs = timeout_get_wait_time(&wheel_next_run,
+							    &wheel_tv, &tv_now,
+							    TRUE);
+			if (msecs < 0 || wheel_msecs < msecs) {
+				msecs = wheel_msecs;
+				*tv_r = wheel_tv;
+			}
+		}
 	}
 	ioloop->next_max_time = tv_now;
 	timeval_add_msecs(&ioloop->next_max_time, msecs);
@@ -531,7 +610,8 @@ static int io_loop_get_wait_time(struct ioloop *ioloop, struct timeval *tv_r)
 	   ioloop and after that we update ioloop_timeval immediately again. */
 	ioloop_timeval = tv_now;
 	ioloop_time = tv_now.tv_sec;
-	i_assert(msecs == 0 || timeout->msecs > 0 || timeout->one_shot);
+	i_assert(msecs == 0 || timeout == NULL ||
+		 timeout->msecs > 0 || timeout->one_shot);
 	return msecs;
 }
 
@@ -587,25 +667,48 @@ static void io_loop_timeouts_start_new(struct ioloop *ioloop)
 		i_assert(!timeout->one_shot);
 		i_assert(timeout->msecs > 0);
 		timeout_update_next(timeout, &ioloop_timeval);
-		priorityq_add(ioloop->timeouts, &timeout->item);
+		timeout_queue_add(timeout);
 	}
 	array_clear(&ioloop->timeouts_new);
 }
 
+static void timeout_move_next_run(struct timeout *to, long long diff_usecs)
+{
+	if (diff_usecs > 0)
+		timeval_add_usecs(&to->next_run, diff_usecs);
+	else
+		timeval_sub_usecs(&to->next_run, -diff_usecs);
+}
+
 static void io_loop_timeouts_update(struct ioloop *ioloop, long long diff_usecs)
 {
 	struct priorityq_item *const *items;
+	struct timer_wheel_item *wheel_item;
+	ARRAY(struct timeout *) wheel_timeouts;
+	struct timeout *to;
 	unsigned int i, count;
 
 	count = priorityq_count(ioloop->timeouts);
 	items = priorityq_items(ioloop->timeouts);
 	for (i = 0; i < count; i++) {
-		struct timeout *to = (struct timeout *)items[i];
+		to = (struct timeout *)items[i];
+		timeout_move_next_run(to, diff_usecs);
+	}
 
-		if (diff_usecs > 0)
-			timeval_add_usecs(&to->next_run, diff_usecs);
-		else
-			timeval_sub_usecs(&to->next_run, -diff_usecs);
+	/* The timer wheel's current time can't be moved backwards, so
+	   recreate the whole wheel. This happens rarely enough. */
+	t_array_init(&wheel_timeouts,
+		     timer_wheel_count(ioloop->timeouts_wheel) + 1);
+	while ((wheel_item = timer_wheel_pop_any(ioloop->timeouts_wheel)) != NULL) {
+		to = container_of(wheel_item, struct timeout, wheel_item);
+		array_push_back(&wheel_timeouts, &to);
+	}
+	timer_wheel_deinit(&ioloop->timeouts_wheel);
+	ioloop->timeouts_wheel =
+		timer_wheel_init(timeval_to_wheel_tick(&ioloop_timeval));
+	array_foreach_elem(&wheel_timeouts, to) {
+		timeout_move_next_run(to, diff_usecs);
+		timeout_queue_add(to);
 	}
 }
 
@@ -635,12 +738,31 @@ static void ioloop_add_wait_time(struct ioloop *ioloop)
 		timer->usecs += diff;
 }
 
+static void io_loop_call_timeout(struct ioloop *ioloop, struct timeout *timeout)
+{
+	data_stack_frame_t t_id;
+
+	if (timeout->ctx != NULL)
+		io_loop_context_activate(timeout->ctx);
+	t_id = t_push_named("ioloop timeout handler %p",
+			    (void *)timeout->callback);
+	timeout->callback(timeout->context);
+	if (!t_pop(&t_id)) {
+		i_panic("Leaked a t_pop() call in timeout handler %p",
+			(void *)timeout->callback);
+	}
+	if (ioloop->cur_ctx != NULL)
+		io_loop_context_deactivate(ioloop->cur_ctx);
+	i_assert(ioloop == current_ioloop);
+}
+
 static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 {
 	struct priorityq_item *item;
+	struct timer_wheel_item *wheel_item;
 	struct timeval tv_old, tv, tv_call;
 	long long diff_usecs;
-	data_stack_frame_t t_id;
+	uint64_t now_tick;
 
 	tv_old = ioloop_timeval;
 	i_gettimeofday(&ioloop_timeval);
@@ -675,7 +797,8 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 
 		/* use tv_call to make sure we don't get to infinite loop in
 		   case callbacks update ioloop_timeval. */
-		if (timeout_get_wait_time(timeout, &tv, &tv_call, TRUE) > 0)
+		if (timeout_get_wait_time(&timeout->next_run, &tv,
+					  &tv_call, TRUE) > 0)
 			break;
 
 		if (timeout->one_shot) {
@@ -686,18 +809,21 @@ static void io_loop_handle_timeouts_real(struct ioloop *ioloop)
 			timeout_reset_timeval(timeout, &tv_call);
 		}
 
-		if (timeout->ctx != NULL)
-			io_loop_context_activate(timeout->ctx);
-		t_id = t_push_named("ioloop timeout handler %p",
-				    (void *)timeout->callback);
-		timeout->callback(timeout->context);
-		if (!t_pop(&t_id)) {
-			i_panic("Leaked a t_pop() call in timeout handler %p",
-				(void *)timeout->callback);
-		}
-		if (ioloop->cur_ctx != NULL)
-			io_loop_context_deactivate(ioloop->cur_ctx);
-		i_assert(ioloop == current_ioloop);
+		io_loop_call_timeout(ioloop, timeout);
+	}
+
+	now_tick = timeval_to_wheel_tick(&tv_call);
+	while (ioloop->running &&
+	       (wheel_item = timer_wheel_pop_expired(ioloop->timeouts_wheel,
+						     now_tick)) != NULL) {
+		struct timeout *timeout =
+			container_of(wheel_item, struct timeout, wheel_item);
+
+		/* coarse timeouts are never one-shot */
+		i_assert(!timeout->one_shot);
+		timeout_update_next(timeout, &tv_call);
+		timeout_queue_add(timeout);
+		io_loop_call_timeout(ioloop, timeout);
 	}
 }
 
@@ -841,6 +967,8 @@ struct ioloop *io_loop_create(void)
 
         ioloop = i_new(struct ioloop, 1);
 	ioloop->timeouts = priorityq_init(timeout_cmp, 32);
+	ioloop->timeouts_wheel =
+		timer_wheel_init(timeval_to_wheel_tick(&ioloop_timeval));
 	i_array_init(&ioloop->timeouts_new, 8);
 
 	ioloop->time_moved_callback = current_ioloop != NULL ?
@@ -857,6 +985,7 @@ void io_loop_destroy(struct ioloop **_ioloop)
 	struct ioloop *ioloop = *_ioloop;
 	struct timeout *to;
 	struct priorityq_item *item;
+	struct timer_wheel_item *wheel_item;
 	bool leaks = FALSE;
 
 	*_ioloop = NULL;
@@ -924,6 +1053,22 @@ void io_loop_destroy(struct ioloop **_ioloop)
 	}
 	priorityq_deinit(&ioloop->timeouts);
 
+	while ((wheel_item = timer_wheel_pop_any(ioloop->timeouts_wheel)) != NULL) {
+		to = container_of(wheel_item, struct timeout, wheel_item);
+		const char *error = t_strdup_printf(
+			"Timeout leak: %p (%s:%u)", (void *)to->callback,
+			to->source_filename,
+			to->source_linenum);
+
+		if (panic_on_leak)
+			i_panic("%s", error);
+		else
+			i_warning("%s", error);
+		timeout_free(to);
+		leaks = TRUE;
+	}
+	timer_wheel_deinit(&ioloop->timeouts_wheel);
+
 	while (ioloop->wait_timers != NULL) {
 		struct io_wait_timer *timer = ioloop->wait_timers;
 		const char *error = t_strdup_printf(
@@ -1303,6 +1448,7 @@ bool io_loop_is_empty(struct ioloop *ioloop)
 {
 	return ioloop->io_files == NULL &&
 		priorityq_count(ioloop->timeouts) == 0 &&
+		timer_wheel_count(ioloop->timeouts_wheel) == 0 &&
 		array_count(&ioloop->timeouts_new) == 0;
 }
 
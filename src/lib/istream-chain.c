@@ -271,6 +271,75 @@ static ssize_t i_stream_chain_read(struct istream_private *stream)
 	return ret;
 }
 
+static bool i_stream_chain_read_cur_eof(struct chain_istream *cstream)
+{
+	struct istream_private *stream = &cstream->istream;
+	struct istream *input = cstream->chain.head->stream;
+	const unsigned char *data;
+	size_t size;
+
+	if (input->eof)
+		return input->stream_errno == 0;
+
+	/* All of the link's data is in our buffer. See if it's at EOF
+	   already. The read may change the link's buffer, so point to it
+	   again. */
+	(void)i_stream_read_memarea(input);
+	data = i_stream_get_data(input, &size);
+	stream->buffer = data;
+	stream->skip = cstream->prev_skip = 0;
+	stream->pos = size;
+	return input->eof && input->stream_errno == 0;
+}
+
+static unsigned int
+i_stream_chain_read_iov(struct istream_private *stream,
+			struct const_iovec *iov, unsigned int iov_count)
+{
+	struct chain_istream *cstream =
+		container_of(stream, struct chain_istream, istream);
+	struct istream_chain_link *link = cstream->chain.head, *prev;
+	const unsigned char *data;
+	size_t size;
+	unsigned int count = 1;
+	bool eof;
+
+	/* The following links can be returned only when our buffer points
+	   directly to the current link's data and it contains all of it. */
+	if (!i_stream_chain_skip(cstream) ||
+	    cstream->prev_stream_left > 0 || link->next == NULL ||
+	    link->next->stream == NULL ||
+	    stream->pos - stream->skip !=
+	    i_stream_get_data_size(link->stream) ||
+	    !i_stream_chain_read_cur_eof(cstream))
+		link = NULL;
+	else
+		link = link->next;
+	iov[0].iov_base = stream->buffer + stream->skip;
+	iov[0].iov_len = stream->pos - stream->skip;
+
+	for (; link != NULL && link->stream != NULL && count < iov_count;
+	     link = link->next) {
+		for (prev = cstream->chain.head; prev != link;
+		     prev = prev->next) {
+			if (!i_stream_buffers_are_independent(prev->stream,
+							      link->stream))
+				return count;
+		}
+		/* i_stream_chain_read_next() does the same seek */
+		i_stream_seek(link->stream, 0);
+		eof = i_stream_read_iov_buffer_all(link->stream, &data, &size);
+		if (size > 0) {
+			iov[count].iov_base = data;
+			iov[count].iov_len = size;
+			count++;
+		}
+		if (!eof)
+			break;
+	}
+	return count;
+}
+
 static void i_stream_chain_close(struct iostream_private *stream,
 				 bool close_parent)
 {
@@ -338,6 +407,7 @@ struct istream *i_stream_create_chain(struct istream_chain **chain_r,
 		i_stream_chain_set_max_buffer_size;
 
 	cstream->istream.read = i_stream_chain_read;
+	cstream->istream.read_iov = i_stream_chain_read_iov;
 	cstream->istream.snapshot = i_stream_chain_snapshot;
 
 	cstream->istream.istream.readable_fd = FALSE;
@@ -18,6 +18,9 @@ struct concat_istream {
 };
 
 static void i_stream_concat_skip(struct concat_istream *cstream);
+static void
+i_stream_concat_set_input_size(struct concat_istream *cstream,
+			       unsigned int idx);
 
 static void i_stream_concat_close(struct iostream_private *stream,
 				  bool close_parent)
@@ -79,6 +82,7 @@ static void i_stream_concat_read_next(struct concat_istream *cstream)
 		cstream->prev_stream_skip = 0;
 	}
 
+	i_stream_concat_set_input_size(cstream, cstream->cur_idx);
 	data = i_stream_get_data(cstream->cur_input, &data_size);
 	cstream->cur_idx++;
 	cstream->cur_input = cstream->input[cstream->cur_idx];
@@ -243,6 +247,94 @@ static ssize_t i_stream_concat_read(struct istream_private *stream)
 	return ret;
 }
 
+static void
+i_stream_concat_set_input_size(struct concat_istream *cstream,
+			       unsigned int idx)
+{
+	struct istream *input = cstream->input[idx];
+
+	/* The input is at EOF with all of its data buffered, so its size is
+	   known now. find_v_offset() looks up the sizes in order, so this is
+	   usable only when all the earlier sizes are known. */
+	if (cstream->unknown_size_idx == idx) {
+		cstream->input_size[idx] =
+			input->v_offset + i_stream_get_data_size(input);
+		cstream->unknown_size_idx++;
+	}
+}
+
+static bool i_stream_concat_read_cur_eof(struct concat_istream *cstream)
+{
+	struct istream_private *stream = &cstream->istream;
+	const unsigned char *data;
+	size_t size;
+
+	if (cstream->cur_input->eof)
+		return cstream->cur_input->stream_errno == 0;
+
+	/* All of cur_input's data is in our buffer. See if it's at EOF
+	   already. If more data was read instead, point to its new buffer. */
+	if (i_stream_read(cstream->cur_input) > 0) {
+		data = i_stream_get_data(cstream->cur_input, &size);
+		stream->buffer = data;
+		stream->skip = cstream->prev_skip = 0;
+		stream->pos = size;
+	}
+	return cstream->cur_input->eof && cstream->cur_input->stream_errno == 0;
+}
+
+static unsigned int
+i_stream_concat_read_iov(struct istream_private *stream,
+			 struct const_iovec *iov, unsigned int iov_count)
+{
+	struct concat_istream *cstream =
+		container_of(stream, struct concat_istream, istream);
+	i_assert(cstream->cur_input == cstream->input[cstream->cur_idx]);
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	unsigned int i, idx, count = 1;
+	bool eof;
+
+	/* The following inputs can be returned only when our buffer points
+	   directly to cur_input's data and it contains all of it. */
+	i_stream_concat_skip(cstream);
+	if (cstream->prev_stream_left > 0 ||
+	    cstream->cur_idx + 1 >= cstream->input_count ||
+	    stream->pos - stream->skip !=
+	    i_stream_get_data_size(cstream->cur_input) ||
+	    !i_stream_concat_read_cur_eof(cstream))
+		idx = cstream->input_count;
+	else {
+		i_stream_concat_set_input_size(cstream, cstream->cur_idx);
+		idx = cstream->cur_idx + 1;
+	}
+	iov[0].iov_base = stream->buffer + stream->skip;
+	iov[0].iov_len = stream->pos - stream->skip;
+
+	for (; idx < cstream->input_count && count < iov_count; idx++) {
+		input = cstream->input[idx];
+		for (i = cstream->cur_idx; i < idx; i++) {
+			if (!i_stream_buffers_are_independent(cstream->input[i],
+							      input))
+				return count;
+		}
+		/* Skipping past our buffer seeks to the wanted input.
+		   i_stream_concat_read_next() does the same seek. */
+		i_stream_seek(input, 0);
+		eof = i_stream_read_iov_buffer_all(input, &data, &size);
+		if (size > 0) {
+			iov[count].iov_base = data;
+			iov[count].iov_len = size;
+			count++;
+		}
+		if (!eof)
+			break;
+		i_stream_concat_set_input_size(cstream, idx);
+	}
+	return count;
+}
+
 static int
 find_v_offset(struct concat_istream *cstream, uoff_t *v_offset,
 	      unsigned int *idx_r)
@@ -383,6 +475,7 @@ struct istream *i_stream_create_concat(struct istream *input[])
 	cstream->istream.read = i_stream_concat_read;
 	cstream->istream.seek = i_stream_concat_seek;
 	cstream->istream.stat = i_stream_concat_stat;
+	cstream->istream.read_iov = i_stream_concat_read_iov;
 
 	cstream->istream.istream.readable_fd = FALSE;
 	cstream->istream.istream.blocking = blocking;
@@ -24,6 +24,13 @@ struct istream_private {
 	struct istream_snapshot *
 		(*snapshot)(struct istream_private *stream,
 			    struct istream_snapshot *prev_snapshot);
+	/* Optional: Called by i_stream_read_iov() when the stream has data
+	   buffered. Fill iov[0] with the buffered data and the rest of the
+	   iovecs with the data following it, as long as it's available
+	   without copying. Returns the number of iovecs filled. */
+	unsigned int (*read_iov)(struct istream_private *stream,
+				 struct const_iovec *iov,
+				 unsigned int iov_count);
 
 /* data: */
 	struct istream istream;
@@ -126,6 +133,16 @@ i_stream_default_snapshot(struct istream_private *stream,
 void i_stream_snapshot_free(struct istream_snapshot **snapshot);
 
 struct istream *i_stream_get_root_io(struct istream *stream);
+/* Returns TRUE if reading one of the streams can't invalidate the other
+   stream's buffer, i.e. they don't share any parent stream and neither of
+   them is combining multiple streams. */
+bool i_stream_buffers_are_independent(struct istream *stream1,
+				      struct istream *stream2);
+/* Read the stream for read_iov() implementations. Returns TRUE if all of
+   the stream's remaining data is now buffered. */
+bool i_stream_read_iov_buffer_all(struct istream *stream,
+				  const unsigned char **data_r,
+				  size_t *size_r);
 void i_stream_set_io(struct istream *stream, struct io *io);
 void i_stream_unset_io(struct istream *stream, struct io *io);
 
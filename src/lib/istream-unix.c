@@ -79,6 +79,8 @@ struct istream *i_stream_create_unix(int fd, size_t max_buffer_size)
 					    max_buffer_size, FALSE);
 	input->real_stream->iostream.close = i_stream_unix_close;
 	input->real_stream->read = i_stream_unix_read;
+	/* don't allow bypassing the fd passing with direct reads */
+	input->readable_fd = FALSE;
 	return input;
 }
 
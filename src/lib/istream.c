@@ -828,6 +828,59 @@ int i_stream_read_limited(struct istream *stream, const unsigned char **data_r,
 	return ret;
 }
 
+int i_stream_read_iov(struct istream *stream, struct const_iovec *iov_r,
+		      unsigned int iov_count)
+{
+	struct istream_private *_stream = stream->real_stream;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	i_assert(iov_count > 0);
+
+	if ((ret = i_stream_read_more(stream, &data, &size)) <= 0)
+		return ret;
+	if (iov_count > 1 && _stream->read_iov != NULL)
+		return _stream->read_iov(_stream, iov_r, iov_count);
+
+	iov_r[0].iov_base = data;
+	iov_r[0].iov_len = size;
+	return 1;
+}
+
+static struct istream_private *i_stream_get_root(struct istream *stream)
+{
+	struct istream_private *_stream = stream->real_stream;
+
+	while (_stream->parent != NULL)
+		_stream = _stream->parent->real_stream;
+	return _stream;
+}
+
+bool i_stream_buffers_are_independent(struct istream *stream1,
+				      struct istream *stream2)
+{
+	struct istream_private *root1 = i_stream_get_root(stream1);
+	struct istream_private *root2 = i_stream_get_root(stream2);
+
+	/* streams implementing read_iov() read multiple other streams, which
+	   may share parents with anything */
+	return root1 != root2 &&
+		root1->read_iov == NULL && root2->read_iov == NULL;
+}
+
+bool i_stream_read_iov_buffer_all(struct istream *stream,
+				  const unsigned char **data_r,
+				  size_t *size_r)
+{
+	/* If the first read didn't reach EOF, try once more to see if it
+	   already returned all the data. */
+	if (i_stream_read_more(stream, data_r, size_r) > 0 && !stream->eof)
+		(void)i_stream_read(stream);
+	*data_r = i_stream_get_data(stream, size_r);
+	return stream->eof && stream->stream_errno == 0;
+}
+
 void i_stream_compress(struct istream_private *stream)
 {
 	i_assert(stream->memarea == NULL ||
@@ -241,6 +241,15 @@ i_stream_read_more(struct istream *stream, const unsigned char **data_r,
    limit to avoid confusion. */
 int i_stream_read_limited(struct istream *stream, const unsigned char **data_r,
 			  size_t *size_r, size_t limit);
+/* Like i_stream_read_more(), but return the data in up to iov_count
+   buffers. Streams combining multiple streams (istream-concat and
+   istream-chain) can then return also the data of the following streams
+   without first copying it into their own buffer. The data is skipped with
+   i_stream_skip() as usual. The returned pointers are valid until the next
+   read or skip. Returns the number of iovecs filled, 0 if stream is
+   non-blocking and no data is available, -1 if EOF or error. */
+int i_stream_read_iov(struct istream *stream, struct const_iovec *iov_r,
+		      unsigned int iov_count);
 /* Return the timestamp when istream last successfully read something.
    The timestamp is 0 if nothing has ever been read. */
 void i_stream_get_last_read_time(struct istream *stream, struct timeval *tv_r);
@@ -0,0 +1,20 @@
+#ifndef JSON_PARSER_PRIVATE_H
+#define JSON_PARSER_PRIVATE_H
+
+enum json_scan_impl {
+	JSON_SCAN_IMPL_SCALAR = 0,
+	JSON_SCAN_IMPL_SSE2,
+	JSON_SCAN_IMPL_AVX2,
+};
+
+/* Returns the number of bytes at the beginning of the data that can be
+   copied as-is into a string value, i.e. the position of the first '"',
+   '\\' or NUL. Returns size if there are none. */
+size_t json_scan_string(const unsigned char *data, size_t size);
+
+/* Use the given implementation instead of the best one supported by the CPU.
+   Returns FALSE if the CPU doesn't support it. This is intended for unit
+   tests and benchmarks. */
+bool json_scan_set_impl(enum json_scan_impl impl);
+
+#endif
@@ -0,0 +1,144 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "json-parser-private.h"
+
+/* The string scanning builds a bitmask of the bytes in a block that end the
+   plain part of a string (the same idea as the structural index of
+   simdjson), so that a block without any of them is skipped with a few
+   instructions and the first one is found with a single bit scan. */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(__GNUC__ >= 5 || defined(__clang__))
+#  define JSON_SCAN_X86
+#  include <immintrin.h>
+#  define JSON_TARGET_SSE2 __attribute__((target("sse2")))
+#  define JSON_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#define JSON_WORD_ONES 0x0101010101010101ULL
+#define JSON_WORD_HIGHS 0x8080808080808080ULL
+/* Non-zero if any of the bytes in the word is 0 */
+#define JSON_WORD_HAS_ZERO(word) \
+	(((word) - JSON_WORD_ONES) & ~(word) & JSON_WORD_HIGHS)
+
+static size_t (*json_scan_func)(const unsigned char *data, size_t size) = NULL;
+
+static size_t json_scan_string_scalar(const unsigned char *data, size_t size)
+{
+	const uint64_t quotes = JSON_WORD_ONES * '"';
+	const uint64_t backslashes = JSON_WORD_ONES * '\\';
+	uint64_t word;
+	size_t pos = 0;
+
+	/* check 8 bytes at a time for the special characters and find the
+	   exact position one byte at a time */
+	for (; pos + sizeof(word) <= size; pos += sizeof(word)) {
+		memcpy(&word, data + pos, sizeof(word));
+		if ((JSON_WORD_HAS_ZERO(word) |
+		     JSON_WORD_HAS_ZERO(word ^ quotes) |
+		     JSON_WORD_HAS_ZERO(word ^ backslashes)) != 0)
+			break;
+	}
+	for (; pos < size; pos++) {
+		if (data[pos] == '"' || data[pos] == '\\' || data[pos] == '\0')
+			break;
+	}
+	return pos;
+}
+
+#ifdef JSON_SCAN_X86
+
+static JSON_TARGET_SSE2 size_t
+json_scan_string_sse2(const unsigned char *data, size_t size)
+{
+	const __m128i quotes = _mm_set1_epi8('"');
+	const __m128i backslashes = _mm_set1_epi8('\\');
+	const __m128i zeros = _mm_setzero_si128();
+	__m128i in, special;
+	unsigned int mask;
+	size_t pos;
+
+	for (pos = 0; pos + 16 <= size; pos += 16) {
+		in = _mm_loadu_si128((const void *)(data + pos));
+		special = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(in, quotes),
+				     _mm_cmpeq_epi8(in, backslashes)),
+			_mm_cmpeq_epi8(in, zeros));
+		mask = _mm_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	return pos + json_scan_string_scalar(data + pos, size - pos);
+}
+
+static JSON_TARGET_AVX2 size_t
+json_scan_string_avx2(const unsigned char *data, size_t size)
+{
+	const __m256i quotes = _mm256_set1_epi8('"');
+	const __m256i backslashes = _mm256_set1_epi8('\\');
+	const __m256i zeros = _mm256_setzero_si256();
+	__m256i in, special;
+	unsigned int mask;
+	size_t pos;
+
+	for (pos = 0; pos + 32 <= size; pos += 32) {
+		in = _mm256_loadu_si256((const void *)(data + pos));
+		special = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(in, quotes),
+					_mm256_cmpeq_epi8(in, backslashes)),
+			_mm256_cmpeq_epi8(in, zeros));
+		mask = (unsigned int)_mm256_movemask_epi8(special);
+		if (mask != 0)
+			return pos + __builtin_ctz(mask);
+	}
+	/* the tail may still contain a full 16 byte block */
+	return pos + json_scan_string_sse2(data + pos, size - pos);
+}
+
+#endif
+
+static void json_scan_init(void)
+{
+	json_scan_func = json_scan_string_scalar;
+#ifdef JSON_SCAN_X86
+	__builtin_cpu_init();
+	if (!json_scan_set_impl(JSON_SCAN_IMPL_AVX2))
+		(void)json_scan_set_impl(JSON_SCAN_IMPL_SSE2);
+#endif
+}
+
+bool json_scan_set_impl(enum json_scan_impl impl)
+{
+	switch (impl) {
+	case JSON_SCAN_IMPL_SCALAR:
+		json_scan_func = json_scan_string_scalar;
+		return TRUE;
+	case JSON_SCAN_IMPL_SSE2:
+#ifdef JSON_SCAN_X86
+		if (!__builtin_cpu_supports("sse2"))
+			return FALSE;
+		json_scan_func = json_scan_string_sse2;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	case JSON_SCAN_IMPL_AVX2:
+#ifdef JSON_SCAN_X86
+		if (!__builtin_cpu_supports("avx2"))
+			return FALSE;
+		json_scan_func = json_scan_string_avx2;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	}
+	i_unreached();
+}
+
+size_t json_scan_string(const unsigned char *data, size_t size)
+{
+	if (unlikely(json_scan_func == NULL))
+		json_scan_init();
+	return json_scan_func(data, size);
+}
@@ -8,6 +8,7 @@
 #include "unichar.h"
 #include "istream-jsonstr.h"
 #include "json-parser.h"
+#include "json-parser-private.h"
 
 enum json_state {
 	JSON_STATE_ROOT = 0,
@@ -176,6 +177,10 @@ static bool json_parse_whitespace(struct json_parser *parser)
 static int json_skip_string(struct json_parser *parser)
 {
 	for (; parser->data != parser->end; parser->data++) {
+		parser->data += json_scan_string(parser->data,
+						 parser->end - parser->data);
+		if (parser->data == parser->end)
+			break;
 		if (*parser->data == '"') {
 			parser->data++;
 			json_parser_update_input_pos(parser);
@@ -302,6 +307,14 @@ static int json_parse_string(struct json_parser *parser, bool allow_skip,
 
 	str_truncate(parser->value, 0);
 	for (; parser->data != parser->end; parser->data++) {
+		/* copy the plain part of the string all at once */
+		size_t plain_len = json_scan_string(parser->data,
+						    parser->end - parser->data);
+		str_append_data(parser->value, parser->data, plain_len);
+		parser->data += plain_len;
+		if (parser->data == parser->end)
+			break;
+
 		if (*parser->data == '"') {
 			parser->data++;
 			*value_r = str_c(parser->value);
@@ -345,8 +358,7 @@ static int json_parse_string(struct json_parser *parser, bool allow_skip,
 			parser->error = "NULs not supported in strings";
 			return -1;
 		default:
-			str_append_c(parser->value, *parser->data);
-			break;
+			i_unreached();
 		}
 	}
 	return 0;
@@ -60,6 +60,10 @@ struct event {
 	/* This is the event's name while it's being sent. It'll be removed
 	   after the event is sent. */
 	char *sending_name;
+	/* Sampling decision for the event while it's being sent: 0 if not
+	   decided yet, otherwise the number of sampled events this one
+	   represents. It's reset after the event is sent. */
+	unsigned int sending_sample_rate;
 
 	ARRAY(struct event_category *) categories;
 	ARRAY(struct event_field) fields;
@@ -17,6 +17,7 @@ enum event_code {
 	EVENT_CODE_CATEGORY		= 'c',
 	EVENT_CODE_TV_LAST_SENT		= 'l',
 	EVENT_CODE_SENDING_NAME		= 'n',
+	EVENT_CODE_SAMPLE_RATE		= 'r',
 	EVENT_CODE_SOURCE		= 's',
 
 	EVENT_CODE_FIELD_INTMAX		= 'I',
@@ -261,6 +262,7 @@ struct event *event_flatten(struct event *src)
 	dst = event_create_internal(NULL, src->source_filename,
 				    src->source_linenum);
 	dst = event_set_name(dst, src->sending_name);
+	dst->sending_sample_rate = src->sending_sample_rate;
 
 	if (current_global_event != NULL)
 		event_flatten_recurse(dst, current_global_event, NULL);
@@ -1182,6 +1184,11 @@ struct event *event_get_parent(const struct event *event)
 	return event->parent;
 }
 
+unsigned int event_get_sample_rate(const struct event *event)
+{
+	return event->sending_sample_rate == 0 ? 1 : event->sending_sample_rate;
+}
+
 void event_get_create_time(const struct event *event, struct timeval *tv_r)
 {
 	*tv_r = event->tv_created;
@@ -1261,8 +1268,10 @@ void event_vsend(struct event *event, struct failure_context *ctx,
 
 void event_send_abort(struct event *event)
 {
-	/* if the event is sent again, it needs a new name */
+	/* if the event is sent again, it needs a new name and a new
+	   sampling decision */
 	i_free(event->sending_name);
+	event->sending_sample_rate = 0;
 	if (event->passthrough)
 		event_unref(&event);
 }
@@ -1333,6 +1342,10 @@ void event_export(const struct event *event, string_t *dest)
 		str_append_c(dest, EVENT_CODE_SENDING_NAME);
 		str_append_tabescaped(dest, event->sending_name);
 	}
+	if (event->sending_sample_rate > 1) {
+		str_printfa(dest, "\t%c%u", EVENT_CODE_SAMPLE_RATE,
+			    event->sending_sample_rate);
+	}
 
 	if (array_is_created(&event->categories)) {
 		struct event_category *cat;
@@ -1504,6 +1517,13 @@ event_import_arg(struct event *event, const char *const **_args,
 		i_free(event->sending_name);
 		event->sending_name = i_strdup(arg);
 		break;
+	case EVENT_CODE_SAMPLE_RATE:
+		if (str_to_uint(arg, &event->sending_sample_rate) < 0 ||
+		    event->sending_sample_rate == 0) {
+			*error_r = "Invalid sample rate";
+			return FALSE;
+		}
+		break;
 	case EVENT_CODE_SOURCE: {
 		unsigned int linenum;
 
@@ -381,6 +381,10 @@ void event_field_clear(struct event *event, const char *key);
 
 /* Returns the parent event, or NULL if it doesn't exist. */
 struct event *event_get_parent(const struct event *event);
+/* Returns how many events the event represents when it was sent through
+   a sampling event filter (see event_filter_set_sampling()). Returns 1 if
+   the event wasn't sampled. */
+unsigned int event_get_sample_rate(const struct event *event);
 /* Get the event's creation time. */
 void event_get_create_time(const struct event *event, struct timeval *tv_r);
 /* Get the time when the event was last sent. Returns TRUE if time was
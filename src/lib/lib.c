@@ -198,6 +198,7 @@ void lib_deinit(void)
 	restrict_access_deinit();
 	i_close_fd(&dev_null_fd);
 	data_stack_deinit();
+	pool_alloconly_block_cache_deinit();
 	failures_deinit();
 	process_title_deinit();
 	random_deinit();
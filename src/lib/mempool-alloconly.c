@@ -111,6 +111,16 @@
  * Since the pool structure itself is allocated from the first block, this
  * final call to free() will release the memory allocated for struct
  * alloconly_pool and struct pool.
+ *
+ * Block recycling
+ * ---------------
+ *
+ * Many alloconly pools are short-lived, so instead of free()ing a block it
+ * may be given to a process-wide block cache, which keeps a few blocks of
+ * each common (power of two) size.  block_alloc() first looks for a block
+ * of the wanted size from the cache before calling calloc().  Since the
+ * unused part of a block is always zero, only the used part needs to be
+ * cleared when the block is put to the cache.
  */
 
 #ifndef DEBUG
@@ -149,6 +159,21 @@ struct pool_block {
 
 #define DEFAULT_BASE_SIZE MEM_ALIGN(sizeof(struct alloconly_pool))
 
+/* The recycled block sizes are 2^MIN_BITS .. 2^MAX_BITS, including the
+   block header. */
+#define BLOCK_CACHE_MIN_BITS 6
+#define BLOCK_CACHE_MAX_BITS 15
+#define BLOCK_CACHE_CLASS_COUNT \
+	(BLOCK_CACHE_MAX_BITS - BLOCK_CACHE_MIN_BITS + 1)
+/* Maximum number of cached blocks per size */
+#define BLOCK_CACHE_MAX_COUNT 8
+
+struct pool_block_cache_class {
+	struct pool_block *blocks[BLOCK_CACHE_MAX_COUNT];
+	unsigned int count;
+};
+static struct pool_block_cache_class block_cache[BLOCK_CACHE_CLASS_COUNT];
+
 #ifdef DEBUG
 #  define CLEAR_CHR 0xde
 #  define SENTRY_COUNT 8
@@ -278,18 +303,75 @@ pool_t pool_alloconly_create_clean(const char *name, size_t size)
 	return pool;
 }
 
+static struct pool_block_cache_class *block_cache_get_class(size_t size)
+{
+	unsigned int bits;
+
+	if (size < (1U << BLOCK_CACHE_MIN_BITS) ||
+	    size > (1U << BLOCK_CACHE_MAX_BITS) ||
+	    (size & (size - 1)) != 0)
+		return NULL;
+	for (bits = BLOCK_CACHE_MIN_BITS; ((size_t)1 << bits) != size; bits++) ;
+	return &block_cache[bits - BLOCK_CACHE_MIN_BITS];
+}
+
+static struct pool_block *block_cache_get(size_t size)
+{
+	struct pool_block_cache_class *class = block_cache_get_class(size);
+	struct pool_block *block;
+
+	if (class == NULL || class->count == 0) {
+		mempool_global_stats.alloconly_block_cache_misses++;
+		return NULL;
+	}
+	mempool_global_stats.alloconly_block_cache_hits++;
+	block = class->blocks[--class->count];
+	memset(block, 0, SIZEOF_POOLBLOCK);
+	return block;
+}
+
+static bool
+block_cache_put(struct pool_block *block, size_t size, size_t dirty_size)
+{
+	struct pool_block_cache_class *class = block_cache_get_class(size);
+
+	if (class == NULL || class->count == BLOCK_CACHE_MAX_COUNT) {
+		mempool_global_stats.alloconly_block_cache_frees++;
+		return FALSE;
+	}
+	mempool_global_stats.alloconly_block_cache_puts++;
+	memset(POOL_BLOCK_DATA(block), 0, dirty_size);
+	class->blocks[class->count++] = block;
+	return TRUE;
+}
+
+void pool_alloconly_block_cache_deinit(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < N_ELEMENTS(block_cache); i++) {
+		while (block_cache[i].count > 0)
+			free(block_cache[i].blocks[--block_cache[i].count]);
+	}
+}
+
 static void pool_alloconly_free_block(struct alloconly_pool *apool ATTR_UNUSED,
 				      struct pool_block *block)
 {
+	size_t alloc_size = SIZEOF_POOLBLOCK + block->size;
+	size_t dirty_size = block->size - block->left;
+
 #ifdef DEBUG
-	safe_memset(block, CLEAR_CHR, SIZEOF_POOLBLOCK + block->size);
+	safe_memset(block, CLEAR_CHR, alloc_size);
+	dirty_size = alloc_size - SIZEOF_POOLBLOCK;
 #else
 	if (apool->clean_frees) {
-		safe_memset(block, CLEAR_CHR,
-			    SIZEOF_POOLBLOCK + block->size);
+		safe_memset(block, CLEAR_CHR, alloc_size);
+		dirty_size = 0;
 	}
 #endif
-	free(block);
+	if (!block_cache_put(block, alloc_size, dirty_size))
+		free(block);
 }
 
 static void
@@ -380,7 +462,9 @@ static void block_alloc(struct alloconly_pool *apool, size_t size)
 #endif
 	}
 
-	block = calloc(size, 1);
+	block = block_cache_get(size);
+	if (block == NULL)
+		block = calloc(size, 1);
 	if (unlikely(block == NULL)) {
 		i_fatal_status(FATAL_OUTOFMEM, "block_alloc(%zu"
 			       "): Out of memory", size);
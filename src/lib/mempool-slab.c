@@ -0,0 +1,410 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+#include "lib.h"
+#include "mempool.h"
+#include "llist.h"
+
+/*
+ * Slab pools support both allocating and freeing memory, but unlike
+ * allocfree pools they don't call malloc() and free() for each small
+ * allocation.
+ *
+ * Implementation
+ * ==============
+ *
+ * Allocations are rounded up to the nearest size class (16, 32, .., 1024
+ * bytes).  Each size class allocates larger slabs (struct slab) from the
+ * system heap and carves them into objects of the class size as needed.
+ * Each object is preceded by a header that contains the object's class, so
+ * p_free() knows where the object needs to be returned.  Freed objects are
+ * put to the class's free list, from which the following allocations are
+ * served first.  The free list pointer is stored in the object's data.
+ *
+ *                 +-------------+
+ *                 |  slab pool  |
+ *                 +-------------+
+ *   class[i].free |             | slabs
+ *      /----------/             \-----> slab ---> slab ---> ... NULL
+ *      |
+ *      \---> object ---> object ---> ... NULL
+ *
+ * Allocations that are larger than the largest size class are allocated
+ * directly with calloc().  They're kept in a doubly linked list so they can
+ * be freed when the pool is cleared.
+ *
+ * Reallocation
+ * ------------
+ *
+ * If the new size still fits into the object's size class, the object is
+ * resized in place.  Otherwise a new object is allocated, the data is
+ * copied there and the old object is freed.  Large allocations are
+ * realloc()ed.
+ *
+ * Clearing
+ * --------
+ *
+ * Clearing the pool frees all the slabs and large allocations and empties
+ * the free lists.
+ *
+ * Destruction
+ * -----------
+ *
+ * Destroying a pool first clears it and then frees the pool structure.
+ */
+
+#define SLAB_MIN_CLASS_BITS 4
+#define SLAB_MAX_CLASS_BITS 10
+#define SLAB_CLASS_COUNT (SLAB_MAX_CLASS_BITS - SLAB_MIN_CLASS_BITS + 1)
+#define SLAB_CLASS_SIZE(class_idx) \
+	((size_t)1 << ((class_idx) + SLAB_MIN_CLASS_BITS))
+#define SLAB_MAX_CLASS_SIZE SLAB_CLASS_SIZE(SLAB_CLASS_COUNT - 1)
+/* Header's class index for large allocations */
+#define SLAB_CLASS_LARGE UINT_MAX
+
+/* Slabs are allocated with this size, except that each slab is large enough
+   for at least SLAB_MIN_OBJECTS objects. */
+#define SLAB_SIZE 8192
+#define SLAB_MIN_OBJECTS 8
+
+struct slab_object_header {
+	unsigned int class_idx;
+};
+#define SIZEOF_SLAB_OBJECT_HEADER MEM_ALIGN(sizeof(struct slab_object_header))
+
+struct slab {
+	struct slab *next;
+	size_t size;
+	/* unsigned char data[]; */
+};
+#define SIZEOF_SLAB MEM_ALIGN(sizeof(struct slab))
+
+struct slab_large_block {
+	struct slab_large_block *prev, *next;
+	size_t size;
+	/* struct slab_object_header header; */
+	/* unsigned char data[]; */
+};
+#define SIZEOF_SLAB_LARGE_BLOCK MEM_ALIGN(sizeof(struct slab_large_block))
+
+struct slab_free_object {
+	struct slab_free_object *next;
+};
+
+struct slab_class {
+	/* freed objects */
+	struct slab_free_object *free;
+	/* not yet used space in the newest slab */
+	unsigned char *pos, *end;
+};
+
+struct slab_pool {
+	struct pool pool;
+	int refcount;
+
+	struct slab_class classes[SLAB_CLASS_COUNT];
+	struct slab *slabs;
+	struct slab_large_block *large_blocks;
+
+	size_t total_used_size;
+	size_t total_alloc_size;
+#ifdef DEBUG
+	char *name;
+#endif
+};
+
+#define SLAB_OBJECT_HEADER(mem) \
+	((struct slab_object_header *) \
+	 ((unsigned char *)(mem) - SIZEOF_SLAB_OBJECT_HEADER))
+#define SLAB_LARGE_BLOCK(mem) \
+	((struct slab_large_block *) \
+	 ((unsigned char *)(mem) - SIZEOF_SLAB_OBJECT_HEADER - \
+	  SIZEOF_SLAB_LARGE_BLOCK))
+
+static const char *pool_slab_get_name(pool_t pool);
+static void pool_slab_ref(pool_t pool);
+static void pool_slab_unref(pool_t *pool);
+static void *pool_slab_malloc(pool_t pool, size_t size);
+static void pool_slab_free(pool_t pool, void *mem);
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size);
+static void pool_slab_clear(pool_t pool);
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool);
+
+static const struct pool_vfuncs static_slab_pool_vfuncs = {
+	pool_slab_get_name,
+	pool_slab_ref,
+	pool_slab_unref,
+	pool_slab_malloc,
+	pool_slab_free,
+	pool_slab_realloc,
+	pool_slab_clear,
+	pool_slab_get_max_easy_alloc_size
+};
+
+static const struct pool static_slab_pool = {
+	.v = &static_slab_pool_vfuncs,
+
+	.alloconly_pool = FALSE,
+	.datastack_pool = FALSE
+};
+
+pool_t pool_slab_create(const char *name ATTR_UNUSED)
+{
+	struct slab_pool *pool;
+
+	(void) COMPILE_ERROR_IF_TRUE(SIZEOF_SLAB_LARGE_BLOCK +
+				     SIZEOF_SLAB_OBJECT_HEADER >
+				     (SSIZE_T_MAX - POOL_MAX_ALLOC_SIZE));
+
+	pool = calloc(1, sizeof(struct slab_pool));
+	if (pool == NULL)
+		i_fatal_status(FATAL_OUTOFMEM, "calloc(1, %zu): Out of memory",
+			       sizeof(struct slab_pool));
+#ifdef DEBUG
+	pool->name = strdup(name);
+#endif
+	pool->pool = static_slab_pool;
+	pool->refcount = 1;
+	return &pool->pool;
+}
+
+static const char *pool_slab_get_name(pool_t pool ATTR_UNUSED)
+{
+#ifdef DEBUG
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+
+	return spool->name;
+#else
+	return "slab";
+#endif
+}
+
+static void pool_slab_ref(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+
+	i_assert(spool->refcount > 0);
+	spool->refcount++;
+}
+
+static void pool_slab_unref(pool_t *_pool)
+{
+	pool_t pool = *_pool;
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+
+	i_assert(spool->refcount > 0);
+
+	/* erase the pointer before freeing anything, as the pointer may
+	   exist inside the pool's memory area */
+	*_pool = NULL;
+
+	if (--spool->refcount > 0)
+		return;
+
+	pool_slab_clear(pool);
+#ifdef DEBUG
+	free(spool->name);
+#endif
+	free(spool);
+}
+
+static unsigned int slab_get_class_idx(size_t size)
+{
+	unsigned int class_idx = 0;
+
+	while (SLAB_CLASS_SIZE(class_idx) < size)
+		class_idx++;
+	return class_idx;
+}
+
+static void slab_alloc(struct slab_pool *spool, unsigned int class_idx)
+{
+	struct slab_class *class = &spool->classes[class_idx];
+	size_t object_size = SIZEOF_SLAB_OBJECT_HEADER +
+		SLAB_CLASS_SIZE(class_idx);
+	size_t size = I_MAX(SLAB_SIZE,
+			    SIZEOF_SLAB + object_size * SLAB_MIN_OBJECTS);
+	struct slab *slab;
+
+	slab = calloc(size, 1);
+	if (unlikely(slab == NULL)) {
+		i_fatal_status(FATAL_OUTOFMEM,
+			       "slab_alloc(%zu): Out of memory", size);
+	}
+	slab->size = size;
+	slab->next = spool->slabs;
+	spool->slabs = slab;
+
+	class->pos = (unsigned char *)slab + SIZEOF_SLAB;
+	class->end = (unsigned char *)slab + size;
+	spool->total_alloc_size += size;
+	mempool_global_stats.slab_slab_allocs++;
+}
+
+static void *pool_slab_malloc_large(struct slab_pool *spool, size_t size)
+{
+	struct slab_large_block *block;
+	struct slab_object_header *hdr;
+
+	block = calloc(SIZEOF_SLAB_LARGE_BLOCK + SIZEOF_SLAB_OBJECT_HEADER +
+		       size, 1);
+	if (unlikely(block == NULL)) {
+		i_fatal_status(FATAL_OUTOFMEM,
+			       "calloc(%zu): Out of memory", size);
+	}
+	block->size = size;
+	DLLIST_PREPEND(&spool->large_blocks, block);
+
+	hdr = PTR_OFFSET(block, SIZEOF_SLAB_LARGE_BLOCK);
+	hdr->class_idx = SLAB_CLASS_LARGE;
+	spool->total_used_size += size;
+	spool->total_alloc_size += size;
+	mempool_global_stats.slab_large_allocs++;
+	return PTR_OFFSET(hdr, SIZEOF_SLAB_OBJECT_HEADER);
+}
+
+static void *pool_slab_malloc(pool_t pool, size_t size)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_object_header *hdr;
+	struct slab_class *class;
+	unsigned int class_idx;
+	size_t class_size;
+	void *mem;
+
+	if (size > SLAB_MAX_CLASS_SIZE)
+		return pool_slab_malloc_large(spool, size);
+
+	class_idx = slab_get_class_idx(size);
+	class_size = SLAB_CLASS_SIZE(class_idx);
+	class = &spool->classes[class_idx];
+	spool->total_used_size += class_size;
+
+	if (class->free != NULL) {
+		/* reuse a freed object */
+		mem = class->free;
+		class->free = class->free->next;
+		memset(mem, 0, class_size);
+		mempool_global_stats.slab_free_list_hits++;
+		return mem;
+	}
+	mempool_global_stats.slab_free_list_misses++;
+
+	if ((size_t)(class->end - class->pos) <
+	    SIZEOF_SLAB_OBJECT_HEADER + class_size)
+		slab_alloc(spool, class_idx);
+	/* the slab memory is still zero */
+	hdr = (struct slab_object_header *)class->pos;
+	hdr->class_idx = class_idx;
+	mem = class->pos + SIZEOF_SLAB_OBJECT_HEADER;
+	class->pos += SIZEOF_SLAB_OBJECT_HEADER + class_size;
+	return mem;
+}
+
+static void pool_slab_free(pool_t pool, void *mem)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_object_header *hdr = SLAB_OBJECT_HEADER(mem);
+	struct slab_large_block *block;
+	struct slab_free_object *obj = mem;
+	struct slab_class *class;
+
+	if (hdr->class_idx == SLAB_CLASS_LARGE) {
+		block = SLAB_LARGE_BLOCK(mem);
+		DLLIST_REMOVE(&spool->large_blocks, block);
+		spool->total_used_size -= block->size;
+		spool->total_alloc_size -= block->size;
+		free(block);
+		return;
+	}
+
+	i_assert(hdr->class_idx < SLAB_CLASS_COUNT);
+	class = &spool->classes[hdr->class_idx];
+	spool->total_used_size -= SLAB_CLASS_SIZE(hdr->class_idx);
+	obj->next = class->free;
+	class->free = obj;
+}
+
+static void *pool_slab_realloc(pool_t pool, void *mem,
+			       size_t old_size, size_t new_size)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_object_header *hdr = SLAB_OBJECT_HEADER(mem);
+	struct slab_large_block *block, *new_block;
+	void *new_mem;
+
+	if (hdr->class_idx == SLAB_CLASS_LARGE &&
+	    new_size > SLAB_MAX_CLASS_SIZE) {
+		block = SLAB_LARGE_BLOCK(mem);
+		DLLIST_REMOVE(&spool->large_blocks, block);
+		new_block = realloc(block, SIZEOF_SLAB_LARGE_BLOCK +
+				    SIZEOF_SLAB_OBJECT_HEADER + new_size);
+		if (unlikely(new_block == NULL)) {
+			i_fatal_status(FATAL_OUTOFMEM,
+				       "realloc(%zu): Out of memory", new_size);
+		}
+		DLLIST_PREPEND(&spool->large_blocks, new_block);
+		spool->total_used_size += new_size - new_block->size;
+		spool->total_alloc_size += new_size - new_block->size;
+		new_block->size = new_size;
+		new_mem = PTR_OFFSET(new_block, SIZEOF_SLAB_LARGE_BLOCK +
+				     SIZEOF_SLAB_OBJECT_HEADER);
+	} else if (hdr->class_idx != SLAB_CLASS_LARGE &&
+		   new_size <= SLAB_CLASS_SIZE(hdr->class_idx)) {
+		/* fits into the same object */
+		new_mem = mem;
+	} else {
+		new_mem = pool_slab_malloc(pool, new_size);
+		memcpy(new_mem, mem, I_MIN(old_size, new_size));
+		pool_slab_free(pool, mem);
+		return new_mem;
+	}
+	if (old_size < new_size) {
+		memset(PTR_OFFSET(new_mem, old_size), 0,
+		       new_size - old_size);
+	}
+	return new_mem;
+}
+
+static void pool_slab_clear(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+	struct slab_large_block *block;
+	struct slab *slab;
+
+	while (spool->large_blocks != NULL) {
+		block = spool->large_blocks;
+		DLLIST_REMOVE(&spool->large_blocks, block);
+		free(block);
+	}
+	while (spool->slabs != NULL) {
+		slab = spool->slabs;
+		spool->slabs = slab->next;
+		free(slab);
+	}
+	i_zero(&spool->classes);
+	spool->total_used_size = 0;
+	spool->total_alloc_size = 0;
+}
+
+static size_t pool_slab_get_max_easy_alloc_size(pool_t pool ATTR_UNUSED)
+{
+	return 0;
+}
+
+size_t pool_slab_get_total_used_size(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+
+	i_assert(pool->v == &static_slab_pool_vfuncs);
+	return spool->total_used_size;
+}
+
+size_t pool_slab_get_total_alloc_size(pool_t pool)
+{
+	struct slab_pool *spool = container_of(pool, struct slab_pool, pool);
+
+	i_assert(pool->v == &static_slab_pool_vfuncs);
+	return spool->total_alloc_size;
+}
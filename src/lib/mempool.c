@@ -23,3 +23,10 @@ size_t pool_get_exp_grown_size(pool_t pool, size_t old_size, size_t min_size)
 	i_assert(exp_size >= min_size);
 	return exp_size;
 }
+
+struct mempool_stats mempool_global_stats;
+
+void mempool_get_stats(struct mempool_stats *stats_r)
+{
+	*stats_r = mempool_global_stats;
+}
@@ -81,6 +81,14 @@ pool_t pool_allocfree_create(const char *name);
    See pool_alloconly_create_clean. */
 pool_t pool_allocfree_create_clean(const char *name);
 
+/* Create a new slab pool. Small allocations are rounded up to a size class
+   and allocated from larger slabs, which are shared by all allocations of
+   the same class. Freed memory is kept in a per-class free list and reused
+   by the following allocations, so this is a good fit for many small
+   objects that are freed individually. Larger allocations fall back to
+   malloc(). All memory is freed when the pool is cleared or destroyed. */
+pool_t pool_slab_create(const char *name);
+
 /* Similar to nearest_power(), but try not to exceed buffer's easy
    allocation size. If you don't have any explicit minimum size, use
    old_size + 1. */
@@ -173,7 +181,38 @@ size_t pool_allocfree_get_total_used_size(pool_t pool);
 /* Returns how much system memory has been allocated for this pool. */
 size_t pool_allocfree_get_total_alloc_size(pool_t pool);
 
+/* Returns how much memory has been allocated from this pool. */
+size_t pool_slab_get_total_used_size(pool_t pool);
+/* Returns how much system memory has been allocated for this pool. */
+size_t pool_slab_get_total_alloc_size(pool_t pool);
+
+struct mempool_stats {
+	/* Alloconly pool blocks that were taken from the process-wide block
+	   recycler vs. ones that were allocated with calloc() */
+	uint64_t alloconly_block_cache_hits;
+	uint64_t alloconly_block_cache_misses;
+	/* Freed alloconly pool blocks that were given to the recycler vs.
+	   ones that were free()d */
+	uint64_t alloconly_block_cache_puts;
+	uint64_t alloconly_block_cache_frees;
+
+	/* Slab pool allocations that reused freed memory from the free list
+	   vs. ones that used new memory from a slab */
+	uint64_t slab_free_list_hits;
+	uint64_t slab_free_list_misses;
+	/* Number of slabs and too large allocations that were malloc()ed */
+	uint64_t slab_slab_allocs;
+	uint64_t slab_large_allocs;
+};
+
+/* Returns the memory pool statistics of this process. */
+void mempool_get_stats(struct mempool_stats *stats_r);
+
 /* private: */
+extern struct mempool_stats mempool_global_stats;
+
 void pool_system_free(pool_t pool, void *mem);
+/* Free the blocks cached by the alloconly pool block recycler. */
+void pool_alloconly_block_cache_deinit(void);
 
 #endif
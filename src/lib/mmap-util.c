@@ -4,6 +4,111 @@
 #include "mmap-util.h"
 
 #include <sys/stat.h>
+#include <sys/resource.h>
+
+static void mmap_get_faults(uint64_t *minor_r, uint64_t *major_r)
+{
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) < 0) {
+		*minor_r = *major_r = 0;
+		return;
+	}
+	*minor_r = usage.ru_minflt;
+	*major_r = usage.ru_majflt;
+}
+
+void *mmap_fd_advice(int fd, size_t length, int prot, int flags,
+		     const struct mmap_advice *advice,
+		     struct mmap_advice_stats *stats_r)
+{
+	uint64_t minor_faults = 0, major_faults = 0;
+	uint64_t minor_faults2, major_faults2;
+	void *base;
+
+	i_zero(stats_r);
+	bool populate = advice->populate_min_size > 0 &&
+		length >= advice->populate_min_size;
+	bool willneed = advice->willneed_min_size > 0 &&
+		length >= advice->willneed_min_size;
+	/* count the faults only when there is some advice that causes
+	   them, so plain mmap()s don't need the extra syscalls */
+	bool get_faults = populate || willneed;
+
+	if (get_faults)
+		mmap_get_faults(&minor_faults, &major_faults);
+
+	if (populate && (flags & MAP_PRIVATE) != 0 && (prot & PROT_WRITE) != 0) {
+		/* MAP_POPULATE would copy-on-write the whole private mapping.
+		   Just read it ahead instead. */
+		populate = FALSE;
+		willneed = TRUE;
+	}
+#ifdef MAP_POPULATE
+	if (populate) {
+		flags |= MAP_POPULATE;
+		stats_r->populated = TRUE;
+	}
+#else
+	if (populate)
+		willneed = TRUE;
+#endif
+	base = mmap(NULL, length, prot, flags, fd, 0);
+	if (base == MAP_FAILED) {
+		stats_r->populated = FALSE;
+		return MAP_FAILED;
+	}
+	stats_r->mapped_bytes = length;
+
+#ifdef MADV_WILLNEED
+	if (willneed && !stats_r->populated) {
+		if (madvise(base, length, MADV_WILLNEED) == 0)
+			stats_r->willneed = TRUE;
+	}
+#endif
+	if (get_faults) {
+		mmap_get_faults(&minor_faults2, &major_faults2);
+		stats_r->minor_faults = minor_faults2 - minor_faults;
+		stats_r->major_faults = major_faults2 - major_faults;
+	}
+	return base;
+}
+
+void *mmap_ro_file_advice(int fd, size_t *length,
+			  const struct mmap_advice *advice,
+			  struct mmap_advice_stats *stats_r)
+{
+	struct stat st;
+
+	i_zero(stats_r);
+	if (fstat(fd, &st) < 0)
+		return MAP_FAILED;
+
+#if OFF_T_MAX > SSIZE_T_MAX
+	if (st.st_size > SSIZE_T_MAX) {
+		/* too large file to map into memory */
+		errno = EFBIG;
+		return MAP_FAILED;
+	}
+#endif
+
+	*length = (size_t)st.st_size;
+	if (*length == 0)
+		return NULL;
+
+	return mmap_fd_advice(fd, *length, PROT_READ, MAP_SHARED,
+			      advice, stats_r);
+}
+
+void mmap_anon_advise(void *start ATTR_UNUSED, size_t length ATTR_UNUSED,
+		      const struct mmap_advice *advice ATTR_UNUSED)
+{
+#ifdef MADV_HUGEPAGE
+	if (advice->hugepage_min_size > 0 &&
+	    length >= advice->hugepage_min_size)
+		(void)madvise(start, length, MADV_HUGEPAGE);
+#endif
+}
 
 void *mmap_file(int fd, size_t *length, int prot)
 {
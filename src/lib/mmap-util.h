@@ -14,9 +14,51 @@
 #  define MREMAP_MAYMOVE 1
 #endif
 
+/* Optional advice for mmap()s. Each setting is a minimum mapping size for
+   the advice to be used. 0 disables it. The advice is silently ignored if
+   the OS doesn't support it. */
+struct mmap_advice {
+	/* Prefault the whole file mapping with MAP_POPULATE. This avoids a
+	   page fault on each first access of a page, but the mmap() call
+	   itself blocks until the file has been read. For writable private
+	   mappings MADV_WILLNEED is used instead, because prefaulting them
+	   would copy the whole file into memory. */
+	size_t populate_min_size;
+	/* Start reading the file in the background with
+	   madvise(MADV_WILLNEED). */
+	size_t willneed_min_size;
+	/* Use transparent huge pages with madvise(MADV_HUGEPAGE) to reduce
+	   TLB misses. Linux supports this only for anonymous memory, so this
+	   is used only by mmap_anon_advise(). */
+	size_t hugepage_min_size;
+};
+
+/* Statistics of a single mmap_*_advice() call */
+struct mmap_advice_stats {
+	/* Number of bytes mapped */
+	size_t mapped_bytes;
+	/* Advice that was actually used */
+	bool populated:1;
+	bool willneed:1;
+	/* Page faults done by the process during the call. With MAP_POPULATE
+	   these show how many pages the prefaulting had to read from disk
+	   (major) or just map from the page cache (minor). They are counted
+	   only when populate or willneed advice applies to the mapping. */
+	uint64_t minor_faults, major_faults;
+};
+
 void *mmap_file(int fd, size_t *length, int prot);
 void *mmap_ro_file(int fd, size_t *length);
 void *mmap_rw_file(int fd, size_t *length);
+/* Same as mmap_ro_file(), but use the given advice. stats_r is filled also
+   on failure. */
+void *mmap_ro_file_advice(int fd, size_t *length,
+			  const struct mmap_advice *advice,
+			  struct mmap_advice_stats *stats_r);
+/* mmap() the first length bytes of the fd using the given advice. */
+void *mmap_fd_advice(int fd, size_t length, int prot, int flags,
+		     const struct mmap_advice *advice,
+		     struct mmap_advice_stats *stats_r);
 
 /* for allocating anonymous mmap()s, with portable mremap(). these must not
    be mixed with any standard mmap calls. */
@@ -24,6 +66,11 @@ void *mmap_anon(size_t length);
 void *mremap_anon(void *old_address, size_t old_size, size_t new_size,
 		  unsigned long flags);
 int munmap_anon(void *start, size_t length);
+/* Apply the advice to an anonymous mapping. Only hugepage_min_size is
+   used, since prefaulting anonymous memory would just allocate zero
+   pages. */
+void mmap_anon_advise(void *start, size_t length,
+		      const struct mmap_advice *advice);
 
 size_t mmap_get_page_size(void) ATTR_CONST;
 
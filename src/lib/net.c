@@ -522,6 +522,8 @@ int net_listen_full(const struct ip_addr *my_ip, in_port_t *port,
 		if (ret >= 0) {
 			*port = sin_get_port(&so);
 
+			if ((*flags & NET_LISTEN_FLAG_NO_LISTEN) != 0)
+				return fd;
 			/* start listening */
 			if (listen(fd, backlog) >= 0)
 				return fd;
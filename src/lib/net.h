@@ -44,7 +44,9 @@ struct net_unix_cred {
 enum net_listen_flags {
 	/* Try to use SO_REUSEPORT if available. If it's not, this flag is
 	   cleared on return. */
-	NET_LISTEN_FLAG_REUSEPORT	= 0x01
+	NET_LISTEN_FLAG_REUSEPORT	= 0x01,
+	/* Only bind() the socket. The caller needs to listen() it. */
+	NET_LISTEN_FLAG_NO_LISTEN	= 0x02,
 };
 
 enum net_hosterror_type {
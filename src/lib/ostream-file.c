@@ -2,8 +2,14 @@
 
 /* @UNSAFE: whole file */
 
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#define _GNU_SOURCE /* for splice() */
 #include "lib.h"
 #include "ioloop.h"
+#include "fd-util.h"
 #include "write-full.h"
 #include "net.h"
 #include "sendfile-util.h"
@@ -29,6 +35,10 @@
 #define MAX_SSIZE_T(size) \
 	((size) < SSIZE_T_MAX ? (size_t)(size) : SSIZE_T_MAX)
 
+/* Maximum number of bytes to splice() at once. This is also the default
+   pipe buffer size in Linux. */
+#define MAX_SPLICE_SIZE (64*1024)
+
 static void stream_send_io(struct file_ostream *fstream);
 static struct ostream * o_stream_create_fd_common(int fd,
 		size_t max_buffer_size, bool autoclose_fd);
@@ -65,6 +75,8 @@ static void o_stream_file_destroy(struct iostream_private *stream)
 	struct file_ostream *fstream =
 		container_of(stream, struct file_ostream, ostream.iostream);
 
+	i_close_fd(&fstream->splice_pipe[0]);
+	i_close_fd(&fstream->splice_pipe[1]);
 	i_free(fstream->buffer);
 }
 
@@ -842,6 +854,171 @@ io_stream_sendfile(struct ostream_private *outstream,
 	return TRUE;
 }
 
+#ifdef HAVE_SPLICE
+static int o_stream_splice_pipe_create(struct file_ostream *foutstream)
+{
+	if (foutstream->splice_pipe[0] != -1)
+		return 0;
+	if (pipe(foutstream->splice_pipe) < 0) {
+		i_error("file_ostream.pipe(%s) failed: %m",
+			o_stream_get_name(&foutstream->ostream.ostream));
+		return -1;
+	}
+	fd_set_nonblock(foutstream->splice_pipe[0], TRUE);
+	fd_set_nonblock(foutstream->splice_pipe[1], TRUE);
+	fd_close_on_exec(foutstream->splice_pipe[0], TRUE);
+	fd_close_on_exec(foutstream->splice_pipe[1], TRUE);
+	return 0;
+}
+
+static int
+o_stream_splice_pipe_to_buffer(struct file_ostream *foutstream, size_t size)
+{
+	unsigned char buf[IO_BLOCK_SIZE];
+	size_t added;
+	ssize_t ret;
+
+	/* The output fd can't take more data right now. Move the rest of the
+	   data in the pipe to the buffer, so the pipe is always empty after
+	   io_stream_splice() returns. The data size was limited to the
+	   buffer's maximum size, so it all fits. */
+	while (size > 0) {
+		ret = read(foutstream->splice_pipe[0], buf,
+			   I_MIN(size, sizeof(buf)));
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR)
+				continue;
+			/* the data is already in the pipe - this shouldn't
+			   ever fail */
+			io_stream_set_error(&foutstream->ostream.iostream,
+				"read(splice pipe) failed: %s",
+				ret == 0 ? "EOF" : strerror(errno));
+			foutstream->ostream.ostream.stream_errno =
+				ret == 0 ? EIO : errno;
+			stream_closed(foutstream);
+			return -1;
+		}
+		added = o_stream_add(foutstream, buf, ret);
+		i_assert(added == (size_t)ret);
+		size -= ret;
+	}
+	return 0;
+}
+
+static bool
+io_stream_splice(struct ostream_private *outstream,
+		 struct istream *instream, int in_fd,
+		 enum ostream_send_istream_result *res_r)
+{
+	struct file_ostream *foutstream =
+		container_of(outstream, struct file_ostream, ostream);
+	struct const_iovec iov;
+	size_t max_size, pipe_used;
+	ssize_t ret;
+	int ret2;
+
+	/* send first the data already read into the istream buffer */
+	iov.iov_base = i_stream_get_data(instream, &iov.iov_len);
+	if (iov.iov_len > 0) {
+		if ((ret = o_stream_sendv(&outstream->ostream, &iov, 1)) < 0) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+			return TRUE;
+		}
+		i_stream_skip(instream, ret);
+		if ((size_t)ret < iov.iov_len) {
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+			return TRUE;
+		}
+	}
+
+	/* flush out any data in buffer */
+	if ((ret2 = buffer_flush(foutstream)) < 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+		return TRUE;
+	} else if (ret2 == 0) {
+		*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+		return TRUE;
+	}
+	if (o_stream_splice_pipe_create(foutstream) < 0)
+		return FALSE;
+
+	max_size = I_MIN(outstream->max_buffer_size, MAX_SPLICE_SIZE);
+	o_stream_socket_cork(foutstream);
+	for (;;) {
+		ret = splice(in_fd, NULL, foutstream->splice_pipe[1], NULL,
+			     max_size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (ret == 0) {
+			instream->eof = TRUE;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_FINISHED;
+			return TRUE;
+		}
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN) {
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT;
+				return TRUE;
+			}
+			if (errno == EINVAL || errno == ENOSYS) {
+				/* splice() not supported with this fd */
+				return FALSE;
+			}
+			io_stream_set_error(&instream->real_stream->iostream,
+					    "splice() failed: %m");
+			instream->stream_errno = errno;
+			instream->eof = TRUE;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT;
+			return TRUE;
+		}
+		/* istream's buffer is empty, so this keeps the offsets
+		   correct. non-seekable file istreams don't use the offset
+		   for reading. */
+		instream->v_offset += ret;
+		pipe_used = ret;
+
+		while (pipe_used > 0) {
+			ret = splice(foutstream->splice_pipe[0], NULL,
+				     foutstream->fd, NULL, pipe_used,
+				     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (ret > 0) {
+				pipe_used -= ret;
+				foutstream->real_offset += ret;
+				foutstream->buffer_offset += ret;
+				outstream->ostream.offset += ret;
+				continue;
+			}
+			i_assert(ret < 0);
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EINVAL) {
+				io_stream_set_error(&outstream->iostream,
+						    "splice() failed: %m");
+				outstream->ostream.stream_errno = errno;
+				stream_closed(foutstream);
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+				return TRUE;
+			}
+			/* EAGAIN: wait for the output to become writable.
+			   EINVAL: splice() isn't supported to the output fd,
+			   fall back to regular sending. The data before it is
+			   now in the buffer, so the ordering is kept. */
+			bool not_supported = errno == EINVAL;
+
+			outstream->ostream.offset += pipe_used;
+			if (o_stream_splice_pipe_to_buffer(foutstream,
+							   pipe_used) < 0) {
+				*res_r = OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
+				return TRUE;
+			}
+			if (not_supported)
+				return FALSE;
+			*res_r = OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
+			return TRUE;
+		}
+	}
+}
+#endif
+
 static enum ostream_send_istream_result
 io_stream_copy_backwards(struct ostream_private *outstream,
 			 struct istream *instream, uoff_t in_size)
@@ -983,6 +1160,23 @@ o_stream_file_send_istream(struct ostream_private *outstream,
 		   regular sending. */
 		foutstream->no_sendfile = TRUE;
 	}
+#ifdef HAVE_SPLICE
+	/* Use splice() between non-seekable fds, unless either stream would
+	   do something else than plain read() or write() with the fd (e.g.
+	   the istream is a filter, such as SSL). */
+	if (!foutstream->no_splice && in_fd != -1 &&
+	    instream->real_stream->parent == NULL &&
+	    in_fd != foutstream->fd && !instream->seekable &&
+	    !instream->blocking && !outstream->ostream.blocking &&
+	    foutstream->writev == o_stream_file_writev) {
+		if (io_stream_splice(outstream, instream, in_fd, &res))
+			return res;
+
+		/* splice() not supported (with these fds), fallback to
+		   regular sending. */
+		foutstream->no_splice = TRUE;
+	}
+#endif
 
 	same_stream = i_stream_get_fd(instream) == foutstream->fd &&
 		foutstream->fd != -1;
@@ -1008,6 +1202,7 @@ o_stream_create_file_common(struct file_ostream *fstream,
 	struct ostream *ostream;
 
 	fstream->fd = fd;
+	fstream->splice_pipe[0] = fstream->splice_pipe[1] = -1;
 	fstream->autoclose_fd = autoclose_fd;
 	fstream->optimal_block_size = DEFAULT_OPTIMAL_BLOCK_SIZE;
 
@@ -1041,6 +1236,7 @@ static void fstream_init_file(struct file_ostream *fstream)
 	struct stat st;
 
 	fstream->no_sendfile = TRUE;
+	fstream->no_splice = TRUE;
 	if (fstat(fstream->fd, &st) < 0)
 		return;
 
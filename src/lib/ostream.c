@@ -4,6 +4,9 @@
 #include "istream.h"
 #include "ostream-private.h"
 
+/* How many input buffers io_stream_copy() sends at once */
+#define IO_STREAM_COPY_IOV_COUNT 8
+
 void o_stream_set_name(struct ostream *stream, const char *name)
 {
 	i_free(stream->real_stream->iostream.name);
@@ -486,13 +489,13 @@ void o_stream_get_last_write_time(struct ostream *stream, struct timeval *tv_r)
 enum ostream_send_istream_result
 io_stream_copy(struct ostream *outstream, struct istream *instream)
 {
-	struct const_iovec iov;
-	const unsigned char *data;
+	struct const_iovec iov[IO_STREAM_COPY_IOV_COUNT];
 	ssize_t ret;
+	int iov_count;
 
-	while (i_stream_read_more(instream, &data, &iov.iov_len) > 0) {
-		iov.iov_base = data;
-		if ((ret = o_stream_sendv(outstream, &iov, 1)) < 0)
+	while ((iov_count = i_stream_read_iov(instream, iov,
+					      N_ELEMENTS(iov))) > 0) {
+		if ((ret = o_stream_sendv(outstream, iov, iov_count)) < 0)
 			return OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT;
 		else if (ret == 0)
 			return OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT;
@@ -0,0 +1,874 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "array.h"
+#include "bsearch-insert-pos.h"
+#include "seq-bitmap.h"
+
+/* Each container stores the sequences that have the same high 16 bits. */
+#define CONTAINER_SEQ_COUNT 65536
+#define CONTAINER_KEY(seq) ((seq) >> 16)
+#define CONTAINER_LOW(seq) ((seq) & 0xffff)
+#define CONTAINER_SEQ(key, low) (((uint32_t)(key) << 16) | (low))
+
+#define BITMAP_WORD_COUNT (CONTAINER_SEQ_COUNT / 64)
+#define BITMAP_SIZE (BITMAP_WORD_COUNT * sizeof(uint64_t))
+/* Switch to a bitmap when the other representations would be larger */
+#define ARRAY_MAX_COUNT (BITMAP_SIZE / sizeof(uint16_t))
+#define RUNS_MAX_COUNT (BITMAP_SIZE / sizeof(struct seq_range))
+
+enum seq_bitmap_container_type {
+	/* sorted array of sequences */
+	CONTAINER_TYPE_ARRAY,
+	/* seq_range array */
+	CONTAINER_TYPE_RUNS,
+	/* bit for each sequence */
+	CONTAINER_TYPE_BITMAP,
+};
+
+struct seq_bitmap_container {
+	uint16_t key;
+	enum seq_bitmap_container_type type;
+	/* number of sequences in the container */
+	unsigned int count;
+
+	ARRAY_TYPE(uint16_t) values;
+	ARRAY_TYPE(seq_range) runs;
+	uint64_t *words;
+};
+
+struct seq_bitmap {
+	/* sorted by key */
+	ARRAY(struct seq_bitmap_container) containers;
+};
+
+static inline uint64_t bitmap_word_mask(unsigned int first, unsigned int last)
+{
+	i_assert(first <= last && last < 64);
+	return (~0ULL << first) & (~0ULL >> (63 - last));
+}
+
+static unsigned int
+bitmap_words_set_range(uint64_t *words, unsigned int first, unsigned int last,
+		       bool set)
+{
+	unsigned int i, changed = 0;
+	unsigned int first_word = first / 64, last_word = last / 64;
+	uint64_t mask, old;
+
+	for (i = first_word; i <= last_word; i++) {
+		mask = bitmap_word_mask(i == first_word ? first % 64 : 0,
+					i == last_word ? last % 64 : 63);
+		old = words[i];
+		if (set)
+			words[i] |= mask;
+		else
+			words[i] &= ~mask;
+		changed += __builtin_popcountll(old ^ words[i]);
+	}
+	return changed;
+}
+
+/* Find the next range of set bits starting from pos. */
+static bool
+bitmap_words_next_range(const uint64_t *words, unsigned int pos,
+			unsigned int *first_r, unsigned int *last_r)
+{
+	unsigned int i = pos / 64;
+	uint64_t word;
+
+	if (pos >= CONTAINER_SEQ_COUNT)
+		return FALSE;
+
+	word = words[i] & (~0ULL << (pos % 64));
+	while (word == 0) {
+		if (++i == BITMAP_WORD_COUNT)
+			return FALSE;
+		word = words[i];
+	}
+	*first_r = i * 64 + __builtin_ctzll(word);
+
+	word = ~words[i] & (~0ULL << (*first_r % 64));
+	while (word == 0) {
+		if (++i == BITMAP_WORD_COUNT) {
+			*last_r = CONTAINER_SEQ_COUNT - 1;
+			return TRUE;
+		}
+		word = ~words[i];
+	}
+	*last_r = i * 64 + __builtin_ctzll(word) - 1;
+	return TRUE;
+}
+
+static void container_free_storage(struct seq_bitmap_container *c)
+{
+	if (array_is_created(&c->values))
+		array_free(&c->values);
+	if (array_is_created(&c->runs))
+		array_free(&c->runs);
+	i_free(c->words);
+}
+
+static void container_init_array(struct seq_bitmap_container *c)
+{
+	c->type = CONTAINER_TYPE_ARRAY;
+	i_array_init(&c->values, 8);
+}
+
+static void container_init_runs(struct seq_bitmap_container *c)
+{
+	c->type = CONTAINER_TYPE_RUNS;
+	i_array_init(&c->runs, 4);
+}
+
+static void
+container_fill_words(const struct seq_bitmap_container *c, uint64_t *words)
+{
+	const struct seq_range *range;
+	const uint16_t *value;
+
+	switch (c->type) {
+	case CONTAINER_TYPE_ARRAY:
+		array_foreach(&c->values, value)
+			words[*value / 64] |= 1ULL << (*value % 64);
+		break;
+	case CONTAINER_TYPE_RUNS:
+		array_foreach(&c->runs, range) {
+			(void)bitmap_words_set_range(words, range->seq1,
+						     range->seq2, TRUE);
+		}
+		break;
+	case CONTAINER_TYPE_BITMAP:
+		memcpy(words, c->words, BITMAP_SIZE);
+		break;
+	}
+}
+
+/* Return the container's sequences as a newly allocated bitmap. The
+   container's own storage is freed, so the caller must give the bitmap back
+   with container_set_words(). */
+static uint64_t *container_detach_words(struct seq_bitmap_container *c)
+{
+	uint64_t *words;
+
+	if (c->type == CONTAINER_TYPE_BITMAP) {
+		words = c->words;
+		c->words = NULL;
+	} else {
+		words = i_new(uint64_t, BITMAP_WORD_COUNT);
+		container_fill_words(c, words);
+	}
+	container_free_storage(c);
+	return words;
+}
+
+/* Store the bitmap into the container using the smallest representation.
+   The container must not have any storage allocated. Takes the ownership of
+   the words. */
+static void container_set_words(struct seq_bitmap_container *c, uint64_t *words)
+{
+	unsigned int i, first, last, pos, count = 0, run_count = 0;
+	uint64_t prev_high = 0;
+
+	for (i = 0; i < BITMAP_WORD_COUNT; i++) {
+		count += __builtin_popcountll(words[i]);
+		/* count the bits that don't have a set bit right before them */
+		run_count += __builtin_popcountll(words[i] &
+						  ~((words[i] << 1) | prev_high));
+		prev_high = words[i] >> 63;
+	}
+	c->count = count;
+
+	if (run_count * sizeof(struct seq_range) <=
+	    I_MIN(count * sizeof(uint16_t), BITMAP_SIZE)) {
+		container_init_runs(c);
+		for (pos = 0; bitmap_words_next_range(words, pos, &first, &last);
+		     pos = last + 1) {
+			struct seq_range *range = array_append_space(&c->runs);
+			range->seq1 = first;
+			range->seq2 = last;
+		}
+		i_free(words);
+	} else if (count <= ARRAY_MAX_COUNT) {
+		container_init_array(c);
+		for (pos = 0; bitmap_words_next_range(words, pos, &first, &last);
+		     pos = last + 1) {
+			for (i = first; i <= last; i++) {
+				uint16_t value = i;
+				array_push_back(&c->values, &value);
+			}
+		}
+		i_free(words);
+	} else {
+		c->type = CONTAINER_TYPE_BITMAP;
+		c->words = words;
+	}
+}
+
+/* Switch to the smallest representation after the container has grown. */
+static void container_optimize(struct seq_bitmap_container *c)
+{
+	switch (c->type) {
+	case CONTAINER_TYPE_ARRAY:
+		if (array_count(&c->values) <= ARRAY_MAX_COUNT)
+			return;
+		break;
+	case CONTAINER_TYPE_RUNS:
+		if (array_count(&c->runs) <= RUNS_MAX_COUNT)
+			return;
+		break;
+	case CONTAINER_TYPE_BITMAP:
+		break;
+	}
+	container_set_words(c, container_detach_words(c));
+}
+
+static int uint16_cmp(const uint16_t *key, const uint16_t *value)
+{
+	return (int)*key - (int)*value;
+}
+
+static bool
+container_exists(const struct seq_bitmap_container *c, unsigned int low)
+{
+	uint16_t value = low;
+	unsigned int idx;
+
+	switch (c->type) {
+	case CONTAINER_TYPE_ARRAY:
+		return array_bsearch_insert_pos(&c->values, &value,
+						uint16_cmp, &idx);
+	case CONTAINER_TYPE_RUNS:
+		return seq_range_exists(&c->runs, low);
+	case CONTAINER_TYPE_BITMAP:
+		return (c->words[low / 64] & (1ULL << (low % 64))) != 0;
+	}
+	i_unreached();
+}
+
+static bool container_add(struct seq_bitmap_container *c, unsigned int low)
+{
+	uint16_t value = low;
+	unsigned int idx;
+
+	switch (c->type) {
+	case CONTAINER_TYPE_ARRAY:
+		if (array_count(&c->values) > 0 &&
+		    *array_back(&c->values) < value) {
+			/* fast path: appending */
+			array_push_back(&c->values, &value);
+		} else if (array_bsearch_insert_pos(&c->values, &value,
+						    uint16_cmp, &idx))
+			return TRUE;
+		else
+			array_insert(&c->values, idx, &value, 1);
+		c->count++;
+		container_optimize(c);
+		return FALSE;
+	case CONTAINER_TYPE_RUNS:
+		if (seq_range_array_add(&c->runs, low))
+			return TRUE;
+		c->count++;
+		container_optimize(c);
+		return FALSE;
+	case CONTAINER_TYPE_BITMAP:
+		if (container_exists(c, low))
+			return TRUE;
+		c->words[low / 64] |= 1ULL << (low % 64);
+		c->count++;
+		return FALSE;
+	}
+	i_unreached();
+}
+
+static unsigned int
+container_add_range(struct seq_bitmap_container *c,
+		    unsigned int first, unsigned int last)
+{
+	unsigned int added;
+
+	if (c->type == CONTAINER_TYPE_ARRAY) {
+		if (array_count(&c->values) == 0) {
+			/* keep ranges as ranges */
+			container_free_storage(c);
+			container_init_runs(c);
+		} else if (last - first < 16) {
+			added = 0;
+			for (unsigned int low = first; low <= last; low++) {
+				if (!container_add(c, low))
+					added++;
+			}
+			return added;
+		} else {
+			uint64_t *words = container_detach_words(c);
+
+			added = bitmap_words_set_range(words, first, last, TRUE);
+			container_set_words(c, words);
+			return added;
+		}
+	}
+
+	switch (c->type) {
+	case CONTAINER_TYPE_ARRAY:
+		i_unreached();
+	case CONTAINER_TYPE_RUNS:
+		added = seq_range_array_add_range_count(&c->runs, first, last);
+		c->count += added;
+		container_optimize(c);
+		return added;
+	case CONTAINER_TYPE_BITMAP:
+		added = bitmap_words_set_range(c->words, first, last, TRUE);
+		c->count += added;
+		if (c->count == CONTAINER_SEQ_COUNT) {
+			/* full - a single range is much smaller */
+			container_set_words(c, container_detach_words(c));
+		}
+		return added;
+	}
+	i_unreached();
+}
+
+static void container_shrink_bitmap(struct seq_bitmap_container *c)
+{
+	if (c->type == CONTAINER_TYPE_BITMAP && c->count <= ARRAY_MAX_COUNT)
+		container_set_words(c, container_detach_words(c));
+}
+
+static bool container_remove(struct seq_bitmap_container *c, unsigned int low)
+{
+	uint16_t value = low;
+	unsigned int idx;
+
+	switch (c->type) {
+	case CONTAINER_TYPE_ARRAY:
+		if (!array_bsearch_insert_pos(&c->values, &value,
+					      uint16_cmp, &idx))
+			return FALSE;
+		array_delete(&c->values, idx, 1);
+		c->count--;
+		return TRUE;
+	case CONTAINER_TYPE_RUNS:
+		if (!seq_range_array_remove(&c->runs, low))
+			return FALSE;
+		c->count--;
+		/* removing from the middle of a range splits it */
+		container_optimize(c);
+		return TRUE;
+	case CONTAINER_TYPE_BITMAP:
+		if (!container_exists(c, low))
+			return FALSE;
+		c->words[low / 64] &= ~(1ULL << (low % 64));
+		c->count--;
+		container_shrink_bitmap(c);
+		return TRUE;
+	}
+	i_unreached();
+}
+
+static unsigned int
+container_remove_range(struct seq_bitmap_container *c,
+		       unsigned int first, unsigned int last)
+{
+	uint16_t value;
+	unsigned int idx1, idx2, removed;
+
+	switch (c->type) {
+	case CONTAINER_TYPE_ARRAY:
+		value = first;
+		(void)array_bsearch_insert_pos(&c->values, &value,
+					       uint16_cmp, &idx1);
+		value = last;
+		if (array_bsearch_insert_pos(&c->values, &value,
+					     uint16_cmp, &idx2))
+			idx2++;
+		removed = idx2 - idx1;
+		array_delete(&c->values, idx1, removed);
+		break;
+	case CONTAINER_TYPE_RUNS:
+		removed = seq_range_array_remove_range(&c->runs, first, last);
+		break;
+	case CONTAINER_TYPE_BITMAP:
+		removed = bitmap_words_set_range(c->words, first, last, FALSE);
+		break;
+	default:
+		i_unreached();
+	}
+	c->count -= removed;
+	if (c->type == CONTAINER_TYPE_RUNS)
+		container_optimize(c);
+	else
+		container_shrink_bitmap(c);
+	return removed;
+}
+
+static void
+container_copy(struct seq_bitmap_container *dest,
+	       const struct seq_bitmap_container *src)
+{
+	i_zero(dest);
+	dest->key = src->key;
+	dest->type = src->type;
+	dest->count = src->count;
+	switch (src->type) {
+	case CONTAINER_TYPE_ARRAY:
+		i_array_init(&dest->values, array_count(&src->values));
+		array_append_array(&dest->values, &src->values);
+		break;
+	case CONTAINER_TYPE_RUNS:
+		i_array_init(&dest->runs, array_count(&src->runs));
+		array_append_array(&dest->runs, &src->runs);
+		break;
+	case CONTAINER_TYPE_BITMAP:
+		dest->words = i_memdup(src->words, BITMAP_SIZE);
+		break;
+	}
+}
+
+static void
+container_union(struct seq_bitmap_container *dest,
+		const struct seq_bitmap_container *src)
+{
+	const struct seq_range *range;
+	uint64_t *words, *src_words;
+	unsigned int i;
+
+	if (src->type == CONTAINER_TYPE_RUNS) {
+		array_foreach(&src->runs, range) {
+			(void)container_add_range(dest, range->seq1,
+						  range->seq2);
+		}
+		return;
+	}
+	if (src->type == CONTAINER_TYPE_ARRAY &&
+	    dest->type != CONTAINER_TYPE_ARRAY) {
+		const uint16_t *value;
+
+		array_foreach(&src->values, value)
+			(void)container_add(dest, *value);
+		return;
+	}
+
+	words = container_detach_words(dest);
+	src_words = i_new(uint64_t, BITMAP_WORD_COUNT);
+	container_fill_words(src, src_words);
+	for (i = 0; i < BITMAP_WORD_COUNT; i++)
+		words[i] |= src_words[i];
+	i_free(src_words);
+	container_set_words(dest, words);
+}
+
+static void
+container_intersect(struct seq_bitmap_container *dest,
+		    const struct seq_bitmap_container *src)
+{
+	uint64_t *words, *src_words;
+	unsigned int i, count;
+
+	if (dest->type == CONTAINER_TYPE_ARRAY) {
+		uint16_t *values = array_get_modifiable(&dest->values, &count);
+		unsigned int j = 0;
+
+		for (i = 0; i < count; i++) {
+			if (container_exists(src, values[i]))
+				values[j++] = values[i];
+		}
+		array_delete(&dest->values, j, count - j);
+		dest->count = j;
+		return;
+	}
+	if (src->type == CONTAINER_TYPE_ARRAY) {
+		ARRAY_TYPE(uint16_t) values;
+		const uint16_t *value;
+
+		i_array_init(&values, array_count(&src->values));
+		array_foreach(&src->values, value) {
+			if (container_exists(dest, *value))
+				array_push_back(&values, value);
+		}
+		container_free_storage(dest);
+		dest->type = CONTAINER_TYPE_ARRAY;
+		dest->values = values;
+		dest->count = array_count(&values);
+		return;
+	}
+
+	words = container_detach_words(dest);
+	src_words = i_new(uint64_t, BITMAP_WORD_COUNT);
+	container_fill_words(src, src_words);
+	for (i = 0; i < BITMAP_WORD_COUNT; i++)
+		words[i] &= src_words[i];
+	i_free(src_words);
+	container_set_words(dest, words);
+}
+
+static unsigned int
+container_remove_container(struct seq_bitmap_container *dest,
+			   const struct seq_bitmap_container *src)
+{
+	const struct seq_range *range;
+	const uint16_t *value;
+	uint64_t *words, *src_words;
+	unsigned int i, old_count = dest->count;
+
+	switch (src->type) {
+	case CONTAINER_TYPE_RUNS:
+		array_foreach(&src->runs, range) {
+			(void)container_remove_range(dest, range->seq1,
+						     range->seq2);
+		}
+		break;
+	case CONTAINER_TYPE_ARRAY:
+		array_foreach(&src->values, value)
+			(void)container_remove(dest, *value);
+		break;
+	case CONTAINER_TYPE_BITMAP:
+		words = container_detach_words(dest);
+		src_words = src->words;
+		for (i = 0; i < BITMAP_WORD_COUNT; i++)
+			words[i] &= ~src_words[i];
+		container_set_words(dest, words);
+		break;
+	}
+	return old_count - dest->count;
+}
+
+static int
+seq_bitmap_container_cmp(const uint16_t *key,
+			 const struct seq_bitmap_container *c)
+{
+	return (int)*key - (int)c->key;
+}
+
+static struct seq_bitmap_container *
+seq_bitmap_lookup(const struct seq_bitmap *bitmap, uint16_t key,
+		  unsigned int *idx_r)
+{
+	unsigned int idx;
+
+	if (!array_bsearch_insert_pos(&bitmap->containers, &key,
+				      seq_bitmap_container_cmp, &idx)) {
+		*idx_r = idx;
+		return NULL;
+	}
+	*idx_r = idx;
+	/* cast-away const - the callers decide whether modifying is ok */
+	return (struct seq_bitmap_container *)
+		array_idx(&bitmap->containers, idx);
+}
+
+static struct seq_bitmap_container *
+seq_bitmap_get(struct seq_bitmap *bitmap, uint16_t key)
+{
+	struct seq_bitmap_container *c;
+	unsigned int idx;
+
+	c = seq_bitmap_lookup(bitmap, key, &idx);
+	if (c == NULL) {
+		c = array_insert_space(&bitmap->containers, idx);
+		c->key = key;
+		container_init_array(c);
+	}
+	return c;
+}
+
+static void
+seq_bitmap_delete_if_empty(struct seq_bitmap *bitmap, unsigned int idx)
+{
+	struct seq_bitmap_container *c =
+		array_idx_modifiable(&bitmap->containers, idx);
+
+	if (c->count == 0) {
+		container_free_storage(c);
+		array_delete(&bitmap->containers, idx, 1);
+	}
+}
+
+struct seq_bitmap *seq_bitmap_create(void)
+{
+	struct seq_bitmap *bitmap;
+
+	bitmap = i_new(struct seq_bitmap, 1);
+	i_array_init(&bitmap->containers, 4);
+	return bitmap;
+}
+
+void seq_bitmap_free(struct seq_bitmap **_bitmap)
+{
+	struct seq_bitmap *bitmap = *_bitmap;
+
+	if (bitmap == NULL)
+		return;
+	*_bitmap = NULL;
+
+	seq_bitmap_clear(bitmap);
+	array_free(&bitmap->containers);
+	i_free(bitmap);
+}
+
+void seq_bitmap_clear(struct seq_bitmap *bitmap)
+{
+	struct seq_bitmap_container *c;
+
+	array_foreach_modifiable(&bitmap->containers, c)
+		container_free_storage(c);
+	array_clear(&bitmap->containers);
+}
+
+bool seq_bitmap_add(struct seq_bitmap *bitmap, uint32_t seq)
+{
+	return container_add(seq_bitmap_get(bitmap, CONTAINER_KEY(seq)),
+			     CONTAINER_LOW(seq));
+}
+
+unsigned int seq_bitmap_add_range(struct seq_bitmap *bitmap,
+				  uint32_t seq1, uint32_t seq2)
+{
+	struct seq_bitmap_container *c;
+	unsigned int key, first, last, added = 0;
+
+	i_assert(seq1 <= seq2);
+	i_assert(seq1 > 0 || seq2 < (uint32_t)-1);
+
+	for (key = CONTAINER_KEY(seq1); key <= CONTAINER_KEY(seq2); key++) {
+		first = key == CONTAINER_KEY(seq1) ? CONTAINER_LOW(seq1) : 0;
+		last = key == CONTAINER_KEY(seq2) ? CONTAINER_LOW(seq2) :
+			CONTAINER_SEQ_COUNT - 1;
+		c = seq_bitmap_get(bitmap, key);
+		added += container_add_range(c, first, last);
+	}
+	return added;
+}
+
+bool seq_bitmap_remove(struct seq_bitmap *bitmap, uint32_t seq)
+{
+	struct seq_bitmap_container *c;
+	unsigned int idx;
+
+	c = seq_bitmap_lookup(bitmap, CONTAINER_KEY(seq), &idx);
+	if (c == NULL || !container_remove(c, CONTAINER_LOW(seq)))
+		return FALSE;
+	seq_bitmap_delete_if_empty(bitmap, idx);
+	return TRUE;
+}
+
+unsigned int seq_bitmap_remove_range(struct seq_bitmap *bitmap,
+				     uint32_t seq1, uint32_t seq2)
+{
+	struct seq_bitmap_container *c;
+	unsigned int idx, first, last, removed = 0;
+
+	i_assert(seq1 <= seq2);
+
+	(void)seq_bitmap_lookup(bitmap, CONTAINER_KEY(seq1), &idx);
+	while (idx < array_count(&bitmap->containers)) {
+		c = array_idx_modifiable(&bitmap->containers, idx);
+		if (c->key > CONTAINER_KEY(seq2))
+			break;
+		first = c->key == CONTAINER_KEY(seq1) ? CONTAINER_LOW(seq1) : 0;
+		last = c->key == CONTAINER_KEY(seq2) ? CONTAINER_LOW(seq2) :
+			CONTAINER_SEQ_COUNT - 1;
+		removed += container_remove_range(c, first, last);
+		if (c->count == 0)
+			seq_bitmap_delete_if_empty(bitmap, idx);
+		else
+			idx++;
+	}
+	return removed;
+}
+
+bool seq_bitmap_exists(const struct seq_bitmap *bitmap, uint32_t seq)
+{
+	const struct seq_bitmap_container *c;
+	unsigned int idx;
+
+	c = seq_bitmap_lookup(bitmap, CONTAINER_KEY(seq), &idx);
+	return c != NULL && container_exists(c, CONTAINER_LOW(seq));
+}
+
+unsigned int seq_bitmap_count(const struct seq_bitmap *bitmap)
+{
+	const struct seq_bitmap_container *c;
+	uint64_t count = 0;
+
+	array_foreach(&bitmap->containers, c)
+		count += c->count;
+	i_assert(count <= UINT_MAX);
+	return count;
+}
+
+void seq_bitmap_merge(struct seq_bitmap *dest, const struct seq_bitmap *src)
+{
+	const struct seq_bitmap_container *src_c;
+	struct seq_bitmap_container *c;
+	unsigned int idx;
+
+	i_assert(dest != src);
+
+	array_foreach(&src->containers, src_c) {
+		c = seq_bitmap_lookup(dest, src_c->key, &idx);
+		if (c == NULL) {
+			c = array_insert_space(&dest->containers, idx);
+			container_copy(c, src_c);
+		} else {
+			container_union(c, src_c);
+		}
+	}
+}
+
+unsigned int seq_bitmap_intersect(struct seq_bitmap *dest,
+				  const struct seq_bitmap *src)
+{
+	const struct seq_bitmap_container *src_c;
+	struct seq_bitmap_container *c;
+	unsigned int idx = 0, src_idx, removed = 0, old_count;
+
+	i_assert(dest != src);
+
+	while (idx < array_count(&dest->containers)) {
+		c = array_idx_modifiable(&dest->containers, idx);
+		old_count = c->count;
+		src_c = seq_bitmap_lookup(src, c->key, &src_idx);
+		if (src_c == NULL)
+			c->count = 0;
+		else
+			container_intersect(c, src_c);
+		removed += old_count - c->count;
+		if (c->count == 0)
+			seq_bitmap_delete_if_empty(dest, idx);
+		else
+			idx++;
+	}
+	return removed;
+}
+
+unsigned int seq_bitmap_remove_bitmap(struct seq_bitmap *dest,
+				      const struct seq_bitmap *src)
+{
+	const struct seq_bitmap_container *src_c;
+	struct seq_bitmap_container *c;
+	unsigned int idx, removed = 0;
+
+	i_assert(dest != src);
+
+	array_foreach(&src->containers, src_c) {
+		c = seq_bitmap_lookup(dest, src_c->key, &idx);
+		if (c != NULL) {
+			removed += container_remove_container(c, src_c);
+			seq_bitmap_delete_if_empty(dest, idx);
+		}
+	}
+	return removed;
+}
+
+void seq_bitmap_add_seq_range(struct seq_bitmap *bitmap,
+			      const ARRAY_TYPE(seq_range) *src)
+{
+	const struct seq_range *range;
+
+	array_foreach(src, range)
+		(void)seq_bitmap_add_range(bitmap, range->seq1, range->seq2);
+}
+
+void seq_bitmap_to_seq_range(const struct seq_bitmap *bitmap,
+			     ARRAY_TYPE(seq_range) *dest)
+{
+	struct seq_bitmap_iter iter;
+	uint32_t seq1, seq2;
+
+	seq_bitmap_iter_init(&iter, bitmap);
+	while (seq_bitmap_iter_next_range(&iter, &seq1, &seq2))
+		seq_range_array_add_range(dest, seq1, seq2);
+}
+
+void seq_bitmap_iter_init(struct seq_bitmap_iter *iter_r,
+			  const struct seq_bitmap *bitmap)
+{
+	i_zero(iter_r);
+	iter_r->bitmap = bitmap;
+}
+
+/* Returns the next range within a single container. */
+static bool
+seq_bitmap_iter_next_container_range(struct seq_bitmap_iter *iter,
+				     uint32_t *seq1_r, uint32_t *seq2_r)
+{
+	const struct seq_bitmap_container *c;
+	const struct seq_range *range;
+	const uint16_t *values;
+	unsigned int count, first, last;
+
+	for (;; iter->container_idx++, iter->pos = 0) {
+		if (iter->container_idx >= array_count(&iter->bitmap->containers))
+			return FALSE;
+		c = array_idx(&iter->bitmap->containers, iter->container_idx);
+
+		switch (c->type) {
+		case CONTAINER_TYPE_ARRAY:
+			values = array_get(&c->values, &count);
+			if (iter->pos >= count)
+				continue;
+			first = last = values[iter->pos++];
+			while (iter->pos < count && values[iter->pos] == last + 1)
+				last = values[iter->pos++];
+			break;
+		case CONTAINER_TYPE_RUNS:
+			if (iter->pos >= array_count(&c->runs))
+				continue;
+			range = array_idx(&c->runs, iter->pos++);
+			first = range->seq1;
+			last = range->seq2;
+			break;
+		case CONTAINER_TYPE_BITMAP:
+			if (!bitmap_words_next_range(c->words, iter->pos,
+						     &first, &last))
+				continue;
+			iter->pos = last + 1;
+			break;
+		default:
+			i_unreached();
+		}
+		*seq1_r = CONTAINER_SEQ(c->key, first);
+		*seq2_r = CONTAINER_SEQ(c->key, last);
+		return TRUE;
+	}
+}
+
+bool seq_bitmap_iter_next_range(struct seq_bitmap_iter *iter,
+				uint32_t *seq1_r, uint32_t *seq2_r)
+{
+	unsigned int container_idx, pos;
+	uint32_t seq1, seq2;
+
+	if (!seq_bitmap_iter_next_container_range(iter, seq1_r, seq2_r))
+		return FALSE;
+
+	/* join ranges continuing in the next container */
+	while (*seq2_r != (uint32_t)-1) {
+		container_idx = iter->container_idx;
+		pos = iter->pos;
+		if (!seq_bitmap_iter_next_container_range(iter, &seq1, &seq2))
+			break;
+		if (seq1 != *seq2_r + 1) {
+			iter->container_idx = container_idx;
+			iter->pos = pos;
+			break;
+		}
+		*seq2_r = seq2;
+	}
+	return TRUE;
+}
+
+bool seq_bitmap_iter_next(struct seq_bitmap_iter *iter, uint32_t *seq_r)
+{
+	if (!iter->have_range) {
+		if (!seq_bitmap_iter_next_range(iter, &iter->seq, &iter->seq2))
+			return FALSE;
+		iter->have_range = TRUE;
+	}
+	*seq_r = iter->seq;
+	if (iter->seq == iter->seq2)
+		iter->have_range = FALSE;
+	else
+		iter->seq++;
+	return TRUE;
+}
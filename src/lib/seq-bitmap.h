@@ -0,0 +1,80 @@
+#ifndef SEQ_BITMAP_H
+#define SEQ_BITMAP_H
+
+#include "seq-range-array.h"
+
+/* Compressed set of sequences (or UIDs), similar to roaring bitmaps. The
+   sequence space is split into 65536 sequence long chunks, and each chunk
+   that has any sequences stores them in whichever form is the smallest: a
+   sorted array of the sequences, a bitmap or a seq_range array. This keeps
+   adding and removing sequences fast also for large fragmented sets, where
+   a seq_range array would need to move most of its memory around.
+
+   The same restrictions as for seq_range arrays apply: the full 0..UINT_MAX
+   range can't be used, because its size can't be returned. */
+
+struct seq_bitmap;
+
+struct seq_bitmap_iter {
+	const struct seq_bitmap *bitmap;
+	unsigned int container_idx, pos;
+
+	/* the range being returned by seq_bitmap_iter_next() */
+	uint32_t seq, seq2;
+	bool have_range;
+};
+
+struct seq_bitmap *seq_bitmap_create(void);
+void seq_bitmap_free(struct seq_bitmap **bitmap);
+/* Remove all sequences. */
+void seq_bitmap_clear(struct seq_bitmap *bitmap);
+
+/* Add sequence to the bitmap. Returns TRUE if it already existed. */
+bool ATTR_NOWARN_UNUSED_RESULT
+seq_bitmap_add(struct seq_bitmap *bitmap, uint32_t seq);
+/* Add sequence range. Returns the number of sequences actually added. */
+unsigned int ATTR_NOWARN_UNUSED_RESULT
+seq_bitmap_add_range(struct seq_bitmap *bitmap, uint32_t seq1, uint32_t seq2);
+/* Remove the given sequence. Returns TRUE if it was found. */
+bool ATTR_NOWARN_UNUSED_RESULT
+seq_bitmap_remove(struct seq_bitmap *bitmap, uint32_t seq);
+/* Remove a sequence range. Returns the number of sequences actually
+   removed. */
+unsigned int ATTR_NOWARN_UNUSED_RESULT
+seq_bitmap_remove_range(struct seq_bitmap *bitmap,
+			uint32_t seq1, uint32_t seq2);
+
+/* Returns TRUE if the sequence exists in the bitmap. */
+bool seq_bitmap_exists(const struct seq_bitmap *bitmap, uint32_t seq) ATTR_PURE;
+/* Returns the number of sequences in the bitmap. */
+unsigned int seq_bitmap_count(const struct seq_bitmap *bitmap) ATTR_PURE;
+
+/* Add all sequences from src to dest. */
+void seq_bitmap_merge(struct seq_bitmap *dest, const struct seq_bitmap *src);
+/* Remove sequences from dest that don't exist in src. Returns the number
+   of sequences removed. */
+unsigned int ATTR_NOWARN_UNUSED_RESULT
+seq_bitmap_intersect(struct seq_bitmap *dest, const struct seq_bitmap *src);
+/* Remove sequences from dest that exist in src. Returns the number of
+   sequences removed. */
+unsigned int ATTR_NOWARN_UNUSED_RESULT
+seq_bitmap_remove_bitmap(struct seq_bitmap *dest, const struct seq_bitmap *src);
+
+/* Add all sequences in the seq_range array to the bitmap. */
+void seq_bitmap_add_seq_range(struct seq_bitmap *bitmap,
+			      const ARRAY_TYPE(seq_range) *src);
+/* Add all sequences in the bitmap to the seq_range array. */
+void seq_bitmap_to_seq_range(const struct seq_bitmap *bitmap,
+			     ARRAY_TYPE(seq_range) *dest);
+
+/* Iterate through the sequences in ascending order. The bitmap must not be
+   modified while iterating. */
+void seq_bitmap_iter_init(struct seq_bitmap_iter *iter_r,
+			  const struct seq_bitmap *bitmap);
+/* Get the next range of sequences. Returns FALSE if there are no more. */
+bool seq_bitmap_iter_next_range(struct seq_bitmap_iter *iter,
+				uint32_t *seq1_r, uint32_t *seq2_r);
+/* Get the next sequence. Returns FALSE if there are no more. */
+bool seq_bitmap_iter_next(struct seq_bitmap_iter *iter, uint32_t *seq_r);
+
+#endif
@@ -15,3 +15,56 @@ int bsearch_strcasecmp(const char *key, const char *const *member)
 {
 	return strcasecmp(key, *member);
 }
+
+#define SORT_RADIX_BITS 8
+#define SORT_RADIX_BUCKETS (1 << SORT_RADIX_BITS)
+#define SORT_RADIX_PASSES (sizeof(uint64_t) * 8 / SORT_RADIX_BITS)
+
+void sort_radix_u64(struct sort_radix_u64_node *nodes, size_t count)
+{
+	size_t (*counts)[SORT_RADIX_BUCKETS];
+	struct sort_radix_u64_node *src = nodes, *dest, *tmp, *tmp_nodes;
+	size_t i, pos, n;
+	unsigned int pass, shift;
+
+	if (count < 2)
+		return;
+
+	/* calculate the histograms for all the passes at once */
+	counts = i_malloc(sizeof(*counts) * SORT_RADIX_PASSES);
+	for (i = 0; i < count; i++) {
+		uint64_t key = nodes[i].key;
+
+		for (pass = 0; pass < SORT_RADIX_PASSES; pass++) {
+			counts[pass][key & (SORT_RADIX_BUCKETS-1)]++;
+			key >>= SORT_RADIX_BITS;
+		}
+	}
+
+	tmp_nodes = dest = i_new(struct sort_radix_u64_node, count);
+	for (pass = 0; pass < SORT_RADIX_PASSES; pass++) {
+		shift = pass * SORT_RADIX_BITS;
+		/* skip the pass if all the keys have the same digit. This is
+		   usually the case for the highest bits. */
+		if (counts[pass][(src[0].key >> shift) &
+				 (SORT_RADIX_BUCKETS-1)] == count)
+			continue;
+
+		/* convert the counts to starting positions */
+		for (i = 0, pos = 0; i < SORT_RADIX_BUCKETS; i++) {
+			n = counts[pass][i];
+			counts[pass][i] = pos;
+			pos += n;
+		}
+		for (i = 0; i < count; i++) {
+			size_t *posp = &counts[pass][(src[i].key >> shift) &
+						     (SORT_RADIX_BUCKETS-1)];
+			dest[(*posp)++] = src[i];
+		}
+		tmp = src; src = dest; dest = tmp;
+	}
+	if (src != nodes)
+		memcpy(nodes, src, sizeof(*nodes) * count);
+	i_free(tmp_nodes);
+	i_free(counts);
+}
@@ -27,6 +27,19 @@ INTEGER_CMP(uint32_cmp, uint32_t)
 						typeof(const typeof(*base) *))), \
 		(int (*)(const void *, const void *))cmp)
 
+/* Node for sort_radix_u64(). The value is typically a sequence number or
+   an array index identifying the sorted item. */
+struct sort_radix_u64_node {
+	uint64_t key;
+	uint32_t value;
+};
+
+/* Stable LSD radix sort of the nodes by their keys. Nodes with identical keys
+   stay in their original order. This is much faster than i_qsort() for large
+   arrays, but it requires a temporary copy of the array, so for small arrays
+   the comparison sort is usually better. */
+void sort_radix_u64(struct sort_radix_u64_node *nodes, size_t count);
+
 int bsearch_strcmp(const char *key, const char *const *member) ATTR_PURE;
 int bsearch_strcasecmp(const char *key, const char *const *member) ATTR_PURE;
 
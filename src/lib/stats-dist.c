@@ -1,35 +1,67 @@
 /* Copyright (c) 2015-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "bits.h"
 #include "stats-dist.h"
-#include "sort.h"
 
-/* In order to have a vaguely accurate 95th percentile, you need way
-   more than 20 in your subsample. */
-#define TIMING_DEFAULT_SUBSAMPLING_BUFFER (20*24) /* 20*24 fits in a page */
+/* Values are counted in log-linear buckets: each power of two is split into
+   2^STATS_DIST_SUB_BUCKET_BITS equally sized buckets. Values below
+   2*STATS_DIST_SUB_BUCKET_COUNT have their own buckets, so they're counted
+   exactly. Larger values are placed into buckets whose width is at most
+   1/STATS_DIST_SUB_BUCKET_COUNT of the value. */
+#define STATS_DIST_SUB_BUCKET_BITS 4
+#define STATS_DIST_SUB_BUCKET_COUNT (1U << STATS_DIST_SUB_BUCKET_BITS)
+#define STATS_DIST_BUCKET_COUNT \
+	((64 - STATS_DIST_SUB_BUCKET_BITS + 1) * STATS_DIST_SUB_BUCKET_COUNT)
+/* Maximum number of values returned by stats_dist_get_samples() by default */
+#define STATS_DIST_DEFAULT_SAMPLE_COUNT (20*24)
 
 struct stats_dist {
 	unsigned int sample_count;
 	unsigned int count;
-	bool     sorted;
 	uint64_t min;
 	uint64_t max;
 	uint64_t sum;
-	uint64_t samples[];
+	/* running mean and sum of squared differences from it */
+	double mean, m2;
+	unsigned int buckets[STATS_DIST_BUCKET_COUNT];
 };
 
+static unsigned int stats_dist_bucket_idx(uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < 2*STATS_DIST_SUB_BUCKET_COUNT)
+		return value;
+	shift = bits_required64(value) - 1 - STATS_DIST_SUB_BUCKET_BITS;
+	return shift * STATS_DIST_SUB_BUCKET_COUNT + (value >> shift);
+}
+
+static void
+stats_dist_bucket_range(unsigned int idx, uint64_t *min_r, uint64_t *width_r)
+{
+	unsigned int shift;
+
+	if (idx < 2*STATS_DIST_SUB_BUCKET_COUNT) {
+		*min_r = idx;
+		*width_r = 1;
+		return;
+	}
+	shift = idx / STATS_DIST_SUB_BUCKET_COUNT - 1;
+	*min_r = (uint64_t)(idx - shift * STATS_DIST_SUB_BUCKET_COUNT) << shift;
+	*width_r = 1ULL << shift;
+}
+
 struct stats_dist *stats_dist_init(void)
 {
-	return stats_dist_init_with_size(TIMING_DEFAULT_SUBSAMPLING_BUFFER);
+	return stats_dist_init_with_size(STATS_DIST_DEFAULT_SAMPLE_COUNT);
 }
 
 struct stats_dist *stats_dist_init_with_size(unsigned int sample_count)
 {
 	i_assert(sample_count > 0);
 
-	struct stats_dist *stats =
-		i_malloc(sizeof(struct stats_dist) +
-			 sizeof(uint64_t) * sample_count);
+	struct stats_dist *stats = i_new(struct stats_dist, 1);
 	stats->sample_count = sample_count;
 	return stats;
 }
@@ -48,23 +80,60 @@ void stats_dist_reset(struct stats_dist *stats)
 
 void stats_dist_add(struct stats_dist *stats, uint64_t value)
 {
-	if (stats->count < stats->sample_count) {
-		stats->samples[stats->count] = value;
-		if (stats->count == 0)
-			stats->min = stats->max = value;
-	} else {
-		unsigned int idx = i_rand_limit(stats->count);
-		if (idx < stats->sample_count)
-			stats->samples[idx] = value;
-	}
+	stats_dist_add_count(stats, value, 1);
+}
 
-	stats->count++;
-	stats->sum += value;
+void stats_dist_add_count(struct stats_dist *stats, uint64_t value,
+			  unsigned int count)
+{
+	double delta = (double)value - stats->mean;
+	unsigned int new_count = stats->count + count;
+
+	i_assert(count > 0);
+
+	if (stats->count == 0)
+		stats->min = stats->max = value;
+
+	stats->buckets[stats_dist_bucket_idx(value)] += count;
+	stats->mean += delta * count / new_count;
+	stats->m2 += delta * delta * stats->count * count / new_count;
+
+	stats->count = new_count;
+	stats->sum += value * count;
 	if (stats->max < value)
 		stats->max = value;
 	if (stats->min > value)
 		stats->min = value;
-	stats->sorted = FALSE;
+}
+
+void stats_dist_merge(struct stats_dist *dest, const struct stats_dist *src)
+{
+	unsigned int i, new_count;
+	double delta;
+
+	if (src->count == 0)
+		return;
+	if (dest->count == 0) {
+		unsigned int sample_count = dest->sample_count;
+		*dest = *src;
+		dest->sample_count = sample_count;
+		return;
+	}
+
+	new_count = dest->count + src->count;
+	delta = src->mean - dest->mean;
+	dest->mean += delta * src->count / new_count;
+	dest->m2 += src->m2 +
+		delta * delta * dest->count * src->count / new_count;
+	for (i = 0; i < STATS_DIST_BUCKET_COUNT; i++)
+		dest->buckets[i] += src->buckets[i];
+
+	dest->count = new_count;
+	dest->sum += src->sum;
+	if (dest->max < src->max)
+		dest->max = src->max;
+	if (dest->min > src->min)
+		dest->min = src->min;
 }
 
 unsigned int stats_dist_get_count(const struct stats_dist *stats)
@@ -95,48 +164,44 @@ double stats_dist_get_avg(const struct stats_dist *stats)
 	return (double)stats->sum / stats->count;
 }
 
-static void stats_dist_ensure_sorted(struct stats_dist *stats)
-{
-	if (stats->sorted)
-		return;
-
-	unsigned int count = (stats->count < stats->sample_count)
-		? stats->count
-		: stats->sample_count;
-	i_qsort(stats->samples, count, sizeof(*stats->samples),
-		uint64_cmp);
-	stats->sorted = TRUE;
-}
-
-uint64_t stats_dist_get_median(struct stats_dist *stats)
+double stats_dist_get_variance(const struct stats_dist *stats)
 {
 	if (stats->count == 0)
 		return 0;
-	/* cast-away const - reading requires sorting */
-	stats_dist_ensure_sorted(stats);
-	unsigned int count = (stats->count < stats->sample_count)
-		? stats->count
-		: stats->sample_count;
-	unsigned int idx1 = (count-1)/2, idx2 = count/2;
-	return (stats->samples[idx1] + stats->samples[idx2]) / 2;
+	return stats->m2 / stats->count;
 }
 
-double stats_dist_get_variance(const struct stats_dist *stats)
+/* Returns the value of the event at the given index, as if all the events
+   were sorted. Within a bucket wider than 1 the events are assumed to be
+   evenly distributed. */
+static uint64_t
+stats_dist_get_ranked(const struct stats_dist *stats, unsigned int rank)
 {
-	double sum = 0;
-	if (stats->count == 0)
-		return 0;
+	uint64_t bucket_min, bucket_width, value;
+	unsigned int i;
 
-	double avg = stats_dist_get_avg(stats);
-	double count = (stats->count < stats->sample_count)
-		? stats->count
-		: stats->sample_count;
+	i_assert(rank < stats->count);
 
-	for(unsigned int i = 0; i < count; i++) {
-		sum += (stats->samples[i] - avg)*(stats->samples[i] - avg);
-	}
+	for (i = 0; rank >= stats->buckets[i]; i++)
+		rank -= stats->buckets[i];
 
-	return sum / count;
+	stats_dist_bucket_range(i, &bucket_min, &bucket_width);
+	value = bucket_min + (uint64_t)(bucket_width *
+		((rank + 0.5) / stats->buckets[i]));
+	if (value < stats->min)
+		return stats->min;
+	if (value > stats->max)
+		return stats->max;
+	return value;
+}
+
+uint64_t stats_dist_get_median(struct stats_dist *stats)
+{
+	if (stats->count == 0)
+		return 0;
+	unsigned int idx1 = (stats->count-1)/2, idx2 = stats->count/2;
+	return (stats_dist_get_ranked(stats, idx1) +
+		stats_dist_get_ranked(stats, idx2)) / 2;
 }
 
 /* This is independent of the stats framework, useful for any selection task */
@@ -155,7 +220,7 @@ static unsigned int stats_dist_get_index(unsigned int range, double fraction)
 	/* Exact boundaries belong to the open range below them.
 	   As FP isn't exact, and ratios may be specified inexactly,
 	   include a small amount of fuzz around the exact boundary. */
-	if (idx_float < 1e-8*range)
+	if (idx_float < 1e-8*range && idx > 0)
 		idx--;
 
 	return idx;
@@ -165,19 +230,22 @@ uint64_t stats_dist_get_percentile(struct stats_dist *stats, double fraction)
 {
 	if (stats->count == 0)
 		return 0;
-	stats_dist_ensure_sorted(stats);
-	unsigned int count = (stats->count < stats->sample_count)
-		? stats->count
-		: stats->sample_count;
-	unsigned int idx = stats_dist_get_index(count, fraction);
-	return stats->samples[idx];
+	unsigned int idx = stats_dist_get_index(stats->count, fraction);
+	return stats_dist_get_ranked(stats, idx);
 }
 
 const uint64_t *stats_dist_get_samples(const struct stats_dist *stats,
 				       unsigned int *count_r)
 {
-	*count_r = (stats->count < stats->sample_count)
-		? stats->count
-		: stats->sample_count;
-	return stats->samples;
+	unsigned int i, count;
+	uint64_t *samples;
+
+	count = I_MIN(stats->count, stats->sample_count);
+	samples = t_new(uint64_t, I_MAX(count, 1));
+	for (i = 0; i < count; i++) {
+		samples[i] = stats_dist_get_ranked(stats,
+			(uint64_t)i * stats->count / count);
+	}
+	*count_r = count;
+	return samples;
 }
@@ -1,7 +1,14 @@
 #ifndef STATS_DIST_H
 #define STATS_DIST_H
 
+/* The events are counted in a log-linear histogram. Counts, sum, min, max,
+   average and variance are exact. Median and percentiles are exact for values
+   below 32, and otherwise within a few percent of the real value. The memory
+   usage is constant, and distributions can be merged without losing any
+   accuracy. */
 struct stats_dist *stats_dist_init(void);
+/* sample_count is the maximum number of values returned by
+   stats_dist_get_samples(). It doesn't affect the accuracy. */
 struct stats_dist *stats_dist_init_with_size(unsigned int sample_count);
 void stats_dist_deinit(struct stats_dist **stats);
 
@@ -10,6 +17,12 @@ void stats_dist_reset(struct stats_dist *stats);
 
 /* Add a new event. */
 void stats_dist_add(struct stats_dist *stats, uint64_t value);
+/* Add the same value as count events. This is used for sampled events, where
+   each received event represents count events. */
+void stats_dist_add_count(struct stats_dist *stats, uint64_t value,
+			  unsigned int count);
+/* Add all the events in src to dest. */
+void stats_dist_merge(struct stats_dist *dest, const struct stats_dist *src);
 
 /* Returns number of events added. */
 unsigned int stats_dist_get_count(const struct stats_dist *stats);
@@ -22,19 +35,21 @@ uint64_t stats_dist_get_min(const struct stats_dist *stats);
 uint64_t stats_dist_get_max(const struct stats_dist *stats);
 /* Returns events' average. */
 double stats_dist_get_avg(const struct stats_dist *stats);
-/* Returns events' approximate (through random subsampling) median. */
+/* Returns events' approximate median. */
 uint64_t stats_dist_get_median(struct stats_dist *stats);
 /* Returns events' variance */
 double stats_dist_get_variance(const struct stats_dist *stats);
-/* Returns events' approximate (through random subsampling) percentile.
+/* Returns events' approximate percentile.
    fraction parameter is in the range (0., 1.], so 95th %-ile is 0.95. */
 uint64_t stats_dist_get_percentile(struct stats_dist *stats, double fraction);
-/* Returns events' approximate (through random subsampling) 95th percentile. */
+/* Returns events' approximate 95th percentile. */
 static inline uint64_t stats_dist_get_95th(struct stats_dist *stats)
 {
 	return stats_dist_get_percentile(stats, 0.95);
 }
-/* Returns the sample array */
+/* Returns an array of at most sample_count values evenly spaced over the
+   events in sorted order. The values are approximated the same way as
+   percentiles. The array is allocated from data stack. */
 const uint64_t *stats_dist_get_samples(const struct stats_dist *stats,
 				       unsigned int *count_r);
 #endif
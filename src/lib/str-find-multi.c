@@ -0,0 +1,237 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+/* @UNSAFE: whole file */
+
+#include "lib.h"
+#include "str-find-multi.h"
+
+/* The automaton is a fully expanded DFA. To keep the table small, the input
+   bytes are first mapped to classes: each byte that appears in some key gets
+   its own class and all the other bytes share class 0. The transition table
+   entries contain the row offset of the next state, so the search loop
+   doesn't need to multiply. The high bit is set if the next state ends some
+   key(s). */
+#define STATE_OUTPUT_FLAG 0x80000000U
+#define STATE_ROW_MASK ((uint32_t)~STATE_OUTPUT_FLAG)
+#define KEY_IDX_NONE UINT_MAX
+
+struct str_find_multi_context {
+	pool_t pool;
+	unsigned int key_count, found_count;
+	unsigned int class_count;
+
+	/* row offset of the current state */
+	uint32_t state_row;
+	uint32_t *trans;
+
+	/* first key that ends in the state or KEY_IDX_NONE */
+	unsigned int *state_key;
+	/* the longest proper suffix state that ends some key, or 0 */
+	unsigned int *dict_link;
+	/* next key that has the same contents as this one */
+	unsigned int *key_next;
+	bool *found;
+
+	uint8_t byte_class[UCHAR_MAX+1];
+};
+
+static void
+str_find_multi_init_classes(struct str_find_multi_context *ctx,
+			    const char *const *keys, unsigned int key_count)
+{
+	const unsigned char *p;
+	unsigned int i;
+
+	ctx->class_count = 1;
+	for (i = 0; i < key_count; i++) {
+		for (p = (const unsigned char *)keys[i]; *p != '\0'; p++) {
+			if (ctx->byte_class[*p] == 0)
+				ctx->byte_class[*p] = ctx->class_count++;
+		}
+	}
+}
+
+static void
+str_find_multi_build(struct str_find_multi_context *ctx,
+		     const char *const *keys, unsigned int state_count)
+{
+	unsigned int class_count = ctx->class_count;
+	unsigned int *queue, *fail, head, tail;
+	unsigned int i, state, next, state_next, c;
+	const unsigned char *p;
+
+	/* trie - transitions to state 0 mean "missing" at this point, since
+	   nothing in the trie points to the root */
+	state_next = 1;
+	for (i = 0; i < ctx->key_count; i++) {
+		state = 0;
+		for (p = (const unsigned char *)keys[i]; *p != '\0'; p++) {
+			c = ctx->byte_class[*p];
+			next = ctx->trans[state * class_count + c];
+			if (next == 0) {
+				next = state_next++;
+				ctx->trans[state * class_count + c] = next;
+			}
+			state = next;
+		}
+		ctx->key_next[i] = ctx->state_key[state];
+		ctx->state_key[state] = i;
+	}
+	i_assert(state_next <= state_count);
+
+	/* Breadth-first walk to fill the failure transitions. The fail
+	   state is always shallower, so its row is already complete. */
+	queue = t_new(unsigned int, state_count);
+	fail = t_new(unsigned int, state_count);
+	head = tail = 0;
+	for (c = 0; c < class_count; c++) {
+		next = ctx->trans[c];
+		if (next != 0)
+			queue[tail++] = next;
+	}
+	while (head < tail) {
+		state = queue[head++];
+		for (c = 0; c < class_count; c++) {
+			uint32_t *t = &ctx->trans[state * class_count + c];
+			unsigned int fail_next =
+				ctx->trans[fail[state] * class_count + c];
+
+			if (*t == 0) {
+				*t = fail_next;
+				continue;
+			}
+			next = *t;
+			fail[next] = fail_next;
+			ctx->dict_link[next] =
+				ctx->state_key[fail_next] != KEY_IDX_NONE ?
+				fail_next : ctx->dict_link[fail_next];
+			queue[tail++] = next;
+		}
+	}
+
+	/* convert the state numbers to row offsets with output flags */
+	for (i = 0; i < state_next * class_count; i++) {
+		next = ctx->trans[i];
+		ctx->trans[i] = next * class_count;
+		if (ctx->state_key[next] != KEY_IDX_NONE ||
+		    ctx->dict_link[next] != 0)
+			ctx->trans[i] |= STATE_OUTPUT_FLAG;
+	}
+}
+
+struct str_find_multi_context *
+str_find_multi_init(pool_t pool, const char *const *keys,
+		    unsigned int key_count)
+{
+	struct str_find_multi_context *ctx;
+	unsigned int i, state_count = 1;
+	size_t key_len;
+
+	i_assert(key_count > 0);
+
+	for (i = 0; i < key_count; i++) {
+		key_len = strlen(keys[i]);
+		i_assert(key_len > 0);
+		i_assert(key_len < INT_MAX - state_count);
+		state_count += key_len;
+	}
+
+	ctx = p_new(pool, struct str_find_multi_context, 1);
+	ctx->pool = pool;
+	ctx->key_count = key_count;
+	str_find_multi_init_classes(ctx, keys, key_count);
+	i_assert(MALLOC_MULTIPLY(state_count, ctx->class_count) <
+		 STATE_OUTPUT_FLAG);
+
+	ctx->trans = p_new(pool, uint32_t,
+			   MALLOC_MULTIPLY(state_count, ctx->class_count));
+	ctx->state_key = p_new(pool, unsigned int, state_count);
+	for (i = 0; i < state_count; i++)
+		ctx->state_key[i] = KEY_IDX_NONE;
+	ctx->dict_link = p_new(pool, unsigned int, state_count);
+	ctx->key_next = p_new(pool, unsigned int, key_count);
+	ctx->found = p_new(pool, bool, key_count);
+
+	T_BEGIN {
+		str_find_multi_build(ctx, keys, state_count);
+	} T_END;
+	return ctx;
+}
+
+void str_find_multi_deinit(struct str_find_multi_context **_ctx)
+{
+	struct str_find_multi_context *ctx = *_ctx;
+
+	*_ctx = NULL;
+	p_free(ctx->pool, ctx->trans);
+	p_free(ctx->pool, ctx->state_key);
+	p_free(ctx->pool, ctx->dict_link);
+	p_free(ctx->pool, ctx->key_next);
+	p_free(ctx->pool, ctx->found);
+	p_free(ctx->pool, ctx);
+}
+
+static void
+str_find_multi_output(struct str_find_multi_context *ctx, uint32_t row)
+{
+	unsigned int key_idx, state = row / ctx->class_count;
+
+	do {
+		key_idx = ctx->state_key[state];
+		for (; key_idx != KEY_IDX_NONE; key_idx = ctx->key_next[key_idx]) {
+			if (!ctx->found[key_idx]) {
+				ctx->found[key_idx] = TRUE;
+				ctx->found_count++;
+			}
+		}
+		state = ctx->dict_link[state];
+	} while (state != 0);
+}
+
+bool str_find_multi_more(struct str_find_multi_context *ctx,
+			 const unsigned char *data, size_t size)
+{
+	const uint32_t *trans = ctx->trans;
+	const uint8_t *byte_class = ctx->byte_class;
+	uint32_t next, row = ctx->state_row;
+	size_t i;
+
+	if (ctx->found_count == ctx->key_count)
+		return TRUE;
+
+	for (i = 0; i < size; i++) {
+		next = trans[row + byte_class[data[i]]];
+		row = next & STATE_ROW_MASK;
+		if (unlikely((next & STATE_OUTPUT_FLAG) != 0)) {
+			str_find_multi_output(ctx, row);
+			if (ctx->found_count == ctx->key_count)
+				break;
+		}
+	}
+	ctx->state_row = row;
+	return ctx->found_count == ctx->key_count;
+}
+
+bool str_find_multi_is_found(struct str_find_multi_context *ctx,
+			     unsigned int key_idx)
+{
+	i_assert(key_idx < ctx->key_count);
+	return ctx->found[key_idx];
+}
+
+unsigned int str_find_multi_get_found_count(struct str_find_multi_context *ctx)
+{
+	return ctx->found_count;
+}
+
+void str_find_multi_reset(struct str_find_multi_context *ctx)
+{
+	ctx->state_row = 0;
+}
+
+void str_find_multi_reset_found(struct str_find_multi_context *ctx)
+{
+	ctx->state_row = 0;
+	ctx->found_count = 0;
+	memset(ctx->found, 0, sizeof(ctx->found[0]) * ctx->key_count);
+}
@@ -0,0 +1,34 @@
+#ifndef STR_FIND_MULTI_H
+#define STR_FIND_MULTI_H
+
+/* Find multiple keys from data with a single pass (Aho-Corasick). This is
+   faster than running str_find_more() separately for each key when there
+   are more than a couple of keys. The memory usage is roughly
+   total_key_length * distinct_key_bytes * 4 bytes, so the caller should
+   limit the key lengths if they come from untrusted input. */
+
+struct str_find_multi_context;
+
+struct str_find_multi_context *
+str_find_multi_init(pool_t pool, const char *const *keys,
+		    unsigned int key_count);
+void str_find_multi_deinit(struct str_find_multi_context **ctx);
+
+/* Search for the keys in data. It's possible to send the data in arbitrary
+   blocks and have the keys still match. Returns TRUE if all the keys have
+   now been found, i.e. there is no need to search further. */
+bool str_find_multi_more(struct str_find_multi_context *ctx,
+			 const unsigned char *data, size_t size);
+/* Returns TRUE if key with the given index has been found. */
+bool str_find_multi_is_found(struct str_find_multi_context *ctx,
+			     unsigned int key_idx);
+/* Returns the number of distinct key indexes found so far. */
+unsigned int str_find_multi_get_found_count(struct str_find_multi_context *ctx);
+
+/* Reset input data. The next str_find_multi_more() call won't try to match
+   the keys to earlier data. The keys that were already found stay found. */
+void str_find_multi_reset(struct str_find_multi_context *ctx);
+/* Reset input data and forget which keys were found. */
+void str_find_multi_reset_found(struct str_find_multi_context *ctx);
+
+#endif
@@ -11,6 +11,9 @@
 #include <stdio.h>
 #include <limits.h>
 #include <ctype.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 #define STRCONCAT_BUFSIZE 512
 
@@ -705,6 +708,33 @@ size_t i_memcspn(const void *data, size_t data_len,
 	return ptr - start;
 }
 
+const void *i_memchr2(const void *data, unsigned char c1, unsigned char c2,
+		      size_t size)
+{
+	const unsigned char *p = data, *end = p + size;
+
+#ifdef __SSE2__
+	/* SSE2 is always available on x86-64 */
+	const __m128i v1 = _mm_set1_epi8((char)c1);
+	const __m128i v2 = _mm_set1_epi8((char)c2);
+	unsigned int mask;
+
+	for (; end - p >= 16; p += 16) {
+		__m128i x = _mm_loadu_si128((const void *)p);
+
+		mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, v1),
+						      _mm_cmpeq_epi8(x, v2)));
+		if (mask != 0)
+			return p + __builtin_ctz(mask);
+	}
+#endif
+	for (; p < end; p++) {
+		if (*p == c1 || *p == c2)
+			return p;
+	}
+	return NULL;
+}
+
 static char **
 split_str_slow(pool_t pool, const char *data, const char *separators, bool spaces)
 {
@@ -144,6 +144,10 @@ size_t i_memspn(const void *data, size_t data_len,
 */
 size_t i_memcspn(const void *data, size_t data_len,
 		 const void *reject, size_t reject_len);
+/* Like memchr(), but find the first byte that is either c1 or c2. This is
+   useful e.g. for finding the next line ending, which can be CR or LF. */
+const void *i_memchr2(const void *data, unsigned char c1, unsigned char c2,
+		      size_t size) ATTR_PURE;
 
 static inline char *i_strchr_to_next(const char *str, char chr)
 {
@@ -79,27 +79,50 @@ STR_TO_U__TEMPLATE(str_to_ullong, unsigned long long)
 STR_TO_U__TEMPLATE(str_to_uint32, uint32_t)
 STR_TO_U__TEMPLATE(str_to_uint64, uint64_t)
 
+/* This many digits always fit into uintmax_t without overflowing */
+#if UINTMAX_MAX == 18446744073709551615ULL
+#  define STR_UINTMAX_SAFE_DIGITS 19
+#else
+#  define STR_UINTMAX_SAFE_DIGITS 9
+#endif
+
 int str_parse_uintmax(const char *str, uintmax_t *num_r,
 	const char **endp_r)
 {
-	uintmax_t n = 0;
+	const unsigned char *p = (const unsigned char *)str;
+	unsigned int i, digit;
+	uintmax_t n;
 
-	if (*str < '0' || *str > '9')
+	/* Characters below '0' wrap around, so a single comparison is enough
+	   to check for a digit. */
+	digit = p[0] - '0';
+	if (digit > 9)
 		return -1;
+	n = digit;
+
+	/* Most numbers are short, so parse them without overflow checks */
+	for (i = 1; i < STR_UINTMAX_SAFE_DIGITS; i++) {
+		digit = p[i] - '0';
+		if (digit > 9)
+			goto end;
+		n = n * 10 + digit;
+	}
 
-	do {
+	for (;; i++) {
+		digit = p[i] - '0';
+		if (digit > 9)
+			break;
 		if (n >= ((uintmax_t)-1 / 10)) {
 			if (n > (uintmax_t)-1 / 10)
 				return -1;
-			if ((uintmax_t)(*str - '0') > ((uintmax_t)-1 % 10))
+			if ((uintmax_t)digit > ((uintmax_t)-1 % 10))
 				return -1;
 		}
-		n = n * 10 + (*str - '0');
-		str++;
-	} while (*str >= '0' && *str <= '9');
-
+		n = n * 10 + digit;
+	}
+end:
 	if (endp_r != NULL)
-		*endp_r = str;
+		*endp_r = str + i;
 	*num_r = n;
 	return 0;
 }
@@ -3,6 +3,7 @@
 #include "test-lib.h"
 #include "str.h"
 #include "base64.h"
+#include "base64-private.h"
 
 static void test_base64_encode(void)
 {
@@ -1302,6 +1303,142 @@ static void test_base64_encode_lines(void)
 	test_end();
 }
 
+static void
+test_base64_simd_encode(const struct base64_scheme *b64,
+			enum base64_encode_flags flags, size_t max_line_len,
+			const unsigned char *in, size_t in_size,
+			size_t dest_size, buffer_t *out, size_t *src_pos_r)
+{
+	struct base64_encoder enc;
+	unsigned char dest_data[4096];
+	buffer_t dest;
+
+	buffer_create_from_data(&dest, dest_data, dest_size);
+	base64_encode_init(&enc, b64, flags, max_line_len);
+	(void)base64_encode_more(&enc, in, in_size, src_pos_r, &dest);
+	buffer_append_buf(out, &dest, 0, SIZE_MAX);
+}
+
+static int
+test_base64_simd_decode(const struct base64_scheme *b64,
+			enum base64_decode_flags flags,
+			const unsigned char *in, size_t in_size,
+			size_t dest_size, buffer_t *out, size_t *src_pos_r)
+{
+	struct base64_decoder dec;
+	unsigned char dest_data[4096];
+	buffer_t dest;
+	int ret;
+
+	buffer_create_from_data(&dest, dest_data, dest_size);
+	base64_decode_init(&dec, b64, flags);
+	ret = base64_decode_more(&dec, in, in_size, src_pos_r, &dest);
+	buffer_append_buf(out, &dest, 0, SIZE_MAX);
+	return ret;
+}
+
+static void test_base64_simd(void)
+{
+	static const enum base64_simd_impl impls[] = {
+		BASE64_SIMD_IMPL_SSSE3,
+		BASE64_SIMD_IMPL_AVX2,
+	};
+	static const char *impl_names[] = { "SSSE3", "AVX2" };
+	static const unsigned char whitespace[] = { ' ', '\t', '\r', '\n' };
+	const struct base64_scheme *b64;
+	unsigned char in[2000], *data;
+	buffer_t *encoded, *out1, *out2;
+	size_t in_size, dest_size, max_line_len, pos, src_pos1, src_pos2;
+	enum base64_encode_flags enc_flags;
+	enum base64_decode_flags dec_flags;
+	unsigned int i, j, n;
+	int ret1, ret2;
+
+	encoded = t_buffer_create(4096);
+	out1 = t_buffer_create(4096);
+	out2 = t_buffer_create(4096);
+	for (i = 0; i < N_ELEMENTS(impls); i++) {
+		if (!base64_simd_set_impl(impls[i]))
+			continue;
+		test_begin(t_strdup_printf("base64 %s", impl_names[i]));
+		for (j = 0; j < 5000; j++) {
+			b64 = i_rand_limit(2) == 0 ?
+				&base64_scheme : &base64url_scheme;
+			in_size = i_rand_limit(sizeof(in));
+			for (pos = 0; pos < in_size; pos++)
+				in[pos] = i_rand_uchar();
+			max_line_len = i_rand_limit(3) == 0 ? 76 : SIZE_MAX;
+			enc_flags = i_rand_limit(2) == 0 ? 0 :
+				BASE64_ENCODE_FLAG_CRLF;
+			dest_size = i_rand_limit(4) == 0 ?
+				i_rand_limit(4096) : 4096;
+
+			/* encoding gives identical results */
+			buffer_set_used_size(out1, 0);
+			buffer_set_used_size(out2, 0);
+			test_base64_simd_encode(b64, enc_flags, max_line_len,
+						in, in_size,
+						dest_size, out2, &src_pos2);
+			(void)base64_simd_set_impl(BASE64_SIMD_IMPL_NONE);
+			test_base64_simd_encode(b64, enc_flags, max_line_len,
+						in, in_size,
+						dest_size, out1, &src_pos1);
+			(void)base64_simd_set_impl(impls[i]);
+			test_assert_idx(src_pos1 == src_pos2, j);
+			test_assert_idx(buffer_cmp(out1, out2), j);
+
+			/* decoding gives identical results, also with
+			   whitespace, invalid characters and padding in
+			   random places */
+			buffer_set_used_size(encoded, 0);
+			buffer_append_buf(encoded, out1, 0, SIZE_MAX);
+			n = i_rand_limit(3);
+			while (n-- > 0 && encoded->used > 0) {
+				pos = i_rand_limit(encoded->used);
+				data = buffer_get_modifiable_data(encoded, NULL);
+				switch (i_rand_limit(3)) {
+				case 0:
+					data[pos] = whitespace[i_rand_limit(
+						N_ELEMENTS(whitespace))];
+					break;
+				case 1:
+					data[pos] = '=';
+					break;
+				default:
+					data[pos] = i_rand_uchar();
+					break;
+				}
+			}
+			dec_flags = i_rand_limit(2) == 0 ? 0 :
+				BASE64_DECODE_FLAG_NO_WHITESPACE;
+			dest_size = i_rand_limit(4) == 0 ?
+				i_rand_limit(4096) : 4096;
+			buffer_set_used_size(out1, 0);
+			buffer_set_used_size(out2, 0);
+			ret2 = test_base64_simd_decode(b64, dec_flags,
+						       encoded->data,
+						       encoded->used,
+						       dest_size, out2,
+						       &src_pos2);
+			(void)base64_simd_set_impl(BASE64_SIMD_IMPL_NONE);
+			ret1 = test_base64_simd_decode(b64, dec_flags,
+						       encoded->data,
+						       encoded->used,
+						       dest_size, out1,
+						       &src_pos1);
+			(void)base64_simd_set_impl(impls[i]);
+			test_assert_idx(ret1 == ret2, j);
+			test_assert_idx(src_pos1 == src_pos2, j);
+			test_assert_idx(buffer_cmp(out1, out2), j);
+		}
+		test_end();
+	}
+	/* back to the default */
+	if (!base64_simd_set_impl(BASE64_SIMD_IMPL_AVX2) &&
+	    !base64_simd_set_impl(BASE64_SIMD_IMPL_SSSE3))
+		(void)base64_simd_set_impl(BASE64_SIMD_IMPL_NONE);
+}
+
 void test_base64(void)
 {
 	test_base64_encode();
@@ -1314,4 +1451,5 @@ void test_base64(void)
 	test_base64_decode_lowlevel();
 	test_base64_random_lowlevel();
 	test_base64_encode_lines();
+	test_base64_simd();
 }
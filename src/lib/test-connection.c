@@ -725,6 +725,75 @@ static void test_connection_no_version(void)
 
 /* END NO VERSION TEST */
 
+/* BEGIN OUTPUT BATCH TEST */
+
+#define TEST_BATCH_LINES 100
+
+static void test_connection_batch_client_connected(struct connection *conn,
+						   bool success)
+{
+	test_assert(success);
+	for (unsigned int i = 0; i < TEST_BATCH_LINES; i++) {
+		connection_output_batch(conn);
+		o_stream_nsend_str(conn->output,
+				   t_strdup_printf("LINE\t%u\n", i));
+	}
+	/* nothing is written before the next ioloop iteration */
+	test_assert(o_stream_get_buffer_used_size(conn->output) >=
+		    TEST_BATCH_LINES * strlen("LINE\t0\n"));
+}
+
+static int
+test_connection_batch_input_args(struct connection *conn,
+				 const char *const *args)
+{
+	unsigned int n;
+
+	if (strcmp(args[0], "LINE") != 0 || args[1] == NULL ||
+	    str_to_uint(args[1], &n) < 0)
+		return -1;
+	test_assert(n == (unsigned int)received_count);
+	if (++received_count < TEST_BATCH_LINES)
+		return 1;
+
+	/* all the lines were received with a single read, possibly
+	   separately from the VERSION line */
+	test_assert(conn->list->stats.input_batches <= 2);
+	test_assert(conn->list->stats.input_lines == TEST_BATCH_LINES + 1);
+	connection_disconnect(conn);
+	return 0;
+}
+
+static void test_connection_batch_destroy(struct connection *conn)
+{
+	if (conn->list->set.client) {
+		test_assert(conn->list->stats.output_batch_requests ==
+			    TEST_BATCH_LINES);
+		test_assert(conn->list->stats.output_batch_flushes == 1);
+	}
+	test_connection_simple_destroy(conn);
+}
+
+static const struct connection_vfuncs batch_v =
+{
+	.client_connected = test_connection_batch_client_connected,
+	.input_args = test_connection_batch_input_args,
+	.destroy = test_connection_batch_destroy,
+};
+
+static void test_connection_output_batch(void)
+{
+	test_begin("connection output batch");
+
+	received_count = 0;
+	test_connection_run(&server_set, &client_set, &batch_v, &batch_v, 1);
+	test_assert(received_count == TEST_BATCH_LINES);
+
+	test_end();
+}
+
+/* END OUTPUT BATCH TEST */
+
 void test_connection(void)
 {
 	test_connection_simple();
@@ -741,4 +810,5 @@ void test_connection(void)
 	test_connection_handshake_failed_input();
 	test_connection_input_error_reason();
 	test_connection_no_version();
+	test_connection_output_batch();
 }
@@ -3,6 +3,63 @@
 #include "test-lib.h"
 #include "crc32.h"
 
+static void test_crc32_impls(void)
+{
+	static const enum crc32_impl impls[] = {
+		CRC32_IMPL_TABLE, CRC32_IMPL_HW
+	};
+	unsigned char data[1024];
+	uint32_t crc, crcc, crc_ref, crcc_ref;
+	size_t size, offset, split, i, j;
+	unsigned int k;
+
+	test_begin("crc32 implementations");
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = i_rand_uchar();
+
+	for (i = 0; i < 2000; i++) {
+		offset = i_rand_limit(16);
+		size = i_rand_limit(sizeof(data) - offset);
+
+		/* compare against the byte a time reference computation */
+		crc_ref = crcc_ref = 0xffffffff;
+		for (j = 0; j < size; j++) {
+			crc_ref ^= data[offset + j];
+			crcc_ref ^= data[offset + j];
+			for (k = 0; k < 8; k++) {
+				crc_ref = (crc_ref >> 1) ^
+					((crc_ref & 1) != 0 ? 0xedb88320 : 0);
+				crcc_ref = (crcc_ref >> 1) ^
+					((crcc_ref & 1) != 0 ? 0x82f63b78 : 0);
+			}
+		}
+		crc_ref = ~crc_ref;
+		crcc_ref = ~crcc_ref;
+
+		for (j = 0; j < N_ELEMENTS(impls); j++) {
+			if (!crc32_set_impl(impls[j]))
+				continue;
+			crc = crc32_data(data + offset, size);
+			crcc = crc32c_data(data + offset, size);
+			test_assert_idx(crc == crc_ref, i);
+			test_assert_idx(crcc == crcc_ref, i);
+
+			/* split into two parts */
+			split = size == 0 ? 0 : i_rand_limit(size);
+			crc = crc32_data(data + offset, split);
+			crc = crc32_data_more(crc, data + offset + split,
+					      size - split);
+			crcc = crc32c_data(data + offset, split);
+			crcc = crc32c_data_more(crcc, data + offset + split,
+						size - split);
+			test_assert_idx(crc == crc_ref, i);
+			test_assert_idx(crcc == crcc_ref, i);
+		}
+	}
+	(void)crc32_set_impl(CRC32_IMPL_AUTO);
+	test_end();
+}
+
 void test_crc32(void)
 {
 	const char str[] = "foo\0bar";
@@ -10,5 +67,10 @@ void test_crc32(void)
 	test_begin("crc32");
 	test_assert(crc32_str(str) == 0x8c736521);
 	test_assert(crc32_data(str, sizeof(str)) == 0x32c9723d);
+	/* the standard check values */
+	test_assert(crc32_str("123456789") == 0xcbf43926);
+	test_assert(crc32c_data("123456789", 9) == 0xe3069283);
 	test_end();
+
+	test_crc32_impls();
 }
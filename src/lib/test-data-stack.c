@@ -343,6 +343,98 @@ static void test_ds_pass_str(void)
 	test_end();
 }
 
+static int ds_frame_peak_event_count = 0;
+
+static bool
+test_ds_frame_peak_event_callback(struct event *event,
+				  enum event_callback_type type,
+				  struct failure_context *ctx ATTR_UNUSED,
+				  const char *fmt ATTR_UNUSED,
+				  va_list args ATTR_UNUSED)
+{
+	const struct event_field *field;
+
+	if (type != EVENT_CALLBACK_TYPE_SEND ||
+	    strcmp(event->sending_name, "data_stack_frame_peak") != 0)
+		return TRUE;
+
+	ds_frame_peak_event_count++;
+	field = event_find_field_nonrecursive(event, "peak_bytes");
+	test_assert(field != NULL &&
+		    field->value_type == EVENT_FIELD_VALUE_TYPE_INTMAX &&
+		    field->value.intmax >= 1024 * 200);
+	field = event_find_field_nonrecursive(event, "frame_marker");
+	test_assert(field != NULL &&
+		    field->value_type == EVENT_FIELD_VALUE_TYPE_STR &&
+		    str_begins_with(field->value.str, "test-frame-stats "));
+	return TRUE;
+}
+
+static const struct data_stack_frame_stats *
+test_ds_frame_stats_find(const char *marker)
+{
+	const struct data_stack_frame_stats *const *stats;
+	unsigned int i, count;
+
+	stats = data_stack_frame_stats_get(&count);
+	for (i = 0; i < count; i++) {
+		if (strcmp(stats[i]->marker, marker) == 0)
+			return stats[i];
+	}
+	return NULL;
+}
+
+static void test_ds_frame_stats(void)
+{
+	const struct data_stack_frame_stats *outer, *inner;
+	const char *error;
+	unsigned int i, count;
+
+	test_begin("data-stack frame stats");
+	event_register_callback(test_ds_frame_peak_event_callback);
+	struct event_filter *filter = event_filter_create();
+	test_assert(event_filter_parse("event=data_stack_frame_peak", filter, &error) == 0);
+	event_set_global_debug_log_filter(filter);
+	event_filter_unref(&filter);
+
+	data_stack_frame_stats_enable(1024);
+	for (i = 0; i < 3; i++) {
+		data_stack_frame_t outer_id = t_push("test-frame-stats outer");
+		(void)t_malloc_no0(100);
+		data_stack_frame_t inner_id = t_push("test-frame-stats inner");
+		(void)t_malloc_no0(i == 0 ? 1024*200 : 1024*10);
+		test_assert(t_pop(&inner_id));
+		T_BEGIN {
+			/* too small to be accounted */
+			(void)t_malloc_no0(100);
+		} T_END;
+		test_assert(t_pop(&outer_id));
+	}
+
+	outer = test_ds_frame_stats_find("test-frame-stats outer");
+	inner = test_ds_frame_stats_find("test-frame-stats inner");
+	test_assert(outer != NULL && inner != NULL);
+	if (outer != NULL && inner != NULL) {
+		test_assert(inner->count == 3);
+		test_assert(inner->peak_bytes >= 1024*200);
+		test_assert(inner->peak_blocks == 2);
+		test_assert(inner->total_peak_bytes >= 1024*(200 + 10*2));
+		test_assert(outer->count == 3);
+		test_assert(outer->peak_bytes >= inner->peak_bytes + 100);
+		test_assert(outer->peak_blocks == 2);
+	}
+	(void)data_stack_frame_stats_get(&count);
+	test_assert(count == 2);
+	/* only the first round's frames reached a new peak */
+	test_assert(ds_frame_peak_event_count == 2);
+
+	data_stack_frame_stats_disable();
+	test_assert(data_stack_frame_stats_get(&count) == NULL && count == 0);
+	event_unset_global_debug_log_filter();
+	event_unregister_callback(test_ds_frame_peak_event_callback);
+	test_end();
+}
+
 void test_data_stack(void)
 {
 	void (*tests[])(void) = {
@@ -354,6 +446,7 @@ void test_data_stack(void)
 		test_ds_realloc,
 		test_ds_recursive,
 		test_ds_pass_str,
+		test_ds_frame_stats,
 	};
 	for (unsigned int i = 0; i < N_ELEMENTS(tests); i++) {
 		ds_grow_event_count = 0;
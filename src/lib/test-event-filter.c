@@ -2,6 +2,7 @@
 
 #include "test-lib.h"
 #include "ioloop.h"
+#include "str.h"
 #include "event-filter-private.h"
 
 static void test_event_filter_override_parent_fields(void)
@@ -881,6 +882,163 @@ static void test_event_filter_ambiguous_units(void)
 	test_end();
 }
 
+static void
+test_event_filter_add_query(struct event_filter *filter, const char *query,
+			    const char *context)
+{
+	struct event_filter *src = event_filter_create();
+	const char *error;
+
+	test_assert(event_filter_parse(query, src, &error) == 0);
+	event_filter_merge_with_context(filter, src, (void *)context);
+	event_filter_unref(&src);
+}
+
+static const char *
+test_event_filter_match_contexts(struct event_filter *filter,
+				 struct event *event)
+{
+	const struct failure_context failure_ctx = {
+		.type = LOG_TYPE_DEBUG
+	};
+	struct event_filter_match_iter *iter;
+	string_t *str = t_str_new(32);
+	const char *context;
+
+	iter = event_filter_match_iter_init(filter, event, &failure_ctx);
+	while ((context = event_filter_match_iter_next(iter)) != NULL)
+		str_append(str, context);
+	event_filter_match_iter_deinit(&iter);
+
+	test_assert(event_filter_match(filter, event, &failure_ctx) ==
+		    (str_len(str) > 0));
+	return str_c(str);
+}
+
+static void test_event_filter_name_index(void)
+{
+	struct event_filter *filter;
+
+	test_begin("event filter: queries indexed by event name");
+
+	filter = event_filter_create();
+	test_event_filter_add_query(filter, "event=foo", "1");
+	test_event_filter_add_query(filter, "event=bar OR event=foo", "2");
+	test_event_filter_add_query(filter, "field1=value", "3");
+	test_event_filter_add_query(filter, "event=foo AND field1=value", "4");
+	test_event_filter_add_query(filter, "NOT event=foo", "5");
+	test_event_filter_add_query(filter, "event=baz OR event=baz", "6");
+	test_event_filter_add_query(filter,
+		"(event=foo OR field1=value) AND event=bar", "7");
+
+	struct event *e_foo = event_create(NULL);
+	event_set_name(e_foo, "foo");
+	event_add_str(e_foo, "field1", "value");
+	struct event *e_bar = event_create(NULL);
+	event_set_name(e_bar, "bar");
+	event_add_str(e_bar, "field1", "value");
+	struct event *e_baz = event_create(NULL);
+	event_set_name(e_baz, "baz");
+	struct event *e_noname = event_create(NULL);
+	event_add_str(e_noname, "field1", "value");
+
+	test_assert_strcmp(test_event_filter_match_contexts(filter, e_foo),
+			   "1234");
+	test_assert_strcmp(test_event_filter_match_contexts(filter, e_bar),
+			   "2357");
+	test_assert_strcmp(test_event_filter_match_contexts(filter, e_baz),
+			   "56");
+	test_assert_strcmp(test_event_filter_match_contexts(filter, e_noname),
+			   "35");
+
+	/* the index is updated when the queries change */
+	test_assert(event_filter_remove_queries_with_context(filter, "2"));
+	test_assert_strcmp(test_event_filter_match_contexts(filter, e_foo),
+			   "134");
+	test_event_filter_add_query(filter, "event=foo", "8");
+	test_event_filter_add_query(filter, "event=bar", "1");
+	test_assert_strcmp(test_event_filter_match_contexts(filter, e_foo),
+			   "1348");
+	test_assert_strcmp(test_event_filter_match_contexts(filter, e_bar),
+			   "1357");
+
+	event_filter_unref(&filter);
+	event_unref(&e_foo);
+	event_unref(&e_bar);
+	event_unref(&e_baz);
+	event_unref(&e_noname);
+	test_end();
+}
+
+static void test_event_filter_sampling(void)
+{
+	const time_t orig_ioloop_time = ioloop_time;
+	struct event_filter *filter;
+	unsigned int i, rate, max;
+	string_t *str = t_str_new(32);
+
+	test_begin("event filter: sampling");
+	filter = event_filter_create();
+	event_filter_get_sampling(filter, &rate, &max);
+	test_assert(rate == 1 && max == 0);
+	for (i = 0; i < 3; i++)
+		test_assert(event_filter_sample(filter) == 1);
+
+	/* fixed rate */
+	event_filter_set_sampling(filter, 3, 0);
+	for (i = 0; i < 9; i++)
+		str_printfa(str, "%u", event_filter_sample(filter));
+	test_assert_strcmp(str_c(str), "003003003");
+
+	/* adaptive rate */
+	event_filter_set_sampling(filter, 1, 2);
+	ioloop_time = 1000;
+	for (i = 0; i < 10; i++)
+		test_assert(event_filter_sample(filter) == 1);
+	ioloop_time++;
+	str_truncate(str, 0);
+	for (i = 0; i < 10; i++)
+		str_printfa(str, "%u", event_filter_sample(filter));
+	test_assert_strcmp(str_c(str), "0000500005");
+	/* the rate is calculated from the average over the whole window */
+	ioloop_time += 2;
+	str_truncate(str, 0);
+	for (i = 0; i < 3; i++)
+		str_printfa(str, "%u", event_filter_sample(filter));
+	test_assert_strcmp(str_c(str), "003");
+	/* never go below the configured rate */
+	event_filter_set_sampling(filter, 2, 1000);
+	ioloop_time++;
+	test_assert(event_filter_sample(filter) == 0);
+	ioloop_time++;
+	test_assert(event_filter_sample(filter) == 2);
+	event_filter_unref(&filter);
+
+	/* sampling through the global debug send filter */
+	filter = event_filter_create();
+	test_event_filter_add_query(filter, "event=foo", NULL);
+	event_filter_set_sampling(filter, 2, 0);
+	event_set_global_debug_send_filter(filter);
+
+	struct event *e = event_create(NULL);
+	event_set_name(e, "foo");
+	test_assert(!event_want_debug(e));
+	event_send_abort(e);
+	event_set_name(e, "foo");
+	test_assert(event_want_debug(e));
+	/* the decision stays until the event is sent */
+	test_assert(event_want_debug(e));
+	test_assert(event_get_sample_rate(e) == 2);
+	event_send_abort(e);
+	test_assert(event_get_sample_rate(e) == 1);
+	event_unref(&e);
+
+	event_unset_global_debug_send_filter();
+	event_filter_unref(&filter);
+	ioloop_time = orig_ioloop_time;
+	test_end();
+}
+
 void test_event_filter(void)
 {
 	test_event_filter_override_parent_fields();
@@ -900,4 +1058,6 @@ void test_event_filter(void)
 	test_event_filter_size_values();
 	test_event_filter_interval_values();
 	test_event_filter_ambiguous_units();
+	test_event_filter_name_index();
+	test_event_filter_sampling();
 }
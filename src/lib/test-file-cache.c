@@ -283,6 +283,65 @@ static void test_file_cache_errors(void)
 	test_end();
 }
 
+static void test_file_cache_mmap_advice(void)
+{
+	struct mmap_advice advice = {
+		.populate_min_size = 1,
+		.willneed_min_size = 1,
+		.hugepage_min_size = 1,
+	};
+	struct mmap_advice_stats stats;
+	size_t page_size = mmap_get_page_size();
+	size_t size;
+	void *map;
+
+	test_begin("mmap advice");
+	struct ostream *os = o_stream_create_file(TEST_FILENAME, 0, 0600, 0);
+	for (unsigned int i = 0; i < 4; i++)
+		o_stream_nsend(os, t_malloc0(page_size), page_size);
+	o_stream_nsend_str(os, "end");
+	test_assert(o_stream_finish(os) == 1);
+	o_stream_destroy(&os);
+
+	int fd = open(TEST_FILENAME, O_RDONLY);
+	i_assert(fd > -1);
+	map = mmap_ro_file_advice(fd, &size, &advice, &stats);
+	test_assert(map != MAP_FAILED);
+	test_assert(size == page_size * 4 + 3);
+	test_assert(stats.mapped_bytes == size);
+#ifdef MAP_POPULATE
+	test_assert(stats.populated && !stats.willneed);
+#endif
+	test_assert(memcmp(PTR_OFFSET(map, page_size * 4), "end", 3) == 0);
+	test_assert(munmap(map, size) == 0);
+
+	/* writable private mappings aren't prefaulted */
+	map = mmap_fd_advice(fd, size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+			     &advice, &stats);
+	test_assert(map != MAP_FAILED);
+	test_assert(!stats.populated);
+	test_assert(munmap(map, size) == 0);
+
+	/* below the thresholds */
+	advice.populate_min_size = advice.willneed_min_size = size + 1;
+	map = mmap_ro_file_advice(fd, &size, &advice, &stats);
+	test_assert(map != MAP_FAILED);
+	test_assert(!stats.populated && !stats.willneed);
+	test_assert(munmap(map, size) == 0);
+
+	/* the file cache works with huge page advice */
+	struct file_cache *cache = file_cache_new_path(fd, TEST_FILENAME);
+	file_cache_set_advice(cache, &advice);
+	test_assert(file_cache_read(cache, 0, size) == (ssize_t)size);
+	map = (void *)file_cache_get_map(cache, &size);
+	test_assert(memcmp(PTR_OFFSET(map, page_size * 4), "end", 3) == 0);
+	file_cache_free(&cache);
+
+	i_close_fd(&fd);
+	i_unlink(TEST_FILENAME);
+	test_end();
+}
+
 void test_file_cache(void)
 {
 	test_file_cache_read();
@@ -292,4 +351,5 @@ void test_file_cache(void)
 	test_file_cache_anon();
 	test_file_cache_switch_fd();
 	test_file_cache_errors();
+	test_file_cache_mmap_advice();
 }
@@ -4,15 +4,19 @@
 #include "hash.h"
 
 
-static void test_hash_random_pool(pool_t pool)
+static void test_hash_random_pool(pool_t pool, bool flat)
 {
 #define KEYMAX 100000
 	HASH_TABLE(void *, void *) hash;
 	unsigned int *keys;
 	unsigned int i, key, keyidx, delidx;
 
+	test_begin(flat ? "hash flat random" : "hash random");
 	keys = i_new(unsigned int, KEYMAX); keyidx = 0;
-	hash_table_create_direct(&hash, pool, 0);
+	if (flat)
+		hash_table_create_direct_flat(&hash, pool, 0);
+	else
+		hash_table_create_direct(&hash, pool, 0);
 	for (i = 0; i < KEYMAX; i++) {
 		key = (i_rand_limit(KEYMAX)) + 1;
 		if (i_rand_limit(5) > 0) {
@@ -29,19 +33,119 @@ static void test_hash_random_pool(pool_t pool)
 			keyidx--;
 		}
 	}
+	test_assert(hash_table_count(hash) == keyidx);
+	for (i = 0; i < keyidx; i++)
+		test_assert(hash_table_lookup(hash, POINTER_CAST(keys[i])) != NULL);
 	for (i = 0; i < keyidx; i++)
 		hash_table_remove(hash, POINTER_CAST(keys[i]));
+	test_assert(hash_table_count(hash) == 0);
 	hash_table_destroy(&hash);
 	i_free(keys);
+	test_end();
+}
+
+static void test_hash_flat_strings(void)
+{
+	HASH_TABLE(char *, char *) hash;
+	const char *key;
+	char *key2, *orig_key, *value;
+	unsigned int i;
+
+	test_begin("hash flat strings");
+	hash_table_create_flat(&hash, default_pool, 0, str_hash, strcmp);
+	for (i = 0; i < 1000; i++) {
+		key2 = i_strdup_printf("key%u", i);
+		hash_table_insert(hash, key2, key2);
+	}
+	test_assert(hash_table_count(hash) == 1000);
+
+	/* update preserves the original key */
+	key = t_strdup("key500");
+	hash_table_update(hash, t_strdup_noconst(key), t_strdup_noconst("foo"));
+	test_assert(hash_table_lookup_full(hash, key, &orig_key, &value));
+	test_assert(orig_key != key && strcmp(orig_key, key) == 0);
+	test_assert_strcmp(value, "foo");
+	test_assert(hash_table_lookup(hash, key + 3) == NULL);
+	test_assert(!hash_table_try_remove(hash, key + 3));
+
+	for (i = 0; i < 1000; i++) {
+		key = t_strdup_printf("key%u", i);
+		test_assert(hash_table_lookup_full(hash, key, &orig_key, &value));
+		test_assert(hash_table_try_remove(hash, key));
+		i_free(orig_key);
+	}
+	test_assert(hash_table_count(hash) == 0);
+	hash_table_destroy(&hash);
+	test_end();
+}
+
+static void test_hash_flat_iterate(void)
+{
+#define ITER_KEYS 5000
+	HASH_TABLE(void *, void *) hash;
+	struct hash_iterate_context *iter;
+	void *key, *value;
+	unsigned int i, seen_count = 0;
+	bool *seen;
+
+	test_begin("hash flat iterate");
+	seen = i_new(bool, ITER_KEYS + 1);
+	hash_table_create_direct_flat(&hash, default_pool, 0);
+	for (i = 1; i <= ITER_KEYS; i++)
+		hash_table_insert(hash, POINTER_CAST(i), POINTER_CAST(i));
+
+	/* removing nodes while iterating is safe */
+	iter = hash_table_iterate_init(hash);
+	while (hash_table_iterate(iter, hash, &key, &value)) {
+		i = POINTER_CAST_TO(key, unsigned int);
+		test_assert(key == value);
+		test_assert(!seen[i]);
+		seen[i] = TRUE;
+		seen_count++;
+		if (i % 2 == 0)
+			hash_table_remove(hash, key);
+	}
+	hash_table_iterate_deinit(&iter);
+	test_assert(seen_count == ITER_KEYS);
+	test_assert(hash_table_count(hash) == ITER_KEYS / 2);
+
+	/* removed slots can be reused while iterating */
+	iter = hash_table_iterate_init(hash);
+	for (i = 2; i <= ITER_KEYS; i += 2)
+		hash_table_insert(hash, POINTER_CAST(i), POINTER_CAST(i));
+	seen_count = 0;
+	while (hash_table_iterate(iter, hash, &key, &value))
+		seen_count++;
+	hash_table_iterate_deinit(&iter);
+	test_assert(seen_count <= ITER_KEYS);
+	test_assert(hash_table_count(hash) == ITER_KEYS);
+
+	/* the table shrinks after most nodes are removed */
+	for (i = 1; i <= ITER_KEYS - 10; i++)
+		hash_table_remove(hash, POINTER_CAST(i));
+	for (i = ITER_KEYS - 9; i <= ITER_KEYS; i++)
+		test_assert(hash_table_lookup(hash, POINTER_CAST(i)) == POINTER_CAST(i));
+
+	hash_table_clear(hash, TRUE);
+	test_assert(hash_table_count(hash) == 0);
+	test_assert(hash_table_lookup(hash, POINTER_CAST(ITER_KEYS)) == NULL);
+	hash_table_destroy(&hash);
+	i_free(seen);
+	test_end();
 }
 
 void test_hash(void)
 {
 	pool_t pool;
 
-	test_hash_random_pool(default_pool);
+	test_hash_random_pool(default_pool, FALSE);
+	test_hash_random_pool(default_pool, TRUE);
 
 	pool = pool_alloconly_create("test hash", 1024);
-	test_hash_random_pool(pool);
+	test_hash_random_pool(pool, FALSE);
+	test_hash_random_pool(pool, TRUE);
 	pool_unref(&pool);
+
+	test_hash_flat_strings();
+	test_hash_flat_iterate();
 }
@@ -191,9 +191,48 @@ static void test_istream_chain_accumulate(void)
 	test_end();
 }
 
+static void test_istream_chain_read_iov(void)
+{
+	static const char *parts[] = { "first", "second", "third" };
+	struct istream *input, *part_input;
+	struct istream_chain *chain;
+	struct const_iovec iov[4];
+	unsigned int i;
+
+	test_begin("istream chain read iov");
+	input = i_stream_create_chain(&chain, IO_BLOCK_SIZE);
+	for (i = 0; i < N_ELEMENTS(parts); i++) {
+		part_input = i_stream_create_from_data(parts[i],
+						       strlen(parts[i]));
+		i_stream_chain_append(chain, part_input);
+		i_stream_unref(&part_input);
+	}
+
+	/* the links' data is returned directly, without copying */
+	test_assert(i_stream_read_iov(input, iov, N_ELEMENTS(iov)) == 3);
+	test_assert(iov[0].iov_base == parts[0] && iov[0].iov_len == 5);
+	test_assert(iov[1].iov_base == parts[1] && iov[1].iov_len == 6);
+	test_assert(iov[2].iov_base == parts[2] && iov[2].iov_len == 5);
+
+	/* skip into the middle of the third link */
+	i_stream_skip(input, 5 + 6 + 2);
+	test_assert(i_stream_read_iov(input, iov, N_ELEMENTS(iov)) == 1);
+	test_assert(iov[0].iov_base == parts[2] + 2 && iov[0].iov_len == 3);
+	i_stream_skip(input, 3);
+	test_assert(i_stream_read_iov(input, iov, N_ELEMENTS(iov)) == 0);
+
+	i_stream_chain_append_eof(chain);
+	test_assert(i_stream_read_iov(input, iov, N_ELEMENTS(iov)) == -1);
+	test_assert(input->eof && input->stream_errno == 0);
+	test_assert(input->v_offset == 16);
+	i_stream_unref(&input);
+	test_end();
+}
+
 void test_istream_chain(void)
 {
 	test_istream_chain_basic();
 	test_istream_chain_early_end();
 	test_istream_chain_accumulate();
+	test_istream_chain_read_iov();
 }
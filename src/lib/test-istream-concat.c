@@ -3,6 +3,8 @@
 #include "test-lib.h"
 #include "istream-private.h"
 #include "istream-concat.h"
+#include "str.h"
+#include "ostream.h"
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -162,6 +164,75 @@ static void test_istream_concat_early_end(void)
 	test_end();
 }
 
+static void test_istream_concat_read_iov(void)
+{
+	static const char *parts[] = { "header\n", "", "body\n", "attachment" };
+	struct istream *streams[N_ELEMENTS(parts)+1], *input, *parent;
+	struct const_iovec iov[4];
+	struct ostream *output;
+	buffer_t *buf;
+	unsigned int i;
+
+	test_begin("istream concat read iov");
+	for (i = 0; i < N_ELEMENTS(parts); i++)
+		streams[i] = i_stream_create_from_data(parts[i], strlen(parts[i]));
+	streams[i] = NULL;
+	input = i_stream_create_concat(streams);
+
+	/* all the streams' data is returned directly, without copying */
+	test_assert(i_stream_read_iov(input, iov, N_ELEMENTS(iov)) == 3);
+	test_assert(iov[0].iov_base == parts[0] && iov[0].iov_len == 7);
+	test_assert(iov[1].iov_base == parts[2] && iov[1].iov_len == 5);
+	test_assert(iov[2].iov_base == parts[3] && iov[2].iov_len == 10);
+	/* skip to the middle of the body */
+	i_stream_skip(input, 9);
+	test_assert(i_stream_read_iov(input, iov, 1) == 1);
+	test_assert(iov[0].iov_base == parts[2] + 2 && iov[0].iov_len == 3);
+	test_assert(i_stream_read_iov(input, iov, N_ELEMENTS(iov)) == 2);
+	test_assert(iov[1].iov_base == parts[3] && iov[1].iov_len == 10);
+	i_stream_skip(input, 3 + 10);
+	test_assert(i_stream_read_iov(input, iov, N_ELEMENTS(iov)) == -1);
+	test_assert(input->eof && input->stream_errno == 0);
+	test_assert(input->v_offset == 22);
+
+	/* seeking back still works */
+	i_stream_seek(input, 3);
+	test_assert(i_stream_read_iov(input, iov, N_ELEMENTS(iov)) == 3);
+	test_assert(iov[0].iov_base == parts[0] + 3 && iov[0].iov_len == 4);
+
+	/* copying to ostream uses the iovecs */
+	i_stream_seek(input, 0);
+	buf = t_buffer_create(64);
+	output = o_stream_create_buffer(buf);
+	test_assert(o_stream_send_istream(output, input) ==
+		    OSTREAM_SEND_ISTREAM_RESULT_FINISHED);
+	test_assert(strcmp(str_c(buf), "header\nbody\nattachment") == 0);
+	o_stream_destroy(&output);
+	i_stream_unref(&input);
+	for (i = 0; i < N_ELEMENTS(parts); i++)
+		i_stream_unref(&streams[i]);
+
+	/* streams sharing the same parent can't be returned together, because
+	   reading one of them changes the other one's buffer */
+	parent = i_stream_create_from_data("0123456789", 10);
+	streams[0] = i_stream_create_range(parent, 0, 4);
+	streams[1] = i_stream_create_range(parent, 4, 6);
+	streams[2] = NULL;
+	input = i_stream_create_concat(streams);
+	test_assert(i_stream_read_iov(input, iov, N_ELEMENTS(iov)) == 1);
+	test_assert(iov[0].iov_len == 4 &&
+		    memcmp(iov[0].iov_base, "0123", 4) == 0);
+	i_stream_skip(input, 4);
+	test_assert(i_stream_read_iov(input, iov, N_ELEMENTS(iov)) == 1);
+	test_assert(iov[0].iov_len == 6 &&
+		    memcmp(iov[0].iov_base, "456789", 6) == 0);
+	i_stream_unref(&input);
+	i_stream_unref(&streams[0]);
+	i_stream_unref(&streams[1]);
+	i_stream_unref(&parent);
+	test_end();
+}
+
 static void test_istream_concat_snapshot(void)
 {
 	struct istream *input;
@@ -251,4 +322,5 @@ void test_istream_concat(void)
 	test_istream_concat_seek_end();
 	test_istream_concat_early_end();
 	test_istream_concat_snapshot();
+	test_istream_concat_read_iov();
 }
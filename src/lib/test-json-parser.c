@@ -4,6 +4,7 @@
 #include "str.h"
 #include "istream-private.h"
 #include "json-parser.h"
+#include "json-parser-private.h"
 
 #define TYPE_SKIP 100
 #define TYPE_STREAM 101
@@ -404,6 +405,109 @@ static void test_json_parser_nuls_in_string(void)
 	test_end();
 }
 
+static int
+test_json_parse_next_slowly(struct json_parser *parser, struct istream *input,
+			    size_t *size, enum json_type *type_r,
+			    const char **value_r)
+{
+	int ret;
+
+	/* make one more byte available every time more input is needed */
+	while ((ret = json_parse_next(parser, type_r, value_r)) == 0)
+		test_istream_set_size(input, ++*size);
+	return ret;
+}
+
+static void test_json_parser_long_strings_impl(const char *impl_name)
+{
+	static const char special[] = { '"', '\\', '\0' };
+	unsigned char data[100];
+	string_t *json = t_str_new(256), *expected = t_str_new(128);
+	struct json_parser *parser;
+	struct istream *input;
+	enum json_type type;
+	const char *value, *error;
+	unsigned int i, pos, len;
+	size_t size;
+	int ret;
+
+	test_begin(t_strdup_printf("json parser long strings (%s)", impl_name));
+	/* the special characters are found at every position */
+	memset(data, 'x', sizeof(data));
+	test_assert(json_scan_string(data, sizeof(data)) == sizeof(data));
+	for (i = 0; i < N_ELEMENTS(special); i++) {
+		for (pos = 0; pos < sizeof(data); pos++) {
+			data[pos] = special[i];
+			test_assert_idx(json_scan_string(data, sizeof(data)) == pos, pos);
+			test_assert_idx(json_scan_string(data, pos) == pos, pos);
+			data[pos] = 0x80 | special[i];
+			test_assert_idx(json_scan_string(data, sizeof(data)) == sizeof(data), pos);
+			data[pos] = 'x';
+		}
+	}
+
+	/* strings with an escape at different positions, read one byte at
+	   a time. Every second string is skipped. */
+	for (len = 1; len < 70; len += 3) {
+		str_truncate(json, 0);
+		str_append_c(json, '[');
+		for (pos = 0; pos < len; pos++) {
+			str_append_c(json, '"');
+			for (i = 0; i < len; i++) {
+				if (i == pos)
+					str_append(json, "\\n");
+				else
+					str_append_c(json, 'a' + i % 26);
+			}
+			str_append(json, "\",");
+		}
+		str_append(json, "\"\"]");
+
+		input = test_istream_create_data(str_data(json), str_len(json));
+		size = 0;
+		test_istream_set_size(input, size);
+		parser = json_parser_init_flags(input, JSON_PARSER_NO_ROOT_OBJECT);
+		test_assert(test_json_parse_next_slowly(parser, input, &size,
+							&type, &value) > 0 &&
+			    type == JSON_TYPE_ARRAY);
+		for (pos = 0; pos < len; pos++) {
+			if (pos % 2 == 1) {
+				json_parse_skip_next(parser);
+				continue;
+			}
+			str_truncate(expected, 0);
+			for (i = 0; i < len; i++) {
+				if (i == pos)
+					str_append_c(expected, '\n');
+				else
+					str_append_c(expected, 'a' + i % 26);
+			}
+			ret = test_json_parse_next_slowly(parser, input, &size,
+							  &type, &value);
+			test_assert_idx(ret > 0 && type == JSON_TYPE_STRING &&
+					strcmp(value, str_c(expected)) == 0, len);
+		}
+		test_istream_set_size(input, str_len(json));
+		test_assert(json_parse_next(parser, &type, &value) > 0 &&
+			    type == JSON_TYPE_STRING && value[0] == '\0');
+		test_assert(json_parse_next(parser, &type, &value) > 0 &&
+			    type == JSON_TYPE_ARRAY_END);
+		test_assert(json_parser_deinit(&parser, &error) == 0);
+		i_stream_unref(&input);
+	}
+	test_end();
+}
+
+static void test_json_parser_long_strings(void)
+{
+	test_assert(json_scan_set_impl(JSON_SCAN_IMPL_SCALAR));
+	test_json_parser_long_strings_impl("scalar");
+	if (json_scan_set_impl(JSON_SCAN_IMPL_SSE2))
+		test_json_parser_long_strings_impl("SSE2");
+	if (json_scan_set_impl(JSON_SCAN_IMPL_AVX2))
+		test_json_parser_long_strings_impl("AVX2");
+}
+
 static void test_json_append_escaped(void)
 {
 	string_t *str = t_str_new(32);
@@ -435,6 +539,7 @@ void test_json_parser(void)
 	test_json_parser_primitive_values();
 	test_json_parser_errors();
 	test_json_parser_nuls_in_string();
+	test_json_parser_long_strings();
 	test_json_append_escaped();
 	test_json_append_escaped_data();
 }
@@ -14,6 +14,50 @@ static bool mem_has_bytes(const void *mem, size_t size, uint8_t b)
 	return TRUE;
 }
 
+static void test_mempool_alloconly_block_cache(void)
+{
+	struct mempool_stats stats1, stats2;
+	pool_t pool;
+	unsigned char *mem;
+	size_t size;
+
+	test_begin("mempool_alloconly block cache");
+	/* start with an empty cache */
+	pool_alloconly_block_cache_deinit();
+
+	/* fill the block with garbage */
+	pool = pool_alloconly_create("test", 1024);
+	size = p_get_max_easy_alloc_size(pool);
+	mem = p_malloc(pool, size);
+	memset(mem, 0xff, size);
+	mempool_get_stats(&stats1);
+	pool_unref(&pool);
+	mempool_get_stats(&stats2);
+	test_assert(stats2.alloconly_block_cache_puts ==
+		    stats1.alloconly_block_cache_puts + 1);
+
+	/* the recycled block must be zeroed */
+	pool = pool_alloconly_create("test", 1024);
+	mempool_get_stats(&stats1);
+	test_assert(stats1.alloconly_block_cache_hits ==
+		    stats2.alloconly_block_cache_hits + 1);
+	test_assert(p_get_max_easy_alloc_size(pool) == size);
+	mem = p_malloc(pool, size);
+	test_assert(mem_has_bytes(mem, size, 0));
+	pool_unref(&pool);
+
+	/* sizes that aren't powers of two aren't cached */
+	mempool_get_stats(&stats1);
+	pool = pool_alloconly_create("test", 1000);
+	pool_unref(&pool);
+	mempool_get_stats(&stats2);
+	test_assert(stats2.alloconly_block_cache_misses ==
+		    stats1.alloconly_block_cache_misses + 1);
+	test_assert(stats2.alloconly_block_cache_frees ==
+		    stats1.alloconly_block_cache_frees + 1);
+	test_end();
+}
+
 void test_mempool_alloconly(void)
 {
 #define SENTRY_SIZE 32
@@ -51,6 +95,8 @@ void test_mempool_alloconly(void)
 		}
 	}
 	test_end();
+
+	test_mempool_alloconly_block_cache();
 }
 
 enum fatal_test_state fatal_mempool_alloconly(unsigned int stage)
@@ -0,0 +1,136 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+
+static bool mem_has_bytes(const void *mem, size_t size, uint8_t b)
+{
+	const uint8_t *bytes = mem;
+	unsigned int i;
+
+	for (i = 0; i < size; i++) {
+		if (bytes[i] != b)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void test_mempool_slab_alloc_free(void)
+{
+#define SLAB_TEST_COUNT 1000
+	struct mempool_stats stats1, stats2;
+	pool_t pool;
+	void *mem[SLAB_TEST_COUNT];
+	size_t sizes[SLAB_TEST_COUNT];
+	unsigned int i;
+
+	test_begin("mempool_slab alloc+free");
+	pool = pool_slab_create("test");
+	for (i = 0; i < SLAB_TEST_COUNT; i++) {
+		sizes[i] = i % 3 == 0 ? i_rand_minmax(1, 3000) :
+			i_rand_minmax(1, 200);
+		mem[i] = p_malloc(pool, sizes[i]);
+		test_assert_idx(mem_has_bytes(mem[i], sizes[i], 0), i);
+		memset(mem[i], i & 0xff, sizes[i]);
+	}
+	/* free every other allocation */
+	for (i = 0; i < SLAB_TEST_COUNT; i += 2)
+		p_free(pool, mem[i]);
+	for (i = 1; i < SLAB_TEST_COUNT; i += 2)
+		test_assert_idx(mem_has_bytes(mem[i], sizes[i], i & 0xff), i);
+
+	/* the freed memory is reused, and it's zeroed */
+	mempool_get_stats(&stats1);
+	for (i = 0; i < SLAB_TEST_COUNT; i += 2) {
+		mem[i] = p_malloc(pool, sizes[i]);
+		test_assert_idx(mem_has_bytes(mem[i], sizes[i], 0), i);
+		memset(mem[i], i & 0xff, sizes[i]);
+	}
+	mempool_get_stats(&stats2);
+	test_assert(stats2.slab_free_list_hits > stats1.slab_free_list_hits);
+	for (i = 0; i < SLAB_TEST_COUNT; i++)
+		test_assert_idx(mem_has_bytes(mem[i], sizes[i], i & 0xff), i);
+
+	test_assert(pool_slab_get_total_used_size(pool) > 0);
+	test_assert(pool_slab_get_total_alloc_size(pool) >=
+		    pool_slab_get_total_used_size(pool));
+	for (i = 0; i < SLAB_TEST_COUNT; i++)
+		p_free(pool, mem[i]);
+	test_assert(pool_slab_get_total_used_size(pool) == 0);
+
+	p_clear(pool);
+	test_assert(pool_slab_get_total_alloc_size(pool) == 0);
+	mem[0] = p_malloc(pool, 10);
+	test_assert(mem_has_bytes(mem[0], 10, 0));
+	pool_unref(&pool);
+	test_end();
+}
+
+static void test_mempool_slab_realloc(void)
+{
+	pool_t pool;
+	unsigned char *mem = NULL;
+	unsigned int i;
+
+	test_begin("mempool_slab realloc");
+	pool = pool_slab_create("test");
+	/* grow through all the size classes into a large allocation */
+	for (i = 1; i < 3000; i++) {
+		mem = p_realloc(pool, mem, i-1, i);
+		test_assert_idx(mem_has_bytes(mem, i-1, 0xde), i);
+		test_assert_idx(mem[i-1] == 0, i);
+		memset(mem, 0xde, i);
+	}
+	/* shrink back to a small allocation */
+	mem = p_realloc(pool, mem, 2999, 1000);
+	test_assert(mem_has_bytes(mem, 1000, 0xde));
+	mem = p_realloc(pool, mem, 1000, 10);
+	test_assert(mem_has_bytes(mem, 10, 0xde));
+	/* growing within the same object zeroes the new part */
+	mem = p_realloc(pool, mem, 10, 16);
+	test_assert(mem_has_bytes(mem, 10, 0xde));
+	test_assert(mem_has_bytes(mem + 10, 6, 0));
+	p_free(pool, mem);
+	test_assert(pool_slab_get_total_used_size(pool) == 0);
+	pool_unref(&pool);
+	test_end();
+}
+
+void test_mempool_slab(void)
+{
+	test_mempool_slab_alloc_free();
+	test_mempool_slab_realloc();
+}
+
+enum fatal_test_state fatal_mempool_slab(unsigned int stage)
+{
+	static pool_t pool;
+
+	if (pool == NULL && stage != 0)
+		return FATAL_TEST_FAILURE;
+
+	switch(stage) {
+	case 0: /* forbidden size */
+		test_begin("fatal_mempool_slab");
+		pool = pool_slab_create("fatal");
+		test_expect_fatal_string("Trying to allocate 0 bytes");
+		(void)p_malloc(pool, 0);
+		return FATAL_TEST_FAILURE;
+
+	case 1: /* logically impossible size */
+		test_expect_fatal_string("Trying to allocate");
+		(void)p_malloc(pool, POOL_MAX_ALLOC_SIZE + 1ULL);
+		return FATAL_TEST_FAILURE;
+
+#if SIZEOF_SIZE_T > 4 /* malloc(POOL_MAX_ALLOC_SIZE) may succeed with 32bit */
+	case 2: /* physically impossible size */
+		test_expect_fatal_string("Out of memory");
+		(void)p_malloc(pool, POOL_MAX_ALLOC_SIZE);
+		return FATAL_TEST_FAILURE;
+#endif
+	}
+
+	/* Either our tests have finished, or the test suite has got confused. */
+	pool_unref(&pool);
+	test_end();
+	return FATAL_TEST_FINISHED;
+}
@@ -1,6 +1,7 @@
 /* Copyright (c) 2009-2018 Dovecot authors, see the included COPYING file */
 
 #include "test-lib.h"
+#include "ioloop.h"
 #include "net.h"
 #include "str.h"
 #include "safe-mkstemp.h"
@@ -181,9 +182,107 @@ static void test_ostream_file_send_istream_sendfile(void)
 	test_end();
 }
 
+static void test_ostream_file_send_istream_splice(void)
+{
+#define SPLICE_TEST_SIZE (1024*1024)
+	struct ioloop *ioloop;
+	struct istream *input, *input2;
+	struct ostream *output;
+	enum ostream_send_istream_result res;
+	unsigned char *data, *buf;
+	size_t written = 0, received = 0;
+	ssize_t ret;
+	int in_fd[2], out_fd[2];
+
+	test_begin("ostream file send istream splice()");
+	/* the ostream adds an IO when the output socket becomes full */
+	ioloop = io_loop_create();
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, in_fd) == 0);
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, out_fd) == 0);
+	fd_set_nonblock(in_fd[0], TRUE);
+	fd_set_nonblock(in_fd[1], TRUE);
+	fd_set_nonblock(out_fd[0], TRUE);
+	fd_set_nonblock(out_fd[1], TRUE);
+	input = i_stream_create_fd(in_fd[1], 1024);
+	output = o_stream_create_fd(out_fd[0], IO_BLOCK_SIZE);
+
+	data = i_malloc(SPLICE_TEST_SIZE);
+	buf = i_malloc(SPLICE_TEST_SIZE);
+	random_fill(data, SPLICE_TEST_SIZE);
+
+	/* data buffered in the istream is sent first */
+	test_assert(write(in_fd[0], data, 10) == 10);
+	test_assert(i_stream_read(input) == 10);
+	written = 10;
+
+	/* the output socket fills up much earlier than all the data is
+	   written, so this also tests moving the pipe contents to the
+	   ostream buffer */
+	do {
+		if (written < SPLICE_TEST_SIZE) {
+			ret = write(in_fd[0], data + written,
+				    SPLICE_TEST_SIZE - written);
+			if (ret > 0)
+				written += ret;
+			if (written == SPLICE_TEST_SIZE)
+				i_close_fd(&in_fd[0]);
+		}
+		if (o_stream_flush(output) < 0)
+			break;
+		res = o_stream_send_istream(output, input);
+		ret = read(out_fd[1], buf + received,
+			   SPLICE_TEST_SIZE - received);
+		if (ret > 0)
+			received += ret;
+	} while (res != OSTREAM_SEND_ISTREAM_RESULT_FINISHED &&
+		 res != OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT &&
+		 res != OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT);
+	test_assert(res == OSTREAM_SEND_ISTREAM_RESULT_FINISHED);
+	test_assert(input->eof);
+	test_assert(input->v_offset == SPLICE_TEST_SIZE);
+	test_assert(output->offset == SPLICE_TEST_SIZE);
+
+	while (o_stream_flush(output) == 0 || received < SPLICE_TEST_SIZE) {
+		ret = read(out_fd[1], buf + received,
+			   SPLICE_TEST_SIZE - received);
+		if (ret > 0)
+			received += ret;
+		else if (ret == 0 || errno != EAGAIN)
+			break;
+	}
+	test_assert(received == SPLICE_TEST_SIZE &&
+		    memcmp(data, buf, SPLICE_TEST_SIZE) == 0);
+	i_stream_unref(&input);
+	i_close_fd(&in_fd[1]);
+
+	/* filter istreams can't be spliced */
+	i_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, in_fd) == 0);
+	fd_set_nonblock(in_fd[1], TRUE);
+	test_assert(write(in_fd[0], "abcdefghij", 10) == 10);
+	input = i_stream_create_fd(in_fd[1], 1024);
+	input2 = i_stream_create_limit(input, 4);
+	test_assert(o_stream_send_istream(output, input2) == OSTREAM_SEND_ISTREAM_RESULT_FINISHED);
+	test_assert(o_stream_flush(output) > 0);
+	test_assert(read(out_fd[1], buf, SPLICE_TEST_SIZE) == 4 &&
+		    memcmp(buf, "abcd", 4) == 0);
+	i_stream_unref(&input2);
+	i_stream_unref(&input);
+
+	o_stream_destroy(&output);
+	i_close_fd(&in_fd[0]);
+	i_close_fd(&in_fd[1]);
+	i_close_fd(&out_fd[0]);
+	i_close_fd(&out_fd[1]);
+	i_free(data);
+	i_free(buf);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
 void test_ostream_file(void)
 {
 	test_ostream_file_random();
 	test_ostream_file_send_istream_file();
 	test_ostream_file_send_istream_sendfile();
+	test_ostream_file_send_istream_splice();
 }
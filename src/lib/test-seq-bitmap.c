@@ -0,0 +1,229 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "array.h"
+#include "seq-bitmap.h"
+
+static bool
+seq_bitmap_equals(const struct seq_bitmap *bitmap,
+		  const ARRAY_TYPE(seq_range) *expected)
+{
+	ARRAY_TYPE(seq_range) ranges;
+	const struct seq_range *r1, *r2;
+	unsigned int i, count1, count2;
+
+	t_array_init(&ranges, 16);
+	seq_bitmap_to_seq_range(bitmap, &ranges);
+	r1 = array_get(&ranges, &count1);
+	r2 = array_get(expected, &count2);
+	if (count1 != count2)
+		return FALSE;
+	for (i = 0; i < count1; i++) {
+		if (r1[i].seq1 != r2[i].seq1 || r1[i].seq2 != r2[i].seq2)
+			return FALSE;
+	}
+	return seq_bitmap_count(bitmap) == seq_range_count(expected);
+}
+
+static void test_seq_bitmap_add_remove(void)
+{
+	struct seq_bitmap *bitmap;
+	uint32_t seq;
+
+	test_begin("seq_bitmap_add/remove()");
+	bitmap = seq_bitmap_create();
+	test_assert(seq_bitmap_count(bitmap) == 0);
+	test_assert(!seq_bitmap_exists(bitmap, 1));
+
+	test_assert(!seq_bitmap_add(bitmap, 5));
+	test_assert(seq_bitmap_add(bitmap, 5));
+	test_assert(!seq_bitmap_add(bitmap, 0));
+	test_assert(!seq_bitmap_add(bitmap, (uint32_t)-1));
+	test_assert(!seq_bitmap_add(bitmap, 70000));
+	test_assert(seq_bitmap_count(bitmap) == 4);
+	test_assert(seq_bitmap_exists(bitmap, 0));
+	test_assert(seq_bitmap_exists(bitmap, 5));
+	test_assert(seq_bitmap_exists(bitmap, 70000));
+	test_assert(seq_bitmap_exists(bitmap, (uint32_t)-1));
+	test_assert(!seq_bitmap_exists(bitmap, 6));
+	test_assert(!seq_bitmap_exists(bitmap, 70000 - 65536));
+
+	test_assert(seq_bitmap_remove(bitmap, 5));
+	test_assert(!seq_bitmap_remove(bitmap, 5));
+	test_assert(!seq_bitmap_remove(bitmap, 1000000));
+	test_assert(seq_bitmap_count(bitmap) == 3);
+
+	test_assert(seq_bitmap_add_range(bitmap, 10, 200000) == 199991 - 1);
+	test_assert(seq_bitmap_count(bitmap) == 199990 + 3);
+	test_assert(seq_bitmap_remove_range(bitmap, 0, 199999) == 199991);
+	test_assert(seq_bitmap_count(bitmap) == 2);
+	test_assert(seq_bitmap_exists(bitmap, 200000));
+	test_assert(seq_bitmap_remove_range(bitmap, 200000, (uint32_t)-1) == 2);
+	test_assert(seq_bitmap_count(bitmap) == 0);
+
+	/* seq_bitmap_iter_next() */
+	(void)seq_bitmap_add_range(bitmap, 65534, 65537);
+	(void)seq_bitmap_add(bitmap, 100);
+	struct seq_bitmap_iter iter;
+	const uint32_t expected[] = { 100, 65534, 65535, 65536, 65537 };
+	unsigned int i = 0;
+
+	seq_bitmap_iter_init(&iter, bitmap);
+	while (seq_bitmap_iter_next(&iter, &seq)) {
+		test_assert_idx(i < N_ELEMENTS(expected) &&
+				seq == expected[i], i);
+		i++;
+	}
+	test_assert(i == N_ELEMENTS(expected));
+	seq_bitmap_free(&bitmap);
+	test_end();
+}
+
+static void test_seq_bitmap_containers(void)
+{
+	ARRAY_TYPE(seq_range) expected;
+	struct seq_bitmap *bitmap;
+	uint32_t seq;
+
+	test_begin("seq_bitmap container conversions");
+	t_array_init(&expected, 16);
+	bitmap = seq_bitmap_create();
+
+	/* grow a sparse array until it has to become a bitmap */
+	for (seq = 0; seq < 65536; seq += 3) {
+		(void)seq_bitmap_add(bitmap, seq);
+		seq_range_array_add(&expected, seq);
+	}
+	test_assert(seq_bitmap_equals(bitmap, &expected));
+	/* shrink back to an array */
+	for (seq = 0; seq < 50000; seq += 3) {
+		(void)seq_bitmap_remove(bitmap, seq);
+		(void)seq_range_array_remove(&expected, seq);
+	}
+	test_assert(seq_bitmap_equals(bitmap, &expected));
+	/* long ranges become runs */
+	test_assert(seq_bitmap_add_range(bitmap, 1000, 60000) ==
+		    seq_range_array_add_range_count(&expected, 1000, 60000));
+	test_assert(seq_bitmap_equals(bitmap, &expected));
+	/* split the runs until they don't fit anymore */
+	for (seq = 1001; seq < 60000; seq += 2) {
+		(void)seq_bitmap_remove(bitmap, seq);
+		(void)seq_range_array_remove(&expected, seq);
+	}
+	test_assert(seq_bitmap_equals(bitmap, &expected));
+	/* full chunk */
+	test_assert(seq_bitmap_add_range(bitmap, 0, 65535) ==
+		    seq_range_array_add_range_count(&expected, 0, 65535));
+	test_assert(seq_bitmap_equals(bitmap, &expected));
+	test_assert(seq_bitmap_count(bitmap) == 65536);
+
+	/* remove everything in small ranges */
+	for (seq = 0; seq < 65536; seq += 7) {
+		test_assert(seq_bitmap_remove_range(bitmap, seq, seq + 3) ==
+			    seq_range_array_remove_range(&expected, seq,
+							 seq + 3));
+	}
+	test_assert(seq_bitmap_equals(bitmap, &expected));
+	test_assert(seq_bitmap_remove_range(bitmap, 0, 65535) ==
+		    seq_range_array_remove_range(&expected, 0, 65535));
+	test_assert(seq_bitmap_count(bitmap) == 0);
+	seq_bitmap_free(&bitmap);
+	test_end();
+}
+
+static void test_seq_bitmap_random_set(struct seq_bitmap *bitmap,
+				       ARRAY_TYPE(seq_range) *expected,
+				       uint32_t max_seq)
+{
+	unsigned int i, count = i_rand_limit(200);
+	uint32_t seq1, seq2;
+
+	for (i = 0; i < count; i++) {
+		seq1 = i_rand_limit(max_seq);
+		seq2 = seq1 + i_rand_limit(i_rand_limit(10) == 0 ? 5000 : 3);
+		(void)seq_bitmap_add_range(bitmap, seq1, seq2);
+		seq_range_array_add_range(expected, seq1, seq2);
+	}
+}
+
+static void test_seq_bitmap_random(void)
+{
+	ARRAY_TYPE(seq_range) expected, expected2, tmp;
+	struct seq_bitmap *bitmap, *bitmap2;
+	unsigned int i, j, removed;
+	uint32_t seq1, seq2, max_seq;
+
+	test_begin("seq_bitmap random");
+	bitmap = seq_bitmap_create();
+	bitmap2 = seq_bitmap_create();
+	for (i = 0; i < 200; i++) T_BEGIN {
+		max_seq = i_rand_limit(2) == 0 ? 100000 : 1000000;
+		t_array_init(&expected, 16);
+		t_array_init(&expected2, 16);
+		seq_bitmap_clear(bitmap);
+		seq_bitmap_clear(bitmap2);
+		test_seq_bitmap_random_set(bitmap, &expected, max_seq);
+		test_seq_bitmap_random_set(bitmap2, &expected2, max_seq);
+
+		for (j = 0; j < 100; j++) {
+			seq1 = i_rand_limit(max_seq);
+			seq2 = seq1 + i_rand_limit(100);
+			switch (i_rand_limit(4)) {
+			case 0:
+				test_assert_idx(seq_bitmap_add(bitmap, seq1) ==
+						seq_range_array_add(&expected, seq1), i);
+				break;
+			case 1:
+				test_assert_idx(seq_bitmap_remove(bitmap, seq1) ==
+						seq_range_array_remove(&expected, seq1), i);
+				break;
+			case 2:
+				test_assert_idx(seq_bitmap_remove_range(bitmap, seq1, seq2) ==
+						seq_range_array_remove_range(&expected, seq1, seq2), i);
+				break;
+			case 3:
+				test_assert_idx(seq_bitmap_exists(bitmap, seq1) ==
+						seq_range_exists(&expected, seq1), i);
+				break;
+			}
+		}
+		test_assert_idx(seq_bitmap_equals(bitmap, &expected), i);
+
+		switch (i % 3) {
+		case 0:
+			seq_bitmap_merge(bitmap, bitmap2);
+			seq_range_array_merge(&expected, &expected2);
+			break;
+		case 1:
+			t_array_init(&tmp, 16);
+			array_append_array(&tmp, &expected);
+			seq_range_array_remove_seq_range(&tmp, &expected2);
+			removed = seq_bitmap_intersect(bitmap, bitmap2);
+			test_assert_idx(removed == seq_range_count(&tmp), i);
+			seq_range_array_intersect(&expected, &expected2);
+			break;
+		case 2:
+			removed = seq_bitmap_remove_bitmap(bitmap, bitmap2);
+			test_assert_idx(removed ==
+				seq_range_array_remove_seq_range(&expected, &expected2), i);
+			break;
+		}
+		test_assert_idx(seq_bitmap_equals(bitmap, &expected), i);
+		test_assert_idx(seq_bitmap_equals(bitmap2, &expected2), i);
+
+		/* conversion from seq_range */
+		seq_bitmap_clear(bitmap2);
+		seq_bitmap_add_seq_range(bitmap2, &expected);
+		test_assert_idx(seq_bitmap_equals(bitmap2, &expected), i);
+	} T_END;
+	seq_bitmap_free(&bitmap);
+	seq_bitmap_free(&bitmap2);
+	test_end();
+}
+
+void test_seq_bitmap(void)
+{
+	test_seq_bitmap_add_remove();
+	test_seq_bitmap_containers();
+	test_seq_bitmap_random();
+}
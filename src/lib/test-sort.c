@@ -0,0 +1,58 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "sort.h"
+
+static int
+sort_radix_u64_node_cmp(const struct sort_radix_u64_node *n1,
+			const struct sort_radix_u64_node *n2)
+{
+	if (n1->key < n2->key)
+		return -1;
+	if (n1->key > n2->key)
+		return 1;
+	return uint32_cmp(&n1->value, &n2->value);
+}
+
+static void test_sort_radix_u64_keys(uint64_t key_mask)
+{
+	struct sort_radix_u64_node nodes[1000], expected[1000];
+	unsigned int i, count = i_rand_minmax(0, N_ELEMENTS(nodes));
+
+	for (i = 0; i < count; i++) {
+		nodes[i].key = (((uint64_t)i_rand() << 32) | i_rand()) &
+			key_mask;
+		/* values are in ascending order, so a stable sort gives
+		   the same result as sorting by (key, value) */
+		nodes[i].value = i;
+	}
+	memcpy(expected, nodes, sizeof(nodes[0]) * count);
+	i_qsort(expected, count, sizeof(expected[0]), sort_radix_u64_node_cmp);
+
+	sort_radix_u64(nodes, count);
+	for (i = 0; i < count; i++) {
+		test_assert_idx(nodes[i].key == expected[i].key, i);
+		test_assert_idx(nodes[i].value == expected[i].value, i);
+	}
+}
+
+static void test_sort_radix_u64(void)
+{
+	static const uint64_t key_masks[] = {
+		0, 0xff, 0x3, 0xff00ff00, 0xffffffff,
+		0xff00000000000000ULL, (uint64_t)-1
+	};
+	unsigned int i, j;
+
+	test_begin("sort_radix_u64()");
+	for (i = 0; i < N_ELEMENTS(key_masks); i++) {
+		for (j = 0; j < 10; j++)
+			test_sort_radix_u64_keys(key_masks[i]);
+	}
+	test_end();
+}
+
+void test_sort(void)
+{
+	test_sort_radix_u64();
+}
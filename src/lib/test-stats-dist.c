@@ -128,5 +128,68 @@ void test_stats_dist(void)
 	stats_dist_deinit(&t);
 	test_end();
 
+	test_begin("stats_dists add count");
+	t = stats_dist_init_with_size(8);
+	stats_dist_add_count(t, 10, 5);
+	test_assert(stats_dist_get_count(t) == 5);
+	test_assert(stats_dist_get_median(t) == 10);
+	stats_dist_add(t, 1);
+	stats_dist_add_count(t, 100, 100);
+	test_assert(stats_dist_get_count(t) == 106);
+	test_assert(stats_dist_get_sum(t) == 10*5 + 1 + 100*100);
+	test_assert(stats_dist_get_min(t) == 1);
+	test_assert(stats_dist_get_max(t) == 100);
+	stats_dist_deinit(&t);
+	test_end();
+
+	test_begin("stats_dists large values");
+	t = stats_dist_init();
+	for (i = 1; i <= 100000; i++)
+		stats_dist_add(t, i * 1000);
+	/* the real values are 50000500, 95000000 and 99900000 */
+	test_assert(stats_dist_get_median(t) > 49000000 &&
+		    stats_dist_get_median(t) < 51000000);
+	test_assert(stats_dist_get_95th(t) > 93000000 &&
+		    stats_dist_get_95th(t) < 97000000);
+	test_assert(stats_dist_get_percentile(t, 0.999) > 97000000 &&
+		    stats_dist_get_percentile(t, 0.999) <= 100000000);
+	test_assert(stats_dist_get_percentile(t, 1) == 100000000);
+	stats_dist_deinit(&t);
+	test_end();
+
+	test_begin("stats_dists samples");
+	t = stats_dist_init_with_size(4);
+	unsigned int sample_count;
+	const uint64_t *samples = stats_dist_get_samples(t, &sample_count);
+	test_assert(sample_count == 0);
+	for (i = 8; i > 0; i--)
+		stats_dist_add(t, i);
+	samples = stats_dist_get_samples(t, &sample_count);
+	test_assert(sample_count == 4);
+	for (i = 0; i < sample_count; i++)
+		test_assert_idx(samples[i] == i*2 + 1, i);
+	stats_dist_deinit(&t);
+	test_end();
+
+	test_begin("stats_dists merge");
+	struct stats_dist *t2 = stats_dist_init();
+	t = stats_dist_init();
+	for (i = 1; i <= 8; i++)
+		stats_dist_add(i <= 3 ? t : t2, i);
+	stats_dist_merge(t, t2);
+	test_assert(stats_dist_get_count(t) == 8);
+	test_assert(stats_dist_get_sum(t) == 36);
+	test_assert(stats_dist_get_min(t) == 1);
+	test_assert(stats_dist_get_max(t) == 8);
+	test_assert(stats_dist_get_median(t) == 4);
+	test_assert(DBL_EQ(stats_dist_get_variance(t), 5.25));
+	stats_dist_reset(t2);
+	stats_dist_merge(t2, t);
+	test_assert(stats_dist_get_count(t2) == 8);
+	test_assert(stats_dist_get_95th(t2) == 8);
+	stats_dist_deinit(&t);
+	stats_dist_deinit(&t2);
+	test_end();
+
 	test_stats_dist_get_variance();
 }
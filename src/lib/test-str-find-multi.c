@@ -0,0 +1,98 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "str-find-multi.h"
+
+static void test_str_find_multi_basic(void)
+{
+	static const char *const keys[] = {
+		"he", "she", "his", "hers", "she", "e", "xyz"
+	};
+	static const char *text = "ushers";
+	struct str_find_multi_context *ctx;
+	unsigned int i;
+
+	test_begin("str_find_multi()");
+	ctx = str_find_multi_init(default_pool, keys, N_ELEMENTS(keys));
+	test_assert(!str_find_multi_more(ctx, (const void *)text, strlen(text)));
+	test_assert(str_find_multi_get_found_count(ctx) == 5);
+	for (i = 0; i < N_ELEMENTS(keys); i++) {
+		test_assert_idx(str_find_multi_is_found(ctx, i) ==
+				(strstr(text, keys[i]) != NULL), i);
+	}
+
+	/* found keys are remembered over reset */
+	str_find_multi_reset(ctx);
+	test_assert(!str_find_multi_more(ctx, (const void *)"xy", 2));
+	test_assert(!str_find_multi_more(ctx, (const void *)"z", 1));
+	test_assert(str_find_multi_is_found(ctx, 6));
+	test_assert(!str_find_multi_is_found(ctx, 2));
+	/* but a match can't continue over reset */
+	test_assert(!str_find_multi_more(ctx, (const void *)"hi", 2));
+	str_find_multi_reset(ctx);
+	test_assert(!str_find_multi_more(ctx, (const void *)"s", 1));
+	test_assert(!str_find_multi_is_found(ctx, 2));
+	test_assert(str_find_multi_more(ctx, (const void *)"his", 3));
+	test_assert(str_find_multi_get_found_count(ctx) == N_ELEMENTS(keys));
+
+	str_find_multi_reset_found(ctx);
+	test_assert(str_find_multi_get_found_count(ctx) == 0);
+	test_assert(!str_find_multi_is_found(ctx, 0));
+	str_find_multi_deinit(&ctx);
+	test_end();
+}
+
+static void test_str_find_multi_random(void)
+{
+#define TEST_KEY_COUNT 6
+	struct str_find_multi_context *ctx;
+	const char *keys[TEST_KEY_COUNT];
+	char text[256];
+	unsigned int i, j, len, text_len, pos, key_count;
+	bool all_found;
+
+	test_begin("str_find_multi() random");
+	for (i = 0; i < 2000; i++) T_BEGIN {
+		/* use a small alphabet so that there are plenty of matches
+		   and partial matches */
+		key_count = 1 + i_rand_limit(TEST_KEY_COUNT);
+		for (j = 0; j < key_count; j++) {
+			char *key;
+
+			len = 1 + i_rand_limit(5);
+			key = t_malloc0(len + 1);
+			for (unsigned int k = 0; k < len; k++)
+				key[k] = 'a' + i_rand_limit(3);
+			keys[j] = key;
+		}
+		text_len = i_rand_limit(sizeof(text));
+		for (j = 0; j < text_len; j++)
+			text[j] = 'a' + i_rand_limit(4);
+		text[text_len] = '\0';
+
+		ctx = str_find_multi_init(pool_datastack_create(),
+					  keys, key_count);
+		/* feed the text in random sized blocks */
+		all_found = FALSE;
+		for (pos = 0; pos < text_len && !all_found; pos += len) {
+			len = i_rand_limit(10);
+			len = I_MIN(text_len - pos, len);
+			all_found = str_find_multi_more(ctx,
+				(const unsigned char *)text + pos, len);
+		}
+		for (j = 0; j < key_count; j++) {
+			test_assert_idx(str_find_multi_is_found(ctx, j) ==
+					(strstr(text, keys[j]) != NULL), i);
+		}
+		test_assert_idx(all_found ==
+				(str_find_multi_get_found_count(ctx) == key_count), i);
+		str_find_multi_deinit(&ctx);
+	} T_END;
+	test_end();
+}
+
+void test_str_find_multi(void)
+{
+	test_str_find_multi_basic();
+	test_str_find_multi_random();
+}
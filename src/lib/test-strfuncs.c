@@ -678,6 +678,33 @@ static void test_memcspn(void)
 	test_end();
 }
 
+static void test_memchr2(void)
+{
+	unsigned char data[100];
+	const unsigned char *p;
+	unsigned int i, j;
+
+	test_begin("i_memchr2");
+	test_assert(i_memchr2("", '\r', '\n', 0) == NULL);
+	memset(data, 'x', sizeof(data));
+	test_assert(i_memchr2(data, '\r', '\n', sizeof(data)) == NULL);
+	for (i = 0; i < sizeof(data); i++) {
+		for (j = i; j < sizeof(data); j += 7) {
+			memset(data, 'x', sizeof(data));
+			data[j] = '\n';
+			data[i] = '\r';
+			p = i_memchr2(data, '\r', '\n', sizeof(data));
+			test_assert_idx(p == data + i, i);
+			p = i_memchr2(data, '\n', '\r', i);
+			test_assert_idx(p == NULL, i);
+			p = i_memchr2(data + i + 1, '\n', '\r',
+				      sizeof(data) - i - 1);
+			test_assert_idx(p == (j > i ? data + j : NULL), i);
+		}
+	}
+	test_end();
+}
+
 void test_strfuncs(void)
 {
 	test_p_strdup();
@@ -701,6 +728,7 @@ void test_strfuncs(void)
 	test_str_match_icase();
 	test_memspn();
 	test_memcspn();
+	test_memchr2();
 }
 
 enum fatal_test_state fatal_strfuncs(unsigned int stage)
@@ -78,6 +78,31 @@ static void test_str_to_uintmax(void)
 		test_assert_idx(ret < 0 && value == valbase + i, i);
 	}
 	test_end();
+
+	/* numbers of every length, including the lengths where the
+	   overflow checking begins */
+	test_begin("str_parse_uintmax lengths");
+	value = 0;
+	for (i = 0; value <= UINTMAX_MAX / 10; i++) {
+		uintmax_t value_back;
+		const char *endp;
+
+		value = value * 10 + (i % 10);
+		i_snprintf(buff, sizeof(buff), "%ju;", value);
+		len = strchr(buff, ';') - buff;
+		ret = str_parse_uintmax(buff, &value_back, &endp);
+		test_assert_idx(ret == 0, i);
+		test_assert_idx(value_back == value, i);
+		test_assert_idx(endp == &buff[len], i);
+	}
+	/* leading zeros don't count towards overflowing */
+	i_snprintf(buff, sizeof(buff), "000000000000000000000000%ju",
+		   UINTMAX_MAX);
+	test_assert(str_to_uintmax(buff, &value) == 0 &&
+		    value == UINTMAX_MAX);
+	i_snprintf(buff, sizeof(buff), "%ju0", UINTMAX_MAX / 10 + 1);
+	test_assert(str_to_uintmax(buff, &value) < 0);
+	test_end();
 }
 
 /* always pads with leading zeros to a size of 9 digits */
@@ -0,0 +1,160 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "test-lib.h"
+#include "timer-wheel.h"
+
+struct tw_test_item {
+	struct timer_wheel_item item;
+	uint64_t expire;
+	bool popped;
+};
+
+static void test_timer_wheel_basic(void)
+{
+	static const uint64_t expires[] = {
+		5, 100, 64, 63, 4095, 4096, 1000000, 70000, 5, 0
+	};
+	struct tw_test_item items[N_ELEMENTS(expires)];
+	struct timer_wheel_item *witem;
+	struct timer_wheel *wheel;
+	struct tw_test_item *item;
+	uint64_t now, prev = 0;
+	unsigned int i, popped = 0;
+
+	test_begin("timer wheel");
+	wheel = timer_wheel_init(10);
+	test_assert(timer_wheel_get_next_tick(wheel) == (uint64_t)-1);
+	test_assert(timer_wheel_pop_expired(wheel, 1000) == NULL);
+
+	timer_wheel_deinit(&wheel);
+
+	wheel = timer_wheel_init(0);
+	for (i = 0; i < N_ELEMENTS(expires); i++) {
+		i_zero(&items[i]);
+		timer_wheel_item_init(&items[i].item);
+		test_assert(!timer_wheel_item_is_added(&items[i].item));
+		items[i].expire = expires[i];
+		timer_wheel_add(wheel, &items[i].item, expires[i]);
+		test_assert(timer_wheel_item_is_added(&items[i].item));
+	}
+	test_assert(timer_wheel_count(wheel) == N_ELEMENTS(expires));
+
+	/* nothing is returned early, and everything comes out in order */
+	for (now = 0; popped < N_ELEMENTS(expires); ) {
+		uint64_t next = timer_wheel_get_next_tick(wheel);
+		test_assert(next >= now);
+		now = next;
+		while ((witem = timer_wheel_pop_expired(wheel, now)) != NULL) {
+			item = container_of(witem, struct tw_test_item, item);
+			test_assert(!item->popped);
+			test_assert(item->expire <= now);
+			test_assert(item->expire >= prev);
+			test_assert(!timer_wheel_item_is_added(&item->item));
+			item->popped = TRUE;
+			prev = item->expire;
+			popped++;
+		}
+	}
+	/* each item was returned exactly at its expire time */
+	test_assert(prev == 1000000);
+	test_assert(timer_wheel_count(wheel) == 0);
+	test_assert(timer_wheel_get_next_tick(wheel) == (uint64_t)-1);
+	timer_wheel_deinit(&wheel);
+	test_end();
+}
+
+static void test_timer_wheel_remove(void)
+{
+	struct tw_test_item items[100];
+	struct timer_wheel_item *witem;
+	struct timer_wheel *wheel;
+	unsigned int i, count = 0;
+
+	test_begin("timer wheel remove");
+	wheel = timer_wheel_init(1000);
+	for (i = 0; i < N_ELEMENTS(items); i++) {
+		timer_wheel_item_init(&items[i].item);
+		timer_wheel_add(wheel, &items[i].item, 1000 + i * 997);
+	}
+	for (i = 0; i < N_ELEMENTS(items); i += 2)
+		timer_wheel_remove(wheel, &items[i].item);
+	test_assert(timer_wheel_count(wheel) == N_ELEMENTS(items) / 2);
+
+	/* re-add one into the past - it's returned immediately */
+	timer_wheel_add(wheel, &items[0].item, 5);
+	witem = timer_wheel_pop_expired(wheel, 1000);
+	test_assert(witem == &items[0].item);
+	test_assert(timer_wheel_pop_expired(wheel, 1000) == NULL);
+
+	while ((witem = timer_wheel_pop_expired(wheel, 1000 + 100 * 997)) != NULL) {
+		i = container_of(witem, struct tw_test_item, item) - items;
+		test_assert(i % 2 == 1);
+		count++;
+	}
+	test_assert(count == N_ELEMENTS(items) / 2);
+	timer_wheel_deinit(&wheel);
+	test_end();
+}
+
+static void test_timer_wheel_random(void)
+{
+#define TW_RANDOM_ITEMS 1000
+	struct tw_test_item *items;
+	struct timer_wheel_item *witem;
+	struct timer_wheel *wheel;
+	struct tw_test_item *item;
+	uint64_t now = 12345, next;
+	unsigned int i, j, idx, added = 0;
+
+	test_begin("timer wheel random");
+	items = i_new(struct tw_test_item, TW_RANDOM_ITEMS);
+	for (i = 0; i < TW_RANDOM_ITEMS; i++)
+		timer_wheel_item_init(&items[i].item);
+
+	wheel = timer_wheel_init(now);
+	for (i = 0; i < 20000; i++) {
+		idx = i_rand_limit(TW_RANDOM_ITEMS);
+		item = &items[idx];
+		if (timer_wheel_item_is_added(&item->item)) {
+			timer_wheel_remove(wheel, &item->item);
+			added--;
+		}
+		/* mix of near and very far away timeouts */
+		item->expire = now + 1 + (i_rand_limit(4) == 0 ?
+					  i_rand_limit(1U << 30) :
+					  i_rand_limit(100000));
+		timer_wheel_add(wheel, &item->item, item->expire);
+		added++;
+
+		if (i_rand_limit(10) == 0) {
+			/* move the time forward */
+			now += i_rand_limit(50000);
+			while ((witem = timer_wheel_pop_expired(wheel, now)) != NULL) {
+				item = container_of(witem, struct tw_test_item, item);
+				test_assert(item->expire <= now);
+				added--;
+			}
+			test_assert(timer_wheel_count(wheel) == added);
+			/* nothing that was left is expired */
+			for (j = 0; j < TW_RANDOM_ITEMS; j++) {
+				if (timer_wheel_item_is_added(&items[j].item))
+					test_assert(items[j].expire > now);
+			}
+			next = timer_wheel_get_next_tick(wheel);
+			test_assert(added == 0 || next > now);
+		}
+	}
+	while ((witem = timer_wheel_pop_any(wheel)) != NULL)
+		added--;
+	test_assert(added == 0);
+	timer_wheel_deinit(&wheel);
+	i_free(items);
+	test_end();
+}
+
+void test_timer_wheel(void)
+{
+	test_timer_wheel_basic();
+	test_timer_wheel_remove();
+	test_timer_wheel_random();
+}
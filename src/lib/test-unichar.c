@@ -4,6 +4,7 @@
 #include "str.h"
 #include "buffer.h"
 #include "unichar.h"
+#include "unichar-private.h"
 
 static void test_unichar_uni_utf8_strlen(void)
 {
@@ -121,6 +122,130 @@ static void test_unichar_surrogates(void)
 	test_end();
 }
 
+static void
+test_unichar_simd_append_random(buffer_t *buf, unsigned int count)
+{
+	static const unsigned char invalid[][4] = {
+		{ 0x80 }, { 0xbf }, { 0xc0, 0x80 }, { 0xc1, 0xbf },
+		{ 0xe0, 0x9f, 0xbf }, { 0xed, 0xa0, 0x80 }, { 0xed, 0xbf, 0xbf },
+		{ 0xf0, 0x8f, 0xbf, 0xbf }, { 0xf4, 0x90, 0x80, 0x80 },
+		{ 0xf5, 0x80, 0x80, 0x80 }, { 0xff }, { 0xc3 }, { 0xe2, 0x82 },
+		{ 0xf0, 0x9f, 0x98 },
+	};
+	unsigned int i, idx;
+
+	for (i = 0; i < count; i++) {
+		switch (i_rand_limit(8)) {
+		case 0:
+			uni_ucs4_to_utf8_c(0x80 + i_rand_limit(0x800 - 0x80),
+					   buf);
+			break;
+		case 1:
+			uni_ucs4_to_utf8_c(0x800 + i_rand_limit(0xd800 - 0x800),
+					   buf);
+			break;
+		case 2:
+			uni_ucs4_to_utf8_c(0x10000 + i_rand_limit(0x100000),
+					   buf);
+			break;
+		case 3:
+			if (i_rand_limit(50) == 0) {
+				idx = i_rand_limit(N_ELEMENTS(invalid));
+				buffer_append(buf, invalid[idx],
+					strnlen((const char *)invalid[idx],
+						sizeof(invalid[idx])));
+				break;
+			}
+			/* fall through */
+		default:
+			buffer_append_c(buf, i_rand_limit(0x80));
+			break;
+		}
+	}
+}
+
+static void test_unichar_simd(void)
+{
+	static const enum uni_utf8_simd_impl impls[] = {
+		UNI_UTF8_SIMD_IMPL_SSSE3,
+		UNI_UTF8_SIMD_IMPL_AVX2,
+	};
+	static const char *impl_names[] = { "SSSE3", "AVX2" };
+	static const unsigned char next_bytes[] = {
+		0x00, 0x7f, 0x80, 0x8f, 0x90, 0x9f, 0xa0, 0xbf, 0xc0, 0xff
+	};
+	unsigned char seq[64];
+	buffer_t *buf, *out1, *out2;
+	size_t pos, prefix;
+	unsigned int i, j, n;
+	bool valid1, valid2;
+
+	buf = t_buffer_create(1024);
+	out1 = t_buffer_create(1024);
+	out2 = t_buffer_create(1024);
+	for (i = 0; i < N_ELEMENTS(impls); i++) {
+		if (!uni_utf8_simd_set_impl(impls[i]))
+			continue;
+		test_begin(t_strdup_printf("unichar SIMD %s", impl_names[i]));
+
+		/* all 2 byte prefixes followed by some 3rd and 4th bytes,
+		   placed around the 16 and 32 byte block boundaries */
+		for (j = 0; j < 256*256; j++) {
+			memset(seq, 'x', sizeof(seq));
+			pos = 12 + j % 24;
+			seq[pos] = j >> 8;
+			seq[pos+1] = j & 0xff;
+			seq[pos+2] = next_bytes[j % N_ELEMENTS(next_bytes)];
+			seq[pos+3] = next_bytes[(j / 7) % N_ELEMENTS(next_bytes)];
+			valid2 = uni_utf8_data_is_valid(seq, sizeof(seq));
+			(void)uni_utf8_simd_set_impl(UNI_UTF8_SIMD_IMPL_NONE);
+			valid1 = uni_utf8_data_is_valid(seq, sizeof(seq));
+			(void)uni_utf8_simd_set_impl(impls[i]);
+			test_assert_idx(valid1 == valid2, j);
+		}
+
+		/* random text with some invalid sequences */
+		for (j = 0; j < 2000; j++) {
+			buffer_set_used_size(buf, 0);
+			test_unichar_simd_append_random(buf, i_rand_limit(300));
+			n = i_rand_limit(3);
+			while (n-- > 0 && buf->used > 0)
+				buffer_write(buf, i_rand_limit(buf->used),
+					     "\x80", 1);
+
+			prefix = uni_utf8_simd_valid_prefix(buf->data,
+							    buf->used);
+			/* the prefix also can't end with a partial character */
+			test_assert_idx(prefix <= buf->used, j);
+			test_assert_idx(uni_utf8_data_is_valid(buf->data,
+							       prefix), j);
+
+			buffer_set_used_size(out1, 0);
+			buffer_set_used_size(out2, 0);
+			valid2 = uni_utf8_get_valid_data(buf->data, buf->used,
+							 out2);
+			(void)uni_utf8_simd_set_impl(UNI_UTF8_SIMD_IMPL_NONE);
+			valid1 = uni_utf8_get_valid_data(buf->data, buf->used,
+							 out1);
+			(void)uni_utf8_simd_set_impl(impls[i]);
+			test_assert_idx(valid1 == valid2, j);
+			test_assert_idx(buffer_cmp(out1, out2), j);
+		}
+
+		/* ASCII is validated in whole blocks */
+		memset(seq, 'x', sizeof(seq));
+		test_assert(uni_utf8_simd_valid_prefix(seq, sizeof(seq)) ==
+			    sizeof(seq));
+		test_assert(uni_utf8_simd_valid_prefix(seq, sizeof(seq) - 1) ==
+			    sizeof(seq) - 16);
+		test_end();
+	}
+	/* back to the default */
+	if (!uni_utf8_simd_set_impl(UNI_UTF8_SIMD_IMPL_AVX2) &&
+	    !uni_utf8_simd_set_impl(UNI_UTF8_SIMD_IMPL_SSSE3))
+		(void)uni_utf8_simd_set_impl(UNI_UTF8_SIMD_IMPL_NONE);
+}
+
 void test_unichar(void)
 {
 	static const char overlong_utf8[] = "\xf8\x80\x95\x81\xa1";
@@ -182,4 +307,5 @@ void test_unichar(void)
 	test_unichar_uni_utf8_partial_strlen_n();
 	test_unichar_valid_unicode();
 	test_unichar_surrogates();
+	test_unichar_simd();
 }
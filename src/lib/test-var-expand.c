@@ -475,6 +475,60 @@ static void test_var_expand_merge_tables(void)
 	test_end();
 }
 
+static void test_var_expand_program(void)
+{
+	static const char *const tests[] = {
+		"",
+		"plain text",
+		"%u",
+		"%{user}@%d",
+		"user=%u AND domain='%{domain}' %%",
+		"%Lu %5.2u %-3.2{user} %{ user } %X",
+		"%{func1:foo}%{func1}%{nosuch}%{env:nosuch}",
+		"%{if;%u;eq;foo;yes;no} %{lookup}",
+		"%{user",
+		"%}{}%{{user}}",
+		"trailing%",
+		"trailing%L",
+		"%Mu%N{user}",
+		"%n%z",
+	};
+	static const struct var_expand_table table[] = {
+		{ 'u', "foo", "user" },
+		{ 'd', "example.com", "domain" },
+		{ 'n', NULL, "null" },
+		{ '\0', "value", "lookup" },
+		{ '\0', NULL, NULL }
+	};
+	static const struct var_expand_func_table func_table[] = {
+		{ "func1", test_var_expand_func1 },
+		{ NULL, NULL }
+	};
+	struct var_expand_program *program;
+	string_t *str1 = t_str_new(128), *str2 = t_str_new(128);
+	const char *error1, *error2;
+	unsigned int i;
+	int ret1, ret2, ctx = 0xabcdef;
+	pool_t pool;
+
+	test_begin("var_expand_program");
+	pool = pool_alloconly_create("var expand program", 1024);
+	for (i = 0; i < N_ELEMENTS(tests); i++) {
+		str_truncate(str1, 0);
+		str_truncate(str2, 0);
+		program = var_expand_program_create(pool, tests[i]);
+		ret1 = var_expand_with_funcs(str1, tests[i], table, func_table,
+					     &ctx, &error1);
+		ret2 = var_expand_program_execute(str2, program, table,
+						  func_table, &ctx, &error2);
+		test_assert_idx(ret1 == ret2, i);
+		test_assert_idx(strcmp(str_c(str1), str_c(str2)) == 0, i);
+		test_assert_idx(null_strcmp(error1, error2) == 0, i);
+	}
+	pool_unref(&pool);
+	test_end();
+}
+
 void test_var_expand(void)
 {
 	test_var_expand_ranges();
@@ -486,4 +540,5 @@ void test_var_expand(void)
 	test_var_expand_extensions();
 	test_var_expand_if();
 	test_var_expand_merge_tables();
+	test_var_expand_program();
 }
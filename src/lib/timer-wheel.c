@@ -0,0 +1,260 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "llist.h"
+#include "timer-wheel.h"
+
+/* Each level has 64 slots, so the used slots can be tracked with a single
+   uint64_t bitmap. With 6 levels the wheel covers 2^36 ticks, i.e. a bit over
+   two years with millisecond ticks. Items further away than that are kept in
+   a separate overflow list. */
+#define TIMER_WHEEL_LEVEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1U << TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 6
+#define TIMER_WHEEL_OVERFLOW_LEVEL TIMER_WHEEL_LEVELS
+
+#define TIMER_WHEEL_LEVEL_SHIFT(level) ((level) * TIMER_WHEEL_LEVEL_BITS)
+#define TIMER_WHEEL_TOP_SHIFT \
+	TIMER_WHEEL_LEVEL_SHIFT(TIMER_WHEEL_LEVELS)
+
+struct timer_wheel {
+	/* Current tick. All items with expire_tick < now have already been
+	   returned. */
+	uint64_t now;
+	unsigned int count;
+
+	uint64_t used_slots[TIMER_WHEEL_LEVELS];
+	struct timer_wheel_item *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	struct timer_wheel_item *overflow;
+};
+
+static unsigned int lowest_bit_set(uint64_t bits)
+{
+	i_assert(bits != 0);
+#if __GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4)
+	return __builtin_ctzll(bits);
+#else
+	unsigned int i;
+
+	for (i = 0; (bits & 1) == 0; i++)
+		bits >>= 1;
+	return i;
+#endif
+}
+
+struct timer_wheel *timer_wheel_init(uint64_t now_tick)
+{
+	struct timer_wheel *wheel;
+
+	wheel = i_new(struct timer_wheel, 1);
+	wheel->now = now_tick;
+	return wheel;
+}
+
+void timer_wheel_deinit(struct timer_wheel **_wheel)
+{
+	struct timer_wheel *wheel = *_wheel;
+
+	*_wheel = NULL;
+	i_free(wheel);
+}
+
+unsigned int timer_wheel_count(const struct timer_wheel *wheel)
+{
+	return wheel->count;
+}
+
+static struct timer_wheel_item **
+timer_wheel_get_list(struct timer_wheel *wheel,
+		     const struct timer_wheel_item *item)
+{
+	if (item->level == TIMER_WHEEL_OVERFLOW_LEVEL)
+		return &wheel->overflow;
+	i_assert(item->level < TIMER_WHEEL_LEVELS);
+	return &wheel->slots[item->level][item->slot];
+}
+
+static void
+timer_wheel_link(struct timer_wheel *wheel, struct timer_wheel_item *item)
+{
+	uint64_t diff = item->expire_tick ^ wheel->now;
+	unsigned int level;
+
+	/* The item goes to the lowest level whose current block contains the
+	   expire tick, i.e. the highest bits above the level are the same as
+	   in the current tick. */
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		if ((diff >> TIMER_WHEEL_LEVEL_SHIFT(level + 1)) == 0)
+			break;
+	}
+	if (level == TIMER_WHEEL_LEVELS) {
+		item->level = TIMER_WHEEL_OVERFLOW_LEVEL;
+		item->slot = 0;
+		DLLIST_PREPEND(&wheel->overflow, item);
+		return;
+	}
+
+	item->level = level;
+	item->slot = (item->expire_tick >> TIMER_WHEEL_LEVEL_SHIFT(level)) &
+		TIMER_WHEEL_SLOT_MASK;
+	DLLIST_PREPEND(&wheel->slots[level][item->slot], item);
+	wheel->used_slots[level] |= 1ULL << item->slot;
+}
+
+static void
+timer_wheel_unlink(struct timer_wheel *wheel, struct timer_wheel_item *item)
+{
+	struct timer_wheel_item **list = timer_wheel_get_list(wheel, item);
+
+	DLLIST_REMOVE(list, item);
+	if (*list == NULL && item->level < TIMER_WHEEL_LEVELS)
+		wheel->used_slots[item->level] &= ~(1ULL << item->slot);
+	item->level = TIMER_WHEEL_ITEM_NOT_ADDED;
+}
+
+void timer_wheel_add(struct timer_wheel *wheel, struct timer_wheel_item *item,
+		     uint64_t expire_tick)
+{
+	i_assert(!timer_wheel_item_is_added(item));
+
+	item->expire_tick = I_MAX(expire_tick, wheel->now);
+	timer_wheel_link(wheel, item);
+	wheel->count++;
+}
+
+void timer_wheel_remove(struct timer_wheel *wheel,
+			struct timer_wheel_item *item)
+{
+	i_assert(timer_wheel_item_is_added(item));
+	i_assert(wheel->count > 0);
+
+	timer_wheel_unlink(wheel, item);
+	wheel->count--;
+}
+
+uint64_t timer_wheel_get_next_tick(const struct timer_wheel *wheel)
+{
+	uint64_t used, block, next_tick = (uint64_t)-1;
+	unsigned int level, start, slot;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		/* At level 0 the current slot contains items expiring now.
+		   At higher levels the current slot has already been moved
+		   to the lower levels, so only the following slots matter. */
+		start = ((wheel->now >> TIMER_WHEEL_LEVEL_SHIFT(level)) &
+			 TIMER_WHEEL_SLOT_MASK) + (level == 0 ? 0 : 1);
+		if (start >= TIMER_WHEEL_SLOTS)
+			continue;
+		used = wheel->used_slots[level] & (~0ULL << start);
+		if (used == 0)
+			continue;
+
+		slot = lowest_bit_set(used);
+		block = (wheel->now >> TIMER_WHEEL_LEVEL_SHIFT(level + 1)) <<
+			TIMER_WHEEL_LEVEL_SHIFT(level + 1);
+		next_tick = I_MIN(next_tick, block |
+			((uint64_t)slot << TIMER_WHEEL_LEVEL_SHIFT(level)));
+		if (level == 0) {
+			/* nothing at higher levels can be earlier */
+			return next_tick;
+		}
+	}
+	if (wheel->overflow != NULL) {
+		next_tick = I_MIN(next_tick,
+			((wheel->now >> TIMER_WHEEL_TOP_SHIFT) + 1) <<
+			TIMER_WHEEL_TOP_SHIFT);
+	}
+	return next_tick;
+}
+
+static void timer_wheel_relink_list(struct timer_wheel *wheel,
+				    struct timer_wheel_item **list)
+{
+	struct timer_wheel_item *item;
+
+	while (*list != NULL) {
+		item = *list;
+		timer_wheel_unlink(wheel, item);
+		timer_wheel_link(wheel, item);
+	}
+}
+
+static void timer_wheel_cascade(struct timer_wheel *wheel)
+{
+	unsigned int level, slot;
+
+	if ((wheel->now & ((1ULL << TIMER_WHEEL_TOP_SHIFT) - 1)) == 0) {
+		/* entered a new top level block */
+		timer_wheel_relink_list(wheel, &wheel->overflow);
+	}
+	/* Move the items in the current slots to the lower levels. Go from top
+	   to bottom, so that items can move down multiple levels at once. */
+	for (level = TIMER_WHEEL_LEVELS - 1; level > 0; level--) {
+		if ((wheel->now &
+		     ((1ULL << TIMER_WHEEL_LEVEL_SHIFT(level)) - 1)) != 0)
+			continue;
+		slot = (wheel->now >> TIMER_WHEEL_LEVEL_SHIFT(level)) &
+			TIMER_WHEEL_SLOT_MASK;
+		if ((wheel->used_slots[level] & (1ULL << slot)) != 0)
+			timer_wheel_relink_list(wheel, &wheel->slots[level][slot]);
+	}
+}
+
+struct timer_wheel_item *
+timer_wheel_pop_expired(struct timer_wheel *wheel, uint64_t now_tick)
+{
+	struct timer_wheel_item *item;
+	uint64_t next_tick;
+	unsigned int slot;
+
+	while (wheel->count > 0) {
+		timer_wheel_cascade(wheel);
+
+		slot = wheel->now & TIMER_WHEEL_SLOT_MASK;
+		item = wheel->slots[0][slot];
+		if (item != NULL) {
+			if (item->expire_tick > now_tick)
+				return NULL;
+			timer_wheel_remove(wheel, item);
+			return item;
+		}
+
+		next_tick = timer_wheel_get_next_tick(wheel);
+		i_assert(next_tick > wheel->now);
+		if (next_tick > now_tick) {
+			/* Nothing expires before now_tick. Advance the
+			   current tick anyway, so the wheel doesn't have to
+			   be walked through again. This can't skip over any
+			   slot that would need to be moved to lower levels. */
+			if (now_tick >= wheel->now)
+				wheel->now = now_tick + 1;
+			return NULL;
+		}
+		wheel->now = next_tick;
+	}
+	/* empty - the current tick can be moved freely */
+	if (now_tick >= wheel->now)
+		wheel->now = now_tick + 1;
+	return NULL;
+}
+
+struct timer_wheel_item *timer_wheel_pop_any(struct timer_wheel *wheel)
+{
+	struct timer_wheel_item *item;
+	unsigned int level;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		if (wheel->used_slots[level] == 0)
+			continue;
+		item = wheel->slots[level][lowest_bit_set(wheel->used_slots[level])];
+		timer_wheel_remove(wheel, item);
+		return item;
+	}
+	if (wheel->overflow != NULL) {
+		item = wheel->overflow;
+		timer_wheel_remove(wheel, item);
+		return item;
+	}
+	return NULL;
+}
@@ -0,0 +1,63 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+/* Hierarchical timer wheel. Adding and removing items is O(1), which makes it
+   cheaper than priorityq for timers that are constantly reset (e.g. idle
+   timeouts). The items don't come out in a strictly sorted order: items
+   expiring at the same tick are returned in arbitrary order. The items you
+   add to the wheel must contain a struct timer_wheel_item. */
+
+struct timer_wheel_item {
+	struct timer_wheel_item *prev, *next;
+	/* Tick when the item expires. */
+	uint64_t expire_tick;
+	/* Wheel level and slot where the item currently is. Set to
+	   TIMER_WHEEL_ITEM_NOT_ADDED when the item isn't in a wheel. */
+	uint8_t level, slot;
+	/* [your own data] */
+};
+
+#define TIMER_WHEEL_ITEM_NOT_ADDED 0xff
+
+/* Create a new timer wheel, with the current time being now_tick. The tick
+   unit is decided by the caller (e.g. milliseconds). */
+struct timer_wheel *timer_wheel_init(uint64_t now_tick);
+void timer_wheel_deinit(struct timer_wheel **wheel);
+
+/* Initialize the item so that timer_wheel_item_is_added() returns FALSE. */
+static inline void timer_wheel_item_init(struct timer_wheel_item *item)
+{
+	item->prev = item->next = NULL;
+	item->level = TIMER_WHEEL_ITEM_NOT_ADDED;
+}
+static inline bool
+timer_wheel_item_is_added(const struct timer_wheel_item *item)
+{
+	return item->level != TIMER_WHEEL_ITEM_NOT_ADDED;
+}
+
+/* Return number of items in the wheel. */
+unsigned int timer_wheel_count(const struct timer_wheel *wheel) ATTR_PURE;
+
+/* Add the item to expire at the given tick. If the tick is already in the
+   past, the item is returned by the next timer_wheel_pop_expired() call. */
+void timer_wheel_add(struct timer_wheel *wheel, struct timer_wheel_item *item,
+		     uint64_t expire_tick);
+/* Remove the specified item from the wheel. */
+void timer_wheel_remove(struct timer_wheel *wheel,
+			struct timer_wheel_item *item);
+
+/* Return the next tick when timer_wheel_pop_expired() may return something,
+   or (uint64_t)-1 if the wheel is empty. The returned tick may be earlier than
+   any of the items' expire_tick, because items far in the future need to be
+   moved to more accurate wheel levels. It's anyway never later than the
+   earliest expire_tick. */
+uint64_t timer_wheel_get_next_tick(const struct timer_wheel *wheel);
+/* Remove and return one item whose expire_tick <= now_tick. Returns NULL if
+   there are no more such items. */
+struct timer_wheel_item *
+timer_wheel_pop_expired(struct timer_wheel *wheel, uint64_t now_tick);
+/* Remove and return any item in the wheel, or NULL if the wheel is empty. */
+struct timer_wheel_item *timer_wheel_pop_any(struct timer_wheel *wheel);
+
+#endif
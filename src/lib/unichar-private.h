@@ -0,0 +1,26 @@
+#ifndef UNICHAR_PRIVATE_H
+#define UNICHAR_PRIVATE_H
+
+enum uni_utf8_simd_impl {
+	UNI_UTF8_SIMD_IMPL_NONE = 0,
+	UNI_UTF8_SIMD_IMPL_SSSE3,
+	UNI_UTF8_SIMD_IMPL_AVX2,
+};
+
+/* Minimum number of input bytes the SIMD validation does anything with. */
+#define UNI_UTF8_SIMD_MIN_INPUT 16
+
+/* Returns the number of bytes at the beginning of the data that are known
+   to be valid UTF-8. The returned position is always at a character
+   boundary. It's 0 if SIMD isn't supported. The validation stops at the
+   first block containing invalid input and also before the last character
+   of the validated blocks, so the caller must check the rest of the data
+   itself. */
+size_t uni_utf8_simd_valid_prefix(const unsigned char *data, size_t size);
+
+/* Use the given implementation instead of the best one supported by the CPU.
+   Returns FALSE if the CPU doesn't support it. This is intended for unit
+   tests. */
+bool uni_utf8_simd_set_impl(enum uni_utf8_simd_impl impl);
+
+#endif
@@ -0,0 +1,274 @@
+/* Copyright (c) 2024 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "unichar-private.h"
+
+/* The validation is based on the lookup algorithm by John Keiser and Daniel
+   Lemire: each byte is classified by looking up the high and low nibble of
+   the previous byte and the high nibble of the byte itself from 16 entry
+   tables. Each table entry has a bit for each error type the nibble may be
+   part of, so ANDing the three lookups leaves only the bits of the errors
+   that actually occur. The 3rd and 4th bytes of a sequence are checked
+   separately by comparing them against the bytes 2 and 3 positions back.
+   The rules are the same as in uni_utf8_get_char_n(): overlong encodings,
+   surrogates and characters above U+10FFFF are invalid. */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(__GNUC__ >= 5 || defined(__clang__))
+#  define UNI_UTF8_SIMD_X86
+#  include <immintrin.h>
+#  define UNI_UTF8_TARGET_SSSE3 __attribute__((target("ssse3")))
+#  define UNI_UTF8_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* error bits */
+#define TOO_SHORT	(1 << 0) /* lead byte not followed by continuation */
+#define TOO_LONG	(1 << 1) /* ASCII followed by continuation */
+#define OVERLONG_3	(1 << 2)
+#define TOO_LARGE	(1 << 3)
+#define SURROGATE	(1 << 4)
+#define OVERLONG_2	(1 << 5)
+#define TOO_LARGE_1000	(1 << 6)
+#define OVERLONG_4	(1 << 6)
+#define TWO_CONTS	(1 << 7) /* two continuations in a row */
+#define CARRY		(TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define UTF8_BYTE_1_HIGH_TABLE \
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, \
+	TOO_SHORT | OVERLONG_2, \
+	TOO_SHORT, \
+	TOO_SHORT | OVERLONG_3 | SURROGATE, \
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+#define UTF8_BYTE_1_LOW_TABLE \
+	CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, \
+	CARRY | OVERLONG_2, \
+	CARRY, \
+	CARRY, \
+	CARRY | TOO_LARGE, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000, \
+	CARRY | TOO_LARGE | TOO_LARGE_1000
+#define UTF8_BYTE_2_HIGH_TABLE \
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | \
+		OVERLONG_4, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+typedef size_t uni_utf8_simd_func_t(const unsigned char *data, size_t size);
+
+static bool uni_utf8_simd_initialized = FALSE;
+static uni_utf8_simd_func_t *uni_utf8_simd_func = NULL;
+
+static size_t
+uni_utf8_simd_char_start(const unsigned char *data, size_t pos)
+{
+	unsigned int i;
+
+	/* Everything before pos has been validated, except the bytes of the
+	   character that may continue after pos. Move back to the beginning
+	   of the last character. */
+	for (i = 0; i < 3 && pos > 0 && (data[pos-1] & 0xc0) == 0x80; i++)
+		pos--;
+	if (pos > 0 && data[pos-1] >= 0xc0)
+		pos--;
+	return pos;
+}
+
+#ifdef UNI_UTF8_SIMD_X86
+
+/*
+ * SSSE3
+ */
+
+static inline UNI_UTF8_TARGET_SSSE3 __m128i
+uni_utf8_ssse3_check(__m128i in, __m128i prev_in)
+{
+	const __m128i mask_0f = _mm_set1_epi8(0x0f);
+	__m128i prev1, prev2, prev3, b1_high, b1_low, b2_high, special;
+	__m128i third, fourth, must23;
+
+	prev1 = _mm_alignr_epi8(in, prev_in, 16 - 1);
+	b1_high = _mm_shuffle_epi8(
+		_mm_setr_epi8(UTF8_BYTE_1_HIGH_TABLE),
+		_mm_and_si128(_mm_srli_epi16(prev1, 4), mask_0f));
+	b1_low = _mm_shuffle_epi8(
+		_mm_setr_epi8(UTF8_BYTE_1_LOW_TABLE),
+		_mm_and_si128(prev1, mask_0f));
+	b2_high = _mm_shuffle_epi8(
+		_mm_setr_epi8(UTF8_BYTE_2_HIGH_TABLE),
+		_mm_and_si128(_mm_srli_epi16(in, 4), mask_0f));
+	special = _mm_and_si128(_mm_and_si128(b1_high, b1_low), b2_high);
+
+	/* Only the 3rd and 4th bytes of a sequence are preceded by
+	   111xxxxx two bytes back or 1111xxxx three bytes back. TWO_CONTS
+	   is set in special exactly for them, so the XOR clears it. */
+	prev2 = _mm_alignr_epi8(in, prev_in, 16 - 2);
+	prev3 = _mm_alignr_epi8(in, prev_in, 16 - 3);
+	third = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xe0 - 0x80)));
+	fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xf0 - 0x80)));
+	must23 = _mm_and_si128(_mm_or_si128(third, fourth),
+			       _mm_set1_epi8((char)0x80));
+	return _mm_xor_si128(must23, special);
+}
+
+static UNI_UTF8_TARGET_SSSE3 size_t
+uni_utf8_ssse3_valid_prefix(const unsigned char *data, size_t size)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i in, prev_in = zero, err;
+	bool prev_ascii = TRUE;
+	size_t pos;
+
+	for (pos = 0; pos + 16 <= size; pos += 16) {
+		in = _mm_loadu_si128((const void *)(data + pos));
+		if (_mm_movemask_epi8(in) == 0) {
+			/* ASCII can only be invalid if the previous block
+			   ended with an incomplete character */
+			if (prev_ascii) {
+				prev_in = in;
+				continue;
+			}
+			prev_ascii = TRUE;
+		} else {
+			prev_ascii = FALSE;
+		}
+		err = uni_utf8_ssse3_check(in, prev_in);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(err, zero)) != 0xffff)
+			break;
+		prev_in = in;
+	}
+	return uni_utf8_simd_char_start(data, pos);
+}
+
+/*
+ * AVX2
+ */
+
+static inline UNI_UTF8_TARGET_AVX2 __m256i
+uni_utf8_avx2_check(__m256i in, __m256i prev_in)
+{
+	const __m256i mask_0f = _mm256_set1_epi8(0x0f);
+	__m256i shifted, prev1, prev2, prev3, b1_high, b1_low, b2_high;
+	__m256i special, third, fourth, must23;
+
+	/* [prev_in high lane, in low lane] for the byte shifts across the
+	   lane boundary */
+	shifted = _mm256_permute2x128_si256(prev_in, in, 0x21);
+	prev1 = _mm256_alignr_epi8(in, shifted, 16 - 1);
+	b1_high = _mm256_shuffle_epi8(
+		_mm256_setr_epi8(UTF8_BYTE_1_HIGH_TABLE,
+				 UTF8_BYTE_1_HIGH_TABLE),
+		_mm256_and_si256(_mm256_srli_epi16(prev1, 4), mask_0f));
+	b1_low = _mm256_shuffle_epi8(
+		_mm256_setr_epi8(UTF8_BYTE_1_LOW_TABLE,
+				 UTF8_BYTE_1_LOW_TABLE),
+		_mm256_and_si256(prev1, mask_0f));
+	b2_high = _mm256_shuffle_epi8(
+		_mm256_setr_epi8(UTF8_BYTE_2_HIGH_TABLE,
+				 UTF8_BYTE_2_HIGH_TABLE),
+		_mm256_and_si256(_mm256_srli_epi16(in, 4), mask_0f));
+	special = _mm256_and_si256(_mm256_and_si256(b1_high, b1_low),
+				   b2_high);
+
+	prev2 = _mm256_alignr_epi8(in, shifted, 16 - 2);
+	prev3 = _mm256_alignr_epi8(in, shifted, 16 - 3);
+	third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xe0 - 0x80)));
+	fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xf0 - 0x80)));
+	must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+				  _mm256_set1_epi8((char)0x80));
+	return _mm256_xor_si256(must23, special);
+}
+
+static UNI_UTF8_TARGET_AVX2 size_t
+uni_utf8_avx2_valid_prefix(const unsigned char *data, size_t size)
+{
+	__m256i in, prev_in = _mm256_setzero_si256(), err;
+	bool prev_ascii = TRUE;
+	size_t pos;
+
+	for (pos = 0; pos + 32 <= size; pos += 32) {
+		in = _mm256_loadu_si256((const void *)(data + pos));
+		if (_mm256_movemask_epi8(in) == 0) {
+			if (prev_ascii) {
+				prev_in = in;
+				continue;
+			}
+			prev_ascii = TRUE;
+		} else {
+			prev_ascii = FALSE;
+		}
+		err = uni_utf8_avx2_check(in, prev_in);
+		if (!_mm256_testz_si256(err, err))
+			return uni_utf8_simd_char_start(data, pos);
+		prev_in = in;
+	}
+	pos = uni_utf8_simd_char_start(data, pos);
+	/* the tail may still contain a full 16 byte block */
+	return pos + uni_utf8_ssse3_valid_prefix(data + pos, size - pos);
+}
+
+#endif
+
+static void uni_utf8_simd_init(void)
+{
+	uni_utf8_simd_initialized = TRUE;
+#ifdef UNI_UTF8_SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		(void)uni_utf8_simd_set_impl(UNI_UTF8_SIMD_IMPL_AVX2);
+	else if (__builtin_cpu_supports("ssse3"))
+		(void)uni_utf8_simd_set_impl(UNI_UTF8_SIMD_IMPL_SSSE3);
+#endif
+}
+
+bool uni_utf8_simd_set_impl(enum uni_utf8_simd_impl impl)
+{
+	uni_utf8_simd_initialized = TRUE;
+	switch (impl) {
+	case UNI_UTF8_SIMD_IMPL_NONE:
+		uni_utf8_simd_func = NULL;
+		return TRUE;
+	case UNI_UTF8_SIMD_IMPL_SSSE3:
+#ifdef UNI_UTF8_SIMD_X86
+		if (!__builtin_cpu_supports("ssse3"))
+			return FALSE;
+		uni_utf8_simd_func = uni_utf8_ssse3_valid_prefix;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	case UNI_UTF8_SIMD_IMPL_AVX2:
+#ifdef UNI_UTF8_SIMD_X86
+		if (!__builtin_cpu_supports("avx2"))
+			return FALSE;
+		uni_utf8_simd_func = uni_utf8_avx2_valid_prefix;
+		return TRUE;
+#else
+		return FALSE;
+#endif
+	}
+	i_unreached();
+}
+
+size_t uni_utf8_simd_valid_prefix(const unsigned char *data, size_t size)
+{
+	if (unlikely(!uni_utf8_simd_initialized))
+		uni_utf8_simd_init();
+	if (uni_utf8_simd_func == NULL)
+		return 0;
+	return uni_utf8_simd_func(data, size);
+}
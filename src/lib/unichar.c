@@ -4,12 +4,15 @@
 #include "array.h"
 #include "bsearch-insert-pos.h"
 #include "unichar.h"
+#include "unichar-private.h"
 
 #include "unicodemap.c"
 
 #define HANGUL_FIRST 0xac00
 #define HANGUL_LAST 0xd7a3
 
+#define UTF8_ASCII_WORD_MASK 0x8080808080808080ULL
+
 const unsigned char utf8_replacement_char[UTF8_REPLACEMENT_CHAR_LEN] =
 	{ 0xef, 0xbf, 0xbd }; /* 0xfffd */
 
@@ -20,6 +23,24 @@ static const uint8_t utf8_non1_bytes[256 - 192 - 2] = {
 
 const uint8_t *const uni_utf8_non1_bytes = utf8_non1_bytes;
 
+/* Returns the position of the first non-ASCII byte at or after pos, or size
+   if there is none. The data is checked a word at a time. */
+static inline size_t
+utf8_skip_ascii(const unsigned char *input, size_t pos, size_t size)
+{
+	uint64_t word;
+
+	while (size - pos >= sizeof(word)) {
+		memcpy(&word, input + pos, sizeof(word));
+		if ((word & UTF8_ASCII_WORD_MASK) != 0)
+			break;
+		pos += sizeof(word);
+	}
+	while (pos < size && input[pos] < 0x80)
+		pos++;
+	return pos;
+}
+
 unsigned int uni_strlen(const unichar_t *str)
 {
 	unsigned int len = 0;
@@ -210,6 +231,12 @@ unsigned int uni_utf8_partial_strlen_n(const void *_input, size_t size,
 	size_t i;
 
 	for (i = 0; i < size; ) {
+		if (input[i] < 0x80) {
+			count = utf8_skip_ascii(input, i, size) - i;
+			i += count;
+			len += count;
+			continue;
+		}
 		count = uni_utf8_char_bytes(input[i]);
 		if (i + count > size)
 			break;
@@ -369,10 +396,13 @@ static int uni_utf8_find_invalid_pos(const unsigned char *input, size_t size,
 {
 	size_t i, len;
 
+	i = size < UNI_UTF8_SIMD_MIN_INPUT ? 0 :
+		uni_utf8_simd_valid_prefix(input, size);
+
 	/* find the first invalid utf8 sequence */
-	for (i = 0; i < size;) {
+	while (i < size) {
 		if (input[i] < 0x80)
-			i++;
+			i = utf8_skip_ascii(input, i, size);
 		else {
 			len = is_valid_utf8_seq(input + i, size-i);
 			if (unlikely(len == 0)) {
@@ -399,7 +429,9 @@ bool uni_utf8_get_valid_data(const unsigned char *input, size_t size,
 	output_add_replacement_char(buf);
 	while (i < size) {
 		if (input[i] < 0x80) {
-			buffer_append_c(buf, input[i++]);
+			len = utf8_skip_ascii(input, i, size) - i;
+			buffer_append(buf, input + i, len);
+			i += len;
 			continue;
 		}
 
@@ -26,6 +26,21 @@ struct var_expand_modifier {
 	const char *(*func)(const char *, struct var_expand_context *);
 };
 
+struct var_expand_program_part {
+	/* Literal text when var is NULL */
+	const char *text;
+	size_t text_len;
+	/* The whole %variable, including the '%' */
+	const char *var;
+	/* Set for %k and %{key} variables without modifiers */
+	char key;
+	const char *long_key;
+};
+
+struct var_expand_program {
+	ARRAY(struct var_expand_program_part) parts;
+};
+
 static ARRAY(struct var_expand_extension_func_table) var_expand_extensions;
 
 static const char *
@@ -665,6 +680,158 @@ int var_expand(string_t *dest, const char *str,
 	return var_expand_with_funcs(dest, str, table, NULL, NULL, error_r);
 }
 
+static bool var_expand_is_modifier(char c)
+{
+	const struct var_expand_modifier *m;
+
+	for (m = modifiers; m->key != '\0'; m++) {
+		if (m->key == c)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* Returns pointer to the last character of the %variable, or NULL if the
+   string ends before the variable. This must match the parsing in
+   var_expand_with_funcs(). */
+static const char *var_expand_find_var_end(const char *str)
+{
+	unsigned int ctr = 1, modifier_count = 0;
+	bool escape = FALSE;
+	const char *end;
+
+	if (*str == '-')
+		str++;
+	if (*str == '0')
+		str++;
+	while (*str >= '0' && *str <= '9')
+		str++;
+	if (*str == '.') {
+		str++;
+		if (*str == '0')
+			str++;
+		if (*str == '-')
+			str++;
+		while (*str >= '0' && *str <= '9')
+			str++;
+	}
+	while (modifier_count < MAX_MODIFIER_COUNT &&
+	       var_expand_is_modifier(*str)) {
+		modifier_count++;
+		str++;
+	}
+	if (*str == '\0')
+		return NULL;
+	if (*str != '{' || strchr(str, '}') == NULL)
+		return str;
+
+	end = str;
+	while (*++end != '\0' && ctr > 0) {
+		if (!escape && *end == '\\') {
+			escape = TRUE;
+			continue;
+		}
+		if (escape) {
+			escape = FALSE;
+			continue;
+		}
+		if (*end == '{') ctr++;
+		if (*end == '}') ctr--;
+	}
+	/* without a matching '}' the rest of the string is the variable */
+	return end - 1;
+}
+
+struct var_expand_program *
+var_expand_program_create(pool_t pool, const char *str)
+{
+	struct var_expand_program *program;
+	struct var_expand_program_part *part;
+	const char *p, *end;
+	size_t len;
+
+	program = p_new(pool, struct var_expand_program, 1);
+	p_array_init(&program->parts, pool, 8);
+	str = p_strdup(pool, str);
+
+	while (*str != '\0') {
+		p = strchr(str, '%');
+		if (p != str) {
+			part = array_append_space(&program->parts);
+			part->text = str;
+			part->text_len = p == NULL ? strlen(str) :
+				(size_t)(p - str);
+			if (p == NULL)
+				break;
+		}
+		end = var_expand_find_var_end(p + 1);
+		if (end == NULL) {
+			/* var_expand_with_funcs() ignores the rest too */
+			break;
+		}
+		len = end - p + 1;
+		part = array_append_space(&program->parts);
+		part->var = p_strndup(pool, p, len);
+		if (len == 2)
+			part->key = p[1];
+		else if (p[1] == '{' && *end == '}' &&
+			 strcspn(p + 2, ":{}\\") == len - 3)
+			part->long_key = p_strndup(pool, p + 2, len - 3);
+		str = end + 1;
+	}
+	return program;
+}
+
+static const char *
+var_expand_program_lookup(const struct var_expand_program_part *part,
+			  const struct var_expand_table *table)
+{
+	const struct var_expand_table *t;
+
+	if (table == NULL)
+		return NULL;
+	for (t = table; !TABLE_LAST(t); t++) {
+		if (part->key != '\0' ? t->key == part->key :
+		    (t->long_key != NULL &&
+		     strcmp(t->long_key, part->long_key) == 0))
+			return t->value != NULL ? t->value : "";
+	}
+	return NULL;
+}
+
+int var_expand_program_execute(string_t *dest,
+			       const struct var_expand_program *program,
+			       const struct var_expand_table *table,
+			       const struct var_expand_func_table *func_table,
+			       void *func_context, const char **error_r)
+{
+	const struct var_expand_program_part *part;
+	const char *value, *error;
+	int ret, final_ret = 1;
+
+	*error_r = NULL;
+	array_foreach(&program->parts, part) {
+		if (part->var == NULL) {
+			str_append_data(dest, part->text, part->text_len);
+			continue;
+		}
+		if (part->key != '\0' || part->long_key != NULL) {
+			value = var_expand_program_lookup(part, table);
+			if (value != NULL) {
+				str_append(dest, value);
+				continue;
+			}
+		}
+		ret = var_expand_with_funcs(dest, part->var, table, func_table,
+					    func_context, &error);
+		if (ret < final_ret)
+			final_ret = ret;
+		if (error != NULL && *error_r == NULL)
+			*error_r = error;
+	}
+	return final_ret;
+}
+
 static bool
 var_get_key_range_full(const char *str, unsigned int *idx_r,
 		       unsigned int *size_r)
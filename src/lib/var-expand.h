@@ -30,6 +30,21 @@ int var_expand_with_funcs(string_t *dest, const char *str,
 			  const struct var_expand_func_table *func_table,
 			  void *func_context, const char **error_r) ATTR_NULL(3, 4, 5);
 
+/* Parse the template once, so it can be expanded multiple times with
+   var_expand_program_execute() without parsing it again. Variables without
+   modifiers are looked up directly from the table. Everything else is
+   expanded with var_expand_with_funcs(). */
+struct var_expand_program *
+var_expand_program_create(pool_t pool, const char *str);
+/* Same as var_expand_with_funcs() for the template the program was created
+   from. */
+int var_expand_program_execute(string_t *dest,
+			       const struct var_expand_program *program,
+			       const struct var_expand_table *table,
+			       const struct var_expand_func_table *func_table,
+			       void *func_context, const char **error_r)
+	ATTR_NULL(3, 4, 5);
+
 /* Returns the actual key character for given string, ie. skip any modifiers
    that are before it. The string should be the data after the '%' character.
    For %{long_variable}, '{' is returned. */
@@ -159,6 +159,9 @@ struct client *client_create(int fd_in, int fd_out,
 	client->real_local_port = conn->real_local_port;
 	client->real_remote_ip = conn->real_remote_ip;
 	client->real_remote_port = conn->real_remote_port;
+	client->delivery_worker = conn->type != NULL &&
+		strcmp(master_service_connection_get_type(conn),
+		       "delivery") == 0;
 	client->state_pool = pool_alloconly_create("client state", 4096);
 
 	client->event = event_create(NULL);
@@ -377,6 +380,10 @@ static bool client_connection_is_trusted(void *context)
 	struct ip_addr net_ip;
 	unsigned int bits;
 
+	if (client->delivery_worker) {
+		/* the socket is accessible only to lmtp processes */
+		return TRUE;
+	}
 	if (client->lmtp_set->login_trusted_networks == NULL)
 		return FALSE;
 
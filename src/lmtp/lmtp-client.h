@@ -40,6 +40,10 @@ struct client_state {
 
 	const char *added_headers_local;
 	const char *added_headers_proxy;
+
+	/* Local users in the order they were first seen in RCPT TO. Used
+	   for choosing the delivery worker. */
+	ARRAY_TYPE(const_string) delivery_users;
 };
 
 struct lmtp_client_vfuncs {
@@ -98,6 +102,9 @@ struct client {
 	bool destroyed:1;
 	bool end_client_tls_secured:1;
 	bool end_client_tls_secured_set:1;
+	/* Connection from another lmtp process to the delivery worker
+	   socket (see lmtp_local_delivery_workers) */
+	bool delivery_worker:1;
 };
 
 struct lmtp_module_register {
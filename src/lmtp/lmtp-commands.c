@@ -18,6 +18,10 @@
 #include "lmtp-local.h"
 #include "lmtp-commands.h"
 
+/* Mail data up to this size is kept in memory before it's written to a
+   temporary file. */
+#define LMTP_DATA_MAX_MEM_SIZE (1024*128)
+
 /*
  * MAIL command
  */
@@ -113,12 +117,49 @@ int cmd_rcpt(void *conn_ctx, struct smtp_server_cmd_ctx *cmd,
 	return client->v.cmd_rcpt(client, cmd, lrcpt);
 }
 
+static unsigned int
+cmd_rcpt_get_delivery_worker(struct client *client,
+			     struct lmtp_recipient *lrcpt)
+{
+	const char *username;
+	unsigned int i, count;
+
+	/* The first user is delivered by this process and the following
+	   users are distributed to the delivery workers. Recipients of the
+	   same user always go to the same place, so that the duplicates are
+	   still delivered only once. */
+	if (!array_is_created(&client->state.delivery_users)) {
+		p_array_init(&client->state.delivery_users,
+			     client->state_pool, 8);
+	}
+	count = array_count(&client->state.delivery_users);
+	for (i = 0; i < count; i++) {
+		username = array_idx_elem(&client->state.delivery_users, i);
+		if (strcmp(username, lrcpt->username) == 0)
+			break;
+	}
+	if (i == count) {
+		username = p_strdup(client->state_pool, lrcpt->username);
+		array_push_back(&client->state.delivery_users, &username);
+	}
+	if (i == 0)
+		return 0;
+	return (i - 1) % client->lmtp_set->lmtp_local_delivery_workers + 1;
+}
+
 int client_default_cmd_rcpt(struct client *client,
 			    struct smtp_server_cmd_ctx *cmd,
 			    struct lmtp_recipient *lrcpt)
 {
+	unsigned int worker;
 	int ret;
 
+	if (client->delivery_worker) {
+		/* the forwarding lmtp process already did the proxy
+		   lookups */
+		return lmtp_local_rcpt(client, cmd, lrcpt);
+	}
+
 	if (client->lmtp_set->lmtp_proxy) {
 		/* proxied? */
 		if ((ret = lmtp_proxy_rcpt(client, cmd, lrcpt)) != 0)
@@ -126,6 +167,14 @@ int client_default_cmd_rcpt(struct client *client,
 		/* no */
 	}
 
+	if (client->lmtp_set->lmtp_local_delivery_workers > 0 &&
+	    (worker = cmd_rcpt_get_delivery_worker(client, lrcpt)) > 0) {
+		/* local delivery in a worker process */
+		ret = lmtp_proxy_rcpt_delivery_worker(client, cmd, lrcpt,
+						      worker);
+		return (ret < 0 ? -1 : 0);
+	}
+
 	/* local delivery */
 	return lmtp_local_rcpt(client, cmd, lrcpt);
 }
@@ -148,9 +197,11 @@ cmd_data_create_added_headers(struct client *client,
 	if (client->local != NULL)
 		lmtp_local_add_headers(client->local, trans, str);
 
-	/* Headers for local and proxied messages */
+	/* Headers for local and proxied messages. The lmtp process that
+	   uses this delivery worker has already added them. */
 	proxy_offset = str_len(str);
-	if (client->lmtp_set->lmtp_add_received_header) {
+	if (client->lmtp_set->lmtp_add_received_header &&
+	    !client->delivery_worker) {
 		const struct lmtp_settings *lmtp_set = client->lmtp_set;
 		enum smtp_server_trace_rcpt_to_address rcpt_to_address =
 			SMTP_SERVER_TRACE_RCPT_TO_ADDRESS_FINAL;
@@ -251,18 +302,28 @@ int cmd_data_continue(void *conn_ctx, struct smtp_server_cmd_ctx *cmd,
 
 int cmd_data_begin(void *conn_ctx,
 		   struct smtp_server_cmd_ctx *cmd ATTR_UNUSED,
-		   struct smtp_server_transaction *trans ATTR_UNUSED,
+		   struct smtp_server_transaction *trans,
 		   struct istream *data_input)
 {
 	struct client *client = (struct client *)conn_ctx;
+	size_t max_mem_size = LMTP_DATA_MAX_MEM_SIZE;
 	string_t *path;
 
 	i_assert(client->state.mail_data_output == NULL);
 
+	/* If the client announced with MAIL FROM SIZE that the mail won't fit
+	   into memory, write it directly to the temporary file. This avoids
+	   first buffering the beginning of the mail in memory and then
+	   copying it to the file. Both local delivery and proxying read the
+	   mail from this same file afterwards. */
+	if (trans->params.size > LMTP_DATA_MAX_MEM_SIZE)
+		max_mem_size = 0;
+
 	path = t_str_new(256);
 	mail_user_set_get_temp_prefix(path, client->raw_mail_user->set);
 	client->state.mail_data_output =
-		iostream_temp_create_named(str_c(path), 0, "(lmtp data)");
+		iostream_temp_create_sized(str_c(path), 0, "(lmtp data)",
+					   max_mem_size);
 
 	client->state.data_input = data_input;
 	return 0;
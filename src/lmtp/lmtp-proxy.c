@@ -37,6 +37,9 @@ struct lmtp_proxy_rcpt_settings {
 	struct auth_proxy_settings set;
 	enum smtp_protocol protocol;
 	struct smtp_params_rcpt params;
+	/* 1.. for connections to the delivery worker socket (host is the
+	   socket path), 0 for other connections */
+	unsigned int delivery_worker;
 };
 
 struct lmtp_proxy_recipient {
@@ -61,6 +64,9 @@ struct lmtp_proxy_connection {
 	struct lmtp_proxy *proxy;
 	struct lmtp_proxy_rcpt_settings set;
 	char *host;
+	/* Key for matching idle connections, or NULL if the connection isn't
+	   reused */
+	char *idle_key;
 
 	struct smtp_client_connection *lmtp_conn;
 	struct smtp_client_transaction *lmtp_trans;
@@ -77,6 +83,7 @@ struct lmtp_proxy {
 	struct smtp_server_transaction *trans;
 
 	struct smtp_client *lmtp_client;
+	struct smtp_proxy_data proxy_data;
 
 	ARRAY(struct lmtp_proxy_connection *) connections;
 	ARRAY(struct lmtp_proxy_recipient *) rcpt_to;
@@ -91,10 +98,131 @@ struct lmtp_proxy {
 	bool finished:1;
 };
 
+struct lmtp_proxy_idle_connection {
+	char *key;
+	struct smtp_client_connection *lmtp_conn;
+	struct timeout *to_idle;
+};
+
+/* Backend connections are created on this client when they may be reused by
+   later transactions. It's not tied to any single LMTP client. */
+static struct smtp_client *lmtp_proxy_shared_client = NULL;
+/* Idle backend connections, oldest first */
+static ARRAY(struct lmtp_proxy_idle_connection *) lmtp_proxy_idle_conns;
+
 static void
 lmtp_proxy_data_cb(const struct smtp_reply *reply,
 		   struct lmtp_proxy_recipient *lprcpt);
 
+/*
+ * Idle connections
+ */
+
+static void
+lmtp_proxy_idle_connection_free(struct lmtp_proxy_idle_connection *iconn)
+{
+	timeout_remove(&iconn->to_idle);
+	if (iconn->lmtp_conn != NULL)
+		smtp_client_connection_close(&iconn->lmtp_conn);
+	i_free(iconn->key);
+	i_free(iconn);
+}
+
+static void
+lmtp_proxy_idle_connection_remove(struct lmtp_proxy_idle_connection *iconn)
+{
+	struct lmtp_proxy_idle_connection *const *iconns;
+	unsigned int i, count;
+
+	iconns = array_get(&lmtp_proxy_idle_conns, &count);
+	for (i = 0; i < count; i++) {
+		if (iconns[i] == iconn) {
+			array_delete(&lmtp_proxy_idle_conns, i, 1);
+			return;
+		}
+	}
+	i_unreached();
+}
+
+static void
+lmtp_proxy_idle_connection_timeout(struct lmtp_proxy_idle_connection *iconn)
+{
+	lmtp_proxy_idle_connection_remove(iconn);
+	lmtp_proxy_idle_connection_free(iconn);
+}
+
+static struct smtp_client_connection *
+lmtp_proxy_idle_connection_take(const char *key)
+{
+	struct lmtp_proxy_idle_connection *iconn;
+	struct smtp_client_connection *lmtp_conn;
+	unsigned int i;
+
+	if (!array_is_created(&lmtp_proxy_idle_conns))
+		return NULL;
+
+	/* prefer the most recently used connection */
+	for (i = array_count(&lmtp_proxy_idle_conns); i > 0; i--) {
+		iconn = array_idx_elem(&lmtp_proxy_idle_conns, i - 1);
+		if (strcmp(iconn->key, key) != 0)
+			continue;
+
+		array_delete(&lmtp_proxy_idle_conns, i - 1, 1);
+		lmtp_conn = iconn->lmtp_conn;
+		if (smtp_client_connection_get_state(lmtp_conn) ==
+		    SMTP_CLIENT_CONNECTION_STATE_READY) {
+			iconn->lmtp_conn = NULL;
+			lmtp_proxy_idle_connection_free(iconn);
+			return lmtp_conn;
+		}
+		/* disconnected by the backend while idling */
+		lmtp_proxy_idle_connection_free(iconn);
+	}
+	return NULL;
+}
+
+static void
+lmtp_proxy_idle_connection_add(const struct lmtp_settings *set,
+			       const char *key,
+			       struct smtp_client_connection **_lmtp_conn)
+{
+	struct lmtp_proxy_idle_connection *iconn;
+
+	if (!array_is_created(&lmtp_proxy_idle_conns))
+		i_array_init(&lmtp_proxy_idle_conns, 8);
+	while (array_count(&lmtp_proxy_idle_conns) > 0 &&
+	       array_count(&lmtp_proxy_idle_conns) >=
+	       set->lmtp_proxy_max_idle_connections) {
+		iconn = array_idx_elem(&lmtp_proxy_idle_conns, 0);
+		array_pop_front(&lmtp_proxy_idle_conns);
+		lmtp_proxy_idle_connection_free(iconn);
+	}
+
+	iconn = i_new(struct lmtp_proxy_idle_connection, 1);
+	iconn->key = i_strdup(key);
+	iconn->lmtp_conn = *_lmtp_conn;
+	*_lmtp_conn = NULL;
+	if (set->lmtp_proxy_max_idle_time > 0) {
+		iconn->to_idle = timeout_add(
+			set->lmtp_proxy_max_idle_time * 1000,
+			lmtp_proxy_idle_connection_timeout, iconn);
+	}
+	array_push_back(&lmtp_proxy_idle_conns, &iconn);
+}
+
+void lmtp_proxy_connections_deinit(void)
+{
+	struct lmtp_proxy_idle_connection *iconn;
+
+	if (array_is_created(&lmtp_proxy_idle_conns)) {
+		array_foreach_elem(&lmtp_proxy_idle_conns, iconn)
+			lmtp_proxy_idle_connection_free(iconn);
+		array_free(&lmtp_proxy_idle_conns);
+	}
+	if (lmtp_proxy_shared_client != NULL)
+		smtp_client_deinit(&lmtp_proxy_shared_client);
+}
+
 /*
  * LMTP proxy
  */
@@ -140,6 +268,7 @@ lmtp_proxy_init(struct client *client,
 	else
 		lmtp_set.proxy_data.ttl_plus_1--;
 	lmtp_set.event_parent = client->event;
+	proxy->proxy_data = lmtp_set.proxy_data;
 
 	if (lmtp_set.proxy_data.ttl_plus_1 <= 1)
 		proxy->initial_ttl = 1;
@@ -155,10 +284,18 @@ static void lmtp_proxy_connection_deinit(struct lmtp_proxy_connection *conn)
 {
 	if (conn->lmtp_trans != NULL)
 		smtp_client_transaction_destroy(&conn->lmtp_trans);
+	if (conn->lmtp_conn != NULL && conn->idle_key != NULL &&
+	    conn->finished &&
+	    smtp_client_connection_get_state(conn->lmtp_conn) ==
+	    SMTP_CLIENT_CONNECTION_STATE_READY) {
+		lmtp_proxy_idle_connection_add(conn->proxy->client->lmtp_set,
+					       conn->idle_key, &conn->lmtp_conn);
+	}
 	if (conn->lmtp_conn != NULL)
 		smtp_client_connection_close(&conn->lmtp_conn);
 	timeout_remove(&conn->to);
 	i_stream_unref(&conn->data_input);
+	i_free(conn->idle_key);
 	i_free(conn->host);
 	i_free(conn);
 }
@@ -230,6 +367,60 @@ lmtp_proxy_connection_has_rcpt_forward(struct lmtp_proxy_connection *conn)
 	return (cap_extra != NULL);
 }
 
+static const char *
+lmtp_proxy_connection_get_idle_key(struct lmtp_proxy_connection *conn)
+{
+	struct lmtp_proxy *proxy = conn->proxy;
+	const struct smtp_proxy_data *proxy_data = &proxy->proxy_data;
+
+	/* The XCLIENT data is sent only once per connection, so a connection
+	   can be reused only for the same client. The session ID isn't
+	   compared, since it's different for each transaction. */
+	return t_strdup_printf("%d\t%s\t%s\t%u\t%s\t%x\t%s\t%s\t%u",
+		conn->set.protocol, conn->set.set.host,
+		net_ip2addr(&conn->set.set.host_ip), conn->set.set.port,
+		net_ip2addr(&conn->set.set.source_ip),
+		conn->set.set.ssl_flags, net_ip2addr(&proxy->client->remote_ip),
+		proxy_data->client_transport, proxy_data->ttl_plus_1);
+}
+
+static struct smtp_client *
+lmtp_proxy_get_shared_client(struct lmtp_proxy *proxy)
+{
+	const char *extra_capabilities[] = {
+		LMTP_RCPT_FORWARD_CAPABILITY,
+		NULL };
+	struct smtp_client_settings lmtp_set;
+
+	if (lmtp_proxy_shared_client != NULL)
+		return lmtp_proxy_shared_client;
+
+	i_zero(&lmtp_set);
+	lmtp_set.my_hostname = proxy->client->my_domain;
+	lmtp_set.extra_capabilities = extra_capabilities;
+	lmtp_set.dns_client_socket_path = dns_client_socket_path;
+	lmtp_set.max_reply_size = LMTP_MAX_REPLY_SIZE;
+	lmtp_proxy_shared_client = smtp_client_init(&lmtp_set);
+	return lmtp_proxy_shared_client;
+}
+
+static void
+lmtp_proxy_connection_start(struct lmtp_proxy *proxy,
+			    struct lmtp_proxy_connection *conn)
+{
+	struct smtp_server_transaction *trans = proxy->trans;
+
+	conn->lmtp_trans = smtp_client_transaction_create(
+		conn->lmtp_conn, trans->mail_from, &trans->params, 0,
+		lmtp_proxy_connection_finish, conn);
+
+	smtp_client_transaction_start(conn->lmtp_trans,
+				      lmtp_proxy_mail_cb, conn);
+
+	if (proxy->max_timeout_msecs < conn->set.set.timeout_msecs)
+		proxy->max_timeout_msecs = conn->set.set.timeout_msecs;
+}
+
 static struct lmtp_proxy_connection *
 lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 			  const struct lmtp_proxy_rcpt_settings *set)
@@ -241,7 +432,7 @@ lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 		.rcpt_param_extensions = rcpt_param_extensions,
 	};
 	struct smtp_client_settings lmtp_set;
-	struct smtp_server_transaction *trans = proxy->trans;
+	struct smtp_client *lmtp_client;
 	struct client *client = proxy->client;
 	struct lmtp_proxy_connection *conn;
 	enum smtp_client_connection_ssl_mode ssl_mode;
@@ -250,7 +441,8 @@ lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 	i_assert(set->set.timeout_msecs > 0);
 
 	array_foreach_elem(&proxy->connections, conn) {
-		if (conn->set.protocol == set->protocol &&
+		if (conn->set.delivery_worker == set->delivery_worker &&
+		    conn->set.protocol == set->protocol &&
 		    conn->set.set.port == set->set.port &&
 		    strcmp(conn->set.set.host, set->set.host) == 0 &&
 		    (set->set.host_ip.family == 0 ||
@@ -270,8 +462,24 @@ lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 	conn->set.set.port = set->set.port;
 	conn->set.set.ssl_flags = set->set.ssl_flags;
 	conn->set.set.timeout_msecs = set->set.timeout_msecs;
+	conn->set.delivery_worker = set->delivery_worker;
 	array_push_back(&proxy->connections, &conn);
 
+	if (client->lmtp_set->lmtp_proxy_max_idle_connections > 0 &&
+	    conn->set.delivery_worker == 0) {
+		conn->idle_key = i_strdup(
+			lmtp_proxy_connection_get_idle_key(conn));
+		conn->lmtp_conn =
+			lmtp_proxy_idle_connection_take(conn->idle_key);
+		if (conn->lmtp_conn != NULL) {
+			e_debug(client->event,
+				"Reusing idle connection to %s:%u",
+				conn->set.set.host, conn->set.set.port);
+			lmtp_proxy_connection_start(proxy, conn);
+			return conn;
+		}
+	}
+
 	lmtp_proxy_connection_init_ssl(conn, &ssl_set, &ssl_mode);
 
 	i_zero(&lmtp_set);
@@ -282,14 +490,27 @@ lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 	lmtp_set.mail_send_broken_path = TRUE;
 	lmtp_set.verbose_user_errors = client->lmtp_set->lmtp_verbose_replies;
 
-	if (conn->set.set.host_ip.family != 0) {
+	lmtp_client = proxy->lmtp_client;
+	if (conn->idle_key != NULL) {
+		/* the connection may outlive this client */
+		lmtp_client = lmtp_proxy_get_shared_client(proxy);
+		lmtp_set.my_hostname = client->my_domain;
+		lmtp_set.rawlog_dir = client->lmtp_set->lmtp_proxy_rawlog_dir;
+		lmtp_set.proxy_data = proxy->proxy_data;
+	}
+
+	if (conn->set.delivery_worker != 0) {
+		conn->lmtp_conn = smtp_client_connection_create_unix(
+			lmtp_client, set->protocol, conn->set.set.host,
+			&lmtp_set);
+	} else if (conn->set.set.host_ip.family != 0) {
 		conn->lmtp_conn = smtp_client_connection_create_ip(
-			proxy->lmtp_client, set->protocol,
+			lmtp_client, set->protocol,
 			&conn->set.set.host_ip, conn->set.set.port,
 			conn->set.set.host, ssl_mode, &lmtp_set);
 	} else {
 		conn->lmtp_conn = smtp_client_connection_create(
-			proxy->lmtp_client, set->protocol,
+			lmtp_client, set->protocol,
 			conn->set.set.host, conn->set.set.port,
 			ssl_mode, &lmtp_set);
 	}
@@ -302,15 +523,7 @@ lmtp_proxy_get_connection(struct lmtp_proxy *proxy,
 						       &cap_rcpt_forward);
 	smtp_client_connection_connect(conn->lmtp_conn, NULL, NULL);
 
-	conn->lmtp_trans = smtp_client_transaction_create(
-		conn->lmtp_conn, trans->mail_from, &trans->params, 0,
-		lmtp_proxy_connection_finish, conn);
-
-	smtp_client_transaction_start(conn->lmtp_trans,
-				      lmtp_proxy_mail_cb, conn);
-
-	if (proxy->max_timeout_msecs < set->set.timeout_msecs)
-		proxy->max_timeout_msecs = set->set.timeout_msecs;
+	lmtp_proxy_connection_start(proxy, conn);
 	return conn;
 }
 
@@ -1032,6 +1245,52 @@ int lmtp_proxy_rcpt(struct client *client,
 	return 1;
 }
 
+int lmtp_proxy_rcpt_delivery_worker(struct client *client,
+				    struct smtp_server_cmd_ctx *cmd ATTR_UNUSED,
+				    struct lmtp_recipient *lrcpt,
+				    unsigned int worker)
+{
+	struct lmtp_proxy_rcpt_settings set;
+	struct lmtp_proxy_connection *conn;
+	struct smtp_server_recipient *rcpt = lrcpt->rcpt;
+	struct lmtp_proxy_recipient *lprcpt;
+
+	i_assert(worker > 0 &&
+		 worker <= client->lmtp_set->lmtp_local_delivery_workers);
+
+	lprcpt = p_new(rcpt->pool, struct lmtp_proxy_recipient, 1);
+	lprcpt->rcpt = lrcpt;
+
+	lrcpt->type = LMTP_RECIPIENT_TYPE_PROXY;
+	lrcpt->backend_context = lprcpt;
+
+	/* The delivery workers are other lmtp processes. Each worker
+	   connection is handled by a separate process, which delivers its
+	   recipients the same way as this process would. */
+	i_zero(&set);
+	set.set.host = t_strconcat(base_dir, "/"LMTP_DELIVERY_WORKER_SOCKET,
+				   NULL);
+	set.set.timeout_msecs = LMTP_PROXY_DEFAULT_TIMEOUT_MSECS;
+	set.protocol = SMTP_PROTOCOL_LMTP;
+	set.delivery_worker = worker;
+
+	if (lmtp_proxy_rcpt_get_connection(lprcpt, &set, &conn) < 0)
+		return -1;
+
+	lprcpt->address = smtp_address_clone(rcpt->pool, rcpt->path);
+
+	smtp_server_recipient_add_hook(
+		rcpt, SMTP_SERVER_RECIPIENT_HOOK_DESTROY,
+		lmtp_proxy_rcpt_destroy, lprcpt);
+	smtp_server_recipient_add_hook(
+		rcpt, SMTP_SERVER_RECIPIENT_HOOK_APPROVED,
+		lmtp_proxy_rcpt_approved, lprcpt);
+
+	smtp_client_connection_connect(conn->lmtp_conn,
+				       lmtp_proxy_rcpt_login_cb, lprcpt);
+	return 1;
+}
+
 /*
  * DATA command
  */
@@ -1059,9 +1318,11 @@ lmtp_proxy_data_cb(const struct smtp_reply *proxy_reply,
 		str_append(msg, "Sent message to");
 	else
 		str_append(msg, "Failed to send message to");
-	str_printfa(msg, " <%s> at %s:%u: %s (%u/%u at %u ms)",
-		    smtp_address_encode(address),
-		    conn->set.set.host, conn->set.set.port,
+	str_printfa(msg, " <%s> at %s", smtp_address_encode(address),
+		    conn->set.set.host);
+	if (conn->set.delivery_worker == 0)
+		str_printfa(msg, ":%u", conn->set.set.port);
+	str_printfa(msg, ": %s (%u/%u at %u ms)",
 		    smtp_reply_log(proxy_reply),
 		    rcpt_index + 1, array_count(&trans->rcpt_to),
 		    timeval_diff_msecs(&ioloop_timeval, &times->started));
@@ -10,6 +10,9 @@
 #define LMTP_PROXY_DEFAULT_TTL 5
 #define LMTP_PROXY_DEFAULT_PORT 24
 
+/* Socket in base_dir for connecting to the delivery workers */
+#define LMTP_DELIVERY_WORKER_SOCKET "lmtp-delivery"
+
 #define CLIENT_TRANSPORT_TLS "TLS"
 #define CLIENT_TRANSPORT_INSECURE "insecure"
 
@@ -20,9 +23,19 @@ struct client;
 
 void lmtp_proxy_deinit(struct lmtp_proxy **proxy);
 
+/* Close all idle backend connections kept for reuse. */
+void lmtp_proxy_connections_deinit(void);
+
 int lmtp_proxy_rcpt(struct client *client,
 		    struct smtp_server_cmd_ctx *cmd,
 		    struct lmtp_recipient *rcpt);
+/* Deliver the recipient locally in another lmtp process. The worker is
+   1..lmtp_local_delivery_workers and the recipients with the same worker
+   use the same process. */
+int lmtp_proxy_rcpt_delivery_worker(struct client *client,
+				    struct smtp_server_cmd_ctx *cmd,
+				    struct lmtp_recipient *lrcpt,
+				    unsigned int worker);
 
 void lmtp_proxy_data(struct client *client,
 		     struct smtp_server_cmd_ctx *cmd,
@@ -24,9 +24,17 @@ static struct file_listener_settings lmtp_unix_listeners_array[] = {
 		.user = "",
 		.group = "",
 	},
+	{
+		.path = "lmtp-delivery",
+		.type = "delivery",
+		.mode = 0600,
+		.user = "",
+		.group = "",
+	},
 };
 static struct file_listener_settings *lmtp_unix_listeners[] = {
-	&lmtp_unix_listeners_array[0]
+	&lmtp_unix_listeners_array[0],
+	&lmtp_unix_listeners_array[1]
 };
 static buffer_t lmtp_unix_listeners_buf = {
 	{ { lmtp_unix_listeners, sizeof(lmtp_unix_listeners) } }
@@ -70,6 +78,9 @@ static const struct setting_define lmtp_setting_defines[] = {
 	DEF(BOOL, lmtp_add_received_header),
 	DEF(BOOL, lmtp_verbose_replies),
 	DEF(UINT, lmtp_user_concurrency_limit),
+	DEF(UINT, lmtp_local_delivery_workers),
+	DEF(UINT, lmtp_proxy_max_idle_connections),
+	DEF(TIME, lmtp_proxy_max_idle_time),
 	DEF(ENUM, lmtp_hdr_delivery_address),
 	DEF(STR_VARS, lmtp_rawlog_dir),
 	DEF(STR_VARS, lmtp_proxy_rawlog_dir),
@@ -92,6 +103,9 @@ static const struct lmtp_settings lmtp_default_settings = {
 	.lmtp_add_received_header = TRUE,
 	.lmtp_verbose_replies = FALSE,
 	.lmtp_user_concurrency_limit = 0,
+	.lmtp_local_delivery_workers = 0,
+	.lmtp_proxy_max_idle_connections = 0,
+	.lmtp_proxy_max_idle_time = 10,
 	.lmtp_hdr_delivery_address = "final:none:original",
 	.lmtp_rawlog_dir = "",
 	.lmtp_proxy_rawlog_dir = "",
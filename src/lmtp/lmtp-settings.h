@@ -25,6 +25,9 @@ struct lmtp_settings {
 	bool lmtp_add_received_header;
 	bool lmtp_verbose_replies;
 	unsigned int lmtp_user_concurrency_limit;
+	unsigned int lmtp_local_delivery_workers;
+	unsigned int lmtp_proxy_max_idle_connections;
+	unsigned int lmtp_proxy_max_idle_time;
 	const char *lmtp_hdr_delivery_address;
 	const char *lmtp_rawlog_dir;
 	const char *lmtp_proxy_rawlog_dir;
@@ -12,6 +12,7 @@
 #include "mail-storage-service.h"
 #include "smtp-submit-settings.h"
 #include "lda-settings.h"
+#include "lmtp-proxy.h"
 
 #include <unistd.h>
 
@@ -106,6 +107,7 @@ static void main_init(void)
 static void main_deinit(void)
 {
 	clients_destroy();
+	lmtp_proxy_connections_deinit();
 	if (anvil != NULL)
 		anvil_client_deinit(&anvil);
 	i_free(dns_client_socket_path);
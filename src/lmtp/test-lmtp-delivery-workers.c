@@ -0,0 +1,333 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lmtp-common.h"
+#include "test-common.h"
+#include "str.h"
+#include "istream.h"
+#include "env-util.h"
+#include "path-util.h"
+#include "unlink-directory.h"
+#include "master-service.h"
+#include "mail-storage-service.h"
+#include "smtp-address.h"
+#include "smtp-submit-settings.h"
+#include "smtp-client.h"
+#include "smtp-client-connection.h"
+#include "smtp-client-transaction.h"
+#include "lda-settings.h"
+#include "mail-deliver.h"
+#include "lmtp-proxy.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#define TEMP_DIRNAME ".test-lmtp-delivery-workers"
+#define TEST_TIMEOUT_MSECS (10*1000)
+
+struct test_listener {
+	const char *name, *type;
+	int fd;
+	struct io *io;
+	unsigned int connection_count;
+};
+
+struct smtp_server *lmtp_server = NULL;
+char *dns_client_socket_path, *base_dir;
+struct mail_storage_service_ctx *storage_service;
+struct anvil_client *anvil = NULL;
+lmtp_client_created_func_t *hook_client_created = NULL;
+struct event_category event_category_lmtp = {
+	.name = "lmtp",
+};
+
+static char *tmpdir;
+static struct test_listener lmtp_listener = {
+	.name = "lmtp", .type = "", .fd = -1,
+};
+static struct test_listener worker_listener = {
+	.name = LMTP_DELIVERY_WORKER_SOCKET, .type = "delivery", .fd = -1,
+};
+static unsigned int rcpt_success_count, data_success_count;
+
+void lmtp_anvil_init(void)
+{
+	i_unreached();
+}
+
+static void test_listener_accept(struct test_listener *listener)
+{
+	struct master_service_connection conn;
+	int fd;
+
+	fd = net_accept(listener->fd, NULL, NULL);
+	if (fd == -1)
+		return;
+	if (fd < 0)
+		i_fatal("net_accept(%s) failed: %m", listener->name);
+
+	i_zero(&conn);
+	conn.fd = fd;
+	conn.name = listener->name;
+	conn.type = listener->type;
+	listener->connection_count++;
+	master_service_client_connection_created(master_service);
+	(void)client_create(fd, fd, &conn);
+}
+
+static void test_listener_init(struct test_listener *listener)
+{
+	const char *path = t_strdup_printf("%s/%s", tmpdir, listener->name);
+
+	listener->fd = net_listen_unix(path, 128);
+	if (listener->fd == -1)
+		i_fatal("net_listen_unix(%s) failed: %m", path);
+	listener->io = io_add(listener->fd, IO_READ,
+			      test_listener_accept, listener);
+}
+
+static void test_listener_deinit(struct test_listener *listener)
+{
+	io_remove(&listener->io);
+	i_close_fd(&listener->fd);
+}
+
+static void
+test_rcpt_cb(const struct smtp_reply *reply, void *context ATTR_UNUSED)
+{
+	if (smtp_reply_is_success(reply))
+		rcpt_success_count++;
+	else
+		i_error("RCPT failed: %s", smtp_reply_log(reply));
+}
+
+static void
+test_data_cb(const struct smtp_reply *reply, void *context ATTR_UNUSED)
+{
+	if (smtp_reply_is_success(reply))
+		data_success_count++;
+	else
+		i_error("DATA failed: %s", smtp_reply_log(reply));
+}
+
+static void
+test_data_trans_cb(const struct smtp_reply *reply ATTR_UNUSED,
+		   void *context ATTR_UNUSED)
+{
+}
+
+static void test_trans_finished(void *context ATTR_UNUSED)
+{
+	io_loop_stop(current_ioloop);
+}
+
+static void test_timeout(void *context ATTR_UNUSED)
+{
+	i_error("Timed out");
+	io_loop_stop(current_ioloop);
+}
+
+static unsigned int
+test_maildir_count_new(const char *username, const char **path_r)
+{
+	const char *dir_path = t_strdup_printf("%s/%s/new", tmpdir, username);
+	struct dirent *d;
+	unsigned int count = 0;
+	DIR *dir;
+
+	*path_r = NULL;
+	dir = opendir(dir_path);
+	if (dir == NULL) {
+		if (errno != ENOENT)
+			i_fatal("opendir(%s) failed: %m", dir_path);
+		return 0;
+	}
+	while ((d = readdir(dir)) != NULL) {
+		if (d->d_name[0] == '.')
+			continue;
+		*path_r = t_strdup_printf("%s/%s", dir_path, d->d_name);
+		count++;
+	}
+	(void)closedir(dir);
+	return count;
+}
+
+static unsigned int test_count_received_headers(const char *path)
+{
+	struct istream *input;
+	const char *line;
+	unsigned int count = 0;
+
+	input = i_stream_create_file(path, SIZE_MAX);
+	while ((line = i_stream_read_next_line(input)) != NULL &&
+	       *line != '\0') {
+		if (str_begins_icase_with(line, "Received:"))
+			count++;
+	}
+	test_assert(input->stream_errno == 0);
+	i_stream_unref(&input);
+	return count;
+}
+
+static void test_lmtp_delivery_workers(void)
+{
+	static const char *const rcpts[] = {
+		"user1", "user2", "user3", "user2"
+	};
+	static const char *message =
+		"Subject: test\r\n"
+		"\r\n"
+		"body\r\n";
+	struct smtp_client_settings smtp_set;
+	struct smtp_client *smtp_client;
+	struct smtp_client_connection *conn;
+	struct smtp_client_transaction *trans;
+	struct ioloop *ioloop;
+	struct timeout *to;
+	struct istream *input;
+	const char *path;
+	unsigned int i;
+
+	test_begin("lmtp delivery workers");
+	ioloop = io_loop_create();
+	test_listener_init(&lmtp_listener);
+	test_listener_init(&worker_listener);
+
+	i_zero(&smtp_set);
+	smtp_set.my_hostname = "localhost";
+	smtp_client = smtp_client_init(&smtp_set);
+	conn = smtp_client_connection_create_unix(smtp_client,
+		SMTP_PROTOCOL_LMTP,
+		t_strdup_printf("%s/%s", tmpdir, lmtp_listener.name), NULL);
+	smtp_client_connection_connect(conn, NULL, NULL);
+
+	trans = smtp_client_transaction_create(conn,
+		smtp_address_create_temp("sender", "example.com"), NULL, 0,
+		test_trans_finished, NULL);
+	for (i = 0; i < N_ELEMENTS(rcpts); i++) {
+		smtp_client_transaction_add_rcpt(trans,
+			smtp_address_create_temp(rcpts[i], NULL), NULL,
+			test_rcpt_cb, test_data_cb, NULL);
+	}
+	input = i_stream_create_from_data(message, strlen(message));
+	smtp_client_transaction_send(trans, input, test_data_trans_cb, NULL);
+	i_stream_unref(&input);
+
+	to = timeout_add(TEST_TIMEOUT_MSECS, test_timeout, NULL);
+	io_loop_run(ioloop);
+	timeout_remove(&to);
+
+	test_assert(rcpt_success_count == N_ELEMENTS(rcpts));
+	test_assert(data_success_count == N_ELEMENTS(rcpts));
+
+	/* user1 was delivered by the lmtp process itself. user2 and user3
+	   were delivered by two different delivery workers. The duplicate
+	   user2 recipient went to the same worker as the first one. */
+	test_assert(lmtp_listener.connection_count == 1);
+	test_assert(worker_listener.connection_count == 2);
+	for (i = 0; i < 3; i++) {
+		const char *username = rcpts[i];
+
+		test_assert_idx(test_maildir_count_new(username, &path) == 1, i);
+		if (path != NULL)
+			test_assert_idx(test_count_received_headers(path) == 1, i);
+	}
+
+	smtp_client_connection_close(&conn);
+	smtp_client_deinit(&smtp_client);
+	clients_destroy();
+	test_listener_deinit(&worker_listener);
+	test_listener_deinit(&lmtp_listener);
+	io_loop_destroy(&ioloop);
+	test_end();
+}
+
+static void test_cleanup(void)
+{
+	const char *error;
+
+	if (unlink_directory(tmpdir, UNLINK_DIRECTORY_FLAG_RMDIR, &error) < 0)
+		i_error("unlink_directory() failed: %s", error);
+}
+
+static void test_init(void)
+{
+	const char *cwd, *error;
+
+	test_assert(t_get_working_dir(&cwd, &error) == 0);
+	tmpdir = i_strconcat(cwd, "/"TEMP_DIRNAME, NULL);
+
+	test_cleanup();
+	if (mkdir(tmpdir, 0700) < 0)
+		i_fatal("mkdir() failed: %m");
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct setting_parser_info *set_roots[] = {
+		&smtp_submit_setting_parser_info,
+		&lda_setting_parser_info,
+		&lmtp_setting_parser_info,
+		NULL
+	};
+	const enum master_service_flags service_flags =
+		MASTER_SERVICE_FLAG_NO_CONFIG_SETTINGS |
+		MASTER_SERVICE_FLAG_STANDALONE |
+		MASTER_SERVICE_FLAG_DONT_SEND_STATS;
+	struct smtp_server_settings lmtp_set;
+	int ret;
+
+	master_service = master_service_init("test-lmtp-delivery-workers",
+					     service_flags, &argc, &argv, "D");
+	master_service_set_client_limit(master_service, 16);
+	master_service_set_service_count(master_service, UINT_MAX);
+	test_init();
+
+	(void)master_service_parse_option(master_service, 'o',
+		"lmtp_local_delivery_workers=2");
+	/* -o settings are already expanded, so %u would be used literally */
+	env_put("MAIL_LOCATION", t_strdup_printf("maildir:%s/%%u", tmpdir));
+	if (geteuid() == 0) {
+		/* lmtp refuses to deliver mails as root */
+		(void)master_service_parse_option(master_service, 'o',
+						  "mail_uid=65534");
+		(void)master_service_parse_option(master_service, 'o',
+						  "mail_gid=65534");
+		if (chmod(tmpdir, 0777) < 0)
+			i_fatal("chmod(%s) failed: %m", tmpdir);
+	}
+	master_service_init_finish(master_service);
+
+	base_dir = i_strdup(tmpdir);
+	dns_client_socket_path = i_strconcat(tmpdir, "/dns-client", NULL);
+	storage_service = mail_storage_service_init(master_service, set_roots,
+		MAIL_STORAGE_SERVICE_FLAG_ALLOW_ROOT |
+		MAIL_STORAGE_SERVICE_FLAG_NO_LOG_INIT |
+		MAIL_STORAGE_SERVICE_FLAG_NO_CHDIR |
+		MAIL_STORAGE_SERVICE_FLAG_TEMP_PRIV_DROP);
+
+	i_zero(&lmtp_set);
+	lmtp_set.protocol = SMTP_PROTOCOL_LMTP;
+	lmtp_set.auth_optional = TRUE;
+	lmtp_set.rcpt_domain_optional = TRUE;
+	lmtp_set.mail_path_allow_broken = TRUE;
+	lmtp_set.reason_code_module = "lmtp";
+	lmtp_server = smtp_server_init(&lmtp_set);
+	mail_deliver_hooks_init();
+
+	static void (*const test_functions[])(void) = {
+		test_lmtp_delivery_workers,
+		NULL
+	};
+	ret = test_run(test_functions);
+
+	lmtp_proxy_connections_deinit();
+	smtp_server_deinit(&lmtp_server);
+	mail_storage_service_deinit(&storage_service);
+	i_free(dns_client_socket_path);
+	i_free(base_dir);
+	test_cleanup();
+	i_free(tmpdir);
+	master_service_deinit(&master_service);
+	return ret;
+}
@@ -17,6 +17,9 @@
 #include <unistd.h>
 
 #define MAX_MSECS_PER_CONNECTION 100
+/* Read this much at once from the log pipe. Each write to it is at most
+   PIPE_BUF bytes, so a single read() can drain many of them. */
+#define LOG_INPUT_MAX_BUFFER_SIZE (PIPE_BUF*16)
 
 /* Log a warning after 1 secs when we've been all the time busy writing the
    log connection. */
@@ -440,6 +443,10 @@ static void log_connection_input(struct log_connection *log)
 		}
 	}
 
+	/* write the lines buffered by the failure handlers */
+	if (i_failure_flush() < 0)
+		i_fatal_status(FATAL_LOGWRITE, "write() failed to log: %m");
+
 	if (log->input->eof) {
 		if (log->input->stream_errno != 0)
 			e_error(log->event,
@@ -484,7 +491,7 @@ void log_connection_create(struct log_error_buffer *errorbuf,
 	log->fd = fd;
 	log->listen_fd = listen_fd;
 	log->io = io_add(fd, IO_READ, log_connection_input, log);
-	log->input = i_stream_create_fd(fd, PIPE_BUF);
+	log->input = i_stream_create_fd(fd, LOG_INPUT_MAX_BUFFER_SIZE);
 	log->default_prefix = i_strdup_printf("listen_fd(%d): ", listen_fd);
 	hash_table_create_direct(&log->clients, default_pool, 0);
 	array_idx_set(&logs_by_fd, listen_fd, &log);
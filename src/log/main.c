@@ -13,6 +13,10 @@
 
 #include <unistd.h>
 
+/* Log lines are collected into writes of up to this size. The buffer is
+   flushed after each batch of lines read from a log connection. */
+#define LOG_WRITE_BUFFER_SIZE (64*1024)
+
 bool verbose_proctitle;
 char *global_log_prefix;
 static struct log_error_buffer *errorbuf;
@@ -36,6 +40,7 @@ static void main_init(void)
 static void main_deinit(void)
 {
 	log_connections_deinit();
+	(void)i_failure_flush();
 	log_error_buffer_deinit(&errorbuf);
 	i_free(global_log_prefix);
 }
@@ -83,6 +88,7 @@ int main(int argc, char *argv[])
 						NULL, &error) < 0)
 		i_fatal("Error reading configuration: %s", error);
 	master_service_init_log_with_prefix(master_service, global_log_prefix);
+	i_set_failure_write_buffer(LOG_WRITE_BUFFER_SIZE);
 
 	verbose_proctitle = master_service_settings_get(master_service)->verbose_proctitle;
 
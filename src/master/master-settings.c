@@ -115,6 +115,7 @@ static const struct setting_define service_setting_defines[] = {
 	DEF(BOOL, drop_priv_before_exec),
 
 	DEF(UINT, process_min_avail),
+	DEF(BOOL, process_min_avail_adaptive),
 	DEF(UINT, process_limit),
 	DEF(UINT, client_limit),
 	DEF(UINT, service_count),
@@ -145,6 +146,7 @@ static const struct service_settings service_default_settings = {
 	.drop_priv_before_exec = FALSE,
 
 	.process_min_avail = 0,
+	.process_min_avail_adaptive = FALSE,
 	.process_limit = 0,
 	.client_limit = 0,
 	.service_count = 0,
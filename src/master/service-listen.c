@@ -198,8 +198,10 @@ service_inet_listener_listen(struct service_listener *l, const char **error_r)
 	if (fd == -1)
 #endif
 	{
-		if (set->reuse_port)
-			flags |= NET_LISTEN_FLAG_REUSEPORT;
+		if (set->reuse_port) {
+			flags |= NET_LISTEN_FLAG_REUSEPORT |
+				NET_LISTEN_FLAG_NO_LISTEN;
+		}
 		fd = net_listen_full(&l->set.inetset.ip, &port, &flags,
 				     service_get_backlog(service));
 		if (fd < 0) {
@@ -208,6 +210,15 @@ service_inet_listener_listen(struct service_listener *l, const char **error_r)
 			return errno == EADDRINUSE ? 0 : -1;
 		}
 		l->reuse_port = (flags & NET_LISTEN_FLAG_REUSEPORT) != 0;
+		l->reuse_port_listening = FALSE;
+		if (!l->reuse_port && (flags & NET_LISTEN_FLAG_NO_LISTEN) != 0 &&
+		    listen(fd, service_get_backlog(service)) < 0) {
+			/* SO_REUSEPORT isn't supported - listen normally */
+			*error_r = t_strdup_printf("listen(%s, %u) failed: %m",
+						   l->inet_address, set->port);
+			i_close_fd(&fd);
+			return -1;
+		}
 	}
 	net_set_nonblock(fd, TRUE);
 	fd_close_on_exec(fd, TRUE);
@@ -240,6 +251,59 @@ int service_listener_listen(struct service_listener *l)
 	return ret;
 }
 
+int service_listener_reuse_port_listen(struct service_listener *l)
+{
+	if (!l->reuse_port || l->fd == -1 || l->reuse_port_listening)
+		return 0;
+
+	if (listen(l->fd, service_get_backlog(l->service)) < 0) {
+		e_error(l->service->event, "listen(%s, %u) failed: %m",
+			l->inet_address, l->set.inetset.set->port);
+		return -1;
+	}
+	l->reuse_port_listening = TRUE;
+	return 0;
+}
+
+void service_reuse_port_listeners_listen(struct service *service)
+{
+	struct service_listener *l;
+
+	array_foreach_elem(&service->listeners, l)
+		(void)service_listener_reuse_port_listen(l);
+}
+
+void service_reuse_port_listeners_reopen(struct service *service,
+					 bool taken_over)
+{
+	struct service_listener *l;
+	int old_fd;
+
+	/* Create new bound-only sockets for the master. They start listening
+	   only when the next process is created or the master itself starts
+	   listening. Otherwise the kernel would assign connections to them
+	   that nobody accepts. */
+	array_foreach_elem(&service->listeners, l) {
+		if (!l->reuse_port || l->fd == -1)
+			continue;
+		if (!taken_over && (l->io != NULL || !l->reuse_port_listening)) {
+			/* the master is accepting from it, or it's still
+			   only bound */
+			continue;
+		}
+
+		io_remove(&l->io);
+		old_fd = l->fd;
+		l->fd = -1;
+		if (service_listener_listen(l) <= 0) {
+			/* keep using the old socket */
+			l->fd = old_fd;
+		} else {
+			i_close_fd(&old_fd);
+		}
+	}
+}
+
 static int service_listen(struct service *service)
 {
 	struct service_listener *l;
@@ -485,6 +549,10 @@ int services_listen_using(struct service_list *new_service_list,
 			    listener_equals(new_listeners[i],
 					    old_listeners[j])) {
 				new_listeners[i]->fd = old_listeners[j]->fd;
+				new_listeners[i]->reuse_port =
+					old_listeners[j]->reuse_port;
+				new_listeners[i]->reuse_port_listening =
+					old_listeners[j]->reuse_port_listening;
                                 old_listeners[j]->fd = -1;
 				break;
 			}
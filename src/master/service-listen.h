@@ -14,6 +14,19 @@ int services_listen_using(struct service_list *new_service_list,
 			  struct service_list *old_service_list);
 
 int service_listener_listen(struct service_listener *l);
+/* Start listening on a reuse_port listener's fd, unless it's already done.
+   Returns 0 on success (or if reuse_port isn't used), -1 on error. */
+int service_listener_reuse_port_listen(struct service_listener *l);
+/* Start listening on all the service's reuse_port listeners. This is done
+   right before fork(), so the new process takes over the sockets. */
+void service_reuse_port_listeners_listen(struct service *service);
+/* Replace the listening reuse_port sockets with new bound-only sockets.
+   taken_over=TRUE is used after a new process took over the sockets.
+   taken_over=FALSE is used after fork() failed. Then only the sockets that
+   the master isn't accepting from are replaced, so that connections don't
+   get queued to sockets that nobody accepts. */
+void service_reuse_port_listeners_reopen(struct service *service,
+					 bool taken_over);
 
 int service_unix_listener_listen(struct service_listener *l, const char *path,
 				 bool verify_addrinuse, const char **error_r);
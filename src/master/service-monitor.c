@@ -10,6 +10,7 @@
 #include "sleep.h"
 #include "master-client.h"
 #include "service.h"
+#include "service-listen.h"
 #include "service-process.h"
 #include "service-process-notify.h"
 #include "service-anvil.h"
@@ -28,12 +29,22 @@
 #define SERVICE_MAX_EXIT_FAILURES_IN_SEC 10
 #define SERVICE_MIN_SUCCESSFUL_AGE_SECS 10
 #define SERVICE_PREFORK_MAX_AT_ONCE 10
+/* process_min_avail_adaptive: How often to update the connection rate, and
+   the weight of the latest interval in the moving average (1/N). */
+#define SERVICE_PREFORK_RATE_INTERVAL_MSECS 1000
+#define SERVICE_PREFORK_RATE_AVG_WEIGHT 4
+#define SERVICE_PREFORK_RATE_SCALE 16
 
 static void service_monitor_start_extra_avail(struct service *service);
 static void service_status_more(struct service_process *process,
 				const struct master_status *status);
 static void service_monitor_listen_start_force(struct service *service);
 
+static unsigned int service_process_min_avail(struct service *service)
+{
+	return I_MAX(service->set->process_min_avail, service->prefork_avail);
+}
+
 static void service_process_kill_idle(struct service_process *process)
 {
 	struct service *service = process->service;
@@ -41,7 +52,7 @@ static void service_process_kill_idle(struct service_process *process)
 
 	i_assert(process->available_count == service->client_limit);
 
-	if (service->process_avail <= service->set->process_min_avail) {
+	if (service->process_avail <= service_process_min_avail(service)) {
 		/* we don't have any extra idling processes anymore. */
 		timeout_remove(&process->to_idle);
 	} else if (process->last_kill_sent > process->last_status_update+1) {
@@ -65,9 +76,11 @@ static void service_status_more(struct service_process *process,
 				const struct master_status *status)
 {
 	struct service *service = process->service;
-
-	process->total_count +=
+	unsigned int new_clients =
 		process->available_count - status->available_count;
+
+	process->total_count += new_clients;
+	service->prefork_rate_conn_count += new_clients;
 	process->idle_start = 0;
 
 	timeout_remove(&process->to_idle);
@@ -96,7 +109,7 @@ static void service_check_idle(struct service_process *process)
 	if (process->available_count != service->client_limit)
 		return;
 	process->idle_start = ioloop_time;
-	if (service->process_avail > service->set->process_min_avail &&
+	if (service->process_avail > service_process_min_avail(service) &&
 	    process->to_idle == NULL &&
 	    service->idle_kill != UINT_MAX) {
 		/* we have more processes than we really need.
@@ -337,9 +350,9 @@ service_monitor_start_count(struct service *service, unsigned int limit)
 {
 	unsigned int i, count;
 
-	i_assert(service->set->process_min_avail >= service->process_avail);
+	i_assert(service_process_min_avail(service) >= service->process_avail);
 
-	count = service->set->process_min_avail - service->process_avail;
+	count = service_process_min_avail(service) - service->process_avail;
 	if (service->process_count + count > service->process_limit)
 		count = service->process_limit - service->process_count;
 	if (count > limit)
@@ -367,9 +380,9 @@ static void service_monitor_prefork_timeout(struct service *service)
 		service->prefork_counter = service->list->fork_counter;
 		return;
 	}
-	if (service->process_avail < service->set->process_min_avail) {
+	if (service->process_avail < service_process_min_avail(service)) {
 		if (service_monitor_start_count(service, SERVICE_PREFORK_MAX_AT_ONCE) &&
-		    service->process_avail < service->set->process_min_avail) {
+		    service->process_avail < service_process_min_avail(service)) {
 			/* All SERVICE_PREFORK_MAX_AT_ONCE were created, but
 			   it still wasn't enough. Launch more in the next
 			   timeout. */
@@ -381,7 +394,7 @@ static void service_monitor_prefork_timeout(struct service *service)
 
 static void service_monitor_start_extra_avail(struct service *service)
 {
-	if (service->process_avail >= service->set->process_min_avail ||
+	if (service->process_avail >= service_process_min_avail(service) ||
 	    service->process_count >= service->process_limit ||
 	    service->list->destroying)
 		return;
@@ -390,7 +403,7 @@ static void service_monitor_start_extra_avail(struct service *service)
 		/* quickly start one process now */
 		if (!service_monitor_start_count(service, 1))
 			return;
-		if (service->process_avail >= service->set->process_min_avail)
+		if (service->process_avail >= service_process_min_avail(service))
 			return;
 	}
 	if (service->to_prefork == NULL) {
@@ -402,6 +415,48 @@ static void service_monitor_start_extra_avail(struct service *service)
 	}
 }
 
+static void service_monitor_prefork_rate_update(struct service *service)
+{
+	unsigned int rate, avail;
+
+	/* exponentially weighted moving average of new connections per
+	   interval */
+	service->prefork_rate_avg =
+		(service->prefork_rate_avg * (SERVICE_PREFORK_RATE_AVG_WEIGHT - 1) +
+		 service->prefork_rate_conn_count * SERVICE_PREFORK_RATE_SCALE) /
+		SERVICE_PREFORK_RATE_AVG_WEIGHT;
+	service->prefork_rate_conn_count = 0;
+
+	/* keep enough processes available for the connections expected
+	   during the next interval */
+	rate = (service->prefork_rate_avg + SERVICE_PREFORK_RATE_SCALE - 1) /
+		SERVICE_PREFORK_RATE_SCALE;
+	avail = (rate + service->client_limit - 1) / service->client_limit;
+	if (avail > service->process_limit)
+		avail = service->process_limit;
+
+	if (avail != service->prefork_avail) {
+		e_debug(event_create_passthrough(service->event)->
+			set_name("service_prefork_avail_changed")->
+			add_int("connection_rate", rate)->
+			add_int("prev_process_min_avail", service->prefork_avail)->
+			add_int("process_min_avail", avail)->event(),
+			"Adaptive process_min_avail changed from %u to %u "
+			"(%u connections per %u ms)", service->prefork_avail,
+			avail, rate, SERVICE_PREFORK_RATE_INTERVAL_MSECS);
+		bool decreased = avail < service->prefork_avail;
+		service->prefork_avail = avail;
+		if (decreased) {
+			/* let the extra idling processes die */
+			struct service_process *process;
+			for (process = service->processes; process != NULL;
+			     process = process->next)
+				service_check_idle(process);
+		}
+	}
+	service_monitor_start_extra_avail(service);
+}
+
 static void service_monitor_listen_start_force(struct service *service)
 {
 	struct service_listener *l;
@@ -412,7 +467,8 @@ static void service_monitor_listen_start_force(struct service *service)
 	timeout_remove(&service->to_drop_warning);
 
 	array_foreach_elem(&service->listeners, l) {
-		if (l->io == NULL && l->fd != -1)
+		if (l->io == NULL && l->fd != -1 &&
+		    service_listener_reuse_port_listen(l) == 0)
 			l->io = io_add(l->fd, IO_READ, service_accept, l);
 	}
 }
@@ -520,6 +576,13 @@ void services_monitor_start(struct service_list *service_list)
 				io_add(service->status_fd[0], IO_READ,
 				       service_status_input, service);
 		}
+		if (service->set->process_min_avail_adaptive &&
+		    service->to_prefork_rate == NULL) {
+			service->to_prefork_rate =
+				timeout_add(SERVICE_PREFORK_RATE_INTERVAL_MSECS,
+					    service_monitor_prefork_rate_update,
+					    service);
+		}
 		service_monitor_listen_start(service);
 		array_push_back(&listener_services, &service);
 	}
@@ -580,6 +643,7 @@ void service_monitor_stop(struct service *service)
 
 	timeout_remove(&service->to_throttle);
 	timeout_remove(&service->to_prefork);
+	timeout_remove(&service->to_prefork_rate);
 }
 
 void service_monitor_stop_close(struct service *service)
@@ -34,24 +34,6 @@
 #include <signal.h>
 #include <sys/wait.h>
 
-static void service_reopen_inet_listeners(struct service *service)
-{
-	struct service_listener *const *listeners;
-	unsigned int i, count;
-	int old_fd;
-
-	listeners = array_get(&service->listeners, &count);
-	for (i = 0; i < count; i++) {
-		if (!listeners[i]->reuse_port || listeners[i]->fd == -1)
-			continue;
-
-		old_fd = listeners[i]->fd;
-		listeners[i]->fd = -1;
-		if (service_listener_listen(listeners[i]) < 0)
-			listeners[i]->fd = old_fd;
-	}
-}
-
 static int
 service_unix_pid_listener_get_path(struct service_listener *l, pid_t pid,
 				   string_t *path, const char **error_r)
@@ -390,6 +372,7 @@ struct service_process *service_process_create(struct service *service)
 		uid = service_anvil_global->uid;
 		process_forked = FALSE;
 	} else {
+		service_reuse_port_listeners_listen(service);
 		pid = fork();
 		process_forked = TRUE;
 		service->list->fork_counter++;
@@ -407,17 +390,19 @@ struct service_process *service_process_create(struct service *service)
 		}
 		errno = fork_errno;
 		e_error(service->event, "fork() failed: %m%s", limit_str);
+		service_reuse_port_listeners_reopen(service, FALSE);
 		return NULL;
 	}
 	if (pid == 0) {
 		/* child */
 		service_process_setup_environment(service, uid, hostdomain);
-		service_reopen_inet_listeners(service);
 		service_dup_fds(service);
 		drop_privileges(service);
 		process_exec(service->executable);
 	}
 	i_assert(hash_table_lookup(service_pids, POINTER_CAST(pid)) == NULL);
+	if (process_forked)
+		service_reuse_port_listeners_reopen(service, TRUE);
 
 	process = i_new(struct service_process, 1);
 	process->service = service;
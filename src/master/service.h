@@ -40,6 +40,9 @@ struct service_listener {
 	} set;
 
 	bool reuse_port;
+	/* reuse_port: listen() has been called for fd. Until then the fd is
+	   only bound, so the kernel doesn't assign connections to it. */
+	bool reuse_port_listening;
 };
 
 struct service {
@@ -114,6 +117,14 @@ struct service {
 	/* prefork processes up to process_min_avail if there's time */
 	struct timeout *to_prefork;
 	unsigned int prefork_counter;
+	/* process_min_avail_adaptive: new connections seen during the current
+	   interval, their moving average (fixed point, see
+	   SERVICE_PREFORK_RATE_SCALE) and the resulting number of available
+	   processes to keep. */
+	struct timeout *to_prefork_rate;
+	unsigned int prefork_rate_conn_count;
+	unsigned int prefork_rate_avg;
+	unsigned int prefork_avail;
 
 	/* Last time a "dropping client connections" warning was logged */
 	time_t last_drop_warning;
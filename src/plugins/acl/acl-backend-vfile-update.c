@@ -234,6 +234,7 @@ int acl_backend_vfile_object_update(struct acl_object *_aclobj,
 	orig_mtime = validity->local_validity.last_mtime;
 
 	/* ACLs were really changed, write the new ones */
+	acl_backend_vfile_parsed_cache_invalidate(aclobj->local_path);
 	path = file_dotlock_get_lock_path(dotlock);
 	if (acl_backend_vfile_update_write(_aclobj, fd, path) < 0) {
 		file_dotlock_delete(&dotlock);
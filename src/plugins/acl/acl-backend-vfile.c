@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "array.h"
+#include "hash.h"
 #include "istream.h"
 #include "nfs-workarounds.h"
 #include "mailbox-list-private.h"
@@ -16,6 +17,23 @@
 
 #define ACL_ESTALE_RETRY_COUNT NFS_ESTALE_RETRY_COUNT
 #define ACL_VFILE_DEFAULT_CACHE_SECS 30
+/* Maximum number of parsed ACL files kept in the process-wide cache */
+#define ACL_VFILE_PARSED_CACHE_MAX_COUNT 10000
+
+/* Parsed ACL file, shared by all the users in the process. This avoids
+   re-reading the same ACL files when e.g. many users list the same shared
+   mailboxes within the same process. Files that don't exist are cached
+   also. */
+struct acl_vfile_parsed {
+	char *path;
+	pool_t pool;
+	ARRAY_TYPE(acl_rights) rights;
+	struct acl_vfile_validity validity;
+	ino_t ino;
+	time_t last_check;
+};
+
+static HASH_TABLE(char *, struct acl_vfile_parsed *) acl_vfile_parsed_cache;
 
 static struct acl_backend *acl_backend_vfile_alloc(void)
 {
@@ -82,6 +100,130 @@ acl_backend_vfile_init(struct acl_backend *_backend, const char *data)
 	return 0;
 }
 
+static void acl_vfile_parsed_free(struct acl_vfile_parsed *parsed)
+{
+	pool_unref(&parsed->pool);
+}
+
+static void acl_vfile_parsed_cache_clear(void)
+{
+	struct hash_iterate_context *iter;
+	struct acl_vfile_parsed *parsed;
+	char *path;
+
+	iter = hash_table_iterate_init(acl_vfile_parsed_cache);
+	while (hash_table_iterate(iter, acl_vfile_parsed_cache, &path, &parsed))
+		acl_vfile_parsed_free(parsed);
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(acl_vfile_parsed_cache, FALSE);
+}
+
+void acl_backend_vfile_parsed_cache_invalidate(const char *path)
+{
+	struct acl_vfile_parsed *parsed;
+
+	if (!hash_table_is_created(acl_vfile_parsed_cache))
+		return;
+	parsed = hash_table_lookup(acl_vfile_parsed_cache, path);
+	if (parsed != NULL) {
+		hash_table_remove(acl_vfile_parsed_cache, path);
+		acl_vfile_parsed_free(parsed);
+	}
+}
+
+void acl_backend_vfile_parsed_cache_deinit(void)
+{
+	if (!hash_table_is_created(acl_vfile_parsed_cache))
+		return;
+	acl_vfile_parsed_cache_clear();
+	hash_table_destroy(&acl_vfile_parsed_cache);
+}
+
+static void
+acl_vfile_parsed_cache_add(const char *path,
+			   const struct acl_rights *rights, unsigned int count,
+			   const struct acl_vfile_validity *validity,
+			   ino_t ino)
+{
+	struct acl_vfile_parsed *parsed;
+	struct acl_rights *dest;
+	pool_t pool;
+
+	if (!hash_table_is_created(acl_vfile_parsed_cache)) {
+		hash_table_create(&acl_vfile_parsed_cache, default_pool, 0,
+				  str_hash, strcmp);
+	}
+	acl_backend_vfile_parsed_cache_invalidate(path);
+	if (hash_table_count(acl_vfile_parsed_cache) >=
+	    ACL_VFILE_PARSED_CACHE_MAX_COUNT) {
+		/* Simply start from scratch. Most processes never get
+		   anywhere near the limit. */
+		acl_vfile_parsed_cache_clear();
+	}
+
+	pool = pool_alloconly_create("acl vfile parsed", 256);
+	parsed = p_new(pool, struct acl_vfile_parsed, 1);
+	parsed->pool = pool;
+	parsed->path = p_strdup(pool, path);
+	parsed->validity = *validity;
+	parsed->ino = ino;
+	parsed->last_check = ioloop_time;
+	p_array_init(&parsed->rights, pool, count);
+	for (unsigned int i = 0; i < count; i++) {
+		dest = array_append_space(&parsed->rights);
+		acl_rights_dup(&rights[i], pool, dest);
+	}
+	hash_table_insert(acl_vfile_parsed_cache, parsed->path, parsed);
+}
+
+static bool
+acl_vfile_validity_has_changed(struct acl_backend_vfile *backend,
+			       const struct acl_vfile_validity *validity,
+			       const struct stat *st);
+
+static int
+acl_vfile_parsed_cache_lookup(struct acl_object *aclobj, const char *path,
+			      struct acl_vfile_validity *validity)
+{
+	struct acl_backend_vfile *backend =
+		(struct acl_backend_vfile *)aclobj->backend;
+	struct acl_vfile_parsed *parsed;
+	const struct acl_rights *rights;
+	struct acl_rights *dest;
+	struct stat st;
+
+	if (!hash_table_is_created(acl_vfile_parsed_cache))
+		return 0;
+	parsed = hash_table_lookup(acl_vfile_parsed_cache, path);
+	if (parsed == NULL)
+		return 0;
+
+	if (parsed->last_check + (time_t)backend->cache_secs <= ioloop_time) {
+		/* make sure the file hasn't changed */
+		if (stat(path, &st) < 0) {
+			if ((errno != ENOENT && errno != ENOTDIR) ||
+			    parsed->validity.last_mtime !=
+			    ACL_VFILE_VALIDITY_MTIME_NOTFOUND)
+				return 0;
+		} else if (parsed->validity.last_mtime ==
+			   ACL_VFILE_VALIDITY_MTIME_NOTFOUND ||
+			   st.st_ino != parsed->ino ||
+			   acl_vfile_validity_has_changed(backend,
+							  &parsed->validity,
+							  &st)) {
+			return 0;
+		}
+		parsed->last_check = ioloop_time;
+	}
+
+	array_foreach(&parsed->rights, rights) {
+		dest = array_append_space(&aclobj->rights);
+		acl_rights_dup(rights, aclobj->rights_pool, dest);
+	}
+	*validity = parsed->validity;
+	return 1;
+}
+
 static void acl_backend_vfile_deinit(struct acl_backend *_backend)
 {
 	struct acl_backend_vfile *backend =
@@ -276,7 +418,7 @@ acl_backend_vfile_read(struct acl_object *aclobj, const char *path,
 	struct stat st;
 	struct acl_rights rights;
 	const char *line, *error;
-	unsigned int linenum;
+	unsigned int linenum, first_idx = array_count(&aclobj->rights);
 	int fd, ret = 0;
 
 	fd = nfs_safe_open(path, O_RDONLY);
@@ -296,6 +438,8 @@ acl_backend_vfile_read(struct acl_object *aclobj, const char *path,
 
 		validity->last_size = 0;
 		validity->last_read_time = ioloop_time;
+		if (validity->last_mtime == ACL_VFILE_VALIDITY_MTIME_NOTFOUND)
+			acl_vfile_parsed_cache_add(path, NULL, 0, validity, 0);
 		return 1;
 	}
 
@@ -356,6 +500,10 @@ acl_backend_vfile_read(struct acl_object *aclobj, const char *path,
 			validity->last_read_time = ioloop_time;
 			validity->last_mtime = st.st_mtime;
 			validity->last_size = st.st_size;
+			acl_vfile_parsed_cache_add(path,
+				array_idx(&aclobj->rights, first_idx),
+				array_count(&aclobj->rights) - first_idx,
+				validity, st.st_ino);
 		}
 	}
 
@@ -381,6 +529,12 @@ acl_backend_vfile_read_with_retry(struct acl_object *aclobj,
 	if (path == NULL)
 		return 0;
 
+	if (acl_vfile_parsed_cache_lookup(aclobj, path, validity) > 0) {
+		e_debug(aclobj->backend->event,
+			"acl vfile: using cached %s", path);
+		return 0;
+	}
+
 	for (i = 0;; i++) {
 		ret = acl_backend_vfile_read(aclobj, path, validity,
 					     i < ACL_ESTALE_RETRY_COUNT);
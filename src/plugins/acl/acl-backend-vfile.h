@@ -68,6 +68,10 @@ int acl_backend_vfile_nonowner_lookups_rebuild(struct acl_backend *backend);
 int acl_backend_vfile_object_get_mtime(struct acl_object *aclobj,
 				       time_t *mtime_r);
 
+/* Remove the ACL file from the process-wide cache of parsed ACL files. */
+void acl_backend_vfile_parsed_cache_invalidate(const char *path);
+void acl_backend_vfile_parsed_cache_deinit(void);
+
 static inline enum mailbox_list_path_type
 mail_storage_get_acl_list_path_type(struct mail_storage *storage)
 {
@@ -4,6 +4,7 @@
 #include "mailbox-list-private.h"
 #include "acl-api.h"
 #include "acl-plugin.h"
+#include "acl-backend-vfile.h"
 
 
 const char *acl_plugin_version = DOVECOT_ABI_VERSION;
@@ -24,4 +25,5 @@ void acl_plugin_init(struct module *module)
 void acl_plugin_deinit(void)
 {
 	mail_storage_hooks_remove(&acl_mail_storage_hooks);
+	acl_backend_vfile_parsed_cache_deinit();
 }
@@ -2,6 +2,7 @@
 
 #include "lib.h"
 #include "array.h"
+#include "hash.h"
 #include "ioloop.h"
 #include "str.h"
 #include "var-expand.h"
@@ -82,7 +83,10 @@ int acl_shared_namespaces_add(struct mail_namespace *ns)
 	struct acl_mailbox_list *alist = ACL_LIST_CONTEXT(ns->list);
 	struct mail_storage *storage = mail_namespace_get_default_storage(ns);
 	struct acl_lookup_dict_iter *iter;
+	HASH_TABLE(const char *, void *) seen_users;
 	const char *name;
+	pool_t pool;
+	int ret;
 
 	i_assert(auser != NULL && alist != NULL);
 	i_assert(ns->type == MAIL_NAMESPACE_TYPE_SHARED);
@@ -94,11 +98,23 @@ int acl_shared_namespaces_add(struct mail_namespace *ns)
 	}
 	alist->last_shared_add_check = ioloop_time;
 
+	/* The same user is returned for each identifier (anyone, user,
+	   groups) that the user has shared mailboxes to. Check each user's
+	   mailboxes only once. */
+	pool = pool_alloconly_create("acl shared users", 1024);
+	hash_table_create(&seen_users, pool, 0, str_hash, strcmp);
 	iter = acl_lookup_dict_iterate_visible_init(auser->acl_lookup_dict);
 	while ((name = acl_lookup_dict_iterate_visible_next(iter)) != NULL) {
+		if (hash_table_lookup(seen_users, name) != NULL)
+			continue;
+		name = p_strdup(pool, name);
+		hash_table_insert(seen_users, name, POINTER_CAST(1));
 		T_BEGIN {
 			acl_shared_namespace_add(ns, storage, name);
 		} T_END;
 	}
-	return acl_lookup_dict_iterate_visible_deinit(&iter);
+	ret = acl_lookup_dict_iterate_visible_deinit(&iter);
+	hash_table_destroy(&seen_users);
+	pool_unref(&pool);
+	return ret;
 }
@@ -11,8 +11,10 @@ extern "C" {
 #include "mail-search.h"
 #include "sleep.h"
 #include "str.h"
+#include "strescape.h"
 #include "unichar.h"
 #include "time-util.h"
+#include "fts-indexer.h"
 #include "fts-backend-flatcurve.h"
 #include "fts-backend-flatcurve-xapian.h"
 #include <dirent.h>
@@ -30,6 +32,7 @@ extern "C" {
 #include <algorithm>
 #include <sstream>
 #include <string>
+#include <vector>
 
 /* How Xapian DBs work in fts-flatcurve: all data lives in under one
  * per-mailbox directory (FTS_FLATCURVE_LABEL) stored at the root of the
@@ -66,6 +69,18 @@ extern "C" {
 /* These are temporary data types that may appear in the fts directory. They
  * are not intended to perservere between sessions. */
 #define FLATCURVE_XAPIAN_DB_OPTIMIZE "optimize"
+#define FLATCURVE_XAPIAN_DB_MERGE "merge"
+
+/* Tiered merging: index shards are grouped into tiers by their message count.
+ * The first tier has the shards smaller than rotate_count messages, and each
+ * following tier is FLATCURVE_XAPIAN_MERGE_FACTOR times larger. Once a tier
+ * has FLATCURVE_XAPIAN_MERGE_FACTOR shards, they are merged into a single
+ * shard of a higher tier. This keeps the number of shards logarithmic to the
+ * mailbox size, while each message is rewritten only a few times. Merging is
+ * done in the background by indexer-worker. */
+#define FLATCURVE_XAPIAN_MERGE_FACTOR 4
+/* The first tier's size if rotate_count is 0 */
+#define FLATCURVE_XAPIAN_MERGE_TIER_MIN_SIZE 1000
 
 /* Xapian "recommendations" are that you begin your local prefix identifier
  * with "X" for data that doesn't match with a data type listed as a Xapian
@@ -125,6 +140,39 @@ struct flatcurve_xapian_db {
 };
 HASH_TABLE_DEFINE_TYPE(xapian_db, char *, struct flatcurve_xapian_db *);
 
+/* Maximum number of mailboxes whose read DBs are kept open after switching
+ * to another mailbox. The number of shards (and so fds) is limited by
+ * fts_flatcurve_read_pool_max_shards. */
+#define FLATCURVE_XAPIAN_READ_POOL_MAX_MAILBOXES 8
+
+/* Read-only DB state of a recently used mailbox. */
+struct flatcurve_xapian_read_pool_mbox {
+	char *db_path;
+	pool_t pool;
+	HASH_TABLE_TYPE(xapian_db) dbs;
+	struct flatcurve_xapian_db *dbw_current;
+	Xapian::Database *db_read;
+	unsigned int shards;
+};
+ARRAY_DEFINE_TYPE(xapian_read_pool_mbox, struct flatcurve_xapian_read_pool_mbox);
+
+/* The DB state that a cached query result was looked up from. Any
+ * indexing, expunging or shard changes modify at least one of these. */
+struct flatcurve_xapian_db_state {
+	Xapian::doccount doccount;
+	Xapian::docid lastdocid;
+	Xapian::doclength avlength;
+	unsigned int shards;
+};
+
+struct flatcurve_xapian_query_cache_entry {
+	struct flatcurve_xapian_db_state state;
+	struct fts_score_map *scores;
+	unsigned int count;
+};
+HASH_TABLE_DEFINE_TYPE(xapian_query_cache, char *,
+		       struct flatcurve_xapian_query_cache_entry *);
+
 struct flatcurve_xapian {
 	/* Current database objects. */
 	struct flatcurve_xapian_db *dbw_current;
@@ -150,9 +198,25 @@ struct flatcurve_xapian {
 	/* List of mailboxes to optimize at shutdown. */
 	HASH_TABLE(char *, char *) optimize;
 
+	/* Read DBs of recently used mailboxes, least recently used first. */
+	ARRAY_TYPE(xapian_read_pool_mbox) read_pool;
+	unsigned int read_pool_shards;
+
+	/* Query results keyed by "db_path\tflags\tquery". Cleared when
+	 * fts_flatcurve_query_cache_max_uids would be exceeded. */
+	pool_t query_cache_pool;
+	HASH_TABLE_TYPE(xapian_query_cache) query_cache;
+	unsigned int query_cache_uids;
+
 	bool deinit:1;
 };
 
+struct flatcurve_xapian_merge_shard {
+	struct flatcurve_xapian_db *xdb;
+	Xapian::doccount messages;
+	unsigned int tier;
+};
+
 struct flatcurve_fts_query_xapian {
 	Xapian::Query *query;
 };
@@ -221,6 +285,145 @@ void fts_flatcurve_xapian_init(struct flatcurve_fts_backend *backend)
 		pool_alloconly_create(FTS_FLATCURVE_LABEL " xapian", 2048);
 	hash_table_create(&backend->xapian->dbs, backend->xapian->pool,
 			  4, str_hash, strcmp);
+	i_array_init(&backend->xapian->read_pool, 4);
+}
+
+static void
+fts_flatcurve_xapian_read_pool_free(struct flatcurve_xapian *x,
+				    unsigned int idx)
+{
+	struct flatcurve_xapian_read_pool_mbox *mbox =
+		array_idx_modifiable(&x->read_pool, idx);
+	struct hash_iterate_context *iter;
+	void *key, *val;
+
+	iter = hash_table_iterate_init(mbox->dbs);
+	while (hash_table_iterate(iter, mbox->dbs, &key, &val)) {
+		struct flatcurve_xapian_db *xdb =
+			(struct flatcurve_xapian_db *)val;
+		if (xdb->db != NULL)
+			delete(xdb->db);
+	}
+	hash_table_iterate_deinit(&iter);
+	hash_table_destroy(&mbox->dbs);
+
+	mbox->db_read->close();
+	delete(mbox->db_read);
+	pool_unref(&mbox->pool);
+
+	i_assert(x->read_pool_shards >= mbox->shards);
+	x->read_pool_shards -= mbox->shards;
+	i_free(mbox->db_path);
+	array_delete(&x->read_pool, idx, 1);
+}
+
+/* Returns: TRUE if the current mailbox's read DBs were moved to the read
+ * pool. */
+static bool
+fts_flatcurve_xapian_read_pool_put(struct flatcurve_fts_backend *backend)
+{
+	struct flatcurve_xapian *x = backend->xapian;
+	struct flatcurve_xapian_read_pool_mbox *mbox;
+	struct hash_iterate_context *iter;
+	void *key, *val;
+	unsigned int max_shards;
+
+	if (backend->fuser == NULL || x->deinit)
+		return FALSE;
+	max_shards = backend->fuser->set.read_pool_max_shards;
+	if (x->db_read == NULL || x->doc != NULL || x->lock != NULL ||
+	    x->shards > max_shards || max_shards == 0)
+		return FALSE;
+
+	/* Only pure read-only state can be kept: anything written must go
+	 * through the normal commit on close. */
+	bool writable = FALSE;
+	iter = hash_table_iterate_init(x->dbs);
+	while (hash_table_iterate(iter, x->dbs, &key, &val)) {
+		if (((struct flatcurve_xapian_db *)val)->dbw != NULL) {
+			writable = TRUE;
+			break;
+		}
+	}
+	hash_table_iterate_deinit(&iter);
+	if (writable)
+		return FALSE;
+
+	mbox = array_append_space(&x->read_pool);
+	mbox->db_path = i_strdup(str_c(backend->db_path));
+	mbox->pool = x->pool;
+	mbox->dbs = x->dbs;
+	mbox->dbw_current = x->dbw_current;
+	mbox->db_read = x->db_read;
+	mbox->shards = x->shards;
+	x->read_pool_shards += x->shards;
+
+	while (array_count(&x->read_pool) >
+			FLATCURVE_XAPIAN_READ_POOL_MAX_MAILBOXES ||
+	       x->read_pool_shards > max_shards)
+		fts_flatcurve_xapian_read_pool_free(x, 0);
+
+	x->pool = pool_alloconly_create(FTS_FLATCURVE_LABEL " xapian", 2048);
+	hash_table_create(&x->dbs, x->pool, 4, str_hash, strcmp);
+	x->lock_path = NULL;
+	x->dbw_current = NULL;
+	x->db_read = NULL;
+	x->shards = 0;
+	return TRUE;
+}
+
+static void
+fts_flatcurve_xapian_read_pool_get(struct flatcurve_fts_backend *backend)
+{
+	struct flatcurve_xapian *x = backend->xapian;
+	struct flatcurve_xapian_read_pool_mbox *mbox;
+	unsigned int i, count;
+
+	mbox = array_get_modifiable(&x->read_pool, &count);
+	for (i = 0; i < count; i++) {
+		if (strcmp(mbox[i].db_path, str_c(backend->db_path)) == 0)
+			break;
+	}
+	if (i == count)
+		return;
+
+	i_assert(x->db_read == NULL && hash_table_count(x->dbs) == 0);
+	hash_table_destroy(&x->dbs);
+	pool_unref(&x->pool);
+
+	x->pool = mbox[i].pool;
+	x->dbs = mbox[i].dbs;
+	x->dbw_current = mbox[i].dbw_current;
+	x->db_read = mbox[i].db_read;
+	x->shards = mbox[i].shards;
+	x->read_pool_shards -= mbox[i].shards;
+	i_free(mbox[i].db_path);
+	array_delete(&x->read_pool, i, 1);
+}
+
+/* Returns: TRUE if the merge request was sent to indexer */
+static bool
+fts_flatcurve_xapian_queue_merge(struct flatcurve_fts_backend *backend)
+{
+	struct mail_user *user = backend->backend.ns->user;
+	const char *path;
+	int fd;
+
+	/* Indexer's OPTIMIZE requests have the lowest priority. */
+	string_t *cmd = t_str_new(128);
+	str_append(cmd, "OPTIMIZE\t0\t");
+	str_append_tabescaped(cmd, user->username);
+	str_append_c(cmd, '\t');
+	str_append_tabescaped(cmd, str_c(backend->boxname));
+	str_append_c(cmd, '\n');
+
+	fd = fts_indexer_cmd(user, str_c(cmd), backend->event, &path);
+	if (fd == -1)
+		return FALSE;
+	i_close_fd(&fd);
+
+	e_debug(backend->event, "Queued merging shards to indexer");
+	return TRUE;
 }
 
 void fts_flatcurve_xapian_deinit(struct flatcurve_fts_backend *backend)
@@ -229,17 +432,34 @@ void fts_flatcurve_xapian_deinit(struct flatcurve_fts_backend *backend)
 	const char *error;
 
 	x->deinit = TRUE;
+	/* Release the pooled DBs before merging, which may delete their
+	 * shards. */
+	while (array_count(&x->read_pool) > 0)
+		fts_flatcurve_xapian_read_pool_free(x, 0);
+	array_free(&x->read_pool);
+	if (hash_table_is_created(x->query_cache)) {
+		hash_table_destroy(&x->query_cache);
+		pool_unref(&x->query_cache_pool);
+		x->query_cache_uids = 0;
+	}
+
 	if (hash_table_is_created(x->optimize)) {
 		struct hash_iterate_context *iter =
 			hash_table_iterate_init(x->optimize);
 
 		void *key, *val;
 		while (hash_table_iterate(iter, x->optimize, &key, &val)) {
+			str_truncate(backend->boxname, 0);
+			str_truncate(backend->db_path, 0);
 			str_append(backend->boxname, (const char *)key);
 			str_append(backend->db_path, (const char *)val);
 
-			if (fts_flatcurve_xapian_optimize_box(
-				backend, &error) < 0)
+			/* Merging can take a while, so leave it to
+			   indexer-worker if possible. */
+			if (!backend->fuser->indexer_worker &&
+			    fts_flatcurve_xapian_queue_merge(backend))
+				continue;
+			if (fts_flatcurve_xapian_merge_box(backend, &error) < 0)
 				e_error(backend->event, "%s", error);
 		}
 
@@ -1121,6 +1341,7 @@ int fts_flatcurve_database_terms(bool headers, const char *path,
 
 void fts_flatcurve_xapian_set_mailbox(struct flatcurve_fts_backend *backend)
 {
+	fts_flatcurve_xapian_read_pool_get(backend);
 	event_set_append_log_prefix(backend->event, p_strdup_printf(
 		backend->xapian->pool, FTS_FLATCURVE_LABEL "(%s): ",
 		str_c(backend->boxname)));
@@ -1496,6 +1717,15 @@ int fts_flatcurve_xapian_close(struct flatcurve_fts_backend *backend,
 	return ret;
 }
 
+/* Returns: 0 on success, -1 on error */
+int fts_flatcurve_xapian_close_mailbox(struct flatcurve_fts_backend *backend,
+				       const char **error_r)
+{
+	if (fts_flatcurve_xapian_read_pool_put(backend))
+		return 0;
+	return fts_flatcurve_xapian_close(backend, error_r);
+}
+
 static uint32_t
 fts_flatcurve_xapian_get_last_uid_query(struct flatcurve_fts_backend *backend ATTR_UNUSED,
 					Xapian::Database *db)
@@ -1945,6 +2175,207 @@ int fts_flatcurve_xapian_optimize_box(struct flatcurve_fts_backend *backend,
 	return ret;
 }
 
+static unsigned int
+fts_flatcurve_xapian_merge_tier(struct flatcurve_fts_backend *backend,
+				Xapian::doccount messages)
+{
+	uint64_t size = backend->fuser->set.rotate_count > 0 ?
+		backend->fuser->set.rotate_count :
+		FLATCURVE_XAPIAN_MERGE_TIER_MIN_SIZE;
+	unsigned int tier = 0;
+
+	for (; messages >= size; size *= FLATCURVE_XAPIAN_MERGE_FACTOR)
+		++tier;
+	return tier;
+}
+
+static bool
+fts_flatcurve_xapian_merge_shard_cmp(const flatcurve_xapian_merge_shard &s1,
+				     const flatcurve_xapian_merge_shard &s2)
+{
+	if (s1.tier != s2.tier)
+		return s1.tier < s2.tier;
+	return s1.messages < s2.messages;
+}
+
+/* Returns: TRUE if merge was filled with the shards to merge */
+static bool
+fts_flatcurve_xapian_merge_select(struct flatcurve_fts_backend *backend,
+				  std::vector<flatcurve_xapian_merge_shard> &merge)
+{
+	std::vector<flatcurve_xapian_merge_shard> shards;
+	struct flatcurve_xapian *x = backend->xapian;
+
+	/* The current shard is still being written to, so only the index
+	 * shards are merged. */
+	void *key, *val;
+	struct hash_iterate_context *iter = hash_table_iterate_init(x->dbs);
+	while (hash_table_iterate(iter, x->dbs, &key, &val)) {
+		struct flatcurve_xapian_db *xdb =
+			(struct flatcurve_xapian_db *)val;
+		if (xdb->type != FLATCURVE_XAPIAN_DB_TYPE_INDEX ||
+		    xdb->db == NULL)
+			continue;
+
+		struct flatcurve_xapian_merge_shard shard;
+		shard.xdb = xdb;
+		shard.messages = xdb->db->get_doccount();
+		shard.tier = fts_flatcurve_xapian_merge_tier(backend,
+							     shard.messages);
+		shards.push_back(shard);
+	}
+	hash_table_iterate_deinit(&iter);
+
+	std::sort(shards.begin(), shards.end(),
+		  fts_flatcurve_xapian_merge_shard_cmp);
+
+	/* Merge the lowest tier that is full. */
+	for (size_t i = 0, j; i < shards.size(); i = j) {
+		for (j = i; j < shards.size(); j++) {
+			if (shards[j].tier != shards[i].tier)
+				break;
+		}
+		if (j - i >= FLATCURVE_XAPIAN_MERGE_FACTOR) {
+			merge.assign(shards.begin() + i, shards.begin() + i +
+				     FLATCURVE_XAPIAN_MERGE_FACTOR);
+			return TRUE;
+		}
+	}
+
+	/* No tier is full, but there are still too many shards. Merge the
+	 * smallest ones. */
+	if (fts_flatcurve_xapian_need_optimize(backend) && shards.size() > 1) {
+		merge.assign(shards.begin(), shards.begin() +
+			     I_MIN(shards.size(), FLATCURVE_XAPIAN_MERGE_FACTOR));
+		return TRUE;
+	}
+	return FALSE;
+}
+
+/* Returns: 0 on success, -1 on error */
+static int
+fts_flatcurve_xapian_merge_shards(struct flatcurve_fts_backend *backend,
+				  std::vector<flatcurve_xapian_merge_shard> &merge,
+				  const char **error_r)
+{
+	static const enum flatcurve_xapian_wdb wopts =
+		ENUM_EMPTY(flatcurve_xapian_wdb);
+
+	/* Open the shards for writing, so expunges can't change them while
+	 * they are being merged. */
+	Xapian::Database db;
+	for (size_t i = 0; i < merge.size(); i++) {
+		if (fts_flatcurve_xapian_write_db_get(
+			backend, merge[i].xdb, wopts, error_r) < 0)
+			return -1;
+		db.add_database(*merge[i].xdb->db);
+	}
+
+	struct flatcurve_xapian_db_path *dbpath =
+		fts_flatcurve_xapian_create_db_path(
+			backend, FLATCURVE_XAPIAN_DB_MERGE);
+	if (fts_flatcurve_xapian_delete(backend, dbpath, error_r) < 0)
+		return -1;
+
+	try {
+		(void)db.reopen();
+		db.compact(dbpath->path, Xapian::DBCOMPACT_NO_RENUMBER |
+					 Xapian::DBCOMPACT_MULTIPASS |
+					 Xapian::Compactor::FULLER);
+	} catch (Xapian::InvalidOperationError &e) {
+		/* Overlapping UID ranges, see
+		 * fts_flatcurve_xapian_optimize_box_do() */
+		if (fts_flatcurve_xapian_optimize_rebuild(
+			backend, &db, dbpath, error_r) < 0)
+			return -1;
+	} catch (Xapian::Error &e) {
+		*error_r = t_strdup_printf("Merge failed: %s",
+					   e.get_description().c_str());
+		return -1;
+	}
+
+	/* Make the merged shard visible before deleting the old ones, so
+	 * searches may see duplicates but never miss messages. */
+	if (fts_flatcurve_xapian_rename_db(backend, dbpath, NULL, error_r) < 0)
+		return -1;
+
+	for (size_t i = 0; i < merge.size(); i++) {
+		if (fts_flatcurve_xapian_close_db(backend, merge[i].xdb,
+				FLATCURVE_XAPIAN_DB_CLOSE_WDB, error_r) < 0 ||
+		    fts_flatcurve_xapian_delete(backend, merge[i].xdb->dbpath,
+						error_r) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Returns: 0 on success, -1 on error */
+int fts_flatcurve_xapian_merge_box(struct flatcurve_fts_backend *backend,
+				   const char **error_r)
+{
+	static const enum flatcurve_xapian_db_opts opts =
+		(enum flatcurve_xapian_db_opts)
+			(FLATCURVE_XAPIAN_DB_NOCREATE_CURRENT |
+			 FLATCURVE_XAPIAN_DB_IGNORE_EMPTY);
+	unsigned int budget = backend->fuser->set.merge_max_messages;
+	unsigned int merged = 0;
+	int ret;
+
+	for (;;) {
+		std::vector<flatcurve_xapian_merge_shard> merge;
+
+		if ((ret = fts_flatcurve_xapian_read_db(
+			backend, opts, NULL, error_r)) <= 0)
+			break;
+		if (!fts_flatcurve_xapian_merge_select(backend, merge)) {
+			ret = 0;
+			break;
+		}
+
+		unsigned int messages = 0;
+		for (size_t i = 0; i < merge.size(); i++)
+			messages += merge[i].messages;
+		if (budget > 0 && merged + messages > budget) {
+			e_debug(backend->event, "Merging %u more messages "
+				"would exceed %u messages, leaving it for "
+				"later", messages, budget);
+			ret = 0;
+			break;
+		}
+
+		e_debug(event_create_passthrough(backend->event)->
+			set_name("fts_flatcurve_merge")->
+			add_str("mailbox", str_c(backend->boxname))->
+			add_int("shards", merge.size())->
+			add_int("messages", messages)->event(),
+			"Merging %zu shards with %u messages",
+			merge.size(), messages);
+
+		ret = 0;
+		if (fts_flatcurve_xapian_lock(backend, error_r) < 0 ||
+		    fts_flatcurve_xapian_merge_shards(backend, merge,
+						      error_r) < 0)
+			ret = -1;
+
+		const char *error;
+		if (fts_flatcurve_xapian_close(backend, &error) < 0) {
+			if (ret < 0)
+				e_error(backend->event, "%s", error);
+			else
+				*error_r = error;
+			ret = -1;
+		}
+		fts_flatcurve_xapian_unlock(backend);
+		if (ret < 0)
+			break;
+		merged += messages;
+	}
+	if (ret >= 0 && backend->xapian->db_read != NULL &&
+	    fts_flatcurve_xapian_close(backend, error_r) < 0)
+		ret = -1;
+	return ret < 0 ? -1 : 0;
+}
+
 static void
 fts_flatcurve_build_query_arg_term(struct flatcurve_fts_query *query,
 				   struct mail_search_arg *arg,
@@ -2210,14 +2641,141 @@ fts_flatcurve_xapian_query_iter_deinit(struct fts_flatcurve_xapian_query_iter **
 	return ret;
 }
 
+static void
+fts_flatcurve_xapian_get_db_state(struct flatcurve_xapian *x,
+				  Xapian::Database *db,
+				  struct flatcurve_xapian_db_state *state_r)
+{
+	i_zero(state_r);
+	state_r->doccount = db->get_doccount();
+	state_r->lastdocid = db->get_lastdocid();
+	state_r->avlength = db->get_avlength();
+	state_r->shards = x->shards;
+}
+
+static bool
+fts_flatcurve_xapian_db_state_equals(const struct flatcurve_xapian_db_state *s1,
+				     const struct flatcurve_xapian_db_state *s2)
+{
+	return s1->doccount == s2->doccount &&
+		s1->lastdocid == s2->lastdocid &&
+		s1->avlength == s2->avlength &&
+		s1->shards == s2->shards;
+}
+
+static const char *
+fts_flatcurve_xapian_query_cache_key(struct flatcurve_fts_query *query)
+{
+	return t_strdup_printf("%s\t%x\t%s",
+			       str_c(query->backend->db_path),
+			       (unsigned int)query->flags,
+			       str_c(query->qtext));
+}
+
+/* Returns: TRUE if the results were found from the cache */
+static bool
+fts_flatcurve_xapian_query_cache_lookup(struct flatcurve_fts_query *query,
+					const char *key,
+					const struct flatcurve_xapian_db_state *state,
+					struct flatcurve_fts_result *r)
+{
+	struct flatcurve_xapian *x = query->backend->xapian;
+	struct flatcurve_xapian_query_cache_entry *entry;
+	unsigned int i;
+
+	if (!hash_table_is_created(x->query_cache))
+		return FALSE;
+	entry = hash_table_lookup(x->query_cache, key);
+	if (entry == NULL ||
+	    !fts_flatcurve_xapian_db_state_equals(&entry->state, state))
+		return FALSE;
+
+	for (i = 0; i < entry->count; i++)
+		seq_range_array_add(&r->uids, entry->scores[i].uid);
+	array_append(&r->scores, entry->scores, entry->count);
+	e_debug(query->backend->event, "Query (%s) results found from cache",
+		str_c(query->qtext));
+	return TRUE;
+}
+
+static void
+fts_flatcurve_xapian_query_cache_add(struct flatcurve_fts_query *query,
+				     const char *key,
+				     const struct flatcurve_xapian_db_state *state,
+				     const struct flatcurve_fts_result *r)
+{
+	struct flatcurve_xapian *x = query->backend->xapian;
+	struct flatcurve_xapian_query_cache_entry *entry;
+	unsigned int count = array_count(&r->scores);
+	unsigned int max_uids = query->backend->fuser->set.query_cache_max_uids;
+
+	if (count > max_uids)
+		return;
+
+	if (!hash_table_is_created(x->query_cache)) {
+		x->query_cache_pool = pool_alloconly_create(
+			FTS_FLATCURVE_LABEL " query cache", 4096);
+		hash_table_create(&x->query_cache, default_pool, 0,
+				  str_hash, strcmp);
+	} else if (x->query_cache_uids + count > max_uids) {
+		/* Clearing everything keeps the memory usage bounded
+		 * without any LRU bookkeeping. Queries that are repeated
+		 * get cached again right away. */
+		hash_table_clear(x->query_cache, TRUE);
+		p_clear(x->query_cache_pool);
+		x->query_cache_uids = 0;
+	} else if ((entry = hash_table_lookup(x->query_cache, key)) != NULL) {
+		/* The old results are outdated. Their memory is freed
+		 * only when the cache gets cleared. */
+		hash_table_remove(x->query_cache, key);
+		x->query_cache_uids -= entry->count;
+	}
+
+	entry = p_new(x->query_cache_pool,
+		      struct flatcurve_xapian_query_cache_entry, 1);
+	entry->state = *state;
+	entry->count = count;
+	if (count > 0) {
+		entry->scores = (struct fts_score_map *)
+			p_memdup(x->query_cache_pool,
+				 array_front(&r->scores),
+				 sizeof(*entry->scores) * count);
+	}
+	hash_table_insert(x->query_cache,
+			  p_strdup(x->query_cache_pool, key), entry);
+	x->query_cache_uids += count;
+}
+
 /* Returns: 0 on success, -1 on error */
 int fts_flatcurve_xapian_run_query(struct flatcurve_fts_query *query,
 				   struct flatcurve_fts_result *r,
 				   const char **error_r)
 {
+	static const enum flatcurve_xapian_db_opts opts =
+		ENUM_EMPTY(flatcurve_xapian_db_opts);
+
+	struct flatcurve_fts_backend *backend = query->backend;
 	struct fts_flatcurve_xapian_query_iter *iter;
 	struct fts_flatcurve_xapian_query_result *result;
 	struct fts_score_map *score;
+	struct flatcurve_xapian_db_state state;
+	Xapian::Database *db;
+	const char *key = NULL;
+
+	if (query->xapian->query != NULL && backend->fuser != NULL &&
+	    backend->fuser->set.query_cache_max_uids > 0) {
+		/* Reopen the DB first, so that the state reflects the latest
+		 * changes. If the DB changes after this, the state won't
+		 * match the next time and the results are looked up again. */
+		if (fts_flatcurve_xapian_read_db(backend, opts, &db,
+						 error_r) < 0)
+			return -1;
+		fts_flatcurve_xapian_get_db_state(backend->xapian, db, &state);
+		key = fts_flatcurve_xapian_query_cache_key(query);
+		if (fts_flatcurve_xapian_query_cache_lookup(query, key,
+							    &state, r))
+			return 0;
+	}
 
 	iter = fts_flatcurve_xapian_query_iter_init(query);
 	while (fts_flatcurve_xapian_query_iter_next(iter, &result)) {
@@ -2226,7 +2784,12 @@ int fts_flatcurve_xapian_run_query(struct flatcurve_fts_query *query,
 		score->score = (float)result->score;
 		score->uid = result->uid;
 	}
-	return fts_flatcurve_xapian_query_iter_deinit(&iter, error_r);
+	if (fts_flatcurve_xapian_query_iter_deinit(&iter, error_r) < 0)
+		return -1;
+
+	if (key != NULL)
+		fts_flatcurve_xapian_query_cache_add(query, key, &state, r);
+	return 0;
 }
 
 void fts_flatcurve_xapian_destroy_query(struct flatcurve_fts_query *query)
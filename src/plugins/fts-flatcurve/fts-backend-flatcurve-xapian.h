@@ -30,6 +30,10 @@ int fts_flatcurve_xapian_refresh(struct flatcurve_fts_backend *backend,
 int fts_flatcurve_xapian_close(struct flatcurve_fts_backend *backend,
 			       const char **error_r);
 void fts_flatcurve_xapian_deinit(struct flatcurve_fts_backend *backend);
+/* Close the current mailbox. Its read-only DBs may be left open in the read
+   pool, so that switching back to the mailbox doesn't need to reopen them. */
+int fts_flatcurve_xapian_close_mailbox(struct flatcurve_fts_backend *backend,
+				       const char **error_r);
 
 int fts_flatcurve_xapian_get_last_uid(struct flatcurve_fts_backend *backend,
 				      uint32_t *last_uid_r, const char **error_r);
@@ -51,6 +55,10 @@ fts_flatcurve_xapian_index_body(struct flatcurve_fts_backend_update_context *ctx
 				const char **error_r);
 int fts_flatcurve_xapian_optimize_box(struct flatcurve_fts_backend *backend,
 				      const char **error_r);
+/* Merge the mailbox's small shards into larger ones using the tiered merge
+   policy. At most fts_flatcurve_merge_max_messages messages are rewritten. */
+int fts_flatcurve_xapian_merge_box(struct flatcurve_fts_backend *backend,
+				   const char **error_r);
 void
 fts_flatcurve_xapian_build_query_match_all(struct flatcurve_fts_query *query);
 void fts_flatcurve_xapian_build_query(struct flatcurve_fts_query *query);
@@ -70,7 +70,7 @@ fts_backend_flatcurve_close_mailbox(struct flatcurve_fts_backend *backend,
 {
 	int ret = 0;
 	if (str_len(backend->boxname) > 0) {
-		ret = fts_flatcurve_xapian_close(backend, error_r);
+		ret = fts_flatcurve_xapian_close_mailbox(backend, error_r);
 
 		str_truncate(backend->boxname, 0);
 		str_truncate(backend->db_path, 0);
@@ -507,8 +507,11 @@ fts_backend_flatcurve_iterate_ns(struct fts_backend *_backend,
 
 		switch (act) {
 		case FTS_BACKEND_FLATCURVE_ACTION_OPTIMIZE:
-			if (fts_flatcurve_xapian_optimize_box(
-				backend, &error) < 0) {
+			/* Optimize requests in indexer-worker are the
+			   background merges queued by the deinit. */
+			if ((backend->fuser->indexer_worker ?
+			     fts_flatcurve_xapian_merge_box(backend, &error) :
+			     fts_flatcurve_xapian_optimize_box(backend, &error)) < 0) {
 				e_error(backend->event, "%s", error);
 				failed = TRUE;
 			}
@@ -16,12 +16,21 @@
 #define FTS_FLATCURVE_MAX_TERM_SIZE_DEFAULT 30
 #define FTS_FLATCURVE_MAX_TERM_SIZE_MAX 200
 
+#define FTS_FLATCURVE_PLUGIN_MERGE_MAX_MESSAGES "fts_flatcurve_merge_max_messages"
+#define FTS_FLATCURVE_MERGE_MAX_MESSAGES_DEFAULT 100000
+
 #define FTS_FLATCURVE_PLUGIN_MIN_TERM_SIZE "fts_flatcurve_min_term_size"
 #define FTS_FLATCURVE_MIN_TERM_SIZE_DEFAULT 2
 
 #define FTS_FLATCURVE_PLUGIN_OPTIMIZE_LIMIT "fts_flatcurve_optimize_limit"
 #define FTS_FLATCURVE_OPTIMIZE_LIMIT_DEFAULT 10
 
+#define FTS_FLATCURVE_PLUGIN_QUERY_CACHE_MAX_UIDS "fts_flatcurve_query_cache_max_uids"
+#define FTS_FLATCURVE_QUERY_CACHE_MAX_UIDS_DEFAULT 100000
+
+#define FTS_FLATCURVE_PLUGIN_READ_POOL_MAX_SHARDS "fts_flatcurve_read_pool_max_shards"
+#define FTS_FLATCURVE_READ_POOL_MAX_SHARDS_DEFAULT 16
+
 #define FTS_FLATCURVE_PLUGIN_ROTATE_COUNT "fts_flatcurve_rotate_count"
 #define FTS_FLATCURVE_ROTATE_SIZE_DEFAULT 5000
 
@@ -74,6 +83,17 @@ fts_flatcurve_plugin_init_settings(struct mail_user *user,
 		set->max_term_size = I_MIN(val, FTS_FLATCURVE_MAX_TERM_SIZE_MAX);
 	}
 
+	set->merge_max_messages = FTS_FLATCURVE_MERGE_MAX_MESSAGES_DEFAULT;
+	pset = mail_user_plugin_getenv(user, FTS_FLATCURVE_PLUGIN_MERGE_MAX_MESSAGES);
+	if (pset != NULL) {
+		if (str_to_uint(pset, &val) < 0) {
+			*error_r = t_strdup_printf("Invalid %s: %s",
+				FTS_FLATCURVE_PLUGIN_MERGE_MAX_MESSAGES, pset);
+			return -1;
+		}
+		set->merge_max_messages = val;
+	}
+
 	set->min_term_size = FTS_FLATCURVE_MIN_TERM_SIZE_DEFAULT;
 	pset = mail_user_plugin_getenv(user, FTS_FLATCURVE_PLUGIN_MIN_TERM_SIZE);
 	if (pset != NULL) {
@@ -96,6 +116,28 @@ fts_flatcurve_plugin_init_settings(struct mail_user *user,
 		set->optimize_limit = val;
 	}
 
+	set->query_cache_max_uids = FTS_FLATCURVE_QUERY_CACHE_MAX_UIDS_DEFAULT;
+	pset = mail_user_plugin_getenv(user, FTS_FLATCURVE_PLUGIN_QUERY_CACHE_MAX_UIDS);
+	if (pset != NULL) {
+		if (str_to_uint(pset, &val) < 0) {
+			*error_r = t_strdup_printf("Invalid %s: %s",
+				FTS_FLATCURVE_PLUGIN_QUERY_CACHE_MAX_UIDS, pset);
+			return -1;
+		}
+		set->query_cache_max_uids = val;
+	}
+
+	set->read_pool_max_shards = FTS_FLATCURVE_READ_POOL_MAX_SHARDS_DEFAULT;
+	pset = mail_user_plugin_getenv(user, FTS_FLATCURVE_PLUGIN_READ_POOL_MAX_SHARDS);
+	if (pset != NULL) {
+		if (str_to_uint(pset, &val) < 0) {
+			*error_r = t_strdup_printf("Invalid %s: %s",
+				FTS_FLATCURVE_PLUGIN_READ_POOL_MAX_SHARDS, pset);
+			return -1;
+		}
+		set->read_pool_max_shards = val;
+	}
+
 	set->rotate_count = FTS_FLATCURVE_ROTATE_SIZE_DEFAULT;
 	pset = mail_user_plugin_getenv(user, FTS_FLATCURVE_PLUGIN_ROTATE_COUNT);
 	if (pset != NULL) {
@@ -132,6 +174,7 @@ static void fts_flatcurve_mail_user_created(struct mail_user *user)
 	const char *error;
 
 	fuser = p_new(user->pool, struct fts_flatcurve_user, 1);
+	fuser->indexer_worker = strcmp(user->service, "indexer-worker") == 0;
 
 	if (fts_flatcurve_plugin_init_settings(user, &fuser->set, &error) < 0 ||
 	    fts_mail_user_init(user, TRUE, &error) < 0) {
@@ -17,8 +17,11 @@
 struct fts_flatcurve_settings {
 	unsigned int commit_limit;
 	unsigned int max_term_size;
+	unsigned int merge_max_messages;
 	unsigned int min_term_size;
 	unsigned int optimize_limit;
+	unsigned int query_cache_max_uids;
+	unsigned int read_pool_max_shards;
 	unsigned int rotate_count;
 	unsigned int rotate_time;
 	bool substring_search;
@@ -28,6 +31,9 @@ struct fts_flatcurve_user {
 	union mail_user_module_context module_ctx;
 	struct flatcurve_fts_backend *backend;
 	struct fts_flatcurve_settings set;
+	/* Running in indexer-worker: shards are merged directly instead of
+	   queueing an indexer request for it. */
+	bool indexer_worker:1;
 };
 
 extern struct fts_backend fts_backend_flatcurve;
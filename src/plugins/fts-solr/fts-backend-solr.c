@@ -20,6 +20,9 @@
 #define SOLR_CMDBUF_SIZE (1024*64)
 #define SOLR_CMDBUF_FLUSH_SIZE (SOLR_CMDBUF_SIZE-128)
 #define SOLR_MAX_MULTI_ROWS 100000
+/* With pipelining the whole batch is kept in memory. Send it early if it
+   grows larger than this. */
+#define SOLR_PIPELINE_BATCH_MAX_SIZE (1024*1024*4)
 
 /* If header is larger than this, truncate it. */
 #define SOLR_HEADER_MAX_SIZE (1024*1024)
@@ -28,12 +31,26 @@
 #define SOLR_HEADER_LINE_MAX_TRUNC_SIZE 1024
 
 #define SOLR_QUERY_MAX_MAILBOX_COUNT 10
+/* Maximum number of lookups sent in parallel for a multi-mailbox search,
+   each restricted to SOLR_QUERY_MAX_MAILBOX_COUNT mailboxes. If more would
+   be needed, all of the user's mailboxes are searched at once instead. */
+#define SOLR_QUERY_MAX_PARALLEL_LOOKUPS 8
 
 struct solr_fts_backend {
 	struct fts_backend backend;
 	struct solr_connection *solr_conn;
 };
 
+struct solr_fts_multi_lookup_context {
+	struct event *event;
+	pool_t pool;
+	HASH_TABLE(char *, struct fts_result *) mailboxes;
+	int ret;
+
+	bool definite_as_maybe:1;
+	bool search_all_mailboxes:1;
+};
+
 struct solr_fts_field {
 	char *key;
 	string_t *value;
@@ -55,6 +72,8 @@ struct solr_fts_backend_update_context {
 	unsigned int mails_since_flush;
 
 	bool tokenized_input:1;
+	bool pipeline:1;
+	bool batch_open:1;
 	bool last_indexed_uid_set:1;
 	bool body_open:1;
 	bool documents_added:1;
@@ -276,12 +295,14 @@ fts_backend_solr_get_last_uid(struct fts_backend *_backend,
 static struct fts_backend_update_context *
 fts_backend_solr_update_init(struct fts_backend *_backend)
 {
+	struct fts_solr_user *fuser = FTS_SOLR_USER_CONTEXT(_backend->ns->user);
 	struct solr_fts_backend_update_context *ctx;
 
 	ctx = i_new(struct solr_fts_backend_update_context, 1);
 	ctx->ctx.backend = _backend;
 	ctx->tokenized_input =
 		(_backend->flags & FTS_BACKEND_FLAG_TOKENIZED_INPUT) != 0;
+	ctx->pipeline = fuser->set.pipeline;
 	i_array_init(&ctx->fields, 16);
 	return &ctx->ctx;
 }
@@ -354,22 +375,60 @@ fts_backend_solr_doc_close(struct solr_fts_backend_update_context *ctx)
 	str_append(ctx->cmd, "</doc>");
 }
 
+static void
+fts_backend_solr_cmd_flush(struct solr_fts_backend_update_context *ctx)
+{
+	if (ctx->pipeline) {
+		/* the whole batch is sent at once */
+		return;
+	}
+	solr_connection_post_more(ctx->post, str_data(ctx->cmd),
+				  str_len(ctx->cmd));
+	str_truncate(ctx->cmd, 0);
+}
+
 static int
 fts_backed_solr_build_flush(struct solr_fts_backend_update_context *ctx)
 {
-	if (ctx->post == NULL)
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)ctx->ctx.backend;
+	int ret;
+
+	if (!ctx->batch_open)
 		return 0;
 
 	fts_backend_solr_doc_close(ctx);
 	str_append(ctx->cmd, "</add>");
 	ctx->mails_since_flush = 0;
+	ctx->batch_open = FALSE;
 
-	solr_connection_post_more(ctx->post, str_data(ctx->cmd),
-				  str_len(ctx->cmd));
-	str_truncate(ctx->cmd, 0);
+	if (ctx->pipeline) {
+		/* Solr processes this batch while the next one is built */
+		ret = solr_connection_post_async(backend->solr_conn,
+						 str_data(ctx->cmd),
+						 str_len(ctx->cmd));
+		str_truncate(ctx->cmd, 0);
+		return ret;
+	}
+
+	fts_backend_solr_cmd_flush(ctx);
 	return solr_connection_post_end(&ctx->post);
 }
 
+/* Flush the current batch and wait until all the batches have been
+   processed. */
+static int
+fts_backend_solr_build_finish(struct solr_fts_backend_update_context *ctx)
+{
+	struct solr_fts_backend *backend =
+		(struct solr_fts_backend *)ctx->ctx.backend;
+	int ret = fts_backed_solr_build_flush(ctx);
+
+	if (ctx->pipeline && solr_connection_post_wait(backend->solr_conn) < 0)
+		ret = -1;
+	return ret;
+}
+
 static void
 fts_backend_solr_expunge_flush(struct solr_fts_backend_update_context *ctx)
 {
@@ -394,7 +453,7 @@ fts_backend_solr_update_deinit(struct fts_backend_update_context *_ctx)
 	const char *str;
 	int ret = _ctx->failed ? -1 : 0;
 
-	if (fts_backed_solr_build_flush(ctx) < 0)
+	if (fts_backend_solr_build_finish(ctx) < 0)
 		ret = -1;
 
 	if (ctx->documents_added || ctx->expunges) {
@@ -434,7 +493,7 @@ fts_backend_solr_update_set_mailbox(struct fts_backend_update_context *_ctx,
 
 		/* flush solr between mailboxes, so we don't wrongly update
 		   last_uid before we know it has succeeded */
-		if (fts_backed_solr_build_flush(ctx) < 0)
+		if (fts_backend_solr_build_finish(ctx) < 0)
 			_ctx->failed = TRUE;
 		else if (!_ctx->failed)
 			fts_index_set_last_uid(ctx->cur_box, ctx->prev_uid);
@@ -496,15 +555,21 @@ fts_backend_solr_uid_changed(struct solr_fts_backend_update_context *ctx,
 		(struct solr_fts_backend *)ctx->ctx.backend;
 	struct fts_solr_user *fuser = FTS_SOLR_USER_CONTEXT(ctx->ctx.backend->ns->user);
 
-	if (ctx->mails_since_flush >= fuser->set.batch_size) {
+	if (ctx->mails_since_flush >= fuser->set.batch_size ||
+	    (ctx->pipeline && ctx->cmd != NULL &&
+	     str_len(ctx->cmd) >= SOLR_PIPELINE_BATCH_MAX_SIZE)) {
 		if (fts_backed_solr_build_flush(ctx) < 0)
 			ctx->ctx.failed = TRUE;
 	}
 	ctx->mails_since_flush++;
-	if (ctx->post == NULL) {
+	if (!ctx->batch_open) {
 		if (ctx->cmd == NULL)
 			ctx->cmd = str_new(default_pool, SOLR_CMDBUF_SIZE);
-		ctx->post = solr_connection_post_begin(backend->solr_conn);
+		if (!ctx->pipeline) {
+			ctx->post = solr_connection_post_begin(
+				backend->solr_conn);
+		}
+		ctx->batch_open = TRUE;
 		str_append(ctx->cmd, "<add>");
 	} else {
 		fts_backend_solr_doc_close(ctx);
@@ -580,13 +645,9 @@ fts_backend_solr_update_build_more(struct fts_backend_update_context *_ctx,
 	if (ctx->cur_value2 == NULL && ctx->cur_value == ctx->cmd) {
 		/* we're writing to message body. if size is huge,
 		   flush it once in a while */
-		while (size >= SOLR_CMDBUF_FLUSH_SIZE) {
-			if (str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE) {
-				solr_connection_post_more(ctx->post,
-							  str_data(ctx->cmd),
-							  str_len(ctx->cmd));
-				str_truncate(ctx->cmd, 0);
-			}
+		while (!ctx->pipeline && size >= SOLR_CMDBUF_FLUSH_SIZE) {
+			if (str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE)
+				fts_backend_solr_cmd_flush(ctx);
 			len = xml_encode_data_max(ctx->cmd, data, size,
 						  SOLR_CMDBUF_FLUSH_SIZE -
 						  str_len(ctx->cmd));
@@ -613,11 +674,8 @@ fts_backend_solr_update_build_more(struct fts_backend_update_context *_ctx,
 		}
 	}
 
-	if (str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE) {
-		solr_connection_post_more(ctx->post, str_data(ctx->cmd),
-					  str_len(ctx->cmd));
-		str_truncate(ctx->cmd, 0);
-	}
+	if (str_len(ctx->cmd) >= SOLR_CMDBUF_FLUSH_SIZE)
+		fts_backend_solr_cmd_flush(ctx);
 	if (!ctx->truncate_header &&
 	    str_len(ctx->cur_value) >= SOLR_HEADER_MAX_SIZE) {
 		/* a large header */
@@ -857,104 +915,190 @@ fts_backend_solr_lookup(struct fts_backend *_backend, struct mailbox *box,
 	return 0;
 }
 
-static int
-solr_search_multi(struct fts_backend *_backend, string_t *str,
-		  struct mailbox *const boxes[], enum fts_lookup_flags flags,
-		  struct fts_multi_result *result)
+static void
+solr_result_merge(struct solr_fts_multi_lookup_context *ctx,
+		  struct fts_result *br, struct solr_result *result,
+		  bool maybe)
 {
-	struct event *event = _backend->ns->user->event;
-	struct solr_fts_backend *backend = (struct solr_fts_backend *)_backend;
-	struct solr_result **solr_results;
-	struct fts_result *fts_result;
-	ARRAY(struct fts_result) fts_results;
-	HASH_TABLE(char *, struct mailbox *) mailboxes;
-	struct mailbox *box;
-	const char *box_guid;
-	unsigned int i;
-	size_t len;
-	bool search_all_mailboxes;
+	ARRAY_TYPE(seq_range) *uids =
+		maybe || ctx->definite_as_maybe ?
+		&br->maybe_uids : &br->definite_uids;
 
-	/* use a separate filter query for selecting the mailbox. it shouldn't
-	   affect the score and there could be some caching benefits too. */
-	str_append(str, "&fq=%2Buser:");
-	if (_backend->ns->owner != NULL)
-		solr_quote_http(str, _backend->ns->owner->username);
+	if (!array_is_created(uids))
+		*uids = result->uids;
 	else
-		str_append(str, "%22%22");
-
-	hash_table_create(&mailboxes, default_pool, 0, str_hash, strcmp);
-	for (i = 0; boxes[i] != NULL; i++) ;
-	search_all_mailboxes = i > SOLR_QUERY_MAX_MAILBOX_COUNT;
-	if (!search_all_mailboxes)
-		str_append(str, "+%2B(");
-	len = str_len(str);
+		seq_range_array_merge(uids, &result->uids);
 
-	for (i = 0; boxes[i] != NULL; i++) {
-		if (fts_mailbox_get_guid(boxes[i], &box_guid) < 0)
-			continue;
-
-		if (!search_all_mailboxes) {
-			if (str_len(str) != len)
-				str_append(str, "+OR+");
-			str_printfa(str, "box:%s", box_guid);
-		}
-		hash_table_insert(mailboxes, t_strdup_noconst(box_guid),
-				  boxes[i]);
+	if (!array_is_created(&br->scores))
+		br->scores = result->scores;
+	else {
+		array_append_array(&br->scores, &result->scores);
+		br->scores_sorted = FALSE;
 	}
-	if (!search_all_mailboxes)
-		str_append_c(str, ')');
+}
 
-	if (solr_connection_select(backend->solr_conn, str_c(str),
-				   result->pool, &solr_results) < 0) {
-		hash_table_destroy(&mailboxes);
-		return -1;
+static void
+solr_lookup_multi_results(struct solr_fts_multi_lookup_context *ctx,
+			  int ret, struct solr_result **results, bool maybe)
+{
+	struct fts_result *br;
+	unsigned int i;
+
+	if (ret < 0) {
+		ctx->ret = -1;
+		return;
 	}
 
-	p_array_init(&fts_results, result->pool, 32);
-	for (i = 0; solr_results[i] != NULL; i++) {
-		box = hash_table_lookup(mailboxes, solr_results[i]->box_id);
-		if (box == NULL) {
-			if (!search_all_mailboxes) {
-				e_warning(event,
+	for (i = 0; results[i] != NULL; i++) {
+		br = hash_table_lookup(ctx->mailboxes, results[i]->box_id);
+		if (br == NULL) {
+			if (!ctx->search_all_mailboxes) {
+				e_warning(ctx->event,
 					  "fts-solr: Lookup returned unexpected mailbox "
-					  "with guid=%s", solr_results[i]->box_id);
+					  "with guid=%s", results[i]->box_id);
 			}
 			continue;
 		}
-		fts_result = array_append_space(&fts_results);
-		fts_result->box = box;
-		if ((flags & FTS_LOOKUP_FLAG_NO_AUTO_FUZZY) == 0)
-			fts_result->definite_uids = solr_results[i]->uids;
-		else
-			fts_result->maybe_uids = solr_results[i]->uids;
-		fts_result->scores = solr_results[i]->scores;
-		fts_result->scores_sorted = TRUE;
+		solr_result_merge(ctx, br, results[i], maybe);
+	}
+}
+
+static void
+solr_lookup_multi_definite_callback(int ret, struct solr_result **results,
+				    struct solr_fts_multi_lookup_context *ctx)
+{
+	solr_lookup_multi_results(ctx, ret, results, FALSE);
+}
+
+static void
+solr_lookup_multi_maybe_callback(int ret, struct solr_result **results,
+				 struct solr_fts_multi_lookup_context *ctx)
+{
+	solr_lookup_multi_results(ctx, ret, results, TRUE);
+}
+
+static void
+solr_lookup_multi_submit(struct fts_backend *_backend,
+			 struct solr_fts_multi_lookup_context *ctx,
+			 const string_t *definite_query,
+			 const string_t *maybe_query,
+			 const char *const *box_guids, unsigned int box_count)
+{
+	struct solr_fts_backend *backend = (struct solr_fts_backend *)_backend;
+	string_t *str, *filter;
+	size_t prefix_len;
+	unsigned int i;
+
+	/* use a separate filter query for selecting the mailbox. it shouldn't
+	   affect the score and there could be some caching benefits too. */
+	filter = t_str_new(128);
+	str_append(filter, "&fq=%2Buser:");
+	if (_backend->ns->owner != NULL)
+		solr_quote_http(filter, _backend->ns->owner->username);
+	else
+		str_append(filter, "%22%22");
+	if (box_count > 0) {
+		str_append(filter, "+%2B(");
+		for (i = 0; i < box_count; i++) {
+			if (i > 0)
+				str_append(filter, "+OR+");
+			str_printfa(filter, "box:%s", box_guids[i]);
+		}
+		str_append_c(filter, ')');
+	}
+
+	str = t_str_new(256);
+	str_printfa(str, "wt=xml&fl=box,uid,score&rows=%u&sort=box+asc,uid+asc&q=%%7b!lucene+q.op%%3dAND%%7d",
+		    SOLR_MAX_MULTI_ROWS);
+	prefix_len = str_len(str);
+
+	if (str_len(definite_query) > 0) {
+		str_append_str(str, definite_query);
+		str_append_str(str, filter);
+		solr_connection_select_submit(backend->solr_conn, str_c(str),
+			ctx->pool, solr_lookup_multi_definite_callback, ctx);
+	}
+	if (str_len(maybe_query) > 0) {
+		str_truncate(str, prefix_len);
+		str_append_str(str, maybe_query);
+		str_append_str(str, filter);
+		solr_connection_select_submit(backend->solr_conn, str_c(str),
+			ctx->pool, solr_lookup_multi_maybe_callback, ctx);
 	}
-	array_append_zero(&fts_results);
-	result->box_results = array_front_modifiable(&fts_results);
-	hash_table_destroy(&mailboxes);
-	return 0;
 }
 
 static int
-fts_backend_solr_lookup_multi(struct fts_backend *backend,
+fts_backend_solr_lookup_multi(struct fts_backend *_backend,
 			      struct mailbox *const boxes[],
 			      struct mail_search_arg *args,
 			      enum fts_lookup_flags flags,
 			      struct fts_multi_result *result)
 {
+	struct solr_fts_backend *backend = (struct solr_fts_backend *)_backend;
 	bool and_args = (flags & FTS_LOOKUP_FLAG_AND_ARGS) != 0;
-	string_t *str;
+	struct solr_fts_multi_lookup_context ctx;
+	struct fts_result *box_results;
+	string_t *definite_query, *maybe_query;
+	ARRAY_TYPE(const_string) box_guids;
+	const char *const *guids, *box_guid;
+	unsigned int i, count, guid_count;
+
+	definite_query = t_str_new(256);
+	if (!solr_add_definite_query_args(definite_query, args, and_args))
+		str_truncate(definite_query, 0);
+	maybe_query = t_str_new(128);
+	if (!solr_add_maybe_query_args(maybe_query, args, and_args))
+		str_truncate(maybe_query, 0);
+	if (str_len(definite_query) == 0 && str_len(maybe_query) == 0)
+		return 0;
 
-	str = t_str_new(256);
-	str_printfa(str, "wt=xml&fl=box,uid,score&rows=%u&sort=box+asc,uid+asc&q=%%7b!lucene+q.op%%3dAND%%7d",
-		    SOLR_MAX_MULTI_ROWS);
+	i_zero(&ctx);
+	ctx.event = _backend->ns->user->event;
+	ctx.pool = result->pool;
+	ctx.definite_as_maybe = (flags & FTS_LOOKUP_FLAG_NO_AUTO_FUZZY) != 0;
+	hash_table_create(&ctx.mailboxes, default_pool, 0, str_hash, strcmp);
 
-	if (solr_add_definite_query_args(str, args, and_args)) {
-		if (solr_search_multi(backend, str, boxes, flags, result) < 0)
-			return -1;
+	for (count = 0; boxes[count] != NULL; count++) ;
+	box_results = p_new(result->pool, struct fts_result, count + 1);
+	t_array_init(&box_guids, count);
+	for (i = 0; boxes[i] != NULL; i++) {
+		if (fts_mailbox_get_guid(boxes[i], &box_guid) < 0)
+			continue;
+
+		box_guid = t_strdup(box_guid);
+		array_push_back(&box_guids, &box_guid);
+		box_results->box = boxes[i];
+		box_results->scores_sorted = TRUE;
+		hash_table_insert(ctx.mailboxes, t_strdup_noconst(box_guid),
+				  box_results);
+		box_results++;
 	}
-	/* FIXME: maybe_uids could be handled also with some more work.. */
+	box_results -= array_count(&box_guids);
+
+	/* Send all the lookups at once and wait for them together. Each
+	   mailbox belongs to only one lookup, so the results can be added
+	   to the mailboxes as they arrive. */
+	guids = array_get(&box_guids, &guid_count);
+	ctx.search_all_mailboxes =
+		guid_count > SOLR_QUERY_MAX_MAILBOX_COUNT *
+			     SOLR_QUERY_MAX_PARALLEL_LOOKUPS;
+	if (ctx.search_all_mailboxes) {
+		solr_lookup_multi_submit(_backend, &ctx, definite_query,
+					 maybe_query, NULL, 0);
+	} else {
+		for (i = 0; i < guid_count; i += SOLR_QUERY_MAX_MAILBOX_COUNT) {
+			solr_lookup_multi_submit(_backend, &ctx, definite_query,
+				maybe_query, guids + i,
+				I_MIN(guid_count - i,
+				      SOLR_QUERY_MAX_MAILBOX_COUNT));
+		}
+	}
+	solr_connection_wait(backend->solr_conn);
+	hash_table_destroy(&ctx.mailboxes);
+
+	if (ctx.ret < 0)
+		return -1;
+	result->box_results = box_results;
 	return 0;
 }
 
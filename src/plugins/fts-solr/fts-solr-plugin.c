@@ -47,6 +47,28 @@ fts_solr_plugin_init_settings(struct mail_user *user,
 					"fts-solr: batch_size must be a positive integer");
 					return -1;
 			}
+		} else if (str_begins(*tmp, "pipeline=", &value)) {
+			if (strcmp(value, "yes") == 0) {
+				set->pipeline = TRUE;
+			} else if (strcmp(value, "no") == 0) {
+				set->pipeline = FALSE;
+			} else {
+				e_error(user->event,
+					"fts-solr: Invalid setting for pipeline: %s",
+					value);
+				return -1;
+			}
+		} else if (str_begins(*tmp, "gzip=", &value)) {
+			if (strcmp(value, "yes") == 0) {
+				set->gzip = TRUE;
+			} else if (strcmp(value, "no") == 0) {
+				set->gzip = FALSE;
+			} else {
+				e_error(user->event,
+					"fts-solr: Invalid setting for gzip: %s",
+					value);
+				return -1;
+			}
 		} else if (str_begins(*tmp, "soft_commit=", &value)) {
 			if (strcmp(value, "yes") == 0) {
 				set->soft_commit = TRUE;
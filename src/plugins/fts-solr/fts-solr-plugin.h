@@ -16,6 +16,11 @@ struct fts_solr_settings {
 	bool use_libfts;
 	bool debug;
 	bool soft_commit;
+	/* Send each batch without waiting for the reply, while the next
+	   batch is being built. */
+	bool pipeline;
+	/* Compress the pipelined batches with gzip. */
+	bool gzip;
 };
 
 struct fts_solr_user {
@@ -7,13 +7,22 @@
 #include "strescape.h"
 #include "ioloop.h"
 #include "istream.h"
+#include "ostream.h"
 #include "http-url.h"
 #include "http-client.h"
+#include "compression.h"
 #include "fts-solr-plugin.h"
 #include "solr-connection.h"
 
 #include <expat.h>
 
+/* Multi-mailbox searches send several lookups at the same time. */
+#define SOLR_HTTP_MAX_PARALLEL_CONNECTIONS 4
+/* Maximum number of pipelined update posts waiting for a reply. */
+#define SOLR_MAX_PENDING_POSTS 2
+/* How often to check whether a pipelined post has been written. */
+#define SOLR_POST_PUSH_CHECK_MSECS 10
+
 struct solr_lookup_context {
 	pool_t result_pool;
 	struct event *event;
@@ -24,6 +33,14 @@ struct solr_lookup_context {
 
 	struct solr_response_parser *parser;
 	struct solr_result **results;
+
+	solr_lookup_callback_t *callback;
+	void *context;
+};
+
+struct solr_lookup_sync_context {
+	int ret;
+	struct solr_result **results;
 };
 
 struct solr_connection_post {
@@ -33,6 +50,9 @@ struct solr_connection_post {
 	int request_status;
 
 	bool failed:1;
+	/* Sent by solr_connection_post_async(), freed by the response
+	   callback. */
+	bool async:1;
 };
 
 struct solr_connection {
@@ -44,9 +64,14 @@ struct solr_connection {
 	char *http_user;
 	char *http_password;
 
+	const struct compression_handler *gz_handler;
+	unsigned int pending_posts;
+	struct istream *push_payload;
+
 	bool debug:1;
 	bool posting:1;
 	bool http_ssl:1;
+	bool pending_post_failed:1;
 };
 
 /* Regardless of the specified URL, make sure path ends in '/' */
@@ -70,9 +95,16 @@ int solr_connection_init(const struct fts_solr_settings *solr_set,
 {
 	struct http_client_settings http_set;
 	struct solr_connection *conn;
+	const struct compression_handler *gz_handler = NULL;
 	struct http_url *http_url;
 	const char *error;
 
+	if (solr_set->gzip &&
+	    compression_lookup_handler("gz", &gz_handler) <= 0) {
+		*error_r = "fts-solr: gzip=yes, but gzip support isn't compiled in";
+		return -1;
+	}
+
 	if (http_url_parse(solr_set->url, NULL, HTTP_URL_ALLOW_USERINFO_PART,
 			   pool_datastack_create(), &http_url, &error) < 0) {
 		*error_r = t_strdup_printf(
@@ -94,11 +126,13 @@ int solr_connection_init(const struct fts_solr_settings *solr_set,
 	}
 
 	conn->debug = solr_set->debug;
+	conn->gz_handler = gz_handler;
 
 	if (solr_http_client == NULL) {
 		i_zero(&http_set);
 		http_set.max_idle_time_msecs = 5*1000;
-		http_set.max_parallel_connections = 1;
+		http_set.max_parallel_connections =
+			SOLR_HTTP_MAX_PARALLEL_CONNECTIONS;
 		http_set.max_pipelined_requests = 1;
 		http_set.max_redirects = 1;
 		http_set.max_attempts = 3;
@@ -127,6 +161,10 @@ void solr_connection_deinit(struct solr_connection **_conn)
 	struct solr_connection *conn = *_conn;
 
 	*_conn = NULL;
+	if (solr_connection_post_wait(conn) < 0) {
+		e_error(conn->event,
+			"fts-solr: Pipelined indexing failed during deinit");
+	}
 	event_unref(&conn->event);
 	i_free(conn->http_host);
 	i_free(conn->http_base_url);
@@ -135,6 +173,12 @@ void solr_connection_deinit(struct solr_connection **_conn)
 	i_free(conn);
 }
 
+static void solr_connection_lookup_finish(struct solr_lookup_context *lctx)
+{
+	lctx->callback(lctx->request_status, lctx->results, lctx->context);
+	i_free(lctx);
+}
+
 static void solr_connection_payload_input(struct solr_lookup_context *lctx)
 {
 	int ret;
@@ -155,6 +199,7 @@ static void solr_connection_payload_input(struct solr_lookup_context *lctx)
 			lctx->request_status = -1;
 		solr_response_parser_deinit(&lctx->parser);
 		io_remove(&lctx->io);
+		solr_connection_lookup_finish(lctx);
 	}
 }
 
@@ -166,12 +211,14 @@ solr_connection_select_response(const struct http_response *response,
 		e_error(lctx->event, "fts-solr: Lookup failed: %s",
 			http_response_get_message(response));
 		lctx->request_status = -1;
+		solr_connection_lookup_finish(lctx);
 		return;
 	}
 
 	if (response->payload == NULL) {
 		e_error(lctx->event, "fts-solr: Lookup failed: Empty response payload");
 		lctx->request_status = -1;
+		solr_connection_lookup_finish(lctx);
 		return;
 	}
 
@@ -183,16 +230,46 @@ solr_connection_select_response(const struct http_response *response,
 	solr_connection_payload_input(lctx);
 }
 
+static void
+solr_connection_select_callback(int ret, struct solr_result **results,
+				struct solr_lookup_sync_context *sctx)
+{
+	sctx->ret = ret;
+	sctx->results = results;
+}
+
 int solr_connection_select(struct solr_connection *conn, const char *query,
 			   pool_t pool, struct solr_result ***box_results_r)
 {
-	struct solr_lookup_context lctx;
+	struct solr_lookup_sync_context sctx;
+
+	i_zero(&sctx);
+	solr_connection_select_submit(conn, query, pool,
+				      solr_connection_select_callback, &sctx);
+	solr_connection_wait(conn);
+
+	if (sctx.ret < 0)
+		return -1;
+
+	*box_results_r = sctx.results;
+	return 0;
+}
+
+#undef solr_connection_select_submit
+void solr_connection_select_submit(struct solr_connection *conn,
+				   const char *query, pool_t pool,
+				   solr_lookup_callback_t *callback,
+				   void *context)
+{
+	struct solr_lookup_context *lctx;
 	struct http_client_request *http_req;
 	const char *url;
 
-	i_zero(&lctx);
-	lctx.result_pool = pool;
-	lctx.event = conn->event;
+	lctx = i_new(struct solr_lookup_context, 1);
+	lctx->result_pool = pool;
+	lctx->event = conn->event;
+	lctx->callback = callback;
+	lctx->context = context;
 
 	i_free_and_null(conn->http_failure);
 	url = t_strconcat(conn->http_base_url, "select?", query, NULL);
@@ -200,7 +277,7 @@ int solr_connection_select(struct solr_connection *conn, const char *query,
 	http_req = http_client_request(solr_http_client, "GET",
 				       conn->http_host, url,
 				       solr_connection_select_response,
-				       &lctx);
+				       lctx);
 	if (conn->http_user != NULL) {
 		http_client_request_set_auth_simple(
 			http_req, conn->http_user, conn->http_password);
@@ -208,27 +285,33 @@ int solr_connection_select(struct solr_connection *conn, const char *query,
 	http_client_request_set_port(http_req, conn->http_port);
 	http_client_request_set_ssl(http_req, conn->http_ssl);
 	http_client_request_submit(http_req);
+}
 
-	lctx.request_status = 0;
+void solr_connection_wait(struct solr_connection *conn ATTR_UNUSED)
+{
 	http_client_wait(solr_http_client);
-
-	if (lctx.request_status < 0)
-		return -1;
-
-	*box_results_r = lctx.results;
-	return 0;
 }
 
 static void
 solr_connection_update_response(const struct http_response *response,
 				struct solr_connection_post *post)
 {
+	struct solr_connection *conn = post->conn;
+
 	if (response->status / 100 != 2) {
-		e_error(post->conn->event,
+		e_error(conn->event,
 			"fts-solr: Indexing failed: %s",
 			http_response_get_message(response));
 		post->request_status = -1;
 	}
+
+	if (post->async) {
+		i_assert(conn->pending_posts > 0);
+		conn->pending_posts--;
+		if (post->request_status < 0)
+			conn->pending_post_failed = TRUE;
+		i_free(post);
+	}
 }
 
 static struct http_client_request *
@@ -307,6 +390,117 @@ int solr_connection_post_end(struct solr_connection_post **_post)
 	return ret;
 }
 
+static struct istream *
+solr_connection_post_payload(struct solr_connection *conn,
+			     const unsigned char *data, size_t size)
+{
+	struct ostream *output, *zoutput;
+	struct istream *input;
+	buffer_t *buf;
+
+	if (conn->gz_handler == NULL)
+		return i_stream_create_copy_from_data(data, size);
+
+	buf = buffer_create_dynamic(default_pool, size / 4 + 64);
+	output = o_stream_create_buffer(buf);
+	zoutput = conn->gz_handler->create_ostream(output,
+		conn->gz_handler->get_default_level());
+	o_stream_nsend(zoutput, data, size);
+	if (o_stream_finish(zoutput) < 0) {
+		i_panic("gzip to buffer failed: %s",
+			o_stream_get_error(zoutput));
+	}
+	o_stream_destroy(&zoutput);
+	o_stream_destroy(&output);
+
+	input = i_stream_create_copy_from_buffer(buf);
+	buffer_free(&buf);
+	return input;
+}
+
+static bool solr_connection_post_pushed(struct solr_connection *conn)
+{
+	return conn->pending_posts == 0 ||
+		!i_stream_have_bytes_left(conn->push_payload);
+}
+
+static void solr_connection_post_push_check(struct solr_connection *conn)
+{
+	if (solr_connection_post_pushed(conn))
+		io_loop_stop(current_ioloop);
+}
+
+/* Run the HTTP client until the payload has been written, so that Solr can
+   process it while the caller builds the next batch. */
+static void
+solr_connection_post_push(struct solr_connection *conn,
+			  struct istream *payload)
+{
+	struct ioloop *prev_ioloop = current_ioloop, *ioloop;
+	struct ioloop *prev_client_ioloop;
+	struct timeout *to;
+
+	conn->push_payload = payload;
+	ioloop = io_loop_create();
+	prev_client_ioloop = http_client_switch_ioloop(solr_http_client);
+	to = timeout_add_short(SOLR_POST_PUSH_CHECK_MSECS,
+			       solr_connection_post_push_check, conn);
+	while (!solr_connection_post_pushed(conn))
+		io_loop_run(ioloop);
+	timeout_remove(&to);
+	conn->push_payload = NULL;
+
+	io_loop_set_current(prev_client_ioloop != NULL ?
+			    prev_client_ioloop : prev_ioloop);
+	(void)http_client_switch_ioloop(solr_http_client);
+	io_loop_set_current(ioloop);
+	io_loop_destroy(&ioloop);
+}
+
+int solr_connection_post_async(struct solr_connection *conn,
+			       const unsigned char *data, size_t size)
+{
+	struct solr_connection_post *post;
+	struct istream *payload;
+
+	i_assert(!conn->posting);
+
+	if (conn->pending_posts >= SOLR_MAX_PENDING_POSTS)
+		http_client_wait(solr_http_client);
+	if (conn->pending_post_failed)
+		return -1;
+
+	post = i_new(struct solr_connection_post, 1);
+	post->conn = conn;
+	post->async = TRUE;
+	post->http_req = solr_connection_post_request(post);
+	if (conn->gz_handler != NULL) {
+		http_client_request_add_header(post->http_req,
+					       "Content-Encoding", "gzip");
+	}
+	payload = solr_connection_post_payload(conn, data, size);
+	http_client_request_set_payload(post->http_req, payload, FALSE);
+	http_client_request_submit(post->http_req);
+	conn->pending_posts++;
+
+	solr_connection_post_push(conn, payload);
+	i_stream_unref(&payload);
+	return 0;
+}
+
+int solr_connection_post_wait(struct solr_connection *conn)
+{
+	if (conn->pending_posts > 0)
+		http_client_wait(solr_http_client);
+	i_assert(conn->pending_posts == 0);
+
+	if (conn->pending_post_failed) {
+		conn->pending_post_failed = FALSE;
+		return -1;
+	}
+	return 0;
+}
+
 int solr_connection_post(struct solr_connection *conn, const char *cmd)
 {
 	struct istream *post_payload;
@@ -314,6 +508,10 @@ int solr_connection_post(struct solr_connection *conn, const char *cmd)
 
 	i_assert(!conn->posting);
 
+	/* keep the updates in order */
+	if (solr_connection_post_wait(conn) < 0)
+		return -1;
+
 	i_zero(&post);
 	post.conn = conn;
 
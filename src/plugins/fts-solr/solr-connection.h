@@ -13,9 +13,36 @@ int solr_connection_init(const struct fts_solr_settings *solr_set,
 			 const char **error_r);
 void solr_connection_deinit(struct solr_connection **conn);
 
+/* Called when a lookup has finished. ret is -1 if the lookup failed. */
+typedef void
+solr_lookup_callback_t(int ret, struct solr_result **results, void *context);
+
 int solr_connection_select(struct solr_connection *conn, const char *query,
 			   pool_t pool, struct solr_result ***box_results_r);
+/* Submit a lookup without waiting for it to finish. Multiple lookups can be
+   in flight at the same time. The callbacks are called from
+   solr_connection_wait(). */
+void solr_connection_select_submit(struct solr_connection *conn,
+				   const char *query, pool_t pool,
+				   solr_lookup_callback_t *callback,
+				   void *context);
+#define solr_connection_select_submit(conn, query, pool, callback, context) \
+	solr_connection_select_submit(conn, query, pool, \
+		(solr_lookup_callback_t *)callback, \
+		TRUE ? context : CALLBACK_TYPECHECK(callback, \
+			void (*)(int, struct solr_result **, typeof(context))))
+/* Wait until all submitted lookups have finished. */
+void solr_connection_wait(struct solr_connection *conn);
 int solr_connection_post(struct solr_connection *conn, const char *cmd);
+/* Send a complete update command without waiting for the reply. The data is
+   copied, so the caller can start building the next command right away.
+   Only a couple of commands are pending at a time. Returns -1
+   if an earlier pending command has failed. */
+int solr_connection_post_async(struct solr_connection *conn,
+			       const unsigned char *data, size_t size);
+/* Wait for all the pending update commands. Returns -1 if any of them
+   failed. */
+int solr_connection_post_wait(struct solr_connection *conn);
 
 struct solr_connection_post *
 solr_connection_post_begin(struct solr_connection *conn);
@@ -4,6 +4,7 @@
 #include "array.h"
 #include "crc32.h"
 #include "hash.h"
+#include "ioloop.h"
 #include "istream.h"
 #include "write-full.h"
 #include "seq-range-array.h"
@@ -11,10 +12,17 @@
 #include "fts-expunge-log.h"
 #include "fts-api-private.h"
 
+#include <stdio.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+/* Compact the log once it has grown to this size, and after that whenever
+   it has doubled in size since the previous compaction. */
+#define FTS_EXPUNGE_LOG_COMPACT_MIN_SIZE (64*1024)
+/* A compaction lock file older than this is assumed to be stale */
+#define FTS_EXPUNGE_LOG_COMPACT_LOCK_STALE_SECS 60
+
 struct fts_expunge_log_record {
 	/* CRC32 of this entire record (except this checksum) */
 	uint32_t checksum;
@@ -36,6 +44,9 @@ struct fts_expunge_log {
 	int fd;
 	struct stat st;
 	struct event *event;
+
+	/* Size of the log after it was last compacted by this process */
+	uoff_t compacted_size;
 };
 
 struct fts_expunge_log_mailbox {
@@ -304,12 +315,20 @@ fts_expunge_log_export(struct fts_expunge_log_append_ctx *ctx,
 	hash_table_iterate_deinit(&iter);
 }
 
+static bool fts_expunge_log_need_compact(struct fts_expunge_log *log,
+					 uoff_t size)
+{
+	return size >= FTS_EXPUNGE_LOG_COMPACT_MIN_SIZE &&
+		size >= log->compacted_size * 2;
+}
+
 static int
 fts_expunge_log_write(struct fts_expunge_log_append_ctx *ctx)
 {
 	struct fts_expunge_log *log = ctx->log;
 	buffer_t *buf;
 	uint32_t expunge_count, *e;
+	uoff_t new_size;
 	int ret;
 
 	/* Unbacked expunge logs cannot be written, by definition */
@@ -343,6 +362,7 @@ fts_expunge_log_write(struct fts_expunge_log_append_ctx *ctx)
 		*e -= expunge_count;
 		expunge_count = 0;
 	}
+	new_size = log->st.st_size + buf->used;
 	buffer_free(&buf);
 
 	if (ret == 0) {
@@ -357,6 +377,8 @@ fts_expunge_log_write(struct fts_expunge_log_append_ctx *ctx)
 		}
 		log->fd = -1;
 	}
+	if (ret == 0 && fts_expunge_log_need_compact(log, new_size))
+		(void)fts_expunge_log_compact(log);
 	return ret;
 }
 
@@ -582,6 +604,109 @@ int fts_expunge_log_append_remove(struct fts_expunge_log_append_ctx *from,
 	mailbox->uids_count -= seq_range_array_remove_seq_range(&mailbox->uids, &record->uids);
 	return 1;
 }
+static int fts_expunge_log_compact_lock(struct fts_expunge_log *log,
+					const char *lock_path, int *fd_r)
+{
+	struct stat st;
+
+	*fd_r = open(lock_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (*fd_r != -1)
+		return 1;
+	if (errno != EEXIST) {
+		e_error(log->event, "open(%s) failed: %m", lock_path);
+		return -1;
+	}
+	/* someone else is compacting the log. if the lock is stale, delete it
+	   so the next append gets to compact. */
+	if (stat(lock_path, &st) < 0) {
+		if (errno != ENOENT)
+			e_error(log->event, "stat(%s) failed: %m", lock_path);
+	} else if (st.st_mtime < ioloop_time - FTS_EXPUNGE_LOG_COMPACT_LOCK_STALE_SECS) {
+		i_unlink_if_exists(lock_path);
+	}
+	return 0;
+}
+
+static int
+fts_expunge_log_compact_write(struct fts_expunge_log *log,
+			      struct fts_expunge_log_append_ctx *flat,
+			      const char *lock_path, int fd)
+{
+	struct stat st;
+	buffer_t *buf;
+	int ret = 0;
+
+	buf = buffer_create_dynamic(default_pool, 1024);
+	fts_expunge_log_export(flat, 0, buf);
+	if (write_full(fd, buf->data, buf->used) < 0) {
+		e_error(log->event, "write(%s) failed: %m", lock_path);
+		ret = -1;
+	} else if (rename(lock_path, log->path) < 0) {
+		e_error(log->event, "rename(%s, %s) failed: %m",
+			lock_path, log->path);
+		ret = -1;
+	} else if (fstat(fd, &st) == 0) {
+		log->compacted_size = st.st_size;
+	}
+	buffer_free(&buf);
+	return ret;
+}
+
+int fts_expunge_log_compact(struct fts_expunge_log *log)
+{
+	struct fts_expunge_log *old_log;
+	struct fts_expunge_log_read_ctx *read_ctx;
+	struct fts_expunge_log_append_ctx *flat, *tail;
+	const struct fts_expunge_log_read_record *record;
+	const char *lock_path;
+	int fd, ret;
+
+	lock_path = t_strconcat(log->path, ".compact", NULL);
+	if ((ret = fts_expunge_log_compact_lock(log, lock_path, &fd)) <= 0)
+		return ret;
+
+	/* merge all the records into one per mailbox */
+	old_log = fts_expunge_log_init(log->path, log->event);
+	read_ctx = fts_expunge_log_read_begin(old_log);
+	read_ctx->unlink = FALSE;
+	flat = fts_expunge_log_append_begin(NULL, log->event);
+	while ((record = fts_expunge_log_read_next(read_ctx)) != NULL)
+		fts_expunge_log_append_record(flat, record);
+	if (read_ctx->failed || read_ctx->corrupted)
+		ret = -1;
+	else if (read_ctx->input == NULL)
+		ret = 0;
+	else
+		ret = fts_expunge_log_compact_write(log, flat, lock_path, fd);
+	(void)fts_expunge_log_append_abort(&flat);
+	if (close(fd) < 0)
+		e_error(log->event, "close(%s) failed: %m", lock_path);
+
+	if (ret == 0 && read_ctx->input != NULL) {
+		/* copy the records that were appended to the old file while
+		   it was being compacted. appenders that noticed the file was
+		   replaced have written their records again, so this may
+		   duplicate some UIDs. That's harmless. */
+		tail = fts_expunge_log_append_begin(log, log->event);
+		while ((record = fts_expunge_log_read_next(read_ctx)) != NULL)
+			fts_expunge_log_append_record(tail, record);
+		if (hash_table_count(tail->mailboxes) > 0)
+			ret = fts_expunge_log_append_commit(&tail);
+		else
+			(void)fts_expunge_log_append_abort(&tail);
+		/* the old file is already replaced - don't let a corrupted
+		   tail unlink the compacted log */
+		read_ctx->corrupted = FALSE;
+		e_debug(log->event, "Compacted fts expunge log %s to %"PRIuUOFF_T" bytes",
+			log->path, log->compacted_size);
+	}
+	if (ret < 0 || read_ctx->input == NULL)
+		i_unlink_if_exists(lock_path);
+	(void)fts_expunge_log_read_end(&read_ctx);
+	fts_expunge_log_deinit(&old_log);
+	return ret < 0 ? -1 : 1;
+}
+
 int fts_expunge_log_subtract(struct fts_expunge_log_append_ctx *from,
 			     struct fts_expunge_log *subtract)
 {
@@ -32,6 +32,12 @@ int fts_expunge_log_append_commit(struct fts_expunge_log_append_ctx **ctx);
 /* Do not commit non-backed structures, abort them after use. */
 int fts_expunge_log_append_abort(struct fts_expunge_log_append_ctx **ctx);
 
+/* Rewrite the log so that it has only a single record per mailbox. This is
+   done automatically by appending once the log has grown large enough.
+   Returns 1 if compacted, 0 if someone else is already compacting the log,
+   -1 on error. */
+int fts_expunge_log_compact(struct fts_expunge_log *log);
+
 int fts_expunge_log_uid_count(struct fts_expunge_log *log,
 			      unsigned int *expunges_r);
 
@@ -0,0 +1,331 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "lib.h"
+#include "buffer.h"
+#include "istream.h"
+#include "hex-binary.h"
+#include "sha2.h"
+#include "str-parse.h"
+#include "module-context.h"
+#include "iostream-ssl.h"
+#include "fs-api.h"
+#include "message-parser.h"
+#include "mail-user.h"
+#include "fts-parser.h"
+
+#define FTS_PARSER_CACHE_USER_CONTEXT(obj) \
+	MODULE_CONTEXT(obj, fts_parser_cache_user_module)
+
+/* Both the parser input and its output are kept in memory until the parsing
+   is finished. Larger attachments are passed through uncached. */
+#define FTS_PARSER_CACHE_MAX_SIZE_DEFAULT (10*1024*1024)
+
+struct fts_parser_cache_user {
+	union mail_user_module_context module_ctx;
+	/* NULL if fts_parser_cache isn't set */
+	const char *fs_str;
+	uoff_t max_size;
+};
+
+struct cache_fts_parser {
+	struct fts_parser parser;
+	struct fts_parser *inner;
+	struct event *event;
+	uoff_t max_size;
+
+	struct sha256_ctx hash_ctx;
+	/* Input buffered until the whole part is seen. NULL once it has been
+	   given to the inner parser. */
+	buffer_t *input;
+	/* Either the output read from the cache, or the output of the inner
+	   parser collected for writing to the cache. */
+	buffer_t *output;
+	size_t output_pos;
+	char *path;
+
+	bool input_finished:1;
+	bool output_finished:1;
+	bool cache_hit:1;
+	bool uncacheable:1;
+};
+
+static struct fs *fts_parser_cache_fs = NULL;
+static char *fts_parser_cache_fs_str = NULL;
+static MODULE_CONTEXT_DEFINE_INIT(fts_parser_cache_user_module,
+				  &mail_user_module_register);
+
+static struct fts_parser_cache_user *
+fts_parser_cache_user_get(struct mail_user *user)
+{
+	struct fts_parser_cache_user *cuser =
+		FTS_PARSER_CACHE_USER_CONTEXT(user);
+	const char *fs_str, *value, *error;
+
+	if (cuser != NULL)
+		return cuser;
+
+	cuser = p_new(user->pool, struct fts_parser_cache_user, 1);
+	MODULE_CONTEXT_SET(user, fts_parser_cache_user_module, cuser);
+
+	fs_str = mail_user_plugin_getenv(user, "fts_parser_cache");
+	if (fs_str == NULL || *fs_str == '\0')
+		return cuser;
+
+	cuser->max_size = FTS_PARSER_CACHE_MAX_SIZE_DEFAULT;
+	value = mail_user_plugin_getenv(user, "fts_parser_cache_max_size");
+	if (value != NULL &&
+	    str_parse_get_size(value, &cuser->max_size, &error) < 0) {
+		e_error(user->event,
+			"fts_parser_cache_max_size: Invalid value '%s': %s",
+			value, error);
+		return cuser;
+	}
+	if (cuser->max_size == 0)
+		return cuser;
+	cuser->fs_str = p_strdup(user->pool, fs_str);
+	return cuser;
+}
+
+static struct fs *fts_parser_cache_get_fs(struct mail_user *user,
+					  const char *fs_str)
+{
+	struct fs_settings fs_set;
+	struct ssl_iostream_settings ssl_set;
+	const char *error;
+
+	if (fts_parser_cache_fs != NULL &&
+	    strcmp(fts_parser_cache_fs_str, fs_str) == 0)
+		return fts_parser_cache_fs;
+
+	/* the fs is shared by all users of the process, like the Tika HTTP
+	   client. it's recreated only if the setting changes. */
+	if (fts_parser_cache_fs != NULL)
+		fs_deinit(&fts_parser_cache_fs);
+	i_free(fts_parser_cache_fs_str);
+
+	i_zero(&fs_set);
+	i_zero(&ssl_set);
+	mail_user_init_fs_settings(user, &fs_set, &ssl_set);
+	if (fs_init_from_string(fs_str, &fs_set, &fts_parser_cache_fs,
+				&error) < 0) {
+		e_error(user->event, "fts_parser_cache: fs_init(%s) failed: %s",
+			fs_str, error);
+		return NULL;
+	}
+	fts_parser_cache_fs_str = i_strdup(fs_str);
+	return fts_parser_cache_fs;
+}
+
+static void
+fts_parser_cache_inner_more(struct cache_fts_parser *parser,
+			    const unsigned char *data, size_t size)
+{
+	struct message_block block;
+
+	i_zero(&block);
+	block.data = data;
+	block.size = size;
+	parser->inner->v.more(parser->inner, &block);
+}
+
+static void fts_parser_cache_input_flush(struct cache_fts_parser *parser)
+{
+	size_t pos, size;
+
+	for (pos = 0; pos < parser->input->used; pos += size) {
+		size = I_MIN(parser->input->used - pos, IO_BLOCK_SIZE);
+		fts_parser_cache_inner_more(parser,
+			CONST_PTR_OFFSET(parser->input->data, pos), size);
+	}
+	buffer_free(&parser->input);
+}
+
+static int fts_parser_cache_read(struct cache_fts_parser *parser)
+{
+	struct fs_file *file;
+	struct istream *input;
+	const unsigned char *data;
+	size_t size;
+	int ret;
+
+	file = fs_file_init_with_event(fts_parser_cache_fs, parser->event,
+				       parser->path, FS_OPEN_MODE_READONLY);
+	input = fs_read_stream(file, IO_BLOCK_SIZE);
+	while ((ret = i_stream_read_more(input, &data, &size)) > 0) {
+		buffer_append(parser->output, data, size);
+		i_stream_skip(input, size);
+	}
+	i_assert(ret == -1);
+
+	if (input->stream_errno == 0)
+		ret = 1;
+	else if (input->stream_errno == ENOENT)
+		ret = 0;
+	else {
+		e_error(parser->event, "fts_parser_cache: read(%s) failed: %s",
+			i_stream_get_name(input), i_stream_get_error(input));
+		ret = -1;
+	}
+	i_stream_unref(&input);
+	fs_file_deinit(&file);
+	if (ret <= 0)
+		buffer_set_used_size(parser->output, 0);
+	return ret;
+}
+
+static void fts_parser_cache_write(struct cache_fts_parser *parser)
+{
+	struct fs_file *file;
+
+	file = fs_file_init_with_event(fts_parser_cache_fs, parser->event,
+				       parser->path, FS_OPEN_MODE_REPLACE);
+	if (fs_write(file, parser->output->data, parser->output->used) < 0) {
+		e_error(parser->event, "fts_parser_cache: write(%s) failed: %s",
+			parser->path, fs_file_last_error(file));
+	}
+	fs_file_deinit(&file);
+}
+
+static void fts_parser_cache_lookup(struct cache_fts_parser *parser)
+{
+	unsigned char digest[SHA256_RESULTLEN];
+	const char *hash;
+
+	sha256_result(&parser->hash_ctx, digest);
+	hash = binary_to_hex(digest, sizeof(digest));
+	parser->path = i_strdup_printf("%c%c/%s", hash[0], hash[1], hash);
+
+	if (fts_parser_cache_read(parser) > 0) {
+		e_debug(parser->event,
+			"fts_parser_cache: Using cached text for %s (%zu bytes)",
+			parser->path, parser->output->used);
+		parser->cache_hit = TRUE;
+		buffer_free(&parser->input);
+		return;
+	}
+	fts_parser_cache_input_flush(parser);
+}
+
+static void fts_parser_cache_more(struct fts_parser *_parser,
+				  struct message_block *block)
+{
+	struct cache_fts_parser *parser = (struct cache_fts_parser *)_parser;
+
+	if (block->size > 0) {
+		i_assert(!parser->input_finished);
+		if (parser->input == NULL) {
+			/* too large to be cached */
+			parser->inner->v.more(parser->inner, block);
+			return;
+		}
+		if (parser->input->used + block->size > parser->max_size) {
+			parser->uncacheable = TRUE;
+			fts_parser_cache_input_flush(parser);
+			parser->inner->v.more(parser->inner, block);
+			return;
+		}
+		sha256_loop(&parser->hash_ctx, block->data, block->size);
+		buffer_append(parser->input, block->data, block->size);
+		block->size = 0;
+		return;
+	}
+
+	if (!parser->input_finished) {
+		parser->input_finished = TRUE;
+		if (!parser->uncacheable)
+			fts_parser_cache_lookup(parser);
+	}
+
+	if (parser->cache_hit) {
+		block->data = CONST_PTR_OFFSET(parser->output->data,
+					       parser->output_pos);
+		block->size = I_MIN(parser->output->used - parser->output_pos,
+				    IO_BLOCK_SIZE);
+		parser->output_pos += block->size;
+		return;
+	}
+
+	parser->inner->v.more(parser->inner, block);
+	if (parser->uncacheable)
+		;
+	else if (block->size == 0)
+		parser->output_finished = TRUE;
+	else if (parser->output->used + block->size > parser->max_size) {
+		parser->uncacheable = TRUE;
+		buffer_free(&parser->output);
+	} else {
+		buffer_append(parser->output, block->data, block->size);
+	}
+}
+
+static int fts_parser_cache_deinit(struct fts_parser *_parser,
+				   const char **retriable_err_msg_r)
+{
+	struct cache_fts_parser *parser = (struct cache_fts_parser *)_parser;
+	int ret;
+
+	if (parser->input != NULL) {
+		/* input wasn't finished - let the inner parser see it anyway
+		   so it gets deinitialized in a consistent state */
+		parser->uncacheable = TRUE;
+		fts_parser_cache_input_flush(parser);
+	}
+	ret = fts_parser_deinit(&parser->inner, retriable_err_msg_r);
+
+	/* An empty output is cached as well. This way content that the
+	   parser can't handle (e.g. Tika's 415 Unsupported Media Type) isn't
+	   sent to it again. Retriable failures are never cached. */
+	if (ret > 0 && !parser->cache_hit && !parser->uncacheable &&
+	    parser->output_finished)
+		fts_parser_cache_write(parser);
+
+	buffer_free(&parser->output);
+	event_unref(&parser->event);
+	i_free(parser->path);
+	i_free(parser);
+	return ret;
+}
+
+static void fts_parser_cache_unload(void)
+{
+	if (fts_parser_cache_fs != NULL)
+		fs_deinit(&fts_parser_cache_fs);
+	i_free(fts_parser_cache_fs_str);
+}
+
+struct fts_parser_vfuncs fts_parser_cache = {
+	NULL,
+	fts_parser_cache_more,
+	fts_parser_cache_deinit,
+	fts_parser_cache_unload
+};
+
+struct fts_parser *
+fts_parser_cache_wrap(struct fts_parser_context *parser_context,
+		      struct fts_parser *inner)
+{
+	struct fts_parser_cache_user *cuser =
+		fts_parser_cache_user_get(parser_context->user);
+	struct cache_fts_parser *parser;
+
+	if (cuser->fs_str == NULL ||
+	    fts_parser_cache_get_fs(parser_context->user, cuser->fs_str) == NULL)
+		return inner;
+
+	parser = i_new(struct cache_fts_parser, 1);
+	parser->parser.v = fts_parser_cache;
+	parser->inner = inner;
+	parser->event = event_create(parser_context->event != NULL ?
+				     parser_context->event :
+				     parser_context->user->event);
+	parser->max_size = cuser->max_size;
+	parser->input = buffer_create_dynamic(default_pool, IO_BLOCK_SIZE);
+	parser->output = buffer_create_dynamic(default_pool, IO_BLOCK_SIZE);
+
+	/* the extracted text depends on the content type as well as on the
+	   content itself */
+	sha256_init(&parser->hash_ctx);
+	sha256_loop(&parser->hash_ctx, parser_context->content_type,
+		    strlen(parser_context->content_type) + 1);
+	return &parser->parser;
+}
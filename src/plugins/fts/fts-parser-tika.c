@@ -3,6 +3,7 @@
 #include "lib.h"
 #include "ioloop.h"
 #include "istream.h"
+#include "hash.h"
 #include "module-context.h"
 #include "iostream-ssl.h"
 #include "http-url.h"
@@ -27,11 +28,15 @@ struct tika_fts_parser {
 	struct ioloop *ioloop;
 	struct io *io;
 	struct istream *payload;
+	char *content_type;
 
 	bool failed;
 };
 
 static struct http_client *tika_http_client = NULL;
+/* Content types that Tika has answered with 415 Unsupported Media Type.
+   They're not sent to it again by this process. */
+static HASH_TABLE(char *, char *) tika_unsupported_content_types;
 static MODULE_CONTEXT_DEFINE_INIT(fts_parser_tika_user_module,
 				  &mail_user_module_register);
 
@@ -109,8 +114,21 @@ fts_tika_parser_response(const struct http_response *response,
 			parser->payload = response->payload;
 		}
 		break;
-	case 204: /* empty response */
 	case 415: /* Unsupported Media Type */
+		if (!hash_table_is_created(tika_unsupported_content_types)) {
+			hash_table_create(&tika_unsupported_content_types,
+					  default_pool, 0, strcase_hash,
+					  strcasecmp);
+		}
+		if (parser->content_type != NULL &&
+		    hash_table_lookup(tika_unsupported_content_types,
+				      parser->content_type) == NULL) {
+			char *content_type = i_strdup(parser->content_type);
+			hash_table_insert(tika_unsupported_content_types,
+					  content_type, content_type);
+		}
+		/* fall through */
+	case 204: /* empty response */
 	case 422: /* Unprocessable Entity */
 		e_debug(parser->user->event, "fts_tika: PUT %s failed: %s",
 			mail_user_plugin_getenv(parser->user, "fts_tika"),
@@ -151,12 +169,17 @@ fts_parser_tika_try_init(struct fts_parser_context *parser_context)
 
 	if (tika_get_http_client_url(parser_context, &http_url) < 0)
 		return NULL;
+	if (hash_table_is_created(tika_unsupported_content_types) &&
+	    hash_table_lookup(tika_unsupported_content_types,
+			      parser_context->content_type) != NULL)
+		return NULL;
 	if (http_url->path == NULL)
 		http_url->path = "/";
 
 	parser = i_new(struct tika_fts_parser, 1);
 	parser->parser.v = fts_parser_tika;
 	parser->user = parser_context->user;
+	parser->content_type = i_strdup(parser_context->content_type);
 
 	http_req = http_client_request(tika_http_client, "PUT",
 			http_url->host.name,
@@ -264,14 +287,26 @@ static int fts_parser_tika_deinit(struct fts_parser *_parser, const char **retri
 		io_loop_set_current(parser->ioloop);
 		io_loop_destroy(&parser->ioloop);
 	}
+	i_free(parser->content_type);
 	i_free(parser);
 	return ret;
 }
 
 static void fts_parser_tika_unload(void)
 {
+	struct hash_iterate_context *iter;
+	char *key, *value;
+
 	if (tika_http_client != NULL)
 		http_client_deinit(&tika_http_client);
+	if (hash_table_is_created(tika_unsupported_content_types)) {
+		iter = hash_table_iterate_init(tika_unsupported_content_types);
+		while (hash_table_iterate(iter, tika_unsupported_content_types,
+					  &key, &value))
+			i_free(key);
+		hash_table_iterate_deinit(&iter);
+		hash_table_destroy(&tika_unsupported_content_types);
+	}
 }
 
 struct fts_parser_vfuncs fts_parser_tika = {
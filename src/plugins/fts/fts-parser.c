@@ -35,8 +35,15 @@ bool fts_parser_init(struct fts_parser_context *parser_context,
 
 	for (i = 0; i < N_ELEMENTS(parsers); i++) {
 		*parser_r = parsers[i]->try_init(parser_context);
-		if (*parser_r != NULL)
-			return TRUE;
+		if (*parser_r == NULL)
+			continue;
+		if (parsers[i] != &fts_parser_html) {
+			/* external parsers are slow enough to be worth
+			   caching */
+			*parser_r = fts_parser_cache_wrap(parser_context,
+							  *parser_r);
+		}
+		return TRUE;
 	}
 	return FALSE;
 }
@@ -124,4 +131,5 @@ void fts_parsers_unload(void)
 		if (parsers[i]->unload != NULL)
 			parsers[i]->unload();
 	}
+	fts_parser_cache.unload();
 }
@@ -30,10 +30,17 @@ struct fts_parser {
 extern struct fts_parser_vfuncs fts_parser_html;
 extern struct fts_parser_vfuncs fts_parser_script;
 extern struct fts_parser_vfuncs fts_parser_tika;
+extern struct fts_parser_vfuncs fts_parser_cache;
 
 bool fts_parser_init(struct fts_parser_context *parser_context,
 		     struct fts_parser **parser_r);
 struct fts_parser *fts_parser_text_init(void);
+/* Wrap the parser so that its output is cached in fts_parser_cache fs,
+   keyed by the hash of the content type and the parser input. Returns the
+   parser itself if caching isn't enabled. */
+struct fts_parser *
+fts_parser_cache_wrap(struct fts_parser_context *parser_context,
+		      struct fts_parser *parser);
 
 /* The parser is initially called with message body blocks. Once message is
    finished, it's still called with incoming size=0 while the parser increases
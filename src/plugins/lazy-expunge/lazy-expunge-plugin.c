@@ -70,6 +70,13 @@ struct lazy_expunge_transaction {
 	char *delayed_internal_errstr;
 	enum mail_error delayed_error;
 
+	/* The result of lazy_expunge_is_internal_mailbox() for the
+	   previously expunged mail's mailbox. Mass expunges are usually
+	   done for mails in the same mailbox. */
+	struct mailbox_list *checked_list;
+	char *checked_vname;
+	bool checked_internal;
+
 	bool copy_only_last_instance;
 };
 
@@ -271,6 +278,23 @@ static bool lazy_expunge_is_internal_mailbox(struct mailbox *box)
 	return FALSE;
 }
 
+static bool
+lazy_expunge_transaction_is_internal_mailbox(struct lazy_expunge_transaction *lt,
+					     struct mailbox *box)
+{
+	if (lt->checked_vname == NULL || lt->checked_list != box->list ||
+	    strcmp(lt->checked_vname, box->vname) != 0) {
+		T_BEGIN {
+			lt->checked_internal =
+				lazy_expunge_is_internal_mailbox(box);
+		} T_END;
+		lt->checked_list = box->list;
+		i_free(lt->checked_vname);
+		lt->checked_vname = i_strdup(box->vname);
+	}
+	return lt->checked_internal;
+}
+
 static void lazy_expunge_set_error(struct lazy_expunge_transaction *lt,
 				   struct mail_storage *storage)
 {
@@ -365,7 +389,7 @@ static void lazy_expunge_mail_expunge(struct mail *_mail)
 		lazy_expunge_set_error(lt, _mail->box->storage);
 		return;
 	}
-	if (lazy_expunge_is_internal_mailbox(real_mail->box)) {
+	if (lazy_expunge_transaction_is_internal_mailbox(lt, real_mail->box)) {
 		mmail->module_ctx.super.expunge(_mail);
 		return;
 	}
@@ -439,6 +463,7 @@ static void lazy_expunge_transaction_free(struct lazy_expunge_transaction *lt)
 	pool_unref(&lt->pool);
 	i_free(lt->delayed_errstr);
 	i_free(lt->delayed_internal_errstr);
+	i_free(lt->checked_vname);
 	i_free(lt);
 }
 
@@ -6,13 +6,19 @@
 #include "istream-seekable.h"
 #include "ostream.h"
 #include "str.h"
+#include "str-parse.h"
+#include "read-full.h"
 #include "mail-user.h"
 #include "index-storage.h"
 #include "index-mail.h"
 #include "compression.h"
+#include "istream-zlib.h"
+#include "ostream-zlib.h"
 #include "mail-compress-plugin.h"
 
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #define MAIL_COMPRESS_CONTEXT(obj) \
 	MODULE_CONTEXT_REQUIRE(obj, mail_compress_storage_module)
@@ -22,6 +28,7 @@
 	MODULE_CONTEXT_REQUIRE(obj, mail_compress_user_module)
 
 #define MAX_INBUF_SIZE (1024*1024)
+#define MAIL_COMPRESS_ZSTD_DICT_MAX_SIZE (1024*1024*10)
 #define MAIL_COMPRESS_MAIL_CACHE_EXPIRE_MSECS (60*1000)
 
 struct mail_compress_mail {
@@ -37,6 +44,12 @@ struct mail_compress_mail_cache {
 	struct istream *input;
 };
 
+struct mail_compress_zstd_dict {
+	unsigned int id;
+	const void *data;
+	size_t size;
+};
+
 struct mail_compress_user {
 	union mail_user_module_context module_ctx;
 
@@ -44,6 +57,12 @@ struct mail_compress_user {
 
 	const struct compression_handler *save_handler;
 	int save_level;
+
+	/* The first dictionary is used for saving. All of them can be used
+	   for reading. */
+	ARRAY(struct mail_compress_zstd_dict) zstd_dicts;
+	/* Save using the seekable zstd format with this frame size */
+	size_t zstd_frame_size;
 };
 
 const char *mail_compress_plugin_version = DOVECOT_ABI_VERSION;
@@ -115,6 +134,78 @@ mail_compress_mail_cache_open(struct mail_compress_user *zuser,
 	}
 }
 
+#ifdef HAVE_ZSTD
+static bool
+mail_compress_zstd_dict_lookup(unsigned int dict_id, const void **dict_r,
+			       size_t *dict_size_r,
+			       struct mail_compress_user *zuser)
+{
+	const struct mail_compress_zstd_dict *dict;
+
+	array_foreach(&zuser->zstd_dicts, dict) {
+		if (dict->id == dict_id) {
+			*dict_r = dict->data;
+			*dict_size_r = dict->size;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+#endif
+
+static struct istream *
+mail_compress_create_istream(struct mail_compress_user *zuser ATTR_UNUSED,
+			     const struct compression_handler *handler,
+			     struct istream *input)
+{
+#ifdef HAVE_ZSTD
+	if (array_is_created(&zuser->zstd_dicts) &&
+	    strcmp(handler->name, "zstd") == 0) {
+		return i_stream_create_zstd_dict(input,
+			mail_compress_zstd_dict_lookup, zuser);
+	}
+#endif
+	return handler->create_istream(input);
+}
+
+static bool
+mail_compress_istream_is_seekable(
+	const struct compression_handler *handler ATTR_UNUSED,
+	struct istream *input ATTR_UNUSED)
+{
+#ifdef HAVE_ZSTD
+	if (strcmp(handler->name, "zstd") == 0)
+		return i_stream_zstd_is_seekable(input);
+#endif
+	return FALSE;
+}
+
+static struct ostream *
+mail_compress_create_ostream(struct mail_compress_user *zuser,
+			     struct ostream *output)
+{
+#ifdef HAVE_ZSTD
+	if (strcmp(zuser->save_handler->name, "zstd") == 0 &&
+	    (zuser->zstd_frame_size > 0 ||
+	     array_is_created(&zuser->zstd_dicts))) {
+		const struct mail_compress_zstd_dict *dict =
+			!array_is_created(&zuser->zstd_dicts) ? NULL :
+			array_front(&zuser->zstd_dicts);
+		const void *dict_data = dict == NULL ? NULL : dict->data;
+		size_t dict_size = dict == NULL ? 0 : dict->size;
+
+		if (zuser->zstd_frame_size > 0) {
+			return o_stream_create_zstd_seekable(output,
+				zuser->save_level, zuser->zstd_frame_size,
+				dict_data, dict_size);
+		}
+		return o_stream_create_zstd_dict(output, zuser->save_level,
+						 dict_data, dict_size);
+	}
+#endif
+	return zuser->save_handler->create_ostream(output, zuser->save_level);
+}
+
 static int mail_compress_istream_opened(struct mail *_mail, struct istream **stream)
 {
 	struct mail_compress_user *zuser = MAIL_COMPRESS_USER_CONTEXT(_mail->box->storage->user);
@@ -149,11 +240,14 @@ static int mail_compress_istream_opened(struct mail *_mail, struct istream **str
 		}
 
 		input = *stream;
-		*stream = handler->create_istream(input);
+		*stream = mail_compress_create_istream(zuser, handler, input);
 		i_stream_unref(&input);
-		/* dont cache the stream if _mail->uid is 0 */
-		*stream = mail_compress_mail_cache_open(zuser, _mail, *stream,
-							(_mail->uid > 0));
+		/* seekable compressed streams don't need to be cached, since
+		   seeking is fast. dont cache the stream if _mail->uid is 0 */
+		if (!mail_compress_istream_is_seekable(handler, *stream)) {
+			*stream = mail_compress_mail_cache_open(zuser, _mail,
+					*stream, (_mail->uid > 0));
+		}
 	}
 	return zmail->module_ctx.super.istream_opened(_mail, stream);
 }
@@ -233,8 +327,7 @@ mail_compress_mail_save_compress_begin(struct mail_save_context *ctx,
 	if (zbox->super.save_begin(ctx, input) < 0)
 		return -1;
 
-	output = zuser->save_handler->create_ostream(ctx->data.output,
-						     zuser->save_level);
+	output = mail_compress_create_ostream(zuser, ctx->data.output);
 	o_stream_unref(&ctx->data.output);
 	ctx->data.output = output;
 	o_stream_cork(ctx->data.output);
@@ -333,6 +426,110 @@ static void mail_compress_mail_user_deinit(struct mail_user *user)
 	zuser->module_ctx.super.deinit(user);
 }
 
+#ifdef HAVE_ZSTD
+static int
+mail_compress_zstd_dict_read(struct mail_user *user, const char *path,
+			     struct mail_compress_zstd_dict *dict_r,
+			     const char **error_r)
+{
+	struct stat st;
+	void *data;
+	int fd, ret;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		*error_r = t_strdup_printf("open(%s) failed: %m", path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		*error_r = t_strdup_printf("fstat(%s) failed: %m", path);
+		i_close_fd(&fd);
+		return -1;
+	}
+	if (st.st_size == 0 || st.st_size > MAIL_COMPRESS_ZSTD_DICT_MAX_SIZE) {
+		*error_r = t_strdup_printf("%s: Invalid dictionary size %"PRIuUOFF_T,
+					   path, (uoff_t)st.st_size);
+		i_close_fd(&fd);
+		return -1;
+	}
+	data = p_malloc(user->pool, st.st_size);
+	ret = read_full(fd, data, st.st_size);
+	if (ret <= 0) {
+		*error_r = ret < 0 ?
+			t_strdup_printf("read(%s) failed: %m", path) :
+			t_strdup_printf("read(%s) failed: Unexpected EOF", path);
+		i_close_fd(&fd);
+		return -1;
+	}
+	i_close_fd(&fd);
+
+	dict_r->data = data;
+	dict_r->size = st.st_size;
+	dict_r->id = compression_zstd_dict_get_id(data, st.st_size);
+	if (dict_r->id == 0) {
+		*error_r = t_strdup_printf("%s: Not a trained zstd dictionary",
+					   path);
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+static void
+mail_compress_zstd_dicts_init(struct mail_compress_user *zuser ATTR_UNUSED,
+			      struct mail_user *user)
+{
+	const char *set_name, *path;
+	unsigned int i;
+
+	for (i = 1;; i++) {
+		set_name = i == 1 ? "mail_compress_zstd_dict" :
+			t_strdup_printf("mail_compress_zstd_dict%u", i);
+		path = mail_user_plugin_getenv(user, set_name);
+		if (path == NULL || path[0] == '\0')
+			break;
+#ifdef HAVE_ZSTD
+		struct mail_compress_zstd_dict dict;
+		const char *error;
+
+		if (mail_compress_zstd_dict_read(user, path, &dict, &error) < 0) {
+			e_error(user->event, "%s: %s", set_name, error);
+			continue;
+		}
+		if (!array_is_created(&zuser->zstd_dicts))
+			p_array_init(&zuser->zstd_dicts, user->pool, 4);
+		array_push_back(&zuser->zstd_dicts, &dict);
+#else
+		e_error(user->event, "%s: Support not compiled in for zstd",
+			set_name);
+		break;
+#endif
+	}
+}
+
+static void
+mail_compress_zstd_frame_size_init(struct mail_compress_user *zuser,
+				   struct mail_user *user)
+{
+	const char *value, *error;
+	uoff_t frame_size;
+
+	value = mail_user_plugin_getenv(user, "mail_compress_zstd_frame_size");
+	if (value == NULL || value[0] == '\0')
+		return;
+	if (str_parse_get_size(value, &frame_size, &error) < 0) {
+		e_error(user->event,
+			"mail_compress_zstd_frame_size: Invalid value '%s': %s",
+			value, error);
+	} else if (frame_size > (uint32_t)-1) {
+		e_error(user->event,
+			"mail_compress_zstd_frame_size: Too large value '%s'",
+			value);
+	} else {
+		zuser->zstd_frame_size = frame_size;
+	}
+}
+
 static void mail_compress_mail_user_created(struct mail_user *user)
 {
 	struct mail_user_vfuncs *v = user->vlast;
@@ -372,6 +569,8 @@ static void mail_compress_mail_user_created(struct mail_user *user)
 	} else if (zuser->save_handler != NULL) {
 		zuser->save_level = zuser->save_handler->get_default_level();
 	}
+	mail_compress_zstd_dicts_init(zuser, user);
+	mail_compress_zstd_frame_size_init(zuser, user);
 	MODULE_CONTEXT_SET(user, mail_compress_user_module, zuser);
 }
 
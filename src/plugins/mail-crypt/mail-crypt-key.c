@@ -1,6 +1,7 @@
 /* Copyright (c) 2015-2018 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "ioloop.h"
 #include "str.h"
 #include "dict.h"
 #include "array.h"
@@ -24,6 +25,20 @@ struct mail_crypt_key_cache_entry {
 	struct dcrypt_keypair pair;
 };
 
+/* Key cache of the last deinitialized user. It's kept for
+   mail_crypt_key_cache_ttl, so that the user's next session in the same
+   process doesn't need to decrypt the private keys again. */
+struct mail_crypt_key_process_cache {
+	char *username;
+	/* SHA256 of mail_crypt_private_password. The keys are given only to
+	   a session with the same password. */
+	unsigned char password_hash[SHA256_RESULTLEN];
+	struct mail_crypt_key_cache_entry *keys;
+	struct timeout *to;
+};
+
+static struct mail_crypt_key_process_cache mail_crypt_process_cache;
+
 static
 int mail_crypt_get_key_cache(struct mail_crypt_key_cache_entry *cache,
 			     const char *pubid,
@@ -115,6 +130,91 @@ void mail_crypt_key_cache_destroy(struct mail_crypt_key_cache_entry **cache)
 	}
 }
 
+static void
+mail_crypt_key_cache_password_hash(struct mail_user *user,
+				   unsigned char hash_r[STATIC_ARRAY SHA256_RESULTLEN])
+{
+	const char *pw =
+		mail_user_plugin_getenv(user, MAIL_CRYPT_USERENV_PASSWORD);
+
+	sha256_get_digest(pw == NULL ? "" : pw, pw == NULL ? 0 : strlen(pw),
+			  hash_r);
+}
+
+static void
+mail_crypt_key_process_cache_free(struct mail_crypt_key_process_cache *cache)
+{
+	timeout_remove(&cache->to);
+	mail_crypt_key_cache_destroy(&cache->keys);
+	i_free(cache->username);
+	safe_memset(cache->password_hash, 0, sizeof(cache->password_hash));
+}
+
+void mail_crypt_key_cache_process_deinit(void)
+{
+	mail_crypt_key_process_cache_free(&mail_crypt_process_cache);
+}
+
+void mail_crypt_key_cache_save(struct mail_user *user,
+			       struct mail_crypt_key_cache_entry **cache,
+			       unsigned int ttl_msecs)
+{
+	struct mail_crypt_key_process_cache *pcache = &mail_crypt_process_cache;
+
+	if (ttl_msecs == 0 || *cache == NULL) {
+		mail_crypt_key_cache_destroy(cache);
+		return;
+	}
+	mail_crypt_key_cache_process_deinit();
+
+	pcache->username = i_strdup(user->username);
+	mail_crypt_key_cache_password_hash(user, pcache->password_hash);
+	pcache->keys = *cache;
+	*cache = NULL;
+	pcache->to = timeout_add(ttl_msecs, mail_crypt_key_process_cache_free,
+				 pcache);
+}
+
+void mail_crypt_key_cache_restore(struct mail_user *user,
+				  struct mail_crypt_key_cache_entry **cache_r)
+{
+	struct mail_crypt_key_process_cache *pcache = &mail_crypt_process_cache;
+	unsigned char password_hash[SHA256_RESULTLEN];
+
+	i_assert(*cache_r == NULL);
+
+	if (pcache->keys == NULL ||
+	    strcmp(pcache->username, user->username) != 0) {
+		/* some other user's (e.g. shared mailbox owner's or raw mail
+		   user's) session - leave the cache to expire */
+		return;
+	}
+
+	/* the keys were unlocked with the password, so never give them to
+	   a session that didn't provide the same password */
+	mail_crypt_key_cache_password_hash(user, password_hash);
+	if (mem_equals_timing_safe(pcache->password_hash, password_hash,
+				   sizeof(password_hash))) {
+		e_debug(user->event, "mail-crypt: Reusing cached keys "
+			"from the previous session");
+		*cache_r = pcache->keys;
+		pcache->keys = NULL;
+	}
+	safe_memset(password_hash, 0, sizeof(password_hash));
+	mail_crypt_key_cache_process_deinit();
+}
+
+void mail_crypt_key_cache_invalidate(struct mail_user *user)
+{
+	struct mail_crypt_user *muser = mail_crypt_get_mail_crypt_user(user);
+
+	if (muser != NULL)
+		mail_crypt_key_cache_destroy(&muser->key_cache);
+	if (mail_crypt_process_cache.username != NULL &&
+	    strcmp(mail_crypt_process_cache.username, user->username) == 0)
+		mail_crypt_key_cache_process_deinit();
+}
+
 int mail_crypt_private_key_id_match(struct dcrypt_private_key *key,
 				     const char *pubid, const char **error_r)
 {
@@ -459,6 +559,10 @@ int mail_crypt_set_private_key(struct mailbox_transaction_context *t,
 
 	safe_memset(buffer_get_modifiable_data(data, NULL), 0, data->used);
 
+	/* the user's keys were changed (e.g. password change or rotation),
+	   don't keep using the old ones */
+	if (ret >= 0 && user_key)
+		mail_crypt_key_cache_invalidate(user);
 	return ret;
 }
 
@@ -955,6 +1059,10 @@ int mail_crypt_box_unset_shared_key(struct mailbox_transaction_context *t,
 						    mailbox_transaction_get_mailbox(t),
 						    NULL));
 		}
+	} else {
+		/* the key may be cached in this process */
+		mail_crypt_key_cache_invalidate(mail_storage_get_user(
+			mailbox_get_storage(mailbox_transaction_get_mailbox(t))));
 	}
 
 	return ret;
@@ -27,6 +27,21 @@ struct mail_crypt_key_cache_entry;
  * key cache management functions
  */
 void mail_crypt_key_cache_destroy(struct mail_crypt_key_cache_entry **cache);
+/* Move the user's key cache to a process-wide cache that is kept for
+   ttl_msecs (0 = destroy it). This allows the user's next session in the
+   same process to reuse the already decrypted keys. */
+void mail_crypt_key_cache_save(struct mail_user *user,
+			       struct mail_crypt_key_cache_entry **cache,
+			       unsigned int ttl_msecs);
+/* Take over the process-wide cache if it belongs to the same user with the
+   same password. If the password differs, the process-wide cache is
+   destroyed. Other users' caches are left to expire. */
+void mail_crypt_key_cache_restore(struct mail_user *user,
+				  struct mail_crypt_key_cache_entry **cache_r);
+/* Drop the user's cached keys. This is done automatically when the user's
+   private keys are changed or a shared key is removed. */
+void mail_crypt_key_cache_invalidate(struct mail_user *user);
+void mail_crypt_key_cache_process_deinit(void);
 void mail_crypt_key_register_mailbox_internal_attributes(void);
 
 /* returns -1 on error, 0 not found, 1 = found */
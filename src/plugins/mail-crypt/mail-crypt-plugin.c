@@ -9,6 +9,7 @@
 #include "randgen.h"
 #include "module-dir.h"
 #include "str.h"
+#include "str-parse.h"
 #include "safe-mkstemp.h"
 #include "istream.h"
 #include "istream-decrypt.h"
@@ -71,6 +72,19 @@ static bool mail_crypt_is_stream_encrypted(struct istream *input)
 	return TRUE;
 }
 
+static bool mail_crypt_is_stream_chunked(struct istream *input)
+{
+	const unsigned char *data;
+	size_t size;
+
+	/* the format version follows the magic */
+	if (i_stream_read_data(input, &data, &size,
+			       sizeof(IOSTREAM_CRYPT_MAGIC)) <= 0)
+		return FALSE;
+	return data[sizeof(IOSTREAM_CRYPT_MAGIC)] ==
+		IOSTREAM_CRYPT_VERSION_CHUNKED;
+}
+
 static void mail_crypt_cache_close(struct mail_crypt_user *muser)
 {
 	struct mail_crypt_cache *cache = &muser->cache;
@@ -178,11 +192,15 @@ mail_crypt_istream_opened(struct mail *_mail, struct istream **stream)
 		return mmail->super.istream_opened(_mail, stream);
 
 	input = *stream;
+	bool chunked = input->seekable && mail_crypt_is_stream_chunked(input);
 	*stream = i_stream_create_decrypt_callback(input,
 				mail_crypt_istream_get_private_key, _mail);
 	i_stream_unref(&input);
 
-	*stream = mail_crypt_cache_open(muser, _mail, *stream);
+	/* chunked streams can seek without decrypting everything before
+	   the offset, so there's no need to cache them in a temp file */
+	if (!chunked)
+		*stream = mail_crypt_cache_open(muser, _mail, *stream);
 	return mmail->super.istream_opened(_mail, stream);
 }
 
@@ -263,6 +281,9 @@ mail_crypt_mail_save_begin(struct mail_save_context *ctx,
 			enc_flags = IO_STREAM_ENC_VERSION_1;
 		} else if (muser->save_version == 2) {
 			enc_flags = IO_STREAM_ENC_INTEGRITY_AEAD;
+		} else if (muser->save_version == 3) {
+			enc_flags = IO_STREAM_ENC_INTEGRITY_AEAD |
+				IO_STREAM_ENC_CHUNKED;
 		} else {
 			i_assert(muser->save_version == 0);
 		}
@@ -390,7 +411,8 @@ static void mail_crypt_mail_user_deinit(struct mail_user *user)
 {
 	struct mail_crypt_user *muser = MAIL_CRYPT_USER_CONTEXT_REQUIRE(user);
 
-	mail_crypt_key_cache_destroy(&muser->key_cache);
+	mail_crypt_key_cache_save(user, &muser->key_cache,
+				  muser->key_cache_ttl_msecs);
 	mail_crypt_global_keys_free(&muser->global_keys);
 	mail_crypt_cache_close(muser);
 	muser->module_ctx.super.deinit(user);
@@ -433,19 +455,33 @@ static void mail_crypt_mail_user_created(struct mail_user *user)
 		muser->save_version = 1;
 	} else if (version[0] == '2') {
 		muser->save_version = 2;
+	} else if (version[0] == '3') {
+		muser->save_version = 3;
 	} else {
 		user->error = p_strdup_printf(user->pool,
 				"mail_crypt_plugin: Invalid "
-				"mail_crypt_save_version %s: use 0, 1, or 2 ",
+				"mail_crypt_save_version %s: use 0, 1, 2 or 3 ",
 				version);
 	}
 
+	const char *ttl = mail_user_plugin_getenv(user,
+			"mail_crypt_key_cache_ttl");
+	if (ttl != NULL && *ttl != '\0' &&
+	    str_parse_get_interval_msecs(ttl, &muser->key_cache_ttl_msecs,
+					 &error) < 0) {
+		user->error = p_strdup_printf(user->pool,
+				"mail_crypt_plugin: Invalid "
+				"mail_crypt_key_cache_ttl %s: %s", ttl, error);
+	}
+
 	if (mail_crypt_global_keys_load(user, "mail_crypt_global",
 					&muser->global_keys, FALSE, &error) < 0) {
 		user->error = p_strdup_printf(user->pool,
 				"mail_crypt_plugin: %s", error);
 	}
 
+	mail_crypt_key_cache_restore(user, &muser->key_cache);
+
 	v->deinit = mail_crypt_mail_user_deinit;
 	MODULE_CONTEXT_SET(user, mail_crypt_user_module, muser);
 }
@@ -483,4 +519,5 @@ void mail_crypt_plugin_deinit(void)
 {
 	mail_storage_hooks_remove(&mail_crypt_mail_storage_hooks);
 	mail_storage_hooks_remove(&mail_crypt_mail_storage_hooks_post);
+	mail_crypt_key_cache_process_deinit();
 }
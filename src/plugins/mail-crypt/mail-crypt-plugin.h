@@ -20,6 +20,9 @@ struct mail_crypt_user {
 	struct mail_crypt_key_cache_entry *key_cache;
 	const char *curve;
 	int save_version;
+	/* how long to keep the decrypted keys in the process after the
+	   user is deinitialized */
+	unsigned int key_cache_ttl_msecs;
 };
 
 void mail_crypt_plugin_init(struct module *module);
@@ -206,6 +206,42 @@ static void test_cache_reset(void)
 	test_end();
 }
 
+static void test_cache_session_reuse(void)
+{
+	struct dcrypt_private_key *key;
+	const char *error = NULL;
+
+	test_begin("cache session reuse");
+
+	struct mail_crypt_user *muser =
+		mail_crypt_get_mail_crypt_user(test_ctx->user);
+	test_assert(muser->key_cache != NULL);
+
+	/* disabled */
+	mail_crypt_key_cache_save(test_ctx->user, &muser->key_cache, 0);
+	test_assert(muser->key_cache == NULL);
+	mail_crypt_key_cache_restore(test_ctx->user, &muser->key_cache);
+	test_assert(muser->key_cache == NULL);
+
+	test_assert(mail_crypt_user_get_private_key(test_ctx->user, NULL,
+						    &key, &error) > 0);
+	dcrypt_key_unref_private(&key);
+
+	/* the next session of the same user gets the keys */
+	mail_crypt_key_cache_save(test_ctx->user, &muser->key_cache, 60*1000);
+	test_assert(muser->key_cache == NULL);
+	mail_crypt_key_cache_restore(test_ctx->user, &muser->key_cache);
+	test_assert(muser->key_cache != NULL);
+
+	/* changing keys drops them */
+	mail_crypt_key_cache_save(test_ctx->user, &muser->key_cache, 60*1000);
+	mail_crypt_key_cache_invalidate(test_ctx->user);
+	mail_crypt_key_cache_restore(test_ctx->user, &muser->key_cache);
+	test_assert(muser->key_cache == NULL);
+
+	test_end();
+}
+
 static void test_verify_keys(void)
 {
 	const char *value = "", *error = NULL;
@@ -405,6 +441,7 @@ int main(int argc, char **argv)
 		test_generate_user_key,
 		test_generate_inbox_key,
 		test_cache_reset,
+		test_cache_session_reuse,
 		test_verify_keys,
 		test_old_key,
 		test_teardown,
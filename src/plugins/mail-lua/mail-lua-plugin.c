@@ -162,6 +162,7 @@ void mail_lua_plugin_init(struct module *module)
 void mail_lua_plugin_deinit(void)
 {
 	mail_storage_hooks_remove(&mail_lua_hooks);
+	dlua_script_cache_deinit();
 }
 
 const char *mail_lua_plugin_dependencies[] = { NULL };
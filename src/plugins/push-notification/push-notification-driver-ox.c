@@ -30,8 +30,12 @@ static const char *const default_mboxes[] = { "INBOX", NULL };
 #define DEFAULT_CACHE_LIFETIME_SECS 60
 #define DEFAULT_TIMEOUT_MSECS 2000
 #define DEFAULT_RETRY_COUNT 1
+#define DEFAULT_MAX_PARALLEL_CONNECTIONS 4
+#define DEFAULT_MAX_IDLE_TIME_MSECS (60*1000)
 
-/* This is data that is shared by all plugin users. */
+/* This is data that is shared by all plugin users. The HTTP client (and its
+   connections) is kept for the lifetime of the process, so the notifications
+   are sent in the background without delaying the user deinit. */
 struct push_notification_driver_ox_global {
 	struct http_client *http_client;
 	int refcount;
@@ -46,6 +50,7 @@ struct push_notification_driver_ox_config {
 	bool use_unsafe_username;
 	unsigned int http_max_retries;
 	unsigned int http_timeout_msecs;
+	unsigned int http_max_parallel_connections;
 
 	char *cached_ox_metadata;
 	time_t cached_ox_metadata_timestamp;
@@ -54,6 +59,17 @@ struct push_notification_driver_ox_config {
 /* This is data specific to an OX driver transaction. */
 struct push_notification_driver_ox_txn {
 	const char *unsafe_user;
+
+	/* Mailbox status looked up once for all the transaction's messages */
+	struct mailbox_status box_status;
+	bool box_status_looked_up;
+	bool box_status_failed;
+};
+
+/* This is data specific to a single notification request. It may outlive
+   the user. */
+struct push_notification_driver_ox_request {
+	struct event *event;
 };
 
 static void
@@ -72,6 +88,9 @@ push_notification_driver_ox_init_global(
 		http_set.debug = user->mail_debug;
 		http_set.max_attempts = config->http_max_retries+1;
 		http_set.request_timeout_msecs = config->http_timeout_msecs;
+		http_set.max_parallel_connections =
+			config->http_max_parallel_connections;
+		http_set.max_idle_time_msecs = DEFAULT_MAX_IDLE_TIME_MSECS;
 		http_set.event_parent = user->event;
 		mail_user_init_ssl_client_settings(user, &ssl_set);
 		http_set.ssl = &ssl_set;
@@ -135,6 +154,14 @@ push_notification_driver_ox_init(struct push_notification_driver_config *config,
 	    (str_to_uint(tmp, &dconfig->http_timeout_msecs) < 0)) {
 		dconfig->http_timeout_msecs = DEFAULT_TIMEOUT_MSECS;
 	}
+	tmp = hash_table_lookup(config->config,
+				(const char *)"max_parallel_connections");
+	if ((tmp == NULL) ||
+	    (str_to_uint(tmp, &dconfig->http_max_parallel_connections) < 0) ||
+	    dconfig->http_max_parallel_connections == 0) {
+		dconfig->http_max_parallel_connections =
+			DEFAULT_MAX_PARALLEL_CONNECTIONS;
+	}
 
 	e_debug(dconfig->event, "Using cache lifetime: %u",
 		dconfig->cached_ox_metadata_lifetime_secs);
@@ -294,23 +321,31 @@ push_notification_driver_ox_begin_txn(struct push_notification_driver_txn *dtxn)
 static void
 push_notification_driver_ox_http_callback(
 	const struct http_response *response,
-	struct push_notification_driver_ox_config *dconfig)
+	struct push_notification_driver_ox_request *oreq)
 {
 	switch (response->status / 100) {
 	case 2:
 		// Success.
-		e_debug(dconfig->event, "Notification sent successfully: %s",
+		e_debug(oreq->event, "Notification sent successfully: %s",
 			http_response_get_message(response));
 		break;
 
 	default:
 		// Error.
-		e_error(dconfig->event, "Error when sending notification: %s",
+		e_error(oreq->event, "Error when sending notification: %s",
 			http_response_get_message(response));
 		break;
 	}
 }
 
+static void
+push_notification_driver_ox_request_destroy(
+	struct push_notification_driver_ox_request *oreq)
+{
+	event_unref(&oreq->event);
+	i_free(oreq);
+}
+
 /* Callback needed for i_stream_add_destroy_callback() in
    push_notification_driver_ox_process_msg. */
 static void str_free_i(string_t *str)
@@ -325,12 +360,20 @@ push_notification_driver_ox_get_mailbox_status(
 {
 	struct push_notification_driver_ox_config *dconfig =
 		dtxn->duser->context;
+	struct push_notification_driver_ox_txn *txn = dtxn->context;
 	/* The already opened mailbox. We cannot use or sync it, because we are
 	   within a save transaction. */
 	struct mailbox *mbox = dtxn->ptxn->mbox;
 	struct mailbox *box;
 	int ret;
 
+	/* The messages are processed only after the transaction is committed,
+	   so the status is the same for all of them. */
+	if (txn->box_status_looked_up) {
+		*r_box_status = txn->box_status;
+		return txn->box_status_failed ? -1 : 0;
+	}
+
 	/* Open and sync new instance of the same mailbox to get most recent
 	   status */
 	box = mailbox_alloc(mailbox_get_namespace(mbox)->list,
@@ -350,10 +393,13 @@ push_notification_driver_ox_get_mailbox_status(
 	}
 
 	mailbox_free(&box);
+	txn->box_status_looked_up = TRUE;
+	txn->box_status_failed = ret < 0;
+	if (ret == 0)
+		txn->box_status = *r_box_status;
 	return ret;
 }
 
-
 static void
 push_notification_driver_ox_process_msg(
 	struct push_notification_driver_txn *dtxn,
@@ -363,6 +409,7 @@ push_notification_driver_ox_process_msg(
 		(struct push_notification_driver_ox_config *)
 			dtxn->duser->context;
 	struct http_client_request *http_req;
+	struct push_notification_driver_ox_request *oreq;
 	struct push_notification_event_messagenew_data *messagenew;
 	struct istream *payload;
 	string_t *str;
@@ -383,10 +430,16 @@ push_notification_driver_ox_process_msg(
 
 	push_notification_driver_ox_init_global(user, dconfig);
 
+	oreq = i_new(struct push_notification_driver_ox_request, 1);
+	oreq->event = dconfig->event;
+	event_ref(oreq->event);
+
 	http_req = http_client_request_url(
 		ox_global->http_client, "PUT", dconfig->http_url,
-		push_notification_driver_ox_http_callback, dconfig);
+		push_notification_driver_ox_http_callback, oreq);
 	http_client_request_set_event(http_req, dtxn->ptxn->event);
+	http_client_request_set_destroy_callback(http_req,
+		push_notification_driver_ox_request_destroy, oreq);
 	http_client_request_add_header(http_req, "Content-Type",
 				       "application/json; charset=utf-8");
 
@@ -435,9 +488,9 @@ push_notification_driver_ox_deinit(
 	struct push_notification_driver_ox_config *dconfig = duser->context;
 
 	i_free(dconfig->cached_ox_metadata);
+	/* Don't wait for the pending notifications here. They are finished in
+	   the background, or at the latest in the plugin deinit. */
 	if (ox_global != NULL) {
-		if (ox_global->http_client != NULL)
-			http_client_wait(ox_global->http_client);
 		i_assert(ox_global->refcount > 0);
 		--ox_global->refcount;
 	}
@@ -446,12 +499,25 @@ push_notification_driver_ox_deinit(
 
 static void push_notification_driver_ox_cleanup(void)
 {
-	if ((ox_global != NULL) && (ox_global->refcount <= 0)) {
-		if (ox_global->http_client != NULL) {
-			http_client_deinit(&ox_global->http_client);
-		}
+	/* The HTTP client is preserved for the following users, so their
+	   notifications can reuse its connections. */
+	if ((ox_global != NULL) && (ox_global->refcount <= 0) &&
+	    (ox_global->http_client == NULL))
 		i_free_and_null(ox_global);
+}
+
+void push_notification_driver_ox_deinit_global(void)
+{
+	if (ox_global == NULL)
+		return;
+	i_assert(ox_global->refcount <= 0);
+
+	if (ox_global->http_client != NULL) {
+		/* Finish sending the pending notifications */
+		http_client_wait(ox_global->http_client);
+		http_client_deinit(&ox_global->http_client);
 	}
+	i_free_and_null(ox_global);
 }
 
 /* Driver definition */
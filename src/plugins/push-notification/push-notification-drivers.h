@@ -110,6 +110,9 @@ int push_notification_driver_init(
 	struct mail_user *user, const char *config_in, pool_t pool,
 	struct push_notification_driver_user **duser_r);
 void push_notification_driver_cleanup_all(void);
+/* Wait for the OX driver's pending notifications to be sent and free its
+   process-global HTTP client. */
+void push_notification_driver_ox_deinit_global(void);
 
 void ATTR_FORMAT(3, 4)
 push_notification_driver_debug(const char *label, struct mail_user *user,
@@ -373,6 +373,7 @@ void push_notification_plugin_init(struct module *module)
 
 void push_notification_plugin_deinit(void)
 {
+	push_notification_driver_ox_deinit_global();
 	push_notification_driver_unregister(&push_notification_driver_dlog);
 	push_notification_driver_unregister(&push_notification_driver_ox);
 
@@ -2,9 +2,21 @@
 
 #include "lib.h"
 #include "ioloop.h"
+#include "hash.h"
 #include "mailbox-list-iter.h"
 #include "quota-private.h"
 
+/* These are all normally cached in the mailbox list index */
+#define QUOTA_COUNT_STATUS_ITEMS \
+	(STATUS_UIDVALIDITY | STATUS_UIDNEXT | STATUS_MESSAGES | \
+	 STATUS_HIGHESTMODSEQ)
+
+struct quota_count_mailbox {
+	uint32_t uid_validity, uid_next;
+	uint64_t highest_modseq;
+	uoff_t vsize;
+};
+
 struct count_quota_root {
 	struct quota_root root;
 
@@ -23,6 +35,79 @@ struct quota_mailbox_iter {
 
 extern struct quota_backend quota_backend_count;
 
+static struct quota_count_mailbox *
+quota_count_mailbox_lookup(struct quota_root *root, const char *vname,
+			   const struct mailbox_status *status)
+{
+	struct quota_count_mailbox *cbox;
+
+	if (!hash_table_is_created(root->count_mailboxes))
+		return NULL;
+	cbox = hash_table_lookup(root->count_mailboxes, vname);
+	if (cbox == NULL || status->highest_modseq == 0 ||
+	    cbox->uid_validity != status->uidvalidity ||
+	    cbox->uid_next != status->uidnext ||
+	    cbox->highest_modseq != status->highest_modseq)
+		return NULL;
+	return cbox;
+}
+
+static void
+quota_count_mailbox_update(struct quota_root *root, const char *vname,
+			   const struct mailbox_status *status, uoff_t vsize)
+{
+	struct quota_count_mailbox *cbox;
+
+	if (status->highest_modseq == 0 || status->nonpermanent_modseqs)
+		return;
+
+	if (!hash_table_is_created(root->count_mailboxes)) {
+		hash_table_create(&root->count_mailboxes, root->pool, 0,
+				  str_hash, strcmp);
+	}
+	cbox = hash_table_lookup(root->count_mailboxes, vname);
+	if (cbox == NULL) {
+		cbox = p_new(root->pool, struct quota_count_mailbox, 1);
+		hash_table_insert(root->count_mailboxes,
+				  p_strdup(root->pool, vname), cbox);
+	}
+	cbox->uid_validity = status->uidvalidity;
+	cbox->uid_next = status->uidnext;
+	cbox->highest_modseq = status->highest_modseq;
+	cbox->vsize = vsize;
+}
+
+static int
+quota_count_mailbox_get(struct quota_root *root, struct mailbox *box,
+			uint64_t *bytes, uint64_t *count)
+{
+	struct quota_count_mailbox *cbox;
+	struct mailbox_metadata metadata;
+	struct mailbox_status status;
+
+	/* The status is cheap to get from the mailbox list index. If the
+	   mailbox hasn't changed since it was last counted, its vsize doesn't
+	   need to be looked up again. */
+	if (mailbox_get_status(box, QUOTA_COUNT_STATUS_ITEMS, &status) < 0)
+		return -1;
+	cbox = quota_count_mailbox_lookup(root, box->vname, &status);
+	if (cbox != NULL)
+		metadata.virtual_size = cbox->vsize;
+	else {
+		if (mailbox_get_metadata(box, MAILBOX_METADATA_VIRTUAL_SIZE,
+					 &metadata) < 0)
+			return -1;
+		/* the mailbox may have changed while getting its size */
+		if (mailbox_get_status(box, STATUS_MESSAGES, &status) < 0)
+			return -1;
+		quota_count_mailbox_update(root, box->vname, &status,
+					   metadata.virtual_size);
+	}
+	*bytes += metadata.virtual_size;
+	*count += status.messages;
+	return 0;
+}
+
 static int
 quota_count_mailbox(struct quota_root *root, struct mail_namespace *ns,
 		    const char *vname, uint64_t *bytes, uint64_t *count,
@@ -31,8 +116,6 @@ quota_count_mailbox(struct quota_root *root, struct mail_namespace *ns,
 {
 	struct quota_rule *rule;
 	struct mailbox *box;
-	struct mailbox_metadata metadata;
-	struct mailbox_status status;
 	enum mail_error error;
 	const char *errstr;
 	int ret;
@@ -47,9 +130,7 @@ quota_count_mailbox(struct quota_root *root, struct mail_namespace *ns,
 	if ((box->storage->class_flags & MAIL_STORAGE_CLASS_FLAG_NOQUOTA) != 0) {
 		/* quota doesn't exist for this mailbox/storage */
 		ret = 0;
-	} else if (mailbox_get_metadata(box, MAILBOX_METADATA_VIRTUAL_SIZE,
-					&metadata) < 0 ||
-	    mailbox_get_status(box, STATUS_MESSAGES, &status) < 0) {
+	} else if (quota_count_mailbox_get(root, box, bytes, count) < 0) {
 		errstr = mailbox_get_last_internal_error(box, &error);
 		if (error == MAIL_ERROR_TEMP) {
 			*error_r = t_strdup_printf(
@@ -70,8 +151,6 @@ quota_count_mailbox(struct quota_root *root, struct mail_namespace *ns,
 		}
 	} else {
 		ret = 0;
-		*bytes += metadata.virtual_size;
-		*count += status.messages;
 	}
 	mailbox_free(&box);
 	return ret;
@@ -141,6 +141,8 @@ struct quota_root {
 
 	/* Module-specific contexts. See quota_module_id. */
 	ARRAY(void) quota_module_contexts;
+	/* vname => mailbox's size at the time of the last quota_count() */
+	HASH_TABLE(char *, struct quota_count_mailbox *) count_mailboxes;
 
 	/* don't enforce quota when saving */
 	bool no_enforcing:1;
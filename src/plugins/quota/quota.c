@@ -371,6 +371,7 @@ static void quota_root_deinit(struct quota_root *root)
 
 	if (root->limit_set_dict != NULL)
 		dict_deinit(&root->limit_set_dict);
+	hash_table_destroy(&root->count_mailboxes);
 	event_unref(&root->backend.event);
 	root->backend.v.deinit(root);
 	pool_unref(&pool);
@@ -893,6 +893,122 @@ virtual_sync_backend_handle_old_vmsgs(struct virtual_sync_context *ctx,
 	virtual_sync_bbox_uids_sort(bbox);
 }
 
+static void
+virtual_sync_log_add_uids(struct mail_index_view *view,
+			  uint32_t uid1, uint32_t uid2,
+			  ARRAY_TYPE(seq_range) *uids)
+{
+	uint32_t seq, seq1, seq2, uid;
+
+	/* add only the UIDs that still exist */
+	if (!mail_index_lookup_seq_range(view, uid1, uid2, &seq1, &seq2))
+		return;
+	for (seq = seq1; seq <= seq2; seq++) {
+		mail_index_lookup_uid(view, seq, &uid);
+		seq_range_array_add(uids, uid);
+	}
+}
+
+static void
+virtual_sync_log_add_keyword_update(struct mail_index_view *view,
+				    const struct mail_transaction_header *hdr,
+				    const void *data,
+				    ARRAY_TYPE(seq_range) *uids)
+{
+	const struct mail_transaction_keyword_update *rec = data;
+	const uint32_t *uidp, *end;
+	unsigned int uids_offset;
+
+	uids_offset = sizeof(*rec) + rec->name_size;
+	if ((uids_offset % 4) != 0)
+		uids_offset += 4 - (uids_offset % 4);
+
+	uidp = CONST_PTR_OFFSET(rec, uids_offset);
+	end = CONST_PTR_OFFSET(rec, hdr->size);
+	for (; uidp < end; uidp += 2)
+		virtual_sync_log_add_uids(view, uidp[0], uidp[1], uids);
+}
+
+/* Find the UIDs whose modseq has changed since the given modseq by reading
+   the transaction log. This is much faster than looking up the modseqs of
+   all the messages when only a few of them have changed. Returns TRUE if
+   all the changes were found, FALSE if the log no longer contains them. */
+static bool
+virtual_sync_backend_get_log_changes(struct mail_index_view *view,
+				     uint64_t modseq,
+				     ARRAY_TYPE(seq_range) *uids)
+{
+	struct mail_transaction_log_view *log_view;
+	const struct mail_transaction_header *hdr;
+	const void *data;
+	const char *reason;
+	uint32_t log_seq;
+	uoff_t log_offset;
+	bool reset;
+	int ret;
+
+	if (!mail_index_modseq_get_next_log_offset(view, modseq,
+						   &log_seq, &log_offset))
+		return FALSE;
+
+	log_view = mail_transaction_log_view_open(view->index->log);
+	ret = mail_transaction_log_view_set(log_view, log_seq, log_offset,
+					    view->log_file_head_seq,
+					    view->log_file_head_offset,
+					    &reset, &reason);
+	if (ret <= 0 || reset) {
+		mail_transaction_log_view_close(&log_view);
+		return FALSE;
+	}
+	while ((ret = mail_transaction_log_view_next(log_view, &hdr, &data)) > 0) {
+		switch (hdr->type & MAIL_TRANSACTION_TYPE_MASK) {
+		case MAIL_TRANSACTION_FLAG_UPDATE: {
+			const struct mail_transaction_flag_update *rec, *end;
+
+			end = CONST_PTR_OFFSET(data, hdr->size);
+			for (rec = data; rec < end; rec++) {
+				virtual_sync_log_add_uids(view, rec->uid1,
+							  rec->uid2, uids);
+			}
+			break;
+		}
+		case MAIL_TRANSACTION_KEYWORD_UPDATE:
+			virtual_sync_log_add_keyword_update(view, hdr, data,
+							    uids);
+			break;
+		case MAIL_TRANSACTION_KEYWORD_RESET: {
+			const struct mail_transaction_keyword_reset *rec, *end;
+
+			end = CONST_PTR_OFFSET(data, hdr->size);
+			for (rec = data; rec < end; rec++) {
+				virtual_sync_log_add_uids(view, rec->uid1,
+							  rec->uid2, uids);
+			}
+			break;
+		}
+		case MAIL_TRANSACTION_MODSEQ_UPDATE: {
+			const struct mail_transaction_modseq_update *rec, *end;
+
+			end = CONST_PTR_OFFSET(data, hdr->size);
+			for (rec = data; rec < end; rec++) {
+				/* uid=0 is a highestmodseq update */
+				if (rec->uid != 0) {
+					virtual_sync_log_add_uids(view,
+						rec->uid, rec->uid, uids);
+				}
+			}
+			break;
+		}
+		}
+	}
+	mail_transaction_log_view_close(&log_view);
+	if (ret < 0) {
+		array_clear(uids);
+		return FALSE;
+	}
+	return TRUE;
+}
+
 static int virtual_sync_backend_box_continue(struct virtual_sync_context *ctx,
 					     struct virtual_backend_box *bbox)
 {
@@ -935,7 +1051,17 @@ static int virtual_sync_backend_box_continue(struct virtual_sync_context *ctx,
 	old_highest_modseq = mail_index_modseq_get_highest(view);
 
 	t_array_init(&flag_update_uids, I_MIN(128, old_msg_count));
-	if (bbox->sync_highest_modseq < old_highest_modseq) {
+	if (bbox->sync_highest_modseq >= old_highest_modseq) {
+		/* no changes */
+	} else if (old_msg_count > 0 &&
+		   virtual_sync_backend_get_log_changes(view,
+				bbox->sync_highest_modseq, &flag_update_uids)) {
+		/* the log also contains changes to the new messages */
+		if (bbox->sync_next_uid > 1) {
+			seq_range_array_remove_range(&flag_update_uids,
+				bbox->sync_next_uid, (uint32_t)-1);
+		}
+	} else {
 		for (seq = 1; seq <= old_msg_count; seq++) {
 			modseq = mail_index_modseq_lookup(view, seq);
 			if (modseq > bbox->sync_highest_modseq) {
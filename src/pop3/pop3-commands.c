@@ -347,6 +347,7 @@ struct fetch_context {
 
 	unsigned char last;
 	bool cr_skipped, in_body;
+	bool send_istream;
 };
 
 static void fetch_deinit(struct fetch_context *ctx)
@@ -355,7 +356,77 @@ static void fetch_deinit(struct fetch_context *ctx)
 	i_free(ctx);
 }
 
-static void fetch_callback(struct client *client)
+static bool fetch_stream_is_pop3_safe(struct fetch_context *ctx)
+{
+	const unsigned char *data, *p, *end;
+	unsigned char last = '\0';
+	size_t size;
+	int ret;
+
+	/* The mail can be sent as-is if all of its lines end with CRLF and
+	   none of them begins with a dot. */
+	while ((ret = i_stream_read_more(ctx->stream, &data, &size)) > 0) {
+		if (last == '\n' && data[0] == '.')
+			return FALSE;
+		end = data + size;
+		for (p = data; (p = memchr(p, '\n', end - p)) != NULL; p++) {
+			if ((p == data ? last : p[-1]) != '\r')
+				return FALSE;
+			if (p + 1 < end && p[1] == '.')
+				return FALSE;
+		}
+		last = data[size-1];
+		i_stream_skip(ctx->stream, size);
+	}
+	if (ret != -1 || ctx->stream->stream_errno != 0)
+		return FALSE;
+	ctx->last = last;
+	return TRUE;
+}
+
+static void fetch_try_send_istream(struct client *client,
+				   struct fetch_context *ctx)
+{
+	/* If the mail is in a plain file that doesn't need any changes,
+	   let the ostream send it directly from the file (using sendfile()
+	   when possible) instead of copying it via fetch_send_escaped(). */
+	if (ctx->body_lines != UOFF_T_MAX ||
+	    (client->set->parsed_workarounds &
+	     (WORKAROUND_OUTLOOK_NO_NULS | WORKAROUND_OE_NS_EOH)) != 0 ||
+	    !ctx->stream->readable_fd || !ctx->stream->seekable ||
+	    i_stream_get_fd(ctx->stream) == -1)
+		return;
+
+	ctx->send_istream = fetch_stream_is_pop3_safe(ctx);
+	i_stream_seek(ctx->stream, 0);
+	if (!ctx->send_istream)
+		ctx->last = '\0';
+}
+
+static bool fetch_send_istream(struct client *client)
+{
+	struct fetch_context *ctx = client->cmd_context;
+
+	switch (o_stream_send_istream(client->output, ctx->stream)) {
+	case OSTREAM_SEND_ISTREAM_RESULT_FINISHED:
+		break;
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_INPUT:
+	case OSTREAM_SEND_ISTREAM_RESULT_WAIT_OUTPUT:
+		/* continue later */
+		return FALSE;
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_INPUT:
+		e_error(client->event, "read(%s) failed: %s",
+			i_stream_get_name(ctx->stream),
+			i_stream_get_error(ctx->stream));
+		client_disconnect(client, "Internal error");
+		break;
+	case OSTREAM_SEND_ISTREAM_RESULT_ERROR_OUTPUT:
+		break;
+	}
+	return TRUE;
+}
+
+static bool fetch_send_escaped(struct client *client)
 {
 	struct fetch_context *ctx = client->cmd_context;
 	const unsigned char *data;
@@ -419,7 +490,7 @@ static void fetch_callback(struct client *client)
 				break;
 			if (ret == 0) {
 				/* continue later */
-				return;
+				return FALSE;
 			}
 		}
 
@@ -432,6 +503,20 @@ static void fetch_callback(struct client *client)
 				i_stream_skip(ctx->stream, 1);
 		}
 	}
+	return TRUE;
+}
+
+static void fetch_callback(struct client *client)
+{
+	struct fetch_context *ctx = client->cmd_context;
+
+	if (ctx->send_istream) {
+		if (!fetch_send_istream(client))
+			return;
+	} else {
+		if (!fetch_send_escaped(client))
+			return;
+	}
 
 	if (ctx->last != '\n') {
 		/* didn't end with CRLF */
@@ -502,6 +587,7 @@ static int fetch(struct client *client, unsigned int msgnum, uoff_t body_lines,
 		client_send_line(client, "+OK");
 		ctx->body_lines++; /* internally we count the empty line too */
 	}
+	fetch_try_send_istream(client, ctx);
 
 	client->cmd = fetch_callback;
 	client->cmd_context = ctx;
@@ -16,6 +16,9 @@
 #define REPLICATOR_RECONNECT_MSECS 5000
 #define REPLICATOR_MEMBUF_MAX_SIZE 1024*1024
 #define REPLICATOR_HANDSHAKE "VERSION\treplicator-notify\t1\t0\n"
+/* Coalesce the low/high priority notifications for the same user that
+   arrive within this time */
+#define REPLICATOR_NOTIFY_COALESCE_MSECS 500
 
 struct replicator_connection {
 	char *path;
@@ -32,6 +35,11 @@ struct replicator_connection {
 
 	buffer_t *queue[REPLICATION_PRIORITY_SYNC + 1];
 
+	/* username => enum replication_priority */
+	HASH_TABLE(char *, void *) pending_users;
+	struct timeout *to_pending;
+	unsigned int pending_notify_count;
+
 	HASH_TABLE(void *, void *) requests;
 	unsigned int request_id_counter;
 	replicator_sync_callback_t *callback;
@@ -220,6 +228,20 @@ static void replicator_connection_disconnect(struct replicator_connection *conn)
 	conn->fd = -1;
 }
 
+static void replicator_pending_users_clear(struct replicator_connection *conn)
+{
+	struct hash_iterate_context *iter;
+	char *username;
+	void *value;
+
+	iter = hash_table_iterate_init(conn->pending_users);
+	while (hash_table_iterate(iter, conn->pending_users, &username, &value))
+		i_free(username);
+	hash_table_iterate_deinit(&iter);
+	hash_table_clear(conn->pending_users, TRUE);
+	conn->pending_notify_count = 0;
+}
+
 static struct replicator_connection *replicator_connection_create(void)
 {
 	struct replicator_connection *conn;
@@ -229,6 +251,8 @@ static struct replicator_connection *replicator_connection_create(void)
 	conn->fd = -1;
 	conn->event = event_create(NULL);
 	hash_table_create_direct(&conn->requests, default_pool, 0);
+	hash_table_create(&conn->pending_users, default_pool, 0,
+			  str_hash, strcmp);
 	for (i = REPLICATION_PRIORITY_LOW; i <= REPLICATION_PRIORITY_SYNC; i++)
 		conn->queue[i] = buffer_create_dynamic(default_pool, 1024);
 	return conn;
@@ -273,6 +297,9 @@ void replicator_connection_destroy(struct replicator_connection **_conn)
 	for (i = REPLICATION_PRIORITY_LOW; i <= REPLICATION_PRIORITY_SYNC; i++)
 		buffer_free(&conn->queue[i]);
 
+	replicator_pending_users_clear(conn);
+	hash_table_destroy(&conn->pending_users);
+	timeout_remove(&conn->to_pending);
 	timeout_remove(&conn->to);
 	hash_table_destroy(&conn->requests);
 	event_unref(&conn->event);
@@ -302,14 +329,12 @@ replicator_send(struct replicator_connection *conn,
 	}
 }
 
-void replicator_connection_notify(struct replicator_connection *conn,
-				  const char *username,
-				  enum replication_priority priority)
+static void
+replicator_send_notify(struct replicator_connection *conn,
+		       const char *username, enum replication_priority priority)
 {
 	const char *priority_str = "";
 
-	replicator_connection_connect(conn);
-
 	switch (priority) {
 	case REPLICATION_PRIORITY_NONE:
 	case REPLICATION_PRIORITY_SYNC:
@@ -330,13 +355,80 @@ void replicator_connection_notify(struct replicator_connection *conn,
 	} T_END;
 }
 
+static void replicator_pending_users_flush(struct replicator_connection *conn)
+{
+	struct hash_iterate_context *iter;
+	struct event_passthrough *e;
+	char *username;
+	void *value;
+	unsigned int users_count;
+
+	timeout_remove(&conn->to_pending);
+	replicator_connection_connect(conn);
+
+	users_count = hash_table_count(conn->pending_users);
+	if (conn->output != NULL)
+		o_stream_cork(conn->output);
+	iter = hash_table_iterate_init(conn->pending_users);
+	while (hash_table_iterate(iter, conn->pending_users, &username, &value))
+		replicator_send_notify(conn, username, POINTER_CAST_TO(value, int));
+	hash_table_iterate_deinit(&iter);
+	if (conn->output != NULL)
+		o_stream_uncork(conn->output);
+
+	e = event_create_passthrough(conn->event)->
+		set_name("replication_notify_batch_sent")->
+		add_int("users", users_count)->
+		add_int("coalesced_notifications",
+			conn->pending_notify_count - users_count);
+	e_debug(e->event(), "Sent %u user notifications (%u coalesced)",
+		users_count, conn->pending_notify_count - users_count);
+	replicator_pending_users_clear(conn);
+}
+
+void replicator_connection_notify(struct replicator_connection *conn,
+				  const char *username,
+				  enum replication_priority priority)
+{
+	char *orig_username;
+	void *value;
+
+	i_assert(priority == REPLICATION_PRIORITY_LOW ||
+		 priority == REPLICATION_PRIORITY_HIGH);
+
+	conn->pending_notify_count++;
+	if (!hash_table_lookup_full(conn->pending_users, username,
+				    &orig_username, &value)) {
+		hash_table_insert(conn->pending_users, i_strdup(username),
+				  POINTER_CAST(priority));
+	} else if (POINTER_CAST_TO(value, int) < (int)priority) {
+		/* upgrade the priority */
+		hash_table_update(conn->pending_users, orig_username,
+				  POINTER_CAST(priority));
+	}
+	if (conn->to_pending == NULL) {
+		conn->to_pending =
+			timeout_add_short(REPLICATOR_NOTIFY_COALESCE_MSECS,
+					  replicator_pending_users_flush, conn);
+	}
+}
+
 void replicator_connection_notify_sync(struct replicator_connection *conn,
 				       const char *username, void *context)
 {
+	char *orig_username;
+	void *value;
 	unsigned int id;
 
 	replicator_connection_connect(conn);
 
+	if (hash_table_lookup_full(conn->pending_users, username,
+				   &orig_username, &value)) {
+		/* the sync request replaces the pending notification */
+		hash_table_remove(conn->pending_users, username);
+		i_free(orig_username);
+	}
+
 	id = ++conn->request_id_counter;
 	if (id == 0) id++;
 	hash_table_insert(conn->requests, POINTER_CAST(id), context);
@@ -16,6 +16,13 @@ struct replicator_queue {
 
 	void (*change_callback)(void *context);
 	void *change_context;
+
+	/* Log of the changes done after the last export */
+	char *log_path;
+	struct ostream *log_output;
+	struct timeout *to_log_flush;
+	/* Size of the file during the last import/export */
+	uoff_t export_size;
 };
 
 #endif
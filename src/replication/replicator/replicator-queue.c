@@ -11,9 +11,15 @@
 #include "replicator-queue-private.h"
 #include "replicator-settings.h"
 
+#include <stdio.h>
 #include <unistd.h>
 #include <fcntl.h>
 
+/* Flush the change log this often */
+#define REPLICATOR_QUEUE_LOG_FLUSH_MSECS 1000
+/* Don't bother compacting the change log before it's at least this large */
+#define REPLICATOR_QUEUE_LOG_MIN_COMPACT_SIZE (1024*1024)
+
 struct replicator_sync_lookup {
 	struct replicator_user *user;
 
@@ -31,6 +37,10 @@ struct replicator_queue_iter {
 static unsigned int replicator_full_sync_interval = 0;
 static unsigned int replicator_failure_resync_interval = 0;
 
+static void
+replicator_queue_export_user(struct replicator_user *user, string_t *str);
+static void replicator_queue_log_close(struct replicator_queue *queue);
+
 static time_t replicator_user_next_sync_time(const struct replicator_user *user)
 {
 	/* The idea is that the higher the priority, the more likely it will
@@ -122,6 +132,8 @@ void replicator_queue_deinit(struct replicator_queue **_queue)
 	*_queue = NULL;
 
 	queue->change_callback = NULL;
+	/* the users aren't really removed */
+	replicator_queue_log_close(queue);
 
 	while ((item = priorityq_pop(queue->user_queue)) != NULL) {
 		struct replicator_user *user = (struct replicator_user *)item;
@@ -162,7 +174,6 @@ bool replicator_user_unref(struct replicator_user **_user)
 		return TRUE;
 
 	i_free(user->state);
-	i_free(user->username);
 	i_free(user);
 	return FALSE;
 }
@@ -180,10 +191,15 @@ replicator_queue_get(struct replicator_queue *queue, const char *username)
 
 	user = replicator_queue_lookup(queue, username);
 	if (user == NULL) {
+		size_t username_size = strlen(username) + 1;
+
 		e_debug(queue->event, "user %s: User not found from queue - adding", username);
-		user = i_new(struct replicator_user, 1);
+		/* allocate the username in the same memory block to save
+		   memory with a large number of users */
+		user = i_malloc(sizeof(*user) + username_size);
 		user->refcount = 1;
-		user->username = i_strdup(username);
+		user->username = (char *)(user + 1);
+		memcpy(user->username, username, username_size);
 		user->last_update = ioloop_time;
 		hash_table_insert(queue->user_hash, user->username, user);
 		if (!user->popped)
@@ -209,6 +225,59 @@ void replicator_queue_update(struct replicator_queue *queue,
 	user->last_update = ioloop_time;
 }
 
+static void replicator_queue_log_flush(struct replicator_queue *queue)
+{
+	timeout_remove(&queue->to_log_flush);
+	o_stream_uncork(queue->log_output);
+	if (o_stream_flush(queue->log_output) < 0) {
+		e_error(queue->event, "write(%s) failed: %s", queue->log_path,
+			o_stream_get_error(queue->log_output));
+	}
+	o_stream_cork(queue->log_output);
+}
+
+static void replicator_queue_log_write(struct replicator_queue *queue,
+				       const string_t *str)
+{
+	o_stream_nsend(queue->log_output, str_data(str), str_len(str));
+	if (queue->to_log_flush == NULL) {
+		queue->to_log_flush =
+			timeout_add(REPLICATOR_QUEUE_LOG_FLUSH_MSECS,
+				    replicator_queue_log_flush, queue);
+	}
+}
+
+static void
+replicator_queue_log_user(struct replicator_queue *queue,
+			  struct replicator_user *user)
+{
+	string_t *str;
+
+	if (queue->log_output == NULL)
+		return;
+
+	str = t_str_new(128);
+	str_append_c(str, '+');
+	replicator_queue_export_user(user, str);
+	replicator_queue_log_write(queue, str);
+}
+
+static void
+replicator_queue_log_user_removed(struct replicator_queue *queue,
+				  struct replicator_user *user)
+{
+	string_t *str;
+
+	if (queue->log_output == NULL)
+		return;
+
+	str = t_str_new(128);
+	str_append_c(str, '-');
+	str_append_tabescaped(str, user->username);
+	str_append_c(str, '\n');
+	replicator_queue_log_write(queue, str);
+}
+
 void replicator_queue_add(struct replicator_queue *queue,
 			  struct replicator_user *user)
 {
@@ -216,6 +285,7 @@ void replicator_queue_add(struct replicator_queue *queue,
 		priorityq_remove(queue->user_queue, &user->item);
 		priorityq_add(queue->user_queue, &user->item);
 	}
+	replicator_queue_log_user(queue, user);
 	if (queue->change_callback != NULL) {
 		e_debug(queue->event, "user %s: Queue changed - calling callback",
 			user->username);
@@ -251,6 +321,7 @@ void replicator_queue_remove(struct replicator_queue *queue,
 	if (!user->popped)
 		priorityq_remove(queue->user_queue, &user->item);
 	hash_table_remove(queue->user_hash, user->username);
+	replicator_queue_log_user_removed(queue, user);
 
 	if (queue->change_callback != NULL) {
 		e_debug(queue->event, "user %s: Queue changed - calling callback",
@@ -354,12 +425,14 @@ void replicator_queue_push(struct replicator_queue *queue,
 	user->popped = FALSE;
 
 	T_BEGIN {
+		replicator_queue_log_user(queue, user);
 		replicator_queue_handle_sync_lookups(queue, user);
 	} T_END;
 }
 
 static int
-replicator_queue_import_line(struct replicator_queue *queue, const char *line)
+replicator_queue_import_line(struct replicator_queue *queue, const char *line,
+			     bool replace)
 {
 	const char *const *args, *username, *state;
 	unsigned int priority;
@@ -392,7 +465,7 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 	}
 
 	user = hash_table_lookup(queue->user_hash, username);
-	if (user != NULL) {
+	if (user != NULL && !replace) {
 		if (user->last_update > tmp_user.last_update) {
 			/* we already have a newer state */
 			return 0;
@@ -403,7 +476,7 @@ replicator_queue_import_line(struct replicator_queue *queue, const char *line)
 			if (user->priority > tmp_user.priority)
 				return 0;
 		}
-	} else {
+	} else if (user == NULL) {
 		user = replicator_queue_get(queue, username);
 	}
 	user->priority = tmp_user.priority;
@@ -437,7 +510,65 @@ int replicator_queue_import(struct replicator_queue *queue, const char *path)
 	input = i_stream_create_fd_autoclose(&fd, SIZE_MAX);
 	while ((line = i_stream_read_next_line(input)) != NULL) {
 		T_BEGIN {
-			ret = replicator_queue_import_line(queue, line);
+			ret = replicator_queue_import_line(queue, line, FALSE);
+		} T_END;
+		if (ret < 0) {
+			e_error(queue->event,
+				"Corrupted replicator record in %s: %s", path, line);
+			break;
+		}
+	}
+	if (input->stream_errno != 0) {
+		e_error(queue->event, "read(%s) failed: %s", path, i_stream_get_error(input));
+		ret = -1;
+	}
+	queue->export_size = input->v_offset;
+	i_stream_destroy(&input);
+	return ret;
+}
+
+static int
+replicator_queue_import_log_line(struct replicator_queue *queue,
+				 const char *line)
+{
+	struct replicator_user *user;
+
+	switch (line[0]) {
+	case '+':
+		return replicator_queue_import_line(queue, line + 1, TRUE);
+	case '-':
+		user = hash_table_lookup(queue->user_hash,
+					 t_str_tabunescape(line + 1));
+		if (user != NULL)
+			replicator_queue_remove(queue, &user);
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+int replicator_queue_import_log(struct replicator_queue *queue,
+				const char *path)
+{
+	struct istream *input;
+	const char *line;
+	int fd, ret = 0;
+
+	e_debug(queue->event, "Replaying changes from %s", path);
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return 0;
+		e_error(queue->event, "open(%s) failed: %m", path);
+		return -1;
+	}
+
+	input = i_stream_create_fd_autoclose(&fd, SIZE_MAX);
+	/* a partially written last line is ignored */
+	while ((line = i_stream_read_next_line(input)) != NULL) {
+		T_BEGIN {
+			ret = replicator_queue_import_log_line(queue, line);
 		} T_END;
 		if (ret < 0) {
 			e_error(queue->event,
@@ -453,6 +584,78 @@ int replicator_queue_import(struct replicator_queue *queue, const char *path)
 	return ret;
 }
 
+static int
+replicator_queue_log_open_fd(struct replicator_queue *queue, int flags)
+{
+	off_t size;
+	int fd;
+
+	fd = open(queue->log_path, O_WRONLY | O_CREAT | flags, 0600);
+	if (fd == -1) {
+		e_error(queue->event, "open(%s) failed: %m", queue->log_path);
+		return -1;
+	}
+	if ((size = lseek(fd, 0, SEEK_END)) < 0) {
+		e_error(queue->event, "lseek(%s) failed: %m", queue->log_path);
+		i_close_fd(&fd);
+		return -1;
+	}
+	queue->log_output = o_stream_create_fd_file_autoclose(&fd, size);
+	o_stream_cork(queue->log_output);
+	return 0;
+}
+
+int replicator_queue_log_open(struct replicator_queue *queue,
+			      const char *path)
+{
+	i_assert(queue->log_output == NULL);
+
+	queue->log_path = i_strdup(path);
+	if (replicator_queue_log_open_fd(queue, 0) < 0) {
+		i_free(queue->log_path);
+		return -1;
+	}
+	return 0;
+}
+
+static void replicator_queue_log_close(struct replicator_queue *queue)
+{
+	if (queue->log_output == NULL)
+		return;
+
+	timeout_remove(&queue->to_log_flush);
+	if (o_stream_finish(queue->log_output) < 0) {
+		e_error(queue->event, "write(%s) failed: %s", queue->log_path,
+			o_stream_get_error(queue->log_output));
+	}
+	o_stream_destroy(&queue->log_output);
+	i_free(queue->log_path);
+}
+
+bool replicator_queue_log_want_compact(struct replicator_queue *queue)
+{
+	uoff_t log_size;
+
+	if (queue->log_output == NULL)
+		return TRUE;
+	log_size = queue->log_output->offset;
+	return log_size >= REPLICATOR_QUEUE_LOG_MIN_COMPACT_SIZE &&
+		log_size >= queue->export_size / 2;
+}
+
+static void replicator_queue_log_truncate(struct replicator_queue *queue)
+{
+	if (queue->log_output == NULL)
+		return;
+
+	timeout_remove(&queue->to_log_flush);
+	/* everything in the log was just exported */
+	o_stream_abort(queue->log_output);
+	o_stream_destroy(&queue->log_output);
+	if (replicator_queue_log_open_fd(queue, O_TRUNC) < 0)
+		i_free(queue->log_path);
+}
+
 static void
 replicator_queue_export_user(struct replicator_user *user, string_t *str)
 {
@@ -472,12 +675,15 @@ int replicator_queue_export(struct replicator_queue *queue, const char *path)
 	struct replicator_queue_iter *iter;
 	struct replicator_user *user;
 	struct ostream *output;
+	const char *temp_path;
 	string_t *str;
 	int fd, ret = 0;
 
-	fd = creat(path, 0600);
+	/* write to a temp file first, so a crash can't lose the old state */
+	temp_path = t_strconcat(path, ".tmp", NULL);
+	fd = creat(temp_path, 0600);
 	if (fd == -1) {
-		e_error(queue->event, "creat(%s) failed: %m", path);
+		e_error(queue->event, "creat(%s) failed: %m", temp_path);
 		return -1;
 	}
 	output = o_stream_create_fd_file_autoclose(&fd, 0);
@@ -493,10 +699,23 @@ int replicator_queue_export(struct replicator_queue *queue, const char *path)
 	}
 	replicator_queue_iter_deinit(&iter);
 	if (o_stream_finish(output) < 0) {
-		e_error(queue->event, "write(%s) failed: %s", path, o_stream_get_error(output));
+		e_error(queue->event, "write(%s) failed: %s", temp_path,
+			o_stream_get_error(output));
 		ret = -1;
 	}
+	queue->export_size = output->offset;
 	o_stream_destroy(&output);
+
+	if (ret < 0)
+		i_unlink(temp_path);
+	else if (rename(temp_path, path) < 0) {
+		e_error(queue->event, "rename(%s, %s) failed: %m",
+			temp_path, path);
+		i_unlink(temp_path);
+		ret = -1;
+	} else {
+		replicator_queue_log_truncate(queue);
+	}
 	return ret;
 }
 
@@ -84,8 +84,23 @@ void replicator_queue_push(struct replicator_queue *queue,
 			   struct replicator_user *user);
 
 int replicator_queue_import(struct replicator_queue *queue, const char *path);
+/* Export all users to the path. If the change log is open, it's truncated
+   afterwards, since the exported file contains all of its changes. */
 int replicator_queue_export(struct replicator_queue *queue, const char *path);
 
+/* Replay the changes written to the change log. Unlike with
+   replicator_queue_import(), the changes always replace the current state. */
+int replicator_queue_import_log(struct replicator_queue *queue,
+				const char *path);
+/* Start appending all changes done via _add(), _push() and _remove() to the
+   change log. This allows replicator_queue_export() to be called much less
+   often without losing the changes. */
+int replicator_queue_log_open(struct replicator_queue *queue,
+			      const char *path);
+/* Returns TRUE if the change log has grown large enough compared to the last
+   export that it should be compacted with replicator_queue_export(). */
+bool replicator_queue_log_want_compact(struct replicator_queue *queue);
+
 /* Returns TRUE if user replication can be started now, FALSE if not. When
    returning FALSE, next_secs_r is set to user's next replication time. */
 bool replicator_queue_want_sync_now(struct replicator_user *user,
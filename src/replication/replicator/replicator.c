@@ -12,10 +12,12 @@
 #include "replicator-queue.h"
 #include "replicator-settings.h"
 
-#define REPLICATOR_DB_DUMP_INTERVAL_MSECS (1000*60*15)
+/* check this often if the change log should be compacted into the db */
+#define REPLICATOR_DB_DUMP_INTERVAL_MSECS (1000*60)
 /* if syncing fails, try again in 5 minutes */
 #define REPLICATOR_FAILURE_RESYNC_INTERVAL_SECS (60*5)
 #define REPLICATOR_DB_FNAME "replicator.db"
+#define REPLICATOR_DB_LOG_FNAME "replicator.db.log"
 
 static struct replicator_queue *queue;
 static struct replicator_brain *brain;
@@ -44,6 +46,13 @@ static void replication_add_users(struct replicator_queue *queue)
 	/* add updates from replicator db, if it exists */
 	path = t_strconcat(service_set->state_dir, "/"REPLICATOR_DB_FNAME, NULL);
 	(void)replicator_queue_import(queue, path);
+
+	/* replay the changes done after the db was last written, and
+	   continue logging the changes there */
+	path = t_strconcat(service_set->state_dir,
+			   "/"REPLICATOR_DB_LOG_FNAME, NULL);
+	(void)replicator_queue_import_log(queue, path);
+	(void)replicator_queue_log_open(queue, path);
 }
 
 static void ATTR_NULL(1)
@@ -51,6 +60,9 @@ replicator_dump_timeout(void *context ATTR_UNUSED)
 {
 	const char *path;
 
+	if (!replicator_queue_log_want_compact(queue))
+		return;
+
 	path = t_strconcat(service_set->state_dir, "/"REPLICATOR_DB_FNAME, NULL);
 	(void)replicator_queue_export(queue, path);
 }
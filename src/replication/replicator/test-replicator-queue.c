@@ -5,8 +5,12 @@
 #include "test-common.h"
 #include "replicator-queue.h"
 
+#include <unistd.h>
+
 #define TEST_REPLICATION_FULL_SYNC_INTERVAL 60
 #define TEST_REPLICATION_FAILURE_RESYNC_INTERVAL 10
+#define TEST_DB_PATH ".test-replicator.db"
+#define TEST_DB_LOG_PATH ".test-replicator.db.log"
 
 static void test_replicator_queue(void)
 {
@@ -249,11 +253,87 @@ static void test_replicator_queue_random(void)
 	test_end();
 }
 
+static struct replicator_queue *test_replicator_queue_reload(void)
+{
+	struct replicator_queue *queue;
+
+	queue = replicator_queue_init(TEST_REPLICATION_FULL_SYNC_INTERVAL,
+				      TEST_REPLICATION_FAILURE_RESYNC_INTERVAL);
+	test_assert(replicator_queue_import(queue, TEST_DB_PATH) == 0);
+	test_assert(replicator_queue_import_log(queue, TEST_DB_LOG_PATH) == 0);
+	test_assert(replicator_queue_log_open(queue, TEST_DB_LOG_PATH) == 0);
+	return queue;
+}
+
+static void test_replicator_queue_log(void)
+{
+	struct replicator_queue *queue;
+	struct replicator_user *user;
+	struct ioloop *ioloop;
+	unsigned int next_secs;
+
+	test_begin("replicator queue log");
+	i_unlink_if_exists(TEST_DB_PATH);
+	i_unlink_if_exists(TEST_DB_LOG_PATH);
+	ioloop = io_loop_create();
+	ioloop_time = time(NULL);
+
+	queue = test_replicator_queue_reload();
+	user = replicator_queue_get(queue, "user1");
+	replicator_queue_update(queue, user, REPLICATION_PRIORITY_LOW);
+	replicator_queue_add(queue, user);
+	user = replicator_queue_get(queue, "user2");
+	replicator_queue_update(queue, user, REPLICATION_PRIORITY_HIGH);
+	replicator_queue_add(queue, user);
+	test_assert(replicator_queue_export(queue, TEST_DB_PATH) == 0);
+
+	/* these changes are only in the log */
+	user = replicator_queue_get(queue, "user1");
+	replicator_queue_remove(queue, &user);
+	user = replicator_queue_pop(queue, &next_secs);
+	test_assert(user != NULL && strcmp(user->username, "user2") == 0);
+	user->priority = REPLICATION_PRIORITY_NONE;
+	user->last_sync_failed = TRUE;
+	replicator_queue_push(queue, user);
+	user = replicator_queue_get(queue, "user3");
+	replicator_queue_update(queue, user, REPLICATION_PRIORITY_SYNC);
+	replicator_queue_add(queue, user);
+	replicator_queue_deinit(&queue);
+
+	queue = test_replicator_queue_reload();
+	test_assert(replicator_queue_count(queue) == 2);
+	test_assert(replicator_queue_lookup(queue, "user1") == NULL);
+	user = replicator_queue_lookup(queue, "user2");
+	test_assert(user != NULL && user->last_sync_failed &&
+		    user->priority == REPLICATION_PRIORITY_NONE);
+	user = replicator_queue_lookup(queue, "user3");
+	test_assert(user != NULL &&
+		    user->priority == REPLICATION_PRIORITY_SYNC);
+	test_assert(!replicator_queue_log_want_compact(queue));
+
+	/* exporting truncates the log */
+	test_assert(replicator_queue_export(queue, TEST_DB_PATH) == 0);
+	user = replicator_queue_get(queue, "user4");
+	replicator_queue_add(queue, user);
+	replicator_queue_deinit(&queue);
+
+	queue = test_replicator_queue_reload();
+	test_assert(replicator_queue_count(queue) == 3);
+	test_assert(replicator_queue_lookup(queue, "user4") != NULL);
+	replicator_queue_deinit(&queue);
+
+	io_loop_destroy(&ioloop);
+	i_unlink(TEST_DB_PATH);
+	i_unlink(TEST_DB_LOG_PATH);
+	test_end();
+}
+
 int main(void)
 {
 	static void (*const test_functions[])(void) = {
 		test_replicator_queue,
 		test_replicator_queue_random,
+		test_replicator_queue_log,
 		NULL
 	};
 	return test_run(test_functions);
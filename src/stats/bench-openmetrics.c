@@ -0,0 +1,95 @@
+/* Copyright (c) 2026 Dovecot authors, see the included COPYING file */
+
+#include "test-stats-common.h"
+#include "ioloop.h"
+#include "time-util.h"
+#include "buffer.h"
+#include "ostream.h"
+#include "stats-service-private.h"
+
+#include <stdio.h>
+
+/**
+ * Measures how long an OpenMetrics scrape takes with a large number of
+ * series. The metric is grouped by two fields with BENCH_GROUP_VALUES
+ * values each, so there are BENCH_GROUP_VALUES^2 sub-metrics (100k by
+ * default), each of which is exported as a count and a duration series.
+ */
+
+#define BENCH_GROUP_VALUES 317
+#define BENCH_SCRAPES 20
+
+bool test_stats_callback(struct event *event ATTR_UNUSED,
+			 enum event_callback_type type ATTR_UNUSED,
+			 struct failure_context *ctx ATTR_UNUSED,
+			 const char *fmt ATTR_UNUSED, va_list args ATTR_UNUSED)
+{
+	return TRUE;
+}
+
+static void bench_fill_metrics(unsigned int values)
+{
+	struct failure_context ctx = {
+		.type = LOG_TYPE_DEBUG,
+	};
+	struct event *event;
+	unsigned int i, j;
+
+	for (i = 0; i < values; i++) {
+		for (j = 0; j < values; j++) T_BEGIN {
+			event = event_create(NULL);
+			event_add_category(event, &test_category);
+			event_set_name(event, "test");
+			event_add_str(event, "user",
+				      t_strdup_printf("user%u@example.com", i));
+			event_add_str(event, "cmd_name",
+				      t_strdup_printf("\"command\" %u", j));
+			stats_metrics_event(stats_metrics, event, &ctx);
+			event_unref(&event);
+		} T_END;
+	}
+}
+
+static void bench_scrape(buffer_t *buf)
+{
+	struct ostream *output;
+	uint64_t ts_0, nsecs;
+	unsigned int i;
+
+	ts_0 = i_nanoseconds();
+	for (i = 0; i < BENCH_SCRAPES; i++) {
+		buffer_set_used_size(buf, 0);
+		output = o_stream_create_buffer(buf);
+		if (stats_service_openmetrics_write(output) < 0)
+			i_fatal("stats_service_openmetrics_write() failed");
+		o_stream_destroy(&output);
+	}
+	nsecs = i_nanoseconds() - ts_0;
+	printf("%u series: %0.1lf ms/scrape (%zu bytes)\n",
+	       BENCH_GROUP_VALUES * BENCH_GROUP_VALUES * 2,
+	       (double)nsecs / BENCH_SCRAPES / 1000000, buf->used);
+}
+
+int main(void)
+{
+	struct ioloop *ioloop;
+	buffer_t *buf;
+
+	lib_init();
+	ioloop = io_loop_create();
+	test_init("metric=test\n"
+		  "metric/test/metric_name=test\n"
+		  "metric/test/filter=event=test\n"
+		  "metric/test/group_by=user cmd_name\n"
+		  "\n");
+	bench_fill_metrics(BENCH_GROUP_VALUES);
+
+	buf = buffer_create_dynamic(default_pool, 1024*1024);
+	bench_scrape(buf);
+	buffer_free(&buf);
+
+	test_deinit();
+	io_loop_destroy(&ioloop);
+	lib_deinit();
+	return 0;
+}
@@ -37,13 +37,22 @@ static struct connection_list *writer_clients = NULL;
 
 static void client_writer_send_handshake(struct writer_client *client)
 {
+	struct event_filter *event_filter =
+		stats_metrics_get_event_filter(stats_metrics);
 	string_t *filter = t_str_new(128);
 	string_t *str = t_str_new(128);
+	unsigned int sample_rate, max_events_per_sec;
 
-	event_filter_export(stats_metrics_get_event_filter(stats_metrics), filter);
+	event_filter_export(event_filter, filter);
 
 	str_append(str, "FILTER\t");
 	str_append_tabescaped(str, str_c(filter));
+	event_filter_get_sampling(event_filter, &sample_rate,
+				  &max_events_per_sec);
+	if (sample_rate > 1 || max_events_per_sec > 0) {
+		/* clients that don't support sampling ignore these */
+		str_printfa(str, "\t%u\t%u", sample_rate, max_events_per_sec);
+	}
 	str_append_c(str, '\n');
 	o_stream_nsend(client->conn.output, str_data(str), str_len(str));
 }
@@ -1,8 +1,11 @@
 /* Copyright (c) 2019 Dovecot authors, see the included COPYING file */
 
 #include "lib.h"
+#include "array.h"
 #include "ioloop.h"
 #include "str.h"
+#include "ostream.h"
+#include "compression.h"
 #include "event-exporter.h"
 #include "http-client.h"
 #include "iostream-ssl.h"
@@ -10,21 +13,86 @@
 #include "master-service-settings.h"
 #include "master-service-ssl-settings.h"
 
+struct event_exporter_http_post_batch {
+	const struct exporter *exporter;
+	const struct compression_handler *compress_handler;
+	const char *content_encoding;
+
+	/* events waiting to be sent, separated by LFs */
+	buffer_t *buf;
+	unsigned int count;
+	struct timeout *to_linger;
+
+	unsigned int pending_requests;
+	/* number of events dropped since the last log message */
+	unsigned int dropped_events;
+	time_t last_drop_log;
+};
+
 /* the http client used to export all events with exporter=http-post */
 static struct http_client *exporter_http_client;
+static ARRAY(struct event_exporter_http_post_batch *) exporter_batches;
+
+void event_export_transport_http_post_init(struct exporter *exporter)
+{
+	struct event_exporter_http_post_batch *batch;
+
+	batch = i_new(struct event_exporter_http_post_batch, 1);
+	batch->exporter = exporter;
+	batch->buf = buffer_create_dynamic(default_pool, 256);
+	if (strcmp(exporter->transport_compression, "gzip") == 0) {
+		batch->content_encoding = "gzip";
+		(void)compression_lookup_handler("gz",
+						 &batch->compress_handler);
+	} else if (strcmp(exporter->transport_compression, "zstd") == 0) {
+		batch->content_encoding = "zstd";
+		(void)compression_lookup_handler("zstd",
+						 &batch->compress_handler);
+	}
+	if (batch->content_encoding != NULL &&
+	    (batch->compress_handler == NULL ||
+	     batch->compress_handler->create_ostream == NULL)) {
+		i_error("Exporter '%s': transport_compression=%s isn't "
+			"supported - sending uncompressed",
+			exporter->name, exporter->transport_compression);
+		batch->compress_handler = NULL;
+		batch->content_encoding = NULL;
+	}
+
+	if (!array_is_created(&exporter_batches))
+		i_array_init(&exporter_batches, 4);
+	array_push_back(&exporter_batches, &batch);
+	exporter->http_post_batch = batch;
+}
 
 void event_export_transport_http_post_deinit(void)
 {
+	struct event_exporter_http_post_batch *batch;
+
+	/* pending requests are aborted, and their callbacks still access
+	   the batches */
 	if (exporter_http_client != NULL)
 		http_client_deinit(&exporter_http_client);
+
+	if (!array_is_created(&exporter_batches))
+		return;
+	array_foreach_elem(&exporter_batches, batch) {
+		timeout_remove(&batch->to_linger);
+		buffer_free(&batch->buf);
+		i_free(batch);
+	}
+	array_free(&exporter_batches);
 }
 
 static void response_fxn(const struct http_response *response,
-			 void *context ATTR_UNUSED)
+			 struct event_exporter_http_post_batch *batch)
 {
 	static time_t last_log;
 	static unsigned suppressed;
 
+	i_assert(batch->pending_requests > 0);
+	batch->pending_requests--;
+
 	if (http_response_is_success(response))
 		return;
 
@@ -44,11 +112,8 @@ static void response_fxn(const struct http_response *response,
 	suppressed = 0;
 }
 
-void event_export_transport_http_post(const struct exporter *exporter,
-				      const buffer_t *buf)
+static struct http_client *event_export_http_client_get(void)
 {
-	struct http_client_request *req;
-
 	if (exporter_http_client == NULL) {
 		const struct master_service_ssl_settings *master_ssl_set =
 			master_service_settings_get_root_set(master_service,
@@ -66,13 +131,111 @@ void event_export_transport_http_post(const struct exporter *exporter,
 		}
 		exporter_http_client = http_client_init(&set);
 	}
+	return exporter_http_client;
+}
+
+static void
+event_export_http_post_drop(struct event_exporter_http_post_batch *batch)
+{
+	batch->dropped_events += batch->count;
+	if (batch->last_drop_log == ioloop_time)
+		return; /* don't spam the log */
+
+	i_error("Exporter '%s': Dropped %u events - "
+		"too many pending HTTP POST requests (%u)",
+		batch->exporter->name, batch->dropped_events,
+		batch->pending_requests);
+	batch->last_drop_log = ioloop_time;
+	batch->dropped_events = 0;
+}
+
+static const buffer_t *
+event_export_http_post_compress(struct event_exporter_http_post_batch *batch)
+{
+	const struct compression_handler *handler = batch->compress_handler;
+	struct ostream *output, *comp_output;
+	buffer_t *dest;
+
+	dest = t_buffer_create(batch->buf->used / 4 + 64);
+	output = o_stream_create_buffer(dest);
+	comp_output = handler->create_ostream(output,
+					      handler->get_default_level());
+	o_stream_unref(&output);
+
+	o_stream_nsend(comp_output, batch->buf->data, batch->buf->used);
+	if (o_stream_finish(comp_output) < 0) {
+		i_error("Exporter '%s': %s compression failed: %s",
+			batch->exporter->name, batch->content_encoding,
+			o_stream_get_error(comp_output));
+		o_stream_destroy(&comp_output);
+		return NULL;
+	}
+	o_stream_destroy(&comp_output);
+	return dest;
+}
+
+static void
+event_export_http_post_flush(struct event_exporter_http_post_batch *batch)
+{
+	const struct exporter *exporter = batch->exporter;
+	struct http_client_request *req;
+	const buffer_t *payload = batch->buf;
+
+	timeout_remove(&batch->to_linger);
+	if (batch->count == 0)
+		return;
+
+	if (exporter->transport_max_pending_requests > 0 &&
+	    batch->pending_requests >= exporter->transport_max_pending_requests) {
+		event_export_http_post_drop(batch);
+		buffer_set_used_size(batch->buf, 0);
+		batch->count = 0;
+		return;
+	}
+
+	T_BEGIN {
+		if (batch->compress_handler != NULL)
+			payload = event_export_http_post_compress(batch);
+		if (payload != NULL) {
+			req = http_client_request_url_str(
+				event_export_http_client_get(), "POST",
+				exporter->transport_args, response_fxn, batch);
+			http_client_request_add_header(req, "Content-Type",
+				exporter->format_mime_type);
+			if (payload != batch->buf) {
+				http_client_request_add_header(req,
+					"Content-Encoding",
+					batch->content_encoding);
+			}
+			http_client_request_set_payload_data(req, payload->data,
+							     payload->used);
+			http_client_request_set_timeout_msecs(req,
+				exporter->transport_timeout);
+			http_client_request_submit(req);
+			batch->pending_requests++;
+		}
+	} T_END;
+
+	buffer_set_used_size(batch->buf, 0);
+	batch->count = 0;
+}
+
+void event_export_transport_http_post(const struct exporter *exporter,
+				      const buffer_t *buf)
+{
+	struct event_exporter_http_post_batch *batch = exporter->http_post_batch;
 
-	req = http_client_request_url_str(exporter_http_client, "POST",
-					  exporter->transport_args,
-					  response_fxn, NULL);
-	http_client_request_add_header(req, "Content-Type", exporter->format_mime_type);
-	http_client_request_set_payload_data(req, buf->data, buf->used);
+	buffer_append_buf(batch->buf, buf, 0, SIZE_MAX);
+	if (exporter->transport_batch_count > 1)
+		buffer_append_c(batch->buf, '\n');
+	batch->count++;
 
-	http_client_request_set_timeout_msecs(req, exporter->transport_timeout);
-	http_client_request_submit(req);
+	if (batch->count >= exporter->transport_batch_count ||
+	    batch->buf->used >= exporter->transport_batch_size)
+		event_export_http_post_flush(batch);
+	else if (batch->to_linger == NULL) {
+		batch->to_linger =
+			timeout_add(exporter->transport_batch_linger_msecs,
+				    event_export_http_post_flush, batch);
+	}
 }
@@ -10,6 +10,7 @@ void event_export_fmt_tabescaped_text(const struct metric *metric, struct event
 
 /* transport functions */
 void event_export_transport_drop(const struct exporter *exporter, const buffer_t *buf);
+void event_export_transport_http_post_init(struct exporter *exporter);
 void event_export_transport_http_post(const struct exporter *exporter, const buffer_t *buf);
 void event_export_transport_http_post_deinit(void);
 void event_export_transport_log(const struct exporter *exporter, const buffer_t *buf);
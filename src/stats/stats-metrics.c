@@ -16,6 +16,14 @@
 
 #define LOG_EXPORTER_LONG_FIELD_TRUNCATE_LEN 1000
 
+/* Sub-metric names are sanitized to this many UTF-8 characters */
+#define STATS_METRIC_SUB_NAME_MAX_CHARS 32
+/* Enough space for STATS_METRIC_SUB_NAME_MAX_CHARS and the "..." suffix */
+#define STATS_METRIC_SUB_NAME_BUF_SIZE (STATS_METRIC_SUB_NAME_MAX_CHARS*4 + 4)
+/* Name of the sub-metric for group_by values evicted due to
+   group_by_max_values */
+#define STATS_METRIC_GROUP_BY_OTHER_NAME "other"
+
 struct stats_metrics {
 	pool_t pool;
 	struct event_filter *filter; /* stats & export */
@@ -38,6 +46,13 @@ static void stats_exporters_add_set(struct stats_metrics *metrics,
 	exporter->name = p_strdup(metrics->pool, set->name);
 	exporter->transport_args = p_strdup(metrics->pool, set->transport_args);
 	exporter->transport_timeout = set->transport_timeout;
+	exporter->transport_batch_count = set->transport_batch_count;
+	exporter->transport_batch_size = set->transport_batch_size;
+	exporter->transport_batch_linger_msecs = set->transport_batch_linger;
+	exporter->transport_compression =
+		p_strdup(metrics->pool, set->transport_compression);
+	exporter->transport_max_pending_requests =
+		set->transport_max_pending_requests;
 	exporter->time_format = set->parsed_time_format;
 
 	/* TODO: The following should be plugable.
@@ -67,6 +82,7 @@ static void stats_exporters_add_set(struct stats_metrics *metrics,
 		exporter->transport = event_export_transport_drop;
 	} else if (strcmp(set->transport, "http-post") == 0) {
 		exporter->transport = event_export_transport_http_post;
+		event_export_transport_http_post_init(exporter);
 	} else if (strcmp(set->transport, "log") == 0) {
 		exporter->transport = event_export_transport_log;
 		exporter->format_max_field_len =
@@ -77,6 +93,12 @@ static void stats_exporters_add_set(struct stats_metrics *metrics,
 
 	exporter->transport_args = set->transport_args;
 
+	if (exporter->transport_batch_count > 1 &&
+	    strcmp(set->format, "json") == 0) {
+		/* batched events are separated by LFs */
+		exporter->format_mime_type = "application/x-ndjson";
+	}
+
 	array_push_back(&metrics->exporters, &exporter);
 }
 
@@ -168,6 +190,7 @@ stats_metric_settings_dup(pool_t pool, const struct stats_metric_settings *src)
 	set->fields = p_strdup(pool, src->fields);
 	set->group_by = p_strdup(pool, src->group_by);
 	set->filter = p_strdup(pool, src->filter);
+	set->group_by_max_values = src->group_by_max_values;
 	set->exporter = p_strdup(pool, src->exporter);
 	set->exporter_include = p_strdup(pool, src->exporter_include);
 
@@ -258,6 +281,8 @@ struct stats_metrics *stats_metrics_init(const struct stats_settings *set)
 	metrics = p_new(pool, struct stats_metrics, 1);
 	metrics->pool = pool;
 	metrics->filter = event_filter_create();
+	event_filter_set_sampling(metrics->filter, set->stats_event_sample_rate,
+				  set->stats_event_sample_max_per_sec);
 	stats_metrics_add_from_settings(metrics, set);
 	return metrics;
 }
@@ -268,6 +293,7 @@ static void stats_metric_free(struct metric *metric)
 	stats_dist_deinit(&metric->duration_stats);
 	for (unsigned int i = 0; i < metric->fields_count; i++)
 		stats_dist_deinit(&metric->fields[i].stats);
+	i_free(metric->sub_name_label);
 	if (!array_is_created(&metric->sub_metrics))
 		return;
 	array_foreach_elem(&metric->sub_metrics, sub_metric)
@@ -299,6 +325,7 @@ void stats_metrics_deinit(struct stats_metrics **_metrics)
 static void stats_metric_reset(struct metric *metric)
 {
 	struct metric *sub_metric;
+	metric->group_by_hits = 0;
 	stats_dist_reset(metric->duration_stats);
 	for (unsigned int i = 0; i < metric->fields_count; i++)
 		stats_dist_reset(metric->fields[i].stats);
@@ -330,6 +357,8 @@ stats_metric_find_sub_metric(struct metric *metric,
 
 	/* lookup sub-metric */
 	array_foreach_elem(&metric->sub_metrics, sub_metrics) {
+		if (sub_metrics == metric->group_by_other)
+			continue;
 		switch (sub_metrics->group_value.type) {
 		case METRIC_VALUE_TYPE_STR:
 			if (memcmp(sub_metrics->group_value.hash, value->hash,
@@ -360,11 +389,79 @@ stats_metric_sub_metric_alloc(struct metric *metric, const char *name, pool_t po
 	array_append_zero(&fields);
 	sub_metric = stats_metric_alloc(pool, metric->name, metric->set,
 					array_idx(&fields, 0));
-	sub_metric->sub_name = p_strdup(pool, str_sanitize_utf8(name, 32));
+	name = str_sanitize_utf8(name, STATS_METRIC_SUB_NAME_MAX_CHARS);
+	if (metric->set->group_by_max_values == 0)
+		sub_metric->sub_name = p_strdup(pool, name);
+	else {
+		/* the name may be replaced later on eviction - preallocate
+		   the space for it, so the pool doesn't keep growing */
+		sub_metric->sub_name_buf =
+			p_malloc(pool, STATS_METRIC_SUB_NAME_BUF_SIZE);
+		(void)i_strocpy(sub_metric->sub_name_buf, name,
+				STATS_METRIC_SUB_NAME_BUF_SIZE);
+		sub_metric->sub_name = sub_metric->sub_name_buf;
+	}
 	array_append(&metric->sub_metrics, &sub_metric, 1);
 	return sub_metric;
 }
 
+static void stats_metric_merge(struct metric *dest, const struct metric *src)
+{
+	i_assert(dest->fields_count == src->fields_count);
+
+	stats_dist_merge(dest->duration_stats, src->duration_stats);
+	for (unsigned int i = 0; i < dest->fields_count; i++)
+		stats_dist_merge(dest->fields[i].stats, src->fields[i].stats);
+}
+
+static struct metric *
+stats_metric_sub_metric_evict(struct metric *metric, const char *name,
+			      pool_t pool)
+{
+	struct metric *sub_metric, *victim = NULL;
+	unsigned int hits;
+
+	/* Space-Saving: replace the value with the least hits. Its stats
+	   are moved to the "other" sub-metric, and the new value inherits its
+	   hit count. Frequent values therefore stay, while the rarely seen
+	   ones keep replacing each other. */
+	array_foreach_elem(&metric->sub_metrics, sub_metric) {
+		if (sub_metric == metric->group_by_other)
+			continue;
+		if (victim == NULL ||
+		    sub_metric->group_by_hits < victim->group_by_hits)
+			victim = sub_metric;
+	}
+	i_assert(victim != NULL);
+
+	if (metric->group_by_other == NULL) {
+		metric->group_by_other = stats_metric_sub_metric_alloc(metric,
+			STATS_METRIC_GROUP_BY_OTHER_NAME, pool);
+	}
+	stats_metric_merge(metric->group_by_other, victim);
+	metric->group_by_other->group_by_hits += victim->group_by_hits;
+
+	hits = victim->group_by_hits;
+	stats_metric_reset(victim);
+	victim->group_by_hits = hits;
+	(void)i_strocpy(victim->sub_name_buf,
+			str_sanitize_utf8(name, STATS_METRIC_SUB_NAME_MAX_CHARS),
+			STATS_METRIC_SUB_NAME_BUF_SIZE);
+	i_free(victim->sub_name_label);
+	return victim;
+}
+
+static bool stats_metric_sub_metrics_full(const struct metric *metric)
+{
+	unsigned int count = array_count(&metric->sub_metrics);
+
+	if (metric->set->group_by_max_values == 0)
+		return FALSE;
+	if (metric->group_by_other != NULL)
+		count--;
+	return count >= metric->set->group_by_max_values;
+}
+
 static bool
 stats_metric_group_by_discrete(const struct event_field *field,
 			       struct metric_value *value_r)
@@ -517,8 +614,13 @@ stats_metric_get_sub_metric(struct metric *metric,
 		const char *value_label =
 			stats_metric_group_by_value_label(field,
 				&metric->group_by[0], value);
-		sub_metric = stats_metric_sub_metric_alloc(metric, value_label,
-							   pool);
+		if (stats_metric_sub_metrics_full(metric)) {
+			sub_metric = stats_metric_sub_metric_evict(metric,
+				value_label, pool);
+		} else {
+			sub_metric = stats_metric_sub_metric_alloc(metric,
+				value_label, pool);
+		}
 	} T_END;
 	if (metric->group_by_count > 1) {
 		sub_metric->group_by_count = metric->group_by_count - 1;
@@ -543,6 +645,7 @@ stats_metric_group_by_field(struct metric *metric, struct event *event,
 	if (!array_is_created(&metric->sub_metrics))
 		p_array_init(&metric->sub_metrics, pool, 8);
 	sub_metric = stats_metric_get_sub_metric(metric, field, &value, pool);
+	sub_metric->group_by_hits++;
 
 	/* sub-metrics are recursive, so each sub-metric can have additional
 	   sub-metrics. */
@@ -610,7 +713,7 @@ stats_metric_group_by(struct metric *metric, struct event *event, pool_t pool)
 
 static void
 stats_metric_event_field(struct event *event, const char *fieldname,
-			 struct stats_dist *stats)
+			 struct stats_dist *stats, unsigned int sample_rate)
 {
 	const struct event_field *field =
 		event_find_field_recursive(event, fieldname);
@@ -632,20 +735,23 @@ stats_metric_event_field(struct event *event, const char *fieldname,
 		break;
 	}
 
-	stats_dist_add(stats, num);
+	stats_dist_add_count(stats, num, sample_rate);
 }
 
 static void
 stats_metric_event(struct metric *metric, struct event *event, pool_t pool)
 {
+	/* a sampled event counts as all the events it represents */
+	unsigned int sample_rate = event_get_sample_rate(event);
+
 	/* duration is special - we always add it */
 	stats_metric_event_field(event, STATS_EVENT_FIELD_NAME_DURATION,
-				 metric->duration_stats);
+				 metric->duration_stats, sample_rate);
 
 	for (unsigned int i = 0; i < metric->fields_count; i++)
 		stats_metric_event_field(event,
 					 metric->fields[i].field_key,
-					 metric->fields[i].stats);
+					 metric->fields[i].stats, sample_rate);
 
 	if (metric->group_by != NULL)
 		stats_metric_group_by(metric, event, pool);
@@ -36,6 +36,15 @@ struct exporter {
 	const char *transport_args;
 	unsigned int transport_timeout;
 
+	/* batching and compression for the http-post transport */
+	unsigned int transport_batch_count;
+	size_t transport_batch_size;
+	unsigned int transport_batch_linger_msecs;
+	const char *transport_compression;
+	unsigned int transport_max_pending_requests;
+	/* transport specific state */
+	struct event_exporter_http_post_batch *http_post_batch;
+
 	/* function to send the event */
 	void (*transport)(const struct exporter *, const buffer_t *);
 };
@@ -89,6 +98,10 @@ struct metric {
 	   This is a display name and does not guarantee uniqueness.
 	*/
 	const char *sub_name;
+	/* sub_name rendered as an OpenMetrics label value (quoted and
+	   escaped). Cached on the first export and freed whenever sub_name
+	   changes. */
+	char *sub_name_label;
 
 	/* Timing for how long the event existed */
 	struct stats_dist *duration_stats;
@@ -100,6 +113,14 @@ struct metric {
 	const struct stats_metric_settings_group_by *group_by;
 	struct metric_value group_value;
 	ARRAY(struct metric *) sub_metrics;
+	/* Number of events grouped into this sub-metric. With
+	   group_by_max_values this is the Space-Saving estimate, which
+	   includes the count of the sub-metric it replaced. */
+	unsigned int group_by_hits;
+	/* Buffer for sub_name, if it can be replaced by eviction */
+	char *sub_name_buf;
+	/* The sub-metric that collects the evicted group_by values, or NULL */
+	struct metric *group_by_other;
 
 	struct metric_export_info export_info;
 };
@@ -53,6 +53,8 @@ struct openmetrics_request {
 	struct stats_metrics_iter *stats_iter;
 	const struct metric *metric;
 	enum openmetrics_metric_type metric_type;
+	/* "dovecot_<metric name>" rendered once for the current metric */
+	string_t *name;
 	string_t *labels;
 	size_t labels_pos;
 	ARRAY(struct openmetrics_request_sub_metric) sub_metric_stack;
@@ -119,8 +121,7 @@ openmetrics_export_metric_value(struct openmetrics_request *req, string_t *out,
 				const struct metric *metric)
 {
 	/* Metric name */
-	str_append(out, "dovecot_");
-	str_append(out, req->metric->name);
+	str_append_str(out, req->name);
 	switch (req->metric_type) {
 	case OPENMETRICS_METRIC_TYPE_COUNT:
 		if (req->metric->group_by != NULL && str_len(req->labels) == 0)
@@ -185,8 +186,7 @@ openmetrics_export_histogram_bucket(struct openmetrics_request *req,
 				    intmax_t bucket_limit, int64_t count)
 {
 	/* Metric name */
-	str_append(out, "dovecot_");
-	str_append(out, metric->name);
+	str_append_str(out, req->name);
 	str_append(out, "_bucket");
 	/* Labels */
 	str_append_c(out, '{');
@@ -238,8 +238,7 @@ openmetrics_export_histogram(struct openmetrics_request *req, string_t *out,
 		return;
 
 	/* Sum */
-	str_append(out, "dovecot_");
-	str_append(out, metric->name);
+	str_append_str(out, req->name);
 	str_append(out, "_sum");
 	/* Labels */
 	if (str_len(req->labels) > 0) {
@@ -254,8 +253,7 @@ openmetrics_export_histogram(struct openmetrics_request *req, string_t *out,
 	}
 	str_printfa(out, " %.6f\n", sum);
 	/* Count */
-	str_append(out, "dovecot_");
-	str_append(out, metric->name);
+	str_append_str(out, req->name);
 	str_append(out, "_count");
 	/* Labels */
 	if (str_len(req->labels) > 0) {
@@ -272,8 +270,8 @@ openmetrics_export_metric_header(struct openmetrics_request *req, string_t *out)
 	const struct metric *metric = req->metric;
 
 	/* Description */
-	str_append(out, "# HELP dovecot_");
-	str_append(out, metric->name);
+	str_append(out, "# HELP ");
+	str_append_str(out, req->name);
 	switch (req->metric_type) {
 	case OPENMETRICS_METRIC_TYPE_COUNT:
 		str_append(out, " Total number of all events of this kind");
@@ -291,8 +289,8 @@ openmetrics_export_metric_header(struct openmetrics_request *req, string_t *out)
 	}
 	str_append_c(out, '\n');
 	/* Type */
-	str_append(out, "# TYPE dovecot_");
-	str_append(out, metric->name);
+	str_append(out, "# TYPE ");
+	str_append_str(out, req->name);
 	switch (req->metric_type) {
 	case OPENMETRICS_METRIC_TYPE_COUNT:
 		str_append(out, " counter\n");
@@ -306,17 +304,32 @@ openmetrics_export_metric_header(struct openmetrics_request *req, string_t *out)
 	}
 }
 
+static const char *openmetrics_sub_name_label(const struct metric *metric)
+{
+	struct metric *cached_metric = (struct metric *)metric;
+	string_t *str;
+
+	/* The same label value is written for the count, duration and
+	   histogram of each sub-metric on every scrape. Escape it only once.
+	   The cache is freed by stats-metrics whenever sub_name changes. */
+	if (metric->sub_name_label == NULL) {
+		str = t_str_new(strlen(metric->sub_name) + 3);
+		str_append_c(str, '"');
+		json_append_escaped(str, metric->sub_name);
+		str_append_c(str, '"');
+		cached_metric->sub_name_label = i_strdup(str_c(str));
+	}
+	return metric->sub_name_label;
+}
+
 static void
 openmetrics_export_submetric(struct openmetrics_request *req, string_t *out,
 			     const struct metric *metric)
 {
 	/* This metric may be a submetric and therefore have a label
 	   associated with it. */
-	if (metric->sub_name != NULL) {
-		str_append_c(req->labels, '"');
-		json_append_escaped(req->labels, metric->sub_name);
-		str_append_c(req->labels, '"');
-	}
+	if (metric->sub_name != NULL)
+		str_append(req->labels, openmetrics_sub_name_label(metric));
 
 	if (req->metric_type == OPENMETRICS_METRIC_TYPE_HISTOGRAM) {
 		if (metric->group_by == NULL ||
@@ -576,10 +589,15 @@ openmetrics_export_continue(struct openmetrics_request *req, string_t *out)
 			break;
 		}
 
-		if (req->labels == NULL)
+		if (req->labels == NULL) {
+			req->name = str_new(default_pool, 64);
 			req->labels = str_new(default_pool, 32);
-		else
+		} else {
+			str_truncate(req->name, 0);
 			str_truncate(req->labels, 0);
+		}
+		str_append(req->name, "dovecot_");
+		str_append(req->name, req->metric->name);
 		req->labels_pos = 0;
 
 		/* Start with count output for this metric if the type
@@ -634,6 +652,7 @@ static void openmetrics_handle_write_error(struct openmetrics_request *req)
 static void openmetrics_request_deinit(struct openmetrics_request *req)
 {
 	stats_metrics_iterate_deinit(&req->stats_iter);
+	str_free(&req->name);
 	str_free(&req->labels);
 	array_free(&req->sub_metric_stack);
 }
@@ -661,17 +680,20 @@ static int openmetrics_export(struct openmetrics_request *req)
 	}
 
 	/* Export metrics into a string buffer and write that buffer to the
-	   output stream after each (sub-)metric, so that the string buffer
-	   stays small. The output stream buffer can grow bigger, but writing is
-	   stopped for later resumption when the output stream buffer has grown
-	   beyond an optimal size. */
-	out = t_str_new(1024);
+	   output stream once it has grown to IO_BLOCK_SIZE, so that the string
+	   buffer stays small while the output stream isn't called separately
+	   for each (sub-)metric. The output stream buffer can grow bigger, but
+	   writing is stopped for later resumption when the output stream
+	   buffer has grown beyond an optimal size. */
+	out = t_str_new(IO_BLOCK_SIZE + 1024);
 	for (;;) {
-		str_truncate(out, 0);
-
 		openmetrics_export_continue(req, out);
+		if (str_len(out) < IO_BLOCK_SIZE &&
+		    req->state != OPENMETRICS_REQUEST_STATE_FINISHED)
+			continue;
 
 		ret = openmetrics_send_buffer(req, out);
+		str_truncate(out, 0);
 		if (ret < 0) {
 			openmetrics_handle_write_error(req);
 			return -1;
@@ -715,6 +737,22 @@ static void openmetrics_request_destroy(struct openmetrics_request *req)
 	openmetrics_request_deinit(req);
 }
 
+int stats_service_openmetrics_write(struct ostream *output)
+{
+	struct openmetrics_request req;
+	int ret;
+
+	i_zero(&req);
+	req.output = output;
+	o_stream_ref(output);
+	do {
+		ret = openmetrics_export(&req);
+	} while (ret == 0);
+	o_stream_unref(&req.output);
+	openmetrics_request_deinit(&req);
+	return ret < 0 ? -1 : 0;
+}
+
 static void
 stats_service_openmetrics_request(void *context ATTR_UNUSED,
 				  struct http_server_request *hsreq,
@@ -3,6 +3,13 @@
 
 #include "stats-service.h"
 
+struct ostream;
+
 void stats_service_openmetrics_init(void);
+/* Write all the metrics to the output stream in OpenMetrics format. The
+   output stream must be able to flush everything immediately, such as a
+   buffer or a blocking file. Returns 0 on success, -1 if the write
+   failed (the error is logged). */
+int stats_service_openmetrics_write(struct ostream *output);
 
 #endif
@@ -88,6 +88,11 @@ static const struct setting_define stats_exporter_setting_defines[] = {
 	DEF(STR, transport),
 	DEF(STR, transport_args),
 	DEF(TIME_MSECS, transport_timeout),
+	DEF(UINT, transport_batch_count),
+	DEF(SIZE, transport_batch_size),
+	DEF(TIME_MSECS, transport_batch_linger),
+	DEF(STR, transport_compression),
+	DEF(UINT, transport_max_pending_requests),
 	DEF(STR, format),
 	DEF(STR, format_args),
 	SETTING_DEFINE_LIST_END
@@ -98,6 +103,11 @@ static const struct stats_exporter_settings stats_exporter_default_settings = {
 	.transport = "",
 	.transport_args = "",
 	.transport_timeout = 250, /* ms */
+	.transport_batch_count = 1,
+	.transport_batch_size = 64*1024,
+	.transport_batch_linger = 1000, /* ms */
+	.transport_compression = "",
+	.transport_max_pending_requests = 0,
 	.format = "",
 	.format_args = "",
 };
@@ -126,6 +136,7 @@ static const struct setting_define stats_metric_setting_defines[] = {
 	DEF(STR, fields),
 	DEF(STR, group_by),
 	DEF(STR, filter),
+	DEF(UINT, group_by_max_values),
 	DEF(STR, exporter),
 	DEF(STR, exporter_include),
 	DEF(STR, description),
@@ -138,6 +149,7 @@ static const struct stats_metric_settings stats_metric_default_settings = {
 	.filter = "",
 	.exporter = "",
 	.group_by = "",
+	.group_by_max_values = 0,
 	.exporter_include = STATS_METRIC_SETTINGS_DEFAULT_EXPORTER_INCLUDE,
 	.description = "",
 };
@@ -168,6 +180,8 @@ const struct setting_parser_info stats_metric_setting_parser_info = {
 
 static const struct setting_define stats_setting_defines[] = {
 	DEF(STR, stats_http_rawlog_dir),
+	DEF(UINT, stats_event_sample_rate),
+	DEF(UINT, stats_event_sample_max_per_sec),
 
 	DEFLIST_UNIQUE(metrics, "metric", &stats_metric_setting_parser_info),
 	DEFLIST_UNIQUE(exporters, "event_exporter", &stats_exporter_setting_parser_info),
@@ -176,6 +190,8 @@ static const struct setting_define stats_setting_defines[] = {
 
 const struct stats_settings stats_default_settings = {
 	.stats_http_rawlog_dir = "",
+	.stats_event_sample_rate = 1,
+	.stats_event_sample_max_per_sec = 0,
 
 	.metrics = ARRAY_INIT,
 	.exporters = ARRAY_INIT,
@@ -296,6 +312,18 @@ static bool stats_exporter_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 		return FALSE;
 	}
 
+	if (set->transport_batch_count == 0) {
+		*error_r = "transport_batch_count must not be 0";
+		return FALSE;
+	}
+	if (set->transport_compression[0] != '\0' &&
+	    strcmp(set->transport_compression, "gzip") != 0 &&
+	    strcmp(set->transport_compression, "zstd") != 0) {
+		*error_r = t_strdup_printf("Unknown transport_compression '%s'",
+					   set->transport_compression);
+		return FALSE;
+	}
+
 	if (!parse_format_args(set, error_r))
 		return FALSE;
 
@@ -525,6 +553,11 @@ static bool stats_settings_check(void *_set, pool_t pool ATTR_UNUSED,
 	struct stats_exporter_settings *exporter;
 	struct stats_metric_settings *metric;
 
+	if (set->stats_event_sample_rate == 0) {
+		*error_r = "stats_event_sample_rate must not be 0";
+		return FALSE;
+	}
+
 	if (!array_is_created(&set->metrics) || !array_is_created(&set->exporters))
 		return TRUE;
 
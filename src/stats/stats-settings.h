@@ -65,6 +65,11 @@ struct stats_exporter_settings {
 	const char *transport;
 	const char *transport_args;
 	unsigned int transport_timeout;
+	unsigned int transport_batch_count;
+	uoff_t transport_batch_size;
+	unsigned int transport_batch_linger;
+	const char *transport_compression;
+	unsigned int transport_max_pending_requests;
 	const char *format;
 	const char *format_args;
 
@@ -103,6 +108,7 @@ struct stats_metric_settings {
 	const char *fields;
 	const char *group_by;
 	const char *filter;
+	unsigned int group_by_max_values;
 
 	ARRAY(struct stats_metric_settings_group_by) parsed_group_by;
 	struct event_filter *parsed_filter;
@@ -114,6 +120,8 @@ struct stats_metric_settings {
 
 struct stats_settings {
 	const char *stats_http_rawlog_dir;
+	unsigned int stats_event_sample_rate;
+	unsigned int stats_event_sample_max_per_sec;
 
 	ARRAY(struct stats_exporter_settings *) exporters;
 	ARRAY(struct stats_metric_settings *) metrics;
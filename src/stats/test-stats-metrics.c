@@ -90,6 +90,50 @@ static void test_stats_metrics_filter(void)
 	test_end();
 }
 
+static const char *settings_blob_sampling =
+"stats_event_sample_rate=3\n"
+"stats_event_sample_max_per_sec=100\n"
+"metric=test\n"
+"metric/test/metric_name=test\n"
+"metric/test/filter=event=test\n"
+"\n";
+
+static void test_stats_metrics_sampling(void)
+{
+	unsigned int sample_rate, max_events_per_sec;
+	const char *error;
+
+	test_begin("stats metrics (sampling)");
+	test_init(settings_blob_sampling);
+
+	event_filter_get_sampling(stats_metrics_get_event_filter(stats_metrics),
+				  &sample_rate, &max_events_per_sec);
+	test_assert(sample_rate == 3);
+	test_assert(max_events_per_sec == 100);
+
+	/* a sampled event is counted as all the events it represents */
+	struct event *event = event_create(NULL);
+	event_add_category(event, &test_category);
+	event_set_name(event, "test");
+	string_t *str = t_str_new(64);
+	event_export(event, str);
+	str_append(str, "\tr3");
+	test_assert(event_import(event, str_c(str), &error));
+	test_assert(event_get_sample_rate(event) == 3);
+	test_event_send(event);
+	/* the rate is reset after sending */
+	test_assert(event_get_sample_rate(event) == 1);
+	test_assert(get_stats_dist_field("test", STATS_DIST_COUNT) == 3);
+
+	event_set_name(event, "test");
+	test_event_send(event);
+	event_unref(&event);
+	test_assert(get_stats_dist_field("test", STATS_DIST_COUNT) == 4);
+
+	test_deinit();
+	test_end();
+}
+
 static void test_stats_metrics_group_by_check_one(const struct metric *metric,
 						  const char *sub_name,
 						  unsigned int total_count,
@@ -434,12 +478,68 @@ static void test_stats_metrics_group_by_quantized(void)
 		test_stats_metrics_group_by_quantized_real(&quantized_tests[i]);
 }
 
+static void test_stats_metrics_group_by_max_values_send(const char *user)
+{
+	struct event *event;
+
+	event = event_create(NULL);
+	event_add_category(event, &test_category);
+	event_set_name(event, "test");
+	event_add_str(event, "user", user);
+	test_event_send(event);
+	event_unref(&event);
+}
+
+static void test_stats_metrics_group_by_max_values(void)
+{
+	unsigned int i;
+
+	test_begin("stats metrics (group by max values)");
+	test_init("metric=test\n"
+		  "metric/test/metric_name=test\n"
+		  "metric/test/filter=event=test\n"
+		  "metric/test/group_by=user\n"
+		  "metric/test/group_by_max_values=2\n"
+		  "\n");
+
+	for (i = 0; i < 10; i++)
+		test_stats_metrics_group_by_max_values_send("heavy");
+	for (i = 0; i < 5; i++)
+		test_stats_metrics_group_by_max_values_send("medium");
+	/* each of these replaces the previous one */
+	for (i = 0; i < 4; i++) {
+		test_stats_metrics_group_by_max_values_send(
+			t_strdup_printf("light%u", i));
+	}
+	test_stats_metrics_group_by_max_values_send("heavy");
+
+	struct stats_metrics_iter *iter = stats_metrics_iterate_init(stats_metrics);
+	const struct metric *root_metric = stats_metrics_iterate(iter);
+	stats_metrics_iterate_deinit(&iter);
+
+	test_assert(stats_dist_get_count(root_metric->duration_stats) == 20);
+	test_assert(array_count(&root_metric->sub_metrics) == 3);
+	struct metric *const *subs = array_idx(&root_metric->sub_metrics, 0);
+	test_assert_strcmp(subs[0]->sub_name, "heavy");
+	test_assert(stats_dist_get_count(subs[0]->duration_stats) == 11);
+	test_assert_strcmp(subs[1]->sub_name, "light3");
+	test_assert(stats_dist_get_count(subs[1]->duration_stats) == 1);
+	test_assert(subs[2] == root_metric->group_by_other);
+	test_assert_strcmp(subs[2]->sub_name, "other");
+	test_assert(stats_dist_get_count(subs[2]->duration_stats) == 8);
+
+	test_deinit();
+	test_end();
+}
+
 int main(void) {
 	void (*const test_functions[])(void) = {
 		test_stats_metrics,
 		test_stats_metrics_filter,
+		test_stats_metrics_sampling,
 		test_stats_metrics_group_by_discrete,
 		test_stats_metrics_group_by_quantized,
+		test_stats_metrics_group_by_max_values,
 		NULL
 	};
 
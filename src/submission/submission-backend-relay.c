@@ -13,12 +13,20 @@
 #include "submission-recipient.h"
 #include "submission-backend-relay.h"
 
+/* While there's no mail transaction, send NOOP to the relay server this
+   often to keep the connection from timing out. */
+#define SUBMISSION_RELAY_KEEPALIVE_INTERVAL_MSECS (2*60*1000)
+
 struct submission_backend_relay {
 	struct submission_backend backend;
 
 	struct smtp_client_connection *conn;
 	struct smtp_client_transaction *trans;
 
+	unsigned int max_idle_time;
+	time_t idle_start;
+	struct timeout *to_keepalive;
+
 	bool trans_started:1;
 	bool trusted:1;
 	bool quit_confirmed:1;
@@ -154,6 +162,53 @@ backend_relay_handle_relay_reply(struct submission_backend_relay *rbackend,
 	return TRUE;
 }
 
+/*
+ * Keepalive
+ */
+
+static void
+backend_relay_keepalive_callback(const struct smtp_reply *relay_reply,
+				 struct submission_backend_relay *rbackend)
+{
+	if (!smtp_reply_is_success(relay_reply)) {
+		/* The relay connection is re-established for the next
+		   transaction if needed. */
+		e_debug(rbackend->backend.event, "Keepalive NOOP failed: %s",
+			smtp_reply_log(relay_reply));
+	}
+}
+
+static void backend_relay_keepalive(struct submission_backend_relay *rbackend)
+{
+	if (ioloop_time - rbackend->idle_start >=
+	    (time_t)rbackend->max_idle_time ||
+	    smtp_client_connection_get_state(rbackend->conn) !=
+	    SMTP_CLIENT_CONNECTION_STATE_READY) {
+		/* Let the relay server disconnect us when it wants to. */
+		timeout_remove(&rbackend->to_keepalive);
+		return;
+	}
+
+	(void)smtp_client_command_noop_submit(
+		rbackend->conn, 0, backend_relay_keepalive_callback, rbackend);
+}
+
+static void
+backend_relay_keepalive_start(struct submission_backend_relay *rbackend)
+{
+	rbackend->idle_start = ioloop_time;
+	timeout_remove(&rbackend->to_keepalive);
+	rbackend->to_keepalive = timeout_add(
+		SUBMISSION_RELAY_KEEPALIVE_INTERVAL_MSECS,
+		backend_relay_keepalive, rbackend);
+}
+
+static void
+backend_relay_keepalive_stop(struct submission_backend_relay *rbackend)
+{
+	timeout_remove(&rbackend->to_keepalive);
+}
+
 /*
  * Mail transaction
  */
@@ -181,6 +236,7 @@ backend_relay_trans_start(struct submission_backend *backend,
 	struct submission_backend_relay *rbackend =
 		container_of(backend, struct submission_backend_relay, backend);
 
+	backend_relay_keepalive_stop(rbackend);
 	if (rbackend->trans == NULL) {
 		rbackend->trans_started = TRUE;
 		rbackend->trans = smtp_client_transaction_create(
@@ -206,6 +262,8 @@ backend_relay_trans_free(struct submission_backend *backend,
 		container_of(backend, struct submission_backend_relay, backend);
 
 	rbackend->trans_started = FALSE;
+	if (backend->ready)
+		backend_relay_keepalive_start(rbackend);
 
 	if (rbackend->trans == NULL)
 		return;
@@ -220,6 +278,7 @@ submission_backend_relay_init_transaction(
 {
 	i_assert(rbackend->trans == NULL);
 
+	backend_relay_keepalive_stop(rbackend);
 	rbackend->trans = smtp_client_transaction_create_empty(
 		rbackend->conn, flags,
 		backend_relay_trans_finished, rbackend);
@@ -1089,6 +1148,7 @@ submission_backend_relay_create(
 				&backend_relay_vfuncs);
 
 	event_set_append_log_prefix(rbackend->backend.event, "relay: ");
+	rbackend->max_idle_time = set->max_idle_time;
 
 	mail_user_init_ssl_client_settings(user, &ssl_set);
 	if (set->ssl_verify)
@@ -1174,6 +1234,7 @@ static void backend_relay_destroy(struct submission_backend *backend)
 	struct submission_backend_relay *rbackend =
 		container_of(backend, struct submission_backend_relay, backend);
 
+	timeout_remove(&rbackend->to_keepalive);
 	if (rbackend->trans != NULL)
 		smtp_client_transaction_destroy(&rbackend->trans);
 	if (rbackend->conn != NULL)
@@ -1202,6 +1263,8 @@ static void backend_relay_ready_cb(const struct smtp_reply *reply,
 	   our capabilities */
 	submission_backend_started(backend,
 		smtp_client_connection_get_capabilities(rbackend->conn));
+	if (rbackend->trans == NULL)
+		backend_relay_keepalive_start(rbackend);
 }
 
 static void backend_relay_start(struct submission_backend *backend)